@@ -20,6 +20,7 @@
 #
 # monitor_check_vdostats_logicalSpace.pl [--warning <warn_pct>|-w <warn_pct>]
 #                                        [--critical <crit_pct>|-c <crit_pct>]
+#                                        [--cache <file> [--max-age <seconds>]]
 #                                        <deviceName>
 #
 # This script parses the output of "vdostats --verbose" for a given VDO
@@ -34,6 +35,12 @@
 # -w <warn_pct>: warning threshold equal to or less than
 #                <crit_pct> percent.
 #
+# --cache <file>: read the statistics from <file>, as written by
+#                 "vdostats --cache <file> --watch <seconds>", rather than
+#                 running vdostats. If <file> is missing, does not list the
+#                 device, or is older than --max-age seconds (default 300),
+#                 vdostats is run instead.
+#
 # The "vdostats" program must be in the path used by "sudo".
 #
 # $Id: //eng/vdo-releases/sulfur/src/tools/monitor/monitor_check_vdostats_logicalSpace.pl#1 $
@@ -42,6 +49,7 @@
 
 use strict;
 use warnings FATAL => qw(all);
+use File::Basename;
 use Getopt::Long;
 
 # Constants for the service status return values.
@@ -55,8 +63,13 @@ use constant {
 my $inputWarnThreshold = -1;
 my $inputCritThreshold = -1;
 
+my $cachePath   = "";
+my $cacheMaxAge = 300;
+
 GetOptions("critical=i" => \$inputCritThreshold,
-           "warning=i"  => \$inputWarnThreshold);
+           "warning=i"  => \$inputWarnThreshold,
+           "cache=s"    => \$cachePath,
+           "max-age=i"  => \$cacheMaxAge);
 
 # Default warning and critical thresholds for "logical used percent".
 my $warnThreshold = 80;
@@ -87,6 +100,35 @@ my @statNames = (
   '1k-blocks available',
 );
 
+#############################################################################
+# Get the statistics output for the given VDO device name from the cache
+# file, if there is a fresh one which lists the device.
+##
+sub getCachedStats {
+  my ($deviceName) = @_;
+  if (!$cachePath) {
+    return ();
+  }
+  my @cacheStat = stat($cachePath);
+  if (!@cacheStat || (time() - $cacheStat[9]) > $cacheMaxAge) {
+    return ();
+  }
+  open(my $cacheFile, "<", $cachePath) or return ();
+  my $name = basename($deviceName);
+  my $inDevice = 0;
+  my @output = ();
+  foreach my $inpline (<$cacheFile>) {
+    # Each device's statistics follow a "<name> : " line.
+    if ($inpline =~ /^(\S.*) : $/) {
+      $inDevice = ($1 eq $name);
+    } elsif ($inDevice) {
+      push(@output, $inpline);
+    }
+  }
+  close($cacheFile);
+  return @output;
+}
+
 #############################################################################
 # Get the statistics output for the given VDO device name, and filter the
 # desired stats values.
@@ -96,7 +138,10 @@ sub getStats {
     return;
   }
   my $deviceName = $ARGV[0];
-  my @verboseStatsOutput = `sudo vdostats $deviceName --verbose`;
+  my @verboseStatsOutput = getCachedStats($deviceName);
+  if (!@verboseStatsOutput) {
+    @verboseStatsOutput = `sudo vdostats $deviceName --verbose`;
+  }
   foreach my $statLabel (@statNames) {
     foreach my $inpline (@verboseStatsOutput) {
       if ($inpline =~ $statLabel) {
@@ -115,6 +160,7 @@ if (scalar(@ARGV) != 1) {
   print("Usage: monitor_check_vdostats_logicalSpace.pl\n");
   print("                [--warning |-w VALUE]\n");
   print("                [--critical|-c VALUE]\n");
+  print("                [--cache FILE [--max-age SECONDS]]\n");
   print("                <deviceName>\n");
   exit(MONITOR_SERVICE_UNKNOWN);
 }
@@ -0,0 +1,9 @@
+#include "checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+int main(void){ static byte b[1<<20]; srand(1); for(size_t i=0;i<sizeof b;i++) b[i]=rand();
+ int bad=0; for(int k=0;k<200000;k++){ size_t off=rand()%4096, len=rand()%(k<1000? (1<<19):5000); uint32_t s=rand();
+  if (vdo_update_crc32(s,b+off,len)!=crc32(s,b+off,len)) bad++; }
+ const byte *bufs[5]={b,b+5000,b+10001,b+20000,b+30003}; crc32_checksum_t c[5]={1,2,3,4,5},d[5]={1,2,3,4,5};
+ vdo_update_crc32_buffers(c,bufs,4097,5); for(int i=0;i<5;i++) if(c[i]!=crc32(d[i],bufs[i],4097)) bad++;
+ printf("bad=%d\n",bad); return 0;}
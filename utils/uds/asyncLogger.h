@@ -0,0 +1,114 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/userLinux/uds/asyncLogger.h#1 $
+ */
+
+#ifndef ASYNC_LOGGER_H
+#define ASYNC_LOGGER_H
+
+#include "compiler.h"
+#include "typeDefs.h"
+
+/**
+ * @file
+ *
+ * Asynchronous delivery of log messages. Each thread which logs formats
+ * its messages into records in a ring of its own, which it never waits
+ * for, and a single logger thread takes the records from all the rings and
+ * writes them out. When a thread's ring is full, its message is dropped
+ * and counted rather than delaying the thread.
+ *
+ * Messages from one thread are written in the order they were logged, but
+ * there is no ordering between the messages of different threads.
+ **/
+
+enum {
+	ASYNC_LOG_MESSAGE_SIZE = 1020,
+};
+
+struct async_log_record {
+	// The length of the message, excluding the terminating NUL.
+	uint16_t length;
+	// The offset of the part of the message copied to stderr, if any.
+	uint16_t stderr_offset;
+	char message[ASYNC_LOG_MESSAGE_SIZE];
+};
+
+/**
+ * A function which writes out a log record. It is only called from the
+ * logger thread, and must not log.
+ *
+ * @param record  the record to write
+ **/
+typedef void async_log_writer_t(const struct async_log_record *record);
+
+/**
+ * Start the logger thread. Messages which threads have queued will be
+ * written out when the process exits or stop_async_logger() is called.
+ * This function does not log.
+ *
+ * @param writer  the function to write each record
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check start_async_logger(async_log_writer_t *writer);
+
+/**
+ * Write out all the queued messages and stop the logger thread.
+ **/
+void stop_async_logger(void);
+
+/**
+ * Check whether messages are being queued for the logger thread.
+ *
+ * @return true if the logger thread is running
+ **/
+bool __must_check is_async_logger_running(void);
+
+/**
+ * Get the next free record in the calling thread's ring.
+ *
+ * @return the record to fill in and pass to commit_async_log_record(), or
+ *         NULL if the ring is full, in which case the message is counted
+ *         as dropped
+ **/
+struct async_log_record *__must_check reserve_async_log_record(void);
+
+/**
+ * Queue the record returned by the last call to reserve_async_log_record()
+ * from the calling thread.
+ *
+ * @param record  the record to queue
+ **/
+void commit_async_log_record(struct async_log_record *record);
+
+/**
+ * Wait, for a short time at most, until the messages queued by all threads
+ * so far have been written out.
+ **/
+void flush_async_logger(void);
+
+/**
+ * Get the number of messages dropped because a thread's ring was full.
+ *
+ * @return the number of dropped messages
+ **/
+uint64_t get_async_log_drops(void);
+
+#endif /* ASYNC_LOGGER_H */
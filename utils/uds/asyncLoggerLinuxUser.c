@@ -0,0 +1,340 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/userLinux/uds/asyncLoggerLinuxUser.c#1 $
+ */
+
+#include "asyncLogger.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atomicDefs.h"
+#include "cpu.h"
+#include "errors.h"
+#include "timeUtils.h"
+
+/*
+ * Nothing in this file may log, since logging could recurse into it, so
+ * it uses the pthread and libc primitives directly rather than the UDS
+ * wrappers, which log their failures.
+ */
+
+enum {
+	// The number of records in each thread's ring; a power of two.
+	LOG_RING_RECORDS = 64,
+	// How long flush_async_logger() waits for the logger thread.
+	FLUSH_TIMEOUT_MS = 1000,
+	// How long the logger thread sleeps if it is never woken.
+	IDLE_TIMEOUT_MS = 1000,
+};
+
+struct log_ring {
+	// The producer's end of the ring, the number of records committed.
+	atomic64_t tail;
+	// The consumer's end of the ring, the number of records written.
+	atomic64_t head __attribute__((aligned(CACHE_LINE_BYTES)));
+	// Set when the thread which owned the ring has exited, so that the
+	// ring can be given to a new thread once it has been drained.
+	atomic_t detached;
+	// The next ring in the list of all rings. Rings are only added to
+	// the front of the list, so this never changes once the ring is
+	// on the list.
+	struct log_ring *next;
+	struct async_log_record records[LOG_RING_RECORDS]
+		__attribute__((aligned(CACHE_LINE_BYTES)));
+};
+
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct log_ring *rings;
+static pthread_key_t ring_key;
+static __thread struct log_ring *thread_ring;
+
+static async_log_writer_t *log_writer;
+static pthread_t logger_thread;
+static sem_t logger_wakeup;
+static atomic_t logger_asleep;
+static atomic_t logger_running;
+static atomic_t logger_stopping;
+static atomic64_t drops;
+
+/**
+ * Get the list of rings. Rings are never removed from the list, so it can
+ * be walked once the lock has been released.
+ *
+ * @return the most recently added ring
+ **/
+static struct log_ring *get_rings(void)
+{
+	struct log_ring *ring;
+	pthread_mutex_lock(&rings_mutex);
+	ring = rings;
+	pthread_mutex_unlock(&rings_mutex);
+	return ring;
+}
+
+/**********************************************************************/
+static bool is_ring_empty(struct log_ring *ring)
+{
+	return (atomic64_read_acquire(&ring->head) ==
+		atomic64_read_acquire(&ring->tail));
+}
+
+/**
+ * Mark the ring of an exiting thread as available for reuse. This is the
+ * destructor of the thread-specific ring key.
+ *
+ * @param arg  the thread's ring
+ **/
+static void detach_ring(void *arg)
+{
+	struct log_ring *ring = arg;
+	atomic_set_release(&ring->detached, true);
+}
+
+/**
+ * Give the calling thread a ring, reusing the drained ring of an exited
+ * thread if there is one.
+ *
+ * @return the thread's ring, or NULL if one could not be allocated
+ **/
+static struct log_ring *attach_ring(void)
+{
+	struct log_ring *ring;
+	pthread_mutex_lock(&rings_mutex);
+	for (ring = rings; ring != NULL; ring = ring->next) {
+		if ((atomic_read_acquire(&ring->detached) != 0) &&
+		    is_ring_empty(ring)) {
+			atomic_set(&ring->detached, false);
+			break;
+		}
+	}
+
+	if (ring == NULL) {
+		if (posix_memalign((void **) &ring, CACHE_LINE_BYTES,
+				   sizeof(*ring)) != 0) {
+			pthread_mutex_unlock(&rings_mutex);
+			return NULL;
+		}
+		memset(ring, 0, sizeof(*ring));
+		ring->next = rings;
+		rings = ring;
+	}
+	pthread_mutex_unlock(&rings_mutex);
+
+	pthread_setspecific(ring_key, ring);
+	thread_ring = ring;
+	return ring;
+}
+
+/**
+ * Write out all the records in a ring.
+ *
+ * @param ring  the ring to drain
+ *
+ * @return true if any records were written
+ **/
+static bool drain_ring(struct log_ring *ring)
+{
+	long head = atomic64_read(&ring->head);
+	long tail = atomic64_read_acquire(&ring->tail);
+	if (head == tail) {
+		return false;
+	}
+
+	for (; head < tail; head++) {
+		log_writer(&ring->records[head % LOG_RING_RECORDS]);
+		// The release pairs with the acquire in
+		// reserve_async_log_record, so that the producer doesn't reuse
+		// the record until it has been written.
+		atomic64_set_release(&ring->head, head + 1);
+	}
+	return true;
+}
+
+/**
+ * Wait until a producer commits a record or the logger is stopped.
+ **/
+static void wait_for_records(void)
+{
+	atomic_set(&logger_asleep, true);
+	// Pairs with the barrier in commit_async_log_record, so that either
+	// we see the new record or the producer sees that we're asleep.
+	smp_mb();
+	struct log_ring *ring;
+	for (ring = get_rings(); ring != NULL; ring = ring->next) {
+		if (!is_ring_empty(ring)) {
+			atomic_set(&logger_asleep, false);
+			return;
+		}
+	}
+	if (atomic_read(&logger_stopping) != 0) {
+		atomic_set(&logger_asleep, false);
+		return;
+	}
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += IDLE_TIMEOUT_MS / 1000;
+	while ((sem_timedwait(&logger_wakeup, &deadline) != 0) &&
+	       (errno == EINTR)) {
+	}
+	atomic_set(&logger_asleep, false);
+}
+
+/**********************************************************************/
+static void *run_logger(void *arg __always_unused)
+{
+	pthread_setname_np(pthread_self(), "udslogger");
+	for (;;) {
+		// Check for a stop before draining so that everything queued
+		// before the stop is written.
+		bool stopping = (atomic_read_acquire(&logger_stopping) != 0);
+		bool drained = false;
+		struct log_ring *ring;
+		for (ring = get_rings(); ring != NULL; ring = ring->next) {
+			drained |= drain_ring(ring);
+		}
+
+		if (!drained) {
+			if (stopping) {
+				return NULL;
+			}
+			wait_for_records();
+		}
+	}
+}
+
+/**********************************************************************/
+static void wake_logger(void)
+{
+	if ((atomic_read(&logger_asleep) != 0) &&
+	    (atomic_cmpxchg(&logger_asleep, true, false) == true)) {
+		sem_post(&logger_wakeup);
+	}
+}
+
+/**********************************************************************/
+int start_async_logger(async_log_writer_t *writer)
+{
+	int result;
+	if (sem_init(&logger_wakeup, 0, 0) != 0) {
+		return errno;
+	}
+
+	result = pthread_key_create(&ring_key, detach_ring);
+	if (result != 0) {
+		sem_destroy(&logger_wakeup);
+		return result;
+	}
+
+	log_writer = writer;
+	result = pthread_create(&logger_thread, NULL, run_logger, NULL);
+	if (result != 0) {
+		pthread_key_delete(ring_key);
+		sem_destroy(&logger_wakeup);
+		return result;
+	}
+
+	atomic_set_release(&logger_running, true);
+	atexit(stop_async_logger);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void stop_async_logger(void)
+{
+	if (atomic_cmpxchg(&logger_running, true, false) != true) {
+		return;
+	}
+
+	atomic_set_release(&logger_stopping, true);
+	smp_mb();
+	wake_logger();
+	pthread_join(logger_thread, NULL);
+}
+
+/**********************************************************************/
+bool is_async_logger_running(void)
+{
+	return (atomic_read_acquire(&logger_running) != 0);
+}
+
+/**********************************************************************/
+struct async_log_record *reserve_async_log_record(void)
+{
+	struct log_ring *ring = thread_ring;
+	if ((ring == NULL) && ((ring = attach_ring()) == NULL)) {
+		atomic64_inc(&drops);
+		return NULL;
+	}
+
+	long tail = atomic64_read(&ring->tail);
+	if ((tail - atomic64_read_acquire(&ring->head)) >= LOG_RING_RECORDS) {
+		atomic64_inc(&drops);
+		return NULL;
+	}
+
+	return &ring->records[tail % LOG_RING_RECORDS];
+}
+
+/**********************************************************************/
+void commit_async_log_record(struct async_log_record *record
+			     __always_unused)
+{
+	struct log_ring *ring = thread_ring;
+	// The release pairs with the acquire in drain_ring.
+	atomic64_set_release(&ring->tail, atomic64_read(&ring->tail) + 1);
+	// Pairs with the barrier in wait_for_records.
+	smp_mb();
+	wake_logger();
+}
+
+/**********************************************************************/
+void flush_async_logger(void)
+{
+	if (!is_async_logger_running()) {
+		return;
+	}
+
+	ktime_t deadline = (current_time_ns(CLOCK_MONOTONIC) +
+			    ms_to_ktime(FLUSH_TIMEOUT_MS));
+	struct log_ring *ring;
+	for (ring = get_rings(); ring != NULL; ring = ring->next) {
+		long tail = atomic64_read_acquire(&ring->tail);
+		while (atomic64_read_acquire(&ring->head) < tail) {
+			if (current_time_ns(CLOCK_MONOTONIC) >= deadline) {
+				return;
+			}
+			smp_mb();
+			wake_logger();
+			usleep(100);
+		}
+	}
+}
+
+/**********************************************************************/
+uint64_t get_async_log_drops(void)
+{
+	return atomic64_read(&drops);
+}
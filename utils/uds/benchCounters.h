@@ -0,0 +1,257 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/benchCounters.h#1 $
+ */
+
+#ifndef BENCH_COUNTERS_H
+#define BENCH_COUNTERS_H
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "typeDefs.h"
+
+/**
+ * Hardware performance counters for the benchmark tools, read with
+ * perf_event_open() around each measured phase. The counters are opened
+ * before a tool starts any threads and are inherited by every thread it
+ * starts, so that they count the work of the whole process. Only user space
+ * is counted, which any process may do of itself at the default
+ * perf_event_paranoid setting. A counter which the processor or the
+ * virtual machine does not provide is left out of the report.
+ **/
+
+enum bench_counter {
+	BENCH_CYCLES = 0,
+	BENCH_INSTRUCTIONS,
+	BENCH_LLC_MISSES,
+	BENCH_DTLB_MISSES,
+	BENCH_BRANCH_MISSES,
+	BENCH_PAGE_FAULTS,
+	BENCH_COUNTER_COUNT,
+};
+
+struct bench_counters {
+	/** The counter file descriptors, or -1 for counters not available */
+	int fds[BENCH_COUNTER_COUNT];
+	/** The counts of the last phase, scaled up for multiplexing */
+	uint64_t values[BENCH_COUNTER_COUNT];
+};
+
+/**
+ * Make the config of a cache miss counter.
+ *
+ * @param cache  the cache, as PERF_COUNT_HW_CACHE_LL or similar
+ *
+ * @return the counter config
+ **/
+static INLINE uint64_t get_bench_cache_miss_config(uint64_t cache)
+{
+	return (cache |
+		((uint64_t) PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		((uint64_t) PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+/**
+ * Get the name of a counter as it is reported.
+ *
+ * @param counter  the counter
+ *
+ * @return the name
+ **/
+static INLINE const char *get_bench_counter_name(enum bench_counter counter)
+{
+	static const char *const names[BENCH_COUNTER_COUNT] = {
+		"cycles", "instructions", "LLC misses", "dTLB misses",
+		"branch misses", "page faults",
+	};
+	return names[counter];
+}
+
+/**
+ * Open the counters, disabled. A counter which cannot be opened is left
+ * out, and if none can be, the reason is reported once.
+ *
+ * @param counters  the counters to open
+ *
+ * @return true if any counter could be opened
+ **/
+static INLINE bool open_bench_counters(struct bench_counters *counters)
+{
+	static const struct {
+		uint32_t type;
+		uint64_t config;
+	} events[BENCH_COUNTER_COUNT] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+	};
+	bool hardware = false;
+	int error = 0;
+	unsigned int i;
+
+	memset(counters, 0, sizeof(*counters));
+	for (i = 0; i < BENCH_COUNTER_COUNT; i++) {
+		struct perf_event_attr attr = {
+			.size = sizeof(attr),
+			.type = events[i].type,
+			.config = ((events[i].type == PERF_TYPE_HW_CACHE) ?
+				   get_bench_cache_miss_config(events[i].config) :
+				   events[i].config),
+			.read_format = (PERF_FORMAT_TOTAL_TIME_ENABLED |
+					PERF_FORMAT_TOTAL_TIME_RUNNING),
+			.disabled = 1,
+			.inherit = 1,
+			.exclude_kernel = 1,
+			.exclude_hv = 1,
+		};
+		counters->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+					   -1, PERF_FLAG_FD_CLOEXEC);
+		if (counters->fds[i] < 0) {
+			error = errno;
+			counters->fds[i] = -1;
+		} else if (events[i].type != PERF_TYPE_SOFTWARE) {
+			hardware = true;
+		}
+	}
+
+	if (!hardware) {
+		fprintf(stderr, "hardware counters unavailable: %s\n",
+			strerror(error));
+	}
+	for (i = 0; i < BENCH_COUNTER_COUNT; i++) {
+		if (counters->fds[i] >= 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Close the counters.
+ *
+ * @param counters  the counters to close
+ **/
+static INLINE void close_bench_counters(struct bench_counters *counters)
+{
+	unsigned int i;
+	for (i = 0; i < BENCH_COUNTER_COUNT; i++) {
+		if (counters->fds[i] >= 0) {
+			close(counters->fds[i]);
+			counters->fds[i] = -1;
+		}
+	}
+}
+
+/**
+ * Zero the counters and start them counting, at the start of a phase.
+ *
+ * @param counters  the counters
+ **/
+static INLINE void start_bench_counters(struct bench_counters *counters)
+{
+	unsigned int i;
+	for (i = 0; i < BENCH_COUNTER_COUNT; i++) {
+		if (counters->fds[i] >= 0) {
+			ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+/**
+ * Stop the counters at the end of a phase, and read them. When there are
+ * more counters than the processor can count at once, the kernel takes
+ * turns among them, and each count is scaled up by the share of the phase
+ * in which it was counted.
+ *
+ * @param counters  the counters
+ **/
+static INLINE void stop_bench_counters(struct bench_counters *counters)
+{
+	unsigned int i;
+	for (i = 0; i < BENCH_COUNTER_COUNT; i++) {
+		uint64_t data[3];
+		counters->values[i] = 0;
+		if (counters->fds[i] < 0) {
+			continue;
+		}
+		ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if ((read(counters->fds[i], data, sizeof(data)) !=
+		     sizeof(data)) ||
+		    (data[2] == 0)) {
+			continue;
+		}
+		counters->values[i] = ((data[2] < data[1]) ?
+				       (uint64_t) ((double) data[0] *
+						   data[1] / data[2]) :
+				       data[0]);
+	}
+}
+
+/**
+ * Print the counts of the last phase for each operation, on one line.
+ *
+ * @param counters  the counters
+ * @param indent    the text to start the line with
+ * @param ops       the number of operations in the phase
+ **/
+static INLINE void print_bench_counters(const struct bench_counters *counters,
+					const char *indent,
+					uint64_t ops)
+{
+	const char *separator = "";
+	unsigned int i;
+
+	if (ops == 0) {
+		return;
+	}
+
+	printf("%s", indent);
+	for (i = 0; i < BENCH_COUNTER_COUNT; i++) {
+		double per_op;
+		if (counters->fds[i] < 0) {
+			continue;
+		}
+		per_op = (double) counters->values[i] / ops;
+		// Misses and faults are often well under one per operation.
+		printf("%s%s %.*f", separator, get_bench_counter_name(i),
+		       ((per_op < 1) ? 4 : 2), per_op);
+		separator = ", ";
+	}
+	if ((counters->fds[BENCH_CYCLES] >= 0) &&
+	    (counters->fds[BENCH_INSTRUCTIONS] >= 0) &&
+	    (counters->values[BENCH_CYCLES] > 0)) {
+		printf(", IPC %.2f",
+		       (double) counters->values[BENCH_INSTRUCTIONS] /
+		       counters->values[BENCH_CYCLES]);
+	}
+	printf(" per op\n");
+}
+
+#endif /* BENCH_COUNTERS_H */
@@ -0,0 +1,147 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/benchHistogram.h#1 $
+ */
+
+#ifndef BENCH_HISTOGRAM_H
+#define BENCH_HISTOGRAM_H
+
+#include "atomicDefs.h"
+#include "compiler.h"
+#include "typeDefs.h"
+
+/**
+ * A latency histogram for the benchmark tools. Each power of two of
+ * nanoseconds is split into BENCH_LATENCY_SUB_BUCKETS linear buckets, so
+ * percentiles are accurate to within 1/BENCH_LATENCY_SUB_BUCKETS while the
+ * whole range of a 64 bit time fits in under a thousand counters. Any thread
+ * may record into a histogram at any time.
+ **/
+
+enum {
+	BENCH_LATENCY_SUB_BITS = 4,
+	BENCH_LATENCY_SUB_BUCKETS = 1 << BENCH_LATENCY_SUB_BITS,
+	BENCH_LATENCY_BUCKETS =
+		(64 - BENCH_LATENCY_SUB_BITS + 1) << BENCH_LATENCY_SUB_BITS,
+};
+
+struct bench_histogram {
+	atomic64_t counts[BENCH_LATENCY_BUCKETS];
+};
+
+/**
+ * Get the bucket which counts a latency.
+ *
+ * @param nanoseconds  the latency
+ *
+ * @return the bucket number
+ **/
+static INLINE unsigned int get_bench_bucket(uint64_t nanoseconds)
+{
+	unsigned int shift;
+	if (nanoseconds < BENCH_LATENCY_SUB_BUCKETS) {
+		return nanoseconds;
+	}
+
+	shift = 63 - __builtin_clzll(nanoseconds) - BENCH_LATENCY_SUB_BITS;
+	return (((shift + 1) << BENCH_LATENCY_SUB_BITS) +
+		((nanoseconds >> shift) & (BENCH_LATENCY_SUB_BUCKETS - 1)));
+}
+
+/**
+ * Get the smallest latency a bucket counts.
+ *
+ * @param bucket  the bucket number
+ *
+ * @return the latency in nanoseconds
+ **/
+static INLINE uint64_t get_bench_bucket_floor(unsigned int bucket)
+{
+	unsigned int shift;
+	if (bucket < BENCH_LATENCY_SUB_BUCKETS) {
+		return bucket;
+	}
+
+	shift = (bucket >> BENCH_LATENCY_SUB_BITS) - 1;
+	return ((uint64_t) (BENCH_LATENCY_SUB_BUCKETS +
+			    (bucket & (BENCH_LATENCY_SUB_BUCKETS - 1)))
+		<< shift);
+}
+
+/**
+ * Count a latency.
+ *
+ * @param histogram    the histogram
+ * @param nanoseconds  the latency
+ **/
+static INLINE void record_bench_latency(struct bench_histogram *histogram,
+					uint64_t nanoseconds)
+{
+	atomic64_inc(&histogram->counts[get_bench_bucket(nanoseconds)]);
+}
+
+/**
+ * Get the total count of a histogram.
+ *
+ * @param histogram  the histogram
+ *
+ * @return the number of latencies recorded
+ **/
+static INLINE uint64_t
+get_bench_count(const struct bench_histogram *histogram)
+{
+	uint64_t count = 0;
+	unsigned int bucket;
+	for (bucket = 0; bucket < BENCH_LATENCY_BUCKETS; bucket++) {
+		count += atomic64_read(&histogram->counts[bucket]);
+	}
+	return count;
+}
+
+/**
+ * Get a percentile of the latencies in a histogram. The top of the bucket
+ * holding the percentile is returned, which overstates it by at most
+ * 1/BENCH_LATENCY_SUB_BUCKETS.
+ *
+ * @param histogram  the histogram
+ * @param per_mille  the percentile, in tenths of a percent
+ *
+ * @return the latency in nanoseconds, or 0 if the histogram is empty
+ **/
+static INLINE uint64_t
+get_bench_percentile(const struct bench_histogram *histogram,
+		     unsigned int per_mille)
+{
+	uint64_t target = (get_bench_count(histogram) * per_mille + 999) / 1000;
+	uint64_t seen = 0;
+	unsigned int bucket;
+	if (target == 0) {
+		return 0;
+	}
+
+	for (bucket = 0; bucket < BENCH_LATENCY_BUCKETS - 1; bucket++) {
+		seen += atomic64_read(&histogram->counts[bucket]);
+		if (seen >= target) {
+			break;
+		}
+	}
+	return get_bench_bucket_floor(bucket + 1);
+}
+
+#endif /* BENCH_HISTOGRAM_H */
@@ -22,6 +22,7 @@
 #include "bits.h"
 
 #include "compiler.h"
+#include "stringUtils.h"
 
 /**
  * This is the largest field size supported by get_big_field & set_big_field.
@@ -67,11 +68,62 @@ set_big_field(uint64_t value, byte *memory, uint64_t offset, int size)
 	put_unaligned_le64(data, addr);
 }
 
+/**
+ * Get 64 bits from a bit stream, starting at an arbitrary bit within a byte.
+ * Unlike get_big_field, this reads one byte past the first 8 bytes so that
+ * all 64 bits can be returned.
+ *
+ * @param addr   The address of the byte containing the first bit
+ * @param shift  The bit offset of the first bit within that byte
+ *
+ * @return the 64 bits
+ **/
+static INLINE uint64_t get_word_at(const byte *addr, int shift)
+{
+	uint64_t word = get_unaligned_le64(addr);
+	if (shift == 0) {
+		return word;
+	}
+	return (word >> shift) | ((uint64_t) addr[sizeof(uint64_t)] <<
+				  (sizeof(uint64_t) * CHAR_BIT - shift));
+}
+
+/**
+ * Put 64 bits into a bit stream, starting at an arbitrary bit within a
+ * byte, and preserving the bits on either side of them.
+ *
+ * @param word   The 64 bits to store
+ * @param addr   The address of the byte containing the first bit
+ * @param shift  The bit offset of the first bit within that byte
+ **/
+static INLINE void put_word_at(uint64_t word, byte *addr, int shift)
+{
+	uint64_t data;
+	if (shift == 0) {
+		put_unaligned_le64(word, addr);
+		return;
+	}
+	data = get_unaligned_le64(addr) & ((1UL << shift) - 1);
+	put_unaligned_le64(data | (word << shift), addr);
+	addr[sizeof(uint64_t)] =
+		((addr[sizeof(uint64_t)] & (0xFF << shift)) |
+		 (word >> (sizeof(uint64_t) * CHAR_BIT - shift)));
+}
+
 /**********************************************************************/
 void get_bytes(const byte *memory, uint64_t offset, byte *destination, int size)
 {
 	const byte *addr = memory + offset / CHAR_BIT;
 	int shift = offset % CHAR_BIT;
+	if (shift == 0) {
+		memcpy(destination, addr, size);
+		return;
+	}
+	for (; size >= (int) sizeof(uint64_t); size -= sizeof(uint64_t)) {
+		put_unaligned_le64(get_word_at(addr, shift), destination);
+		addr += sizeof(uint64_t);
+		destination += sizeof(uint64_t);
+	}
 	while (--size >= 0) {
 		*destination++ = get_unaligned_le16(addr++) >> shift;
 	}
@@ -83,6 +135,15 @@ void set_bytes(byte *memory, uint64_t offset, const byte *source, int size)
 	byte *addr = memory + offset / CHAR_BIT;
 	int shift = offset % CHAR_BIT;
 	uint16_t mask = ~((uint16_t) 0xFF << shift);
+	if (shift == 0) {
+		memcpy(addr, source, size);
+		return;
+	}
+	for (; size >= (int) sizeof(uint64_t); size -= sizeof(uint64_t)) {
+		put_word_at(get_unaligned_le64(source), addr, shift);
+		addr += sizeof(uint64_t);
+		source += sizeof(uint64_t);
+	}
 	while (--size >= 0) {
 		uint16_t data = (get_unaligned_le16(addr) & mask) |
 				(*source++ << shift);
@@ -90,6 +151,66 @@ void set_bytes(byte *memory, uint64_t offset, const byte *source, int size)
 	}
 }
 
+/**
+ * Move a field that is small enough to be read as a single big field.
+ *
+ * @param s_memory        The base source memory byte address
+ * @param source          Bit offset into memory for the source start
+ * @param d_memory        The base destination memory byte address
+ * @param destination     Bit offset into memory for the destination start
+ * @param size            The number of bits in the field, which may be zero
+ **/
+static INLINE void move_field(const byte *s_memory,
+			      uint64_t source,
+			      byte *d_memory,
+			      uint64_t destination,
+			      int size)
+{
+	if (size > 0) {
+		uint64_t field = get_big_field(s_memory, source, size);
+		set_big_field(field, d_memory, destination, size);
+	}
+}
+
+/**
+ * Move a field with the same alignment at the source and destination.  The
+ * whole bytes in the middle are moved with memmove, and the partial bytes at
+ * either end are moved as fields.  The ends are ordered so that the bytes
+ * of an overlapping source are read before they are overwritten.
+ *
+ * @param s_memory        The base source memory byte address
+ * @param source          Bit offset into memory for the source start
+ * @param d_memory        The base destination memory byte address
+ * @param destination     Bit offset into memory for the destination start
+ * @param size            The number of bits in the field
+ **/
+static void move_aligned_bits(const byte *s_memory,
+			      uint64_t source,
+			      byte *d_memory,
+			      uint64_t destination,
+			      int size)
+{
+	int head = (CHAR_BIT - destination % CHAR_BIT) % CHAR_BIT;
+	int tail = (destination + size) % CHAR_BIT;
+	int tail_offset = size - tail;
+	const byte *src = s_memory + (source + head) / CHAR_BIT;
+	byte *dest = d_memory + (destination + head) / CHAR_BIT;
+	size_t bytes = (size - head - tail) / CHAR_BIT;
+	if (source > destination) {
+		// Moving to a lower address, so move the lower bits first
+		move_field(s_memory, source, d_memory, destination, head);
+		memmove(dest, src, bytes);
+		move_field(s_memory, source + tail_offset,
+			   d_memory, destination + tail_offset, tail);
+	} else {
+		// Moving to a higher address, so move the higher bits first
+		move_field(s_memory, source + tail_offset,
+			   d_memory, destination + tail_offset, tail);
+		memmove(dest, src, bytes);
+		move_field(s_memory, source, d_memory, destination, head);
+	}
+}
+
 /**********************************************************************/
 void move_bits(const byte *s_memory,
 	       uint64_t source,
@@ -97,79 +218,99 @@ void move_bits(const byte *s_memory,
 	       uint64_t destination,
 	       int size)
 {
-	enum { UINT32_BIT = sizeof(uint32_t) * CHAR_BIT };
+	enum { UINT64_BIT = sizeof(uint64_t) * CHAR_BIT };
 	if (size > MAX_BIG_FIELD_BITS) {
+		const byte *src;
+		byte *dest;
+		uint64_t word;
+		int count, shift;
+		if ((source % CHAR_BIT) == (destination % CHAR_BIT)) {
+			move_aligned_bits(s_memory, source, d_memory,
+					  destination, size);
+			return;
+		}
 		if (source > destination) {
-			const byte *src;
-			byte *dest;
-			int offset;
 			// This is a large move from a higher to a lower
 			// address.  We move the lower addressed bits first.
 			// Start by moving one field that ends on a destination
-			// int boundary
-			int count =
-				MAX_BIG_FIELD_BITS -
-				(destination + MAX_BIG_FIELD_BITS) % UINT32_BIT;
-			uint64_t field =
-				get_big_field(s_memory, source, count);
-			set_big_field(field, d_memory, destination, count);
+			// byte boundary.
+			count = (CHAR_BIT - destination % CHAR_BIT) % CHAR_BIT;
+			move_field(s_memory, source, d_memory, destination,
+				   count);
 			source += count;
 			destination += count;
 			size -= count;
-			// Now do the main loop to copy 32 bit chunks that are
-			// int-aligned at the destination.
-			offset = source % UINT32_BIT;
-			src = s_memory + (source - offset) / CHAR_BIT;
+			// Now do the main loop to copy 64 bit chunks that are
+			// byte-aligned at the destination.
+			// Each source word is loaded once, and supplies the
+			// high bits of one chunk and the low bits of the next.
+			shift = source % CHAR_BIT;
+			src = s_memory + source / CHAR_BIT;
 			dest = d_memory + destination / CHAR_BIT;
-			while (size > MAX_BIG_FIELD_BITS) {
-				put_unaligned_le32(get_unaligned_le64(src) >>
-							   offset,
+			word = get_unaligned_le64(src);
+			while (size >= UINT64_BIT) {
+				uint64_t next = get_unaligned_le64(src +
+							sizeof(uint64_t));
+				put_unaligned_le64((word >> shift) |
+						   (next << (UINT64_BIT -
+							     shift)),
 						   dest);
-				src += sizeof(uint32_t);
-				dest += sizeof(uint32_t);
-				source += UINT32_BIT;
-				destination += UINT32_BIT;
-				size -= UINT32_BIT;
+				word = next;
+				src += sizeof(uint64_t);
+				dest += sizeof(uint64_t);
+				source += UINT64_BIT;
+				destination += UINT64_BIT;
+				size -= UINT64_BIT;
+			}
+			// What is left may still be too big for one field.
+			if (size > MAX_BIG_FIELD_BITS) {
+				move_field(s_memory, source, d_memory,
+					   destination, CHAR_BIT);
+				source += CHAR_BIT;
+				destination += CHAR_BIT;
+				size -= CHAR_BIT;
 			}
 		} else {
-			const byte *src;
-			byte *dest;
 			// This is a large move from a lower to a higher
 			// address.  We move the higher addressed bits first.
 			// Start by moving one field that begins on a
-			// destination int boundary
-			int offset, count = (destination + size) % UINT32_BIT;
-			if (count > 0) {
-				uint64_t field;
-				size -= count;
-				field = get_big_field(s_memory, source + size,
-						      count);
-				set_big_field(field,
-					      d_memory,
-					      destination + size,
-					      count);
-			}
-			// Now do the main loop to copy 32 bit chunks that are
-			// int-aligned at the destination.
-			offset = (source + size) % UINT32_BIT;
-			src = s_memory + (source + size - offset) / CHAR_BIT;
+			// destination byte boundary.
+			count = (destination + size) % CHAR_BIT;
+			size -= count;
+			move_field(s_memory, source + size,
+				   d_memory, destination + size, count);
+			// Now do the main loop to copy 64 bit chunks that are
+			// byte-aligned at the destination.
+			// Each source word is loaded once, and supplies the
+			// low bits of one chunk and the high bits of the next.
+			shift = (source + size) % CHAR_BIT;
+			src = s_memory + (source + size) / CHAR_BIT;
 			dest = d_memory + (destination + size) / CHAR_BIT;
-			while (size > MAX_BIG_FIELD_BITS) {
-				src -= sizeof(uint32_t);
-				dest -= sizeof(uint32_t);
-				size -= UINT32_BIT;
-				put_unaligned_le32(get_unaligned_le64(src) >>
-							   offset,
+			word = get_unaligned_le64(src);
+			while (size >= UINT64_BIT) {
+				uint64_t next;
+				src -= sizeof(uint64_t);
+				dest -= sizeof(uint64_t);
+				size -= UINT64_BIT;
+				next = get_unaligned_le64(src);
+				put_unaligned_le64((next >> shift) |
+						   (word << (UINT64_BIT -
+							     shift)),
 						   dest);
+				word = next;
+			}
+			// What is left may still be too big for one field.
+			if (size > MAX_BIG_FIELD_BITS) {
+				size -= CHAR_BIT;
+				move_field(s_memory, source + size,
+					   d_memory, destination + size,
+					   CHAR_BIT);
 			}
 		}
 	}
 	// Finish up by doing the last chunk, which can have any arbitrary
 	// alignment
-	if (size > 0) {
-		uint64_t field = get_big_field(s_memory, source, size);
-		set_big_field(field, d_memory, destination, size);
-	}
+	move_field(s_memory, source, d_memory, destination, size);
 }
 
 /**********************************************************************/
@@ -240,6 +240,18 @@ byte *get_buffer_contents(struct buffer *buffer)
 	return buffer->data + buffer->start;
 }
 
+/**********************************************************************/
+int peek_bytes_in_buffer(struct buffer *buffer, size_t length,
+			 const byte **bytes_ptr)
+{
+	if (content_length(buffer) < length) {
+		return UDS_BUFFER_ERROR;
+	}
+
+	*bytes_ptr = buffer->data + buffer->start;
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int copy_bytes(struct buffer *buffer, size_t length, byte **destination_ptr)
 {
@@ -274,12 +286,13 @@ int put_bytes(struct buffer *buffer, size_t length, const void *source)
 /**********************************************************************/
 int put_buffer(struct buffer *target, struct buffer *source, size_t length)
 {
-	int result;
-	if (content_length(source) < length) {
-		return UDS_BUFFER_ERROR;
+	const byte *bytes;
+	int result = peek_bytes_in_buffer(source, length, &bytes);
+	if (result != UDS_SUCCESS) {
+		return result;
 	}
 
-	result = put_bytes(target, length, get_buffer_contents(source));
+	result = put_bytes(target, length, bytes);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
@@ -342,14 +355,20 @@ int put_uint16_le_into_buffer(struct buffer *buffer, uint16_t ui)
 int get_uint16_les_from_buffer(struct buffer *buffer, size_t count,
 			       uint16_t *ui)
 {
-	unsigned int i;
 	if (content_length(buffer) < (sizeof(uint16_t) * count)) {
 		return UDS_BUFFER_ERROR;
 	}
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	// The encoding is the native layout, so the integers can be copied.
+	memcpy(ui, buffer->data + buffer->start, sizeof(uint16_t) * count);
+	buffer->start += sizeof(uint16_t) * count;
+#else
+	unsigned int i;
 	for (i = 0; i < count; i++) {
 		decode_uint16_le(buffer->data, &buffer->start, ui + i);
 	}
+#endif
 	return UDS_SUCCESS;
 }
 
@@ -358,14 +377,19 @@ int put_uint16_les_into_buffer(struct buffer *buffer,
 				 size_t count,
 				 const uint16_t *ui)
 {
-	unsigned int i;
 	if (!ensure_available_space(buffer, sizeof(uint16_t) * count)) {
 		return UDS_BUFFER_ERROR;
 	}
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(buffer->data + buffer->end, ui, sizeof(uint16_t) * count);
+	buffer->end += sizeof(uint16_t) * count;
+#else
+	unsigned int i;
 	for (i = 0; i < count; i++) {
 		encode_uint16_le(buffer->data, &buffer->end, ui[i]);
 	}
+#endif
 	return UDS_SUCCESS;
 }
 
@@ -439,14 +463,20 @@ int put_uint64_le_into_buffer(struct buffer *buffer, uint64_t ui)
 int get_uint64_les_from_buffer(struct buffer *buffer, size_t count,
 			       uint64_t *ui)
 {
-	unsigned int i;
 	if (content_length(buffer) < (sizeof(uint64_t) * count)) {
 		return UDS_BUFFER_ERROR;
 	}
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	// The encoding is the native layout, so the integers can be copied.
+	memcpy(ui, buffer->data + buffer->start, sizeof(uint64_t) * count);
+	buffer->start += sizeof(uint64_t) * count;
+#else
+	unsigned int i;
 	for (i = 0; i < count; i++) {
 		decode_uint64_le(buffer->data, &buffer->start, ui + i);
 	}
+#endif
 	return UDS_SUCCESS;
 }
 
@@ -455,13 +485,18 @@ int put_uint64_les_into_buffer(struct buffer *buffer,
 				 size_t count,
 				 const uint64_t *ui)
 {
-	unsigned int i;
 	if (!ensure_available_space(buffer, sizeof(uint64_t) * count)) {
 		return UDS_BUFFER_ERROR;
 	}
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(buffer->data + buffer->end, ui, sizeof(uint64_t) * count);
+	buffer->end += sizeof(uint64_t) * count;
+#else
+	unsigned int i;
 	for (i = 0; i < count; i++) {
 		encode_uint64_le(buffer->data, &buffer->end, ui[i]);
 	}
+#endif
 	return UDS_SUCCESS;
 }
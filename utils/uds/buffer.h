@@ -236,6 +236,23 @@ get_bytes_from_buffer(struct buffer *buffer, size_t length, void *destination);
  **/
 byte *get_buffer_contents(struct buffer *buffer);
 
+/**
+ * Get a pointer to the next bytes in a buffer without copying them or
+ * advancing the start of the buffer. As with get_buffer_contents(), the
+ * pointer refers to the buffer's own memory, which must not be modified
+ * while the pointer is in use.
+ *
+ * @param buffer     The buffer from which to get the bytes
+ * @param length     The number of bytes wanted
+ * @param bytes_ptr  A pointer to hold the pointer to the bytes
+ *
+ * @return UDS_SUCCESS or UDS_BUFFER_ERROR if there are fewer than length
+ *         bytes in the buffer
+ **/
+int __must_check
+peek_bytes_in_buffer(struct buffer *buffer, size_t length,
+		     const byte **bytes_ptr);
+
 /**
  * Copy bytes out of a buffer and advance the start of the buffer past the
  * copied data. Memory will be allocated to hold the copy.
@@ -26,6 +26,7 @@
 #include "logger.h"
 #include "memoryAlloc.h"
 #include "numeric.h"
+#include "uds-threads.h"
 
 /*
  * Define sector_t.  The kernel really wants us to use it.  The code becomes
@@ -35,20 +36,60 @@
  */
 #define sector_t uint64_t
 
+/**
+ * The state of the second buffer of a reader which reads ahead. The helper
+ * thread fills the buffer with the blocks following those the reader is
+ * using, while the reader decodes them.
+ **/
+struct read_ahead {
+	// Protects the fields below, and signals changes to them
+	struct mutex ra_mutex;
+	struct cond_var ra_cond;
+	// The thread which fills the buffer
+	struct thread *ra_thread;
+	// The buffer being filled
+	byte *ra_buffer;
+	// The first block to be read into the buffer
+	uint64_t ra_block_number;
+	// The number of blocks to be read into the buffer
+	size_t ra_blocks;
+	// The result of filling the buffer
+	int ra_result;
+	// Has the buffer been requested, and has it been filled?
+	bool ra_requested;
+	bool ra_filled;
+	// Should the thread exit?
+	bool ra_exiting;
+};
+
 struct buffered_reader {
 	// Region to read from
 	struct io_region *br_region;
+	// Number of blocks in the region
+	uint64_t br_region_blocks;
 	// Number of the current block
 	uint64_t br_block_number;
-	// Start of the buffer
+	// Start of the current block in the window
 	byte *br_start;
 	// End of the data read from the buffer
 	byte *br_pointer;
+	// Bytes read from the region
+	uint64_t br_bytes_read;
+	// The blocks read from the region
+	byte *br_window;
+	// Number of the first block in the window
+	uint64_t br_window_block;
+	// Number of blocks in the window
+	size_t br_window_blocks;
+	// Number of blocks the window can hold
+	size_t br_buffer_blocks;
+	// The read-ahead state, or NULL if the reader does not read ahead
+	struct read_ahead *br_read_ahead;
 };
 
-
 /**********************************************************************/
 int make_buffered_reader(struct io_region *region,
+			 size_t size,
 			 struct buffered_reader **reader_ptr)
 {
 	byte *data;
@@ -69,9 +110,16 @@ int make_buffered_reader(struct io_region *region,
 
 	*reader = (struct buffered_reader){
 		.br_region = region,
+		.br_region_blocks = size / UDS_BLOCK_SIZE,
 		.br_block_number = 0,
 		.br_start = data,
 		.br_pointer = NULL,
+		.br_bytes_read = 0,
+		.br_window = data,
+		.br_window_block = 0,
+		.br_window_blocks = 0,
+		.br_buffer_blocks = 1,
+		.br_read_ahead = NULL,
 	};
 
 	get_io_region(region);
@@ -79,27 +127,290 @@ int make_buffered_reader(struct io_region *region,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+static void read_ahead_thread(void *arg)
+{
+	struct buffered_reader *br = arg;
+	struct read_ahead *ra = br->br_read_ahead;
+	uds_lock_mutex(&ra->ra_mutex);
+	while (!ra->ra_exiting) {
+		if (!ra->ra_requested || ra->ra_filled) {
+			uds_wait_cond(&ra->ra_cond, &ra->ra_mutex);
+			continue;
+		}
+		uds_unlock_mutex(&ra->ra_mutex);
+		// The reader leaves the buffer alone until it has been filled.
+		int result = read_from_region(br->br_region,
+					      ra->ra_block_number *
+						      UDS_BLOCK_SIZE,
+					      ra->ra_buffer,
+					      ra->ra_blocks * UDS_BLOCK_SIZE,
+					      NULL);
+		uds_lock_mutex(&ra->ra_mutex);
+		ra->ra_result = result;
+		ra->ra_filled = true;
+		uds_broadcast_cond(&ra->ra_cond);
+	}
+	uds_unlock_mutex(&ra->ra_mutex);
+}
+
+/**
+ * Free the read-ahead state of a reader, stopping its thread.
+ *
+ * @param ra  The read-ahead state
+ **/
+static void free_read_ahead(struct read_ahead *ra)
+{
+	if (ra == NULL) {
+		return;
+	}
+	uds_lock_mutex(&ra->ra_mutex);
+	ra->ra_exiting = true;
+	uds_broadcast_cond(&ra->ra_cond);
+	uds_unlock_mutex(&ra->ra_mutex);
+	uds_join_threads(ra->ra_thread);
+	uds_destroy_cond(&ra->ra_cond);
+	uds_destroy_mutex(&ra->ra_mutex);
+	UDS_FREE(ra->ra_buffer);
+	UDS_FREE(ra);
+}
+
+/**
+ * Make the read-ahead state of a reader and start its thread.
+ *
+ * @param br      The buffered reader
+ * @param blocks  The number of blocks in each buffer
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int make_read_ahead(struct buffered_reader *br, size_t blocks)
+{
+	struct read_ahead *ra;
+	int result = UDS_ALLOCATE(1, struct read_ahead, "read ahead", &ra);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = UDS_ALLOCATE_IO_ALIGNED(blocks * UDS_BLOCK_SIZE, byte,
+					 "read ahead buffer", &ra->ra_buffer);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(ra);
+		return result;
+	}
+
+	result = uds_init_mutex(&ra->ra_mutex);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(ra->ra_buffer);
+		UDS_FREE(ra);
+		return result;
+	}
+
+	result = uds_init_cond(&ra->ra_cond);
+	if (result != UDS_SUCCESS) {
+		uds_destroy_mutex(&ra->ra_mutex);
+		UDS_FREE(ra->ra_buffer);
+		UDS_FREE(ra);
+		return result;
+	}
+
+	br->br_read_ahead = ra;
+	result = uds_create_thread(read_ahead_thread, br, "readAhead",
+				   &ra->ra_thread);
+	if (result != UDS_SUCCESS) {
+		br->br_read_ahead = NULL;
+		uds_destroy_cond(&ra->ra_cond);
+		uds_destroy_mutex(&ra->ra_mutex);
+		UDS_FREE(ra->ra_buffer);
+		UDS_FREE(ra);
+		return result;
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int start_buffered_reader_read_ahead(struct buffered_reader *br,
+				     size_t buffer_size)
+{
+	size_t blocks = buffer_size / UDS_BLOCK_SIZE;
+	byte *window;
+	int result;
+
+	if (br->br_pointer != NULL) {
+		return uds_log_error_strerror(UDS_BAD_STATE,
+					      "cannot start reading ahead after reading");
+	}
+	if (blocks >= br->br_region_blocks) {
+		// The whole region fits in one buffer, so there is nothing to
+		// read ahead of the reader.
+		blocks = br->br_region_blocks;
+	}
+	if (blocks <= 1) {
+		return UDS_SUCCESS;
+	}
+
+	result = UDS_ALLOCATE_IO_ALIGNED(blocks * UDS_BLOCK_SIZE, byte,
+					 "buffered reader window", &window);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	if (blocks < br->br_region_blocks) {
+		result = make_read_ahead(br, blocks);
+		if (result != UDS_SUCCESS) {
+			UDS_FREE(window);
+			return result;
+		}
+	}
+
+	UDS_FREE(br->br_window);
+	br->br_window = window;
+	br->br_start = window;
+	br->br_buffer_blocks = blocks;
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 void free_buffered_reader(struct buffered_reader *br)
 {
 	if (br == NULL) {
 		return;
 	}
+	free_read_ahead(br->br_read_ahead);
 	put_io_region(br->br_region);
-	UDS_FREE(br->br_start);
+	UDS_FREE(br->br_window);
 	UDS_FREE(br);
 }
 
+/**
+ * Ask the read-ahead thread of a reader to read the blocks which follow
+ * the window.
+ *
+ * @param br  The buffered reader
+ **/
+static void request_read_ahead(struct buffered_reader *br)
+{
+	struct read_ahead *ra = br->br_read_ahead;
+	uint64_t next = br->br_window_block + br->br_window_blocks;
+	if ((ra == NULL) || (next >= br->br_region_blocks)) {
+		return;
+	}
+	uds_lock_mutex(&ra->ra_mutex);
+	ra->ra_block_number = next;
+	ra->ra_blocks = min((uint64_t) br->br_buffer_blocks,
+			    br->br_region_blocks - next);
+	ra->ra_requested = true;
+	ra->ra_filled = false;
+	uds_broadcast_cond(&ra->ra_cond);
+	uds_unlock_mutex(&ra->ra_mutex);
+}
+
+/**
+ * Wait for the read-ahead thread to finish any read it has been asked to
+ * make. The read-ahead mutex must be held.
+ *
+ * @param ra  The read-ahead state
+ **/
+static void wait_for_read_ahead(struct read_ahead *ra)
+{
+	while (ra->ra_requested && !ra->ra_filled) {
+		uds_wait_cond(&ra->ra_cond, &ra->ra_mutex);
+	}
+}
+
+/**
+ * Discard anything a reader has read ahead, once it has been read.
+ *
+ * @param br  The buffered reader
+ **/
+static void cancel_read_ahead(struct buffered_reader *br)
+{
+	struct read_ahead *ra = br->br_read_ahead;
+	if (ra == NULL) {
+		return;
+	}
+	uds_lock_mutex(&ra->ra_mutex);
+	wait_for_read_ahead(ra);
+	ra->ra_requested = false;
+	uds_unlock_mutex(&ra->ra_mutex);
+}
+
+/**
+ * Wait for any read ahead of a reader to finish, and take its buffer as
+ * the window if it holds the wanted block.
+ *
+ * @param br            The buffered reader
+ * @param block_number  The block the reader wants
+ *
+ * @return true if the window now holds the wanted block
+ **/
+static bool take_read_ahead(struct buffered_reader *br,
+			    sector_t block_number)
+{
+	struct read_ahead *ra = br->br_read_ahead;
+	bool taken = false;
+	if (ra == NULL) {
+		return false;
+	}
+	uds_lock_mutex(&ra->ra_mutex);
+	wait_for_read_ahead(ra);
+	if (ra->ra_requested && (ra->ra_result == UDS_SUCCESS) &&
+	    (ra->ra_block_number == block_number)) {
+		byte *window = br->br_window;
+		br->br_window = ra->ra_buffer;
+		br->br_window_block = ra->ra_block_number;
+		br->br_window_blocks = ra->ra_blocks;
+		br->br_bytes_read += ra->ra_blocks * UDS_BLOCK_SIZE;
+		ra->ra_buffer = window;
+		taken = true;
+	}
+	ra->ra_requested = false;
+	uds_unlock_mutex(&ra->ra_mutex);
+	return taken;
+}
+
+/**
+ * Fill the window of a reader with the blocks starting at a given block,
+ * and start reading the blocks after them ahead.
+ *
+ * @param br            The buffered reader
+ * @param block_number  The first block to put in the window
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int fill_window(struct buffered_reader *br, sector_t block_number)
+{
+	size_t blocks = 1;
+	int result;
+	if (!take_read_ahead(br, block_number)) {
+		if (block_number < br->br_region_blocks) {
+			blocks = min((uint64_t) br->br_buffer_blocks,
+				     br->br_region_blocks - block_number);
+		}
+		br->br_window_blocks = 0;
+		result = read_from_region(br->br_region,
+					  block_number * UDS_BLOCK_SIZE,
+					  br->br_window,
+					  blocks * UDS_BLOCK_SIZE,
+					  NULL);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		br->br_window_block = block_number;
+		br->br_window_blocks = blocks;
+		br->br_bytes_read += blocks * UDS_BLOCK_SIZE;
+	}
+	request_read_ahead(br);
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 static int
 position_reader(struct buffered_reader *br, sector_t block_number, off_t offset)
 {
-	if ((br->br_pointer == NULL) || (block_number != br->br_block_number)) {
-		int result = read_from_region(br->br_region,
-					      block_number * UDS_BLOCK_SIZE,
-					      br->br_start,
-					      UDS_BLOCK_SIZE,
-					      NULL);
+	if ((br->br_pointer == NULL) ||
+	    (block_number < br->br_window_block) ||
+	    (block_number >= br->br_window_block + br->br_window_blocks)) {
+		int result = fill_window(br, block_number);
 		if (result != UDS_SUCCESS) {
 			uds_log_warning_strerror(
 				result,
@@ -109,6 +420,8 @@ position_reader(struct buffered_reader *br, sector_t block_number, off_t offset)
 		}
 	}
 	br->br_block_number = block_number;
+	br->br_start = (br->br_window +
+			(block_number - br->br_window_block) * UDS_BLOCK_SIZE);
 	br->br_pointer = br->br_start + offset;
 	return UDS_SUCCESS;
 }
@@ -121,6 +434,58 @@ static size_t bytes_remaining_in_read_buffer(struct buffered_reader *br)
 			br->br_start + UDS_BLOCK_SIZE - br->br_pointer);
 }
 
+/**
+ * Read whole blocks straight into the caller's memory rather than one at a
+ * time through the buffer. The reader is positioned at the start of the
+ * first block, which is already in the window. The blocks in the window are
+ * copied, and the rest are read directly. The reader is left at the end of
+ * the last block as if the blocks had been read through the buffer.
+ *
+ * @param br      The buffered reader
+ * @param data    The memory to read into
+ * @param blocks  The number of blocks to read
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int read_whole_blocks(struct buffered_reader *br,
+			     byte *data,
+			     size_t blocks)
+{
+	size_t length = blocks * UDS_BLOCK_SIZE;
+	sector_t last_block = br->br_block_number + blocks - 1;
+	size_t buffered = min((uint64_t) blocks,
+			      (br->br_window_block + br->br_window_blocks -
+			       br->br_block_number));
+	int result;
+	memcpy(data, br->br_start, buffered * UDS_BLOCK_SIZE);
+	if (blocks > buffered) {
+		// Any blocks read ahead are about to be read directly.
+		cancel_read_ahead(br);
+		result = read_from_region(br->br_region,
+					  (br->br_block_number + buffered) *
+						  UDS_BLOCK_SIZE,
+					  data + buffered * UDS_BLOCK_SIZE,
+					  length - buffered * UDS_BLOCK_SIZE,
+					  NULL);
+		if (result != UDS_SUCCESS) {
+			return uds_log_warning_strerror(result,
+							"%s got read_from_region error",
+							__func__);
+		}
+		br->br_bytes_read += length - buffered * UDS_BLOCK_SIZE;
+		memcpy(br->br_window, data + length - UDS_BLOCK_SIZE,
+		       UDS_BLOCK_SIZE);
+		br->br_window_block = last_block;
+		br->br_window_blocks = 1;
+		request_read_ahead(br);
+	}
+	br->br_block_number = last_block;
+	br->br_start = (br->br_window +
+			(last_block - br->br_window_block) * UDS_BLOCK_SIZE);
+	br->br_pointer = br->br_start + UDS_BLOCK_SIZE;
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int read_from_buffered_reader(struct buffered_reader *br,
 			      void *data,
@@ -141,6 +506,19 @@ int read_from_buffered_reader(struct buffered_reader *br,
 			}
 		}
 
+		if ((br->br_pointer == br->br_start) &&
+		    (length >= br->br_buffer_blocks * UDS_BLOCK_SIZE)) {
+			result = read_whole_blocks(br, dp,
+						   length / UDS_BLOCK_SIZE);
+			if (result != UDS_SUCCESS) {
+				break;
+			}
+			chunk = length - length % UDS_BLOCK_SIZE;
+			length -= chunk;
+			dp += chunk;
+			continue;
+		}
+
 		avail = bytes_remaining_in_read_buffer(br);
 		chunk = min(length, avail);
 		memcpy(dp, br->br_pointer, chunk);
@@ -195,3 +573,23 @@ int verify_buffered_data(struct buffered_reader *br,
 
 	return UDS_SUCCESS;
 }
+
+/**********************************************************************/
+int skip_buffered_data(struct buffered_reader *br, size_t length)
+{
+	uint64_t position = (br->br_block_number * UDS_BLOCK_SIZE) + length;
+	if (length == 0) {
+		return UDS_SUCCESS;
+	}
+	if (br->br_pointer != NULL) {
+		position += br->br_pointer - br->br_start;
+	}
+	return position_reader(br, position / UDS_BLOCK_SIZE,
+			       position % UDS_BLOCK_SIZE);
+}
+
+/**********************************************************************/
+uint64_t get_buffered_reader_bytes_read(const struct buffered_reader *br)
+{
+	return br->br_bytes_read;
+}
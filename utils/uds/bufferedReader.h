@@ -37,13 +37,31 @@ struct buffered_reader;
  * Make a new buffered reader.
  *
  * @param region      An IO region to read from.
+ * @param size        The size of the region in bytes.
  * @param reader_ptr  The pointer to hold the newly allocated buffered reader.
  *
  * @return UDS_SUCCESS or error code.
  **/
 int __must_check make_buffered_reader(struct io_region *region,
+				      size_t size,
 				      struct buffered_reader **reader_ptr);
 
+/**
+ * Make a buffered reader read ahead of its caller. The reader reads up to
+ * buffer_size bytes from the region at a time, and a helper thread reads
+ * the following bytes into a second buffer while the caller consumes the
+ * first. A region which fits in one buffer is read into it all at once
+ * without a helper thread. This must be called before anything is read.
+ *
+ * @param reader       The buffered reader
+ * @param buffer_size  The size of each buffer in bytes
+ *
+ * @return UDS_SUCCESS or an error code; on error the reader is unchanged
+ **/
+int __must_check
+start_buffered_reader_read_ahead(struct buffered_reader *reader,
+				 size_t buffer_size);
+
 /**
  * Free a buffered reader.
  *
@@ -81,4 +99,26 @@ int __must_check verify_buffered_data(struct buffered_reader *reader,
 				      const void *value,
 				      size_t length);
 
+/**
+ * Skip over data in a buffered reader, reading from the region only the
+ * block where the skipped data ends.
+ *
+ * @param reader        The buffered reader
+ * @param length        The length of the data to skip
+ *
+ * @return UDS_SUCCESS or an error code.
+ **/
+int __must_check skip_buffered_data(struct buffered_reader *reader,
+				    size_t length);
+
+/**
+ * Get the number of bytes a buffered reader has read from its region.
+ *
+ * @param reader        The buffered reader
+ *
+ * @return The number of bytes read from the region
+ **/
+uint64_t __must_check
+get_buffered_reader_bytes_read(const struct buffered_reader *reader);
+
 #endif // BUFFERED_READER_H
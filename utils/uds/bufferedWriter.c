@@ -24,10 +24,37 @@
 #include "compiler.h"
 #include "errors.h"
 #include "ioFactory.h"
+#include "ioThrottle.h"
 #include "logger.h"
 #include "memoryAlloc.h"
 #include "numeric.h"
+#include "uds-threads.h"
 
+/**
+ * The state of the second buffer of a writer which writes behind. The
+ * helper thread writes out the full buffer while the writer fills the
+ * other one.
+ **/
+struct write_behind {
+	// Protects the fields below, and signals changes to them
+	struct mutex wb_mutex;
+	struct cond_var wb_cond;
+	// The thread which writes the buffer
+	struct thread *wb_thread;
+	// The buffer being written
+	byte *wb_buffer;
+	// The block at which to write the buffer
+	uint64_t wb_block_number;
+	// The number of bytes to write
+	size_t wb_length;
+	// The result of writing the buffer
+	int wb_result;
+	// Has the buffer been submitted, and has it been written?
+	bool wb_requested;
+	bool wb_written;
+	// Should the thread exit?
+	bool wb_exiting;
+};
 
 struct buffered_writer {
 	// Region to write to
@@ -42,6 +69,14 @@ struct buffered_writer {
 	int bw_error;
 	// Have writes been done?
 	bool bw_used;
+	// Bytes written to the region
+	uint64_t bw_bytes_written;
+	// Number of blocks the buffer can hold
+	size_t bw_buffer_blocks;
+	// The write-behind state, or NULL if the writer writes synchronously
+	struct write_behind *bw_write_behind;
+	// The throttle which paces the writes, or NULL
+	struct io_throttle *bw_throttle;
 };
 
 
@@ -72,6 +107,10 @@ int make_buffered_writer(struct io_region *region,
 		.bw_block_number = 0,
 		.bw_error = UDS_SUCCESS,
 		.bw_used = false,
+		.bw_bytes_written = 0,
+		.bw_buffer_blocks = 1,
+		.bw_write_behind = NULL,
+		.bw_throttle = NULL,
 	};
 
 	get_io_region(region);
@@ -79,6 +118,188 @@ int make_buffered_writer(struct io_region *region,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+static void write_behind_thread(void *arg)
+{
+	struct buffered_writer *bw = arg;
+	struct write_behind *wb = bw->bw_write_behind;
+	uds_lock_mutex(&wb->wb_mutex);
+	while (!wb->wb_exiting) {
+		if (!wb->wb_requested || wb->wb_written) {
+			uds_wait_cond(&wb->wb_cond, &wb->wb_mutex);
+			continue;
+		}
+		uds_unlock_mutex(&wb->wb_mutex);
+		throttle_io(bw->bw_throttle, wb->wb_length);
+		// The writer leaves the buffer alone until it has been written.
+		int result = write_to_region(bw->bw_region,
+					     wb->wb_block_number *
+						     UDS_BLOCK_SIZE,
+					     wb->wb_buffer,
+					     bw->bw_buffer_blocks *
+						     UDS_BLOCK_SIZE,
+					     wb->wb_length);
+		uds_lock_mutex(&wb->wb_mutex);
+		wb->wb_result = result;
+		wb->wb_written = true;
+		uds_broadcast_cond(&wb->wb_cond);
+	}
+	uds_unlock_mutex(&wb->wb_mutex);
+}
+
+/**
+ * Wait for the write-behind thread of a writer to finish writing any
+ * buffer it has been given, and collect the result.
+ *
+ * @param bw  The buffered writer
+ *
+ * @return UDS_SUCCESS or the error from any write the writer has made
+ **/
+static int wait_for_write_behind(struct buffered_writer *bw)
+{
+	struct write_behind *wb = bw->bw_write_behind;
+	if (wb == NULL) {
+		return bw->bw_error;
+	}
+	uds_lock_mutex(&wb->wb_mutex);
+	while (wb->wb_requested && !wb->wb_written) {
+		uds_wait_cond(&wb->wb_cond, &wb->wb_mutex);
+	}
+	if (wb->wb_requested) {
+		if (wb->wb_result == UDS_SUCCESS) {
+			bw->bw_bytes_written += wb->wb_length;
+		} else if (bw->bw_error == UDS_SUCCESS) {
+			bw->bw_error = wb->wb_result;
+		}
+		wb->wb_requested = false;
+	}
+	uds_unlock_mutex(&wb->wb_mutex);
+	return bw->bw_error;
+}
+
+/**
+ * Free the write-behind state of a writer, stopping its thread. Any
+ * buffer already given to the thread is written first.
+ *
+ * @param bw  The buffered writer
+ **/
+static void free_write_behind(struct buffered_writer *bw)
+{
+	struct write_behind *wb = bw->bw_write_behind;
+	if (wb == NULL) {
+		return;
+	}
+	wait_for_write_behind(bw);
+	uds_lock_mutex(&wb->wb_mutex);
+	wb->wb_exiting = true;
+	uds_broadcast_cond(&wb->wb_cond);
+	uds_unlock_mutex(&wb->wb_mutex);
+	uds_join_threads(wb->wb_thread);
+	uds_destroy_cond(&wb->wb_cond);
+	uds_destroy_mutex(&wb->wb_mutex);
+	UDS_FREE(wb->wb_buffer);
+	UDS_FREE(wb);
+	bw->bw_write_behind = NULL;
+}
+
+/**
+ * Make the write-behind state of a writer and start its thread.
+ *
+ * @param bw      The buffered writer
+ * @param blocks  The number of blocks in each buffer
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int make_write_behind(struct buffered_writer *bw, size_t blocks)
+{
+	struct write_behind *wb;
+	int result = UDS_ALLOCATE(1, struct write_behind, "write behind",
+				  &wb);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = UDS_ALLOCATE_IO_ALIGNED(blocks * UDS_BLOCK_SIZE, byte,
+					 "write behind buffer",
+					 &wb->wb_buffer);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(wb);
+		return result;
+	}
+
+	result = uds_init_mutex(&wb->wb_mutex);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(wb->wb_buffer);
+		UDS_FREE(wb);
+		return result;
+	}
+
+	result = uds_init_cond(&wb->wb_cond);
+	if (result != UDS_SUCCESS) {
+		uds_destroy_mutex(&wb->wb_mutex);
+		UDS_FREE(wb->wb_buffer);
+		UDS_FREE(wb);
+		return result;
+	}
+
+	bw->bw_write_behind = wb;
+	result = uds_create_thread(write_behind_thread, bw, "writeBehind",
+				   &wb->wb_thread);
+	if (result != UDS_SUCCESS) {
+		bw->bw_write_behind = NULL;
+		uds_destroy_cond(&wb->wb_cond);
+		uds_destroy_mutex(&wb->wb_mutex);
+		UDS_FREE(wb->wb_buffer);
+		UDS_FREE(wb);
+		return result;
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int start_buffered_writer_write_behind(struct buffered_writer *bw,
+				       size_t buffer_size)
+{
+	size_t blocks = buffer_size / UDS_BLOCK_SIZE;
+	byte *data;
+	int result;
+
+	if (bw->bw_used) {
+		return uds_log_error_strerror(UDS_BAD_STATE,
+					      "cannot start writing behind after writing");
+	}
+	if (blocks == 0) {
+		blocks = 1;
+	}
+
+	result = UDS_ALLOCATE_IO_ALIGNED(blocks * UDS_BLOCK_SIZE, byte,
+					 "buffer writer buffer", &data);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// The buffers must be the same size before the thread can use them.
+	bw->bw_buffer_blocks = blocks;
+	result = make_write_behind(bw, blocks);
+	if (result != UDS_SUCCESS) {
+		bw->bw_buffer_blocks = 1;
+		UDS_FREE(data);
+		return result;
+	}
+
+	UDS_FREE(bw->bw_start);
+	bw->bw_start = data;
+	bw->bw_pointer = data;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void set_buffered_writer_throttle(struct buffered_writer *bw,
+				  struct io_throttle *throttle)
+{
+	bw->bw_throttle = throttle;
+}
+
 /**********************************************************************/
 void free_buffered_writer(struct buffered_writer *bw)
 {
@@ -86,6 +307,7 @@ void free_buffered_writer(struct buffered_writer *bw)
 	if (bw == NULL) {
 		return;
 	}
+	free_write_behind(bw);
 	result = sync_region_contents(bw->bw_region);
 	if (result != UDS_SUCCESS) {
 		uds_log_warning_strerror(result,
@@ -105,7 +327,58 @@ static INLINE size_t space_used_in_buffer(struct buffered_writer *bw)
 /**********************************************************************/
 size_t space_remaining_in_write_buffer(struct buffered_writer *bw)
 {
-	return UDS_BLOCK_SIZE - space_used_in_buffer(bw);
+	return bw->bw_buffer_blocks * UDS_BLOCK_SIZE - space_used_in_buffer(bw);
+}
+
+/**
+ * Write out the data in the buffer of a writer. A writer which writes
+ * behind hands the buffer to its thread and carries on with the other
+ * buffer; the write may not have finished when this returns.
+ *
+ * @param bw  The buffered writer
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int submit_buffer(struct buffered_writer *bw)
+{
+	struct write_behind *wb = bw->bw_write_behind;
+	size_t n = space_used_in_buffer(bw);
+	int result;
+	if (n == 0) {
+		return UDS_SUCCESS;
+	}
+
+	if (wb == NULL) {
+		throttle_io(bw->bw_throttle, n);
+		result = write_to_region(bw->bw_region,
+					 bw->bw_block_number * UDS_BLOCK_SIZE,
+					 bw->bw_start,
+					 UDS_BLOCK_SIZE,
+					 n);
+		if (result != UDS_SUCCESS) {
+			return bw->bw_error = result;
+		}
+		bw->bw_bytes_written += n;
+	} else {
+		byte *buffer;
+		result = wait_for_write_behind(bw);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		uds_lock_mutex(&wb->wb_mutex);
+		buffer = wb->wb_buffer;
+		wb->wb_buffer = bw->bw_start;
+		wb->wb_block_number = bw->bw_block_number;
+		wb->wb_length = n;
+		wb->wb_requested = true;
+		wb->wb_written = false;
+		uds_broadcast_cond(&wb->wb_cond);
+		uds_unlock_mutex(&wb->wb_mutex);
+		bw->bw_start = buffer;
+	}
+	bw->bw_pointer = bw->bw_start;
+	bw->bw_block_number += (n + UDS_BLOCK_SIZE - 1) / UDS_BLOCK_SIZE;
+	return UDS_SUCCESS;
 }
 
 /**********************************************************************/
@@ -121,6 +394,31 @@ int write_to_buffered_writer(struct buffered_writer *bw,
 	}
 
 	while ((len > 0) && (result == UDS_SUCCESS)) {
+		if ((space_used_in_buffer(bw) == 0) &&
+		    (len >= bw->bw_buffer_blocks * UDS_BLOCK_SIZE)) {
+			// Write whole blocks straight from the caller's memory,
+			// a buffer at a time if the writes are paced.
+			chunk = len - len % UDS_BLOCK_SIZE;
+			if (bw->bw_throttle != NULL) {
+				chunk = min(chunk,
+					    bw->bw_buffer_blocks *
+						    UDS_BLOCK_SIZE);
+				throttle_io(bw->bw_throttle, chunk);
+			}
+			result = write_to_region(bw->bw_region,
+						 bw->bw_block_number *
+							 UDS_BLOCK_SIZE,
+						 dp, chunk, chunk);
+			if (result != UDS_SUCCESS) {
+				bw->bw_error = result;
+				break;
+			}
+			bw->bw_bytes_written += chunk;
+			bw->bw_block_number += chunk / UDS_BLOCK_SIZE;
+			len -= chunk;
+			dp += chunk;
+			continue;
+		}
 
 		avail = space_remaining_in_write_buffer(bw);
 		chunk = min(len, avail);
@@ -130,7 +428,7 @@ int write_to_buffered_writer(struct buffered_writer *bw,
 		bw->bw_pointer += chunk;
 
 		if (space_remaining_in_write_buffer(bw) == 0) {
-			result = flush_buffered_writer(bw);
+			result = submit_buffer(bw);
 		}
 	}
 
@@ -156,7 +454,7 @@ int write_zeros_to_buffered_writer(struct buffered_writer *bw, size_t len)
 		bw->bw_pointer += chunk;
 
 		if (space_remaining_in_write_buffer(bw) == 0) {
-			result = flush_buffered_writer(bw);
+			result = submit_buffer(bw);
 		}
 	}
 
@@ -167,26 +465,16 @@ int write_zeros_to_buffered_writer(struct buffered_writer *bw, size_t len)
 /**********************************************************************/
 int flush_buffered_writer(struct buffered_writer *bw)
 {
+	int result;
 	if (bw->bw_error != UDS_SUCCESS) {
 		return bw->bw_error;
 	}
 
-	size_t n = space_used_in_buffer(bw);
-	if (n > 0) {
-		int result =
-			write_to_region(bw->bw_region,
-					bw->bw_block_number * UDS_BLOCK_SIZE,
-					bw->bw_start,
-					UDS_BLOCK_SIZE,
-					n);
-		if (result != UDS_SUCCESS) {
-			return bw->bw_error = result;
-		} else {
-			bw->bw_pointer = bw->bw_start;
-			bw->bw_block_number++;
-		}
+	result = submit_buffer(bw);
+	if (result != UDS_SUCCESS) {
+		return result;
 	}
-	return UDS_SUCCESS;
+	return wait_for_write_behind(bw);
 }
 
 /**********************************************************************/
@@ -200,3 +488,9 @@ void note_buffered_writer_used(struct buffered_writer *bw)
 {
 	bw->bw_used = true;
 }
+
+/**********************************************************************/
+uint64_t get_buffered_writer_bytes_written(const struct buffered_writer *bw)
+{
+	return bw->bw_bytes_written;
+}
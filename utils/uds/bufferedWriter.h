@@ -25,6 +25,7 @@
 #include "common.h"
 
 struct io_region;
+struct io_throttle;
 
 struct buffered_writer;
 
@@ -39,6 +40,35 @@ struct buffered_writer;
 int __must_check make_buffered_writer(struct io_region *region,
 				      struct buffered_writer **writer_ptr);
 
+/**
+ * Give a buffered writer a larger buffer, and a second buffer which a
+ * helper thread writes out while the first is being filled. Buffers are
+ * then written when they fill, without waiting for the write to finish;
+ * flushing waits for all the writes. This must be done before anything
+ * is written.
+ *
+ * @param bw           The buffered writer
+ * @param buffer_size  The size of each buffer, in bytes
+ *
+ * @return UDS_SUCCESS or an error code; on error the writer is unchanged
+ **/
+int __must_check
+start_buffered_writer_write_behind(struct buffered_writer *bw,
+				   size_t buffer_size);
+
+/**
+ * Pace the writes of a buffered writer with a throttle. The writer waits on
+ * the throttle before each write to its region; a writer which writes behind
+ * waits on its helper thread, so that it is only held up once both of its
+ * buffers are full.
+ *
+ * @param bw        The buffered writer
+ * @param throttle  The throttle to use, which must outlive the writer, or
+ *                  NULL to write at full speed
+ **/
+void set_buffered_writer_throttle(struct buffered_writer *bw,
+				  struct io_throttle *throttle);
+
 /**
  * Free a buffered writer, without flushing.
  *
@@ -77,7 +107,8 @@ int __must_check write_zeros_to_buffered_writer(struct buffered_writer *bw,
 						size_t len);
 
 /**
- * Flush any partial data from the buffer.
+ * Flush any partial data from the buffer, and wait for any writes still
+ * in progress to finish.
  *
  * @param buffer        The buffered writer object.
  *
@@ -115,4 +146,14 @@ bool __must_check was_buffered_writer_used(const struct buffered_writer *buffer)
  **/
 void note_buffered_writer_used(struct buffered_writer *buffer);
 
+/**
+ * Get the number of bytes a buffered writer has written to its region.
+ *
+ * @param buffer        The buffered writer object.
+ *
+ * @return              The number of bytes written to the region.
+ **/
+uint64_t __must_check
+get_buffered_writer_bytes_written(const struct buffered_writer *buffer);
+
 #endif // BUFFERED_WRITER_H
@@ -25,12 +25,13 @@
 
 #include "compiler.h"
 #include "errors.h"
+#include "numeric.h"
 #include "permassert.h"
 #include "stringUtils.h"
 #include "uds.h"
 
 /**********************************************************************/
-void increment_cache_counter(struct cache_counters *counters,
+void increment_cache_counter(struct zone_cache_counters *counters,
 			     int probe_type,
 			     enum cache_result_kind kind)
 {
@@ -92,3 +93,57 @@ void increment_cache_counter(struct cache_counters *counters,
 	// atomic.
 	atomic64_inc((atomic64_t *) my_counter);
 }
+
+/**
+ * Get the histogram bucket for a value, where bucket i holds values of at
+ * least 2^i and less than 2^(i+1).
+ *
+ * @param value         the value to count
+ * @param bucket_count  the number of buckets
+ *
+ * @return the bucket
+ **/
+static unsigned int get_log2_bucket(uint64_t value, unsigned int bucket_count)
+{
+	unsigned int bucket = ((value < 2) ? 0 : (63 - __builtin_clzll(value)));
+	return min(bucket, bucket_count - 1);
+}
+
+/**********************************************************************/
+void record_cache_read(struct cache_counters *counters, ktime_t duration)
+{
+	uint64_t nanoseconds = ((duration > 0) ? duration : 0);
+	counters->read_latency.counts[get_log2_bucket(nanoseconds,
+						      UDS_LATENCY_BUCKETS)]++;
+}
+
+/**********************************************************************/
+void record_cache_eviction(struct cache_counters *counters, ktime_t age)
+{
+	uint64_t milliseconds = ((age > 0) ? ktime_to_ms(age) : 0);
+	counters->evictions++;
+	counters->eviction_age[get_log2_bucket(milliseconds,
+					       UDS_EVICTION_AGE_BUCKETS)]++;
+}
+
+/**********************************************************************/
+static void get_probe_counts(const struct cache_counts_by_kind *counts,
+			     struct uds_cache_probe_counts *stats)
+{
+	stats->hits = READ_ONCE(counts->hits);
+	stats->misses = READ_ONCE(counts->misses);
+	stats->queued = READ_ONCE(counts->queued);
+}
+
+/**********************************************************************/
+void get_zone_cache_stats(const struct zone_cache_counters *counters,
+			  struct uds_page_cache_zone_stats *stats)
+{
+	get_probe_counts(&counters->first_time.index_page,
+			 &stats->first_index);
+	get_probe_counts(&counters->first_time.record_page,
+			 &stats->first_record);
+	get_probe_counts(&counters->retried.index_page, &stats->retry_index);
+	get_probe_counts(&counters->retried.record_page,
+			 &stats->retry_record);
+}
@@ -22,7 +22,11 @@
 #ifndef CACHE_COUNTERS_H
 #define CACHE_COUNTERS_H
 
+#include "compiler.h"
+#include "cpu.h"
+#include "timeUtils.h"
 #include "typeDefs.h"
+#include "uds.h"
 
 /**
  * Basic counts of hits and misses for a given type of cache probe.
@@ -70,19 +74,37 @@ struct cache_counts_by_page_type {
 };
 
 /**
- * All the counters used for an entry cache.
+ * The page cache probe counters of one zone. Each zone has its own counters,
+ * aligned so that zones do not share cache lines.
  **/
-struct cache_counters {
-	// counters for the page cache
+struct zone_cache_counters {
 	/** Hit/miss counts for the first attempt per request */
 	struct cache_counts_by_page_type first_time;
 	/** Hit/miss counts when a second (or later) attempt is needed */
 	struct cache_counts_by_page_type retried;
+} __attribute__((aligned(CACHE_LINE_BYTES)));
 
+/**
+ * All the counters used for an entry cache.
+ **/
+struct cache_counters {
+	// counters for the page cache
 	/** Number of cache entry invalidations due to single-entry eviction */
 	uint64_t evictions;
 	/** Number of cache entry invalidations due to chapter expiration */
 	uint64_t expirations;
+	/** Number of cache entry invalidations due to errors */
+	uint64_t errors;
+	/** Number of record page reads queued by a reader thread */
+	uint64_t chained_reads;
+	/** Number of mapped page reads done without a reader thread */
+	uint64_t resident_reads;
+	/** Number of pages loaded from the saved warm list */
+	uint64_t warmed_pages;
+	/** The time taken by volume page reads */
+	struct uds_latency_histogram read_latency;
+	/** How long evicted pages had been in the cache */
+	uint64_t eviction_age[UDS_EVICTION_AGE_BUCKETS];
 
 	// counters for the sparse chapter index cache
 	/** Hit/miss counts for the sparse cache chapter probes */
@@ -108,12 +130,37 @@ enum cache_result_kind {
 /**
  * Increment one of the cache counters.
  *
- * @param counters    pointer to the counters
+ * @param counters    pointer to the counters of the probing zone
  * @param probe_type  type of access done
  * @param kind        result of probe
  **/
-void increment_cache_counter(struct cache_counters *counters,
+void increment_cache_counter(struct zone_cache_counters *counters,
 			     int probe_type,
 			     enum cache_result_kind kind);
 
+/**
+ * Record the time taken by a volume page read.
+ *
+ * @param counters  pointer to the counters
+ * @param duration  the duration of the read
+ **/
+void record_cache_read(struct cache_counters *counters, ktime_t duration);
+
+/**
+ * Record the eviction of a page.
+ *
+ * @param counters  pointer to the counters
+ * @param age       how long the page had been in the cache
+ **/
+void record_cache_eviction(struct cache_counters *counters, ktime_t age);
+
+/**
+ * Copy the probe counts of a zone into the public statistics.
+ *
+ * @param counters  the counters of the zone
+ * @param stats     the public statistics for the zone
+ **/
+void get_zone_cache_stats(const struct zone_cache_counters *counters,
+			  struct uds_page_cache_zone_stats *stats);
+
 #endif /* CACHE_COUNTERS_H */
@@ -21,11 +21,197 @@
 
 #include "cachedChapterIndex.h"
 
+#include "chapterIndex.h"
+#include "hashUtils.h"
+#include "logger.h"
 #include "memoryAlloc.h"
+#include "permassert.h"
+#include "stringUtils.h"
+
+enum {
+	/** The number of filter bits per chapter index entry */
+	FILTER_BITS_PER_ENTRY = 8,
+	/** The decoded record page of an address with collision entries */
+	COLLIDED_RECORD_PAGE = UINT16_MAX,
+};
+
+/**
+ * Compute log2 of the number of bits in a chapter filter, which holds at
+ * least FILTER_BITS_PER_ENTRY bits for every record in the chapter.
+ *
+ * @param geometry  the geometry governing the volume
+ *
+ * @return the filter size as a power of two
+ **/
+static unsigned int compute_filter_shift(const struct geometry *geometry)
+{
+	uint64_t bits =
+		(uint64_t) geometry->records_per_chapter * FILTER_BITS_PER_ENTRY;
+	unsigned int shift = 6;
+	while ((1ULL << shift) < bits) {
+		shift++;
+	}
+	return shift;
+}
+
+/**********************************************************************/
+size_t get_cached_chapter_filter_size(const struct geometry *geometry)
+{
+	return ((size_t) 1 << compute_filter_shift(geometry)) / CHAR_BIT;
+}
+
+/**********************************************************************/
+size_t get_cached_chapter_decoded_size(const struct geometry *geometry)
+{
+	return ((sizeof(uint32_t) * (geometry->delta_lists_per_chapter + 1)) +
+		((sizeof(uint32_t) + sizeof(uint16_t)) *
+		 geometry->records_per_chapter));
+}
+
+/**
+ * Compute the two filter bits for a chapter index entry.
+ *
+ * @param chapter  the cache entry owning the filter
+ * @param list     the delta list number of the entry
+ * @param address  the delta address of the entry
+ * @param bits     the two bit numbers in the filter
+ **/
+static INLINE void get_filter_bits(const struct cached_chapter_index *chapter,
+				   unsigned int list,
+				   unsigned int address,
+				   uint64_t bits[2])
+{
+	uint64_t mask = (1ULL << chapter->filter_shift) - 1;
+	uint64_t hash = ((((uint64_t) list << 32) | address) *
+			 0x9e3779b97f4a7c15ULL);
+	uint64_t rehash = (hash ^ (hash >> 29)) * 0xbf58476d1ce4e5b9ULL;
+	bits[0] = (hash >> 32) & mask;
+	bits[1] = (rehash >> 32) & mask;
+}
+
+/**
+ * Record a chapter index entry in a chapter's decoded form. An address which
+ * has collision entries depends on the whole chunk name, so it is only marked
+ * here and left to the chapter index page to resolve.
+ *
+ * @param chapter  the cache entry being decoded
+ * @param count    the number of entries decoded so far
+ * @param entry    the chapter index entry to record
+ *
+ * @return the new number of decoded entries
+ **/
+static unsigned int decode_chapter_entry(struct cached_chapter_index *chapter,
+					 unsigned int count,
+					 const struct delta_index_entry *entry)
+{
+	if (entry->is_collision) {
+		chapter->record_pages[count - 1] = COLLIDED_RECORD_PAGE;
+		return count;
+	}
+	chapter->addresses[count] = entry->key;
+	chapter->record_pages[count] = get_delta_entry_value(entry);
+	return count + 1;
+}
+
+/**
+ * Fill in a chapter's filter, and its decoded form if it keeps one, from its
+ * decoded chapter index pages.
+ *
+ * @param chapter   the cache entry whose pages have just been read
+ * @param geometry  the geometry governing the volume
+ *
+ * @return UDS_SUCCESS or an error code if a delta list is corrupt
+ **/
+static int build_chapter_filter(struct cached_chapter_index *chapter,
+				const struct geometry *geometry)
+{
+	bool decoded = (chapter->addresses != NULL);
+	unsigned int count = 0;
+	unsigned int next_list = 0;
+	unsigned int i;
+	memset(chapter->filter, 0,
+	       ((size_t) 1 << chapter->filter_shift) / CHAR_BIT);
+	for (i = 0; i < chapter->index_pages_count; i++) {
+		const struct delta_index_page *page = &chapter->index_pages[i];
+		unsigned int first = page->lowest_list_number;
+		unsigned int list;
+		for (list = first; list <= page->highest_list_number; list++) {
+			struct delta_index_entry entry;
+			int result = start_delta_index_search(&page->delta_index,
+							      list - first,
+							      0, true,
+							      &entry);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+			if (decoded) {
+				while (next_list <= list) {
+					chapter->list_starts[next_list++] =
+						count;
+				}
+			}
+			for (;;) {
+				uint64_t bits[2];
+				result = next_delta_index_entry(&entry);
+				if (result != UDS_SUCCESS) {
+					return result;
+				}
+				if (entry.at_end) {
+					break;
+				}
+				get_filter_bits(chapter, list, entry.key, bits);
+				chapter->filter[bits[0] / 64] |=
+					1ULL << (bits[0] % 64);
+				chapter->filter[bits[1] / 64] |=
+					1ULL << (bits[1] % 64);
+				if (!decoded) {
+					continue;
+				}
+				if (!entry.is_collision &&
+				    (count >= geometry->records_per_chapter)) {
+					return uds_log_error_strerror(
+						UDS_CORRUPT_DATA,
+						"chapter index has more than %u entries",
+						geometry->records_per_chapter);
+				}
+				count = decode_chapter_entry(chapter, count,
+							     &entry);
+			}
+		}
+	}
+
+	if (decoded) {
+		while (next_list <= geometry->delta_lists_per_chapter) {
+			chapter->list_starts[next_list++] = count;
+		}
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Check whether a chapter's filter admits a delta list entry.
+ *
+ * @param chapter  the cache entry to check
+ * @param list     the delta list number of the name
+ * @param address  the delta address of the name
+ *
+ * @return <code>false</code> if the chapter index has no such entry
+ **/
+static INLINE bool
+chapter_filter_may_contain(const struct cached_chapter_index *chapter,
+			   unsigned int list,
+			   unsigned int address)
+{
+	uint64_t bits[2];
+	get_filter_bits(chapter, list, address, bits);
+	return (((chapter->filter[bits[0] / 64] >> (bits[0] % 64)) &
+		 (chapter->filter[bits[1] / 64] >> (bits[1] % 64)) & 1) != 0);
+}
 
 /**********************************************************************/
 int initialize_cached_chapter_index(struct cached_chapter_index *chapter,
-				    const struct geometry *geometry)
+				    const struct geometry *geometry,
+				    bool decoded)
 {
 	int result;
 	unsigned int i;
@@ -48,6 +234,48 @@ int initialize_cached_chapter_index(struct cached_chapter_index *chapter,
 		return result;
 	}
 
+	chapter->filter_shift = compute_filter_shift(geometry);
+	result = UDS_ALLOCATE(((size_t) 1 << chapter->filter_shift) / 64,
+			      uint64_t,
+			      "sparse chapter filter",
+			      &chapter->filter);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	if (decoded) {
+		result = ASSERT(geometry->record_pages_per_chapter <
+					COLLIDED_RECORD_PAGE,
+				"decoded record page numbers fit in 16 bits");
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+
+		result = UDS_ALLOCATE(geometry->delta_lists_per_chapter + 1,
+				      uint32_t,
+				      "decoded chapter list starts",
+				      &chapter->list_starts);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+
+		result = UDS_ALLOCATE(geometry->records_per_chapter,
+				      uint32_t,
+				      "decoded chapter addresses",
+				      &chapter->addresses);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+
+		result = UDS_ALLOCATE(geometry->records_per_chapter,
+				      uint16_t,
+				      "decoded chapter record pages",
+				      &chapter->record_pages);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
+
 	for (i = 0; i < chapter->index_pages_count; i++) {
 		result = initialize_volume_page(geometry,
 						&chapter->volume_pages[i]);
@@ -78,8 +306,12 @@ void destroy_cached_chapter_index(struct cached_chapter_index *chapter)
 			destroy_volume_page(&chapter->volume_pages[i]);
 		}
 	}
-	UDS_FREE(chapter->index_pages);
-	UDS_FREE(chapter->volume_pages);
+	UDS_FREE(UDS_FORGET(chapter->index_pages));
+	UDS_FREE(UDS_FORGET(chapter->volume_pages));
+	UDS_FREE(UDS_FORGET(chapter->filter));
+	UDS_FREE(UDS_FORGET(chapter->list_starts));
+	UDS_FREE(UDS_FORGET(chapter->addresses));
+	UDS_FREE(UDS_FORGET(chapter->record_pages));
 }
 
 /**********************************************************************/
@@ -102,18 +334,170 @@ int cache_chapter_index(struct cached_chapter_index *chapter,
 		return result;
 	}
 
-	// Reset all chapter counter values to zero.
+	result = build_chapter_filter(chapter, volume->geometry);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// Reset all chapter counter values, giving the chapter a hit rate
+	// which lets it be searched for a while.
 	chapter->counters.search_hits = 0;
 	chapter->counters.search_misses = 0;
-	chapter->counters.consecutive_misses = 0;
+	chapter->counters.hit_rate = CHAPTER_HIT_RATE_INITIAL;
+	chapter->counters.skipped_searches = 0;
 
-	// Mark the entry as valid--it's now in the cache.
-	chapter->virtual_chapter = virtual_chapter;
+	// Mark the entry as valid--it's now in the cache. The zone threads
+	// may look at the entry as soon as the chapter number appears, so
+	// everything else must be visible first.
 	chapter->skip_search = false;
+	smp_wmb();
+	WRITE_ONCE(chapter->virtual_chapter, virtual_chapter);
 
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+void prefetch_cached_chapter_filter(const struct cached_chapter_index *chapter,
+				    const struct geometry *geometry,
+				    const struct uds_chunk_name *name)
+{
+	uint64_t bits[2];
+	get_filter_bits(chapter,
+			hash_to_chapter_delta_list(name, geometry),
+			hash_to_chapter_delta_address(name, geometry),
+			bits);
+	prefetch_address(&chapter->filter[bits[0] / 64], false);
+	prefetch_address(&chapter->filter[bits[1] / 64], false);
+}
+
+/**********************************************************************/
+bool cached_chapter_may_contain(const struct cached_chapter_index *chapter,
+				const struct geometry *geometry,
+				const struct uds_chunk_name *name)
+{
+	return chapter_filter_may_contain(chapter,
+					  hash_to_chapter_delta_list(name,
+								     geometry),
+					  hash_to_chapter_delta_address(name,
+									geometry));
+}
+
+/**
+ * Look up a delta list entry in a chapter's decoded form.
+ *
+ * @param chapter  the cache entry to search
+ * @param list     the delta list number of the name
+ * @param address  the delta address of the name
+ *
+ * @return the record page number of the entry, NO_CHAPTER_INDEX_ENTRY if
+ *         there is none, or COLLIDED_RECORD_PAGE if the chapter index page
+ *         must decide
+ **/
+static int search_decoded_chapter(const struct cached_chapter_index *chapter,
+				  unsigned int list,
+				  unsigned int address)
+{
+	unsigned int low = chapter->list_starts[list];
+	unsigned int high = chapter->list_starts[list + 1];
+	while (low < high) {
+		unsigned int middle = low + (high - low) / 2;
+		if (chapter->addresses[middle] < address) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	if ((low < chapter->list_starts[list + 1]) &&
+	    (chapter->addresses[low] == address)) {
+		return chapter->record_pages[low];
+	}
+	return NO_CHAPTER_INDEX_ENTRY;
+}
+
+/**
+ * Find the chapter index page and the delta list within it that would hold
+ * a chunk name.
+ *
+ * @param [in]  chapter         the cache entry to look in
+ * @param [in]  geometry        the geometry governing the volume
+ * @param [in]  index_page_map  the index page number map for the volume
+ * @param [in]  name            the chunk name
+ * @param [out] list_ptr        the delta list number within the page
+ *
+ * @return the chapter index page, or NULL if the map has no page for it
+ **/
+static const struct delta_index_page *
+find_chapter_list(const struct cached_chapter_index *chapter,
+		  const struct geometry *geometry,
+		  const struct index_page_map *index_page_map,
+		  const struct uds_chunk_name *name,
+		  unsigned int *list_ptr)
+{
+	const struct delta_index_page *page;
+	unsigned int physical_chapter =
+		map_to_physical_chapter(geometry, chapter->virtual_chapter);
+	unsigned int index_page_number;
+	if (find_index_page_number(index_page_map, name, physical_chapter,
+				   &index_page_number) != UDS_SUCCESS) {
+		return NULL;
+	}
+
+	page = &chapter->index_pages[index_page_number];
+	*list_ptr = (hash_to_chapter_delta_list(name, geometry) -
+		     page->lowest_list_number);
+	return page;
+}
+
+/**********************************************************************/
+void
+prefetch_cached_chapter_list_header(const struct cached_chapter_index *chapter,
+				    const struct geometry *geometry,
+				    const struct index_page_map *index_page_map,
+				    const struct uds_chunk_name *name)
+{
+	unsigned int list;
+	const struct delta_index_page *page;
+	if (chapter->addresses != NULL) {
+		list = hash_to_chapter_delta_list(name, geometry);
+		prefetch_address(&chapter->list_starts[list], false);
+		return;
+	}
+
+	page = find_chapter_list(chapter, geometry, index_page_map, name,
+				 &list);
+	if (page != NULL) {
+		prefetch_delta_index_list_header(&page->delta_index, list);
+	}
+}
+
+/**********************************************************************/
+void prefetch_cached_chapter_list(const struct cached_chapter_index *chapter,
+				  const struct geometry *geometry,
+				  const struct index_page_map *index_page_map,
+				  const struct uds_chunk_name *name)
+{
+	unsigned int list;
+	const struct delta_index_page *page;
+	if (chapter->addresses != NULL) {
+		unsigned int start;
+		list = hash_to_chapter_delta_list(name, geometry);
+		start = chapter->list_starts[list];
+		prefetch_range(&chapter->addresses[start],
+			       ((chapter->list_starts[list + 1] - start) *
+				sizeof(uint32_t)),
+			       false);
+		prefetch_address(&chapter->record_pages[start], false);
+		return;
+	}
+
+	page = find_chapter_list(chapter, geometry, index_page_map, name,
+				 &list);
+	if (page != NULL) {
+		prefetch_delta_index_list(&page->delta_index, list);
+	}
+}
+
 /**********************************************************************/
 int search_cached_chapter_index(struct cached_chapter_index *chapter,
 				const struct geometry *geometry,
@@ -121,12 +505,34 @@ int search_cached_chapter_index(struct cached_chapter_index *chapter,
 				const struct uds_chunk_name *name,
 				int *record_page_ptr)
 {
+	unsigned int list = hash_to_chapter_delta_list(name, geometry);
+	unsigned int address = hash_to_chapter_delta_address(name, geometry);
+	unsigned int physical_chapter, index_page_number;
+	int result;
+
+	// Most misses can be rejected by the filter, without decoding any
+	// part of the chapter index.
+	if (!chapter_filter_may_contain(chapter, list, address)) {
+		*record_page_ptr = NO_CHAPTER_INDEX_ENTRY;
+		return UDS_SUCCESS;
+	}
+
+	// The decoded form answers everything but addresses with collision
+	// entries, which need the full chunk name.
+	if (chapter->addresses != NULL) {
+		int record_page =
+			search_decoded_chapter(chapter, list, address);
+		if (record_page != COLLIDED_RECORD_PAGE) {
+			*record_page_ptr = record_page;
+			return UDS_SUCCESS;
+		}
+	}
+
 	// Find the index_page_number in the chapter that would have the chunk
 	// name.
-	unsigned int physical_chapter =
+	physical_chapter =
 		map_to_physical_chapter(geometry, chapter->virtual_chapter);
-	unsigned int index_page_number;
-	int result = find_index_page_number(index_page_map, name,
+	result = find_index_page_number(index_page_map, name,
 					    physical_chapter,
 					    &index_page_number);
 	if (result != UDS_SUCCESS) {
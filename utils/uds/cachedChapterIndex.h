@@ -32,6 +32,13 @@
 #include "volume.h"
 #include "volumeStore.h"
 
+enum {
+	/** The hit rate estimate which stands for every search hitting */
+	CHAPTER_HIT_RATE_ONE = 1 << 24,
+	/** The hit rate estimate a newly cached chapter starts with */
+	CHAPTER_HIT_RATE_INITIAL = CHAPTER_HIT_RATE_ONE >> 8,
+};
+
 /**
  * These counters are essentially fields of the struct cached_chapter_index,
  * but are segregated into this structure because they are frequently modified.
@@ -45,8 +52,17 @@ struct __attribute__((aligned(CACHE_LINE_BYTES))) cached_index_counters {
 	/** the total number of search misses since this chapter was cached */
 	uint64_t search_misses;
 
-	/** the number of consecutive search misses since the last cache hit */
-	uint64_t consecutive_misses;
+	/**
+	 * the decaying estimate of the zone zero search hit rate, in units
+	 * of 1/CHAPTER_HIT_RATE_ONE
+	 */
+	uint64_t hit_rate;
+
+	/** the searches zone zero has skipped since it last probed */
+	uint64_t skipped_searches;
+
+	/** the sparse cache LRU clock value at the last zone zero hit */
+	uint64_t last_used;
 };
 
 /**
@@ -56,8 +72,8 @@ struct __attribute__((aligned(CACHE_LINE_BYTES))) cached_index_counters {
 struct __attribute__((aligned(CACHE_LINE_BYTES))) cached_chapter_index {
 	/*
 	 * The virtual chapter number of the cached chapter index. UINT64_MAX
-	 * means this cache entry is unused. Must only be modified in the
-	 * critical section in updateSparseCache().
+	 * means this cache entry is unused. Must only be modified by the
+	 * sparse cache loader thread.
 	 */
 	uint64_t virtual_chapter;
 
@@ -86,6 +102,26 @@ struct __attribute__((aligned(CACHE_LINE_BYTES))) cached_chapter_index {
 	/* pointer to an array of volume pages containing the index pages */
 	struct volume_page *volume_pages;
 
+	/*
+	 * A bit filter of the delta list and address of every entry in the
+	 * chapter index, built when the chapter is cached, so that most
+	 * misses need not decode an index page.
+	 */
+	uint64_t *filter;
+
+	/* log2 of the number of bits in the filter */
+	unsigned int filter_shift;
+
+	/*
+	 * The decoded form of the chapter index, or NULL if the cache does
+	 * not keep one. The entries of delta list n are at positions
+	 * list_starts[n] up to list_starts[n + 1] of the address and record
+	 * page arrays, sorted by address.
+	 */
+	uint32_t *list_starts;
+	uint32_t *addresses;
+	uint16_t *record_pages;
+
 	// The cache-aligned counters change often and are placed at the end of
 	// the structure to prevent false sharing with the more stable fields
 	// above.
@@ -101,10 +137,12 @@ struct __attribute__((aligned(CACHE_LINE_BYTES))) cached_chapter_index {
  *
  * @param chapter   the chapter index cache entry to initialize
  * @param geometry  the geometry governing the volume
+ * @param decoded   whether to also keep the chapter index decoded
  **/
 int __must_check
 initialize_cached_chapter_index(struct cached_chapter_index *chapter,
-				const struct geometry *geometry);
+				const struct geometry *geometry,
+				bool decoded);
 
 /**
  * Release the all cached page data for a cached_chapter_index.
@@ -115,7 +153,8 @@ void release_cached_chapter_index(struct cached_chapter_index *chapter);
 
 /**
  * Destroy a cached_chapter_index, freeing the memory allocated for the
- * ChapterIndexPages and raw index page data.
+ * ChapterIndexPages and raw index page data. The entry may be destroyed
+ * again, or initialized afresh.
  *
  * @param chapter   the chapter index cache entry to destroy
  **/
@@ -167,7 +206,7 @@ should_skip_chapter_index(const struct index_zone *zone,
 		return (virtual_chapter != chapter->virtual_chapter);
 	} else {
 		// When searching the entire cache, save time by skipping over
-		// chapters that have had too many consecutive misses.
+		// chapters whose hit rate has fallen too low.
 		return READ_ONCE(chapter->skip_search);
 	}
 }
@@ -189,6 +228,85 @@ int __must_check cache_chapter_index(struct cached_chapter_index *chapter,
 				     uint64_t virtual_chapter,
 				     const struct volume *volume);
 
+/**
+ * Get the number of bytes of filter each cached chapter index uses.
+ *
+ * @param geometry  the geometry governing the volume
+ *
+ * @return the filter size in bytes
+ **/
+size_t __must_check
+get_cached_chapter_filter_size(const struct geometry *geometry);
+
+/**
+ * Get the number of bytes each cached chapter index uses to keep its
+ * decoded form.
+ *
+ * @param geometry  the geometry governing the volume
+ *
+ * @return the decoded chapter index size in bytes
+ **/
+size_t __must_check
+get_cached_chapter_decoded_size(const struct geometry *geometry);
+
+/**
+ * Prefetch the filter words which cached_chapter_may_contain() will check
+ * for a chunk name.
+ *
+ * @param chapter   the cache entry to be searched
+ * @param geometry  the geometry governing the volume
+ * @param name      the chunk name to be searched for
+ **/
+void prefetch_cached_chapter_filter(const struct cached_chapter_index *chapter,
+				    const struct geometry *geometry,
+				    const struct uds_chunk_name *name);
+
+/**
+ * Check the filter of a cached chapter index for a chunk name.
+ *
+ * @param chapter   the cache entry to check
+ * @param geometry  the geometry governing the volume
+ * @param name      the chunk name to check for
+ *
+ * @return <code>false</code> if the chapter index cannot have an entry for
+ *         the name
+ **/
+bool __must_check
+cached_chapter_may_contain(const struct cached_chapter_index *chapter,
+			   const struct geometry *geometry,
+			   const struct uds_chunk_name *name);
+
+/**
+ * Prefetch the header of the chapter index delta list which a search for a
+ * chunk name will decode. This is the first half of a batched search, as for
+ * prefetch_delta_index_list_header().
+ *
+ * @param chapter         the cache entry to be searched
+ * @param geometry        the geometry governing the volume
+ * @param index_page_map  the index page number map for the volume
+ * @param name            the chunk name to be searched for
+ **/
+void
+prefetch_cached_chapter_list_header(const struct cached_chapter_index *chapter,
+				    const struct geometry *geometry,
+				    const struct index_page_map *index_page_map,
+				    const struct uds_chunk_name *name);
+
+/**
+ * Prefetch the bits of the chapter index delta list which a search for a
+ * chunk name will decode. This should follow
+ * prefetch_cached_chapter_list_header() for the same name.
+ *
+ * @param chapter         the cache entry to be searched
+ * @param geometry        the geometry governing the volume
+ * @param index_page_map  the index page number map for the volume
+ * @param name            the chunk name to be searched for
+ **/
+void prefetch_cached_chapter_list(const struct cached_chapter_index *chapter,
+				  const struct geometry *geometry,
+				  const struct index_page_map *index_page_map,
+				  const struct uds_chunk_name *name);
+
 /**
  * Search a single cached sparse chapter index for a chunk name, returning the
  * record page number that may contain the name.
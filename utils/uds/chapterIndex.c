@@ -56,7 +56,8 @@ int make_open_chapter_index(struct open_chapter_index **open_chapter_index,
 				        geometry->delta_lists_per_chapter,
 				        geometry->chapter_mean_delta,
 				        geometry->chapter_payload_bits,
-				        memory_size);
+				        memory_size,
+				        0);
 	if (result != UDS_SUCCESS) {
 		UDS_FREE(*open_chapter_index);
 		*open_chapter_index = NULL;
@@ -154,15 +155,14 @@ int pack_open_chapter_index_page(struct open_chapter_index *open_chapter_index,
 	unsigned int removals = 0;
 	struct delta_index_entry entry;
 	int list_number;
+	int result;
+	// Settle which lists go on the page, removing entries if they can't
+	// all fit, before any bits are copied. Then the page is packed once.
 	for (;;) {
-		int result =
-			pack_delta_index_page(delta_index,
-					      open_chapter_index->volume_nonce,
-					      memory,
-					      geometry->bytes_per_page,
-					      open_chapter_index->virtual_chapter_number,
-					      first_list,
-					      num_lists);
+		result = count_delta_index_page_lists(delta_index,
+						      geometry->bytes_per_page,
+						      first_list,
+						      num_lists);
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
@@ -227,7 +227,13 @@ int pack_open_chapter_index_page(struct open_chapter_index *open_chapter_index,
 				(unsigned long long) open_chapter_index->virtual_chapter_number,
 				removals);
 	}
-	return UDS_SUCCESS;
+	return pack_delta_index_page(delta_index,
+				     open_chapter_index->volume_nonce,
+				     memory,
+				     geometry->bytes_per_page,
+				     open_chapter_index->virtual_chapter_number,
+				     first_list,
+				     num_lists);
 }
 
 /**********************************************************************/
@@ -28,6 +28,8 @@
 #include "logger.h"
 #include "memoryAlloc.h"
 #include "openChapter.h"
+#include "sharedIndex.h"
+#include "udsProbes.h"
 #include "uds-threads.h"
 
 
@@ -48,6 +50,16 @@ struct chapter_writer {
 	size_t memory_allocated;
 	/* The number of zones which have submitted a chapter for writing */
 	unsigned int zones_to_write;
+	/* True while the last chapter written is being synced to storage */
+	bool syncing;
+	/* The number of chapters written */
+	uint64_t chapters_written;
+	/* The number of chapters written which are also synced */
+	uint64_t chapters_synced;
+	/* The thread syncing the last chapter written, if any */
+	struct thread *sync_thread;
+	/* The result of the sync done by the sync thread */
+	int sync_result;
 	/* Open chapter index used by close_open_chapter() */
 	struct open_chapter_index *open_chapter_index;
 	/* Collated records used by close_open_chapter() */
@@ -56,18 +68,90 @@ struct chapter_writer {
 	struct open_chapter_zone *chapters[];
 };
 
+/**********************************************************************/
+static void sync_chapter(void *arg)
+{
+	struct chapter_writer *writer = arg;
+
+	writer->sync_result =
+		sync_volume_store(&writer->index->volume->volume_store);
+}
+
+/**
+ * Wait for the sync of the last chapter written to finish, if one is in
+ * progress. Only the writer thread may call this.
+ *
+ * @param writer  the chapter writer
+ *
+ * @return UDS_SUCCESS or the error from syncing the chapter
+ **/
+static int finish_chapter_sync(struct chapter_writer *writer)
+{
+	if (writer->sync_thread == NULL) {
+		return UDS_SUCCESS;
+	}
+
+	uds_join_threads(writer->sync_thread);
+	writer->sync_thread = NULL;
+	return writer->sync_result;
+}
+
+/**
+ * Start syncing the chapter just written, on another thread if possible so
+ * that the writer can go on to the next chapter. If the index is taking
+ * checkpoints, the chapter must be on storage before the state that
+ * references it is saved, so it is synced here instead. Only the writer
+ * thread may call this.
+ *
+ * @param writer  the chapter writer
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int start_chapter_sync(struct chapter_writer *writer)
+{
+	struct uds_index *index = writer->index;
+
+	if ((get_index_checkpoint_frequency(index->checkpoint) == 0) &&
+	    (uds_create_thread(sync_chapter, writer, "chaptersync",
+			       &writer->sync_thread) == UDS_SUCCESS)) {
+		return UDS_SUCCESS;
+	}
+
+	writer->sync_thread = NULL;
+	return sync_volume_store(&index->volume->volume_store);
+}
+
 /**
  * This is the driver function for the writer thread. It loops until
  * terminated, waiting for a chapter to provided to close.
  **/
 static void close_chapters(void *arg)
 {
-	int result;
+	int result, sync_result;
 	struct chapter_writer *writer = arg;
+	ktime_t start;
+	uds_set_memory_tag(UDS_MEMORY_CHAPTER_WRITER);
 	uds_log_debug("chapter writer starting");
 	uds_lock_mutex(&writer->mutex);
 	for (;;) {
 		while (writer->zones_to_write < writer->index->zone_count) {
+			if (writer->syncing) {
+				// There's no chapter to write yet, so finish
+				// syncing the last one.
+				uds_unlock_mutex(&writer->mutex);
+				result = finish_chapter_sync(writer);
+				uds_lock_mutex(&writer->mutex);
+				writer->syncing = false;
+				if (writer->result == UDS_SUCCESS) {
+					writer->result = result;
+				}
+				if (result == UDS_SUCCESS) {
+					writer->chapters_synced =
+						writer->chapters_written;
+				}
+				uds_broadcast_cond(&writer->cond);
+				continue;
+			}
 			if (writer->stop && (writer->zones_to_write == 0)) {
 				// We've been told to stop, and all of the
 				// zones are in the same open chapter, so we
@@ -104,6 +188,9 @@ static void close_chapters(void *arg)
 			}
 		}
 
+		UDS_PROBE1(chapter_close_start,
+			   writer->index->newest_virtual_chapter);
+		start = current_time_ns(CLOCK_MONOTONIC);
 		result =
 			close_open_chapter(writer->chapters,
 					   writer->index->zone_count,
@@ -111,25 +198,54 @@ static void close_chapters(void *arg)
 					   writer->open_chapter_index,
 					   writer->collated_records,
 					   writer->index->newest_virtual_chapter);
+		if (result == UDS_SUCCESS) {
+			note_index_chapter_written(writer->index->checkpoint,
+						   ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+							     start));
+			note_shared_index_chapter_written(writer->index->shared,
+							  writer->index->newest_virtual_chapter);
+		}
+
+		// The previous chapter must be on storage before this one is
+		// made active, so that at most one chapter is ever unsynced.
+		sync_result = finish_chapter_sync(writer);
+		if (result == UDS_SUCCESS) {
+			result = sync_result;
+		}
+		if (result == UDS_SUCCESS) {
+			result = start_chapter_sync(writer);
+		}
 
 		if (result == UDS_SUCCESS) {
 			result = process_chapter_writer_checkpoint_saves(writer->index);
 		}
+		UDS_PROBE2(chapter_close_done,
+			   writer->index->newest_virtual_chapter, result);
 
 
 		uds_lock_mutex(&writer->mutex);
 		// Note that the index is totally finished with the writing
 		// chapter
 		advance_active_chapters(writer->index);
+		writer->syncing = (writer->sync_thread != NULL);
+		writer->chapters_written += 1;
+		if (result == UDS_SUCCESS) {
+			// The chapter before this one is synced, and so is
+			// this one unless it is syncing in the background.
+			writer->chapters_synced = (writer->chapters_written -
+						   (writer->syncing ? 1 : 0));
+		}
 		writer->result = result;
 		writer->zones_to_write = 0;
 		uds_broadcast_cond(&writer->cond);
 	}
 }
 
-/**********************************************************************/
-int make_chapter_writer(struct uds_index *index,
-			struct chapter_writer **writer_ptr)
+/**
+ * Allocate a chapter writer and start its thread.
+ **/
+static int allocate_chapter_writer(struct uds_index *index,
+				   struct chapter_writer **writer_ptr)
 {
 	size_t open_chapter_index_memory_allocated;
 	struct chapter_writer *writer;
@@ -190,11 +306,23 @@ int make_chapter_writer(struct uds_index *index,
 		free_chapter_writer(writer);
 		return result;
 	}
+	bind_thread_to_slot(index->affinity, writer->thread,
+			    index->zone_count + 1);
 
 	*writer_ptr = writer;
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+int make_chapter_writer(struct uds_index *index,
+			struct chapter_writer **writer_ptr)
+{
+	enum uds_memory_tag tag = uds_set_memory_tag(UDS_MEMORY_CHAPTER_WRITER);
+	int result = allocate_chapter_writer(index, writer_ptr);
+	uds_set_memory_tag(tag);
+	return result;
+}
+
 /**********************************************************************/
 void free_chapter_writer(struct chapter_writer *writer)
 {
@@ -250,9 +378,25 @@ int finish_previous_chapter(struct chapter_writer *writer,
 void wait_for_idle_chapter_writer(struct chapter_writer *writer)
 {
 	uds_lock_mutex(&writer->mutex);
-	while (writer->zones_to_write > 0) {
-		// The chapter writer is probably writing a chapter.  If it is
-		// not, it will soon wake up and write a chapter.
+	while ((writer->zones_to_write > 0) || writer->syncing) {
+		// The chapter writer is probably writing or syncing a chapter.
+		// If it is not, it will soon wake up and write a chapter.
+		uds_wait_cond(&writer->cond, &writer->mutex);
+	}
+	uds_unlock_mutex(&writer->mutex);
+}
+
+/**********************************************************************/
+void wait_for_closed_chapters(struct chapter_writer *writer)
+{
+	uint64_t target;
+	uds_lock_mutex(&writer->mutex);
+	// A chapter which any zone has started closing counts as closed;
+	// chapters closed after this point are not waited for.
+	target = (writer->chapters_written +
+		  ((writer->zones_to_write > 0) ? 1 : 0));
+	while ((writer->chapters_synced < target) &&
+	       (writer->result == UDS_SUCCESS)) {
 		uds_wait_cond(&writer->cond, &writer->mutex);
 	}
 	uds_unlock_mutex(&writer->mutex);
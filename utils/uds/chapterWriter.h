@@ -85,6 +85,15 @@ int __must_check finish_previous_chapter(struct chapter_writer *writer,
  **/
 void wait_for_idle_chapter_writer(struct chapter_writer *writer);
 
+/**
+ * Wait for the chapters closed before this call to be written and synced to
+ * storage. Unlike wait_for_idle_chapter_writer(), this does not wait for
+ * chapters which are closed while it waits.
+ *
+ * @param writer  the chapter writer
+ **/
+void wait_for_closed_chapters(struct chapter_writer *writer);
+
 /**
  * Stop the chapter writer and wait for it to finish.
  *
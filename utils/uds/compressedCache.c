@@ -0,0 +1,428 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/compressedCache.c#1 $
+ */
+
+#include "compressedCache.h"
+
+#define ZLIB_CONST
+#include <zlib.h>
+
+#include "errors.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "stringUtils.h"
+#include "uds-threads.h"
+
+enum {
+	/*
+	 * A raw deflate stream with a window and hash table no larger than a
+	 * page keeps the per-call allocation by zlib small, since each store
+	 * and fetch sets up a fresh stream.
+	 */
+	COMPRESSION_LEVEL = 1,
+	WINDOW_BITS = -12,
+	MEMORY_LEVEL = 4,
+};
+
+struct compressed_page {
+	/* The next older page in the cache */
+	struct compressed_page *older;
+	/* The next newer page in the cache */
+	struct compressed_page *newer;
+	/* The physical page number of the page */
+	unsigned int physical_page;
+	/* The number of bytes of compressed data */
+	unsigned int size;
+	/* The compressed data */
+	byte data[];
+};
+
+struct compressed_cache {
+	/* Protects everything below */
+	struct mutex mutex;
+	/* The number of bytes of pages the cache may hold */
+	size_t budget;
+	/* The number of bytes of pages the cache holds */
+	size_t bytes_used;
+	/* The size of an uncompressed page */
+	unsigned int bytes_per_page;
+	/* The largest compressed size worth keeping */
+	unsigned int max_compressed_size;
+	/* The number of entries in the page map */
+	unsigned int num_index_entries;
+	/* The compressed pages, indexed by physical page number */
+	struct compressed_page **index;
+	/* The oldest page, which is the first to be dropped */
+	struct compressed_page *oldest;
+	/* The newest page */
+	struct compressed_page *newest;
+	/* Advanced by every invalidation */
+	uint64_t epoch;
+	/* The number of pages held */
+	uint64_t pages;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t stores;
+	uint64_t rejects;
+	uint64_t evictions;
+};
+
+/**********************************************************************/
+int make_compressed_cache(const struct geometry *geometry,
+			  size_t budget,
+			  struct compressed_cache **cache_ptr)
+{
+	struct compressed_cache *cache;
+	int result;
+
+	if (budget < geometry->bytes_per_page) {
+		return uds_log_error_strerror(UDS_INVALID_ARGUMENT,
+					      "compressed cache budget of %zu bytes is smaller than a page",
+					      budget);
+	}
+
+	result = UDS_ALLOCATE(1, struct compressed_cache, "compressed cache",
+			      &cache);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	cache->budget = budget;
+	cache->bytes_per_page = geometry->bytes_per_page;
+	// A page which only shrinks by a little costs more in inflation time
+	// than it saves in storage reads.
+	cache->max_compressed_size =
+		geometry->bytes_per_page - geometry->bytes_per_page / 4;
+	cache->num_index_entries = geometry->pages_per_volume + 1;
+
+	result = UDS_ALLOCATE(cache->num_index_entries,
+			      struct compressed_page *,
+			      "compressed cache index",
+			      &cache->index);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(cache);
+		return result;
+	}
+
+	result = uds_init_mutex(&cache->mutex);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(cache->index);
+		UDS_FREE(cache);
+		return result;
+	}
+
+	*cache_ptr = cache;
+	return UDS_SUCCESS;
+}
+
+/**
+ * Remove a page from a compressed cache and free it. The caller must hold
+ * the cache mutex.
+ *
+ * @param cache  The cache
+ * @param page   The page to remove
+ **/
+static void remove_compressed_page(struct compressed_cache *cache,
+				   struct compressed_page *page)
+{
+	if (page->older != NULL) {
+		page->older->newer = page->newer;
+	} else {
+		cache->oldest = page->newer;
+	}
+	if (page->newer != NULL) {
+		page->newer->older = page->older;
+	} else {
+		cache->newest = page->older;
+	}
+
+	cache->index[page->physical_page] = NULL;
+	cache->bytes_used -= sizeof(*page) + page->size;
+	cache->pages--;
+	UDS_FREE(page);
+}
+
+/**
+ * Drop every page in a compressed cache. The caller must hold the cache
+ * mutex.
+ *
+ * @param cache  The cache
+ **/
+static void remove_all_compressed_pages(struct compressed_cache *cache)
+{
+	while (cache->oldest != NULL) {
+		remove_compressed_page(cache, cache->oldest);
+	}
+}
+
+/**********************************************************************/
+void free_compressed_cache(struct compressed_cache *cache)
+{
+	if (cache == NULL) {
+		return;
+	}
+
+	remove_all_compressed_pages(cache);
+	uds_destroy_mutex(&cache->mutex);
+	UDS_FREE(cache->index);
+	UDS_FREE(cache);
+}
+
+/**********************************************************************/
+uint64_t get_compressed_cache_epoch(struct compressed_cache *cache)
+{
+	uint64_t epoch;
+
+	uds_lock_mutex(&cache->mutex);
+	epoch = cache->epoch;
+	uds_unlock_mutex(&cache->mutex);
+	return epoch;
+}
+
+/**
+ * Deflate a page into a compressed page buffer.
+ *
+ * @param cache  The cache
+ * @param data   The page data
+ * @param page   The compressed page, with room for max_compressed_size bytes
+ *
+ * @return true if the page fit
+ **/
+static bool compress_page(const struct compressed_cache *cache,
+			  const byte *data,
+			  struct compressed_page *page)
+{
+	z_stream stream = {
+		.next_in = data,
+		.avail_in = cache->bytes_per_page,
+		.next_out = page->data,
+		.avail_out = cache->max_compressed_size,
+	};
+	int result;
+
+	if (deflateInit2(&stream, COMPRESSION_LEVEL, Z_DEFLATED, WINDOW_BITS,
+			 MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return false;
+	}
+
+	result = deflate(&stream, Z_FINISH);
+	page->size = cache->max_compressed_size - stream.avail_out;
+	deflateEnd(&stream);
+	return (result == Z_STREAM_END);
+}
+
+/**********************************************************************/
+void store_compressed_page(struct compressed_cache *cache,
+			   unsigned int physical_page,
+			   const byte *data,
+			   uint64_t epoch)
+{
+	struct compressed_page *page;
+	struct compressed_page *shrunk;
+	size_t full_size;
+	int result;
+
+	if (physical_page >= cache->num_index_entries) {
+		return;
+	}
+
+	full_size = sizeof(*page) + cache->max_compressed_size;
+	result = UDS_ALLOCATE_EXTENDED(struct compressed_page,
+				       cache->max_compressed_size,
+				       byte,
+				       "compressed page",
+				       &page);
+	if (result != UDS_SUCCESS) {
+		return;
+	}
+
+	if (!compress_page(cache, data, page)) {
+		UDS_FREE(page);
+		uds_lock_mutex(&cache->mutex);
+		cache->rejects++;
+		uds_unlock_mutex(&cache->mutex);
+		return;
+	}
+
+	result = uds_reallocate_memory(page, full_size,
+				       sizeof(*page) + page->size,
+				       "compressed page", &shrunk);
+	if (result == UDS_SUCCESS) {
+		page = shrunk;
+	}
+	page->physical_page = physical_page;
+
+	uds_lock_mutex(&cache->mutex);
+	if (epoch != cache->epoch) {
+		// The page's chapter was forgotten while it was compressed.
+		uds_unlock_mutex(&cache->mutex);
+		UDS_FREE(page);
+		return;
+	}
+
+	if (cache->index[physical_page] != NULL) {
+		remove_compressed_page(cache, cache->index[physical_page]);
+	}
+
+	cache->bytes_used += sizeof(*page) + page->size;
+	while ((cache->bytes_used > cache->budget) && (cache->oldest != NULL)) {
+		remove_compressed_page(cache, cache->oldest);
+		cache->evictions++;
+	}
+
+	page->older = cache->newest;
+	page->newer = NULL;
+	if (cache->newest != NULL) {
+		cache->newest->newer = page;
+	} else {
+		cache->oldest = page;
+	}
+	cache->newest = page;
+	cache->index[physical_page] = page;
+	cache->pages++;
+	cache->stores++;
+	uds_unlock_mutex(&cache->mutex);
+}
+
+/**
+ * Inflate a compressed page.
+ *
+ * @param cache  The cache
+ * @param page   The compressed page
+ * @param data   A buffer of a full page to hold the page data
+ *
+ * @return true if the page expanded to exactly a full page
+ **/
+static bool expand_page(const struct compressed_cache *cache,
+			const struct compressed_page *page,
+			byte *data)
+{
+	z_stream stream = {
+		.next_in = page->data,
+		.avail_in = page->size,
+		.next_out = data,
+		.avail_out = cache->bytes_per_page,
+	};
+	int result;
+
+	if (inflateInit2(&stream, WINDOW_BITS) != Z_OK) {
+		return false;
+	}
+
+	result = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+	return ((result == Z_STREAM_END) && (stream.avail_out == 0));
+}
+
+/**********************************************************************/
+bool fetch_compressed_page(struct compressed_cache *cache,
+			   unsigned int physical_page,
+			   byte *data)
+{
+	struct compressed_page *page;
+	bool found;
+
+	if (physical_page >= cache->num_index_entries) {
+		return false;
+	}
+
+	uds_lock_mutex(&cache->mutex);
+	page = cache->index[physical_page];
+	if (page == NULL) {
+		cache->misses++;
+		uds_unlock_mutex(&cache->mutex);
+		return false;
+	}
+
+	// Expanding under the lock is cheaper than unlinking the page and
+	// allocating a copy of it.
+	found = expand_page(cache, page, data);
+	if (found) {
+		cache->hits++;
+	} else {
+		uds_log_warning("compressed copy of page %u is unusable",
+				physical_page);
+		cache->misses++;
+	}
+	remove_compressed_page(cache, page);
+	uds_unlock_mutex(&cache->mutex);
+	return found;
+}
+
+/**********************************************************************/
+void invalidate_compressed_pages(struct compressed_cache *cache,
+				 unsigned int first_page,
+				 unsigned int page_count)
+{
+	unsigned int page;
+	unsigned int last_page = min(first_page + page_count,
+				     cache->num_index_entries);
+
+	uds_lock_mutex(&cache->mutex);
+	cache->epoch++;
+	for (page = first_page; page < last_page; page++) {
+		if (cache->index[page] != NULL) {
+			remove_compressed_page(cache, cache->index[page]);
+		}
+	}
+	uds_unlock_mutex(&cache->mutex);
+}
+
+/**********************************************************************/
+void invalidate_compressed_cache(struct compressed_cache *cache)
+{
+	uds_lock_mutex(&cache->mutex);
+	cache->epoch++;
+	remove_all_compressed_pages(cache);
+	uds_unlock_mutex(&cache->mutex);
+}
+
+/**********************************************************************/
+size_t get_compressed_cache_size(struct compressed_cache *cache)
+{
+	if (cache == NULL) {
+		return 0;
+	}
+
+	return (sizeof(*cache) + cache->budget +
+		cache->num_index_entries * sizeof(*cache->index));
+}
+
+/**********************************************************************/
+void get_compressed_cache_stats(struct compressed_cache *cache,
+				struct uds_compressed_cache_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (cache == NULL) {
+		return;
+	}
+
+	uds_lock_mutex(&cache->mutex);
+	stats->budget = cache->budget;
+	stats->bytes_used = cache->bytes_used;
+	stats->pages = cache->pages;
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->stores = cache->stores;
+	stats->rejects = cache->rejects;
+	stats->evictions = cache->evictions;
+	uds_unlock_mutex(&cache->mutex);
+}
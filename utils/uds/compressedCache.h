@@ -0,0 +1,138 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/compressedCache.h#1 $
+ */
+
+#ifndef COMPRESSED_CACHE_H
+#define COMPRESSED_CACHE_H
+
+#include "compiler.h"
+#include "geometry.h"
+#include "typeDefs.h"
+#include "uds.h"
+
+/**
+ * A compressed_cache is a second tier behind the page cache. When a page is
+ * evicted from the page cache, a deflated copy of it is kept here within a
+ * fixed memory budget, oldest copies being dropped first. A later read of the
+ * page inflates the copy instead of going to storage, and removes it, so a
+ * page is never held in both tiers.
+ *
+ * The cache has its own lock, so pages may be stored and fetched without
+ * holding the volume's read threads mutex. Since a chapter may be forgotten
+ * while an evicted page is being compressed, a store must present the epoch
+ * which was current when the page was evicted; any invalidation advances the
+ * epoch and causes such a stale store to be discarded.
+ **/
+struct compressed_cache;
+
+/**
+ * Make a compressed cache.
+ *
+ * @param geometry   The geometry of the volume
+ * @param budget     The number of bytes of compressed pages to hold
+ * @param cache_ptr  A pointer to hold the new cache
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check make_compressed_cache(const struct geometry *geometry,
+				       size_t budget,
+				       struct compressed_cache **cache_ptr);
+
+/**
+ * Free a compressed cache.
+ *
+ * @param cache  The cache to free, which may be NULL
+ **/
+void free_compressed_cache(struct compressed_cache *cache);
+
+/**
+ * Get the current invalidation epoch of a compressed cache.
+ *
+ * @param cache  The cache
+ *
+ * @return the epoch to pass to store_compressed_page()
+ **/
+uint64_t __must_check
+get_compressed_cache_epoch(struct compressed_cache *cache);
+
+/**
+ * Store a compressed copy of an evicted page. Pages which do not compress
+ * well enough to be worth keeping are not stored.
+ *
+ * @param cache          The cache
+ * @param physical_page  The physical page number of the page
+ * @param data           The page data
+ * @param epoch          The cache epoch at the time the page was evicted
+ **/
+void store_compressed_page(struct compressed_cache *cache,
+			   unsigned int physical_page,
+			   const byte *data,
+			   uint64_t epoch);
+
+/**
+ * Fetch a page from a compressed cache, removing it from the cache.
+ *
+ * @param cache          The cache
+ * @param physical_page  The physical page number of the page
+ * @param data           A buffer of a full page to hold the page data
+ *
+ * @return true if the page was found and expanded into the buffer
+ **/
+bool __must_check fetch_compressed_page(struct compressed_cache *cache,
+					unsigned int physical_page,
+					byte *data);
+
+/**
+ * Drop the compressed copies of a range of pages.
+ *
+ * @param cache       The cache
+ * @param first_page  The physical page number of the first page to drop
+ * @param page_count  The number of pages to drop
+ **/
+void invalidate_compressed_pages(struct compressed_cache *cache,
+				 unsigned int first_page,
+				 unsigned int page_count);
+
+/**
+ * Drop every page in a compressed cache.
+ *
+ * @param cache  The cache
+ **/
+void invalidate_compressed_cache(struct compressed_cache *cache);
+
+/**
+ * Get the amount of memory a compressed cache may use.
+ *
+ * @param cache  The cache, which may be NULL
+ *
+ * @return the budget plus the size of the page map, in bytes
+ **/
+size_t __must_check get_compressed_cache_size(struct compressed_cache *cache);
+
+/**
+ * Get the statistics for a compressed cache.
+ *
+ * @param cache  The cache, which may be NULL
+ * @param stats  The statistics structure to fill in
+ **/
+void get_compressed_cache_stats(struct compressed_cache *cache,
+				struct uds_compressed_cache_stats *stats);
+
+#endif /* COMPRESSED_CACHE_H */
@@ -111,6 +111,8 @@ void log_uds_configuration(struct uds_configuration *conf)
 		      conf->bytes_per_page);
 	uds_log_debug("  Sparse sample rate:         %10u",
 		      conf->sparse_sample_rate);
+	uds_log_debug("  Compressed record pages:    %10s",
+		      conf->compress_record_pages ? "yes" : "no");
 	uds_log_debug("  Nonce:                      %llu",
 		      (unsigned long long) conf->nonce);
 }
@@ -61,6 +61,8 @@ struct uds_configuration {
 	uint64_t remapped_virtual;
 	/** New physical chapter which remapped chapter was moved to */
 	uint64_t remapped_physical;
+	/** Whether record pages are compressed when they are written */
+	bool compress_record_pages;
 };
 
 /**
@@ -89,6 +91,34 @@ struct uds_configuration_6_02 {
 	uds_nonce_t nonce;
 };
 
+/**
+ * Data that are used for configuring an 8.02 index.
+ **/
+struct uds_configuration_8_02 {
+	/** Smaller (16), Small (64) or large (256) indices */
+	unsigned int record_pages_per_chapter;
+	/** Total number of chapters per volume */
+	unsigned int chapters_per_volume;
+	/** Number of sparse chapters per volume */
+	unsigned int sparse_chapters_per_volume;
+	/** Size of the page cache, in chapters */
+	unsigned int cache_chapters;
+	/** Frequency with which to checkpoint */
+	unsigned int checkpoint_frequency;
+	/** The volume index mean delta to use */
+	unsigned int volume_index_mean_delta;
+	/** Size of a page, used for both record pages and index pages */
+	unsigned int bytes_per_page;
+	/** Sampling rate for sparse indexing */
+	unsigned int sparse_sample_rate;
+	/** Index Owner's nonce */
+	uds_nonce_t nonce;
+	/** Virtual chapter remapped from physical chapter 0 */
+	uint64_t remapped_virtual;
+	/** New physical chapter which remapped chapter was moved to */
+	uint64_t remapped_physical;
+};
+
 struct index_location {
 	char *host;
 	char *port;
@@ -131,7 +161,8 @@ int __must_check read_config_contents(struct buffered_reader *reader,
  * Write the index configuration information to stable storage.  If
  * the superblock version is < 4 write the 6.02 version; otherwise
  * write the 8.02 version, indicating the configuration is for an
- * index that has been reduced by one chapter.
+ * index that has been reduced by one chapter, or the 8.03 version if
+ * the index compresses its record pages.
  * 
  * @param writer        A buffered writer.
  * @param config        The index configuration.
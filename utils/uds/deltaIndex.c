@@ -31,6 +31,7 @@
 #include "stringUtils.h"
 #include "typeDefs.h"
 #include "uds.h"
+#include "uds-threads.h"
 #include "zone.h"
 
 /*
@@ -139,9 +140,12 @@
  **/
 enum { MAGIC_SIZE = 8 };
 static const char MAGIC_DI_START[] = "DI-00002";
+// A packed save has the same header and list sizes, followed by the delta
+// list bits back to back instead of by delta_list_save_info records.
+static const char MAGIC_DI_PACKED[] = "DI-00003";
 
 struct di_header {
-	char magic[MAGIC_SIZE]; // MAGIC_DI_START
+	char magic[MAGIC_SIZE]; // MAGIC_DI_START or MAGIC_DI_PACKED
 	uint32_t zone_number;
 	uint32_t num_zones;
 	uint32_t first_list;
@@ -198,6 +202,12 @@ struct delta_page_header {
 
 enum { IMMUTABLE_HEADER_SIZE = 19 };
 
+// Searches keep checkpoints in a mutable delta list only when they would be
+// at least this many bits apart, so short lists are always searched from
+// their start or saved offset.
+
+enum { DELTA_LIST_SKIP_MIN_STRIDE = 512 };
+
 /**
  * Get the bit offset to the immutable delta list header
  *
@@ -266,20 +276,30 @@ static INLINE void decode_delta(struct delta_index_entry *delta_entry)
 		get_delta_entry_offset(delta_entry) + delta_entry->value_bits;
 	const byte *addr = memory + delta_offset / CHAR_BIT;
 	int offset = delta_offset % CHAR_BIT;
-	uint32_t data = get_unaligned_le32(addr) >> offset;
-	addr += sizeof(uint32_t);
+	/*
+	 * A single 64 bit load holds at least 56 bits of the entry, and the
+	 * POST_FIELD_GUARD_BYTES make it safe even for the last entry in
+	 * memory. That covers the min_bits field and the unary tail of all
+	 * but the largest deltas, so the tail is normally found with one bit
+	 * scan instead of a loop.
+	 */
+	uint64_t data = get_unaligned_le64(addr) >> offset;
 	key_bits = delta_zone->min_bits;
 	delta = data & ((1 << key_bits) - 1);
 	if (delta >= delta_zone->min_keys) {
 		data >>= key_bits;
-		if (data == 0) {
-			key_bits = sizeof(uint32_t) * CHAR_BIT - offset;
-			while ((data = get_unaligned_le32(addr)) == 0) {
+		if (likely(data != 0)) {
+			key_bits += __builtin_ctzll(data) + 1;
+		} else {
+			uint32_t word;
+			addr += sizeof(uint64_t);
+			key_bits = sizeof(uint64_t) * CHAR_BIT - offset;
+			while ((word = get_unaligned_le32(addr)) == 0) {
 				addr += sizeof(uint32_t);
 				key_bits += sizeof(uint32_t) * CHAR_BIT;
 			}
+			key_bits += ffs(word);
 		}
-		key_bits += ffs(data);
 		delta += (key_bits - delta_zone->min_bits - 1) *
 				delta_zone->incr_keys;
 	}
@@ -477,13 +497,17 @@ static int insert_bits(struct delta_index_entry *delta_entry, int size)
 		if (!before_flag) {
 			growing_index++;
 		}
-		result =
-			extend_delta_memory(delta_zone,
-					    growing_index,
-					    (size + CHAR_BIT - 1) / CHAR_BIT,
-					    true);
-		if (result != UDS_SUCCESS) {
-			return result;
+		if (!rebalance_nearby_delta_lists(delta_zone, growing_index,
+						  (size + CHAR_BIT - 1) /
+							CHAR_BIT)) {
+			result = extend_delta_memory(delta_zone,
+						     growing_index,
+						     (size + CHAR_BIT - 1) /
+							CHAR_BIT,
+						     true);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
 		}
 	}
 
@@ -558,6 +582,22 @@ static void set_collision(struct delta_index_entry *delta_entry)
 	delta_entry->entry_bits += COLLISION_BITS;
 }
 
+/**
+ * Get the number of bits used to encode a delta.
+ *
+ * @param delta_zone  The delta memory
+ * @param delta       The delta
+ *
+ * @return the number of bits in the encoded delta
+ **/
+static INLINE int get_delta_key_bits(const struct delta_memory *delta_zone,
+				     unsigned int delta)
+{
+	return delta_zone->min_bits +
+		((delta_zone->incr_keys - delta_zone->min_keys + delta) /
+			delta_zone->incr_keys);
+}
+
 /**
  * Set the delta in a delta index entry.
  *
@@ -566,13 +606,9 @@ static void set_collision(struct delta_index_entry *delta_entry)
  **/
 static void set_delta(struct delta_index_entry *delta_entry, unsigned int delta)
 {
-	const struct delta_memory *delta_zone = delta_entry->delta_zone;
-	int key_bits = delta_zone->min_bits +
-				((delta_zone->incr_keys -
-					delta_zone->min_keys + delta) /
-						delta_zone->incr_keys);
 	delta_entry->delta = delta;
-	delta_entry->entry_bits = delta_entry->value_bits + key_bits;
+	delta_entry->entry_bits = delta_entry->value_bits +
+		get_delta_key_bits(delta_entry->delta_zone, delta);
 }
 
 //**********************************************************************
@@ -584,7 +620,8 @@ int initialize_delta_index(struct delta_index *delta_index,
 			   unsigned int num_lists,
 			   unsigned int mean_delta,
 			   unsigned int num_payload_bits,
-			   size_t memory_size)
+			   size_t memory_size,
+			   size_t huge_page_size)
 {
 	int result;
 	unsigned int z;
@@ -637,7 +674,8 @@ int initialize_delta_index(struct delta_index *delta_index,
 						 first_list_in_zone,
 						 num_lists_in_zone,
 						 mean_delta,
-						 num_payload_bits);
+						 num_payload_bits,
+						 huge_page_size);
 		if (result != UDS_SUCCESS) {
 			uninitialize_delta_index(delta_index);
 			return result;
@@ -792,19 +830,14 @@ void empty_delta_index_zone(const struct delta_index *delta_index,
 }
 
 /**********************************************************************/
-int pack_delta_index_page(const struct delta_index *delta_index,
-			  uint64_t header_nonce,
-			  byte *memory,
-			  size_t mem_size,
-			  uint64_t virtual_chapter_number,
-			  unsigned int first_list,
-			  unsigned int *num_lists)
+int count_delta_index_page_lists(const struct delta_index *delta_index,
+				 size_t mem_size,
+				 unsigned int first_list,
+				 unsigned int *num_lists)
 {
-	const struct delta_memory *delta_zone;
-	struct delta_list *delta_lists;
-	unsigned int max_lists, n_lists = 0, offset, i;
+	const struct delta_list *delta_lists;
+	unsigned int max_lists, n_lists = 0;
 	int num_bits;
-	struct delta_page_header *header;
 	if (!delta_index->is_mutable) {
 		return uds_log_error_strerror(UDS_BAD_STATE,
 					      "Cannot pack an immutable index");
@@ -821,9 +854,8 @@ int pack_delta_index_page(const struct delta_index *delta_index,
 					      delta_index->num_lists);
 	}
 
-	delta_zone = &delta_index->delta_zones[0];
 	delta_lists =
-		&delta_zone->delta_lists[first_list + 1];
+		&delta_index->delta_zones[0].delta_lists[first_list + 1];
 	max_lists = delta_index->num_lists - first_list;
 
 	// Compute how many lists will fit on the page
@@ -851,6 +883,32 @@ int pack_delta_index_page(const struct delta_index *delta_index,
 		num_bits -= bits;
 	}
 	*num_lists = n_lists;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int pack_delta_index_page(const struct delta_index *delta_index,
+			  uint64_t header_nonce,
+			  byte *memory,
+			  size_t mem_size,
+			  uint64_t virtual_chapter_number,
+			  unsigned int first_list,
+			  unsigned int *num_lists)
+{
+	const struct delta_memory *delta_zone;
+	struct delta_list *delta_lists;
+	unsigned int n_lists, offset, i;
+	struct delta_page_header *header;
+	int result = count_delta_index_page_lists(delta_index, mem_size,
+						  first_list, &n_lists);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	*num_lists = n_lists;
+
+	delta_zone = &delta_index->delta_zones[0];
+	delta_lists =
+		&delta_zone->delta_lists[first_list + 1];
 
 	// Construct the page header
 	header = (struct delta_page_header *) memory;
@@ -860,23 +918,21 @@ int pack_delta_index_page(const struct delta_index *delta_index,
 	put_unaligned_le16(first_list, (byte *) &header->first_list);
 	put_unaligned_le16(n_lists, (byte *) &header->num_lists);
 
-	// Construct the delta list offset table, making sure that the memory
-	// page is large enough.
+	// Construct the delta list offset table and copy the delta list data
+	// onto the memory page in a single pass over the lists. The counting
+	// above has made sure that the memory page is large enough.
 	offset = get_immutable_header_offset(n_lists + 1);
 	set_immutable_start(memory, 0, offset);
-	for (i = 0; i < n_lists; i++) {
-		offset += get_delta_list_size(&delta_lists[i]);
-		set_immutable_start(memory, i + 1, offset);
-	}
-
-	// Copy the delta list data onto the memory page
 	for (i = 0; i < n_lists; i++) {
 		struct delta_list *delta_list = &delta_lists[i];
+		unsigned int size = get_delta_list_size(delta_list);
 		move_bits(delta_zone->memory,
 			  get_delta_list_start(delta_list),
 			  memory,
-			  get_immutable_start(memory, i),
-			  get_delta_list_size(delta_list));
+			  offset,
+			  size);
+		offset += size;
+		set_immutable_start(memory, i + 1, offset);
 	}
 
 	// Set all the bits in the guard bytes.  Do not use the bit field
@@ -967,6 +1023,219 @@ static int __must_check read_delta_index_header(struct buffered_reader *reader,
 	return result;
 }
 
+/**
+ * Check the magic number of a saved delta index zone.
+ *
+ * @param header     The header of the saved zone
+ * @param packed_ptr Set to whether the zone was saved packed
+ *
+ * @return true if the magic number is one that is understood
+ **/
+static bool check_delta_index_magic(const struct di_header *header,
+				    bool *packed_ptr)
+{
+	*packed_ptr = (memcmp(header->magic, MAGIC_DI_PACKED, MAGIC_SIZE) == 0);
+	return (*packed_ptr ||
+		(memcmp(header->magic, MAGIC_DI_START, MAGIC_SIZE) == 0));
+}
+
+/**
+ * Read the saved sizes of the delta lists of one zone.
+ *
+ * @param buffered_reader  The buffered reader positioned at the sizes
+ * @param sizes            The array to fill with the sizes
+ * @param num_lists        The number of delta lists in the zone
+ *
+ * @return UDS_SUCCESS on success, or an error code on failure
+ **/
+static int read_delta_list_sizes(struct buffered_reader *buffered_reader,
+				 uint16_t *sizes,
+				 unsigned int num_lists)
+{
+	unsigned int i;
+	for (i = 0; i < num_lists; i++) {
+		byte delta_list_size_data[sizeof(uint16_t)];
+		int result = read_from_buffered_reader(buffered_reader,
+						       delta_list_size_data,
+						       sizeof(delta_list_size_data));
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		sizes[i] = get_unaligned_le16(delta_list_size_data);
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Restore the delta lists of one zone of a packed save, one list at a time.
+ * This is needed when the lists of the saved zone are not the lists of a
+ * single zone of the delta index, or when the save is the base of an
+ * incremental save.
+ *
+ * @param delta_index      The delta index being restored
+ * @param buffered_reader  The buffered reader positioned at the packed bits
+ * @param first_list       The first delta list of the saved zone
+ * @param num_lists        The number of delta lists in the saved zone
+ * @param sizes            The saved sizes of the delta lists, or NULL if
+ *                         they are the sizes in the delta index
+ * @param base             Whether the save is the base of an incremental
+ *                         save
+ *
+ * @return UDS_SUCCESS on success, or an error code on failure
+ **/
+static int restore_packed_delta_lists(const struct delta_index *delta_index,
+				      struct buffered_reader *buffered_reader,
+				      unsigned int first_list,
+				      unsigned int num_lists,
+				      const uint16_t *sizes,
+				      bool base)
+{
+	uint64_t offset = 0, bytes_read = 0;
+	byte last_byte = 0;
+	unsigned int i;
+	byte *data;
+	int result = UDS_ALLOCATE(DELTA_LIST_MAX_BYTE_COUNT, byte,
+				  "delta list data", &data);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	for (i = 0; i < num_lists; i++) {
+		struct delta_list_save_info dlsi;
+		uint64_t first_byte;
+		unsigned int list_number = first_list + i;
+		unsigned int shared;
+		uint16_t bit_size;
+		if (sizes != NULL) {
+			bit_size = sizes[i];
+		} else {
+			unsigned int zone_number =
+				get_delta_index_zone(delta_index, list_number);
+			const struct delta_memory *delta_zone =
+				&delta_index->delta_zones[zone_number];
+			list_number -= delta_zone->first_list;
+			bit_size = get_delta_list_size(
+				&delta_zone->delta_lists[list_number + 1]);
+			list_number += delta_zone->first_list;
+		}
+		if (bit_size == 0) {
+			continue;
+		}
+
+		first_byte = offset / CHAR_BIT;
+		dlsi = (struct delta_list_save_info) {
+			.tag = delta_index->tag,
+			.bit_offset = offset % CHAR_BIT,
+			.byte_count = ((offset + bit_size + CHAR_BIT - 1) /
+				       CHAR_BIT - first_byte),
+			.index = list_number,
+		};
+		// Neighbouring lists share the byte where one ends and the
+		// next begins, and that byte is already at the end of the
+		// data for the previous list.
+		shared = (first_byte < bytes_read) ? 1 : 0;
+		data[0] = last_byte;
+		result = read_from_buffered_reader(buffered_reader,
+						   data + shared,
+						   dlsi.byte_count - shared);
+		if (result != UDS_SUCCESS) {
+			uds_log_warning_strerror(result,
+						 "failed to read packed delta list data");
+			break;
+		}
+		bytes_read = first_byte + dlsi.byte_count;
+		last_byte = data[dlsi.byte_count - 1];
+		offset += bit_size;
+
+		result = (base ?
+			  restore_base_delta_list_to_delta_index(delta_index,
+								 &dlsi, data) :
+			  restore_delta_list_to_delta_index(delta_index, &dlsi,
+							    data));
+		if (result != UDS_SUCCESS) {
+			break;
+		}
+	}
+	UDS_FREE(data);
+	return result;
+}
+
+/**
+ * A zone of a packed save being read on a thread of its own.
+ **/
+struct packed_zone_reader {
+	struct delta_memory *delta_zone;
+	struct buffered_reader *buffered_reader;
+	struct thread *thread;
+	int result;
+};
+
+/**********************************************************************/
+static void read_packed_zone_thread(void *arg)
+{
+	struct packed_zone_reader *zone_reader = arg;
+	zone_reader->result =
+		read_packed_delta_memory(zone_reader->delta_zone,
+					 zone_reader->buffered_reader);
+}
+
+/**
+ * Read the packed delta lists of every zone straight into the zone's
+ * memory.  The zones share no memory, so all the zones after the first
+ * are read in parallel on threads of their own.
+ *
+ * @param delta_index       The delta index being restored
+ * @param buffered_readers  The buffered reader for each zone
+ * @param packed            Whether each zone was saved packed
+ *
+ * @return UDS_SUCCESS on success, or an error code on failure
+ **/
+static int read_packed_delta_zones(const struct delta_index *delta_index,
+				   struct buffered_reader **buffered_readers,
+				   const bool *packed)
+{
+	struct packed_zone_reader *zone_readers;
+	unsigned int z;
+	int result = UDS_ALLOCATE(delta_index->num_zones,
+				  struct packed_zone_reader, __func__,
+				  &zone_readers);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	for (z = 0; z < delta_index->num_zones; z++) {
+		struct packed_zone_reader *zone_reader = &zone_readers[z];
+		zone_reader->delta_zone = &delta_index->delta_zones[z];
+		zone_reader->buffered_reader = buffered_readers[z];
+		if ((z == 0) || !packed[z]) {
+			continue;
+		}
+		if (uds_create_thread(read_packed_zone_thread, zone_reader,
+				      "readDI", &zone_reader->thread) !=
+		    UDS_SUCCESS) {
+			zone_reader->thread = NULL;
+		}
+	}
+
+	// A zone which could not get a thread is read here after the first.
+	for (z = 0; z < delta_index->num_zones; z++) {
+		struct packed_zone_reader *zone_reader = &zone_readers[z];
+		if (!packed[z]) {
+			continue;
+		}
+		if (zone_reader->thread != NULL) {
+			uds_join_threads(zone_reader->thread);
+		} else {
+			read_packed_zone_thread(zone_reader);
+		}
+		if (result == UDS_SUCCESS) {
+			result = zone_reader->result;
+		}
+	}
+	UDS_FREE(zone_readers);
+	return result;
+}
+
 /**********************************************************************/
 int start_restoring_delta_index(const struct delta_index *delta_index,
 				struct buffered_reader   **buffered_readers,
@@ -977,6 +1246,7 @@ int start_restoring_delta_index(const struct delta_index *delta_index,
 	unsigned int first_list[MAX_ZONES], num_lists[MAX_ZONES];
 	struct buffered_reader *reader[MAX_ZONES];
 	unsigned int z, list_next = 0;
+	bool packed[MAX_ZONES];
 	bool zone_flags[MAX_ZONES] = {
 		false,
 	};
@@ -999,13 +1269,14 @@ int start_restoring_delta_index(const struct delta_index *delta_index,
 	// Read the header from each file, and make sure we have a matching set
 	for (z = 0; z < num_zones; z++) {
 		struct di_header header;
+		bool is_packed;
 		int result =
 			read_delta_index_header(buffered_readers[z], &header);
 		if (result != UDS_SUCCESS) {
 			return uds_log_warning_strerror(result,
 							"failed to read delta index header");
 		}
-		if (memcmp(header.magic, MAGIC_DI_START, MAGIC_SIZE) != 0) {
+		if (!check_delta_index_magic(&header, &is_packed)) {
 			return uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
 							"delta index file has bad magic number");
 		}
@@ -1027,6 +1298,7 @@ int start_restoring_delta_index(const struct delta_index *delta_index,
 							header.zone_number);
 		}
 		reader[header.zone_number] = buffered_readers[z];
+		packed[header.zone_number] = is_packed;
 		first_list[header.zone_number] = header.first_list;
 		num_lists[header.zone_number] = header.num_lists;
 		zone_flags[header.zone_number] = true;
@@ -1095,6 +1367,26 @@ int start_restoring_delta_index(const struct delta_index *delta_index,
 			return result;
 		}
 	}
+
+	// The delta list data of a packed save follow the sizes.  When the
+	// zones are the same as when it was saved, each zone reads its lists
+	// straight into memory.
+	if (num_zones == delta_index->num_zones) {
+		return read_packed_delta_zones(delta_index, reader, packed);
+	}
+	for (z = 0; z < num_zones; z++) {
+		int result;
+		if (!packed[z]) {
+			continue;
+		}
+		result = restore_packed_delta_lists(delta_index, reader[z],
+						    first_list[z],
+						    num_lists[z], NULL,
+						    false);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
 	return UDS_SUCCESS;
 }
 
@@ -1134,6 +1426,134 @@ int restore_delta_list_to_delta_index(const struct delta_index *delta_index,
 				  dlsi, data);
 }
 
+/**********************************************************************/
+int start_restoring_delta_index_base(const struct delta_index *delta_index,
+				     struct buffered_reader **buffered_readers,
+				     int num_readers)
+{
+	unsigned int num_zones = num_readers;
+	unsigned int first_list[MAX_ZONES], num_lists[MAX_ZONES];
+	uint16_t *sizes[MAX_ZONES] = {
+		NULL,
+	};
+	unsigned int z, list_count = 0;
+	int result = UDS_SUCCESS;
+
+	if (num_readers <= 0) {
+		return uds_log_warning_strerror(UDS_INVALID_ARGUMENT,
+						"No delta index base files");
+	}
+	if (num_zones > MAX_ZONES) {
+		return uds_log_error_strerror(UDS_INVALID_ARGUMENT,
+					      "zone count %u must not exceed MAX_ZONES",
+					      num_zones);
+	}
+
+	for (z = 0; z < num_zones; z++) {
+		struct di_header header;
+		bool packed;
+		result = read_delta_index_header(buffered_readers[z], &header);
+		if (result != UDS_SUCCESS) {
+			uds_log_warning_strerror(result,
+						 "failed to read delta index base header");
+			break;
+		}
+		if (!check_delta_index_magic(&header, &packed)) {
+			result = uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
+							  "delta index base file has bad magic number");
+			break;
+		}
+		if (num_zones != header.num_zones) {
+			result = uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
+							  "delta index base files contain mismatched zone counts (%u,%u)",
+							  num_zones,
+							  header.num_zones);
+			break;
+		}
+		first_list[z] = header.first_list;
+		num_lists[z] = header.num_lists;
+		list_count += header.num_lists;
+		if (!packed) {
+			// The list sizes of the incremental save are the
+			// current ones.
+			result = skip_buffered_data(buffered_readers[z],
+						    header.num_lists *
+							    sizeof(uint16_t));
+			if (result != UDS_SUCCESS) {
+				uds_log_warning_strerror(result,
+							 "failed to read delta index base sizes");
+				break;
+			}
+			continue;
+		}
+
+		// The packed lists can only be found using the sizes of the
+		// lists when the base was saved.
+		result = UDS_ALLOCATE(header.num_lists, uint16_t,
+				      "delta index base sizes", &sizes[z]);
+		if (result == UDS_SUCCESS) {
+			result = read_delta_list_sizes(buffered_readers[z],
+						       sizes[z],
+						       header.num_lists);
+		}
+		if (result != UDS_SUCCESS) {
+			uds_log_warning_strerror(result,
+						 "failed to read delta index base sizes");
+			break;
+		}
+	}
+	if ((result == UDS_SUCCESS) && (list_count != delta_index->num_lists)) {
+		result = uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
+						  "delta index base files contain %u delta lists instead of %u delta lists",
+						  list_count,
+						  delta_index->num_lists);
+	}
+
+	if (result == UDS_SUCCESS) {
+		for (z = 0; z < delta_index->num_zones; z++) {
+			flag_restored_delta_lists_dirty(&delta_index->delta_zones[z]);
+		}
+	}
+	for (z = 0; (result == UDS_SUCCESS) && (z < num_zones); z++) {
+		if (sizes[z] != NULL) {
+			result = restore_packed_delta_lists(delta_index,
+							    buffered_readers[z],
+							    first_list[z],
+							    num_lists[z],
+							    sizes[z], true);
+		}
+	}
+	for (z = 0; z < num_zones; z++) {
+		UDS_FREE(sizes[z]);
+	}
+	return result;
+}
+
+/**********************************************************************/
+int
+restore_base_delta_list_to_delta_index(const struct delta_index *delta_index,
+				       const struct delta_list_save_info *dlsi,
+				       const byte data[DELTA_LIST_MAX_BYTE_COUNT])
+{
+	unsigned int zone_number;
+	// Make sure the data are intended for this delta list.  Do not
+	// log an error, as this may be valid data for another delta index.
+	if (dlsi->tag != delta_index->tag) {
+		return UDS_CORRUPT_COMPONENT;
+	}
+
+	if (dlsi->index >= delta_index->num_lists) {
+		return uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
+						"invalid delta list number %u of %u",
+						dlsi->index,
+						delta_index->num_lists);
+	}
+
+	zone_number = get_delta_index_zone(delta_index, dlsi->index);
+	return restore_base_delta_list(&delta_index->delta_zones[zone_number],
+				       dlsi, data);
+}
+
 /**********************************************************************/
 void abort_restoring_delta_index(const struct delta_index *delta_index)
 {
@@ -1147,7 +1567,7 @@ void abort_restoring_delta_index(const struct delta_index *delta_index)
 static int __must_check encode_delta_index_header(struct buffer *buffer,
 						  struct di_header *header)
 {
-	int result = put_bytes(buffer, MAGIC_SIZE, MAGIC_DI_START);
+	int result = put_bytes(buffer, MAGIC_SIZE, header->magic);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
@@ -1186,7 +1606,8 @@ static int __must_check encode_delta_index_header(struct buffer *buffer,
 /**********************************************************************/
 int start_saving_delta_index(const struct delta_index *delta_index,
 			     unsigned int zone_number,
-			     struct buffered_writer *buffered_writer)
+			     struct buffered_writer *buffered_writer,
+			     enum delta_save_mode mode)
 {
 	struct buffer *buffer;
 	int result;
@@ -1194,7 +1615,9 @@ int start_saving_delta_index(const struct delta_index *delta_index,
 	struct delta_memory *delta_zone =
 		&delta_index->delta_zones[zone_number];
 	struct di_header header;
-	memcpy(header.magic, MAGIC_DI_START, MAGIC_SIZE);
+	memcpy(header.magic,
+	       (mode == DELTA_SAVE_PACKED) ? MAGIC_DI_PACKED : MAGIC_DI_START,
+	       MAGIC_SIZE);
 	header.zone_number = zone_number;
 	header.num_zones = delta_index->num_zones;
 	header.first_list = delta_zone->first_list;
@@ -1235,7 +1658,14 @@ int start_saving_delta_index(const struct delta_index *delta_index,
 		}
 	}
 
-	start_saving_delta_memory(delta_zone, buffered_writer);
+	if (mode == DELTA_SAVE_PACKED) {
+		result = write_packed_delta_memory(delta_zone, buffered_writer);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
+
+	start_saving_delta_memory(delta_zone, buffered_writer, mode);
 	return UDS_SUCCESS;
 }
 
@@ -1317,6 +1747,120 @@ static void prefetch_delta_list(const struct delta_memory *delta_zone,
 	prefetch_range(addr, size, false);
 }
 
+/**********************************************************************/
+void prefetch_delta_index_list_header(const struct delta_index *delta_index,
+				      unsigned int list_number)
+{
+	const struct delta_memory *delta_zone =
+		&delta_index->delta_zones[get_delta_index_zone(delta_index,
+							       list_number)];
+	if (!delta_index->is_mutable) {
+		// The headers of immutable lists are packed into the page.
+		unsigned int offset =
+			get_immutable_header_offset(list_number -
+						    delta_zone->first_list);
+		prefetch_address(&delta_zone->memory[offset / CHAR_BIT],
+				 false);
+		return;
+	}
+	prefetch_address(&delta_zone->delta_lists[list_number -
+						  delta_zone->first_list + 1],
+			 false);
+}
+
+/**********************************************************************/
+void prefetch_delta_index_list(const struct delta_index *delta_index,
+			       unsigned int list_number)
+{
+	const struct delta_memory *delta_zone =
+		&delta_index->delta_zones[get_delta_index_zone(delta_index,
+							       list_number)];
+	if (!delta_index->is_mutable) {
+		unsigned int list = list_number - delta_zone->first_list;
+		unsigned int start =
+			get_immutable_start(delta_zone->memory, list);
+		unsigned int end =
+			get_immutable_start(delta_zone->memory, list + 1);
+		prefetch_range(&delta_zone->memory[start / CHAR_BIT],
+			       (end - start) / CHAR_BIT, false);
+		return;
+	}
+	prefetch_delta_list(delta_zone,
+			    &delta_zone->delta_lists[list_number -
+						     delta_zone->first_list +
+						     1]);
+}
+
+/**
+ * Get the search checkpoints for a delta list, if the delta index keeps them.
+ *
+ * @param delta_entry  A delta index entry positioned in the delta list
+ *
+ * @return the checkpoints for the list, or NULL
+ **/
+static INLINE struct delta_list_skips *
+get_delta_list_skips(const struct delta_index_entry *delta_entry)
+{
+	struct delta_list_skips *skips = delta_entry->delta_zone->skips;
+	return ((skips == NULL) ? NULL : &skips[delta_entry->list_number]);
+}
+
+/**
+ * Move a delta index search forward to the last checkpoint that precedes the
+ * key, if that is closer than where the search would otherwise start.
+ *
+ * @param skips        The checkpoints for the delta list
+ * @param key          The key being searched for
+ * @param delta_entry  The search, positioned where it would start
+ **/
+static void skip_ahead_in_delta_list(const struct delta_list_skips *skips,
+				     unsigned int key,
+				     struct delta_index_entry *delta_entry)
+{
+	unsigned int i;
+	for (i = 0; i < DELTA_LIST_SKIP_POINTS; i++) {
+		if ((skips->offsets[i] > delta_entry->offset) &&
+		    (key > skips->keys[i])) {
+			delta_entry->key = skips->keys[i];
+			delta_entry->offset = skips->offsets[i];
+		}
+	}
+}
+
+/**
+ * Adjust the checkpoints of a delta list after its size has changed.  Bits
+ * were added or removed at the given offset, and the entry that began at
+ * that offset is still the first entry there.  Checkpoints at or before the
+ * offset are unaffected. If bits were removed, any checkpoint within the
+ * removed entry or at the entry following it refers to a key that is gone
+ * and is dropped.  Every other later checkpoint moves with its entry.
+ *
+ * @param skips         The checkpoints for the delta list
+ * @param offset        The offset at which the list changed
+ * @param removed_bits  The size of the removed entry, or 0 for an insertion
+ * @param old_size      The size of the list before the change
+ * @param new_size      The size of the list after the change
+ **/
+static void adjust_delta_list_skips(struct delta_list_skips *skips,
+				    unsigned int offset,
+				    unsigned int removed_bits,
+				    unsigned int old_size,
+				    unsigned int new_size)
+{
+	unsigned int i;
+	for (i = 0; i < DELTA_LIST_SKIP_POINTS; i++) {
+		unsigned int skip_offset = skips->offsets[i];
+		if (skip_offset <= offset) {
+			continue;
+		}
+		if (skip_offset <= offset + removed_bits) {
+			skips->offsets[i] = 0;
+		} else {
+			skips->offsets[i] = skip_offset + new_size - old_size;
+		}
+	}
+}
+
 /**********************************************************************/
 int start_delta_index_search(const struct delta_index *delta_index,
 			     unsigned int list_number,
@@ -1393,6 +1937,10 @@ int start_delta_index_search(const struct delta_index *delta_index,
 	delta_entry->list_number = list_number;
 	delta_entry->list_overflow = false;
 	delta_entry->value_bits = delta_zone->value_bits;
+	if (!read_only && (delta_zone->skips != NULL)) {
+		skip_ahead_in_delta_list(&delta_zone->skips[list_number], key,
+					 delta_entry);
+	}
 	return UDS_SUCCESS;
 }
 
@@ -1453,16 +2001,50 @@ int get_delta_index_entry(const struct delta_index *delta_index,
 			  bool read_only,
 			  struct delta_index_entry *delta_entry)
 {
+	struct delta_list_skips *skips;
+	unsigned int stride = 0, slot = 0;
 	int result = start_delta_index_search(delta_index, list_number, key,
 					      read_only, delta_entry);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
+	skips = read_only ? NULL : get_delta_list_skips(delta_entry);
+	if (skips != NULL) {
+		// Only lists long enough to take a while to search get
+		// checkpoints.
+		stride = (get_delta_list_size(delta_entry->delta_list) /
+			  (DELTA_LIST_SKIP_POINTS + 1));
+		if (stride < DELTA_LIST_SKIP_MIN_STRIDE) {
+			skips = NULL;
+		} else {
+			slot = delta_entry->offset / stride;
+		}
+	}
 	do {
 		result = next_delta_index_entry(delta_entry);
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
+		if ((skips != NULL) && !delta_entry->at_end &&
+		    (delta_entry->offset >= (slot + 1) * stride) &&
+		    !delta_entry->is_collision) {
+			// Record the first entry past the start of each
+			// stride, unless the checkpoint there is still in
+			// the stride.
+			slot = delta_entry->offset / stride;
+			if (slot <= DELTA_LIST_SKIP_POINTS) {
+				unsigned int old_offset =
+					skips->offsets[slot - 1];
+				if ((old_offset < slot * stride) ||
+				    (old_offset >= (slot + 1) * stride)) {
+					skips->keys[slot - 1] =
+						(delta_entry->key -
+						 delta_entry->delta);
+					skips->offsets[slot - 1] =
+						delta_entry->offset;
+				}
+			}
+		}
 	} while (!delta_entry->at_end && (key > delta_entry->key));
 
 	result = remember_delta_index_offset(delta_entry);
@@ -1497,6 +2079,127 @@ int get_delta_index_entry(const struct delta_index *delta_index,
 	return UDS_SUCCESS;
 }
 
+/**
+ * Step to the next entry of a delta list which another thread may be
+ * changing, like next_delta_index_entry() but without logging.
+ *
+ * @param delta_entry  The delta index entry to advance
+ *
+ * @return UDS_SUCCESS, or UDS_CORRUPT_DATA if the list could not be decoded
+ **/
+static INLINE int
+peek_next_delta_index_entry(struct delta_index_entry *delta_entry)
+{
+	unsigned int size = get_delta_list_size(delta_entry->delta_list);
+	delta_entry->offset += delta_entry->entry_bits;
+	if (delta_entry->offset >= size) {
+		delta_entry->at_end = true;
+		delta_entry->delta = 0;
+		delta_entry->is_collision = false;
+		return ((delta_entry->offset == size) ?
+				UDS_SUCCESS : UDS_CORRUPT_DATA);
+	}
+
+	decode_delta(delta_entry);
+	return (((delta_entry->offset + delta_entry->entry_bits) <= size) ?
+			UDS_SUCCESS : UDS_CORRUPT_DATA);
+}
+
+/**********************************************************************/
+int peek_delta_index_entry(const struct delta_index *delta_index,
+			   unsigned int list_number,
+			   unsigned int key,
+			   const byte *name,
+			   struct delta_index_entry *delta_entry)
+{
+	const struct delta_list *shared_list;
+	struct delta_list *delta_list = &delta_entry->temp_delta_list;
+	struct delta_memory *delta_zone;
+	unsigned int zone_number;
+	int result;
+
+	if (!delta_index->is_mutable) {
+		// Immutable lists never change, and a read-only search of
+		// them only writes to the entry.
+		return get_delta_index_entry(delta_index, list_number, key,
+					     name, true, delta_entry);
+	}
+
+	if (list_number >= delta_index->num_lists) {
+		return UDS_CORRUPT_DATA;
+	}
+	zone_number = get_delta_index_zone(delta_index, list_number);
+	delta_zone = &delta_index->delta_zones[zone_number];
+	list_number -= delta_zone->first_list;
+	if (list_number >= delta_zone->num_lists) {
+		return UDS_CORRUPT_DATA;
+	}
+
+	/*
+	 * Search a copy of the list header, since the search must not write
+	 * the saved position back, and check that the copy at least lies
+	 * within the zone's memory so that a torn header can't send the
+	 * search astray.
+	 */
+	shared_list = &delta_zone->delta_lists[list_number + 1];
+	delta_list->start_offset = READ_ONCE(shared_list->start_offset);
+	delta_list->size = READ_ONCE(shared_list->size);
+	delta_list->save_key = READ_ONCE(shared_list->save_key);
+	delta_list->save_offset = READ_ONCE(shared_list->save_offset);
+	if (get_delta_list_end(delta_list) > (delta_zone->size * CHAR_BIT)) {
+		return UDS_CORRUPT_DATA;
+	}
+
+	if ((key > delta_list->save_key) &&
+	    (delta_list->save_offset <= delta_list->size)) {
+		delta_entry->key = delta_list->save_key;
+		delta_entry->offset = delta_list->save_offset;
+	} else {
+		delta_entry->key = 0;
+		delta_entry->offset = 0;
+	}
+	delta_entry->at_end = false;
+	delta_entry->delta_zone = delta_zone;
+	delta_entry->delta_list = delta_list;
+	delta_entry->entry_bits = 0;
+	delta_entry->is_collision = false;
+	delta_entry->list_number = list_number;
+	delta_entry->list_overflow = false;
+	delta_entry->value_bits = delta_zone->value_bits;
+
+	do {
+		result = peek_next_delta_index_entry(delta_entry);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	} while (!delta_entry->at_end && (key > delta_entry->key));
+
+	if (!delta_entry->at_end && (key == delta_entry->key)) {
+		struct delta_index_entry collision_entry = *delta_entry;
+		for (;;) {
+			byte collision_name[COLLISION_BYTES];
+			result = peek_next_delta_index_entry(&collision_entry);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+			if (collision_entry.at_end ||
+			    !collision_entry.is_collision) {
+				break;
+			}
+			get_bytes(delta_zone->memory,
+				  get_collision_offset(&collision_entry),
+				  collision_name,
+				  COLLISION_BYTES);
+			if (memcmp(collision_name, name, COLLISION_BYTES) ==
+			    0) {
+				*delta_entry = collision_entry;
+				break;
+			}
+		}
+	}
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int get_delta_entry_collision(const struct delta_index_entry *delta_entry,
 			      byte *name)
@@ -1555,6 +2258,8 @@ int set_delta_entry_value(const struct delta_index_entry *delta_entry,
 		  delta_entry->delta_zone->memory,
 		  get_delta_entry_offset(delta_entry),
 		  delta_entry->value_bits);
+	mark_delta_list_dirty(delta_entry->delta_zone,
+			      delta_entry->list_number);
 	return UDS_SUCCESS;
 }
 
@@ -1565,6 +2270,8 @@ int put_delta_index_entry(struct delta_index_entry *delta_entry,
 			  const byte *name)
 {
 	struct delta_memory *delta_zone;
+	struct delta_list_skips *skips;
+	unsigned int old_size;
 	int result = assert_mutable_entry(delta_entry);
 	if (result != UDS_SUCCESS) {
 		return result;
@@ -1580,6 +2287,7 @@ int put_delta_index_entry(struct delta_index_entry *delta_entry,
 		return UDS_DUPLICATE_NAME;
 	}
 
+	old_size = get_delta_list_size(delta_entry->delta_list);
 	if (delta_entry->offset < delta_entry->delta_list->save_offset) {
 		// The saved entry offset is after the new entry and will no
 		// longer be valid, so replace it with the insertion point.
@@ -1658,9 +2366,205 @@ int put_delta_index_entry(struct delta_index_entry *delta_entry,
 	}
 	encode_entry(delta_entry, value, name);
 
+	skips = get_delta_list_skips(delta_entry);
+	if (skips != NULL) {
+		adjust_delta_list_skips(skips, delta_entry->offset, 0, old_size,
+					get_delta_list_size(delta_entry->delta_list));
+	}
+
 	delta_zone = delta_entry->delta_zone;
 	delta_zone->record_count++;
 	delta_zone->collision_count += delta_entry->is_collision ? 1 : 0;
+	mark_delta_list_dirty(delta_zone, delta_entry->list_number);
+	return UDS_SUCCESS;
+}
+
+/**
+ * Append an entry to a delta list being rewritten by a batch merge.  The
+ * entry is a collision if it has the same key as the entry before it.
+ *
+ * @param writer  The last entry written, updated to describe the new entry
+ * @param key     The key field
+ * @param value   The value field
+ * @param name    The 256 bit full name, used if the entry is a collision
+ **/
+static void append_merged_entry(struct delta_index_entry *writer,
+				unsigned int key,
+				unsigned int value,
+				const byte *name)
+{
+	bool is_collision = (writer->entry_bits > 0) && (key == writer->key);
+	writer->offset += writer->entry_bits;
+	set_delta(writer, key - writer->key);
+	writer->key = key;
+	writer->is_collision = false;
+	if (is_collision) {
+		set_collision(writer);
+	}
+	encode_entry(writer, value, is_collision ? name : NULL);
+}
+
+/**
+ * Read the value and collision name of the delta list entry which a batch
+ * merge will take next, before the merge can write over it.
+ *
+ * @param tail   The next old entry of the delta list
+ * @param value  Set to the value of the entry
+ * @param name   Set to the name of the entry if it is a collision
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int read_merged_entry(const struct delta_index_entry *tail,
+			     unsigned int *value,
+			     byte *name)
+{
+	if (tail->at_end) {
+		return UDS_SUCCESS;
+	}
+	*value = get_delta_entry_value(tail);
+	return (tail->is_collision ? get_delta_entry_collision(tail, name) :
+				     UDS_SUCCESS);
+}
+
+/**********************************************************************/
+int put_delta_index_entries(const struct delta_index *delta_index,
+			    unsigned int list_number,
+			    const struct delta_index_insertion *insertions,
+			    unsigned int count)
+{
+	struct delta_index_entry tail, old_entry, writer;
+	struct delta_memory *delta_zone;
+	struct delta_list *delta_list;
+	struct delta_list_skips *skips;
+	byte old_name[COLLISION_BYTES];
+	unsigned int prev_key, key, merge_offset, old_size, merged_bits;
+	unsigned int old_value = 0, collisions = 0, i;
+	int result;
+
+	if (count == 0) {
+		return UDS_SUCCESS;
+	}
+	result = start_delta_index_search(delta_index, list_number,
+					  insertions[0].key, false, &tail);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	result = assert_mutable_entry(&tail);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// Find the first entry which the batch changes.  Everything before it
+	// stays where it is.
+	do {
+		result = next_delta_index_entry(&tail);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	} while (!tail.at_end && (tail.key < insertions[0].key));
+	merge_offset = tail.offset;
+	prev_key = tail.at_end ? tail.key : tail.key - tail.delta;
+	delta_list = tail.delta_list;
+	delta_zone = tail.delta_zone;
+	old_size = get_delta_list_size(delta_list);
+
+	// Size the merged remainder of the list, with the old entries of each
+	// key ahead of the new ones.
+	old_entry = tail;
+	key = prev_key;
+	merged_bits = 0;
+	i = 0;
+	while ((i < count) || !old_entry.at_end) {
+		unsigned int next_key;
+		bool is_collision;
+		if (!old_entry.at_end &&
+		    ((i == count) || (old_entry.key <= insertions[i].key))) {
+			next_key = old_entry.key;
+			is_collision = old_entry.is_collision;
+			result = next_delta_index_entry(&old_entry);
+		} else {
+			next_key = insertions[i].key;
+			is_collision = (merged_bits > 0) && (next_key == key);
+			result = ASSERT_WITH_ERROR_CODE(next_key >= key,
+							UDS_INVALID_ARGUMENT,
+							"delta index insertions are sorted");
+			if ((result == UDS_SUCCESS) && is_collision) {
+				result = ASSERT_WITH_ERROR_CODE(insertions[i].name != NULL,
+								UDS_INVALID_ARGUMENT,
+								"colliding insertion has a name");
+				collisions++;
+			}
+			i++;
+		}
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		merged_bits += (tail.value_bits +
+				get_delta_key_bits(delta_zone, next_key - key) +
+				(is_collision ? COLLISION_BITS : 0));
+		key = next_key;
+	}
+
+	// Grow the list once.  This leaves the merge point where it is and
+	// moves the old entries after it up by the added bits.
+	old_entry = tail;
+	result = insert_bits(&old_entry,
+			     merged_bits - (old_size - merge_offset));
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	tail.offset += merged_bits - (old_size - merge_offset);
+
+	/*
+	 * Rewrite the list from the merge point.  The merged entries can grow
+	 * past the start of the next old entry, but never past the end of it,
+	 * so each old entry is read as soon as the one before it is written.
+	 */
+	writer = tail;
+	writer.offset = merge_offset;
+	writer.key = prev_key;
+	writer.entry_bits = 0;
+	result = read_merged_entry(&tail, &old_value, old_name);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	i = 0;
+	while ((i < count) || !tail.at_end) {
+		if (tail.at_end ||
+		    ((i < count) && (insertions[i].key < tail.key))) {
+			append_merged_entry(&writer, insertions[i].key,
+					    insertions[i].value,
+					    insertions[i].name);
+			i++;
+			continue;
+		}
+		append_merged_entry(&writer, tail.key, old_value, old_name);
+		result = next_delta_index_entry(&tail);
+		if (result == UDS_SUCCESS) {
+			result = read_merged_entry(&tail, &old_value,
+						   old_name);
+		}
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
+
+	if (delta_list->save_offset > merge_offset) {
+		// The saved entry offset may no longer be at an entry, so
+		// replace it with the merge point.
+		delta_list->save_key = prev_key;
+		delta_list->save_offset = merge_offset;
+	}
+	skips = get_delta_list_skips(&writer);
+	if (skips != NULL) {
+		adjust_delta_list_skips(skips, merge_offset,
+					old_size - merge_offset, old_size,
+					get_delta_list_size(delta_list));
+	}
+
+	delta_zone->record_count += count;
+	delta_zone->collision_count += collisions;
+	mark_delta_list_dirty(delta_zone, writer.list_number);
 	return UDS_SUCCESS;
 }
 
@@ -1670,6 +2574,8 @@ int remove_delta_index_entry(struct delta_index_entry *delta_entry)
 	struct delta_index_entry next_entry;
 	struct delta_memory *delta_zone;
 	struct delta_list *delta_list;
+	struct delta_list_skips *skips;
+	unsigned int old_size, removed_bits;
 	int result = assert_mutable_entry(delta_entry);
 	if (result != UDS_SUCCESS) {
 		return result;
@@ -1682,6 +2588,8 @@ int remove_delta_index_entry(struct delta_index_entry *delta_entry)
 	}
 
 	delta_zone = delta_entry->delta_zone;
+	old_size = get_delta_list_size(delta_entry->delta_list);
+	removed_bits = delta_entry->entry_bits;
 
 	if (delta_entry->is_collision) {
 		// This is a collision entry, so just remove it
@@ -1712,9 +2620,16 @@ int remove_delta_index_entry(struct delta_index_entry *delta_entry)
 	}
 	delta_zone->record_count--;
 	delta_zone->discard_count++;
+	mark_delta_list_dirty(delta_zone, delta_entry->list_number);
 	*delta_entry = next_entry;
 
 	delta_list = delta_entry->delta_list;
+	skips = get_delta_list_skips(delta_entry);
+	if (skips != NULL) {
+		adjust_delta_list_skips(skips, delta_entry->offset,
+					removed_bits, old_size,
+					get_delta_list_size(delta_list));
+	}
 	if (delta_entry->offset < delta_list->save_offset) {
 		// The saved entry offset is after the entry we just removed
 		// and it will no longer be valid.  We must force the next
@@ -1783,6 +2698,39 @@ get_delta_index_dlist_bits_allocated(const struct delta_index *delta_index)
 	return byte_count * CHAR_BIT;
 }
 
+/**********************************************************************/
+void compact_delta_index_zone(const struct delta_index *delta_index,
+			      unsigned int zone_number)
+{
+	struct delta_memory *delta_zone =
+		&delta_index->delta_zones[zone_number];
+	if (!delta_index->is_mutable) {
+		return;
+	}
+
+	if (delta_zone->compaction_cursor == 0) {
+		delta_zone->compaction_start_bits =
+			get_delta_index_zone_dlist_bits_used(delta_index,
+							     zone_number);
+	}
+	if (!compact_delta_memory(delta_zone)) {
+		return;
+	}
+
+	if (delta_zone->compaction_windows > 0) {
+		uds_log_ratelimit(uds_log_info,
+				  "delta index %c zone %u:  compacted %u windows of delta lists, %llu of %llu bits used before and %llu after",
+				  delta_index->tag,
+				  zone_number,
+				  delta_zone->compaction_windows,
+				  (unsigned long long) delta_zone->compaction_start_bits,
+				  (unsigned long long) delta_zone->size * CHAR_BIT,
+				  (unsigned long long) get_delta_index_zone_dlist_bits_used(delta_index,
+											    zone_number));
+	}
+	delta_zone->compaction_windows = 0;
+}
+
 /**********************************************************************/
 void get_delta_index_stats(const struct delta_index *delta_index,
 			   struct delta_index_stats *stats)
@@ -1796,13 +2744,32 @@ void get_delta_index_stats(const struct delta_index *delta_index,
 			&delta_index->delta_zones[z];
 		stats->memory_allocated +=
 			get_delta_memory_allocated(delta_zone);
+		if (delta_zone->huge_page_size > 0) {
+			stats->huge_page_memory += delta_zone->size;
+		}
 		stats->rebalance_time += delta_zone->rebalance_time;
 		stats->rebalance_count += delta_zone->rebalance_count;
+		stats->local_rebalance_time +=
+			delta_zone->local_rebalance_time;
+		stats->local_rebalance_count +=
+			delta_zone->local_rebalance_count;
+		stats->compaction_time += delta_zone->compaction_time;
+		stats->compaction_count += delta_zone->compaction_count;
 		stats->record_count += delta_zone->record_count;
 		stats->collision_count += delta_zone->collision_count;
 		stats->discard_count += delta_zone->discard_count;
 		stats->overflow_count += delta_zone->overflow_count;
 		stats->num_lists += delta_zone->num_lists;
+		if (delta_index->is_mutable) {
+			unsigned int i;
+			for (i = 1; i <= delta_zone->num_lists; i++) {
+				unsigned int size = get_delta_list_size(
+					&delta_zone->delta_lists[i]);
+				stats->list_sizes[(size == 0) ?
+						  0 :
+						  32 - __builtin_clz(size)]++;
+			}
+		}
 	}
 }
 
@@ -113,15 +113,41 @@ struct delta_index_entry {
 					    // immutable indices
 };
 
+/*
+ * A delta_index_insertion describes one new entry in a batch of entries
+ * being added to a delta list by put_delta_index_entries().
+ */
+struct delta_index_insertion {
+	unsigned int key;    // The key field
+	unsigned int value;  // The value field
+	const byte *name;    // The 256 bit full name, stored only if the
+			     // entry turns out to be a collision
+};
+
+enum {
+	// Delta list sizes are histogrammed by the number of significant bits
+	// in their size, so there is one bucket for empty lists and one for
+	// each bit of the 16 bit list size.
+	DELTA_LIST_SIZE_BUCKETS = 17,
+};
+
 struct delta_index_stats {
 	size_t memory_allocated;    // Number of bytes allocated
+	size_t huge_page_memory;    // Number of bytes backed by huge pages
 	ktime_t rebalance_time;	    // Nanoseconds spent rebalancing
 	int rebalance_count;        // Number of memory rebalances
+	ktime_t local_rebalance_time; // Nanoseconds rebalancing nearby lists
+	int local_rebalance_count;  // Number of nearby list rebalances
+	ktime_t compaction_time;    // Nanoseconds spent compacting lists
+	int compaction_count;       // Number of windows of lists compacted
 	long record_count;          // The number of records in the index
 	long collision_count;       // The number of collision records
 	long discard_count;         // The number of records removed
 	long overflow_count;        // The number of UDS_OVERFLOWs detected
 	unsigned int num_lists;     // The number of delta lists
+	// The number of delta lists whose size in bits is in
+	// [2^(b-1), 2^b) for each bucket b, with empty lists in bucket 0
+	long list_sizes[DELTA_LIST_SIZE_BUCKETS];
 };
 
 /**
@@ -133,6 +159,8 @@ struct delta_index_stats {
  * @param mean_delta        The mean delta value
  * @param num_payload_bits  The number of bits in the payload or value
  * @param memory_size       The number of bytes in memory for the index
+ * @param huge_page_size    The size of huge pages to back the index memory
+ *                          with, or 0 to use ordinary allocations
  *
  * @return error code or UDS_SUCCESS
  **/
@@ -141,7 +169,8 @@ int __must_check initialize_delta_index(struct delta_index *delta_index,
 					unsigned int num_lists,
 					unsigned int mean_delta,
 					unsigned int num_payload_bits,
-					size_t memory_size);
+					size_t memory_size,
+					size_t huge_page_size);
 
 /**
  * Initialize an immutable delta index page.
@@ -186,6 +215,24 @@ void empty_delta_index(const struct delta_index *delta_index);
 void empty_delta_index_zone(const struct delta_index *delta_index,
 			    unsigned int zone_number);
 
+/**
+ * Count how many delta lists from a mutable delta index, starting with a
+ * specified list index, will fit on an immutable delta index page. This uses
+ * only the list sizes the delta index already tracks, so no bits are copied.
+ *
+ * @param delta_index  The delta index being converted
+ * @param mem_size     The size of the memory page
+ * @param first_list   The first delta list number to be copied
+ * @param num_lists    The number of delta lists that will fit
+ *
+ * @return error code or UDS_SUCCESS
+ **/
+int __must_check
+count_delta_index_page_lists(const struct delta_index *delta_index,
+			     size_t mem_size,
+			     unsigned int first_list,
+			     unsigned int *num_lists);
+
 /**
  * Pack delta lists from a mutable delta index into an immutable delta index
  * page.  A range of delta lists (starting with a specified list index) is
@@ -221,7 +268,9 @@ int __must_check pack_delta_index_page(const struct delta_index *delta_index,
 void set_delta_index_tag(struct delta_index *delta_index, byte tag);
 
 /**
- * Start restoring a delta index from an input stream.
+ * Start restoring a delta index from an input stream. The lists of zones
+ * saved packed are restored here; the rest are restored one at a time with
+ * restore_delta_list_to_delta_index().
  *
  * @param delta_index       The delta index to read into
  * @param buffered_readers  The buffered readers to read the delta index from
@@ -258,6 +307,40 @@ restore_delta_list_to_delta_index(const struct delta_index *delta_index,
 				  const struct delta_list_save_info *dlsi,
 				  const byte data[DELTA_LIST_MAX_BYTE_COUNT]);
 
+/**
+ * Start restoring the base of an incremental save of a delta index. The
+ * headers and list sizes of the base are read and skipped, since the list
+ * sizes come from the incremental save which has already been started with
+ * start_restoring_delta_index(). The lists already restored from the
+ * incremental save are noted as changed since the base. If the base is a
+ * packed save, the rest of its lists are restored here.
+ *
+ * @param delta_index       The delta index being restored
+ * @param buffered_readers  The buffered readers to read the base from
+ * @param num_readers       The number of buffered readers
+ *
+ * @return UDS_SUCCESS on success, or an error code on failure
+ **/
+int __must_check
+start_restoring_delta_index_base(const struct delta_index *delta_index,
+				 struct buffered_reader **buffered_readers,
+				 int num_readers);
+
+/**
+ * Restore a delta list saved in the base of an incremental save. Lists
+ * which were restored from the incremental save are left alone.
+ *
+ * @param delta_index  The delta index
+ * @param dlsi         The delta_list_save_info describing the delta list
+ * @param data         The saved delta list bit stream
+ *
+ * @return error code or UDS_SUCCESS
+ **/
+int __must_check
+restore_base_delta_list_to_delta_index(const struct delta_index *delta_index,
+				       const struct delta_list_save_info *dlsi,
+				       const byte data[DELTA_LIST_MAX_BYTE_COUNT]);
+
 /**
  * Abort restoring a delta index from an input stream.
  *
@@ -271,13 +354,15 @@ void abort_restoring_delta_index(const struct delta_index *delta_index);
  * @param delta_index      The delta index
  * @param zone_number      The zone number
  * @param buffered_writer  The index state component being written
+ * @param mode             The kind of save being made
  *
  * @return UDS_SUCCESS on success, or an error code on failure
  **/
 int __must_check
 start_saving_delta_index(const struct delta_index *delta_index,
 			 unsigned int zone_number,
-			 struct buffered_writer *buffered_writer);
+			 struct buffered_writer *buffered_writer,
+			 enum delta_save_mode mode);
 
 /**
  * Have all the data been written while saving a delta index zone to an
@@ -337,6 +422,28 @@ size_t __must_check compute_delta_index_save_bytes(unsigned int num_lists,
  **/
 int __must_check validate_delta_index(const struct delta_index *delta_index);
 
+/**
+ * Prefetch the header of a delta list.  This is the first half of a batched
+ * lookup: issue it for every list in the batch, then prefetch the lists
+ * themselves with prefetch_delta_index_list(), and only then search them.
+ * Both mutable indexes and immutable index pages may be prefetched.
+ *
+ * @param delta_index  The delta index
+ * @param list_number  The delta list number
+ **/
+void prefetch_delta_index_list_header(const struct delta_index *delta_index,
+				      unsigned int list_number);
+
+/**
+ * Prefetch the bits of a delta list.  This reads the delta list header, so
+ * it should follow prefetch_delta_index_list_header() for the same list.
+ *
+ * @param delta_index  The delta index
+ * @param list_number  The delta list number
+ **/
+void prefetch_delta_index_list(const struct delta_index *delta_index,
+			       unsigned int list_number);
+
 /**
  * Prepare to search for an entry in the specified delta list.
  *
@@ -403,6 +510,26 @@ int __must_check get_delta_index_entry(const struct delta_index *delta_index,
 				       bool read_only,
 				       struct delta_index_entry *delta_entry);
 
+/**
+ * Find a delta index entry without changing the delta index, while another
+ * thread may be changing the delta list. Nothing is logged for lists which
+ * cannot be decoded, and the caller must discard the result, whatever it
+ * is, unless it can show that the list did not change during the search.
+ *
+ * @param delta_index  The delta index to search
+ * @param list_number  The delta list number
+ * @param key          The key field being looked for
+ * @param name         The 256 bit full name
+ * @param delta_entry  Updated to describe the entry being looked for
+ *
+ * @return UDS_SUCCESS, or UDS_CORRUPT_DATA if the list could not be decoded
+ **/
+int __must_check peek_delta_index_entry(const struct delta_index *delta_index,
+					unsigned int list_number,
+					unsigned int key,
+					const byte *name,
+					struct delta_index_entry *delta_entry);
+
 /**
  * Get the full name from a collision delta_index_entry
  *
@@ -496,6 +623,27 @@ int __must_check put_delta_index_entry(struct delta_index_entry *delta_entry,
 				       unsigned int value,
 				       const byte *name);
 
+/**
+ * Add a batch of new entries to one delta list. The list is grown once and
+ * the part of it following the first new key is rewritten in a single merge
+ * pass, instead of shifting the list once for every entry.  A new entry
+ * whose key matches an entry already in the list, or an earlier entry of
+ * the batch, is added as a collision entry following it.
+ *
+ * @param delta_index  The delta index
+ * @param list_number  The delta list number
+ * @param insertions   The entries to add, sorted by key
+ * @param count        The number of entries to add
+ *
+ * @return UDS_SUCCESS, UDS_OVERFLOW if the list would be too large (in which
+ *         case the list is unchanged), or an error code
+ **/
+int __must_check
+put_delta_index_entries(const struct delta_index *delta_index,
+			unsigned int list_number,
+			const struct delta_index_insertion *insertions,
+			unsigned int count);
+
 /**
  * Remove an existing delta index entry, and advance to the next entry in
  * the delta list.
@@ -579,6 +727,19 @@ get_delta_index_dlist_bits_used(const struct delta_index *delta_index);
 uint64_t __must_check
 get_delta_index_dlist_bits_allocated(const struct delta_index *delta_index);
 
+/**
+ * Compact one slice of a zone of a mutable delta index, spreading out the
+ * free space between a window of its delta lists if it has become uneven.
+ * When a sweep of the zone which moved any lists finishes, the bits in use
+ * before and after the sweep are logged.  This must be called by the thread
+ * which owns the zone.
+ *
+ * @param delta_index  The delta index
+ * @param zone_number  The zone number
+ **/
+void compact_delta_index_zone(const struct delta_index *delta_index,
+			      unsigned int zone_number);
+
 /**
  * Get the delta index statistics.
  *
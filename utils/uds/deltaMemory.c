@@ -43,6 +43,15 @@
 // This is the number of guard bits that are needed in the tail guard list
 enum { GUARD_BITS = POST_FIELD_GUARD_BYTES * CHAR_BIT };
 
+// These bound the window of delta lists moved by a nearby rebalance
+enum {
+	LOCAL_REBALANCE_MIN_LISTS = 16,
+	LOCAL_REBALANCE_MAX_LISTS = 1024,
+};
+
+// This is the number of delta lists examined by each slice of compaction
+enum { COMPACTION_WINDOW_LISTS = 64 };
+
 /**
  * Get the offset of the first byte that a delta list bit stream resides in
  *
@@ -85,6 +94,18 @@ static INLINE size_t get_size_of_delta_lists(unsigned int num_lists)
 	return (num_lists + 2) * sizeof(struct delta_list);
 }
 
+/**
+ * Get the number of bytes in the delta list search checkpoints.
+ *
+ * @param num_lists  The number of delta lists
+ *
+ * @return the number of bytes in the delta list search checkpoints
+ **/
+static INLINE size_t get_size_of_skips(unsigned int num_lists)
+{
+	return num_lists * sizeof(struct delta_list_skips);
+}
+
 /**
  * Get the size of the flags array (in bytes)
  *
@@ -146,6 +167,28 @@ static void flag_non_empty_delta_lists(struct delta_memory *delta_memory)
 	}
 }
 
+/**********************************************************************/
+
+/**
+ * Set the transfer flags for delta lists that are not empty and have
+ * changed since the last full save, and count how many there are.
+ *
+ * @param delta_memory  The delta memory
+ **/
+static void flag_dirty_delta_lists(struct delta_memory *delta_memory)
+{
+	unsigned int i;
+	clear_transfer_flags(delta_memory);
+	for (i = 0; i < delta_memory->num_lists; i++) {
+		if ((get_field(delta_memory->dirty, i, 1) != 0) &&
+		    (get_delta_list_size(&delta_memory->delta_lists[i + 1]) >
+		     0)) {
+			set_one(delta_memory->flags, i, 1);
+			delta_memory->num_transfers++;
+		}
+	}
+}
+
 /**********************************************************************/
 void empty_delta_lists(struct delta_memory *delta_memory)
 {
@@ -155,6 +198,8 @@ void empty_delta_lists(struct delta_memory *delta_memory)
 	struct delta_list *delta_lists = delta_memory->delta_lists;
 	memset(delta_lists, 0,
 	       get_size_of_delta_lists(delta_memory->num_lists));
+	memset(delta_memory->skips, 0,
+	       get_size_of_skips(delta_memory->num_lists));
 
 	/*
 	 * Initialize delta lists to be empty. We keep 2 extra delta list
@@ -267,13 +312,220 @@ static void rebalance_delta_memory(const struct delta_memory *delta_memory,
 	}
 }
 
+/**********************************************************************/
+bool rebalance_nearby_delta_lists(struct delta_memory *delta_memory,
+				  unsigned int growing_index,
+				  size_t growing_size)
+{
+	struct delta_list *delta_lists = delta_memory->delta_lists;
+	ktime_t start_time = current_time_ns(CLOCK_MONOTONIC);
+	unsigned int width;
+	for (width = LOCAL_REBALANCE_MIN_LISTS;
+	     (width <= LOCAL_REBALANCE_MAX_LISTS) &&
+		(width < delta_memory->num_lists);
+	     width *= 2) {
+		uint64_t base, limit, offset;
+		size_t used_space, spacing;
+		unsigned int i;
+		// Center the window of lists on the gap that needs to grow.
+		// The gap before growing_index is always in the window.
+		unsigned int first = ((growing_index > width / 2) ?
+				      growing_index - width / 2 : 1);
+		unsigned int last = min(first + width - 1,
+					delta_memory->num_lists);
+
+		// Find the bytes between the lists just outside the window,
+		// and the space that the lists in the window need.
+		base = (get_delta_list_byte_start(&delta_lists[first - 1]) +
+			get_delta_list_byte_size(&delta_lists[first - 1]));
+		limit = get_delta_list_byte_start(&delta_lists[last + 1]);
+		used_space = growing_size;
+		for (i = first; i <= last; i++) {
+			used_space += get_delta_list_byte_size(&delta_lists[i]);
+		}
+		if (limit < base + used_space) {
+			continue;
+		}
+
+		// Only settle for this window if every gap in it will still
+		// have room for another growth of the same size.
+		spacing = (limit - base - used_space) / (last - first + 2);
+		if (spacing < growing_size) {
+			continue;
+		}
+
+		offset = base + spacing;
+		for (i = first; i <= last; i++) {
+			if (i == growing_index) {
+				offset += growing_size;
+			}
+			delta_memory->temp_offsets[i] =
+				(offset * CHAR_BIT +
+				 get_delta_list_start(&delta_lists[i]) %
+					CHAR_BIT);
+			offset += get_delta_list_byte_size(&delta_lists[i]) +
+				  spacing;
+		}
+		rebalance_delta_memory(delta_memory, first, last);
+		delta_memory->local_rebalance_count++;
+		delta_memory->local_rebalance_time +=
+			ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+				  start_time);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Compute the free space that a compaction sweep plans to leave before a
+ * delta list, sharing out the free space evenly without any rounding left
+ * over.
+ *
+ * @param delta_memory  The delta memory being compacted
+ * @param list_number   The list, or num_lists + 1 for the final gap
+ *
+ * @return the planned free bytes before the list
+ **/
+static size_t get_compaction_gap(const struct delta_memory *delta_memory,
+				 unsigned int list_number)
+{
+	uint64_t free_space = delta_memory->compaction_free_space;
+	uint64_t gaps = delta_memory->num_lists + 1;
+	return ((free_space * list_number / gaps) -
+		(free_space * (list_number - 1) / gaps));
+}
+
+/**********************************************************************/
+bool compact_delta_memory(struct delta_memory *delta_memory)
+{
+	struct delta_list *delta_lists = delta_memory->delta_lists;
+	ktime_t start_time = current_time_ns(CLOCK_MONOTONIC);
+	unsigned int num_lists = delta_memory->num_lists;
+	unsigned int first, last, i;
+	uint64_t base, limit, offset;
+	size_t used_space, planned_space, tolerance;
+	bool backward = delta_memory->compaction_backward;
+	bool move = false;
+
+	if (delta_memory->compaction_cursor == 0) {
+		// Start a sweep by measuring the free space to share out.
+		used_space = 0;
+		for (i = 1; i <= num_lists; i++) {
+			used_space += get_delta_list_byte_size(&delta_lists[i]);
+		}
+		delta_memory->compaction_free_space =
+			(get_delta_list_byte_start(&delta_lists[num_lists + 1]) -
+			 get_delta_list_byte_size(&delta_lists[0]) -
+			 used_space);
+		delta_memory->compaction_cursor = backward ? num_lists : 1;
+	}
+	if (backward) {
+		last = delta_memory->compaction_cursor;
+		first = ((last > COMPACTION_WINDOW_LISTS) ?
+			 last - COMPACTION_WINDOW_LISTS + 1 :
+			 1);
+	} else {
+		first = delta_memory->compaction_cursor;
+		last = min(first + COMPACTION_WINDOW_LISTS - 1, num_lists);
+	}
+	// A gap with under a quarter of its share is short of space.
+	tolerance =
+		delta_memory->compaction_free_space / (4 * (num_lists + 1));
+
+	// Find the bytes between the lists just outside the window and the
+	// space that the lists in the window need.
+	base = (get_delta_list_byte_start(&delta_lists[first - 1]) +
+		get_delta_list_byte_size(&delta_lists[first - 1]));
+	limit = get_delta_list_byte_start(&delta_lists[last + 1]);
+	used_space = 0;
+	planned_space = 0;
+	for (i = first; i <= last + 1; i++) {
+		if (i <= last) {
+			used_space +=
+				get_delta_list_byte_size(&delta_lists[i]);
+		}
+		planned_space += get_compaction_gap(delta_memory, i);
+	}
+
+	/*
+	 * Leave the planned space before every list in the window if there
+	 * is room, putting any more at the end of the window that the sweep
+	 * is moving towards so that it is carried along to the lists which
+	 * are short of it. Otherwise spread the free space evenly.
+	 */
+	if ((tolerance > 0) && (limit >= base + used_space)) {
+		size_t free_space = limit - base - used_space;
+		unsigned int gaps = last - first + 2;
+		bool planned = (free_space >= planned_space);
+		// Only move the lists if one of them is short of space, or if
+		// the window has a lot of space to pass along.
+		move = (free_space >= planned_space + planned_space / 2);
+		offset = ((backward && planned) ?
+			  base + free_space - planned_space :
+			  base);
+		for (i = first; i <= last + 1; i++) {
+			uint64_t end =
+				(get_delta_list_byte_start(&delta_lists[i - 1]) +
+				 get_delta_list_byte_size(&delta_lists[i - 1]));
+			move |= (get_delta_list_byte_start(&delta_lists[i]) <
+				 end + tolerance);
+		}
+		for (i = first; i <= last; i++) {
+			offset += (planned ?
+				   get_compaction_gap(delta_memory, i) :
+				   free_space / gaps);
+			delta_memory->temp_offsets[i] =
+				(offset * CHAR_BIT +
+				 get_delta_list_start(&delta_lists[i]) %
+					CHAR_BIT);
+			offset += get_delta_list_byte_size(&delta_lists[i]);
+		}
+	}
+	if (move) {
+		rebalance_delta_memory(delta_memory, first, last);
+		delta_memory->compaction_count++;
+		delta_memory->compaction_windows++;
+		delta_memory->compaction_time +=
+			ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+				  start_time);
+	}
+
+	if (backward ? (first == 1) : (last == num_lists)) {
+		// Sweep back the other way next time.
+		delta_memory->compaction_cursor = 0;
+		delta_memory->compaction_backward = !backward;
+		return true;
+	}
+	delta_memory->compaction_cursor = backward ? first - 1 : last + 1;
+	return false;
+}
+
+/**
+ * Free the memory array of a delta memory structure.
+ *
+ * @param delta_memory  The delta memory
+ **/
+static void free_delta_list_memory(struct delta_memory *delta_memory)
+{
+	if (delta_memory->borrowed) {
+		// Leave the memory to its owner.
+	} else if (delta_memory->huge_page_size > 0) {
+		uds_free_huge_memory(delta_memory->memory, delta_memory->size,
+				     delta_memory->huge_page_size);
+	} else {
+		UDS_FREE(delta_memory->memory);
+	}
+	delta_memory->memory = NULL;
+}
+
 /**********************************************************************/
 int initialize_delta_memory(struct delta_memory *delta_memory,
 			    size_t size,
 			    unsigned int first_list,
 			    unsigned int num_lists,
 			    unsigned int mean_delta,
-			    unsigned int num_payload_bits)
+			    unsigned int num_payload_bits,
+			    size_t huge_page_size)
 {
 	byte *memory = NULL, *flags = NULL;
 	uint64_t *temp_offsets = NULL;
@@ -282,20 +534,29 @@ int initialize_delta_memory(struct delta_memory *delta_memory,
 		return uds_log_warning_strerror(UDS_INVALID_ARGUMENT,
 					    	"cannot initialize delta memory with 0 delta lists");
 	}
-	result = UDS_ALLOCATE(size, byte, "delta list", &memory);
+	if (huge_page_size > 0) {
+		result = uds_allocate_huge_memory(size, huge_page_size,
+						  "delta list", &memory);
+	} else {
+		result = UDS_ALLOCATE(size, byte, "delta list", &memory);
+	}
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
+	delta_memory->memory = memory;
+	delta_memory->size = size;
+	delta_memory->huge_page_size = huge_page_size;
+	delta_memory->borrowed = false;
 	result = UDS_ALLOCATE(num_lists + 2, uint64_t, "delta list temp",
 			      &temp_offsets);
 	if (result != UDS_SUCCESS) {
-		UDS_FREE(memory);
+		free_delta_list_memory(delta_memory);
 		return result;
 	}
 	result = UDS_ALLOCATE(get_size_of_flags(num_lists), byte,
 			      "delta list flags", &flags);
 	if (result != UDS_SUCCESS) {
-		UDS_FREE(memory);
+		free_delta_list_memory(delta_memory);
 		UDS_FREE(temp_offsets);
 		return result;
 	}
@@ -305,14 +566,16 @@ int initialize_delta_memory(struct delta_memory *delta_memory,
 				 &delta_memory->min_keys,
 				 &delta_memory->incr_keys);
 	delta_memory->value_bits = num_payload_bits;
-	delta_memory->memory = memory;
 	delta_memory->delta_lists = NULL;
+	delta_memory->skips = NULL;
 	delta_memory->temp_offsets = temp_offsets;
 	delta_memory->flags = flags;
+	delta_memory->dirty = NULL;
 	delta_memory->buffered_writer = NULL;
-	delta_memory->size = size;
 	delta_memory->rebalance_time = 0;
 	delta_memory->rebalance_count = 0;
+	delta_memory->local_rebalance_time = 0;
+	delta_memory->local_rebalance_count = 0;
 	delta_memory->record_count = 0;
 	delta_memory->collision_count = 0;
 	delta_memory->discard_count = 0;
@@ -323,6 +586,14 @@ int initialize_delta_memory(struct delta_memory *delta_memory,
 	delta_memory->transfer_status = UDS_SUCCESS;
 	delta_memory->tag = 'm';
 
+	result = uds_init_mutex(&delta_memory->restore_mutex);
+	if (result != UDS_SUCCESS) {
+		free_delta_list_memory(delta_memory);
+		UDS_FREE(temp_offsets);
+		UDS_FREE(flags);
+		return result;
+	}
+
 	// Allocate the delta lists.
 	result = UDS_ALLOCATE(delta_memory->num_lists + 2, struct delta_list,
 			      "delta lists", &delta_memory->delta_lists);
@@ -331,6 +602,22 @@ int initialize_delta_memory(struct delta_memory *delta_memory,
 		return result;
 	}
 
+	result = UDS_ALLOCATE(delta_memory->num_lists,
+			      struct delta_list_skips,
+			      "delta list skips",
+			      &delta_memory->skips);
+	if (result != UDS_SUCCESS) {
+		uninitialize_delta_memory(delta_memory);
+		return result;
+	}
+
+	result = UDS_ALLOCATE(get_size_of_flags(num_lists), byte,
+			      "delta list dirty flags", &delta_memory->dirty);
+	if (result != UDS_SUCCESS) {
+		uninitialize_delta_memory(delta_memory);
+		return result;
+	}
+
 	empty_delta_lists(delta_memory);
 	return UDS_SUCCESS;
 }
@@ -340,12 +627,36 @@ void uninitialize_delta_memory(struct delta_memory *delta_memory)
 {
 	UDS_FREE(delta_memory->flags);
 	delta_memory->flags = NULL;
+	UDS_FREE(delta_memory->dirty);
+	delta_memory->dirty = NULL;
 	UDS_FREE(delta_memory->temp_offsets);
 	delta_memory->temp_offsets = NULL;
-	UDS_FREE(delta_memory->delta_lists);
+	UDS_FREE(delta_memory->skips);
+	delta_memory->skips = NULL;
+	if (!delta_memory->borrowed) {
+		UDS_FREE(delta_memory->delta_lists);
+	}
 	delta_memory->delta_lists = NULL;
-	UDS_FREE(delta_memory->memory);
-	delta_memory->memory = NULL;
+	free_delta_list_memory(delta_memory);
+	uds_destroy_mutex(&delta_memory->restore_mutex);
+}
+
+/**********************************************************************/
+void move_delta_memory(struct delta_memory *delta_memory,
+		       byte *memory,
+		       struct delta_list *delta_lists)
+{
+	memcpy(memory, delta_memory->memory, delta_memory->size);
+	memcpy(delta_lists, delta_memory->delta_lists,
+	       get_size_of_delta_lists(delta_memory->num_lists));
+	free_delta_list_memory(delta_memory);
+	if (!delta_memory->borrowed) {
+		UDS_FREE(delta_memory->delta_lists);
+	}
+	delta_memory->memory = memory;
+	delta_memory->delta_lists = delta_lists;
+	delta_memory->huge_page_size = 0;
+	delta_memory->borrowed = true;
 }
 
 /**********************************************************************/
@@ -363,12 +674,18 @@ void initialize_delta_memory_page(struct delta_memory *delta_memory,
 	delta_memory->value_bits = num_payload_bits;
 	delta_memory->memory = memory;
 	delta_memory->delta_lists = NULL;
+	delta_memory->skips = NULL;
 	delta_memory->temp_offsets = NULL;
 	delta_memory->flags = NULL;
+	delta_memory->dirty = NULL;
 	delta_memory->buffered_writer = NULL;
 	delta_memory->size = size;
+	delta_memory->huge_page_size = 0;
+	delta_memory->borrowed = false;
 	delta_memory->rebalance_time = 0;
 	delta_memory->rebalance_count = 0;
+	delta_memory->local_rebalance_time = 0;
+	delta_memory->local_rebalance_count = 0;
 	delta_memory->record_count = 0;
 	delta_memory->collision_count = 0;
 	delta_memory->discard_count = 0;
@@ -454,9 +771,9 @@ int read_saved_delta_list(struct delta_list_save_info *dlsi,
 }
 
 /**********************************************************************/
-int restore_delta_list(struct delta_memory *delta_memory,
-		       const struct delta_list_save_info *dlsi,
-		       const byte data[DELTA_LIST_MAX_BYTE_COUNT])
+static int restore_delta_list_locked(struct delta_memory *delta_memory,
+				     const struct delta_list_save_info *dlsi,
+				     const byte data[DELTA_LIST_MAX_BYTE_COUNT])
 {
 	struct delta_list *delta_list;
 	uint16_t bit_size;
@@ -498,6 +815,107 @@ int restore_delta_list(struct delta_memory *delta_memory,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+int restore_delta_list(struct delta_memory *delta_memory,
+		       const struct delta_list_save_info *dlsi,
+		       const byte data[DELTA_LIST_MAX_BYTE_COUNT])
+{
+	// Neighbouring lists can share a byte of memory and of transfer
+	// flags, so lists restored from different streams are serialized.
+	int result;
+	uds_lock_mutex(&delta_memory->restore_mutex);
+	result = restore_delta_list_locked(delta_memory, dlsi, data);
+	uds_unlock_mutex(&delta_memory->restore_mutex);
+	return result;
+}
+
+/**********************************************************************/
+void flag_restored_delta_lists_dirty(struct delta_memory *delta_memory)
+{
+	unsigned int i;
+	memset(delta_memory->dirty, 0,
+	       get_size_of_flags(delta_memory->num_lists));
+	for (i = 0; i < delta_memory->num_lists; i++) {
+		if ((get_field(delta_memory->flags, i, 1) == 0) &&
+		    (get_delta_list_size(&delta_memory->delta_lists[i + 1]) >
+		     0)) {
+			set_one(delta_memory->dirty, i, 1);
+		}
+	}
+}
+
+/**********************************************************************/
+int restore_base_delta_list(struct delta_memory *delta_memory,
+			    const struct delta_list_save_info *dlsi,
+			    const byte data[DELTA_LIST_MAX_BYTE_COUNT])
+{
+	unsigned int list_number = dlsi->index - delta_memory->first_list;
+	int result = UDS_SUCCESS;
+	uds_lock_mutex(&delta_memory->restore_mutex);
+	if ((list_number >= delta_memory->num_lists) ||
+	    (get_field(delta_memory->flags, list_number, 1) != 0)) {
+		result = restore_delta_list_locked(delta_memory, dlsi, data);
+	}
+	uds_unlock_mutex(&delta_memory->restore_mutex);
+	return result;
+}
+
+/**********************************************************************/
+int read_packed_delta_memory(struct delta_memory *delta_memory,
+			     struct buffered_reader *buffered_reader)
+{
+	struct delta_list *delta_lists = delta_memory->delta_lists;
+	uint64_t packed_bits = 0, guard_start, packed_start, offset;
+	unsigned int i;
+	int result;
+
+	for (i = 1; i <= delta_memory->num_lists; i++) {
+		packed_bits += get_delta_list_size(&delta_lists[i]);
+	}
+	guard_start =
+		get_delta_list_start(&delta_lists[delta_memory->num_lists + 1]);
+	if (packed_bits > guard_start) {
+		return uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
+						"packed delta lists do not fit in memory");
+	}
+	// Put the packed bits as high as they fit below the end guard list.
+	// Every list is laid out at or below its packed position, so moving
+	// the lists in order never overwrites bits which are still packed.
+	packed_start = (guard_start - packed_bits) & ~((uint64_t) CHAR_BIT - 1);
+	offset = packed_start;
+	for (i = 1; i <= delta_memory->num_lists; i++) {
+		if (get_delta_list_start(&delta_lists[i]) > offset) {
+			return uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
+							"packed delta lists do not fit in memory");
+		}
+		offset += get_delta_list_size(&delta_lists[i]);
+	}
+
+	result = read_from_buffered_reader(buffered_reader,
+					   delta_memory->memory +
+						   packed_start / CHAR_BIT,
+					   (packed_bits + CHAR_BIT - 1) /
+						   CHAR_BIT);
+	if (result != UDS_SUCCESS) {
+		return uds_log_warning_strerror(result,
+						"failed to read packed delta lists");
+	}
+
+	offset = packed_start;
+	for (i = 1; i <= delta_memory->num_lists; i++) {
+		uint16_t bit_size = get_delta_list_size(&delta_lists[i]);
+		if (bit_size > 0) {
+			move_bits(delta_memory->memory, offset,
+				  delta_memory->memory,
+				  get_delta_list_start(&delta_lists[i]),
+				  bit_size);
+		}
+		offset += bit_size;
+	}
+	clear_transfer_flags(delta_memory);
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 void abort_restoring_delta_memory(struct delta_memory *delta_memory)
 {
@@ -507,9 +925,24 @@ void abort_restoring_delta_memory(struct delta_memory *delta_memory)
 
 /**********************************************************************/
 void start_saving_delta_memory(struct delta_memory *delta_memory,
-			       struct buffered_writer *buffered_writer)
+			       struct buffered_writer *buffered_writer,
+			       enum delta_save_mode mode)
 {
-	flag_non_empty_delta_lists(delta_memory);
+	switch (mode) {
+	case DELTA_SAVE_INCREMENTAL:
+		flag_dirty_delta_lists(delta_memory);
+		break;
+	case DELTA_SAVE_PACKED:
+		clear_transfer_flags(delta_memory);
+		memset(delta_memory->dirty, 0,
+		       get_size_of_flags(delta_memory->num_lists));
+		break;
+	default:
+		flag_non_empty_delta_lists(delta_memory);
+		memset(delta_memory->dirty, 0,
+		       get_size_of_flags(delta_memory->num_lists));
+		break;
+	}
 	delta_memory->buffered_writer = buffered_writer;
 }
 
@@ -593,6 +1026,59 @@ void flush_delta_list(struct delta_memory *delta_memory,
 	}
 }
 
+/**********************************************************************/
+int write_packed_delta_memory(struct delta_memory *delta_memory,
+			      struct buffered_writer *buffered_writer)
+{
+	enum { PACK_BUFFER_BYTES = 64 * KILOBYTE };
+	uint64_t offset = 0;
+	unsigned int i;
+	byte *buffer;
+	int result = UDS_ALLOCATE(PACK_BUFFER_BYTES + DELTA_LIST_MAX_BYTE_COUNT,
+				  byte, "packed delta lists", &buffer);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	for (i = 1; i <= delta_memory->num_lists; i++) {
+		const struct delta_list *delta_list =
+			&delta_memory->delta_lists[i];
+		uint16_t bit_size = get_delta_list_size(delta_list);
+		if (bit_size == 0) {
+			continue;
+		}
+		move_bits(delta_memory->memory,
+			  get_delta_list_start(delta_list),
+			  buffer, offset, bit_size);
+		offset += bit_size;
+		if (offset / CHAR_BIT < PACK_BUFFER_BYTES) {
+			continue;
+		}
+		// Write the whole bytes, and keep the partial byte at the end
+		// to be finished by the next list.
+		result = write_to_buffered_writer(buffered_writer, buffer,
+						  offset / CHAR_BIT);
+		if (result != UDS_SUCCESS) {
+			break;
+		}
+		buffer[0] = buffer[offset / CHAR_BIT];
+		memset(buffer + 1, 0,
+		       PACK_BUFFER_BYTES + DELTA_LIST_MAX_BYTE_COUNT - 1);
+		offset %= CHAR_BIT;
+	}
+	if (result == UDS_SUCCESS) {
+		result = write_to_buffered_writer(buffered_writer, buffer,
+						  (offset + CHAR_BIT - 1) /
+							  CHAR_BIT);
+	}
+	UDS_FREE(buffer);
+	if (result != UDS_SUCCESS) {
+		return uds_log_warning_strerror(result,
+						"failed to write packed delta lists");
+	}
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int write_guard_delta_list(struct buffered_writer *buffered_writer)
 {
@@ -763,7 +1249,8 @@ size_t get_delta_memory_allocated(const struct delta_memory *delta_memory)
 {
 	return (delta_memory->size +
 		get_size_of_delta_lists(delta_memory->num_lists) +
-		get_size_of_flags(delta_memory->num_lists) +
+		get_size_of_skips(delta_memory->num_lists) +
+		2 * get_size_of_flags(delta_memory->num_lists) +
 		get_size_of_temp_offsets(delta_memory->num_lists));
 }
 
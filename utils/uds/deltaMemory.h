@@ -28,6 +28,7 @@
 #include "compiler.h"
 #include "cpu.h"
 #include "timeUtils.h"
+#include "uds-threads.h"
 
 /*
  * We encode the delta list information into 16 bytes per list.
@@ -54,20 +55,72 @@ struct delta_list {
 				// save_offset.
 };
 
+enum {
+	// The number of sampled search checkpoints kept for each delta list
+	DELTA_LIST_SKIP_POINTS = 4,
+};
+
+/*
+ * Search checkpoints for one delta list of a mutable delta memory.  Each
+ * point names an entry by its bit offset within the list, together with the
+ * key of the entry just before it, in the same way as save_offset and
+ * save_key.  An offset of zero marks an unused point.  The points are never
+ * saved; searches rebuild them after the delta lists are loaded.
+ */
+struct delta_list_skips {
+	unsigned int keys[DELTA_LIST_SKIP_POINTS];
+	uint16_t offsets[DELTA_LIST_SKIP_POINTS];
+};
+
 struct delta_memory {
 	byte *memory;                             // The delta list memory
 	struct delta_list *delta_lists;           // The delta list headers
+	struct delta_list_skips *skips;           // Search checkpoints, or
+						  // NULL if immutable
 	uint64_t *temp_offsets;                   // Temporary starts of delta
 						  // lists
 	byte *flags;                              // Transfer flags
+	byte *dirty;                              // Flags for the lists
+						  // changed since the last
+						  // full save
 	struct buffered_writer *buffered_writer;  // Buffered writer for saving
 						  // an index
+	struct mutex restore_mutex;               // Serializes delta lists
+						  // restored concurrently
 	size_t size;                              // The size of delta list
 						  // memory
+	size_t huge_page_size;                    // The size of the huge
+						  // pages backing memory, or
+						  // 0 if not huge
+	bool borrowed;                            // Whether memory and
+						  // delta_lists belong to
+						  // someone else
 	ktime_t rebalance_time;                   // Nanoseconds spent
 						  // rebalancing
 	int rebalance_count;                      // Number of memory
 						  // rebalances
+	ktime_t local_rebalance_time;             // Nanoseconds spent
+						  // rebalancing nearby lists
+	int local_rebalance_count;                // Number of nearby list
+						  // rebalances
+	ktime_t compaction_time;                  // Nanoseconds spent
+						  // compacting
+	int compaction_count;                     // Number of windows of
+						  // lists compacted
+	unsigned int compaction_cursor;           // The list at which the
+						  // next window to compact
+						  // starts, or 0 to start a
+						  // sweep
+	bool compaction_backward;                 // Whether compaction is
+						  // sweeping from the last
+						  // list to the first
+	uint64_t compaction_free_space;           // The free bytes the
+						  // current sweep is sharing
+						  // out among the lists
+	unsigned int compaction_windows;          // Windows compacted in the
+						  // current sweep
+	uint64_t compaction_start_bits;           // Bits in use when the
+						  // current sweep began
 	unsigned short value_bits;                // The number of bits of
 						  // value
 	unsigned short min_bits;                  // The number of bits in the
@@ -95,6 +148,21 @@ struct delta_memory {
 						  // delta index
 } __attribute__((aligned(CACHE_LINE_BYTES)));
 
+/*
+ * The ways a delta memory can be saved. A full save streams every non-empty
+ * delta list and an incremental save streams only the lists changed since
+ * the last full save, each list with its own delta_list_save_info, so that
+ * the lists can be written lazily while the index keeps changing. A packed
+ * save is a full save of an index which is not changing, and writes all the
+ * list bits back to back right after the list sizes, so that loading it
+ * into the same zones is one read and a pass of moves within memory.
+ */
+enum delta_save_mode {
+	DELTA_SAVE_FULL,
+	DELTA_SAVE_INCREMENTAL,
+	DELTA_SAVE_PACKED,
+};
+
 struct delta_list_save_info {
 	uint8_t  tag;         // Tag identifying which delta index this list
 			      // is in
@@ -119,6 +187,8 @@ enum {
  * @param num_lists         The number of delta lists
  * @param mean_delta        The mean delta
  * @param num_payload_bits  The number of payload bits
+ * @param huge_page_size    The size of huge pages to back the memory array
+ *                          with, or 0 to use ordinary allocations
  *
  * @return error code or UDS_SUCCESS
  **/
@@ -127,7 +197,8 @@ int __must_check initialize_delta_memory(struct delta_memory *delta_memory,
 					 unsigned int first_list,
 					 unsigned int num_lists,
 					 unsigned int mean_delta,
-					 unsigned int num_payload_bits);
+					 unsigned int num_payload_bits,
+					 size_t huge_page_size);
 
 /**
  * Uninitialize delta list memory.
@@ -136,6 +207,21 @@ int __must_check initialize_delta_memory(struct delta_memory *delta_memory,
  **/
 void uninitialize_delta_memory(struct delta_memory *delta_memory);
 
+/**
+ * Move the delta list memory and list headers of a delta memory into
+ * storage provided by the caller, such as shared memory which other
+ * processes search. The storage must hold at least the size of the memory
+ * and num_lists + 2 list headers, and must outlive the delta memory, which
+ * no longer frees them.
+ *
+ * @param delta_memory  A delta memory structure
+ * @param memory        The new delta list memory
+ * @param delta_lists   The new delta list headers
+ **/
+void move_delta_memory(struct delta_memory *delta_memory,
+		       byte *memory,
+		       struct delta_list *delta_lists);
+
 /**
  * Initialize delta list memory to refer to a cached page.
  *
@@ -195,7 +281,8 @@ int __must_check read_saved_delta_list(struct delta_list_save_info *dlsi,
 				       struct buffered_reader *buffered_reader);
 
 /**
- * Restore a saved delta list
+ * Restore a saved delta list.  Lists read from different saved streams may
+ * be restored concurrently.
  *
  * @param delta_memory  A delta memory structure
  * @param dlsi          The delta_list_save_info describing the delta list
@@ -215,13 +302,71 @@ int __must_check restore_delta_list(struct delta_memory *delta_memory,
 void abort_restoring_delta_memory(struct delta_memory *delta_memory);
 
 /**
- * Start saving delta list memory to a buffered output stream
+ * Note that the lists already restored from an incremental save have changed
+ * since its base, so that the next save can again be based on it.
+ *
+ * @param delta_memory  A delta memory structure
+ **/
+void flag_restored_delta_lists_dirty(struct delta_memory *delta_memory);
+
+/**
+ * Restore a delta list saved in the base of an incremental save. Lists which
+ * have already been restored from the incremental save, or which are empty
+ * in it, are skipped.
+ *
+ * @param delta_memory  A delta memory structure
+ * @param dlsi          The delta_list_save_info describing the delta list
+ * @param data          The saved delta list bit stream
+ *
+ * @return error code or UDS_SUCCESS
+ **/
+int __must_check
+restore_base_delta_list(struct delta_memory *delta_memory,
+			const struct delta_list_save_info *dlsi,
+			const byte data[DELTA_LIST_MAX_BYTE_COUNT]);
+
+/**
+ * Restore the delta lists of a packed save into a delta memory which holds
+ * exactly the lists that were saved, and whose list sizes and layout have
+ * been set up by start_restoring_delta_memory(). The packed bits are read
+ * straight into the end of the memory and then moved down into place.
+ *
+ * @param delta_memory     A delta memory structure
+ * @param buffered_reader  The buffered reader positioned at the packed bits
+ *
+ * @return error code or UDS_SUCCESS
+ **/
+int __must_check
+read_packed_delta_memory(struct delta_memory *delta_memory,
+			 struct buffered_reader *buffered_reader);
+
+/**
+ * Write all the delta lists of a delta memory back to back, as the body of
+ * a packed save.
  *
  * @param delta_memory     A delta memory structure
  * @param buffered_writer  The index state component being written
+ *
+ * @return error code or UDS_SUCCESS
+ **/
+int __must_check
+write_packed_delta_memory(struct delta_memory *delta_memory,
+			  struct buffered_writer *buffered_writer);
+
+/**
+ * Start saving delta list memory to a buffered output stream. A full or
+ * packed save forgets which lists have changed; an incremental save writes
+ * only the lists which have changed since the last full save. A packed save
+ * has already been written by write_packed_delta_memory(), so no lists are
+ * left to transfer.
+ *
+ * @param delta_memory     A delta memory structure
+ * @param buffered_writer  The index state component being written
+ * @param mode             The kind of save being made
  **/
 void start_saving_delta_memory(struct delta_memory *delta_memory,
-			       struct buffered_writer *buffered_writer);
+			       struct buffered_writer *buffered_writer,
+			       enum delta_save_mode mode);
 
 /**
  * Finish saving delta list memory to an output stream.  Force the writing
@@ -286,6 +431,42 @@ int __must_check extend_delta_memory(struct delta_memory *delta_memory,
 				     size_t growing_size,
 				     bool do_copy);
 
+/**
+ * Make room for a delta list to grow by rebalancing only the delta lists
+ * around it, so that a zone does not have to move every list to make room
+ * for one.  A window of nearby lists is widened until its free space can be
+ * spread out to leave every gap in it with at least the requested room, or
+ * until it would move too many lists.
+ *
+ * @param delta_memory   A delta memory structure
+ * @param growing_index  Index of the delta list that needs additional space
+ *                       left before it (from 1 to N+1)
+ * @param growing_size   Number of additional bytes needed before growing_index
+ *
+ * @return true if the room was made, or false if the caller must use
+ *         extend_delta_memory instead
+ **/
+bool __must_check
+rebalance_nearby_delta_lists(struct delta_memory *delta_memory,
+			     unsigned int growing_index,
+			     size_t growing_size);
+
+/**
+ * Compact one slice of a delta memory. Deletes and chapter expiry leave the
+ * free space between the delta lists unevenly spread, so that lists which
+ * grow have to be moved again and again. Each slice examines a small window
+ * of lists, and if a gap in it is short of its even share of the free space,
+ * or the window holds far more than its share, moves the lists to give each
+ * gap its share. Free space beyond that is carried along by the sweep to the
+ * lists which lack it, with sweeps alternating between the two directions so
+ * that it can flow either way.
+ *
+ * @param delta_memory  A mutable delta memory structure
+ *
+ * @return true if the slice finished a sweep of every list in the memory
+ **/
+bool compact_delta_memory(struct delta_memory *delta_memory);
+
 /**
  * Validate the delta list headers.
  *
@@ -382,6 +563,20 @@ static INLINE bool is_mutable(const struct delta_memory *delta_memory)
 	return delta_memory->delta_lists != NULL;
 }
 
+/**
+ * Note that a delta list has changed since the last full save.
+ *
+ * @param delta_memory  A delta memory structure
+ * @param list_number   The zone relative number of the delta list
+ **/
+static INLINE void mark_delta_list_dirty(struct delta_memory *delta_memory,
+					 unsigned int list_number)
+{
+	if (delta_memory->dirty != NULL) {
+		set_one(delta_memory->dirty, list_number, 1);
+	}
+}
+
 /**
  * Lazily flush a delta list to an output stream
  *
@@ -0,0 +1,596 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/deltabench.c#1 $
+ */
+
+/**
+ * deltabench times the delta index on its own: it fills a mutable delta
+ * index with random keys, looks them up, packs the lists into immutable
+ * pages and looks them up there, saves the index to a file and restores it,
+ * and finally removes every entry. It reports the cost of each operation and
+ * how many bits each entry takes.
+ **/
+
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "benchCounters.h"
+#include "bufferedReader.h"
+#include "bufferedWriter.h"
+#include "deltaIndex.h"
+#include "errors.h"
+#include "ioFactory.h"
+#include "memoryAlloc.h"
+#include "timeUtils.h"
+
+enum {
+	/** The marker for a generated key which duplicated an earlier one */
+	NO_KEY = UINT32_MAX,
+	/** The tag of the saved delta index */
+	BENCH_TAG = 'b',
+};
+
+static const char usage_string[] = " [--help] [options...] filename";
+
+static const char help_string[] =
+	"deltabench - measure the speed and density of the delta index\n"
+	"\n"
+	"SYNOPSIS\n"
+	"  deltabench [options] filename\n"
+	"\n"
+	"DESCRIPTION\n"
+	"  deltabench fills a delta index with random keys and times putting,\n"
+	"  getting and removing entries, packing the index into immutable\n"
+	"  pages and searching them, and saving the index to filename and\n"
+	"  restoring it. filename is overwritten.\n"
+	"\n"
+	"OPTIONS\n"
+	"    --counters\n"
+	"       Also report the hardware performance counters of each\n"
+	"       operation.\n"
+	"\n"
+	"    --entries=<count>\n"
+	"       Put <count> entries in each delta list. The default is 256.\n"
+	"\n"
+	"    --fill=<percent>\n"
+	"       Size the delta memory so that the entries fill <percent> of\n"
+	"       it. The default is 50.\n"
+	"\n"
+	"    --help\n"
+	"       Print this help message and exit.\n"
+	"\n"
+	"    --lists=<count>\n"
+	"       Use <count> delta lists. The default is 4096.\n"
+	"\n"
+	"    --mean-delta=<delta>\n"
+	"       The mean distance between keys in a list. The default is\n"
+	"       4096, as in the volume index.\n"
+	"\n"
+	"    --page-size=<bytes>\n"
+	"       Pack the index into pages of <bytes>. The default is 4096.\n"
+	"\n"
+	"    --payload-bits=<bits>\n"
+	"       Store <bits> of payload with each entry. The default is 8.\n"
+	"\n";
+
+static struct option options[] = {
+	{ "counters", no_argument, NULL, 'c' },
+	{ "entries", required_argument, NULL, 'e' },
+	{ "fill", required_argument, NULL, 'f' },
+	{ "help", no_argument, NULL, 'h' },
+	{ "lists", required_argument, NULL, 'l' },
+	{ "mean-delta", required_argument, NULL, 'm' },
+	{ "page-size", required_argument, NULL, 'p' },
+	{ "payload-bits", required_argument, NULL, 'b' },
+	{ NULL, 0, NULL, 0 },
+};
+static char option_string[] = "b:ce:f:hl:m:p:";
+
+/** The hardware counters, which are read if counting is set */
+static struct bench_counters counters;
+static bool counting;
+
+/** The settings of the benchmark and the keys it generated */
+struct bench_config {
+	const char *filename;
+	unsigned int entries;
+	unsigned int fill_percent;
+	unsigned int lists;
+	unsigned int mean_delta;
+	unsigned int page_size;
+	unsigned int payload_bits;
+	size_t memory_size;
+	uint64_t random_state;
+	/** The keys, entry-major so that consecutive keys are in new lists */
+	unsigned int *keys;
+	unsigned long key_count;
+};
+
+/**********************************************************************/
+static void usage(const char *progname)
+{
+	errx(1, "Usage: %s%s\n", progname, usage_string);
+}
+
+/**********************************************************************/
+static unsigned int parse_number(const char *name,
+				 const char *arg,
+				 unsigned int min,
+				 unsigned int max)
+{
+	uint64_t value;
+	if ((uds_parse_uint64(arg, &value) != UDS_SUCCESS) || (value < min) ||
+	    (value > max)) {
+		errx(1, "invalid --%s value: %s", name, arg);
+	}
+	return value;
+}
+
+/**********************************************************************/
+static void check(int result, const char *what)
+{
+	if (result != UDS_SUCCESS) {
+		char buf[UDS_STRING_ERROR_BUFSIZE];
+		errx(1, "%s failed: %s", what,
+		     uds_string_error(result, buf, sizeof(buf)));
+	}
+}
+
+/**
+ * Advance the random number generator (xorshift64*).
+ **/
+static uint64_t next_random(struct bench_config *config)
+{
+	uint64_t x = config->random_state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	config->random_state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**********************************************************************/
+static ktime_t now(void)
+{
+	return current_time_ns(CLOCK_MONOTONIC);
+}
+
+/**
+ * Start a measured phase.
+ *
+ * @return the time the phase started
+ **/
+static ktime_t start_phase(void)
+{
+	if (counting) {
+		start_bench_counters(&counters);
+	}
+	return now();
+}
+
+/**********************************************************************/
+static void report(const char *phase,
+		   unsigned long ops,
+		   const char *unit,
+		   ktime_t elapsed)
+{
+	if (counting) {
+		stop_bench_counters(&counters);
+	}
+	printf("  %-10s %12lu %-8s %10.1f ns/op\n", phase, ops, unit,
+	       (double) elapsed / ops);
+	if (counting) {
+		print_bench_counters(&counters, "    ", ops);
+	}
+}
+
+/**
+ * Put every key into the index, skipping keys which turn out to duplicate
+ * an earlier key in the same list.
+ **/
+static void bench_put(struct bench_config *config,
+		      struct delta_index *delta_index)
+{
+	unsigned long i;
+	unsigned long puts = 0;
+	ktime_t start = start_phase();
+
+	for (i = 0; i < config->key_count; i++) {
+		struct delta_index_entry entry;
+		unsigned int list = i % config->lists;
+		unsigned int key = config->keys[i];
+		check(get_delta_index_entry(delta_index, list, key, NULL, false,
+					    &entry),
+		      "get_delta_index_entry");
+		if (!entry.at_end && (entry.key == key)) {
+			config->keys[i] = NO_KEY;
+			continue;
+		}
+
+		check(put_delta_index_entry(&entry, key,
+					    i & ((1u << config->payload_bits) -
+						 1),
+					    NULL),
+		      "put_delta_index_entry");
+		puts++;
+	}
+
+	report("put", puts, "entries", ktime_sub(now(), start));
+}
+
+/**********************************************************************/
+static void bench_get(const struct bench_config *config,
+		      const struct delta_index *delta_index)
+{
+	unsigned long i;
+	unsigned long gets = 0;
+	ktime_t start = start_phase();
+
+	for (i = 0; i < config->key_count; i++) {
+		struct delta_index_entry entry;
+		unsigned int key = config->keys[i];
+		if (key == NO_KEY) {
+			continue;
+		}
+
+		check(get_delta_index_entry(delta_index, i % config->lists, key,
+					    NULL, true, &entry),
+		      "get_delta_index_entry");
+		if (entry.at_end || (entry.key != key)) {
+			errx(1, "key %u missing from list %lu", key,
+			     i % config->lists);
+		}
+		gets++;
+	}
+
+	report("get", gets, "entries", ktime_sub(now(), start));
+}
+
+/**
+ * Pack the whole index into immutable pages, then search the pages for every
+ * key.
+ **/
+static void bench_pages(const struct bench_config *config,
+			const struct delta_index *delta_index,
+			unsigned long entry_count)
+{
+	struct delta_index_page *pages;
+	byte *memory;
+	unsigned int *page_of_list;
+	unsigned int page_count = 0;
+	unsigned int first_list = 0;
+	unsigned int max_pages = config->lists;
+	unsigned long i;
+	unsigned long gets = 0;
+	ktime_t start;
+
+	check(UDS_ALLOCATE(max_pages, struct delta_index_page, "pages",
+			   &pages),
+	      "allocate pages");
+	check(UDS_ALLOCATE((size_t) max_pages * config->page_size, byte,
+			   "page memory", &memory),
+	      "allocate page memory");
+	check(UDS_ALLOCATE(config->lists, unsigned int, "page map",
+			   &page_of_list),
+	      "allocate page map");
+
+	start = start_phase();
+	while (first_list < config->lists) {
+		unsigned int num_lists;
+		check(pack_delta_index_page(delta_index, 0,
+					    &memory[(size_t) page_count *
+						    config->page_size],
+					    config->page_size, 0, first_list,
+					    &num_lists),
+		      "pack_delta_index_page");
+		if (num_lists == 0) {
+			errx(1, "delta list %u does not fit on a page",
+			     first_list);
+		}
+		for (i = 0; i < num_lists; i++) {
+			page_of_list[first_list + i] = page_count;
+		}
+		first_list += num_lists;
+		page_count++;
+	}
+	report("pack", page_count, "pages", ktime_sub(now(), start));
+
+	for (i = 0; i < page_count; i++) {
+		check(initialize_delta_index_page(&pages[i], 0,
+						  config->mean_delta,
+						  config->payload_bits,
+						  &memory[i *
+							  config->page_size],
+						  config->page_size),
+		      "initialize_delta_index_page");
+	}
+
+	start = start_phase();
+	for (i = 0; i < config->key_count; i++) {
+		struct delta_index_entry entry;
+		unsigned int list = i % config->lists;
+		unsigned int key = config->keys[i];
+		struct delta_index_page *page = &pages[page_of_list[list]];
+		if (key == NO_KEY) {
+			continue;
+		}
+
+		check(get_delta_index_entry(&page->delta_index,
+					    list - page->lowest_list_number,
+					    key, NULL, true, &entry),
+		      "get_delta_index_entry");
+		if (entry.at_end || (entry.key != key)) {
+			errx(1, "key %u missing from page %u", key,
+			     page_of_list[list]);
+		}
+		gets++;
+	}
+	report("page get", gets, "entries", ktime_sub(now(), start));
+
+	printf("  %-10s %12.2f bits/entry on %u pages\n", "packed",
+	       (double) page_count * config->page_size * CHAR_BIT /
+		       entry_count,
+	       page_count);
+
+	UDS_FREE(page_of_list);
+	UDS_FREE(memory);
+	UDS_FREE(pages);
+}
+
+/**
+ * Save the index to the file, then restore it into a fresh index and check
+ * that every entry came back.
+ **/
+static void bench_save(const struct bench_config *config,
+		       const struct delta_index *delta_index)
+{
+	struct io_factory *factory;
+	struct buffered_writer *writer;
+	struct buffered_reader *reader;
+	struct delta_index restored;
+	struct delta_index_stats before, after;
+	size_t save_size = compute_delta_index_save_bytes(config->lists,
+							  config->memory_size);
+	byte *dl_data;
+	unsigned long lists = 0;
+	ktime_t start;
+
+	check(make_uds_io_factory(config->filename, FU_CREATE_READ_WRITE,
+				  &factory),
+	      "make_uds_io_factory");
+	check(UDS_ALLOCATE(DELTA_LIST_MAX_BYTE_COUNT, byte, "delta list data",
+			   &dl_data),
+	      "allocate delta list data");
+
+	check(open_uds_buffered_writer(factory, 0, save_size, &writer),
+	      "open_uds_buffered_writer");
+	start = start_phase();
+	check(start_saving_delta_index(delta_index, 0, writer,
+				       DELTA_SAVE_FULL),
+	      "start_saving_delta_index");
+	check(finish_saving_delta_index(delta_index, 0),
+	      "finish_saving_delta_index");
+	check(write_guard_delta_list(writer), "write_guard_delta_list");
+	check(flush_buffered_writer(writer), "flush_buffered_writer");
+	report("save", config->lists, "lists", ktime_sub(now(), start));
+	free_buffered_writer(writer);
+
+	check(initialize_delta_index(&restored, 1, config->lists,
+				     config->mean_delta, config->payload_bits,
+				     config->memory_size, 0),
+	      "initialize_delta_index");
+	set_delta_index_tag(&restored, BENCH_TAG);
+	check(open_uds_buffered_reader(factory, 0, save_size, &reader),
+	      "open_uds_buffered_reader");
+	start = start_phase();
+	check(start_restoring_delta_index(&restored, &reader, 1),
+	      "start_restoring_delta_index");
+	for (;;) {
+		struct delta_list_save_info dlsi;
+		int result = read_saved_delta_list(&dlsi, dl_data, reader);
+		if (result == UDS_END_OF_FILE) {
+			break;
+		}
+		check(result, "read_saved_delta_list");
+		check(restore_delta_list_to_delta_index(&restored, &dlsi,
+							dl_data),
+		      "restore_delta_list_to_delta_index");
+		lists++;
+	}
+	if (!is_restoring_delta_index_done(&restored)) {
+		errx(1, "restore is missing delta lists");
+	}
+	report("restore", lists, "lists", ktime_sub(now(), start));
+	free_buffered_reader(reader);
+
+	get_delta_index_stats(delta_index, &before);
+	get_delta_index_stats(&restored, &after);
+	if ((before.record_count != after.record_count) ||
+	    (get_delta_index_dlist_bits_used(delta_index) !=
+	     get_delta_index_dlist_bits_used(&restored))) {
+		errx(1, "restored index differs: %ld records, expected %ld",
+		     after.record_count, before.record_count);
+	}
+	check(validate_delta_index(&restored), "validate_delta_index");
+
+	uninitialize_delta_index(&restored);
+	UDS_FREE(dl_data);
+	put_uds_io_factory(factory);
+}
+
+/**********************************************************************/
+static void bench_remove(const struct bench_config *config,
+			 struct delta_index *delta_index)
+{
+	unsigned long i;
+	unsigned long removes = 0;
+	ktime_t start = start_phase();
+
+	for (i = 0; i < config->key_count; i++) {
+		struct delta_index_entry entry;
+		unsigned int key = config->keys[i];
+		if (key == NO_KEY) {
+			continue;
+		}
+
+		check(get_delta_index_entry(delta_index, i % config->lists, key,
+					    NULL, false, &entry),
+		      "get_delta_index_entry");
+		check(remove_delta_index_entry(&entry),
+		      "remove_delta_index_entry");
+		removes++;
+	}
+
+	report("remove", removes, "entries", ktime_sub(now(), start));
+	if (get_delta_index_dlist_bits_used(delta_index) != 0) {
+		errx(1, "delta index is not empty after removing every entry");
+	}
+}
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+	struct bench_config config = {
+		.entries = 256,
+		.fill_percent = 50,
+		.lists = 4096,
+		.mean_delta = 4096,
+		.page_size = 4096,
+		.payload_bits = 8,
+		.random_state = 0x9e3779b97f4a7c15ULL,
+	};
+	struct delta_index delta_index;
+	struct delta_index_stats stats;
+	unsigned long i;
+	uint64_t bits_used;
+	int c;
+
+	while ((c = getopt_long(argc, argv, option_string, options, NULL)) !=
+	       -1) {
+		switch (c) {
+		case 'b':
+			config.payload_bits =
+				parse_number("payload-bits", optarg, 1, 16);
+			break;
+
+		case 'c':
+			counting = true;
+			break;
+
+		case 'e':
+			config.entries = parse_number("entries", optarg, 1,
+						      1 << 16);
+			break;
+
+		case 'f':
+			config.fill_percent = parse_number("fill", optarg, 1,
+							   99);
+			break;
+
+		case 'h':
+			printf("%s", help_string);
+			exit(0);
+
+		case 'l':
+			config.lists = parse_number("lists", optarg, 1,
+						    1 << 24);
+			break;
+
+		case 'm':
+			config.mean_delta = parse_number("mean-delta", optarg,
+							 2, 1 << 20);
+			break;
+
+		case 'p':
+			config.page_size = parse_number("page-size", optarg,
+							512, 1 << 20);
+			break;
+
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (optind != (argc - 1)) {
+		usage(argv[0]);
+	}
+	config.filename = argv[optind];
+	if (counting) {
+		counting = open_bench_counters(&counters);
+	}
+
+	config.key_count = (unsigned long) config.lists * config.entries;
+	if (config.key_count > UINT32_MAX) {
+		errx(1, "too many entries");
+	}
+	check(UDS_ALLOCATE(config.key_count, unsigned int, "keys",
+			   &config.keys),
+	      "allocate keys");
+	for (i = 0; i < config.key_count; i++) {
+		config.keys[i] = (next_random(&config) %
+				  ((uint64_t) config.mean_delta *
+				   config.entries));
+	}
+
+	// The packed size of the entries is a good estimate of the delta
+	// memory they take, before leaving room for the lists to grow.
+	config.memory_size =
+		((size_t) get_delta_index_page_count(config.key_count,
+						     config.lists,
+						     config.mean_delta,
+						     config.payload_bits,
+						     config.page_size) *
+		 config.page_size * 100 / config.fill_percent);
+
+	check(initialize_delta_index(&delta_index, 1, config.lists,
+				     config.mean_delta, config.payload_bits,
+				     config.memory_size, 0),
+	      "initialize_delta_index");
+	set_delta_index_tag(&delta_index, BENCH_TAG);
+
+	printf("%u lists, %u entries per list, mean delta %u, "
+	       "%u payload bits, %zu bytes of delta memory\n",
+	       config.lists, config.entries, config.mean_delta,
+	       config.payload_bits, config.memory_size);
+
+	bench_put(&config, &delta_index);
+	get_delta_index_stats(&delta_index, &stats);
+	bits_used = get_delta_index_dlist_bits_used(&delta_index);
+	printf("  %-10s %12.2f bits/entry, %.1f%% of delta memory, "
+	       "%d rebalances\n",
+	       "mutable", (double) bits_used / stats.record_count,
+	       100.0 * bits_used /
+		       get_delta_index_dlist_bits_allocated(&delta_index),
+	       stats.rebalance_count);
+
+	bench_get(&config, &delta_index);
+	bench_pages(&config, &delta_index, stats.record_count);
+	bench_save(&config, &delta_index);
+	bench_remove(&config, &delta_index);
+
+	uninitialize_delta_index(&delta_index);
+	UDS_FREE(config.keys);
+	if (counting) {
+		close_bench_counters(&counters);
+	}
+	exit(0);
+}
@@ -21,10 +21,18 @@
 
 #include "fileIORegion.h"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "compiler.h"
 #include "ioFactory.h"
+#include "ioRing.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
 #include "permassert.h"
 
 
@@ -34,6 +42,7 @@ struct file_io_region {
 	int fd;
 	bool reading;
 	bool writing;
+	bool direct;
 	off_t offset;
 	size_t size;
 };
@@ -44,6 +53,39 @@ static INLINE struct file_io_region *as_file_io_region(struct io_region *region)
 	return container_of(region, struct file_io_region, common);
 }
 
+/**
+ * Check that a transfer to or from a direct I/O region meets the alignment
+ * which O_DIRECT demands, so that it fails with a useful error rather than
+ * EINVAL from the system call.
+ *
+ * @param fior    The region
+ * @param offset  The offset in the region of the transfer
+ * @param buffer  The memory to transfer to or from
+ * @param size    The size of the transfer
+ *
+ * @return UDS_SUCCESS or UDS_INCORRECT_ALIGNMENT
+ **/
+static int validate_direct_io(struct file_io_region *fior,
+			      off_t offset,
+			      const void *buffer,
+			      size_t size)
+{
+	if (!fior->direct) {
+		return UDS_SUCCESS;
+	}
+
+	if (((fior->offset + offset) % UDS_BLOCK_SIZE != 0) ||
+	    (size % UDS_BLOCK_SIZE != 0) ||
+	    ((uintptr_t) buffer % UDS_IO_ALIGNMENT != 0)) {
+		return uds_log_error_strerror(UDS_INCORRECT_ALIGNMENT,
+					      "direct I/O of %zu bytes at offset %lld from %p is not aligned",
+					      size,
+					      (long long) offset,
+					      buffer);
+	}
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 static int validate_io(struct file_io_region *fior,
 		       off_t offset,
@@ -80,6 +122,9 @@ static int validate_io(struct file_io_region *fior,
 static void fior_free(struct io_region *region)
 {
 	struct file_io_region *fior = as_file_io_region(region);
+	if (fior->direct) {
+		close_file(fior->fd, "cannot close direct IO region");
+	}
 	put_uds_io_factory(fior->factory);
 	UDS_FREE(fior);
 }
@@ -99,8 +144,34 @@ static int fior_write(struct io_region *region,
 		return result;
 	}
 
+	result = validate_direct_io(fior, offset, data, size);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// Direct I/O can only write whole blocks.
 	return write_buffer_at_offset(fior->fd, fior->offset + offset, data,
-				      length);
+				      fior->direct ? size : length);
+}
+
+/**********************************************************************/
+static void fior_prefetch(struct io_region *region, off_t offset, size_t size)
+{
+	struct file_io_region *fior = as_file_io_region(region);
+	int result;
+
+	// Reads bypass the page cache, so filling it would only waste memory.
+	if (fior->direct || !fior->reading || (offset < 0) ||
+	    ((size_t) offset >= fior->size)) {
+		return;
+	}
+	size = min(size, fior->size - offset);
+	result = posix_fadvise(fior->fd, fior->offset + offset, size,
+			       POSIX_FADV_WILLNEED);
+	if (result != 0) {
+		uds_log_debug("cannot prefetch %zu bytes at offset %lld: %s",
+			      size, (long long) offset, strerror(result));
+	}
 }
 
 /**********************************************************************/
@@ -119,6 +190,11 @@ static int fior_read(struct io_region *region,
 		return result;
 	}
 
+	result = validate_direct_io(fior, offset, buffer, size);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
 	size_t data_length = 0;
 	result = read_data_at_offset(fior->fd, fior->offset + offset, buffer,
 				     size, &data_length);
@@ -149,6 +225,147 @@ static int fior_read(struct io_region *region,
 	return UDS_SUCCESS;
 }
 
+/**
+ * Check a vector of buffers for a transfer to or from a region, and find
+ * the total size of the transfer.
+ *
+ * @param fior        The region
+ * @param offset      The offset in the region of the transfer
+ * @param iov         The buffers to transfer
+ * @param iov_count   The number of buffers
+ * @param will_write  Whether the transfer is a write
+ * @param size_ptr    A pointer to hold the total size of the transfer
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int validate_vectored_io(struct file_io_region *fior,
+				off_t offset,
+				const struct iovec *iov,
+				unsigned int iov_count,
+				bool will_write,
+				size_t *size_ptr)
+{
+	size_t size = 0;
+	unsigned int i;
+	int result;
+
+	if (iov_count > IOV_MAX) {
+		return uds_log_error_strerror(UDS_BUFFER_ERROR,
+					      "%u buffers exceed the limit of %u",
+					      iov_count,
+					      IOV_MAX);
+	}
+
+	for (i = 0; i < iov_count; i++) {
+		result = validate_direct_io(fior, offset + size,
+					    iov[i].iov_base, iov[i].iov_len);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		size += iov[i].iov_len;
+	}
+
+	result = validate_io(fior, offset, size, size, will_write);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	*size_ptr = size;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+static int fior_readv(struct io_region *region,
+		      off_t offset,
+		      const struct iovec *iov,
+		      unsigned int iov_count)
+{
+	struct file_io_region *fior = as_file_io_region(region);
+	size_t size, data_length = 0, position = 0;
+	unsigned int i;
+
+	int result = validate_vectored_io(fior, offset, iov, iov_count, false,
+					  &size);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = read_vectored_at_offset(fior->fd, fior->offset + offset,
+					 iov, iov_count, &data_length);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// As with a single buffer, anything beyond the end of the file reads
+	// as zeros.
+	for (i = 0; (data_length < size) && (i < iov_count); i++) {
+		size_t start = ((data_length > position) ?
+				min(data_length - position, iov[i].iov_len) :
+				0);
+		memset((byte *) iov[i].iov_base + start, 0,
+		       iov[i].iov_len - start);
+		position += iov[i].iov_len;
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+static int fior_read_batch(struct io_region *region,
+			   struct io_ring *ring,
+			   struct io_ring_read *reads,
+			   unsigned int count)
+{
+	struct file_io_region *fior = as_file_io_region(region);
+	unsigned int i;
+	int result = UDS_SUCCESS;
+
+	for (i = 0; (i < count) && (result == UDS_SUCCESS); i++) {
+		result = validate_io(fior, reads[i].offset, reads[i].size,
+				     reads[i].size, false);
+		if (result == UDS_SUCCESS) {
+			result = validate_direct_io(fior, reads[i].offset,
+						    reads[i].buffer,
+						    reads[i].size);
+		}
+	}
+	if (result != UDS_SUCCESS) {
+		for (i = 0; i < count; i++) {
+			reads[i].result = result;
+		}
+		return result;
+	}
+
+	// The ring reads the file itself, so the offsets are moved into the
+	// file for the batch.
+	for (i = 0; i < count; i++) {
+		reads[i].offset += fior->offset;
+	}
+	result = read_with_io_ring(ring, fior->fd, reads, count);
+	for (i = 0; i < count; i++) {
+		reads[i].offset -= fior->offset;
+	}
+	return result;
+}
+
+/**********************************************************************/
+static int fior_writev(struct io_region *region,
+		       off_t offset,
+		       const struct iovec *iov,
+		       unsigned int iov_count)
+{
+	struct file_io_region *fior = as_file_io_region(region);
+	size_t size;
+
+	int result = validate_vectored_io(fior, offset, iov, iov_count, true,
+					  &size);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	return write_vectored_at_offset(fior->fd, fior->offset + offset, iov,
+					iov_count);
+}
+
 /**********************************************************************/
 static int fior_sync_contents(struct io_region *region)
 {
@@ -157,6 +374,46 @@ static int fior_sync_contents(struct io_region *region)
 			     "cannot sync contents of file IO region");
 }
 
+/**********************************************************************/
+static int fior_map(struct io_region *region, struct region_mapping *mapping)
+{
+	struct file_io_region *fior = as_file_io_region(region);
+	long page_size = sysconf(_SC_PAGESIZE);
+	off_t start;
+	size_t slack;
+	void *base;
+
+	// Mapped reads go through the page cache, which direct I/O avoids.
+	if (fior->direct || !fior->reading || (fior->size == 0) ||
+	    (page_size <= 0)) {
+		return EINVAL;
+	}
+
+	start = fior->offset & ~((off_t) page_size - 1);
+	slack = fior->offset - start;
+	base = mmap(NULL, fior->size + slack, PROT_READ, MAP_SHARED, fior->fd,
+		    start);
+	if (base == MAP_FAILED) {
+		return uds_log_warning_strerror(errno,
+						"cannot map %zu bytes of file region",
+						fior->size);
+	}
+
+	// Index lookups touch scattered pages, so read-ahead would be waste.
+	if (madvise(base, fior->size + slack, MADV_RANDOM) != 0) {
+		uds_log_debug("cannot advise random access: %s",
+			      strerror(errno));
+	}
+
+	*mapping = (struct region_mapping) {
+		.base = base,
+		.length = fior->size + slack,
+		.data = (byte *) base + slack,
+		.size = fior->size,
+	};
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int make_file_region(struct io_factory *factory,
 		     int fd,
@@ -174,9 +431,14 @@ int make_file_region(struct io_factory *factory,
 	get_uds_io_factory(factory);
 
 	fior->common.free = fior_free;
+	fior->common.prefetch = fior_prefetch;
 	fior->common.read = fior_read;
+	fior->common.readv = fior_readv;
+	fior->common.read_batch = fior_read_batch;
 	fior->common.sync_contents = fior_sync_contents;
 	fior->common.write = fior_write;
+	fior->common.writev = fior_writev;
+	fior->common.map = fior_map;
 	fior->factory = factory;
 	fior->fd = fd;
 	fior->reading = (access <= FU_CREATE_READ_WRITE);
@@ -188,3 +450,22 @@ int make_file_region(struct io_factory *factory,
 	*region_ptr = &fior->common;
 	return UDS_SUCCESS;
 }
+
+/**********************************************************************/
+int make_direct_file_region(struct io_factory *factory,
+			    int fd,
+			    off_t offset,
+			    size_t size,
+			    struct io_region **region_ptr)
+{
+	struct io_region *region;
+	int result = make_file_region(factory, fd, FU_READ_WRITE, offset, size,
+				      &region);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	as_file_io_region(region)->direct = true;
+	*region_ptr = region;
+	return UDS_SUCCESS;
+}
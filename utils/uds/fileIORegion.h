@@ -45,4 +45,24 @@ int __must_check make_file_region(struct io_factory *factory,
 				  size_t size,
 				  struct io_region **region_ptr);
 
+/**
+ * Make a read-write IO region using a file descriptor opened for direct I/O.
+ * The region owns the file descriptor and closes it when it is freed. All
+ * buffers, offsets, and sizes used with the region must be aligned to
+ * UDS_IO_ALIGNMENT.
+ *
+ * @param [in]  factory    The IO factory for the file.
+ * @param [in]  fd         The file descriptor opened with O_DIRECT.
+ * @param [in]  offset     The byte offset to the start of the region.
+ * @param [in]  size       Size of the file region (in bytes).
+ * @param [out] region_ptr The new region.
+ *
+ * @return UDS_SUCCESS or an error code.
+ **/
+int __must_check make_direct_file_region(struct io_factory *factory,
+					 int fd,
+					 off_t offset,
+					 size_t size,
+					 struct io_region **region_ptr);
+
 #endif // FILE_IO_REGION_H
@@ -210,6 +210,64 @@ int read_data_at_offset(int fd,
 }
 
 
+/**********************************************************************/
+int read_vectored_at_offset(int fd,
+			    off_t offset,
+			    const struct iovec *iov,
+			    int iov_count,
+			    size_t *length)
+{
+	off_t current_offset = offset;
+
+	while (iov_count > 0) {
+		ssize_t bytes_read;
+		int result = logging_preadv(fd,
+					    iov,
+					    iov_count,
+					    current_offset,
+					    __func__,
+					    &bytes_read);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+
+		if (bytes_read == 0) {
+			break;
+		}
+		current_offset += bytes_read;
+		while ((iov_count > 0) && ((size_t) bytes_read >= iov->iov_len)) {
+			bytes_read -= iov->iov_len;
+			iov++;
+			iov_count--;
+		}
+
+		if (bytes_read > 0) {
+			// Finish the buffer the read stopped in, so that the
+			// vector can be restarted at a buffer boundary.
+			size_t data_length;
+			size_t rest = iov->iov_len - bytes_read;
+			result = read_data_at_offset(fd,
+						     current_offset,
+						     (byte *) iov->iov_base +
+							     bytes_read,
+						     rest,
+						     &data_length);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+			current_offset += data_length;
+			if (data_length < rest) {
+				break;
+			}
+			iov++;
+			iov_count--;
+		}
+	}
+
+	*length = current_offset - offset;
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int write_buffer(int fd, const void *buffer, unsigned int length)
 {
@@ -272,6 +330,62 @@ int write_buffer_at_offset(int fd,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+int write_vectored_at_offset(int fd,
+			     off_t offset,
+			     const struct iovec *iov,
+			     int iov_count)
+{
+	off_t current_offset = offset;
+
+	while (iov_count > 0) {
+		ssize_t written;
+		int result = logging_pwritev(fd,
+					     iov,
+					     iov_count,
+					     current_offset,
+					     __func__,
+					     &written);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+
+		if (written == 0) {
+			// this should not happen, but if it does, errno won't
+			// be defined, so we need to return our own error
+			return uds_log_error_strerror(UDS_UNKNOWN_ERROR,
+						      "impossible write error");
+		}
+
+		current_offset += written;
+		while ((iov_count > 0) && ((size_t) written >= iov->iov_len)) {
+			written -= iov->iov_len;
+			iov++;
+			iov_count--;
+		}
+
+		if (written > 0) {
+			// Finish the buffer the write stopped in, so that the
+			// vector can be restarted at a buffer boundary.
+			size_t rest = iov->iov_len - written;
+			result = write_buffer_at_offset(fd,
+							current_offset,
+							(const byte *)
+								iov->iov_base +
+								written,
+							rest);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+			current_offset += rest;
+			iov++;
+			iov_count--;
+		}
+	}
+
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int get_open_file_size(int fd, off_t *size_ptr)
 {
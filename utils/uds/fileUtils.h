@@ -23,6 +23,7 @@
 #define FILE_UTILS_H 1
 
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "common.h"
 #include "compiler.h"
@@ -133,6 +134,24 @@ int __must_check read_data_at_offset(int fd,
 				     size_t *length);
 
 
+/**
+ * Read into several buffers from a file at a given offset into the file,
+ * filling each buffer in turn.
+ *
+ * @param [in]  fd         The file descriptor from which to read
+ * @param [in]  offset     The file offset at which to start reading
+ * @param [in]  iov        The buffers into which to read
+ * @param [in]  iov_count  The number of buffers
+ * @param [out] length     The amount actually read
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check read_vectored_at_offset(int fd,
+					 off_t offset,
+					 const struct iovec *iov,
+					 int iov_count,
+					 size_t *length);
+
 /**
  * Write a buffer to a file.
  *
@@ -159,6 +178,22 @@ int __must_check write_buffer_at_offset(int fd,
 					const void *buffer,
 					size_t length);
 
+/**
+ * Write several buffers to a file starting at a given offset in the file,
+ * one after another.
+ *
+ * @param fd         The file descriptor to which to write
+ * @param offset     The offset into the file at which to write
+ * @param iov        The buffers to write
+ * @param iov_count  The number of buffers
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check write_vectored_at_offset(int fd,
+					  off_t offset,
+					  const struct iovec *iov,
+					  int iov_count);
+
 /**
  * Determine the size of an open file.
  *
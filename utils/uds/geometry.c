@@ -29,6 +29,42 @@
 #include "permassert.h"
 #include "uds.h"
 
+/**
+ * Find the standard shape of a geometry, if it has one.
+ *
+ * @param geometry  the geometry, with its page counts set
+ *
+ * @return the shape
+ **/
+static enum geometry_shape get_geometry_shape(const struct geometry *geometry)
+{
+	static const struct {
+		unsigned int record_pages;
+		unsigned int index_pages;
+		enum geometry_shape shape;
+	} shapes[] = {
+		{ 64, SHAPE_64_INDEX_PAGES, GEOMETRY_SHAPE_64 },
+		{ 128, SHAPE_128_INDEX_PAGES, GEOMETRY_SHAPE_128 },
+		{ 192, SHAPE_192_INDEX_PAGES, GEOMETRY_SHAPE_192 },
+		{ 256, SHAPE_256_INDEX_PAGES, GEOMETRY_SHAPE_256 },
+	};
+	unsigned int i;
+
+	if (geometry->bytes_per_page != DEFAULT_BYTES_PER_PAGE) {
+		return GEOMETRY_SHAPE_CUSTOM;
+	}
+
+	for (i = 0; i < COUNT_OF(shapes); i++) {
+		if ((geometry->record_pages_per_chapter ==
+		     shapes[i].record_pages) &&
+		    (geometry->index_pages_per_chapter ==
+		     shapes[i].index_pages)) {
+			return shapes[i].shape;
+		}
+	}
+	return GEOMETRY_SHAPE_CUSTOM;
+}
+
 /**********************************************************************/
 static int initialize_geometry(struct geometry *geometry,
 			       size_t bytes_per_page,
@@ -113,6 +149,14 @@ static int initialize_geometry(struct geometry *geometry,
 	geometry->bytes_per_chapter =
 		bytes_per_page * geometry->pages_per_chapter;
 
+	// Dense volumes have a power of two chapters, so a mask finds the
+	// physical chapter. A reduced volume has an odd number.
+	if ((chapters_per_volume > 1) &&
+	    ((chapters_per_volume & (chapters_per_volume - 1)) == 0)) {
+		geometry->chapter_number_mask = chapters_per_volume - 1;
+	}
+	geometry->shape = get_geometry_shape(geometry);
+
 	return UDS_SUCCESS;
 }
 
@@ -170,6 +214,10 @@ map_to_physical_chapter(const struct geometry *geometry,
 			uint64_t virtual_chapter)
 {
 	uint64_t delta;
+	if (geometry->chapter_number_mask != 0) {
+		return (virtual_chapter & geometry->chapter_number_mask);
+	}
+
 	if (!is_reduced_geometry(geometry)) {
 		return (virtual_chapter % geometry->chapters_per_volume);
 	}
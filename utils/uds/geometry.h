@@ -26,6 +26,54 @@
 #include "typeDefs.h"
 #include "uds.h"
 
+/**
+ * The standard geometries, of the default page size with 64, 128, 192 or
+ * 256 record pages per chapter. The page arithmetic on the hot index paths
+ * is specialized for each of these with constant sizes, which the compiler
+ * reduces to multiplies and shifts. Other geometries take the general path.
+ **/
+enum geometry_shape {
+	GEOMETRY_SHAPE_CUSTOM = 0,
+	GEOMETRY_SHAPE_64,
+	GEOMETRY_SHAPE_128,
+	GEOMETRY_SHAPE_192,
+	GEOMETRY_SHAPE_256,
+};
+
+enum {
+	/** The index pages per chapter of each standard geometry */
+	SHAPE_64_INDEX_PAGES = 6,
+	SHAPE_128_INDEX_PAGES = 13,
+	SHAPE_192_INDEX_PAGES = 20,
+	SHAPE_256_INDEX_PAGES = 26,
+};
+
+/**
+ * Return the result of a function called with the record and index pages
+ * per chapter of a geometry, which are compile-time constants when the
+ * geometry has a standard shape. The function should be static INLINE so
+ * that a copy is specialized for each shape.
+ *
+ * @param geometry  the geometry
+ * @param function  the function, taking the record pages and index pages
+ *                  per chapter followed by the remaining arguments
+ **/
+#define DISPATCH_ON_GEOMETRY_SHAPE(geometry, function, ...)		\
+	switch ((geometry)->shape) {					\
+	case GEOMETRY_SHAPE_64:						\
+		return function(64, SHAPE_64_INDEX_PAGES, __VA_ARGS__);	\
+	case GEOMETRY_SHAPE_128:					\
+		return function(128, SHAPE_128_INDEX_PAGES, __VA_ARGS__); \
+	case GEOMETRY_SHAPE_192:					\
+		return function(192, SHAPE_192_INDEX_PAGES, __VA_ARGS__); \
+	case GEOMETRY_SHAPE_256:					\
+		return function(256, SHAPE_256_INDEX_PAGES, __VA_ARGS__); \
+	default:							\
+		return function((geometry)->record_pages_per_chapter,	\
+				(geometry)->index_pages_per_chapter,	\
+				__VA_ARGS__);				\
+	}
+
 /**
  * geometry defines constants and a record that parameterize the
  * layout of a UDS index volume.
@@ -121,6 +169,10 @@ struct geometry {
 	unsigned int chapter_address_bits;
 	/** Number of densely-indexed chapters in a volume */
 	unsigned int dense_chapters_per_volume;
+	/** The mask giving a physical chapter, or 0 if a divide is needed */
+	uint64_t chapter_number_mask;
+	/** Which standard geometry this is, if any */
+	enum geometry_shape shape;
 };
 
 enum {
@@ -23,6 +23,7 @@
 
 #include "errors.h"
 #include "logger.h"
+#include "murmur/MurmurHash3.h"
 #include "permassert.h"
 #include "stringUtils.h"
 #include "uds.h"
@@ -105,3 +106,26 @@ void hash_utils_compile_time_assertions(void)
 	STATIC_ASSERT((UDS_CHUNK_NAME_SIZE % sizeof(uint64_t)) == 0);
 	STATIC_ASSERT(UDS_CHUNK_NAME_SIZE == 16);
 }
+
+/**********************************************************************/
+void uds_calculate_murmur3_chunk_names(const void *const blocks[],
+				       unsigned int count,
+				       size_t size,
+				       uint32_t seed,
+				       struct uds_chunk_name names[])
+{
+	unsigned int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		void *const out[4] = {
+			names[i].name,
+			names[i + 1].name,
+			names[i + 2].name,
+			names[i + 3].name,
+		};
+		MurmurHash3_x64_128_x4(&blocks[i], size, seed, out);
+	}
+	for (; i < count; i++) {
+		MurmurHash3_x64_128(blocks[i], size, seed, names[i].name);
+	}
+}
@@ -22,15 +22,22 @@
 
 #include "index.h"
 
+#include "atomicDefs.h"
 #include "hashUtils.h"
 #include "indexCheckpoint.h"
 #include "indexStateData.h"
+#include "ioThrottle.h"
 #include "logger.h"
+#include "memoryPressure.h"
 #include "openChapter.h"
+#include "recordPage.h"
 #include "requestQueue.h"
+#include "sharedIndex.h"
+#include "udsProbes.h"
+#include "warmList.h"
 #include "zone.h"
 
-static const unsigned int MAX_COMPONENT_COUNT = 4;
+static const unsigned int MAX_COMPONENT_COUNT = 5;
 static const uint64_t NO_LAST_CHECKPOINT = UINT_MAX;
 
 
@@ -48,136 +55,6 @@ static struct index_zone *get_request_zone(struct uds_index *index,
 	return index->zones[request->zone_number];
 }
 
-/**
- * Triage an index request, deciding whether it requires that a sparse cache
- * barrier message precede it.
- *
- * This resolves the chunk name in the request in the volume index,
- * determining if it is a hook or not, and if a hook, what virtual chapter (if
- * any) it might be found in. If a virtual chapter is found, it checks whether
- * that chapter appears in the sparse region of the index. If all these
- * conditions are met, the (sparse) virtual chapter number is returned. In all
- * other cases it returns <code>UINT64_MAX</code>.
- *
- * @param index	   the index that will process the request
- * @param request  the index request containing the chunk name to triage
- *
- * @return the sparse chapter number for the sparse cache barrier message, or
- *	   <code>UINT64_MAX</code> if the request does not require a barrier
- **/
-static uint64_t triage_index_request(struct uds_index *index,
-				     struct uds_request *request)
-{
-	struct volume_index_triage triage;
-	struct index_zone *zone;
-	lookup_volume_index_name(index->volume_index, &request->chunk_name,
-				 &triage);
-	if (!triage.in_sampled_chapter) {
-		// Not indexed or not a hook.
-		return UINT64_MAX;
-	}
-
-	zone = get_request_zone(index, request);
-	if (!is_zone_chapter_sparse(zone, triage.virtual_chapter)) {
-		return UINT64_MAX;
-	}
-
-	// XXX Optimize for a common case by remembering the chapter from the
-	// most recent barrier message and skipping this chapter if is it the
-	// same.
-
-	// Return the sparse chapter number to trigger the barrier messages.
-	return triage.virtual_chapter;
-}
-
-/**
- * Construct and enqueue asynchronous control messages to add the chapter
- * index for a given virtual chapter to the sparse chapter index cache.
- *
- * @param index            the index with the relevant cache and chapter
- * @param virtual_chapter  the virtual chapter number of the chapter to cache
- **/
-static void enqueue_barrier_messages(struct uds_index *index,
-				     uint64_t virtual_chapter)
-{
-	struct uds_zone_message message = {
-		.type = UDS_MESSAGE_SPARSE_CACHE_BARRIER,
-		.index = index,
-		.virtual_chapter = virtual_chapter,
-	};
-	unsigned int zone;
-	for (zone = 0; zone < index->zone_count; zone++) {
-		int result = launch_zone_message(message, zone, index);
-		ASSERT_LOG_ONLY((result == UDS_SUCCESS),
-				"barrier message allocation");
-	}
-}
-
-/**
- * Simulate the creation of a sparse cache barrier message by the triage
- * queue, and the later execution of that message in an index zone.
- *
- * If the index receiving the request is multi-zone or dense, this function
- * does nothing. This simulation is an optimization for single-zone sparse
- * indexes. It also supports unit testing of indexes without queues.
- *
- * @param zone	   the index zone responsible for the index request
- * @param request  the index request about to be executed
- *
- * @return UDS_SUCCESS always
- **/
-static int simulate_index_zone_barrier_message(struct index_zone *zone,
-					       struct uds_request *request)
-{
-	uint64_t sparse_virtual_chapter;
-	// Do nothing unless this is a single-zone sparse index.
-	if ((zone->index->zone_count > 1) ||
-	    !is_sparse(zone->index->volume->geometry)) {
-		return UDS_SUCCESS;
-	}
-
-	// Check if the index request is for a sampled name in a sparse
-	// chapter.
-	sparse_virtual_chapter = triage_index_request(zone->index, request);
-	if (sparse_virtual_chapter == UINT64_MAX) {
-		// Not indexed, not a hook, or in a chapter that is still
-		// dense, which means there should be no change to the sparse
-		// chapter index cache.
-		return UDS_SUCCESS;
-	}
-
-	/*
-	 * The triage queue would have generated and enqueued a barrier message
-	 * preceding this request, which we simulate by directly invoking the
-	 * message function.
-	 */
-	return update_sparse_cache(zone, sparse_virtual_chapter);
-}
-
-/**
- * This is the request processing function for the triage stage queue. Each
- * request is resolved in the volume index, determining if it is a hook or
- * not, and if a hook, what virtual chapter (if any) it might be found in. If
- * a virtual chapter is found, this enqueues a sparse chapter cache barrier in
- * every zone before enqueueing the request in its zone.
- *
- * @param request  the request to triage
- **/
-static void triage_request(struct uds_request *request)
-{
-	struct uds_index *index = request->index;
-
-	// Check if the name is a hook in the index pointing at a sparse
-	// chapter.
-	uint64_t sparse_virtual_chapter = triage_index_request(index, request);
-	if (sparse_virtual_chapter != UINT64_MAX) {
-		// Generate and place a barrier request on every zone queue.
-		enqueue_barrier_messages(index, sparse_virtual_chapter);
-	}
-
-	enqueue_request(request, STAGE_INDEX);
-}
-
 /**
  * This is the request processing function invoked by the zone's
  * uds_request_queue worker thread.
@@ -189,6 +66,8 @@ static void execute_zone_request(struct uds_request *request)
 	int result;
 	struct uds_index *index = request->index;
 
+	UDS_PROBE3(zone_dispatch, request, request->zone_number,
+		   request->type);
 	if (request->zone_message.type != UDS_MESSAGE_NONE) {
 		result = dispatch_index_zone_control_request(request);
 		if (result != UDS_SUCCESS) {
@@ -200,13 +79,22 @@ static void execute_zone_request(struct uds_request *request)
 		 * Asynchronous control messages are complete when they are
 		 * executed. There should be nothing they need to do on the
 		 * callback thread. The message has been completely processed,
-		 * so just free it.
+		 * so just return it to the pool.
 		 */
-		UDS_FREE(UDS_FORGET(request));
+		put_pooled_request(index->message_pool, request);
 		return;
 	}
 
-	index->need_to_save = true;
+	if (request->zone_time == 0) {
+		request->zone_time = current_time_ns(CLOCK_MONOTONIC);
+	}
+
+	// Every zone thread passes here for every request, so only write the
+	// flag when it changes, to keep the index structure from bouncing
+	// between the zones' caches.
+	if (!READ_ONCE(index->need_to_save)) {
+		WRITE_ONCE(index->need_to_save, true);
+	}
 	if (request->requeued && !is_successful(request->status)) {
 		index->callback(request);
 		return;
@@ -223,38 +111,122 @@ static void execute_zone_request(struct uds_request *request)
 }
 
 /**
- * Initialize the zone queues and the triage queue.
+ * This is the batch processing function invoked by the zone's
+ * uds_request_queue worker thread. The volume index memory for all the chunk
+ * requests in the batch is prefetched before any of them is executed.
+ *
+ * @param requests  the requests to be indexed or executed by the zone worker
+ * @param count     the number of requests
+ **/
+static void execute_zone_requests(struct uds_request **requests,
+				  unsigned int count)
+{
+	const struct uds_chunk_name *names[UDS_REQUEST_QUEUE_MAX_BATCH];
+	struct uds_index *index = requests[0]->index;
+	struct sparse_cache *sparse_cache = index->volume->sparse_cache;
+	unsigned int zone_number = requests[0]->zone_number;
+	struct index_zone *zone = index->zones[zone_number];
+	ktime_t start = current_time_ns(CLOCK_MONOTONIC);
+	unsigned int depth =
+		uds_get_request_queue_depth(index->zone_queues[zone_number]);
+	unsigned int name_count = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (requests[i]->zone_message.type == UDS_MESSAGE_NONE) {
+			names[name_count++] = &requests[i]->chunk_name;
+		}
+	}
+	if (name_count > 0) {
+		prefetch_volume_index_names(index->volume_index, names,
+					    name_count);
+	}
+
+	// The batch boundaries are the zone's quiescent points for the sparse
+	// cache.
+	if (sparse_cache != NULL) {
+		begin_sparse_cache_access(sparse_cache, zone_number);
+	}
+	for (i = 0; i < count; i++) {
+		execute_zone_request(requests[i]);
+	}
+	if (sparse_cache != NULL) {
+		end_sparse_cache_access(sparse_cache, zone_number);
+	}
+
+	// A zone with nothing more to do spends a little of its idle time
+	// evening out the free space in its delta list memory.
+	if (uds_get_request_queue_depth(index->zone_queues[zone_number]) == 0) {
+		compact_volume_index_zone(index->volume_index, zone_number);
+	}
+
+	// The requests in the batch were waiting too.
+	depth += count;
+	if (depth > zone->max_queue_depth) {
+		zone->max_queue_depth = depth;
+	}
+	zone->requests += name_count;
+	zone->busy_time += ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+				     start);
+}
+
+/**
+ * Initialize the zone queues.
  *
  * @param index     the index containing the queues
- * @param geometry  the geometry governing the indexes
  *
  * @return  UDS_SUCCESS or error code
  **/
-static int initialize_index_queues(struct uds_index *index,
-				   const struct geometry *geometry)
+static int initialize_index_queues(struct uds_index *index)
 {
 	unsigned int i;
 	for (i = 0; i < index->zone_count; i++) {
-		int result = make_uds_request_queue("indexW",
-						    &execute_zone_request,
-						    &index->zone_queues[i]);
-		if (result != UDS_SUCCESS) {
-			return result;
-		}
-	}
-
-	// The triage queue is only needed for sparse multi-zone indexes.
-	if ((index->zone_count > 1) && is_sparse(geometry)) {
-		int result = make_uds_request_queue("triageW", &triage_request,
-						    &index->triage_queue);
+		int result =
+			make_uds_batch_request_queue("indexW",
+						     &execute_zone_requests,
+						     &index->zone_queues[i]);
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
+		bind_request_queue_to_slot(index->zone_queues[i],
+					   index->affinity, i);
 	}
 
 	return UDS_SUCCESS;
 }
 
+/**
+ * Note the time taken by a phase of opening or saving an index.
+ *
+ * @param index  The index
+ * @param phase  The phase which has finished
+ * @param start  The time at which the phase started
+ **/
+static void note_index_phase(struct uds_index *index,
+			     enum uds_index_phase phase,
+			     ktime_t start)
+{
+	ktime_t elapsed = ktime_sub(current_time_ns(CLOCK_MONOTONIC), start);
+	index->phase_stats.phase_time[phase] = ktime_to_us(elapsed);
+}
+
+/**
+ * Add up the bytes all the saved components read or wrote.
+ *
+ * @param counts  The byte counts of each component
+ *
+ * @return The total number of bytes
+ **/
+static uint64_t sum_component_bytes(const uint64_t counts[UDS_COMPONENT_COUNT])
+{
+	uint64_t total = 0;
+	unsigned int i;
+	for (i = 0; i < UDS_COMPONENT_COUNT; i++) {
+		total += counts[i];
+	}
+	return total;
+}
+
 /**
  * Replay an index which was loaded from a checkpoint.
  *
@@ -271,6 +243,7 @@ static int replay_index_from_checkpoint(struct uds_index *index,
 	unsigned int chapters_per_volume;
 	int result;
 	uint64_t lowest_vcn, highest_vcn, first_replay_chapter;
+	uint64_t first_record_chapter, last_page_map_chapter;
 	bool is_empty = false;
 	enum index_lookup_mode old_lookup_mode = index->volume->lookup_mode;
 	index->volume->lookup_mode = LOOKUP_FOR_REBUILD;
@@ -305,11 +278,31 @@ static int replay_index_from_checkpoint(struct uds_index *index,
 		index->oldest_virtual_chapter++;
 	}
 
-	first_replay_chapter = last_checkpoint_chapter;
-	if (first_replay_chapter < index->oldest_virtual_chapter) {
-		first_replay_chapter = index->oldest_virtual_chapter;
-	}
-	return replay_volume(index, first_replay_chapter);
+	/*
+	 * Each zone starts its part of a checkpoint as it opens the chapter
+	 * after the checkpoint chapter, and every later change to a delta
+	 * list is held back until that list is saved, so the saved volume
+	 * index has every record through the checkpoint chapter. The saved
+	 * index page map knows the last chapter it covers, which is the
+	 * checkpoint chapter unless the chapter writer was a chapter behind
+	 * when the checkpoint started. Only the chapters missing from one or
+	 * the other need to be read, and the records of a chapter need to be
+	 * replayed only if the volume index is missing them.
+	 */
+	first_record_chapter =
+		((index->last_checkpoint != NO_LAST_CHECKPOINT) ?
+			 last_checkpoint_chapter + 1 :
+			 0);
+	last_page_map_chapter = get_last_update(index->volume->index_page_map);
+	first_replay_chapter =
+		((last_page_map_chapter > 0) ? last_page_map_chapter + 1 : 0);
+	first_replay_chapter = min(first_replay_chapter, first_record_chapter);
+	first_replay_chapter = max(first_replay_chapter,
+				   index->oldest_virtual_chapter);
+	first_record_chapter = max(first_record_chapter,
+				   index->oldest_virtual_chapter);
+	return replay_volume(index, first_replay_chapter,
+			     first_record_chapter);
 }
 
 /**********************************************************************/
@@ -350,6 +343,13 @@ static int load_index(struct uds_index *index, bool allow_replay)
 		set_active_chapters(index->zones[i]);
 	}
 
+	// A cold page cache is slower, but still correct.
+	result = start_volume_warm_up(index->volume);
+	if (result != UDS_SUCCESS) {
+		uds_log_warning_strerror(result,
+					 "not warming the page cache");
+	}
+
 	index->loaded_type = replay_required ? LOAD_REPLAY : LOAD_LOAD;
 	return UDS_SUCCESS;
 }
@@ -403,7 +403,8 @@ static int rebuild_index(struct uds_index *index)
 		return UDS_SUCCESS;
 	}
 
-	result = replay_volume(index, index->oldest_virtual_chapter);
+	result = replay_volume(index, index->oldest_virtual_chapter,
+			       index->oldest_virtual_chapter);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
@@ -416,6 +417,12 @@ static int rebuild_index(struct uds_index *index)
 	return UDS_SUCCESS;
 }
 
+/**
+ * The number of indexes allocated in this process, so each can size its
+ * share of the CPUs.
+ **/
+static atomic_t open_index_count = ATOMIC_INIT(0);
+
 /**********************************************************************/
 int allocate_index(struct index_layout *layout,
 		   const struct configuration *config,
@@ -442,6 +449,7 @@ int allocate_index(struct index_layout *layout,
 		return result;
 	}
 
+	atomic_inc(&open_index_count);
 	index->loaded_type = LOAD_UNDEFINED;
 
 	result = make_index_checkpoint(index);
@@ -451,6 +459,12 @@ int allocate_index(struct index_layout *layout,
 	}
 	set_index_checkpoint_frequency(index->checkpoint,
 				       checkpoint_frequency);
+	if ((user_params != NULL) &&
+	    (user_params->checkpoint_replay_target > 0)) {
+		set_index_checkpoint_replay_target(index->checkpoint,
+						   user_params->checkpoint_replay_target,
+						   config->geometry->chapters_per_volume - 1);
+	}
 
 	get_uds_index_layout(layout, &index->layout);
 	index->zone_count = zone_count;
@@ -462,6 +476,12 @@ int allocate_index(struct index_layout *layout,
 		return result;
 	}
 
+	result = make_request_pool(0, &index->message_pool);
+	if (result != UDS_SUCCESS) {
+		free_index(index);
+		return result;
+	}
+
 	result = make_index_state(layout, index->zone_count,
 				  MAX_COMPONENT_COUNT, &index->state);
 	if (result != UDS_SUCCESS) {
@@ -469,6 +489,19 @@ int allocate_index(struct index_layout *layout,
 		return result;
 	}
 
+	if (user_params != NULL) {
+		result = make_io_throttle(user_params->save_bandwidth,
+					  user_params->save_iops,
+					  &index->save_throttle);
+		if (result != UDS_SUCCESS) {
+			free_index(index);
+			return result;
+		}
+		index->state->throttle = index->save_throttle;
+		set_index_checkpoint_throttle(index->checkpoint,
+					      index->save_throttle);
+	}
+
 	result = add_index_state_component(index->state, &INDEX_STATE_INFO,
 					   index, NULL);
 	if (result != UDS_SUCCESS) {
@@ -476,6 +509,12 @@ int allocate_index(struct index_layout *layout,
 		return result;
 	}
 
+	result = make_thread_affinity(user_params, &index->affinity);
+	if (result != UDS_SUCCESS) {
+		free_index(index);
+		return result;
+	}
+
 	result = make_volume(config, index->layout,
 			     user_params,
 			     VOLUME_CACHE_DEFAULT_MAX_QUEUED_READS,
@@ -486,6 +525,18 @@ int allocate_index(struct index_layout *layout,
 	}
 	index->volume->lookup_mode = LOOKUP_NORMAL;
 
+	for (i = 0; i < index->volume->num_read_threads; i++) {
+		bind_thread_to_slot(index->affinity,
+				    index->volume->readers[i].thread,
+				    index->zone_count + 2 + i);
+	}
+	if (index->volume->sparse_cache != NULL) {
+		struct thread *loader =
+			get_sparse_cache_loader(index->volume->sparse_cache);
+		bind_thread_to_slot(index->affinity, loader,
+				    index->zone_count);
+	}
+
 	for (i = 0; i < index->zone_count; i++) {
 		result = make_index_zone(index, i);
 		if (result != UDS_SUCCESS) {
@@ -494,6 +545,7 @@ int allocate_index(struct index_layout *layout,
 						      "Could not create index zone");
 		}
 	}
+	index->zone_load_start = current_time_ns(CLOCK_MONOTONIC);
 
 	result = add_index_state_component(index->state, &OPEN_CHAPTER_INFO,
 					   index, NULL);
@@ -517,8 +569,12 @@ int make_index(struct index_layout *layout,
 	       struct uds_index **new_index)
 {
 	struct uds_index *index;
+	struct uds_index_phase_stats stats;
 	uint64_t nonce;
-	unsigned int zone_count = get_zone_count(user_params);
+	unsigned int i;
+	unsigned int zone_count =
+		get_zone_count(user_params, atomic_read(&open_index_count));
+	ktime_t start = current_time_ns(CLOCK_MONOTONIC);
 	int result = allocate_index(layout, config, user_params, zone_count,
 				    &index);
 	if (result != UDS_SUCCESS) {
@@ -529,7 +585,7 @@ int make_index(struct index_layout *layout,
 	index->load_context = load_context;
 	index->callback = callback;
 
-	result = initialize_index_queues(index, config->geometry);
+	result = initialize_index_queues(index);
 	if (result != UDS_SUCCESS) {
 		free_index(index);
 		return result;
@@ -544,6 +600,13 @@ int make_index(struct index_layout *layout,
 					      "could not make volume index");
 	}
 
+	// Keep each zone's portion of the volume index near its thread.
+	for (i = 0; i < zone_count; i++) {
+		bind_volume_index_zone_memory(index->volume_index, i,
+					      get_slot_node(index->affinity,
+							    i));
+	}
+
 	result = add_index_state_component(index->state, VOLUME_INDEX_INFO,
 					   NULL, index->volume_index);
 	if (result != UDS_SUCCESS) {
@@ -560,14 +623,31 @@ int make_index(struct index_layout *layout,
 		return result;
 	}
 
+	result = add_index_state_component(index->state, &WARM_LIST_INFO,
+					   index->volume, NULL);
+	if (result != UDS_SUCCESS) {
+		free_index(index);
+		return result;
+	}
+
 	result = make_chapter_writer(index, &index->chapter_writer);
 	if (result != UDS_SUCCESS) {
 		free_index(index);
 		return result;
 	}
 
+	result = claim_volume_store_zones(&index->volume->volume_store, nonce,
+					  ((load_type != LOAD_LOAD) &&
+					   (load_type != LOAD_REBUILD)));
+	if (result != UDS_SUCCESS) {
+		free_index(index);
+		return result;
+	}
+
 	if ((load_type == LOAD_LOAD) || (load_type == LOAD_REBUILD)) {
+		ktime_t phase_start = current_time_ns(CLOCK_MONOTONIC);
 		result = load_index(index, load_type == LOAD_REBUILD);
+		note_index_phase(index, UDS_PHASE_LOAD, phase_start);
 		switch (result) {
 		case UDS_SUCCESS:
 			break;
@@ -580,7 +660,10 @@ int make_index(struct index_layout *layout,
 			uds_log_error_strerror(result,
 					   "index could not be loaded");
 			if (load_type == LOAD_REBUILD) {
+				phase_start = current_time_ns(CLOCK_MONOTONIC);
 				result = rebuild_index(index);
+				note_index_phase(index, UDS_PHASE_REBUILD,
+						 phase_start);
 				if (result != UDS_SUCCESS) {
 					uds_log_error_strerror(result,
 							       "index could not be rebuilt");
@@ -599,6 +682,29 @@ int make_index(struct index_layout *layout,
 					      "fatal error in make_index");
 	}
 
+	if ((user_params != NULL) && (user_params->shared_name != NULL)) {
+		unsigned int mode = ((user_params->shared_mode != 0) ?
+				     user_params->shared_mode : 0600);
+		result = make_shared_index(index, user_params->shared_name,
+					   mode, &index->shared);
+		if (result != UDS_SUCCESS) {
+			free_index(index);
+			return uds_log_error_strerror(result,
+						      "could not share index");
+		}
+	}
+
+	if ((user_params != NULL) && (user_params->min_cache_chapters > 0)) {
+		result = make_memory_pressure_monitor(index->volume,
+						      user_params->min_cache_chapters,
+						      &index->memory_pressure);
+		if (result != UDS_SUCCESS) {
+			free_index(index);
+			return uds_log_error_strerror(result,
+						      "could not watch memory pressure");
+		}
+	}
+
 	if (index->load_context != NULL) {
 		uds_lock_mutex(&index->load_context->mutex);
 		index->load_context->status = INDEX_READY;
@@ -610,6 +716,17 @@ int make_index(struct index_layout *layout,
 
 	index->has_saved_open_chapter = (index->loaded_type == LOAD_LOAD);
 	index->need_to_save = (index->loaded_type != LOAD_LOAD);
+	note_index_phase(index, UDS_PHASE_MAKE, start);
+	get_index_phase_stats(index, &stats);
+	note_index_chapter_replay(index->checkpoint, stats.chapters_replayed,
+				  us_to_ktime(stats.phase_time[UDS_PHASE_REPLAY]));
+	uds_log_info("opened index in %llu ms (load %llu ms, replay of %llu chapters %llu ms, rebuild %llu ms, %llu bytes read)",
+		     (unsigned long long) stats.phase_time[UDS_PHASE_MAKE] / 1000,
+		     (unsigned long long) stats.phase_time[UDS_PHASE_LOAD] / 1000,
+		     (unsigned long long) stats.chapters_replayed,
+		     (unsigned long long) stats.phase_time[UDS_PHASE_REPLAY] / 1000,
+		     (unsigned long long) stats.phase_time[UDS_PHASE_REBUILD] / 1000,
+		     (unsigned long long) sum_component_bytes(stats.bytes_read));
 	*new_index = index;
 	return UDS_SUCCESS;
 }
@@ -623,7 +740,8 @@ void free_index(struct uds_index *index)
 		return;
 	}
 
-	uds_request_queue_finish(index->triage_queue);
+	// Stop resizing the caches before anything is torn down.
+	free_memory_pressure_monitor(index->memory_pressure);
 	for (i = 0; i < index->zone_count; i++) {
 		uds_request_queue_finish(index->zone_queues[i]);
 	}
@@ -633,6 +751,7 @@ void free_index(struct uds_index *index)
 	if (index->volume_index != NULL) {
 		free_volume_index(index->volume_index);
 	}
+	free_shared_index(index->shared);
 
 	if (index->zones != NULL) {
 		for (i = 0; i < index->zone_count; i++) {
@@ -644,18 +763,25 @@ void free_index(struct uds_index *index)
 	free_volume(index->volume);
 	free_index_state(index->state);
 	free_index_checkpoint(index->checkpoint);
+	free_io_throttle(index->save_throttle);
 	put_uds_index_layout(UDS_FORGET(index->layout));
+	free_thread_affinity(index->affinity);
+	free_request_pool(index->message_pool);
 	UDS_FREE(index);
+	atomic_add(-1, &open_index_count);
 }
 
 /**********************************************************************/
 int save_index(struct uds_index *index)
 {
+	struct uds_index_phase_stats stats;
+	ktime_t start;
 	int result;
 
 	if (!index->need_to_save) {
 		return UDS_SUCCESS;
 	}
+	start = current_time_ns(CLOCK_MONOTONIC);
 	wait_for_idle_chapter_writer(index->chapter_writer);
 	result = finish_checkpointing(index);
 	if (result != UDS_SUCCESS) {
@@ -671,12 +797,24 @@ int save_index(struct uds_index *index)
 	} else {
 		index->has_saved_open_chapter = true;
 		index->need_to_save = false;
-		uds_log_info("finished save (vcn %llu)",
-			     (unsigned long long) index->last_checkpoint);
+		note_index_phase(index, UDS_PHASE_SAVE, start);
+		get_index_phase_stats(index, &stats);
+		uds_log_info("finished save (vcn %llu) in %llu ms, %llu bytes written",
+			     (unsigned long long) index->last_checkpoint,
+			     (unsigned long long) stats.phase_time[UDS_PHASE_SAVE] / 1000,
+			     (unsigned long long) sum_component_bytes(stats.bytes_written));
 	}
 	return result;
 }
 
+/**********************************************************************/
+void get_index_phase_stats(const struct uds_index *index,
+			   struct uds_index_phase_stats *stats)
+{
+	*stats = index->phase_stats;
+	get_index_state_component_io(index->state, stats);
+}
+
 /**********************************************************************/
 int replace_index_storage(struct uds_index *index, const char *path)
 {
@@ -695,7 +833,7 @@ static int search_index_zone(struct index_zone *zone,
 			     struct uds_request *request)
 {
 	struct volume_index_record record;
-	bool overflow_record, found = false;
+	bool overflow_record, found = false, searched_sparse = false;
 	struct uds_chunk_data *metadata;
 	uint64_t chapter;
 	int result = get_volume_index_record(zone->index->volume_index,
@@ -714,6 +852,8 @@ static int search_index_zone(struct index_zone *zone,
 			request->location =
 				compute_index_region(zone,
 						     record.virtual_chapter);
+			request->chapter_age = (zone->newest_virtual_chapter -
+						record.virtual_chapter);
 		}
 	}
 
@@ -730,6 +870,10 @@ static int search_index_zone(struct index_zone *zone,
 		    (!request->update || overflow_record)) {
 			/* This is a query without update, or with nothing to
 			 * update */
+			if (!request->update) {
+				remember_zone_query(zone, request, found,
+						    record.virtual_chapter);
+			}
 			return UDS_SUCCESS;
 		}
 
@@ -754,6 +898,7 @@ static int search_index_zone(struct index_zone *zone,
 		    is_sparse(zone->index->volume->geometry)) {
 			// Passing UINT64_MAX triggers a search of the entire
 			// sparse cache.
+			searched_sparse = true;
 			result = search_sparse_cache_in_zone(zone, request,
 							     UINT64_MAX,
 							     &found);
@@ -769,7 +914,14 @@ static int search_index_zone(struct index_zone *zone,
 		if (request->type == UDS_QUERY) {
 			if (!found || !request->update) {
 				// This is a query without update or for a new
-				// record, so we're done.
+				// record, so we're done. The contents of the
+				// sparse cache change without the zone
+				// noticing, so only remember answers which
+				// did not depend on it.
+				if (!request->update && !searched_sparse) {
+					remember_zone_query(zone, request,
+							    false, 0);
+				}
 				return UDS_SUCCESS;
 			}
 		}
@@ -841,6 +993,8 @@ static int remove_from_index_zone(struct index_zone *zone,
 	}
 
 	request->location = compute_index_region(zone, record.virtual_chapter);
+	request->chapter_age =
+		zone->newest_virtual_chapter - record.virtual_chapter;
 
 	/*
 	 * Delete the volume index entry for the named record only. Note that a
@@ -876,27 +1030,28 @@ int dispatch_index_request(struct uds_index *index,
 	int result;
 	struct index_zone *zone = get_request_zone(index, request);
 
-	if (!request->requeued) {
-		// Single-zone sparse indexes don't have a triage queue to
-		// generate cache barrier requests, so see if we need to
-		// synthesize a barrier.
-		int result =
-			simulate_index_zone_barrier_message(zone, request);
-		if (result != UDS_SUCCESS) {
-			return result;
-		}
-	}
-
 	request->location = UDS_LOCATION_UNKNOWN;
 
 	switch (request->type) {
+	case UDS_QUERY:
+		if (!request->update) {
+			result = (answer_query_from_zone_cache(zone, request) ?
+				  UDS_SUCCESS :
+				  search_index_zone(zone, request));
+			break;
+		}
+		fallthrough;
+
 	case UDS_POST:
 	case UDS_UPDATE:
-	case UDS_QUERY:
+		forget_zone_query(zone, &request->chunk_name);
 		result = search_index_zone(zone, request);
 		break;
 
 	case UDS_DELETE:
+		// Deleting a name can also change which names collide with
+		// it, so forget everything.
+		forget_zone_queries(zone);
 		result = remove_from_index_zone(zone, request);
 		break;
 
@@ -960,7 +1115,10 @@ static int rebuild_index_page_map(struct uds_index *index, uint64_t vcn)
 }
 
 /**
- * Add an entry to the volume index when rebuilding.
+ * Update the volume index entry for a record when rebuilding, or decide
+ * that the record needs a new entry.  New entries are not put here, but are
+ * left to be added with the rest of the chapter, so that each delta list is
+ * rewritten once per chapter instead of once per record.
  *
  * @param index			  The index to query.
  * @param name			  The block name of interest.
@@ -969,17 +1127,24 @@ static int rebuild_index_page_map(struct uds_index *index, uint64_t vcn)
  * @param will_be_sparse_chapter  True if this entry will be in the sparse
  *				  portion of the index at the end of
  *				  rebuilding
+ * @param search_mutex		  The mutex serializing searches of the
+ *				  volume page cache between zones
+ * @param add_record		  Set to true if the block name needs a new
+ *				  volume index entry
  *
  * @return UDS_SUCCESS or an error code
  **/
 static int replay_record(struct uds_index *index,
 			 const struct uds_chunk_name *name,
 			 uint64_t virtual_chapter,
-			 bool will_be_sparse_chapter)
+			 bool will_be_sparse_chapter,
+			 struct mutex *search_mutex,
+			 bool *add_record)
 {
 	struct volume_index_record record;
 	bool update_record;
 	int result;
+	*add_record = false;
 	if (will_be_sparse_chapter &&
 	    !is_volume_index_sample(index->volume_index, name)) {
 		// This entry will be in a sparse chapter after the rebuild
@@ -1022,10 +1187,15 @@ static int replay_record(struct uds_index *index,
 			 * that chapter to determine if the volume index entry
 			 * was for the same record or a different one.
 			 */
+			// Searches without a request all use the state of
+			// zone 0 in the page cache, so only one zone may
+			// search at a time.
+			uds_lock_mutex(search_mutex);
 			result = search_volume_page_cache(index->volume,
 							  NULL, name,
 							  record.virtual_chapter,
 							  NULL, &update_record);
+			uds_unlock_mutex(search_mutex);
 			if (result != UDS_SUCCESS) {
 				return result;
 			}
@@ -1034,15 +1204,7 @@ static int replay_record(struct uds_index *index,
 		update_record = false;
 	}
 
-	if (update_record) {
-		/*
-		 * Update the volume index to reference the new chapter for the
-		 * block. If the record had been deleted or dropped from the
-		 * chapter index, it will be back.
-		 */
-		result = set_volume_index_record_chapter(&record,
-							 virtual_chapter);
-	} else {
+	if (!update_record) {
 		/*
 		 * Add a new entry to the volume index referencing the open
 		 * chapter. This should be done regardless of whether we are a
@@ -1050,11 +1212,18 @@ static int replay_record(struct uds_index *index,
 		 * exist in the index but does on disk, since for a sparse
 		 * record, we would want to un-sparsify if it did exist.
 		 */
-		result = put_volume_index_record(&record, virtual_chapter);
+		*add_record = true;
+		return UDS_SUCCESS;
 	}
 
-	if ((result == UDS_DUPLICATE_NAME) || (result == UDS_OVERFLOW)) {
-		/* Ignore duplicate record and delta list overflow errors */
+	/*
+	 * Update the volume index to reference the new chapter for the
+	 * block. If the record had been deleted or dropped from the chapter
+	 * index, it will be back.
+	 */
+	result = set_volume_index_record_chapter(&record, virtual_chapter);
+	if (result == UDS_DUPLICATE_NAME) {
+		/* Ignore duplicate record errors */
 		return UDS_SUCCESS;
 	}
 
@@ -1110,20 +1279,628 @@ static bool check_for_suspend(struct uds_index *index)
 	return ret_val;
 }
 
+/*
+ * The records of a chapter being replayed are applied to each volume index
+ * zone by a separate thread, in chapter order, while a reader thread reads
+ * the chapters which follow it.
+ */
+struct replay_zone {
+	/* The index being replayed */
+	struct uds_index *index;
+	/* The volume index zone being replayed */
+	unsigned int zone;
+	/* The first chapter whose records the zone must replay */
+	uint64_t from_vcn;
+	/* The virtual chapter being replayed */
+	uint64_t vcn;
+	/* Whether the chapter will be sparse when the replay is done */
+	bool will_be_sparse_chapter;
+	/* The names of the records in the chapter, in chapter order */
+	const struct uds_chunk_name *names;
+	/* The names of the chapter which need new volume index entries */
+	const struct uds_chunk_name **additions;
+	/* The mutex serializing page cache searches between the zones */
+	struct mutex *search_mutex;
+	/* The thread replaying the zone, if any */
+	struct thread *thread;
+	/* The result of replaying the zone */
+	int result;
+};
+
+enum {
+	/* The number of chapters which may be read ahead of the replay */
+	REPLAY_READ_AHEAD_CHAPTERS = 4,
+	/* The number of record pages read from the volume at once */
+	REPLAY_READ_PAGES = 16,
+};
+
+/*
+ * A chapter read ahead of the replay. The slots are filled by the reader and
+ * emptied by the replay in virtual chapter order.
+ */
+struct replay_chapter {
+	/* The names of the records in the chapter, in chapter order */
+	struct uds_chunk_name *names;
+	/* Whether the chapter has been read */
+	bool ready;
+	/* The result of reading the chapter */
+	int result;
+};
+
+struct replay_reader {
+	/* The index being replayed */
+	struct uds_index *index;
+	/* The first chapter to read */
+	uint64_t from_vcn;
+	/* The chapter after the last one to read */
+	uint64_t upto_vcn;
+	/* The oldest chapter which has not been replayed */
+	uint64_t replay_vcn;
+	/* Whether the replay has stopped wanting chapters */
+	bool stopping;
+	/* The mutex protecting the slots and the fields above */
+	struct mutex mutex;
+	/* The condition signalled when a slot is filled or emptied */
+	struct cond_var cond;
+	/* The chapters read ahead of the replay */
+	struct replay_chapter chapters[REPLAY_READ_AHEAD_CHAPTERS];
+	/* A buffer for the record pages being read */
+	byte *pages;
+	/* A buffer for expanding a compressed record page */
+	byte *unpacked_page;
+	/* The reader thread, if any */
+	struct thread *thread;
+};
+
+/**
+ * Rebuild the index page map for a chapter and read the names of all the
+ * records in it. The record pages are read straight from the volume store in
+ * large runs rather than through the page cache, so that the rebuild does
+ * not churn the cache a page at a time.
+ *
+ * @param reader  The chapter reader
+ * @param vcn     The virtual chapter to read
+ * @param names   An array to hold the names of the records in the chapter
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int read_replay_chapter(struct replay_reader *reader,
+			       uint64_t vcn,
+			       struct uds_chunk_name *names)
+{
+	struct uds_index *index = reader->index;
+	const struct geometry *geometry = index->volume->geometry;
+	unsigned int chapter = map_to_physical_chapter(geometry, vcn);
+	unsigned int first_page =
+		map_to_physical_page(geometry, chapter,
+				     geometry->index_pages_per_chapter);
+	unsigned int i, j, k;
+	int result;
+
+	if (vcn + 1 < reader->upto_vcn) {
+		/*
+		 * Start reading the next chapter while this one is being read
+		 * and replayed.
+		 */
+		unsigned int next_chapter =
+			map_to_physical_chapter(geometry, vcn + 1);
+		prefetch_volume_pages(&index->volume->volume_store,
+				      map_to_physical_page(geometry,
+							   next_chapter,
+							   0),
+				      geometry->pages_per_chapter);
+	}
+
+	result = rebuild_index_page_map(index, vcn);
+	if (result != UDS_SUCCESS) {
+		return uds_log_error_strerror(result,
+					      "could not rebuild index page map for chapter %u",
+					      chapter);
+	}
+
+	for (i = 0; i < geometry->record_pages_per_chapter;
+	     i += REPLAY_READ_PAGES) {
+		unsigned int count = geometry->record_pages_per_chapter - i;
+		if (count > REPLAY_READ_PAGES) {
+			count = REPLAY_READ_PAGES;
+		}
+
+		result = read_volume_pages(&index->volume->volume_store,
+					   first_page + i, count,
+					   reader->pages);
+		if (result != UDS_SUCCESS) {
+			return uds_log_error_strerror(result,
+						      "could not read record pages of chapter %u",
+						      chapter);
+		}
+		for (j = 0; j < count; j++) {
+			const byte *record_page =
+				reader->pages + (j * geometry->bytes_per_page);
+			if (get_stored_record_page_size(geometry, record_page) <
+			    geometry->bytes_per_page) {
+				unpack_record_page(geometry, record_page,
+						   reader->unpacked_page);
+				record_page = reader->unpacked_page;
+			}
+			for (k = 0; k < geometry->records_per_page; k++) {
+				memcpy(&names->name,
+				       record_page + (k * BYTES_PER_RECORD),
+				       UDS_CHUNK_NAME_SIZE);
+				names++;
+			}
+		}
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Read chapters ahead of the replay until they have all been read, reading
+ * fails, or the replay stops.
+ *
+ * @param reader  The chapter reader
+ **/
+static void read_replay_chapters(struct replay_reader *reader)
+{
+	uint64_t vcn;
+
+	for (vcn = reader->from_vcn; vcn < reader->upto_vcn; vcn++) {
+		struct replay_chapter *slot =
+			&reader->chapters[(vcn - reader->from_vcn) %
+					  REPLAY_READ_AHEAD_CHAPTERS];
+		bool stopping;
+		int result;
+
+		uds_lock_mutex(&reader->mutex);
+		while (!reader->stopping &&
+		       (vcn >= reader->replay_vcn + REPLAY_READ_AHEAD_CHAPTERS)) {
+			uds_wait_cond(&reader->cond, &reader->mutex);
+		}
+		stopping = reader->stopping;
+		uds_unlock_mutex(&reader->mutex);
+		if (stopping) {
+			return;
+		}
+
+		result = read_replay_chapter(reader, vcn, slot->names);
+
+		uds_lock_mutex(&reader->mutex);
+		slot->result = result;
+		slot->ready = true;
+		uds_broadcast_cond(&reader->cond);
+		uds_unlock_mutex(&reader->mutex);
+		if (result != UDS_SUCCESS) {
+			return;
+		}
+	}
+}
+
 /**********************************************************************/
-int replay_volume(struct uds_index *index, uint64_t from_vcn)
+static void replay_reader_thread(void *arg)
+{
+	read_replay_chapters(arg);
+}
+
+/**
+ * Get the names of the records in the next chapter to replay, waiting for
+ * the reader if it has not read the chapter yet, or reading the chapter
+ * here if there is no reader thread.
+ *
+ * @param reader  The chapter reader
+ * @param vcn     The virtual chapter to replay
+ * @param names   A pointer to hold the names of the records in the chapter
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int get_replay_chapter(struct replay_reader *reader,
+			      uint64_t vcn,
+			      const struct uds_chunk_name **names)
+{
+	struct replay_chapter *slot =
+		&reader->chapters[(vcn - reader->from_vcn) %
+				  REPLAY_READ_AHEAD_CHAPTERS];
+	int result;
+
+	if (reader->thread == NULL) {
+		result = read_replay_chapter(reader, vcn, slot->names);
+	} else {
+		uds_lock_mutex(&reader->mutex);
+		while (!slot->ready) {
+			uds_wait_cond(&reader->cond, &reader->mutex);
+		}
+		result = slot->result;
+		uds_unlock_mutex(&reader->mutex);
+	}
+
+	*names = slot->names;
+	return result;
+}
+
+/**
+ * Return the slot of a chapter which has been replayed to the reader.
+ *
+ * @param reader  The chapter reader
+ * @param vcn     The virtual chapter which has been replayed
+ **/
+static void release_replay_chapter(struct replay_reader *reader, uint64_t vcn)
+{
+	uds_lock_mutex(&reader->mutex);
+	reader->chapters[(vcn - reader->from_vcn) %
+			 REPLAY_READ_AHEAD_CHAPTERS].ready = false;
+	reader->replay_vcn = vcn + 1;
+	uds_broadcast_cond(&reader->cond);
+	uds_unlock_mutex(&reader->mutex);
+}
+
+/**
+ * Replay the records of a chapter that belong to one volume index zone.
+ *
+ * @param replay  The zone and chapter to replay
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int replay_chapter_zone(struct replay_zone *replay)
+{
+	struct uds_index *index = replay->index;
+	unsigned int records = index->volume->geometry->records_per_chapter;
+	unsigned int addition_count = 0;
+	unsigned int i;
+	int result;
+
+	set_volume_index_zone_open_chapter(index->volume_index, replay->zone,
+					   replay->vcn);
+	for (i = 0; i < records; i++) {
+		const struct uds_chunk_name *name = &replay->names[i];
+		bool add_record;
+
+		if ((index->zone_count > 1) &&
+		    (get_volume_index_zone(index->volume_index, name) !=
+		     replay->zone)) {
+			continue;
+		}
+
+		result = replay_record(index, name, replay->vcn,
+				       replay->will_be_sparse_chapter,
+				       replay->search_mutex, &add_record);
+		if (result != UDS_SUCCESS) {
+			char hex_name[(2 * UDS_CHUNK_NAME_SIZE) + 1];
+			if (chunk_name_to_hex(name, hex_name,
+					      sizeof(hex_name)) !=
+			    UDS_SUCCESS) {
+				strncpy(hex_name, "<unknown>",
+					sizeof(hex_name));
+			}
+			return uds_log_error_strerror(result,
+						      "could not find block %s during rebuild",
+						      hex_name);
+		}
+		if (add_record) {
+			replay->additions[addition_count++] = name;
+		}
+	}
+
+	result = put_volume_index_records(index->volume_index,
+					  replay->additions, addition_count,
+					  replay->vcn);
+	if (result == UDS_OVERFLOW) {
+		/* Ignore delta list overflow errors */
+		return UDS_SUCCESS;
+	}
+	if (result != UDS_SUCCESS) {
+		return uds_log_error_strerror(result,
+					      "could not add the records of chapter %llu during rebuild",
+					      (unsigned long long) replay->vcn);
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+static void replay_chapter_zone_thread(void *arg)
+{
+	struct replay_zone *replay = arg;
+
+	replay->result = replay_chapter_zone(replay);
+}
+
+/**
+ * Replay a chapter whose record names have been read, with one thread for
+ * each volume index zone. A zone whose thread can't be started is replayed
+ * on this thread. A zone which already has the records of the chapter is
+ * skipped.
+ *
+ * @param index     The index being replayed
+ * @param replays   The replay state of each zone
+ * @param from_vcn  The first chapter being replayed
+ * @param vcn       The virtual chapter to replay
+ * @param upto_vcn  The chapter after the last one to replay
+ * @param names     The names of the records in the chapter
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int replay_chapter(struct uds_index *index,
+			  struct replay_zone *replays,
+			  uint64_t from_vcn,
+			  uint64_t vcn,
+			  uint64_t upto_vcn,
+			  const struct uds_chunk_name *names)
+{
+	const struct geometry *geometry = index->volume->geometry;
+	bool will_be_sparse_chapter =
+		is_chapter_sparse(geometry, from_vcn, upto_vcn, vcn);
+	unsigned int z;
+	int result = UDS_SUCCESS;
+
+	for (z = 0; z < index->zone_count; z++) {
+		struct replay_zone *replay = &replays[z];
+		replay->vcn = vcn;
+		replay->will_be_sparse_chapter = will_be_sparse_chapter;
+		replay->names = names;
+		replay->result = UDS_SUCCESS;
+		replay->thread = NULL;
+		if (vcn < replay->from_vcn) {
+			continue;
+		}
+		if ((index->zone_count == 1) ||
+		    (uds_create_thread(replay_chapter_zone_thread, replay,
+				       "replay", &replay->thread) !=
+		     UDS_SUCCESS)) {
+			replay->thread = NULL;
+		}
+	}
+
+	for (z = 0; z < index->zone_count; z++) {
+		struct replay_zone *replay = &replays[z];
+		if (vcn < replay->from_vcn) {
+			continue;
+		}
+		if (replay->thread != NULL) {
+			uds_join_threads(replay->thread);
+			replay->thread = NULL;
+		} else {
+			replay->result = replay_chapter_zone(replay);
+		}
+		if (result == UDS_SUCCESS) {
+			result = replay->result;
+		}
+	}
+	return result;
+}
+
+/**
+ * Replay a range of chapters into the volume index as the reader supplies
+ * them, using the replay state already set up for each zone.
+ *
+ * @param index     The index to replay
+ * @param replays   The replay state of each zone
+ * @param reader    The chapter reader
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int replay_chapter_range(struct uds_index *index,
+				struct replay_zone *replays,
+				struct replay_reader *reader)
+{
+	uint64_t vcn;
+
+	for (vcn = reader->from_vcn; vcn < reader->upto_vcn; ++vcn) {
+		const struct uds_chunk_name *names;
+		int result;
+
+		if (check_for_suspend(index)) {
+			uds_log_info("Replay interrupted by index shutdown at chapter %llu",
+				     (unsigned long long) vcn);
+			return -EBUSY;
+		}
+
+		result = get_replay_chapter(reader, vcn, &names);
+		if (result == UDS_SUCCESS) {
+			result = replay_chapter(index, replays,
+						reader->from_vcn, vcn,
+						reader->upto_vcn, names);
+		}
+		release_replay_chapter(reader, vcn);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Free the buffers of a chapter reader.
+ *
+ * @param reader  The chapter reader
+ **/
+static void free_replay_reader_buffers(struct replay_reader *reader)
+{
+	unsigned int i;
+
+	for (i = 0; i < REPLAY_READ_AHEAD_CHAPTERS; i++) {
+		UDS_FREE(reader->chapters[i].names);
+		reader->chapters[i].names = NULL;
+	}
+	UDS_FREE(reader->pages);
+	reader->pages = NULL;
+	UDS_FREE(reader->unpacked_page);
+	reader->unpacked_page = NULL;
+}
+
+/**
+ * Initialize a chapter reader, and start its thread if possible.
+ *
+ * @param reader    The chapter reader to initialize
+ * @param index     The index being replayed
+ * @param from_vcn  The first chapter to read
+ * @param upto_vcn  The chapter after the last one to read
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int initialize_replay_reader(struct replay_reader *reader,
+				    struct uds_index *index,
+				    uint64_t from_vcn,
+				    uint64_t upto_vcn)
+{
+	const struct geometry *geometry = index->volume->geometry;
+	unsigned int i;
+	int result;
+
+	memset(reader, 0, sizeof(*reader));
+	reader->index = index;
+	reader->from_vcn = from_vcn;
+	reader->upto_vcn = upto_vcn;
+	reader->replay_vcn = from_vcn;
+
+	result = UDS_ALLOCATE_IO_ALIGNED(REPLAY_READ_PAGES *
+						 geometry->bytes_per_page,
+					 byte, "replay record pages",
+					 &reader->pages);
+	if (result == UDS_SUCCESS) {
+		result = UDS_ALLOCATE(geometry->bytes_per_page, byte,
+				      "replay unpacked record page",
+				      &reader->unpacked_page);
+	}
+	for (i = 0;
+	     (result == UDS_SUCCESS) && (i < REPLAY_READ_AHEAD_CHAPTERS);
+	     i++) {
+		result = UDS_ALLOCATE(geometry->records_per_chapter,
+				      struct uds_chunk_name,
+				      "replay chapter names",
+				      &reader->chapters[i].names);
+	}
+	if (result != UDS_SUCCESS) {
+		free_replay_reader_buffers(reader);
+		return result;
+	}
+
+	result = uds_init_mutex(&reader->mutex);
+	if (result != UDS_SUCCESS) {
+		free_replay_reader_buffers(reader);
+		return result;
+	}
+
+	result = uds_init_cond(&reader->cond);
+	if (result != UDS_SUCCESS) {
+		uds_destroy_mutex(&reader->mutex);
+		free_replay_reader_buffers(reader);
+		return result;
+	}
+
+	if (uds_create_thread(replay_reader_thread, reader, "replayread",
+			      &reader->thread) != UDS_SUCCESS) {
+		reader->thread = NULL;
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Stop a chapter reader, wait for its thread to finish, and release its
+ * resources.
+ *
+ * @param reader  The chapter reader
+ **/
+static void destroy_replay_reader(struct replay_reader *reader)
+{
+	uds_lock_mutex(&reader->mutex);
+	reader->stopping = true;
+	uds_broadcast_cond(&reader->cond);
+	uds_unlock_mutex(&reader->mutex);
+	if (reader->thread != NULL) {
+		uds_join_threads(reader->thread);
+		reader->thread = NULL;
+	}
+
+	uds_destroy_cond(&reader->cond);
+	uds_destroy_mutex(&reader->mutex);
+	free_replay_reader_buffers(reader);
+}
+
+/**
+ * Replay a range of chapters into the volume index, and rebuild the index
+ * page map for them. The chapters are read and their index page maps are
+ * rebuilt ahead of the replay by a reader thread, so that the volume is read
+ * while the records of earlier chapters are being inserted.
+ *
+ * @param index            The index to replay
+ * @param from_vcn         The first chapter to replay
+ * @param record_from_vcn  The first chapter whose records must be replayed
+ * @param upto_vcn         The chapter after the last one to replay
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int replay_chapters(struct uds_index *index,
+			   uint64_t from_vcn,
+			   uint64_t record_from_vcn,
+			   uint64_t upto_vcn)
+{
+	struct replay_reader reader;
+	struct replay_zone *replays;
+	struct mutex search_mutex;
+	unsigned int z;
+	int result = UDS_ALLOCATE(index->zone_count,
+				  struct replay_zone,
+				  "replay zones",
+				  &replays);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	for (z = 0; z < index->zone_count; z++) {
+		result = UDS_ALLOCATE(index->volume->geometry->records_per_chapter,
+				      const struct uds_chunk_name *,
+				      "replay additions",
+				      &replays[z].additions);
+		if (result != UDS_SUCCESS) {
+			break;
+		}
+	}
+	if (result == UDS_SUCCESS) {
+		result = uds_init_mutex(&search_mutex);
+	}
+	if (result != UDS_SUCCESS) {
+		for (z = 0; z < index->zone_count; z++) {
+			UDS_FREE(replays[z].additions);
+		}
+		UDS_FREE(replays);
+		return result;
+	}
+
+	result = initialize_replay_reader(&reader, index, from_vcn, upto_vcn);
+	if (result == UDS_SUCCESS) {
+		for (z = 0; z < index->zone_count; z++) {
+			replays[z].index = index;
+			replays[z].zone = z;
+			replays[z].from_vcn = record_from_vcn;
+			replays[z].search_mutex = &search_mutex;
+		}
+		result = replay_chapter_range(index, replays, &reader);
+		destroy_replay_reader(&reader);
+	}
+
+	uds_destroy_mutex(&search_mutex);
+	for (z = 0; z < index->zone_count; z++) {
+		UDS_FREE(replays[z].additions);
+	}
+	UDS_FREE(replays);
+	return result;
+}
+
+/**********************************************************************/
+int replay_volume(struct uds_index *index,
+		  uint64_t from_vcn,
+		  uint64_t record_from_vcn)
 {
 	int result;
-	unsigned int j, k;
 	enum index_lookup_mode old_lookup_mode;
-	const struct geometry *geometry;
-	uint64_t old_ipm_update, new_ipm_update, vcn;
+	uint64_t old_ipm_update, new_ipm_update;
 	uint64_t upto_vcn = index->newest_virtual_chapter;
+	ktime_t start = current_time_ns(CLOCK_MONOTONIC);
 	uds_log_info("Replaying volume from chapter %llu through chapter %llu",
 		     (unsigned long long) from_vcn,
 		     (unsigned long long) upto_vcn);
+	if ((record_from_vcn > from_vcn) && (record_from_vcn < upto_vcn)) {
+		uds_log_info("volume index already has chapters before %llu",
+			     (unsigned long long) record_from_vcn);
+	}
 	set_volume_index_open_chapter(index->volume_index, upto_vcn);
-	set_volume_index_open_chapter(index->volume_index, from_vcn);
+	set_volume_index_open_chapter(index->volume_index, record_from_vcn);
 
 	/*
 	 * At least two cases to deal with here!
@@ -1145,74 +1922,18 @@ int replay_volume(struct uds_index *index, uint64_t from_vcn)
 	 * Also, go through each index page for each chapter and rebuild the
 	 * index page map.
 	 */
-	geometry = index->volume->geometry;
 	old_ipm_update = get_last_update(index->volume->index_page_map);
-	for (vcn = from_vcn; vcn < upto_vcn; ++vcn) {
-		bool will_be_sparse_chapter;
-		unsigned int chapter;
-		if (check_for_suspend(index)) {
-			uds_log_info("Replay interrupted by index shutdown at chapter %llu",
-				     (unsigned long long) vcn);
-			return -EBUSY;
-		}
-
-		will_be_sparse_chapter =
-			is_chapter_sparse(geometry, from_vcn, upto_vcn, vcn);
-		chapter = map_to_physical_chapter(geometry, vcn);
-		prefetch_volume_pages(&index->volume->volume_store,
-				      map_to_physical_page(geometry, chapter, 0),
-				      geometry->pages_per_chapter);
-		set_volume_index_open_chapter(index->volume_index, vcn);
-		result = rebuild_index_page_map(index, vcn);
+	if (from_vcn < upto_vcn) {
+		result = replay_chapters(index, from_vcn, record_from_vcn,
+					 upto_vcn);
 		if (result != UDS_SUCCESS) {
 			index->volume->lookup_mode = old_lookup_mode;
-			return uds_log_error_strerror(result,
-						      "could not rebuild index page map for chapter %u",
-						      chapter);
-		}
-
-		for (j = 0; j < geometry->record_pages_per_chapter; j++) {
-			byte *record_page;
-			unsigned int record_page_number =
-				geometry->index_pages_per_chapter + j;
-			result = get_volume_page(index->volume, chapter,
-						 record_page_number,
-						 CACHE_PROBE_RECORD_FIRST,
-						 &record_page, NULL);
-			if (result != UDS_SUCCESS) {
-				index->volume->lookup_mode = old_lookup_mode;
-				return uds_log_error_strerror(result,
-							      "could not get page %d",
-							      record_page_number);
-			}
-			for (k = 0; k < geometry->records_per_page; k++) {
-				const byte *name_bytes =
-					record_page + (k * BYTES_PER_RECORD);
-
-				struct uds_chunk_name name;
-				memcpy(&name.name, name_bytes,
-				       UDS_CHUNK_NAME_SIZE);
-
-				result = replay_record(index, &name, vcn,
-						       will_be_sparse_chapter);
-				if (result != UDS_SUCCESS) {
-					char hex_name[(2 * UDS_CHUNK_NAME_SIZE) +
-						      1];
-					if (chunk_name_to_hex(&name, hex_name,
-							      sizeof(hex_name)) !=
-					    UDS_SUCCESS) {
-						strncpy(hex_name, "<unknown>",
-							sizeof(hex_name));
-					}
-					index->volume->lookup_mode =
-						old_lookup_mode;
-					return uds_log_error_strerror(result,
-								      "could not find block %s during rebuild",
-								      hex_name);
-				}
-			}
+			note_index_phase(index, UDS_PHASE_REPLAY, start);
+			return result;
 		}
 	}
+	index->phase_stats.chapters_replayed =
+		(from_vcn < upto_vcn) ? upto_vcn - from_vcn : 0;
 	index->volume->lookup_mode = old_lookup_mode;
 
 	// We also need to reap the chapter being replaced by the open chapter
@@ -1226,6 +1947,7 @@ int replay_volume(struct uds_index *index, uint64_t from_vcn)
 			     (unsigned long long) new_ipm_update);
 	}
 
+	note_index_phase(index, UDS_PHASE_REPLAY, start);
 	return UDS_SUCCESS;
 }
 
@@ -1246,10 +1968,119 @@ void get_index_stats(struct uds_index *index, struct uds_index_stats *counters)
 		((uint64_t) dense_stats.memory_allocated +
 		 (uint64_t) sparse_stats.memory_allocated +
 		 (uint64_t) get_cache_size(index->volume) + cw_allocated);
+	counters->huge_page_memory_used =
+		((uint64_t) dense_stats.huge_page_memory +
+		 (uint64_t) sparse_stats.huge_page_memory +
+		 (uint64_t) get_page_cache_huge_page_memory(index->volume->page_cache));
+	get_page_cache_stats(index->volume->page_cache, &counters->page_cache);
+	get_compressed_cache_stats(index->volume->compressed_cache,
+				   &counters->compressed_cache);
+	get_sparse_cache_stats(index->volume->sparse_cache,
+			       &counters->sparse_cache);
+	get_memory_pressure_stats(index->memory_pressure,
+				  &counters->memory_pressure);
+	get_volume_reader_stats(index->volume, &counters->readers);
 	counters->collisions =
 		(dense_stats.collision_count + sparse_stats.collision_count);
 	counters->entries_discarded =
 		(dense_stats.discard_count + sparse_stats.discard_count);
+	counters->volume_index_filter.memory_used =
+		(dense_stats.filter.memory_allocated +
+		 sparse_stats.filter.memory_allocated);
+	counters->volume_index_filter.negatives =
+		(dense_stats.filter.negatives + sparse_stats.filter.negatives);
+	counters->volume_index_filter.passes =
+		(dense_stats.filter.passes + sparse_stats.filter.passes);
+	counters->volume_index_filter.false_positives =
+		(dense_stats.filter.false_positives +
+		 sparse_stats.filter.false_positives);
+	counters->volume_index_filter.rebuilds =
+		(dense_stats.filter.rebuilds + sparse_stats.filter.rebuilds);
+}
+
+/**********************************************************************/
+void get_index_backlog(struct uds_index *index,
+		       struct uds_index_backlog *backlog)
+{
+	struct page_cache *cache = index->volume->page_cache;
+	unsigned int z;
+
+	memset(backlog, 0, sizeof(*backlog));
+	backlog->zone_count =
+		min(index->zone_count, (unsigned int) UDS_LATENCY_MAX_ZONES);
+	for (z = 0; z < backlog->zone_count; z++) {
+		backlog->zone_requests[z] =
+			uds_get_request_queue_depth(index->zone_queues[z]);
+	}
+	backlog->queued_reads = get_read_queue_occupancy(cache);
+	// One entry is always left empty to tell a full queue from an empty
+	// one.
+	backlog->read_queue_size = cache->read_queue_max_size - 1;
+}
+
+/**
+ * Compute how far the busiest zone is above an even share of a total.
+ *
+ * @param busiest     The count of the busiest zone
+ * @param total       The count of all the zones together
+ * @param zone_count  The number of zones
+ *
+ * @return The busiest count as a percentage of an even share, or 100 if
+ *         nothing has been counted
+ **/
+static unsigned int compute_zone_skew(uint64_t busiest,
+				      uint64_t total,
+				      unsigned int zone_count)
+{
+	if (total == 0) {
+		return 100;
+	}
+	return (unsigned int) ((busiest * zone_count * 100) / total);
+}
+
+/**********************************************************************/
+void get_index_zone_stats(struct uds_index *index,
+			  struct uds_index_zone_stats *stats)
+{
+	uint64_t total_requests = 0, most_requests = 0;
+	ktime_t total_busy = 0, most_busy = 0;
+	unsigned int z;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->elapsed_time =
+		ktime_to_us(ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+				      index->zone_load_start));
+	stats->zone_count =
+		min(index->zone_count, (unsigned int) UDS_LATENCY_MAX_ZONES);
+	// The zone threads update their counts as they go, so each is read
+	// once and the totals are made from the copies.
+	for (z = 0; z < index->zone_count; z++) {
+		const struct index_zone *zone = index->zones[z];
+		uint64_t requests = READ_ONCE(zone->requests);
+		ktime_t busy = READ_ONCE(zone->busy_time);
+
+		total_requests += requests;
+		most_requests = max(most_requests, requests);
+		total_busy += busy;
+		most_busy = max(most_busy, busy);
+		if (z < stats->zone_count) {
+			stats->zones[z] = (struct uds_zone_load) {
+				.requests = requests,
+				.busy_time = ktime_to_us(busy),
+				.queue_depth =
+					uds_get_request_queue_depth(index->zone_queues[z]),
+				.max_queue_depth =
+					READ_ONCE(zone->max_queue_depth),
+				.cached_queries =
+					READ_ONCE(zone->cached_queries),
+			};
+		}
+	}
+	stats->request_skew = compute_zone_skew(most_requests, total_requests,
+						index->zone_count);
+	stats->busy_skew = compute_zone_skew(ktime_to_us(most_busy),
+					     ktime_to_us(total_busy),
+					     index->zone_count);
 }
 
 /**********************************************************************/
@@ -1267,17 +2098,6 @@ struct uds_request_queue *select_index_queue(struct uds_index *index,
 					     enum request_stage next_stage)
 {
 	switch (next_stage) {
-	case STAGE_TRIAGE:
-		// The triage queue is only needed for multi-zone sparse
-		// indexes and won't be allocated by the index if not needed,
-		// so simply check for NULL.
-		if (index->triage_queue != NULL) {
-			return index->triage_queue;
-		}
-		// Dense index or single zone, so route it directly to the zone
-		// queue.
-		fallthrough;
-
 	case STAGE_INDEX:
 		request->zone_number =
 			get_volume_index_zone(index->volume_index,
@@ -29,6 +29,8 @@
 #include "loadType.h"
 #include "volumeIndexOps.h"
 #include "request.h"
+#include "requestPool.h"
+#include "threadAffinity.h"
 #include "volume.h"
 
 
@@ -37,6 +39,12 @@
  **/
 struct index_checkpoint;
 
+/**
+ * Shared memory publishing the index to other processes, private to
+ * sharedIndex.c.
+ **/
+struct shared_index;
+
 /**
  * Callback after a query, update or remove request completes and fills in
  * select fields in the request: status for all requests, oldMetadata and
@@ -77,8 +85,26 @@ struct uds_index {
 	// checkpoint state used by indexCheckpoint.c
 	struct index_checkpoint *checkpoint;
 
+	// timing of the most recent open and save; the component byte
+	// counts are kept by the index state
+	struct uds_index_phase_stats phase_stats;
+	// when the zones started counting their load
+	ktime_t zone_load_start;
+
 	index_callback_t callback;
-	struct uds_request_queue *triage_queue;
+	// placement of the index threads, or NULL; zone threads use slots 0
+	// to zone_count - 1, followed by the sparse cache loader, writer and
+	// reader threads
+	struct thread_affinity *affinity;
+	// the recycled requests which carry zone messages
+	struct request_pool *message_pool;
+	// the volume index published to other processes, or NULL
+	struct shared_index *shared;
+	// the pacing of checkpoint and save writes, or NULL
+	struct io_throttle *save_throttle;
+	// the thread which resizes the volume caches under memory pressure,
+	// or NULL
+	struct memory_pressure_monitor *memory_pressure;
 	struct uds_request_queue *zone_queues[];
 };
 
@@ -196,14 +222,30 @@ void begin_save(struct uds_index *index,
 		uint64_t open_chapter_number);
 
 /**
- * Replay the volume file to repopulate the volume index.
+ * Replay the volume file to repopulate the volume index. The chapters before
+ * record_from_vcn are read only to rebuild the index page map, since the
+ * volume index already has their records.
  *
- * @param index		The index
- * @param from_vcn	The virtual chapter to start replaying
+ * @param index			The index
+ * @param from_vcn		The virtual chapter to start replaying
+ * @param record_from_vcn	The first chapter whose records must be
+ *				put back into the volume index
  *
  * @return		UDS_SUCCESS if successful
  **/
-int __must_check replay_volume(struct uds_index *index, uint64_t from_vcn);
+int __must_check replay_volume(struct uds_index *index,
+			       uint64_t from_vcn,
+			       uint64_t record_from_vcn);
+
+/**
+ * Get the timing and I/O statistics of the most recent open and save of the
+ * index.
+ *
+ * @param index	    The index
+ * @param stats	    The phase statistics to fill
+ **/
+void get_index_phase_stats(const struct uds_index *index,
+			   struct uds_index_phase_stats *stats);
 
 /**
  * Gather statistics from the volume index, volume, and cache.
@@ -214,6 +256,26 @@ int __must_check replay_volume(struct uds_index *index, uint64_t from_vcn);
 void get_index_stats(struct uds_index *index,
 		     struct uds_index_stats *counters);
 
+/**
+ * Get the number of requests waiting in each zone queue and the occupancy
+ * of the volume read queue, without locking.
+ *
+ * @param index	    The index
+ * @param backlog   The backlog to fill
+ **/
+void get_index_backlog(struct uds_index *index,
+		       struct uds_index_backlog *backlog);
+
+/**
+ * Get the load counts of the zones and how unevenly the requests are spread
+ * among them, without locking.
+ *
+ * @param index	    The index
+ * @param stats     The zone statistics to fill
+ **/
+void get_index_zone_stats(struct uds_index *index,
+			  struct uds_index_zone_stats *stats);
+
 /**
  * Advance the newest virtual chapter. If this will overwrite the oldest
  * virtual chapter, advance that also.
@@ -231,21 +293,20 @@ void advance_active_chapters(struct uds_index *index);
  * @param request     The request destined for the queue.
  * @param next_stage  The next request stage.
  *
- * @return the next index stage queue (the triage queue or the zone queue)
+ * @return the next index stage queue (the zone queue)
  **/
 struct uds_request_queue *select_index_queue(struct uds_index *index,
 					     struct uds_request *request,
 					     enum request_stage next_stage);
 
 /**
- * Wait for the index to finish all operations that access a local storage
- * device.
+ * Wait for the index to finish writing the chapters closed before the call.
  *
  * @param index  The index
  **/
-static INLINE void wait_for_idle_index(struct uds_index *index)
+static INLINE void wait_for_index_chapter_writes(struct uds_index *index)
 {
-	wait_for_idle_chapter_writer(index->chapter_writer);
+	wait_for_closed_chapters(index->chapter_writer);
 }
 
 #endif /* INDEX_H */
@@ -22,9 +22,12 @@
 #include "indexCheckpoint.h"
 
 #include "errors.h"
+#include "ioThrottle.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
 #include "permassert.h"
+#include "udsProbes.h"
 #include "uds-threads.h"
 #include "typeDefs.h"
 
@@ -40,6 +43,15 @@ enum checkpoint_state {
 	CHECKPOINT_ABORTING
 };
 
+enum {
+	// A new measurement makes up 1/SMOOTHING_WEIGHT of an average
+	SMOOTHING_WEIGHT = 4,
+	// Checkpoints may do work for at most 1/CHECKPOINT_SHARE of the time
+	CHECKPOINT_SHARE = 4,
+	// Changes of less than 1/FREQUENCY_SLACK of the frequency are ignored
+	FREQUENCY_SLACK = 8,
+};
+
 /**
  * Private structure which tracks checkpointing.
  **/
@@ -49,7 +61,24 @@ struct index_checkpoint {
 	enum checkpoint_state state;  // is checkpoint in progress or aborting
 	unsigned int zones_busy;      // count of zones not yet done
 	unsigned int frequency;       // number of chapters between checkpoints
+	unsigned int cycle_frequency; // frequency when this checkpoint started
 	uint64_t checkpoints;         // number of checkpoints this session
+	// The replay target, and the measurements which choose the frequency
+	ktime_t replay_target;        // longest replay to aim for, or 0
+	unsigned int max_frequency;   // most chapters between checkpoints
+	uint64_t adjustments;         // number of frequency changes
+	uint64_t next_chapter;        // first vcn to start a checkpoint at
+	ktime_t replay_cost;          // average replay time of a chapter
+	bool replay_measured;         // whether replay_cost is from a replay
+	ktime_t checkpoint_cost;      // average work of recent checkpoints
+	ktime_t work;                 // work of the checkpoint in progress
+	ktime_t chapter_time;         // average time between chapters
+	ktime_t last_chapter_time;    // when zone 0 last opened a chapter
+	// The pacing of the checkpoint writes
+	struct io_throttle *throttle; // the save throttle, or NULL
+	ktime_t start_delay;          // throttle delay when this one started
+	bool stretched;               // whether this one ran past its cycle
+	uint64_t stretches;           // number of stretched checkpoints
 };
 
 /**
@@ -81,6 +110,88 @@ checkpoint_function_t *const checkpoint_funcs[] = {
 	do_checkpoint_abort
 };
 
+/**
+ * Fold a new measurement into a running average.
+ *
+ * @param average  The average so far, or 0 if there is none
+ * @param sample   The new measurement
+ *
+ * @return the new average
+ **/
+static ktime_t smooth_time(ktime_t average, ktime_t sample)
+{
+	if (average == 0) {
+		return sample;
+	}
+	return average + (sample - average) / SMOOTHING_WEIGHT;
+}
+
+/**
+ * Choose the checkpoint frequency for a replay target from the current
+ * measurements. This is called with the checkpoint mutex held, and the new
+ * frequency takes effect from the next checkpoint to start.
+ *
+ * @param checkpoint  the checkpoint state of the index
+ **/
+static void adapt_checkpoint_frequency(struct index_checkpoint *checkpoint)
+{
+	unsigned int old_frequency = checkpoint->frequency;
+	uint64_t most, least = 1, frequency, change;
+
+	if ((checkpoint->replay_target == 0) ||
+	    (checkpoint->replay_cost == 0)) {
+		return;
+	}
+
+	// A crash just before a checkpoint finishes replays from the start of
+	// the checkpoint before it, which is up to twice the frequency.
+	most = checkpoint->replay_target / (2 * checkpoint->replay_cost);
+	if (checkpoint->chapter_time > 0) {
+		// Checkpointing more often would starve the requests.
+		least = ((checkpoint->checkpoint_cost * CHECKPOINT_SHARE +
+			  checkpoint->chapter_time - 1) /
+			 checkpoint->chapter_time);
+	}
+	frequency = max(most, least);
+	frequency = max(frequency, (uint64_t) 1);
+	frequency = min(frequency, (uint64_t) checkpoint->max_frequency);
+
+	change = ((frequency > old_frequency) ? frequency - old_frequency :
+						old_frequency - frequency);
+	if ((change == 0) || (change * FREQUENCY_SLACK < old_frequency)) {
+		return;
+	}
+
+	checkpoint->frequency = frequency;
+	checkpoint->adjustments += 1;
+	uds_log_info("checkpoint frequency changed from %u to %u chapters (replay %lld us per chapter, checkpoint %lld us, chapter %lld us)%s",
+		     old_frequency,
+		     checkpoint->frequency,
+		     (long long) ktime_to_us(checkpoint->replay_cost),
+		     (long long) ktime_to_us(checkpoint->checkpoint_cost),
+		     (long long) ktime_to_us(checkpoint->chapter_time),
+		     ((least > most) ? ", missing the replay target" : ""));
+}
+
+/**
+ * Note that a checkpoint has finished, folding its work into the average
+ * checkpoint cost. This is called with the checkpoint mutex held.
+ *
+ * @param checkpoint  the checkpoint state of the index
+ **/
+static void note_checkpoint_done(struct index_checkpoint *checkpoint)
+{
+	checkpoint->checkpoints += 1;
+	if (checkpoint->stretched) {
+		checkpoint->stretches += 1;
+		checkpoint->stretched = false;
+	}
+	checkpoint->checkpoint_cost = smooth_time(checkpoint->checkpoint_cost,
+						  checkpoint->work);
+	checkpoint->work = 0;
+	adapt_checkpoint_frequency(checkpoint);
+}
+
 /**********************************************************************/
 int make_index_checkpoint(struct uds_index *index)
 {
@@ -138,6 +249,81 @@ set_index_checkpoint_frequency(struct index_checkpoint *checkpoint,
 	return old_frequency;
 }
 
+/**********************************************************************/
+void set_index_checkpoint_replay_target(struct index_checkpoint *checkpoint,
+					unsigned int target_ms,
+					unsigned int max_frequency)
+{
+	uds_lock_mutex(&checkpoint->mutex);
+	checkpoint->replay_target = ms_to_ktime(target_ms);
+	checkpoint->max_frequency = max(max_frequency, 1U);
+	adapt_checkpoint_frequency(checkpoint);
+	uds_unlock_mutex(&checkpoint->mutex);
+}
+
+/**********************************************************************/
+void set_index_checkpoint_throttle(struct index_checkpoint *checkpoint,
+				   struct io_throttle *throttle)
+{
+	uds_lock_mutex(&checkpoint->mutex);
+	checkpoint->throttle = throttle;
+	uds_unlock_mutex(&checkpoint->mutex);
+}
+
+/**********************************************************************/
+void note_index_chapter_replay(struct index_checkpoint *checkpoint,
+			       uint64_t chapters,
+			       ktime_t duration)
+{
+	if ((chapters == 0) || (duration <= 0)) {
+		return;
+	}
+	uds_lock_mutex(&checkpoint->mutex);
+	checkpoint->replay_cost = duration / chapters;
+	checkpoint->replay_measured = true;
+	adapt_checkpoint_frequency(checkpoint);
+	uds_unlock_mutex(&checkpoint->mutex);
+}
+
+/**********************************************************************/
+void note_index_chapter_written(struct index_checkpoint *checkpoint,
+				ktime_t duration)
+{
+	uds_lock_mutex(&checkpoint->mutex);
+	if (!checkpoint->replay_measured) {
+		// Replaying a chapter reads it back and reindexes its records,
+		// which costs about what writing it did.
+		checkpoint->replay_cost = smooth_time(checkpoint->replay_cost,
+						      duration);
+		adapt_checkpoint_frequency(checkpoint);
+	}
+	uds_unlock_mutex(&checkpoint->mutex);
+}
+
+/**********************************************************************/
+void get_index_checkpoint_stats(struct index_checkpoint *checkpoint,
+				struct uds_checkpoint_stats *stats)
+{
+	uds_lock_mutex(&checkpoint->mutex);
+	*stats = (struct uds_checkpoint_stats) {
+		.replay_target = ktime_to_us(checkpoint->replay_target),
+		.frequency = checkpoint->frequency,
+		.checkpoints = checkpoint->checkpoints,
+		.adjustments = checkpoint->adjustments,
+		.chapter_replay_time = ktime_to_us(checkpoint->replay_cost),
+		.replay_measured = checkpoint->replay_measured,
+		.checkpoint_time = ktime_to_us(checkpoint->checkpoint_cost),
+		.chapter_time = ktime_to_us(checkpoint->chapter_time),
+		.estimated_replay_time =
+			(2 * checkpoint->frequency *
+			 ktime_to_us(checkpoint->replay_cost)),
+		.throttle_time =
+			ktime_to_us(get_io_throttle_delay(checkpoint->throttle)),
+		.stretched_checkpoints = checkpoint->stretches,
+	};
+	uds_unlock_mutex(&checkpoint->mutex);
+}
+
 /**********************************************************************/
 uint64_t get_checkpoint_count(struct index_checkpoint *checkpoint)
 {
@@ -149,25 +335,40 @@ static enum index_checkpoint_trigger_value
 get_checkpoint_action(struct index_checkpoint *checkpoint,
 		      uint64_t virtual_chapter)
 {
-	unsigned int value;
-	if (checkpoint->frequency == 0) {
-		return ICTV_IDLE;
-	}
-	value = virtual_chapter % checkpoint->frequency;
 	if (checkpoint->state == CHECKPOINT_ABORTING) {
 		return ICTV_ABORT;
 	} else if (checkpoint->state == CHECKPOINT_IN_PROGRESS) {
-		if (value == checkpoint->frequency - 1) {
-			return ICTV_FINISH;
-		} else {
+		// The frequency may have changed since the checkpoint started.
+		uint64_t deadline =
+			checkpoint->chapter + checkpoint->cycle_frequency - 1;
+		if (virtual_chapter < deadline) {
 			return ICTV_CONTINUE;
 		}
-	} else {
-		if (value == 0) {
-			return ICTV_START;
-		} else {
-			return ICTV_IDLE;
+		// Finishing writes out every delta list not yet saved, so a
+		// checkpoint the throttle has slowed gets up to another cycle
+		// to save more of them as the zones touch them.
+		if ((virtual_chapter < deadline + checkpoint->cycle_frequency) &&
+		    (get_io_throttle_delay(checkpoint->throttle) >
+		     checkpoint->start_delay)) {
+			checkpoint->stretched = true;
+			return ICTV_CONTINUE;
+		}
+		return ICTV_FINISH;
+	} else if (checkpoint->frequency == 0) {
+		return ICTV_IDLE;
+	} else if (checkpoint->replay_target > 0) {
+		// An adapted frequency counts from the last checkpoint.
+		if (checkpoint->next_chapter == 0) {
+			checkpoint->next_chapter =
+				virtual_chapter + checkpoint->frequency;
 		}
+		return ((virtual_chapter >= checkpoint->next_chapter) ?
+				ICTV_START :
+				ICTV_IDLE);
+	} else if (virtual_chapter % checkpoint->frequency == 0) {
+		return ICTV_START;
+	} else {
+		return ICTV_IDLE;
 	}
 }
 
@@ -181,10 +382,24 @@ int process_checkpointing(struct uds_index *index,
 	enum index_checkpoint_trigger_value ictv;
 	uds_lock_mutex(&checkpoint->mutex);
 
+	if (zone == 0) {
+		ktime_t now = current_time_ns(CLOCK_MONOTONIC);
+		if (checkpoint->last_chapter_time != 0) {
+			checkpoint->chapter_time =
+				smooth_time(checkpoint->chapter_time,
+					    ktime_sub(now,
+						      checkpoint->last_chapter_time));
+		}
+		checkpoint->last_chapter_time = now;
+	}
+
 	ictv = get_checkpoint_action(checkpoint, new_virtual_chapter);
 
 	if (ictv == ICTV_START) {
 		checkpoint->chapter = new_virtual_chapter;
+		checkpoint->cycle_frequency = checkpoint->frequency;
+		checkpoint->next_chapter =
+			new_virtual_chapter + checkpoint->frequency;
 	}
 
 	func = checkpoint_funcs[ictv];
@@ -206,7 +421,10 @@ int process_chapter_writer_checkpoint_saves(struct uds_index *index)
 
 	uds_lock_mutex(&checkpoint->mutex);
 	if (checkpoint->state == CHECKPOINT_IN_PROGRESS) {
+		ktime_t start = current_time_ns(CLOCK_MONOTONIC);
 		result = perform_index_state_checkpoint_chapter_synchronized_saves(index->state);
+		checkpoint->work += ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+					      start);
 
 		if (result != UDS_SUCCESS) {
 			checkpoint->state = CHECKPOINT_ABORTING;
@@ -288,8 +506,13 @@ static int do_checkpoint_start(struct uds_index *index, unsigned int zone)
 {
 	int result;
 	struct index_checkpoint *checkpoint = index->checkpoint;
+	ktime_t start = current_time_ns(CLOCK_MONOTONIC);
+	UDS_PROBE2(checkpoint_start, checkpoint->chapter, zone);
+	checkpoint->start_delay = get_io_throttle_delay(checkpoint->throttle);
+	checkpoint->stretched = false;
 	begin_save(index, true, checkpoint->chapter);
 	result = start_index_state_checkpoint(index->state);
+	checkpoint->work = ktime_sub(current_time_ns(CLOCK_MONOTONIC), start);
 	if (result != UDS_SUCCESS) {
 		uds_log_error_strerror(result,
 				       "cannot start index checkpoint");
@@ -309,20 +532,21 @@ static int do_checkpoint_process(struct uds_index *index, unsigned int zone)
 {
 	struct index_checkpoint *checkpoint = index->checkpoint;
 	enum completion_status status = CS_NOT_COMPLETED;
+	ktime_t start = current_time_ns(CLOCK_MONOTONIC);
 	int result;
 	uds_unlock_mutex(&checkpoint->mutex);
+	UDS_PROBE2(checkpoint_process, checkpoint->chapter, zone);
 	result = perform_index_state_checkpoint_in_zone(index->state, zone,
 							&status);
+	uds_lock_mutex(&checkpoint->mutex);
+	checkpoint->work += ktime_sub(current_time_ns(CLOCK_MONOTONIC), start);
 	if (result != UDS_SUCCESS) {
-		uds_lock_mutex(&checkpoint->mutex);
 		uds_log_error_strerror(result,
 				       "cannot continue index checkpoint");
 		result = abort_checkpointing(index, result);
-		uds_unlock_mutex(&checkpoint->mutex);
 	} else if (status == CS_JUST_COMPLETED) {
-		uds_lock_mutex(&checkpoint->mutex);
 		if (--checkpoint->zones_busy == 0) {
-			checkpoint->checkpoints += 1;
+			note_checkpoint_done(checkpoint);
 			uds_log_info("finished checkpoint");
 			result = finish_index_state_checkpoint(index->state);
 			if (result != UDS_SUCCESS) {
@@ -330,10 +554,12 @@ static int do_checkpoint_process(struct uds_index *index, unsigned int zone)
 						       "%s checkpoint finish failed",
 						       __func__);
 			}
+			UDS_PROBE2(checkpoint_done, checkpoint->chapter,
+				   result);
 			checkpoint->state = NOT_CHECKPOINTING;
 		}
-		uds_unlock_mutex(&checkpoint->mutex);
 	}
+	uds_unlock_mutex(&checkpoint->mutex);
 	return result;
 }
 
@@ -342,8 +568,10 @@ static int do_checkpoint_abort(struct uds_index *index, unsigned int zone)
 {
 	struct index_checkpoint *checkpoint = index->checkpoint;
 	enum completion_status status = CS_NOT_COMPLETED;
-	int result = abort_index_state_checkpoint_in_zone(index->state, zone,
-							  &status);
+	int result;
+	UDS_PROBE2(checkpoint_abort, checkpoint->chapter, zone);
+	result = abort_index_state_checkpoint_in_zone(index->state, zone,
+						      &status);
 	if (result != UDS_SUCCESS) {
 		uds_log_error_strerror(result,
 				       "cannot abort index checkpoint");
@@ -368,20 +596,21 @@ static int do_checkpoint_finish(struct uds_index *index, unsigned int zone)
 {
 	struct index_checkpoint *checkpoint = index->checkpoint;
 	enum completion_status status = CS_NOT_COMPLETED;
+	ktime_t start = current_time_ns(CLOCK_MONOTONIC);
 	int result;
 	uds_unlock_mutex(&checkpoint->mutex);
+	UDS_PROBE2(checkpoint_finish, checkpoint->chapter, zone);
 	result = finish_index_state_checkpoint_in_zone(index->state, zone,
 						       &status);
+	uds_lock_mutex(&checkpoint->mutex);
+	checkpoint->work += ktime_sub(current_time_ns(CLOCK_MONOTONIC), start);
 	if (result != UDS_SUCCESS) {
 		uds_log_error_strerror(result,
 				       "cannot finish index checkpoint");
-		uds_lock_mutex(&checkpoint->mutex);
 		result = abort_checkpointing(index, result);
-		uds_unlock_mutex(&checkpoint->mutex);
 	} else if (status == CS_JUST_COMPLETED) {
-		uds_lock_mutex(&checkpoint->mutex);
 		if (--checkpoint->zones_busy == 0) {
-			checkpoint->checkpoints += 1;
+			note_checkpoint_done(checkpoint);
 			uds_log_info("finished checkpoint");
 			result = finish_index_state_checkpoint(index->state);
 			if (result != UDS_SUCCESS) {
@@ -389,9 +618,11 @@ static int do_checkpoint_finish(struct uds_index *index, unsigned int zone)
 						       "%s checkpoint finish failed",
 						       __func__);
 			}
+			UDS_PROBE2(checkpoint_done, checkpoint->chapter,
+				   result);
 			checkpoint->state = NOT_CHECKPOINTING;
 		}
-		uds_unlock_mutex(&checkpoint->mutex);
 	}
+	uds_unlock_mutex(&checkpoint->mutex);
 	return result;
 }
@@ -23,6 +23,7 @@
 #define INDEX_CHECKPOINT_H
 
 #include "index.h"
+#include "timeUtils.h"
 
 /**
  * Construct and initialize the checkpoint sub-structure of an index.
@@ -62,6 +63,63 @@ unsigned int
 set_index_checkpoint_frequency(struct index_checkpoint *checkpoint,
 			       unsigned int frequency);
 
+/**
+ * Make the index choose its own checkpointing frequency, aiming to keep the
+ * replay after a crash within a target time. The frequency is revised as
+ * each checkpoint starts, from measurements of chapter replay and of recent
+ * checkpoints; the fixed frequency is used until there are measurements.
+ *
+ * @param checkpoint     the checkpoint state of the index
+ * @param target_ms      the longest replay to aim for, in milliseconds, or
+ *                       0 to use the fixed frequency again
+ * @param max_frequency  the most chapters to allow between checkpoints
+ **/
+void set_index_checkpoint_replay_target(struct index_checkpoint *checkpoint,
+					unsigned int target_ms,
+					unsigned int max_frequency);
+
+/**
+ * Give the checkpoints of an index the throttle which paces their writes,
+ * so that a checkpoint which the throttle has slowed may run past its
+ * frequency rather than finishing all its remaining writes at once.
+ *
+ * @param checkpoint  the checkpoint state of the index
+ * @param throttle    the throttle of the save writers, or NULL
+ **/
+void set_index_checkpoint_throttle(struct index_checkpoint *checkpoint,
+				   struct io_throttle *throttle);
+
+/**
+ * Record the time taken by a replay of chapters, which gives the best
+ * estimate of the cost of replaying after a crash.
+ *
+ * @param checkpoint  the checkpoint state of the index
+ * @param chapters    the number of chapters replayed
+ * @param duration    the time the replay took
+ **/
+void note_index_chapter_replay(struct index_checkpoint *checkpoint,
+			       uint64_t chapters,
+			       ktime_t duration);
+
+/**
+ * Record the time taken to write a chapter, which stands in for the cost of
+ * replaying a chapter until a replay has been measured.
+ *
+ * @param checkpoint  the checkpoint state of the index
+ * @param duration    the time writing the chapter took
+ **/
+void note_index_chapter_written(struct index_checkpoint *checkpoint,
+				ktime_t duration);
+
+/**
+ * Get the checkpointing statistics of an index.
+ *
+ * @param checkpoint  the checkpoint state of the index
+ * @param stats       the statistics to fill in
+ **/
+void get_index_checkpoint_stats(struct index_checkpoint *checkpoint,
+				struct uds_checkpoint_stats *stats);
+
 /**
  * Gets the number of checkpoints completed during the lifetime of this index
  *
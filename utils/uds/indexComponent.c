@@ -29,6 +29,7 @@
 #include "memoryAlloc.h"
 #include "permassert.h"
 #include "typeDefs.h"
+#include "uds-threads.h"
 
 /**********************************************************************/
 int make_index_component(struct index_state *state,
@@ -71,6 +72,23 @@ int make_index_component(struct index_state *state,
 	return UDS_SUCCESS;
 }
 
+/**
+ * Free the buffered writer of a write zone, counting the bytes it wrote
+ * as written by the component.  Zones may be finished on separate threads.
+ *
+ * @param write_zone  the write zone
+ **/
+static void free_zone_writer(struct write_zone *write_zone)
+{
+	if (write_zone->writer == NULL) {
+		return;
+	}
+	atomic64_add(get_buffered_writer_bytes_written(write_zone->writer),
+		     &write_zone->component->bytes_written);
+	free_buffered_writer(write_zone->writer);
+	write_zone->writer = NULL;
+}
+
 /**********************************************************************/
 static void free_write_zones(struct index_component *component)
 {
@@ -81,7 +99,7 @@ static void free_write_zones(struct index_component *component)
 			if (wz == NULL) {
 				continue;
 			}
-			free_buffered_writer(wz->writer);
+			free_zone_writer(wz);
 			UDS_FREE(wz);
 		}
 		UDS_FREE(component->write_zones);
@@ -112,8 +130,11 @@ static void free_read_portal(struct read_portal *read_portal)
 		return;
 	}
 	for (z = 0; z < read_portal->zones; ++z) {
-		if (read_portal->readers[z] != NULL) {
-			free_buffered_reader(read_portal->readers[z]);
+		struct buffered_reader *reader = read_portal->readers[z];
+		if (reader != NULL) {
+			read_portal->component->bytes_read +=
+				get_buffered_reader_bytes_read(reader);
+			free_buffered_reader(reader);
 		}
 	}
 	UDS_FREE(read_portal->readers);
@@ -134,6 +155,13 @@ int get_buffered_reader_for_portal(struct read_portal *portal,
 					  portal->zones);
 	}
 	component = portal->component;
+	if (component->info->optional &&
+	    !has_uds_index_region(component->state->layout,
+				  component->state->load_slot,
+				  component->info->kind)) {
+		*reader_ptr = NULL;
+		return UDS_SUCCESS;
+	}
 	if (component->info->io_storage && (portal->readers[part] == NULL)) {
 		int result = open_state_buffered_reader(component->state,
 							component->info->kind,
@@ -170,6 +198,7 @@ int read_index_component(struct index_component *component)
 		return result;
 	}
 
+	component->bytes_read = 0;
 	portal->component = component;
 	portal->zones = read_zones;
 	result = (*component->info->loader)(portal);
@@ -342,6 +371,13 @@ static int open_buffered_writers(struct index_component *component)
 			return result;
 		}
 
+		if (component->info->optional &&
+		    !has_uds_index_region(component->state->layout,
+					  component->state->save_slot,
+					  component->info->kind)) {
+			continue;
+		}
+
 		if (component->info->io_storage) {
 			result =
 				open_state_buffered_writer(component->state,
@@ -359,7 +395,9 @@ static int open_buffered_writers(struct index_component *component)
 /**********************************************************************/
 static int start_index_component_save(struct index_component *component)
 {
-	int result = make_write_zones(component);
+	int result;
+	atomic64_set(&component->bytes_written, 0);
+	result = make_write_zones(component);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
@@ -378,44 +416,126 @@ int start_index_component_incremental_save(struct index_component *component)
 	return start_index_component_save(component);
 }
 
+/**
+ * One zone of a multi-zone component, saved on a thread of its own.
+ **/
+struct zone_saver {
+	struct write_zone *write_zone;
+	saver_t saver;
+	struct thread *thread;
+	int result;
+};
+
 /**********************************************************************/
-int write_index_component(struct index_component *component)
+static int save_component_zone(struct write_zone *write_zone, saver_t saver)
 {
-	int result;
+	int result = (*saver)(write_zone->component, write_zone->writer,
+			      write_zone->zone);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	return done_with_zone(write_zone);
+}
+
+/**********************************************************************/
+static void save_component_zone_thread(void *arg)
+{
+	struct zone_saver *zone_saver = arg;
+	zone_saver->result = save_component_zone(zone_saver->write_zone,
+						 zone_saver->saver);
+}
+
+/**
+ * Save every zone of a component.  The zones are written to separate
+ * regions and share no state while saving, so all zones after the first
+ * are saved in parallel on threads of their own.
+ *
+ * @param component  the index component
+ * @param saver      the saver to call for each zone
+ *
+ * @return UDS_SUCCESS or the first error encountered
+ **/
+static int save_component_zones(struct index_component *component,
+				saver_t saver)
+{
+	struct zone_saver *zone_savers;
 	unsigned int z;
-	saver_t saver = component->info->saver;
-	if ((saver == NULL) && (component->info->incremental != NULL)) {
-		saver = index_component_saver_incremental_wrapper;
+	int result;
+
+	if (component->num_zones < 2) {
+		for (z = 0; z < component->num_zones; ++z) {
+			result = save_component_zone(component->write_zones[z],
+						     saver);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+		}
+		return UDS_SUCCESS;
 	}
 
-	result = start_index_component_save(component);
+	result = UDS_ALLOCATE(component->num_zones, struct zone_saver,
+			      __func__, &zone_savers);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
 
-	for (z = 0; z < component->num_zones; ++z) {
-		struct write_zone *write_zone = component->write_zones[z];
-
-		result = (*saver)(component, write_zone->writer, z);
-		if (result != UDS_SUCCESS) {
-			break;
+	for (z = 1; z < component->num_zones; ++z) {
+		struct zone_saver *zone_saver = &zone_savers[z];
+		zone_saver->write_zone = component->write_zones[z];
+		zone_saver->saver = saver;
+		if (uds_create_thread(save_component_zone_thread, zone_saver,
+				      "saveZone", &zone_saver->thread) !=
+		    UDS_SUCCESS) {
+			zone_saver->thread = NULL;
 		}
+	}
 
-		result = done_with_zone(write_zone);
-		if (result != UDS_SUCCESS) {
-			break;
+	// A zone which could not get a thread is saved here after the first.
+	result = save_component_zone(component->write_zones[0], saver);
+	for (z = 1; z < component->num_zones; ++z) {
+		struct zone_saver *zone_saver = &zone_savers[z];
+		if (zone_saver->thread != NULL) {
+			uds_join_threads(zone_saver->thread);
+		} else if (result == UDS_SUCCESS) {
+			zone_saver->result =
+				save_component_zone(zone_saver->write_zone,
+						    saver);
+		}
+		if (result == UDS_SUCCESS) {
+			result = zone_saver->result;
 		}
+	}
+	UDS_FREE(zone_savers);
+	return result;
+}
 
-		free_buffered_writer(write_zone->writer);
-		write_zone->writer = NULL;
+/**********************************************************************/
+int write_index_component(struct index_component *component)
+{
+	int result;
+	unsigned int z;
+	saver_t saver = component->info->saver;
+	if ((saver == NULL) && (component->info->incremental != NULL)) {
+		saver = index_component_saver_incremental_wrapper;
 	}
 
+	result = start_index_component_save(component);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = save_component_zones(component, saver);
 	if (result != UDS_SUCCESS) {
 		free_write_zones(component);
 		return uds_log_error_strerror(result,
 					      "index component write failed");
 	}
 
+	for (z = 0; z < component->num_zones; ++z) {
+		free_zone_writer(component->write_zones[z]);
+	}
+
 	return UDS_SUCCESS;
 }
 
@@ -438,8 +558,7 @@ static int close_buffered_writer(struct write_zone *write_zone)
 	}
 
 	result = done_with_zone(write_zone);
-	free_buffered_writer(write_zone->writer);
-	write_zone->writer = NULL;
+	free_zone_writer(write_zone);
 
 	return result;
 }
@@ -23,6 +23,7 @@
 #define INDEX_COMPONENT_H 1
 
 #include "common.h"
+#include "atomicDefs.h"
 
 #include "bufferedReader.h"
 #include "bufferedWriter.h"
@@ -111,6 +112,11 @@ struct index_component_info {
 	bool multi_zone;                  // Does this component have multiple
 					  // zones?
 	bool io_storage;                  // Do we do I/O directly to storage?
+	bool load_first;                  // Must be loaded before the other
+					  // components?
+	bool optional;                    // May be absent from a save, in
+					  // which case I/O is done with NULL
+					  // readers and writers?
 	loader_t loader;                  // The function load this component
 	saver_t saver;                    // The function to store this
 					  // component
@@ -133,6 +139,10 @@ struct index_component {
 						 // write portal
 	struct write_zone **write_zones;         // State for writing
 						 // component
+	uint64_t bytes_read;                     // Bytes read by the last
+						 // load
+	atomic64_t bytes_written;                // Bytes written by the
+						 // last save
 };
 
 /**
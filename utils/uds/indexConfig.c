@@ -28,10 +28,13 @@
 static const byte INDEX_CONFIG_MAGIC[] = "ALBIC";
 static const byte INDEX_CONFIG_VERSION_6_02[] = "06.02";
 static const byte INDEX_CONFIG_VERSION_8_02[] = "08.02";
+static const byte INDEX_CONFIG_VERSION_8_03[] = "08.03";
 
 enum {
 	INDEX_CONFIG_MAGIC_LENGTH = sizeof(INDEX_CONFIG_MAGIC) - 1,
-	INDEX_CONFIG_VERSION_LENGTH = sizeof(INDEX_CONFIG_VERSION_6_02) - 1
+	INDEX_CONFIG_VERSION_LENGTH = sizeof(INDEX_CONFIG_VERSION_6_02) - 1,
+	// The 8.03 version adds the record page compression flag.
+	INDEX_CONFIG_8_03_SIZE = sizeof(struct uds_configuration_8_02) + 1,
 };
 
 /**********************************************************************/
@@ -86,6 +89,7 @@ decode_index_config_06_02(struct buffer *buffer,
 	}
 	config->remapped_virtual = 0;
 	config->remapped_physical = 0;
+	config->compress_record_pages = false;
 	if (ASSERT_LOG_ONLY(content_length(buffer) == 0,
 			    "%zu bytes decoded of %zu expected",
 			    buffer_length(buffer) - content_length(buffer),
@@ -95,10 +99,18 @@ decode_index_config_06_02(struct buffer *buffer,
 	return result;
 }
 
-/**********************************************************************/
+/**
+ * Decode the fields which the 8.02 and 8.03 versions of the configuration
+ * share.
+ *
+ * @param buffer  The buffer holding the encoded configuration
+ * @param config  The configuration to fill in
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
 static int __must_check
-decode_index_config_08_02(struct buffer *buffer,
-			  struct uds_configuration *config)
+decode_index_config_08_02_fields(struct buffer *buffer,
+				 struct uds_configuration *config)
 {
 	int result =
 		get_uint32_le_from_buffer(buffer,
@@ -153,6 +165,41 @@ decode_index_config_08_02(struct buffer *buffer,
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+static int __must_check
+decode_index_config_08_02(struct buffer *buffer,
+			  struct uds_configuration *config)
+{
+	int result = decode_index_config_08_02_fields(buffer, config);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	config->compress_record_pages = false;
+	if (ASSERT_LOG_ONLY(content_length(buffer) == 0,
+			    "%zu bytes decoded of %zu expected",
+			    buffer_length(buffer) - content_length(buffer),
+			    buffer_length(buffer)) != UDS_SUCCESS) {
+		return UDS_CORRUPT_COMPONENT;
+	}
+	return result;
+}
+
+/**********************************************************************/
+static int __must_check
+decode_index_config_08_03(struct buffer *buffer,
+			  struct uds_configuration *config)
+{
+	int result = decode_index_config_08_02_fields(buffer, config);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	result = get_boolean(buffer, &config->compress_record_pages);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
 	if (ASSERT_LOG_ONLY(content_length(buffer) == 0,
 			    "%zu bytes decoded of %zu expected",
 			    buffer_length(buffer) - content_length(buffer),
@@ -197,7 +244,8 @@ static int read_version(struct buffered_reader *reader,
 	} else if (memcmp(INDEX_CONFIG_VERSION_8_02, version_buffer,
 			  INDEX_CONFIG_VERSION_LENGTH) == 0) {
 		struct buffer *buffer;
-		result = make_buffer(sizeof(struct uds_configuration), &buffer);
+		result = make_buffer(sizeof(struct uds_configuration_8_02),
+				     &buffer);
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
@@ -212,6 +260,24 @@ static int read_version(struct buffered_reader *reader,
 		clear_buffer(buffer);
 		result = decode_index_config_08_02(buffer, conf);
 		free_buffer(UDS_FORGET(buffer));
+	} else if (memcmp(INDEX_CONFIG_VERSION_8_03, version_buffer,
+			  INDEX_CONFIG_VERSION_LENGTH) == 0) {
+		struct buffer *buffer;
+		result = make_buffer(INDEX_CONFIG_8_03_SIZE, &buffer);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		result = read_from_buffered_reader(reader,
+						   get_buffer_contents(buffer),
+						   buffer_length(buffer));
+		if (result != UDS_SUCCESS) {
+			free_buffer(UDS_FORGET(buffer));
+			return uds_log_error_strerror(result,
+						      "cannot read config data");
+		}
+		clear_buffer(buffer);
+		result = decode_index_config_08_03(buffer, conf);
+		free_buffer(UDS_FORGET(buffer));
 	} else {
 		uds_log_error_strerror(result,
 				       "unsupported configuration version: '%.*s'",
@@ -294,10 +360,18 @@ encode_index_config_06_02(struct buffer *buffer,
 			       sizeof(*config));
 }
 
-/**********************************************************************/
+/**
+ * Encode the fields which the 8.02 and 8.03 versions of the configuration
+ * share.
+ *
+ * @param buffer  The buffer to encode the configuration into
+ * @param config  The configuration
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
 static int __must_check
-encode_index_config_08_02(struct buffer *buffer,
-			  struct uds_configuration *config)
+encode_index_config_08_02_fields(struct buffer *buffer,
+				 struct uds_configuration *config)
 {
 	int result =
 		put_uint32_le_into_buffer(buffer,
@@ -351,12 +425,45 @@ encode_index_config_08_02(struct buffer *buffer,
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+static int __must_check
+encode_index_config_08_02(struct buffer *buffer,
+			  struct uds_configuration *config)
+{
+	int result = encode_index_config_08_02_fields(buffer, config);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
 
 	return ASSERT_LOG_ONLY(content_length(buffer) ==
-			       sizeof(struct uds_configuration),
+			       sizeof(struct uds_configuration_8_02),
 			       "%zu bytes encoded, of %zu expected",
 			       content_length(buffer),
-			       sizeof(*config));
+			       sizeof(struct uds_configuration_8_02));
+}
+
+/**********************************************************************/
+static int __must_check
+encode_index_config_08_03(struct buffer *buffer,
+			  struct uds_configuration *config)
+{
+	int result = encode_index_config_08_02_fields(buffer, config);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	result = put_boolean(buffer, config->compress_record_pages);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	return ASSERT_LOG_ONLY(content_length(buffer) ==
+			       INDEX_CONFIG_8_03_SIZE,
+			       "%zu bytes encoded, of %zu expected",
+			       content_length(buffer),
+			       (size_t) INDEX_CONFIG_8_03_SIZE);
 }
 
 /**********************************************************************/
@@ -373,9 +480,27 @@ int write_config_contents(struct buffered_writer *writer,
 	/*
 	 * If version is < 4, the index has not been reduced by a
 	 * chapter so it must be written out as version 6.02 so that
-	 * it is still compatible with older versions of UDS.
+	 * it is still compatible with older versions of UDS. Only an
+	 * index which compresses its record pages needs the 8.03
+	 * version, which older versions of UDS will refuse to load.
 	 */
-	if (version < 4) {
+	if (config->compress_record_pages) {
+		result = write_to_buffered_writer(writer,
+						  INDEX_CONFIG_VERSION_8_03,
+						  INDEX_CONFIG_VERSION_LENGTH);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		result = make_buffer(INDEX_CONFIG_8_03_SIZE, &buffer);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		result = encode_index_config_08_03(buffer, config);
+		if (result != UDS_SUCCESS) {
+			free_buffer(UDS_FORGET(buffer));
+			return result;
+		}
+	} else if (version < 4) {
 		result = write_to_buffered_writer(writer,
 						  INDEX_CONFIG_VERSION_6_02,
 						  INDEX_CONFIG_VERSION_LENGTH);
@@ -399,7 +524,8 @@ int write_config_contents(struct buffered_writer *writer,
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
-		result = make_buffer(sizeof(struct uds_configuration), &buffer);
+		result = make_buffer(sizeof(struct uds_configuration_8_02),
+				     &buffer);
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
@@ -439,6 +565,7 @@ int make_configuration(const struct uds_configuration *conf,
 	}
 
 	config->sparse_sample_rate = conf->sparse_sample_rate;
+	config->compress_record_pages = conf->compress_record_pages;
 	config->cache_chapters = conf->cache_chapters;
 	config->volume_index_mean_delta = conf->volume_index_mean_delta;
 
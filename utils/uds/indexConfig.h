@@ -47,6 +47,21 @@ struct configuration {
 
 	/* Sampling rate for sparse indexing */
 	unsigned int sparse_sample_rate;
+
+	/* Whether record pages are compressed when they are written */
+	bool compress_record_pages;
+
+	/*
+	 * Size of the huge pages backing the page cache and volume index, or
+	 * 0 to use ordinary pages
+	 */
+	size_t huge_page_size;
+
+	/*
+	 * Memory budget for the negative lookup filters in front of the
+	 * volume index, or 0 for no filters
+	 */
+	size_t volume_index_filter_size;
 };
 
 #endif /* INDEX_CONFIG_H */
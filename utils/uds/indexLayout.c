@@ -31,6 +31,8 @@
 #include "memoryAlloc.h"
 #include "nonce.h"
 #include "openChapter.h"
+#include "warmList.h"
+#include "zone.h"
 
 /*
  * Overall layout of an index on disk:
@@ -83,8 +85,21 @@
  * index state record for that save or checkpoint. Each save or
  * checkpoint has a unique generation number and nonce which is used
  * to seed the checksums of those regions.
+ *
+ * The save regions can instead be kept on separate, faster storage, so
+ * that saves and checkpoints do not compete with volume I/O. The super
+ * block then records the path of the save storage, and the save regions
+ * in the layout only reserve their space. The save storage begins with a
+ * block identifying the layout it belongs to, followed by the save
+ * regions packed in the same order and with the same region tables as
+ * they would have in the layout.
  */
 
+enum {
+	/** The size of the separate save path recorded in the super block */
+	SAVE_PATH_SIZE = 256,
+};
+
 struct index_save_data {
 	uint64_t timestamp; // ms since epoch...
 	uint64_t nonce;
@@ -100,6 +115,7 @@ struct index_save_layout {
 	struct layout_region free_space;
 	struct layout_region *volume_index_zones;
 	struct layout_region *open_chapter;
+	struct layout_region warm_list;
 	enum index_save_type save_type;
 	struct index_save_data save_data;
 	struct buffer *index_state_buffer;
@@ -127,10 +143,13 @@ struct super_block_data {
 	uint64_t page_map_blocks;
 	uint64_t volume_offset;
 	uint64_t start_offset;
+	char save_path[SAVE_PATH_SIZE]; // empty unless saves are separate
 };
 
 struct index_layout {
 	struct io_factory *factory;
+	struct io_factory *save_factory; // NULL unless saves are separate
+	uint64_t save_base; // first block of the save regions
 	off_t offset;
 	struct super_block_data super;
 	struct layout_region header;
@@ -186,6 +205,9 @@ enum {
 static const byte SINGLE_FILE_MAGIC_1[32] = "*ALBIREO*SINGLE*FILE*LAYOUT*001*";
 enum { SINGLE_FILE_MAGIC_1_LENGTH = sizeof(SINGLE_FILE_MAGIC_1) };
 
+static const byte SAVE_FILE_MAGIC_1[32] = "*ALBIREO*SEPARATE*SAVES*LAYOUT*1";
+enum { SAVE_FILE_MAGIC_1_LENGTH = sizeof(SAVE_FILE_MAGIC_1) };
+
 static int __must_check
 reconstitute_single_file_layout(struct index_layout *layout,
 				struct region_table *table,
@@ -195,11 +217,39 @@ write_index_save_layout(struct index_layout *layout,
 			struct index_save_layout *isl);
 
 /**********************************************************************/
-static INLINE bool is_converted_super_block(struct super_block_data *super)
+static INLINE bool
+is_converted_super_block(const struct super_block_data *super)
 {
 	return (super->version == 7);
 }
 
+/**********************************************************************/
+static INLINE bool has_separate_saves(const struct super_block_data *super)
+{
+	return (super->save_path[0] != '\0');
+}
+
+/**
+ * Compute the encoded size of a super block, which depends on the optional
+ * fields it carries.
+ *
+ * @param super  the super block
+ *
+ * @return the number of bytes the super block encodes to
+ **/
+static uint16_t get_super_block_payload(const struct super_block_data *super)
+{
+	size_t payload = offsetof(struct super_block_data, volume_offset);
+	if (is_converted_super_block(super)) {
+		payload += (sizeof(super->volume_offset) +
+			    sizeof(super->start_offset));
+	}
+	if (has_separate_saves(super)) {
+		payload += sizeof(super->save_path);
+	}
+	return payload;
+}
+
 /**********************************************************************/
 static INLINE uint64_t block_count(uint64_t bytes, uint32_t block_size)
 {
@@ -313,6 +363,73 @@ open_layout_writer(struct index_layout *layout,
 					writer_ptr);
 }
 
+/**
+ * Compute the byte offset of a save region in the separate save storage.
+ *
+ * @param layout  the layout containing the region
+ * @param lr      a save region, or a region within one
+ *
+ * @return the byte offset of the region in the save storage
+ **/
+static off_t get_save_storage_offset(struct index_layout *layout,
+				     struct layout_region *lr)
+{
+	return ((1 + lr->start_block - layout->save_base) *
+		layout->super.block_size);
+}
+
+/**
+ * Open a reader for a save region or a region within one, on whichever
+ * storage holds the saves.
+ *
+ * @param layout      the layout containing the region
+ * @param lr          the region to read
+ * @param reader_ptr  where to store the new reader
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int __must_check open_save_reader(struct index_layout *layout,
+					 struct layout_region *lr,
+					 struct buffered_reader **reader_ptr)
+{
+	if (layout->save_factory == NULL) {
+		return open_layout_reader(layout, lr,
+					  -layout->super.start_offset,
+					  reader_ptr);
+	}
+	return open_uds_buffered_reader(layout->save_factory,
+					get_save_storage_offset(layout, lr),
+					lr->num_blocks *
+						layout->super.block_size,
+					reader_ptr);
+}
+
+/**
+ * Open a writer for a save region or a region within one, on whichever
+ * storage holds the saves.
+ *
+ * @param layout      the layout containing the region
+ * @param lr          the region to write
+ * @param writer_ptr  where to store the new writer
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int __must_check open_save_writer(struct index_layout *layout,
+					 struct layout_region *lr,
+					 struct buffered_writer **writer_ptr)
+{
+	if (layout->save_factory == NULL) {
+		return open_layout_writer(layout, lr,
+					  -layout->super.start_offset,
+					  writer_ptr);
+	}
+	return open_uds_buffered_writer(layout->save_factory,
+					get_save_storage_offset(layout, lr),
+					lr->num_blocks *
+						layout->super.block_size,
+					writer_ptr);
+}
+
 /**********************************************************************/
 static int __must_check
 decode_index_save_data(struct buffer *buffer,
@@ -575,6 +692,19 @@ decode_super_block_data(struct buffer *buffer, struct super_block_data *super)
 		super->volume_offset = 0;
 		super->start_offset = 0;
 	}
+	memset(super->save_path, 0, sizeof(super->save_path));
+	if (content_length(buffer) > 0) {
+		result = get_bytes_from_buffer(buffer, sizeof(super->save_path),
+					       super->save_path);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		if ((super->save_path[0] == '\0') ||
+		    (super->save_path[sizeof(super->save_path) - 1] != '\0')) {
+			return uds_log_error_strerror(UDS_CORRUPT_COMPONENT,
+						      "invalid save path in super block");
+		}
+	}
 	result = ASSERT_LOG_ONLY(content_length(buffer) == 0,
 				 "%zu bytes decoded of %zu expected",
 				 buffer_length(buffer),
@@ -941,6 +1071,15 @@ static void populate_index_save_layout(struct index_save_layout *isl,
 	blocks_avail = (isl->index_save.num_blocks -
 			(next_block - isl->index_save.start_block) -
 			super->open_chapter_blocks);
+	/*
+	 * The page cache warm list is carved out of the rounding slack that
+	 * the volume index blocks carry for each possible zone, so it must
+	 * leave at least one spare block for every zone in use.
+	 */
+	if ((save_type == IS_SAVE) &&
+	    (num_zones <= MAX_ZONES - WARM_LIST_BLOCKS)) {
+		blocks_avail -= WARM_LIST_BLOCKS;
+	}
 
 	if (num_zones > 0) {
 		uint64_t mi_block_count = blocks_avail / num_zones;
@@ -961,6 +1100,16 @@ static void populate_index_save_layout(struct index_save_layout *isl,
 			     RL_KIND_OPEN_CHAPTER,
 			     RL_SOLE_INSTANCE);
 	}
+	if ((save_type == IS_SAVE) &&
+	    (num_zones <= MAX_ZONES - WARM_LIST_BLOCKS)) {
+		setup_layout(&isl->warm_list,
+			     &next_block,
+			     WARM_LIST_BLOCKS,
+			     RL_KIND_WARM_LIST,
+			     RL_SOLE_INSTANCE);
+	} else {
+		isl->warm_list = (struct layout_region) { 0 };
+	}
 	setup_layout(&isl->free_space,
 		     &next_block,
 		     (isl->index_save.num_blocks -
@@ -1062,6 +1211,15 @@ reconstruct_index_save(struct index_save_layout *isl,
 			      RL_KIND_OPEN_CHAPTER,
 			      RL_SOLE_INSTANCE);
 	}
+	// The warm list is optional, and is absent from older saves.
+	if (!expect_layout(false,
+			   &isl->warm_list,
+			   &iter,
+			   WARM_LIST_BLOCKS,
+			   RL_KIND_WARM_LIST,
+			   RL_SOLE_INSTANCE)) {
+		isl->warm_list = (struct layout_region) { 0 };
+	}
 	if (!expect_layout(false,
 			   &isl->free_space,
 			   &iter,
@@ -1167,11 +1325,8 @@ static int __must_check load_sub_index_regions(struct index_layout *layout)
 		struct index_save_layout *isl = &layout->index.saves[j];
 
 		struct buffered_reader *reader;
-		int result =
-			open_layout_reader(layout,
-					   &isl->index_save,
-					   -layout->super.start_offset,
-					   &reader);
+		int result = open_save_reader(layout, &isl->index_save,
+					      &reader);
 
 		if (result != UDS_SUCCESS) {
 			uds_log_error_strerror(result,
@@ -1205,8 +1360,195 @@ static int __must_check load_sub_index_regions(struct index_layout *layout)
 	return UDS_SUCCESS;
 }
 
+/**
+ * Write the block which identifies separate save storage as belonging to a
+ * layout.
+ *
+ * @param layout  the layout whose save storage is being formatted
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int __must_check write_save_storage_header(struct index_layout *layout)
+{
+	struct buffered_writer *writer = NULL;
+	struct buffer *buffer;
+	int result = make_buffer(SAVE_FILE_MAGIC_1_LENGTH + sizeof(uint64_t),
+				 &buffer);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = put_bytes(buffer, SAVE_FILE_MAGIC_1_LENGTH,
+			   SAVE_FILE_MAGIC_1);
+	if (result == UDS_SUCCESS) {
+		result = put_uint64_le_into_buffer(buffer, layout->super.nonce);
+	}
+	if (result == UDS_SUCCESS) {
+		result = open_uds_buffered_writer(layout->save_factory, 0,
+						  layout->super.block_size,
+						  &writer);
+	}
+	if (result == UDS_SUCCESS) {
+		result = write_to_buffered_writer(writer,
+						  get_buffer_contents(buffer),
+						  content_length(buffer));
+	}
+	if (result == UDS_SUCCESS) {
+		result = flush_buffered_writer(writer);
+	}
+	free_buffered_writer(writer);
+	free_buffer(UDS_FORGET(buffer));
+	return result;
+}
+
+/**
+ * Check that separate save storage belongs to a layout.
+ *
+ * @param layout     the layout whose save storage has been opened
+ * @param save_path  the path of the save storage, for logging
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int __must_check verify_save_storage_header(struct index_layout *layout,
+						   const char *save_path)
+{
+	byte magic[SAVE_FILE_MAGIC_1_LENGTH];
+	uint64_t nonce;
+	struct buffered_reader *reader;
+	struct buffer *buffer;
+	int result = make_buffer(SAVE_FILE_MAGIC_1_LENGTH + sizeof(uint64_t),
+				 &buffer);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = open_uds_buffered_reader(layout->save_factory, 0,
+					  layout->super.block_size, &reader);
+	if (result != UDS_SUCCESS) {
+		free_buffer(UDS_FORGET(buffer));
+		return uds_log_error_strerror(result,
+					      "cannot read save storage %s",
+					      save_path);
+	}
+
+	result = read_from_buffered_reader(reader,
+					   get_buffer_contents(buffer),
+					   buffer_length(buffer));
+	free_buffered_reader(reader);
+	if (result == UDS_SUCCESS) {
+		result = reset_buffer_end(buffer, buffer_length(buffer));
+	}
+	if (result == UDS_SUCCESS) {
+		result = get_bytes_from_buffer(buffer, sizeof(magic), magic);
+	}
+	if (result == UDS_SUCCESS) {
+		result = get_uint64_le_from_buffer(buffer, &nonce);
+	}
+	free_buffer(UDS_FORGET(buffer));
+	if (result != UDS_SUCCESS) {
+		return uds_log_error_strerror(result,
+					      "cannot read save storage %s",
+					      save_path);
+	}
+
+	if ((memcmp(magic, SAVE_FILE_MAGIC_1, SAVE_FILE_MAGIC_1_LENGTH) != 0) ||
+	    (nonce != layout->super.nonce)) {
+		return uds_log_error_strerror(UDS_CORRUPT_COMPONENT,
+					      "save storage %s does not belong to this index",
+					      save_path);
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Set up separate storage for the saves of a new layout, recording its path
+ * in the super block.
+ *
+ * @param layout     the layout being created
+ * @param save_path  the path of the save storage
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int __must_check create_save_storage(struct index_layout *layout,
+					    const char *save_path)
+{
+	struct super_block_data *super = &layout->super;
+	uint64_t save_bytes;
+	int result;
+
+	if (strlen(save_path) >= sizeof(super->save_path)) {
+		uds_log_error("save storage path %s is too long", save_path);
+		return -EINVAL;
+	}
+
+	result = make_uds_io_factory(save_path, FU_CREATE_READ_WRITE,
+				     &layout->save_factory);
+	if (result != UDS_SUCCESS) {
+		return uds_log_error_strerror(result,
+					      "cannot open save storage %s",
+					      save_path);
+	}
+
+	save_bytes = ((1 + (super->max_saves *
+			    layout->index.saves[0].index_save.num_blocks)) *
+		      super->block_size);
+	if (get_uds_writable_size(layout->save_factory) < save_bytes) {
+		uds_log_error("save storage %s is smaller than the required size %llu",
+			      save_path,
+			      (unsigned long long) save_bytes);
+		return -ENOSPC;
+	}
+
+	memset(super->save_path, 0, sizeof(super->save_path));
+	memcpy(super->save_path, save_path, strlen(save_path));
+	return write_save_storage_header(layout);
+}
+
+/**
+ * Open the separate save storage of an existing layout, if it has any.
+ *
+ * @param layout     the layout being loaded, with its super block read
+ * @param save_path  the save storage named by the caller, or NULL to use
+ *                   the one recorded in the super block
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int __must_check open_save_storage(struct index_layout *layout,
+					  const char *save_path)
+{
+	int result;
+
+	if (!has_separate_saves(&layout->super)) {
+		if (save_path != NULL) {
+			uds_log_error("index does not keep its saves on separate storage");
+			return -EINVAL;
+		}
+		return UDS_SUCCESS;
+	}
+
+	if (save_path == NULL) {
+		save_path = layout->super.save_path;
+	} else if (strcmp(save_path, layout->super.save_path) != 0) {
+		uds_log_info("using save storage %s in place of %s",
+			     save_path, layout->super.save_path);
+	}
+
+	result = make_uds_io_factory(save_path,
+				     (is_uds_io_factory_read_only(layout->factory) ?
+				      FU_READ_ONLY : FU_READ_WRITE),
+				     &layout->save_factory);
+	if (result != UDS_SUCCESS) {
+		return uds_log_error_strerror(result,
+					      "cannot open save storage %s",
+					      save_path);
+	}
+
+	return verify_save_storage_header(layout, save_path);
+}
+
 /**********************************************************************/
-static int load_index_layout(struct index_layout *layout)
+static int load_index_layout(struct index_layout *layout,
+			     const char *save_path)
 {
 	struct buffered_reader *reader;
 	int result = open_uds_buffered_reader(layout->factory, layout->offset,
@@ -1221,6 +1563,9 @@ static int load_index_layout(struct index_layout *layout)
 				  layout->offset / UDS_BLOCK_SIZE,
 				  reader);
 	free_buffered_reader(reader);
+	if (result == UDS_SUCCESS) {
+		result = open_save_storage(layout, save_path);
+	}
 	if (result != UDS_SUCCESS) {
 		UDS_FREE(layout->index.saves);
 		layout->index.saves = NULL;
@@ -1432,6 +1777,7 @@ init_single_file_layout(struct index_layout *layout,
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
+	layout->save_base = layout->index.saves[0].index_save.start_block;
 	setup_layout(&layout->seal, &next_block, 1, RL_KIND_SEAL,
 		     RL_SOLE_INSTANCE);
 	if (next_block * sls->block_size > offset + size) {
@@ -1522,6 +1868,7 @@ reconstitute_single_file_layout(struct index_layout *layout,
 	if (iter.result != UDS_SUCCESS) {
 		return iter.result;
 	}
+	layout->save_base = layout->index.saves[0].index_save.start_block;
 
 	if ((iter.next_block - layout->super.volume_offset) !=
 	    (first_block + layout->total_blocks)) {
@@ -1751,6 +2098,13 @@ static int __must_check encode_super_block_data(struct buffer *buffer,
 			return result;
 		}
 	}
+	if (has_separate_saves(super)) {
+		result = put_bytes(buffer, sizeof(super->save_path),
+				   super->save_path);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
 	return ASSERT_LOG_ONLY(content_length(buffer) == buffer_length(buffer),
 			       "%zu bytes encoded, of %zu expected",
 			       content_length(buffer), buffer_length(buffer));
@@ -1764,20 +2118,12 @@ write_single_file_header(struct index_layout *layout,
 			 struct buffered_writer *writer)
 {
 	unsigned int i;
-	uint16_t payload;
+	uint16_t payload = get_super_block_payload(&layout->super);
 	size_t table_size = sizeof(struct region_table) + num_regions *
 		sizeof(struct layout_region);
 	struct buffer *buffer;
 	int result;
 
-	if (is_converted_super_block(&layout->super)) {
-		payload = sizeof(struct super_block_data);
-	} else {
-		payload = sizeof(struct super_block_data) -
-			sizeof(layout->super.volume_offset) -
-			sizeof(layout->super.start_offset);
-	}
-
 	table->header = (struct region_header) {
 		.magic = REGION_MAGIC,
 		.region_blocks = layout->total_blocks,
@@ -1893,6 +2239,9 @@ void put_uds_index_layout(struct index_layout *layout)
 	if (layout->factory != NULL) {
 		put_uds_io_factory(layout->factory);
 	}
+	if (layout->save_factory != NULL) {
+		put_uds_io_factory(layout->save_factory);
+	}
 	UDS_FREE(layout);
 }
 
@@ -1934,11 +2283,10 @@ int write_uds_index_config(struct index_layout *layout,
 }
 
 /**********************************************************************/
-int verify_uds_index_config(struct index_layout *layout,
-			    struct uds_configuration *config)
+int read_uds_index_config(struct index_layout *layout,
+			  struct uds_configuration *config)
 {
 	struct buffered_reader *reader = NULL;
-	struct uds_configuration stored_config;
 	uint64_t offset = layout->super.volume_offset -
 		layout->super.start_offset;
 	int result = open_layout_reader(layout, &layout->config,
@@ -1949,13 +2297,24 @@ int verify_uds_index_config(struct index_layout *layout,
 					      "failed to open config reader");
 	}
 
-	result = read_config_contents(reader, &stored_config);
+	result = read_config_contents(reader, config);
+	free_buffered_reader(reader);
 	if (result != UDS_SUCCESS) {
-		free_buffered_reader(reader);
 		return uds_log_error_strerror(result,
 					      "failed to read config region");
 	}
-	free_buffered_reader(reader);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int verify_uds_index_config(struct index_layout *layout,
+			    struct uds_configuration *config)
+{
+	struct uds_configuration stored_config;
+	int result = read_uds_index_config(layout, &stored_config);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
 
 	if (!are_uds_configurations_equal(&stored_config, config)) {
 		uds_log_warning("Supplied configuration does not match save");
@@ -1974,16 +2333,45 @@ int replace_index_layout_storage(struct index_layout *layout,
 }
 
 /**********************************************************************/
-int open_uds_volume_region(struct index_layout *layout,
-			   struct io_region **region_ptr)
+void get_uds_volume_region_location(struct index_layout *layout,
+				    const char **path,
+				    off_t *start,
+				    size_t *size)
 {
 	struct layout_region *lr = &layout->index.volume;
-	off_t start = (lr->start_block + layout->super.volume_offset -
-		       layout->super.start_offset) *
+	*path = get_uds_io_factory_path(layout->factory);
+	*start = (lr->start_block + layout->super.volume_offset -
+		  layout->super.start_offset) *
 		layout->super.block_size;
-	size_t size = lr->num_blocks * layout->super.block_size;
-	int result =
-		make_uds_io_region(layout->factory, start, size, region_ptr);
+	*size = lr->num_blocks * layout->super.block_size;
+}
+
+/**********************************************************************/
+int open_uds_volume_region(struct index_layout *layout,
+			   bool direct_io,
+			   struct io_region **region_ptr)
+{
+	const char *path;
+	off_t start;
+	size_t size;
+	int result;
+
+	get_uds_volume_region_location(layout, &path, &start, &size);
+
+	if (direct_io) {
+		result = make_uds_direct_io_region(layout->factory, start,
+						   size, region_ptr);
+		if (result != EINVAL) {
+			if (result != UDS_SUCCESS) {
+				return uds_log_error_strerror(result,
+							      "cannot access index volume region");
+			}
+			return UDS_SUCCESS;
+		}
+		uds_log_warning("index storage does not support direct I/O, using buffered I/O for the volume");
+	}
+
+	result = make_uds_io_region(layout->factory, start, size, region_ptr);
 	if (result != UDS_SUCCESS) {
 		return uds_log_error_strerror(result,
 					      "cannot access index volume region");
@@ -2047,18 +2435,25 @@ static int validate_index_save_layout(struct index_save_layout *isl,
 static int __must_check
 select_oldest_index_save_layout(struct sub_index_layout *sil,
 				unsigned int max_saves,
+				unsigned int keep_slot,
 				struct index_save_layout **isl_ptr)
 {
 	struct index_save_layout *oldest = NULL;
 	uint64_t oldest_time = 0;
 	int result;
 
-	// find the oldest valid or first invalid slot
+	// find the oldest valid or first invalid slot, other than the one
+	// being kept
 	struct index_save_layout *isl;
 	for (isl = sil->saves; isl < sil->saves + max_saves; ++isl) {
 		uint64_t save_time = 0;
-		int result =
-			validate_index_save_layout(isl, sil->nonce, &save_time);
+		int result;
+		if (((unsigned int) (isl - sil->saves) == keep_slot) &&
+		    (max_saves > 1)) {
+			continue;
+		}
+		result = validate_index_save_layout(isl, sil->nonce,
+						    &save_time);
 		if (result != UDS_SUCCESS) {
 			save_time = 0;
 		}
@@ -2185,6 +2580,7 @@ invalidate_old_save(struct index_layout *layout, struct index_save_layout *isl)
 int setup_uds_index_save_slot(struct index_layout *layout,
 			      unsigned int num_zones,
 			      enum index_save_type save_type,
+			      unsigned int keep_slot,
 			      unsigned int *save_slot_ptr)
 {
 	struct sub_index_layout *sil = &layout->index;
@@ -2192,6 +2588,7 @@ int setup_uds_index_save_slot(struct index_layout *layout,
 	struct index_save_layout *isl = NULL;
 	int result = select_oldest_index_save_layout(sil,
 						     layout->super.max_saves,
+						     keep_slot,
 						     &isl);
 	if (result != UDS_SUCCESS) {
 		return result;
@@ -2212,6 +2609,37 @@ int setup_uds_index_save_slot(struct index_layout *layout,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+int get_uds_index_save_slot_info(struct index_layout *layout,
+				 unsigned int slot,
+				 uint64_t *nonce_ptr,
+				 unsigned int *num_zones_ptr)
+{
+	struct sub_index_layout *sil = &layout->index;
+	struct index_save_layout *isl;
+	int result = ASSERT((slot < layout->super.max_saves),
+			    "save slot out of range");
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	isl = &sil->saves[slot];
+	result = validate_index_save_layout(isl, sil->nonce, NULL);
+	if (result != UDS_SUCCESS) {
+		return uds_log_error_strerror(result,
+					      "index save slot %u is not valid",
+					      slot);
+	}
+
+	if (nonce_ptr != NULL) {
+		*nonce_ptr = isl->save_data.nonce;
+	}
+	if (num_zones_ptr != NULL) {
+		*num_zones_ptr = isl->num_zones;
+	}
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int find_latest_uds_index_save_slot(struct index_layout *layout,
 				    unsigned int *num_zones_ptr,
@@ -2249,8 +2677,10 @@ make_index_save_region_table(struct index_save_layout *isl,
 	unsigned int num_regions = 1 + // header
 				   1 + // index page map
 				   isl->num_zones + // volume index zones
-				   (bool) isl->open_chapter; // open chapter if
-							     // needed
+				   (bool) isl->open_chapter + // open chapter if
+							      // needed
+				   (isl->warm_list.num_blocks > 0); // warm
+								     // list
 
 	if (isl->free_space.num_blocks > 0) {
 		num_regions++;
@@ -2274,6 +2704,9 @@ make_index_save_region_table(struct index_save_layout *isl,
 	if (isl->open_chapter) {
 		*lr++ = *isl->open_chapter;
 	}
+	if (isl->warm_list.num_blocks > 0) {
+		*lr++ = isl->warm_list;
+	}
 	if (isl->free_space.num_blocks > 0) {
 		*lr++ = isl->free_space;
 	}
@@ -2409,9 +2842,7 @@ static int write_index_save_layout(struct index_layout *layout,
 		return result;
 	}
 
-	result = open_layout_writer(layout, &isl->header,
-				    -layout->super.start_offset,
-				    &writer);
+	result = open_save_writer(layout, &isl->header, &writer);
 	if (result != UDS_SUCCESS) {
 		UDS_FREE(table);
 		return result;
@@ -2501,6 +2932,7 @@ int discard_uds_index_saves(struct index_layout *layout, bool all)
 /**********************************************************************/
 static int create_index_layout(struct index_layout *layout,
 			       uint64_t size,
+			       const char *save_path,
 			       const struct uds_configuration *config)
 {
 	struct save_layout_sizes sizes;
@@ -2531,6 +2963,13 @@ static int create_index_layout(struct index_layout *layout,
 		return result;
 	}
 
+	if (save_path != NULL) {
+		result = create_save_storage(layout, save_path);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
+
 	result = save_sub_index_regions(layout);
 	if (result != UDS_SUCCESS) {
 		return result;
@@ -2581,6 +3020,16 @@ static int find_layout_region(struct index_layout *layout,
 		lr = isl->open_chapter;
 		break;
 
+	case RL_KIND_WARM_LIST:
+		if (isl->warm_list.num_blocks == 0) {
+			return uds_log_error_strerror(UDS_UNEXPECTED_RESULT,
+						      "%s: %s has no warm list",
+						      __func__,
+						      operation);
+		}
+		lr = &isl->warm_list;
+		break;
+
 	case RL_KIND_VOLUME_INDEX:
 		if (isl->volume_index_zones == NULL || zone >= isl->num_zones) {
 			return uds_log_error_strerror(UDS_UNEXPECTED_RESULT,
@@ -2603,6 +3052,29 @@ static int find_layout_region(struct index_layout *layout,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+bool has_uds_index_region(struct index_layout *layout,
+			  unsigned int slot,
+			  enum region_kind kind)
+{
+	struct index_save_layout *isl;
+
+	if (slot >= layout->super.max_saves) {
+		return false;
+	}
+	isl = &layout->index.saves[slot];
+	switch (kind) {
+	case RL_KIND_OPEN_CHAPTER:
+		return (isl->open_chapter != NULL);
+
+	case RL_KIND_WARM_LIST:
+		return (isl->warm_list.num_blocks > 0);
+
+	default:
+		return true;
+	}
+}
+
 /**********************************************************************/
 int open_uds_index_buffered_reader(struct index_layout *layout,
 				   unsigned int slot,
@@ -2615,8 +3087,7 @@ int open_uds_index_buffered_reader(struct index_layout *layout,
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
-	return open_layout_reader(layout, lr, -layout->super.start_offset,
-				  reader_ptr);
+	return open_save_reader(layout, lr, reader_ptr);
 }
 
 /**********************************************************************/
@@ -2631,14 +3102,14 @@ int open_uds_index_buffered_writer(struct index_layout *layout,
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
-	return open_layout_writer(layout, lr, -layout->super.start_offset,
-				  writer_ptr);
+	return open_save_writer(layout, lr, writer_ptr);
 }
 
 /**********************************************************************/
 int make_uds_index_layout_from_factory(struct io_factory *factory,
 				       off_t offset,
 				       uint64_t named_size,
+				       const char *save_path,
 				       bool new_layout,
 				       const struct uds_configuration *config,
 				       struct index_layout **layout_ptr)
@@ -2659,18 +3130,24 @@ int make_uds_index_layout_from_factory(struct io_factory *factory,
 		size = named_size;
 	}
 
-	// Get the index size according the the config
-	result = uds_compute_index_size(config, &config_size);
-	if (result != UDS_SUCCESS) {
-		return result;
-	}
-	if (size < config_size) {
-		uds_log_error("index storage (%zu) is smaller than the required size %llu",
-			      size,
-			      (unsigned long long) config_size);
-		return -ENOSPC;
+	// Get the index size according the the config. An existing layout
+	// may be loaded without one, since the layout records its own size.
+	if (config != NULL) {
+		result = uds_compute_index_size(config, &config_size);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		if (size < config_size) {
+			uds_log_error("index storage (%zu) is smaller than the required size %llu",
+				      size,
+				      (unsigned long long) config_size);
+			return -ENOSPC;
+		}
+		size = config_size;
+	} else if (new_layout) {
+		uds_log_error("a new index layout needs a configuration");
+		return -EINVAL;
 	}
-	size = config_size;
 
 	result = UDS_ALLOCATE(1, struct index_layout, __func__, &layout);
 	if (result != UDS_SUCCESS) {
@@ -2683,10 +3160,10 @@ int make_uds_index_layout_from_factory(struct io_factory *factory,
 
 	if (new_layout) {
 		// Populate the layout from the UDS configuration
-		result = create_index_layout(layout, size, config);
+		result = create_index_layout(layout, size, save_path, config);
 	} else {
 		// Populate the layout from the saved index.
-		result = load_index_layout(layout);
+		result = load_index_layout(layout, save_path);
 	}
 	if (result != UDS_SUCCESS) {
 		put_uds_index_layout(layout);
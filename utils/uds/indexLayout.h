@@ -52,6 +52,18 @@ int __must_check make_uds_index_layout(const char *name,
 				       const struct uds_configuration *config,
 				       struct index_layout **layout_ptr);
 
+/**
+ * Construct an index layout for an existing index which may only be read,
+ * for tools which examine an index without opening it for service.
+ *
+ * @param name        The same name as for make_uds_index_layout().
+ * @param layout_ptr  Where to store the new index layout
+ *
+ * @return UDS_SUCCESS or an error code.
+ **/
+int __must_check make_uds_read_only_index_layout(const char *name,
+						 struct index_layout **layout_ptr);
+
 /**
  * Construct an index layout using an IO factory.  This method is
  * common to all platforms.
@@ -62,6 +74,11 @@ int __must_check make_uds_index_layout(const char *name,
  *                    storage address space.
  * @param named_size  The size in bytes of the space within the block storage
  *                    address space, as specified in the name string.
+ * @param save_path   The path of separate storage for the index saves, as
+ *                    specified in the name string, or NULL. A new layout
+ *                    keeps its saves there; an existing layout which keeps
+ *                    its saves separately uses it in place of the path
+ *                    recorded when the layout was created.
  * @param new_layout  Whether this is a new layout.
  * @param config      The UDS configuration required for a new layout.
  * @param layout_ptr  Where to store the new index layout
@@ -72,6 +89,7 @@ int __must_check
 make_uds_index_layout_from_factory(struct io_factory *factory,
 				   off_t offset,
 				   uint64_t named_size,
+				   const char *save_path,
 				   bool new_layout,
 				   const struct uds_configuration *config,
 				   struct index_layout **layout_ptr);
@@ -107,6 +125,22 @@ int __must_check commit_uds_index_save(struct index_layout *layout,
 int __must_check discard_uds_index_saves(struct index_layout *layout,
 					 bool all);
 
+/**
+ * Get the nonce and zone count of a valid index save slot.
+ *
+ * @param [in]  layout          The single file layout.
+ * @param [in]  slot            The save slot.
+ * @param [out] nonce_ptr       Where to store the nonce of the save.
+ * @param [out] num_zones_ptr   Where to store the number of zones that were
+ *                                saved.
+ *
+ * @return UDS_SUCCESS or an error code.
+ **/
+int __must_check get_uds_index_save_slot_info(struct index_layout *layout,
+					      unsigned int slot,
+					      uint64_t *nonce_ptr,
+					      unsigned int *num_zones_ptr);
+
 /**
  * Find the latest index save slot.
  *
@@ -130,6 +164,20 @@ int __must_check find_latest_uds_index_save_slot(struct index_layout *layout,
 void get_uds_index_layout(struct index_layout *layout,
 			  struct index_layout **layout_ptr);
 
+/**
+ * Check whether a save slot contains an optional region of the given kind.
+ * Kinds which are not optional are always reported as present.
+ *
+ * @param layout  The index layout
+ * @param slot    The save slot
+ * @param kind    The kind of index save region
+ *
+ * @return true if the region is present
+ **/
+bool __must_check has_uds_index_region(struct index_layout *layout,
+				       unsigned int slot,
+				       enum region_kind kind);
+
 /**
  * Open a buffered reader for a specified state, kind, and zone.
  *
@@ -180,13 +228,40 @@ uint64_t __must_check get_uds_volume_nonce(struct index_layout *layout);
  * Obtain an IO region for the specified index volume.
  *
  * @param [in]  layout      The index layout.
+ * @param [in]  direct_io   Whether to bypass the kernel page cache.
  * @param [out] region_ptr  Where to put the new region.
  *
  * @return UDS_SUCCESS or an error code.
  **/
 int __must_check open_uds_volume_region(struct index_layout *layout,
+					bool direct_io,
 					struct io_region **region_ptr);
 
+/**
+ * Find where the index volume is stored, so that another process can read
+ * it.
+ *
+ * @param [in]  layout  The index layout.
+ * @param [out] path    Set to the path of the storage holding the volume.
+ * @param [out] start   Set to the byte offset of the volume in the storage.
+ * @param [out] size    Set to the size of the volume in bytes.
+ **/
+void get_uds_volume_region_location(struct index_layout *layout,
+				    const char **path,
+				    off_t *start,
+				    size_t *size);
+
+/**
+ * Read the index configuration saved in the layout.
+ *
+ * @param layout  the generic index layout
+ * @param config  the index configuration to fill in
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check read_uds_index_config(struct index_layout *layout,
+				       struct uds_configuration *config);
+
 /**
  * Read the index configuration, and verify that it matches the given
  * configuration.
@@ -208,6 +283,8 @@ int __must_check verify_uds_index_config(struct index_layout *layout,
  * @param [in]  layout          The index layout.
  * @param [in]  num_zones       Actual number of zones currently in use.
  * @param [in]  save_type       The index save type.
+ * @param [in]  keep_slot       A save slot which must not be reused, or
+ *                                UINT_MAX.
  * @param [out] save_slot_ptr   Where to store the save slot number.
  *
  * @return UDS_SUCCESS or an error code
@@ -215,6 +292,7 @@ int __must_check verify_uds_index_config(struct index_layout *layout,
 int __must_check setup_uds_index_save_slot(struct index_layout *layout,
 					   unsigned int num_zones,
 					   enum index_save_type save_type,
+					   unsigned int keep_slot,
 					   unsigned int *save_slot_ptr);
 
 /**
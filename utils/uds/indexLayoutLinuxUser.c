@@ -27,13 +27,26 @@
 #include "memoryAlloc.h"
 #include "uds.h"
 
-/**********************************************************************/
-int make_uds_index_layout(const char *name,
-			  bool new_layout,
-			  const struct uds_configuration *config,
-			  struct index_layout **layout_ptr)
+/**
+ * Make an index layout from a name, opening its storage with the given
+ * access.
+ *
+ * @param name        The name of the index storage and its parameters
+ * @param new_layout  Whether this is a new layout
+ * @param access      The access to open the storage with
+ * @param config      The UDS configuration required for a new layout
+ * @param layout_ptr  Where to store the new index layout
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int make_layout(const char *name,
+		       bool new_layout,
+		       enum file_access access,
+		       const struct uds_configuration *config,
+		       struct index_layout **layout_ptr)
 {
 	char *file = NULL;
+	char *saves = NULL;
 	uint64_t offset = 0;
 	uint64_t size = 0;
 
@@ -41,6 +54,7 @@ int make_uds_index_layout(const char *name,
 		{ "file", LP_STRING | LP_DEFAULT, { .str = &file }, false },
 		{ "size", LP_UINT64, { .num = &size }, false },
 		{ "offset", LP_UINT64, { .num = &offset }, false },
+		{ "saves", LP_STRING, { .str = &saves }, false },
 		LP_NULL_PARAMETER,
 	};
 
@@ -52,7 +66,7 @@ int make_uds_index_layout(const char *name,
 		return result;
 	}
 
-	// note file will be set to memory owned by params
+	// note file and saves will be set to memory owned by params
 	result = parse_layout_string(params, parameter_table);
 	if (result != UDS_SUCCESS) {
 		UDS_FREE(params);
@@ -67,17 +81,15 @@ int make_uds_index_layout(const char *name,
 
 	struct io_factory *factory = NULL;
 	result =
-		make_uds_io_factory(file,
-				    new_layout ? FU_CREATE_READ_WRITE
-				    	       : FU_READ_WRITE,
-				    &factory);
-	UDS_FREE(params);
+		make_uds_io_factory(file, access, &factory);
 	if (result != UDS_SUCCESS) {
+		UDS_FREE(params);
 		return result;
 	}
 	struct index_layout *layout;
 	result = make_uds_index_layout_from_factory(
-		factory, offset, size, new_layout, config, &layout);
+		factory, offset, size, saves, new_layout, config, &layout);
+	UDS_FREE(params);
 	put_uds_io_factory(factory);
 	if (result != UDS_SUCCESS) {
 		return result;
@@ -85,3 +97,21 @@ int make_uds_index_layout(const char *name,
 	*layout_ptr = layout;
 	return UDS_SUCCESS;
 }
+
+/**********************************************************************/
+int make_uds_index_layout(const char *name,
+			  bool new_layout,
+			  const struct uds_configuration *config,
+			  struct index_layout **layout_ptr)
+{
+	return make_layout(name, new_layout,
+			   new_layout ? FU_CREATE_READ_WRITE : FU_READ_WRITE,
+			   config, layout_ptr);
+}
+
+/**********************************************************************/
+int make_uds_read_only_index_layout(const char *name,
+				    struct index_layout **layout_ptr)
+{
+	return make_layout(name, false, FU_READ_ONLY, NULL, layout_ptr);
+}
@@ -169,6 +169,51 @@ int update_index_page_map(struct index_page_map *map,
 	return UDS_SUCCESS;
 }
 
+/**
+ * Find the index page of a chapter which holds a delta list.
+ *
+ * @param record_pages  the record pages per chapter (unused)
+ * @param index_pages   the index pages per chapter
+ * @param entries       the index page map entries of the chapter
+ * @param list_number   the delta list number
+ *
+ * @return the index page number
+ **/
+static INLINE unsigned int
+search_chapter_entries(unsigned int record_pages __always_unused,
+		       unsigned int index_pages,
+		       const index_page_map_entry_t *entries,
+		       unsigned int list_number)
+{
+	const index_page_map_entry_t *base = entries;
+	unsigned int count = index_pages - 1;
+
+	// The entries of a chapter are in increasing order, so find the first
+	// entry at or above the list number by binary search. Each step halves
+	// the range with a conditional move rather than a branch, which the
+	// random list numbers would mispredict half the time. With a constant
+	// count the loop unrolls completely.
+	if (count == 0) {
+		return 0;
+	}
+
+	while (count > 1) {
+		unsigned int half = count / 2;
+		base = (base[half] < list_number) ? base + half : base;
+		count -= half;
+	}
+	return (base - entries) + (*base < list_number);
+}
+
+/**********************************************************************/
+static unsigned int search_chapter(const struct geometry *geometry,
+				   const index_page_map_entry_t *entries,
+				   unsigned int list_number)
+{
+	DISPATCH_ON_GEOMETRY_SHAPE(geometry, search_chapter_entries, entries,
+				   list_number);
+}
+
 /**********************************************************************/
 int find_index_page_number(const struct index_page_map *map,
 			   const struct uds_chunk_name *name,
@@ -176,7 +221,7 @@ int find_index_page_number(const struct index_page_map *map,
 			   unsigned int *index_page_number_ptr)
 {
 	int result;
-	unsigned int delta_list_number, slot, limit, index_page_number = 0;
+	unsigned int delta_list_number, slot, index_page_number;
 	const struct geometry *geometry = map->geometry;
 	if (chapter_number >= geometry->chapters_per_volume) {
 		return uds_log_error_strerror(UDS_INVALID_ARGUMENT,
@@ -187,12 +232,8 @@ int find_index_page_number(const struct index_page_map *map,
 
 	delta_list_number = hash_to_chapter_delta_list(name, geometry);
 	slot = (chapter_number * (geometry->index_pages_per_chapter - 1));
-	limit = slot + (geometry->index_pages_per_chapter - 1);
-	for (; slot < limit; index_page_number++, slot++) {
-		if (delta_list_number <= map->entries[slot]) {
-			break;
-		}
-	}
+	index_page_number = search_chapter(geometry, &map->entries[slot],
+					   delta_list_number);
 
 	// This should be a clear post-condition of the loop above, but just in
 	// case it's not obvious, the check is cheap.
@@ -21,9 +21,13 @@
 
 #include "indexSession.h"
 
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 #include "indexCheckpoint.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "requestPool.h"
 #include "requestQueue.h"
 #include "timeUtils.h"
 
@@ -32,6 +36,7 @@ static void collect_stats(const struct uds_index_session *index_session,
 			  struct uds_index_stats *stats)
 {
 	const struct session_stats *session_stats = &index_session->stats;
+	unsigned int kind, bucket;
 
 	stats->current_time =
 		ktime_to_seconds(current_time_ns(CLOCK_REALTIME));
@@ -50,6 +55,43 @@ static void collect_stats(const struct uds_index_session *index_session,
 	stats->queries_found = READ_ONCE(session_stats->queries_found);
 	stats->queries_not_found = READ_ONCE(session_stats->queries_not_found);
 	stats->requests = READ_ONCE(session_stats->requests);
+	for (kind = 0; kind < UDS_HIT_KIND_COUNT; kind++) {
+		for (bucket = 0; bucket < UDS_CHAPTER_AGE_BUCKETS; bucket++) {
+			stats->chapter_ages[kind].counts[bucket] =
+				READ_ONCE(index_session->chapter_ages[kind]
+						  .counts[bucket]);
+		}
+	}
+}
+
+/**
+ * Queue a finished request which has no callback for the client to poll,
+ * signalling the eventfd if a poller asked for it. Only the callback thread
+ * calls this.
+ *
+ * @param index_session  the session of the request
+ * @param request        the finished request
+ **/
+static void queue_completion(struct uds_index_session *index_session,
+			     struct uds_request *request)
+{
+	funnel_queue_put(index_session->completion_queue,
+			 &request->request_queue_link);
+	if (index_session->completion_fd < 0) {
+		return;
+	}
+
+	// Pairs with the barrier in uds_poll_completions, so that either the
+	// poller sees this request or we see the poller's flag.
+	smp_mb();
+	if (atomic_read(&index_session->completion_armed) &&
+	    (atomic_cmpxchg(&index_session->completion_armed, 1, 0) == 1)) {
+		uint64_t one = 1;
+		if (write(index_session->completion_fd, &one,
+			  sizeof(one)) != sizeof(one)) {
+			uds_log_warning("could not signal completion eventfd");
+		}
+	}
 }
 
 /**********************************************************************/
@@ -60,18 +102,30 @@ static void handle_callbacks(struct uds_request *request)
 		// time, along with the rest of the request, in the context's
 		// stat counters.
 		update_request_context_stats(request);
+		update_request_latency_stats(request);
+		update_request_chapter_age_stats(request);
 	}
 
 	if (request->callback != NULL) {
 		// The request has specified its own callback and does not
 		// expect to be freed.
 		struct uds_index_session *index_session = request->session;
+		unsigned int epoch = request->session_epoch;
 		request->found =
 			(request->location != UDS_LOCATION_UNAVAILABLE);
 		request->callback((struct uds_request *) request);
 		// We do this release after the callback because of the
 		// contract of the uds_flush_index_session method.
-		release_index_session(index_session);
+		release_index_session(index_session, epoch);
+	} else {
+		// The client polls for this request, and the session pointer
+		// may not be used once the client has it.
+		struct uds_index_session *index_session = request->session;
+		unsigned int epoch = request->session_epoch;
+		request->found =
+			(request->location != UDS_LOCATION_UNAVAILABLE);
+		queue_completion(index_session, request);
+		release_index_session(index_session, epoch);
 	}
 }
 
@@ -96,26 +150,51 @@ int check_index_session(struct uds_index_session *index_session)
 }
 
 /**********************************************************************/
-int get_index_session(struct uds_index_session *index_session)
+int get_index_session(struct uds_index_session *index_session,
+		      unsigned int *epoch_ptr)
+{
+	return get_index_session_references(index_session, 1, epoch_ptr);
+}
+
+/**********************************************************************/
+int get_index_session_references(struct uds_index_session *index_session,
+				 unsigned int count,
+				 unsigned int *epoch_ptr)
 {
+	unsigned int epoch;
 	int result;
 	uds_lock_mutex(&index_session->request_mutex);
-	index_session->request_count++;
+	epoch = index_session->request_epoch % SESSION_FLUSH_EPOCHS;
+	index_session->request_count += count;
+	index_session->epoch_counts[epoch] += count;
 	uds_unlock_mutex(&index_session->request_mutex);
 
 	result = check_index_session(index_session);
 	if (result != UDS_SUCCESS) {
-		release_index_session(index_session);
+		release_index_session_references(index_session, count, epoch);
 		return result;
 	}
+	*epoch_ptr = epoch;
 	return UDS_SUCCESS;
 }
 
 /**********************************************************************/
-void release_index_session(struct uds_index_session *index_session)
+void release_index_session(struct uds_index_session *index_session,
+			   unsigned int epoch)
+{
+	release_index_session_references(index_session, 1, epoch);
+}
+
+/**********************************************************************/
+void release_index_session_references(struct uds_index_session *index_session,
+				      unsigned int count,
+				      unsigned int epoch)
 {
 	uds_lock_mutex(&index_session->request_mutex);
-	if (--index_session->request_count == 0) {
+	index_session->request_count -= count;
+	index_session->epoch_counts[epoch] -= count;
+	if ((index_session->request_count == 0) ||
+	    (index_session->epoch_counts[epoch] == 0)) {
 		uds_broadcast_cond(&index_session->request_cond);
 	}
 	uds_unlock_mutex(&index_session->request_mutex);
@@ -211,6 +290,30 @@ int make_empty_index_session(struct uds_index_session **index_session_ptr)
 		return result;
 	}
 
+	result = make_request_pool(0, &session->request_pool);
+	if (result != UDS_SUCCESS) {
+		uds_request_queue_finish(session->callback_queue);
+		uds_destroy_cond(&session->load_context.cond);
+		uds_destroy_mutex(&session->load_context.mutex);
+		uds_destroy_cond(&session->request_cond);
+		uds_destroy_mutex(&session->request_mutex);
+		UDS_FREE(session);
+		return result;
+	}
+
+	result = uds_init_mutex(&session->completion_mutex);
+	if (result != UDS_SUCCESS) {
+		free_request_pool(session->request_pool);
+		uds_request_queue_finish(session->callback_queue);
+		uds_destroy_cond(&session->load_context.cond);
+		uds_destroy_mutex(&session->load_context.mutex);
+		uds_destroy_cond(&session->request_cond);
+		uds_destroy_mutex(&session->request_mutex);
+		UDS_FREE(session);
+		return result;
+	}
+	session->completion_fd = -1;
+
 	*index_session_ptr = session;
 	return UDS_SUCCESS;
 }
@@ -433,6 +536,7 @@ int save_and_free_index(struct uds_index_session *index_session)
 							 "ignoring error from save_index");
 			}
 		}
+		get_index_phase_stats(index, &index_session->phase_stats);
 		free_index(index);
 		index_session->index = NULL;
 
@@ -543,6 +647,12 @@ int uds_destroy_index_session(struct uds_index_session *index_session)
 	result = save_and_free_index(index_session);
 	uds_request_queue_finish(index_session->callback_queue);
 	index_session->callback_queue = NULL;
+	free_request_pool(index_session->request_pool);
+	free_funnel_queue(index_session->completion_queue);
+	if (index_session->completion_fd >= 0) {
+		close(index_session->completion_fd);
+	}
+	uds_destroy_mutex(&index_session->completion_mutex);
 	uds_destroy_cond(&index_session->load_context.cond);
 	uds_destroy_mutex(&index_session->load_context.mutex);
 	uds_destroy_cond(&index_session->request_cond);
@@ -552,12 +662,40 @@ int uds_destroy_index_session(struct uds_index_session *index_session)
 	return uds_map_to_system_error(result);
 }
 
+/**
+ * Wait for every reference to the session taken before this call to be
+ * released, without waiting for ones taken after it. The epoch to be reused
+ * must first drain of references taken before an earlier flush; then a new
+ * epoch is started and the previous one is waited for.
+ *
+ * @param index_session  the session
+ **/
+static void wait_for_earlier_requests(struct uds_index_session *index_session)
+{
+	unsigned int previous;
+
+	uds_lock_mutex(&index_session->request_mutex);
+	previous = (index_session->request_epoch + 1) % SESSION_FLUSH_EPOCHS;
+	while (index_session->epoch_counts[previous] > 0) {
+		uds_wait_cond(&index_session->request_cond,
+			      &index_session->request_mutex);
+	}
+
+	previous = index_session->request_epoch % SESSION_FLUSH_EPOCHS;
+	index_session->request_epoch += 1;
+	while (index_session->epoch_counts[previous] > 0) {
+		uds_wait_cond(&index_session->request_cond,
+			      &index_session->request_mutex);
+	}
+	uds_unlock_mutex(&index_session->request_mutex);
+}
+
 /**********************************************************************/
 int uds_flush_index_session(struct uds_index_session *index_session)
 {
-	wait_for_no_requests_in_progress(index_session);
-	// Wait until any open chapter writes are complete
-	wait_for_idle_index(index_session->index);
+	wait_for_earlier_requests(index_session);
+	// Wait for the chapters those requests closed to reach storage.
+	wait_for_index_chapter_writes(index_session->index);
 	return UDS_SUCCESS;
 }
 
@@ -570,6 +708,43 @@ int uds_set_checkpoint_frequency(struct uds_index_session *index_session,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+int uds_set_checkpoint_replay_target(struct uds_index_session *index_session,
+				     unsigned int target_ms)
+{
+	struct geometry *geometry = index_session->index->volume->geometry;
+	set_index_checkpoint_replay_target(index_session->index->checkpoint,
+					   target_ms,
+					   geometry->chapters_per_volume - 1);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_resize_page_cache(struct uds_index_session *index_session,
+			  unsigned int cache_chapters)
+{
+	struct volume *volume;
+	unsigned int epoch;
+	int result = get_index_session(index_session, &epoch);
+	if (result != UDS_SUCCESS) {
+		return uds_map_to_system_error(result);
+	}
+
+	volume = index_session->index->volume;
+	if ((cache_chapters < 1) ||
+	    (cache_chapters > volume->max_cache_chapters)) {
+		uds_log_error("cache size of %u chapters is not between 1 and %u",
+			      cache_chapters,
+			      volume->max_cache_chapters);
+		release_index_session(index_session, epoch);
+		return -EINVAL;
+	}
+
+	result = resize_volume_cache(volume, cache_chapters);
+	release_index_session(index_session, epoch);
+	return uds_map_to_system_error(result);
+}
+
 /**********************************************************************/
 int uds_get_index_configuration(struct uds_index_session *index_session,
 				struct uds_configuration **conf)
@@ -586,6 +761,205 @@ int uds_get_index_configuration(struct uds_index_session *index_session,
 	return uds_map_to_system_error(result);
 }
 
+/**********************************************************************/
+int uds_get_index_latency_stats(struct uds_index_session *index_session,
+				struct uds_index_latency_stats *stats)
+{
+	if (stats == NULL) {
+		uds_log_error("received a NULL index latency stats pointer");
+		return -EINVAL;
+	}
+
+	// The histograms are updated by the callback thread without locking,
+	// so a snapshot may mix counts from adjacent requests.
+	*stats = index_session->latency;
+	stats->zone_count = ((index_session->index == NULL) ?
+				     0 :
+				     min(index_session->index->zone_count,
+					 (unsigned int) UDS_LATENCY_MAX_ZONES));
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_get_index_checkpoint_stats(struct uds_index_session *index_session,
+				   struct uds_checkpoint_stats *stats)
+{
+	if (stats == NULL) {
+		uds_log_error("received a NULL checkpoint stats pointer");
+		return -EINVAL;
+	}
+
+	if (index_session->index != NULL) {
+		get_index_checkpoint_stats(index_session->index->checkpoint,
+					   stats);
+	} else {
+		memset(stats, 0, sizeof(*stats));
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_get_index_backlog(struct uds_index_session *index_session,
+			  struct uds_index_backlog *backlog)
+{
+	if (backlog == NULL) {
+		uds_log_error("received a NULL index backlog pointer");
+		return -EINVAL;
+	}
+
+	if (index_session->index != NULL) {
+		get_index_backlog(index_session->index, backlog);
+	} else {
+		memset(backlog, 0, sizeof(*backlog));
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_get_index_zone_stats(struct uds_index_session *index_session,
+			     struct uds_index_zone_stats *stats)
+{
+	if (stats == NULL) {
+		uds_log_error("received a NULL index zone stats pointer");
+		return -EINVAL;
+	}
+
+	if (index_session->index != NULL) {
+		get_index_zone_stats(index_session->index, stats);
+	} else {
+		memset(stats, 0, sizeof(*stats));
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_get_index_phase_stats(struct uds_index_session *index_session,
+			      struct uds_index_phase_stats *stats)
+{
+	if (stats == NULL) {
+		uds_log_error("received a NULL index phase stats pointer");
+		return -EINVAL;
+	}
+
+	if (index_session->index != NULL) {
+		get_index_phase_stats(index_session->index, stats);
+	} else {
+		*stats = index_session->phase_stats;
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_get_pooled_request(struct uds_index_session *index_session,
+			   struct uds_request **request_ptr)
+{
+	struct uds_request *request;
+	int result = get_pooled_request(index_session->request_pool,
+					&request);
+	if (result != UDS_SUCCESS) {
+		return uds_map_to_system_error(result);
+	}
+
+	request->session = index_session;
+	*request_ptr = request;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void uds_put_pooled_request(struct uds_request *request)
+{
+	put_pooled_request(request->session->request_pool, request);
+}
+
+/**********************************************************************/
+int uds_enable_completion_queue(struct uds_index_session *index_session,
+				int *fd_ptr)
+{
+	struct funnel_queue *queue;
+	int fd = -1;
+	int result;
+
+	if (READ_ONCE(index_session->completion_queue) != NULL) {
+		uds_log_error("completion queue is already enabled");
+		return -EBUSY;
+	}
+
+	result = make_funnel_queue(&queue);
+	if (result != UDS_SUCCESS) {
+		return uds_map_to_system_error(result);
+	}
+
+	if (fd_ptr != NULL) {
+		fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (fd < 0) {
+			result = errno;
+			free_funnel_queue(queue);
+			return uds_log_error_strerror(result,
+						      "cannot create completion eventfd");
+		}
+		// Nothing has been polled yet, so signal the first completion.
+		atomic_set(&index_session->completion_armed, 1);
+	}
+
+	index_session->completion_fd = fd;
+	// Publish the queue only once the descriptor is in place, since any
+	// thread which sees the queue may start requests which use it.
+	smp_wmb();
+	WRITE_ONCE(index_session->completion_queue, queue);
+	if (fd_ptr != NULL) {
+		*fd_ptr = fd;
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+unsigned int uds_poll_completions(struct uds_index_session *index_session,
+				  struct uds_request **requests,
+				  unsigned int max_requests)
+{
+	struct funnel_queue *queue =
+		READ_ONCE(index_session->completion_queue);
+	unsigned int count = 0;
+
+	if (queue == NULL) {
+		return 0;
+	}
+	// Pairs with the barrier in uds_enable_completion_queue.
+	smp_rmb();
+
+	if (index_session->completion_fd >= 0) {
+		// Ask for a signal before looking, so that a request queued
+		// after we find the queue empty is not missed.
+		atomic_set(&index_session->completion_armed, 1);
+		smp_mb();
+	}
+
+	uds_lock_mutex(&index_session->completion_mutex);
+	while (count < max_requests) {
+		struct funnel_queue_entry *entry = funnel_queue_poll(queue);
+		if (entry == NULL) {
+			break;
+		}
+		requests[count++] = container_of(entry, struct uds_request,
+						 request_queue_link);
+	}
+	uds_unlock_mutex(&index_session->completion_mutex);
+	return count;
+}
+
+/**********************************************************************/
+int uds_get_request_pool_stats(struct uds_index_session *index_session,
+			       struct uds_request_pool_stats *stats)
+{
+	if (stats == NULL) {
+		uds_log_error("received a NULL request pool stats pointer");
+		return -EINVAL;
+	}
+
+	get_request_pool_stats(index_session->request_pool, stats);
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int uds_get_index_stats(struct uds_index_session *index_session,
 			struct uds_index_stats *stats)
@@ -601,9 +975,17 @@ int uds_get_index_stats(struct uds_index_session *index_session,
 	} else {
 		stats->entries_indexed = 0;
 		stats->memory_used = 0;
+		stats->huge_page_memory_used = 0;
 		stats->collisions = 0;
 		stats->entries_discarded = 0;
-	}
+		memset(&stats->page_cache, 0, sizeof(stats->page_cache));
+		memset(&stats->compressed_cache, 0,
+		       sizeof(stats->compressed_cache));
+		memset(&stats->sparse_cache, 0, sizeof(stats->sparse_cache));
+		memset(&stats->volume_index_filter, 0,
+		       sizeof(stats->volume_index_filter));
+	}
+	get_uds_memory_stats(&stats->memory);
 
 	return UDS_SUCCESS;
 }
@@ -28,6 +28,7 @@
 #include "cpu.h"
 #include "uds-threads.h"
 #include "uds.h"
+#include "util/funnelQueue.h"
 
 /**
  * The bit position of flags used to indicate index session states.
@@ -85,6 +86,11 @@ struct __attribute__((aligned(CACHE_LINE_BYTES))) session_stats {
 	uint64_t requests;                 /* Total number of requests */
 };
 
+enum {
+	/** The number of flush epochs whose references are counted apart */
+	SESSION_FLUSH_EPOCHS = 2,
+};
+
 /**
  * States used in the index load context, reflecting the state of the index.
  **/
@@ -128,14 +134,34 @@ struct uds_index_session {
 	unsigned int state; // Covered by request_mutex.
 	struct uds_index *index;
 	struct uds_request_queue *callback_queue;
+	struct request_pool *request_pool;
 	struct uds_configuration user_config;
 	struct index_load_context load_context;
 	// Asynchronous request synchronization
 	struct mutex request_mutex;
 	struct cond_var request_cond;
 	int request_count;
+	// Flushes wait only for the references taken before them. Each
+	// reference is counted in the slot of the epoch it was taken in, and
+	// a flush starts a new epoch.
+	uint64_t request_epoch;
+	int epoch_counts[SESSION_FLUSH_EPOCHS];
 	// Request statistics, all owned by the callback thread
 	struct session_stats stats;
+	struct uds_index_latency_stats latency;
+	// The ages of the chapters in which requests were found, kept by the
+	// callback thread
+	struct uds_chapter_age_histogram chapter_ages[UDS_HIT_KIND_COUNT];
+	// Phase statistics of the last index closed
+	struct uds_index_phase_stats phase_stats;
+	// Finished requests without callbacks, put only by the callback
+	// thread and polled by the client under completion_mutex
+	struct funnel_queue *completion_queue;
+	struct mutex completion_mutex;
+	// The eventfd signalled for the client, or -1
+	int completion_fd;
+	// Set while a poller wants the eventfd signalled for new completions
+	atomic_t completion_armed;
 };
 
 /**
@@ -182,17 +208,47 @@ void disable_index_session(struct uds_index_session *index_session);
  * release_index_session().
  *
  * @param index_session  The index session
+ * @param epoch_ptr      A pointer to hold the flush epoch of the reference
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check get_index_session(struct uds_index_session *index_session,
+				   unsigned int *epoch_ptr);
+
+/**
+ * Acquire the index session for a batch of asynchronous index requests.
+ * Each reference must eventually be released.
+ *
+ * @param index_session  The index session
+ * @param count          The number of references to acquire
+ * @param epoch_ptr      A pointer to hold the flush epoch of the references
  *
  * @return UDS_SUCCESS or an error code
  **/
-int __must_check get_index_session(struct uds_index_session *index_session);
+int __must_check
+get_index_session_references(struct uds_index_session *index_session,
+			     unsigned int count,
+			     unsigned int *epoch_ptr);
 
 /**
  * Release a pointer to an index session.
  *
  * @param index_session  The session to release
+ * @param epoch          The flush epoch returned when it was acquired
+ **/
+void release_index_session(struct uds_index_session *index_session,
+			   unsigned int epoch);
+
+/**
+ * Release several references to an index session.
+ *
+ * @param index_session  The session to release
+ * @param count          The number of references to release
+ * @param epoch          The flush epoch returned when they were acquired
  **/
-void release_index_session(struct uds_index_session *index_session);
+void release_index_session_references(struct uds_index_session *index_session,
+				      unsigned int count,
+				      unsigned int epoch);
 
 /**
  * Construct a new, empty index session.
@@ -224,4 +280,19 @@ int __must_check
 uds_set_checkpoint_frequency(struct uds_index_session *session,
 			     unsigned int frequency);
 
+/**
+ * Make the grid choose its own checkpoint frequency, aiming to keep the
+ * replay after a crash within a target time.
+ *
+ * @param session    The index session to be modified.
+ * @param target_ms  The longest replay to aim for, in milliseconds, or 0 to
+ *                   return to the fixed checkpoint frequency.
+ *
+ * @return          Either UDS_SUCCESS or an error code.
+ *
+ **/
+int __must_check
+uds_set_checkpoint_replay_target(struct uds_index_session *session,
+				 unsigned int target_ms);
+
 #endif /* INDEX_SESSION_H */
@@ -21,11 +21,14 @@
 
 #include "indexState.h"
 
+#include "bufferedReader.h"
+#include "bufferedWriter.h"
 #include "errors.h"
 #include "indexComponent.h"
 #include "indexLayout.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "uds-threads.h"
 
 
 /**********************************************************************/
@@ -56,7 +59,14 @@ int make_index_state(struct index_layout *layout,
 	state->length = max_components;
 	state->load_zones = 0;
 	state->load_slot = UINT_MAX;
+	state->load_base_zones = 0;
+	state->load_base_slot = UINT_MAX;
 	state->save_slot = UINT_MAX;
+	state->base_slot = UINT_MAX;
+	state->incremental_saves = 0;
+	state->incremental = false;
+	state->save_type = NO_SAVE;
+	state->throttle = NULL;
 	state->saving = false;
 	state->zone_count = num_zones;
 
@@ -152,11 +162,147 @@ static const char *index_save_type_name(enum index_save_type save_type)
 	return save_type == IS_SAVE ? "save" : "checkpoint";
 }
 
+/**
+ * A component being loaded on a thread of its own.
+ **/
+struct component_loader {
+	struct index_component *component;
+	struct thread *thread;
+	int result;
+};
+
+/**********************************************************************/
+static void load_component_thread(void *arg)
+{
+	struct component_loader *loader = arg;
+	loader->result = read_index_component(loader->component);
+}
+
+/**
+ * Check the result of loading a component, noting whether the index must
+ * be replayed because a save-only component is missing.
+ *
+ * @param state            the index state
+ * @param component        the component that was loaded
+ * @param result           the result of loading it
+ * @param replay_required  set if the index must be replayed
+ *
+ * @return UDS_SUCCESS or the error that makes the load fail
+ **/
+static int check_component_load(struct index_state *state,
+				struct index_component *component,
+				int result,
+				bool *replay_required)
+{
+	if (result == UDS_SUCCESS) {
+		return UDS_SUCCESS;
+	}
+	if (!missing_index_component_requires_replay(component)) {
+		state->load_zones = 0;
+		state->load_slot = UINT_MAX;
+		state->load_base_slot = UINT_MAX;
+		state->base_slot = UINT_MAX;
+		return uds_log_error_strerror(result,
+					      "index component %s",
+					      index_component_name(component));
+	}
+	*replay_required = true;
+	return UDS_SUCCESS;
+}
+
+/**
+ * Load every component of an index state.  The components which the
+ * others depend on are loaded first.  The rest are in separate regions and
+ * share no state, so all but the first of them are loaded in parallel on
+ * threads of their own.
+ *
+ * @param state            the index state
+ * @param replay_required  set if the index must be replayed
+ *
+ * @return UDS_SUCCESS or the first error encountered
+ **/
+static int load_index_state_components(struct index_state *state,
+				       bool *replay_required)
+{
+	struct component_loader *loaders;
+	struct component_loader *first = NULL;
+	unsigned int i;
+	int result;
+
+	for (i = 0; i < state->count; ++i) {
+		struct index_component *component = state->entries[i];
+		if (!component->info->load_first) {
+			continue;
+		}
+		result = check_component_load(state, component,
+					      read_index_component(component),
+					      replay_required);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
+
+	result = UDS_ALLOCATE(state->count, struct component_loader,
+			      __func__, &loaders);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	for (i = 0; i < state->count; ++i) {
+		struct component_loader *loader = &loaders[i];
+		loader->component = state->entries[i];
+		if (loader->component->info->load_first) {
+			continue;
+		}
+		if (first == NULL) {
+			first = loader;
+			continue;
+		}
+		if (uds_create_thread(load_component_thread, loader,
+				      "loadComponent", &loader->thread) !=
+		    UDS_SUCCESS) {
+			loader->thread = NULL;
+		}
+	}
+
+	// A component which could not get a thread is loaded here after the
+	// first.
+	if (first != NULL) {
+		load_component_thread(first);
+	}
+	for (i = 0; i < state->count; ++i) {
+		struct component_loader *loader = &loaders[i];
+		if (loader->component->info->load_first || (loader == first)) {
+			continue;
+		}
+		if (loader->thread != NULL) {
+			uds_join_threads(loader->thread);
+		} else {
+			load_component_thread(loader);
+		}
+	}
+
+	result = UDS_SUCCESS;
+	for (i = 0; i < state->count; ++i) {
+		struct component_loader *loader = &loaders[i];
+		if (loader->component->info->load_first) {
+			continue;
+		}
+		result = check_component_load(state, loader->component,
+					      loader->result,
+					      replay_required);
+		if (result != UDS_SUCCESS) {
+			break;
+		}
+	}
+	UDS_FREE(loaders);
+	return result;
+}
+
 /**********************************************************************/
 int load_index_state(struct index_state *state, bool *replay_ptr)
 {
 	bool replay_required = false;
-	unsigned int i;
 	int result = find_latest_uds_index_save_slot(state->layout,
 						     &state->load_zones,
 						     &state->load_slot);
@@ -164,23 +310,19 @@ int load_index_state(struct index_state *state, bool *replay_ptr)
 		return result;
 	}
 
-	for (i = 0; i < state->count; ++i) {
-		struct index_component *component = state->entries[i];
-		result = read_index_component(component);
-		if (result != UDS_SUCCESS) {
-			if (!missing_index_component_requires_replay(component)) {
-				state->load_zones = 0;
-				state->load_slot = UINT_MAX;
-				return uds_log_error_strerror(result,
-							      "index component %s",
-							      index_component_name(component));
-			}
-			replay_required = true;
-		}
+	result = load_index_state_components(state, &replay_required);
+	if (result != UDS_SUCCESS) {
+		return result;
 	}
 
+	// The next incremental save shares the base of the one just loaded,
+	// whose delta lists have been noted as changed since that base.
+	state->base_slot = ((state->load_base_slot == UINT_MAX) ?
+			    state->load_slot : state->load_base_slot);
+	state->incremental_saves = 0;
 	state->load_zones = 0;
 	state->load_slot = UINT_MAX;
+	state->load_base_slot = UINT_MAX;
 	if (replay_ptr != NULL) {
 		*replay_ptr = replay_required;
 	}
@@ -197,14 +339,28 @@ int prepare_to_save_index_state(struct index_state *state,
 		return uds_log_error_strerror(
 			UDS_BAD_STATE, "already saving the index state");
 	}
+	// The last full save is kept for as long as it is a base, so a crash
+	// during any later save leaves a complete one to load.
 	result = setup_uds_index_save_slot(state->layout, state->zone_count,
-					   save_type, &state->save_slot);
+					   save_type, state->base_slot,
+					   &state->save_slot);
 	if (result != UDS_SUCCESS) {
 		return uds_log_error_strerror(result,
 					      "cannot prepare index %s",
 					      index_save_type_name(save_type));
 	}
 
+	state->save_type = save_type;
+	// A clean save is incremental too, so that suspending or closing the
+	// index mostly writes what changed since the last full save.
+	state->incremental =
+		((state->base_slot != UINT_MAX) &&
+		 (state->incremental_saves < MAX_INCREMENTAL_CHECKPOINTS));
+	if (!state->incremental) {
+		// A full save forgets which delta lists have changed, so the
+		// old base is no longer usable even if this save fails.
+		state->base_slot = UINT_MAX;
+	}
 	return UDS_SUCCESS;
 }
 
@@ -221,11 +377,18 @@ static int complete_index_saving(struct index_state *state)
 	int result;
 	state->saving = false;
 	result = commit_uds_index_save(state->layout, state->save_slot);
-	state->save_slot = UINT_MAX;
 	if (result != UDS_SUCCESS) {
+		state->save_slot = UINT_MAX;
 		return uds_log_error_strerror(result,
 					      "cannot commit index state");
 	}
+	if (state->incremental) {
+		state->incremental_saves++;
+	} else {
+		state->base_slot = state->save_slot;
+		state->incremental_saves = 0;
+	}
+	state->save_slot = UINT_MAX;
 	return UDS_SUCCESS;
 }
 
@@ -485,6 +648,7 @@ int discard_index_state_data(struct index_state *state)
 {
 	int result = discard_uds_index_saves(state->layout, true);
 	state->save_slot = UINT_MAX;
+	state->base_slot = UINT_MAX;
 	if (result != UDS_SUCCESS) {
 		return uds_log_error_strerror(result,
 					      "%s: cannot destroy all index saves",
@@ -498,6 +662,7 @@ int discard_last_index_state_save(struct index_state *state)
 {
 	int result = discard_uds_index_saves(state->layout, false);
 	state->save_slot = UINT_MAX;
+	state->base_slot = UINT_MAX;
 	if (result != UDS_SUCCESS) {
 		return uds_log_error_strerror(result,
 					      "%s: cannot destroy latest index save",
@@ -506,6 +671,33 @@ int discard_last_index_state_save(struct index_state *state)
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+void get_index_state_component_io(const struct index_state *state,
+				  struct uds_index_phase_stats *stats)
+{
+	unsigned int i;
+	for (i = 0; i < state->count; ++i) {
+		struct index_component *component = state->entries[i];
+		enum uds_index_component_type type;
+		switch (component->info->kind) {
+		case RL_KIND_OPEN_CHAPTER:
+			type = UDS_COMPONENT_OPEN_CHAPTER;
+			break;
+		case RL_KIND_VOLUME_INDEX:
+			type = UDS_COMPONENT_VOLUME_INDEX;
+			break;
+		case RL_KIND_INDEX_PAGE_MAP:
+			type = UDS_COMPONENT_INDEX_PAGE_MAP;
+			break;
+		default:
+			continue;
+		}
+		stats->bytes_read[type] = component->bytes_read;
+		stats->bytes_written[type] =
+			atomic64_read(&component->bytes_written);
+	}
+}
+
 /**********************************************************************/
 struct buffer *get_state_index_state_buffer(struct index_state *state,
 					    enum io_access_mode  mode)
@@ -515,22 +707,96 @@ struct buffer *get_state_index_state_buffer(struct index_state *state,
 	return get_uds_index_state_buffer(state->layout, slot);
 }
 
+/**
+ * The size of each buffer of the readers of saved components. The
+ * components are read from start to end, so the readers read ahead. The
+ * buffers are kept small enough to still be in the CPU cache when the
+ * data in them is decoded.
+ **/
+static const size_t STATE_READ_AHEAD_SIZE = 16 * UDS_BLOCK_SIZE;
+
+/**
+ * Open a reader for a saved component, and have it read ahead.
+ *
+ * @param state       The index state
+ * @param slot        The save slot to read from
+ * @param kind        The kind of component
+ * @param zone        The zone of the component
+ * @param reader_ptr  The pointer to hold the new reader
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int open_read_ahead_reader(struct index_state *state,
+				  unsigned int slot,
+				  enum region_kind kind,
+				  unsigned int zone,
+				  struct buffered_reader **reader_ptr)
+{
+	int result = open_uds_index_buffered_reader(state->layout, slot, kind,
+						    zone, reader_ptr);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// A reader which cannot read ahead still reads correctly.
+	result = start_buffered_reader_read_ahead(*reader_ptr,
+						  STATE_READ_AHEAD_SIZE);
+	if (result != UDS_SUCCESS) {
+		uds_log_warning_strerror(result,
+					 "reading zone %u without read-ahead",
+					 zone);
+	}
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int open_state_buffered_reader(struct index_state   *state,
 			       enum region_kind         kind,
 			       unsigned int             zone,
 			       struct buffered_reader **reader_ptr)
 {
-	return open_uds_index_buffered_reader(state->layout, state->load_slot,
-					      kind, zone, reader_ptr);
+	return open_read_ahead_reader(state, state->load_slot, kind, zone,
+				      reader_ptr);
 }
 
+/**********************************************************************/
+int open_state_base_buffered_reader(struct index_state *state,
+				    enum region_kind kind,
+				    unsigned int zone,
+				    struct buffered_reader **reader_ptr)
+{
+	return open_read_ahead_reader(state, state->load_base_slot, kind,
+				      zone, reader_ptr);
+}
+
+/**
+ * The size of each buffer of the writers of saved components. Zone threads
+ * save their parts of a checkpoint between requests, so the writers write
+ * behind rather than making them wait for each buffer to be written.
+ **/
+static const size_t STATE_WRITE_BEHIND_SIZE = 16 * UDS_BLOCK_SIZE;
+
 /**********************************************************************/
 int open_state_buffered_writer(struct index_state *state,
 			       enum region_kind kind,
 			       unsigned int zone,
 			       struct buffered_writer **writer_ptr)
 {
-	return open_uds_index_buffered_writer(state->layout, state->save_slot,
-					      kind, zone, writer_ptr);
+	int result = open_uds_index_buffered_writer(state->layout,
+						    state->save_slot, kind,
+						    zone, writer_ptr);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// A writer which cannot write behind still writes correctly.
+	result = start_buffered_writer_write_behind(*writer_ptr,
+						    STATE_WRITE_BEHIND_SIZE);
+	if (result != UDS_SUCCESS) {
+		uds_log_warning_strerror(result,
+					 "writing zone %u without write-behind",
+					 zone);
+	}
+	set_buffered_writer_throttle(*writer_ptr, state->throttle);
+	return UDS_SUCCESS;
 }
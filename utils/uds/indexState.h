@@ -44,6 +44,14 @@ enum io_access_mode {
 	IO_WRITE = 0x2,
 };
 
+/*
+ * The number of checkpoints or saves which write only the volume index delta
+ * lists changed since the last full save before a full save is made again.
+ */
+enum {
+	MAX_INCREMENTAL_CHECKPOINTS = 4,
+};
+
 /**
  * The index state structure controls the loading and saving of the index
  * state.
@@ -53,7 +61,14 @@ struct index_state {
 	unsigned int zone_count;           // number of index zones to use
 	unsigned int load_zones;
 	unsigned int load_slot;
+	unsigned int load_base_zones;      // zones in the base of the load
+	unsigned int load_base_slot;       // base of the load, if incremental
 	unsigned int save_slot;
+	unsigned int base_slot;            // last full save, or UINT_MAX
+	unsigned int incremental_saves;    // saves made since the full save
+	bool incremental;                  // save in progress is incremental
+	enum index_save_type save_type;    // type of the save in progress
+	struct io_throttle *throttle;      // paces the save writers, or NULL
 	unsigned int count;                // count of registered entries
 					   // (<= length)
 	unsigned int length;               // total span of array allocation
@@ -247,6 +262,16 @@ int discard_index_state_data(struct index_state *state);
  **/
 int discard_last_index_state_save(struct index_state *state);
 
+/**
+ * Get the number of bytes each saved component read when it was last
+ * loaded, and wrote when it was last saved.
+ *
+ * @param state         The index state
+ * @param stats         The statistics to fill with the component byte counts
+ **/
+void get_index_state_component_io(const struct index_state *state,
+				  struct uds_index_phase_stats *stats);
+
 /**
  * Find index component, for testing.
  *
@@ -288,6 +313,24 @@ open_state_buffered_reader(struct index_state *state,
 			   unsigned int zone,
 			   struct buffered_reader **reader_ptr);
 
+/**
+ * Open a buffered reader on the base of the save being loaded for a
+ * specified state, kind, and zone.  This helper function is used by
+ * index components which can be saved incrementally.
+ *
+ * @param state       The index state.
+ * @param kind        The kind of index save region to open.
+ * @param zone        The zone number for the region.
+ * @param reader_ptr  Where to store the buffered reader.
+ *
+ * @return UDS_SUCCESS or an error code.
+ **/
+int __must_check
+open_state_base_buffered_reader(struct index_state *state,
+				enum region_kind kind,
+				unsigned int zone,
+				struct buffered_reader **reader_ptr);
+
 /**
  * Open a buffered writer for a specified state, kind, and zone.
  * This helper function is used by index_component.
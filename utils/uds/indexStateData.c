@@ -24,6 +24,7 @@
 #include "buffer.h"
 #include "errors.h"
 #include "index.h"
+#include "indexLayout.h"
 #include "logger.h"
 #include "uds.h"
 
@@ -47,6 +48,66 @@ static const struct index_state_version INDEX_STATE_VERSION_301 = {
 	.version_id = 301,
 };
 
+/*
+ * The version 302 index state is written by an incremental save. It is the
+ * version 301 state followed by the slot and nonce of the full save which
+ * holds the volume index delta lists that did not change.
+ */
+struct index_state_base302 {
+	uint32_t base_slot;
+	uint32_t padding;
+	uint64_t base_nonce;
+};
+
+static const struct index_state_version INDEX_STATE_VERSION_302 = {
+	.signature  = -1,
+	.version_id = 302,
+};
+
+/**
+ * Read the base of an incremental save and check that it is still the save
+ * which was the base when the incremental save was written.
+ *
+ * @param state   The index state being loaded
+ * @param buffer  The buffer holding the index state
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int read_index_state_base(struct index_state *state,
+				 struct buffer *buffer)
+{
+	struct index_state_base302 base;
+	uint64_t nonce;
+	unsigned int zones;
+	int result = get_uint32_le_from_buffer(buffer, &base.base_slot);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	result = get_uint32_le_from_buffer(buffer, &base.padding);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	result = get_uint64_le_from_buffer(buffer, &base.base_nonce);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	if ((base.padding != 0) || (base.base_slot == state->load_slot)) {
+		return UDS_CORRUPT_COMPONENT;
+	}
+
+	result = get_uds_index_save_slot_info(state->layout, base.base_slot,
+					      &nonce, &zones);
+	if ((result != UDS_SUCCESS) || (nonce != base.base_nonce)) {
+		return uds_log_error_strerror(UDS_CORRUPT_COMPONENT,
+					      "base of incremental index save is missing");
+	}
+
+	state->load_base_slot = base.base_slot;
+	state->load_base_zones = zones;
+	return UDS_SUCCESS;
+}
+
 /**
  * The index state index component reader.
  *
@@ -76,7 +137,9 @@ static int read_index_state_data(struct read_portal *portal)
 		return result;
 	}
 
-	if (file_version.signature != -1 || file_version.version_id != 301) {
+	if (file_version.signature != -1 ||
+	    (file_version.version_id != 301 &&
+	     file_version.version_id != 302)) {
 		return uds_log_error_strerror(UDS_UNSUPPORTED_VERSION,
 					      "index state version %d,%d is unsupported",
 					      file_version.signature,
@@ -108,7 +171,20 @@ static int read_index_state_data(struct read_portal *portal)
 		return UDS_CORRUPT_COMPONENT;
 	}
 
+	if (file_version.version_id == 302) {
+		result = read_index_state_base(portal->component->state,
+					       buffer);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
+
+	// Without an index, the state is loaded only to find the base of an
+	// incremental save.
 	index = index_component_data(portal->component);
+	if (index == NULL) {
+		return UDS_SUCCESS;
+	}
 	index->newest_virtual_chapter = state.newest_chapter;
 	index->oldest_virtual_chapter = state.oldest_chapter;
 	index->last_checkpoint = state.last_checkpoint;
@@ -131,19 +207,22 @@ write_index_state_data(struct index_component *component,
 {
 	struct uds_index *index;
 	struct index_state_data301 state;
+	struct index_state_base302 base;
+	struct index_state *index_state = component->state;
+	const struct index_state_version *version =
+		(index_state->incremental ? &INDEX_STATE_VERSION_302 :
+					    &INDEX_STATE_VERSION_301);
 	struct buffer *buffer =
-		get_state_index_state_buffer(component->state, IO_WRITE);
+		get_state_index_state_buffer(index_state, IO_WRITE);
 	int result = reset_buffer_end(buffer, 0);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
-	result = put_uint32_le_into_buffer(buffer,
-					   INDEX_STATE_VERSION_301.signature);
+	result = put_uint32_le_into_buffer(buffer, version->signature);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
-	result = put_uint32_le_into_buffer(buffer,
-					   INDEX_STATE_VERSION_301.version_id);
+	result = put_uint32_le_into_buffer(buffer, version->version_id);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
@@ -175,7 +254,28 @@ write_index_state_data(struct index_component *component,
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
-	return UDS_SUCCESS;
+	if (!index_state->incremental) {
+		return UDS_SUCCESS;
+	}
+
+	base = (struct index_state_base302) {
+		.base_slot = index_state->base_slot,
+	};
+	result = get_uds_index_save_slot_info(index_state->layout,
+					      base.base_slot,
+					      &base.base_nonce, NULL);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	result = put_uint32_le_into_buffer(buffer, base.base_slot);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	result = put_uint32_le_into_buffer(buffer, base.padding);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	return put_uint64_le_into_buffer(buffer, base.base_nonce);
 }
 
 /**********************************************************************/
@@ -187,6 +287,7 @@ const struct index_component_info INDEX_STATE_INFO = {
 	.chapter_sync = true,
 	.multi_zone   = false,
 	.io_storage   = false,
+	.load_first   = true,
 	.loader       = read_index_state_data,
 	.saver        = write_index_state_data,
 	.incremental  = NULL,
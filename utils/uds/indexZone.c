@@ -22,6 +22,7 @@
 #include "indexZone.h"
 
 #include "errors.h"
+#include "hashUtils.h"
 #include "index.h"
 #include "indexCheckpoint.h"
 #include "logger.h"
@@ -35,6 +36,9 @@
 int make_index_zone(struct uds_index *index, unsigned int zone_number)
 {
 	struct index_zone *zone;
+	// The open chapters are only touched by the zone thread, so keep them
+	// on its node.
+	int node = get_slot_node(index->affinity, zone_number);
 	int result = UDS_ALLOCATE(1, struct index_zone, "index zone", &zone);
 	if (result != UDS_SUCCESS) {
 		return result;
@@ -42,6 +46,7 @@ int make_index_zone(struct uds_index *index, unsigned int zone_number)
 
 	result = make_open_chapter(index->volume->geometry,
 				   index->zone_count,
+				   node,
 				   &zone->open_chapter);
 	if (result != UDS_SUCCESS) {
 		free_index_zone(zone);
@@ -50,14 +55,25 @@ int make_index_zone(struct uds_index *index, unsigned int zone_number)
 
 	result = make_open_chapter(index->volume->geometry,
 				   index->zone_count,
+				   node,
 				   &zone->writing_chapter);
 	if (result != UDS_SUCCESS) {
 		free_index_zone(zone);
 		return result;
 	}
 
+	result = UDS_ALLOCATE(ZONE_QUERY_CACHE_SLOTS,
+			      struct zone_query_result,
+			      "zone query results",
+			      &zone->query_cache);
+	if (result != UDS_SUCCESS) {
+		free_index_zone(zone);
+		return result;
+	}
+
 	zone->index = index;
 	zone->id = zone_number;
+	zone->query_generation = 1;
 	index->zones[zone_number] = zone;
 
 	return UDS_SUCCESS;
@@ -72,6 +88,7 @@ void free_index_zone(struct index_zone *zone)
 
 	free_open_chapter(zone->open_chapter);
 	free_open_chapter(zone->writing_chapter);
+	UDS_FREE(zone->query_cache);
 	UDS_FREE(zone);
 }
 
@@ -173,9 +190,6 @@ int dispatch_index_zone_control_request(struct uds_request *request)
 	struct index_zone *zone = message->index->zones[request->zone_number];
 
 	switch (message->type) {
-	case UDS_MESSAGE_SPARSE_CACHE_BARRIER:
-		return update_sparse_cache(zone, message->virtual_chapter);
-
 	case UDS_MESSAGE_ANNOUNCE_CHAPTER_CLOSED:
 		return handle_chapter_closed(zone, message->virtual_chapter);
 
@@ -249,6 +263,9 @@ int open_next_chapter(struct index_zone *zone, struct uds_request *request)
 	}
 
 	closed_chapter = zone->newest_virtual_chapter++;
+	// Records of the closed chapter can be dropped when it is written,
+	// and the oldest chapters may expire, so old answers may be wrong.
+	forget_zone_queries(zone);
 	result = reap_oldest_chapter(zone);
 	if (result != UDS_SUCCESS) {
 		return uds_log_error_strerror(result,
@@ -325,6 +342,7 @@ int get_record_from_zone(struct index_zone *zone,
 			 uint64_t virtual_chapter)
 {
 	struct volume *volume;
+	int result;
 	if (virtual_chapter == zone->newest_virtual_chapter) {
 		search_open_chapter(zone->open_chapter,
 				    &request->chunk_name,
@@ -352,21 +370,30 @@ int get_record_from_zone(struct index_zone *zone,
 	}
 
 	volume = zone->index->volume;
-	if (is_zone_chapter_sparse(zone, virtual_chapter) &&
-	    sparse_cache_contains(volume->sparse_cache,
-				  virtual_chapter,
-				  request->zone_number)) {
-		// The named chunk, if it exists, is in a sparse chapter that
-		// is cached, so just run the chunk through the sparse chapter
-		// cache search.
-		return search_sparse_cache_in_zone(zone, request,
-						   virtual_chapter, found);
+	if (is_zone_chapter_sparse(zone, virtual_chapter)) {
+		if (sparse_cache_contains(volume->sparse_cache,
+					  virtual_chapter,
+					  request->zone_number)) {
+			// The named chunk, if it exists, is in a sparse
+			// chapter that is cached, so just run the chunk
+			// through the sparse chapter cache search.
+			return search_sparse_cache_in_zone(zone, request,
+							   virtual_chapter,
+							   found);
+		}
+
+		// Have the chapter loaded for later hooks, and look for this
+		// one in the page cache meanwhile.
+		request_sparse_chapter(zone, virtual_chapter);
 	}
 
-	return search_volume_page_cache(volume,
-					request, &request->chunk_name,
-					virtual_chapter,
-					&request->old_metadata, found);
+	result = search_volume_page_cache(volume,
+					  request, &request->chunk_name,
+					  virtual_chapter,
+					  &request->old_metadata, found);
+	request->page_cache_hit = ((result == UDS_SUCCESS) && *found &&
+				   (request->read_time == 0));
+	return result;
 }
 
 /**********************************************************************/
@@ -388,6 +415,83 @@ int put_record_in_zone(struct index_zone *zone,
 	return UDS_SUCCESS;
 }
 
+/**
+ * Get the slot which may hold the remembered query result for a name.
+ *
+ * @param zone  The index zone
+ * @param name  The name
+ *
+ * @return The slot for the name
+ **/
+static struct zone_query_result *
+get_zone_query_slot(struct index_zone *zone, const struct uds_chunk_name *name)
+{
+	return &zone->query_cache[name_to_hash_slot(name,
+						    ZONE_QUERY_CACHE_SLOTS)];
+}
+
+/**********************************************************************/
+bool answer_query_from_zone_cache(struct index_zone *zone,
+				  struct uds_request *request)
+{
+	const struct zone_query_result *slot =
+		get_zone_query_slot(zone, &request->chunk_name);
+	if ((slot->generation != zone->query_generation) ||
+	    (memcmp(&slot->name, &request->chunk_name,
+		    UDS_CHUNK_NAME_SIZE) != 0)) {
+		return false;
+	}
+
+	if (slot->found) {
+		request->old_metadata = slot->metadata;
+		request->location =
+			compute_index_region(zone, slot->virtual_chapter);
+		request->chapter_age = (zone->newest_virtual_chapter -
+					slot->virtual_chapter);
+	}
+	zone->cached_queries++;
+	return true;
+}
+
+/**********************************************************************/
+void remember_zone_query(struct index_zone *zone,
+			 const struct uds_request *request,
+			 bool found,
+			 uint64_t virtual_chapter)
+{
+	struct zone_query_result *slot =
+		get_zone_query_slot(zone, &request->chunk_name);
+	slot->name = request->chunk_name;
+	slot->found = found;
+	if (found) {
+		slot->metadata = request->old_metadata;
+		slot->virtual_chapter = virtual_chapter;
+	}
+	slot->generation = zone->query_generation;
+}
+
+/**********************************************************************/
+void forget_zone_query(struct index_zone *zone,
+		       const struct uds_chunk_name *name)
+{
+	struct zone_query_result *slot = get_zone_query_slot(zone, name);
+	if ((slot->generation == zone->query_generation) &&
+	    (memcmp(&slot->name, name, UDS_CHUNK_NAME_SIZE) == 0)) {
+		slot->generation = 0;
+	}
+}
+
+/**********************************************************************/
+void forget_zone_queries(struct index_zone *zone)
+{
+	if (++zone->query_generation == 0) {
+		// Wrapping could revive results from long ago.
+		memset(zone->query_cache, 0,
+		       ZONE_QUERY_CACHE_SLOTS * sizeof(*zone->query_cache));
+		zone->query_generation = 1;
+	}
+}
+
 /**********************************************************************/
 int search_sparse_cache_in_zone(struct index_zone *zone,
 				struct uds_request *request,
@@ -411,8 +515,12 @@ int search_sparse_cache_in_zone(struct index_zone *zone,
 	// invalidations.
 	chapter = map_to_physical_chapter(volume->geometry, virtual_chapter);
 
-	return search_cached_record_page(volume,
-					 request, &request->chunk_name,
-					 chapter, record_page_number,
-					 &request->old_metadata, found);
+	result = search_cached_record_page(volume,
+					   request, &request->chunk_name,
+					   chapter, record_page_number,
+					   &request->old_metadata, found);
+	request->page_cache_hit = ((result == UDS_SUCCESS) && *found &&
+				   (request->read_time == 0));
+	request->chapter_age = zone->newest_virtual_chapter - virtual_chapter;
+	return result;
 }
@@ -23,16 +23,47 @@
 #define INDEX_ZONE_H
 
 #include "common.h"
+#include "cpu.h"
 #include "openChapterZone.h"
 #include "request.h"
 
-struct index_zone {
+enum {
+	/* The number of recent query results each zone remembers */
+	ZONE_QUERY_CACHE_SLOTS = 256,
+};
+
+/*
+ * The result of a recent query, kept so that a query repeated soon after
+ * is answered without searching the volume index or the chapters. A slot
+ * is valid only while its generation is the zone's current one.
+ */
+struct zone_query_result {
+	struct uds_chunk_name name;
+	struct uds_chunk_data metadata;
+	uint64_t virtual_chapter;
+	unsigned int generation;
+	bool found;
+};
+
+/*
+ * Each zone is written by its own thread, so each is aligned to keep
+ * neighbouring zones from sharing a cache line.
+ */
+struct __attribute__((aligned(CACHE_LINE_BYTES))) index_zone {
 	struct uds_index *index;
 	struct open_chapter_zone *open_chapter;
 	struct open_chapter_zone *writing_chapter;
 	uint64_t oldest_virtual_chapter;
 	uint64_t newest_virtual_chapter;
 	unsigned int id;
+	/* The load on the zone, written only by the zone thread */
+	uint64_t requests;
+	ktime_t busy_time;
+	unsigned int max_queue_depth;
+	uint64_t cached_queries;
+	/* The recent query results, direct mapped by name */
+	struct zone_query_result *query_cache;
+	unsigned int query_generation;
 };
 
 /**
@@ -137,6 +168,49 @@ int __must_check put_record_in_zone(struct index_zone *zone,
 				    struct uds_request *request,
 				    const struct uds_chunk_data *metadata);
 
+/**
+ * Answer a query from the zone's recent query results if the same name was
+ * queried since anything which could change the answer.
+ *
+ * @param zone     The index zone handling the query
+ * @param request  The query, which is filled in as if it had been searched
+ *                 if it is answered
+ *
+ * @return true if the query was answered
+ **/
+bool __must_check answer_query_from_zone_cache(struct index_zone *zone,
+					       struct uds_request *request);
+
+/**
+ * Remember the result of a query which did not change the index.
+ *
+ * @param zone             The index zone which handled the query
+ * @param request          The query, which has been searched
+ * @param found            Whether the name was found
+ * @param virtual_chapter  The chapter in which the name was found
+ **/
+void remember_zone_query(struct index_zone *zone,
+			 const struct uds_request *request,
+			 bool found,
+			 uint64_t virtual_chapter);
+
+/**
+ * Forget any remembered query result for a name which is about to change.
+ *
+ * @param zone  The index zone handling the name
+ * @param name  The name which is changing
+ **/
+void forget_zone_query(struct index_zone *zone,
+		       const struct uds_chunk_name *name);
+
+/**
+ * Forget all the remembered query results of a zone, because a chapter has
+ * closed or expired, or a change may have affected more than one name.
+ *
+ * @param zone  The index zone
+ **/
+void forget_zone_queries(struct index_zone *zone);
+
 /**
  * Search the cached sparse chapter index, either for a cached sparse hook, or
  * as the last chance for finding the record named by a request.
@@ -101,6 +101,57 @@ void put_uds_io_factory(struct io_factory *factory);
  **/
 size_t __must_check get_uds_writable_size(struct io_factory *factory);
 
+/**
+ * Check whether an IO factory was opened for reading only.
+ *
+ * @param factory  The IO factory
+ *
+ * @return true if the storage may not be written
+ **/
+bool __must_check is_uds_io_factory_read_only(struct io_factory *factory);
+
+/**
+ * Get the path of the block device or file of an IO factory.
+ *
+ * @param factory  The IO factory
+ *
+ * @return the path
+ **/
+const char * __must_check get_uds_io_factory_path(struct io_factory *factory);
+
+/**
+ * Get the zones of a zoned block device. Zones which can be written
+ * anywhere (conventional zones) are only found at the start of a device,
+ * so the zones from the first sequential zone onward all have write
+ * pointers.
+ *
+ * @param [in]  factory                The IO factory
+ * @param [out] zone_size              The size in bytes of each zone
+ * @param [out] zone_count             The number of zones
+ * @param [out] first_sequential_zone  The first zone with a write pointer
+ *
+ * @return UDS_SUCCESS or an error code, particularly EINVAL if the storage
+ *         is not a zoned block device
+ **/
+int __must_check get_uds_zones(struct io_factory *factory,
+			       size_t *zone_size,
+			       unsigned int *zone_count,
+			       unsigned int *first_sequential_zone);
+
+/**
+ * Reset the write pointers of a range of sequential zones of a zoned block
+ * device, discarding their contents.
+ *
+ * @param factory  The IO factory
+ * @param offset   The byte offset of the first zone
+ * @param size     The size in bytes of the zones, a multiple of the zone size
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check reset_uds_zones(struct io_factory *factory,
+				 off_t offset,
+				 size_t size);
+
 /**
  * Create an IO region for a region of the index.
  *
@@ -116,6 +167,24 @@ int __must_check make_uds_io_region(struct io_factory *factory,
 				    size_t size,
 				    struct io_region **region_ptr);
 
+/**
+ * Create an IO region for a region of the index which is read and written
+ * with direct I/O, bypassing the kernel page cache. The region uses its own
+ * file descriptor.
+ *
+ * @param factory    The IO factory
+ * @param offset     The byte offset to the region within the index
+ * @param size       The size in bytes of the region
+ * @param region_ptr The IO region is returned here
+ *
+ * @return UDS_SUCCESS or an error code, particularly EINVAL if the storage
+ *         does not support direct I/O
+ **/
+int __must_check make_uds_direct_io_region(struct io_factory *factory,
+					   off_t offset,
+					   size_t size,
+					   struct io_region **region_ptr);
+
 /**
  * Create a buffered reader for a region of the index.
  *
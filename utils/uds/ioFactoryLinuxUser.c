@@ -19,16 +19,24 @@
  * $Id: //eng/uds-releases/krusty/userLinux/uds/ioFactoryLinuxUser.c#16 $
  */
 
+#include <linux/blkzoned.h>
+#include <sys/ioctl.h>
+
 #include "atomicDefs.h"
 #include "fileIORegion.h"
 #include "ioFactory.h"
+#include "logger.h"
 #include "memoryAlloc.h"
 
+enum { SECTOR_SHIFT = 9 };
+
 /*
  * A user mode IOFactory object controls access to an index stored in a file.
  */
 struct io_factory {
 	int fd;
+	char *path;
+	bool read_only;
 	atomic_t ref_count;
 };
 
@@ -49,11 +57,21 @@ int make_uds_io_factory(const char *path,
 		return result;
 	}
 
+	result = uds_duplicate_string(path, "IO factory path",
+				      &factory->path);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(factory);
+		return result;
+	}
+
 	result = open_file(path, access, &factory->fd);
 	if (result != UDS_SUCCESS) {
+		UDS_FREE(factory->path);
 		UDS_FREE(factory);
 		return result;
 	}
+	factory->read_only = ((access == FU_READ_ONLY) ||
+			      (access == FU_READ_ONLY_DIRECT));
 
 	atomic_set_release(&factory->ref_count, 1);
 	*factory_ptr = factory;
@@ -65,15 +83,24 @@ int replace_uds_storage(struct io_factory *factory,
 			const char *path)
 {
 	int fd;
+	char *new_path;
 	int result;
 
+	result = uds_duplicate_string(path, "IO factory path", &new_path);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
 	result = open_file(path, FU_READ_WRITE, &fd);
 	if (result != UDS_SUCCESS) {
+		UDS_FREE(new_path);
 		return result;
 	}
 
 	close_file(factory->fd, NULL);
 	factory->fd = fd;
+	UDS_FREE(factory->path);
+	factory->path = new_path;
 	return UDS_SUCCESS;
 }
 
@@ -82,6 +109,7 @@ void put_uds_io_factory(struct io_factory *factory)
 {
 	if (atomic_add_return(-1, &factory->ref_count) <= 0) {
 		close_file(factory->fd, NULL);
+		UDS_FREE(factory->path);
 		UDS_FREE(factory);
 	}
 }
@@ -98,6 +126,92 @@ size_t get_uds_writable_size(struct io_factory *factory __attribute__((unused)))
 	return SIZE_MAX;
 }
 
+/**********************************************************************/
+bool is_uds_io_factory_read_only(struct io_factory *factory)
+{
+	return factory->read_only;
+}
+
+/**********************************************************************/
+const char *get_uds_io_factory_path(struct io_factory *factory)
+{
+	return factory->path;
+}
+
+/**********************************************************************/
+int get_uds_zones(struct io_factory *factory,
+		  size_t *zone_size,
+		  unsigned int *zone_count,
+		  unsigned int *first_sequential_zone)
+{
+	struct blk_zone_report *report;
+	__u32 sectors, count;
+	unsigned int zone;
+	int result;
+
+	if (ioctl(factory->fd, BLKGETZONESZ, &sectors) != 0) {
+		return uds_log_error_strerror(errno,
+					      "cannot get zone size of %s",
+					      factory->path);
+	}
+	if (sectors == 0) {
+		return uds_log_error_strerror(EINVAL,
+					      "%s is not a zoned block device",
+					      factory->path);
+	}
+	if (ioctl(factory->fd, BLKGETNRZONES, &count) != 0) {
+		return uds_log_error_strerror(errno,
+					      "cannot get zone count of %s",
+					      factory->path);
+	}
+
+	result = UDS_ALLOCATE_EXTENDED(struct blk_zone_report, 1,
+				       struct blk_zone, __func__, &report);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	for (zone = 0; zone < count; zone++) {
+		report->sector = (__u64) zone * sectors;
+		report->nr_zones = 1;
+		if (ioctl(factory->fd, BLKREPORTZONE, report) != 0) {
+			result = uds_log_error_strerror(errno,
+							"cannot report zone %u of %s",
+							zone, factory->path);
+			break;
+		}
+		if ((report->nr_zones == 0) ||
+		    (report->zones[0].type != BLK_ZONE_TYPE_CONVENTIONAL)) {
+			break;
+		}
+	}
+	UDS_FREE(report);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	*zone_size = (size_t) sectors << SECTOR_SHIFT;
+	*zone_count = count;
+	*first_sequential_zone = zone;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int reset_uds_zones(struct io_factory *factory, off_t offset, size_t size)
+{
+	struct blk_zone_range range = {
+		.sector = offset >> SECTOR_SHIFT,
+		.nr_sectors = size >> SECTOR_SHIFT,
+	};
+
+	if (ioctl(factory->fd, BLKRESETZONE, &range) != 0) {
+		return uds_log_error_strerror(errno,
+					      "cannot reset zones at %lld of %s",
+					      (long long) offset,
+					      factory->path);
+	}
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int make_uds_io_region(struct io_factory *factory,
 		       off_t offset,
@@ -112,6 +226,26 @@ int make_uds_io_region(struct io_factory *factory,
 				region_ptr);
 }
 
+/**********************************************************************/
+int make_uds_direct_io_region(struct io_factory *factory,
+			      off_t offset,
+			      size_t size,
+			      struct io_region **region_ptr)
+{
+	int fd;
+	int result = open_file(factory->path, FU_READ_WRITE_DIRECT, &fd);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = make_direct_file_region(factory, fd, offset, size,
+					 region_ptr);
+	if (result != UDS_SUCCESS) {
+		close_file(fd, NULL);
+	}
+	return result;
+}
+
 /**********************************************************************/
 
 int open_uds_buffered_reader(struct io_factory *factory,
@@ -129,7 +263,7 @@ int open_uds_buffered_reader(struct io_factory *factory,
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
-	result = make_buffered_reader(region, reader_ptr);
+	result = make_buffered_reader(region, size, reader_ptr);
 	put_io_region(region);
 	return result;
 }
@@ -26,6 +26,24 @@
 #include "compiler.h"
 #include "typeDefs.h"
 
+struct iovec;
+struct io_ring;
+struct io_ring_read;
+
+/**
+ * A read-only memory mapping of a whole IO region, made by map_region().
+ **/
+struct region_mapping {
+	/** The start of the mapped memory, for munmap() */
+	void *base;
+	/** The length of the mapped memory */
+	size_t length;
+	/** The first byte of the region within the mapping */
+	byte *data;
+	/** The size of the region */
+	size_t size;
+};
+
 /**
  * The IO region type is an abstraction which represents a specific
  * place which can be read or written. There are file-based
@@ -36,9 +54,17 @@
  **/
 struct io_region {
 	void (*free)(struct io_region *);
+	void (*prefetch)(struct io_region *, off_t, size_t);
 	int (*read)(struct io_region *, off_t, void *, size_t, size_t *);
+	int (*readv)(struct io_region *, off_t, const struct iovec *,
+		     unsigned int);
+	int (*read_batch)(struct io_region *, struct io_ring *,
+			  struct io_ring_read *, unsigned int);
 	int (*sync_contents)(struct io_region *);
 	int (*write)(struct io_region *, off_t, const void *, size_t, size_t);
+	int (*writev)(struct io_region *, off_t, const struct iovec *,
+		      unsigned int);
+	int (*map)(struct io_region *, struct region_mapping *);
 	atomic_t ref_count;
 };
 
@@ -65,6 +91,22 @@ static INLINE void put_io_region(struct io_region *region)
 	}
 }
 
+/**
+ * Advise a region that a range of it will be read soon, so that the data
+ * can be brought into memory ahead of the reads. This is only a hint; no
+ * error is reported if it cannot be honored.
+ *
+ * @param region  The IO region.
+ * @param offset  The offset of the first byte which will be read.
+ * @param size    The number of bytes which will be read.
+ **/
+static INLINE void prefetch_region(struct io_region *region,
+				   off_t offset,
+				   size_t size)
+{
+	region->prefetch(region, offset, size);
+}
+
 /**
  * Read some data from a region into a buffer.
  *
@@ -95,6 +137,74 @@ static INLINE int __must_check read_from_region(struct io_region *region,
 	return region->read(region, offset, buffer, size, length);
 }
 
+/**
+ * Read contiguous data from a region into several buffers, filling each
+ * buffer in turn with a single transfer where the region supports it.
+ * As with read_from_region() without a length, any part of the buffers
+ * beyond the end of the data is zeroed.
+ *
+ * @param region     The IO region.
+ * @param offset     The offset from which to read; must be aligned to the
+ *                   region's block size.
+ * @param iov        The buffers to read into; each length must be a
+ *                   multiple of the block size.
+ * @param iov_count  The number of buffers.
+ *
+ * @return UDS_SUCCESS or an error code, potentially
+ *         UDS_BUFFER_ERROR if there are too many buffers,
+ *         UDS_INCORRECT_ALIGNMENT if the offset or a buffer is incorrect,
+ *         UDS_OUT_OF_RANGE if the data is not within the region
+ **/
+static INLINE int __must_check
+read_vectored_from_region(struct io_region *region,
+			  off_t offset,
+			  const struct iovec *iov,
+			  unsigned int iov_count)
+{
+	return region->readv(region, offset, iov, iov_count);
+}
+
+/**
+ * Read a batch of ranges of a region, keeping them all in flight at once
+ * through an io_ring. As with read_from_region() without a length, any part
+ * of a range beyond the end of the data is zeroed. The offsets of the reads
+ * are offsets in the region, and the result of each read is stored in it.
+ *
+ * @param region  The IO region.
+ * @param ring    The io_ring of the calling thread.
+ * @param reads   The reads to do; each offset and size must be aligned to
+ *                the region's block size.
+ * @param count   The number of reads.
+ *
+ * @return UDS_SUCCESS or the first error of any read, potentially
+ *         UDS_INCORRECT_ALIGNMENT if a read is incorrect,
+ *         UDS_OUT_OF_RANGE if a read is not within the region
+ **/
+static INLINE int read_batch_from_region(struct io_region *region,
+					 struct io_ring *ring,
+					 struct io_ring_read *reads,
+					 unsigned int count)
+{
+	return region->read_batch(region, ring, reads, count);
+}
+
+/**
+ * Map a whole region into memory for reading. Writes to the region through
+ * the other operations are visible through the mapping. The caller owns the
+ * mapping and must unmap it before the region's storage is released.
+ *
+ * @param [in]  region   The IO region.
+ * @param [out] mapping  The mapping.
+ *
+ * @return UDS_SUCCESS or an error code, particularly EINVAL for regions
+ *         which cannot be mapped
+ **/
+static INLINE int __must_check map_region(struct io_region *region,
+					  struct region_mapping *mapping)
+{
+	return region->map(region, mapping);
+}
+
 /**
  * Force the region to be written to the backing store, if supported.
  *
@@ -134,4 +244,29 @@ static INLINE int __must_check write_to_region(struct io_region *region,
 	return region->write(region, offset, data, size, length);
 }
 
+/**
+ * Write several buffers to contiguous space in a region, with a single
+ * transfer where the region supports it.
+ *
+ * @param region     The IO region.
+ * @param offset     The offset at which to write; must be aligned to the
+ *                   region's block size.
+ * @param iov        The buffers to write; each length must be a multiple
+ *                   of the block size.
+ * @param iov_count  The number of buffers.
+ *
+ * @return UDS_SUCCESS or an error code, potentially
+ *         UDS_BUFFER_ERROR if there are too many buffers,
+ *         UDS_INCORRECT_ALIGNMENT if the offset or a buffer is incorrect,
+ *         UDS_OUT_OF_RANGE if the data is not within the region
+ **/
+static INLINE int __must_check
+write_vectored_to_region(struct io_region *region,
+			 off_t offset,
+			 const struct iovec *iov,
+			 unsigned int iov_count)
+{
+	return region->writev(region, offset, iov, iov_count);
+}
+
 #endif // IO_REGION_H
@@ -0,0 +1,88 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/ioRing.h#1 $
+ */
+
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include "compiler.h"
+#include "typeDefs.h"
+
+/**
+ * An io_ring keeps many reads of a file in flight at once from a single
+ * thread. It drives io_uring through the system calls directly, so that no
+ * library is needed. An io_ring is not thread safe; each thread reading
+ * through one needs its own.
+ **/
+struct io_ring;
+
+/**
+ * One read in a batch given to read_with_io_ring().
+ **/
+struct io_ring_read {
+	/** The buffer to read into */
+	void *buffer;
+	/** The number of bytes to read */
+	size_t size;
+	/** The offset in the file at which to read */
+	off_t offset;
+	/** UDS_SUCCESS or the error of the read, once the batch is done */
+	int result;
+};
+
+/**
+ * Make an io_ring. If the kernel does not provide io_uring, or does not let
+ * the process use it, no ring is made.
+ *
+ * @param depth     the most reads to keep in flight at once
+ * @param ring_ptr  a pointer to hold the ring, which will be set to NULL if
+ *                  no ring was made
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check make_io_ring(unsigned int depth, struct io_ring **ring_ptr);
+
+/**
+ * Free an io_ring.
+ *
+ * @param ring  the ring to free, which may be NULL
+ **/
+void free_io_ring(struct io_ring *ring);
+
+/**
+ * Read a batch of ranges of a file, keeping as many of them in flight at
+ * once as the ring allows. A short read is continued until its range is
+ * done, and any part of a range beyond the end of the file is zeroed, as
+ * with read_from_region(). The result of each read is stored in the read.
+ * This does not return until every read which was started has finished.
+ *
+ * @param ring   the ring
+ * @param fd     the file to read
+ * @param reads  the reads to do
+ * @param count  the number of reads
+ *
+ * @return UDS_SUCCESS or the first error of any read
+ **/
+int __must_check read_with_io_ring(struct io_ring *ring,
+				   int fd,
+				   struct io_ring_read reads[],
+				   unsigned int count);
+
+#endif /* IO_RING_H */
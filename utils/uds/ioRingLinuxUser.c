@@ -0,0 +1,449 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/userLinux/uds/ioRingLinuxUser.c#1 $
+ */
+
+#include "ioRing.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "atomicDefs.h"
+#include "errors.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "permassert.h"
+
+/*
+ * Each read in flight has a slot, which describes the part of its range
+ * which has not been read yet, so that a short read can be continued from
+ * the same slot.
+ */
+struct io_ring_slot {
+	struct iovec iov;
+	off_t offset;
+	/* The index in its batch of the read */
+	unsigned int read;
+};
+
+struct io_ring {
+	/* The io_uring file descriptor */
+	int fd;
+	/* The most reads in flight at once */
+	unsigned int depth;
+	/* The mapped submission queue ring */
+	void *sq_ring;
+	size_t sq_ring_bytes;
+	/* The mapped completion queue ring, which may be the same memory */
+	void *cq_ring;
+	size_t cq_ring_bytes;
+	/* The mapped submission queue entries */
+	struct io_uring_sqe *sqes;
+	size_t sqes_bytes;
+	/* Pointers into the submission queue ring */
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	/* Pointers into the completion queue ring */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* The slots, and a stack of those not in flight */
+	struct io_ring_slot *slots;
+	unsigned int *free_slots;
+	unsigned int free_count;
+};
+
+/**********************************************************************/
+static int setup_io_ring(unsigned int entries, struct io_uring_params *params)
+{
+	return (int) syscall(SYS_io_uring_setup, entries, params);
+}
+
+/**********************************************************************/
+static int enter_io_ring(struct io_ring *ring, unsigned int to_submit)
+{
+	return (int) syscall(SYS_io_uring_enter, ring->fd, to_submit, 1,
+			     IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+/**********************************************************************/
+static void *map_ring(struct io_ring *ring, size_t bytes, off_t offset)
+{
+	void *mapped = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd, offset);
+	return ((mapped == MAP_FAILED) ? NULL : mapped);
+}
+
+/**********************************************************************/
+void free_io_ring(struct io_ring *ring)
+{
+	if (ring == NULL) {
+		return;
+	}
+
+	if (ring->sqes != NULL) {
+		munmap(ring->sqes, ring->sqes_bytes);
+	}
+	if ((ring->cq_ring != NULL) && (ring->cq_ring != ring->sq_ring)) {
+		munmap(ring->cq_ring, ring->cq_ring_bytes);
+	}
+	if (ring->sq_ring != NULL) {
+		munmap(ring->sq_ring, ring->sq_ring_bytes);
+	}
+	if (ring->fd >= 0) {
+		close(ring->fd);
+	}
+	UDS_FREE(ring->slots);
+	UDS_FREE(ring->free_slots);
+	UDS_FREE(ring);
+}
+
+/**
+ * Map the queues of a new io_ring and find the parts of them it uses.
+ *
+ * @param ring    the ring
+ * @param params  the parameters io_uring_setup() returned
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int map_io_ring(struct io_ring *ring,
+		       const struct io_uring_params *params)
+{
+	bool single_mmap = ((params->features & IORING_FEAT_SINGLE_MMAP) != 0);
+	byte *sq, *cq;
+
+	ring->sq_ring_bytes = (params->sq_off.array +
+			       params->sq_entries * sizeof(unsigned int));
+	ring->cq_ring_bytes = (params->cq_off.cqes +
+			       params->cq_entries *
+				       sizeof(struct io_uring_cqe));
+	if (single_mmap) {
+		ring->sq_ring_bytes = max(ring->sq_ring_bytes,
+					  ring->cq_ring_bytes);
+		ring->cq_ring_bytes = ring->sq_ring_bytes;
+	}
+
+	ring->sq_ring = map_ring(ring, ring->sq_ring_bytes, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == NULL) {
+		return uds_log_error_strerror(errno,
+					      "cannot map io_uring submission ring");
+	}
+
+	if (single_mmap) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = map_ring(ring, ring->cq_ring_bytes,
+					 IORING_OFF_CQ_RING);
+		if (ring->cq_ring == NULL) {
+			return uds_log_error_strerror(errno,
+						      "cannot map io_uring completion ring");
+		}
+	}
+
+	ring->sqes_bytes = params->sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = map_ring(ring, ring->sqes_bytes, IORING_OFF_SQES);
+	if (ring->sqes == NULL) {
+		return uds_log_error_strerror(errno,
+					      "cannot map io_uring entries");
+	}
+
+	sq = ring->sq_ring;
+	ring->sq_tail = (unsigned int *) (sq + params->sq_off.tail);
+	ring->sq_mask = (unsigned int *) (sq + params->sq_off.ring_mask);
+	ring->sq_array = (unsigned int *) (sq + params->sq_off.array);
+
+	cq = ring->cq_ring;
+	ring->cq_head = (unsigned int *) (cq + params->cq_off.head);
+	ring->cq_tail = (unsigned int *) (cq + params->cq_off.tail);
+	ring->cq_mask = (unsigned int *) (cq + params->cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params->cq_off.cqes);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int make_io_ring(unsigned int depth, struct io_ring **ring_ptr)
+{
+	struct io_uring_params params;
+	struct io_ring *ring;
+	unsigned int i;
+	int result;
+
+	*ring_ptr = NULL;
+	result = ASSERT(depth > 0, "io_ring depth must be positive");
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = UDS_ALLOCATE(1, struct io_ring, __func__, &ring);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = setup_io_ring(depth, &params);
+	if (ring->fd < 0) {
+		result = errno;
+		free_io_ring(ring);
+		if ((result == ENOSYS) || (result == EPERM)) {
+			uds_log_debug("io_uring is not available");
+			return UDS_SUCCESS;
+		}
+		return uds_log_error_strerror(result, "io_uring_setup failed");
+	}
+
+	ring->depth = min(depth, params.sq_entries);
+	result = map_io_ring(ring, &params);
+	if (result != UDS_SUCCESS) {
+		free_io_ring(ring);
+		return result;
+	}
+
+	result = UDS_ALLOCATE(ring->depth, struct io_ring_slot,
+			      "io_ring slots", &ring->slots);
+	if (result != UDS_SUCCESS) {
+		free_io_ring(ring);
+		return result;
+	}
+
+	result = UDS_ALLOCATE(ring->depth, unsigned int,
+			      "io_ring free slots", &ring->free_slots);
+	if (result != UDS_SUCCESS) {
+		free_io_ring(ring);
+		return result;
+	}
+
+	for (i = 0; i < ring->depth; i++) {
+		ring->free_slots[ring->free_count++] = i;
+	}
+
+	*ring_ptr = ring;
+	return UDS_SUCCESS;
+}
+
+/**
+ * Put the read in a slot on the submission queue.
+ *
+ * @param ring  the ring
+ * @param fd    the file to read
+ * @param slot  the slot holding the read
+ **/
+static void queue_slot(struct io_ring *ring, int fd, unsigned int slot)
+{
+	unsigned int tail = ACCESS_ONCE(*ring->sq_tail);
+	unsigned int index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t) &ring->slots[slot].iov;
+	sqe->len = 1;
+	sqe->off = ring->slots[slot].offset;
+	sqe->user_data = slot;
+	ring->sq_array[index] = index;
+
+	// The entry must be visible to the kernel before the new tail is.
+	smp_wmb();
+	ACCESS_ONCE(*ring->sq_tail) = tail + 1;
+}
+
+/**
+ * Take back the reads which were queued but not submitted when the kernel
+ * refused a submission, so that they neither hold their slots nor linger on
+ * the submission queue.
+ *
+ * @param ring   the ring
+ * @param reads  the reads of the batch
+ * @param count  the number of reads to take back
+ * @param error  the error to record for them
+ **/
+static void withdraw_slots(struct io_ring *ring,
+			   struct io_ring_read reads[],
+			   unsigned int count,
+			   int error)
+{
+	unsigned int tail = ACCESS_ONCE(*ring->sq_tail);
+	unsigned int i;
+
+	for (i = 1; i <= count; i++) {
+		struct io_uring_sqe *sqe =
+			&ring->sqes[(tail - i) & *ring->sq_mask];
+		unsigned int slot = (unsigned int) sqe->user_data;
+
+		reads[ring->slots[slot].read].result = error;
+		ring->free_slots[ring->free_count++] = slot;
+	}
+
+	// Without SQPOLL, the kernel only reads the queue in io_uring_enter().
+	ACCESS_ONCE(*ring->sq_tail) = tail - count;
+}
+
+/**
+ * Account for a finished read request.
+ *
+ * @param ring    the ring
+ * @param fd      the file being read
+ * @param reads   the reads of the batch
+ * @param cqe     the completion of the request
+ * @param failed  whether the batch has stopped submitting
+ *
+ * @return true if the request was queued again to continue the read
+ **/
+static bool complete_slot(struct io_ring *ring,
+			  int fd,
+			  struct io_ring_read reads[],
+			  const struct io_uring_cqe *cqe,
+			  bool failed)
+{
+	unsigned int slot = (unsigned int) cqe->user_data;
+	struct io_ring_slot *request = &ring->slots[slot];
+	struct io_ring_read *read = &reads[request->read];
+
+	if ((cqe->res == -EINTR) || (cqe->res == -EAGAIN)) {
+		if (!failed) {
+			queue_slot(ring, fd, slot);
+			return true;
+		}
+		read->result = -cqe->res;
+	} else if (cqe->res < 0) {
+		read->result = -cqe->res;
+	} else if (cqe->res == 0) {
+		// The rest of the range is beyond the end of the file.
+		memset(request->iov.iov_base, 0, request->iov.iov_len);
+	} else if ((size_t) cqe->res < request->iov.iov_len) {
+		request->iov.iov_base = ((byte *) request->iov.iov_base +
+					 cqe->res);
+		request->iov.iov_len -= cqe->res;
+		request->offset += cqe->res;
+		if (!failed) {
+			queue_slot(ring, fd, slot);
+			return true;
+		}
+		read->result = UDS_SHORT_READ;
+	}
+
+	ring->free_slots[ring->free_count++] = slot;
+	return false;
+}
+
+/**********************************************************************/
+int read_with_io_ring(struct io_ring *ring,
+		      int fd,
+		      struct io_ring_read reads[],
+		      unsigned int count)
+{
+	unsigned int next = 0, to_submit = 0, in_flight = 0, i;
+	bool failed = false;
+	int result = UDS_SUCCESS;
+
+	for (i = 0; i < count; i++) {
+		reads[i].result = UDS_SUCCESS;
+	}
+
+	while ((!failed && (next < count)) || (in_flight > 0)) {
+		unsigned int head, tail;
+		int submitted;
+
+		while (!failed && (next < count) && (ring->free_count > 0)) {
+			unsigned int slot =
+				ring->free_slots[--ring->free_count];
+
+			ring->slots[slot] = (struct io_ring_slot) {
+				.iov = {
+					.iov_base = reads[next].buffer,
+					.iov_len = reads[next].size,
+				},
+				.offset = reads[next].offset,
+				.read = next,
+			};
+			queue_slot(ring, fd, slot);
+			next++;
+			to_submit++;
+			in_flight++;
+		}
+
+		submitted = enter_io_ring(ring, to_submit);
+		if (submitted < 0) {
+			int error = errno;
+
+			submitted = 0;
+			if (error == EBUSY) {
+				// The completion queue overflowed; only a call
+				// which submits nothing flushes it.
+				(void) enter_io_ring(ring, 0);
+			} else if ((error != EINTR) && (error != EAGAIN)) {
+				// The reads already submitted may still write
+				// into their buffers, so reap them all before
+				// returning.
+				if (!failed) {
+					uds_log_error_strerror(error,
+							       "io_uring_enter failed");
+					failed = true;
+					result = error;
+				}
+				withdraw_slots(ring, reads, to_submit, error);
+				in_flight -= to_submit;
+				to_submit = 0;
+			}
+		}
+		to_submit -= submitted;
+
+		head = *ring->cq_head;
+		tail = ACCESS_ONCE(*ring->cq_tail);
+		// Read the completions only after the tail which covers them.
+		smp_rmb();
+		if ((head == tail) && failed) {
+			// io_uring_enter() is failing, so it can't wait.
+			sched_yield();
+		}
+		for (; head != tail; head++) {
+			if (complete_slot(ring, fd, reads,
+					  &ring->cqes[head & *ring->cq_mask],
+					  failed)) {
+				to_submit++;
+				continue;
+			}
+			in_flight--;
+		}
+
+		// Release the completions only once they have been consumed.
+		smp_mb();
+		ACCESS_ONCE(*ring->cq_head) = head;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (i >= next) {
+			reads[i].result = result;
+		}
+		if ((result == UDS_SUCCESS) &&
+		    (reads[i].result != UDS_SUCCESS)) {
+			result = reads[i].result;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/ioThrottle.c#1 $
+ */
+
+#include "ioThrottle.h"
+
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "uds-threads.h"
+
+enum {
+	/** The most time without writes which is saved up for a burst */
+	THROTTLE_BURST_MS = 100,
+};
+
+struct io_throttle {
+	/** the most bytes to write per second, or 0 for no limit */
+	uint64_t bytes_per_second;
+	/** the nanoseconds each write costs at least */
+	ktime_t write_cost;
+	/** protects the fields below, and times each writer's wait */
+	struct mutex mutex;
+	struct cond_var cond;
+	/** the time from which the next write may be made */
+	ktime_t next_time;
+	/** the total time writers have waited */
+	ktime_t delay;
+};
+
+/**********************************************************************/
+int make_io_throttle(uint64_t bytes_per_second,
+		     unsigned int writes_per_second,
+		     struct io_throttle **throttle_ptr)
+{
+	struct io_throttle *throttle;
+	int result;
+
+	*throttle_ptr = NULL;
+	if ((bytes_per_second == 0) && (writes_per_second == 0)) {
+		return UDS_SUCCESS;
+	}
+
+	result = UDS_ALLOCATE(1, struct io_throttle, __func__, &throttle);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	throttle->bytes_per_second = bytes_per_second;
+	if (writes_per_second > 0) {
+		throttle->write_cost = NSEC_PER_SEC / writes_per_second;
+	}
+
+	result = uds_init_mutex(&throttle->mutex);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(throttle);
+		return result;
+	}
+
+	result = uds_init_cond(&throttle->cond);
+	if (result != UDS_SUCCESS) {
+		uds_destroy_mutex(&throttle->mutex);
+		UDS_FREE(throttle);
+		return result;
+	}
+
+	*throttle_ptr = throttle;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void free_io_throttle(struct io_throttle *throttle)
+{
+	if (throttle == NULL) {
+		return;
+	}
+
+	uds_destroy_cond(&throttle->cond);
+	uds_destroy_mutex(&throttle->mutex);
+	UDS_FREE(throttle);
+}
+
+/**********************************************************************/
+void throttle_io(struct io_throttle *throttle, size_t bytes)
+{
+	ktime_t now, turn, cost = 0;
+
+	if (throttle == NULL) {
+		return;
+	}
+
+	if (throttle->bytes_per_second > 0) {
+		cost = (ktime_t) ((bytes * (uint64_t) NSEC_PER_SEC) /
+				  throttle->bytes_per_second);
+	}
+	cost = max(cost, throttle->write_cost);
+
+	uds_lock_mutex(&throttle->mutex);
+	now = current_time_ns(CLOCK_MONOTONIC);
+	turn = max(throttle->next_time,
+		   ktime_sub(now, ms_to_ktime(THROTTLE_BURST_MS)));
+	throttle->next_time = turn + cost;
+	if (turn > now) {
+		throttle->delay += ktime_sub(turn, now);
+		// Nothing signals the condition; it only times the wait.
+		while (turn > now) {
+			uds_timed_wait_cond(&throttle->cond, &throttle->mutex,
+					    ktime_sub(turn, now));
+			now = current_time_ns(CLOCK_MONOTONIC);
+		}
+	}
+	uds_unlock_mutex(&throttle->mutex);
+}
+
+/**********************************************************************/
+ktime_t get_io_throttle_delay(struct io_throttle *throttle)
+{
+	ktime_t delay;
+
+	if (throttle == NULL) {
+		return 0;
+	}
+
+	uds_lock_mutex(&throttle->mutex);
+	delay = throttle->delay;
+	uds_unlock_mutex(&throttle->mutex);
+	return delay;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/ioThrottle.h#1 $
+ */
+
+#ifndef IO_THROTTLE_H
+#define IO_THROTTLE_H
+
+#include "compiler.h"
+#include "timeUtils.h"
+#include "typeDefs.h"
+
+/**
+ * An io_throttle caps the rate of the writes which pass through it, in
+ * bytes and in writes per second, by making each writer wait for its turn.
+ * A throttle is shared by all the writers of an index's saves, so that the
+ * cap applies to them together. Time in which nothing is written earns a
+ * short burst of writes at full speed.
+ **/
+struct io_throttle;
+
+/**
+ * Make a throttle.
+ *
+ * @param bytes_per_second   the most bytes to write per second, or 0 for
+ *                           no limit
+ * @param writes_per_second  the most writes per second, or 0 for no limit
+ * @param throttle_ptr       a pointer to hold the throttle, which will be
+ *                           set to NULL if neither limit is given
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check make_io_throttle(uint64_t bytes_per_second,
+				  unsigned int writes_per_second,
+				  struct io_throttle **throttle_ptr);
+
+/**
+ * Free a throttle.
+ *
+ * @param throttle  the throttle to free, which may be NULL
+ **/
+void free_io_throttle(struct io_throttle *throttle);
+
+/**
+ * Wait until a write may be made without exceeding the limits of a
+ * throttle, and charge the write against them.
+ *
+ * @param throttle  the throttle, which may be NULL
+ * @param bytes     the size of the write
+ **/
+void throttle_io(struct io_throttle *throttle, size_t bytes);
+
+/**
+ * Get the total time writers have waited on a throttle.
+ *
+ * @param throttle  the throttle, which may be NULL
+ *
+ * @return the time waited, or 0 if there is no throttle
+ **/
+ktime_t get_io_throttle_delay(struct io_throttle *throttle);
+
+#endif /* IO_THROTTLE_H */
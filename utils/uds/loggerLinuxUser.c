@@ -25,13 +25,16 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#include "asyncLogger.h"
 #include "fileUtils.h"
 #include "memoryAlloc.h"
+#include "minisyslog.h"
 #include "stringUtils.h"
 #include "uds-threads.h"
 
 const char TIMESTAMPS_ENVIRONMENT_VARIABLE[] = "UDS_LOG_TIMESTAMPS";
 const char IDS_ENVIRONMENT_VARIABLE[] = "UDS_LOG_IDS";
+const char ASYNC_ENVIRONMENT_VARIABLE[] = "UDS_LOG_ASYNC";
 
 static const char IDENTITY[] = "UDS";
 
@@ -41,9 +44,10 @@ static unsigned int opened = 0;
 static FILE *fp = NULL;
 static bool timestamps = true;
 static bool ids = true;
+static bool async = false;
 
 /**********************************************************************/
-static void init_logger(void)
+static void open_log_destination(void)
 {
 	const char *uds_log_level = getenv("UDS_LOG_LEVEL");
 	if (uds_log_level != NULL) {
@@ -62,6 +66,11 @@ static void init_logger(void)
 		ids = false;
 	}
 
+	char *async_string = getenv(ASYNC_ENVIRONMENT_VARIABLE);
+	if (async_string != NULL && strcmp(async_string, "0") != 0) {
+		async = true;
+	}
+
 	int error = 0;
 	char *log_file = getenv("UDS_LOGFILE");
 	bool is_abs_path = false;
@@ -103,12 +112,6 @@ static void init_logger(void)
 	opened = 1;
 }
 
-/**********************************************************************/
-void open_uds_logger(void)
-{
-	perform_once(&logger_once, init_logger);
-}
-
 /**********************************************************************/
 static void format_current_time(char *buffer, size_t buffer_size)
 {
@@ -138,6 +141,188 @@ static void format_current_time(char *buffer, size_t buffer_size)
 		 (int) ((now % NSEC_PER_SEC) / NSEC_PER_MSEC));
 }
 
+/**
+ * Format a message as it would be written to the log file.
+ *
+ * @param buffer    the buffer in which to format the message
+ * @param size      the size of the buffer
+ * @param priority  the priority at which to log the message
+ * @param prefix    optional string prefix to message, may be NULL
+ * @param fmt1      format of message first part, may be NULL
+ * @param args1     arguments for message first part
+ * @param fmt2      format of message second part, may be NULL
+ * @param args2     arguments for message second part
+ *
+ * @return the length of the message
+ **/
+__printf(5, 0)
+static size_t format_file_message(char *buffer,
+				  size_t size,
+				  int priority,
+				  const char *prefix,
+				  const char *fmt1,
+				  va_list args1,
+				  const char *fmt2,
+				  va_list args2)
+{
+	char *buf_end = buffer + size;
+	char *bufp = buffer;
+	char tname[16];
+	uds_get_thread_name(tname);
+
+	if (timestamps) {
+		char time_buffer[32];
+		format_current_time(time_buffer, sizeof(time_buffer));
+		bufp = uds_append_to_buffer(bufp, buf_end, "%s ",
+					    time_buffer);
+	}
+
+	bufp = uds_append_to_buffer(bufp, buf_end, "%s",
+				    program_invocation_short_name);
+
+	if (ids) {
+		bufp = uds_append_to_buffer(bufp, buf_end, "[%u]", getpid());
+	}
+
+	bufp = uds_append_to_buffer(bufp, buf_end, ": %-6s (%s",
+				    uds_log_priority_to_string(priority),
+				    tname);
+
+	if (ids) {
+		bufp = uds_append_to_buffer(bufp, buf_end, "/%d",
+					    uds_get_thread_id());
+	}
+
+	bufp = uds_append_to_buffer(bufp, buf_end, ") ");
+
+	if (prefix != NULL) {
+		bufp = uds_append_to_buffer(bufp, buf_end, "%s", prefix);
+	}
+	if (fmt1 != NULL) {
+		bufp = uds_v_append_to_buffer(bufp, buf_end, fmt1, args1);
+	}
+	if (fmt2 != NULL) {
+		bufp = uds_v_append_to_buffer(bufp, buf_end, fmt2, args2);
+	}
+	if (bufp == buf_end) {
+		// Truncated; vsnprintf has left the buffer terminated.
+		bufp--;
+	}
+	return bufp - buffer;
+}
+
+/**
+ * Format a message into a record for the logger thread.
+ *
+ * @param record    the record to fill in
+ * @param priority  the priority at which to log the message
+ * @param prefix    optional string prefix to message, may be NULL
+ * @param fmt1      format of message first part, may be NULL
+ * @param args1     arguments for message first part
+ * @param fmt2      format of message second part, may be NULL
+ * @param args2     arguments for message second part
+ *
+ * @return true if the message was formatted
+ **/
+__printf(4, 0)
+static bool format_record(struct async_log_record *record,
+			  int priority,
+			  const char *prefix,
+			  const char *fmt1,
+			  va_list args1,
+			  const char *fmt2,
+			  va_list args2)
+{
+	size_t length;
+	size_t stderr_offset = 0;
+	if (fp == NULL) {
+		length = mini_syslog_format_pack(record->message,
+						 sizeof(record->message),
+						 &stderr_offset, priority,
+						 prefix, fmt1, args1, fmt2,
+						 args2);
+	} else {
+		length = format_file_message(record->message,
+					     sizeof(record->message),
+					     priority, prefix, fmt1, args1,
+					     fmt2, args2);
+	}
+	record->length = length;
+	record->stderr_offset = stderr_offset;
+	return (length > 0);
+}
+
+/**
+ * Write out a formatted message.
+ *
+ * @param record  the record holding the message
+ **/
+static void write_message(const struct async_log_record *record)
+{
+	if (fp == NULL) {
+		mini_syslog_send(record->message, record->length,
+				 record->stderr_offset);
+	} else {
+		flockfile(fp);
+		fwrite(record->message, 1, record->length, fp);
+		fputs("\n", fp);
+		fflush(fp);
+		funlockfile(fp);
+	}
+}
+
+/**********************************************************************/
+__printf(3, 4)
+static void write_notice(struct async_log_record *record,
+			 int priority,
+			 const char *format,
+			 ...)
+{
+	va_list args;
+	va_start(args, format);
+	if (format_record(record, priority, NULL, format, args, NULL, args)) {
+		write_message(record);
+	}
+	va_end(args);
+}
+
+/**
+ * Write out a queued message, followed by a notice of how many messages
+ * have been dropped since the last notice, if any have been. This is only
+ * called from the logger thread.
+ *
+ * Implements async_log_writer_t.
+ **/
+static void write_record(const struct async_log_record *record)
+{
+	static uint64_t reported = 0;
+	write_message(record);
+
+	uint64_t drops = get_async_log_drops();
+	if (drops != reported) {
+		struct async_log_record notice;
+		write_notice(&notice, UDS_LOG_WARNING,
+			     "%llu log messages dropped",
+			     (unsigned long long) (drops - reported));
+		reported = drops;
+	}
+}
+
+/**********************************************************************/
+static void init_logger(void)
+{
+	open_log_destination();
+	if (async && (start_async_logger(write_record) != UDS_SUCCESS)) {
+		async = false;
+	}
+}
+
+/**********************************************************************/
+void open_uds_logger(void)
+{
+	perform_once(&logger_once, init_logger);
+}
+
 /**********************************************************************/
 void uds_log_message_pack(int priority,
 			  const char *module __always_unused,
@@ -156,6 +341,24 @@ void uds_log_message_pack(int priority,
 	// state than about errors in the logging code.
 	int error = errno;
 
+	if (async && is_async_logger_running()) {
+		if (priority > UDS_LOG_CRIT) {
+			struct async_log_record *record =
+				reserve_async_log_record();
+			if ((record != NULL) &&
+			    format_record(record, priority, prefix, fmt1,
+					  args1, fmt2, args2)) {
+				commit_async_log_record(record);
+			}
+			errno = error;
+			return;
+		}
+
+		// Write critical messages before returning, but after the
+		// messages queued before them.
+		flush_async_logger();
+	}
+
 	if (fp == NULL) {
 		mini_syslog_pack(priority, prefix, fmt1, args1, fmt2, args2);
 	} else {
@@ -264,6 +467,8 @@ void uds_log_backtrace(int priority)
 /**********************************************************************/
 void uds_pause_for_logger(void)
 {
-	// User-space logger can't be overrun, so this is a no-op.
+	// The synchronous user-space logger can't be overrun, but give the
+	// logger thread a chance to catch up when logging asynchronously.
+	flush_async_logger();
 }
 
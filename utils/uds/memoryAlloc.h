@@ -26,6 +26,7 @@
 #include "cpu.h"
 #include "permassert.h"
 #include "typeDefs.h"
+#include "uds.h"
 
 #include <stdarg.h>
 
@@ -45,6 +46,27 @@ int __must_check uds_allocate_memory(size_t size,
 				     const char *what,
 				     void *ptr);
 
+/**
+ * Allocate storage which will be kept on a NUMA node, logging an error if the
+ * allocation fails. The memory will be zeroed. An allocation of at least a
+ * page is given whole pages of its own, and the placement is set before the
+ * memory is first touched, so no page needs to be moved later. A smaller
+ * allocation is placed wherever the allocator puts it.
+ *
+ * @param size   The size of an object
+ * @param align  The required alignment
+ * @param node   The NUMA node, or -1 to allocate as uds_allocate_memory()
+ * @param what   What is being allocated (for error logging)
+ * @param ptr    A pointer to hold the allocated memory
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check uds_allocate_memory_on_node(size_t size,
+					     size_t align,
+					     int node,
+					     const char *what,
+					     void *ptr);
+
 /**
  * Free storage
  *
@@ -52,6 +74,51 @@ int __must_check uds_allocate_memory(size_t size,
  **/
 void uds_free_memory(void *ptr);
 
+/**
+ * Set the subsystem charged with the memory the current thread allocates
+ * from now on. Memory is uncharged from the subsystem it was charged to when
+ * it is freed, whichever thread frees it.
+ *
+ * @param tag  The subsystem to charge
+ *
+ * @return The subsystem which was being charged, to be restored when done
+ **/
+enum uds_memory_tag uds_set_memory_tag(enum uds_memory_tag tag);
+
+/**
+ * Get the current and peak memory allocated in this process, in total and
+ * for each subsystem.
+ *
+ * @param stats  The statistics structure to fill
+ **/
+void get_uds_memory_stats(struct uds_memory_stats *stats);
+
+/**
+ * Allocate a large region of zeroed memory backed by huge pages. If no huge
+ * pages of the requested size are available, ordinary pages are used and the
+ * kernel is advised to back them with transparent huge pages instead.
+ *
+ * @param size            The number of bytes to allocate
+ * @param huge_page_size  The size of a huge page, 2 MB or 1 GB
+ * @param what            What is being allocated (for error logging)
+ * @param ptr             A pointer to hold the allocated memory
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check uds_allocate_huge_memory(size_t size,
+					  size_t huge_page_size,
+					  const char *what,
+					  void *ptr);
+
+/**
+ * Free storage allocated with uds_allocate_huge_memory().
+ *
+ * @param ptr             The memory to be freed
+ * @param size            The size it was allocated with
+ * @param huge_page_size  The huge page size it was allocated with
+ **/
+void uds_free_huge_memory(void *ptr, size_t size, size_t huge_page_size);
+
 /**
  * Null out a reference and return a copy of the referenced object.
  *
@@ -188,6 +255,13 @@ int __must_check uds_reallocate_memory(void *ptr,
 		_result;                                                 \
 	})
 
+/*
+ * The alignment of buffers used for I/O. Direct I/O requires buffers aligned
+ * to the logical block size of the device, and 4K covers every device with a
+ * block size no larger than the UDS block size.
+ */
+enum { UDS_IO_ALIGNMENT = 4096 };
+
 /**
  * Allocate one or more elements of the indicated type, aligning them
  * on the boundary that will allow them to be used in I/O, logging an
@@ -201,7 +275,7 @@ int __must_check uds_reallocate_memory(void *ptr,
  * @return UDS_SUCCESS or an error code
  **/
 #define UDS_ALLOCATE_IO_ALIGNED(COUNT, TYPE, WHAT, PTR) \
-	UDS_ALLOCATE(COUNT, TYPE, WHAT, PTR)
+	uds_do_allocation(COUNT, sizeof(TYPE), 0, UDS_IO_ALIGNMENT, WHAT, PTR)
 
 /**
  * Free memory allocated with UDS_ALLOCATE().
@@ -230,6 +304,27 @@ static INLINE int __must_check uds_allocate_cache_aligned(size_t size,
 	return uds_allocate_memory(size, CACHE_LINE_BYTES, what, ptr);
 }
 
+/**
+ * Allocate memory starting on a cache line boundary and kept on a NUMA node,
+ * logging an error if the allocation fails. The memory will be zeroed.
+ *
+ * @param size  The number of bytes to allocate
+ * @param node  The NUMA node, or -1 for no particular node
+ * @param what  What is being allocated (for error logging)
+ * @param ptr   A pointer to hold the allocated memory
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static INLINE int __must_check
+uds_allocate_cache_aligned_on_node(size_t size,
+				   int node,
+				   const char *what,
+				   void *ptr)
+{
+	return uds_allocate_memory_on_node(size, CACHE_LINE_BYTES, node, what,
+					   ptr);
+}
+
 
 /**
  * Duplicate a string.
@@ -20,10 +20,267 @@
  */
 
 #include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include "atomicDefs.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
 #include "stringUtils.h"
+#include "threadAffinity.h"
+#include "threadOnce.h"
+#include "uds-threads.h"
+
+/*
+ * Every allocation is recorded in a registry so that its size and tag are
+ * known when it is freed. The registry is a set of open-addressed hash
+ * tables, one per shard, each covered by its own mutex, so that threads
+ * allocating at the same time rarely wait for one another. The tables are
+ * allocated with calloc() directly, and an allocation which cannot be
+ * recorded is simply not counted.
+ */
+enum {
+	MEMORY_REGISTRY_SHARD_BITS = 4,
+	MEMORY_REGISTRY_SHARDS = 1 << MEMORY_REGISTRY_SHARD_BITS,
+	MEMORY_REGISTRY_INITIAL_SLOTS = 1024,
+};
+
+struct memory_record {
+	void *ptr;
+	size_t size;
+	enum uds_memory_tag tag;
+};
+
+struct __attribute__((aligned(CACHE_LINE_BYTES))) memory_registry_shard {
+	struct mutex mutex;
+	size_t slot_count;
+	size_t record_count;
+	struct memory_record *records;
+};
+
+struct __attribute__((aligned(CACHE_LINE_BYTES))) memory_tag_counters {
+	atomic64_t bytes_used;
+	atomic64_t peak_bytes_used;
+	atomic64_t allocations;
+};
+
+static once_state_t registry_once = ONCE_STATE_INITIALIZER;
+static struct memory_registry_shard registry[MEMORY_REGISTRY_SHARDS];
+static struct memory_tag_counters tag_counters[UDS_MEMORY_TAG_COUNT];
+static struct memory_tag_counters total_counters;
+
+// The subsystem charged for the allocations of each thread
+static __thread enum uds_memory_tag thread_memory_tag;
+
+/**********************************************************************/
+static void initialize_memory_registry(void)
+{
+	unsigned int i;
+	for (i = 0; i < MEMORY_REGISTRY_SHARDS; i++) {
+		pthread_mutex_init(&registry[i].mutex.mutex, NULL);
+	}
+}
+
+/**
+ * Hash a pointer. Multiplying by an odd 64-bit constant moves the variation
+ * in the address bits up into the high bits, even for page-aligned memory.
+ **/
+static INLINE uint64_t hash_pointer(const void *ptr)
+{
+	return ((uintptr_t) ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+/**
+ * Find the slot of a pointer in a shard's table, or the empty slot where it
+ * belongs.
+ **/
+static struct memory_record *
+find_memory_record(struct memory_record *records,
+		   size_t slot_count,
+		   const void *ptr)
+{
+	size_t slot = (hash_pointer(ptr) >> 32) & (slot_count - 1);
+	while ((records[slot].ptr != NULL) && (records[slot].ptr != ptr)) {
+		slot = (slot + 1) & (slot_count - 1);
+	}
+	return &records[slot];
+}
+
+/**
+ * Double the size of a shard's table, or allocate its first one.
+ *
+ * @return true if the table has room for another record
+ **/
+static bool grow_memory_registry_shard(struct memory_registry_shard *shard)
+{
+	size_t slot_count = ((shard->slot_count == 0) ?
+			     MEMORY_REGISTRY_INITIAL_SLOTS :
+			     2 * shard->slot_count);
+	struct memory_record *records =
+		calloc(slot_count, sizeof(struct memory_record));
+	size_t i;
+	if (records == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < shard->slot_count; i++) {
+		if (shard->records[i].ptr != NULL) {
+			*find_memory_record(records, slot_count,
+					    shard->records[i].ptr) =
+				shard->records[i];
+		}
+	}
+	free(shard->records);
+	shard->records = records;
+	shard->slot_count = slot_count;
+	return true;
+}
+
+/**********************************************************************/
+static struct memory_registry_shard *get_registry_shard(const void *ptr)
+{
+	perform_once(&registry_once, initialize_memory_registry);
+	// The top bits of the hash pick the shard, and the bits below them
+	// the slot.
+	return &registry[hash_pointer(ptr) >> (64 - MEMORY_REGISTRY_SHARD_BITS)];
+}
+
+/**
+ * Add bytes to a set of counters, raising the peak if it is passed.
+ **/
+static void add_memory(struct memory_tag_counters *counters, size_t size)
+{
+	long used = atomic64_add_return(size, &counters->bytes_used);
+	long peak = atomic64_read(&counters->peak_bytes_used);
+	while (used > peak) {
+		long seen = atomic64_cmpxchg(&counters->peak_bytes_used, peak,
+					     used);
+		if (seen == peak) {
+			break;
+		}
+		peak = seen;
+	}
+	atomic64_inc(&counters->allocations);
+}
+
+/**
+ * Record a new allocation.
+ **/
+static void record_allocation(void *ptr, size_t size, enum uds_memory_tag tag)
+{
+	struct memory_registry_shard *shard;
+	struct memory_record *record;
+	if (ptr == NULL) {
+		return;
+	}
+
+	shard = get_registry_shard(ptr);
+	uds_lock_mutex(&shard->mutex);
+	if ((2 * (shard->record_count + 1) > shard->slot_count) &&
+	    !grow_memory_registry_shard(shard)) {
+		uds_unlock_mutex(&shard->mutex);
+		return;
+	}
+	record = find_memory_record(shard->records, shard->slot_count, ptr);
+	*record = (struct memory_record) {
+		.ptr = ptr,
+		.size = size,
+		.tag = tag,
+	};
+	shard->record_count++;
+	uds_unlock_mutex(&shard->mutex);
+
+	add_memory(&tag_counters[tag], size);
+	add_memory(&total_counters, size);
+}
+
+/**
+ * Forget an allocation which is about to be freed, and uncharge its tag.
+ * This must be done before the memory is released, since once it is, the
+ * same address may be allocated and recorded by another thread.
+ *
+ * @param ptr      The allocation
+ * @param freed    A record to hold what was forgotten
+ *
+ * @return true if the allocation had been recorded
+ **/
+static bool forget_allocation(void *ptr, struct memory_record *freed)
+{
+	struct memory_registry_shard *shard;
+	struct memory_record *record, *hole;
+	size_t mask;
+	if (ptr == NULL) {
+		return false;
+	}
+
+	shard = get_registry_shard(ptr);
+	uds_lock_mutex(&shard->mutex);
+	if (shard->records == NULL) {
+		uds_unlock_mutex(&shard->mutex);
+		return false;
+	}
+	record = find_memory_record(shard->records, shard->slot_count, ptr);
+	if (record->ptr == NULL) {
+		uds_unlock_mutex(&shard->mutex);
+		return false;
+	}
+	*freed = *record;
+
+	// Close the hole so that every record stays reachable from its home
+	// slot by linear probing.
+	mask = shard->slot_count - 1;
+	hole = record;
+	for (;;) {
+		size_t home;
+		record = &shard->records[((record - shard->records) + 1) & mask];
+		if (record->ptr == NULL) {
+			break;
+		}
+		home = (hash_pointer(record->ptr) >> 32) & mask;
+		if (((record - shard->records - home) & mask) >=
+		    ((size_t) (record - hole) & mask)) {
+			*hole = *record;
+			hole = record;
+		}
+	}
+	hole->ptr = NULL;
+	shard->record_count--;
+	uds_unlock_mutex(&shard->mutex);
+
+	atomic64_add(-(long) freed->size, &tag_counters[freed->tag].bytes_used);
+	atomic64_add(-(long) freed->size, &total_counters.bytes_used);
+	return true;
+}
+
+/**********************************************************************/
+enum uds_memory_tag uds_set_memory_tag(enum uds_memory_tag tag)
+{
+	enum uds_memory_tag previous = thread_memory_tag;
+	thread_memory_tag = tag;
+	return previous;
+}
+
+/**
+ * Copy a set of counters into a statistics structure.
+ **/
+static void get_counters(const struct memory_tag_counters *counters,
+			 struct uds_memory_tag_stats *stats)
+{
+	stats->bytes_used = atomic64_read(&counters->bytes_used);
+	stats->peak_bytes_used = atomic64_read(&counters->peak_bytes_used);
+	stats->allocations = atomic64_read(&counters->allocations);
+}
+
+/**********************************************************************/
+void get_uds_memory_stats(struct uds_memory_stats *stats)
+{
+	unsigned int tag;
+	get_counters(&total_counters, &stats->total);
+	for (tag = 0; tag < UDS_MEMORY_TAG_COUNT; tag++) {
+		get_counters(&tag_counters[tag], &stats->tags[tag]);
+	}
+}
 
 /**********************************************************************/
 int uds_allocate_memory(size_t size, size_t align, const char *what, void *ptr)
@@ -63,6 +320,45 @@ int uds_allocate_memory(size_t size, size_t align, const char *what, void *ptr)
 		}
 	}
 	memset(p, 0, size);
+	record_allocation(p, size, thread_memory_tag);
+	*((void **) ptr) = p;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_allocate_memory_on_node(size_t size,
+				size_t align,
+				int node,
+				const char *what,
+				void *ptr)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	if ((node < 0) || (size < page_size)) {
+		return uds_allocate_memory(size, align, what, ptr);
+	}
+	if (ptr == NULL) {
+		return UDS_INVALID_ARGUMENT;
+	}
+
+	// Own whole pages so that the placement covers all of the memory and
+	// no other allocation shares it.
+	size_t rounded_size = (size + page_size - 1) / page_size * page_size;
+	void *p;
+	int result = posix_memalign(&p, max(align, page_size), rounded_size);
+	if (result != 0) {
+		if (what != NULL) {
+			uds_log_error_strerror(result,
+					       "failed to posix_memalign %s (%zu bytes)",
+					       what,
+					       size);
+		}
+		return -result;
+	}
+
+	// Zeroing is the first touch, so the pages are faulted in on the node.
+	bind_memory_to_node(p, rounded_size, node);
+	memset(p, 0, size);
+	record_allocation(p, size, thread_memory_tag);
 	*((void **) ptr) = p;
 	return UDS_SUCCESS;
 }
@@ -70,9 +366,78 @@ int uds_allocate_memory(size_t size, size_t align, const char *what, void *ptr)
 /**********************************************************************/
 void uds_free_memory(void *ptr)
 {
+	struct memory_record freed;
+	forget_allocation(ptr, &freed);
 	free(ptr);
 }
 
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+/**********************************************************************/
+int uds_allocate_huge_memory(size_t size,
+			     size_t huge_page_size,
+			     const char *what,
+			     void *ptr)
+{
+	if ((ptr == NULL) || (huge_page_size == 0) ||
+	    ((huge_page_size & (huge_page_size - 1)) != 0)) {
+		return UDS_INVALID_ARGUMENT;
+	}
+	if (size == 0) {
+		*((void **) ptr) = NULL;
+		return UDS_SUCCESS;
+	}
+
+	// Huge page mappings must be a whole number of huge pages.
+	size = (size + huge_page_size - 1) & ~(huge_page_size - 1);
+	int page_shift = __builtin_ctzl(huge_page_size);
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+			(page_shift << MAP_HUGE_SHIFT)),
+		       -1, 0);
+	if (p != MAP_FAILED) {
+		uds_log_debug("allocated %s (%zu bytes) with %zu byte pages",
+			      what, size, huge_page_size);
+		record_allocation(p, size, thread_memory_tag);
+		*((void **) ptr) = p;
+		return UDS_SUCCESS;
+	}
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		int result = errno;
+		if (what != NULL) {
+			uds_log_error_strerror(result,
+					       "failed to map %s (%zu bytes)",
+					       what,
+					       size);
+		}
+		return -result;
+	}
+	if (madvise(p, size, MADV_HUGEPAGE) != 0) {
+		uds_log_debug("cannot use transparent huge pages for %s: %s",
+			      what, strerror(errno));
+	}
+	record_allocation(p, size, thread_memory_tag);
+	*((void **) ptr) = p;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void uds_free_huge_memory(void *ptr, size_t size, size_t huge_page_size)
+{
+	if (ptr == NULL) {
+		return;
+	}
+	struct memory_record freed;
+	size = (size + huge_page_size - 1) & ~(huge_page_size - 1);
+	forget_allocation(ptr, &freed);
+	munmap(ptr, size);
+}
+
 /**********************************************************************/
 int uds_reallocate_memory(void *ptr,
 			  size_t old_size,
@@ -80,9 +445,16 @@ int uds_reallocate_memory(void *ptr,
 			  const char *what,
 			  void *new_ptr)
 {
+	// The reallocated memory stays charged to the tag of the original.
+	struct memory_record old = { .tag = thread_memory_tag };
+	bool recorded = forget_allocation(ptr, &old);
 	char *new = realloc(ptr, size);
 	if ((new == NULL) && (size != 0)) {
-		return uds_log_error_strerror(-errno,
+		int result = -errno;
+		if (recorded) {
+			record_allocation(ptr, old.size, old.tag);
+		}
+		return uds_log_error_strerror(result,
 					      "failed to reallocate %s (%zu bytes)",
 					      what,
 					      size);
@@ -92,6 +464,7 @@ int uds_reallocate_memory(void *ptr,
           memset(new + old_size, 0, size - old_size);
         }
 
+	record_allocation(new, size, old.tag);
 	*((void **) new_ptr) = new;
 	return UDS_SUCCESS;
 }
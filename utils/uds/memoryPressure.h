@@ -0,0 +1,73 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/memoryPressure.h#1 $
+ */
+
+#ifndef MEMORY_PRESSURE_H
+#define MEMORY_PRESSURE_H
+
+#include "compiler.h"
+#include "typeDefs.h"
+#include "uds.h"
+#include "volume.h"
+
+/**
+ * A memory_pressure_monitor is a thread which watches the memory pressure
+ * of the cgroup the process runs in, and shrinks the page cache and the
+ * sparse cache of a volume while memory is short, growing them back once it
+ * is not. The caches are kept between a minimum number of chapters and
+ * their size when the monitor was made.
+ **/
+struct memory_pressure_monitor;
+
+/**
+ * Make a memory pressure monitor for a volume. If the kernel does not
+ * report memory pressure, no monitor is made and the caches keep their size.
+ *
+ * @param volume        the volume whose caches are resized
+ * @param min_chapters  the fewest chapters to shrink the caches to
+ * @param monitor_ptr   a pointer to hold the monitor, which will be set to
+ *                      NULL if no monitor was made
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check
+make_memory_pressure_monitor(struct volume *volume,
+			     unsigned int min_chapters,
+			     struct memory_pressure_monitor **monitor_ptr);
+
+/**
+ * Stop a memory pressure monitor and free it. The caches keep whatever
+ * size the monitor last gave them.
+ *
+ * @param monitor  the monitor to free, which may be NULL
+ **/
+void free_memory_pressure_monitor(struct memory_pressure_monitor *monitor);
+
+/**
+ * Get the statistics of a memory pressure monitor.
+ *
+ * @param monitor  the monitor, which may be NULL
+ * @param stats    the statistics to fill in, which are zeroed if there is
+ *                 no monitor
+ **/
+void get_memory_pressure_stats(struct memory_pressure_monitor *monitor,
+			       struct uds_memory_pressure_stats *stats);
+
+#endif /* MEMORY_PRESSURE_H */
@@ -0,0 +1,449 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/userLinux/uds/memoryPressureLinuxUser.c#1 $
+ */
+
+#include "memoryPressure.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "sparseCache.h"
+#include "timeUtils.h"
+#include "uds-threads.h"
+
+static const char CGROUP_DIRECTORY[] = "/sys/fs/cgroup";
+static const char SYSTEM_PRESSURE_FILE[] = "/proc/pressure/memory";
+
+enum {
+	/** The time between samples of the memory pressure */
+	SAMPLE_INTERVAL_MS = 1000,
+	/** The stall share, in hundredths of a percent, to shrink at */
+	SHRINK_PRESSURE = 1000,
+	/** The stall share below which the caches may grow */
+	GROW_PRESSURE = 100,
+	/** The percentage of memory.high to shrink at */
+	SHRINK_HIGH_USAGE = 95,
+	/** The percentage of memory.high below which the caches may grow */
+	GROW_HIGH_USAGE = 85,
+	/**
+	 * The samples to wait after shrinking before shrinking again for
+	 * stalls, since the ten second average is slow to fall
+	 */
+	SHRINK_HOLDOFF_SAMPLES = 5,
+	/** The consecutive calm samples needed before each growth step */
+	GROW_CALM_SAMPLES = 10,
+	/** The number of steps in which the caches grow from min to max */
+	GROW_STEPS = 8,
+};
+
+struct memory_pressure_monitor {
+	/** the volume whose caches are resized */
+	struct volume *volume;
+	/** the PSI file to sample, or empty if there is none */
+	char pressure_path[1280];
+	/** the cgroup directory with the tightest memory.high, or empty */
+	char high_directory[1280];
+	/** the fewest chapters the caches may shrink to */
+	unsigned int min_chapters;
+	/** the most chapters the caches may grow back to */
+	unsigned int max_chapters;
+	/** the samples to skip before shrinking for stalls again */
+	unsigned int holdoff;
+	/** the consecutive samples without pressure */
+	unsigned int calm_samples;
+	/** the thread which samples the pressure */
+	struct thread *thread;
+	/** protects the fields below */
+	struct mutex mutex;
+	/** signaled to stop the thread */
+	struct cond_var cond;
+	/** whether the thread should exit */
+	bool exiting;
+	/** the statistics reported by get_memory_pressure_stats() */
+	struct uds_memory_pressure_stats stats;
+};
+
+/**
+ * Read a cgroup memory limit or usage file holding a byte count or "max".
+ *
+ * @param directory  the cgroup directory
+ * @param name       the name of the file
+ *
+ * @return the byte count, or 0 if the file is missing or reads "max"
+ **/
+static unsigned long long read_cgroup_bytes(const char *directory,
+					    const char *name)
+{
+	char path[1536];
+	unsigned long long bytes = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return 0;
+	}
+	if (fscanf(file, "%llu", &bytes) != 1) {
+		bytes = 0;
+	}
+	fclose(file);
+	return bytes;
+}
+
+/**
+ * Read the ten second average of the share of time in which some task was
+ * stalled waiting for memory, from a PSI file whose first line reads
+ * "some avg10=1.23 avg60=...".
+ *
+ * @param path      the PSI file
+ * @param pressure  set to the average, in hundredths of a percent
+ *
+ * @return true if the file could be read
+ **/
+static bool read_pressure(const char *path, unsigned int *pressure)
+{
+	unsigned int whole;
+	unsigned int hundredths;
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+
+	int count = fscanf(file, "some avg10=%u.%u", &whole, &hundredths);
+	fclose(file);
+	if (count != 2) {
+		return false;
+	}
+	*pressure = (whole * 100) + hundredths;
+	return true;
+}
+
+/**
+ * Find the PSI file and the memory.high limit which apply to this process.
+ * The pressure of the process's own cgroup is preferred, falling back to
+ * the pressure of the whole system. Since a memory.high on any ancestor
+ * cgroup also throttles this one, the tightest of them is used.
+ *
+ * @param monitor  the monitor to fill in
+ **/
+static void find_pressure_files(struct memory_pressure_monitor *monitor)
+{
+	unsigned int pressure;
+	FILE *file = fopen("/proc/self/cgroup", "r");
+	char line[1024];
+	char cgroup[1024] = "";
+
+	if (file != NULL) {
+		// Only cgroup v2, with an entry of "0::/path", reports
+		// memory.pressure.
+		while (fgets(line, sizeof(line), file) != NULL) {
+			if (strncmp(line, "0::", 3) == 0) {
+				line[strcspn(line, "\n")] = '\0';
+				snprintf(cgroup, sizeof(cgroup), "%s",
+					 line + 3);
+			}
+		}
+		fclose(file);
+	}
+
+	if (cgroup[0] == '/') {
+		char directory[1280];
+		unsigned long long limit = 0;
+
+		snprintf(monitor->pressure_path,
+			 sizeof(monitor->pressure_path),
+			 "%s%s/memory.pressure", CGROUP_DIRECTORY,
+			 ((strcmp(cgroup, "/") == 0) ? "" : cgroup));
+		while (true) {
+			snprintf(directory, sizeof(directory), "%s%s",
+				 CGROUP_DIRECTORY, cgroup);
+			unsigned long long high =
+				read_cgroup_bytes(directory, "memory.high");
+			if ((high > 0) && ((limit == 0) || (high < limit))) {
+				limit = high;
+				snprintf(monitor->high_directory,
+					 sizeof(monitor->high_directory),
+					 "%s", directory);
+			}
+
+			// The root cgroup has no memory.high.
+			char *slash = strrchr(cgroup, '/');
+			if (slash == NULL) {
+				break;
+			}
+			*slash = '\0';
+			if (cgroup[0] == '\0') {
+				break;
+			}
+		}
+	}
+
+	if ((monitor->pressure_path[0] == '\0') ||
+	    !read_pressure(monitor->pressure_path, &pressure)) {
+		snprintf(monitor->pressure_path,
+			 sizeof(monitor->pressure_path),
+			 "%s", SYSTEM_PRESSURE_FILE);
+		if (!read_pressure(monitor->pressure_path, &pressure)) {
+			monitor->pressure_path[0] = '\0';
+		}
+	}
+}
+
+/**
+ * Resize the page cache and the sparse cache of the monitored volume.
+ *
+ * @param monitor   the monitor
+ * @param chapters  the number of chapters to size the caches for
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int resize_caches(struct memory_pressure_monitor *monitor,
+			 unsigned int chapters)
+{
+	struct volume *volume = monitor->volume;
+	int result = resize_volume_cache(volume, chapters);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	if (volume->sparse_cache != NULL) {
+		resize_sparse_cache(volume->sparse_cache, chapters);
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Take one sample of the memory pressure, and shrink or grow the caches if
+ * it calls for it.
+ *
+ * @param monitor  the monitor
+ **/
+static void sample_memory_pressure(struct memory_pressure_monitor *monitor)
+{
+	unsigned int pressure = 0;
+	unsigned int high_usage = 0;
+	unsigned int chapters;
+	unsigned int target;
+	bool stalled;
+
+	if (monitor->pressure_path[0] != '\0') {
+		read_pressure(monitor->pressure_path, &pressure);
+	}
+	if (monitor->high_directory[0] != '\0') {
+		unsigned long long high =
+			read_cgroup_bytes(monitor->high_directory,
+					  "memory.high");
+		unsigned long long current =
+			read_cgroup_bytes(monitor->high_directory,
+					  "memory.current");
+		if (high > 0) {
+			high_usage = (current * 100) / high;
+		}
+	}
+
+	uds_lock_mutex(&monitor->mutex);
+	monitor->stats.pressure = pressure;
+	monitor->stats.high_usage = high_usage;
+	chapters = monitor->stats.cache_chapters;
+	uds_unlock_mutex(&monitor->mutex);
+
+	target = chapters;
+	stalled = ((pressure >= SHRINK_PRESSURE) && (monitor->holdoff == 0));
+	if (monitor->holdoff > 0) {
+		monitor->holdoff--;
+	}
+
+	if (stalled || (high_usage >= SHRINK_HIGH_USAGE)) {
+		monitor->calm_samples = 0;
+		target = (monitor->min_chapters +
+			  (chapters - monitor->min_chapters) / 2);
+	} else if ((pressure < GROW_PRESSURE) &&
+		   (high_usage < GROW_HIGH_USAGE)) {
+		if (++monitor->calm_samples >= GROW_CALM_SAMPLES) {
+			unsigned int step = max(1U,
+						(monitor->max_chapters -
+						 monitor->min_chapters) /
+						GROW_STEPS);
+			monitor->calm_samples = 0;
+			target = min(monitor->max_chapters, chapters + step);
+		}
+	} else {
+		monitor->calm_samples = 0;
+	}
+
+	if (target == chapters) {
+		return;
+	}
+
+	uds_log_info("memory pressure %u.%02u%%, %u%% of memory.high: %s caches from %u to %u chapters",
+		     pressure / 100,
+		     pressure % 100,
+		     high_usage,
+		     ((target < chapters) ? "shrinking" : "growing"),
+		     chapters,
+		     target);
+	int result = resize_caches(monitor, target);
+	if (result != UDS_SUCCESS) {
+		uds_log_warning_strerror(result,
+					 "failed to resize caches to %u chapters",
+					 target);
+		return;
+	}
+
+	uds_lock_mutex(&monitor->mutex);
+	monitor->stats.cache_chapters = target;
+	if (target < chapters) {
+		monitor->stats.shrinks++;
+		monitor->holdoff = SHRINK_HOLDOFF_SAMPLES;
+	} else {
+		monitor->stats.grows++;
+	}
+	uds_unlock_mutex(&monitor->mutex);
+}
+
+/**********************************************************************/
+static void memory_pressure_thread(void *arg)
+{
+	struct memory_pressure_monitor *monitor = arg;
+
+	uds_lock_mutex(&monitor->mutex);
+	while (!monitor->exiting) {
+		uds_timed_wait_cond(&monitor->cond,
+				    &monitor->mutex,
+				    ms_to_ktime(SAMPLE_INTERVAL_MS));
+		if (monitor->exiting) {
+			break;
+		}
+		uds_unlock_mutex(&monitor->mutex);
+		sample_memory_pressure(monitor);
+		uds_lock_mutex(&monitor->mutex);
+	}
+	uds_unlock_mutex(&monitor->mutex);
+}
+
+/**********************************************************************/
+int make_memory_pressure_monitor(struct volume *volume,
+				 unsigned int min_chapters,
+				 struct memory_pressure_monitor **monitor_ptr)
+{
+	struct memory_pressure_monitor *monitor;
+	unsigned int chapters = (volume->page_cache->live_cache_entries /
+				 volume->geometry->record_pages_per_chapter);
+	int result;
+
+	*monitor_ptr = NULL;
+	if (min_chapters >= chapters) {
+		uds_log_info("not watching memory pressure: minimum of %u chapters is not below the cache size of %u chapters",
+			     min_chapters,
+			     chapters);
+		return UDS_SUCCESS;
+	}
+
+	result = UDS_ALLOCATE(1, struct memory_pressure_monitor, __func__,
+			      &monitor);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	find_pressure_files(monitor);
+	if ((monitor->pressure_path[0] == '\0') &&
+	    (monitor->high_directory[0] == '\0')) {
+		uds_log_info("not watching memory pressure: neither memory.pressure nor memory.high is available");
+		UDS_FREE(monitor);
+		return UDS_SUCCESS;
+	}
+
+	monitor->volume = volume;
+	monitor->min_chapters = min_chapters;
+	monitor->max_chapters = chapters;
+	monitor->stats = (struct uds_memory_pressure_stats) {
+		.cache_chapters = chapters,
+		.min_cache_chapters = min_chapters,
+		.max_cache_chapters = chapters,
+	};
+
+	result = uds_init_mutex(&monitor->mutex);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(monitor);
+		return result;
+	}
+
+	result = uds_init_cond(&monitor->cond);
+	if (result != UDS_SUCCESS) {
+		uds_destroy_mutex(&monitor->mutex);
+		UDS_FREE(monitor);
+		return result;
+	}
+
+	result = uds_create_thread(memory_pressure_thread, monitor,
+				   "memorypressure", &monitor->thread);
+	if (result != UDS_SUCCESS) {
+		uds_destroy_cond(&monitor->cond);
+		uds_destroy_mutex(&monitor->mutex);
+		UDS_FREE(monitor);
+		return result;
+	}
+
+	uds_log_info("watching %s%s%s to keep the caches between %u and %u chapters",
+		     ((monitor->pressure_path[0] != '\0') ?
+		      monitor->pressure_path : ""),
+		     (((monitor->pressure_path[0] != '\0') &&
+		       (monitor->high_directory[0] != '\0')) ?
+		      " and memory.high of " : ""),
+		     monitor->high_directory,
+		     min_chapters,
+		     chapters);
+	*monitor_ptr = monitor;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void free_memory_pressure_monitor(struct memory_pressure_monitor *monitor)
+{
+	if (monitor == NULL) {
+		return;
+	}
+
+	uds_lock_mutex(&monitor->mutex);
+	monitor->exiting = true;
+	uds_broadcast_cond(&monitor->cond);
+	uds_unlock_mutex(&monitor->mutex);
+	uds_join_threads(monitor->thread);
+
+	uds_destroy_cond(&monitor->cond);
+	uds_destroy_mutex(&monitor->mutex);
+	UDS_FREE(monitor);
+}
+
+/**********************************************************************/
+void get_memory_pressure_stats(struct memory_pressure_monitor *monitor,
+			       struct uds_memory_pressure_stats *stats)
+{
+	if (monitor == NULL) {
+		*stats = (struct uds_memory_pressure_stats) { 0 };
+		return;
+	}
+
+	uds_lock_mutex(&monitor->mutex);
+	*stats = monitor->stats;
+	uds_unlock_mutex(&monitor->mutex);
+}
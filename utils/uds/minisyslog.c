@@ -119,17 +119,19 @@ static bool __must_check write_msg(int fd, const char *msg)
 }
 
 /**********************************************************************/
-__printf(3, 0)
-static void log_it(int priority,
-		   const char *prefix,
-		   const char *format1,
-		   va_list args1,
-		   const char *format2,
-		   va_list args2)
+__printf(6, 0)
+static size_t format_it(char *buffer,
+			size_t size,
+			size_t *stderr_offset_ptr,
+			int priority,
+			const char *prefix,
+			const char *format1,
+			va_list args1,
+			const char *format2,
+			va_list args2)
 {
 	const char *priority_str = uds_log_priority_to_string(priority);
-	char buffer[1024];
-	char *buf_end = buffer + sizeof(buffer);
+	char *buf_end = buffer + size;
 	char *bufp = buffer;
 	time_t t = ktime_to_seconds(current_time_ns(CLOCK_REALTIME));
 	struct tm tm;
@@ -149,7 +151,7 @@ static void log_it(int priority,
 
 	bufp = uds_append_to_buffer(bufp, buf_end, "<%d>%s", priority,
 				    timestamp);
-	const char *stderr_msg = bufp;
+	*stderr_offset_ptr = bufp - buffer;
 	bufp = uds_append_to_buffer(bufp, buf_end, " %s",
 				    log_ident == NULL ? "" : log_ident);
 
@@ -167,7 +169,7 @@ static void log_it(int priority,
 		bufp = uds_append_to_buffer(bufp, buf_end, ": ");
 	}
 	if ((bufp + sizeof("...")) >= buf_end) {
-		return;
+		return 0;
 	}
 	if (prefix != NULL) {
 		bufp = uds_append_to_buffer(bufp, buf_end, "%s", prefix);
@@ -191,6 +193,13 @@ static void log_it(int priority,
 	if (bufp == buf_end) {
 		strcpy(buf_end - sizeof("..."), "...");
 	}
+	return bufp - buffer;
+}
+
+/**********************************************************************/
+static void send_it(const char *buffer, size_t length, size_t stderr_offset)
+{
+	const char *stderr_msg = buffer + stderr_offset;
 	bool failure = false;
 	if (log_option & LOG_PERROR) {
 		failure |= write_msg(STDERR_FILENO, stderr_msg);
@@ -198,10 +207,9 @@ static void log_it(int priority,
 	open_socket_locked();
 	failure |= (log_socket == -1);
 	if (log_socket != -1) {
-		size_t bytes_to_write = bufp - buffer;
 		ssize_t bytes_written =
-			send(log_socket, buffer, bytes_to_write, MSG_NOSIGNAL);
-		failure |= (bytes_written != (ssize_t) bytes_to_write);
+			send(log_socket, buffer, length, MSG_NOSIGNAL);
+		failure |= (bytes_written != (ssize_t) length);
 	}
 	if (failure && (log_option & LOG_CONS)) {
 		int console = open(_PATH_CONSOLE, O_WRONLY);
@@ -212,6 +220,25 @@ static void log_it(int priority,
 	}
 }
 
+/**********************************************************************/
+__printf(3, 0)
+static void log_it(int priority,
+		   const char *prefix,
+		   const char *format1,
+		   va_list args1,
+		   const char *format2,
+		   va_list args2)
+{
+	char buffer[1024];
+	size_t stderr_offset;
+	size_t length = format_it(buffer, sizeof(buffer), &stderr_offset,
+				  priority, prefix, format1, args1, format2,
+				  args2);
+	if (length > 0) {
+		send_it(buffer, length, stderr_offset);
+	}
+}
+
 void mini_syslog_pack(int priority,
 		      const char *prefix,
 		      const char *fmt1,
@@ -224,6 +251,35 @@ void mini_syslog_pack(int priority,
 	uds_unlock_mutex(&mutex);
 }
 
+/**********************************************************************/
+size_t mini_syslog_format_pack(char *buffer,
+			       size_t size,
+			       size_t *stderr_offset_ptr,
+			       int priority,
+			       const char *prefix,
+			       const char *fmt1,
+			       va_list args1,
+			       const char *fmt2,
+			       va_list args2)
+{
+	/*
+	 * The identity and options are only changed by mini_openlog(),
+	 * which the logger calls once before any message is formatted, so
+	 * the mutex isn't needed to read them here.
+	 */
+	return format_it(buffer, size, stderr_offset_ptr, priority, prefix,
+			 fmt1, args1, fmt2, args2);
+}
+
+/**********************************************************************/
+void mini_syslog_send(const char *message, size_t length,
+		      size_t stderr_offset)
+{
+	uds_lock_mutex(&mutex);
+	send_it(message, length, stderr_offset);
+	uds_unlock_mutex(&mutex);
+}
+
 void mini_vsyslog(int priority, const char *format, va_list ap)
 {
 	va_list dummy;
@@ -24,6 +24,7 @@
 
 #include <syslog.h>
 #include <stdarg.h>
+#include <stddef.h>
 
 #include "compiler.h"
 
@@ -80,6 +81,47 @@ void mini_syslog_pack(int priority,
 		      va_list args2)
 	__printf(3, 0) __printf(5, 0);
 
+/**
+ * Format a message pack as mini_syslog_pack() would send it, but without
+ * sending it, so that it can be sent later from another thread by
+ * mini_syslog_send().
+ *
+ * @param buffer             the buffer in which to format the message
+ * @param size               the size of the buffer
+ * @param stderr_offset_ptr  a pointer to hold the offset of the part of
+ *                           the message which is copied to stderr
+ * @param priority           the priority at which to log the message
+ * @param prefix             optional string prefix to message, may be NULL
+ * @param fmt1               format of message first part, may be NULL
+ * @param args1              arguments for message first part
+ * @param fmt2               format of message second part, may be NULL
+ * @param args2              arguments for message second part
+ *
+ * @return the length of the formatted message, or 0 if the buffer is too
+ *         small to hold it
+ **/
+size_t mini_syslog_format_pack(char *buffer,
+			       size_t size,
+			       size_t *stderr_offset_ptr,
+			       int priority,
+			       const char *prefix,
+			       const char *fmt1,
+			       va_list args1,
+			       const char *fmt2,
+			       va_list args2)
+	__printf(6, 0) __printf(8, 0);
+
+/**
+ * Send a message formatted by mini_syslog_format_pack().
+ *
+ * @param message        the formatted message, which must be terminated
+ * @param length         the length of the message
+ * @param stderr_offset  the offset of the part of the message to copy to
+ *                       stderr
+ **/
+void mini_syslog_send(const char *message, size_t length,
+		      size_t stderr_offset);
+
 /**
  * Close a logger. This function mimics the closelog() c-library function.
  **/
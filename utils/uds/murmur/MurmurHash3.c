@@ -379,3 +379,105 @@ void MurmurHash3_x64_128 ( const void * key, const int len,
   putblock64((uint64_t*)out, 0, h1);
   putblock64((uint64_t*)out, 1, h2);
 }
+
+//-----------------------------------------------------------------------------
+// MurmurHash3_x64_128 of four keys of the same length at once. The four
+// hashes are independent, so interleaving their rounds lets the multiplies
+// of one key overlap those of the others instead of waiting on each other.
+// Each output is identical to MurmurHash3_x64_128 of the same key.
+
+static FORCE_INLINE void x64_128_finish ( const uint8_t * tail, const int len,
+                                          uint64_t h1, uint64_t h2,
+                                          void * out )
+{
+  uint64_t c1 = BIG_CONSTANT(0x87c37b91114253d5);
+  uint64_t c2 = BIG_CONSTANT(0x4cf5ad432745937f);
+
+  uint64_t k1 = 0, k2 = 0;
+
+  switch(len & 15)
+  {
+  case 15: k2 ^= ((uint64_t)tail[14]) << 48;
+  case 14: k2 ^= ((uint64_t)tail[13]) << 40;
+  case 13: k2 ^= ((uint64_t)tail[12]) << 32;
+  case 12: k2 ^= ((uint64_t)tail[11]) << 24;
+  case 11: k2 ^= ((uint64_t)tail[10]) << 16;
+  case 10: k2 ^= ((uint64_t)tail[ 9]) << 8;
+  case  9: k2 ^= ((uint64_t)tail[ 8]) << 0;
+           k2 *= c2; k2  = ROTL64(k2,33); k2 *= c1; h2 ^= k2;
+
+  case  8: k1 ^= ((uint64_t)tail[ 7]) << 56;
+  case  7: k1 ^= ((uint64_t)tail[ 6]) << 48;
+  case  6: k1 ^= ((uint64_t)tail[ 5]) << 40;
+  case  5: k1 ^= ((uint64_t)tail[ 4]) << 32;
+  case  4: k1 ^= ((uint64_t)tail[ 3]) << 24;
+  case  3: k1 ^= ((uint64_t)tail[ 2]) << 16;
+  case  2: k1 ^= ((uint64_t)tail[ 1]) << 8;
+  case  1: k1 ^= ((uint64_t)tail[ 0]) << 0;
+           k1 *= c1; k1  = ROTL64(k1,31); k1 *= c2; h1 ^= k1;
+  default: break;
+  };
+
+  h1 ^= len; h2 ^= len;
+
+  h1 += h2;
+  h2 += h1;
+
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+
+  h1 += h2;
+  h2 += h1;
+
+  putblock64((uint64_t*)out, 0, h1);
+  putblock64((uint64_t*)out, 1, h2);
+}
+
+void MurmurHash3_x64_128_x4 ( const void * const keys[4], const int len,
+                              const uint32_t seed, void * const out[4] )
+{
+  const int nblocks = len / 16;
+
+  uint64_t h1[4] = { seed, seed, seed, seed };
+  uint64_t h2[4] = { seed, seed, seed, seed };
+
+  uint64_t c1 = BIG_CONSTANT(0x87c37b91114253d5);
+  uint64_t c2 = BIG_CONSTANT(0x4cf5ad432745937f);
+
+  const uint64_t * blocks[4];
+
+  int i, j;
+  for(j = 0; j < 4; j++)
+  {
+    blocks[j] = (const uint64_t *)(keys[j]);
+  }
+
+  //----------
+  // body
+
+  for(i = 0; i < nblocks; i++)
+  {
+    for(j = 0; j < 4; j++)
+    {
+      uint64_t k1 = getblock64(blocks[j],i*2+0);
+      uint64_t k2 = getblock64(blocks[j],i*2+1);
+
+      k1 *= c1; k1  = ROTL64(k1,31); k1 *= c2; h1[j] ^= k1;
+
+      h1[j] = ROTL64(h1[j],27); h1[j] += h2[j]; h1[j] = h1[j]*5+0x52dce729;
+
+      k2 *= c2; k2  = ROTL64(k2,33); k2 *= c1; h2[j] ^= k2;
+
+      h2[j] = ROTL64(h2[j],31); h2[j] += h1[j]; h2[j] = h2[j]*5+0x38495ab5;
+    }
+  }
+
+  //----------
+  // tail and finalization
+
+  for(j = 0; j < 4; j++)
+  {
+    x64_128_finish((const uint8_t*)keys[j] + nblocks*16, len,
+                   h1[j], h2[j], out[j]);
+  }
+}
@@ -32,6 +32,9 @@ void MurmurHash3_x86_128 ( const void * key, int len, uint32_t seed, void * out
 
 void MurmurHash3_x64_128 ( const void * key, int len, uint32_t seed, void * out );
 
+void MurmurHash3_x64_128_x4 ( const void * const keys[4], int len, uint32_t seed,
+                              void * const out[4] );
+
 //-----------------------------------------------------------------------------
 
 #endif // _MURMURHASH3_H_
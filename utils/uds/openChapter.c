@@ -25,6 +25,7 @@
 #include "logger.h"
 #include "memoryAlloc.h"
 #include "numeric.h"
+#include "uds-threads.h"
 #include "zone.h"
 
 static int read_open_chapters(struct read_portal *portal);
@@ -52,6 +53,26 @@ enum {
 	OPEN_CHAPTER_VERSION_LENGTH = sizeof(OPEN_CHAPTER_VERSION) - 1
 };
 
+/*
+ * The share of a saved open chapter handled by one zone. When saving, the
+ * zone copies its records into its own section of the records; when
+ * loading, it takes the records belonging to it from all of them.
+ */
+struct open_chapter_section {
+	/* The index whose open chapter is being saved or loaded */
+	struct uds_index *index;
+	/* The zone handling this section */
+	unsigned int zone;
+	/* The records of this section, or of the whole chapter when loading */
+	struct uds_chunk_record *records;
+	/* The number of records in the section */
+	uint32_t record_count;
+	/* The thread handling the zone, if any */
+	struct thread *thread;
+	/* The result of handling the zone */
+	int result;
+};
+
 /**********************************************************************/
 static int fill_delta_chapter_index(struct open_chapter_zone **chapter_zones,
 				    unsigned int zone_count,
@@ -169,11 +190,150 @@ int close_open_chapter(struct open_chapter_zone **chapter_zones,
 	return write_chapter(volume, chapter_index, collated_records);
 }
 
+/**
+ * Copy the records of one zone's open chapter which have not been deleted
+ * into the zone's section, in the order they were added.
+ *
+ * @param section  The section to fill
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int copy_open_chapter_zone(struct open_chapter_section *section)
+{
+	struct open_chapter_zone *open_chapter =
+		section->index->zones[section->zone]->open_chapter;
+	uint32_t copied = 0;
+	unsigned int record_index;
+
+	for (record_index = 1; record_index <= open_chapter->size;
+	     record_index++) {
+		if (open_chapter->slots[record_index].record_deleted) {
+			continue;
+		}
+		section->records[copied++] = open_chapter->records[record_index];
+	}
+
+	return ASSERT((copied == section->record_count),
+		      "open chapter zone %u has %u records, not %u",
+		      section->zone, copied, section->record_count);
+}
+
+/**********************************************************************/
+static void copy_open_chapter_zone_thread(void *arg)
+{
+	struct open_chapter_section *section = arg;
+
+	section->result = copy_open_chapter_zone(section);
+}
+
+/**
+ * Run a function on the section of each zone, with one thread for each
+ * zone. A zone whose thread can't be started is handled on this thread.
+ *
+ * @param sections     The section of each zone
+ * @param zone_count   The number of zones
+ * @param handle       The function to handle a section
+ * @param thread_func  The thread body wrapping the function
+ * @param name         The name of the threads
+ *
+ * @return UDS_SUCCESS or the first error from any zone
+ **/
+static int
+run_open_chapter_sections(struct open_chapter_section *sections,
+			  unsigned int zone_count,
+			  int (*handle)(struct open_chapter_section *),
+			  void (*thread_func)(void *),
+			  const char *name)
+{
+	int result = UDS_SUCCESS;
+	unsigned int z;
+
+	for (z = 0; z < zone_count; z++) {
+		struct open_chapter_section *section = &sections[z];
+		section->result = UDS_SUCCESS;
+		if ((zone_count == 1) ||
+		    (uds_create_thread(thread_func, section, name,
+				       &section->thread) != UDS_SUCCESS)) {
+			section->thread = NULL;
+		}
+	}
+
+	for (z = 0; z < zone_count; z++) {
+		struct open_chapter_section *section = &sections[z];
+		if (section->thread != NULL) {
+			uds_join_threads(section->thread);
+			section->thread = NULL;
+		} else {
+			section->result = handle(section);
+		}
+		if (result == UDS_SUCCESS) {
+			result = section->result;
+		}
+	}
+	return result;
+}
+
+/**
+ * Gather the records of every zone's open chapter into one allocation,
+ * each zone copying its records into its own section concurrently.
+ *
+ * @param [in]  index          The index
+ * @param [out] records_ptr    A pointer to hold the records
+ * @param [out] total_records  A pointer to hold the number of records
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int gather_open_chapters(struct uds_index *index,
+				struct uds_chunk_record **records_ptr,
+				uint32_t *total_records)
+{
+	struct open_chapter_section sections[MAX_ZONES];
+	struct uds_chunk_record *records;
+	uint32_t count = 0;
+	unsigned int z;
+	int result;
+
+	for (z = 0; z < index->zone_count; z++) {
+		sections[z] = (struct open_chapter_section) {
+			.index = index,
+			.zone = z,
+			.record_count =
+				open_chapter_size(index->zones[z]->open_chapter),
+		};
+		count += sections[z].record_count;
+	}
+
+	result = UDS_ALLOCATE(max(count, 1U), struct uds_chunk_record,
+			      "saved open chapter records", &records);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	count = 0;
+	for (z = 0; z < index->zone_count; z++) {
+		sections[z].records = &records[count];
+		count += sections[z].record_count;
+	}
+
+	result = run_open_chapter_sections(sections, index->zone_count,
+					   copy_open_chapter_zone,
+					   copy_open_chapter_zone_thread,
+					   "saveopen");
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(records);
+		return result;
+	}
+
+	*records_ptr = records;
+	*total_records = count;
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int save_open_chapters(struct uds_index *index, struct buffered_writer *writer)
 {
-	uint32_t total_records = 0, records_added = 0;
-	unsigned int i, record_index;
+	uint32_t total_records;
+	struct uds_chunk_record *records;
 	byte total_record_data[sizeof(total_records)];
 	int result = write_to_buffered_writer(writer, OPEN_CHAPTER_MAGIC,
 					      OPEN_CHAPTER_MAGIC_LENGTH);
@@ -187,9 +347,13 @@ int save_open_chapters(struct uds_index *index, struct buffered_writer *writer)
 		return result;
 	}
 
-	for (i = 0; i < index->zone_count; i++) {
-		total_records +=
-			open_chapter_size(index->zones[i]->open_chapter);
+	// Only write out the records that have been added and not deleted.
+	// Each zone's records are written together, in the order they were
+	// added; the loader assigns every record to its zone by name, so it
+	// does not depend on the order.
+	result = gather_open_chapters(index, &records, &total_records);
+	if (result != UDS_SUCCESS) {
+		return result;
 	}
 
 	// Store the record count in little-endian order.
@@ -197,36 +361,16 @@ int save_open_chapters(struct uds_index *index, struct buffered_writer *writer)
 
 	result = write_to_buffered_writer(writer, total_record_data,
 					  sizeof(total_record_data));
+	if (result == UDS_SUCCESS) {
+		result = write_to_buffered_writer(writer, records,
+						  (total_records *
+						   sizeof(struct uds_chunk_record)));
+	}
+	UDS_FREE(records);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
 
-	// Only write out the records that have been added and not deleted.
-	record_index = 1;
-	while (records_added < total_records) {
-		unsigned int i;
-		for (i = 0; i < index->zone_count; i++) {
-			struct open_chapter_zone *open_chapter =
-				index->zones[i]->open_chapter;
-			struct uds_chunk_record *record;
-			if (record_index > open_chapter->size) {
-				continue;
-			}
-			if (open_chapter->slots[record_index].record_deleted) {
-				continue;
-			}
-			record = &open_chapter->records[record_index];
-			result = write_to_buffered_writer(writer,
-							  record,
-							  sizeof(struct uds_chunk_record));
-			if (result != UDS_SUCCESS) {
-				return result;
-			}
-			records_added++;
-		}
-		record_index++;
-	}
-
 	return flush_buffered_writer(writer);
 }
 
@@ -282,18 +426,67 @@ static int read_version(struct buffered_reader *reader, const byte **version)
 	return UDS_SUCCESS;
 }
 
+/**
+ * Add the saved records which belong to one zone to the zone's open
+ * chapter, in the order they were saved.
+ *
+ * @param section  The section for the zone, holding all the saved records
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int restore_open_chapter_zone(struct open_chapter_section *section)
+{
+	struct uds_index *index = section->index;
+	struct open_chapter_zone *open_chapter =
+		index->zones[section->zone]->open_chapter;
+	uint32_t i;
+
+	for (i = 0; i < section->record_count; i++) {
+		const struct uds_chunk_record *record = &section->records[i];
+		unsigned int remaining;
+		int result;
+
+		// A read-only index has no volume index, but it also has only
+		// one zone.
+		if ((index->zone_count > 1) &&
+		    (get_volume_index_zone(index->volume_index,
+					   &record->name) != section->zone)) {
+			continue;
+		}
+
+		// Add records until the open chapter zone almost runs out of
+		// space. The chapter can't be closed here, so don't add the
+		// last record.
+		result = put_open_chapter(open_chapter, &record->name,
+					  &record->data, &remaining);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		if (remaining <= 1) {
+			break;
+		}
+	}
+
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+static void restore_open_chapter_zone_thread(void *arg)
+{
+	struct open_chapter_section *section = arg;
+
+	section->result = restore_open_chapter_zone(section);
+}
+
 /**********************************************************************/
 static int load_version20(struct uds_index *index,
 			  struct buffered_reader *reader)
 {
-	uint32_t num_records, records;
+	struct open_chapter_section sections[MAX_ZONES];
+	struct uds_chunk_record *records;
+	uint32_t num_records;
 	byte num_records_data[sizeof(uint32_t)];
-	struct uds_chunk_record record;
-
-	// Keep track of which zones cannot accept any more records.
-	bool full_flags[MAX_ZONES] = {
-		false,
-	};
+	unsigned int z;
 
 	int result = read_from_buffered_reader(reader, &num_records_data,
 					       sizeof(num_records_data));
@@ -301,39 +494,43 @@ static int load_version20(struct uds_index *index,
 		return result;
 	}
 	num_records = get_unaligned_le32(num_records_data);
+	if (num_records > index->volume->geometry->records_per_chapter) {
+		return uds_log_error_strerror(UDS_CORRUPT_COMPONENT,
+					      "saved open chapter has %u records",
+					      num_records);
+	}
 
-	// Assign records to the correct zones.
-	for (records = 0; records < num_records; records++) {
-		unsigned int zone = 0;
-		result = read_from_buffered_reader(reader, &record,
-						   sizeof(struct uds_chunk_record));
-		if (result != UDS_SUCCESS) {
-			return result;
-		}
+	result = UDS_ALLOCATE(max(num_records, 1U), struct uds_chunk_record,
+			      "saved open chapter records", &records);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
 
-		if (index->zone_count > 1) {
-			// A read-only index has no volume index, but it also
-			// has only one zone.
-			zone = get_volume_index_zone(index->volume_index,
-						     &record.name);
-		}
-		// Add records until the open chapter zone almost runs out of
-		// space. The chapter can't be closed here, so don't add the
-		// last record.
-		if (!full_flags[zone]) {
-			unsigned int remaining;
-			result = put_open_chapter(index->zones[zone]->open_chapter,
-						  &record.name,
-						  &record.data,
-						  &remaining);
-			full_flags[zone] = (remaining <= 1);
-			if (result != UDS_SUCCESS) {
-				return result;
-			}
-		}
+	result = read_from_buffered_reader(reader, records,
+					   (num_records *
+					    sizeof(struct uds_chunk_record)));
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(records);
+		return result;
 	}
 
-	return UDS_SUCCESS;
+	// Every zone scans all the records, keeping the ones which belong to
+	// it, so the zones can be filled concurrently.
+	for (z = 0; z < index->zone_count; z++) {
+		sections[z] = (struct open_chapter_section) {
+			.index = index,
+			.zone = z,
+			.records = records,
+			.record_count = num_records,
+		};
+	}
+
+	result = run_open_chapter_sections(sections, index->zone_count,
+					   restore_open_chapter_zone,
+					   restore_open_chapter_zone_thread,
+					   "loadopen");
+	UDS_FREE(records);
+	return result;
 }
 
 /**********************************************************************/
@@ -47,7 +47,8 @@ extern const struct index_component_info OPEN_CHAPTER_INFO;
  **/
 
 /**
- * Close the open chapter and write it to disk.
+ * Close the open chapter and write it to disk. The chapter is not flushed
+ * to storage; the caller must sync the volume store before relying on it.
  *
  * @param chapter_zones          The zones of the chapter to close
  * @param zone_count             The number of zones
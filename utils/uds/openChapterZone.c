@@ -27,6 +27,15 @@
 #include "memoryAlloc.h"
 #include "permassert.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum {
+	/** The number of hash slots whose tags are compared together */
+	SLOT_GROUP_SIZE = 16,
+};
+
 /**********************************************************************/
 static INLINE size_t records_size(const struct open_chapter_zone *open_chapter)
 {
@@ -40,6 +49,12 @@ static INLINE size_t slots_size(size_t slot_count)
 	return (sizeof(struct open_chapter_zone_slot) * slot_count);
 }
 
+/**********************************************************************/
+static INLINE size_t tags_size(size_t slot_count)
+{
+	return (sizeof(byte) * slot_count);
+}
+
 /**
  * Round up to the first power of two greater than or equal
  * to the supplied number.
@@ -57,10 +72,13 @@ static INLINE size_t next_power_of_two(size_t val)
 	return (1 << compute_bits(val - 1));
 }
 
-/**********************************************************************/
-int make_open_chapter(const struct geometry *geometry,
-		      unsigned int zone_count,
-		      struct open_chapter_zone **open_chapter_ptr)
+/**
+ * Allocate an open chapter zone.
+ **/
+static int allocate_open_chapter(const struct geometry *geometry,
+				 unsigned int zone_count,
+				 int node,
+				 struct open_chapter_zone **open_chapter_ptr)
 {
 	struct open_chapter_zone *open_chapter;
 	size_t capacity, slot_count;
@@ -97,19 +115,33 @@ int make_open_chapter(const struct geometry *geometry,
 	// will never fail if the hash table is not full.
 	slot_count = next_power_of_two(capacity *
 				       geometry->open_chapter_load_ratio);
-	result = UDS_ALLOCATE_EXTENDED(struct open_chapter_zone,
-				       slot_count,
-				       struct open_chapter_zone_slot,
-				       "open chapter",
-				       &open_chapter);
+	if (slot_count < SLOT_GROUP_SIZE) {
+		slot_count = SLOT_GROUP_SIZE;
+	}
+	result = uds_allocate_memory_on_node(sizeof(struct open_chapter_zone) +
+					     (slot_count *
+					      sizeof(struct open_chapter_zone_slot)),
+					     __alignof__(struct open_chapter_zone),
+					     node,
+					     "open chapter",
+					     &open_chapter);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
 	open_chapter->slot_count = slot_count;
 	open_chapter->capacity = capacity;
-	result = uds_allocate_cache_aligned(records_size(open_chapter),
-					    "record pages",
-					    &open_chapter->records);
+	result = uds_allocate_cache_aligned_on_node(records_size(open_chapter),
+						    node,
+						    "record pages",
+						    &open_chapter->records);
+	if (result != UDS_SUCCESS) {
+		free_open_chapter(open_chapter);
+		return result;
+	}
+	result = uds_allocate_cache_aligned_on_node(tags_size(slot_count),
+						    node,
+						    "open chapter tags",
+						    &open_chapter->tags);
 	if (result != UDS_SUCCESS) {
 		free_open_chapter(open_chapter);
 		return result;
@@ -119,6 +151,21 @@ int make_open_chapter(const struct geometry *geometry,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+int make_open_chapter(const struct geometry *geometry,
+		      unsigned int zone_count,
+		      int node,
+		      struct open_chapter_zone **open_chapter_ptr)
+{
+	enum uds_memory_tag tag = uds_set_memory_tag(UDS_MEMORY_OPEN_CHAPTER);
+	int result = allocate_open_chapter(geometry,
+					   zone_count,
+					   node,
+					   open_chapter_ptr);
+	uds_set_memory_tag(tag);
+	return result;
+}
+
 /**********************************************************************/
 size_t open_chapter_size(const struct open_chapter_zone *open_chapter)
 {
@@ -128,11 +175,58 @@ size_t open_chapter_size(const struct open_chapter_zone *open_chapter)
 /**********************************************************************/
 void reset_open_chapter(struct open_chapter_zone *open_chapter)
 {
+	// A slot's record number is only read once its tag is set, so only
+	// the deleted flags of the records in use need to be cleared.
+	memset(open_chapter->slots, 0, slots_size(open_chapter->size + 1));
+	memset(open_chapter->tags, 0, tags_size(open_chapter->slot_count));
+	memset(open_chapter->records, 0, records_size(open_chapter));
+
 	open_chapter->size = 0;
 	open_chapter->deleted = 0;
+}
 
-	memset(open_chapter->records, 0, records_size(open_chapter));
-	memset(open_chapter->slots, 0, slots_size(open_chapter->slot_count));
+/**
+ * Compute the tag stored in a hash slot for a chunk name. The tag is taken
+ * from the most significant chapter index byte, which is not used to select
+ * the slot, and is never zero.
+ *
+ * @param name  The chunk name
+ *
+ * @return the slot tag for the name
+ **/
+static INLINE byte name_to_slot_tag(const struct uds_chunk_name *name)
+{
+	byte tag = name->name[CHAPTER_INDEX_BYTES_OFFSET];
+
+	return ((tag == 0) ? 1 : tag);
+}
+
+/**
+ * Find the slots in a group whose tag matches.
+ *
+ * @param tags  The tags of the slot group
+ * @param tag   The tag to look for
+ *
+ * @return a mask with bit N set if slot N of the group has the tag
+ **/
+static INLINE unsigned int match_slot_tags(const byte *tags, byte tag)
+{
+#ifdef __SSE2__
+	__m128i group = _mm_load_si128((const __m128i *) tags);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group,
+						_mm_set1_epi8((char) tag)));
+#else
+	unsigned int mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < SLOT_GROUP_SIZE; i++) {
+		if (tags[i] == tag) {
+			mask |= (1U << i);
+		}
+	}
+	return mask;
+#endif
 }
 
 /**********************************************************************/
@@ -142,41 +236,55 @@ probe_chapter_slots(struct open_chapter_zone *open_chapter,
 		    unsigned int *slot_ptr,
 		    unsigned int *record_number_ptr)
 {
-	unsigned int slots = open_chapter->slot_count;
-	unsigned int probe = name_to_hash_slot(name, slots);
-	unsigned int first_slot = 0;
+	unsigned int groups = open_chapter->slot_count / SLOT_GROUP_SIZE;
+	unsigned int group = name_to_hash_slot(name, groups);
+	byte tag = name_to_slot_tag(name);
 
-	struct uds_chunk_record *record;
+	struct uds_chunk_record *record = NULL;
 	unsigned int probe_slot;
-	unsigned int record_number;
+	unsigned int record_number = 0;
 	unsigned int probe_attempts;
 
 	for (probe_attempts = 1;; ++probe_attempts) {
-		probe_slot = first_slot + probe;
-		record_number = open_chapter->slots[probe_slot].record_number;
+		unsigned int first_slot = group * SLOT_GROUP_SIZE;
+		const byte *tags = &open_chapter->tags[first_slot];
+		unsigned int matches = match_slot_tags(tags, tag);
+		unsigned int empty;
+		bool found = false;
 
-		// If the hash slot is empty, we've reached the end of a chain
-		// without finding the record and should terminate the search.
-		if (record_number == 0) {
-			record = NULL;
+		// Only the records whose tags match need to be compared. If
+		// one of them has the requested name and has not been
+		// deleted, then we've found it.
+		while ((matches != 0) && !found) {
+			probe_slot = first_slot + __builtin_ctz(matches);
+			matches &= matches - 1;
+			record_number =
+				open_chapter->slots[probe_slot].record_number;
+			record = &open_chapter->records[record_number];
+			found = ((memcmp(&record->name, name,
+					 UDS_CHUNK_NAME_SIZE) == 0) &&
+				 !open_chapter->slots[record_number]
+					 .record_deleted);
+		}
+		if (found) {
 			break;
 		}
 
-		// If the name of the record referenced by the slot matches and
-		// has not been deleted, then we've found the requested name.
-		record = &open_chapter->records[record_number];
-		if ((memcmp(&record->name, name, UDS_CHUNK_NAME_SIZE) == 0) &&
-		    !open_chapter->slots[record_number].record_deleted) {
+		// If the group has an empty slot, we've reached the end of a
+		// chain without finding the record and should terminate the
+		// search. Slots in a group are filled in order, so the first
+		// empty one is where the name would be added.
+		empty = match_slot_tags(tags, 0);
+		if (empty != 0) {
+			probe_slot = first_slot + __builtin_ctz(empty);
+			record_number = 0;
+			record = NULL;
 			break;
 		}
 
-		// Quadratic probing: advance the probe by 1, 2, 3, etc. and
-		// try again. This performs better than linear probing and
-		// works best for 2^N slots.
-		probe += probe_attempts;
-		if (probe >= slots) {
-			probe = probe % slots;
-		}
+		// Quadratic probing: advance the probe by 1, 2, 3, etc. groups
+		// and try again. With 2^N groups this visits every group.
+		group = (group + probe_attempts) & (groups - 1);
 	}
 
 	// These NULL checks will be optimized away in callers who don't care
@@ -232,6 +340,7 @@ int put_open_chapter(struct open_chapter_zone *open_chapter,
 
 	record_number = ++open_chapter->size;
 	open_chapter->slots[slot].record_number = record_number;
+	open_chapter->tags[slot] = name_to_slot_tag(name);
 	record = &open_chapter->records[record_number];
 	record->name = *name;
 	record->data = *metadata;
@@ -266,6 +375,7 @@ void free_open_chapter(struct open_chapter_zone *open_chapter)
 {
 	if (open_chapter != NULL) {
 		UDS_FREE(open_chapter->records);
+		UDS_FREE(open_chapter->tags);
 		UDS_FREE(open_chapter);
 	}
 }
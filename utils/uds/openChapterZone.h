@@ -54,6 +54,12 @@
  * flags, indexed by record number. This overlay is possible because the
  * number of hash slots always exceeds the number of records, and is done
  * simply to save on memory.
+ *
+ * <p>Alongside the hash slots is an array of one-byte tags, one per slot,
+ * taken from a part of the name that doesn't select the slot. A zero tag
+ * marks an empty slot. The slots are probed a group at a time by comparing
+ * the whole group of tags at once, so a record is only read when its tag
+ * matches.
  **/
 
 enum {
@@ -80,6 +86,8 @@ struct open_chapter_zone {
 	struct uds_chunk_record *records;
 	/** The number of slots in the chapter zone hash table. */
 	unsigned int slot_count;
+	/** The name tag of each hash slot, or zero if the slot is empty */
+	byte *tags;
 	/** Hash table, referencing virtual record numbers */
 	struct open_chapter_zone_slot slots[];
 };
@@ -89,6 +97,7 @@ struct open_chapter_zone {
  *
  * @param geometry          the geometry of the volume
  * @param zone_count        the total number of open chapter zones
+ * @param node              the NUMA node of the zone thread, or -1
  * @param open_chapter_ptr  a pointer to hold the new open chapter
  *
  * @return UDS_SUCCESS or an error code
@@ -96,6 +105,7 @@ struct open_chapter_zone {
 int __must_check
 make_open_chapter(const struct geometry *geometry,
 		  unsigned int zone_count,
+		  int node,
 		  struct open_chapter_zone **open_chapter_ptr);
 
 /**
@@ -32,6 +32,7 @@
 #include "indexConfig.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
 #include "permassert.h"
 #include "recordPage.h"
 #include "stringUtils.h"
@@ -51,7 +52,7 @@ int assert_page_in_cache(struct page_cache *cache, struct cached_page *page)
 	}
 
 	page_index = cache->index[page->cp_physical_page];
-	return ASSERT((page_index < cache->num_cache_entries) &&
+	return ASSERT((page_index < cache->max_cache_entries) &&
 			      (&cache->cache[page_index] == page),
 		      "page is at expected location in cache");
 }
@@ -74,6 +75,40 @@ static void clear_cache_page(struct page_cache *cache,
 {
 	page->cp_physical_page = cache->num_index_entries;
 	WRITE_ONCE(page->cp_last_used, 0);
+	WRITE_ONCE(page->cp_referenced, false);
+}
+
+/**
+ * Check whether a page buffer was carved from the huge page allocation rather
+ * than allocated by itself. Buffers move between cache pages and the scratch
+ * page when index pages are donated, so this depends on the buffer and not
+ * on which page holds it.
+ *
+ * @param cache  the cache
+ * @param data   the page buffer
+ *
+ * @return true if the buffer belongs to the huge page allocation
+ **/
+static bool is_huge_page_data(struct page_cache *cache, const byte *data)
+{
+	return ((cache->page_data != NULL) && (data >= cache->page_data) &&
+		(data < (cache->page_data +
+			 get_page_cache_huge_page_memory(cache))));
+}
+
+/**
+ * Free a page buffer unless it belongs to the huge page allocation, in which
+ * case it stays with the page for reuse.
+ *
+ * @param cache  the cache
+ * @param page   the page buffer
+ **/
+static void destroy_page_data(struct page_cache *cache,
+			      struct volume_page *page)
+{
+	if (!is_huge_page_data(cache, get_page_data(page))) {
+		destroy_volume_page(page);
+	}
 }
 
 /**
@@ -120,7 +155,7 @@ static int __must_check get_page_no_stats(struct page_cache *cache,
 	queued = (index_value & VOLUME_CACHE_QUEUED_FLAG) != 0;
 	index = index_value & ~VOLUME_CACHE_QUEUED_FLAG;
 
-	if (!queued && (index < cache->num_cache_entries)) {
+	if (!queued && (index < cache->max_cache_entries)) {
 		*page_ptr = &cache->cache[index];
 		/*
 		 * We have acquired access to the cached page, but
@@ -139,39 +174,95 @@ static int __must_check get_page_no_stats(struct page_cache *cache,
 }
 
 /**
- * Wait for all pending searches on a page in the cache to complete
+ * Check whether a cache page may not be reused yet, because it is being read
+ * into or because a zone may still be searching it.
+ *
+ * @param page  the cached page
+ *
+ * @return true if the page is busy
+ **/
+static INLINE bool is_page_busy(const struct cached_page *page)
+{
+	return (page->cp_read_pending || (page->cp_retired_searches > 0));
+}
+
+/**
+ * Let pages be reused once the zones which were searching them when they
+ * were removed from the cache have finished those searches.
+ *
+ * @param cache  the page cache
+ **/
+static void reclaim_retired_pages(struct page_cache *cache)
+{
+	unsigned int i = 0;
+	bool reclaimed = false;
+
+	// We hold the readThreadsMutex.
+	while (i < cache->retired_search_count) {
+		struct retired_search *retired = &cache->retired_searches[i];
+		if (get_invalidate_counter(cache, retired->zone_number) ==
+		    retired->counter) {
+			i++;
+			continue;
+		}
+
+		cache->cache[retired->cache_index].cp_retired_searches--;
+		*retired = cache->retired_searches[--cache->retired_search_count];
+		reclaimed = true;
+	}
+
+	/*
+	 * The searches must be seen to have ended before a reclaimed page is
+	 * overwritten.  The corresponding memory barrier is in
+	 * end_pending_search.
+	 */
+	if (reclaimed) {
+		smp_mb();
+	}
+}
+
+/**
+ * Note the zones which are still searching a page which has just been
+ * removed from the page map, so that the page is not reused until they are
+ * done with it. No new search can find the page once it is unmapped.
  *
  * @param cache          the page cache
- * @param physical_page  the page to check searches on
+ * @param page           the cached page
+ * @param physical_page  the physical page the cached page held
  **/
-static void wait_for_pending_searches(struct page_cache *cache,
-				      unsigned int physical_page)
+static void retire_pending_searches(struct page_cache *cache,
+				    struct cached_page *page,
+				    unsigned int physical_page)
 {
-	invalidate_counter_t initial_counters[MAX_ZONES];
 	unsigned int i;
 	/*
-	 * We hold the readThreadsMutex.  We are waiting for threads
-	 * that do not hold the readThreadsMutex.  Those threads have
-	 * "locked" their targeted page by setting the
+	 * We hold the readThreadsMutex.  The zones do not hold it, but
+	 * have "locked" their targeted page by setting their
 	 * search_pending_counter.  The corresponding write memory
 	 * barrier is in begin_pending_search.
 	 */
 	smp_mb();
 
+	// Each zone may have only one retired search, which is for the page
+	// it is searching now, so drop those it has since finished first.
+	reclaim_retired_pages(cache);
 	for (i = 0; i < cache->zone_count; i++) {
-		initial_counters[i] = get_invalidate_counter(cache, i);
-	}
-	for (i = 0; i < cache->zone_count; i++) {
-		if (search_pending(initial_counters[i]) &&
-		    (page_being_searched(initial_counters[i]) ==
-		     physical_page)) {
-			// There is an active search using the physical page.
-			// We need to wait for the search to finish.
-			while (initial_counters[i] ==
-			       get_invalidate_counter(cache, i)) {
-				uds_yield_scheduler();
-			}
+		invalidate_counter_t counter = get_invalidate_counter(cache, i);
+		if (!search_pending(counter) ||
+		    (page_being_searched(counter) != physical_page)) {
+			continue;
 		}
+
+		ASSERT_LOG_ONLY((cache->retired_search_count <
+				 cache->zone_count),
+				"room for a retired search by zone %u", i);
+		cache->retired_searches[cache->retired_search_count++] =
+			(struct retired_search) {
+				.counter = counter,
+				.zone_number = i,
+				.cache_index = page - cache->cache,
+			};
+		page->cp_retired_searches++;
 	}
 }
 
@@ -197,11 +288,16 @@ invalidate_page_in_cache(struct page_cache *cache,
 	if (page->cp_physical_page != cache->num_index_entries) {
 		switch (reason) {
 		case INVALIDATION_EVICT:
-			cache->counters.evictions++;
+			record_cache_eviction(&cache->counters,
+					      ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+							page->cp_install_time));
 			break;
 		case INVALIDATION_EXPIRE:
 			cache->counters.expirations++;
 			break;
+		case INVALIDATION_ERROR:
+			cache->counters.errors++;
+			break;
 		default:
 			break;
 		}
@@ -214,8 +310,8 @@ invalidate_page_in_cache(struct page_cache *cache,
 		}
 
 		WRITE_ONCE(cache->index[page->cp_physical_page],
-			   cache->num_cache_entries);
-		wait_for_pending_searches(cache, page->cp_physical_page);
+			   cache->max_cache_entries);
+		retire_pending_searches(cache, page, page->cp_physical_page);
 	}
 
 	clear_cache_page(cache, page);
@@ -269,6 +365,7 @@ int find_invalidate_and_make_least_recent(struct page_cache *cache,
 	// Move the cached page to the least recently used end of the list
 	// so it will be replaced before any page with valid data.
 	WRITE_ONCE(page->cp_last_used, 0);
+	WRITE_ONCE(page->cp_referenced, false);
 
 	return UDS_SUCCESS;
 }
@@ -277,17 +374,26 @@ int find_invalidate_and_make_least_recent(struct page_cache *cache,
 static int __must_check initialize_page_cache(struct page_cache *cache,
 					      const struct geometry *geometry,
 					      unsigned int chapters_in_cache,
+					      unsigned int max_chapters_in_cache,
 					      unsigned int read_queue_max_size,
-					      unsigned int zone_count)
+					      unsigned int zone_count,
+					      enum uds_cache_policy policy,
+					      size_t huge_page_size)
 {
 	int result;
 	unsigned int i;
+	unsigned int max_cache_entries =
+		max(chapters_in_cache, max_chapters_in_cache) *
+		geometry->record_pages_per_chapter;
 	cache->geometry = geometry;
 	cache->num_index_entries = geometry->pages_per_volume + 1;
 	cache->num_cache_entries =
 		chapters_in_cache * geometry->record_pages_per_chapter;
+	cache->live_cache_entries = cache->num_cache_entries;
 	cache->read_queue_max_size = read_queue_max_size;
 	cache->zone_count = zone_count;
+	cache->policy = policy;
+	cache->huge_page_size = huge_page_size;
 	atomic64_set(&cache->clock, 1);
 
 	result = UDS_ALLOCATE(read_queue_max_size,
@@ -306,13 +412,30 @@ static int __must_check initialize_page_cache(struct page_cache *cache,
 		return result;
 	}
 
-	result = ASSERT((cache->num_cache_entries <= VOLUME_CACHE_MAX_ENTRIES),
+	result = UDS_ALLOCATE(cache->zone_count,
+			      struct retired_search,
+			      "page cache retired searches",
+			      &cache->retired_searches);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = UDS_ALLOCATE(cache->zone_count,
+			      struct zone_cache_counters,
+			      "page cache zone counters",
+			      &cache->zone_counters);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = ASSERT((max_cache_entries <= VOLUME_CACHE_MAX_ENTRIES),
 			"requested cache size, %u, within limit %u",
-			cache->num_cache_entries,
+			max_cache_entries,
 			VOLUME_CACHE_MAX_ENTRIES);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
+	cache->max_cache_entries = max_cache_entries;
 
 	result = UDS_ALLOCATE(cache->num_index_entries,
 			      uint16_t,
@@ -324,10 +447,10 @@ static int __must_check initialize_page_cache(struct page_cache *cache,
 
 	// Initialize index values to invalid values.
 	for (i = 0; i < cache->num_index_entries; i++) {
-		cache->index[i] = cache->num_cache_entries;
+		cache->index[i] = cache->max_cache_entries;
 	}
 
-	result = UDS_ALLOCATE(cache->num_cache_entries,
+	result = UDS_ALLOCATE(cache->max_cache_entries,
 			      struct cached_page,
 			      "page cache cache",
 			      &cache->cache);
@@ -335,24 +458,49 @@ static int __must_check initialize_page_cache(struct page_cache *cache,
 		return result;
 	}
 
-	for (i = 0; i < cache->num_cache_entries; i++) {
-		struct cached_page *page = &cache->cache[i];
-		result = initialize_volume_page(geometry, &page->cp_page_data);
+	if (huge_page_size > 0) {
+		// One extra page is the scratch page.
+		cache->huge_page_entries = cache->num_cache_entries + 1;
+		result = uds_allocate_huge_memory(get_page_cache_huge_page_memory(cache),
+						  huge_page_size,
+						  "page cache data",
+						  &cache->page_data);
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
+	}
+
+	for (i = 0; i < cache->num_cache_entries; i++) {
+		struct cached_page *page = &cache->cache[i];
+		if (cache->page_data != NULL) {
+			initialize_volume_page_with_data(&page->cp_page_data,
+							 (cache->page_data +
+							  ((size_t) i *
+							   geometry->bytes_per_page)));
+		} else {
+			result = initialize_volume_page(geometry,
+							&page->cp_page_data);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+		}
 		clear_cache_page(cache, page);
 	}
 
 	return UDS_SUCCESS;
 }
 
-/**********************************************************************/
-int make_page_cache(const struct geometry  *geometry,
-		    unsigned int chapters_in_cache,
-		    unsigned int read_queue_max_size,
-		    unsigned int zone_count,
-		    struct page_cache **cache_ptr)
+/**
+ * Allocate and initialize a page cache.
+ **/
+static int allocate_page_cache(const struct geometry  *geometry,
+			       unsigned int chapters_in_cache,
+			       unsigned int max_chapters_in_cache,
+			       unsigned int read_queue_max_size,
+			       unsigned int zone_count,
+			       enum uds_cache_policy policy,
+			       size_t huge_page_size,
+			       struct page_cache **cache_ptr)
 {
 	struct page_cache *cache;
 	int result;
@@ -369,6 +517,12 @@ int make_page_cache(const struct geometry  *geometry,
 		return uds_log_warning_strerror(UDS_INVALID_ARGUMENT,
 						"cache must have at least one zone");
 	}
+	if ((policy != UDS_CACHE_POLICY_LRU) &&
+	    (policy != UDS_CACHE_POLICY_CLOCK)) {
+		return uds_log_warning_strerror(UDS_INVALID_ARGUMENT,
+						"unknown cache policy %d",
+						policy);
+	}
 
 	result = UDS_ALLOCATE(1, struct page_cache, "volume cache", &cache);
 	if (result != UDS_SUCCESS) {
@@ -378,8 +532,11 @@ int make_page_cache(const struct geometry  *geometry,
 	result = initialize_page_cache(cache,
 				       geometry,
 				       chapters_in_cache,
+				       max_chapters_in_cache,
 				       read_queue_max_size,
-				       zone_count);
+				       zone_count,
+				       policy,
+				       huge_page_size);
 	if (result != UDS_SUCCESS) {
 		free_page_cache(cache);
 		return result;
@@ -389,6 +546,29 @@ int make_page_cache(const struct geometry  *geometry,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+int make_page_cache(const struct geometry  *geometry,
+		    unsigned int chapters_in_cache,
+		    unsigned int max_chapters_in_cache,
+		    unsigned int read_queue_max_size,
+		    unsigned int zone_count,
+		    enum uds_cache_policy policy,
+		    size_t huge_page_size,
+		    struct page_cache **cache_ptr)
+{
+	enum uds_memory_tag tag = uds_set_memory_tag(UDS_MEMORY_PAGE_CACHE);
+	int result = allocate_page_cache(geometry,
+					 chapters_in_cache,
+					 max_chapters_in_cache,
+					 read_queue_max_size,
+					 zone_count,
+					 policy,
+					 huge_page_size,
+					 cache_ptr);
+	uds_set_memory_tag(tag);
+	return result;
+}
+
 /**********************************************************************/
 void free_page_cache(struct page_cache *cache)
 {
@@ -397,13 +577,20 @@ void free_page_cache(struct page_cache *cache)
 	}
 	if (cache->cache != NULL) {
 		unsigned int i;
-		for (i = 0; i < cache->num_cache_entries; i++) {
-			destroy_volume_page(&cache->cache[i].cp_page_data);
+		for (i = 0; i < cache->max_cache_entries; i++) {
+			destroy_page_data(cache, &cache->cache[i].cp_page_data);
 		}
 	}
+	if (cache->page_data != NULL) {
+		uds_free_huge_memory(cache->page_data,
+				     get_page_cache_huge_page_memory(cache),
+				     cache->huge_page_size);
+	}
 	UDS_FREE(cache->index);
 	UDS_FREE(cache->cache);
 	UDS_FREE(cache->search_pending_counters);
+	UDS_FREE(cache->retired_searches);
+	UDS_FREE(cache->zone_counters);
 	UDS_FREE(cache->read_queue);
 	UDS_FREE(cache);
 }
@@ -413,10 +600,10 @@ void invalidate_page_cache(struct page_cache *cache)
 {
 	unsigned int i;
 	for (i = 0; i < cache->num_index_entries; i++) {
-		cache->index[i] = cache->num_cache_entries;
+		cache->index[i] = cache->max_cache_entries;
 	}
 
-	for (i = 0; i < cache->num_cache_entries; i++) {
+	for (i = 0; i < cache->live_cache_entries; i++) {
 		struct cached_page *page = &cache->cache[i];
 		release_volume_page(&page->cp_page_data);
 		clear_cache_page(cache, page);
@@ -459,6 +646,15 @@ void make_page_most_recent(struct page_cache *cache, struct cached_page *page)
 	// ASSERTION: We are either a zone thread holding a
 	// search_pending_counter, or we are any thread holding the
 	// readThreadsMutex.
+	if (cache->policy == UDS_CACHE_POLICY_CLOCK) {
+		// Only write when the bit changes, so that hits on a hot page
+		// leave its cache line shared.
+		if (!READ_ONCE(page->cp_referenced)) {
+			WRITE_ONCE(page->cp_referenced, true);
+		}
+		return;
+	}
+
 	if (atomic64_read(&cache->clock) != READ_ONCE(page->cp_last_used)) {
 		WRITE_ONCE(page->cp_last_used,
 			   atomic64_inc_return(&cache->clock));
@@ -479,24 +675,22 @@ static int __must_check get_least_recent_page(struct page_cache *cache,
 {
 	// We hold the readThreadsMutex.
 	int oldest_index = 0;
-	// Our first candidate is any page that does have a pending read.  We
-	// ensure above that there are more entries than read threads, so there
-	// must be one.
+	// Our first candidate is any page that is not busy.  There are far
+	// more entries than read threads and zones, so there must be one.
 	unsigned int i;
 	for (i = 0;; i++) {
 		if (i >= cache->num_cache_entries) {
 			// This should never happen.
 			return ASSERT(false, "oldest page is not NULL");
 		}
-		if (!cache->cache[i].cp_read_pending) {
+		if (!is_page_busy(&cache->cache[i])) {
 			oldest_index = i;
 			break;
 		}
 	}
-	// Now find the least recently used page that does not have a pending
-	// read.
+	// Now find the least recently used page that is not busy.
 	for (i = 0; i < cache->num_cache_entries; i++) {
-		if (!cache->cache[i].cp_read_pending &&
+		if (!is_page_busy(&cache->cache[i]) &&
 		    (READ_ONCE(cache->cache[i].cp_last_used) <=
 		     READ_ONCE(cache->cache[oldest_index].cp_last_used))) {
 			oldest_index = i;
@@ -506,10 +700,46 @@ static int __must_check get_least_recent_page(struct page_cache *cache,
 	return UDS_SUCCESS;
 }
 
+/**
+ * Get a page to replace using the CLOCK policy. The hand sweeps the cache,
+ * clearing the reference bit of each page it passes, and stops at the first
+ * page which is not referenced and is not busy.
+ *
+ * @param cache     the cache
+ * @param page_ptr  a pointer to hold the page
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int __must_check get_clock_victim_page(struct page_cache *cache,
+					      struct cached_page **page_ptr)
+{
+	// We hold the readThreadsMutex.
+	unsigned int i;
+	// Every reference bit is clear after one full sweep, so a second
+	// sweep must find a victim unless every page is busy.
+	for (i = 0; i < 2 * cache->num_cache_entries; i++) {
+		struct cached_page *page = &cache->cache[cache->clock_hand];
+		cache->clock_hand = (cache->clock_hand + 1) %
+			cache->num_cache_entries;
+		if (is_page_busy(page)) {
+			continue;
+		}
+		if (READ_ONCE(page->cp_referenced)) {
+			WRITE_ONCE(page->cp_referenced, false);
+			continue;
+		}
+		*page_ptr = page;
+		return UDS_SUCCESS;
+	}
+	// This should never happen.
+	return ASSERT(false, "clock victim page is not NULL");
+}
+
 /**********************************************************************/
 int get_page_from_cache(struct page_cache *cache,
 			unsigned int physical_page,
 			int probe_type,
+			unsigned int zone_number,
 			struct cached_page **page_ptr)
 {
 	// ASSERTION: We are in a zone thread.
@@ -534,7 +764,8 @@ int get_page_from_cache(struct page_cache *cache,
 			 ((queue_index != -1) ?
 			  CACHE_RESULT_QUEUED :
 			  CACHE_RESULT_MISS));
-	increment_cache_counter(&cache->counters, probe_type, cache_result);
+	increment_cache_counter(&cache->zone_counters[zone_number], probe_type,
+				cache_result);
 
 	if (page_ptr != NULL) {
 		*page_ptr = page;
@@ -542,6 +773,24 @@ int get_page_from_cache(struct page_cache *cache,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+bool is_page_cached(const struct page_cache *cache,
+		    unsigned int physical_page)
+{
+	// We hold the readThreadsMutex.
+	uint16_t index_value = cache->index[physical_page];
+	return (((index_value & VOLUME_CACHE_QUEUED_FLAG) == 0) &&
+		(index_value < cache->max_cache_entries));
+}
+
+/**********************************************************************/
+bool is_page_queued(const struct page_cache *cache,
+		    unsigned int physical_page)
+{
+	// We hold the readThreadsMutex.
+	return ((cache->index[physical_page] & VOLUME_CACHE_QUEUED_FLAG) != 0);
+}
+
 /**********************************************************************/
 int enqueue_read(struct page_cache *cache,
 		 struct uds_request *request,
@@ -565,6 +814,8 @@ int enqueue_read(struct page_cache *cache,
 		/* fill the read queue entry */
 		cache->read_queue[last].physical_page = physical_page;
 		cache->read_queue[last].invalid = false;
+		cache->read_queue[last].queued_time =
+			current_time_ns(CLOCK_MONOTONIC);
 
 		/* point the cache index to it */
 		read_queue_pos = last;
@@ -624,7 +875,7 @@ bool reserve_read_queue_entry(struct page_cache *cache,
 	// resetting
 	if (is_invalid && queued) {
 		// invalidate cache index slot
-		WRITE_ONCE(cache->index[page_no], cache->num_cache_entries);
+		WRITE_ONCE(cache->index[page_no], cache->max_cache_entries);
 	}
 
 	// If a sync read has taken this page, set invalid to true so we don't
@@ -673,23 +924,42 @@ int select_victim_in_cache(struct page_cache *cache,
 						"cannot put page in NULL cache");
 	}
 
-	result = get_least_recent_page(cache, &page);
-	if (result != UDS_SUCCESS) {
-		return result;
-	}
+	reclaim_retired_pages(cache);
+	for (;;) {
+		if (cache->policy == UDS_CACHE_POLICY_CLOCK) {
+			result = get_clock_victim_page(cache, &page);
+		} else {
+			result = get_least_recent_page(cache, &page);
+		}
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
 
-	result = ASSERT((page != NULL), "least recent page was not NULL");
-	if (result != UDS_SUCCESS) {
-		return result;
-	}
+		result = ASSERT((page != NULL),
+				"least recent page was not NULL");
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
 
-	// If the page is currently being pointed to by the page map, clear
-	// it from the page map, and update cache stats
-	if (page->cp_physical_page != cache->num_index_entries) {
-		cache->counters.evictions++;
+		if (page->cp_physical_page == cache->num_index_entries) {
+			break;
+		}
+
+		// The page is currently being pointed to by the page map, so
+		// clear it from the page map, and update cache stats
+		record_cache_eviction(&cache->counters,
+				      ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+						page->cp_install_time));
 		WRITE_ONCE(cache->index[page->cp_physical_page],
-			   cache->num_cache_entries);
-		wait_for_pending_searches(cache, page->cp_physical_page);
+			   cache->max_cache_entries);
+		retire_pending_searches(cache, page, page->cp_physical_page);
+		if (page->cp_retired_searches == 0) {
+			break;
+		}
+
+		// A zone is still searching the page, so leave it to be
+		// reclaimed later and take another.
+		clear_cache_page(cache, page);
 	}
 
 	page->cp_read_pending = true;
@@ -727,10 +997,11 @@ int put_page_in_cache(struct page_cache *cache,
 	clear_cache_page(cache, page);
 
 	page->cp_physical_page = physical_page;
+	page->cp_install_time = current_time_ns(CLOCK_MONOTONIC);
 
 	// Figure out the index into the cache array using pointer arithmetic
 	value = page - cache->cache;
-	result = ASSERT((value < cache->num_cache_entries),
+	result = ASSERT((value < cache->live_cache_entries),
 			"cache index is valid");
 	if (result != UDS_SUCCESS) {
 		return result;
@@ -781,7 +1052,96 @@ void cancel_page_in_cache(struct page_cache *cache,
 	page->cp_read_pending = false;
 
 	// Clear the page map for the new page. Will clear queued flag
-	WRITE_ONCE(cache->index[physical_page], cache->num_cache_entries);
+	WRITE_ONCE(cache->index[physical_page], cache->max_cache_entries);
+}
+
+/**
+ * Add or remove some of the entries of a page cache, as resize_page_cache().
+ **/
+static int resize_page_cache_entries(struct page_cache *cache,
+				     unsigned int num_entries,
+				     unsigned int max_steps,
+				     bool *blocked)
+{
+	unsigned int step;
+	int result;
+
+	// We hold the readThreadsMutex.
+	*blocked = false;
+	result = ASSERT(((num_entries > 0) &&
+			 (num_entries <= cache->max_cache_entries)),
+			"requested cache size, %u, within limit %u",
+			num_entries,
+			cache->max_cache_entries);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// Pages which are to be dropped are no longer chosen as victims, but
+	// can still be found until they are dropped.
+	cache->num_cache_entries = min(num_entries,
+				       (unsigned int) cache->live_cache_entries);
+	if (cache->clock_hand >= cache->num_cache_entries) {
+		cache->clock_hand = 0;
+	}
+
+	for (step = 0; step < max_steps; step++) {
+		struct cached_page *page;
+		if (cache->live_cache_entries > num_entries) {
+			page = &cache->cache[cache->live_cache_entries - 1];
+			reclaim_retired_pages(cache);
+			if (is_page_busy(page)) {
+				*blocked = true;
+				break;
+			}
+
+			result = invalidate_page_in_cache(cache, page,
+							  INVALIDATION_EVICT);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+			if (page->cp_retired_searches > 0) {
+				*blocked = true;
+				break;
+			}
+			destroy_page_data(cache, &page->cp_page_data);
+			WRITE_ONCE(cache->live_cache_entries,
+				   cache->live_cache_entries - 1);
+		} else if (cache->live_cache_entries < num_entries) {
+			page = &cache->cache[cache->live_cache_entries];
+			if (get_page_data(&page->cp_page_data) == NULL) {
+				result = initialize_volume_page(cache->geometry,
+								&page->cp_page_data);
+				if (result != UDS_SUCCESS) {
+					return result;
+				}
+			}
+			clear_cache_page(cache, page);
+			page->cp_read_pending = false;
+			WRITE_ONCE(cache->live_cache_entries,
+				   cache->live_cache_entries + 1);
+			cache->num_cache_entries = cache->live_cache_entries;
+		} else {
+			break;
+		}
+	}
+
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int resize_page_cache(struct page_cache *cache,
+		      unsigned int num_entries,
+		      unsigned int max_steps,
+		      bool *blocked)
+{
+	enum uds_memory_tag tag = uds_set_memory_tag(UDS_MEMORY_PAGE_CACHE);
+	int result = resize_page_cache_entries(cache,
+					       num_entries,
+					       max_steps,
+					       blocked);
+	uds_set_memory_tag(tag);
+	return result;
 }
 
 /**********************************************************************/
@@ -790,6 +1150,182 @@ size_t get_page_cache_size(struct page_cache *cache)
 	if (cache == NULL) {
 		return 0;
 	}
-	return sizeof(struct delta_index_page) * cache->num_cache_entries;
+	return (sizeof(struct delta_index_page) *
+		READ_ONCE(cache->live_cache_entries));
+}
+
+/**********************************************************************/
+void get_page_cache_stats(struct page_cache *cache,
+			  struct uds_page_cache_stats *stats)
+{
+	unsigned int z;
+
+	memset(stats, 0, sizeof(*stats));
+	if (cache == NULL) {
+		return;
+	}
+
+	stats->zone_count = min(cache->zone_count,
+				(unsigned int) UDS_LATENCY_MAX_ZONES);
+	for (z = 0; z < stats->zone_count; z++) {
+		get_zone_cache_stats(&cache->zone_counters[z],
+				     &stats->zones[z]);
+	}
+
+	// These are updated under the read threads mutex, but a slightly
+	// stale copy is good enough for statistics.
+	stats->evictions = READ_ONCE(cache->counters.evictions);
+	stats->expirations = READ_ONCE(cache->counters.expirations);
+	stats->errors = READ_ONCE(cache->counters.errors);
+	stats->chained_reads = READ_ONCE(cache->counters.chained_reads);
+	stats->resident_reads = READ_ONCE(cache->counters.resident_reads);
+	stats->warmed_pages = READ_ONCE(cache->counters.warmed_pages);
+	memcpy(&stats->read_latency, &cache->counters.read_latency,
+	       sizeof(stats->read_latency));
+	memcpy(stats->eviction_age, cache->counters.eviction_age,
+	       sizeof(stats->eviction_age));
+}
+
+/**
+ * Check whether one cache page was used less recently than another. Under
+ * the CLOCK policy a referenced page counts as more recent than one which
+ * is not, and otherwise whichever was installed later is more recent.
+ *
+ * @param cache  the cache
+ * @param a      the index of the first page
+ * @param b      the index of the second page
+ *
+ * @return <code>true</code> if page a was used less recently than page b
+ **/
+static bool is_less_recent(const struct page_cache *cache,
+			   uint16_t a,
+			   uint16_t b)
+{
+	const struct cached_page *page_a = &cache->cache[a];
+	const struct cached_page *page_b = &cache->cache[b];
+	bool referenced_a = READ_ONCE(page_a->cp_referenced);
+	bool referenced_b = READ_ONCE(page_b->cp_referenced);
+	int64_t last_used_a = READ_ONCE(page_a->cp_last_used);
+	int64_t last_used_b = READ_ONCE(page_b->cp_last_used);
+
+	if (referenced_a != referenced_b) {
+		return referenced_b;
+	}
+	if (last_used_a != last_used_b) {
+		return (last_used_a < last_used_b);
+	}
+	return (page_a->cp_install_time < page_b->cp_install_time);
+}
+
+/**
+ * Restore the heap property of a heap of cache page indexes, in which each
+ * page is less recent than its parent, below one node.
+ *
+ * @param cache  the cache
+ * @param heap   the heap of page indexes
+ * @param count  the number of indexes in the heap
+ * @param node   the node which may be less recent than its children
+ **/
+static void sift_down(const struct page_cache *cache,
+		      uint16_t *heap,
+		      unsigned int count,
+		      unsigned int node)
+{
+	for (;;) {
+		unsigned int child = 2 * node + 1;
+		uint16_t temp;
+
+		if (child >= count) {
+			return;
+		}
+		if ((child + 1 < count) &&
+		    is_less_recent(cache, heap[child], heap[child + 1])) {
+			child++;
+		}
+		if (!is_less_recent(cache, heap[node], heap[child])) {
+			return;
+		}
+		temp = heap[node];
+		heap[node] = heap[child];
+		heap[child] = temp;
+		node = child;
+	}
+}
+
+/**********************************************************************/
+unsigned int list_cached_pages(struct page_cache *cache,
+			       unsigned int *pages,
+			       unsigned int max_pages)
+{
+	// We hold the readThreadsMutex.
+	uint16_t *heap;
+	unsigned int count = 0, listed = 0;
+	unsigned int i;
+	int result;
+
+	result = UDS_ALLOCATE(cache->num_cache_entries, uint16_t,
+			      "cached page list", &heap);
+	if (result != UDS_SUCCESS) {
+		return 0;
+	}
+
+	for (i = 0; i < cache->num_cache_entries; i++) {
+		if (!cache->cache[i].cp_read_pending &&
+		    (cache->cache[i].cp_physical_page !=
+		     cache->num_index_entries)) {
+			heap[count++] = i;
+		}
+	}
+
+	// Pop the most recent page off a heap until enough are listed.
+	for (i = count / 2; i-- > 0;) {
+		sift_down(cache, heap, count, i);
+	}
+	while ((count > 0) && (listed < max_pages)) {
+		pages[listed++] = cache->cache[heap[0]].cp_physical_page;
+		heap[0] = heap[--count];
+		sift_down(cache, heap, count, 0);
+	}
+
+	UDS_FREE(heap);
+	return listed;
+}
+
+/**********************************************************************/
+size_t get_page_cache_huge_page_memory(struct page_cache *cache)
+{
+	if ((cache == NULL) || (cache->huge_page_size == 0)) {
+		return 0;
+	}
+	return ((size_t) cache->huge_page_entries *
+		cache->geometry->bytes_per_page);
+}
+
+/**********************************************************************/
+int initialize_scratch_page(struct page_cache *cache, struct volume_page *page)
+{
+	if (cache->page_data == NULL) {
+		return initialize_volume_page(cache->geometry, page);
+	}
+
+	/*
+	 * The scratch page data is swapped with the data of cached pages, so
+	 * it must come from the same allocation as theirs.
+	 */
+	initialize_volume_page_with_data(page,
+					 (cache->page_data +
+					  ((size_t) (cache->huge_page_entries - 1) *
+					   cache->geometry->bytes_per_page)));
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void destroy_scratch_page(struct page_cache *cache, struct volume_page *page)
+{
+	if (cache == NULL) {
+		destroy_volume_page(page);
+	} else {
+		destroy_page_data(cache, page);
+	}
 }
 
@@ -41,10 +41,16 @@ struct request_list {
 struct cached_page {
 	/* whether this page is currently being read asynchronously */
 	bool cp_read_pending;
+	/* the number of zone searches to end before the page may be reused */
+	unsigned int cp_retired_searches;
 	/* if equal to num_cache_entries, the page is invalid */
 	unsigned int cp_physical_page;
 	/* the value of the volume clock when this page was last used */
 	int64_t cp_last_used;
+	/* whether this page has been used since the clock hand last passed */
+	bool cp_referenced;
+	/* when this page was put in the cache */
+	ktime_t cp_install_time;
 	/* the cache page data */
 	struct volume_page cp_page_data;
 	/* the chapter index page. This is here, even for record pages */
@@ -66,6 +72,8 @@ struct queued_read {
 	unsigned int physical_page;
 	/* list of requests waiting on a queued read */
 	struct request_list request_list;
+	/* when the read was queued */
+	ktime_t queued_time;
 };
 
 // Reason for invalidating a cache entry, used for gathering statistics
@@ -85,7 +93,8 @@ enum invalidation_reason {
  * the begin_pending_search or end_pending_search methods.
  *
  * Any other thread that is accessing an invalidate counter is reading
- * the value in the wait_for_pending_searches method.
+ * the value in the retire_pending_searches or reclaim_retired_pages
+ * methods.
  */
 typedef int64_t invalidate_counter_t;
 // Fields of invalidate_counter_t.
@@ -97,6 +106,22 @@ struct __attribute__((aligned(CACHE_LINE_BYTES))) search_pending_counter {
 	atomic64_t atomic_value;
 };
 
+/*
+ * A search by a zone which was still using a page when the page was removed
+ * from the cache. The page is not reused until the zone's invalidate counter
+ * moves on from the value it had during the search, which marks the zone as
+ * having passed a quiescent point, so nothing which unmaps a page ever has to
+ * wait for the zones.
+ */
+struct retired_search {
+	/* the invalidate counter of the zone during the search */
+	invalidate_counter_t counter;
+	/* the zone doing the search */
+	unsigned int zone_number;
+	/* the index of the page in the cache */
+	uint16_t cache_index;
+};
+
 struct page_cache {
 	// Geometry governing the volume
 	const struct geometry *geometry;
@@ -104,8 +129,14 @@ struct page_cache {
 	unsigned int zone_count;
 	// The number of index entries
 	unsigned int num_index_entries;
-	// The max number of cached entries
+	// The number of entries in the cache array, which is also the index
+	// value of a page which is not in the cache
+	uint16_t max_cache_entries;
+	// The number of cached entries which may be chosen for replacement
 	uint16_t num_cache_entries;
+	// The number of cached entries which hold page buffers. This is more
+	// than num_cache_entries while the cache is being shrunk.
+	uint16_t live_cache_entries;
 	// The index used to quickly access page in cache - top bit is a
 	// 'queued' flag
 	uint16_t *index;
@@ -116,10 +147,23 @@ struct page_cache {
 	struct search_pending_counter *search_pending_counters;
 	// Queued reads, as a circular array, with first and last indexes
 	struct queued_read *read_queue;
+	// Probe counters for each zone
+	struct zone_cache_counters *zone_counters;
+	// The replacement policy
+	enum uds_cache_policy policy;
+	// The size of the huge pages backing the page data, or 0 if each
+	// page is allocated separately
+	size_t huge_page_size;
+	// The data for the initial pages and one scratch page, if backed by
+	// huge pages
+	byte *page_data;
+	// The number of page buffers in page_data
+	unsigned int huge_page_entries;
 	// Cache counters for stats.  This is the first field of a
 	// page_cache that is not constant after the struct is
-	// initialized.
-	struct cache_counters counters;
+	// initialized, so it starts a new cache line.
+	struct cache_counters counters
+		__attribute__((aligned(CACHE_LINE_BYTES)));
 	/**
 	 * Entries are enqueued at read_queue_last.
 	 * To 'reserve' entries, we get the entry pointed to by
@@ -148,8 +192,16 @@ struct page_cache {
 	uint16_t read_queue_last;
 	// The size of the read queue
 	unsigned int read_queue_max_size;
-	// Page access counter
-	atomic64_t clock;
+	// The next page examined by the CLOCK policy
+	unsigned int clock_hand;
+	// Searches which must end before their pages are reused; each zone
+	// can be searching only one page, so there is room for one per zone
+	struct retired_search *retired_searches;
+	// The number of entries in retired_searches
+	unsigned int retired_search_count;
+	// Page access counter, advanced by every zone on page hits, so it
+	// has a cache line to itself
+	atomic64_t clock __attribute__((aligned(CACHE_LINE_BYTES)));
 };
 
 /**
@@ -157,16 +209,25 @@ struct page_cache {
  *
  * @param geometry            The geometry governing the volume
  * @param chapters_in_cache   The size (in chapters) of the page cache
+ * @param max_chapters_in_cache The size (in chapters) to which the cache
+ *                            may later grow, if larger than
+ *                            chapters_in_cache
  * @param read_queue_max_size The maximum size of the read queue
  * @param zone_count          The number of zones in the index
+ * @param policy              The page replacement policy
+ * @param huge_page_size      The size of huge pages to back the page data
+ *                            with, or 0 to allocate each page separately
  * @param cache_ptr           A pointer to hold the new page cache
  *
  * @return UDS_SUCCESS or an error code
  **/
 int __must_check make_page_cache(const struct geometry *geometry,
 				 unsigned int chapters_in_cache,
+				 unsigned int max_chapters_in_cache,
 				 unsigned int read_queue_max_size,
 				 unsigned int zone_count,
+				 enum uds_cache_policy policy,
+				 size_t huge_page_size,
 				 struct page_cache **cache_ptr);
 
 /**
@@ -247,6 +308,7 @@ int __must_check assert_page_in_cache(struct page_cache *cache,
  * @param [in] probe_type    the type of cache access being done
  *                           (cache_probe_type optionally OR'ed with
  *                           CACHE_PROBE_IGNORE_FAILURE)
+ * @param [in] zone_number   the zone doing the access
  * @param [out] page_ptr     the found page
  *
  * @return UDS_SUCCESS or an error code
@@ -254,8 +316,33 @@ int __must_check assert_page_in_cache(struct page_cache *cache,
 int __must_check get_page_from_cache(struct page_cache *cache,
 				     unsigned int physical_page,
 				     int probe_type,
+				     unsigned int zone_number,
 				     struct cached_page **page_ptr);
 
+/**
+ * Check whether a page is in the cache, without counting a probe. The caller
+ * must hold the read threads mutex.
+ *
+ * @param cache          the page cache
+ * @param physical_page  the physical page to check
+ *
+ * @return <code>true</code> if the page is cached
+ **/
+bool is_page_cached(const struct page_cache *cache,
+		    unsigned int physical_page);
+
+/**
+ * Check whether a read of a page has been queued. The caller must hold the
+ * read threads mutex.
+ *
+ * @param cache          the page cache
+ * @param physical_page  the physical page to check
+ *
+ * @return <code>true</code> if a read of the page is queued
+ **/
+bool is_page_queued(const struct page_cache *cache,
+		    unsigned int physical_page);
+
 /**
  * Enqueue a read request
  *
@@ -312,6 +399,23 @@ static INLINE bool read_queue_is_full(struct page_cache *cache)
 		(cache->read_queue_last + 1) % cache->read_queue_max_size);
 }
 
+/**
+ * Get the number of entries in use in the page cache read queue, including
+ * reads in progress. The queue is not locked, so the count may be slightly
+ * out of date.
+ *
+ * @param cache  the page cache
+ *
+ * @return the number of read queue entries in use
+ **/
+static INLINE unsigned int get_read_queue_occupancy(struct page_cache *cache)
+{
+	unsigned int first = READ_ONCE(cache->read_queue_first);
+	unsigned int last = READ_ONCE(cache->read_queue_last);
+	return ((last + cache->read_queue_max_size - first) %
+		cache->read_queue_max_size);
+}
+
 /**
  * Selects a page in the cache to be used for a read.
  *
@@ -359,6 +463,27 @@ void cancel_page_in_cache(struct page_cache *cache,
 			  unsigned int physical_page,
 			  struct cached_page *page);
 
+/**
+ * Move a page cache a bounded number of pages toward a new size. Growing
+ * allocates buffers for new pages. Shrinking stops choosing the excess pages
+ * for replacement at once, then drops them one at a time from the end of the
+ * cache. A page with a read in progress cannot be dropped until the read
+ * completes, nor one which a zone was still searching when it was removed
+ * until the search ends, so the caller should wait a little and call again.
+ *
+ * @param cache        the page cache
+ * @param num_entries  the new number of pages, no more than the maximum
+ *                     the cache was made with
+ * @param max_steps    the most pages to add or drop in this call
+ * @param blocked      set to true if shrinking is waiting for a busy page
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check resize_page_cache(struct page_cache *cache,
+				   unsigned int num_entries,
+				   unsigned int max_steps,
+				   bool *blocked);
+
 /**
  * Get the page cache size
  *
@@ -368,6 +493,60 @@ void cancel_page_in_cache(struct page_cache *cache,
  **/
 size_t __must_check get_page_cache_size(struct page_cache *cache);
 
+/**
+ * Get the page cache statistics.
+ *
+ * @param cache  the cache
+ * @param stats  the statistics to fill in
+ **/
+void get_page_cache_stats(struct page_cache *cache,
+			  struct uds_page_cache_stats *stats);
+
+/**
+ * List the physical page numbers of the valid pages in the cache, most
+ * recently used first.  The caller must hold the read threads mutex.
+ *
+ * @param cache      the cache
+ * @param pages      the array to fill in
+ * @param max_pages  the size of the array
+ *
+ * @return the number of pages listed, no more than max_pages
+ **/
+unsigned int list_cached_pages(struct page_cache *cache,
+			       unsigned int *pages,
+			       unsigned int max_pages);
+
+/**
+ * Initialize a scratch page which may be swapped with the pages of the cache.
+ *
+ * @param cache  the cache
+ * @param page   the scratch page
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check initialize_scratch_page(struct page_cache *cache,
+					 struct volume_page *page);
+
+/**
+ * Destroy a scratch page initialized with initialize_scratch_page(). This
+ * must be called before the cache is freed.
+ *
+ * @param cache  the cache, which may be NULL if the page was never
+ *               initialized
+ * @param page   the scratch page
+ **/
+void destroy_scratch_page(struct page_cache *cache, struct volume_page *page);
+
+/**
+ * Get the number of bytes of page data backed by huge pages.
+ *
+ * @param cache  the cache
+ *
+ * @return the number of bytes
+ **/
+size_t __must_check
+get_page_cache_huge_page_memory(struct page_cache *cache);
+
 
 /**
  * Read the invalidate counter for the given zone.
@@ -450,7 +629,7 @@ static INLINE void begin_pending_search(struct page_cache *cache,
 	 * This memory barrier ensures that the write to the invalidate counter
 	 * is seen by other threads before this thread accesses the cached
 	 * page.  The corresponding read memory barrier is in
-	 * wait_for_pending_searches.
+	 * retire_pending_searches.
 	 */
 	smp_mb();
 }
@@ -0,0 +1,895 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/pagebench.c#1 $
+ */
+
+/**
+ * pagebench builds a volume of the requested geometry and replays a trace of
+ * (chapter, page) accesses against its page cache, either a recorded trace
+ * or a synthetic one with a Zipf distribution over the pages. Each access is
+ * made the way a zone thread makes it, queueing misses for the read threads
+ * and waiting for them to finish, or with get_volume_page() reading in the
+ * client itself. The replay is repeated for each combination of cache size,
+ * read thread count and replacement policy asked for.
+ **/
+
+#include <err.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uds.h"
+
+#include "benchCounters.h"
+#include "benchHistogram.h"
+#include "config.h"
+#include "errors.h"
+#include "geometry.h"
+#include "indexConfig.h"
+#include "indexLayout.h"
+#include "indexPageMap.h"
+#include "memoryAlloc.h"
+#include "murmur/MurmurHash3.h"
+#include "pageCache.h"
+#include "request.h"
+#include "timeUtils.h"
+#include "uds-threads.h"
+#include "volume.h"
+#include "volumeStore.h"
+
+enum {
+	/** The most values of each list option */
+	MAX_RUN_VALUES = 16,
+	/** The hash seed used to name the records of the volume */
+	NAME_SEED = 0x70616765,
+};
+
+static const char usage_string[] = " [--help] [options...] filename";
+
+static const char help_string[] =
+	"pagebench - replay page accesses against the volume page cache\n"
+	"\n"
+	"SYNOPSIS\n"
+	"  pagebench [options] filename\n"
+	"\n"
+	"DESCRIPTION\n"
+	"  pagebench creates an index in filename, destroying anything there,\n"
+	"  and fills every chapter of its volume. It then opens the volume on\n"
+	"  its own and replays page accesses against it, reporting the cache\n"
+	"  hit rate, the number of reads issued, accesses per second, and the\n"
+	"  latency percentiles of the accesses and of waiting for reads.\n"
+	"\n"
+	"OPTIONS\n"
+	"    --accesses=<count>\n"
+	"       Replay <count> synthetic accesses. The default is 1000000.\n"
+	"\n"
+	"    --cache-chapters=<count>[,<count>...]\n"
+	"       Replay with a page cache of each <count> chapters. The\n"
+	"       default is 7.\n"
+	"\n"
+	"    --chapters=<count>\n"
+	"       Build a volume of <count> chapters. The default is 64.\n"
+	"\n"
+	"    --clients=<count>\n"
+	"       Replay from <count> threads, each taking a share of the\n"
+	"       trace as its own zone. The default is 1.\n"
+	"\n"
+	"    --counters\n"
+	"       Also report the hardware performance counters of each\n"
+	"       access.\n"
+	"\n"
+	"    --help\n"
+	"       Print this help message and exit.\n"
+	"\n"
+	"    --policy=<lru|clock>[,...]\n"
+	"       Replay with each page cache replacement policy. The default\n"
+	"       is lru.\n"
+	"\n"
+	"    --read-threads=<count>[,<count>...]\n"
+	"       Replay with each number of read threads. The default is 2.\n"
+	"\n"
+	"    --record-pages=<count>\n"
+	"       Build chapters of <count> record pages. The default is 16.\n"
+	"\n"
+	"    --skew=<exponent>\n"
+	"       The exponent of the Zipf distribution of synthetic accesses,\n"
+	"       with 0 for uniform accesses. The default is 0.9.\n"
+	"\n"
+	"    --sync\n"
+	"       Read missing pages in the client with get_volume_page()\n"
+	"       rather than queueing them for the read threads.\n"
+	"\n"
+	"    --trace=<file>\n"
+	"       Replay the accesses in <file>, one \"<chapter> <page>\" pair\n"
+	"       per line, rather than synthetic ones. Lines starting with #\n"
+	"       are ignored, and out of range numbers wrap around.\n"
+	"\n";
+
+static struct option options[] = {
+	{ "accesses", required_argument, NULL, 'a' },
+	{ "cache-chapters", required_argument, NULL, 'c' },
+	{ "chapters", required_argument, NULL, 'C' },
+	{ "clients", required_argument, NULL, 'z' },
+	{ "counters", no_argument, NULL, 'P' },
+	{ "help", no_argument, NULL, 'h' },
+	{ "policy", required_argument, NULL, 'p' },
+	{ "read-threads", required_argument, NULL, 'r' },
+	{ "record-pages", required_argument, NULL, 'R' },
+	{ "skew", required_argument, NULL, 'k' },
+	{ "sync", no_argument, NULL, 's' },
+	{ "trace", required_argument, NULL, 't' },
+	{ NULL, 0, NULL, 0 },
+};
+static char option_string[] = "a:c:C:hk:Pp:r:R:st:z:";
+
+/** One page access of a trace */
+struct page_access {
+	unsigned int chapter;
+	unsigned int page;
+};
+
+/** The hardware counters, which are read if counting is set */
+static struct bench_counters counters;
+static bool counting;
+
+/** The settings of the benchmark */
+struct bench_config {
+	const char *filename;
+	const char *trace_file;
+	unsigned long accesses;
+	unsigned int cache_chapters[MAX_RUN_VALUES];
+	unsigned int cache_runs;
+	unsigned int chapters;
+	unsigned int clients;
+	enum uds_cache_policy policies[MAX_RUN_VALUES];
+	unsigned int policy_runs;
+	unsigned int read_threads[MAX_RUN_VALUES];
+	unsigned int read_runs;
+	unsigned int record_pages;
+	double skew;
+	bool sync;
+};
+
+/** The measurements of one replay */
+struct replay_stats {
+	struct bench_histogram access_latency;
+	struct bench_histogram read_wait;
+};
+
+/** A replay thread, which makes its accesses as one zone */
+struct replay_client {
+	struct volume *volume;
+	struct replay_stats *stats;
+	const struct page_access *accesses;
+	unsigned long access_count;
+	bool sync;
+	struct thread *thread;
+	struct uds_request request;
+	struct semaphore read_done;
+	unsigned long checksum;
+	int result;
+};
+
+/**********************************************************************/
+static void usage(const char *progname)
+{
+	errx(1, "Usage: %s%s\n", progname, usage_string);
+}
+
+/**********************************************************************/
+static void check(int result, const char *what)
+{
+	if (result != UDS_SUCCESS) {
+		char buf[UDS_STRING_ERROR_BUFSIZE];
+		errx(1, "%s failed: %s", what,
+		     uds_string_error(result, buf, sizeof(buf)));
+	}
+}
+
+/**********************************************************************/
+static unsigned long parse_number(const char *name,
+				  const char *arg,
+				  unsigned long min,
+				  unsigned long max)
+{
+	uint64_t value;
+	if ((uds_parse_uint64(arg, &value) != UDS_SUCCESS) || (value < min) ||
+	    (value > max)) {
+		errx(1, "invalid --%s value: %s", name, arg);
+	}
+	return value;
+}
+
+/**
+ * Parse a comma separated list of option values.
+ *
+ * @return the number of values parsed
+ **/
+static unsigned int parse_list(const char *name,
+			       const char *arg,
+			       unsigned int min,
+			       unsigned int max,
+			       unsigned int values[])
+{
+	unsigned int count = 0;
+	char *copy = strdup(arg);
+	char *saveptr = NULL;
+	char *token;
+	if (copy == NULL) {
+		errx(1, "out of memory");
+	}
+
+	for (token = strtok_r(copy, ",", &saveptr); token != NULL;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		if (count == MAX_RUN_VALUES) {
+			errx(1, "too many --%s values: %s", name, arg);
+		}
+		if (strcmp(name, "policy") == 0) {
+			if (strcmp(token, "lru") == 0) {
+				values[count++] = UDS_CACHE_POLICY_LRU;
+			} else if (strcmp(token, "clock") == 0) {
+				values[count++] = UDS_CACHE_POLICY_CLOCK;
+			} else {
+				errx(1, "invalid --policy value: %s", token);
+			}
+		} else {
+			values[count++] = parse_number(name, token, min, max);
+		}
+	}
+	free(copy);
+
+	if (count == 0) {
+		errx(1, "invalid --%s value: %s", name, arg);
+	}
+	return count;
+}
+
+/**
+ * Advance a random number generator (xorshift64*).
+ **/
+static uint64_t next_random(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**********************************************************************/
+static ktime_t now(void)
+{
+	return current_time_ns(CLOCK_MONOTONIC);
+}
+
+/**********************************************************************/
+static void count_post(struct uds_request *request)
+{
+	check(request->status, "post");
+}
+
+/**
+ * Create the index and post enough records to fill every chapter of the
+ * volume, and then one more chapter so that the oldest chapter is the only
+ * one written twice.
+ **/
+static void build_volume(const struct bench_config *config,
+			 struct uds_configuration *conf)
+{
+	struct uds_parameters params = UDS_PARAMETERS_INITIALIZER;
+	struct uds_index_session *session;
+	struct configuration *index_config;
+	struct uds_request *requests;
+	unsigned int records_per_chapter;
+	uint64_t name_number = 0;
+	unsigned int chapter, i;
+
+	check(make_configuration(conf, &index_config), "make_configuration");
+	records_per_chapter = index_config->geometry->records_per_chapter;
+	free_configuration(index_config);
+
+	check(UDS_ALLOCATE(records_per_chapter, struct uds_request,
+			   "build requests", &requests),
+	      "allocate build requests");
+	check(uds_create_index_session(&session), "uds_create_index_session");
+	params.zone_count = 1;
+	check(uds_open_index(UDS_CREATE, config->filename, &params, conf,
+			     session),
+	      "uds_open_index");
+
+	for (chapter = 0; chapter <= config->chapters; chapter++) {
+		for (i = 0; i < records_per_chapter; i++) {
+			struct uds_request *request = &requests[i];
+			uint64_t hash[2];
+			memset(request, 0, sizeof(*request));
+			MurmurHash3_x64_128(&name_number, sizeof(name_number),
+					    NAME_SEED, hash);
+			memcpy(request->chunk_name.name, hash,
+			       UDS_CHUNK_NAME_SIZE);
+			memcpy(request->new_metadata.data, &name_number,
+			       sizeof(name_number));
+			name_number++;
+			request->callback = count_post;
+			request->session = session;
+			request->type = UDS_POST;
+			check(uds_start_chunk_operation(request),
+			      "uds_start_chunk_operation");
+		}
+		check(uds_flush_index_session(session),
+		      "uds_flush_index_session");
+	}
+
+	check(uds_close_index(session), "uds_close_index");
+	uds_destroy_index_session(session);
+	UDS_FREE(requests);
+}
+
+/**
+ * Read a trace of page accesses.
+ **/
+static struct page_access *read_trace(const char *trace_file,
+				      const struct geometry *geometry,
+				      unsigned long *count_ptr)
+{
+	struct page_access *accesses = NULL;
+	unsigned long count = 0;
+	unsigned long capacity = 0;
+	char line[256];
+	FILE *trace = fopen(trace_file, "r");
+	if (trace == NULL) {
+		err(1, "unable to open %s", trace_file);
+	}
+
+	while (fgets(line, sizeof(line), trace) != NULL) {
+		unsigned long chapter, page;
+		if ((line[0] == '#') ||
+		    (sscanf(line, "%lu %lu", &chapter, &page) != 2)) {
+			continue;
+		}
+
+		if (count == capacity) {
+			capacity = (capacity == 0) ? 4096 : capacity * 2;
+			check(uds_reallocate_memory(accesses,
+						    count * sizeof(*accesses),
+						    capacity *
+							    sizeof(*accesses),
+						    "trace", &accesses),
+			      "allocate trace");
+		}
+		accesses[count].chapter =
+			chapter % geometry->chapters_per_volume;
+		accesses[count].page = page % geometry->pages_per_chapter;
+		count++;
+	}
+	fclose(trace);
+
+	if (count == 0) {
+		errx(1, "no accesses in %s", trace_file);
+	}
+	*count_ptr = count;
+	return accesses;
+}
+
+/**
+ * Make a synthetic trace whose accesses follow a Zipf distribution over the
+ * pages of the volume, with the popularity ranks shuffled across the pages.
+ **/
+static struct page_access *make_trace(const struct bench_config *config,
+				      const struct geometry *geometry)
+{
+	unsigned int pages = geometry->pages_per_volume;
+	struct page_access *accesses;
+	unsigned int *page_of_rank;
+	double *cumulative;
+	double total = 0;
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	unsigned long i;
+
+	check(UDS_ALLOCATE(config->accesses, struct page_access, "trace",
+			   &accesses),
+	      "allocate trace");
+	check(UDS_ALLOCATE(pages, unsigned int, "page ranks", &page_of_rank),
+	      "allocate page ranks");
+	check(UDS_ALLOCATE(pages, double, "page weights", &cumulative),
+	      "allocate page weights");
+
+	for (i = 0; i < pages; i++) {
+		page_of_rank[i] = i;
+	}
+	for (i = pages - 1; i > 0; i--) {
+		unsigned int j = next_random(&state) % (i + 1);
+		unsigned int swap = page_of_rank[i];
+		page_of_rank[i] = page_of_rank[j];
+		page_of_rank[j] = swap;
+	}
+	for (i = 0; i < pages; i++) {
+		total += pow(i + 1, -config->skew);
+		cumulative[i] = total;
+	}
+
+	for (i = 0; i < config->accesses; i++) {
+		double pick = ((next_random(&state) >> 11) * 0x1.0p-53) * total;
+		unsigned int low = 0;
+		unsigned int high = pages - 1;
+		unsigned int page;
+		while (low < high) {
+			unsigned int middle = (low + high) / 2;
+			if (cumulative[middle] < pick) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+
+		page = page_of_rank[low];
+		accesses[i].chapter = page / geometry->pages_per_chapter;
+		accesses[i].page = page % geometry->pages_per_chapter;
+	}
+
+	UDS_FREE(cumulative);
+	UDS_FREE(page_of_rank);
+	return accesses;
+}
+
+/**
+ * Fill in the index page map of a freshly made volume from its chapter
+ * index pages, as a rebuild does, and then empty the page cache again.
+ **/
+static void load_index_page_map(struct volume *volume)
+{
+	const struct geometry *geometry = volume->geometry;
+	unsigned int chapter, page;
+
+	volume->lookup_mode = LOOKUP_FOR_REBUILD;
+	for (chapter = 0; chapter < geometry->chapters_per_volume; chapter++) {
+		uint64_t virtual_chapter = 0;
+		for (page = 0; page < geometry->index_pages_per_chapter;
+		     page++) {
+			struct delta_index_page *index_page;
+			check(get_volume_page(volume, chapter, page,
+					      CACHE_PROBE_INDEX_FIRST, NULL,
+					      &index_page),
+			      "get_volume_page");
+			virtual_chapter = index_page->virtual_chapter_number;
+			check(update_index_page_map(volume->index_page_map,
+						    virtual_chapter, chapter,
+						    page,
+						    index_page->highest_list_number),
+			      "update_index_page_map");
+		}
+		check(forget_chapter(volume, virtual_chapter,
+				     INVALIDATION_EXPIRE),
+		      "forget_chapter");
+	}
+	volume->lookup_mode = LOOKUP_NORMAL;
+}
+
+/**
+ * Called by a read thread when a page a client is waiting for has been read.
+ **/
+static void finish_read(struct uds_request *request)
+{
+	struct replay_client *client =
+		container_of(request, struct replay_client, request);
+	uds_release_semaphore(&client->read_done);
+}
+
+/**
+ * Make an access the way a zone thread does, queueing a read for the read
+ * threads if the page is not cached and waiting for it to be done.
+ **/
+static int access_page(struct replay_client *client,
+		       const struct page_access *access)
+{
+	struct volume *volume = client->volume;
+	const struct geometry *geometry = volume->geometry;
+	unsigned int zone_number = client->request.zone_number;
+	bool record_page = (access->page >= geometry->index_pages_per_chapter);
+	int probe_type = (record_page ? CACHE_PROBE_RECORD_FIRST :
+				        CACHE_PROBE_INDEX_FIRST);
+	unsigned int physical_page =
+		map_to_physical_page(geometry, access->chapter, access->page);
+
+	for (;;) {
+		struct cached_page *page;
+		ktime_t queued = now();
+		int result;
+
+		begin_pending_search(volume->page_cache, physical_page,
+				     zone_number);
+		result = get_volume_page_protected(volume, &client->request,
+						   physical_page, probe_type,
+						   &page);
+		if (result == UDS_SUCCESS) {
+			client->checksum +=
+				get_page_data(&page->cp_page_data)[0];
+			end_pending_search(volume->page_cache, zone_number);
+			return UDS_SUCCESS;
+		}
+
+		end_pending_search(volume->page_cache, zone_number);
+		if (result != UDS_QUEUED) {
+			return result;
+		}
+
+		uds_acquire_semaphore(&client->read_done);
+		if (client->request.status != UDS_SUCCESS) {
+			return client->request.status;
+		}
+		record_bench_latency(&client->stats->read_wait,
+				     ktime_sub(client->request.read_time,
+					       queued));
+		probe_type = (record_page ? CACHE_PROBE_RECORD_RETRY :
+					    CACHE_PROBE_INDEX_RETRY);
+	}
+}
+
+/**
+ * Make an access with get_volume_page(), which reads a missing page in the
+ * calling thread.
+ **/
+static int access_page_sync(struct replay_client *client,
+			    const struct page_access *access)
+{
+	const struct geometry *geometry = client->volume->geometry;
+	byte *data;
+	struct delta_index_page *index_page;
+	int result;
+
+	if (access->page >= geometry->index_pages_per_chapter) {
+		result = get_volume_page(client->volume, access->chapter,
+					 access->page,
+					 CACHE_PROBE_RECORD_FIRST, &data,
+					 NULL);
+		if (result == UDS_SUCCESS) {
+			client->checksum += data[0];
+		}
+	} else {
+		result = get_volume_page(client->volume, access->chapter,
+					 access->page, CACHE_PROBE_INDEX_FIRST,
+					 NULL, &index_page);
+		if (result == UDS_SUCCESS) {
+			client->checksum += index_page->lowest_list_number;
+		}
+	}
+	return result;
+}
+
+/**********************************************************************/
+static void run_client(void *arg)
+{
+	struct replay_client *client = arg;
+	unsigned long i;
+
+	for (i = 0; i < client->access_count; i++) {
+		ktime_t start = now();
+		int result = (client->sync ?
+			      access_page_sync(client, &client->accesses[i]) :
+			      access_page(client, &client->accesses[i]));
+		if (result != UDS_SUCCESS) {
+			client->result = result;
+			return;
+		}
+		record_bench_latency(&client->stats->access_latency,
+				     ktime_sub(now(), start));
+	}
+}
+
+/**
+ * Sum the first probe counts of a cache's statistics.
+ **/
+static void count_probes(const struct uds_page_cache_stats *stats,
+			 uint64_t *hits,
+			 uint64_t *probes,
+			 uint64_t *reads)
+{
+	unsigned int z, b;
+	*hits = 0;
+	*probes = 0;
+	*reads = 0;
+	for (z = 0; z < stats->zone_count; z++) {
+		const struct uds_page_cache_zone_stats *zone =
+			&stats->zones[z];
+		*hits += zone->first_index.hits + zone->first_record.hits;
+		*probes += (zone->first_index.hits + zone->first_index.misses +
+			    zone->first_index.queued +
+			    zone->first_record.hits +
+			    zone->first_record.misses +
+			    zone->first_record.queued);
+	}
+	for (b = 0; b < UDS_LATENCY_BUCKETS; b++) {
+		*reads += stats->read_latency.counts[b];
+	}
+}
+
+/**
+ * Open the volume with the given page cache settings and replay the trace
+ * against it.
+ **/
+static void replay(const struct bench_config *config,
+		   struct uds_configuration *conf,
+		   struct uds_index_session *session,
+		   const struct page_access *accesses,
+		   unsigned long access_count,
+		   unsigned int cache_chapters,
+		   unsigned int read_threads,
+		   enum uds_cache_policy policy)
+{
+	struct uds_parameters params = UDS_PARAMETERS_INITIALIZER;
+	struct configuration *index_config;
+	struct index_layout *layout;
+	struct volume *volume;
+	struct replay_client *clients;
+	struct replay_stats *stats;
+	struct uds_page_cache_stats *before, *after;
+	uint64_t hits, probes, reads, base_hits, base_probes, base_reads;
+	unsigned long share = access_count / config->clients;
+	double seconds;
+	ktime_t start;
+	unsigned int i;
+
+	conf->cache_chapters = cache_chapters;
+	check(make_configuration(conf, &index_config), "make_configuration");
+	check(make_uds_index_layout(config->filename, false, conf, &layout),
+	      "make_uds_index_layout");
+	params.zone_count = config->clients;
+	params.read_threads = read_threads;
+	params.cache_policy = policy;
+	check(make_volume(index_config, layout, &params,
+			  VOLUME_CACHE_DEFAULT_MAX_QUEUED_READS,
+			  config->clients, &volume),
+	      "make_volume");
+	load_index_page_map(volume);
+
+	check(UDS_ALLOCATE(config->clients, struct replay_client, "clients",
+			   &clients),
+	      "allocate clients");
+	check(UDS_ALLOCATE(1, struct replay_stats, "replay stats", &stats),
+	      "allocate replay stats");
+	check(UDS_ALLOCATE(1, struct uds_page_cache_stats, "cache stats",
+			   &before),
+	      "allocate cache stats");
+	check(UDS_ALLOCATE(1, struct uds_page_cache_stats, "cache stats",
+			   &after),
+	      "allocate cache stats");
+
+	get_page_cache_stats(volume->page_cache, before);
+	if (counting) {
+		start_bench_counters(&counters);
+	}
+	start = now();
+	for (i = 0; i < config->clients; i++) {
+		struct replay_client *client = &clients[i];
+		client->volume = volume;
+		client->stats = stats;
+		client->accesses = &accesses[i * share];
+		client->access_count = ((i == config->clients - 1) ?
+					access_count - i * share :
+					share);
+		client->sync = config->sync;
+		// Any session makes the volume queue reads for its read
+		// threads rather than reading in the calling thread.
+		client->request.session = session;
+		client->request.zone_number = i;
+		check(uds_initialize_semaphore(&client->read_done, 0),
+		      "uds_initialize_semaphore");
+		check(uds_create_thread(run_client, client, "pagebench",
+					&client->thread),
+		      "uds_create_thread");
+	}
+	for (i = 0; i < config->clients; i++) {
+		uds_join_threads(clients[i].thread);
+		check(clients[i].result, "page access");
+		uds_destroy_semaphore(&clients[i].read_done);
+	}
+	seconds = ktime_sub(now(), start) / 1e9;
+	if (counting) {
+		stop_bench_counters(&counters);
+	}
+	get_page_cache_stats(volume->page_cache, after);
+
+	count_probes(before, &base_hits, &base_probes, &base_reads);
+	count_probes(after, &hits, &probes, &reads);
+	hits -= base_hits;
+	probes -= base_probes;
+	reads -= base_reads;
+
+	printf("cache %u chapters, %s, %u read threads%s: "
+	       "%.1f%% hits, %llu reads, %.0f accesses/sec, %llu evictions\n",
+	       cache_chapters,
+	       (policy == UDS_CACHE_POLICY_CLOCK) ? "clock" : "lru",
+	       read_threads, config->sync ? " (sync)" : "",
+	       (probes == 0) ? 0.0 : 100.0 * hits / probes,
+	       (unsigned long long) reads, access_count / seconds,
+	       (unsigned long long) (after->evictions - before->evictions));
+	printf("  %-12s %12s %10s %10s %10s\n", "latency", "count", "p50 us",
+	       "p99 us", "p999 us");
+	printf("  %-12s %12llu %10.1f %10.1f %10.1f\n", "access",
+	       (unsigned long long) get_bench_count(&stats->access_latency),
+	       get_bench_percentile(&stats->access_latency, 500) / 1000.0,
+	       get_bench_percentile(&stats->access_latency, 990) / 1000.0,
+	       get_bench_percentile(&stats->access_latency, 999) / 1000.0);
+	if (!config->sync) {
+		printf("  %-12s %12llu %10.1f %10.1f %10.1f\n", "read wait",
+		       (unsigned long long) get_bench_count(&stats->read_wait),
+		       get_bench_percentile(&stats->read_wait, 500) / 1000.0,
+		       get_bench_percentile(&stats->read_wait, 990) / 1000.0,
+		       get_bench_percentile(&stats->read_wait, 999) / 1000.0);
+	}
+	if (counting) {
+		print_bench_counters(&counters, "  ", access_count);
+	}
+
+	UDS_FREE(after);
+	UDS_FREE(before);
+	UDS_FREE(stats);
+	UDS_FREE(clients);
+	free_volume(volume);
+	put_uds_index_layout(layout);
+	free_configuration(index_config);
+}
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+	struct bench_config config = {
+		.accesses = 1000000,
+		.cache_chapters = { 7 },
+		.cache_runs = 1,
+		.chapters = 64,
+		.clients = 1,
+		.policies = { UDS_CACHE_POLICY_LRU },
+		.policy_runs = 1,
+		.read_threads = { 2 },
+		.read_runs = 1,
+		.record_pages = 16,
+		.skew = 0.9,
+	};
+	struct uds_configuration *conf;
+	struct uds_index_session *session;
+	struct configuration *index_config;
+	struct page_access *accesses;
+	unsigned long access_count;
+	unsigned int c_run, r_run, p_run;
+	char *end;
+	int c;
+
+	while ((c = getopt_long(argc, argv, option_string, options, NULL)) !=
+	       -1) {
+		switch (c) {
+		case 'a':
+			config.accesses = parse_number("accesses", optarg, 1,
+						       1UL << 32);
+			break;
+
+		case 'c':
+			config.cache_runs = parse_list("cache-chapters",
+						       optarg, 1, 1 << 16,
+						       config.cache_chapters);
+			break;
+
+		case 'C':
+			config.chapters = parse_number("chapters", optarg, 2,
+						       1 << 16);
+			break;
+
+		case 'h':
+			printf("%s", help_string);
+			exit(0);
+
+		case 'k':
+			config.skew = strtod(optarg, &end);
+			if ((*end != '\0') || (config.skew < 0)) {
+				errx(1, "invalid --skew value: %s", optarg);
+			}
+			break;
+
+		case 'P':
+			counting = true;
+			break;
+
+		case 'p':
+			config.policy_runs = parse_list("policy", optarg, 0, 0,
+							config.policies);
+			break;
+
+		case 'r':
+			config.read_runs = parse_list("read-threads", optarg,
+						      1, 64,
+						      config.read_threads);
+			break;
+
+		case 'R':
+			config.record_pages = parse_number("record-pages",
+							   optarg, 1, 1024);
+			break;
+
+		case 's':
+			config.sync = true;
+			break;
+
+		case 't':
+			config.trace_file = optarg;
+			break;
+
+		case 'z':
+			config.clients = parse_number("clients", optarg, 1,
+						      UDS_LATENCY_MAX_ZONES);
+			break;
+
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (optind != (argc - 1)) {
+		usage(argv[0]);
+	}
+	config.filename = argv[optind];
+	if (counting) {
+		counting = open_bench_counters(&counters);
+	}
+
+	check(uds_initialize_configuration(&conf, UDS_MEMORY_CONFIG_256MB),
+	      "uds_initialize_configuration");
+	conf->record_pages_per_chapter = config.record_pages;
+	conf->chapters_per_volume = config.chapters;
+	conf->sparse_chapters_per_volume = 0;
+	build_volume(&config, conf);
+
+	check(make_configuration(conf, &index_config), "make_configuration");
+	if (config.trace_file != NULL) {
+		accesses = read_trace(config.trace_file,
+				      index_config->geometry, &access_count);
+	} else {
+		accesses = make_trace(&config, index_config->geometry);
+		access_count = config.accesses;
+	}
+	free_configuration(index_config);
+	if (access_count < config.clients) {
+		errx(1, "fewer accesses than clients");
+	}
+
+	check(uds_create_index_session(&session), "uds_create_index_session");
+	set_request_restarter(finish_read);
+	for (p_run = 0; p_run < config.policy_runs; p_run++) {
+		for (r_run = 0; r_run < config.read_runs; r_run++) {
+			for (c_run = 0; c_run < config.cache_runs; c_run++) {
+				replay(&config, conf, session, accesses,
+				       access_count,
+				       config.cache_chapters[c_run],
+				       config.read_threads[r_run],
+				       config.policies[p_run]);
+			}
+		}
+	}
+	set_request_restarter(NULL);
+
+	uds_destroy_index_session(session);
+	uds_free_configuration(conf);
+	UDS_FREE(accesses);
+	if (counting) {
+		close_bench_counters(&counters);
+	}
+	exit(0);
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/readerPool.c#1 $
+ */
+
+#include "readerPool.h"
+
+#include "errors.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "threadOnce.h"
+#include "uds-threads.h"
+
+enum {
+	/** The most threads a reader pool will run */
+	MAX_READER_POOL_THREADS = 64,
+};
+
+struct reader_pool {
+	/** the mutex protecting the fields below */
+	struct mutex mutex;
+	/** signalled when work is queued or the pool is shutting down */
+	struct cond_var work_cond;
+	/** broadcast when a client's busy count drops to zero */
+	struct cond_var idle_cond;
+	/** the clients of the pool */
+	struct reader_pool_client *clients;
+	/** the number of clients of the pool */
+	unsigned int client_count;
+	/** the number of times work has been signalled */
+	uint64_t signals;
+	/** set when the threads should exit */
+	bool exiting;
+	/** the number of threads started */
+	unsigned int thread_count;
+	/** the threads of the pool */
+	struct thread *threads[MAX_READER_POOL_THREADS];
+};
+
+/** The process-wide pool, made by the first client to join */
+static struct reader_pool *shared_pool;
+static struct mutex shared_pool_mutex;
+static once_state_t shared_pool_once = ONCE_STATE_INITIALIZER;
+
+/**********************************************************************/
+static void initialize_shared_pool_mutex(void)
+{
+	if (uds_init_mutex(&shared_pool_mutex) != UDS_SUCCESS) {
+		uds_log_error("cannot initialize the reader pool mutex");
+	}
+}
+
+/**
+ * The body of a pool thread, which offers each client in turn a chance to
+ * work until a whole pass finds nothing to do and nothing new is signalled.
+ *
+ * @param arg  the pool
+ **/
+static void reader_pool_thread(void *arg)
+{
+	struct reader_pool *pool = arg;
+
+	uds_lock_mutex(&pool->mutex);
+	while (!pool->exiting) {
+		uint64_t signals = pool->signals;
+		struct reader_pool_client *client;
+		bool worked = false;
+
+		// A client cannot be unlinked while we hold its busy count,
+		// so its next pointer is valid once the mutex is retaken.
+		for (client = pool->clients; client != NULL;
+		     client = client->next) {
+			if (client->leaving) {
+				continue;
+			}
+
+			client->busy++;
+			uds_unlock_mutex(&pool->mutex);
+			worked |= client->service(client->context);
+			uds_lock_mutex(&pool->mutex);
+			if (--client->busy == 0) {
+				uds_broadcast_cond(&pool->idle_cond);
+			}
+		}
+
+		if (!worked && (signals == pool->signals) && !pool->exiting) {
+			uds_wait_cond(&pool->work_cond, &pool->mutex);
+		}
+	}
+	uds_unlock_mutex(&pool->mutex);
+}
+
+/**
+ * Stop the threads of a pool and free it. The pool must have no clients.
+ *
+ * @param pool  the pool to free
+ **/
+static void free_reader_pool(struct reader_pool *pool)
+{
+	unsigned int i;
+
+	uds_lock_mutex(&pool->mutex);
+	pool->exiting = true;
+	uds_broadcast_cond(&pool->work_cond);
+	uds_unlock_mutex(&pool->mutex);
+	for (i = 0; i < pool->thread_count; i++) {
+		uds_join_threads(pool->threads[i]);
+	}
+
+	uds_destroy_cond(&pool->idle_cond);
+	uds_destroy_cond(&pool->work_cond);
+	uds_destroy_mutex(&pool->mutex);
+	UDS_FREE(pool);
+}
+
+/**
+ * Make an empty pool with no threads.
+ *
+ * @param pool_ptr  a pointer to hold the new pool
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int make_reader_pool(struct reader_pool **pool_ptr)
+{
+	struct reader_pool *pool;
+	int result = UDS_ALLOCATE(1, struct reader_pool, __func__, &pool);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = uds_init_mutex(&pool->mutex);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(pool);
+		return result;
+	}
+
+	result = uds_init_cond(&pool->work_cond);
+	if (result != UDS_SUCCESS) {
+		uds_destroy_mutex(&pool->mutex);
+		UDS_FREE(pool);
+		return result;
+	}
+
+	result = uds_init_cond(&pool->idle_cond);
+	if (result != UDS_SUCCESS) {
+		uds_destroy_cond(&pool->work_cond);
+		uds_destroy_mutex(&pool->mutex);
+		UDS_FREE(pool);
+		return result;
+	}
+
+	*pool_ptr = pool;
+	return UDS_SUCCESS;
+}
+
+/**
+ * Start more threads in a pool, up to the requested number. The caller must
+ * hold the shared pool mutex, so pool threads are only added by one thread
+ * at a time.
+ *
+ * @param pool     the pool
+ * @param threads  the number of threads wanted
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int grow_reader_pool(struct reader_pool *pool, unsigned int threads)
+{
+	if (threads > MAX_READER_POOL_THREADS) {
+		threads = MAX_READER_POOL_THREADS;
+	}
+
+	while (pool->thread_count < threads) {
+		int result = uds_create_thread(reader_pool_thread, pool,
+					       "reader",
+					       &pool->threads[pool->thread_count]);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		pool->thread_count++;
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int join_reader_pool(unsigned int threads,
+		     struct reader_pool_client *client,
+		     struct reader_pool **pool_ptr)
+{
+	struct reader_pool *pool;
+	int result;
+
+	perform_once(&shared_pool_once, initialize_shared_pool_mutex);
+	uds_lock_mutex(&shared_pool_mutex);
+	if (shared_pool == NULL) {
+		result = make_reader_pool(&shared_pool);
+		if (result != UDS_SUCCESS) {
+			shared_pool = NULL;
+			uds_unlock_mutex(&shared_pool_mutex);
+			return result;
+		}
+	}
+	pool = shared_pool;
+
+	result = grow_reader_pool(pool, threads);
+	if ((result != UDS_SUCCESS) && (pool->thread_count == 0)) {
+		// The pool is useless without threads.
+		if (pool->client_count == 0) {
+			free_reader_pool(pool);
+			shared_pool = NULL;
+		}
+		uds_unlock_mutex(&shared_pool_mutex);
+		return result;
+	}
+	if (result != UDS_SUCCESS) {
+		uds_log_warning_strerror(result,
+					 "reader pool running with %u threads",
+					 pool->thread_count);
+	}
+
+	client->busy = 0;
+	client->leaving = false;
+	uds_lock_mutex(&pool->mutex);
+	client->next = pool->clients;
+	pool->clients = client;
+	pool->client_count++;
+	uds_unlock_mutex(&pool->mutex);
+	uds_unlock_mutex(&shared_pool_mutex);
+
+	*pool_ptr = pool;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void leave_reader_pool(struct reader_pool *pool,
+		       struct reader_pool_client *client)
+{
+	struct reader_pool_client **link;
+	bool last;
+
+	uds_lock_mutex(&shared_pool_mutex);
+	uds_lock_mutex(&pool->mutex);
+	client->leaving = true;
+	while (client->busy > 0) {
+		uds_wait_cond(&pool->idle_cond, &pool->mutex);
+	}
+
+	for (link = &pool->clients; *link != NULL; link = &(*link)->next) {
+		if (*link == client) {
+			*link = client->next;
+			break;
+		}
+	}
+	last = (--pool->client_count == 0);
+	uds_unlock_mutex(&pool->mutex);
+
+	if (last) {
+		free_reader_pool(pool);
+		shared_pool = NULL;
+	}
+	uds_unlock_mutex(&shared_pool_mutex);
+}
+
+/**********************************************************************/
+void signal_reader_pool(struct reader_pool *pool)
+{
+	uds_lock_mutex(&pool->mutex);
+	pool->signals++;
+	uds_signal_cond(&pool->work_cond);
+	uds_unlock_mutex(&pool->mutex);
+}
+
+/**********************************************************************/
+unsigned int get_reader_pool_thread_count(struct reader_pool *pool)
+{
+	unsigned int count;
+
+	uds_lock_mutex(&pool->mutex);
+	count = pool->thread_count;
+	uds_unlock_mutex(&pool->mutex);
+	return count;
+}
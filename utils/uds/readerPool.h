@@ -0,0 +1,110 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/readerPool.h#1 $
+ */
+
+#ifndef READER_POOL_H
+#define READER_POOL_H
+
+#include "compiler.h"
+#include "typeDefs.h"
+
+/**
+ * A reader pool is a process-wide set of threads which read volume pages on
+ * behalf of every index which joins it, so that a host with many indexes
+ * needs only as many reader threads as its busiest index asked for, rather
+ * than a full set for each index. The pool is made when the first client
+ * joins and freed when the last one leaves.
+ *
+ * The pool knows nothing of volumes. Each client supplies a function which
+ * does one unit of queued work, if there is any, and signals the pool
+ * whenever it queues more. A pool thread which is woken offers every client
+ * a chance to work, and sleeps again only when a full pass found nothing to
+ * do and no client has signalled since the pass started.
+ **/
+struct reader_pool;
+
+/**
+ * Do one unit of a client's queued work.
+ *
+ * @param context  the client context
+ *
+ * @return <code>true</code> if there was work to do
+ **/
+typedef bool reader_pool_service_t(void *context);
+
+/**
+ * The registration of one client of a reader pool. The client owns the
+ * structure, which the pool links into its list while the client is a member.
+ **/
+struct reader_pool_client {
+	/** the function which does one unit of the client's work */
+	reader_pool_service_t *service;
+	/** the context passed to the service function */
+	void *context;
+	/** the next client in the pool's list */
+	struct reader_pool_client *next;
+	/** the number of pool threads currently in the service function */
+	unsigned int busy;
+	/** set while the client is leaving, so no new work is started */
+	bool leaving;
+};
+
+/**
+ * Join the process-wide reader pool, making it if necessary, and make sure
+ * it has at least the given number of threads.
+ *
+ * @param [in]  threads   the least number of threads the client wants
+ * @param [in]  client    the client registration, with its service
+ *                        function and context filled in
+ * @param [out] pool_ptr  a pointer to hold the pool
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check join_reader_pool(unsigned int threads,
+				  struct reader_pool_client *client,
+				  struct reader_pool **pool_ptr);
+
+/**
+ * Leave a reader pool, waiting until no pool thread is doing the client's
+ * work. The last client to leave frees the pool.
+ *
+ * @param pool    the pool
+ * @param client  the client registration given to join_reader_pool()
+ **/
+void leave_reader_pool(struct reader_pool *pool,
+		       struct reader_pool_client *client);
+
+/**
+ * Tell the threads of a reader pool that a client has queued work.
+ *
+ * @param pool  the pool
+ **/
+void signal_reader_pool(struct reader_pool *pool);
+
+/**
+ * Get the number of threads in a reader pool.
+ *
+ * @param pool  the pool
+ *
+ * @return the number of threads
+ **/
+unsigned int get_reader_pool_thread_count(struct reader_pool *pool);
+
+#endif /* READER_POOL_H */
@@ -21,8 +21,31 @@
 
 #include "recordPage.h"
 
+#define ZLIB_CONST
+#include <zlib.h>
+
+#include "cpu.h"
+#include "ioFactory.h"
+#include "numeric.h"
 #include "permassert.h"
 
+/*
+ * A packed record page starts with a magic number and the size of the
+ * compressed metadata, followed by the names of the records in page order
+ * and then a raw deflate stream of their metadata. Chunk names are hashes
+ * which do not compress, so only the metadata is worth the deflate time.
+ * The stream uses a window no larger than the compressed cache's, since
+ * the records which repeat each other's metadata are close together.
+ */
+enum {
+	PACKED_MAGIC_SIZE = 8,
+	PACKED_HEADER_SIZE = PACKED_MAGIC_SIZE + sizeof(uint32_t),
+	PACKED_COMPRESSION_LEVEL = 1,
+	PACKED_WINDOW_BITS = -12,
+	PACKED_MEMORY_LEVEL = 8,
+};
+static const byte PACKED_MAGIC[] = "UDSRPZ01";
+
 /**********************************************************************/
 static unsigned int
 encode_tree(byte record_page[],
@@ -56,14 +79,14 @@ encode_tree(byte record_page[],
 }
 
 /**********************************************************************/
-int encode_record_page(const struct volume *volume,
+int encode_record_page(const struct geometry *geometry,
+		       struct radix_sorter *sorter,
+		       const struct uds_chunk_record **record_pointers,
 		       const struct uds_chunk_record records[],
 		       byte record_page[])
 {
 	int result;
-	unsigned int records_per_page = volume->geometry->records_per_page;
-	const struct uds_chunk_record **record_pointers =
-		volume->record_pointers;
+	unsigned int records_per_page = geometry->records_per_page;
 
 	// Build an array of record pointers. We'll sort the pointers by the
 	// block names in the records, which is less work than sorting the
@@ -74,7 +97,7 @@ int encode_record_page(const struct volume *volume,
 	}
 
 	STATIC_ASSERT(offsetof(struct uds_chunk_record, name) == 0);
-	result = radix_sort(volume->radix_sorter,
+	result = radix_sort(sorter,
 				(const byte **) record_pointers,
 				records_per_page,
 				UDS_CHUNK_NAME_SIZE);
@@ -88,22 +111,61 @@ int encode_record_page(const struct volume *volume,
 	return UDS_SUCCESS;
 }
 
-/**********************************************************************/
-bool search_record_page(const byte record_page[],
-			const struct uds_chunk_name *name,
-			const struct geometry *geometry,
-			struct uds_chunk_data *metadata)
+/**
+ * Compare a chunk name, given as two big-endian words, to the name of a
+ * record. This orders names the same way memcmp() does.
+ *
+ * @param high    The first eight bytes of the name
+ * @param low     The last eight bytes of the name
+ * @param record  The record to compare against
+ *
+ * @return a negative, zero, or positive value as the name sorts before,
+ *         equal to, or after the name of the record
+ **/
+static INLINE int compare_record_name(uint64_t high,
+				      uint64_t low,
+				      const struct uds_chunk_record *record)
 {
-	// The record page is just an array of chunk records.
-	const struct uds_chunk_record *records =
-		(const struct uds_chunk_record *) record_page;
+	uint64_t record_high = get_unaligned_be64(&record->name.name[0]);
+	uint64_t record_low = get_unaligned_be64(&record->name.name[8]);
+
+	if (high != record_high) {
+		return ((high < record_high) ? -1 : 1);
+	}
+	if (low != record_low) {
+		return ((low < record_low) ? -1 : 1);
+	}
+	return 0;
+}
 
+/**
+ * Search the binary tree of a record page. This is inlined with a constant
+ * record count for the standard page size, which bounds the descent.
+ **/
+static INLINE bool search_record_tree(const struct uds_chunk_record *records,
+				      unsigned int records_per_page,
+				      uint64_t high,
+				      uint64_t low,
+				      struct uds_chunk_data *metadata)
+{
 	// The array of records is sorted by name and stored as a binary tree
 	// in heap order, so the root of the tree is the first array element.
 	unsigned int node = 0;
-	while (node < geometry->records_per_page) {
+	while (node < records_per_page) {
 		const struct uds_chunk_record *record = &records[node];
-		int result = memcmp(name, &record->name, UDS_CHUNK_NAME_SIZE);
+		// The four grandchildren of node N are adjacent in the heap,
+		// starting at index 4N+3. Fetch them while this node and its
+		// child are compared.
+		unsigned int grandchild = (4 * node) + 3;
+		int result;
+
+		if (grandchild < records_per_page) {
+			prefetch_range(&records[grandchild],
+				       4 * sizeof(struct uds_chunk_record),
+				       false);
+		}
+
+		result = compare_record_name(high, low, record);
 		if (result == 0) {
 			if (metadata != NULL) {
 				*metadata = record->data;
@@ -116,3 +178,157 @@ bool search_record_page(const byte record_page[],
 	}
 	return false;
 }
+
+/**********************************************************************/
+bool search_record_page(const byte record_page[],
+			const struct uds_chunk_name *name,
+			const struct geometry *geometry,
+			struct uds_chunk_data *metadata)
+{
+	// The record page is just an array of chunk records.
+	const struct uds_chunk_record *records =
+		(const struct uds_chunk_record *) record_page;
+	uint64_t high = get_unaligned_be64(&name->name[0]);
+	uint64_t low = get_unaligned_be64(&name->name[8]);
+
+	if (geometry->shape != GEOMETRY_SHAPE_CUSTOM) {
+		return search_record_tree(records, DEFAULT_RECORDS_PER_PAGE,
+					  high, low, metadata);
+	}
+	return search_record_tree(records, geometry->records_per_page, high,
+				  low, metadata);
+}
+
+/**********************************************************************/
+size_t pack_record_page(const struct geometry *geometry,
+			byte record_page[],
+			byte scratch[])
+{
+	size_t bytes_per_page = geometry->bytes_per_page;
+	unsigned int records_per_page = geometry->records_per_page;
+	size_t names_size = records_per_page * UDS_CHUNK_NAME_SIZE;
+	size_t metadata_size = records_per_page * UDS_METADATA_SIZE;
+	// Packing is only worth it if the page can be read in fewer blocks.
+	size_t limit = (((bytes_per_page - 1) / UDS_BLOCK_SIZE) *
+			UDS_BLOCK_SIZE);
+	z_stream stream = {
+		.next_in = scratch,
+		.avail_in = metadata_size,
+		.next_out = &scratch[metadata_size],
+	};
+	size_t packed_size;
+	unsigned int i;
+	int result;
+
+	if (limit <= PACKED_HEADER_SIZE + names_size) {
+		return bytes_per_page;
+	}
+
+	// Gather the metadata, and compress it into the rest of the scratch
+	// buffer.
+	for (i = 0; i < records_per_page; i++) {
+		memcpy(&scratch[i * UDS_METADATA_SIZE],
+		       &record_page[(i * BYTES_PER_RECORD) +
+				    UDS_CHUNK_NAME_SIZE],
+		       UDS_METADATA_SIZE);
+	}
+	stream.avail_out = min(limit - PACKED_HEADER_SIZE - names_size,
+			       bytes_per_page - metadata_size);
+	if (deflateInit2(&stream, PACKED_COMPRESSION_LEVEL, Z_DEFLATED,
+			 PACKED_WINDOW_BITS, PACKED_MEMORY_LEVEL,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		return bytes_per_page;
+	}
+	result = deflate(&stream, Z_FINISH);
+	deflateEnd(&stream);
+	if (result != Z_STREAM_END) {
+		return bytes_per_page;
+	}
+
+	// Each name moves down to a place which no later name occupies.
+	for (i = 0; i < records_per_page; i++) {
+		memmove(&record_page[PACKED_HEADER_SIZE +
+				     (i * UDS_CHUNK_NAME_SIZE)],
+			&record_page[i * BYTES_PER_RECORD],
+			UDS_CHUNK_NAME_SIZE);
+	}
+	memcpy(record_page, PACKED_MAGIC, PACKED_MAGIC_SIZE);
+	put_unaligned_le32(stream.total_out,
+			   &record_page[PACKED_MAGIC_SIZE]);
+	packed_size = PACKED_HEADER_SIZE + names_size;
+	memcpy(&record_page[packed_size], &scratch[metadata_size],
+	       stream.total_out);
+	packed_size += stream.total_out;
+	memset(&record_page[packed_size], 0, bytes_per_page - packed_size);
+	return packed_size;
+}
+
+/**********************************************************************/
+size_t get_stored_record_page_size(const struct geometry *geometry,
+				   const byte data[])
+{
+	size_t packed_size;
+
+	if (memcmp(data, PACKED_MAGIC, PACKED_MAGIC_SIZE) != 0) {
+		return geometry->bytes_per_page;
+	}
+	packed_size = (PACKED_HEADER_SIZE +
+		       (geometry->records_per_page * UDS_CHUNK_NAME_SIZE) +
+		       get_unaligned_le32(&data[PACKED_MAGIC_SIZE]));
+	return min(packed_size, (size_t) geometry->bytes_per_page);
+}
+
+/**********************************************************************/
+void unpack_record_page(const struct geometry *geometry,
+			const byte data[],
+			byte record_page[])
+{
+	size_t bytes_per_page = geometry->bytes_per_page;
+	unsigned int records_per_page = geometry->records_per_page;
+	size_t names_size = records_per_page * UDS_CHUNK_NAME_SIZE;
+	size_t metadata_size = records_per_page * UDS_METADATA_SIZE;
+	size_t stored_size = get_stored_record_page_size(geometry, data);
+	z_stream stream = {
+		.next_in = &data[PACKED_HEADER_SIZE + names_size],
+		.next_out = &record_page[bytes_per_page - metadata_size],
+		.avail_out = metadata_size,
+	};
+	unsigned int i;
+	int result;
+
+	if ((stored_size == bytes_per_page) ||
+	    (inflateInit2(&stream, PACKED_WINDOW_BITS) != Z_OK)) {
+		memcpy(record_page, data, bytes_per_page);
+		return;
+	}
+	stream.avail_in = stored_size - PACKED_HEADER_SIZE - names_size;
+	result = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+	if ((result != Z_STREAM_END) || (stream.avail_out != 0)) {
+		// Anything which does not inflate fully is taken as it is.
+		memcpy(record_page, data, bytes_per_page);
+		return;
+	}
+
+	/*
+	 * The metadata was inflated into the end of the page. Rebuild the
+	 * records from the front, which only overwrites metadata that has
+	 * already been used, except for the last record's own.
+	 */
+	for (i = 0; i < records_per_page; i++) {
+		byte metadata[UDS_METADATA_SIZE];
+
+		memcpy(metadata,
+		       &record_page[bytes_per_page - metadata_size +
+				    (i * UDS_METADATA_SIZE)],
+		       UDS_METADATA_SIZE);
+		memcpy(&record_page[i * BYTES_PER_RECORD],
+		       &data[PACKED_HEADER_SIZE + (i * UDS_CHUNK_NAME_SIZE)],
+		       UDS_CHUNK_NAME_SIZE);
+		memcpy(&record_page[(i * BYTES_PER_RECORD) +
+				    UDS_CHUNK_NAME_SIZE],
+		       metadata, UDS_METADATA_SIZE);
+	}
+	memset(&record_page[records_per_page * BYTES_PER_RECORD], 0,
+	       bytes_per_page - (records_per_page * BYTES_PER_RECORD));
+}
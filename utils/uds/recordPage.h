@@ -29,13 +29,18 @@
  * Generate the on-disk encoding of a record page from the list of records
  * in the open chapter representation.
  *
- * @param volume       The volume
- * @param records      The records to be encoded
- * @param record_page  The record page
+ * @param geometry         The geometry of the volume
+ * @param sorter           The radix sorter to sort the records with
+ * @param record_pointers  An array of records_per_page record pointers to
+ *                         sort
+ * @param records          The records to be encoded
+ * @param record_page      The record page
  *
  * @return UDS_SUCCESS or an error code
  **/
-int encode_record_page(const struct volume *volume,
+int encode_record_page(const struct geometry *geometry,
+		       struct radix_sorter *sorter,
+		       const struct uds_chunk_record **record_pointers,
 		       const struct uds_chunk_record records[],
 		       byte record_page[]);
 
@@ -55,4 +60,47 @@ bool search_record_page(const byte record_page[],
 			const struct geometry *geometry,
 			struct uds_chunk_data *metadata);
 
+/**
+ * Pack an encoded record page for storage by compressing it in place, if
+ * that lets it be read back in fewer blocks. A packed page starts with a
+ * header which the readers of record pages recognize, and the remainder of
+ * the page is zeroed.
+ *
+ * @param geometry     The geometry of the volume
+ * @param record_page  The encoded record page
+ * @param scratch      A buffer of a full page for compressing the page
+ *
+ * @return the number of leading bytes of the page which hold its contents,
+ *         which is a full page if the page was left as it was
+ **/
+size_t pack_record_page(const struct geometry *geometry,
+			byte record_page[],
+			byte scratch[]);
+
+/**
+ * Find how much of a stored record page must be read to unpack it.
+ *
+ * @param geometry  The geometry of the volume
+ * @param data      The start of the stored page, of at least one block
+ *
+ * @return the number of leading bytes of the page which hold its contents
+ **/
+size_t __must_check get_stored_record_page_size(const struct geometry *geometry,
+						const byte data[]);
+
+/**
+ * Unpack a stored record page into a record page buffer, inflating it if it
+ * was packed and copying it otherwise.
+ *
+ * @param geometry     The geometry of the volume
+ * @param data         A full page buffer holding at least the number of
+ *                     leading bytes of the stored page given by
+ *                     get_stored_record_page_size()
+ * @param record_page  The buffer for the record page, which must not
+ *                     overlap the stored page
+ **/
+void unpack_record_page(const struct geometry *geometry,
+			const byte data[],
+			byte record_page[]);
+
 #endif /* RECORDPAGE_H */
@@ -41,6 +41,7 @@ enum region_kind {
 	RL_KIND_INDEX_PAGE_MAP = 301,
 	RL_KIND_VOLUME_INDEX = 302,
 	RL_KIND_OPEN_CHAPTER = 303,
+	RL_KIND_WARM_LIST = 304,
 	RL_KIND_INDEX_STATE = 401, // not saved as region
 };
 
@@ -25,16 +25,21 @@
 #include "indexSession.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
 #include "permassert.h"
 #include "requestQueue.h"
 
-/**********************************************************************/
-int uds_start_chunk_operation(struct uds_request *request)
+/**
+ * Check that a request from the application is well formed.
+ *
+ * @param request  The request to check
+ *
+ * @return UDS_SUCCESS or -EINVAL
+ **/
+static int validate_chunk_operation(const struct uds_request *request)
 {
-	size_t internal_size;
-	int result;
-
-	if (request->callback == NULL) {
+	if ((request->callback == NULL) &&
+	    (READ_ONCE(request->session->completion_queue) == NULL)) {
 		uds_log_error("missing required callback");
 		return -EINVAL;
 	}
@@ -48,22 +53,120 @@ int uds_start_chunk_operation(struct uds_request *request)
 		uds_log_error("received invalid callback type");
 		return -EINVAL;
 	}
+	if ((unsigned int) request->priority >= UDS_PRIORITY_COUNT) {
+		uds_log_error("received invalid request priority");
+		return -EINVAL;
+	}
+	return UDS_SUCCESS;
+}
 
-	// Reset all internal fields before processing.
-	internal_size = sizeof(struct uds_request)
+/**
+ * Reset the internal fields of a request before it enters the index.
+ *
+ * @param request  The request to reset
+ **/
+static void reset_chunk_operation(struct uds_request *request, ktime_t now)
+{
+	size_t internal_size = sizeof(struct uds_request)
 		- offsetof(struct uds_request, zone_number);
 	memset(&request->zone_number, 0, internal_size);
 
-	result = get_index_session(request->session);
+	request->found = false;
+	request->unbatched = false;
+	request->interactive =
+		((request->priority == UDS_PRIORITY_INTERACTIVE) &&
+		 (request->type == UDS_QUERY) && !request->update);
+	request->index = request->session->index;
+	request->start_time = now;
+}
+
+/**********************************************************************/
+int uds_start_chunk_operation(struct uds_request *request)
+{
+	unsigned int epoch;
+	int result = validate_chunk_operation(request);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
 
-	request->found = false;
-	request->unbatched = false;
-	request->index = request->session->index;
+	result = get_index_session(request->session, &epoch);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	reset_chunk_operation(request, current_time_ns(CLOCK_MONOTONIC));
+	request->session_epoch = epoch;
+	enqueue_request(request, STAGE_INDEX);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_try_start_chunk_operation(struct uds_request *request,
+				  unsigned int max_backlog)
+{
+	struct uds_index *index;
+	unsigned int epoch, zone;
+	int result = validate_chunk_operation(request);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = get_index_session(request->session, &epoch);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	index = request->session->index;
+	zone = get_volume_index_zone(index->volume_index,
+				     &request->chunk_name);
+	if (uds_get_request_queue_depth(index->zone_queues[zone]) >=
+	    max_backlog) {
+		release_index_session(request->session, epoch);
+		return -EBUSY;
+	}
+
+	reset_chunk_operation(request, current_time_ns(CLOCK_MONOTONIC));
+	request->session_epoch = epoch;
+	enqueue_request(request, STAGE_INDEX);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_start_chunk_operations(struct uds_request **requests,
+			       unsigned int count)
+{
+	struct uds_index_session *session;
+	unsigned int i, epoch;
+	ktime_t now;
+	int result;
+
+	if (count == 0) {
+		return UDS_SUCCESS;
+	}
 
-	enqueue_request(request, STAGE_TRIAGE);
+	session = requests[0]->session;
+	for (i = 0; i < count; i++) {
+		result = validate_chunk_operation(requests[i]);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		if (requests[i]->session != session) {
+			uds_log_error("requests in a batch must share a session");
+			return -EINVAL;
+		}
+	}
+
+	result = get_index_session_references(session, count, &epoch);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	now = current_time_ns(CLOCK_MONOTONIC);
+	for (i = 0; i < count; i++) {
+		reset_chunk_operation(requests[i], now);
+		requests[i]->session_epoch = epoch;
+	}
+	enqueue_requests(requests, count, STAGE_INDEX);
 	return UDS_SUCCESS;
 }
 
@@ -73,7 +176,7 @@ int launch_zone_message(struct uds_zone_message message,
 			struct uds_index *index)
 {
 	struct uds_request *request;
-	int result = UDS_ALLOCATE(1, struct uds_request, __func__, &request);
+	int result = get_pooled_request(index->message_pool, &request);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
@@ -112,6 +215,46 @@ void enqueue_request(struct uds_request *request,
 	uds_request_queue_enqueue(next_queue, request);
 }
 
+/**********************************************************************/
+void enqueue_requests(struct uds_request **requests,
+		      unsigned int count,
+		      enum request_stage next_stage)
+{
+	struct uds_request_queue *queues[ENQUEUE_BATCH_SIZE];
+	struct uds_request *group[ENQUEUE_BATCH_SIZE];
+	unsigned int start;
+
+	for (start = 0; start < count; start += ENQUEUE_BATCH_SIZE) {
+		unsigned int size = min(count - start,
+					(unsigned int) ENQUEUE_BATCH_SIZE);
+		unsigned int i;
+		for (i = 0; i < size; i++) {
+			queues[i] = get_next_stage_queue(requests[start + i],
+							 next_stage);
+		}
+
+		// Gather the requests for each queue in turn, preserving
+		// their order, and enqueue each group with one wakeup.
+		for (i = 0; i < size; i++) {
+			struct uds_request_queue *queue = queues[i];
+			unsigned int group_size = 0;
+			unsigned int j;
+			if (queue == NULL) {
+				continue;
+			}
+			for (j = i; j < size; j++) {
+				if (queues[j] == queue) {
+					group[group_size++] =
+						requests[start + j];
+					queues[j] = NULL;
+				}
+			}
+			uds_request_queue_enqueue_batch(queue, group,
+							group_size);
+		}
+	}
+}
+
 /*
  * This function pointer allows unit test code to intercept the slow-lane
  * requeuing of a request.
@@ -231,3 +374,85 @@ void enter_callback_stage(struct uds_request *request)
 	// Handle asynchronous client callbacks in the designated thread.
 	enqueue_request(request, STAGE_CALLBACK);
 }
+
+/**********************************************************************/
+static void record_latency(struct uds_latency_histogram *histogram,
+			   ktime_t start,
+			   ktime_t end)
+{
+	uint64_t latency = ((end > start) ? (end - start) : 0);
+	// Bucket 0 holds latencies below 2 nanoseconds, including zero.
+	unsigned int bucket = ((latency < 2) ?
+				       0 :
+				       (63 - __builtin_clzll(latency)));
+	if (bucket >= UDS_LATENCY_BUCKETS) {
+		bucket = UDS_LATENCY_BUCKETS - 1;
+	}
+	WRITE_ONCE(histogram->counts[bucket], histogram->counts[bucket] + 1);
+}
+
+/**********************************************************************/
+void update_request_latency_stats(struct uds_request *request)
+{
+	/*
+	 * As with the context stats, no synchronization is needed since the
+	 * histograms are only modified from the single callback thread.
+	 */
+	struct uds_index_latency_stats *latency = &request->session->latency;
+	struct uds_latency_histogram *stages;
+	ktime_t now = current_time_ns(CLOCK_MONOTONIC);
+	ktime_t finished = request->zone_time;
+
+	if (request->zone_number >= UDS_LATENCY_MAX_ZONES) {
+		return;
+	}
+	stages = latency->zones[request->zone_number];
+
+	record_latency(&stages[UDS_LATENCY_ZONE_QUEUE], request->start_time,
+		       request->zone_time);
+	if (request->read_time != 0) {
+		record_latency(&stages[UDS_LATENCY_PAGE_READ],
+			       request->zone_time, request->read_time);
+		finished = request->read_time;
+	}
+	record_latency(&stages[UDS_LATENCY_CALLBACK], finished, now);
+	record_latency(&stages[UDS_LATENCY_TOTAL], request->start_time, now);
+	record_latency(&latency->priorities[(request->interactive ?
+					     UDS_PRIORITY_INTERACTIVE :
+					     UDS_PRIORITY_BULK)],
+		       request->start_time, now);
+}
+
+/**********************************************************************/
+void update_request_chapter_age_stats(struct uds_request *request)
+{
+	// Only the callback thread modifies the histograms.
+	struct uds_chapter_age_histogram *histogram;
+	uint64_t age = request->chapter_age;
+	// Bucket 0 holds only age zero, the open chapter.
+	unsigned int bucket = ((age == 0) ? 0 : (64 - __builtin_clzll(age)));
+	enum uds_hit_kind kind;
+
+	switch (request->location) {
+	case UDS_LOCATION_IN_OPEN_CHAPTER:
+		kind = UDS_HIT_OPEN_CHAPTER;
+		break;
+	case UDS_LOCATION_IN_DENSE:
+		kind = UDS_HIT_DENSE;
+		break;
+	case UDS_LOCATION_IN_SPARSE:
+		kind = UDS_HIT_SPARSE;
+		break;
+	default:
+		return;
+	}
+	if (request->page_cache_hit) {
+		kind = UDS_HIT_PAGE_CACHE;
+	}
+
+	if (bucket >= UDS_CHAPTER_AGE_BUCKETS) {
+		bucket = UDS_CHAPTER_AGE_BUCKETS - 1;
+	}
+	histogram = &request->session->chapter_ages[kind];
+	WRITE_ONCE(histogram->counts[bucket], histogram->counts[bucket] + 1);
+}
@@ -34,12 +34,18 @@
  * life-cycle of a request.
  **/
 enum request_stage {
-	STAGE_TRIAGE,
 	STAGE_INDEX,
 	STAGE_CALLBACK,
 	STAGE_MESSAGE,
 };
 
+/**
+ * The largest number of requests enqueued on a queue with a single wakeup.
+ **/
+enum {
+	ENQUEUE_BATCH_SIZE = 64,
+};
+
 typedef void (*request_restarter_t)(struct uds_request *);
 
 /**
@@ -56,6 +62,19 @@ int __must_check launch_zone_message(struct uds_zone_message message,
 				     unsigned int zone,
 				     struct uds_index *index);
 
+/**
+ * Enqueue several requests for the next stage of the pipeline. The requests
+ * are grouped by destination queue, and each queue is woken at most once for
+ * each group of up to ENQUEUE_BATCH_SIZE requests.
+ *
+ * @param requests      The requests to enqueue
+ * @param count         The number of requests
+ * @param next_stage    The next stage of the pipeline to process the requests
+ **/
+void enqueue_requests(struct uds_request **requests,
+		      unsigned int count,
+		      enum request_stage next_stage);
+
 /**
  * Enqueue a request for the next stage of the pipeline. If there is more than
  * one possible queue for a stage, this function uses the request to decide
@@ -101,6 +120,22 @@ void enter_callback_stage(struct uds_request *request);
  **/
 void update_request_context_stats(struct uds_request *request);
 
+/**
+ * Update the latency histograms to reflect the successful completion of a
+ * client request.
+ *
+ * @param request  a client request that has successfully completed execution
+ **/
+void update_request_latency_stats(struct uds_request *request);
+
+/**
+ * Update the chapter age histograms to reflect the successful completion of a
+ * client request which found its chunk name.
+ *
+ * @param request  a client request that has successfully completed execution
+ **/
+void update_request_chapter_age_stats(struct uds_request *request);
+
 /**
  * Compute the cache_probe_type value reflecting the request and page type.
  *
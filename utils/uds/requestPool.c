@@ -0,0 +1,344 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/requestPool.c#1 $
+ */
+
+#include "requestPool.h"
+
+#include "cpu.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "stringUtils.h"
+#include "uds-threads.h"
+
+enum {
+	/* The most shards a pool will divide its free requests among */
+	MAX_REQUEST_POOL_SHARDS = 16,
+	/* The number of requests allocated each time a pool grows */
+	REQUEST_POOL_SLAB_SIZE = 256,
+};
+
+/*
+ * Padding each request to a whole number of cache lines keeps two requests
+ * in flight on different threads from sharing a line.
+ */
+struct __attribute__((aligned(CACHE_LINE_BYTES))) pooled_request {
+	struct uds_request request;
+};
+
+struct __attribute__((aligned(CACHE_LINE_BYTES))) request_slab {
+	struct request_slab *next;
+	struct pooled_request requests[];
+};
+
+struct __attribute__((aligned(CACHE_LINE_BYTES))) request_pool_shard {
+	struct mutex mutex;
+	/* The free requests, linked through next_request */
+	struct uds_request *free_list;
+	unsigned int free_count;
+	uint64_t gets;
+	uint64_t puts;
+	uint64_t steals;
+};
+
+struct request_pool {
+	struct mutex slab_mutex;
+	struct request_slab *slabs;
+	uint64_t capacity;
+	uint64_t grows;
+	unsigned int shard_count;
+	struct request_pool_shard shards[];
+};
+
+/*
+ * The shard a thread uses, offset by one so that zero means not yet chosen.
+ * Looking it up once per thread keeps a system call off the request path.
+ */
+static __thread unsigned int thread_shard_hint;
+
+/**
+ * Choose the shard used by the current thread.
+ *
+ * @param pool  The pool
+ *
+ * @return The shard of the current thread
+ **/
+static struct request_pool_shard *get_thread_shard(struct request_pool *pool)
+{
+	if (thread_shard_hint == 0) {
+		thread_shard_hint = ((unsigned int) uds_get_thread_id()
+				     % MAX_REQUEST_POOL_SHARDS) + 1;
+	}
+
+	return &pool->shards[(thread_shard_hint - 1) % pool->shard_count];
+}
+
+/**
+ * Allocate a slab of requests and link all but the first of them onto a
+ * shard.
+ *
+ * @param pool         The pool
+ * @param shard        The shard to receive the new free requests
+ * @param request_ptr  A pointer to hold the first new request
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int grow_request_pool(struct request_pool *pool,
+			     struct request_pool_shard *shard,
+			     struct uds_request **request_ptr)
+{
+	struct uds_request *free_list = NULL;
+	struct request_slab *slab;
+	unsigned int i;
+	int result = UDS_ALLOCATE_EXTENDED(struct request_slab,
+					   REQUEST_POOL_SLAB_SIZE,
+					   struct pooled_request,
+					   "request pool slab",
+					   &slab);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	for (i = REQUEST_POOL_SLAB_SIZE - 1; i > 0; i--) {
+		slab->requests[i].request.next_request = free_list;
+		free_list = &slab->requests[i].request;
+	}
+
+	uds_lock_mutex(&pool->slab_mutex);
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+	pool->capacity += REQUEST_POOL_SLAB_SIZE;
+	pool->grows++;
+	uds_unlock_mutex(&pool->slab_mutex);
+
+	uds_lock_mutex(&shard->mutex);
+	slab->requests[REQUEST_POOL_SLAB_SIZE - 1].request.next_request =
+		shard->free_list;
+	shard->free_list = free_list;
+	shard->free_count += REQUEST_POOL_SLAB_SIZE - 1;
+	uds_unlock_mutex(&shard->mutex);
+
+	*request_ptr = &slab->requests[0].request;
+	return UDS_SUCCESS;
+}
+
+/**
+ * Refill an empty shard by taking the whole free list of another shard.
+ * Only one shard lock is held at a time.
+ *
+ * @param pool   The pool
+ * @param shard  The empty shard
+ *
+ * @return true if any requests were taken
+ **/
+static bool steal_free_requests(struct request_pool *pool,
+				struct request_pool_shard *shard)
+{
+	unsigned int offset;
+	unsigned int first = shard - pool->shards;
+	for (offset = 1; offset < pool->shard_count; offset++) {
+		struct request_pool_shard *victim =
+			&pool->shards[(first + offset) % pool->shard_count];
+		struct uds_request *free_list, *last;
+		unsigned int free_count;
+
+		uds_lock_mutex(&victim->mutex);
+		free_list = victim->free_list;
+		free_count = victim->free_count;
+		victim->free_list = NULL;
+		victim->free_count = 0;
+		uds_unlock_mutex(&victim->mutex);
+		if (free_list == NULL) {
+			continue;
+		}
+
+		for (last = free_list; last->next_request != NULL;
+		     last = last->next_request) {
+		}
+
+		uds_lock_mutex(&shard->mutex);
+		last->next_request = shard->free_list;
+		shard->free_list = free_list;
+		shard->free_count += free_count;
+		shard->steals++;
+		uds_unlock_mutex(&shard->mutex);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Pop a free request from a shard.
+ *
+ * @param shard  The shard
+ *
+ * @return The request, or NULL if the shard is empty
+ **/
+static struct uds_request *pop_free_request(struct request_pool_shard *shard)
+{
+	struct uds_request *request;
+	uds_lock_mutex(&shard->mutex);
+	request = shard->free_list;
+	if (request != NULL) {
+		shard->free_list = request->next_request;
+		shard->free_count--;
+		shard->gets++;
+	}
+	uds_unlock_mutex(&shard->mutex);
+	return request;
+}
+
+/**********************************************************************/
+int make_request_pool(unsigned int initial_requests,
+		      struct request_pool **pool_ptr)
+{
+	struct request_pool *pool;
+	unsigned int shard_count = min(max(uds_get_num_cores(), 1U),
+				       (unsigned int) MAX_REQUEST_POOL_SHARDS);
+	unsigned int i;
+	int result = UDS_ALLOCATE_EXTENDED(struct request_pool,
+					   shard_count,
+					   struct request_pool_shard,
+					   "request pool",
+					   &pool);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = uds_init_mutex(&pool->slab_mutex);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(pool);
+		return result;
+	}
+
+	for (i = 0; i < shard_count; i++) {
+		result = uds_init_mutex(&pool->shards[i].mutex);
+		if (result != UDS_SUCCESS) {
+			free_request_pool(pool);
+			return result;
+		}
+		pool->shard_count++;
+	}
+
+	/*
+	 * Grow the pool until it holds the initial requests, spreading them
+	 * over the shards so that no thread must steal on its first get.
+	 */
+	for (i = 0; pool->capacity < initial_requests; i++) {
+		struct uds_request *request;
+		struct request_pool_shard *shard =
+			&pool->shards[i % pool->shard_count];
+		result = grow_request_pool(pool, shard, &request);
+		if (result != UDS_SUCCESS) {
+			free_request_pool(pool);
+			return result;
+		}
+		uds_lock_mutex(&shard->mutex);
+		request->next_request = shard->free_list;
+		shard->free_list = request;
+		shard->free_count++;
+		uds_unlock_mutex(&shard->mutex);
+	}
+	pool->grows = 0;
+
+	*pool_ptr = pool;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void free_request_pool(struct request_pool *pool)
+{
+	unsigned int i;
+	if (pool == NULL) {
+		return;
+	}
+
+	while (pool->slabs != NULL) {
+		struct request_slab *slab = pool->slabs;
+		pool->slabs = slab->next;
+		UDS_FREE(slab);
+	}
+
+	for (i = 0; i < pool->shard_count; i++) {
+		uds_destroy_mutex(&pool->shards[i].mutex);
+	}
+	uds_destroy_mutex(&pool->slab_mutex);
+	UDS_FREE(pool);
+}
+
+/**********************************************************************/
+int get_pooled_request(struct request_pool *pool,
+		       struct uds_request **request_ptr)
+{
+	struct request_pool_shard *shard = get_thread_shard(pool);
+	struct uds_request *request = pop_free_request(shard);
+	while ((request == NULL) && steal_free_requests(pool, shard)) {
+		request = pop_free_request(shard);
+	}
+
+	if (request == NULL) {
+		int result = grow_request_pool(pool, shard, &request);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		uds_lock_mutex(&shard->mutex);
+		shard->gets++;
+		uds_unlock_mutex(&shard->mutex);
+	}
+
+	memset(request, 0, sizeof(*request));
+	*request_ptr = request;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void put_pooled_request(struct request_pool *pool,
+			struct uds_request *request)
+{
+	struct request_pool_shard *shard = get_thread_shard(pool);
+	uds_lock_mutex(&shard->mutex);
+	request->next_request = shard->free_list;
+	shard->free_list = request;
+	shard->free_count++;
+	shard->puts++;
+	uds_unlock_mutex(&shard->mutex);
+}
+
+/**********************************************************************/
+void get_request_pool_stats(struct request_pool *pool,
+			    struct uds_request_pool_stats *stats)
+{
+	unsigned int i;
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < pool->shard_count; i++) {
+		struct request_pool_shard *shard = &pool->shards[i];
+		uds_lock_mutex(&shard->mutex);
+		stats->free += shard->free_count;
+		stats->gets += shard->gets;
+		stats->puts += shard->puts;
+		stats->steals += shard->steals;
+		uds_unlock_mutex(&shard->mutex);
+	}
+
+	uds_lock_mutex(&pool->slab_mutex);
+	stats->capacity = pool->capacity;
+	stats->grows = pool->grows;
+	uds_unlock_mutex(&pool->slab_mutex);
+}
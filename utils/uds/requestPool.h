@@ -0,0 +1,90 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/requestPool.h#1 $
+ */
+
+#ifndef REQUEST_POOL_H
+#define REQUEST_POOL_H
+
+#include "compiler.h"
+#include "typeDefs.h"
+#include "uds.h"
+
+/**
+ * A request_pool recycles uds_request structures so that a steady stream of
+ * requests neither allocates nor frees memory. Each request occupies its own
+ * cache lines. The free requests are kept on a set of shards, each with its
+ * own lock, and a thread always gets and puts requests on the same shard, so
+ * the locks are normally uncontended. Since requests are usually returned on
+ * a different thread (the callback thread) than the one which got them, a
+ * thread whose shard is empty takes the whole free list of another shard at
+ * once. Only when every shard is empty does the pool grow, by a slab of
+ * requests which are never freed until the pool is.
+ **/
+struct request_pool;
+
+/**
+ * Make a request pool.
+ *
+ * @param initial_requests  The number of requests to allocate at once
+ * @param pool_ptr          A pointer to hold the new pool
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check make_request_pool(unsigned int initial_requests,
+				   struct request_pool **pool_ptr);
+
+/**
+ * Free a request pool and every request it has allocated. No request got
+ * from the pool may be in use.
+ *
+ * @param pool  The pool to free
+ **/
+void free_request_pool(struct request_pool *pool);
+
+/**
+ * Get a zeroed request from a pool.
+ *
+ * @param pool         The pool
+ * @param request_ptr  A pointer to hold the request
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check get_pooled_request(struct request_pool *pool,
+				    struct uds_request **request_ptr);
+
+/**
+ * Return a request to the pool it was got from.
+ *
+ * @param pool     The pool
+ * @param request  The request to return
+ **/
+void put_pooled_request(struct request_pool *pool,
+			struct uds_request *request);
+
+/**
+ * Gather the statistics of a request pool.
+ *
+ * @param pool   The pool
+ * @param stats  The statistics structure to fill
+ **/
+void get_request_pool_stats(struct request_pool *pool,
+			    struct uds_request_pool_stats *stats);
+
+#endif /* REQUEST_POOL_H */
@@ -23,14 +23,34 @@
 #define REQUEST_QUEUE_H
 
 #include "compiler.h"
+#include "threadAffinity.h"
 #include "typeDefs.h"
 #include "uds.h"
 
 struct uds_request_queue;
 
+/**
+ * Counters describing how an idle worker thread waited for requests. They
+ * are only maintained when the queue parks its worker on a futex.
+ **/
+struct uds_request_queue_stats {
+	uint64_t spins; // times the worker spun polling for a request
+	uint64_t parks; // times the worker went to sleep on the futex
+	uint64_t wakes; // times an enqueuer woke a parked worker
+};
+
 /* void return value because this function will process its own errors */
 typedef void uds_request_queue_processor_t(struct uds_request *);
 
+/* Processes several requests taken from a queue, in the order given */
+typedef void uds_request_queue_batch_processor_t(struct uds_request **,
+						 unsigned int);
+
+enum {
+	/** The most requests handed to a batch processor at once */
+	UDS_REQUEST_QUEUE_MAX_BATCH = 16
+};
+
 /**
  * Allocate a new request processing queue and start a worker thread to
  * consume and service requests in the queue.
@@ -46,10 +66,28 @@ make_uds_request_queue(const char *queue_name,
 		       uds_request_queue_processor_t *process_one,
 		       struct uds_request_queue **queue_ptr);
 
+/**
+ * Allocate a new request processing queue whose worker thread hands the
+ * requests it finds already queued to the processor together, up to
+ * UDS_REQUEST_QUEUE_MAX_BATCH at a time.
+ *
+ * @param queue_name    the name of the queue and the worker thread
+ * @param process_many  the function the worker will invoke on each batch
+ * @param queue_ptr     a pointer to receive the new queue
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check
+make_uds_batch_request_queue(const char *queue_name,
+			     uds_request_queue_batch_processor_t *process_many,
+			     struct uds_request_queue **queue_ptr);
+
 /**
  * Add a request to the end of the queue for processing by the worker thread.
  * If the requeued flag is set on the request, it will be processed before
- * any non-requeued requests under most circumstances.
+ * any non-requeued requests under most circumstances. An interactive request
+ * is processed ahead of the normal requests queued before it, though not
+ * indefinitely while normal requests keep waiting.
  *
  * @param queue    the request queue that should process the request
  * @param request  the request to be processed on the queue's worker thread
@@ -57,6 +95,49 @@ make_uds_request_queue(const char *queue_name,
 void uds_request_queue_enqueue(struct uds_request_queue *queue,
 			       struct uds_request *request);
 
+/**
+ * Add several requests to the queue, as if by uds_request_queue_enqueue(),
+ * but waking the worker thread at most once.
+ *
+ * @param queue     the request queue that should process the requests
+ * @param requests  the requests to be processed, in order
+ * @param count     the number of requests
+ **/
+void uds_request_queue_enqueue_batch(struct uds_request_queue *queue,
+				     struct uds_request **requests,
+				     unsigned int count);
+
+/**
+ * Bind the worker thread of a request queue to the CPU for a slot.
+ *
+ * @param queue     the request queue
+ * @param affinity  the thread placement, which may be NULL
+ * @param slot      the slot number of the worker thread
+ **/
+void bind_request_queue_to_slot(struct uds_request_queue *queue,
+				const struct thread_affinity *affinity,
+				unsigned int slot);
+
+/**
+ * Get the wait counters of a request queue.
+ *
+ * @param queue  the request queue
+ * @param stats  the structure to fill in
+ **/
+void uds_get_request_queue_stats(struct uds_request_queue *queue,
+				 struct uds_request_queue_stats *stats);
+
+/**
+ * Get the number of requests waiting in a request queue. The count is read
+ * without locking, so it may be slightly out of date by the time it is
+ * returned.
+ *
+ * @param queue  the request queue
+ *
+ * @return the number of requests enqueued and not yet taken by the worker
+ **/
+unsigned int uds_get_request_queue_depth(struct uds_request_queue *queue);
+
 /**
  * Shut down the request queue worker thread, then destroy and free the queue.
  *
@@ -21,15 +21,25 @@
 
 #include "requestQueue.h"
 
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include "atomicDefs.h"
 #include "compiler.h"
 #include "logger.h"
+#include "permassert.h"
 #include "request.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
+#include "stringUtils.h"
+#include "threadOnce.h"
 #include "uds-threads.h"
 #include "timeUtils.h"
+#include "udsProbes.h"
 #include "util/eventCount.h"
 #include "util/funnelQueue.h"
+#include "util/mpscRing.h"
 
 /*
  * Ordering:
@@ -50,6 +60,17 @@
  * happening, and the enqueuing operations complete while the request
  * processing is still in progress, then the retry request(s) *will*
  * get processed next.  (This is used for testing.)
+ *
+ * Normal requests go into a bounded ring, falling back to a funnel queue
+ * when the ring is full. Once any request is in the overflow queue, all
+ * producers use it until the worker has taken every overflow request, and
+ * the worker does not hand out an overflow request while older entries
+ * remain in the ring, so the order from a single producer is preserved.
+ *
+ * Interactive requests have a queue of their own, and may be processed
+ * ahead of normal requests enqueued before them. They are only queries
+ * which change nothing, so the reordering is harmless. Interactive requests
+ * from a single producer keep their order among themselves.
  */
 
 /**
@@ -77,16 +98,62 @@ enum {
  **/
 enum {
 	MINIMUM_BATCH = 32, // wait time increases if batch smaller than this
-	MAXIMUM_BATCH = 64  // wait time decreases if batch larger than this
+	MAXIMUM_BATCH = 64, // wait time decreases if batch larger than this
+	MAXIMUM_DRAIN = UDS_REQUEST_QUEUE_MAX_BATCH // requests processed per
+						    // pass of the worker loop
+};
+
+/**
+ * The number of slots in the ring for normal requests. This must be a power
+ * of two.
+ **/
+enum {
+	MAIN_RING_SIZE = 1024
+};
+
+/**
+ * The number of interactive requests the worker takes for each normal
+ * request when both kinds are queued, so that a steady stream of
+ * interactive requests cannot starve the normal ones.
+ **/
+enum {
+	INTERACTIVE_WEIGHT = 4
 };
 
+/**
+ * The number of times an idle futex-mode worker polls its queues before
+ * parking on the futex.
+ **/
+enum {
+	FUTEX_SPIN_POLLS = 256
+};
+
+/**
+ * How an idle worker thread waits for new requests. The default uses an
+ * event count with an adaptive timeout. The futex mode spins briefly and
+ * then parks on a sequence word, so enqueuers only make a system call when
+ * the worker is actually asleep. The mode may be chosen by setting the
+ * environment variable UDS_REQUEST_QUEUE_WAIT to "event-count" or "futex".
+ **/
+static enum wait_mode {
+	WAIT_EVENT_COUNT,
+	WAIT_FUTEX
+} hidden_wait_mode = WAIT_EVENT_COUNT;
+
 struct uds_request_queue {
 	const char *name; // name of queue
 	uds_request_queue_processor_t *process_one; // function to process 1
 						    // request
+	uds_request_queue_batch_processor_t *process_many; // function to
+							   // process a batch
+							   // of requests, or
+							   // NULL
 
-	struct funnel_queue *main_queue;  // new incoming requests
+	struct mpsc_ring *main_ring;      // new incoming requests
+	struct funnel_queue *main_queue;  // new requests when the ring is full
 	struct funnel_queue *retry_queue; // old requests to retry first
+	struct funnel_queue *interactive_queue; // requests to take before
+						// normal ones
 	struct event_count *work_event;   // signal to wake the worker thread
 
 	struct thread *thread; // thread id of the worker thread
@@ -94,15 +161,53 @@ struct uds_request_queue {
 
 	bool alive;    // when true, requests can be enqueued
 
+	/** true if the worker parks on a futex rather than the event count */
+	bool use_futex;
+
+	// The following fields are shared by the enqueuers and the worker to
+	// decide when the worker must be woken. The first field is aligned so
+	// that their updates do not disturb the read-mostly fields above.
+
 	/** A flag set when the worker is waiting without a timeout */
-	atomic_t dormant;
+	atomic_t dormant __attribute__((aligned(CACHE_LINE_BYTES)));
+
+	/** The number of requests put in main_queue and not yet dequeued */
+	atomic_t overflow_count;
+
+	/** The futex word, advanced each time a parked worker is woken */
+	atomic_t futex_sequence;
+
+	/** A flag set while the worker is, or is about to be, parked */
+	atomic_t parked;
+
+	/** The number of futex wakes issued by enqueuers */
+	atomic64_t wakes;
+
+	/** The number of requests ever enqueued */
+	atomic64_t enqueued;
 
 	// The following fields are mutable state private to the worker thread.
 	// The first field is aligned to avoid cache line sharing with
 	// preceding fields.
 
+	/** an overflow request waiting for older ring entries to drain */
+	struct uds_request *held_request
+		__attribute__((aligned(CACHE_LINE_BYTES)));
+
+	/** The number of times the worker spun waiting for a request */
+	atomic64_t spins;
+
+	/** The number of times the worker parked on the futex */
+	atomic64_t parks;
+
+	/** The number of requests ever dequeued */
+	atomic64_t dequeued;
+
+	/** interactive requests which may still be taken before a normal one */
+	unsigned int interactive_credit;
+
 	/** requests processed since last wait */
-	uint64_t current_batch __attribute__((aligned(CACHE_LINE_BYTES)));
+	uint64_t current_batch;
 
 	/** the amount of time to wait to accumulate a batch of requests */
 	uint64_t wait_nanoseconds;
@@ -111,6 +216,51 @@ struct uds_request_queue {
 	ktime_t wake_rel_time;
 };
 
+/**********************************************************************/
+static void initialize_wait_mode(void)
+{
+	static const char UDS_REQUEST_QUEUE_WAIT_ENV[] =
+		"UDS_REQUEST_QUEUE_WAIT";
+
+	const char *wait_mode_string = getenv(UDS_REQUEST_QUEUE_WAIT_ENV);
+	if (wait_mode_string != NULL) {
+		if (strcmp(wait_mode_string, "event-count") == 0) {
+			hidden_wait_mode = WAIT_EVENT_COUNT;
+		} else if (strcmp(wait_mode_string, "futex") == 0) {
+			hidden_wait_mode = WAIT_FUTEX;
+		} else {
+			ASSERT_LOG_ONLY(false,
+					"environment variable %s had unexpected value '%s'",
+					UDS_REQUEST_QUEUE_WAIT_ENV,
+					wait_mode_string);
+		}
+	}
+}
+
+/**********************************************************************/
+static enum wait_mode get_wait_mode(void)
+{
+	static once_state_t once_state = ONCE_STATE_INITIALIZER;
+
+	perform_once(&once_state, initialize_wait_mode);
+
+	return hidden_wait_mode;
+}
+
+/**********************************************************************/
+static INLINE long futex(atomic_t *word, int op, int value)
+{
+	return syscall(SYS_futex, &word->value, op, value, NULL, NULL, 0);
+}
+
+/**********************************************************************/
+static INLINE void count_worker_event(atomic64_t *counter)
+{
+	// Only the worker thread updates this counter, so no locked
+	// operation is needed.
+	atomic64_set(counter, atomic64_read(counter) + 1);
+}
+
 /**
  * Adjust the wait time if the last batch of requests was larger or smaller
  * than the tuning constants.
@@ -177,23 +327,156 @@ static struct uds_request *remove_head(struct funnel_queue *queue)
 	return container_of(entry, struct uds_request, request_queue_link);
 }
 
+/**
+ * Poll for a normal request. The ring is used first; a request taken from
+ * the overflow queue is held back until every ring slot claimed before it
+ * was put has been consumed, since those entries may be older requests from
+ * the same producer.
+ *
+ * @param queue  the request queue being serviced
+ *
+ * @return a dequeued request, or NULL if no request was available
+ **/
+static struct uds_request *poll_main_queue(struct uds_request_queue *queue)
+{
+	struct uds_request *request = mpsc_ring_poll(queue->main_ring);
+	if (request != NULL) {
+		return request;
+	}
+
+	if (queue->held_request == NULL) {
+		queue->held_request = remove_head(queue->main_queue);
+		if (queue->held_request == NULL) {
+			return NULL;
+		}
+		// Make sure claims on ring slots made before the overflow
+		// request was put are visible below.
+		smp_mb();
+	}
+
+	if (!is_mpsc_ring_idle(queue->main_ring)) {
+		// No new slots can be claimed while the overflow count is
+		// non-zero, so the ring will drain.
+		return mpsc_ring_poll(queue->main_ring);
+	}
+
+	request = queue->held_request;
+	queue->held_request = NULL;
+	smp_mb__before_atomic();
+	atomic_add(-1, &queue->overflow_count);
+	return request;
+}
+
 /**
  * Poll the underlying lock-free queues for a request to process. Requests in
- * the retry queue have higher priority, so that queue is polled first.
+ * the retry queue have the highest priority, so that queue is polled first.
+ * Interactive requests come next, but only INTERACTIVE_WEIGHT of them are
+ * taken in a row while normal requests are waiting.
  *
  * @param queue  the request queue being serviced
  *
  * @return a dequeued request, or NULL if no request was available
  **/
-static struct uds_request *poll_queues(struct uds_request_queue *queue)
+static struct uds_request *select_request(struct uds_request_queue *queue)
 {
 	struct uds_request *request = remove_head(queue->retry_queue);
-	if (request == NULL) {
-		request = remove_head(queue->main_queue);
+	if (request != NULL) {
+		return request;
+	}
+
+	if (queue->interactive_credit > 0) {
+		request = remove_head(queue->interactive_queue);
+		if (request != NULL) {
+			queue->interactive_credit -= 1;
+			return request;
+		}
+	}
+
+	request = poll_main_queue(queue);
+	if (request != NULL) {
+		queue->interactive_credit = INTERACTIVE_WEIGHT;
+		return request;
+	}
+
+	// With no normal request waiting, the credit doesn't matter.
+	return remove_head(queue->interactive_queue);
+}
+
+/**
+ * Poll for a request to process, counting it as dequeued.
+ *
+ * @param queue  the request queue being serviced
+ *
+ * @return a dequeued request, or NULL if no request was available
+ **/
+static struct uds_request *poll_queues(struct uds_request_queue *queue)
+{
+	struct uds_request *request = select_request(queue);
+	if (request != NULL) {
+		count_worker_event(&queue->dequeued);
 	}
 	return request;
 }
 
+/**
+ * Remove the next request to be processed from the queue, spinning and then
+ * parking on the futex if the queue is empty. Must only be called by the
+ * worker thread.
+ *
+ * @param queue  the queue from which to remove an entry
+ *
+ * @return the next request in the queue, or NULL if the queue has been
+ *         shut down and the worker thread should exit
+ **/
+static struct uds_request *
+dequeue_request_futex(struct uds_request_queue *queue)
+{
+	for (;;) {
+		struct uds_request *request = poll_queues(queue);
+		if (request != NULL) {
+			return request;
+		}
+
+		// Spin for a while in the hope that more work arrives before
+		// it is worth going to sleep.
+		count_worker_event(&queue->spins);
+		unsigned int polls;
+		for (polls = 0; polls < FUTEX_SPIN_POLLS; polls++) {
+			barrier();
+			request = poll_queues(queue);
+			if (request != NULL) {
+				return request;
+			}
+		}
+
+		// Sample the sequence before announcing that we are parked,
+		// so that any wake after the announcement changes it.
+		int sequence = atomic_read(&queue->futex_sequence);
+		atomic_set(&queue->parked, true);
+		// Pairs with the barrier between the put and the check of the
+		// parked flag in uds_request_queue_enqueue.
+		smp_mb();
+
+		bool shutting_down = !READ_ONCE(queue->alive);
+		if (shutting_down) {
+			// See dequeue_request.
+			smp_rmb();
+		}
+
+		request = poll_queues(queue);
+		if ((request != NULL) || shutting_down) {
+			atomic_set(&queue->parked, false);
+			return request;
+		}
+
+		// If an enqueuer has already advanced the sequence, the wait
+		// returns immediately.
+		count_worker_event(&queue->parks);
+		futex(&queue->futex_sequence, FUTEX_WAIT_PRIVATE, sequence);
+		atomic_set(&queue->parked, false);
+	}
+}
+
 /**
  * Remove the next request to be processed from the queue, waiting for a
  * request if the queue is empty. Must only be called by the worker thread.
@@ -270,22 +553,70 @@ static struct uds_request *dequeue_request(struct uds_request_queue *queue)
 	}
 }
 
+/**
+ * Process a request and then drain up to MAXIMUM_DRAIN - 1 more requests
+ * which are already queued, without going back through the wait logic of
+ * dequeue_request for each one. Retry requests still take priority since
+ * poll_queues checks the retry queue first on every poll. A queue with a
+ * batch processor collects the requests first and hands them over
+ * together, so that it can prefetch for all of them before doing any.
+ *
+ * @param queue    the request queue being serviced
+ * @param request  the first request to process
+ **/
+static void process_batch(struct uds_request_queue *queue,
+			  struct uds_request *request)
+{
+	unsigned int count = 1;
+	UDS_PROBE2(request_dequeue, queue->name, request);
+	if (queue->process_many != NULL) {
+		struct uds_request *batch[MAXIMUM_DRAIN];
+		batch[0] = request;
+		while (count < MAXIMUM_DRAIN) {
+			request = poll_queues(queue);
+			if (request == NULL) {
+				break;
+			}
+			UDS_PROBE2(request_dequeue, queue->name, request);
+			batch[count++] = request;
+		}
+		queue->process_many(batch, count);
+	} else {
+		queue->process_one(request);
+		while (count < MAXIMUM_DRAIN) {
+			request = poll_queues(queue);
+			if (request == NULL) {
+				break;
+			}
+			UDS_PROBE2(request_dequeue, queue->name, request);
+			queue->process_one(request);
+			count++;
+		}
+	}
+
+	// dequeue_request has already counted the first request.
+	queue->current_batch += count - 1;
+}
+
 /**********************************************************************/
 static void request_queue_worker(void *arg)
 {
 	struct uds_request_queue *queue = (struct uds_request_queue *) arg;
 	uds_log_debug("%s queue starting", queue->name);
+	struct uds_request *(*dequeue)(struct uds_request_queue *) =
+		(queue->use_futex ? dequeue_request_futex : dequeue_request);
 	struct uds_request *request;
-	while ((request = dequeue_request(queue)) != NULL) {
-		queue->process_one(request);
+	while ((request = dequeue(queue)) != NULL) {
+		process_batch(queue, request);
 	}
 	uds_log_debug("%s queue done", queue->name);
 }
 
 /**********************************************************************/
-int make_uds_request_queue(const char *queue_name,
-			   uds_request_queue_processor_t *process_one,
-			   struct uds_request_queue **queue_ptr)
+static int make_queue(const char *queue_name,
+		      uds_request_queue_processor_t *process_one,
+		      uds_request_queue_batch_processor_t *process_many,
+		      struct uds_request_queue **queue_ptr)
 {
 	struct uds_request_queue *queue;
 	int result = UDS_ALLOCATE(1, struct uds_request_queue, __func__,
@@ -295,9 +626,18 @@ int make_uds_request_queue(const char *queue_name,
 	}
 	queue->name = queue_name;
 	queue->process_one = process_one;
+	queue->process_many = process_many;
 	queue->alive = true;
 	queue->current_batch = 0;
 	queue->wait_nanoseconds = DEFAULT_WAIT_TIME;
+	queue->interactive_credit = INTERACTIVE_WEIGHT;
+	queue->use_futex = (get_wait_mode() == WAIT_FUTEX);
+
+	result = make_mpsc_ring(MAIN_RING_SIZE, &queue->main_ring);
+	if (result != UDS_SUCCESS) {
+		uds_request_queue_finish(queue);
+		return result;
+	}
 
 	result = make_funnel_queue(&queue->main_queue);
 	if (result != UDS_SUCCESS) {
@@ -311,6 +651,12 @@ int make_uds_request_queue(const char *queue_name,
 		return result;
 	}
 
+	result = make_funnel_queue(&queue->interactive_queue);
+	if (result != UDS_SUCCESS) {
+		uds_request_queue_finish(queue);
+		return result;
+	}
+
 	result = make_event_count(&queue->work_event);
 	if (result != UDS_SUCCESS) {
 		uds_request_queue_finish(queue);
@@ -330,20 +676,83 @@ int make_uds_request_queue(const char *queue_name,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+int make_uds_request_queue(const char *queue_name,
+			   uds_request_queue_processor_t *process_one,
+			   struct uds_request_queue **queue_ptr)
+{
+	return make_queue(queue_name, process_one, NULL, queue_ptr);
+}
+
+/**********************************************************************/
+int make_uds_batch_request_queue(const char *queue_name,
+				 uds_request_queue_batch_processor_t *process_many,
+				 struct uds_request_queue **queue_ptr)
+{
+	return make_queue(queue_name, NULL, process_many, queue_ptr);
+}
+
 /**********************************************************************/
 static INLINE void wake_up_worker(struct uds_request_queue *queue)
 {
+	if (queue->use_futex) {
+		atomic_inc(&queue->futex_sequence);
+		futex(&queue->futex_sequence, FUTEX_WAKE_PRIVATE, 1);
+		atomic64_inc(&queue->wakes);
+		return;
+	}
+
 	event_count_broadcast(queue->work_event);
 }
 
-/**********************************************************************/
-void uds_request_queue_enqueue(struct uds_request_queue *queue,
-			       struct uds_request *request)
+/**
+ * Put a request on the appropriate internal queue without waking the worker.
+ *
+ * @param queue    the request queue
+ * @param request  the request to add
+ **/
+static void put_request(struct uds_request_queue *queue,
+			struct uds_request *request)
+{
+	if (request->requeued) {
+		funnel_queue_put(queue->retry_queue,
+				 &request->request_queue_link);
+	} else if (request->interactive) {
+		funnel_queue_put(queue->interactive_queue,
+				 &request->request_queue_link);
+	} else if ((atomic_read(&queue->overflow_count) > 0) ||
+		   !mpsc_ring_put(queue->main_ring, request)) {
+		// The count must be raised before the request is visible so
+		// this producer's later requests also go to the overflow
+		// queue.
+		atomic_inc(&queue->overflow_count);
+		funnel_queue_put(queue->main_queue,
+				 &request->request_queue_link);
+	}
+}
+
+/**
+ * Wake the worker if it may not notice newly added requests by itself.
+ *
+ * @param queue      the request queue
+ * @param unbatched  true if any of the new requests is unbatched
+ **/
+static void wake_for_new_requests(struct uds_request_queue *queue,
+				  bool unbatched)
 {
-	bool unbatched = request->unbatched;
-	funnel_queue_put(request->requeued ? queue->retry_queue :
-					     queue->main_queue,
-			 &request->request_queue_link);
+	if (queue->use_futex) {
+		/*
+		 * A spinning worker will find the request by itself, so only
+		 * wake a parked one. Clearing the flag ensures that only one
+		 * of several racing enqueuers makes the system call.
+		 */
+		smp_mb();
+		if (atomic_read(&queue->parked) &&
+		    (atomic_cmpxchg(&queue->parked, true, false) == true)) {
+			wake_up_worker(queue);
+		}
+		return;
+	}
 
 	/*
 	 * We must wake the worker thread when it is dormant (waiting with no
@@ -355,6 +764,66 @@ void uds_request_queue_enqueue(struct uds_request_queue *queue,
 	}
 }
 
+/**********************************************************************/
+void uds_request_queue_enqueue(struct uds_request_queue *queue,
+			       struct uds_request *request)
+{
+	// Interactive requests don't wait for the worker to gather a batch.
+	bool unbatched = (request->unbatched || request->interactive);
+	UDS_PROBE2(request_enqueue, queue->name, request);
+	// The request is counted before the worker can take it, so the depth
+	// never appears negative.
+	atomic64_inc(&queue->enqueued);
+	put_request(queue, request);
+	wake_for_new_requests(queue, unbatched);
+}
+
+/**********************************************************************/
+void uds_request_queue_enqueue_batch(struct uds_request_queue *queue,
+				     struct uds_request **requests,
+				     unsigned int count)
+{
+	bool unbatched = false;
+	unsigned int i;
+	atomic64_add(count, &queue->enqueued);
+	for (i = 0; i < count; i++) {
+		unbatched |= (requests[i]->unbatched ||
+			      requests[i]->interactive);
+		UDS_PROBE2(request_enqueue, queue->name, requests[i]);
+		put_request(queue, requests[i]);
+	}
+	wake_for_new_requests(queue, unbatched);
+}
+
+/**********************************************************************/
+void bind_request_queue_to_slot(struct uds_request_queue *queue,
+				const struct thread_affinity *affinity,
+				unsigned int slot)
+{
+	bind_thread_to_slot(affinity, queue->thread, slot);
+}
+
+/**********************************************************************/
+void uds_get_request_queue_stats(struct uds_request_queue *queue,
+				 struct uds_request_queue_stats *stats)
+{
+	stats->spins = atomic64_read(&queue->spins);
+	stats->parks = atomic64_read(&queue->parks);
+	stats->wakes = atomic64_read(&queue->wakes);
+}
+
+/**********************************************************************/
+unsigned int uds_get_request_queue_depth(struct uds_request_queue *queue)
+{
+	// Reading the dequeue count first keeps it from passing the enqueue
+	// count read after it.
+	uint64_t dequeued = atomic64_read(&queue->dequeued);
+	uint64_t enqueued;
+	smp_rmb();
+	enqueued = atomic64_read(&queue->enqueued);
+	return (unsigned int) min(enqueued - dequeued, (uint64_t) UINT_MAX);
+}
+
 /**********************************************************************/
 void uds_request_queue_finish(struct uds_request_queue *queue)
 {
@@ -387,8 +856,17 @@ void uds_request_queue_finish(struct uds_request_queue *queue)
 		}
 	}
 
+	if (queue->use_futex) {
+		uds_log_debug("%s queue: %ld spins, %ld parks, %ld wakes",
+			      queue->name, atomic64_read(&queue->spins),
+			      atomic64_read(&queue->parks),
+			      atomic64_read(&queue->wakes));
+	}
+
 	free_event_count(queue->work_event);
+	free_mpsc_ring(queue->main_ring);
 	free_funnel_queue(queue->main_queue);
 	free_funnel_queue(queue->retry_queue);
+	free_funnel_queue(queue->interactive_queue);
 	UDS_FREE(queue);
 }
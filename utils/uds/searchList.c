@@ -41,16 +41,13 @@ int make_search_list(unsigned int capacity, struct search_list **list_ptr)
 					      "search list capacity must fit in 8 bits");
 	}
 
-	// We need three temporary entry arrays for purge_search_list().
-	// Allocate them contiguously with the main array.
-	bytes = sizeof(struct search_list) + (4 * capacity * sizeof(uint8_t));
+	bytes = sizeof(struct search_list) + (capacity * sizeof(uint8_t));
 	result = uds_allocate_cache_aligned(bytes, "search list", &list);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
 
 	list->capacity = capacity;
-	list->first_dead_entry = 0;
 
 	// Fill in the indexes of the chapter index cache entries. These will
 	// be only ever be permuted as the search list is used.
@@ -61,55 +58,3 @@ int make_search_list(unsigned int capacity, struct search_list **list_ptr)
 	*list_ptr = list;
 	return UDS_SUCCESS;
 }
-
-/**********************************************************************/
-void purge_search_list(struct search_list *search_list,
-		       const struct cached_chapter_index chapters[],
-		       uint64_t oldest_virtual_chapter)
-{
-	uint8_t *entries, *alive, *skipped, *dead;
-	unsigned int next_alive, next_skipped, next_dead;
-	int i;
-
-	if (search_list->first_dead_entry == 0) {
-		// There are no live entries in the list to purge.
-		return;
-	}
-
-	/*
-	 * Partition the previously-alive entries in the list into three
-	 * temporary lists, keeping the current LRU search order within each
-	 * list. The element array was allocated with enough space for all four
-	 * lists.
-	 */
-	entries = &search_list->entries[0];
-	alive = &entries[search_list->capacity];
-	skipped = &alive[search_list->capacity];
-	dead = &skipped[search_list->capacity];
-	next_alive = next_skipped = next_dead = 0;
-
-	for (i = 0; i < search_list->first_dead_entry; i++) {
-		uint8_t entry = entries[i];
-		const struct cached_chapter_index *chapter = &chapters[entry];
-		if ((chapter->virtual_chapter < oldest_virtual_chapter) ||
-		    (chapter->virtual_chapter == UINT64_MAX)) {
-			dead[next_dead++] = entry;
-		} else if (chapter->skip_search) {
-			skipped[next_skipped++] = entry;
-		} else {
-			alive[next_alive++] = entry;
-		}
-	}
-
-	// Copy the temporary lists back to the search list so we wind up with
-	// [ alive, alive, skippable, new-dead, new-dead, old-dead, old-dead ]
-	memcpy(entries, alive, next_alive);
-	entries += next_alive;
-
-	memcpy(entries, skipped, next_skipped);
-	entries += next_skipped;
-
-	memcpy(entries, dead, next_dead);
-	// The first dead entry is now the start of the copied dead list.
-	search_list->first_dead_entry = (next_alive + next_skipped);
-}
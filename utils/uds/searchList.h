@@ -31,13 +31,12 @@
  * A search_list represents the permutations of the sparse chapter index cache
  * entry array. Those permutations express an ordering on the chapter indexes,
  * from most recently accessed to least recently accessed, which is the order
- * in which the indexes should be searched and the reverse order in which they
- * should be evicted from the cache (LRU cache replacement policy).
+ * in which the indexes should be searched.
  *
- * Cache entries that are dead (virtual_chapter == UINT64_MAX) are kept as a
- * suffix of the list, avoiding the need to even iterate over them to search,
- * and ensuring that dead entries are replaced before any live entries are
- * evicted.
+ * Cache membership changes in the background, so every entry is iterated and
+ * the searcher skips dead entries (virtual_chapter == UINT64_MAX) itself. The
+ * cache is small enough that this costs less than keeping a dead suffix
+ * consistent across zones would.
  *
  * The search list is intended to be instantated for each zone thread,
  * avoiding any need for synchronization. The structure is allocated on a
@@ -48,15 +47,12 @@ struct search_list {
 	/** The number of cached chapter indexes and search list entries */
 	uint8_t capacity;
 
-	/** The index in the entries array of the first dead cache entry */
-	uint8_t first_dead_entry;
-
 	/** The chapter array indexes representing the chapter search order */
 	uint8_t entries[];
 };
 
 /**
- * search_list_iterator captures the fields needed to iterate over the live
+ * search_list_iterator captures the fields needed to iterate over the
  * entries in a search list and return the struct cached_chapter_index pointers
  * that the search code actually wants to deal with.
  **/
@@ -74,9 +70,7 @@ struct search_list_iterator {
 /**
  * Allocate and initialize a new chapter cache search list with the same
  * capacity as the cache. The index of each entry in the cache will appear
- * exactly once in the array. All the chapters in the cache are assumed to be
- * initially dead, so first_dead_entry will be zero and no chapters will be
- * returned when the search list is iterated.
+ * exactly once in the array.
  *
  * @param [in]  capacity  the number of entries in the search list
  * @param [out] list_ptr  a pointer in which to return the new search list
@@ -98,9 +92,9 @@ static INLINE void copy_search_list(const struct search_list *source,
 }
 
 /**
- * Prepare to iterate over the live cache entries a search list.
+ * Prepare to iterate over the cache entries in a search list.
  *
- * @param list      the list defining the live chapters and the search order
+ * @param list      the list defining the search order
  * @param chapters  the chapter index entries to return from get_next_chapter()
  *
  * @return an iterator positioned at the start of the search list
@@ -127,17 +121,17 @@ iterate_search_list(struct search_list *list,
 static INLINE bool
 has_next_chapter(const struct search_list_iterator *iterator)
 {
-	return (iterator->next_entry < iterator->list->first_dead_entry);
+	return (iterator->next_entry < iterator->list->capacity);
 }
 
 /**
- * Return a pointer to the next live chapter in the search list iteration and
+ * Return a pointer to the next chapter in the search list iteration and
  * advance the iterator. This must only be called when has_next_chapter()
  * returns <code>true</code>.
  *
  * @param iterator  the search list iterator
  *
- * @return a pointer to the next live chapter index in the search list order
+ * @return a pointer to the next chapter index in the search list order
  **/
 static INLINE struct cached_chapter_index *
 get_next_chapter(struct search_list_iterator *iterator)
@@ -181,33 +175,7 @@ static INLINE uint8_t rotate_search_list(struct search_list *search_list,
 		search_list->entries[0] = most_recent;
 	}
 
-	// This function is also used to move a dead chapter to the front of
-	// the list, in which case the suffix of dead chapters was pushed down
-	// too.
-	if (search_list->first_dead_entry < prefix_length) {
-		search_list->first_dead_entry += 1;
-	}
-
 	return most_recent;
 }
 
-/**
- * Purge invalid cache entries, marking them as dead and moving them to the
- * end of the search list, then push any chapters that have skip_search set
- * down so they follow all the remaining live, valid chapters in the search
- * list. This effectively sorts the search list into three regions--active,
- * skippable, and dead--while maintaining the LRU ordering that already
- * existed (a stable sort).
- *
- * This operation must only be called during the critical section in
- * update_sparse_cache() since it effectively changes cache membership.
- *
- * @param search_list             the chapter index search list to purge
- * @param chapters                the chapter index cache entries
- * @param oldest_virtual_chapter  the oldest virtual chapter
- **/
-void purge_search_list(struct search_list *search_list,
-		       const struct cached_chapter_index chapters[],
-		       uint64_t oldest_virtual_chapter);
-
 #endif /* SEARCH_LIST_H */
@@ -0,0 +1,595 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/sharedIndex.c#1 $
+ */
+
+#include "sharedIndex.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "atomicDefs.h"
+#include "chapterIndex.h"
+#include "errors.h"
+#include "hashUtils.h"
+#include "ioFactory.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "recordPage.h"
+#include "volumeIndex005.h"
+
+/*
+ * The shared memory starts with a header describing the geometry of the
+ * index and where its volume is, followed by the delta lists of each zone
+ * of the volume index. The owner writes the magic last, so a reader which
+ * finds it knows the rest of the header is complete. Readers search the
+ * volume index under the sequence counts of its zones, and then read the
+ * chapter it names straight from the volume, through the kernel page cache
+ * which all the processes share.
+ */
+enum { SHARED_MAGIC_SIZE = 8 };
+static const char SHARED_MAGIC[] = "UDSSHM02";
+
+struct shared_index_header {
+	char magic[SHARED_MAGIC_SIZE];
+	uint64_t nonce;                      // The volume nonce
+	uint32_t owner;                      // The process sharing the index
+	uint64_t size;                       // The size of the shared memory
+	uint64_t bytes_per_page;             // The geometry of the volume
+	uint32_t record_pages_per_chapter;
+	uint32_t chapters_per_volume;
+	uint64_t remapped_virtual;
+	uint64_t remapped_physical;
+	uint64_t volume_start;               // Where the volume is stored
+	uint64_t volume_size;
+	char volume_path[PATH_MAX];
+	uint64_t written_chapters;           // Every chapter before this one
+					     // is on storage
+	bool open;                           // Cleared when the owner closes
+					     // the index
+	struct shared_volume_index volume_index;
+};
+
+struct shared_index {
+	char *name;                          // The shared memory object
+	struct shared_index_header *header;  // The mapped shared memory
+	size_t size;                         // The size of the mapping
+};
+
+struct uds_shared_index {
+	struct shared_index_header *header;  // The mapped shared memory
+	size_t size;                         // The size of the mapping
+	struct geometry *geometry;           // The geometry of the volume
+	struct delta_index delta_index;      // The view of the volume index
+	struct io_region *volume;            // The volume
+	byte *page;                          // A buffer for volume pages
+	byte *unpacked_page;                 // A buffer for expanding a
+					     // compressed record page
+};
+
+/**
+ * Get the offset at which the delta lists of a shared index start.
+ *
+ * @return the offset of the delta lists
+ **/
+static INLINE size_t get_shared_lists_offset(void)
+{
+	return (((sizeof(struct shared_index_header) + CACHE_LINE_BYTES - 1) /
+		 CACHE_LINE_BYTES) *
+		CACHE_LINE_BYTES);
+}
+
+/**
+ * Decide whether a shared memory object left with the name of a shared index
+ * may be replaced. It may if its owner closed it or is gone; a copy which an
+ * open index still publishes is never taken over, whichever index it is.
+ *
+ * @param name   The name of the shared memory object
+ * @param nonce  The nonce of the index to be shared
+ *
+ * @return UDS_SUCCESS if the object is stale, or an error code
+ **/
+static int check_stale_shared_index(const char *name, uint64_t nonce)
+{
+	const struct shared_index_header *header;
+	struct stat info;
+	uint32_t owner;
+	void *base;
+	bool open;
+	int fd, result;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			return UDS_SUCCESS;
+		}
+		return uds_log_error_strerror(errno,
+					      "cannot examine shared index %s",
+					      name);
+	}
+	if (fstat(fd, &info) != 0) {
+		result = uds_log_error_strerror(errno,
+						"cannot examine shared index %s",
+						name);
+		close(fd);
+		return result;
+	}
+	if ((size_t) info.st_size < sizeof(struct shared_index_header)) {
+		close(fd);
+		return uds_log_error_strerror(EEXIST,
+					      "shared index %s is being created by another process",
+					      name);
+	}
+	base = mmap(NULL, sizeof(struct shared_index_header), PROT_READ,
+		    MAP_SHARED, fd, 0);
+	result = errno;
+	close(fd);
+	if (base == MAP_FAILED) {
+		return uds_log_error_strerror(result,
+					      "cannot map shared index %s",
+					      name);
+	}
+
+	header = base;
+	owner = READ_ONCE(header->owner);
+	open = READ_ONCE(header->open);
+	result = UDS_SUCCESS;
+	if (owner == 0) {
+		result = uds_log_error_strerror(EEXIST,
+						"shared index %s is being created by another process",
+						name);
+	} else if (open && ((kill(owner, 0) == 0) || (errno == EPERM))) {
+		result = uds_log_error_strerror(EEXIST,
+						"shared index %s is in use by process %u%s",
+						name, owner,
+						((header->nonce == nonce) ?
+						 "" : " for another index"));
+	}
+	munmap(base, sizeof(struct shared_index_header));
+	return result;
+}
+
+/**********************************************************************/
+int make_shared_index(struct uds_index *index,
+		      const char *name,
+		      unsigned int mode,
+		      struct shared_index **shared_ptr)
+{
+	const struct geometry *geometry = index->volume->geometry;
+	struct shared_index_header *header;
+	struct shared_index *shared;
+	const char *volume_path;
+	off_t volume_start;
+	size_t volume_size;
+	void *base;
+	int fd, result;
+
+	if (is_sparse(geometry)) {
+		return uds_log_error_strerror(UDS_INVALID_ARGUMENT,
+					      "a sparse index cannot be shared");
+	}
+	get_uds_volume_region_location(index->layout, &volume_path,
+				       &volume_start, &volume_size);
+	if (strlen(volume_path) >= sizeof(header->volume_path)) {
+		return uds_log_error_strerror(UDS_INVALID_ARGUMENT,
+					      "index storage path %s is too long to share",
+					      volume_path);
+	}
+
+	result = UDS_ALLOCATE(1, struct shared_index, __func__, &shared);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	result = uds_duplicate_string(name, "shared index name",
+				      &shared->name);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(shared);
+		return result;
+	}
+	shared->size = (get_shared_lists_offset() +
+			get_volume_index005_shared_size(index->volume_index));
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+	if ((fd < 0) && (errno == EEXIST)) {
+		result = check_stale_shared_index(name, index->volume->nonce);
+		if (result != UDS_SUCCESS) {
+			free_shared_index(shared);
+			return result;
+		}
+		// Readers still attached to a stale copy keep their own
+		// mapping of it.
+		if (shm_unlink(name) == 0) {
+			uds_log_info("replacing stale shared index %s", name);
+		}
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+	}
+	if (fd < 0) {
+		result = uds_log_error_strerror(errno,
+						"cannot create shared index %s",
+						name);
+		free_shared_index(shared);
+		return result;
+	}
+	if (ftruncate(fd, shared->size) != 0) {
+		result = uds_log_error_strerror(errno,
+						"cannot size shared index %s",
+						name);
+		close(fd);
+		shm_unlink(name);
+		free_shared_index(shared);
+		return result;
+	}
+	base = mmap(NULL, shared->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	result = errno;
+	close(fd);
+	if (base == MAP_FAILED) {
+		uds_log_error_strerror(result, "cannot map shared index %s",
+				       name);
+		shm_unlink(name);
+		free_shared_index(shared);
+		return result;
+	}
+	header = shared->header = base;
+
+	// Claim the object first so that a rival sees it is not stale.
+	WRITE_ONCE(header->owner, (uint32_t) getpid());
+	WRITE_ONCE(header->open, true);
+	header->nonce = index->volume->nonce;
+	header->size = shared->size;
+	header->bytes_per_page = geometry->bytes_per_page;
+	header->record_pages_per_chapter = geometry->record_pages_per_chapter;
+	header->chapters_per_volume = geometry->chapters_per_volume;
+	header->remapped_virtual = geometry->remapped_virtual;
+	header->remapped_physical = geometry->remapped_physical;
+	header->volume_start = volume_start;
+	header->volume_size = volume_size;
+	strcpy(header->volume_path, volume_path);
+	header->written_chapters = index->newest_virtual_chapter;
+	result = share_volume_index005(index->volume_index,
+				       &header->volume_index, base,
+				       get_shared_lists_offset());
+	if (result != UDS_SUCCESS) {
+		free_shared_index(shared);
+		return result;
+	}
+	smp_wmb();
+	memcpy(header->magic, SHARED_MAGIC, SHARED_MAGIC_SIZE);
+
+	uds_log_info("sharing index as %s (%zu bytes)", name, shared->size);
+	*shared_ptr = shared;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void note_shared_index_chapter_written(struct shared_index *shared,
+				       uint64_t virtual_chapter)
+{
+	if (shared == NULL) {
+		return;
+	}
+	smp_wmb();
+	WRITE_ONCE(shared->header->written_chapters, virtual_chapter + 1);
+}
+
+/**********************************************************************/
+void free_shared_index(struct shared_index *shared)
+{
+	if (shared == NULL) {
+		return;
+	}
+	if (shared->header != NULL) {
+		WRITE_ONCE(shared->header->open, false);
+		munmap(shared->header, shared->size);
+		shm_unlink(shared->name);
+	}
+	UDS_FREE(shared->name);
+	UDS_FREE(shared);
+}
+
+/**
+ * Read a page of the volume of a shared index into the page buffer.
+ *
+ * @param reader         The view of the shared index
+ * @param physical_page  The physical page number
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int read_shared_page(struct uds_shared_index *reader,
+			    int physical_page)
+{
+	size_t bytes_per_page = reader->geometry->bytes_per_page;
+	return read_from_region(reader->volume,
+				(off_t) physical_page * bytes_per_page,
+				reader->page, bytes_per_page, NULL);
+}
+
+/**
+ * Search a chapter of the volume of a shared index for a chunk name,
+ * finding the index page which covers its delta list by bisection since
+ * the index page map is not shared.
+ *
+ * @param reader           The view of the shared index
+ * @param name             The chunk name
+ * @param virtual_chapter  The chapter the volume index names
+ * @param metadata         Set to the metadata of the chunk name, if found
+ * @param found            Set to whether the chunk name was found
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int search_shared_chapter(struct uds_shared_index *reader,
+				 const struct uds_chunk_name *name,
+				 uint64_t virtual_chapter,
+				 struct uds_chunk_data *metadata,
+				 bool *found)
+{
+	const struct geometry *geometry = reader->geometry;
+	unsigned int chapter =
+		map_to_physical_chapter(geometry, virtual_chapter);
+	unsigned int list_number = hash_to_chapter_delta_list(name, geometry);
+	unsigned int first = 0;
+	unsigned int last = geometry->index_pages_per_chapter;
+	struct delta_index_page index_page;
+	int record_page = NO_CHAPTER_INDEX_ENTRY;
+	int result;
+
+	*found = false;
+	while (first < last) {
+		unsigned int page = first + (last - first) / 2;
+		result = read_shared_page(reader,
+					  map_to_physical_page(geometry,
+							       chapter,
+							       page));
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		result = initialize_chapter_index_page(&index_page, geometry,
+						       reader->page,
+						       reader->header->nonce);
+		if ((result != UDS_SUCCESS) ||
+		    (index_page.virtual_chapter_number != virtual_chapter)) {
+			// The chapter has been replaced since it was indexed.
+			return UDS_SUCCESS;
+		}
+		if (list_number < index_page.lowest_list_number) {
+			last = page;
+		} else if (list_number > index_page.highest_list_number) {
+			first = page + 1;
+		} else {
+			result = search_chapter_index_page(&index_page,
+							   geometry, name,
+							   &record_page);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+			break;
+		}
+	}
+	if (record_page == NO_CHAPTER_INDEX_ENTRY) {
+		return UDS_SUCCESS;
+	}
+
+	result = read_shared_page(reader,
+				  map_to_physical_page(geometry, chapter,
+						       geometry->index_pages_per_chapter +
+						       record_page));
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	if (get_stored_record_page_size(geometry, reader->page) <
+	    geometry->bytes_per_page) {
+		unpack_record_page(geometry, reader->page,
+				   reader->unpacked_page);
+		*found = search_record_page(reader->unpacked_page, name,
+					    geometry, metadata);
+		return UDS_SUCCESS;
+	}
+	*found = search_record_page(reader->page, name, geometry, metadata);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_attach_shared_index(const char *name,
+			    struct uds_shared_index **reader_ptr)
+{
+	const struct shared_index_header *header;
+	struct uds_shared_index *reader;
+	struct io_factory *factory;
+	struct stat info;
+	void *base;
+	int fd, result;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			return UDS_NO_INDEX;
+		}
+		return uds_log_error_strerror(errno,
+					      "cannot open shared index %s",
+					      name);
+	}
+	if (fstat(fd, &info) != 0) {
+		result = uds_log_error_strerror(errno,
+						"cannot examine shared index %s",
+						name);
+		close(fd);
+		return result;
+	}
+	if ((size_t) info.st_size < sizeof(struct shared_index_header)) {
+		close(fd);
+		return UDS_NO_INDEX;
+	}
+	base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	result = errno;
+	close(fd);
+	if (base == MAP_FAILED) {
+		return uds_log_error_strerror(result,
+					      "cannot map shared index %s",
+					      name);
+	}
+
+	header = base;
+	if (memcmp(header->magic, SHARED_MAGIC, SHARED_MAGIC_SIZE) != 0) {
+		munmap(base, info.st_size);
+		return UDS_NO_INDEX;
+	}
+	smp_rmb();
+	if ((header->size != (uint64_t) info.st_size) ||
+	    (strnlen(header->volume_path, sizeof(header->volume_path)) ==
+	     sizeof(header->volume_path))) {
+		munmap(base, info.st_size);
+		return uds_log_error_strerror(UDS_CORRUPT_DATA,
+					      "shared index %s is malformed",
+					      name);
+	}
+
+	result = UDS_ALLOCATE(1, struct uds_shared_index, __func__, &reader);
+	if (result != UDS_SUCCESS) {
+		munmap(base, info.st_size);
+		return result;
+	}
+	reader->header = base;
+	reader->size = info.st_size;
+
+	result = make_geometry(header->bytes_per_page,
+			       header->record_pages_per_chapter,
+			       header->chapters_per_volume, 0,
+			       header->remapped_virtual,
+			       header->remapped_physical,
+			       &reader->geometry);
+	if (result != UDS_SUCCESS) {
+		uds_detach_shared_index(reader);
+		return result;
+	}
+
+	result = attach_shared_volume_index005(&header->volume_index, base,
+					       reader->size,
+					       &reader->delta_index);
+	if (result != UDS_SUCCESS) {
+		uds_detach_shared_index(reader);
+		return result;
+	}
+
+	result = UDS_ALLOCATE(header->bytes_per_page, byte,
+			      "shared index page", &reader->page);
+	if (result != UDS_SUCCESS) {
+		uds_detach_shared_index(reader);
+		return result;
+	}
+
+	result = UDS_ALLOCATE(header->bytes_per_page, byte,
+			      "shared index unpacked page",
+			      &reader->unpacked_page);
+	if (result != UDS_SUCCESS) {
+		uds_detach_shared_index(reader);
+		return result;
+	}
+
+	result = make_uds_io_factory(header->volume_path, FU_READ_ONLY,
+				     &factory);
+	if (result != UDS_SUCCESS) {
+		uds_detach_shared_index(reader);
+		return uds_log_error_strerror(result,
+					      "cannot open shared index volume %s",
+					      header->volume_path);
+	}
+	result = make_uds_io_region(factory, header->volume_start,
+				    header->volume_size, &reader->volume);
+	put_uds_io_factory(factory);
+	if (result != UDS_SUCCESS) {
+		uds_detach_shared_index(reader);
+		return uds_log_error_strerror(result,
+					      "cannot access shared index volume %s",
+					      header->volume_path);
+	}
+
+	*reader_ptr = reader;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int uds_query_shared_index(struct uds_shared_index *reader,
+			   const struct uds_chunk_name *name,
+			   struct uds_chunk_data *metadata,
+			   bool *found)
+{
+	const struct shared_index_header *header = reader->header;
+	uint64_t virtual_chapter;
+	unsigned int zone;
+	bool indexed, in_chapter;
+	int result;
+
+	*found = false;
+	if (!READ_ONCE(header->open)) {
+		return UDS_DISABLED;
+	}
+
+	result = lookup_shared_volume_index005(&header->volume_index,
+					       &reader->delta_index, name,
+					       &indexed, &zone,
+					       &virtual_chapter);
+	if ((result != UDS_SUCCESS) || !indexed) {
+		return result;
+	}
+	// Names in the chapter being filled or written are not yet readable.
+	if (virtual_chapter >= READ_ONCE(header->written_chapters)) {
+		return UDS_SUCCESS;
+	}
+	smp_rmb();
+
+	result = search_shared_chapter(reader, name, virtual_chapter,
+				       metadata, &in_chapter);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// The owner expires a chapter from the volume index before it
+	// overwrites it, so if the chapter is still indexed now, the pages
+	// read were really from it.
+	smp_rmb();
+	if (virtual_chapter <
+	    READ_ONCE(header->volume_index.zones[zone].virtual_chapter_low)) {
+		return UDS_SUCCESS;
+	}
+	*found = in_chapter;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void uds_detach_shared_index(struct uds_shared_index *reader)
+{
+	if (reader == NULL) {
+		return;
+	}
+	if (reader->volume != NULL) {
+		put_io_region(reader->volume);
+	}
+	UDS_FREE(reader->page);
+	UDS_FREE(reader->unpacked_page);
+	detach_shared_volume_index005(&reader->delta_index);
+	free_geometry(reader->geometry);
+	munmap(reader->header, reader->size);
+	UDS_FREE(reader);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/sharedIndex.h#1 $
+ */
+
+#ifndef SHARED_INDEX_H
+#define SHARED_INDEX_H
+
+#include "index.h"
+
+/*
+ * A shared index publishes the volume index of a dense index in POSIX
+ * shared memory, together with where its volume is stored, so that other
+ * processes can look up chunk names without a session of their own. The
+ * owning process keeps running the index as usual; readers attach with
+ * uds_attach_shared_index() and search without ever writing to the shared
+ * memory or the volume.
+ */
+
+/**
+ * Publish the volume index of an index in shared memory. Shared memory with
+ * the same name is replaced only if the process which published it has
+ * closed it or is gone; otherwise the name is in use and this fails.
+ *
+ * @param index       The index, which must be loaded but not yet running
+ * @param name        The name of the shared memory object
+ * @param mode        The permissions of the shared memory object
+ * @param shared_ptr  Set to the new shared index
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check make_shared_index(struct uds_index *index,
+				   const char *name,
+				   unsigned int mode,
+				   struct shared_index **shared_ptr);
+
+/**
+ * Tell readers of a shared index that a chapter is on storage, so that they
+ * may search it.
+ *
+ * @param shared           The shared index, or NULL
+ * @param virtual_chapter  The chapter which has been written
+ **/
+void note_shared_index_chapter_written(struct shared_index *shared,
+				       uint64_t virtual_chapter);
+
+/**
+ * Withdraw a shared index. Readers which are still attached find it closed.
+ * This must be called after the volume index which uses the shared memory
+ * is freed.
+ *
+ * @param shared  The shared index, or NULL
+ **/
+void free_shared_index(struct shared_index *shared);
+
+#endif /* SHARED_INDEX_H */
@@ -23,86 +23,74 @@
  * The sparse chapter index cache is implemented as a simple array of cache
  * entries. Since the cache is small (seven chapters by default), searching
  * for a specific virtual chapter is implemented as a linear search. The cache
- * replacement policy is least-recently-used (LRU). Again, size of the cache
- * allows the LRU order to be maintained by shifting entries in an array list.
+ * replacement policy is least-recently-used (LRU), approximated by a clock
+ * value that zone zero stamps on an entry whenever it hits.
  *
  * The most important property of this cache is the absence of synchronization
- * for read operations. Safe concurrent access to the cache by the zone
- * threads is controlled by the triage queue and the barrier requests it
- * issues to the zone queues. The set of cached chapters does not and must not
- * change between the carefully coordinated calls to update_sparse_cache() from
- * the zone threads.
+ * for read operations. The zone threads never change its membership. When a
+ * zone looks for a hook in a sparse chapter that is not cached, it asks the
+ * loader thread for that chapter with request_sparse_chapter() and resolves
+ * the hook through the volume page cache in the meantime. The next name in
+ * that zone which misses in the whole cache waits for the chapter to arrive
+ * and searches again; no other zone waits for it. Only the loader thread
+ * changes cache membership.
+ *
+ * Membership is published in the virtual chapter number field of each cache
+ * entry. The value <code>UINT64_MAX</code> is used to represent a null,
+ * undefined, or wildcard chapter number. When present in the virtual chapter
+ * number field of a cached_chapter_index, it indicates that the cache entry
+ * is dead, and all the other fields of that entry (other than immutable
+ * pointers to cache memory) are undefined and irrelevant. The loader fills in
+ * a dead entry and then stores its chapter number, with a write barrier
+ * between, so a zone which sees the number also sees the entry contents.
  *
- * The critical invariant for that coordination is the cache membership must
- * not change between those updates; the calls to sparse_cache_contains() from
- * the zone threads must all receive the same results for any virtual chapter
- * number. To ensure that critical invariant, state changes such as "that
- * virtual chapter is no longer in the volume" and "skip searching that
- * chapter because it has had too many cache misses" are represented
- * separately from the cache membership information (the virtual chapter
- * number).
- *
- * As a result of this invariant, we have the guarantee that every zone thread
- * will call update_sparse_cache() once and exactly once to request a chapter
- * that is not in the cache, and the serialization of the barrier requests
- * from the triage queue ensures they will all request the same chapter
- * number. This means the only synchronization we need can be provided by a
- * pair of thread barriers used only in the update_sparse_cache() call,
- * providing a critical section where a single zone thread can drive the cache
- * update while all the other zone threads are known to be blocked, waiting in
- * the second barrier. Outside that critical section, all the zone threads
- * implicitly hold a shared lock. Inside it, the "captain" (the thread that
- * was uniquely flagged when passing through the first barrier) holds an
- * exclusive lock. No other threads may access or modify the cache, except for
- * accessing cache statistics and similar queries.
- *
- * Cache statistics must only be modified by a single thread, conventionally
- * the zone zero thread. All fields that might be frequently updated by that
- * thread are kept in separate cache-aligned structures so they will not cause
- * cache contention via "false sharing" with the fields that are frequently
- * accessed by all of the zone threads.
- *
- * LRU order is kept independently by each zone thread, and each zone uses its
- * own list for searching and cache membership queries. The zone zero list is
- * used to decide which chapter to evict when the cache is updated, and its
- * search list is copied to the other threads at that time.
- *
- * The virtual chapter number field of the cache entry is the single field
- * indicating whether a chapter is a member of the cache or not. The value
- * <code>UINT64_MAX</code> is used to represent a null, undefined, or wildcard
- * chapter number. When present in the virtual chapter number field
- * cached_chapter_index, it indicates that the cache entry is dead, and all
- * the other fields of that entry (other than immutable pointers to cache
- * memory) are undefined and irrelevant. Any cache entry that is not marked as
- * dead is fully defined and a member of the cache--sparse_cache_contains()
- * must always return true for any virtual chapter number that appears in any
- * of the cache entries.
+ * Reusing a live entry is a read-copy-update: the loader first marks the
+ * victim dead, and then waits for every zone thread to pass a quiescent point
+ * before overwriting it. A zone thread is quiescent between batches of
+ * requests; begin_sparse_cache_access() and end_sparse_cache_access() bracket
+ * each batch by bumping a per-zone sequence number, odd while the batch runs.
+ * The loader snapshots all the sequence numbers after unpublishing the
+ * victim and waits only for the zones whose snapshot was odd to move on, so
+ * zones which were idle are never waited for, and a zone that starts a new
+ * batch after the snapshot cannot see the old chapter. A chapter seen by a
+ * zone during a batch therefore stays intact until the batch ends, while the
+ * set of cached chapters may differ from zone to zone until each one next
+ * looks.
  *
  * A chapter index that is a member of the cache may be marked for different
- * treatment (disabling search) between calls to update_sparse_cache() in two
- * different ways. When a chapter falls off the end of the volume, its virtual
- * chapter number will be less that the oldest virtual chapter number. Since
- * that chapter is no longer part of the volume, there's no point in continuing
- * to search that chapter index. Once invalidated, that virtual chapter will
- * still be considered a member of the cache, but it will no longer be searched
- * for matching chunk names.
+ * treatment (disabling search) in two different ways. When a chapter falls
+ * off the end of the volume, its virtual chapter number will be less that the
+ * oldest virtual chapter number. Since that chapter is no longer part of the
+ * volume, there's no point in continuing to search that chapter index, and
+ * the loader will replace it before any live entry.
  *
  * The second mechanism for disabling search is the heuristic based on keeping
- * track of the number of consecutive search misses in a given chapter index.
- * Once that count exceeds a threshold, the skip_search flag will be set to
- * true, causing the chapter to be skipped in the fallback search of the
- * entire cache, but still allowing it to be found when searching for a hook
- * in that specific chapter. Finding a hook will clear the skip_search flag,
- * once again allowing the non-hook searches to use the cache entry. Again,
- * regardless of the state of the skip_search flag, the virtual chapter must
- * still considered to be a member of the cache for sparse_cache_contains().
+ * a decaying estimate of the search hit rate of each chapter index, which
+ * zone zero updates on every search. Once the estimate falls below a
+ * threshold, the skip_search flag will be set to true, causing the chapter to
+ * be skipped in the fallback search of the entire cache, but still allowing
+ * it to be found when searching for a hook in that specific chapter. Finding
+ * a hook will clear the skip_search flag, once again allowing the non-hook
+ * searches to use the cache entry. Zone zero also probes a skipped chapter
+ * every so often, so a chapter whose hit rate recovers without hooks being
+ * found is searched again. Skipped chapters are replaced before the other
+ * live chapters.
  *
- * Barrier requests and the sparse chapter index cache are also described in
+ * Each cache entry also carries a small filter of its chapter index entries,
+ * so most searches which miss never decode an index page.
  *
- * https://intranet.permabit.com/wiki/Chapter_Index_Cache_supports_concurrent_access
+ * Cache statistics must only be modified by a single thread: the search
+ * counters by the zone zero thread and the eviction counters by the loader.
+ * Repeated load requests which a zone drops on its own, and searches which
+ * missed while a load was outstanding, are counted in that zone's state; the
+ * rest of the load request counters are guarded by the loader mutex.
+ * All fields that might be frequently updated by those threads are kept in
+ * separate cache-aligned structures so they will not cause cache contention
+ * via "false sharing" with the fields that are frequently accessed by all of
+ * the zone threads.
  *
- * and in a message to the albireo mailing list on 5/28/2011 titled "true
- * barriers with a hook resolution queue".
+ * Search order is kept independently by each zone thread, and each zone uses
+ * its own list for searching and cache membership queries.
  **/
 
 #include "sparseCache.h"
@@ -115,13 +103,38 @@
 #include "memoryAlloc.h"
 #include "permassert.h"
 #include "searchList.h"
+#include "stringUtils.h"
+#include "timeUtils.h"
 #include "uds-threads.h"
 #include "zone.h"
 
 enum {
-	/** The number of consecutive search misses that will disable searching
+	/**
+	 * Each search moves the hit rate estimate 1/2^HIT_RATE_DECAY_SHIFT of
+	 * the way towards the result of that search.
 	 */
-	SKIP_SEARCH_THRESHOLD = 20000,
+	HIT_RATE_DECAY_SHIFT = 10,
+
+	/** The hit rate estimate below which searching is disabled */
+	SKIP_SEARCH_HIT_RATE = CHAPTER_HIT_RATE_ONE >> 14,
+
+	/** The number of skipped searches after which zone zero probes */
+	SKIP_SEARCH_PROBE_INTERVAL = 4096,
+
+	/** The number of chapter loads which may be waiting for the loader */
+	MAX_PENDING_LOADS = 8,
+
+	/** How often the loader yields before sleeping while zones finish */
+	QUIESCENT_SPINS = 4,
+
+	/** How long the loader sleeps at a time while zones finish */
+	QUIESCENT_SLEEP_US = 50,
+
+	/**
+	 * The number of chapters whose filters and delta lists are prefetched
+	 * together before any of them is searched
+	 */
+	SPARSE_SEARCH_BATCH = 8,
 
 	/** a named constant to use when identifying zone zero */
 	ZONE_ZERO = 0
@@ -146,6 +159,9 @@ struct sparse_cache_counters {
 	/** the total number of cache searches that found no matches */
 	uint64_t search_misses;
 
+	/** the LRU clock, advanced by every zone zero hit */
+	uint64_t lru_clock;
+
 	/** the number of cache entries that fell off the end of the volume */
 	uint64_t invalidations;
 
@@ -153,6 +169,29 @@ struct sparse_cache_counters {
 	uint64_t evictions;
 } __attribute__((aligned(CACHE_LINE_BYTES)));
 
+/**
+ * The state each zone thread shares with the loader, one cache line per zone.
+ **/
+struct sparse_cache_zone {
+	/** the batch sequence number, odd while the zone may use the cache */
+	atomic64_t activity;
+
+	/** the chapter this zone most recently asked the loader for */
+	uint64_t last_requested;
+
+	/** the loader generation at the time of that request */
+	uint64_t last_generation;
+
+	/** the repeated requests this zone did not pass on to the loader */
+	uint64_t coalesced;
+
+	/** the queued chapter a whole-cache miss should wait for, or UINT64_MAX */
+	uint64_t awaited_chapter;
+
+	/** the whole-cache searches which waited for the awaited chapter */
+	uint64_t loading_waits;
+} __attribute__((aligned(CACHE_LINE_BYTES)));
+
 /**
  * This is the private structure definition of a sparse_cache.
  **/
@@ -161,23 +200,50 @@ struct sparse_cache {
 	 * array */
 	unsigned int capacity;
 
+	/** the number of leading entries which have memory and may be used */
+	unsigned int live_count;
+
 	/** the number of zone threads using the cache */
 	unsigned int zone_count;
 
+	/** whether each chapter index is also kept decoded */
+	bool decoded;
+
 	/** the geometry governing the volume */
 	const struct geometry *geometry;
 
-	/** the number of search misses in zone zero that will disable
-	 * searching */
-	unsigned int skip_search_threshold;
+	/** the volume from which chapter indexes are loaded */
+	const struct volume *volume;
 
 	/** pointers to the cache-aligned chapter search order for each zone */
 	struct search_list *search_lists[MAX_ZONES];
 
-	/** the thread barriers used to synchronize the zone threads for update
-	 */
-	struct barrier begin_cache_update;
-	struct barrier end_cache_update;
+	/** the number of loads the loader has finished, successful or not */
+	uint64_t load_generation;
+
+	/** the loader thread and the state protected by its mutex */
+	struct thread *loader;
+	struct mutex loader_mutex;
+	struct cond_var loader_cond;
+	bool loader_exiting;
+	/** the chapter being loaded, or UINT64_MAX */
+	uint64_t loading_chapter;
+	/** the oldest virtual chapter reported by any zone */
+	uint64_t oldest_virtual_chapter;
+	/** the number of entries the cache has been asked to keep */
+	unsigned int target_count;
+	/** whether the loader is adding or dropping entries */
+	bool resizing;
+	/** the chapters waiting to be loaded, oldest request first */
+	unsigned int pending_count;
+	uint64_t pending[MAX_PENDING_LOADS];
+	/** the requests which were queued, coalesced, or dropped */
+	uint64_t loads_queued;
+	uint64_t loads_coalesced;
+	uint64_t loads_dropped;
+
+	/** the per-zone state shared with the loader (cache-aligned) */
+	struct sparse_cache_zone zones[MAX_ZONES];
 
 	/** frequently-updated counter fields (cache-aligned) */
 	struct sparse_cache_counters counters;
@@ -186,63 +252,76 @@ struct sparse_cache {
 	struct cached_chapter_index chapters[];
 };
 
+static void sparse_cache_loader(void *arg);
+
 /**
  * Initialize a sparse chapter index cache.
  *
  * @param cache      the sparse cache to initialize
- * @param geometry   the geometry governing the volume
+ * @param volume     the volume from which chapter indexes are read
  * @param capacity   the number of chapters the cache will hold
  * @param zone_count  the number of zone threads using the cache
+ * @param decoded     whether to also keep chapter indexes decoded
  *
  * @return UDS_SUCCESS or an error code
  **/
 static int __must_check initialize_sparse_cache(struct sparse_cache *cache,
-						const struct geometry *geometry,
+						const struct volume *volume,
 						unsigned int capacity,
-						unsigned int zone_count)
+						unsigned int zone_count,
+						bool decoded)
 {
 	unsigned int i;
 	int result;
 
-	cache->geometry = geometry;
+	cache->geometry = volume->geometry;
+	cache->volume = volume;
 	cache->capacity = capacity;
+	cache->live_count = capacity;
+	cache->target_count = capacity;
 	cache->zone_count = zone_count;
+	cache->decoded = decoded;
+	cache->loading_chapter = UINT64_MAX;
 
-	// Scale down the skip threshold by the number of zones since we count
-	// the chapter search misses only in zone zero.
-	cache->skip_search_threshold = (SKIP_SEARCH_THRESHOLD / zone_count);
-
-	result = uds_initialize_barrier(&cache->begin_cache_update, zone_count);
-	if (result != UDS_SUCCESS) {
-		return result;
-	}
-	result = uds_initialize_barrier(&cache->end_cache_update, zone_count);
-	if (result != UDS_SUCCESS) {
-		return result;
-	}
 	for (i = 0; i < capacity; i++) {
 		result = initialize_cached_chapter_index(&cache->chapters[i],
-							 geometry);
+							 cache->geometry,
+							 decoded);
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
 	}
 
-	// Allocate each zone's independent LRU order.
+	// Allocate each zone's independent search order.
 	for (i = 0; i < zone_count; i++) {
 		result = make_search_list(capacity, &cache->search_lists[i]);
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
+		cache->zones[i].last_requested = UINT64_MAX;
+		cache->zones[i].awaited_chapter = UINT64_MAX;
 	}
-	return UDS_SUCCESS;
+
+	result = uds_init_mutex(&cache->loader_mutex);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	result = uds_init_cond(&cache->loader_cond);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	return uds_create_thread(sparse_cache_loader, cache, "sparseload",
+				 &cache->loader);
 }
 
-/**********************************************************************/
-int make_sparse_cache(const struct geometry *geometry,
-		      unsigned int capacity,
-		      unsigned int zone_count,
-		      struct sparse_cache **cache_ptr)
+/**
+ * Allocate and initialize a sparse cache.
+ **/
+static int allocate_sparse_cache(const struct volume *volume,
+				 unsigned int capacity,
+				 unsigned int zone_count,
+				 bool decoded,
+				 struct sparse_cache **cache_ptr)
 {
 	unsigned int bytes =
 		(sizeof(struct sparse_cache) +
@@ -254,8 +333,8 @@ int make_sparse_cache(const struct geometry *geometry,
 		return result;
 	}
 
-	result =
-		initialize_sparse_cache(cache, geometry, capacity, zone_count);
+	result = initialize_sparse_cache(cache, volume, capacity, zone_count,
+					 decoded);
 	if (result != UDS_SUCCESS) {
 		free_sparse_cache(cache);
 		return result;
@@ -265,6 +344,23 @@ int make_sparse_cache(const struct geometry *geometry,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+int make_sparse_cache(const struct volume *volume,
+		      unsigned int capacity,
+		      unsigned int zone_count,
+		      bool decoded,
+		      struct sparse_cache **cache_ptr)
+{
+	enum uds_memory_tag tag = uds_set_memory_tag(UDS_MEMORY_SPARSE_CACHE);
+	int result = allocate_sparse_cache(volume,
+					   capacity,
+					   zone_count,
+					   decoded,
+					   cache_ptr);
+	uds_set_memory_tag(tag);
+	return result;
+}
+
 /**********************************************************************/
 size_t get_sparse_cache_memory_size(const struct sparse_cache *cache)
 {
@@ -273,8 +369,32 @@ size_t get_sparse_cache_memory_size(const struct sparse_cache *cache)
 	size_t page_size = (sizeof(struct delta_index_page) +
 			    cache->geometry->bytes_per_page);
 	size_t chapter_size =
-		(page_size * cache->geometry->index_pages_per_chapter);
-	return (cache->capacity * chapter_size);
+		((page_size * cache->geometry->index_pages_per_chapter) +
+		 get_cached_chapter_filter_size(cache->geometry));
+	if (cache->decoded) {
+		chapter_size +=
+			get_cached_chapter_decoded_size(cache->geometry);
+	}
+	return (READ_ONCE(cache->live_count) * chapter_size);
+}
+
+/**********************************************************************/
+struct thread *get_sparse_cache_loader(const struct sparse_cache *cache)
+{
+	return cache->loader;
+}
+
+/**
+ * Stamp a chapter with the LRU clock after a zone zero hit.
+ *
+ * @param cache      the cache to update
+ * @param chapter    the cache entry which was hit
+ **/
+static void touch_chapter(struct sparse_cache *cache,
+			  struct cached_chapter_index *chapter)
+{
+	cache->counters.lru_clock += 1;
+	WRITE_ONCE(chapter->counters.last_used, cache->counters.lru_clock);
 }
 
 /**
@@ -288,6 +408,7 @@ static void score_chapter_hit(struct sparse_cache *cache,
 			      struct cached_chapter_index *chapter)
 {
 	cache->counters.chapter_hits += 1;
+	touch_chapter(cache, chapter);
 	set_skip_search(chapter, false);
 }
 
@@ -303,20 +424,21 @@ static void score_chapter_miss(struct sparse_cache *cache)
 
 /**
  * Check if the cache entry that is about to be replaced is already dead, and
- * if it's not, add to tally of evicted or invalidated cache entries.
+ * if it's not, add to tally of evicted or invalidated cache entries. Only
+ * the loader thread calls this.
  *
- * @param zone       the zone used to find the oldest chapter
  * @param cache      the cache to update
  * @param chapter    the cache entry about to be replaced
+ * @param oldest     the oldest virtual chapter in the volume
  **/
-static void score_eviction(struct index_zone *zone,
-			   struct sparse_cache *cache,
-			   struct cached_chapter_index *chapter)
+static void score_eviction(struct sparse_cache *cache,
+			   struct cached_chapter_index *chapter,
+			   uint64_t oldest)
 {
 	if (chapter->virtual_chapter == UINT64_MAX) {
 		return;
 	}
-	if (chapter->virtual_chapter < zone->oldest_virtual_chapter) {
+	if (chapter->virtual_chapter < oldest) {
 		cache->counters.invalidations += 1;
 	} else {
 		cache->counters.evictions += 1;
@@ -325,7 +447,7 @@ static void score_eviction(struct index_zone *zone,
 
 /**
  * Update counters to reflect a cache search hit. This bumps the hit
- * count, clears the miss count, and clears the skip_search flag.
+ * count, raises the hit rate estimate, and clears the skip_search flag.
  *
  * @param cache      the cache to update
  * @param chapter    the cache entry to update
@@ -333,15 +455,19 @@ static void score_eviction(struct index_zone *zone,
 static void score_search_hit(struct sparse_cache *cache,
 			     struct cached_chapter_index *chapter)
 {
+	uint64_t rate = chapter->counters.hit_rate;
 	cache->counters.search_hits += 1;
 	chapter->counters.search_hits += 1;
-	chapter->counters.consecutive_misses = 0;
+	chapter->counters.hit_rate =
+		(rate - (rate >> HIT_RATE_DECAY_SHIFT) +
+		 (CHAPTER_HIT_RATE_ONE >> HIT_RATE_DECAY_SHIFT));
+	touch_chapter(cache, chapter);
 	set_skip_search(chapter, false);
 }
 
 /**
- * Update counters to reflect a cache search miss. This bumps the consecutive
- * miss count, and if it goes over skip_search_threshold, sets the skip_search
+ * Update counters to reflect a cache search miss. This decays the hit rate
+ * estimate, and if it falls below SKIP_SEARCH_HIT_RATE, sets the skip_search
  * flag on the chapter.
  *
  * @param cache      the cache to update
@@ -350,15 +476,42 @@ static void score_search_hit(struct sparse_cache *cache,
 static void score_search_miss(struct sparse_cache *cache,
 			      struct cached_chapter_index *chapter)
 {
+	uint64_t rate = chapter->counters.hit_rate;
 	cache->counters.search_misses += 1;
 	chapter->counters.search_misses += 1;
-	chapter->counters.consecutive_misses += 1;
-	if (chapter->counters.consecutive_misses >
-	    cache->skip_search_threshold) {
+	chapter->counters.hit_rate = rate - (rate >> HIT_RATE_DECAY_SHIFT);
+	if (chapter->counters.hit_rate < SKIP_SEARCH_HIT_RATE) {
 		set_skip_search(chapter, true);
 	}
 }
 
+/**
+ * Decide whether zone zero should search a chapter that searching has been
+ * disabled for anyway, to find out whether its hit rate has recovered.
+ *
+ * @param zone     the zone doing the search
+ * @param chapter  the skipped cache entry
+ *
+ * @return <code>true</code> if the chapter should be probed
+ **/
+static bool should_probe_chapter(const struct index_zone *zone,
+				 struct cached_chapter_index *chapter)
+{
+	// Only zone zero keeps the counters, so only it probes.
+	if ((zone->id != ZONE_ZERO) || !READ_ONCE(chapter->skip_search) ||
+	    (chapter->virtual_chapter == UINT64_MAX) ||
+	    (chapter->virtual_chapter < zone->oldest_virtual_chapter)) {
+		return false;
+	}
+
+	chapter->counters.skipped_searches += 1;
+	if (chapter->counters.skipped_searches < SKIP_SEARCH_PROBE_INTERVAL) {
+		return false;
+	}
+	chapter->counters.skipped_searches = 0;
+	return true;
+}
+
 /**********************************************************************/
 void free_sparse_cache(struct sparse_cache *cache)
 {
@@ -367,6 +520,14 @@ void free_sparse_cache(struct sparse_cache *cache)
 		return;
 	}
 
+	if (cache->loader != NULL) {
+		uds_lock_mutex(&cache->loader_mutex);
+		cache->loader_exiting = true;
+		uds_broadcast_cond(&cache->loader_cond);
+		uds_unlock_mutex(&cache->loader_mutex);
+		uds_join_threads(cache->loader);
+	}
+
 	for (i = 0; i < cache->zone_count; i++) {
 		UDS_FREE(UDS_FORGET(cache->search_lists[i]));
 	}
@@ -376,26 +537,427 @@ void free_sparse_cache(struct sparse_cache *cache)
 		destroy_cached_chapter_index(chapter);
 	}
 
-	uds_destroy_barrier(&cache->begin_cache_update);
-	uds_destroy_barrier(&cache->end_cache_update);
+	uds_destroy_cond(&cache->loader_cond);
+	uds_destroy_mutex(&cache->loader_mutex);
 	UDS_FREE(cache);
 }
 
+/**********************************************************************/
+void begin_sparse_cache_access(struct sparse_cache *cache,
+			       unsigned int zone_number)
+{
+	atomic64_inc(&cache->zones[zone_number].activity);
+	// Order the odd sequence number before any reads of cache entries;
+	// pairs with the barrier in wait_for_quiescent_zones().
+	smp_mb();
+}
+
+/**********************************************************************/
+void end_sparse_cache_access(struct sparse_cache *cache,
+			     unsigned int zone_number)
+{
+	// Finish all reads of cache entries before declaring them unused.
+	smp_mb();
+	atomic64_inc(&cache->zones[zone_number].activity);
+}
+
+/**
+ * Wait until every zone thread which might have seen a cache entry before it
+ * was unpublished has passed a quiescent point. Zones which are idle, or
+ * which start a batch after this call begins, are not waited for.
+ *
+ * @param cache  the cache
+ **/
+static void wait_for_quiescent_zones(struct sparse_cache *cache)
+{
+	long snapshot[MAX_ZONES];
+	unsigned int z;
+
+	smp_mb();
+	for (z = 0; z < cache->zone_count; z++) {
+		snapshot[z] = atomic64_read(&cache->zones[z].activity);
+	}
+
+	for (z = 0; z < cache->zone_count; z++) {
+		unsigned int spins = 0;
+		if ((snapshot[z] & 1) == 0) {
+			continue;
+		}
+		while (atomic64_read(&cache->zones[z].activity) ==
+		       snapshot[z]) {
+			if (++spins < QUIESCENT_SPINS) {
+				uds_yield_scheduler();
+				continue;
+			}
+
+			// The zone is in a long batch; sleep rather than
+			// compete with it for a CPU.
+			uds_lock_mutex(&cache->loader_mutex);
+			uds_timed_wait_cond(&cache->loader_cond,
+					    &cache->loader_mutex,
+					    us_to_ktime(QUIESCENT_SLEEP_US));
+			uds_unlock_mutex(&cache->loader_mutex);
+		}
+	}
+	smp_mb();
+}
+
+/**
+ * Check whether a chapter is queued for the loader or being loaded. This must
+ * be called with the loader mutex held.
+ *
+ * @param cache            the cache
+ * @param virtual_chapter  the chapter to look for
+ *
+ * @return <code>true</code> if the chapter has yet to be published
+ **/
+static bool is_chapter_queued(const struct sparse_cache *cache,
+			      uint64_t virtual_chapter)
+{
+	unsigned int i;
+	if (cache->loading_chapter == virtual_chapter) {
+		return true;
+	}
+	for (i = 0; i < cache->pending_count; i++) {
+		if (cache->pending[i] == virtual_chapter) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Check whether a chapter is already cached or on its way. This must be
+ * called with the loader mutex held.
+ *
+ * @param cache            the cache
+ * @param virtual_chapter  the chapter to look for
+ *
+ * @return <code>true</code> if the loader need not be asked for it
+ **/
+static bool is_chapter_pending(const struct sparse_cache *cache,
+			       uint64_t virtual_chapter)
+{
+	unsigned int i;
+	if (is_chapter_queued(cache, virtual_chapter)) {
+		return true;
+	}
+	for (i = 0; i < cache->capacity; i++) {
+		if (READ_ONCE(cache->chapters[i].virtual_chapter) ==
+		    virtual_chapter) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**********************************************************************/
+void request_sparse_chapter(struct index_zone *zone, uint64_t virtual_chapter)
+{
+	struct sparse_cache *cache = zone->index->volume->sparse_cache;
+	struct sparse_cache_zone *cache_zone = &cache->zones[zone->id];
+	uint64_t generation = READ_ONCE(cache->load_generation);
+
+	// Hooks tend to arrive in runs from the same chapter; don't take the
+	// mutex again until the loader has made progress.
+	if ((cache_zone->last_requested == virtual_chapter) &&
+	    (cache_zone->last_generation == generation)) {
+		WRITE_ONCE(cache_zone->coalesced, cache_zone->coalesced + 1);
+		return;
+	}
+	cache_zone->last_requested = virtual_chapter;
+	cache_zone->last_generation = generation;
+
+	uds_lock_mutex(&cache->loader_mutex);
+	if (zone->oldest_virtual_chapter > cache->oldest_virtual_chapter) {
+		cache->oldest_virtual_chapter = zone->oldest_virtual_chapter;
+	}
+	if (is_chapter_pending(cache, virtual_chapter)) {
+		cache->loads_coalesced += 1;
+		if (is_chapter_queued(cache, virtual_chapter)) {
+			cache_zone->awaited_chapter = virtual_chapter;
+		}
+	} else if ((cache->pending_count < MAX_PENDING_LOADS) &&
+		   (cache->pending_count < cache->live_count)) {
+		cache->pending[cache->pending_count] = virtual_chapter;
+		WRITE_ONCE(cache->pending_count, cache->pending_count + 1);
+		cache->loads_queued += 1;
+		cache_zone->awaited_chapter = virtual_chapter;
+		uds_signal_cond(&cache->loader_cond);
+	} else {
+		cache->loads_dropped += 1;
+	}
+	uds_unlock_mutex(&cache->loader_mutex);
+}
+
+/**
+ * Wait for the loader to publish the chapter this zone most recently asked
+ * for, if it has not already. The names which follow a hook tend to come
+ * from the hook's chapter, so a name which misses in the cache while that
+ * chapter is on its way is held until it arrives, rather than reported as
+ * new. Only the zone which asked waits, and only once per chapter it asked
+ * for. The zone leaves its cache access while it waits, so that the loader
+ * can evict an entry to make room.
+ *
+ * @param zone  the zone whose search of the whole cache missed
+ *
+ * @return <code>true</code> if the cache may now hold the chapter, and
+ *         should be searched again
+ **/
+static bool wait_for_awaited_chapter(struct index_zone *zone)
+{
+	struct sparse_cache *cache = zone->index->volume->sparse_cache;
+	struct sparse_cache_zone *cache_zone = &cache->zones[zone->id];
+	uint64_t virtual_chapter = cache_zone->awaited_chapter;
+
+	if (virtual_chapter == UINT64_MAX) {
+		return false;
+	}
+	cache_zone->awaited_chapter = UINT64_MAX;
+
+	// Searches made earlier in this batch hold no cache entries, so the
+	// zone may pass a quiescent point here.
+	end_sparse_cache_access(cache, zone->id);
+	uds_lock_mutex(&cache->loader_mutex);
+	while (!cache->loader_exiting &&
+	       is_chapter_queued(cache, virtual_chapter)) {
+		uds_wait_cond(&cache->loader_cond, &cache->loader_mutex);
+	}
+	uds_unlock_mutex(&cache->loader_mutex);
+	begin_sparse_cache_access(cache, zone->id);
+
+	WRITE_ONCE(cache_zone->loading_waits, cache_zone->loading_waits + 1);
+	return true;
+}
+
+/**
+ * Choose the cache entry to replace: a dead or expired entry if there is one,
+ * else the least recently used entry which has searching disabled, else the
+ * least recently used entry.
+ *
+ * @param cache   the cache
+ * @param oldest  the oldest virtual chapter in the volume
+ *
+ * @return the entry to replace
+ **/
+static struct cached_chapter_index *
+select_victim(struct sparse_cache *cache, uint64_t oldest)
+{
+	struct cached_chapter_index *skipped = NULL;
+	struct cached_chapter_index *live = NULL;
+	unsigned int i;
+
+	for (i = 0; i < cache->live_count; i++) {
+		struct cached_chapter_index *chapter = &cache->chapters[i];
+		struct cached_chapter_index **best;
+		if ((chapter->virtual_chapter == UINT64_MAX) ||
+		    (chapter->virtual_chapter < oldest)) {
+			return chapter;
+		}
+
+		best = (READ_ONCE(chapter->skip_search) ? &skipped : &live);
+		if ((*best == NULL) ||
+		    (READ_ONCE(chapter->counters.last_used) <
+		     READ_ONCE((*best)->counters.last_used))) {
+			*best = chapter;
+		}
+	}
+	return ((skipped != NULL) ? skipped : live);
+}
+
+/**
+ * Load a chapter index into the cache on behalf of the zone threads. Only
+ * the loader thread calls this, without holding the loader mutex.
+ *
+ * @param cache            the cache
+ * @param virtual_chapter  the chapter to load
+ * @param oldest           the oldest virtual chapter in the volume
+ **/
+static void load_sparse_chapter(struct sparse_cache *cache,
+				uint64_t virtual_chapter,
+				uint64_t oldest)
+{
+	struct cached_chapter_index *victim;
+	int result;
+
+	// The hook may have fallen out of the index while it waited.
+	if (virtual_chapter < oldest) {
+		return;
+	}
+
+	victim = select_victim(cache, oldest);
+	score_eviction(cache, victim, oldest);
+	if (victim->virtual_chapter != UINT64_MAX) {
+		// Unpublish the victim, then wait out every zone that might
+		// still be searching it.
+		WRITE_ONCE(victim->virtual_chapter, UINT64_MAX);
+		wait_for_quiescent_zones(cache);
+	}
+
+	// Start the new entry off as the most recently used.
+	victim->counters.last_used = READ_ONCE(cache->counters.lru_clock);
+	result = cache_chapter_index(victim, virtual_chapter, cache->volume);
+	if (result != UDS_SUCCESS) {
+		uds_log_warning_strerror(result,
+					 "could not cache sparse chapter %llu",
+					 (unsigned long long) virtual_chapter);
+	}
+}
+
+/**
+ * Add or drop cache entries so that the cache holds a given number of
+ * chapters. Dropped entries are unpublished and freed once no zone can be
+ * searching them. Only the loader thread calls this, without holding the
+ * loader mutex.
+ *
+ * @param cache   the cache
+ * @param target  the number of entries to keep
+ *
+ * @return the number of entries now in use, which is less than the target
+ *         if memory for more could not be allocated
+ **/
+static unsigned int resize_sparse_entries(struct sparse_cache *cache,
+					  unsigned int target)
+{
+	unsigned int live = cache->live_count;
+	enum uds_memory_tag tag;
+	unsigned int i;
+
+	if (target < live) {
+		for (i = target; i < live; i++) {
+			WRITE_ONCE(cache->chapters[i].virtual_chapter,
+				   UINT64_MAX);
+		}
+		wait_for_quiescent_zones(cache);
+		for (i = target; i < live; i++) {
+			destroy_cached_chapter_index(&cache->chapters[i]);
+		}
+		return target;
+	}
+
+	tag = uds_set_memory_tag(UDS_MEMORY_SPARSE_CACHE);
+	for (i = live; i < target; i++) {
+		int result =
+			initialize_cached_chapter_index(&cache->chapters[i],
+							cache->geometry,
+							cache->decoded);
+		if (result != UDS_SUCCESS) {
+			destroy_cached_chapter_index(&cache->chapters[i]);
+			uds_log_warning_strerror(result,
+						 "could not grow sparse cache beyond %u chapters",
+						 i);
+			break;
+		}
+	}
+	uds_set_memory_tag(tag);
+	return i;
+}
+
+/**********************************************************************/
+void resize_sparse_cache(struct sparse_cache *cache, unsigned int chapters)
+{
+	uds_lock_mutex(&cache->loader_mutex);
+	cache->target_count = min(max(chapters, 1U), cache->capacity);
+	uds_broadcast_cond(&cache->loader_cond);
+	uds_unlock_mutex(&cache->loader_mutex);
+}
+
+/**
+ * The body of the loader thread, which serves chapter requests from the zone
+ * threads until the cache is freed.
+ *
+ * @param arg  the sparse cache
+ **/
+static void sparse_cache_loader(void *arg)
+{
+	struct sparse_cache *cache = arg;
+
+	uds_lock_mutex(&cache->loader_mutex);
+	while (true) {
+		uint64_t virtual_chapter, oldest;
+		while ((cache->pending_count == 0) &&
+		       (cache->target_count == cache->live_count) &&
+		       !cache->loader_exiting) {
+			uds_wait_cond(&cache->loader_cond,
+				      &cache->loader_mutex);
+		}
+		if (cache->loader_exiting) {
+			break;
+		}
+
+		if (cache->target_count != cache->live_count) {
+			unsigned int target = cache->target_count;
+			unsigned int live;
+			cache->resizing = true;
+			uds_unlock_mutex(&cache->loader_mutex);
+
+			live = resize_sparse_entries(cache, target);
+
+			uds_lock_mutex(&cache->loader_mutex);
+			WRITE_ONCE(cache->live_count, live);
+			if ((live < target) && (cache->target_count == target)) {
+				// Don't retry a growth which failed.
+				cache->target_count = live;
+			}
+			cache->resizing = false;
+			uds_broadcast_cond(&cache->loader_cond);
+			continue;
+		}
+
+		virtual_chapter = cache->pending[0];
+		// Publish the load before the queue shrinks, so that a zone
+		// never sees neither.
+		WRITE_ONCE(cache->loading_chapter, virtual_chapter);
+		WRITE_ONCE(cache->pending_count, cache->pending_count - 1);
+		memmove(&cache->pending[0], &cache->pending[1],
+			cache->pending_count * sizeof(uint64_t));
+		oldest = cache->oldest_virtual_chapter;
+		uds_unlock_mutex(&cache->loader_mutex);
+
+		load_sparse_chapter(cache, virtual_chapter, oldest);
+
+		uds_lock_mutex(&cache->loader_mutex);
+		WRITE_ONCE(cache->loading_chapter, UINT64_MAX);
+		WRITE_ONCE(cache->load_generation, cache->load_generation + 1);
+		uds_broadcast_cond(&cache->loader_cond);
+	}
+	uds_unlock_mutex(&cache->loader_mutex);
+}
+
+/**********************************************************************/
+void get_sparse_cache_stats(struct sparse_cache *cache,
+			    struct uds_sparse_cache_stats *stats)
+{
+	unsigned int z;
+
+	memset(stats, 0, sizeof(*stats));
+	if (cache == NULL) {
+		return;
+	}
+
+	stats->chapter_hits = READ_ONCE(cache->counters.chapter_hits);
+	stats->chapter_misses = READ_ONCE(cache->counters.chapter_misses);
+	for (z = 0; z < cache->zone_count; z++) {
+		stats->loads_coalesced += READ_ONCE(cache->zones[z].coalesced);
+		stats->loading_waits +=
+			READ_ONCE(cache->zones[z].loading_waits);
+	}
+
+	uds_lock_mutex(&cache->loader_mutex);
+	stats->loads_queued = cache->loads_queued;
+	stats->loads_coalesced += cache->loads_coalesced;
+	stats->loads_dropped = cache->loads_dropped;
+	uds_unlock_mutex(&cache->loader_mutex);
+
+	stats->invalidations = READ_ONCE(cache->counters.invalidations);
+	stats->evictions = READ_ONCE(cache->counters.evictions);
+}
 
 /**********************************************************************/
 bool sparse_cache_contains(struct sparse_cache *cache,
 			   uint64_t virtual_chapter,
 			   unsigned int zone_number)
 {
-	/*
-	 * The correctness of the barriers depends on the invariant that
-	 * between calls to update_sparse_cache(), the answers this function
-	 * returns must never vary--the result for a given chapter must be
-	 * identical across zones. That invariant must be maintained even if
-	 * the chapter falls off the end of the volume, or if searching it is
-	 * disabled because of too many search misses.
-	 */
-
 	// Get the chapter search order for this zone thread.
 	struct search_list_iterator iterator =
 		iterate_search_list(cache->search_lists[zone_number],
@@ -403,7 +965,7 @@ bool sparse_cache_contains(struct sparse_cache *cache,
 	while (has_next_chapter(&iterator)) {
 		struct cached_chapter_index *chapter =
 			get_next_chapter(&iterator);
-		if (virtual_chapter == chapter->virtual_chapter) {
+		if (virtual_chapter == READ_ONCE(chapter->virtual_chapter)) {
 			if (zone_number == ZONE_ZERO) {
 				score_chapter_hit(cache, chapter);
 			}
@@ -421,80 +983,6 @@ bool sparse_cache_contains(struct sparse_cache *cache,
 	return false;
 }
 
-/**********************************************************************/
-int update_sparse_cache(struct index_zone *zone, uint64_t virtual_chapter)
-{
-	int result = UDS_SUCCESS;
-	const struct uds_index *index = zone->index;
-	struct sparse_cache *cache = index->volume->sparse_cache;
-
-	// If the chapter is already in the cache, we don't need to do a thing
-	// except update the search list order, which this check does.
-	if (sparse_cache_contains(cache, virtual_chapter, zone->id)) {
-		return UDS_SUCCESS;
-	}
-
-	// Wait for every zone thread to have reached its corresponding barrier
-	// request and invoked this function before starting to modify the
-	// cache.
-	uds_enter_barrier(&cache->begin_cache_update, NULL);
-
-	/*
-	 * This is the start of the critical section: the zone zero thread is
-	 * captain, effectively holding an exclusive lock on the sparse cache.
-	 * All the other zone threads must do nothing between the two barriers.
-	 * They will wait at the end_cache_update barrier for the captain to
-	 * finish the update.
-	 */
-
-	if (zone->id == ZONE_ZERO) {
-		unsigned int z;
-		// Purge invalid chapters from the LRU search list.
-		struct search_list *zone_zero_list =
-			cache->search_lists[ZONE_ZERO];
-		purge_search_list(zone_zero_list,
-				  cache->chapters,
-				  zone->oldest_virtual_chapter);
-
-		// First check that the desired chapter is still in the volume.
-		// If it's not, the hook fell out of the index and there's
-		// nothing to do for it.
-		if (virtual_chapter >= index->oldest_virtual_chapter) {
-			// Evict the least recently used live chapter, or
-			// replace a dead cache entry, all by rotating the the
-			// last list entry to the front.
-			struct cached_chapter_index *victim =
-				&cache->chapters[rotate_search_list(zone_zero_list,
-								    cache->capacity)];
-
-			// Check if the victim is already dead, and if it's
-			// not, add to the tally of evicted or invalidated
-			// cache entries.
-			score_eviction(zone, cache, victim);
-
-			// Read the index page bytes and initialize the page
-			// array.
-			result = cache_chapter_index(victim, virtual_chapter,
-						     index->volume);
-		}
-
-		// Copy the new search list state to all the other zone threads
-		// so they'll get the result of pruning and see the new
-		// chapter.
-		for (z = 1; z < cache->zone_count; z++) {
-			copy_search_list(zone_zero_list,
-					 cache->search_lists[z]);
-		}
-	}
-
-	// This is the end of the critical section. All cache invariants must
-	// have been restored--it will be shared/read-only again beyond the
-	// barrier.
-
-	uds_enter_barrier(&cache->end_cache_update, NULL);
-	return result;
-}
-
 /**********************************************************************/
 void invalidate_sparse_cache(struct sparse_cache *cache)
 {
@@ -502,83 +990,236 @@ void invalidate_sparse_cache(struct sparse_cache *cache)
 	if (cache == NULL) {
 		return;
 	}
+
+	uds_lock_mutex(&cache->loader_mutex);
+	WRITE_ONCE(cache->pending_count, 0);
+	while ((cache->loading_chapter != UINT64_MAX) || cache->resizing) {
+		uds_wait_cond(&cache->loader_cond, &cache->loader_mutex);
+	}
 	for (i = 0; i < cache->capacity; i++) {
 		struct cached_chapter_index *chapter = &cache->chapters[i];
-		chapter->virtual_chapter = UINT64_MAX;
+		WRITE_ONCE(chapter->virtual_chapter, UINT64_MAX);
 		release_cached_chapter_index(chapter);
 	}
+	WRITE_ONCE(cache->load_generation, cache->load_generation + 1);
+	uds_unlock_mutex(&cache->loader_mutex);
 }
 
-/**********************************************************************/
-int search_sparse_cache(struct index_zone *zone,
-			const struct uds_chunk_name *name,
-			uint64_t *virtual_chapter_ptr,
-			int *record_page_ptr)
+/**
+ * Search one chapter of the sparse cache which may hold a chunk name, keeping
+ * the statistics and search order up to date.
+ *
+ * @param [in]  zone             the zone doing the search
+ * @param [in]  list             the search list of the zone
+ * @param [in]  position         the position of the chapter in the list
+ * @param [in]  may_contain      whether the chapter filter passed the name
+ * @param [in]  name             the chunk name to search for
+ * @param [out] record_page_ptr  the record page number of a match, else
+ *                               NO_CHAPTER_INDEX_ENTRY
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int search_cached_chapter(struct index_zone *zone,
+				 struct search_list *list,
+				 uint8_t position,
+				 bool may_contain,
+				 const struct uds_chunk_name *name,
+				 int *record_page_ptr)
 {
 	struct volume *volume = zone->index->volume;
 	struct sparse_cache *cache = volume->sparse_cache;
-	unsigned int zone_number = zone->id;
-	// If the caller did not specify a virtual chapter, search the entire
-	// cache.
-	bool search_all = (*virtual_chapter_ptr == UINT64_MAX);
-	unsigned int chapters_searched = 0;
+	struct cached_chapter_index *chapter =
+		&cache->chapters[list->entries[position]];
+	*record_page_ptr = NO_CHAPTER_INDEX_ENTRY;
+	if (may_contain) {
+		int result = search_cached_chapter_index(chapter,
+							 cache->geometry,
+							 volume->index_page_map,
+							 name,
+							 record_page_ptr);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
 
-	// Get the chapter search order for this zone thread, searching the
-	// chapters from most recently hit to least recently hit.
-	struct search_list_iterator iterator =
-		iterate_search_list(cache->search_lists[zone_number],
-				    cache->chapters);
-	while (has_next_chapter(&iterator)) {
-		int result;
-		struct cached_chapter_index *chapter =
-			get_next_chapter(&iterator);
+	if (*record_page_ptr == NO_CHAPTER_INDEX_ENTRY) {
+		if (zone->id == ZONE_ZERO) {
+			score_search_miss(cache, chapter);
+		}
+		return UDS_SUCCESS;
+	}
 
-		// Skip chapters no longer cached, or that have too many search
-		// misses.
-		if (should_skip_chapter_index(zone, chapter,
-					      *virtual_chapter_ptr)) {
+	if (zone->id == ZONE_ZERO) {
+		score_search_hit(cache, chapter);
+	}
+
+	// Move the chapter to the front of the search list.
+	rotate_search_list(list, position + 1);
+	return UDS_SUCCESS;
+}
+
+/**
+ * Search every chapter in the sparse cache for a chunk name. The chapters are
+ * searched newest first, so that the match returned is the one the dense
+ * index would have found. Rather than taking the cache misses of each chapter
+ * in turn, the filter words and then the delta lists of a batch of chapters
+ * are prefetched together, so the memory latency of the batch overlaps.
+ *
+ * @param [in]  zone                 the zone doing the search
+ * @param [in]  name                 the chunk name to search for
+ * @param [out] virtual_chapter_ptr  the virtual chapter of a match
+ * @param [out] record_page_ptr      the record page number of a match, else
+ *                                   NO_CHAPTER_INDEX_ENTRY
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int search_all_cached_chapters(struct index_zone *zone,
+				      const struct uds_chunk_name *name,
+				      uint64_t *virtual_chapter_ptr,
+				      int *record_page_ptr)
+{
+	struct volume *volume = zone->index->volume;
+	struct sparse_cache *cache = volume->sparse_cache;
+	const struct geometry *geometry = cache->geometry;
+	struct search_list *list = cache->search_lists[zone->id];
+	uint8_t positions[UINT8_MAX];
+	unsigned int count = 0;
+	unsigned int base, i;
+
+	// Collect the chapters worth searching: those still cached, and
+	// those with too low a hit rate only when it is time to probe them.
+	for (i = 0; i < list->capacity; i++) {
+		struct cached_chapter_index *chapter =
+			&cache->chapters[list->entries[i]];
+		if (should_skip_chapter_index(zone, chapter, UINT64_MAX) &&
+		    !should_probe_chapter(zone, chapter)) {
 			continue;
 		}
+		positions[count++] = i;
+	}
 
-		result = search_cached_chapter_index(chapter,
-						     cache->geometry,
-						     volume->index_page_map,
-						     name,
-						     record_page_ptr);
-		if (result != UDS_SUCCESS) {
-			return result;
+	// Pairs with the barrier publishing the entry in
+	// cache_chapter_index().
+	smp_rmb();
+
+	// Order the candidates newest first. The list is short and usually
+	// close to sorted already, so an insertion sort is plenty.
+	for (i = 1; i < count; i++) {
+		uint8_t position = positions[i];
+		uint64_t chapter =
+			cache->chapters[list->entries[position]].virtual_chapter;
+		unsigned int j = i;
+		while ((j > 0) &&
+		       (cache->chapters[list->entries[positions[j - 1]]]
+				.virtual_chapter < chapter)) {
+			positions[j] = positions[j - 1];
+			j--;
 		}
-		chapters_searched += 1;
+		positions[j] = position;
+	}
 
-		// Did we find an index entry for the name?
-		if (*record_page_ptr != NO_CHAPTER_INDEX_ENTRY) {
-			if (zone_number == ZONE_ZERO) {
-				score_search_hit(cache, chapter);
+	for (base = 0; base < count; base += SPARSE_SEARCH_BATCH) {
+		unsigned int batch = min(count - base,
+					 (unsigned int) SPARSE_SEARCH_BATCH);
+		struct cached_chapter_index *chapters[SPARSE_SEARCH_BATCH];
+		bool may_contain[SPARSE_SEARCH_BATCH];
+
+		for (i = 0; i < batch; i++) {
+			chapters[i] = &cache->chapters[list->entries
+							    [positions[base + i]]];
+			prefetch_cached_chapter_filter(chapters[i], geometry,
+						       name);
+		}
+
+		for (i = 0; i < batch; i++) {
+			may_contain[i] = cached_chapter_may_contain(chapters[i],
+								    geometry,
+								    name);
+			if (may_contain[i]) {
+				prefetch_cached_chapter_list_header(
+					chapters[i], geometry,
+					volume->index_page_map, name);
 			}
+		}
 
-			// Move the chapter to the front of the search list.
-			rotate_search_list(iterator.list, iterator.next_entry);
+		for (i = 0; i < batch; i++) {
+			if (may_contain[i]) {
+				prefetch_cached_chapter_list(
+					chapters[i], geometry,
+					volume->index_page_map, name);
+			}
+		}
+
+		for (i = 0; i < batch; i++) {
+			uint64_t virtual_chapter = chapters[i]->virtual_chapter;
+			int result = search_cached_chapter(zone, list,
+							   positions[base + i],
+							   may_contain[i],
+							   name,
+							   record_page_ptr);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
 
 			// Return a matching entry as soon as it is found. It
 			// might be a false collision that has a true match in
-			// another chapter, but that's a very rare case and not
-			// worth the extra search cost or complexity.
-			*virtual_chapter_ptr = chapter->virtual_chapter;
-			return UDS_SUCCESS;
+			// an older chapter, but that's a very rare case and
+			// not worth the extra search cost or complexity.
+			if (*record_page_ptr != NO_CHAPTER_INDEX_ENTRY) {
+				*virtual_chapter_ptr = virtual_chapter;
+				return UDS_SUCCESS;
+			}
 		}
+	}
+	return UDS_SUCCESS;
+}
 
-		if (zone_number == ZONE_ZERO) {
-			score_search_miss(cache, chapter);
+/**********************************************************************/
+int search_sparse_cache(struct index_zone *zone,
+			const struct uds_chunk_name *name,
+			uint64_t *virtual_chapter_ptr,
+			int *record_page_ptr)
+{
+	struct sparse_cache *cache = zone->index->volume->sparse_cache;
+	struct search_list *list = cache->search_lists[zone->id];
+	unsigned int i;
+
+	*record_page_ptr = NO_CHAPTER_INDEX_ENTRY;
+
+	// If the caller did not specify a virtual chapter, search the entire
+	// cache, and again once any chapter the zone is waiting for arrives.
+	if (*virtual_chapter_ptr == UINT64_MAX) {
+		int result = search_all_cached_chapters(zone, name,
+							virtual_chapter_ptr,
+							record_page_ptr);
+		if ((result != UDS_SUCCESS) ||
+		    (*record_page_ptr != NO_CHAPTER_INDEX_ENTRY) ||
+		    !wait_for_awaited_chapter(zone)) {
+			return result;
 		}
+		return search_all_cached_chapters(zone, name,
+						  virtual_chapter_ptr,
+						  record_page_ptr);
+	}
 
-		if (!search_all) {
-			// We just searched the virtual chapter the caller
-			// specified and there was no match, so we're done.
-			break;
+	for (i = 0; i < list->capacity; i++) {
+		struct cached_chapter_index *chapter =
+			&cache->chapters[list->entries[i]];
+		if (should_skip_chapter_index(zone, chapter,
+					      *virtual_chapter_ptr)) {
+			continue;
 		}
+
+		// Pairs with the barrier publishing the entry in
+		// cache_chapter_index().
+		smp_rmb();
+
+		// We search only the virtual chapter the caller specified,
+		// whether or not there is a match.
+		return search_cached_chapter(zone, list, i, true, name,
+					     record_page_ptr);
 	}
 
 	// The name was not found in the cache.
-	*record_page_ptr = NO_CHAPTER_INDEX_ENTRY;
 	return UDS_SUCCESS;
 }
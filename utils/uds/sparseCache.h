@@ -35,28 +35,34 @@
  * cache.
  *
  * Searching the cache is an unsynchronized operation. Changing the contents
- * of the cache is a coordinated process requiring the coordinated
- * participation of all zone threads via the careful use of barrier messages
- * sent to all the index zones by the triage queue worker thread.
+ * of the cache is done by a loader thread owned by the cache, which the zone
+ * threads ask for chapters they could not find. The loader only reuses an
+ * entry once every zone thread has passed a quiescent point, so the zone
+ * threads never wait for it.
  **/
 struct sparse_cache;
 
-// Bare declaration to avoid include dependency loops.
+// Bare declarations to avoid include dependency loops.
+struct thread;
 struct uds_index;
+struct volume;
 
 /**
  * Allocate and initialize a sparse chapter index cache.
  *
- * @param [in]  geometry    the geometry governing the volume
+ * @param [in]  volume      the volume from which chapter indexes are read
  * @param [in]  capacity    the number of chapters the cache will hold
  * @param [in]  zone_count  the number of zone threads using the cache
+ * @param [in]  decoded     whether to also keep each cached chapter index
+ *                          decoded, trading memory for search time
  * @param [out] cache_ptr   a pointer in which to return the new cache
  *
  * @return UDS_SUCCESS or an error code
  **/
-int __must_check make_sparse_cache(const struct geometry *geometry,
+int __must_check make_sparse_cache(const struct volume *volume,
 				   unsigned int capacity,
 				   unsigned int zone_count,
+				   bool decoded,
 				   struct sparse_cache **cache_ptr);
 
 /**
@@ -73,6 +79,47 @@ void free_sparse_cache(struct sparse_cache *cache);
  **/
 size_t get_sparse_cache_memory_size(const struct sparse_cache *cache);
 
+/**
+ * Change the number of chapters a sparse cache may hold, within the capacity
+ * it was made with. The loader thread applies the change in the background,
+ * freeing the memory of the entries it drops and allocating it again when
+ * the cache grows.
+ *
+ * @param cache     the cache
+ * @param chapters  the number of chapters to hold, at least one
+ **/
+void resize_sparse_cache(struct sparse_cache *cache, unsigned int chapters);
+
+/**
+ * Get the thread which loads chapter indexes into a sparse cache, so that
+ * the index can place it.
+ *
+ * @param cache  the cache
+ *
+ * @return the loader thread
+ **/
+struct thread *get_sparse_cache_loader(const struct sparse_cache *cache);
+
+/**
+ * Note that a zone thread is about to process a batch of requests which may
+ * search the cache. Cache entries seen during the batch stay valid until the
+ * matching call to end_sparse_cache_access().
+ *
+ * @param cache        the cache
+ * @param zone_number  the zone number of the calling thread
+ **/
+void begin_sparse_cache_access(struct sparse_cache *cache,
+			       unsigned int zone_number);
+
+/**
+ * Note that a zone thread has passed a quiescent point and holds no
+ * references to cache entries.
+ *
+ * @param cache        the cache
+ * @param zone_number  the zone number of the calling thread
+ **/
+void end_sparse_cache_access(struct sparse_cache *cache,
+			     unsigned int zone_number);
 
 /**
  * Check whether a sparse chapter index is present in the chapter cache. This
@@ -89,35 +136,38 @@ bool sparse_cache_contains(struct sparse_cache *cache,
 			   unsigned int zone_number);
 
 /**
- * Update the sparse cache to contain a chapter index.
- *
- * This function must be called by all the zone threads with the same chapter
- * numbers to correctly enter the thread barriers used to synchronize the
- * cache updates.
+ * Ask the loader thread to add a chapter index to the sparse cache. The
+ * request is only a hint; the caller must not wait for it, and should
+ * resolve the current request through the volume page cache instead.
  *
- * @param zone             the index zone
+ * @param zone             the index zone which missed in the cache
  * @param virtual_chapter  the virtual chapter number of the chapter index
- *
- * @return UDS_SUCCESS or an error code if the chapter index could not be
- *         read or decoded
  **/
-int __must_check update_sparse_cache(struct index_zone *zone,
-				     uint64_t virtual_chapter);
+void request_sparse_chapter(struct index_zone *zone, uint64_t virtual_chapter);
 
 /**
- * Mark every chapter in the cache as invalid.
- *
- * Note that sparse_cache_contains() does and must still return true for
- * entries in the cache after this call, but those entries will not be
- * searched and their data will be invalid.
+ * Mark every chapter in the cache as invalid, discarding any pending loads.
+ * The zone threads must be idle.
  *
  * @param cache  the cache to invalidate
  **/
 void invalidate_sparse_cache(struct sparse_cache *cache);
 
+/**
+ * Get the counters of a sparse chapter index cache. The counters are read
+ * without stopping the zone threads, so they may be slightly inconsistent.
+ *
+ * @param cache  the cache, which may be NULL for a dense index
+ * @param stats  the statistics structure to fill in
+ **/
+void get_sparse_cache_stats(struct sparse_cache *cache,
+			    struct uds_sparse_cache_stats *stats);
+
 /**
  * Search the cached sparse chapter indexes for a chunk name, returning a
  * virtual chapter number and record page number that may contain the name.
+ * A search of the whole cache which misses first waits for any chapter the
+ * zone has asked the loader for and not yet seen, and then searches again.
  *
  * @param [in]     zone                 the zone containing the volume, sparse
  *                                      chapter index cache and the index page
@@ -74,6 +74,25 @@ int logging_pread(int fd,
 	return result;
 }
 
+/**********************************************************************/
+int logging_preadv(int fd,
+		   const struct iovec *iov,
+		   int iov_count,
+		   off_t offset,
+		   const char *context,
+		   ssize_t *bytes_read_ptr)
+{
+	int result;
+	do {
+		result = check_io_errors(preadv(fd, iov, iov_count, offset),
+					 __func__,
+					 context,
+					 bytes_read_ptr);
+	} while (result == EINTR);
+
+	return result;
+}
+
 /**********************************************************************/
 int logging_write(int fd,
 		  const void *buf,
@@ -124,6 +143,25 @@ int logging_pwrite(int fd,
 	return result;
 }
 
+/**********************************************************************/
+int logging_pwritev(int fd,
+		    const struct iovec *iov,
+		    int iov_count,
+		    off_t offset,
+		    const char *context,
+		    ssize_t *bytes_written_ptr)
+{
+	int result;
+	do {
+		result = check_io_errors(pwritev(fd, iov, iov_count, offset),
+					 __func__,
+					 context,
+					 bytes_written_ptr);
+	} while (result == EINTR);
+
+	return result;
+}
+
 /**********************************************************************/
 int logging_close(int fd, const char *context)
 {
@@ -23,6 +23,7 @@
 #define SYSCALLS_H 1
 
 #include <errno.h>
+#include <sys/uio.h>
 
 #include "compiler.h"
 #include "errors.h"
@@ -65,6 +66,25 @@ int __must_check logging_pread(int fd,
 			       const char *context,
 			       ssize_t *bytes_read_ptr);
 
+/**
+ * Wrap the preadv(2) system call, looping as long as errno is EINTR.
+ *
+ * @param fd             The descriptor from which to read
+ * @param iov            The buffers to read into
+ * @param iov_count      The number of buffers
+ * @param offset         The offset into the file at which to read
+ * @param context        The calling context (for logging)
+ * @param bytes_read_ptr A pointer to hold the number of bytes read
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check logging_preadv(int fd,
+				const struct iovec *iov,
+				int iov_count,
+				off_t offset,
+				const char *context,
+				ssize_t *bytes_read_ptr);
+
 /**
  * Wrap the write(2) system call, looping as long as errno is EINTR.
  *
@@ -103,6 +123,26 @@ int __must_check logging_pwrite(int fd,
 				const char *context,
 				ssize_t *bytes_written_ptr);
 
+/**
+ * Wrap the pwritev(2) system call, looping as long as errno is EINTR.
+ *
+ * @param fd                The descriptor to which to write
+ * @param iov               The buffers to write from
+ * @param iov_count         The number of buffers
+ * @param offset            The offset into the file at which to write
+ * @param context           The calling context (for logging)
+ * @param bytes_written_ptr A pointer to hold the number of bytes written;
+ *                          on error, -1 is returned
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check logging_pwritev(int fd,
+				 const struct iovec *iov,
+				 int iov_count,
+				 off_t offset,
+				 const char *context,
+				 ssize_t *bytes_written_ptr);
+
 /**
  * Wrap the close(2) system call.
  *
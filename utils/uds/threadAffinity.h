@@ -0,0 +1,112 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/threadAffinity.h#1 $
+ */
+
+#ifndef THREAD_AFFINITY_H
+#define THREAD_AFFINITY_H
+
+#include "compiler.h"
+#include "typeDefs.h"
+#include "uds.h"
+#include "uds-threads.h"
+
+/**
+ * A thread_affinity is an ordered list of CPUs, derived from the affinity
+ * policy in the uds_parameters, onto which index threads are placed. Each
+ * thread is given a slot number and is bound to the CPU at that position in
+ * the list, wrapping around if there are more threads than CPUs.
+ **/
+struct thread_affinity;
+
+/**
+ * The CPUs this process may use, as limited by its affinity mask and by any
+ * CPU bandwidth limit of its cgroup.
+ **/
+struct cpu_budget {
+	/** the number of CPUs in the affinity mask */
+	unsigned int cpus;
+	/** the CPUs worth of time the cgroup allows, or 0 if unlimited */
+	unsigned int quota_cpus;
+	/** the number of NUMA nodes with a CPU in the affinity mask */
+	unsigned int node_count;
+};
+
+/**
+ * Find the CPUs this process may use. Anything which cannot be determined is
+ * reported as unlimited, or as a single NUMA node.
+ *
+ * @param budget  the budget to fill in
+ **/
+void get_cpu_budget(struct cpu_budget *budget);
+
+/**
+ * Build the CPU placement for an affinity policy.
+ *
+ * @param user_params   the index parameters, which may be NULL
+ * @param affinity_ptr  a pointer to hold the placement, which will be set to
+ *                      NULL if no affinity was requested
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check make_thread_affinity(const struct uds_parameters *user_params,
+				      struct thread_affinity **affinity_ptr);
+
+/**
+ * Free a CPU placement.
+ *
+ * @param affinity  the placement to free, which may be NULL
+ **/
+void free_thread_affinity(struct thread_affinity *affinity);
+
+/**
+ * Bind a thread to the CPU for a slot. Failures are logged and otherwise
+ * ignored since affinity is only a performance hint.
+ *
+ * @param affinity  the placement, which may be NULL
+ * @param thread    the thread to bind
+ * @param slot      the slot number of the thread
+ **/
+void bind_thread_to_slot(const struct thread_affinity *affinity,
+			 struct thread *thread,
+			 unsigned int slot);
+
+/**
+ * Get the NUMA node of the CPU for a slot.
+ *
+ * @param affinity  the placement, which may be NULL
+ * @param slot      the slot number
+ *
+ * @return the node number, or -1 if there is no placement
+ **/
+int __must_check get_slot_node(const struct thread_affinity *affinity,
+			       unsigned int slot);
+
+/**
+ * Ask the kernel to keep a range of memory on a NUMA node, moving any pages
+ * which have already been touched. Only whole pages within the range are
+ * affected. Failures are logged and otherwise ignored.
+ *
+ * @param memory  the start of the range
+ * @param size    the size of the range in bytes
+ * @param node    the node for the memory, or -1 to do nothing
+ **/
+void bind_memory_to_node(void *memory, size_t size, int node);
+
+#endif /* THREAD_AFFINITY_H */
@@ -0,0 +1,551 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/userLinux/uds/threadAffinityLinuxUser.c#1 $
+ */
+
+#include "threadAffinity.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "permassert.h"
+
+static const char NODE_DIRECTORY[] = "/sys/devices/system/node";
+static const char CGROUP_DIRECTORY[] = "/sys/fs/cgroup";
+
+struct thread_affinity {
+	unsigned int cpu_count;
+	unsigned int cpus[CPU_SETSIZE];
+	int nodes[CPU_SETSIZE];
+};
+
+/**
+ * The NUMA topology of the CPUs this process may run on.
+ **/
+struct topology {
+	cpu_set_t allowed;
+	int node_count;
+	int node_of_cpu[CPU_SETSIZE];
+};
+
+/**
+ * Parse a CPU list of the form used by sysfs and taskset, such as "0-3,8".
+ * Each CPU is passed to a callback in the order listed.
+ *
+ * @param list     the CPU list
+ * @param visitor  the function to call for each CPU
+ * @param context  the context for the visitor
+ *
+ * @return UDS_SUCCESS or UDS_INVALID_ARGUMENT
+ **/
+static int parse_cpu_list(const char *list,
+			  void (*visitor)(unsigned int cpu, void *context),
+			  void *context)
+{
+	const char *cursor = list;
+	while ((*cursor != '\0') && (*cursor != '\n')) {
+		char *end;
+		unsigned long first = strtoul(cursor, &end, 10);
+		unsigned long last = first;
+		if (end == cursor) {
+			return UDS_INVALID_ARGUMENT;
+		}
+		if (*end == '-') {
+			cursor = end + 1;
+			last = strtoul(cursor, &end, 10);
+			if ((end == cursor) || (last < first)) {
+				return UDS_INVALID_ARGUMENT;
+			}
+		}
+		if (last >= CPU_SETSIZE) {
+			return UDS_INVALID_ARGUMENT;
+		}
+
+		unsigned long cpu;
+		for (cpu = first; cpu <= last; cpu++) {
+			visitor(cpu, context);
+		}
+
+		cursor = end;
+		if (*cursor == ',') {
+			cursor++;
+		} else if ((*cursor != '\0') && (*cursor != '\n')) {
+			return UDS_INVALID_ARGUMENT;
+		}
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+struct node_visit {
+	struct topology *topology;
+	int node;
+};
+
+/**********************************************************************/
+static void set_cpu_node(unsigned int cpu, void *context)
+{
+	struct node_visit *visit = context;
+	visit->topology->node_of_cpu[cpu] = visit->node;
+}
+
+/**
+ * Read the CPU list of each NUMA node from sysfs. If the node information is
+ * not available, every CPU is treated as being on node 0.
+ *
+ * @param topology  the topology to fill in
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int read_topology(struct topology *topology)
+{
+	if (sched_getaffinity(0, sizeof(topology->allowed),
+			      &topology->allowed) != 0) {
+		return uds_log_error_strerror(errno,
+					      "sched_getaffinity() failed");
+	}
+
+	unsigned int cpu;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		topology->node_of_cpu[cpu] = 0;
+	}
+	topology->node_count = 1;
+
+	DIR *directory = opendir(NODE_DIRECTORY);
+	if (directory == NULL) {
+		return UDS_SUCCESS;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(directory)) != NULL) {
+		char *end;
+		if (strncmp(entry->d_name, "node", 4) != 0) {
+			continue;
+		}
+		long node = strtol(entry->d_name + 4, &end, 10);
+		if ((end == entry->d_name + 4) || (*end != '\0')) {
+			continue;
+		}
+
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%s/cpulist", NODE_DIRECTORY,
+			 entry->d_name);
+		FILE *file = fopen(path, "r");
+		if (file == NULL) {
+			continue;
+		}
+		char list[1024];
+		if (fgets(list, sizeof(list), file) != NULL) {
+			struct node_visit visit = {
+				.topology = topology,
+				.node = node,
+			};
+			if (parse_cpu_list(list, set_cpu_node, &visit)
+			    != UDS_SUCCESS) {
+				uds_log_warning("could not parse %s", path);
+			}
+		}
+		fclose(file);
+		if (node >= topology->node_count) {
+			topology->node_count = node + 1;
+		}
+	}
+	closedir(directory);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+static void add_cpu(struct thread_affinity *affinity,
+		    const struct topology *topology,
+		    unsigned int cpu)
+{
+	if (!CPU_ISSET(cpu, &topology->allowed) ||
+	    (affinity->cpu_count >= CPU_SETSIZE)) {
+		return;
+	}
+	affinity->cpus[affinity->cpu_count] = cpu;
+	affinity->nodes[affinity->cpu_count] = topology->node_of_cpu[cpu];
+	affinity->cpu_count++;
+}
+
+/**
+ * Order the allowed CPUs so that the CPUs of each node are used before
+ * those of the next node.
+ **/
+static void place_compact(struct thread_affinity *affinity,
+			  const struct topology *topology)
+{
+	int node;
+	for (node = 0; node < topology->node_count; node++) {
+		unsigned int cpu;
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (topology->node_of_cpu[cpu] == node) {
+				add_cpu(affinity, topology, cpu);
+			}
+		}
+	}
+}
+
+/**
+ * Order the allowed CPUs so that successive slots alternate between nodes.
+ **/
+static void place_spread(struct thread_affinity *affinity,
+			 const struct topology *topology)
+{
+	unsigned int next_cpu[CPU_SETSIZE] = { 0 };
+	unsigned int count = CPU_COUNT(&topology->allowed);
+	while (affinity->cpu_count < count) {
+		int node;
+		for (node = 0; node < topology->node_count; node++) {
+			unsigned int cpu;
+			for (cpu = next_cpu[node]; cpu < CPU_SETSIZE; cpu++) {
+				if ((topology->node_of_cpu[cpu] == node) &&
+				    CPU_ISSET(cpu, &topology->allowed)) {
+					break;
+				}
+			}
+			next_cpu[node] = cpu + 1;
+			if (cpu < CPU_SETSIZE) {
+				add_cpu(affinity, topology, cpu);
+			}
+		}
+	}
+}
+
+/**********************************************************************/
+struct cpuset_visit {
+	struct thread_affinity *affinity;
+	const struct topology *topology;
+};
+
+/**********************************************************************/
+static void add_listed_cpu(unsigned int cpu, void *context)
+{
+	struct cpuset_visit *visit = context;
+	add_cpu(visit->affinity, visit->topology, cpu);
+}
+
+/**
+ * Read the CPU bandwidth limit of one cgroup directory, from either the
+ * cgroup v2 cpu.max file or the cgroup v1 quota and period files.
+ *
+ * @param directory  the cgroup directory
+ *
+ * @return the CPUs worth of time allowed, rounded up, or 0 if unlimited
+ **/
+static unsigned int read_cgroup_quota(const char *directory)
+{
+	char path[1536];
+	long long quota = -1;
+	long long period = 0;
+
+	snprintf(path, sizeof(path), "%s/cpu.max", directory);
+	FILE *file = fopen(path, "r");
+	if (file != NULL) {
+		if (fscanf(file, "%lld %lld", &quota, &period) != 2) {
+			quota = -1;
+		}
+		fclose(file);
+	} else {
+		snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", directory);
+		file = fopen(path, "r");
+		if (file == NULL) {
+			return 0;
+		}
+		if (fscanf(file, "%lld", &quota) != 1) {
+			quota = -1;
+		}
+		fclose(file);
+
+		snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", directory);
+		file = fopen(path, "r");
+		if (file == NULL) {
+			return 0;
+		}
+		if (fscanf(file, "%lld", &period) != 1) {
+			period = 0;
+		}
+		fclose(file);
+	}
+
+	// "max" in cpu.max and -1 in cpu.cfs_quota_us both mean unlimited.
+	if ((quota <= 0) || (period <= 0)) {
+		return 0;
+	}
+	return (quota + period - 1) / period;
+}
+
+/**
+ * Find the tightest CPU bandwidth limit on this process, checking its own
+ * cgroup and each of the cgroup's ancestors, since a limit on a parent
+ * applies to all of its children.
+ *
+ * @return the CPUs worth of time allowed, or 0 if unlimited
+ **/
+static unsigned int read_cpu_quota(void)
+{
+	FILE *file = fopen("/proc/self/cgroup", "r");
+	if (file == NULL) {
+		return 0;
+	}
+
+	// A v2 entry reads "0::/path"; a v1 cpu entry reads "N:cpu,...:/path".
+	char line[1024];
+	char v1_path[1024] = "";
+	char v2_path[1024] = "";
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char *controllers = strchr(line, ':');
+		char *cgroup = ((controllers == NULL) ?
+				NULL : strchr(controllers + 1, ':'));
+		if (cgroup == NULL) {
+			continue;
+		}
+		*cgroup++ = '\0';
+		controllers++;
+		cgroup[strcspn(cgroup, "\n")] = '\0';
+		if (*controllers == '\0') {
+			snprintf(v2_path, sizeof(v2_path), "%s", cgroup);
+			continue;
+		}
+
+		char *controller;
+		char *save;
+		for (controller = strtok_r(controllers, ",", &save);
+		     controller != NULL;
+		     controller = strtok_r(NULL, ",", &save)) {
+			if (strcmp(controller, "cpu") == 0) {
+				snprintf(v1_path, sizeof(v1_path), "%s",
+					 cgroup);
+			}
+		}
+	}
+	fclose(file);
+
+	char directory[1280];
+	unsigned int limit = 0;
+	char *cgroup = v2_path;
+	const char *mount = "";
+	if (v1_path[0] != '\0') {
+		cgroup = v1_path;
+		mount = "/cpu";
+	}
+
+	while (true) {
+		snprintf(directory, sizeof(directory), "%s%s%s",
+			 CGROUP_DIRECTORY, mount, cgroup);
+		unsigned int quota = read_cgroup_quota(directory);
+		if ((quota > 0) && ((limit == 0) || (quota < limit))) {
+			limit = quota;
+		}
+
+		// The root cgroup has no limit of its own.
+		char *slash = strrchr(cgroup, '/');
+		if (slash == NULL) {
+			break;
+		}
+		*slash = '\0';
+		if (cgroup[0] == '\0') {
+			break;
+		}
+	}
+	return limit;
+}
+
+/**********************************************************************/
+void get_cpu_budget(struct cpu_budget *budget)
+{
+	*budget = (struct cpu_budget) {
+		.cpus = uds_get_num_cores(),
+		.quota_cpus = read_cpu_quota(),
+		.node_count = 1,
+	};
+
+	struct topology *topology;
+	if (UDS_ALLOCATE(1, struct topology, __func__, &topology)
+	    != UDS_SUCCESS) {
+		return;
+	}
+
+	if (read_topology(topology) == UDS_SUCCESS) {
+		bool used[CPU_SETSIZE] = { false };
+		unsigned int cpu;
+		unsigned int nodes = 0;
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			int node = topology->node_of_cpu[cpu];
+			if (CPU_ISSET(cpu, &topology->allowed) && !used[node]) {
+				used[node] = true;
+				nodes++;
+			}
+		}
+		if (nodes > 0) {
+			budget->node_count = nodes;
+		}
+	}
+	UDS_FREE(topology);
+}
+
+/**********************************************************************/
+int make_thread_affinity(const struct uds_parameters *user_params,
+			 struct thread_affinity **affinity_ptr)
+{
+	*affinity_ptr = NULL;
+	if ((user_params == NULL) ||
+	    (user_params->affinity == UDS_AFFINITY_NONE)) {
+		return UDS_SUCCESS;
+	}
+
+	struct topology *topology;
+	int result = UDS_ALLOCATE(1, struct topology, __func__, &topology);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = read_topology(topology);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(topology);
+		return result;
+	}
+
+	struct thread_affinity *affinity;
+	result = UDS_ALLOCATE(1, struct thread_affinity, __func__, &affinity);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(topology);
+		return result;
+	}
+
+	switch (user_params->affinity) {
+	case UDS_AFFINITY_COMPACT:
+		place_compact(affinity, topology);
+		break;
+
+	case UDS_AFFINITY_SPREAD:
+		place_spread(affinity, topology);
+		break;
+
+	case UDS_AFFINITY_CPUSET:
+		if (user_params->cpuset == NULL) {
+			result = UDS_INVALID_ARGUMENT;
+			break;
+		}
+		struct cpuset_visit visit = {
+			.affinity = affinity,
+			.topology = topology,
+		};
+		result = parse_cpu_list(user_params->cpuset, add_listed_cpu,
+					&visit);
+		break;
+
+	default:
+		result = UDS_INVALID_ARGUMENT;
+		break;
+	}
+	UDS_FREE(topology);
+
+	if (result != UDS_SUCCESS) {
+		free_thread_affinity(affinity);
+		return uds_log_error_strerror(result,
+					      "invalid thread affinity %d (cpuset '%s')",
+					      user_params->affinity,
+					      ((user_params->cpuset == NULL) ?
+						       "" :
+						       user_params->cpuset));
+	}
+
+	if (affinity->cpu_count == 0) {
+		free_thread_affinity(affinity);
+		return uds_log_error_strerror(UDS_INVALID_ARGUMENT,
+					      "thread affinity includes no usable CPUs");
+	}
+
+	*affinity_ptr = affinity;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void free_thread_affinity(struct thread_affinity *affinity)
+{
+	UDS_FREE(affinity);
+}
+
+/**********************************************************************/
+void bind_thread_to_slot(const struct thread_affinity *affinity,
+			 struct thread *thread,
+			 unsigned int slot)
+{
+	if (affinity == NULL) {
+		return;
+	}
+
+	unsigned int cpu = affinity->cpus[slot % affinity->cpu_count];
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	CPU_SET(cpu, &cpu_set);
+	int result = pthread_setaffinity_np(thread->thread, sizeof(cpu_set),
+					    &cpu_set);
+	if (result != 0) {
+		uds_log_warning_strerror(result,
+					 "could not bind thread to CPU %u",
+					 cpu);
+	}
+}
+
+/**********************************************************************/
+int get_slot_node(const struct thread_affinity *affinity, unsigned int slot)
+{
+	if (affinity == NULL) {
+		return -1;
+	}
+	return affinity->nodes[slot % affinity->cpu_count];
+}
+
+/**********************************************************************/
+void bind_memory_to_node(void *memory, size_t size, int node)
+{
+	if ((node < 0) || (memory == NULL)) {
+		return;
+	}
+
+	uintptr_t page_size = sysconf(_SC_PAGESIZE);
+	uintptr_t start = ((uintptr_t) memory + page_size - 1) & ~(page_size - 1);
+	uintptr_t end = ((uintptr_t) memory + size) & ~(page_size - 1);
+	if (end <= start) {
+		return;
+	}
+
+	unsigned long node_mask[CPU_SETSIZE / (CHAR_BIT * sizeof(long))] = { 0 };
+	if ((size_t) node >= CHAR_BIT * sizeof(node_mask)) {
+		return;
+	}
+	node_mask[node / (CHAR_BIT * sizeof(long))] |=
+		1UL << (node % (CHAR_BIT * sizeof(long)));
+	if (syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, node_mask,
+		    CHAR_BIT * sizeof(node_mask), MPOL_MF_MOVE) != 0) {
+		uds_log_warning_strerror(errno,
+					 "could not bind memory to node %d",
+					 node);
+	}
+}
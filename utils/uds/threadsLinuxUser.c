@@ -22,6 +22,8 @@
 #include "uds-threads.h"
 
 #include <errno.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
 #include <unistd.h>
@@ -48,6 +50,54 @@ unsigned int uds_get_num_cores(void)
 	return n_cpus;
 }
 
+/**********************************************************************/
+unsigned int uds_get_cpu_quota(void)
+{
+	FILE *file = fopen("/proc/self/cgroup", "r");
+	char line[1024];
+	char cgroup[1024] = "";
+	unsigned int cpus = 0;
+
+	if (file == NULL) {
+		return 0;
+	}
+	// Only cgroup v2, with an entry of "0::/path", has cpu.max.
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (strncmp(line, "0::", 3) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			snprintf(cgroup, sizeof(cgroup), "%s", line + 3);
+		}
+	}
+	fclose(file);
+
+	// A quota on any ancestor also limits this cgroup, and the root
+	// cgroup has no cpu.max, so stop before it.
+	while ((cgroup[0] == '/') && (cgroup[1] != '\0')) {
+		char path[1280];
+		unsigned long long quota;
+		unsigned long long period;
+
+		snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max",
+			 cgroup);
+		file = fopen(path, "r");
+		if (file != NULL) {
+			// A cgroup without a quota reads "max <period>".
+			if ((fscanf(file, "%llu %llu", &quota, &period) == 2) &&
+			    (period > 0)) {
+				unsigned int limit =
+					(quota + period - 1) / period;
+				if ((cpus == 0) || (limit < cpus)) {
+					cpus = limit;
+				}
+			}
+			fclose(file);
+		}
+
+		*strrchr(cgroup, '/') = '\0';
+	}
+	return cpus;
+}
+
 /**********************************************************************/
 void uds_get_thread_name(char *name)
 {
@@ -85,6 +85,14 @@ int __must_check uds_create_thread(void (*thread_func)(void *),
  **/
 unsigned int uds_get_num_cores(void);
 
+/**
+ * Get the number of CPUs' worth of time the cgroup of this process may use,
+ * from the tightest cpu.max of the cgroup and its ancestors, rounded up.
+ *
+ * @return the number of CPUs, or 0 if the cgroup has no CPU quota
+ **/
+unsigned int uds_get_cpu_quota(void);
+
 /**
  * Return the id of the current thread.
  *
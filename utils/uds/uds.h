@@ -68,6 +68,23 @@ enum uds_request_type {
 	UDS_QUERY,
 };
 
+/**
+ * Request priority classes. A request of a higher class is generally taken
+ * from the index's queues ahead of queued requests of a lower class.
+ **/
+enum uds_request_priority {
+	/** The default class, for ingest traffic */
+	UDS_PRIORITY_BULK = 0,
+	/**
+	 * The class for latency-sensitive lookups. It is only honored for a
+	 * #UDS_QUERY without update, since such a request changes nothing
+	 * and so may safely overtake the bulk requests queued before it;
+	 * other requests are handled as bulk requests.
+	 **/
+	UDS_PRIORITY_INTERACTIVE,
+	UDS_PRIORITY_COUNT,
+};
+
 /**
  * Valid types for opening an index.
  **/
@@ -145,23 +162,470 @@ struct uds_index_session;
 struct uds_configuration;
 typedef uint64_t uds_nonce_t;
 
+/**
+ * How the index places its zone, sparse cache, writer and reader threads on
+ * CPUs.
+ **/
+enum uds_affinity_policy {
+	/** Let the scheduler place the threads */
+	UDS_AFFINITY_NONE = 0,
+	/** Fill the CPUs of one NUMA node before using the next node */
+	UDS_AFFINITY_COMPACT,
+	/** Place successive threads on alternating NUMA nodes */
+	UDS_AFFINITY_SPREAD,
+	/** Place the threads on the CPUs listed in cpuset, in order */
+	UDS_AFFINITY_CPUSET,
+};
+
+/**
+ * How the volume page cache chooses a page to evict.
+ **/
+enum uds_cache_policy {
+	/** Evict the least recently used page */
+	UDS_CACHE_POLICY_LRU = 0,
+	/** Evict the first unreferenced page found by a sweeping clock hand */
+	UDS_CACHE_POLICY_CLOCK,
+};
+
+/**
+ * The size of the huge pages backing the page cache and volume index.
+ **/
+enum uds_huge_pages {
+	/** Use ordinary pages */
+	UDS_HUGE_PAGES_NONE = 0,
+	/** Use 2 MB pages */
+	UDS_HUGE_PAGES_2MB,
+	/** Use 1 GB pages */
+	UDS_HUGE_PAGES_1GB,
+};
+
 /**
  * The data used to configure a new index session.
  **/
+enum {
+	/**
+	 * The zone count which sizes the zones to the CPUs this process may
+	 * use and the number of indexes it has open.
+	 **/
+	UDS_ZONE_COUNT_AUTO = -1,
+};
+
 struct uds_parameters {
-	// Tne number of threads used to process index requests.
+	// Tne number of threads used to process index requests, 0 for half
+	// the cores, or UDS_ZONE_COUNT_AUTO. An index saved with one zone
+	// count may be loaded with another.
 	int zone_count;
-	// The number of threads used to read volume pages.
+	// The number of threads used to read volume pages. Values below 1
+	// mean 1. Set max_read_threads to let the count follow the load.
 	int read_threads;
+	// The most threads to read volume pages with, or 0 to keep
+	// read_threads fixed. When larger than read_threads, the volume
+	// starts read_threads readers and adds more, up to this many and to
+	// four for each CPU the cgroup's cpu.max allows, while page reads wait
+	// in the read queue longer than read_wait_target on average. A reader
+	// left idle for a second exits, down to read_threads. Not used with
+	// shared_readers.
+	unsigned int max_read_threads;
+	// The read queue wait, in microseconds, above which more reader
+	// threads are added, or 0 for the default of one millisecond.
+	unsigned int read_wait_target;
 	// The number of chapters to write between checkpoints.
 	int checkpoint_frequency;
+	// The longest replay after a crash to aim for, in milliseconds, or 0.
+	// When set, the index adjusts the number of chapters between
+	// checkpoints itself, starting from checkpoint_frequency.
+	unsigned int checkpoint_replay_target;
+	// The most bytes per second, and the most writes per second, for
+	// checkpoints and saves to write, or 0 for no limit. Capping them
+	// leaves the storage free for the volume page reads of requests;
+	// a checkpoint slowed by the cap runs over more chapters instead of
+	// holding up the zones to finish on time.
+	uint64_t save_bandwidth;
+	unsigned int save_iops;
+	// The placement of index threads on CPUs.
+	enum uds_affinity_policy affinity;
+	// A CPU list such as "0-3,8" for UDS_AFFINITY_CPUSET.
+	const char *cpuset;
+	// The page cache replacement policy.
+	enum uds_cache_policy cache_policy;
+	// The huge pages to back the page cache and volume index with.
+	enum uds_huge_pages huge_pages;
+	// Whether to read and write the volume with O_DIRECT, so that
+	// chapter pages are only cached by the index itself.
+	bool direct_io;
+	// Whether to read the volume through a read-only memory mapping, so
+	// the page cache points into the mapping instead of holding copies.
+	// This suits volumes on fast local storage, and excludes direct_io.
+	bool mmap_volume;
+	// The memory budget in bytes for keeping compressed copies of pages
+	// evicted from the page cache, or 0 for no compressed cache.
+	size_t compressed_cache_size;
+	// The largest number of chapters uds_resize_page_cache() may grow the
+	// page cache to, or 0 to only allow shrinking it.
+	unsigned int max_cache_chapters;
+	// The fewest chapters to shrink the page cache and sparse cache to
+	// while the cgroup of the process is short of memory, or 0 to keep
+	// their size fixed. When set, a thread watches the memory.pressure
+	// and memory.high of the cgroup, shrinking the caches under pressure
+	// and growing them back to their size at open once it clears.
+	unsigned int min_cache_chapters;
+	// The memory budget in bytes for filters which let the volume index
+	// rule out most new chunk names without searching its delta lists,
+	// or 0 for no filters.
+	size_t volume_index_filter_size;
+	// Whether to read volume pages with the process-wide reader pool
+	// shared by every index session which asks for it, rather than with
+	// threads of its own. read_threads is then the least number of
+	// threads the pool should have.
+	bool shared_readers;
+	// Whether the sparse cache should also keep each cached chapter index
+	// decoded into sorted arrays, which makes sparse searches cheaper
+	// but roughly triples the memory of every cached chapter.
+	bool decoded_sparse_cache;
+	// The file or block device on faster storage which keeps copies of
+	// the newest fast_volume_chapters chapters of the volume and serves
+	// reads of them, or NULL. The copies are never saved: they are made
+	// as chapters are written, and the volume remains complete.
+	const char *fast_volume_path;
+	// The number of chapters kept on the fast volume storage.
+	unsigned int fast_volume_chapters;
+	// A zoned block device (host-managed SMR or ZNS) to hold the chapters
+	// of the volume in place of the volume region of the index storage,
+	// or NULL. Each chapter is written sequentially into zones of its
+	// own, which are reset when the chapter is rewritten. The device is
+	// labeled when the index is created and must be given whenever the
+	// index is opened.
+	const char *zoned_volume_path;
+	// The name of a POSIX shared memory object, such as "/myindex", in
+	// which to publish a dense index for uds_attach_shared_index(), or
+	// NULL. The name must not be in use by another open index.
+	const char *shared_name;
+	// The permissions of the shared memory object, or 0 for 0600, which
+	// lets only processes of the same user attach.
+	unsigned int shared_mode;
 };
-#define UDS_PARAMETERS_INITIALIZER {		\
-		.zone_count = 0,		\
-		.read_threads = 2,		\
-		.checkpoint_frequency = 0,	\
+#define UDS_PARAMETERS_INITIALIZER {			\
+		.zone_count = 0,			\
+		.read_threads = 2,			\
+		.max_read_threads = 0,			\
+		.read_wait_target = 0,			\
+		.checkpoint_frequency = 0,		\
+		.checkpoint_replay_target = 0,	\
+		.save_bandwidth = 0,			\
+		.save_iops = 0,				\
+		.affinity = UDS_AFFINITY_NONE,		\
+		.cpuset = NULL,				\
+		.cache_policy = UDS_CACHE_POLICY_LRU,	\
+		.huge_pages = UDS_HUGE_PAGES_NONE,	\
+		.direct_io = false,			\
+		.mmap_volume = false,			\
+		.compressed_cache_size = 0,		\
+		.max_cache_chapters = 0,		\
+		.min_cache_chapters = 0,		\
+		.volume_index_filter_size = 0,		\
+		.shared_readers = false,		\
+		.decoded_sparse_cache = false,		\
+		.fast_volume_path = NULL,		\
+		.fast_volume_chapters = 0,	\
+		.zoned_volume_path = NULL,		\
+		.shared_name = NULL,			\
+		.shared_mode = 0,			\
 	}
 
+enum {
+	/** The number of buckets in a latency histogram */
+	UDS_LATENCY_BUCKETS = 32,
+	/** The largest number of zones for which latency is reported */
+	UDS_LATENCY_MAX_ZONES = 16,
+	/** The number of buckets in the page cache eviction age histogram */
+	UDS_EVICTION_AGE_BUCKETS = 32,
+	/** The number of buckets in a chapter age histogram */
+	UDS_CHAPTER_AGE_BUCKETS = 32,
+};
+
+/**
+ * A log2 histogram of latencies. Bucket i counts latencies of at least 2^i
+ * and less than 2^(i+1) nanoseconds, except that the first bucket also
+ * counts zero and the last bucket counts everything longer.
+ **/
+struct uds_latency_histogram {
+	uint64_t counts[UDS_LATENCY_BUCKETS];
+};
+
+/**
+ * The results of page cache probes for one kind of page.
+ **/
+struct uds_cache_probe_counts {
+	/** The number of probes which found the page */
+	uint64_t hits;
+	/** The number of probes which had to read the page */
+	uint64_t misses;
+	/** The number of probes for a page already queued for read */
+	uint64_t queued;
+};
+
+/**
+ * The page cache probes made by one zone.
+ **/
+struct uds_page_cache_zone_stats {
+	/** The first probe of a request for an index page */
+	struct uds_cache_probe_counts first_index;
+	/** The first probe of a request for a record page */
+	struct uds_cache_probe_counts first_record;
+	/** Later probes of a request for an index page */
+	struct uds_cache_probe_counts retry_index;
+	/** Later probes of a request for a record page */
+	struct uds_cache_probe_counts retry_record;
+};
+
+/**
+ * Page cache statistics
+ *
+ * Misses on a retry follow a queued read which was invalidated, so the
+ * first probe counts are the ones to use for the hit rate.
+ **/
+struct uds_page_cache_stats {
+	/** The number of zones with valid probe counts */
+	unsigned int zone_count;
+	/** The probe counts for each zone */
+	struct uds_page_cache_zone_stats zones[UDS_LATENCY_MAX_ZONES];
+	/** The number of pages evicted to make room for a read */
+	uint64_t evictions;
+	/** The number of pages invalidated because their chapter expired */
+	uint64_t expirations;
+	/** The number of pages invalidated because they were unusable */
+	uint64_t errors;
+	/**
+	 * The number of record page reads queued as soon as the index page
+	 * naming them was read, without a trip back through the zone
+	 **/
+	uint64_t chained_reads;
+	/**
+	 * The number of pages of a mapped volume which were already in memory,
+	 * and so were taken into the cache by the zone thread itself rather
+	 * than queued for a reader thread
+	 **/
+	uint64_t resident_reads;
+	/**
+	 * The number of pages loaded in the background from the list of
+	 * cached pages saved with the index
+	 **/
+	uint64_t warmed_pages;
+	/** The time taken by each volume page read */
+	struct uds_latency_histogram read_latency;
+	/**
+	 * A log2 histogram of how long evicted pages had been in the cache.
+	 * Bucket i counts ages of at least 2^i and less than 2^(i+1)
+	 * milliseconds, except that the first bucket also counts zero and
+	 * the last bucket counts everything older.
+	 **/
+	uint64_t eviction_age[UDS_EVICTION_AGE_BUCKETS];
+};
+
+/**
+ * Statistics for the compressed cache of pages evicted from the page cache.
+ **/
+struct uds_compressed_cache_stats {
+	/** The memory budget for compressed pages, in bytes */
+	uint64_t budget;
+	/** The memory currently used by compressed pages, in bytes */
+	uint64_t bytes_used;
+	/** The number of pages currently held */
+	uint64_t pages;
+	/** The number of page reads satisfied from the compressed cache */
+	uint64_t hits;
+	/** The number of page reads which had to go to storage */
+	uint64_t misses;
+	/** The number of evicted pages which were stored */
+	uint64_t stores;
+	/** The number of evicted pages which did not compress well enough */
+	uint64_t rejects;
+	/** The number of pages dropped to stay within the budget */
+	uint64_t evictions;
+};
+
+/**
+ * Statistics for the cache of sparse chapter indexes. A zone which misses in
+ * the cache asks the loader thread for the chapter; asks for a chapter which
+ * is already cached, queued, or being loaded are coalesced rather than sent.
+ *
+ * A hook for an uncached chapter is found through the volume page cache
+ * while its chapter loads. A name which is not a hook can only be found in a
+ * cached chapter, so when one misses while the chapter its zone asked for is
+ * still on its way, that zone waits for the chapter and searches again.
+ * Other zones do not wait, and a zone waits at most once per chapter it asks
+ * for; loading_waits counts the waits.
+ **/
+struct uds_sparse_cache_stats {
+	/** The number of probes for a specific chapter which found it */
+	uint64_t chapter_hits;
+	/** The number of probes for a specific chapter which missed */
+	uint64_t chapter_misses;
+	/** The number of chapter loads queued for the loader thread */
+	uint64_t loads_queued;
+	/** The number of chapter load requests coalesced with earlier ones */
+	uint64_t loads_coalesced;
+	/** The number of chapter load requests dropped with the queue full */
+	uint64_t loads_dropped;
+	/**
+	 * The number of searches of the whole cache which missed and waited
+	 * for a chapter their zone had asked the loader for
+	 **/
+	uint64_t loading_waits;
+	/** The number of cache entries that fell off the end of the volume */
+	uint64_t invalidations;
+	/** The number of cache entries that were evicted while still valid */
+	uint64_t evictions;
+};
+
+/**
+ * The reader threads of the volume. Without a max_read_threads, the count
+ * stays fixed and nothing is added or retired.
+ **/
+struct uds_reader_stats {
+	/** The number of reader threads now running */
+	unsigned int read_threads;
+	/** The fewest reader threads to run */
+	unsigned int min_read_threads;
+	/**
+	 * The most reader threads to run, after the limit set by the CPU
+	 * quota of the cgroup
+	 */
+	unsigned int max_read_threads;
+	/** The number of reader threads added */
+	uint64_t threads_added;
+	/** The number of idle reader threads retired */
+	uint64_t threads_retired;
+	/** The number of batches of page reads kept in flight together */
+	uint64_t read_batches;
+	/** The number of pages read in those batches */
+	uint64_t batched_reads;
+	/**
+	 * The average time, in nanoseconds, for which recent page reads
+	 * waited in the read queue before a reader took them
+	 */
+	uint64_t read_wait;
+};
+
+/**
+ * The counters of the memory pressure monitor, which resizes the page cache
+ * and the sparse cache while the index runs. All are zero if the index was
+ * opened without a min_cache_chapters or the kernel does not report memory
+ * pressure.
+ **/
+struct uds_memory_pressure_stats {
+	/** The number of chapters the caches are now sized for */
+	unsigned int cache_chapters;
+	/** The fewest chapters the caches may shrink to */
+	unsigned int min_cache_chapters;
+	/** The most chapters the caches may grow back to */
+	unsigned int max_cache_chapters;
+	/** The number of times the caches were shrunk */
+	uint64_t shrinks;
+	/** The number of times the caches were grown */
+	uint64_t grows;
+	/**
+	 * The share of the last ten seconds, in hundredths of a percent, in
+	 * which some task of the cgroup was stalled waiting for memory, as of
+	 * the latest sample
+	 */
+	unsigned int pressure;
+	/**
+	 * The memory use of the cgroup as a percentage of its memory.high, as
+	 * of the latest sample, or 0 if it has no memory.high
+	 */
+	unsigned int high_usage;
+};
+
+/**
+ * The counters of the volume index filters. The false positive rate of the
+ * filters is false_positives / (false_positives + negatives).
+ **/
+struct uds_volume_index_filter_stats {
+	/** The memory used by the filters, in bytes */
+	uint64_t memory_used;
+	/** The number of lookups the filters answered as not present */
+	uint64_t negatives;
+	/** The number of lookups which had to search the volume index */
+	uint64_t passes;
+	/** The number of those searches which did not find the name */
+	uint64_t false_positives;
+	/** The number of times a filter was rebuilt from the index */
+	uint64_t rebuilds;
+};
+
+/**
+ * The subsystems to which UDS memory allocations are charged.
+ **/
+enum uds_memory_tag {
+	/** Memory not charged to any of the subsystems below */
+	UDS_MEMORY_OTHER = 0,
+	/** The volume index and its filters */
+	UDS_MEMORY_VOLUME_INDEX,
+	/** The page cache and its pages */
+	UDS_MEMORY_PAGE_CACHE,
+	/** The sparse chapter index cache */
+	UDS_MEMORY_SPARSE_CACHE,
+	/** The open chapters of the zones */
+	UDS_MEMORY_OPEN_CHAPTER,
+	/** The chapter writer and its open chapter index */
+	UDS_MEMORY_CHAPTER_WRITER,
+	/** The radix sorters used to build record pages */
+	UDS_MEMORY_RADIX_SORTER,
+	UDS_MEMORY_TAG_COUNT,
+};
+
+/**
+ * The memory charged to one subsystem.
+ **/
+struct uds_memory_tag_stats {
+	/** The bytes currently allocated */
+	uint64_t bytes_used;
+	/** The most bytes which have been allocated at once */
+	uint64_t peak_bytes_used;
+	/** The number of allocations made */
+	uint64_t allocations;
+};
+
+/**
+ * The memory allocated by UDS in this process, in total and for each
+ * subsystem, covering every index in the process.
+ **/
+struct uds_memory_stats {
+	struct uds_memory_tag_stats total;
+	struct uds_memory_tag_stats tags[UDS_MEMORY_TAG_COUNT];
+};
+
+/**
+ * The kinds of hit for which chapter age histograms are kept. Each request
+ * which finds its chunk name is counted as exactly one kind.
+ **/
+enum uds_hit_kind {
+	/** Found in the open chapter */
+	UDS_HIT_OPEN_CHAPTER = 0,
+	/** Found in a dense chapter other than by a page cache hit */
+	UDS_HIT_DENSE,
+	/** Found in a sparse chapter other than by a page cache hit */
+	UDS_HIT_SPARSE,
+	/**
+	 * Found in a closed chapter whose page was already in the page cache,
+	 * so that the request never waited for a volume read
+	 **/
+	UDS_HIT_PAGE_CACHE,
+	UDS_HIT_KIND_COUNT,
+};
+
+/**
+ * A log2 histogram of the ages of the chapters in which requests found their
+ * chunk names, where the age is the number of chapters between the open
+ * chapter and the one holding the name. The first bucket counts age zero,
+ * and bucket i counts ages of at least 2^(i-1) and less than 2^i, except
+ * that the last bucket counts everything older.
+ **/
+struct uds_chapter_age_histogram {
+	uint64_t counts[UDS_CHAPTER_AGE_BUCKETS];
+};
+
 /**
  * Index statistics
  *
@@ -173,6 +637,8 @@ struct uds_index_stats {
 	uint64_t entries_indexed;
 	/** An estimate of the index's memory usage. */
 	uint64_t memory_used;
+	/** The number of bytes of index memory backed by huge pages. */
+	uint64_t huge_page_memory_used;
 	/** The number of collisions recorded in the volume index. */
 	uint64_t collisions;
 	/** The number of entries discarded from the index since startup. */
@@ -216,6 +682,221 @@ struct uds_index_stats {
 	 * deletions, and queries).
 	 **/
 	uint64_t requests;
+	/** The page cache counters. */
+	struct uds_page_cache_stats page_cache;
+	/** The compressed page cache counters. */
+	struct uds_compressed_cache_stats compressed_cache;
+	/** The sparse chapter index cache counters. */
+	struct uds_sparse_cache_stats sparse_cache;
+	/** The memory pressure monitor counters. */
+	struct uds_memory_pressure_stats memory_pressure;
+	/** The volume reader thread counters. */
+	struct uds_reader_stats readers;
+	/** The volume index filter counters. */
+	struct uds_volume_index_filter_stats volume_index_filter;
+	/** The memory allocated by UDS in this process. */
+	struct uds_memory_stats memory;
+	/** The ages of the chapters in which requests were found, by kind */
+	struct uds_chapter_age_histogram chapter_ages[UDS_HIT_KIND_COUNT];
+};
+
+/**
+ * The stages of a request's trip through the index for which latency
+ * histograms are kept.
+ **/
+enum uds_latency_stage {
+	/** From submission until the zone worker takes the request */
+	UDS_LATENCY_ZONE_QUEUE = 0,
+	/** From the zone worker until a volume page read for it completes */
+	UDS_LATENCY_PAGE_READ,
+	/** From the zone worker or page read until the callback thread */
+	UDS_LATENCY_CALLBACK,
+	/** From submission until the callback thread takes the request */
+	UDS_LATENCY_TOTAL,
+	UDS_LATENCY_STAGE_COUNT,
+};
+
+/**
+ * Request latency statistics
+ *
+ * These histograms break down the latency of successful requests by zone
+ * and by stage. A stage which a request did not pass through, such as a
+ * page read, is not counted for that request.
+ **/
+struct uds_index_latency_stats {
+	/** The number of zones with valid histograms */
+	unsigned int zone_count;
+	/** The histograms for each zone and stage */
+	struct uds_latency_histogram
+		zones[UDS_LATENCY_MAX_ZONES][UDS_LATENCY_STAGE_COUNT];
+	/** The total latency of the requests handled in each priority class */
+	struct uds_latency_histogram priorities[UDS_PRIORITY_COUNT];
+};
+
+/**
+ * Request backlog
+ *
+ * The requests waiting inside an index. The counts are read without
+ * locking, so they are cheap enough to check before each submission but
+ * may be slightly out of date.
+ **/
+struct uds_index_backlog {
+	/** The number of zones with valid counts */
+	unsigned int zone_count;
+	/** The requests waiting in each zone queue */
+	unsigned int zone_requests[UDS_LATENCY_MAX_ZONES];
+	/** The volume page reads queued or in progress */
+	unsigned int queued_reads;
+	/** The most volume page reads which can be queued at once */
+	unsigned int read_queue_size;
+};
+
+/**
+ * The load on one index zone.
+ **/
+struct uds_zone_load {
+	/** The chunk requests the zone has handled */
+	uint64_t requests;
+	/** The time the zone thread spent handling requests, in microseconds */
+	uint64_t busy_time;
+	/** The requests waiting in the zone queue now */
+	unsigned int queue_depth;
+	/** The most requests seen waiting when the zone took a batch */
+	unsigned int max_queue_depth;
+	/** The queries answered from the zone's recent query results */
+	uint64_t cached_queries;
+};
+
+/**
+ * Zone load statistics
+ *
+ * Requests go to zones by bits of their chunk names, so a workload which
+ * repeats the same names can load one zone much more than the others, and
+ * that zone thread then limits the whole index. The rate of requests to a
+ * zone is its request count divided by the elapsed time. The counts are
+ * kept by the zone threads and read without locking.
+ **/
+struct uds_index_zone_stats {
+	/** The time the counts cover, in microseconds since the index opened */
+	uint64_t elapsed_time;
+	/** The number of zones with valid counts */
+	unsigned int zone_count;
+	/** The load on each zone */
+	struct uds_zone_load zones[UDS_LATENCY_MAX_ZONES];
+	/**
+	 * The requests of the busiest zone as a percentage of an even share;
+	 * 100 when the zones are balanced, and 100 times the zone count when
+	 * one zone gets every request
+	 */
+	unsigned int request_skew;
+	/** The busy time of the busiest zone measured the same way */
+	unsigned int busy_skew;
+};
+
+/**
+ * The phases of opening and saving an index which are timed.
+ **/
+enum uds_index_phase {
+	/** All of making the index, including any load, replay, or rebuild */
+	UDS_PHASE_MAKE = 0,
+	/** Loading the saved index components */
+	UDS_PHASE_LOAD,
+	/** Replaying the chapters written since the last save */
+	UDS_PHASE_REPLAY,
+	/** Rebuilding the index from the volume */
+	UDS_PHASE_REBUILD,
+	/** Saving the index components */
+	UDS_PHASE_SAVE,
+	UDS_PHASE_COUNT,
+};
+
+/**
+ * The saved index components whose I/O is counted.
+ **/
+enum uds_index_component_type {
+	/** The records of the open chapter */
+	UDS_COMPONENT_OPEN_CHAPTER = 0,
+	/** The volume index */
+	UDS_COMPONENT_VOLUME_INDEX,
+	/** The index page map */
+	UDS_COMPONENT_INDEX_PAGE_MAP,
+	UDS_COMPONENT_COUNT,
+};
+
+/**
+ * Index open and save statistics
+ *
+ * These statistics describe the most recent open of the index and its most
+ * recent save. A phase which did not happen is reported as taking no time.
+ **/
+struct uds_index_phase_stats {
+	/** The time spent in each phase, in microseconds */
+	uint64_t phase_time[UDS_PHASE_COUNT];
+	/** The bytes of each component read when the index was loaded */
+	uint64_t bytes_read[UDS_COMPONENT_COUNT];
+	/** The bytes of each component written by the last save or checkpoint */
+	uint64_t bytes_written[UDS_COMPONENT_COUNT];
+	/** The number of chapters replayed by a replay or rebuild */
+	uint64_t chapters_replayed;
+};
+
+/**
+ * Checkpoint statistics
+ *
+ * These statistics describe the checkpoints of an index since it was opened,
+ * and the estimates behind the checkpoint frequency it chose if it has a
+ * replay target. An estimate which has not been measured is reported as 0.
+ **/
+struct uds_checkpoint_stats {
+	/** The longest replay to aim for in microseconds, 0 if none */
+	uint64_t replay_target;
+	/** The number of chapters between checkpoints now */
+	unsigned int frequency;
+	/** The number of checkpoints completed */
+	uint64_t checkpoints;
+	/** The number of times the replay target changed the frequency */
+	uint64_t adjustments;
+	/** The estimated time to replay a chapter, in microseconds */
+	uint64_t chapter_replay_time;
+	/** Whether that estimate comes from a replay, not chapter writes */
+	bool replay_measured;
+	/** The average work of recent checkpoints, in microseconds */
+	uint64_t checkpoint_time;
+	/** The average time between chapters, in microseconds */
+	uint64_t chapter_time;
+	/** The estimated longest replay now, in microseconds */
+	uint64_t estimated_replay_time;
+	/**
+	 * The time save writes have waited for the save_bandwidth and
+	 * save_iops caps, in microseconds
+	 **/
+	uint64_t throttle_time;
+	/**
+	 * The number of checkpoints which the caps kept from finishing
+	 * within their frequency
+	 **/
+	uint64_t stretched_checkpoints;
+};
+
+/**
+ * Request pool statistics
+ *
+ * These statistics describe the pool of requests kept by an index session for
+ * #uds_get_pooled_request.
+ **/
+struct uds_request_pool_stats {
+	/** The number of requests the pool has allocated */
+	uint64_t capacity;
+	/** The number of requests currently free in the pool */
+	uint64_t free;
+	/** The number of requests got from the pool */
+	uint64_t gets;
+	/** The number of requests returned to the pool */
+	uint64_t puts;
+	/** The number of times a thread took the free requests of another */
+	uint64_t steals;
+	/** The number of times the pool allocated more requests */
+	uint64_t grows;
 };
 
 /**
@@ -246,8 +927,6 @@ enum uds_index_region {
 enum uds_zone_message_type {
 	/** A standard request with no message */
 	UDS_MESSAGE_NONE = 0,
-	/** Add a chapter to the sparse chapter index cache */
-	UDS_MESSAGE_SPARSE_CACHE_BARRIER,
 	/** Close a chapter to keep the zone from falling behind */
 	UDS_MESSAGE_ANNOUNCE_CHAPTER_CLOSED,
 } __packed;
@@ -298,7 +977,8 @@ struct uds_request {
 	 */
 	struct uds_chunk_data new_metadata;
 	/*
-	 * The callback method to be invoked when the operation finishes.
+	 * The callback method to be invoked when the operation finishes, or
+	 * NULL to queue the request for #uds_poll_completions instead.
 	 * Set before starting an operation.
 	 * Unchanged at time of callback.
 	 */
@@ -331,6 +1011,12 @@ struct uds_request {
 	 * Unchanged at time of callback.
 	 */
 	bool update;
+	/*
+	 * The priority class of the operation, which defaults to
+	 * #UDS_PRIORITY_BULK. Set before starting an operation.
+	 * Unchanged at time of callback.
+	 */
+	enum uds_request_priority priority;
 
 	/*
 	 * The remainder of this structure consists of fields used within the
@@ -353,8 +1039,22 @@ struct uds_request {
 	bool unbatched;
 	/** If true, attempt to handle this request before newer requests */
 	bool requeued;
+	/** If true, handle this request ahead of queued bulk requests */
+	bool interactive;
+	/** The flush epoch of the session reference held by this request */
+	unsigned int session_epoch;
 	/** The location of this chunk name in the index */
 	enum uds_index_region location;
+	/** Whether the name was found in a page already in the page cache */
+	bool page_cache_hit;
+	/** The number of chapters from the open chapter to the one found */
+	uint64_t chapter_age;
+	/** The monotonic time in nanoseconds that the request was started */
+	int64_t start_time;
+	/** The time a zone worker first took the request */
+	int64_t zone_time;
+	/** The time a page read for the request completed, or zero */
+	int64_t read_time;
 };
 
 /**
@@ -389,6 +1089,30 @@ void uds_configuration_set_sparse(struct uds_configuration *conf, bool sparse);
  **/
 bool __must_check uds_configuration_get_sparse(struct uds_configuration *conf);
 
+/**
+ * Sets or clears whether an index compresses its record pages. A record
+ * page which compresses well enough is written in fewer blocks, so that
+ * reading it back into the page cache on a miss reads fewer bytes. The
+ * setting is kept with the index when it is created, and an index with
+ * compressed record pages cannot be loaded by versions of UDS which do not
+ * know of them.
+ *
+ * @param [in,out] conf      The configuration to change
+ * @param [in]     compress  Whether to compress record pages
+ **/
+void uds_configuration_set_compressed_record_pages(struct uds_configuration *conf,
+						   bool compress);
+
+/**
+ * Tests whether an index configuration compresses record pages.
+ *
+ * @param [in] conf  The configuration to check
+ *
+ * @return <code>true</code> if record pages are compressed
+ **/
+bool __must_check
+uds_configuration_get_compressed_record_pages(struct uds_configuration *conf);
+
 /**
  * Sets an index configuration's nonce.
  *
@@ -450,6 +1174,27 @@ void uds_free_configuration(struct uds_configuration *conf);
 int __must_check uds_compute_index_size(const struct uds_configuration *config,
 					uint64_t *index_size);
 
+/**
+ * Compute the chunk names of a number of blocks of data of the same size.
+ * Each name is the 128-bit MurmurHash3 (x64 variant) of its block with the
+ * given seed, exactly as MurmurHash3_x64_128() computes it one block at a
+ * time, so names from this function match names computed that way. The
+ * blocks are hashed several at a time, which is much faster than hashing
+ * them one after another.
+ *
+ * @param [in]  blocks  The blocks of data to name
+ * @param [in]  count   The number of blocks
+ * @param [in]  size    The size of each block, which must be less than
+ *                      2 GB
+ * @param [in]  seed    The hash seed
+ * @param [out] names   The names of the blocks, in the same order
+ **/
+void uds_calculate_murmur3_chunk_names(const void *const blocks[],
+				       unsigned int count,
+				       size_t size,
+				       uint32_t seed,
+				       struct uds_chunk_name names[]);
+
 /**
  * Opens an index session.
  *
@@ -479,6 +1224,13 @@ const char * __must_check uds_get_version(void);
  * in the index and the byte offset to the start of the index.  For example,
  * the name "/dev/sda8 offset=409600 size=2048000000" is an index that is
  * stored in 2040000000 bytes of /dev/sda8 starting at byte 409600.
+ *
+ * The name can also contain a saves option which names a separate file or
+ * block device for the index saves and checkpoints, such as one on faster
+ * local storage, so that they do not compete with the volume I/O. When an
+ * index is created with "/dev/sda8 saves=/dev/nvme0n1p2", the path of the
+ * save storage is recorded in the index, and later opens only need to name
+ * it if it has moved.
  **/
 
 /**
@@ -531,7 +1283,10 @@ int __must_check uds_resume_index_session(struct uds_index_session *session,
 					  const char *name);
 
 /**
- * Waits until all callbacks for index operations are complete.
+ * Waits until the callbacks for all index operations started before this
+ * call are complete, and the chapters closed by then are written to storage.
+ * Operations started and chapters closed during the flush are not waited
+ * for, so a flush finishes even while new requests keep arriving.
  *
  * @param [in] session  The session to flush
  *
@@ -586,6 +1341,88 @@ int __must_check uds_get_index_configuration(struct uds_index_session *session,
 int __must_check uds_get_index_stats(struct uds_index_session *session,
 				     struct uds_index_stats *stats);
 
+/**
+ * Returns the per-stage request latency histograms for an index.
+ *
+ * @param [in]  session  The session
+ * @param [out] stats    The latency statistics structure to fill
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check
+uds_get_index_latency_stats(struct uds_index_session *session,
+			    struct uds_index_latency_stats *stats);
+
+/**
+ * Returns the timing and I/O statistics of the most recent open and save of
+ * an index. Once the index is closed, the statistics of its final save
+ * remain available until another index is opened.
+ *
+ * @param [in]  session  The session
+ * @param [out] stats    The phase statistics structure to fill
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check
+uds_get_index_phase_stats(struct uds_index_session *session,
+			  struct uds_index_phase_stats *stats);
+
+/**
+ * Returns the checkpoint statistics of an index, including the estimates
+ * which set its checkpoint frequency when it has a replay target.
+ *
+ * @param [in]  session  The session
+ * @param [out] stats    The checkpoint statistics structure to fill
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check
+uds_get_index_checkpoint_stats(struct uds_index_session *session,
+			       struct uds_checkpoint_stats *stats);
+
+/**
+ * Returns the number of requests waiting in each zone of an index and the
+ * number of volume page reads queued. A full queue makes the index block
+ * rather than fail, so a client can use this to throttle before requests
+ * start to wait.
+ *
+ * @param [in]  session  The session
+ * @param [out] backlog  The backlog structure to fill
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check uds_get_index_backlog(struct uds_index_session *session,
+				       struct uds_index_backlog *backlog);
+
+/**
+ * Returns the load on each zone of an index and how unevenly the requests
+ * are spread among the zones. A skew well above 100 means one zone thread
+ * is limiting the index.
+ *
+ * @param [in]  session  The session
+ * @param [out] stats    The zone statistics structure to fill
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check
+uds_get_index_zone_stats(struct uds_index_session *session,
+			 struct uds_index_zone_stats *stats);
+
+/**
+ * Change the number of chapters the page cache holds while the index is
+ * running. Pages are added or dropped a few at a time, so requests continue
+ * to be processed while the cache is resized. The cache may not grow beyond
+ * the max_cache_chapters given when the index was opened. The new size lasts
+ * until the index is closed; it does not change the saved configuration.
+ *
+ * @param [in] session         The session
+ * @param [in] cache_chapters  The new cache size, in chapters
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check uds_resize_page_cache(struct uds_index_session *session,
+				       unsigned int cache_chapters);
+
 /**
  * Convert an error code to a string.
  *
@@ -650,6 +1487,162 @@ enum { UDS_STRING_ERROR_BUFSIZE = 128 };
  * @return Either #UDS_SUCCESS or an error code
  **/
 int __must_check uds_start_chunk_operation(struct uds_request *request);
+
+/**
+ * Start an operation as if by #uds_start_chunk_operation, unless the index
+ * zone which would handle it already has too many requests waiting. The
+ * operation is then not started, so the caller can throttle or skip
+ * deduplication of the block rather than wait behind the backlog.
+ *
+ * @param [in] request      The operation, set up as for
+ *                          #uds_start_chunk_operation
+ * @param [in] max_backlog  The number of requests waiting in the zone at
+ *                          which the operation is refused
+ *
+ * @return Either #UDS_SUCCESS, -EBUSY if the zone backlog has reached
+ *         max_backlog, or an error code
+ **/
+int __must_check uds_try_start_chunk_operation(struct uds_request *request,
+					       unsigned int max_backlog);
+
+/**
+ * Start several operations, as if by calling #uds_start_chunk_operation on
+ * each of them, but with one session check for the whole batch and a single
+ * wakeup for each index zone which receives requests. Requests which go to
+ * the same zone are processed in the order given. If an error is returned,
+ * none of the operations has been started.
+ *
+ * @param [in] requests  The operations, which must all have the same
+ *                       <code>session</code> and otherwise be set up as for
+ *                       #uds_start_chunk_operation
+ * @param [in] count     The number of operations
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check uds_start_chunk_operations(struct uds_request **requests,
+					    unsigned int count);
+
+/**
+ * Get a request from the pool kept by an index session, instead of
+ * allocating one. The request is zeroed except for its <code>session</code>,
+ * which is set. Requests are recycled through per-thread free lists, so a
+ * client which gets and returns requests at a high rate does no allocation
+ * once the pool has grown to cover the requests it has in flight.
+ *
+ * @param [in]  session      The session
+ * @param [out] request_ptr  A pointer to hold the request
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check uds_get_pooled_request(struct uds_index_session *session,
+					struct uds_request **request_ptr);
+
+/**
+ * Return a request got from #uds_get_pooled_request to its session's pool.
+ * The request may be returned from its callback. Its <code>session</code>
+ * field must be unchanged, and it must not be used once it is returned.
+ * Every pooled request must be returned before its session is destroyed.
+ *
+ * @param [in] request  The request
+ **/
+void uds_put_pooled_request(struct uds_request *request);
+
+/**
+ * Fetches the request pool statistics for the given index session.
+ *
+ * @param [in]  session  The session
+ * @param [out] stats    The request pool statistics structure to fill
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check
+uds_get_request_pool_stats(struct uds_index_session *session,
+			   struct uds_request_pool_stats *stats);
+
+/**
+ * Lets the client of an index session collect its finished requests from
+ * its own threads instead of having callbacks run for them. Once this has
+ * been called, a request may be started with a NULL <code>callback</code>;
+ * when it finishes, it is queued for #uds_poll_completions rather than
+ * called back. Requests which have a callback still get it. A queued request
+ * counts as complete for #uds_flush_index_session.
+ *
+ * If <code>fd_ptr</code> is not NULL, it receives an eventfd which becomes
+ * readable when requests may be waiting, for use in an event loop. The
+ * client reads the descriptor to clear it and then polls until no requests
+ * are returned. The descriptor is closed when the session is destroyed.
+ *
+ * This may be called only once for a session.
+ *
+ * @param [in]  session  The session
+ * @param [out] fd_ptr   A pointer to hold the eventfd, or NULL
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check uds_enable_completion_queue(struct uds_index_session *session,
+					     int *fd_ptr);
+
+/**
+ * Takes finished requests from the completion queue of an index session, in
+ * the order they finished. Any number of client threads may poll at once.
+ * The status, found flag and metadata of each request are set as they would
+ * be for its callback. Every queued request must be collected before the
+ * session is destroyed.
+ *
+ * @param [in]  session       The session
+ * @param [out] requests      An array to hold the finished requests
+ * @param [in]  max_requests  The size of the array
+ *
+ * @return The number of requests returned, which is zero if none are waiting
+ **/
+unsigned int uds_poll_completions(struct uds_index_session *session,
+				  struct uds_request **requests,
+				  unsigned int max_requests);
+
+/**
+ * A read-only view of an index which another process publishes with the
+ * shared_name parameter.
+ **/
+struct uds_shared_index;
+
+/**
+ * Attaches to an index published by another process. Lookups through the
+ * view need no session and never change the index. A view may be used by
+ * only one thread at a time, but any number of views may be attached.
+ *
+ * @param [in]  name        The shared_name the index was opened with
+ * @param [out] reader_ptr  A pointer to hold the new view
+ *
+ * @return Either #UDS_SUCCESS, or #UDS_NO_INDEX if no index has been
+ *         published under the name yet, or another error code
+ **/
+int __must_check uds_attach_shared_index(const char *name,
+					 struct uds_shared_index **reader_ptr);
+
+/**
+ * Looks up a chunk name in a shared index. Chunk names which the owner
+ * has posted since its current open chapter began are not seen until that
+ * chapter has been written to storage.
+ *
+ * @param [in]  reader    The view of the shared index
+ * @param [in]  name      The chunk name to look up
+ * @param [out] metadata  Set to the metadata of the chunk name, if found
+ * @param [out] found     Set to whether the chunk name was found
+ *
+ * @return Either #UDS_SUCCESS, or #UDS_DISABLED if the owner has closed
+ *         the index, or another error code
+ **/
+int __must_check uds_query_shared_index(struct uds_shared_index *reader,
+					const struct uds_chunk_name *name,
+					struct uds_chunk_data *metadata,
+					bool *found);
+
+/**
+ * Detaches from a shared index and frees the view.
+ *
+ * @param reader  The view of the shared index
+ **/
+void uds_detach_shared_index(struct uds_shared_index *reader);
 /** @} */
 
 #endif /* UDS_H */
@@ -164,6 +164,21 @@ bool uds_configuration_get_sparse(struct uds_configuration *user_config)
 	return user_config->sparse_chapters_per_volume > 0;
 }
 
+/**********************************************************************/
+void
+uds_configuration_set_compressed_record_pages(struct uds_configuration *user_config,
+					      bool compress)
+{
+	user_config->compress_record_pages = compress;
+}
+
+/**********************************************************************/
+bool
+uds_configuration_get_compressed_record_pages(struct uds_configuration *user_config)
+{
+	return user_config->compress_record_pages;
+}
+
 /**********************************************************************/
 void uds_configuration_set_nonce(struct uds_configuration *user_config,
 				 uds_nonce_t nonce)
@@ -251,6 +266,19 @@ int uds_create_index_session(struct uds_index_session **session)
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+static size_t get_huge_page_size(enum uds_huge_pages huge_pages)
+{
+	switch (huge_pages) {
+	case UDS_HUGE_PAGES_2MB:
+		return 1UL << 21;
+	case UDS_HUGE_PAGES_1GB:
+		return 1UL << 30;
+	default:
+		return 0;
+	}
+}
+
 /**********************************************************************/
 static int
 initialize_index_session_with_layout(struct uds_index_session *index_session,
@@ -274,6 +302,12 @@ initialize_index_session_with_layout(struct uds_index_session *index_session,
 		uds_log_error_strerror(result, "Failed to allocate config");
 		return result;
 	}
+	if (user_params != NULL) {
+		index_config->huge_page_size =
+			get_huge_page_size(user_params->huge_pages);
+		index_config->volume_index_filter_size =
+			user_params->volume_index_filter_size;
+	}
 
 	// Zero the stats for the new index.
 	memset(&index_session->stats, 0, sizeof(index_session->stats));
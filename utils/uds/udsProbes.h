@@ -0,0 +1,61 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ */
+
+#ifndef UDS_PROBES_H
+#define UDS_PROBES_H
+
+/*
+ * Static (USDT) probe points for SystemTap, bpftrace, and perf. The probes
+ * are compiled in only when UDS_USDT_PROBES is defined (build with USDT=1),
+ * which requires <sys/sdt.h>. Otherwise they expand to nothing and their
+ * arguments are not evaluated.
+ *
+ * An enabled probe costs a single nop at the probe site, and its arguments
+ * are only computed into registers, so probes should only be given values
+ * which are already at hand.
+ */
+
+#ifdef UDS_USDT_PROBES
+#include <sys/sdt.h>
+
+#define USDT_PROBE0(provider, name) DTRACE_PROBE(provider, name)
+#define USDT_PROBE1(provider, name, a1) DTRACE_PROBE1(provider, name, a1)
+#define USDT_PROBE2(provider, name, a1, a2) \
+	DTRACE_PROBE2(provider, name, a1, a2)
+#define USDT_PROBE3(provider, name, a1, a2, a3) \
+	DTRACE_PROBE3(provider, name, a1, a2, a3)
+#else
+#define USDT_PROBE0(provider, name) do { } while (0)
+#define USDT_PROBE1(provider, name, a1) do { (void) sizeof(a1); } while (0)
+#define USDT_PROBE2(provider, name, a1, a2) \
+	do { (void) sizeof(a1); (void) sizeof(a2); } while (0)
+#define USDT_PROBE3(provider, name, a1, a2, a3)			\
+	do {							\
+		(void) sizeof(a1);				\
+		(void) sizeof(a2);				\
+		(void) sizeof(a3);				\
+	} while (0)
+#endif /* UDS_USDT_PROBES */
+
+#define UDS_PROBE0(name) USDT_PROBE0(uds, name)
+#define UDS_PROBE1(name, a1) USDT_PROBE1(uds, name, a1)
+#define UDS_PROBE2(name, a1, a2) USDT_PROBE2(uds, name, a1, a2)
+#define UDS_PROBE3(name, a1, a2, a3) USDT_PROBE3(uds, name, a1, a2, a3)
+
+#endif /* UDS_PROBES_H */
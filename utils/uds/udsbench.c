@@ -0,0 +1,977 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/udsbench.c#1 $
+ */
+
+/**
+ * udsbench creates an index in a file and drives a stream of synthetic
+ * requests at it from several client threads, through the same session and
+ * uds_start_chunk_operation() interface a deduplicating client uses. It
+ * reports the throughput and the latency distribution of each request type,
+ * once for each zone count asked for.
+ **/
+
+#include <err.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "uds.h"
+
+#include "atomicDefs.h"
+#include "benchCounters.h"
+#include "benchHistogram.h"
+#include "common.h"
+#include "errors.h"
+#include "memoryAlloc.h"
+#include "murmur/MurmurHash3.h"
+#include "stringUtils.h"
+#include "timeUtils.h"
+#include "uds-threads.h"
+
+enum {
+	/** The number of zone counts one invocation may benchmark */
+	MAX_ZONE_RUNS = 16,
+	/** The request types, in the order they are reported */
+	REQUEST_TYPES = 4,
+	/** The hash seed used to turn name numbers into chunk names */
+	NAME_SEED = 0x75647362,
+	/** The most finished requests the poller takes at once */
+	POLL_BATCH = 64,
+	/** How long the poller waits for the eventfd, in milliseconds */
+	POLL_TIMEOUT_MS = 100,
+};
+
+static const enum uds_request_type TYPES[REQUEST_TYPES] = {
+	UDS_POST, UDS_QUERY, UDS_UPDATE, UDS_DELETE,
+};
+
+static const char *const TYPE_NAMES[REQUEST_TYPES] = {
+	"post", "query", "update", "delete",
+};
+
+static const char usage_string[] = " [--help] [options...] filename";
+
+static const char help_string[] =
+	"udsbench - measure the throughput and latency of a UDS index\n"
+	"\n"
+	"SYNOPSIS\n"
+	"  udsbench [options] filename\n"
+	"\n"
+	"DESCRIPTION\n"
+	"  udsbench creates a new index in filename, destroying anything\n"
+	"  stored there, and drives requests at it from client threads. The\n"
+	"  requests name synthetic chunks: a post names a new chunk unless it\n"
+	"  is chosen to be a duplicate, and duplicates, queries, updates and\n"
+	"  deletes name a chunk chosen from the most recently named ones.\n"
+	"  For each zone count, it reports operations per second and the\n"
+	"  50th, 99th and 99.9th percentile latencies of each request type.\n"
+	"  With more than one zone, it also reports the load on each zone\n"
+	"  and how far the busiest zone is above an even share.\n"
+	"\n"
+	"OPTIONS\n"
+	"    --checkpoint-frequency=<chapters>\n"
+	"       Checkpoint the index every <chapters> chapters.\n"
+	"\n"
+	"    --compress-record-pages\n"
+	"       Create an index which compresses its record pages.\n"
+	"\n"
+	"    --counters\n"
+	"       Also report the hardware performance counters of each\n"
+	"       request, counted in every thread of the process.\n"
+	"\n"
+	"    --decoded-sparse\n"
+	"       Keep the chapter indexes in the sparse cache decoded.\n"
+	"\n"
+	"    --duplicates=<percent>\n"
+	"       Make <percent> of the posts name a chunk which has been named\n"
+	"       before. The default is 10.\n"
+	"\n"
+	"    --fast-chapters=<count>\n"
+	"       Keep <count> chapters on the fast volume storage. The default\n"
+	"       is 64.\n"
+	"\n"
+	"    --fast-volume=<path>\n"
+	"       Keep copies of the newest chapters of the volume in <path>,\n"
+	"       and read them from there.\n"
+	"\n"
+	"    --help\n"
+	"       Print this help message and exit.\n"
+	"\n"
+	"    --interactive\n"
+	"       Start the queries in the interactive priority class, so that\n"
+	"       they are handled ahead of the other requests.\n"
+	"\n"
+	"    --locality=<names>\n"
+	"       Choose the chunks named again from the <names> most recently\n"
+	"       named chunks. 0, the default, chooses from all of them.\n"
+	"\n"
+	"    --memory=<gigabytes>\n"
+	"       The memory size of the index, as for --uds-memory-size of\n"
+	"       vdoformat. The default is 0.25.\n"
+	"\n"
+	"    --max-read-threads=<count>\n"
+	"       Add reader threads, up to <count> of them, while volume page\n"
+	"       reads wait too long in the read queue, retiring them again\n"
+	"       when they are idle.\n"
+	"\n"
+	"    --min-cache-chapters=<count>\n"
+	"       Shrink the page cache and sparse cache to as few as <count>\n"
+	"       chapters while memory is short, growing them back when it\n"
+	"       is not.\n"
+	"\n"
+	"    --mix=<post>,<query>,<update>,<delete>\n"
+	"       The relative weights of the request types. The default is\n"
+	"       100,0,0,0.\n"
+	"\n"
+	"    --mmap\n"
+	"       Read the volume through a memory mapping.\n"
+	"\n"
+	"    --outstanding=<requests>\n"
+	"       Keep up to <requests> requests in flight from each client\n"
+	"       thread. The default is 64.\n"
+	"\n"
+	"    --poll\n"
+	"       Collect finished requests from the session's completion\n"
+	"       queue on a poller thread, instead of through callbacks.\n"
+	"\n"
+	"    --requests=<count>\n"
+	"       Issue <count> requests for each zone count. The default is\n"
+	"       1000000.\n"
+	"\n"
+	"    --save-bandwidth=<megabytes>\n"
+	"       Write checkpoints and saves at no more than <megabytes>\n"
+	"       per second.\n"
+	"\n"
+	"    --shared-readers\n"
+	"       Read volume pages with the process-wide reader pool instead\n"
+	"       of reader threads of the index's own.\n"
+	"\n"
+	"    --sparse\n"
+	"       Create a sparse index.\n"
+	"\n"
+	"    --threads=<count>\n"
+	"       Issue requests from <count> client threads. The default is 1.\n"
+	"\n"
+	"    --zoned-volume=<path>\n"
+	"       Keep the chapters of the volume on the zoned block device\n"
+	"       <path>, one chapter to a run of zones.\n"
+	"\n"
+	"    --zones=<count>[,<count>...]\n"
+	"       Run the benchmark once with each number of index zones. The\n"
+	"       default is the index's own choice.\n"
+	"\n";
+
+static struct option options[] = {
+	{ "checkpoint-frequency", required_argument, NULL, 'k' },
+	{ "compress-record-pages", no_argument, NULL, 'c' },
+	{ "counters", no_argument, NULL, 'P' },
+	{ "decoded-sparse", no_argument, NULL, 'D' },
+	{ "duplicates", required_argument, NULL, 'd' },
+	{ "fast-chapters", required_argument, NULL, 'F' },
+	{ "fast-volume", required_argument, NULL, 'f' },
+	{ "help", no_argument, NULL, 'h' },
+	{ "interactive", no_argument, NULL, 'i' },
+	{ "locality", required_argument, NULL, 'l' },
+	{ "memory", required_argument, NULL, 'm' },
+	{ "max-read-threads", required_argument, NULL, 'T' },
+	{ "min-cache-chapters", required_argument, NULL, 'C' },
+	{ "mix", required_argument, NULL, 'x' },
+	{ "mmap", no_argument, NULL, 'M' },
+	{ "outstanding", required_argument, NULL, 'o' },
+	{ "poll", no_argument, NULL, 'p' },
+	{ "requests", required_argument, NULL, 'r' },
+	{ "save-bandwidth", required_argument, NULL, 'b' },
+	{ "shared-readers", no_argument, NULL, 'R' },
+	{ "sparse", no_argument, NULL, 's' },
+	{ "threads", required_argument, NULL, 't' },
+	{ "zoned-volume", required_argument, NULL, 'Z' },
+	{ "zones", required_argument, NULL, 'z' },
+	{ NULL, 0, NULL, 0 },
+};
+static char option_string[] = "b:C:cDd:F:f:hik:l:Mm:x:o:Ppr:Rst:T:Z:z:";
+
+/** The latency and outcome counts of one request type */
+struct type_stats {
+	atomic64_t requests;
+	atomic64_t found;
+	struct bench_histogram latency;
+};
+
+/** The hardware counters, which are read if counting is set */
+static struct bench_counters counters;
+static bool counting;
+
+/** The settings of a benchmark run */
+struct bench_config {
+	const char *filename;
+	uds_memory_config_size_t memory;
+	bool sparse;
+	bool decoded_sparse;
+	bool compress_record_pages;
+	bool interactive;
+	bool poll;
+	bool shared_readers;
+	bool mmap_volume;
+	const char *fast_volume_path;
+	unsigned int fast_volume_chapters;
+	const char *zoned_volume_path;
+	unsigned int min_cache_chapters;
+	unsigned int max_read_threads;
+	unsigned int checkpoint_frequency;
+	uint64_t save_bandwidth;
+	unsigned int duplicate_percent;
+	uint64_t locality;
+	unsigned int mix[REQUEST_TYPES];
+	unsigned int mix_total;
+	unsigned int outstanding;
+	uint64_t requests;
+	unsigned int threads;
+	unsigned int zone_counts[MAX_ZONE_RUNS];
+	unsigned int zone_runs;
+};
+
+struct bench_client;
+
+/** A request and what the benchmark needs to know when it finishes */
+struct bench_request {
+	struct uds_request request;
+	struct bench_client *client;
+	unsigned int type_index;
+	ktime_t start_time;
+	struct bench_request *next_free;
+};
+
+/** The state of one client thread */
+struct bench_client {
+	const struct bench_config *config;
+	struct uds_index_session *session;
+	struct thread *thread;
+	uint64_t requests;
+	uint64_t random_state;
+	int result;
+	struct semaphore slots;
+	struct mutex free_mutex;
+	struct bench_request *free_requests;
+	struct bench_request *request_memory;
+};
+
+/** The count of chunk names handed out so far, shared by all clients */
+static atomic64_t name_count;
+
+/** The completion eventfd of the session, when polling */
+static int completion_fd;
+
+/** Set once the clients are done, to stop the poller thread */
+static atomic_t poller_stopping;
+
+static struct type_stats *stats;
+
+/**********************************************************************/
+static void usage(const char *progname)
+{
+	errx(1, "Usage: %s%s\n", progname, usage_string);
+}
+
+/**
+ * Parse an unsigned decimal option value, exiting if it is malformed or out
+ * of range.
+ **/
+static uint64_t parse_number(const char *name,
+			     const char *arg,
+			     uint64_t min,
+			     uint64_t max)
+{
+	uint64_t value;
+	if ((uds_parse_uint64(arg, &value) != UDS_SUCCESS) || (value < min) ||
+	    (value > max)) {
+		errx(1, "invalid --%s value: %s", name, arg);
+	}
+	return value;
+}
+
+/**
+ * Parse a comma separated list of unsigned decimal values.
+ *
+ * @return the number of values parsed
+ **/
+static unsigned int parse_list(const char *name,
+			       const char *arg,
+			       unsigned int min,
+			       unsigned int max,
+			       unsigned int values[],
+			       unsigned int capacity)
+{
+	unsigned int count = 0;
+	char *copy = strdup(arg);
+	char *saveptr = NULL;
+	char *token;
+	if (copy == NULL) {
+		errx(1, "out of memory");
+	}
+
+	for (token = strtok_r(copy, ",", &saveptr); token != NULL;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		if (count == capacity) {
+			errx(1, "too many --%s values: %s", name, arg);
+		}
+		values[count++] = parse_number(name, token, min, max);
+	}
+	free(copy);
+
+	if (count == 0) {
+		errx(1, "invalid --%s value: %s", name, arg);
+	}
+	return count;
+}
+
+/**********************************************************************/
+static uds_memory_config_size_t parse_memory(const char *arg)
+{
+	if (strcmp(arg, "0.25") == 0) {
+		return UDS_MEMORY_CONFIG_256MB;
+	} else if ((strcmp(arg, "0.5") == 0) || (strcmp(arg, "0.50") == 0)) {
+		return UDS_MEMORY_CONFIG_512MB;
+	} else if (strcmp(arg, "0.75") == 0) {
+		return UDS_MEMORY_CONFIG_768MB;
+	}
+	return parse_number("memory", arg, 1, UDS_MEMORY_CONFIG_MAX);
+}
+
+/**
+ * Advance a client's random number generator (xorshift64*), which is cheap
+ * enough not to distort the measurement and needs no locking.
+ **/
+static uint64_t next_random(struct bench_client *client)
+{
+	uint64_t x = client->random_state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	client->random_state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * Choose a chunk name, either a new one or one named before.
+ **/
+static void choose_name(struct bench_client *client,
+			bool repeat,
+			struct uds_chunk_name *name)
+{
+	uint64_t number;
+	uint64_t out[2];
+	uint64_t count = atomic64_read(&name_count);
+	if (repeat && (count > 0)) {
+		uint64_t window = count;
+		if ((client->config->locality > 0) &&
+		    (client->config->locality < window)) {
+			window = client->config->locality;
+		}
+		number = count - 1 - (next_random(client) % window);
+	} else {
+		number = atomic64_inc_return(&name_count) - 1;
+	}
+
+	MurmurHash3_x64_128(&number, sizeof(number), NAME_SEED, out);
+	memcpy(name->name, out, UDS_CHUNK_NAME_SIZE);
+}
+
+/**
+ * Choose the type of the next request according to the mix.
+ *
+ * @return the index of the type in TYPES
+ **/
+static unsigned int choose_type(struct bench_client *client)
+{
+	const struct bench_config *config = client->config;
+	unsigned int pick = next_random(client) % config->mix_total;
+	unsigned int i;
+	for (i = 0; i < REQUEST_TYPES - 1; i++) {
+		if (pick < config->mix[i]) {
+			break;
+		}
+		pick -= config->mix[i];
+	}
+	return i;
+}
+
+/**********************************************************************/
+static void finish_request(struct uds_request *request)
+{
+	struct bench_request *bench_request =
+		container_of(request, struct bench_request, request);
+	struct bench_client *client = bench_request->client;
+	struct type_stats *type_stats = &stats[bench_request->type_index];
+	ktime_t latency = ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+				    bench_request->start_time);
+
+	if (request->status != UDS_SUCCESS) {
+		client->result = request->status;
+	}
+	atomic64_inc(&type_stats->requests);
+	if (request->found) {
+		atomic64_inc(&type_stats->found);
+	}
+	record_bench_latency(&type_stats->latency, latency);
+
+	uds_lock_mutex(&client->free_mutex);
+	bench_request->next_free = client->free_requests;
+	client->free_requests = bench_request;
+	uds_unlock_mutex(&client->free_mutex);
+	uds_release_semaphore(&client->slots);
+}
+
+/**********************************************************************/
+static void run_client(void *arg)
+{
+	struct bench_client *client = arg;
+	const struct bench_config *config = client->config;
+	uint64_t i;
+
+	for (i = 0; (i < client->requests) && (client->result == UDS_SUCCESS);
+	     i++) {
+		struct bench_request *bench_request;
+		struct uds_request *request;
+		unsigned int type_index = choose_type(client);
+		bool repeat = ((TYPES[type_index] != UDS_POST) ||
+			       ((next_random(client) % 100) <
+				config->duplicate_percent));
+		int result;
+
+		uds_acquire_semaphore(&client->slots);
+		uds_lock_mutex(&client->free_mutex);
+		bench_request = client->free_requests;
+		client->free_requests = bench_request->next_free;
+		uds_unlock_mutex(&client->free_mutex);
+
+		request = &bench_request->request;
+		memset(request, 0, sizeof(*request));
+		choose_name(client, repeat, &request->chunk_name);
+		memcpy(request->new_metadata.data, &i, sizeof(i));
+		request->callback = (config->poll ? NULL : finish_request);
+		request->session = client->session;
+		request->type = TYPES[type_index];
+		if (config->interactive && (request->type == UDS_QUERY)) {
+			request->priority = UDS_PRIORITY_INTERACTIVE;
+		}
+		bench_request->type_index = type_index;
+		bench_request->start_time = current_time_ns(CLOCK_MONOTONIC);
+		result = uds_start_chunk_operation(request);
+		if (result != UDS_SUCCESS) {
+			client->result = result;
+			uds_lock_mutex(&client->free_mutex);
+			bench_request->next_free = client->free_requests;
+			client->free_requests = bench_request;
+			uds_unlock_mutex(&client->free_mutex);
+			uds_release_semaphore(&client->slots);
+		}
+	}
+
+	// Wait for every request still in flight.
+	for (i = 0; i < config->outstanding; i++) {
+		uds_acquire_semaphore(&client->slots);
+	}
+}
+
+/**
+ * The body of the poller thread, which waits on the completion eventfd and
+ * finishes the requests it collects until the clients are done.
+ **/
+static void run_poller(void *arg)
+{
+	struct uds_index_session *session = arg;
+	struct uds_request *requests[POLL_BATCH];
+	struct pollfd pfd = { .fd = completion_fd, .events = POLLIN };
+
+	while (!atomic_read(&poller_stopping)) {
+		uint64_t signals;
+		unsigned int count, i;
+
+		if (poll(&pfd, 1, POLL_TIMEOUT_MS) <= 0) {
+			continue;
+		}
+		if (read(pfd.fd, &signals, sizeof(signals)) < 0) {
+			continue;
+		}
+
+		while ((count = uds_poll_completions(session, requests,
+						     POLL_BATCH)) > 0) {
+			for (i = 0; i < count; i++) {
+				finish_request(requests[i]);
+			}
+		}
+	}
+}
+
+/**********************************************************************/
+static int initialize_client(struct bench_client *client,
+			     const struct bench_config *config,
+			     struct uds_index_session *session,
+			     unsigned int number)
+{
+	unsigned int i;
+	int result;
+
+	client->config = config;
+	client->session = session;
+	client->requests = config->requests / config->threads;
+	if (number < config->requests % config->threads) {
+		client->requests += 1;
+	}
+	client->random_state = 0x9e3779b97f4a7c15ULL * (number + 1);
+	client->result = UDS_SUCCESS;
+
+	result = UDS_ALLOCATE(config->outstanding, struct bench_request,
+			      "benchmark requests", &client->request_memory);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	for (i = 0; i < config->outstanding; i++) {
+		client->request_memory[i].client = client;
+		client->request_memory[i].next_free = client->free_requests;
+		client->free_requests = &client->request_memory[i];
+	}
+
+	result = uds_init_mutex(&client->free_mutex);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	return uds_initialize_semaphore(&client->slots, config->outstanding);
+}
+
+/**********************************************************************/
+static void print_report(struct uds_index_session *session,
+			 unsigned int zone_count,
+			 const struct bench_config *config,
+			 ktime_t elapsed)
+{
+	struct uds_index_zone_stats zone_stats;
+	struct uds_index_stats index_stats;
+	struct uds_checkpoint_stats checkpoint_stats;
+	double seconds = elapsed / 1e9;
+	uint64_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < REQUEST_TYPES; i++) {
+		total += atomic64_read(&stats[i].requests);
+	}
+
+	if (zone_count == 0) {
+		printf("default zones");
+	} else {
+		printf("zones %u", zone_count);
+	}
+	printf(", %u client threads, %u outstanding each: "
+	       "%llu requests in %.3f s, %.0f ops/sec\n",
+	       config->threads, config->outstanding,
+	       (unsigned long long) total, seconds, total / seconds);
+	printf("  %-8s %12s %12s %12s %10s %10s %10s\n", "type",
+	       "requests", "found", "ops/sec", "p50 us", "p99 us", "p999 us");
+	for (i = 0; i < REQUEST_TYPES; i++) {
+		uint64_t requests = atomic64_read(&stats[i].requests);
+		if (requests == 0) {
+			continue;
+		}
+
+		printf("  %-8s %12llu %12llu %12.0f", TYPE_NAMES[i],
+		       (unsigned long long) requests,
+		       (unsigned long long) atomic64_read(&stats[i].found),
+		       requests / seconds);
+		printf(" %10.1f %10.1f %10.1f\n",
+		       get_bench_percentile(&stats[i].latency, 500) / 1000.0,
+		       get_bench_percentile(&stats[i].latency, 990) / 1000.0,
+		       get_bench_percentile(&stats[i].latency, 999) / 1000.0);
+	}
+	if (counting) {
+		print_bench_counters(&counters, "  ", total);
+	}
+
+	if ((config->min_cache_chapters > 0) &&
+	    (uds_get_index_stats(session, &index_stats) == UDS_SUCCESS)) {
+		const struct uds_memory_pressure_stats *pressure =
+			&index_stats.memory_pressure;
+		printf("  cache %u chapters (%u to %u), %llu shrinks, %llu grows, pressure %u.%02u%%\n",
+		       pressure->cache_chapters,
+		       pressure->min_cache_chapters,
+		       pressure->max_cache_chapters,
+		       (unsigned long long) pressure->shrinks,
+		       (unsigned long long) pressure->grows,
+		       pressure->pressure / 100,
+		       pressure->pressure % 100);
+	}
+
+	if ((config->max_read_threads > 0) &&
+	    (uds_get_index_stats(session, &index_stats) == UDS_SUCCESS)) {
+		const struct uds_reader_stats *readers = &index_stats.readers;
+		printf("  readers %u (%u to %u), %llu added, %llu retired, read wait %.1f us\n",
+		       readers->read_threads, readers->min_read_threads,
+		       readers->max_read_threads,
+		       (unsigned long long) readers->threads_added,
+		       (unsigned long long) readers->threads_retired,
+		       readers->read_wait / 1000.0);
+	}
+
+	if ((uds_get_index_stats(session, &index_stats) == UDS_SUCCESS) &&
+	    (index_stats.readers.read_batches > 0)) {
+		const struct uds_reader_stats *readers = &index_stats.readers;
+		printf("  batched reads %llu in %llu batches\n",
+		       (unsigned long long) readers->batched_reads,
+		       (unsigned long long) readers->read_batches);
+	}
+
+	if (config->sparse &&
+	    (uds_get_index_stats(session, &index_stats) == UDS_SUCCESS)) {
+		const struct uds_sparse_cache_stats *sparse =
+			&index_stats.sparse_cache;
+		printf("  sparse cache %llu loads, %llu coalesced, %llu dropped, %llu waits for loads\n",
+		       (unsigned long long) sparse->loads_queued,
+		       (unsigned long long) sparse->loads_coalesced,
+		       (unsigned long long) sparse->loads_dropped,
+		       (unsigned long long) sparse->loading_waits);
+	}
+
+	if ((config->checkpoint_frequency > 0) &&
+	    (uds_get_index_checkpoint_stats(session, &checkpoint_stats) ==
+	     UDS_SUCCESS)) {
+		printf("  %llu checkpoints, %llu stretched, average %.1f ms, throttled %.1f ms\n",
+		       (unsigned long long) checkpoint_stats.checkpoints,
+		       (unsigned long long) checkpoint_stats.stretched_checkpoints,
+		       checkpoint_stats.checkpoint_time / 1000.0,
+		       checkpoint_stats.throttle_time / 1000.0);
+	}
+
+	if ((uds_get_index_zone_stats(session, &zone_stats) != UDS_SUCCESS) ||
+	    (zone_stats.zone_count < 2) || (zone_stats.elapsed_time == 0)) {
+		return;
+	}
+	printf("  zone skew: requests %u%%, busy time %u%%\n",
+	       zone_stats.request_skew, zone_stats.busy_skew);
+	printf("  %-8s %12s %12s %10s %10s %12s\n", "zone", "requests",
+	       "ops/sec", "busy %", "max queue", "cached");
+	for (i = 0; i < zone_stats.zone_count; i++) {
+		const struct uds_zone_load *load = &zone_stats.zones[i];
+		printf("  %-8u %12llu %12.0f %10.1f %10u %12llu\n", i,
+		       (unsigned long long) load->requests,
+		       load->requests * 1e6 / zone_stats.elapsed_time,
+		       load->busy_time * 100.0 / zone_stats.elapsed_time,
+		       load->max_queue_depth,
+		       (unsigned long long) load->cached_queries);
+	}
+}
+
+/**
+ * Create an index with the given zone count, run the workload against it,
+ * and report the results.
+ **/
+static int run_benchmark(const struct bench_config *config,
+			 unsigned int zone_count)
+{
+	struct uds_parameters params = UDS_PARAMETERS_INITIALIZER;
+	struct uds_configuration *uds_config;
+	struct uds_index_session *session;
+	struct bench_client *clients;
+	struct thread *poller = NULL;
+	ktime_t start;
+	unsigned int i;
+	int result;
+
+	result = uds_initialize_configuration(&uds_config, config->memory);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	uds_configuration_set_sparse(uds_config, config->sparse);
+	uds_configuration_set_compressed_record_pages(uds_config,
+						      config->compress_record_pages);
+
+	result = uds_create_index_session(&session);
+	if (result != UDS_SUCCESS) {
+		uds_free_configuration(uds_config);
+		return result;
+	}
+
+	params.zone_count = zone_count;
+	params.shared_readers = config->shared_readers;
+	params.mmap_volume = config->mmap_volume;
+	params.decoded_sparse_cache = config->decoded_sparse;
+	params.fast_volume_path = config->fast_volume_path;
+	params.fast_volume_chapters = config->fast_volume_chapters;
+	params.zoned_volume_path = config->zoned_volume_path;
+	params.min_cache_chapters = config->min_cache_chapters;
+	params.max_read_threads = config->max_read_threads;
+	params.checkpoint_frequency = config->checkpoint_frequency;
+	params.save_bandwidth = config->save_bandwidth;
+	result = uds_open_index(UDS_CREATE, config->filename, &params,
+				uds_config, session);
+	uds_free_configuration(uds_config);
+	if (result != UDS_SUCCESS) {
+		uds_destroy_index_session(session);
+		return result;
+	}
+
+	result = UDS_ALLOCATE(config->threads, struct bench_client,
+			      "benchmark clients", &clients);
+	if (result == UDS_SUCCESS) {
+		result = UDS_ALLOCATE(REQUEST_TYPES, struct type_stats,
+				      "benchmark statistics", &stats);
+	}
+	for (i = 0; (result == UDS_SUCCESS) && (i < config->threads); i++) {
+		result = initialize_client(&clients[i], config, session, i);
+	}
+
+	atomic64_set(&name_count, 0);
+	atomic_set(&poller_stopping, 0);
+	if (counting) {
+		start_bench_counters(&counters);
+	}
+	start = current_time_ns(CLOCK_MONOTONIC);
+	if ((result == UDS_SUCCESS) && config->poll) {
+		result = uds_enable_completion_queue(session, &completion_fd);
+		if (result == UDS_SUCCESS) {
+			result = uds_create_thread(run_poller, session,
+						   "udsbenchPoll", &poller);
+		}
+	}
+	for (i = 0; (result == UDS_SUCCESS) && (i < config->threads); i++) {
+		result = uds_create_thread(run_client, &clients[i],
+					   "udsbench", &clients[i].thread);
+	}
+
+	for (i = 0; (clients != NULL) && (i < config->threads); i++) {
+		if (clients[i].thread != NULL) {
+			uds_join_threads(clients[i].thread);
+		}
+		if ((result == UDS_SUCCESS) &&
+		    (clients[i].result != UDS_SUCCESS)) {
+			result = clients[i].result;
+		}
+	}
+
+	if (result == UDS_SUCCESS) {
+		result = uds_flush_index_session(session);
+	}
+	if (poller != NULL) {
+		atomic_set(&poller_stopping, 1);
+		uds_join_threads(poller);
+	}
+	if (counting) {
+		stop_bench_counters(&counters);
+	}
+	if (result == UDS_SUCCESS) {
+		print_report(session, zone_count, config,
+			     ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+				       start));
+	}
+
+	for (i = 0; (clients != NULL) && (i < config->threads); i++) {
+		if (clients[i].request_memory != NULL) {
+			uds_destroy_semaphore(&clients[i].slots);
+			uds_destroy_mutex(&clients[i].free_mutex);
+			UDS_FREE(clients[i].request_memory);
+		}
+	}
+	UDS_FREE(clients);
+	UDS_FREE(stats);
+	stats = NULL;
+
+	if (result == UDS_SUCCESS) {
+		result = uds_close_index(session);
+	}
+	uds_destroy_index_session(session);
+	return result;
+}
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+	struct bench_config config = {
+		.memory = UDS_MEMORY_CONFIG_256MB,
+		.duplicate_percent = 10,
+		.fast_volume_chapters = 64,
+		.mix = { 100, 0, 0, 0 },
+		.mix_total = 100,
+		.outstanding = 64,
+		.requests = 1000000,
+		.threads = 1,
+		.zone_counts = { 0 },
+		.zone_runs = 1,
+	};
+	unsigned int i;
+	int c;
+
+	while ((c = getopt_long(argc, argv, option_string, options, NULL)) !=
+	       -1) {
+		switch (c) {
+		case 'b':
+			config.save_bandwidth =
+				parse_number("save-bandwidth", optarg, 1,
+					     1 << 20) * MEGABYTE;
+			break;
+
+		case 'C':
+			config.min_cache_chapters =
+				parse_number("min-cache-chapters", optarg, 1,
+					     UINT_MAX);
+			break;
+
+		case 'c':
+			config.compress_record_pages = true;
+			break;
+
+		case 'D':
+			config.decoded_sparse = true;
+			break;
+
+		case 'd':
+			config.duplicate_percent =
+				parse_number("duplicates", optarg, 0, 100);
+			break;
+
+		case 'F':
+			config.fast_volume_chapters =
+				parse_number("fast-chapters", optarg, 1,
+					     UINT_MAX);
+			break;
+
+		case 'f':
+			config.fast_volume_path = optarg;
+			break;
+
+		case 'h':
+			printf("%s", help_string);
+			exit(0);
+
+		case 'i':
+			config.interactive = true;
+			break;
+
+		case 'k':
+			config.checkpoint_frequency =
+				parse_number("checkpoint-frequency", optarg, 1,
+					     INT_MAX);
+			break;
+
+		case 'l':
+			config.locality =
+				parse_number("locality", optarg, 0, UINT64_MAX);
+			break;
+
+		case 'M':
+			config.mmap_volume = true;
+			break;
+
+		case 'm':
+			config.memory = parse_memory(optarg);
+			break;
+
+		case 'o':
+			config.outstanding = parse_number("outstanding", optarg,
+							  1, 1 << 20);
+			break;
+
+		case 'P':
+			counting = true;
+			break;
+
+		case 'p':
+			config.poll = true;
+			break;
+
+		case 'r':
+			config.requests = parse_number("requests", optarg, 1,
+						       UINT64_MAX);
+			break;
+
+		case 'R':
+			config.shared_readers = true;
+			break;
+
+		case 's':
+			config.sparse = true;
+			break;
+
+		case 'T':
+			config.max_read_threads =
+				parse_number("max-read-threads", optarg, 1,
+					     UINT_MAX);
+			break;
+
+		case 't':
+			config.threads = parse_number("threads", optarg, 1,
+						      1024);
+			break;
+
+		case 'x':
+			if (parse_list("mix", optarg, 0, 1000000, config.mix,
+				       REQUEST_TYPES) != REQUEST_TYPES) {
+				errx(1, "--mix needs %u weights",
+				     REQUEST_TYPES);
+			}
+			config.mix_total = 0;
+			for (i = 0; i < REQUEST_TYPES; i++) {
+				config.mix_total += config.mix[i];
+			}
+			if (config.mix_total == 0) {
+				errx(1, "--mix needs a non-zero weight");
+			}
+			break;
+
+		case 'Z':
+			config.zoned_volume_path = optarg;
+			break;
+
+		case 'z':
+			config.zone_runs = parse_list("zones", optarg, 1, 1024,
+						      config.zone_counts,
+						      MAX_ZONE_RUNS);
+			break;
+
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (optind != (argc - 1)) {
+		usage(argv[0]);
+	}
+	config.filename = argv[optind];
+	if (counting) {
+		counting = open_bench_counters(&counters);
+	}
+
+	for (i = 0; i < config.zone_runs; i++) {
+		int result = run_benchmark(&config, config.zone_counts[i]);
+		if (result != UDS_SUCCESS) {
+			char buf[UDS_STRING_ERROR_BUFSIZE];
+			errx(1, "benchmark failed: %s",
+			     uds_string_error(result, buf, sizeof(buf)));
+		}
+	}
+
+	if (counting) {
+		close_bench_counters(&counters);
+	}
+	exit(0);
+}
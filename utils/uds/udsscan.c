@@ -0,0 +1,625 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/udsscan.c#1 $
+ */
+
+/**
+ * udsscan reports statistics of an index which is not in service. It opens
+ * the index storage read-only and, without replaying or starting the index,
+ * reads every chapter of the volume with one read per chapter, spread over
+ * several threads, while it loads the volume index from the latest save.
+ * The report is written as JSON.
+ **/
+
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uds.h"
+
+#include "chapterIndex.h"
+#include "config.h"
+#include "errors.h"
+#include "geometry.h"
+#include "indexLayout.h"
+#include "indexState.h"
+#include "indexStateData.h"
+#include "ioRegion.h"
+#include "memoryAlloc.h"
+#include "timeUtils.h"
+#include "uds-threads.h"
+#include "volume.h"
+#include "volumeIndexOps.h"
+#include "zone.h"
+
+enum {
+	/** The most threads to scan the volume with by default */
+	DEFAULT_MAX_THREADS = 8,
+	/** The number of buckets in the chapter fill histogram */
+	FILL_BUCKETS = 10,
+};
+
+static const char usage_string[] = " [--help] [options...] index";
+
+static const char help_string[] =
+	"udsscan - report statistics of an index without opening it\n"
+	"\n"
+	"SYNOPSIS\n"
+	"  udsscan [options] index\n"
+	"\n"
+	"DESCRIPTION\n"
+	"  udsscan opens the index named by index, in the same form as for\n"
+	"  uds_open_index(), for reading only. It reads every chapter of the\n"
+	"  volume and loads the volume index from the latest save, without\n"
+	"  replaying chapters or starting the index, and writes a JSON report\n"
+	"  of the records and collisions in each chapter, how full the\n"
+	"  chapters are, and the sizes of the chapter index and volume index\n"
+	"  delta lists. The index should not be in use while it is scanned.\n"
+	"\n"
+	"OPTIONS\n"
+	"    --help\n"
+	"       Print this help message and exit.\n"
+	"\n"
+	"    --output=<file>\n"
+	"       Write the report to <file> rather than to standard output.\n"
+	"\n"
+	"    --summary\n"
+	"       Leave the list of chapters out of the report.\n"
+	"\n"
+	"    --threads=<count>\n"
+	"       Read the volume with <count> threads. The default is the\n"
+	"       number of cores, but at most 8.\n"
+	"\n";
+
+static struct option options[] = {
+	{ "help", no_argument, NULL, 'h' },
+	{ "output", required_argument, NULL, 'o' },
+	{ "summary", no_argument, NULL, 's' },
+	{ "threads", required_argument, NULL, 't' },
+	{ NULL, 0, NULL, 0 },
+};
+static char option_string[] = "ho:st:";
+
+/** What the scan found in one physical chapter */
+struct chapter_report {
+	uint64_t virtual_chapter;
+	unsigned int records;
+	unsigned int collisions;
+	bool written;
+};
+
+/** The state shared by the threads scanning the volume */
+struct volume_scan {
+	const struct geometry *geometry;
+	struct io_region *volume;
+	uint64_t nonce;
+	struct chapter_report *chapters;
+};
+
+/** A thread scanning a contiguous range of physical chapters */
+struct scan_thread {
+	struct volume_scan *scan;
+	unsigned int first_chapter;
+	unsigned int end_chapter;
+	byte *buffer;
+	// Chapter index delta lists by the number of entries in them, in
+	// the same power of two buckets as the volume index list sizes
+	long list_entries[DELTA_LIST_SIZE_BUCKETS];
+	struct thread *thread;
+	int result;
+};
+
+/** What was loaded from the saved volume index */
+struct volume_index_report {
+	struct volume_index_stats stats;
+	int result;
+};
+
+/**********************************************************************/
+static void usage(const char *progname)
+{
+	errx(1, "Usage: %s%s\n", progname, usage_string);
+}
+
+/**********************************************************************/
+static void check(int result, const char *what)
+{
+	if (result != UDS_SUCCESS) {
+		char buf[UDS_STRING_ERROR_BUFSIZE];
+		errx(1, "%s failed: %s", what,
+		     uds_string_error(result, buf, sizeof(buf)));
+	}
+}
+
+/**********************************************************************/
+static unsigned long parse_number(const char *name,
+				  const char *arg,
+				  unsigned long min,
+				  unsigned long max)
+{
+	uint64_t value;
+	if ((uds_parse_uint64(arg, &value) != UDS_SUCCESS) || (value < min) ||
+	    (value > max)) {
+		errx(1, "invalid --%s value: %s", name, arg);
+	}
+	return value;
+}
+
+/**
+ * Get the histogram bucket of a delta list size.
+ **/
+static unsigned int get_size_bucket(unsigned int size)
+{
+	unsigned int bucket = (size == 0) ? 0 : 32 - __builtin_clz(size);
+	return min(bucket, (unsigned int) DELTA_LIST_SIZE_BUCKETS - 1);
+}
+
+/**
+ * Count the entries of the delta lists of one chapter index page.
+ *
+ * @param index_page    The chapter index page
+ * @param report        The report of the chapter to add the entries to
+ * @param list_entries  The histogram of list lengths to add to
+ *
+ * @return UDS_SUCCESS or an error code if the page cannot be decoded
+ **/
+static int count_index_page(const struct delta_index_page *index_page,
+			    struct chapter_report *report,
+			    long list_entries[])
+{
+	unsigned int list_count = (index_page->highest_list_number -
+				   index_page->lowest_list_number + 1);
+	unsigned int list_number;
+	for (list_number = 0; list_number < list_count; list_number++) {
+		struct delta_index_entry entry;
+		unsigned int entries = 0;
+		int result = start_delta_index_search(&index_page->delta_index,
+						      list_number, 0, true,
+						      &entry);
+		for (;;) {
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+			result = next_delta_index_entry(&entry);
+			if ((result == UDS_SUCCESS) && entry.at_end) {
+				break;
+			}
+			if (result == UDS_SUCCESS) {
+				entries++;
+				if (entry.is_collision) {
+					report->collisions++;
+				}
+			}
+		}
+		report->records += entries;
+		list_entries[get_size_bucket(entries)]++;
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Scan one physical chapter, which has already been read into the buffer
+ * of the thread. A chapter whose index pages do not belong to this volume,
+ * or do not agree on the chapter they describe, was never written or has
+ * been damaged, and is reported as unwritten.
+ *
+ * @param thread   The scanning thread
+ * @param chapter  The physical chapter number
+ **/
+static void scan_chapter(struct scan_thread *thread, unsigned int chapter)
+{
+	const struct geometry *geometry = thread->scan->geometry;
+	struct chapter_report *report = &thread->scan->chapters[chapter];
+	long list_entries[DELTA_LIST_SIZE_BUCKETS] = { 0 };
+	unsigned int page, i;
+
+	for (page = 0; page < geometry->index_pages_per_chapter; page++) {
+		struct delta_index_page index_page;
+		int result = initialize_chapter_index_page(&index_page,
+							   geometry,
+							   thread->buffer +
+							   (page *
+							    geometry->bytes_per_page),
+							   thread->scan->nonce);
+		if (result != UDS_SUCCESS) {
+			return;
+		}
+		if (page == 0) {
+			report->virtual_chapter =
+				index_page.virtual_chapter_number;
+			if (map_to_physical_chapter(geometry,
+						    report->virtual_chapter) !=
+			    chapter) {
+				return;
+			}
+		} else if (index_page.virtual_chapter_number !=
+			   report->virtual_chapter) {
+			return;
+		}
+		if (count_index_page(&index_page, report, list_entries) !=
+		    UDS_SUCCESS) {
+			return;
+		}
+	}
+
+	report->written = true;
+	for (i = 0; i < DELTA_LIST_SIZE_BUCKETS; i++) {
+		thread->list_entries[i] += list_entries[i];
+	}
+}
+
+/**********************************************************************/
+static void run_scan_thread(void *arg)
+{
+	struct scan_thread *thread = arg;
+	const struct geometry *geometry = thread->scan->geometry;
+	unsigned int chapter;
+
+	for (chapter = thread->first_chapter; chapter < thread->end_chapter;
+	     chapter++) {
+		off_t offset =
+			((off_t) map_to_physical_page(geometry, chapter, 0) *
+			 geometry->bytes_per_page);
+		struct chapter_report *report =
+			&thread->scan->chapters[chapter];
+		// Chapters past the end of a volume file were never written.
+		size_t length = 0;
+		memset(report, 0, sizeof(*report));
+		thread->result = read_from_region(thread->scan->volume, offset,
+						  thread->buffer,
+						  geometry->bytes_per_chapter,
+						  &length);
+		if (thread->result != UDS_SUCCESS) {
+			return;
+		}
+		if (length < geometry->bytes_per_chapter) {
+			continue;
+		}
+		scan_chapter(thread, chapter);
+	}
+}
+
+/**
+ * Load the volume index from the latest save of the index. The index state
+ * is loaded as well, without an index to hold it, since it names the base
+ * of an incremental save; nothing else of the index is loaded.
+ *
+ * @param layout  The index layout
+ * @param config  The index configuration
+ * @param zones   The number of zones to load the volume index into
+ * @param report  The report to fill in
+ **/
+static void scan_volume_index(struct index_layout *layout,
+			      const struct configuration *config,
+			      unsigned int zones,
+			      struct volume_index_report *report)
+{
+	struct volume_index *volume_index;
+	struct index_state *state;
+
+	report->result = make_volume_index(config, zones,
+					   get_uds_volume_nonce(layout),
+					   &volume_index);
+	if (report->result != UDS_SUCCESS) {
+		return;
+	}
+	report->result = make_index_state(layout, zones, 2, &state);
+	if (report->result == UDS_SUCCESS) {
+		report->result = add_index_state_component(state,
+							   &INDEX_STATE_INFO,
+							   NULL, NULL);
+		if (report->result == UDS_SUCCESS) {
+			report->result =
+				add_index_state_component(state,
+							  VOLUME_INDEX_INFO,
+							  NULL,
+							  volume_index);
+		}
+		if (report->result == UDS_SUCCESS) {
+			report->result = load_index_state(state, NULL);
+		}
+		free_index_state(state);
+	}
+	if (report->result == UDS_SUCCESS) {
+		get_volume_index_combined_stats(volume_index, &report->stats);
+	}
+	free_volume_index(volume_index);
+}
+
+/**
+ * Write a string as a JSON string literal.
+ **/
+static void print_json_string(FILE *out, const char *string)
+{
+	const char *c;
+	fputc('"', out);
+	for (c = string; *c != '\0'; c++) {
+		if ((*c == '"') || (*c == '\\')) {
+			fprintf(out, "\\%c", *c);
+		} else if ((unsigned char) *c < 0x20) {
+			fprintf(out, "\\u%04x", (unsigned char) *c);
+		} else {
+			fputc(*c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+/**
+ * Write a histogram as a JSON array.
+ **/
+static void print_json_histogram(FILE *out, const long buckets[],
+				 unsigned int count)
+{
+	unsigned int i;
+	fputc('[', out);
+	for (i = 0; i < count; i++) {
+		fprintf(out, "%s%ld", (i == 0) ? "" : ", ", buckets[i]);
+	}
+	fputc(']', out);
+}
+
+/**********************************************************************/
+static void print_report(FILE *out,
+			 const char *name,
+			 const struct geometry *geometry,
+			 const struct chapter_report *chapters,
+			 const long list_entries[],
+			 const struct volume_index_report *volume_index,
+			 bool summary,
+			 double seconds)
+{
+	uint64_t records = 0, collisions = 0;
+	uint64_t oldest = UINT64_MAX, newest = 0;
+	long fill[FILL_BUCKETS] = { 0 };
+	unsigned int written = 0, chapter;
+	bool first = true;
+
+	for (chapter = 0; chapter < geometry->chapters_per_volume; chapter++) {
+		const struct chapter_report *report = &chapters[chapter];
+		if (!report->written) {
+			continue;
+		}
+		written++;
+		records += report->records;
+		collisions += report->collisions;
+		oldest = min(oldest, report->virtual_chapter);
+		newest = max(newest, report->virtual_chapter);
+		fill[min((unsigned int) FILL_BUCKETS - 1,
+			 (report->records * FILL_BUCKETS) /
+			 geometry->records_per_chapter)]++;
+	}
+
+	fprintf(out, "{\n  \"index\": ");
+	print_json_string(out, name);
+	fprintf(out, ",\n  \"scan_seconds\": %.3f,\n", seconds);
+	fprintf(out,
+		"  \"geometry\": {\"bytes_per_page\": %zu, "
+		"\"chapters_per_volume\": %u, "
+		"\"sparse_chapters_per_volume\": %u, "
+		"\"index_pages_per_chapter\": %u, "
+		"\"record_pages_per_chapter\": %u, "
+		"\"records_per_chapter\": %u, "
+		"\"delta_lists_per_chapter\": %u},\n",
+		geometry->bytes_per_page, geometry->chapters_per_volume,
+		geometry->sparse_chapters_per_volume,
+		geometry->index_pages_per_chapter,
+		geometry->record_pages_per_chapter,
+		geometry->records_per_chapter,
+		geometry->delta_lists_per_chapter);
+
+	fprintf(out, "  \"chapters\": {\n    \"written\": %u,\n", written);
+	if (written > 0) {
+		fprintf(out,
+			"    \"oldest\": %llu,\n    \"newest\": %llu,\n",
+			(unsigned long long) oldest,
+			(unsigned long long) newest);
+	}
+	fprintf(out,
+		"    \"records\": %llu,\n    \"collisions\": %llu,\n"
+		"    \"mean_fill\": %.4f,\n    \"fill_deciles\": ",
+		(unsigned long long) records,
+		(unsigned long long) collisions,
+		((written == 0) ? 0.0 :
+		 (double) records /
+		 ((double) written * geometry->records_per_chapter)));
+	print_json_histogram(out, fill, FILL_BUCKETS);
+	fprintf(out, ",\n    \"list_entries\": ");
+	print_json_histogram(out, list_entries, DELTA_LIST_SIZE_BUCKETS);
+	if (!summary) {
+		fprintf(out, ",\n    \"list\": [");
+		for (chapter = 0; chapter < geometry->chapters_per_volume;
+		     chapter++) {
+			const struct chapter_report *report =
+				&chapters[chapter];
+			if (!report->written) {
+				continue;
+			}
+			fprintf(out,
+				"%s\n      {\"physical\": %u, \"virtual\": %llu, "
+				"\"records\": %u, \"collisions\": %u, "
+				"\"fill\": %.4f}",
+				first ? "" : ",", chapter,
+				(unsigned long long) report->virtual_chapter,
+				report->records, report->collisions,
+				((double) report->records /
+				 geometry->records_per_chapter));
+			first = false;
+		}
+		fprintf(out, "\n    ]");
+	}
+	fprintf(out, "\n  },\n  \"volume_index\": ");
+
+	if (volume_index->result != UDS_SUCCESS) {
+		char buf[UDS_STRING_ERROR_BUFSIZE];
+		fprintf(out, "{\"error\": ");
+		print_json_string(out,
+				  uds_string_error(volume_index->result, buf,
+						   sizeof(buf)));
+		fprintf(out, "}\n}\n");
+		return;
+	}
+	fprintf(out,
+		"{\n    \"records\": %ld,\n    \"collisions\": %ld,\n"
+		"    \"delta_lists\": %u,\n    \"memory_allocated\": %zu,\n"
+		"    \"list_bits\": ",
+		volume_index->stats.record_count,
+		volume_index->stats.collision_count,
+		volume_index->stats.num_lists,
+		volume_index->stats.memory_allocated);
+	print_json_histogram(out, volume_index->stats.list_sizes,
+			     DELTA_LIST_SIZE_BUCKETS);
+	fprintf(out, "\n  }\n}\n");
+}
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+	unsigned int thread_count =
+		min(uds_get_num_cores(), (unsigned int) DEFAULT_MAX_THREADS);
+	const char *output = NULL;
+	bool summary = false;
+	struct uds_configuration user_config;
+	struct configuration *config;
+	struct index_layout *layout;
+	struct volume_scan scan;
+	struct scan_thread *threads;
+	struct volume_index_report volume_index;
+	long list_entries[DELTA_LIST_SIZE_BUCKETS] = { 0 };
+	const char *volume_path;
+	off_t volume_start;
+	size_t volume_size;
+	struct io_factory *factory;
+	ktime_t start;
+	int64_t elapsed;
+	FILE *out = stdout;
+	unsigned int chapters, t, i;
+	int c;
+
+	while ((c = getopt_long(argc, argv, option_string, options, NULL)) !=
+	       -1) {
+		switch (c) {
+		case 'h':
+			printf("%s", help_string);
+			exit(0);
+
+		case 'o':
+			output = optarg;
+			break;
+
+		case 's':
+			summary = true;
+			break;
+
+		case 't':
+			thread_count = parse_number("threads", optarg, 1, 256);
+			break;
+
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+	}
+	thread_count = max(thread_count, 1U);
+
+	start = current_time_ns(CLOCK_MONOTONIC);
+	check(make_uds_read_only_index_layout(argv[optind], &layout),
+	      "make_uds_read_only_index_layout");
+	check(read_uds_index_config(layout, &user_config),
+	      "read_uds_index_config");
+	check(make_configuration(&user_config, &config),
+	      "make_configuration");
+
+	get_uds_volume_region_location(layout, &volume_path, &volume_start,
+				       &volume_size);
+	check(make_uds_io_factory(volume_path, FU_READ_ONLY, &factory),
+	      "make_uds_io_factory");
+	scan.geometry = config->geometry;
+	scan.nonce = get_uds_volume_nonce(layout);
+	check(make_uds_io_region(factory, volume_start, volume_size,
+				 &scan.volume),
+	      "make_uds_io_region");
+	put_uds_io_factory(factory);
+	chapters = scan.geometry->chapters_per_volume;
+	check(UDS_ALLOCATE(chapters, struct chapter_report, "chapter reports",
+			   &scan.chapters),
+	      "allocate chapter reports");
+
+	thread_count = min(thread_count, chapters);
+	check(UDS_ALLOCATE(thread_count, struct scan_thread, "scan threads",
+			   &threads),
+	      "allocate scan threads");
+	for (t = 0; t < thread_count; t++) {
+		struct scan_thread *thread = &threads[t];
+		thread->scan = &scan;
+		thread->first_chapter =
+			(unsigned int) (((uint64_t) chapters * t) /
+					thread_count);
+		thread->end_chapter =
+			(unsigned int) (((uint64_t) chapters * (t + 1)) /
+					thread_count);
+		check(UDS_ALLOCATE(scan.geometry->bytes_per_chapter, byte,
+				   "chapter buffer", &thread->buffer),
+		      "allocate chapter buffer");
+		check(uds_create_thread(run_scan_thread, thread, "scanner",
+					&thread->thread),
+		      "start scan thread");
+	}
+
+	// The volume index loads with threads of its own, one per zone.
+	scan_volume_index(layout, config, min(thread_count,
+					      (unsigned int) MAX_ZONES),
+			  &volume_index);
+
+	for (t = 0; t < thread_count; t++) {
+		struct scan_thread *thread = &threads[t];
+		check(uds_join_threads(thread->thread), "join scan thread");
+		check(thread->result, "read chapter");
+		for (i = 0; i < DELTA_LIST_SIZE_BUCKETS; i++) {
+			list_entries[i] += thread->list_entries[i];
+		}
+		UDS_FREE(thread->buffer);
+	}
+
+	if (output != NULL) {
+		out = fopen(output, "w");
+		if (out == NULL) {
+			err(1, "cannot open %s", output);
+		}
+	}
+	elapsed = ktime_to_us(ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+					start));
+	print_report(out, argv[optind], scan.geometry, scan.chapters,
+		     list_entries, &volume_index, summary,
+		     elapsed / 1000000.0);
+	if ((out != stdout) && (fclose(out) != 0)) {
+		err(1, "cannot write %s", output);
+	}
+
+	UDS_FREE(threads);
+	UDS_FREE(scan.chapters);
+	put_io_region(scan.volume);
+	free_configuration(config);
+	put_uds_index_layout(layout);
+	return 0;
+}
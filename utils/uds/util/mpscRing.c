@@ -0,0 +1,82 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/util/mpscRing.c#1 $
+ */
+
+#include "mpscRing.h"
+
+#include "memoryAlloc.h"
+#include "permassert.h"
+#include "uds.h"
+
+/**********************************************************************/
+int make_mpsc_ring(unsigned int size, struct mpsc_ring **ring_ptr)
+{
+	int result = ASSERT(((size > 0) && ((size & (size - 1)) == 0)),
+			    "ring size %u is a power of two", size);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	struct mpsc_ring *ring;
+	result = UDS_ALLOCATE_EXTENDED(struct mpsc_ring, size,
+				       struct mpsc_ring_slot, "mpsc ring",
+				       &ring);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	unsigned int i;
+	for (i = 0; i < size; i++) {
+		atomic64_set(&ring->slots[i].sequence, i);
+	}
+	ring->mask = size - 1;
+	ring->head = 0;
+	atomic64_set(&ring->tail, 0);
+
+	*ring_ptr = ring;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void free_mpsc_ring(struct mpsc_ring *ring)
+{
+	UDS_FREE(ring);
+}
+
+/**********************************************************************/
+void *mpsc_ring_poll(struct mpsc_ring *ring)
+{
+	struct mpsc_ring_slot *slot = &ring->slots[ring->head & ring->mask];
+	if (atomic64_read_acquire(&slot->sequence) != (long) ring->head + 1) {
+		return NULL;
+	}
+
+	void *item = slot->item;
+	// Free the slot for the next lap.
+	atomic64_set_release(&slot->sequence, ring->head + ring->mask + 1);
+	ring->head++;
+	return item;
+}
+
+/**********************************************************************/
+bool is_mpsc_ring_idle(struct mpsc_ring *ring)
+{
+	return (atomic64_read_acquire(&ring->tail) == (long) ring->head);
+}
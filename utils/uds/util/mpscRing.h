@@ -0,0 +1,158 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/util/mpscRing.h#1 $
+ */
+
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <linux/atomic.h>
+
+#include "compiler.h"
+#include "cpu.h"
+#include "typeDefs.h"
+
+/**
+ * An mpsc_ring is a bounded lock-free queue which accepts pointers from
+ * multiple producer threads and delivers them to a single consumer thread.
+ * It is an array of slots whose size is a power of two, with a sequence
+ * number in each slot recording whether the slot is free or holds an item
+ * for the current lap of the ring (after Dmitry Vyukov's bounded queue).
+ *
+ * Unlike a funnel_queue, the items are not linked through the structures
+ * they point to, so the consumer reads its next item from a cache line
+ * which is usually already present rather than from the previous item.
+ * The price is that a put can fail when the ring is full, in which case the
+ * caller must put the item somewhere else.
+ *
+ * As with a funnel_queue, there is no mechanism to ensure that only one
+ * thread is consuming from the ring. A producer which is pre-empted between
+ * claiming a slot and filling it will hide later items from the consumer
+ * until it resumes.
+ **/
+
+struct mpsc_ring_slot {
+	// The lap position of the slot: equal to the position when the slot
+	// is free, and to the position plus one when it holds an item.
+	atomic64_t sequence;
+	void *item;
+};
+
+/**
+ * The ring structure. This should be considered opaque; it is exposed here
+ * so mpsc_ring_put() can be in-lined.
+ **/
+struct __attribute__((aligned(CACHE_LINE_BYTES))) mpsc_ring {
+	// The producers' end of the ring, the next position to claim.
+	atomic64_t tail;
+
+	// The consumer's end of the ring, the next position to take. Owned
+	// by the consumer.
+	uint64_t head __attribute__((aligned(CACHE_LINE_BYTES)));
+
+	// The mask for converting a position to a slot number.
+	uint64_t mask;
+
+	// The slots.
+	struct mpsc_ring_slot slots[]
+		__attribute__((aligned(CACHE_LINE_BYTES)));
+};
+
+/**
+ * Construct and initialize a new, empty ring.
+ *
+ * @param size      the number of slots in the ring, which must be a power
+ *                  of two
+ * @param ring_ptr  a pointer in which to store the ring
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check make_mpsc_ring(unsigned int size,
+				struct mpsc_ring **ring_ptr);
+
+/**
+ * Free a ring. This does not free any items still in the ring.
+ *
+ * @param ring  the ring to free
+ **/
+void free_mpsc_ring(struct mpsc_ring *ring);
+
+/**
+ * Put an item on the end of the ring if there is room for it.
+ *
+ * @param ring  the ring on which to place the item
+ * @param item  the item to add, which must not be NULL
+ *
+ * @return true if the item was added, false if the ring was full
+ **/
+static INLINE bool __must_check mpsc_ring_put(struct mpsc_ring *ring,
+					      void *item)
+{
+	long position = atomic64_read(&ring->tail);
+	struct mpsc_ring_slot *slot;
+	for (;;) {
+		slot = &ring->slots[position & ring->mask];
+		long difference =
+			atomic64_read_acquire(&slot->sequence) - position;
+		if (difference == 0) {
+			// The slot is free for this lap; try to claim it.
+			long claimed = atomic64_cmpxchg(&ring->tail, position,
+							position + 1);
+			if (claimed == position) {
+				break;
+			}
+			position = claimed;
+		} else if (difference < 0) {
+			// The slot still holds an item from the previous lap.
+			return false;
+		} else {
+			// Another producer claimed the slot first.
+			position = atomic64_read(&ring->tail);
+		}
+	}
+
+	slot->item = item;
+	// Publish the item. The release pairs with the acquire in
+	// mpsc_ring_poll.
+	atomic64_set_release(&slot->sequence, position + 1);
+	return true;
+}
+
+/**
+ * Poll a ring, removing the oldest item if one is available. This function
+ * must only be called from a single consumer thread.
+ *
+ * @param ring  the ring from which to remove an item
+ *
+ * @return the oldest item, or NULL if no item is available
+ **/
+void *__must_check mpsc_ring_poll(struct mpsc_ring *ring);
+
+/**
+ * Check whether any producer has claimed a slot in the ring which the
+ * consumer has not yet taken, including slots which are still being filled.
+ * This function must only be called from the consumer thread.
+ *
+ * @param ring  the ring to check
+ *
+ * @return true if no slot is claimed
+ **/
+bool __must_check is_mpsc_ring_idle(struct mpsc_ring *ring);
+
+#endif /* MPSC_RING_H */
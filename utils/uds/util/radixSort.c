@@ -38,7 +38,9 @@
 
 enum {
 	// Piles smaller than this are handled with a simple insertion sort.
-	INSERTION_SORT_THRESHOLD = 12
+	INSERTION_SORT_THRESHOLD = 12,
+	// The most bits taken from the keys for the first radix digit.
+	MAX_FIRST_DIGIT_BITS = 11,
 };
 
 // Sort keys are pointers to immutable fixed-length arrays of bytes.
@@ -72,6 +74,8 @@ struct task {
 struct radix_sorter {
 	unsigned int count;
 	struct histogram bins;
+	sort_key_t *scratch; // count key pointers for the first digit pass
+	uint32_t first_size[1 << MAX_FIRST_DIGIT_BITS];
 	sort_key_t *pile[256];
 	struct task *end_of_stack;
 	struct task is_list[256];
@@ -263,8 +267,11 @@ static INLINE int push_bins(struct task **stack,
 	return UDS_SUCCESS;
 }
 
-/**********************************************************************/
-int make_radix_sorter(unsigned int count, struct radix_sorter **sorter)
+/**
+ * Allocate a radix sorter.
+ **/
+static int allocate_radix_sorter(unsigned int count,
+				 struct radix_sorter **sorter)
 {
 	unsigned int stack_size = count / INSERTION_SORT_THRESHOLD;
 	struct radix_sorter *radix_sorter;
@@ -278,16 +285,136 @@ int make_radix_sorter(unsigned int count, struct radix_sorter **sorter)
 	}
 	radix_sorter->count = count;
 	radix_sorter->end_of_stack = radix_sorter->stack + stack_size;
+	result = UDS_ALLOCATE(count, sort_key_t, __func__,
+			      &radix_sorter->scratch);
+	if (result != UDS_SUCCESS) {
+		free_radix_sorter(radix_sorter);
+		return result;
+	}
 	*sorter = radix_sorter;
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+int make_radix_sorter(unsigned int count, struct radix_sorter **sorter)
+{
+	enum uds_memory_tag tag = uds_set_memory_tag(UDS_MEMORY_RADIX_SORTER);
+	int result = allocate_radix_sorter(count, sorter);
+	uds_set_memory_tag(tag);
+	return result;
+}
+
 /**********************************************************************/
 void free_radix_sorter(struct radix_sorter *sorter)
 {
+	if (sorter == NULL) {
+		return;
+	}
+	UDS_FREE(sorter->scratch);
 	UDS_FREE(sorter);
 }
 
+/**
+ * Choose the number of bits of the keys to use as the first radix digit.
+ * With one bin for every key or so, nearly every pile of uniformly
+ * distributed keys is left with at most a few keys after the first pass.
+ *
+ * @param count   the number of keys to sort
+ * @param length  the length of every key, in bytes
+ *
+ * @return the number of bits in the first digit, or zero if the first
+ *         digit should be a single byte like the rest
+ **/
+static INLINE unsigned int first_digit_bits(unsigned int count,
+					    unsigned short length)
+{
+	unsigned int bits;
+
+	if (length < 2) {
+		return 0;
+	}
+	bits = 31 - __builtin_clz(count);
+	if (bits <= 8) {
+		return 0;
+	}
+	return ((bits > MAX_FIRST_DIGIT_BITS) ? MAX_FIRST_DIGIT_BITS : bits);
+}
+
+/**********************************************************************/
+static INLINE unsigned int first_digit(sort_key_t key, unsigned int bits)
+{
+	return ((((unsigned int) key[0] << 8) | key[1]) >> (16 - bits));
+}
+
+/**
+ * Distribute the keys into piles by a first radix digit wider than a byte,
+ * copying them through the scratch array, and set up tasks to sort each pile
+ * by the bytes after the first. Small piles are sorted immediately. The
+ * piles share their first byte, so sorting them can continue from the
+ * second byte even though the digit ends part way through it.
+ *
+ * @param sorter  the heap storage used by the sorting
+ * @param keys    the array of key pointers to sort
+ * @param count   the number of keys
+ * @param length  the length of every key, in bytes
+ * @param bits    the number of bits in the first digit
+ * @param stack   pointer to the top of the task stack
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int sort_first_digit(struct radix_sorter *sorter,
+			    sort_key_t *keys,
+			    unsigned int count,
+			    unsigned short length,
+			    unsigned int bits,
+			    struct task **stack)
+{
+	uint32_t *size = sorter->first_size;
+	unsigned int bins = 1 << bits;
+	unsigned int bin, i;
+	uint32_t start = 0;
+
+	memset(size, 0, bins * sizeof(*size));
+	for (i = 0; i < count; i++) {
+		size[first_digit(keys[i], bits)]++;
+	}
+
+	// Turn the counts into the start of each pile.
+	for (bin = 0; bin < bins; bin++) {
+		uint32_t pile_size = size[bin];
+		size[bin] = start;
+		start += pile_size;
+	}
+
+	for (i = 0; i < count; i++) {
+		sort_key_t key = keys[i];
+		sorter->scratch[size[first_digit(key, bits)]++] = key;
+	}
+	memcpy(keys, sorter->scratch, count * sizeof(*keys));
+
+	// Each entry is now the end of its pile.
+	start = 0;
+	for (bin = 0; bin < bins; bin++) {
+		uint32_t pile_size = size[bin] - start;
+		if (pile_size > INSERTION_SORT_THRESHOLD) {
+			if (*stack >= sorter->end_of_stack) {
+				return UDS_BAD_STATE;
+			}
+			push_task(stack, &keys[start], pile_size, 1,
+				  length - 1);
+		} else if (pile_size > 1) {
+			insertion_sort((struct task) {
+				.first_key = &keys[start],
+				.last_key = &keys[size[bin] - 1],
+				.offset = 1,
+				.length = length - 1,
+			});
+		}
+		start = size[bin];
+	}
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 int radix_sort(struct radix_sorter *sorter,
 	       const unsigned char *keys[],
@@ -298,6 +425,7 @@ int radix_sort(struct radix_sorter *sorter,
 	struct histogram *bins = &sorter->bins;
 	sort_key_t **pile = sorter->pile;
 	struct task *sp = sorter->stack;
+	unsigned int bits;
 
 	// All zero-length keys are identical and therefore already sorted.
 	if ((count == 0) || (length == 0)) {
@@ -321,13 +449,24 @@ int radix_sort(struct radix_sorter *sorter,
 		return UDS_INVALID_ARGUMENT;
 	}
 
+	bits = first_digit_bits(count, length);
+	if (bits > 0) {
+		int result = sort_first_digit(sorter, keys, count, length,
+					      bits, &sp);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	} else {
+		*sp++ = start;
+	}
+
 	/*
 	 * Repeatedly consume a sorting task from the stack and process it,
 	 * pushing new sub-tasks onto to the stack for each radix-sorted pile.
 	 * When all tasks and sub-tasks have been processed, the stack will be
 	 * empty and all the keys in the starting task will be fully sorted.
 	 */
-	for (*sp = start; sp >= sorter->stack; sp--) {
+	for (sp--; sp >= sorter->stack; sp--) {
 		const struct task task = *sp;
 		struct task *lp;
 		int result;
@@ -24,30 +24,110 @@
 #include "cacheCounters.h"
 #include "chapterIndex.h"
 #include "compiler.h"
+#include "compressedCache.h"
 #include "errors.h"
 #include "geometry.h"
 #include "hashUtils.h"
 #include "indexConfig.h"
+#include "ioRing.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
 #include "permassert.h"
+#include "readerPool.h"
 #include "recordPage.h"
 #include "request.h"
 #include "sparseCache.h"
 #include "stringUtils.h"
+#include "udsProbes.h"
 #include "uds-threads.h"
 
 enum {
 	MAX_BAD_CHAPTERS = 100,           // max number of contiguous bad
 					  // chapters
 	DEFAULT_VOLUME_READ_THREADS = 2,  // Default number of reader threads
-	MAX_VOLUME_READ_THREADS = 16,     // Maximum number of reader threads
+	MAX_VOLUME_READ_THREADS = 64,     // Maximum number of reader threads
+	READ_THREADS_PER_CORE = 4,        // Most reader threads per core of
+					  // CPU quota when they are added on
+					  // demand
+	DEFAULT_READ_WAIT_TARGET_US = 1000, // Read queue wait above which
+					  // reader threads are added
+	READ_WAIT_WEIGHT = 8,             // Reads over which the read queue
+					  // wait is averaged
+	READER_ADD_INTERVAL_MS = 10,      // The least time between adding
+					  // reader threads
+	READER_IDLE_MS = 1000,            // How long an extra reader thread
+					  // waits for work before retiring
+	CACHE_RESIZE_STEP_PAGES = 64,     // Pages added or dropped per hold
+					  // of the read threads mutex
+	CACHE_RESIZE_WAIT_MS = 1,         // How long a resize waits for a
+					  // busy page before trying again
+	ENCODER_BATCH_PAGES = 8,          // Record pages each encoder writes
+					  // at once
+	WARM_BATCH_PAGES = 64,            // Warm list pages sorted into runs
+					  // at once, and the longest run
+	WARM_BACKOFF_MS = 1,              // How long warming waits for
+					  // demand reads to finish
+	READ_BATCH_ENTRIES = 16,          // Most read queue entries a reader
+					  // thread keeps in flight at once
+};
+
+/*
+ * A read queue entry which a reader thread has reserved, and the cache page
+ * its page is being read into.
+ */
+struct reserved_read {
+	/* The reserved read queue entry */
+	unsigned int queue_pos;
+	/* The requests waiting for the page */
+	struct uds_request *request_list;
+	/* The page to read */
+	unsigned int physical_page;
+	/* Whether the entry was invalidated before the read */
+	bool invalid;
+	/* The cache page being loaded, or NULL if the page is not read */
+	struct cached_page *page;
+	/* The physical page the cache page held before */
+	unsigned int evicted_page;
+	/* The result of get_eviction_epoch() at eviction */
+	uint64_t epoch;
+	/* The result of reading the page */
+	int result;
+};
+
+/*
+ * A record page encoder sorts and writes a share of the record pages of a
+ * chapter on its own thread, with its own sorting state and page buffers.
+ */
+struct record_page_encoder {
+	/* The volume being written */
+	struct volume *volume;
+	/* For sorting record pages */
+	struct radix_sorter *sorter;
+	/* A single page's records, for sorting */
+	const struct uds_chunk_record **record_pointers;
+	/* The page buffers used for writing to the volume */
+	struct volume_page pages[ENCODER_BATCH_PAGES];
+	/* A buffer for compressing record pages, if they are compressed */
+	byte *compression_buffer;
+	/* The thread running the encoder, if any */
+	struct thread *thread;
+	/* The physical page number of the first record page of the chapter */
+	int physical_page;
+	/* The 1-based array of records in the chapter */
+	const struct uds_chunk_record *records;
+	/* The first record page to encode */
+	unsigned int first_page;
+	/* The record page after the last one to encode */
+	unsigned int end_page;
+	/* The result of encoding the pages */
+	int result;
 };
 
 /**********************************************************************/
 static unsigned int get_read_threads(const struct uds_parameters *user_params)
 {
-	unsigned int read_threads =
+	int read_threads =
 		(user_params == NULL ? DEFAULT_VOLUME_READ_THREADS :
 				       user_params->read_threads);
 	if (read_threads < 1) {
@@ -59,26 +139,52 @@ static unsigned int get_read_threads(const struct uds_parameters *user_params)
 	return read_threads;
 }
 
+/**********************************************************************/
+static INLINE unsigned int page_number_of(unsigned int record_pages,
+					  unsigned int index_pages,
+					  unsigned int physical_page)
+{
+	return ((physical_page - 1) % (record_pages + index_pages));
+}
+
 /**********************************************************************/
 static INLINE unsigned int map_to_page_number(struct geometry *geometry,
 					      unsigned int physical_page)
 {
-	return ((physical_page - 1) % geometry->pages_per_chapter);
+	DISPATCH_ON_GEOMETRY_SHAPE(geometry, page_number_of, physical_page);
+}
+
+/**********************************************************************/
+static INLINE unsigned int chapter_number_of(unsigned int record_pages,
+					     unsigned int index_pages,
+					     unsigned int physical_page)
+{
+	return ((physical_page - 1) / (record_pages + index_pages));
 }
 
 /**********************************************************************/
 static INLINE unsigned int map_to_chapter_number(struct geometry *geometry,
 						 unsigned int physical_page)
 {
-	return ((physical_page - 1) / geometry->pages_per_chapter);
+	DISPATCH_ON_GEOMETRY_SHAPE(geometry, chapter_number_of,
+				   physical_page);
+}
+
+/**********************************************************************/
+static INLINE bool page_is_record_page(unsigned int record_pages,
+				       unsigned int index_pages,
+				       unsigned int physical_page)
+{
+	return (((physical_page - 1) % (record_pages + index_pages)) >=
+		index_pages);
 }
 
 /**********************************************************************/
 static INLINE bool is_record_page(struct geometry *geometry,
 				  unsigned int physical_page)
 {
-	return (((physical_page - 1) % geometry->pages_per_chapter) >=
-		geometry->index_pages_per_chapter);
+	DISPATCH_ON_GEOMETRY_SHAPE(geometry, page_is_record_page,
+				   physical_page);
 }
 
 /**********************************************************************/
@@ -87,14 +193,38 @@ static INLINE unsigned int get_zone_number(struct uds_request *request)
 	return (request == NULL) ? 0 : request->zone_number;
 }
 
+/**********************************************************************/
+static INLINE int physical_page_of(unsigned int record_pages,
+				   unsigned int index_pages,
+				   int chapter,
+				   int page)
+{
+	// Page zero is the header page, so the first index page in the
+	// first chapter is physical page one.
+	return (1 + ((int) (record_pages + index_pages) * chapter) + page);
+}
+
 /**********************************************************************/
 int map_to_physical_page(const struct geometry *geometry,
 			 int chapter,
 			 int page)
 {
-	// Page zero is the header page, so the first index page in the
-	// first chapter is physical page one.
-	return (1 + (geometry->pages_per_chapter * chapter) + page);
+	DISPATCH_ON_GEOMETRY_SHAPE(geometry, physical_page_of, chapter, page);
+}
+
+/**
+ * Wake a reader to service the read queue, whether the volume has its own
+ * reader threads or shares the process-wide reader pool.
+ *
+ * @param volume  the volume with queued reads
+ **/
+static void signal_reader_threads(struct volume *volume)
+{
+	if (volume->reader_pool != NULL) {
+		signal_reader_pool(volume->reader_pool);
+	} else {
+		uds_signal_cond(&volume->read_threads_cond);
+	}
 }
 
 /**********************************************************************/
@@ -115,7 +245,7 @@ static void wait_for_read_queue_not_full(struct volume *volume,
 
 	while (read_queue_is_full(volume->page_cache)) {
 		uds_log_debug("Waiting until read queue not full");
-		uds_signal_cond(&volume->read_threads_cond);
+		signal_reader_threads(volume);
 		uds_wait_cond(&volume->read_threads_read_done_cond,
 			      &volume->read_threads_mutex);
 	}
@@ -152,21 +282,32 @@ int enqueue_page_read(struct volume *volume,
 	}
 
 	if (result == UDS_QUEUED) {
+		UDS_PROBE2(page_cache_miss, request, physical_page);
 		/* signal a read thread */
-		uds_signal_cond(&volume->read_threads_cond);
+		signal_reader_threads(volume);
 	}
 
 	return result;
 }
 
 /**********************************************************************/
-static INLINE void
+/**
+ * Wait until a read queue entry can be reserved or the readers are told to
+ * exit. While there are more reader threads than the fewest to keep, a
+ * thread which finds no work for READER_IDLE_MS gives up waiting so that
+ * it may retire.
+ *
+ * @return <code>false</code> if the thread was idle for too long
+ **/
+static INLINE bool
 wait_to_reserve_read_queue_entry(struct volume *volume,
 				 unsigned int *queue_pos,
 				 struct uds_request **request_list,
 				 unsigned int *physical_page,
 				 bool *invalid)
 {
+	ktime_t idle_start = 0;
+
 	while (((volume->reader_state & READER_STATE_EXIT) == 0) &&
 	       (((volume->reader_state & READER_STATE_STOP) != 0) ||
 		!reserve_read_queue_entry(volume->page_cache,
@@ -174,9 +315,26 @@ wait_to_reserve_read_queue_entry(struct volume *volume,
 					  request_list,
 					  physical_page,
 					  invalid))) {
-		uds_wait_cond(&volume->read_threads_cond,
-			      &volume->read_threads_mutex);
+		ktime_t now;
+
+		if (volume->num_read_threads <= volume->min_read_threads) {
+			uds_wait_cond(&volume->read_threads_cond,
+				      &volume->read_threads_mutex);
+			continue;
+		}
+
+		now = current_time_ns(CLOCK_MONOTONIC);
+		if (idle_start == 0) {
+			idle_start = now;
+		} else if (ktime_sub(now, idle_start) >=
+			   ms_to_ktime(READER_IDLE_MS)) {
+			return false;
+		}
+		uds_timed_wait_cond(&volume->read_threads_cond,
+				    &volume->read_threads_mutex,
+				    ms_to_ktime(READER_IDLE_MS));
 	}
+	return true;
 }
 
 /**********************************************************************/
@@ -232,6 +390,67 @@ static int init_chapter_index_page(const struct volume *volume,
 				      "index page map mismatch with chapter index");
 }
 
+/**********************************************************************/
+static void read_thread_function(void *arg);
+
+/**
+ * Account for how long a page read waited in the read queue before a reader
+ * took it, and add a reader thread if reads have been waiting too long.
+ * Must be called with the read threads mutex held.
+ *
+ * @param volume     the volume
+ * @param queue_pos  the read queue entry which was just reserved
+ **/
+static void note_read_wait(struct volume *volume, unsigned int queue_pos)
+{
+	unsigned int i;
+	ktime_t now = current_time_ns(CLOCK_MONOTONIC);
+	ktime_t wait =
+		ktime_sub(now,
+			  volume->page_cache->read_queue[queue_pos].queued_time);
+	struct volume_reader *slot = NULL;
+
+	volume->read_wait += (wait - volume->read_wait) / READ_WAIT_WEIGHT;
+	if ((volume->readers == NULL) ||
+	    (volume->num_read_threads >= volume->max_read_threads) ||
+	    (volume->read_wait <= volume->read_wait_target) ||
+	    (ktime_sub(now, volume->reader_added_time) <
+	     ms_to_ktime(READER_ADD_INTERVAL_MS)) ||
+	    ((volume->reader_state & READER_STATE_EXIT) != 0)) {
+		return;
+	}
+
+	// Reuse the first slot which is empty or whose thread has retired.
+	for (i = 0; i < volume->max_read_threads; i++) {
+		struct volume_reader *reader = &volume->readers[i];
+		if (reader->thread == NULL) {
+			slot = reader;
+			break;
+		}
+		if (reader->exited) {
+			// The thread has already released the mutex for good.
+			uds_join_threads(reader->thread);
+			reader->thread = NULL;
+			reader->exited = false;
+			slot = reader;
+			break;
+		}
+	}
+
+	if (slot == NULL) {
+		return;
+	}
+
+	volume->reader_added_time = now;
+	if (uds_create_thread(read_thread_function, slot, "reader",
+			      &slot->thread) != UDS_SUCCESS) {
+		slot->thread = NULL;
+		return;
+	}
+	volume->num_read_threads++;
+	volume->readers_added++;
+}
+
 /**********************************************************************/
 static int initialize_index_page(const struct volume *volume,
 				 unsigned int physical_page,
@@ -250,145 +469,613 @@ static int initialize_index_page(const struct volume *volume,
 	return result;
 }
 
-/**********************************************************************/
-static void read_thread_function(void *arg)
+/**
+ * Get the compressed cache epoch for a page which is being evicted from the
+ * page cache. The caller must hold the read threads mutex, so that no
+ * chapter can be forgotten before the epoch is read.
+ *
+ * @param volume  the volume
+ *
+ * @return the epoch to pass to load_cache_page()
+ **/
+static uint64_t get_eviction_epoch(struct volume *volume)
 {
-	struct volume *volume = arg;
-	unsigned int queue_pos;
-	struct uds_request *request_list;
-	unsigned int physical_page;
-	bool invalid = false;
+	if (volume->compressed_cache == NULL) {
+		return 0;
+	}
+	return get_compressed_cache_epoch(volume->compressed_cache);
+}
 
-	uds_log_debug("reader starting");
-	uds_lock_mutex(&volume->read_threads_mutex);
-	while (true) {
-		bool record_page;
-		struct cached_page *page = NULL;
-		int result = UDS_SUCCESS;
-		wait_to_reserve_read_queue_entry(volume,
-						 &queue_pos,
-						 &request_list,
-						 &physical_page,
-						 &invalid);
-		if ((volume->reader_state & READER_STATE_EXIT) != 0) {
-			break;
+/**
+ * Compress a record page which is about to be written, if the volume
+ * compresses its record pages, and note how many blocks it will take.
+ *
+ * @param volume         the volume
+ * @param physical_page  the page number of the record page in the volume
+ * @param record_page    the encoded record page
+ * @param buffer         a buffer of a page for compressing the page
+ **/
+static void compress_volume_record_page(struct volume *volume,
+					unsigned int physical_page,
+					byte *record_page,
+					byte *buffer)
+{
+	size_t size;
+	unsigned int blocks;
+
+	if (!volume->compress_record_pages) {
+		return;
+	}
+
+	size = pack_record_page(volume->geometry, record_page, buffer);
+	blocks = (size + UDS_BLOCK_SIZE - 1) / UDS_BLOCK_SIZE;
+	WRITE_ONCE(volume->record_page_blocks[physical_page],
+		   ((blocks <= UINT8_MAX) ? blocks : 0));
+}
+
+/**
+ * Read a record page from the volume store, reading only the blocks which
+ * hold it if it was compressed to a known size, and expanding it into a page
+ * buffer.
+ *
+ * @param volume         the volume
+ * @param physical_page  the page to read
+ * @param volume_page    the page buffer to read it into
+ *
+ * @return UDS_SUCCESS or an error code from reading the page
+ **/
+static int read_record_page(struct volume *volume,
+			    unsigned int physical_page,
+			    struct volume_page *volume_page)
+{
+	const struct geometry *geometry = volume->geometry;
+	unsigned int blocks =
+		READ_ONCE(volume->record_page_blocks[physical_page]);
+	size_t size = geometry->bytes_per_page;
+	size_t stored_size;
+	struct volume_page stored;
+	int result;
+
+	if ((blocks > 0) && (blocks * UDS_BLOCK_SIZE < size)) {
+		size = blocks * UDS_BLOCK_SIZE;
+	}
+
+	result = initialize_volume_page(geometry, &stored);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = read_partial_volume_page(&volume->volume_store,
+					  physical_page, size, &stored);
+	if (result == UDS_SUCCESS) {
+		stored_size = get_stored_record_page_size(geometry,
+							  get_page_data(&stored));
+		if (stored_size > size) {
+			// The page has been rewritten since its size was
+			// noted.
+			result = read_volume_page(&volume->volume_store,
+						  physical_page, &stored);
 		}
+	}
+	if (result == UDS_SUCCESS) {
+		blocks = (stored_size + UDS_BLOCK_SIZE - 1) / UDS_BLOCK_SIZE;
+		WRITE_ONCE(volume->record_page_blocks[physical_page],
+			   ((blocks <= UINT8_MAX) ? blocks : 0));
+		release_volume_page(volume_page);
+		unpack_record_page(geometry, get_page_data(&stored),
+				   get_page_data(volume_page));
+	}
+	destroy_volume_page(&stored);
+	return result;
+}
+
+/**
+ * Read a page from the volume store into a page buffer.
+ *
+ * @param volume         the volume
+ * @param physical_page  the page to read
+ * @param volume_page    the page buffer to read it into
+ *
+ * @return UDS_SUCCESS or an error code from reading the page
+ **/
+static int read_page_from_store(struct volume *volume,
+				unsigned int physical_page,
+				struct volume_page *volume_page)
+{
+	if (volume->compress_record_pages &&
+	    is_record_page(volume->geometry, physical_page)) {
+		return read_record_page(volume, physical_page, volume_page);
+	}
+	return read_volume_page(&volume->volume_store, physical_page,
+				volume_page);
+}
+
+/**
+ * Fill a page cache page which has been selected as a victim. The data the
+ * page held is kept in the compressed cache, if there is one, before it is
+ * overwritten, and the new data is taken from the compressed cache if it is
+ * there, or read from storage otherwise.
+ *
+ * @param volume         the volume
+ * @param physical_page  the page to load
+ * @param page           the cache page to load it into
+ * @param evicted_page   the physical page the cache page held before
+ * @param epoch          the result of get_eviction_epoch() at eviction
+ *
+ * @return UDS_SUCCESS or an error code from reading the page
+ **/
+static int load_cache_page(struct volume *volume,
+			   unsigned int physical_page,
+			   struct cached_page *page,
+			   unsigned int evicted_page,
+			   uint64_t epoch)
+{
+	if (volume->compressed_cache == NULL) {
+		return read_page_from_store(volume, physical_page,
+					    &page->cp_page_data);
+	}
 
-		volume->busy_reader_threads++;
+	if (evicted_page != volume->page_cache->num_index_entries) {
+		store_compressed_page(volume->compressed_cache,
+				      evicted_page,
+				      get_page_data(&page->cp_page_data),
+				      epoch);
+	}
 
-		record_page = is_record_page(volume->geometry, physical_page);
+	// The page may show the store mapping, which is read-only.
+	release_volume_page(&page->cp_page_data);
+	if (fetch_compressed_page(volume->compressed_cache,
+				  physical_page,
+				  get_page_data(&page->cp_page_data))) {
+		return UDS_SUCCESS;
+	}
 
-		if (!invalid) {
-			// Find a place to put the read queue page we reserved
-			// above.
-			result = select_victim_in_cache(volume->page_cache,
-							&page);
-			if (result == UDS_SUCCESS) {
-				uds_unlock_mutex(&volume->read_threads_mutex);
-				result =
-					read_volume_page(&volume->volume_store,
-							 physical_page,
-							 &page->cp_page_data);
+	return read_page_from_store(volume, physical_page,
+				    &page->cp_page_data);
+}
+
+/**
+ * Queue a waiting request for the record page it will need, now that the
+ * chapter index page which names that page has been read. Without this, the
+ * record page read would only start once the zone thread had taken the
+ * request off its queue again and searched the index page itself. The caller
+ * must hold the read threads mutex.
+ *
+ * @param volume         the volume
+ * @param request        a request which was waiting for the index page
+ * @param physical_page  the physical page number of the index page
+ * @param page           the cache page holding the index page
+ *
+ * @return <code>true</code> if the request now waits for a record page read
+ **/
+static bool chain_record_page_read(struct volume *volume,
+				   struct uds_request *request,
+				   unsigned int physical_page,
+				   struct cached_page *page)
+{
+	struct geometry *geometry = volume->geometry;
+	unsigned int list_number =
+		hash_to_chapter_delta_list(&request->chunk_name, geometry);
+	int record_page_number;
+	unsigned int record_page;
+	int result;
+
+	// Leave a request the page does not cover to its zone to sort out.
+	if ((list_number < page->cp_index_page.lowest_list_number) ||
+	    (list_number > page->cp_index_page.highest_list_number)) {
+		return false;
+	}
+
+	result = search_chapter_index_page(&page->cp_index_page,
+					   geometry,
+					   &request->chunk_name,
+					   &record_page_number);
+	if ((result != UDS_SUCCESS) ||
+	    (record_page_number == NO_CHAPTER_INDEX_ENTRY) ||
+	    (record_page_number < 0) ||
+	    ((unsigned int) record_page_number >=
+	     geometry->record_pages_per_chapter)) {
+		return false;
+	}
+
+	record_page =
+		map_to_physical_page(geometry,
+				     map_to_chapter_number(geometry,
+							   physical_page),
+				     (geometry->index_pages_per_chapter +
+				      record_page_number));
+	// A cached record page is found by the zone as quickly as by us.
+	if (is_page_cached(volume->page_cache, record_page)) {
+		return false;
+	}
+
+	if (enqueue_read(volume->page_cache, request, record_page) !=
+	    UDS_QUEUED) {
+		return false;
+	}
+
+	volume->page_cache->counters.chained_reads += 1;
+	UDS_PROBE2(page_cache_miss, request, record_page);
+	signal_reader_threads(volume);
+	return true;
+}
+
+/**
+ * Begin to read the page for a reserved read queue entry, by choosing the
+ * cache page to read it into. The read threads mutex must be held.
+ *
+ * @param volume  the volume
+ * @param read    the reserved read queue entry
+ **/
+static void start_reserved_read(struct volume *volume,
+				struct reserved_read *read)
+{
+	note_read_wait(volume, read->queue_pos);
+	volume->busy_reader_threads++;
+
+	read->page = NULL;
+	read->result = UDS_SUCCESS;
+	if (read->invalid) {
+		return;
+	}
+
+	// Find a place to put the read queue page we reserved.
+	read->result = select_victim_in_cache(volume->page_cache, &read->page);
+	if (read->result != UDS_SUCCESS) {
+		uds_log_warning("Error selecting cache victim for page read");
+		read->page = NULL;
+		return;
+	}
+
+	read->evicted_page = read->page->cp_physical_page;
+	read->epoch = get_eviction_epoch(volume);
+}
+
+/**
+ * Give up the cache page of a reserved read whose page could not be read.
+ *
+ * @param volume  the volume
+ * @param read    the reserved read queue entry
+ **/
+static void cancel_reserved_read(struct volume *volume,
+				 struct reserved_read *read)
+{
+	uds_log_warning("Error reading page %u from volume",
+			read->physical_page);
+	cancel_page_in_cache(volume->page_cache, read->physical_page,
+			     read->page);
+}
+
+/**
+ * Put the page of a reserved read queue entry in the page cache, once it
+ * has been read, and send its waiting requests back to their zones. The
+ * read threads mutex must be held.
+ *
+ * @param volume  the volume
+ * @param read    the reserved read queue entry
+ **/
+static void finish_reserved_read(struct volume *volume,
+				 struct reserved_read *read)
+{
+	struct uds_request *request_list = read->request_list;
+	unsigned int physical_page = read->physical_page;
+	struct cached_page *page = read->page;
+	bool record_page = is_record_page(volume->geometry, physical_page);
+	bool invalid = read->invalid;
+	int result = read->result;
+
+	if (invalid) {
+		uds_log_debug("Requeuing requests for invalid page");
+	} else if (result == UDS_SUCCESS) {
+		if (!volume->page_cache->read_queue[read->queue_pos].invalid) {
+			if (!record_page) {
+				result = initialize_index_page(volume,
+							       physical_page,
+							       page);
 				if (result != UDS_SUCCESS) {
-					uds_log_warning("Error reading page %u from volume",
-							physical_page);
+					uds_log_warning("Error initializing chapter index page");
 					cancel_page_in_cache(volume->page_cache,
 							     physical_page,
 							     page);
 				}
-				uds_lock_mutex(&volume->read_threads_mutex);
-			} else {
-				uds_log_warning("Error selecting cache victim for page read");
 			}
 
 			if (result == UDS_SUCCESS) {
-				if (!volume->page_cache->read_queue[queue_pos]
-					     .invalid) {
-					if (!record_page) {
-						result = initialize_index_page(volume,
-									       physical_page,
-									       page);
-						if (result != UDS_SUCCESS) {
-							uds_log_warning("Error initializing chapter index page");
-							cancel_page_in_cache(volume->page_cache,
-									     physical_page,
-									     page);
-						}
-					}
-
-					if (result == UDS_SUCCESS) {
-						result = put_page_in_cache(volume->page_cache,
-									   physical_page,
-									   page);
-						if (result != UDS_SUCCESS) {
-							uds_log_warning("Error putting page %u in cache",
-								    physical_page);
-							cancel_page_in_cache(volume->page_cache,
-									     physical_page,
-									     page);
-						}
-					}
-				} else {
-					uds_log_warning("Page %u invalidated after read",
-						    physical_page);
+				result = put_page_in_cache(volume->page_cache,
+							   physical_page,
+							   page);
+				if (result != UDS_SUCCESS) {
+					uds_log_warning("Error putting page %u in cache",
+							physical_page);
 					cancel_page_in_cache(volume->page_cache,
 							     physical_page,
 							     page);
-					invalid = true;
 				}
 			}
 		} else {
-			uds_log_debug("Requeuing requests for invalid page");
+			uds_log_warning("Page %u invalidated after read",
+					physical_page);
+			cancel_page_in_cache(volume->page_cache,
+					     physical_page,
+					     page);
+			invalid = true;
 		}
+	}
 
-		if (invalid) {
-			result = UDS_SUCCESS;
-			page = NULL;
-		}
+	if (invalid) {
+		result = UDS_SUCCESS;
+		page = NULL;
+	}
 
-		while (request_list != NULL) {
-			struct uds_request *request = request_list;
-			request_list = request->next_request;
+	while (request_list != NULL) {
+		struct uds_request *request = request_list;
+		request_list = request->next_request;
 
-			/*
-			 * If we've read in a record page, we're going to do an
-			 * immediate search, in an attempt to speed up
-			 * processing when we requeue the request, so that it
-			 * doesn't have to go back into the
-			 * get_record_from_zone code again. However, if we've
-			 * just read in an index page, we don't want to search.
-			 * We want the request to be processed again and
-			 * get_record_from_zone to be run.  We have added new
-			 * fields in request to allow the index code to know
-			 * whether it can stop processing before
-			 * get_record_from_zone is called again.
-			 */
-			if ((result == UDS_SUCCESS) && (page != NULL) &&
-			    record_page) {
-				if (search_record_page(get_page_data(&page->cp_page_data),
-						       &request->chunk_name,
-						       volume->geometry,
-						       &request->old_metadata)) {
-					request->location = UDS_LOCATION_IN_DENSE;
-				} else {
-					request->location = UDS_LOCATION_UNAVAILABLE;
-				}
+		/*
+		 * If we've read in a record page, we're going to do an
+		 * immediate search, in an attempt to speed up
+		 * processing when we requeue the request, so that it
+		 * doesn't have to go back into the
+		 * get_record_from_zone code again. If we've just read
+		 * in an index page, we start the read of the record
+		 * page it names right away when that page is not
+		 * cached, and only otherwise send the request back to
+		 * have get_record_from_zone run again. We have added
+		 * new fields in request to allow the index code to
+		 * know whether it can stop processing before
+		 * get_record_from_zone is called again.
+		 */
+		if ((result == UDS_SUCCESS) && (page != NULL) &&
+		    record_page) {
+			if (search_record_page(get_page_data(&page->cp_page_data),
+					       &request->chunk_name,
+					       volume->geometry,
+					       &request->old_metadata)) {
+				request->location = UDS_LOCATION_IN_DENSE;
+			} else {
+				request->location = UDS_LOCATION_UNAVAILABLE;
 			}
+		} else if ((result == UDS_SUCCESS) && (page != NULL) &&
+			   ((volume->reader_state &
+			     READER_STATE_EXIT) == 0) &&
+			   chain_record_page_read(volume, request,
+						  physical_page,
+						  page)) {
+			continue;
+		}
+
+		// reflect any read failures in the request status
+		request->status = result;
+		request->read_time = current_time_ns(CLOCK_MONOTONIC);
+		UDS_PROBE3(page_read_done, request, physical_page,
+			   result);
+		restart_request(request);
+	}
+
+	release_read_queue_entry(volume->page_cache, read->queue_pos);
+
+	volume->busy_reader_threads--;
+	uds_broadcast_cond(&volume->read_threads_read_done_cond);
+}
+
+/**
+ * Read the page for a reserved read queue entry into the page cache and send
+ * its waiting requests back to their zones. The read threads mutex must be
+ * held, and is released while the page is read.
+ *
+ * @param volume  the volume
+ * @param read    the reserved read queue entry
+ **/
+static void process_read_queue_entry(struct volume *volume,
+				     struct reserved_read *read)
+{
+	start_reserved_read(volume, read);
+	if (read->page != NULL) {
+		ktime_t start, duration;
 
-			// reflect any read failures in the request status
-			request->status = result;
-			restart_request(request);
+		uds_unlock_mutex(&volume->read_threads_mutex);
+		start = current_time_ns(CLOCK_MONOTONIC);
+		read->result = load_cache_page(volume,
+					       read->physical_page,
+					       read->page,
+					       read->evicted_page,
+					       read->epoch);
+		duration = ktime_sub(current_time_ns(CLOCK_MONOTONIC), start);
+		if (read->result != UDS_SUCCESS) {
+			cancel_reserved_read(volume, read);
 		}
+		uds_lock_mutex(&volume->read_threads_mutex);
+		record_cache_read(&volume->page_cache->counters, duration);
+	}
+	finish_reserved_read(volume, read);
+}
 
-		release_read_queue_entry(volume->page_cache, queue_pos);
+/**
+ * Read the pages for several reserved read queue entries into the page
+ * cache with all of the reads in flight at once, and send their waiting
+ * requests back to their zones. The read threads mutex must be held, and is
+ * released while the pages are read.
+ *
+ * @param volume  the volume
+ * @param ring    the io_ring of the reader thread
+ * @param reads   the reserved read queue entries
+ * @param count   the number of entries, at most READ_BATCH_ENTRIES
+ **/
+static void process_read_queue_batch(struct volume *volume,
+				     struct io_ring *ring,
+				     struct reserved_read reads[],
+				     unsigned int count)
+{
+	struct volume_page_read page_reads[READ_BATCH_ENTRIES];
+	unsigned int loading = 0, i;
+
+	for (i = 0; i < count; i++) {
+		start_reserved_read(volume, &reads[i]);
+		if (reads[i].page != NULL) {
+			page_reads[loading++] = (struct volume_page_read) {
+				.physical_page = reads[i].physical_page,
+				.volume_page = &reads[i].page->cp_page_data,
+			};
+		}
+	}
+
+	if (loading > 0) {
+		ktime_t start, duration;
+		unsigned int loaded = 0;
+
+		uds_unlock_mutex(&volume->read_threads_mutex);
+		start = current_time_ns(CLOCK_MONOTONIC);
+		// Each page read has its own result.
+		(void) read_volume_page_batch(&volume->volume_store, ring,
+					      page_reads, loading);
+		duration = ktime_sub(current_time_ns(CLOCK_MONOTONIC), start);
+		for (i = 0; i < count; i++) {
+			if (reads[i].page == NULL) {
+				continue;
+			}
+			reads[i].result = page_reads[loaded++].result;
+			if (reads[i].result != UDS_SUCCESS) {
+				cancel_reserved_read(volume, &reads[i]);
+			}
+		}
+		uds_lock_mutex(&volume->read_threads_mutex);
+		for (i = 0; i < loading; i++) {
+			record_cache_read(&volume->page_cache->counters,
+					  duration);
+		}
+		volume->read_batches++;
+		volume->batched_reads += loading;
+	}
 
-		volume->busy_reader_threads--;
-		uds_broadcast_cond(&volume->read_threads_read_done_cond);
+	for (i = 0; i < count; i++) {
+		finish_reserved_read(volume, &reads[i]);
+	}
+}
+
+/**
+ * Check whether the reader threads of a volume may read pages in batches.
+ * A page loaded through the compressed cache, or a compressed record page,
+ * needs more than a plain read of the page, so those are read one at a
+ * time.
+ *
+ * @param volume  the volume
+ *
+ * @return <code>true</code> if pages may be read in batches
+ **/
+static bool can_batch_page_reads(const struct volume *volume)
+{
+	return ((volume->compressed_cache == NULL) &&
+		!volume->compress_record_pages);
+}
+
+/**
+ * Reserve more read queue entries, without waiting, to read along with one
+ * already reserved. The read threads mutex must be held.
+ *
+ * @param volume  the volume
+ * @param reads   the reserved entries, the first of them already filled in
+ *
+ * @return the number of entries now reserved
+ **/
+static unsigned int reserve_read_queue_batch(struct volume *volume,
+					     struct reserved_read reads[])
+{
+	unsigned int count = 1;
+
+	while ((count < READ_BATCH_ENTRIES) &&
+	       ((volume->reader_state &
+		 (READER_STATE_EXIT | READER_STATE_STOP)) == 0) &&
+	       reserve_read_queue_entry(volume->page_cache,
+					&reads[count].queue_pos,
+					&reads[count].request_list,
+					&reads[count].physical_page,
+					&reads[count].invalid)) {
+		count++;
+	}
+	return count;
+}
+
+/**********************************************************************/
+static void read_thread_function(void *arg)
+{
+	struct volume_reader *reader = arg;
+	struct volume *volume = reader->volume;
+	struct reserved_read reads[READ_BATCH_ENTRIES];
+	struct io_ring *ring = NULL;
+	unsigned int count;
+
+	uds_log_debug("reader starting");
+	// Without a ring, the thread reads one page at a time.
+	if (can_batch_page_reads(volume) &&
+	    (make_io_ring(READ_BATCH_ENTRIES, &ring) != UDS_SUCCESS)) {
+		ring = NULL;
+	}
+
+	uds_lock_mutex(&volume->read_threads_mutex);
+	while (true) {
+		reads[0].invalid = false;
+		if (!wait_to_reserve_read_queue_entry(volume,
+						      &reads[0].queue_pos,
+						      &reads[0].request_list,
+						      &reads[0].physical_page,
+						      &reads[0].invalid)) {
+			if (volume->num_read_threads >
+			    volume->min_read_threads) {
+				volume->num_read_threads--;
+				volume->readers_retired++;
+				reader->exited = true;
+				break;
+			}
+			continue;
+		}
+		if ((volume->reader_state & READER_STATE_EXIT) != 0) {
+			break;
+		}
+
+		count = ((ring != NULL) ?
+			 reserve_read_queue_batch(volume, reads) : 1);
+		if (count == 1) {
+			process_read_queue_entry(volume, &reads[0]);
+		} else {
+			process_read_queue_batch(volume, ring, reads, count);
+		}
 	}
 	uds_unlock_mutex(&volume->read_threads_mutex);
+	free_io_ring(ring);
 	uds_log_debug("reader done");
 }
 
+/**
+ * Service one read queue entry of a volume on behalf of the shared reader
+ * pool.
+ *
+ * @param context  the volume
+ *
+ * @return <code>true</code> if an entry was serviced
+ **/
+static bool service_volume_reads(void *context)
+{
+	struct volume *volume = context;
+	struct reserved_read read = {
+		.invalid = false,
+	};
+	bool reserved;
+
+	uds_lock_mutex(&volume->read_threads_mutex);
+	reserved = (((volume->reader_state &
+		      (READER_STATE_EXIT | READER_STATE_STOP)) == 0) &&
+		    reserve_read_queue_entry(volume->page_cache,
+					     &read.queue_pos,
+					     &read.request_list,
+					     &read.physical_page,
+					     &read.invalid));
+	if (reserved) {
+		process_read_queue_entry(volume, &read);
+	}
+	uds_unlock_mutex(&volume->read_threads_mutex);
+	return reserved;
+}
+
 /**********************************************************************/
 static int read_page_locked(struct volume *volume,
 			    struct uds_request *request,
@@ -402,17 +1089,35 @@ static int read_page_locked(struct volume *volume,
 	sync_read |= ((volume->lookup_mode == LOOKUP_FOR_REBUILD) ||
 		      (request == NULL) || (request->session == NULL));
 
+	// A mapped page which is already in memory can be taken into the
+	// cache here faster than a reader thread could be handed the request,
+	// unless a reader is already on its way to it.
+	if (!sync_read &&
+	    is_volume_page_resident(&volume->volume_store, physical_page) &&
+	    !is_page_queued(volume->page_cache, physical_page)) {
+		sync_read = true;
+		volume->page_cache->counters.resident_reads += 1;
+	}
 
 	if (sync_read) {
+		ktime_t start;
+		UDS_PROBE2(page_cache_miss, request, physical_page);
 		// Find a place to put the page.
 		result = select_victim_in_cache(volume->page_cache, &page);
 		if (result != UDS_SUCCESS) {
 			uds_log_warning("Error selecting cache victim for page read");
 			return result;
 		}
-		result = read_volume_page(&volume->volume_store,
-					  physical_page,
-					  &page->cp_page_data);
+		start = current_time_ns(CLOCK_MONOTONIC);
+		result = load_cache_page(volume,
+					 physical_page,
+					 page,
+					 page->cp_physical_page,
+					 get_eviction_epoch(volume));
+		record_cache_read(&volume->page_cache->counters,
+				  ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+					    start));
+		UDS_PROBE3(page_read_done, request, physical_page, result);
 		if (result != UDS_SUCCESS) {
 			uds_log_warning("Error reading page %u from volume",
 				    physical_page);
@@ -465,7 +1170,8 @@ int get_volume_page_locked(struct volume *volume,
 {
 	struct cached_page *page = NULL;
 	int result = get_page_from_cache(volume->page_cache, physical_page,
-					 probe_type, &page);
+					 probe_type, get_zone_number(request),
+					 &page);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
@@ -497,6 +1203,7 @@ int get_volume_page_protected(struct volume *volume,
 		get_page_from_cache(volume->page_cache,
 				    physical_page,
 				    probe_type | CACHE_PROBE_IGNORE_FAILURE,
+				    get_zone_number(request),
 				    &page);
 	if (result != UDS_SUCCESS) {
 		return result;
@@ -520,7 +1227,7 @@ int get_volume_page_protected(struct volume *volume,
 		 * entries in the cache for the same page.
 		 */
 		result = get_page_from_cache(volume->page_cache, physical_page,
-					     probe_type, &page);
+					     probe_type, zone_number, &page);
 		if (result != UDS_SUCCESS) {
 			/*
 			 * In non-success cases (anything not UDS_SUCCESS,
@@ -762,38 +1469,33 @@ int read_chapter_index_from_volume(const struct volume *volume,
 				   struct delta_index_page index_pages[])
 {
 	int result;
-	struct volume_page volume_page;
 	unsigned int i;
 	const struct geometry *geometry = volume->geometry;
 	unsigned int physical_chapter =
 		map_to_physical_chapter(geometry, virtual_chapter);
 	int physical_page =
 		map_to_physical_page(geometry, physical_chapter, 0);
-	prefetch_volume_pages(&volume->volume_store,
-			      physical_page,
-			      geometry->index_pages_per_chapter);
 
-	result = initialize_volume_page(geometry, &volume_page);
+	// The index pages are contiguous, so read them all at once.
+	result = read_volume_page_array(&volume->volume_store,
+					physical_page,
+					geometry->index_pages_per_chapter,
+					volume_pages);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
 	for (i = 0; i < geometry->index_pages_per_chapter; i++) {
-		byte *index_page;
-		int result = read_volume_page(&volume->volume_store,
-					      physical_page + i,
-					      &volume_pages[i]);
-		if (result != UDS_SUCCESS) {
-			break;
-		}
-		index_page = get_page_data(&volume_pages[i]);
 		result = init_chapter_index_page(volume,
-						 index_page,
+						 get_page_data(&volume_pages[i]),
 						 physical_chapter,
 						 i,
 						 &index_pages[i]);
 		if (result != UDS_SUCCESS) {
-			break;
+			return result;
 		}
 	}
-	destroy_volume_page(&volume_page);
-	return result;
+	return UDS_SUCCESS;
 }
 
 /**********************************************************************/
@@ -846,10 +1548,20 @@ int forget_chapter(struct volume *volume,
 	uds_log_debug("forgetting chapter %llu",
 		      (unsigned long long) virtual_chapter);
 	uds_lock_mutex(&volume->read_threads_mutex);
+	if (volume->warm_forgotten != NULL) {
+		volume->warm_forgotten[physical_chapter] = true;
+	}
 	result = invalidate_page_cache_for_chapter(volume->page_cache,
 						   physical_chapter,
 						   volume->geometry->pages_per_chapter,
 						   reason);
+	if (volume->compressed_cache != NULL) {
+		invalidate_compressed_pages(volume->compressed_cache,
+					    map_to_physical_page(volume->geometry,
+								 physical_chapter,
+								 0),
+					    volume->geometry->pages_per_chapter);
+	}
 	uds_unlock_mutex(&volume->read_threads_mutex);
 	return result;
 }
@@ -1020,7 +1732,10 @@ int write_record_pages(struct volume *volume,
 
 		// Sort the next page of records and copy them to the record
 		// page as a binary tree stored in heap order.
-		result = encode_record_page(volume, next_record,
+		result = encode_record_page(geometry,
+					    volume->radix_sorter,
+					    volume->record_pointers,
+					    next_record,
 					    get_page_data(&volume->scratch_page));
 		if (result != UDS_SUCCESS) {
 			return uds_log_warning_strerror(result,
@@ -1028,61 +1743,506 @@ int write_record_pages(struct volume *volume,
 							record_page_number);
 		}
 		next_record += geometry->records_per_page;
+		compress_volume_record_page(volume,
+					    physical_page + record_page_number,
+					    get_page_data(&volume->scratch_page),
+					    volume->compression_buffer);
+
+		result = write_volume_page(&volume->volume_store,
+					   physical_page + record_page_number,
+					   &volume->scratch_page);
+		if (result != UDS_SUCCESS) {
+			return uds_log_warning_strerror(result,
+							"failed to write chapter record page");
+		}
+
+		if (pages != NULL) {
+			memcpy(pages[record_page_number],
+			       get_page_data(&volume->scratch_page),
+			       geometry->bytes_per_page);
+		}
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Sort and write the record pages assigned to a record page encoder.
+ *
+ * @param encoder  The encoder
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int encode_record_pages(struct record_page_encoder *encoder)
+{
+	struct volume *volume = encoder->volume;
+	const struct geometry *geometry = volume->geometry;
+	unsigned int page, batched = 0;
+
+	for (page = encoder->first_page; page < encoder->end_page; page++) {
+		// The record array from the open chapter is 1-based.
+		const struct uds_chunk_record *next_record =
+			&encoder->records[1 + (page * geometry->records_per_page)];
+		int result = encode_record_page(geometry,
+						encoder->sorter,
+						encoder->record_pointers,
+						next_record,
+						get_page_data(&encoder->pages[batched]));
+		if (result != UDS_SUCCESS) {
+			return uds_log_warning_strerror(result,
+							"failed to encode record page %u",
+							page);
+		}
+		compress_volume_record_page(volume,
+					    encoder->physical_page + page,
+					    get_page_data(&encoder->pages[batched]),
+					    encoder->compression_buffer);
+
+		// Write the pages a batch at a time.
+		batched++;
+		if ((batched < ENCODER_BATCH_PAGES) &&
+		    (page + 1 < encoder->end_page)) {
+			continue;
+		}
+		result = write_volume_page_array(&volume->volume_store,
+						 encoder->physical_page +
+							 page + 1 - batched,
+						 batched,
+						 encoder->pages);
+		if (result != UDS_SUCCESS) {
+			return uds_log_warning_strerror(result,
+							"failed to write chapter record pages");
+		}
+		batched = 0;
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+static void encode_record_pages_thread(void *arg)
+{
+	struct record_page_encoder *encoder = arg;
+
+	encoder->result = encode_record_pages(encoder);
+}
+
+/**
+ * Sort and write the record pages of a chapter using the record page
+ * encoders of the volume, while the index pages of the chapter are packed
+ * and written by the calling thread. Each encoder handles a contiguous range
+ * of the record pages. An encoder whose thread can't be started does its
+ * work once the index pages have been written.
+ *
+ * @param volume         the volume containing the chapter
+ * @param physical_page  the page number in the volume for the chapter
+ * @param chapter_index  the populated delta chapter index
+ * @param records        a 1-based array of chunk records in the chapter
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int write_chapter_pages_in_parallel(struct volume *volume,
+					   int physical_page,
+					   struct open_chapter_index *chapter_index,
+					   const struct uds_chunk_record records[])
+{
+	const struct geometry *geometry = volume->geometry;
+	unsigned int count = volume->encoder_count;
+	unsigned int pages = geometry->record_pages_per_chapter;
+	unsigned int i;
+	int result;
+
+	for (i = 0; i < count; i++) {
+		struct record_page_encoder *encoder = &volume->encoders[i];
+
+		encoder->physical_page =
+			physical_page + geometry->index_pages_per_chapter;
+		encoder->records = records;
+		encoder->first_page = (i * pages) / count;
+		encoder->end_page = ((i + 1) * pages) / count;
+		encoder->result = UDS_SUCCESS;
+		if (uds_create_thread(encode_record_pages_thread,
+				      encoder,
+				      "recordpages",
+				      &encoder->thread) != UDS_SUCCESS) {
+			encoder->thread = NULL;
+		}
+	}
+
+	result = write_index_pages(volume, physical_page, chapter_index, NULL);
+
+	for (i = 0; i < count; i++) {
+		struct record_page_encoder *encoder = &volume->encoders[i];
+
+		if (encoder->thread != NULL) {
+			uds_join_threads(encoder->thread);
+			encoder->thread = NULL;
+		} else {
+			encoder->result = encode_record_pages(encoder);
+		}
+		if (result == UDS_SUCCESS) {
+			result = encoder->result;
+		}
+	}
+	return result;
+}
+
+/**********************************************************************/
+int write_chapter(struct volume *volume,
+		  struct open_chapter_index *chapter_index,
+		  const struct uds_chunk_record records[])
+{
+	// Determine the position of the virtual chapter in the volume file.
+	struct geometry *geometry = volume->geometry;
+	unsigned int physical_chapter_number =
+		map_to_physical_chapter(geometry,
+					chapter_index->virtual_chapter_number);
+	int physical_page =
+		map_to_physical_page(geometry, physical_chapter_number, 0);
+	int result;
+
+	result = begin_volume_store_chapter(&volume->volume_store,
+					    physical_chapter_number);
+	if (result != UDS_SUCCESS) {
+		uds_log_error_strerror(result,
+				       "cannot prepare to write chapter %u",
+				       physical_chapter_number);
+	} else if (volume->encoder_count > 0) {
+		result = write_chapter_pages_in_parallel(volume,
+							 physical_page,
+							 chapter_index,
+							 records);
+	} else {
+		// Pack and write the delta chapter index pages to the volume.
+		result = write_index_pages(volume, physical_page,
+					   chapter_index, NULL);
+		if (result == UDS_SUCCESS) {
+			// Sort and write the record pages to the volume.
+			result = write_record_pages(volume, physical_page,
+						    records, NULL);
+		}
+	}
+	finish_volume_store_chapter(&volume->volume_store,
+				    physical_chapter_number,
+				    (result == UDS_SUCCESS));
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	release_volume_page(&volume->scratch_page);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int resize_volume_cache(struct volume *volume, unsigned int cache_chapters)
+{
+	unsigned int num_entries;
+	int result = UDS_SUCCESS;
+
+	if ((cache_chapters < 1) ||
+	    (cache_chapters > volume->max_cache_chapters)) {
+		return uds_log_error_strerror(UDS_INVALID_ARGUMENT,
+					      "cache size of %u chapters is not between 1 and %u",
+					      cache_chapters,
+					      volume->max_cache_chapters);
+	}
+
+	num_entries = cache_chapters * volume->geometry->record_pages_per_chapter;
+	uds_lock_mutex(&volume->read_threads_mutex);
+	while (volume->page_cache->live_cache_entries != num_entries) {
+		bool blocked;
+		result = resize_page_cache(volume->page_cache,
+					   num_entries,
+					   CACHE_RESIZE_STEP_PAGES,
+					   &blocked);
+		if (result != UDS_SUCCESS) {
+			break;
+		}
+
+		if (blocked) {
+			// Retired searches end without a signal.
+			uds_timed_wait_cond(&volume->read_threads_read_done_cond,
+					    &volume->read_threads_mutex,
+					    ms_to_ktime(CACHE_RESIZE_WAIT_MS));
+		} else {
+			// Let readers and zone threads at the cache between
+			// steps.
+			uds_unlock_mutex(&volume->read_threads_mutex);
+			uds_yield_scheduler();
+			uds_lock_mutex(&volume->read_threads_mutex);
+		}
+	}
+	uds_unlock_mutex(&volume->read_threads_mutex);
+
+	if (result != UDS_SUCCESS) {
+		return uds_log_error_strerror(result,
+					      "failed to resize page cache to %u chapters",
+					      cache_chapters);
+	}
+
+	uds_log_info("page cache resized to %u chapters", cache_chapters);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void get_volume_reader_stats(struct volume *volume,
+			     struct uds_reader_stats *stats)
+{
+	uds_lock_mutex(&volume->read_threads_mutex);
+	*stats = (struct uds_reader_stats) {
+		.read_threads = volume->num_read_threads,
+		.min_read_threads = volume->min_read_threads,
+		.max_read_threads = volume->max_read_threads,
+		.threads_added = volume->readers_added,
+		.threads_retired = volume->readers_retired,
+		.read_batches = volume->read_batches,
+		.batched_reads = volume->batched_reads,
+		.read_wait = volume->read_wait,
+	};
+	uds_unlock_mutex(&volume->read_threads_mutex);
+}
+
+/**********************************************************************/
+size_t get_cache_size(struct volume *volume)
+{
+	size_t size = get_page_cache_size(volume->page_cache);
+	if (is_sparse(volume->geometry)) {
+		size += get_sparse_cache_memory_size(volume->sparse_cache);
+	}
+	size += get_compressed_cache_size(volume->compressed_cache);
+	return size;
+}
+
+/**********************************************************************/
+void set_volume_warm_list(struct volume *volume,
+			  unsigned int *pages,
+			  unsigned int count)
+{
+	UDS_FREE(volume->warm_pages);
+	volume->warm_pages = pages;
+	volume->warm_page_count = count;
+}
+
+/**
+ * Install the pages of a run which has been read for warming into the page
+ * cache. The caller must hold the read threads mutex.
+ *
+ * @param volume      the volume
+ * @param first_page  the physical page number of the first page of the run
+ * @param count       the number of pages in the run
+ *
+ * @return <code>true</code> if warming should continue
+ **/
+static bool install_warm_pages(struct volume *volume,
+			       unsigned int first_page,
+			       unsigned int count)
+{
+	struct page_cache *cache = volume->page_cache;
+	size_t bytes_per_page = volume->geometry->bytes_per_page;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		unsigned int physical_page = first_page + i;
+		unsigned int chapter =
+			map_to_chapter_number(volume->geometry, physical_page);
+		struct cached_page *page;
+		unsigned int evicted_page;
+		int result;
+
+		// A forgotten chapter may have been rewritten under the read.
+		if (volume->warm_forgotten[chapter] ||
+		    is_page_cached(cache, physical_page) ||
+		    is_page_queued(cache, physical_page)) {
+			continue;
+		}
+
+		result = select_victim_in_cache(cache, &page);
+		if (result != UDS_SUCCESS) {
+			return false;
+		}
+
+		evicted_page = page->cp_physical_page;
+		if ((volume->compressed_cache != NULL) &&
+		    (evicted_page != cache->num_index_entries)) {
+			store_compressed_page(volume->compressed_cache,
+					      evicted_page,
+					      get_page_data(&page->cp_page_data),
+					      get_eviction_epoch(volume));
+		}
+
+		release_volume_page(&page->cp_page_data);
+		if (volume->compress_record_pages &&
+		    is_record_page(volume->geometry, physical_page)) {
+			unpack_record_page(volume->geometry,
+					   volume->warm_buffer +
+						   (i * bytes_per_page),
+					   get_page_data(&page->cp_page_data));
+		} else {
+			memcpy(get_page_data(&page->cp_page_data),
+			       volume->warm_buffer + (i * bytes_per_page),
+			       bytes_per_page);
+		}
+		result = UDS_SUCCESS;
+		if (!is_record_page(volume->geometry, physical_page)) {
+			result = initialize_index_page(volume, physical_page,
+						       page);
+		}
+		if (result == UDS_SUCCESS) {
+			result = put_page_in_cache(cache, physical_page, page);
+		}
+		if (result != UDS_SUCCESS) {
+			cancel_page_in_cache(cache, physical_page, page);
+		} else {
+			cache->counters.warmed_pages += 1;
+		}
+
+		// The cache is full once the victim is a page in use.
+		if (evicted_page != cache->num_index_entries) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Read a run of consecutive warm list pages and put them in the page cache,
+ * once no reads for requests are waiting.
+ *
+ * @param volume      the volume
+ * @param first_page  the physical page number of the first page of the run
+ * @param count       the number of pages in the run
+ *
+ * @return <code>true</code> if warming should continue
+ **/
+static bool warm_page_run(struct volume *volume,
+			  unsigned int first_page,
+			  unsigned int count)
+{
+	struct page_cache *cache = volume->page_cache;
+	bool keep_warming;
+	int result;
+
+	uds_lock_mutex(&volume->read_threads_mutex);
+	while (!volume->stop_warming &&
+	       ((cache->read_queue_first != cache->read_queue_last) ||
+		(volume->busy_reader_threads > 0))) {
+		uds_timed_wait_cond(&volume->read_threads_read_done_cond,
+				    &volume->read_threads_mutex,
+				    ms_to_ktime(WARM_BACKOFF_MS));
+	}
+	if (volume->stop_warming) {
+		uds_unlock_mutex(&volume->read_threads_mutex);
+		return false;
+	}
+	uds_unlock_mutex(&volume->read_threads_mutex);
+
+	result = read_volume_pages(&volume->volume_store, first_page, count,
+				   volume->warm_buffer);
+	if (result != UDS_SUCCESS) {
+		return false;
+	}
+
+	uds_lock_mutex(&volume->read_threads_mutex);
+	keep_warming = (!volume->stop_warming &&
+			install_warm_pages(volume, first_page, count));
+	uds_unlock_mutex(&volume->read_threads_mutex);
+	return keep_warming;
+}
 
-		result = write_volume_page(&volume->volume_store,
-					   physical_page + record_page_number,
-					   &volume->scratch_page);
-		if (result != UDS_SUCCESS) {
-			return uds_log_warning_strerror(result,
-							"failed to write chapter record page");
+/**********************************************************************/
+static void warm_thread_function(void *arg)
+{
+	struct volume *volume = arg;
+	unsigned int start;
+	ktime_t begin = current_time_ns(CLOCK_MONOTONIC);
+	ktime_t elapsed;
+	bool keep_warming = true;
+
+	/*
+	 * Take the most recent pages first, so the hottest pages are back
+	 * soonest, but sort each batch so that its pages can be read in runs.
+	 */
+	for (start = 0;
+	     keep_warming && (start < volume->warm_page_count);
+	     start += WARM_BATCH_PAGES) {
+		unsigned int *batch = volume->warm_pages + start;
+		unsigned int count = min(volume->warm_page_count - start,
+					 (unsigned int) WARM_BATCH_PAGES);
+		unsigned int i, run;
+
+		for (i = 1; i < count; i++) {
+			unsigned int page = batch[i];
+			unsigned int j = i;
+			for (; (j > 0) && (batch[j - 1] > page); j--) {
+				batch[j] = batch[j - 1];
+			}
+			batch[j] = page;
 		}
 
-		if (pages != NULL) {
-			memcpy(pages[record_page_number],
-			       get_page_data(&volume->scratch_page),
-			       geometry->bytes_per_page);
+		for (i = 0; keep_warming && (i < count); i += run) {
+			for (run = 1; (i + run < count) &&
+				      (batch[i + run] == batch[i] + run);
+			     run++)
+				;
+			keep_warming = warm_page_run(volume, batch[i], run);
 		}
 	}
-	return UDS_SUCCESS;
+
+	elapsed = ktime_sub(current_time_ns(CLOCK_MONOTONIC), begin);
+	uds_log_debug("warmed %llu cached pages in %lld ms",
+		      (unsigned long long)
+		      READ_ONCE(volume->page_cache->counters.warmed_pages),
+		      (long long) ktime_to_ms(elapsed));
+
+	// Nothing else uses the list or the buffer once warming is done.
+	UDS_FREE(UDS_FORGET(volume->warm_pages));
+	volume->warm_page_count = 0;
+	UDS_FREE(UDS_FORGET(volume->warm_buffer));
 }
 
 /**********************************************************************/
-int write_chapter(struct volume *volume,
-		  struct open_chapter_index *chapter_index,
-		  const struct uds_chunk_record records[])
+int start_volume_warm_up(struct volume *volume)
 {
-	// Determine the position of the virtual chapter in the volume file.
-	struct geometry *geometry = volume->geometry;
-	unsigned int physical_chapter_number =
-		map_to_physical_chapter(geometry,
-					chapter_index->virtual_chapter_number);
-	int physical_page =
-		map_to_physical_page(geometry, physical_chapter_number, 0);
+	int result;
 
-	// Pack and write the delta chapter index pages to the volume.
-	int result =
-		write_index_pages(volume, physical_page, chapter_index, NULL);
+	if (volume->warm_page_count == 0) {
+		return UDS_SUCCESS;
+	}
+
+	result = UDS_ALLOCATE(volume->geometry->chapters_per_volume, bool,
+			      "warm forgotten chapters",
+			      &volume->warm_forgotten);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
-	// Sort and write the record pages to the volume.
-	result = write_record_pages(volume, physical_page, records, NULL);
+
+	result = UDS_ALLOCATE_IO_ALIGNED(WARM_BATCH_PAGES *
+						 volume->geometry->bytes_per_page,
+					 byte, "warm pages",
+					 &volume->warm_buffer);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
-	release_volume_page(&volume->scratch_page);
-	// Flush the data to permanent storage.
-	return sync_volume_store(&volume->volume_store);
+
+	return uds_create_thread(warm_thread_function, volume, "warmcache",
+				 &volume->warm_thread);
 }
 
-/**********************************************************************/
-size_t get_cache_size(struct volume *volume)
+/**
+ * Stop warming the page cache of a volume, and wait for the warm thread to
+ * exit.
+ *
+ * @param volume  the volume
+ **/
+static void stop_volume_warm_up(struct volume *volume)
 {
-	size_t size = get_page_cache_size(volume->page_cache);
-	if (is_sparse(volume->geometry)) {
-		size += get_sparse_cache_memory_size(volume->sparse_cache);
+	if (volume->warm_thread == NULL) {
+		return;
 	}
-	return size;
+
+	uds_lock_mutex(&volume->read_threads_mutex);
+	volume->stop_warming = true;
+	uds_broadcast_cond(&volume->read_threads_read_done_cond);
+	uds_unlock_mutex(&volume->read_threads_mutex);
+	uds_join_threads(volume->warm_thread);
+	volume->warm_thread = NULL;
 }
 
 /**********************************************************************/
@@ -1169,6 +2329,135 @@ static int probe_wrapper(void *aux,
 	return result;
 }
 
+/*
+ * A chapter being probed by the search for the chapter boundaries, on its
+ * own thread if one could be started.
+ */
+struct chapter_search_probe {
+	/* The volume being searched */
+	struct volume *volume;
+	/* The physical chapter to probe */
+	unsigned int chapter;
+	/* A buffer for the first index page of the chapter */
+	struct volume_page page;
+	/* The virtual chapter number found, or UINT64_MAX for a bad chapter */
+	uint64_t vcn;
+	/* The thread doing the probe, if any */
+	struct thread *thread;
+	/* The result of the probe */
+	int result;
+};
+
+/**
+ * Get the virtual chapter number of a chapter from the header of its first
+ * index page. The page is read straight from the volume store, so that
+ * several chapters can be probed at once without holding the read threads
+ * mutex across their reads.
+ *
+ * @param probe  The chapter to probe
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int probe_chapter_header(struct chapter_search_probe *probe)
+{
+	struct volume *volume = probe->volume;
+	const struct geometry *geometry = volume->geometry;
+	struct delta_index_page index_page;
+	int result = read_volume_page(&volume->volume_store,
+				      map_to_physical_page(geometry,
+							   probe->chapter,
+							   0),
+				      &probe->page);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	probe->vcn = UINT64_MAX;
+	result = initialize_chapter_index_page(&index_page,
+					       geometry,
+					       get_page_data(&probe->page),
+					       volume->nonce);
+	if (result == UDS_SUCCESS) {
+		result = validate_chapter_index_page(&index_page, geometry);
+	}
+	if ((result == UDS_CORRUPT_COMPONENT) ||
+	    (result == UDS_CORRUPT_DATA)) {
+		return UDS_SUCCESS;
+	}
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	if ((index_page.lowest_list_number == 0) &&
+	    (probe->chapter ==
+	     map_to_physical_chapter(geometry,
+				     index_page.virtual_chapter_number))) {
+		probe->vcn = index_page.virtual_chapter_number;
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+static void probe_chapter_header_thread(void *arg)
+{
+	struct chapter_search_probe *probe = arg;
+
+	probe->result = probe_chapter_header(probe);
+}
+
+/**********************************************************************/
+static int search_wrapper(void *aux,
+			  unsigned int count,
+			  const unsigned int *chapters,
+			  uint64_t *vcns)
+{
+	struct chapter_search_probe probes[MAX_CHAPTER_SEARCH_PROBES];
+	unsigned int i;
+	int result = ASSERT(count <= MAX_CHAPTER_SEARCH_PROBES,
+			    "at most %u chapters probed at once",
+			    MAX_CHAPTER_SEARCH_PROBES);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	memset(probes, 0, sizeof(probes));
+	for (i = 0; (result == UDS_SUCCESS) && (i < count); i++) {
+		probes[i].volume = aux;
+		probes[i].chapter = chapters[i];
+		result = initialize_volume_page(probes[i].volume->geometry,
+						&probes[i].page);
+	}
+
+	if (result == UDS_SUCCESS) {
+		for (i = 0; (count > 1) && (i < count); i++) {
+			if (uds_create_thread(probe_chapter_header_thread,
+					      &probes[i], "probe",
+					      &probes[i].thread) !=
+			    UDS_SUCCESS) {
+				probes[i].thread = NULL;
+			}
+		}
+
+		for (i = 0; i < count; i++) {
+			if (probes[i].thread != NULL) {
+				uds_join_threads(probes[i].thread);
+			} else {
+				probes[i].result =
+					probe_chapter_header(&probes[i]);
+			}
+			if (result == UDS_SUCCESS) {
+				result = probes[i].result;
+			}
+			vcns[i] = probes[i].vcn;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		destroy_volume_page(&probes[i].page);
+	}
+	return result;
+}
+
 /**********************************************************************/
 static int find_real_end_of_volume(struct volume *volume,
 				   unsigned int limit,
@@ -1237,10 +2526,57 @@ int find_volume_chapter_boundaries(struct volume *volume,
 						   lowest_vcn,
 						   highest_vcn,
 						   probe_wrapper,
+						   search_wrapper,
 						   volume->geometry,
 						   volume);
 }
 
+/**
+ * Choose the chapters to probe in one step of the search for the chapter
+ * boundaries, spreading them evenly over the range still to be searched and
+ * skipping over the chapter moved by conversion.
+ *
+ * @param left_chapter   The first chapter in the range
+ * @param right_chapter  The chapter after the last one in the range
+ * @param moved_chapter  The chapter moved by conversion, or UINT64_MAX
+ * @param chapters       An array to hold the chapters to probe, in order
+ *
+ * @return the number of chapters to probe
+ **/
+static unsigned int select_search_chapters(unsigned int left_chapter,
+					   unsigned int right_chapter,
+					   uint64_t moved_chapter,
+					   unsigned int *chapters)
+{
+	unsigned int span = right_chapter - left_chapter;
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (i = 0; i < MAX_CHAPTER_SEARCH_PROBES; i++) {
+		unsigned int chapter;
+		if (span <= MAX_CHAPTER_SEARCH_PROBES) {
+			if (i >= span) {
+				break;
+			}
+			chapter = left_chapter + i;
+		} else {
+			chapter = left_chapter +
+				  ((span * (i + 1)) /
+				   (MAX_CHAPTER_SEARCH_PROBES + 1));
+		}
+
+		if (chapter == moved_chapter) {
+			chapter--;
+		}
+		if ((chapter < left_chapter) ||
+		    ((count > 0) && (chapters[count - 1] == chapter))) {
+			continue;
+		}
+		chapters[count++] = chapter;
+	}
+	return count;
+}
+
 /**********************************************************************/
 int find_volume_chapter_boundaries_impl(unsigned int chapter_limit,
 					unsigned int max_bad_chapters,
@@ -1249,6 +2585,10 @@ int find_volume_chapter_boundaries_impl(unsigned int chapter_limit,
 					int (*probe_func)(void *aux,
 							  unsigned int chapter,
 							  uint64_t *vcn),
+					int (*search_func)(void *aux,
+							   unsigned int count,
+							   const unsigned int *chapters,
+							   uint64_t *vcns),
 					struct geometry *geometry,
 					void *aux)
 {
@@ -1281,9 +2621,9 @@ int find_volume_chapter_boundaries_impl(unsigned int chapter_limit,
 	}
 
 	/*
-	 * Binary search for end of the discontinuity in the monotonically
-	 * increasing virtual chapter numbers; bad spots are treated as a span
-	 * of UINT64_MAX values. In effect we're searching for the index of the
+	 * Search for end of the discontinuity in the monotonically increasing
+	 * virtual chapter numbers, probing several chapters at each step;
+	 * bad spots are treated as a span of UINT64_MAX values. In effect we're searching for the index of the
 	 * smallest value less than zero_vcn. In the case we go off the end it
 	 * means that chapter 0 has the lowest vcn.
 	 *
@@ -1309,22 +2649,36 @@ int find_volume_chapter_boundaries_impl(unsigned int chapter_limit,
 	right_chapter = chapter_limit;
 
 	while (left_chapter < right_chapter) {
-		uint64_t probe_vcn;
-		unsigned int chapter = (left_chapter + right_chapter) / 2;
-		if (chapter == moved_chapter) {
-			chapter--;
+		unsigned int chapters[MAX_CHAPTER_SEARCH_PROBES];
+		uint64_t vcns[MAX_CHAPTER_SEARCH_PROBES];
+		unsigned int count =
+			select_search_chapters(left_chapter, right_chapter,
+					       moved_chapter, chapters);
+		unsigned int i;
+
+		if (search_func != NULL) {
+			result = (*search_func)(aux, count, chapters, vcns);
+		} else {
+			for (i = 0; (result == UDS_SUCCESS) && (i < count);
+			     i++) {
+				result = (*probe_func)(aux, chapters[i],
+						       &vcns[i]);
+			}
 		}
-		result = (*probe_func)(aux, chapter, &probe_vcn);
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
-		if (zero_vcn <= probe_vcn) {
-			left_chapter = chapter + 1;
-			if (left_chapter == moved_chapter) {
-				left_chapter++;
+
+		for (i = 0; i < count; i++) {
+			if (zero_vcn <= vcns[i]) {
+				left_chapter = chapters[i] + 1;
+				if (left_chapter == moved_chapter) {
+					left_chapter++;
+				}
+			} else {
+				right_chapter = chapters[i];
+				break;
 			}
-		} else {
-			right_chapter = chapter;
 		}
 	}
 
@@ -1381,6 +2735,105 @@ int find_volume_chapter_boundaries_impl(unsigned int chapter_limit,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+static void free_record_page_encoders(struct volume *volume)
+{
+	unsigned int i;
+
+	if (volume->encoders == NULL) {
+		return;
+	}
+
+	for (i = 0; i < volume->encoder_count; i++) {
+		struct record_page_encoder *encoder = &volume->encoders[i];
+
+		unsigned int j;
+
+		free_radix_sorter(encoder->sorter);
+		UDS_FREE(encoder->record_pointers);
+		UDS_FREE(encoder->compression_buffer);
+		for (j = 0; j < ENCODER_BATCH_PAGES; j++) {
+			destroy_volume_page(&encoder->pages[j]);
+		}
+	}
+	UDS_FREE(volume->encoders);
+	volume->encoders = NULL;
+	volume->encoder_count = 0;
+}
+
+/**
+ * Create the record page encoders for a volume. Record pages are encoded
+ * by as many threads as there are zones filling chapters, up to the number
+ * of cores. With only one such thread, the chapter writer encodes the
+ * record pages itself.
+ *
+ * @param volume      the volume
+ * @param zone_count  the number of zones in the index
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int __must_check make_record_page_encoders(struct volume *volume,
+						  unsigned int zone_count)
+{
+	unsigned int count = min(zone_count, uds_get_num_cores());
+	unsigned int i, j;
+	int result;
+
+	// Chapters on a zoned device must be written in order.
+	if ((count < 2) || is_volume_store_sequential(&volume->volume_store)) {
+		return UDS_SUCCESS;
+	}
+
+	result = UDS_ALLOCATE(count,
+			      struct record_page_encoder,
+			      "record page encoders",
+			      &volume->encoders);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// Count each encoder as it is set up, so that freeing the encoders
+	// releases exactly what was allocated.
+	for (i = 0; i < count; i++) {
+		struct record_page_encoder *encoder = &volume->encoders[i];
+
+		volume->encoder_count = i + 1;
+		encoder->volume = volume;
+		result = make_radix_sorter(volume->geometry->records_per_page,
+					   &encoder->sorter);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+
+		result = UDS_ALLOCATE(volume->geometry->records_per_page,
+				      const struct uds_chunk_record *,
+				      "record pointers",
+				      &encoder->record_pointers);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+
+		for (j = 0; j < ENCODER_BATCH_PAGES; j++) {
+			result = initialize_volume_page(volume->geometry,
+							&encoder->pages[j]);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+		}
+
+		if (volume->compress_record_pages) {
+			result = UDS_ALLOCATE(volume->geometry->bytes_per_page,
+					      byte,
+					      "record page compression buffer",
+					      &encoder->compression_buffer);
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+		}
+	}
+	return UDS_SUCCESS;
+}
+
 /**
  * Allocate a volume.
  *
@@ -1394,6 +2847,7 @@ int find_volume_chapter_boundaries_impl(unsigned int chapter_limit,
  **/
 static int __must_check allocate_volume(const struct configuration *config,
 					struct index_layout *layout,
+					const struct uds_parameters *user_params,
 					unsigned int read_queue_max_size,
 					unsigned int zone_count,
 					struct volume **new_volume)
@@ -1414,8 +2868,14 @@ static int __must_check allocate_volume(const struct configuration *config,
 						"failed to allocate geometry: error");
 	}
 
+	volume->max_cache_chapters = config->cache_chapters;
+	if ((user_params != NULL) &&
+	    (user_params->max_cache_chapters > config->cache_chapters)) {
+		volume->max_cache_chapters = user_params->max_cache_chapters;
+	}
+
 	// Need a buffer for each entry in the page cache
-	reserved_buffers = config->cache_chapters *
+	reserved_buffers = volume->max_cache_chapters *
 		config->geometry->record_pages_per_chapter;
 	// And a buffer for the chapter writer
 	reserved_buffers += 1;
@@ -1425,21 +2885,42 @@ static int __must_check allocate_volume(const struct configuration *config,
 				     config->geometry->index_pages_per_chapter);
 	}
 	volume->reserved_buffers = reserved_buffers;
+	volume->direct_io = ((user_params != NULL) && user_params->direct_io);
+	volume->mmap_volume = ((user_params != NULL) &&
+			       user_params->mmap_volume);
 	result = open_volume_store(&volume->volume_store,
 				   layout,
 				   volume->reserved_buffers,
-				   config->geometry->bytes_per_page);
+				   config->geometry->bytes_per_page,
+				   volume->direct_io,
+				   volume->mmap_volume);
 	if (result != UDS_SUCCESS) {
 		free_volume(volume);
 		return result;
 	}
-	result = initialize_volume_page(config->geometry,
-					&volume->scratch_page);
-	if (result != UDS_SUCCESS) {
-		free_volume(volume);
-		return result;
+	if ((user_params != NULL) && (user_params->fast_volume_path != NULL) &&
+	    (user_params->fast_volume_chapters > 0)) {
+		result = open_volume_store_tier(&volume->volume_store,
+						user_params->fast_volume_path,
+						min(user_params->fast_volume_chapters,
+						    config->geometry->chapters_per_volume),
+						config->geometry->pages_per_chapter,
+						volume->direct_io);
+		if (result != UDS_SUCCESS) {
+			free_volume(volume);
+			return result;
+		}
+	}
+	if ((user_params != NULL) && (user_params->zoned_volume_path != NULL)) {
+		result = open_volume_store_zones(&volume->volume_store,
+						 user_params->zoned_volume_path,
+						 config->geometry->chapters_per_volume,
+						 config->geometry->pages_per_chapter);
+		if (result != UDS_SUCCESS) {
+			free_volume(volume);
+			return result;
+		}
 	}
-
 	result = make_radix_sorter(config->geometry->records_per_page,
 				   &volume->radix_sorter);
 	if (result != UDS_SUCCESS) {
@@ -1456,10 +2937,36 @@ static int __must_check allocate_volume(const struct configuration *config,
 		return result;
 	}
 
+	volume->compress_record_pages = config->compress_record_pages;
+	if (volume->compress_record_pages) {
+		result = UDS_ALLOCATE(config->geometry->bytes_per_page, byte,
+				      "record page compression buffer",
+				      &volume->compression_buffer);
+		if (result != UDS_SUCCESS) {
+			free_volume(volume);
+			return result;
+		}
+		result = UDS_ALLOCATE(config->geometry->pages_per_volume + 1,
+				      byte, "record page block counts",
+				      &volume->record_page_blocks);
+		if (result != UDS_SUCCESS) {
+			free_volume(volume);
+			return result;
+		}
+	}
+
+	result = make_record_page_encoders(volume, zone_count);
+	if (result != UDS_SUCCESS) {
+		free_volume(volume);
+		return result;
+	}
+
 	if (is_sparse(volume->geometry)) {
-		result = make_sparse_cache(volume->geometry,
+		result = make_sparse_cache(volume,
 					   config->cache_chapters,
 					   zone_count,
+					   ((user_params != NULL) &&
+					    user_params->decoded_sparse_cache),
 					   &volume->sparse_cache);
 		if (result != UDS_SUCCESS) {
 			free_volume(volume);
@@ -1468,13 +2975,33 @@ static int __must_check allocate_volume(const struct configuration *config,
 	}
 	result = make_page_cache(volume->geometry,
 				 config->cache_chapters,
+				 volume->max_cache_chapters,
 				 read_queue_max_size,
 				 zone_count,
+				 ((user_params == NULL) ?
+				  UDS_CACHE_POLICY_LRU :
+				  user_params->cache_policy),
+				 config->huge_page_size,
 				 &volume->page_cache);
 	if (result != UDS_SUCCESS) {
 		free_volume(volume);
 		return result;
 	}
+	result = initialize_scratch_page(volume->page_cache,
+					 &volume->scratch_page);
+	if (result != UDS_SUCCESS) {
+		free_volume(volume);
+		return result;
+	}
+	if ((user_params != NULL) && (user_params->compressed_cache_size > 0)) {
+		result = make_compressed_cache(volume->geometry,
+					       user_params->compressed_cache_size,
+					       &volume->compressed_cache);
+		if (result != UDS_SUCCESS) {
+			free_volume(volume);
+			return result;
+		}
+	}
 	result =
 		make_index_page_map(volume->geometry, &volume->index_page_map);
 	if (result != UDS_SUCCESS) {
@@ -1493,6 +3020,7 @@ int __must_check replace_volume_storage(struct volume *volume,
 {
 	int result;
 
+	stop_volume_warm_up(volume);
 	result = replace_index_layout_storage(layout, name);
 	if (result != UDS_SUCCESS) {
 		return result;
@@ -1502,12 +3030,17 @@ int __must_check replace_volume_storage(struct volume *volume,
 	release_volume_page(&volume->scratch_page);
 	invalidate_page_cache(volume->page_cache);
 	invalidate_sparse_cache(volume->sparse_cache);
+	if (volume->compressed_cache != NULL) {
+		invalidate_compressed_cache(volume->compressed_cache);
+	}
 	close_volume_store(&volume->volume_store);
 
 	return open_volume_store(&volume->volume_store,
 				 layout,
 				 volume->reserved_buffers,
-				 volume->geometry->bytes_per_page);
+				 volume->geometry->bytes_per_page,
+				 volume->direct_io,
+				 volume->mmap_volume);
 }
 
 /**********************************************************************/
@@ -1520,6 +3053,7 @@ int make_volume(const struct configuration *config,
 {
 	unsigned int i;
 	unsigned int volume_read_threads = get_read_threads(user_params);
+	unsigned int max_read_threads = volume_read_threads;
 	struct volume *volume = NULL;
 	int result;
 
@@ -1528,8 +3062,25 @@ int make_volume(const struct configuration *config,
 		return UDS_INVALID_ARGUMENT;
 	}
 
-	result = allocate_volume(config, layout, read_queue_max_size,
-				     zone_count, &volume);
+	if ((user_params != NULL) && !user_params->shared_readers &&
+	    (user_params->max_read_threads > volume_read_threads)) {
+		// Reads block, so allow several readers for each CPU the
+		// cgroup may use.
+		unsigned int cpu_quota = uds_get_cpu_quota();
+		max_read_threads = min(user_params->max_read_threads,
+				       (unsigned int) MAX_VOLUME_READ_THREADS);
+		max_read_threads = min(max_read_threads,
+				       read_queue_max_size - 1);
+		if (cpu_quota > 0) {
+			max_read_threads = min(max_read_threads,
+					       READ_THREADS_PER_CORE *
+					       cpu_quota);
+		}
+		max_read_threads = max(max_read_threads, volume_read_threads);
+	}
+
+	result = allocate_volume(config, layout, user_params,
+				     read_queue_max_size, zone_count, &volume);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
@@ -1549,28 +3100,61 @@ int make_volume(const struct configuration *config,
 		return result;
 	}
 
-	// Start the reader threads.  If this allocation succeeds, free_volume
-	// knows that it needs to try and stop those threads.
-	result = UDS_ALLOCATE(volume_read_threads,
-			      struct thread *,
+	if ((user_params != NULL) && user_params->shared_readers) {
+		// Join the process-wide reader pool rather than starting reader
+		// threads of our own.
+		volume->pool_client.service = service_volume_reads;
+		volume->pool_client.context = volume;
+		result = join_reader_pool(volume_read_threads,
+					  &volume->pool_client,
+					  &volume->reader_pool);
+		if (result != UDS_SUCCESS) {
+			free_volume(volume);
+			return result;
+		}
+
+		*new_volume = volume;
+		return UDS_SUCCESS;
+	}
+
+	volume->min_read_threads = volume_read_threads;
+	volume->max_read_threads = max_read_threads;
+	volume->read_wait_target =
+		us_to_ktime(((user_params != NULL) &&
+			     (user_params->read_wait_target > 0)) ?
+				    user_params->read_wait_target :
+				    DEFAULT_READ_WAIT_TARGET_US);
+
+	// Start the reader threads, leaving empty slots for any which may be
+	// added later.  If this allocation succeeds, free_volume knows that
+	// it needs to try and stop those threads.
+	result = UDS_ALLOCATE(max_read_threads,
+			      struct volume_reader,
 			      "reader threads",
-			      &volume->reader_threads);
+			      &volume->readers);
 	if (result != UDS_SUCCESS) {
 		free_volume(volume);
 		return result;
 	}
+	uds_lock_mutex(&volume->read_threads_mutex);
 	for (i = 0; i < volume_read_threads; i++) {
+		volume->readers[i].volume = volume;
 		result = uds_create_thread(read_thread_function,
-					   (void *) volume,
+					   &volume->readers[i],
 					   "reader",
-					   &volume->reader_threads[i]);
+					   &volume->readers[i].thread);
 		if (result != UDS_SUCCESS) {
+			uds_unlock_mutex(&volume->read_threads_mutex);
 			free_volume(volume);
 			return result;
 		}
 		// We only stop as many threads as actually got started.
 		volume->num_read_threads = i + 1;
 	}
+	for (; i < max_read_threads; i++) {
+		volume->readers[i].volume = volume;
+	}
+	uds_unlock_mutex(&volume->read_threads_mutex);
 
 	*new_volume = volume;
 	return UDS_SUCCESS;
@@ -1583,36 +3167,58 @@ void free_volume(struct volume *volume)
 		return;
 	}
 
-	// If reader_threads is NULL, then we haven't set up the reader
-	// threads.
-	if (volume->reader_threads != NULL) {
+	stop_volume_warm_up(volume);
+
+	// If readers is NULL, then we haven't set up the reader threads.
+	if (volume->readers != NULL) {
 		unsigned int i;
 		// Stop the reader threads.  It is ok if there aren't any of
-		// them.
+		// them.  No thread is added once the readers are told to
+		// exit, so the slots can be read without the mutex.
 		uds_lock_mutex(&volume->read_threads_mutex);
 		volume->reader_state |= READER_STATE_EXIT;
 		uds_broadcast_cond(&volume->read_threads_cond);
 		uds_unlock_mutex(&volume->read_threads_mutex);
-		for (i = 0; i < volume->num_read_threads; i++) {
-			uds_join_threads(volume->reader_threads[i]);
+		for (i = 0; i < volume->max_read_threads; i++) {
+			if (volume->readers[i].thread != NULL) {
+				uds_join_threads(volume->readers[i].thread);
+			}
 		}
-		UDS_FREE(volume->reader_threads);
-		volume->reader_threads = NULL;
+		UDS_FREE(volume->readers);
+		volume->readers = NULL;
+	}
+
+	if (volume->reader_pool != NULL) {
+		// Stop new reads, then wait for the pool to finish ours.
+		uds_lock_mutex(&volume->read_threads_mutex);
+		volume->reader_state |= READER_STATE_EXIT;
+		uds_unlock_mutex(&volume->read_threads_mutex);
+		leave_reader_pool(volume->reader_pool, &volume->pool_client);
+		volume->reader_pool = NULL;
 	}
 
 	// Must close the volume store AFTER freeing the scratch page and the
 	// caches
-	destroy_volume_page(&volume->scratch_page);
+	destroy_scratch_page(volume->page_cache, &volume->scratch_page);
 	free_page_cache(volume->page_cache);
+	free_compressed_cache(volume->compressed_cache);
 	free_sparse_cache(volume->sparse_cache);
 	close_volume_store(&volume->volume_store);
+	close_volume_store_tier(&volume->volume_store);
+	close_volume_store_zones(&volume->volume_store);
 
 	uds_destroy_cond(&volume->read_threads_cond);
 	uds_destroy_cond(&volume->read_threads_read_done_cond);
 	uds_destroy_mutex(&volume->read_threads_mutex);
 	free_index_page_map(volume->index_page_map);
 	free_radix_sorter(volume->radix_sorter);
+	free_record_page_encoders(volume);
 	UDS_FREE(volume->geometry);
 	UDS_FREE(volume->record_pointers);
+	UDS_FREE(volume->compression_buffer);
+	UDS_FREE(volume->record_page_blocks);
+	UDS_FREE(volume->warm_pages);
+	UDS_FREE(volume->warm_forgotten);
+	UDS_FREE(volume->warm_buffer);
 	UDS_FREE(volume);
 }
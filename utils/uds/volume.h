@@ -25,10 +25,12 @@
 #include "cacheCounters.h"
 #include "common.h"
 #include "chapterIndex.h"
+#include "compressedCache.h"
 #include "indexConfig.h"
 #include "indexLayout.h"
 #include "indexPageMap.h"
 #include "pageCache.h"
+#include "readerPool.h"
 #include "request.h"
 #include "sparseCache.h"
 #include "uds.h"
@@ -59,6 +61,16 @@ enum index_lookup_mode {
 	LOOKUP_FOR_REBUILD
 };
 
+/* A reader thread of a volume, in one of the slots of its readers array */
+struct volume_reader {
+	/* The volume the thread reads pages for */
+	struct volume *volume;
+	/* The thread, or NULL if the slot has never had one */
+	struct thread *thread;
+	/* Whether the thread has retired and only needs to be joined */
+	bool exited;
+};
+
 struct volume {
 	/* The layout of the volume */
 	struct geometry *geometry;
@@ -74,10 +86,25 @@ struct volume {
 	const struct uds_chunk_record **record_pointers;
 	/* For sorting record pages */
 	struct radix_sorter *radix_sorter;
+	/* The number of threads encoding record pages when writing a chapter */
+	unsigned int encoder_count;
+	/* The state of each record page encoding thread */
+	struct record_page_encoder *encoders;
 	/* The sparse chapter index cache */
 	struct sparse_cache *sparse_cache;
 	/* The page cache */
 	struct page_cache *page_cache;
+	/* The compressed copies of pages evicted from the page cache */
+	struct compressed_cache *compressed_cache;
+	/* Whether record pages are compressed when they are written */
+	bool compress_record_pages;
+	/* A buffer for compressing the record pages written by the writer */
+	byte *compression_buffer;
+	/*
+	 * The number of blocks holding each compressed record page, as last
+	 * written or read, or 0 if not known
+	 */
+	byte *record_page_blocks;
 	/* The index page map maps delta list numbers to index page numbers */
 	struct index_page_map *index_page_map;
 	/* mutex to sync between read threads and index thread */
@@ -86,20 +113,83 @@ struct volume {
 	struct cond_var read_threads_cond;
 	/* cond_var to indicate when a read thread has finished a read */
 	struct cond_var read_threads_read_done_cond;
-	/* Threads to read data from disk */
-	struct thread **reader_threads;
+	/* Threads to read data from disk, max_read_threads slots of them */
+	struct volume_reader *readers;
+	/* The shared reader pool, used instead of readers if set */
+	struct reader_pool *reader_pool;
+	/* The registration of this volume with the reader pool */
+	struct reader_pool_client pool_client;
 	/* Number of threads busy with reads */
 	unsigned int busy_reader_threads;
 	/* The state of the reader threads */
 	enum reader_state reader_state;
 	/* The lookup mode for the index */
 	enum index_lookup_mode lookup_mode;
-	/* Number of read threads to use (run-time parameter) */
+	/* Number of reader threads running */
 	unsigned int num_read_threads;
+	/* The fewest reader threads to keep running */
+	unsigned int min_read_threads;
+	/* The most reader threads to run */
+	unsigned int max_read_threads;
+	/* The average read queue wait above which readers are added */
+	ktime_t read_wait_target;
+	/* The moving average of the read queue wait of recent reads */
+	ktime_t read_wait;
+	/* When a reader thread was last added */
+	ktime_t reader_added_time;
+	/* The number of reader threads added and retired */
+	uint64_t readers_added;
+	uint64_t readers_retired;
+	/* The number of batches of page reads, and the pages read in them */
+	uint64_t read_batches;
+	uint64_t batched_reads;
 	/* Number of reserved buffers for the volume store */
 	unsigned int reserved_buffers;
+	/* Whether the volume store bypasses the kernel page cache */
+	bool direct_io;
+	/* Whether the volume store reads through a memory mapping */
+	bool mmap_volume;
+	/* The largest number of chapters the page cache may be resized to */
+	unsigned int max_cache_chapters;
+	/* The saved list of cached pages, most recent first, to warm up */
+	unsigned int *warm_pages;
+	/* The number of pages in warm_pages */
+	unsigned int warm_page_count;
+	/* The thread loading the warm list into the page cache */
+	struct thread *warm_thread;
+	/* Whether the warm thread should stop */
+	bool stop_warming;
+	/* Which physical chapters have been forgotten since warming began */
+	bool *warm_forgotten;
+	/* The I/O buffer for each run of warm list pages */
+	byte *warm_buffer;
 };
 
+/**
+ * Give a volume the list of pages which were cached when the index was
+ * saved. The volume takes ownership of the list.
+ *
+ * @param volume  the volume
+ * @param pages   the physical page numbers, most recently used first
+ * @param count   the number of pages in the list
+ **/
+void set_volume_warm_list(struct volume *volume,
+			  unsigned int *pages,
+			  unsigned int count);
+
+/**
+ * Start loading the pages of a volume's warm list into its page cache in
+ * the background, if it has one. The pages are read in runs of consecutive
+ * pages, and only while no requests are waiting for reads of their own.
+ * Warming only fills pages of the cache which are empty, and stops as soon
+ * as it would need to evict a page the index brought in itself.
+ *
+ * @param volume  the volume
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check start_volume_warm_up(struct volume *volume);
+
 /**
  * Create a volume.
  *
@@ -127,6 +217,20 @@ int __must_check make_volume(const struct configuration *config,
  **/
 void free_volume(struct volume *volume);
 
+/**
+ * Change the number of chapters of record pages the page cache holds. The
+ * pages are added or dropped a few at a time, so lookups continue while the
+ * cache is resized.
+ *
+ * @param volume          The volume
+ * @param cache_chapters  The new size of the cache, which may be no larger
+ *                        than the volume's max_cache_chapters
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check resize_volume_cache(struct volume *volume,
+				     unsigned int cache_chapters);
+
 /**
  * Replace the backing storage for a volume.
  *
@@ -282,7 +386,10 @@ int __must_check write_record_pages(struct volume *volume,
 
 /**
  * Write the index and records from the most recently filled chapter to the
- * volume.
+ * volume. If the volume has record page encoders, the record pages are
+ * sorted and written by them while the index pages are written. The pages
+ * are not flushed to storage; the caller must sync the volume store before
+ * relying on the chapter being durable.
  *
  * @param volume                the volume containing the chapter
  * @param chapter_index         the populated delta chapter index
@@ -407,7 +514,39 @@ int __must_check get_volume_page(struct volume *volume,
 /**********************************************************************/
 size_t __must_check get_cache_size(struct volume *volume);
 
-/**********************************************************************/
+/**
+ * Get the counters of the reader threads of a volume.
+ *
+ * @param volume  the volume
+ * @param stats   the counters to fill in
+ **/
+void get_volume_reader_stats(struct volume *volume,
+			     struct uds_reader_stats *stats);
+
+/*
+ * The most chapters probed at once by each step of the search for the
+ * chapter boundaries.
+ */
+enum { MAX_CHAPTER_SEARCH_PROBES = 7 };
+
+/**
+ * Find the lowest and highest virtual chapter numbers in a volume, given
+ * functions to probe its chapters. A probe reports a bad chapter with a
+ * virtual chapter number of UINT64_MAX.
+ *
+ * @param chapter_limit     The number of chapters which may hold data
+ * @param max_bad_chapters  The most contiguous bad chapters allowed
+ * @param lowest_vcn        A pointer to hold the lowest virtual chapter
+ * @param highest_vcn       A pointer to hold the highest virtual chapter
+ * @param probe_func        A function to fully check one chapter
+ * @param search_func       A function to get the virtual chapter numbers of
+ *                          up to MAX_CHAPTER_SEARCH_PROBES chapters for the
+ *                          search, or NULL to use probe_func on each
+ * @param geometry          The geometry of the volume
+ * @param aux               The argument to pass to the probe functions
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
 int __must_check
 find_volume_chapter_boundaries_impl(unsigned int chapter_limit,
 				    unsigned int max_bad_chapters,
@@ -416,6 +555,10 @@ find_volume_chapter_boundaries_impl(unsigned int chapter_limit,
 				    int (*probe_func)(void *aux,
 						      unsigned int chapter,
 						      uint64_t *vcn),
+				    int (*search_func)(void *aux,
+						       unsigned int count,
+						       const unsigned int *chapters,
+						       uint64_t *vcns),
 				    struct geometry *geometry,
 				    void *aux);
 
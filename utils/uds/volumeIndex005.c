@@ -22,12 +22,15 @@
 
 #include "buffer.h"
 #include "compiler.h"
+#include "cpu.h"
 #include "errors.h"
 #include "geometry.h"
 #include "hashUtils.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "threadAffinity.h"
 #include "uds.h"
+#include "volumeIndexFilter.h"
 #include "zone.h"
 
 /*
@@ -59,6 +62,8 @@ struct volume_index_zone {
 	uint64_t virtual_chapter_low;   // The lowest virtual chapter indexed
 	uint64_t virtual_chapter_high;  // The highest virtual chapter indexed
 	long num_early_flushes;         // The number of early flushes
+	struct volume_index_filter *filter; // The negative lookup filter, or
+					    // NULL
 } __attribute__((aligned(CACHE_LINE_BYTES)));
 
 struct volume_index5 {
@@ -78,6 +83,7 @@ struct volume_index5 {
 	unsigned int num_chapters;      // Number of chapters used
 	unsigned int num_delta_lists; // The number of delta lists
 	unsigned int num_zones; // The number of zones
+	struct shared_volume_index *shared; // The published index, or NULL
 };
 
 struct chapter_range {
@@ -89,6 +95,12 @@ struct chapter_range {
 static const byte volume_index_record_magic = 0xAA;
 static const byte bad_magic = 0;
 
+enum {
+	// Searches of a shared index to try before deciding that its owner
+	// has stopped in the middle of a change
+	SHARED_SEARCH_ATTEMPTS = 100000,
+};
+
 /*
  * In production, the default value for min_volume_index_delta_lists will be
  * replaced by MAX_ZONES*MAX_ZONES.  Some unit tests will replace
@@ -343,6 +355,12 @@ static void free_volume_index_005(struct volume_index *volume_index)
 							 common);
 		UDS_FREE(vi5->flush_chapters);
 		vi5->flush_chapters = NULL;
+		if (vi5->zones != NULL) {
+			unsigned int z;
+			for (z = 0; z < vi5->num_zones; z++) {
+				free_volume_index_filter(vi5->zones[z].filter);
+			}
+		}
 		UDS_FREE(vi5->zones);
 		vi5->zones = NULL;
 		uninitialize_delta_index(&vi5->delta_index);
@@ -428,13 +446,15 @@ static int __must_check encode_volume_index_header(struct buffer *buffer,
  * @param volume_index     The volume index
  * @param zone_number      The number of the zone to save
  * @param buffered_writer  The index state component being written
+ * @param mode             The kind of save being made
  *
  * @return UDS_SUCCESS on success, or an error code on failure
  **/
 static int
 start_saving_volume_index_005(const struct volume_index *volume_index,
 			      unsigned int zone_number,
-			      struct buffered_writer *buffered_writer)
+			      struct buffered_writer *buffered_writer,
+			      enum delta_save_mode mode)
 {
 	int result;
 	const struct volume_index5 *vi5 =
@@ -501,7 +521,7 @@ start_saving_volume_index_005(const struct volume_index *volume_index,
 	}
 
 	return start_saving_delta_index(&vi5->delta_index, zone_number,
-					buffered_writer);
+					buffered_writer, mode);
 }
 
 /**********************************************************************/
@@ -605,6 +625,52 @@ static int __must_check decode_volume_index_header(struct buffer *buffer,
 	return result;
 }
 
+/**
+ * Read and check the header of a saved volume index zone.
+ *
+ * @param reader  The buffered reader to read the header from
+ * @param header  The header to fill in
+ *
+ * @return UDS_SUCCESS on success, or an error code on failure
+ **/
+static int __must_check
+read_volume_index_header(struct buffered_reader *reader,
+			 struct vi005_data *header)
+{
+	struct buffer *buffer;
+	int result = make_buffer(sizeof(struct vi005_data), &buffer);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = read_from_buffered_reader(reader,
+					   get_buffer_contents(buffer),
+					   buffer_length(buffer));
+	if (result != UDS_SUCCESS) {
+		free_buffer(UDS_FORGET(buffer));
+		return uds_log_warning_strerror(result,
+						"failed to read volume index header");
+	}
+
+	result = reset_buffer_end(buffer, buffer_length(buffer));
+	if (result != UDS_SUCCESS) {
+		free_buffer(UDS_FORGET(buffer));
+		return result;
+	}
+
+	result = decode_volume_index_header(buffer, header);
+	free_buffer(UDS_FORGET(buffer));
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	if (memcmp(header->magic, MAGIC_START, MAGIC_SIZE) != 0) {
+		return uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
+						"volume index file had bad magic number");
+	}
+	return UDS_SUCCESS;
+}
+
 /**
  * Start restoring the volume index from multiple buffered readers
  *
@@ -631,41 +697,23 @@ start_restoring_volume_index_005(struct volume_index *volume_index,
 	}
 	vi5 = container_of(volume_index, struct volume_index5, common);
 	empty_delta_index(&vi5->delta_index);
+	// The filters are rebuilt from the restored delta lists when the
+	// zones are next used.
+	for (z = 0; z < vi5->num_zones; z++) {
+		if (vi5->zones[z].filter != NULL) {
+			clear_volume_index_filter(vi5->zones[z].filter);
+		}
+	}
 
 	for (i = 0; i < num_readers; i++) {
 		struct buffer *buffer;
 		struct vi005_data header;
-		int result = make_buffer(sizeof(struct vi005_data), &buffer);
-		if (result != UDS_SUCCESS) {
-			return result;
-		}
-
-		result = read_from_buffered_reader(buffered_readers[i],
-						   get_buffer_contents(buffer),
-						   buffer_length(buffer));
-		if (result != UDS_SUCCESS) {
-			free_buffer(UDS_FORGET(buffer));
-			return uds_log_warning_strerror(result,
-							"failed to read volume index header");
-		}
-
-		result = reset_buffer_end(buffer, buffer_length(buffer));
-		if (result != UDS_SUCCESS) {
-			free_buffer(UDS_FORGET(buffer));
-			return result;
-		}
-
-		result = decode_volume_index_header(buffer, &header);
-		free_buffer(UDS_FORGET(buffer));
+		int result = read_volume_index_header(buffered_readers[i],
+						      &header);
 		if (result != UDS_SUCCESS) {
 			return result;
 		}
 
-		if (memcmp(header.magic, MAGIC_START, MAGIC_SIZE) != 0) {
-			return uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
-							"volume index file had bad magic number");
-		}
-
 		if (vi5->volume_nonce == 0) {
 			vi5->volume_nonce = header.volume_nonce;
 		} else if (header.volume_nonce != vi5->volume_nonce) {
@@ -737,6 +785,58 @@ start_restoring_volume_index_005(struct volume_index *volume_index,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+/**
+ * Start restoring the base of an incremental save of the volume index
+ *
+ * @param volume_index      The volume index to restore into
+ * @param buffered_readers  The buffered readers to read the base from
+ * @param num_readers       The number of buffered readers
+ *
+ * @return UDS_SUCCESS on success, or an error code on failure
+ **/
+static int
+start_restoring_volume_index_base_005(struct volume_index *volume_index,
+				      struct buffered_reader **buffered_readers,
+				      int num_readers)
+{
+	struct volume_index5 *vi5 =
+		container_of(volume_index, struct volume_index5, common);
+	int i, result;
+
+	for (i = 0; i < num_readers; i++) {
+		struct vi005_data header;
+		result = read_volume_index_header(buffered_readers[i], &header);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+
+		if (header.volume_nonce != vi5->volume_nonce) {
+			return uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
+							"volume index base volume nonce incorrect");
+		}
+
+		// The flush chapters of the incremental save are the current
+		// ones.
+		result = skip_buffered_data(buffered_readers[i],
+					    header.num_lists *
+						    sizeof(uint64_t));
+		if (result != UDS_SUCCESS) {
+			return uds_log_warning_strerror(result,
+							"failed to read volume index base flush ranges");
+		}
+	}
+
+	result = start_restoring_delta_index_base(&vi5->delta_index,
+						  buffered_readers,
+						  num_readers);
+	if (result != UDS_SUCCESS) {
+		return uds_log_warning_strerror(result,
+						"restoring delta index base failed");
+	}
+	return UDS_SUCCESS;
+}
+
 /**********************************************************************/
 /**
  * Have all the data been read while restoring a volume index from an
@@ -774,6 +874,27 @@ restore_delta_list_to_volume_index_005(struct volume_index *volume_index,
 	return restore_delta_list_to_delta_index(&vi5->delta_index, dlsi, data);
 }
 
+/**********************************************************************/
+/**
+ * Restore a delta list saved in the base of an incremental save
+ *
+ * @param volume_index  The volume index to restore into
+ * @param dlsi          The delta_list_save_info describing the delta list
+ * @param data          The saved delta list bit stream
+ *
+ * @return error code or UDS_SUCCESS
+ **/
+static int
+restore_base_delta_list_to_volume_index_005(struct volume_index *volume_index,
+					    const struct delta_list_save_info *dlsi,
+					    const byte data[DELTA_LIST_MAX_BYTE_COUNT])
+{
+	struct volume_index5 *vi5 =
+		container_of(volume_index, struct volume_index5, common);
+	return restore_base_delta_list_to_delta_index(&vi5->delta_index, dlsi,
+						      data);
+}
+
 /**********************************************************************/
 /**
  * Abort restoring a volume index from an input stream.
@@ -787,6 +908,45 @@ static void abort_restoring_volume_index_005(struct volume_index *volume_index)
 	abort_restoring_delta_index(&vi5->delta_index);
 }
 
+/**
+ * Ask for the memory of a volume index zone to be kept on a NUMA node.
+ *
+ * @param volume_index  The volume index
+ * @param zone_number   The number of the zone
+ * @param node          The NUMA node, or -1 to leave the memory alone
+ **/
+static void bind_volume_index_zone_memory_005(struct volume_index *volume_index,
+					      unsigned int zone_number,
+					      int node)
+{
+	struct volume_index5 *vi5 =
+		container_of(volume_index, struct volume_index5, common);
+	struct delta_memory *zone =
+		&vi5->delta_index.delta_zones[zone_number];
+	bind_memory_to_node(zone->memory, zone->size, node);
+}
+
+/**********************************************************************/
+static void compact_volume_index_zone_005(struct volume_index *volume_index,
+					  unsigned int zone_number)
+{
+	struct volume_index5 *vi5 =
+		container_of(volume_index, struct volume_index5, common);
+	// Compaction moves delta lists, which the readers of a shared index
+	// must notice.
+	unsigned int *sequence =
+		((vi5->shared != NULL) ?
+			 &vi5->shared->zones[zone_number].sequence :
+			 NULL);
+	if (unlikely(sequence != NULL)) {
+		begin_volume_index_change(sequence);
+	}
+	compact_delta_index_zone(&vi5->delta_index, zone_number);
+	if (unlikely(sequence != NULL)) {
+		end_volume_index_change(sequence);
+	}
+}
+
 /**********************************************************************/
 static void remove_newest_chapters(struct volume_index5 *vi5,
 				   unsigned int zone_number,
@@ -839,6 +999,71 @@ static void remove_newest_chapters(struct volume_index5 *vi5,
 	}
 }
 
+/**********************************************************************/
+/**
+ * Refill the negative lookup filter of a zone from the entries in its delta
+ * lists, leaving out entries of expired chapters. If the delta lists cannot
+ * be read, the filter is dropped rather than left to rule out names which
+ * are in the index.
+ *
+ * @param vi5          The volume index
+ * @param zone_number  The zone whose filter is rebuilt
+ **/
+static void rebuild_volume_index_filter(struct volume_index5 *vi5,
+					unsigned int zone_number)
+{
+	struct volume_index_zone *volume_index_zone = &vi5->zones[zone_number];
+	struct volume_index_filter *filter = volume_index_zone->filter;
+	unsigned int first_list =
+		get_delta_index_zone_first_list(&vi5->delta_index,
+						zone_number);
+	unsigned int num_lists =
+		get_delta_index_zone_num_lists(&vi5->delta_index,
+					       zone_number);
+	ktime_t start_time = current_time_ns(CLOCK_MONOTONIC);
+	unsigned int list_number;
+
+	clear_volume_index_filter(filter);
+	for (list_number = first_list;
+	     list_number < first_list + num_lists;
+	     list_number++) {
+		struct delta_index_entry entry;
+		int result = start_delta_index_search(&vi5->delta_index,
+						      list_number, 0, true,
+						      &entry);
+		while (result == UDS_SUCCESS) {
+			unsigned int rolling_chapter;
+			result = next_delta_index_entry(&entry);
+			if ((result != UDS_SUCCESS) || entry.at_end) {
+				break;
+			}
+			if (entry.is_collision) {
+				continue;
+			}
+			rolling_chapter =
+				((get_delta_entry_value(&entry) -
+				  volume_index_zone->virtual_chapter_low) &
+				 vi5->chapter_mask);
+			if (volume_index_zone->virtual_chapter_low +
+			    rolling_chapter >
+			    volume_index_zone->virtual_chapter_high) {
+				continue;
+			}
+			add_to_volume_index_filter(filter, list_number,
+						   entry.key);
+		}
+		if (result != UDS_SUCCESS) {
+			uds_log_warning_strerror(result,
+						 "zone %u: dropping volume index filter",
+						 zone_number);
+			free_volume_index_filter(filter);
+			volume_index_zone->filter = NULL;
+			return;
+		}
+	}
+	finish_rebuilding_volume_index_filter(filter, start_time);
+}
+
 /**********************************************************************/
 /**
  * Set the open chapter number on a zone.  The volume index zone will be
@@ -858,6 +1083,9 @@ set_volume_index_zone_open_chapter_005(struct volume_index *volume_index,
 		container_of(volume_index, struct volume_index5, common);
 	struct volume_index_zone *volume_index_zone =
 		&vi5->zones[zone_number];
+	struct shared_volume_index_zone *shared_zone =
+		((vi5->shared != NULL) ? &vi5->shared->zones[zone_number] :
+					 NULL);
 	// Take care here to avoid underflow of an unsigned value.  Note that
 	// this is the smallest valid virtual low.  We may or may not actually
 	// use this value.
@@ -866,6 +1094,9 @@ set_volume_index_zone_open_chapter_005(struct volume_index *volume_index,
 			 virtual_chapter - vi5->num_chapters + 1 :
 			 0);
 
+	if (shared_zone != NULL) {
+		begin_volume_index_change(&shared_zone->sequence);
+	}
 	if (virtual_chapter <= volume_index_zone->virtual_chapter_low) {
 		/*
 		 * Moving backwards and the new range is totally before the old
@@ -943,6 +1174,20 @@ set_volume_index_zone_open_chapter_005(struct volume_index *volume_index,
 			}
 		}
 	}
+
+	if (shared_zone != NULL) {
+		WRITE_ONCE(shared_zone->virtual_chapter_low,
+			   volume_index_zone->virtual_chapter_low);
+		WRITE_ONCE(shared_zone->virtual_chapter_high,
+			   volume_index_zone->virtual_chapter_high);
+		end_volume_index_change(&shared_zone->sequence);
+	}
+
+	// Expired chapters leave stale keys in the filter.
+	if ((volume_index_zone->filter != NULL) &&
+	    volume_index_filter_needs_rebuild(volume_index_zone->filter)) {
+		rebuild_volume_index_filter(vi5, zone_number);
+	}
 }
 
 /**********************************************************************/
@@ -1006,79 +1251,34 @@ get_volume_index_zone_005(const struct volume_index *volume_index,
 
 /**********************************************************************/
 /**
- * Do a quick read-only lookup of the chunk name and return information
- * needed by the index code to process the chunk name.
- *
- * @param volume_index The volume index
- * @param name         The chunk name
- * @param triage       Information about the chunk name
- *
- * @return UDS_SUCCESS or an error code
- **/
-static int
-lookup_volume_index_name_005(const struct volume_index *volume_index,
-			     const struct uds_chunk_name *name,
-			     struct volume_index_triage *triage)
-{
-	triage->is_sample = false;
-	triage->in_sampled_chapter = false;
-	triage->zone = get_volume_index_zone_005(volume_index, name);
-	return UDS_SUCCESS;
-}
-
-/**********************************************************************/
-/**
- * Do a quick read-only lookup of the sampled chunk name and return
- * information needed by the index code to process the chunk name.
+ * Prefetch the delta lists of a batch of chunk names.  All the list
+ * headers and flush chapters are requested first, then the lists they
+ * describe, so that no lookup waits on a single cache miss at a time.
  *
- * @param volume_index The volume index
- * @param name         The chunk name
- * @param triage       Information about the chunk name.  The zone and
- *                     is_sample fields are already filled in.  Set
- *                     in_sampled_chapter and virtual_chapter if the chunk
- *                     name is found in the index.
- *
- * @return UDS_SUCCESS or an error code
+ * @param volume_index  The volume index
+ * @param names         The chunk names
+ * @param count         The number of chunk names
  **/
-static int
-lookup_volume_index_sampled_name_005(const struct volume_index *volume_index,
-				     const struct uds_chunk_name *name,
-				     struct volume_index_triage *triage)
+static void
+prefetch_volume_index_names_005(const struct volume_index *volume_index,
+				const struct uds_chunk_name *const *names,
+				unsigned int count)
 {
 	const struct volume_index5 *vi5 =
 		const_container_of(volume_index, struct volume_index5, common);
-	unsigned int address = extract_address(vi5, name);
-	unsigned int delta_list_number = extract_dlist_num(vi5, name);
-	struct delta_index_entry delta_entry;
-	int result = get_delta_index_entry(&vi5->delta_index,
-					   delta_list_number,
-					   address,
-					   name->name,
-					   true,
-					   &delta_entry);
-	if (result != UDS_SUCCESS) {
-		return result;
-	}
-	triage->in_sampled_chapter =
-		!delta_entry.at_end && (delta_entry.key == address);
-	if (triage->in_sampled_chapter) {
-		const struct volume_index_zone *volume_index_zone =
-			&vi5->zones[triage->zone];
-		unsigned int index_chapter =
-			get_delta_entry_value(&delta_entry);
-		unsigned int rolling_chapter =
-			((index_chapter -
-			  volume_index_zone->virtual_chapter_low) &
-			 vi5->chapter_mask);
-		triage->virtual_chapter =
-			volume_index_zone->virtual_chapter_low +
-		  rolling_chapter;
-		if (triage->virtual_chapter >
-		    volume_index_zone->virtual_chapter_high) {
-			triage->in_sampled_chapter = false;
-		}
+	unsigned int i;
+	for (i = 0; i < count; i++) {
+		unsigned int delta_list_number =
+			extract_dlist_num(vi5, names[i]);
+		prefetch_delta_index_list_header(&vi5->delta_index,
+						 delta_list_number);
+		prefetch_address(&vi5->flush_chapters[delta_list_number],
+				 false);
+	}
+	for (i = 0; i < count; i++) {
+		prefetch_delta_index_list(&vi5->delta_index,
+					  extract_dlist_num(vi5, names[i]));
 	}
-	return UDS_SUCCESS;
 }
 
 /**********************************************************************/
@@ -1118,15 +1318,46 @@ static int get_volume_index_record_005(struct volume_index *volume_index,
 		container_of(volume_index, struct volume_index5, common);
 	unsigned int address = extract_address(vi5, name);
 	unsigned int delta_list_number = extract_dlist_num(vi5, name);
-	uint64_t flush_chapter = vi5->flush_chapters[delta_list_number];
+	uint64_t flush_chapter;
+	struct volume_index_filter *filter;
 	record->magic = volume_index_record_magic;
 	record->volume_index = volume_index;
-	record->mutex = NULL;
 	record->name = name;
 	record->zone_number =
 		get_delta_index_zone(&vi5->delta_index, delta_list_number);
+	record->sequence =
+		((vi5->shared != NULL) ?
+			 &vi5->shared->zones[record->zone_number].sequence :
+			 NULL);
+	record->is_filtered = false;
 	volume_index_zone = get_zone_for_record(record);
 
+	filter = volume_index_zone->filter;
+	if ((filter != NULL) && !filter->valid) {
+		rebuild_volume_index_filter(vi5, record->zone_number);
+		filter = volume_index_zone->filter;
+	}
+	if (filter != NULL) {
+		if (!may_be_in_volume_index_filter(filter, delta_list_number,
+						   address)) {
+			// Leave finding the place for a new entry to
+			// put_volume_index_record().
+			filter->negatives++;
+			record->is_filtered = true;
+			record->is_found = false;
+			record->is_collision = false;
+			return UDS_SUCCESS;
+		}
+		filter->passes++;
+	}
+
+	flush_chapter = vi5->flush_chapters[delta_list_number];
+
+	// Even a search moves the saved position of the delta list, which
+	// the readers of a shared index rely on.
+	if (unlikely(record->sequence != NULL)) {
+		begin_volume_index_change(record->sequence);
+	}
 	if (flush_chapter < volume_index_zone->virtual_chapter_low) {
 		struct chapter_range range;
 		uint64_t flush_count =
@@ -1152,6 +1383,9 @@ static int get_volume_index_record_005(struct volume_index *volume_index,
 					       false,
 					       &record->delta_entry);
 	}
+	if (unlikely(record->sequence != NULL)) {
+		end_volume_index_change(record->sequence);
+	}
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
@@ -1162,6 +1396,8 @@ static int get_volume_index_record_005(struct volume_index *volume_index,
 			get_delta_entry_value(&record->delta_entry);
 		record->virtual_chapter =
 			convert_index_to_virtual(record, index_chapter);
+	} else if (filter != NULL) {
+		filter->false_positives++;
 	}
 	record->is_collision = record->delta_entry.is_collision;
 	return UDS_SUCCESS;
@@ -1180,7 +1416,8 @@ int put_volume_index_record(struct volume_index_record *record,
 			    uint64_t virtual_chapter)
 {
 	int result;
-	unsigned int address;
+	unsigned int address, delta_list_number;
+	struct volume_index_filter *filter;
 	const struct volume_index5 *vi5 = container_of(record->volume_index,
 						       struct volume_index5,
 						       common);
@@ -1198,18 +1435,42 @@ int put_volume_index_record(struct volume_index_record *record,
 						(unsigned long long) volume_index_zone->virtual_chapter_high);
 	}
 	address = extract_address(vi5, record->name);
-	if (unlikely(record->mutex != NULL)) {
-		uds_lock_mutex(record->mutex);
+	delta_list_number = extract_dlist_num(vi5, record->name);
+	if (unlikely(record->sequence != NULL)) {
+		begin_volume_index_change(record->sequence);
+	}
+	if (record->is_filtered) {
+		// The filter ruled the name out, so the delta list has not
+		// been searched for the place to put it yet.
+		result = get_delta_index_entry(&vi5->delta_index,
+					       delta_list_number,
+					       address,
+					       record->name->name,
+					       false,
+					       &record->delta_entry);
+		record->is_filtered = false;
+	} else {
+		result = UDS_SUCCESS;
+	}
+	if (result == UDS_SUCCESS) {
+		result = put_delta_index_entry(&record->delta_entry,
+					       address,
+					       convert_virtual_to_index(vi5,
+									virtual_chapter),
+					       record->is_found ?
+						       record->name->name :
+						       NULL);
 	}
-	result = put_delta_index_entry(&record->delta_entry,
-				       address,
-				       convert_virtual_to_index(vi5, virtual_chapter),
-				       record->is_found ? record->name->name : NULL);
-	if (unlikely(record->mutex != NULL)) {
-		uds_unlock_mutex(record->mutex);
+	if (unlikely(record->sequence != NULL)) {
+		end_volume_index_change(record->sequence);
 	}
 	switch (result) {
 	case UDS_SUCCESS:
+		filter = get_zone_for_record(record)->filter;
+		if (filter != NULL) {
+			add_to_volume_index_filter(filter, delta_list_number,
+						   address);
+		}
 		record->virtual_chapter = virtual_chapter;
 		record->is_collision = record->delta_entry.is_collision;
 		record->is_found = true;
@@ -1226,6 +1487,227 @@ int put_volume_index_record(struct volume_index_record *record,
 	return result;
 }
 
+/*
+ * A record being added by put_volume_index_records(), with the delta list
+ * and delta index entry it will have.
+ */
+struct record_insertion {
+	unsigned int list_number;               // The delta list number
+	const struct uds_chunk_name *name;      // The block name
+	struct delta_index_insertion insertion; // The new delta index entry
+};
+
+/**
+ * Determine whether one record insertion belongs before another in a delta
+ * index.
+ *
+ * @param a  The first record insertion
+ * @param b  The second record insertion
+ *
+ * @return true if a belongs strictly before b
+ **/
+static INLINE bool precedes_record_insertion(const struct record_insertion *a,
+					     const struct record_insertion *b)
+{
+	return ((a->list_number < b->list_number) ||
+		((a->list_number == b->list_number) &&
+		 (a->insertion.key < b->insertion.key)));
+}
+
+/**
+ * Sort record insertions by delta list and address with a bottom up merge
+ * sort.  Insertions with the same address keep their order, so the first of
+ * them is the one which can become the non-collision entry.
+ *
+ * @param records  The record insertions to sort
+ * @param temp     Space for as many record insertions
+ * @param count    The number of record insertions
+ *
+ * @return the sorted record insertions, which are either in records or in
+ *         temp
+ **/
+static struct record_insertion *
+sort_record_insertions(struct record_insertion *records,
+		       struct record_insertion *temp,
+		       unsigned int count)
+{
+	unsigned int width;
+	for (width = 1; width < count; width *= 2) {
+		struct record_insertion *swap;
+		unsigned int start;
+		for (start = 0; start < count; start += 2 * width) {
+			unsigned int middle = min(start + width, count);
+			unsigned int end = min(start + 2 * width, count);
+			unsigned int left = start, right = middle, out;
+			for (out = start; out < end; out++) {
+				if ((right == end) ||
+				    ((left < middle) &&
+				     !precedes_record_insertion(&records[right],
+								&records[left]))) {
+					temp[out] = records[left++];
+				} else {
+					temp[out] = records[right++];
+				}
+			}
+		}
+		swap = records;
+		records = temp;
+		temp = swap;
+	}
+	return records;
+}
+
+/**
+ * Add the records of a batch which belong to one delta list.  If the merged
+ * list would be too large, the records are put one at a time, so that as
+ * many of them are kept as would have been without the batch.
+ *
+ * @param vi5              The volume index
+ * @param records          The record insertions for the delta list
+ * @param insertions       Space for as many delta index insertions
+ * @param count            The number of records
+ * @param virtual_chapter  The chapter number where the blocks are found
+ *
+ * @return UDS_SUCCESS, UDS_OVERFLOW if any of the records were dropped, or
+ *         an error code
+ **/
+static int put_delta_list_records(struct volume_index5 *vi5,
+				  const struct record_insertion *records,
+				  struct delta_index_insertion *insertions,
+				  unsigned int count,
+				  uint64_t virtual_chapter)
+{
+	unsigned int list_number = records[0].list_number;
+	unsigned int zone_number =
+		get_delta_index_zone(&vi5->delta_index, list_number);
+	struct volume_index_zone *volume_index_zone = &vi5->zones[zone_number];
+	unsigned int *sequence =
+		((vi5->shared != NULL) ?
+			 &vi5->shared->zones[zone_number].sequence :
+			 NULL);
+	unsigned int i;
+	int result;
+
+	if ((virtual_chapter < volume_index_zone->virtual_chapter_low) ||
+	    (virtual_chapter > volume_index_zone->virtual_chapter_high)) {
+		return uds_log_warning_strerror(UDS_INVALID_ARGUMENT,
+						"cannot put record into chapter number %llu that is out of the valid range %llu to %llu",
+						(unsigned long long) virtual_chapter,
+						(unsigned long long) volume_index_zone->virtual_chapter_low,
+						(unsigned long long) volume_index_zone->virtual_chapter_high);
+	}
+
+	for (i = 0; i < count; i++) {
+		insertions[i] = records[i].insertion;
+	}
+	if (unlikely(sequence != NULL)) {
+		begin_volume_index_change(sequence);
+	}
+	result = put_delta_index_entries(&vi5->delta_index, list_number,
+					 insertions, count);
+	if (unlikely(sequence != NULL)) {
+		end_volume_index_change(sequence);
+	}
+
+	if (result == UDS_SUCCESS) {
+		if (volume_index_zone->filter != NULL) {
+			for (i = 0; i < count; i++) {
+				add_to_volume_index_filter(volume_index_zone->filter,
+							   list_number,
+							   insertions[i].key);
+			}
+		}
+		return UDS_SUCCESS;
+	}
+	if (result != UDS_OVERFLOW) {
+		return result;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct volume_index_record record;
+		result = get_volume_index_record_005(&vi5->common,
+						     records[i].name, &record);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		result = put_volume_index_record(&record, virtual_chapter);
+		if ((result != UDS_SUCCESS) && (result != UDS_OVERFLOW) &&
+		    (result != UDS_DUPLICATE_NAME)) {
+			return result;
+		}
+	}
+	return UDS_OVERFLOW;
+}
+
+/**********************************************************************/
+static int
+put_volume_index_records_005(struct volume_index *volume_index,
+			     const struct uds_chunk_name *const *names,
+			     unsigned int count,
+			     uint64_t virtual_chapter)
+{
+	struct volume_index5 *vi5 =
+		container_of(volume_index, struct volume_index5, common);
+	struct record_insertion *records, *sorted;
+	struct delta_index_insertion *insertions;
+	unsigned int index_chapter =
+		convert_virtual_to_index(vi5, virtual_chapter);
+	unsigned int start, end, i;
+	bool overflowed = false;
+	int result;
+
+	if (count == 0) {
+		return UDS_SUCCESS;
+	}
+	result = UDS_ALLOCATE(2 * count, struct record_insertion,
+			      "volume index record insertions", &records);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	result = UDS_ALLOCATE(count, struct delta_index_insertion,
+			      "delta index insertions", &insertions);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(records);
+		return result;
+	}
+
+	for (i = 0; i < count; i++) {
+		records[i].list_number = extract_dlist_num(vi5, names[i]);
+		records[i].name = names[i];
+		records[i].insertion.key = extract_address(vi5, names[i]);
+		records[i].insertion.value = index_chapter;
+		records[i].insertion.name = names[i]->name;
+	}
+	sorted = sort_record_insertions(records, &records[count], count);
+
+	for (start = 0; start < count; start = end) {
+		for (end = start + 1; end < count; end++) {
+			if (sorted[end].list_number !=
+			    sorted[start].list_number) {
+				break;
+			}
+		}
+		result = put_delta_list_records(vi5, &sorted[start],
+						insertions, end - start,
+						virtual_chapter);
+		if (result == UDS_OVERFLOW) {
+			overflowed = true;
+		} else if (result != UDS_SUCCESS) {
+			break;
+		}
+	}
+
+	UDS_FREE(insertions);
+	UDS_FREE(records);
+	if (result == UDS_OVERFLOW) {
+		result = UDS_SUCCESS;
+	}
+	if ((result == UDS_SUCCESS) && overflowed) {
+		result = UDS_OVERFLOW;
+	}
+	return result;
+}
+
 /**********************************************************************/
 static INLINE int validate_record(struct volume_index_record *record)
 {
@@ -1256,12 +1738,12 @@ int remove_volume_index_record(struct volume_index_record *record)
 	}
 	// Mark the record so that it cannot be used again
 	record->magic = bad_magic;
-	if (unlikely(record->mutex != NULL)) {
-		uds_lock_mutex(record->mutex);
+	if (unlikely(record->sequence != NULL)) {
+		begin_volume_index_change(record->sequence);
 	}
 	result = remove_delta_index_entry(&record->delta_entry);
-	if (unlikely(record->mutex != NULL)) {
-		uds_unlock_mutex(record->mutex);
+	if (unlikely(record->sequence != NULL)) {
+		end_volume_index_change(record->sequence);
 	}
 	return result;
 }
@@ -1286,14 +1768,14 @@ int set_volume_index_record_chapter(struct volume_index_record *record,
 						(unsigned long long) volume_index_zone->virtual_chapter_low,
 						(unsigned long long) volume_index_zone->virtual_chapter_high);
 	}
-	if (unlikely(record->mutex != NULL)) {
-		uds_lock_mutex(record->mutex);
+	if (unlikely(record->sequence != NULL)) {
+		begin_volume_index_change(record->sequence);
 	}
 	result = set_delta_entry_value(&record->delta_entry,
 				       convert_virtual_to_index(vi5,
 				       				virtual_chapter));
-	if (unlikely(record->mutex != NULL)) {
-		uds_unlock_mutex(record->mutex);
+	if (unlikely(record->sequence != NULL)) {
+		end_volume_index_change(record->sequence);
 	}
 	if (result != UDS_SUCCESS) {
 		return result;
@@ -1342,17 +1824,27 @@ static void get_volume_index_stats_005(const struct volume_index *volume_index,
 		(dis.memory_allocated + sizeof(struct volume_index5) +
 		 vi5->num_delta_lists * sizeof(uint64_t) +
 		 vi5->num_zones * sizeof(struct volume_index_zone));
+	dense->huge_page_memory = dis.huge_page_memory;
 	dense->rebalance_time = dis.rebalance_time;
 	dense->rebalance_count = dis.rebalance_count;
+	dense->local_rebalance_time = dis.local_rebalance_time;
+	dense->local_rebalance_count = dis.local_rebalance_count;
+	dense->compaction_time = dis.compaction_time;
+	dense->compaction_count = dis.compaction_count;
 	dense->record_count = dis.record_count;
 	dense->collision_count = dis.collision_count;
 	dense->discard_count = dis.discard_count;
 	dense->overflow_count = dis.overflow_count;
 	dense->num_lists = dis.num_lists;
+	memcpy(dense->list_sizes, dis.list_sizes, sizeof(dis.list_sizes));
 	dense->early_flushes = 0;
+	memset(&dense->filter, 0, sizeof(dense->filter));
 	for (z = 0; z < vi5->num_zones; z++) {
 		dense->early_flushes += vi5->zones[z].num_early_flushes;
+		add_volume_index_filter_stats(vi5->zones[z].filter,
+					      &dense->filter);
 	}
+	dense->memory_allocated += dense->filter.memory_allocated;
 	memset(sparse, 0, sizeof(struct volume_index_stats));
 }
 
@@ -1547,6 +2039,10 @@ int make_volume_index005(const struct configuration *config,
 	vi5->common.abort_saving_volume_index = abort_saving_volume_index_005;
 	vi5->common.finish_saving_volume_index =
 		finish_saving_volume_index_005;
+	vi5->common.bind_volume_index_zone_memory =
+		bind_volume_index_zone_memory_005;
+	vi5->common.compact_volume_index_zone =
+		compact_volume_index_zone_005;
 	vi5->common.free_volume_index = free_volume_index_005;
 	vi5->common.get_volume_index_memory_used =
 		get_volume_index_memory_used_005;
@@ -1558,9 +2054,11 @@ int make_volume_index005(const struct configuration *config,
 		is_restoring_volume_index_done_005;
 	vi5->common.is_saving_volume_index_done =
 		is_saving_volume_index_done_005;
-	vi5->common.lookup_volume_index_name = lookup_volume_index_name_005;
-	vi5->common.lookup_volume_index_sampled_name =
-		lookup_volume_index_sampled_name_005;
+	vi5->common.prefetch_volume_index_names =
+		prefetch_volume_index_names_005;
+	vi5->common.put_volume_index_records = put_volume_index_records_005;
+	vi5->common.restore_base_delta_list_to_volume_index =
+		restore_base_delta_list_to_volume_index_005;
 	vi5->common.restore_delta_list_to_volume_index =
 		restore_delta_list_to_volume_index_005;
 	vi5->common.set_volume_index_open_chapter =
@@ -1570,6 +2068,8 @@ int make_volume_index005(const struct configuration *config,
 		set_volume_index_zone_open_chapter_005;
 	vi5->common.start_restoring_volume_index =
 		start_restoring_volume_index_005;
+	vi5->common.start_restoring_volume_index_base =
+		start_restoring_volume_index_base_005;
 	vi5->common.start_saving_volume_index = start_saving_volume_index_005;
 
 	vi5->address_bits = params.address_bits;
@@ -1587,7 +2087,8 @@ int make_volume_index005(const struct configuration *config,
 					params.num_delta_lists,
 					params.mean_delta,
 					params.chapter_bits,
-					params.memory_size);
+					params.memory_size,
+					config->huge_page_size);
 	if (result == UDS_SUCCESS) {
 		vi5->max_zone_bits =
 			((get_delta_index_dlist_bits_allocated(&vi5->delta_index) -
@@ -1612,6 +2113,19 @@ int make_volume_index005(const struct configuration *config,
 				      &vi5->zones);
 	}
 
+	if ((result == UDS_SUCCESS) && (config->volume_index_filter_size > 0)) {
+		size_t filter_size =
+			config->volume_index_filter_size / num_zones;
+		unsigned int z;
+		for (z = 0; z < num_zones; z++) {
+			result = make_volume_index_filter(filter_size,
+							  &vi5->zones[z].filter);
+			if (result != UDS_SUCCESS) {
+				break;
+			}
+		}
+	}
+
 	if (result == UDS_SUCCESS) {
 		*volume_index = &vi5->common;
 	} else {
@@ -1620,3 +2134,224 @@ int make_volume_index005(const struct configuration *config,
 	}
 	return result;
 }
+
+/**
+ * Round a size up to a whole number of cache lines, so that each part of a
+ * shared volume index starts on its own cache line.
+ *
+ * @param size  The size to round
+ *
+ * @return the rounded size
+ **/
+static INLINE size_t round_to_cache_lines(size_t size)
+{
+	return (((size + CACHE_LINE_BYTES - 1) / CACHE_LINE_BYTES) *
+		CACHE_LINE_BYTES);
+}
+
+/**
+ * Get the number of bytes in the list headers of a shared volume index zone.
+ *
+ * @param num_lists  The number of delta lists in the zone
+ *
+ * @return the number of bytes in the list headers, including the guards
+ **/
+static INLINE size_t get_shared_lists_size(unsigned int num_lists)
+{
+	return (num_lists + 2) * sizeof(struct delta_list);
+}
+
+/**********************************************************************/
+size_t get_volume_index005_shared_size(const struct volume_index *volume_index)
+{
+	const struct volume_index5 *vi5 =
+		const_container_of(volume_index, struct volume_index5, common);
+	size_t size = 0;
+	unsigned int z;
+	for (z = 0; z < vi5->num_zones; z++) {
+		const struct delta_memory *delta_zone =
+			&vi5->delta_index.delta_zones[z];
+		size += round_to_cache_lines(delta_zone->size);
+		size += round_to_cache_lines(get_shared_lists_size(delta_zone->num_lists));
+	}
+	return size;
+}
+
+/**********************************************************************/
+int share_volume_index005(struct volume_index *volume_index,
+			  struct shared_volume_index *shared,
+			  byte *base,
+			  size_t offset)
+{
+	struct volume_index5 *vi5 =
+		container_of(volume_index, struct volume_index5, common);
+	const struct delta_memory *first_zone =
+		&vi5->delta_index.delta_zones[0];
+	unsigned int z;
+	if (vi5->num_zones > MAX_ZONES) {
+		return uds_log_error_strerror(UDS_INVALID_ARGUMENT,
+					      "cannot share a volume index with %u zones",
+					      vi5->num_zones);
+	}
+
+	shared->num_zones = vi5->num_zones;
+	shared->num_delta_lists = vi5->num_delta_lists;
+	shared->lists_per_zone = vi5->delta_index.lists_per_zone;
+	shared->address_bits = vi5->address_bits;
+	shared->address_mask = vi5->address_mask;
+	shared->chapter_mask = vi5->chapter_mask;
+	shared->value_bits = first_zone->value_bits;
+	shared->min_bits = first_zone->min_bits;
+	shared->min_keys = first_zone->min_keys;
+	shared->incr_keys = first_zone->incr_keys;
+	for (z = 0; z < vi5->num_zones; z++) {
+		struct delta_memory *delta_zone =
+			&vi5->delta_index.delta_zones[z];
+		struct shared_volume_index_zone *shared_zone =
+			&shared->zones[z];
+		shared_zone->sequence = 0;
+		shared_zone->virtual_chapter_low =
+			vi5->zones[z].virtual_chapter_low;
+		shared_zone->virtual_chapter_high =
+			vi5->zones[z].virtual_chapter_high;
+		shared_zone->memory_offset = offset;
+		shared_zone->memory_size = delta_zone->size;
+		offset += round_to_cache_lines(delta_zone->size);
+		shared_zone->lists_offset = offset;
+		offset += round_to_cache_lines(get_shared_lists_size(delta_zone->num_lists));
+		shared_zone->first_list = delta_zone->first_list;
+		shared_zone->num_lists = delta_zone->num_lists;
+		move_delta_memory(delta_zone,
+				  base + shared_zone->memory_offset,
+				  (struct delta_list *) (base +
+							 shared_zone->lists_offset));
+	}
+	vi5->shared = shared;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int attach_shared_volume_index005(const struct shared_volume_index *shared,
+				  byte *base,
+				  size_t size,
+				  struct delta_index *delta_index)
+{
+	unsigned int z;
+	int result;
+	if ((shared->num_zones == 0) || (shared->num_zones > MAX_ZONES) ||
+	    (shared->lists_per_zone == 0)) {
+		return uds_log_error_strerror(UDS_CORRUPT_DATA,
+					      "shared volume index has %u zones",
+					      shared->num_zones);
+	}
+
+	result = UDS_ALLOCATE(shared->num_zones, struct delta_memory,
+			      "shared delta index zones",
+			      &delta_index->delta_zones);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	delta_index->num_zones = shared->num_zones;
+	delta_index->num_lists = shared->num_delta_lists;
+	delta_index->lists_per_zone = shared->lists_per_zone;
+	delta_index->is_mutable = true;
+	delta_index->tag = 'm';
+
+	for (z = 0; z < shared->num_zones; z++) {
+		const struct shared_volume_index_zone *shared_zone =
+			&shared->zones[z];
+		struct delta_memory *delta_zone = &delta_index->delta_zones[z];
+		size_t lists_size = get_shared_lists_size(shared_zone->num_lists);
+		if ((shared_zone->memory_offset > size) ||
+		    (shared_zone->memory_size >
+		     size - shared_zone->memory_offset) ||
+		    (shared_zone->lists_offset > size) ||
+		    (lists_size > size - shared_zone->lists_offset)) {
+			detach_shared_volume_index005(delta_index);
+			return uds_log_error_strerror(UDS_CORRUPT_DATA,
+						      "shared volume index zone %u lies outside the shared memory",
+						      z);
+		}
+		delta_zone->memory = base + shared_zone->memory_offset;
+		delta_zone->delta_lists =
+			(struct delta_list *) (base + shared_zone->lists_offset);
+		delta_zone->size = shared_zone->memory_size;
+		delta_zone->borrowed = true;
+		delta_zone->value_bits = shared->value_bits;
+		delta_zone->min_bits = shared->min_bits;
+		delta_zone->min_keys = shared->min_keys;
+		delta_zone->incr_keys = shared->incr_keys;
+		delta_zone->first_list = shared_zone->first_list;
+		delta_zone->num_lists = shared_zone->num_lists;
+		delta_zone->tag = 'm';
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void detach_shared_volume_index005(struct delta_index *delta_index)
+{
+	UDS_FREE(delta_index->delta_zones);
+	delta_index->delta_zones = NULL;
+}
+
+/**********************************************************************/
+int lookup_shared_volume_index005(const struct shared_volume_index *shared,
+				  const struct delta_index *delta_index,
+				  const struct uds_chunk_name *name,
+				  bool *found,
+				  unsigned int *zone_ptr,
+				  uint64_t *virtual_chapter)
+{
+	uint64_t bits = extract_volume_index_bytes(name);
+	unsigned int address = bits & shared->address_mask;
+	unsigned int list_number =
+		(bits >> shared->address_bits) % shared->num_delta_lists;
+	unsigned int zone_number =
+		get_delta_index_zone(delta_index, list_number);
+	const struct shared_volume_index_zone *zone;
+	unsigned int attempt;
+	if (zone_number >= delta_index->num_zones) {
+		return UDS_CORRUPT_DATA;
+	}
+
+	zone = &shared->zones[zone_number];
+	*zone_ptr = zone_number;
+	for (attempt = 0; attempt < SHARED_SEARCH_ATTEMPTS; attempt++) {
+		struct delta_index_entry entry;
+		uint64_t low, high;
+		bool is_found;
+		int result;
+		unsigned int sequence = READ_ONCE(zone->sequence);
+		if ((sequence & 1) != 0) {
+			uds_yield_scheduler();
+			continue;
+		}
+		smp_rmb();
+
+		low = READ_ONCE(zone->virtual_chapter_low);
+		high = READ_ONCE(zone->virtual_chapter_high);
+		result = peek_delta_index_entry(delta_index, list_number,
+						address, name->name, &entry);
+		is_found = ((result == UDS_SUCCESS) && !entry.at_end &&
+			    (entry.key == address));
+		if (is_found) {
+			unsigned int index_chapter =
+				get_delta_entry_value(&entry);
+			*virtual_chapter =
+				low + ((index_chapter - low) &
+				       shared->chapter_mask);
+			is_found = (*virtual_chapter <= high);
+		}
+
+		smp_rmb();
+		if (READ_ONCE(zone->sequence) == sequence) {
+			if (result != UDS_SUCCESS) {
+				return result;
+			}
+			*found = is_found;
+			return UDS_SUCCESS;
+		}
+	}
+	return -EBUSY;
+}
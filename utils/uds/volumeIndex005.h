@@ -22,7 +22,43 @@
 #ifndef VOLUMEINDEX005_H
 #define VOLUMEINDEX005_H 1
 
+#include "deltaIndex.h"
 #include "volumeIndexOps.h"
+#include "zone.h"
+
+/*
+ * A volume index published in memory shared with other processes, which
+ * search it without taking part in the index. The delta list memory and
+ * list headers of each zone live at the given offsets from the start of the
+ * shared memory. The zone thread makes odd the sequence count of its zone
+ * while it changes the zone, and readers retry searches which saw the count
+ * odd or changed.
+ */
+struct shared_volume_index_zone {
+	unsigned int sequence;          // Odd while the zone is changing
+	uint64_t virtual_chapter_low;   // The lowest virtual chapter indexed
+	uint64_t virtual_chapter_high;  // The highest virtual chapter indexed
+	uint64_t memory_offset;         // Where the delta list memory is
+	uint64_t memory_size;           // The size of the delta list memory
+	uint64_t lists_offset;          // Where the delta list headers are
+	unsigned int first_list;        // The first delta list of the zone
+	unsigned int num_lists;         // The number of delta lists
+} __attribute__((aligned(CACHE_LINE_BYTES)));
+
+struct shared_volume_index {
+	unsigned int num_zones;         // The number of zones
+	unsigned int num_delta_lists;   // The number of delta lists
+	unsigned int lists_per_zone;    // Delta lists per zone
+	unsigned int address_bits;      // Number of bits in address mask
+	unsigned int address_mask;      // Mask to get address within delta
+					// list
+	unsigned int chapter_mask;      // Largest storable chapter number
+	unsigned short value_bits;      // The delta list coding parameters
+	unsigned short min_bits;
+	unsigned int min_keys;
+	unsigned int incr_keys;
+	struct shared_volume_index_zone zones[MAX_ZONES];
+};
 
 /**
  * Make a new volume index.
@@ -52,4 +88,81 @@ int __must_check
 compute_volume_index_save_bytes005(const struct configuration *config,
 				   size_t *num_bytes);
 
+/**
+ * Compute the number of bytes of shared memory needed to publish the delta
+ * lists of a volume index with share_volume_index005().
+ *
+ * @param volume_index  The volume index
+ *
+ * @return the number of bytes needed
+ **/
+size_t __must_check
+get_volume_index005_shared_size(const struct volume_index *volume_index);
+
+/**
+ * Publish a volume index in shared memory. The delta lists of every zone
+ * are moved into the memory, and from then on each change to a zone is
+ * bracketed by its sequence count. This must be called before the zone
+ * threads start changing the index, and the shared memory must outlive
+ * the volume index.
+ *
+ * @param volume_index  The volume index
+ * @param shared        The shared description of the index to fill in
+ * @param base          The start of the shared memory
+ * @param offset        The offset from base at which to put the delta
+ *                      lists, leaving get_volume_index005_shared_size()
+ *                      bytes for them
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check share_volume_index005(struct volume_index *volume_index,
+				       struct shared_volume_index *shared,
+				       byte *base,
+				       size_t offset);
+
+/**
+ * Make a read-only view of a volume index published by another process.
+ *
+ * @param shared       The shared description of the index
+ * @param base         The start of the shared memory
+ * @param size         The size of the shared memory
+ * @param delta_index  The delta index to initialize
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check
+attach_shared_volume_index005(const struct shared_volume_index *shared,
+			      byte *base,
+			      size_t size,
+			      struct delta_index *delta_index);
+
+/**
+ * Free a view made by attach_shared_volume_index005().
+ *
+ * @param delta_index  The delta index to free
+ **/
+void detach_shared_volume_index005(struct delta_index *delta_index);
+
+/**
+ * Look up a chunk name in a volume index published by another process.
+ * Searches which the owner's changes disturb are retried, but since the
+ * owner may have died in the middle of a change, not forever.
+ *
+ * @param shared           The shared description of the index
+ * @param delta_index      The view made by attach_shared_volume_index005()
+ * @param name             The chunk name
+ * @param found            Set to whether the chunk name is indexed
+ * @param zone_ptr         Set to the zone of the chunk name
+ * @param virtual_chapter  Set to the chapter of the chunk name, if found
+ *
+ * @return UDS_SUCCESS, or -EBUSY if the index never held still for a search
+ **/
+int __must_check
+lookup_shared_volume_index005(const struct shared_volume_index *shared,
+			      const struct delta_index *delta_index,
+			      const struct uds_chunk_name *name,
+			      bool *found,
+			      unsigned int *zone_ptr,
+			      uint64_t *virtual_chapter);
+
 #endif /* VOLUMEINDEX005_H */
@@ -27,6 +27,7 @@
 #include "logger.h"
 #include "volumeIndex005.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
 #include "permassert.h"
 #include "uds-threads.h"
 #include "uds.h"
@@ -41,17 +42,13 @@
  * one thread operating on each zone.  Any operation that operates on all
  * the zones needs to do its operation at a safe point that ensures that
  * only one thread is operating on the volume index.
- *
- * The only multithreaded operation supported by the sparse volume index is
- * the lookup_volume_index_name() method.  It is called by the thread that
- * assigns an index request to the proper zone, and needs to do a volume
- * index query for sampled chunk names.  The zone mutexes are used to make
- * this lookup operation safe.
  */
 
-struct volume_index_zone {
-	struct mutex hook_mutex; // Protects the sampled index in this zone
-} __attribute__((aligned(CACHE_LINE_BYTES)));
+/*
+ * The number of chunk names a batched prefetch sorts between the sub-indexes
+ * at a time.
+ */
+enum { NAME_BATCH_SIZE = 16 };
 
 struct volume_index6 {
 	struct volume_index common;	  // Common volume index methods
@@ -59,7 +56,6 @@ struct volume_index6 {
 	unsigned int num_zones;           // The number of zones
 	struct volume_index *vi_non_hook; // The non-hook index
 	struct volume_index *vi_hook;     // Hook index == sample index
-	struct volume_index_zone *zones;  // The zones
 };
 
 /**
@@ -111,14 +107,6 @@ static void free_volume_index_006(struct volume_index *volume_index)
 		struct volume_index6 *vi6 = container_of(volume_index,
 							 struct volume_index6,
 							 common);
-		if (vi6->zones != NULL) {
-			unsigned int zone;
-			for (zone = 0; zone < vi6->num_zones; zone++) {
-				uds_destroy_mutex(&vi6->zones[zone].hook_mutex);
-			}
-			UDS_FREE(vi6->zones);
-			vi6->zones = NULL;
-		}
 		if (vi6->vi_non_hook != NULL) {
 			free_volume_index(vi6->vi_non_hook);
 			vi6->vi_non_hook = NULL;
@@ -186,13 +174,15 @@ static int __must_check encode_volume_index_header(struct buffer *buffer,
  * @param volume_index     The volume index
  * @param zone_number      The number of the zone to save
  * @param buffered_writer  The index state component being written
+ * @param mode             The kind of save being made
  *
  * @return UDS_SUCCESS on success, or an error code on failure
  **/
 static int
 start_saving_volume_index_006(const struct volume_index *volume_index,
 			      unsigned int zone_number,
-			      struct buffered_writer *buffered_writer)
+			      struct buffered_writer *buffered_writer,
+			      enum delta_save_mode mode)
 {
 	struct vi006_data header;
 	const struct volume_index6 *vi6 =
@@ -222,13 +212,13 @@ start_saving_volume_index_006(const struct volume_index *volume_index,
 	}
 
 	result = start_saving_volume_index(vi6->vi_non_hook, zone_number,
-					   buffered_writer);
+					   buffered_writer, mode);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
 
 	result = start_saving_volume_index(vi6->vi_hook, zone_number,
-					   buffered_writer);
+					   buffered_writer, mode);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
@@ -329,6 +319,52 @@ static int __must_check decode_volume_index_header(struct buffer *buffer,
 	return result;
 }
 
+/**
+ * Read and check the header of a saved volume index zone.
+ *
+ * @param reader  The buffered reader to read the header from
+ * @param header  The header to fill in
+ *
+ * @return UDS_SUCCESS on success, or an error code on failure
+ **/
+static int __must_check
+read_volume_index_header(struct buffered_reader *reader,
+			 struct vi006_data *header)
+{
+	struct buffer *buffer;
+	int result = make_buffer(sizeof(struct vi006_data), &buffer);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = read_from_buffered_reader(reader,
+					   get_buffer_contents(buffer),
+					   buffer_length(buffer));
+	if (result != UDS_SUCCESS) {
+		free_buffer(UDS_FORGET(buffer));
+		return uds_log_warning_strerror(result,
+						"failed to read volume index header");
+	}
+
+	result = reset_buffer_end(buffer, buffer_length(buffer));
+	if (result != UDS_SUCCESS) {
+		free_buffer(UDS_FORGET(buffer));
+		return result;
+	}
+
+	result = decode_volume_index_header(buffer, header);
+	free_buffer(UDS_FORGET(buffer));
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	if (memcmp(header->magic, MAGIC_START, MAGIC_SIZE) != 0) {
+		return uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
+						"volume index file had bad magic number");
+	}
+	return UDS_SUCCESS;
+}
+
 /**
  * Start restoring the volume index from multiple buffered readers
  *
@@ -356,38 +392,11 @@ start_restoring_volume_index_006(struct volume_index *volume_index,
 
 	for (i = 0; i < num_readers; i++) {
 		struct vi006_data header;
-		struct buffer *buffer;
-		result = make_buffer(sizeof(struct vi006_data), &buffer);
-		if (result != UDS_SUCCESS) {
-			return result;
-		}
-
-		result = read_from_buffered_reader(buffered_readers[i],
-						   get_buffer_contents(buffer),
-						   buffer_length(buffer));
-		if (result != UDS_SUCCESS) {
-			free_buffer(UDS_FORGET(buffer));
-			return uds_log_warning_strerror(result,
-							"failed to read volume index header");
-		}
-
-		result = reset_buffer_end(buffer, buffer_length(buffer));
+		result = read_volume_index_header(buffered_readers[i], &header);
 		if (result != UDS_SUCCESS) {
-			free_buffer(UDS_FORGET(buffer));
 			return result;
 		}
 
-		result = decode_volume_index_header(buffer, &header);
-		free_buffer(UDS_FORGET(buffer));
-		if (result != UDS_SUCCESS) {
-			return result;
-		}
-
-		if (memcmp(header.magic, MAGIC_START, MAGIC_SIZE) != 0) {
-			return uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
-							"volume index file had bad magic number");
-		}
-
 		if (i == 0) {
 			vi6->sparse_sample_rate = header.sparse_sample_rate;
 		} else if (vi6->sparse_sample_rate !=
@@ -410,6 +419,52 @@ start_restoring_volume_index_006(struct volume_index *volume_index,
 					    num_readers);
 }
 
+/**********************************************************************/
+/**
+ * Start restoring the base of an incremental save of the volume index
+ *
+ * @param volume_index      The volume index to restore into
+ * @param buffered_readers  The buffered readers to read the base from
+ * @param num_readers       The number of buffered readers
+ *
+ * @return UDS_SUCCESS on success, or an error code on failure
+ **/
+static int
+start_restoring_volume_index_base_006(struct volume_index *volume_index,
+				      struct buffered_reader **buffered_readers,
+				      int num_readers)
+{
+	struct volume_index6 *vi6 =
+		container_of(volume_index, struct volume_index6, common);
+	int i, result;
+
+	for (i = 0; i < num_readers; i++) {
+		struct vi006_data header;
+		result = read_volume_index_header(buffered_readers[i], &header);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+
+		if (vi6->sparse_sample_rate != header.sparse_sample_rate) {
+			uds_log_warning_strerror(UDS_CORRUPT_COMPONENT,
+						 "Inconsistent sparse sample rate in delta index base files: %u vs. %u",
+						 vi6->sparse_sample_rate,
+						 header.sparse_sample_rate);
+			return UDS_CORRUPT_COMPONENT;
+		}
+	}
+
+	result = start_restoring_volume_index_base(vi6->vi_non_hook,
+						   buffered_readers,
+						   num_readers);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	return start_restoring_volume_index_base(vi6->vi_hook,
+						 buffered_readers,
+						 num_readers);
+}
+
 /**********************************************************************/
 /**
  * Have all the data been read while restoring a volume index from an
@@ -456,6 +511,34 @@ restore_delta_list_to_volume_index_006(struct volume_index *volume_index,
 	return result;
 }
 
+/**********************************************************************/
+/**
+ * Restore a delta list saved in the base of an incremental save
+ *
+ * @param volume_index  The volume index to restore into
+ * @param dlsi          The delta_list_save_info describing the delta list
+ * @param data          The saved delta list bit stream
+ *
+ * @return error code or UDS_SUCCESS
+ **/
+static int
+restore_base_delta_list_to_volume_index_006(struct volume_index *volume_index,
+					    const struct delta_list_save_info *dlsi,
+					    const byte data[DELTA_LIST_MAX_BYTE_COUNT])
+{
+	struct volume_index6 *vi6 =
+		container_of(volume_index, struct volume_index6, common);
+	int result = restore_base_delta_list_to_volume_index(vi6->vi_non_hook,
+							     dlsi,
+							     data);
+	if (result != UDS_SUCCESS) {
+		result = restore_base_delta_list_to_volume_index(vi6->vi_hook,
+								 dlsi,
+								 data);
+	}
+	return result;
+}
+
 /**********************************************************************/
 /**
  * Abort restoring a volume index from an input stream.
@@ -470,6 +553,33 @@ static void abort_restoring_volume_index_006(struct volume_index *volume_index)
 	abort_restoring_volume_index(vi6->vi_hook);
 }
 
+/**
+ * Ask for the memory of a volume index zone to be kept on a NUMA node.
+ *
+ * @param volume_index  The volume index
+ * @param zone_number   The number of the zone
+ * @param node          The NUMA node, or -1 to leave the memory alone
+ **/
+static void bind_volume_index_zone_memory_006(struct volume_index *volume_index,
+					      unsigned int zone_number,
+					      int node)
+{
+	struct volume_index6 *vi6 =
+		container_of(volume_index, struct volume_index6, common);
+	bind_volume_index_zone_memory(vi6->vi_non_hook, zone_number, node);
+	bind_volume_index_zone_memory(vi6->vi_hook, zone_number, node);
+}
+
+/**********************************************************************/
+static void compact_volume_index_zone_006(struct volume_index *volume_index,
+					  unsigned int zone_number)
+{
+	struct volume_index6 *vi6 =
+		container_of(volume_index, struct volume_index6, common);
+	compact_volume_index_zone(vi6->vi_non_hook, zone_number);
+	compact_volume_index_zone(vi6->vi_hook, zone_number);
+}
+
 /**********************************************************************/
 /**
  * Set the open chapter number on a zone.  The volume index zone will be
@@ -487,16 +597,10 @@ set_volume_index_zone_open_chapter_006(struct volume_index *volume_index,
 {
 	struct volume_index6 *vi6 =
 		container_of(volume_index, struct volume_index6, common);
-	struct mutex *mutex = &vi6->zones[zone_number].hook_mutex;
 	set_volume_index_zone_open_chapter(vi6->vi_non_hook, zone_number,
 					   virtual_chapter);
-
-	// We need to prevent a lookup_volume_index_name() happening while we
-	// are changing the open chapter number
-	uds_lock_mutex(mutex);
 	set_volume_index_zone_open_chapter(vi6->vi_hook, zone_number,
 					   virtual_chapter);
-	uds_unlock_mutex(mutex);
 }
 
 /**********************************************************************/
@@ -538,61 +642,40 @@ get_volume_index_zone_006(const struct volume_index *volume_index,
 
 /**********************************************************************/
 /**
- * Do a quick read-only lookup of the chunk name and return information
- * needed by the index code to process the chunk name.
+ * Prefetch the volume index memory for a batch of chunk names, splitting
+ * them between the hook and non-hook sub-indexes.
  *
  * @param volume_index  The volume index
- * @param name          The chunk name
- * @param triage        Information about the chunk name
- *
- * @return UDS_SUCCESS or an error code
+ * @param names         The chunk names
+ * @param count         The number of chunk names
  **/
-static int
-lookup_volume_index_name_006(const struct volume_index *volume_index,
-			     const struct uds_chunk_name *name,
-			     struct volume_index_triage *triage)
+static void
+prefetch_volume_index_names_006(const struct volume_index *volume_index,
+				const struct uds_chunk_name *const *names,
+				unsigned int count)
 {
-	int result = UDS_SUCCESS;
 	const struct volume_index6 *vi6 =
 		const_container_of(volume_index, struct volume_index6, common);
-	triage->is_sample = is_volume_index_sample_006(volume_index, name);
-	triage->in_sampled_chapter = false;
-	triage->zone = get_volume_index_zone_006(volume_index, name);
-	if (triage->is_sample) {
-		struct mutex *mutex =
-			&vi6->zones[triage->zone].hook_mutex;
-		uds_lock_mutex(mutex);
-		result = lookup_volume_index_sampled_name(vi6->vi_hook, name,
-							  triage);
-		uds_unlock_mutex(mutex);
+	const struct uds_chunk_name *hooks[NAME_BATCH_SIZE];
+	const struct uds_chunk_name *non_hooks[NAME_BATCH_SIZE];
+	unsigned int start;
+	for (start = 0; start < count; start += NAME_BATCH_SIZE) {
+		unsigned int size = min(count - start,
+					(unsigned int) NAME_BATCH_SIZE);
+		unsigned int hook_count = 0, non_hook_count = 0;
+		unsigned int i;
+		for (i = start; i < start + size; i++) {
+			if (is_volume_index_sample_006(volume_index,
+						       names[i])) {
+				hooks[hook_count++] = names[i];
+			} else {
+				non_hooks[non_hook_count++] = names[i];
+			}
+		}
+		prefetch_volume_index_names(vi6->vi_non_hook, non_hooks,
+					    non_hook_count);
+		prefetch_volume_index_names(vi6->vi_hook, hooks, hook_count);
 	}
-	return result;
-}
-
-/**********************************************************************/
-/**
- * Do a quick read-only lookup of the sampled chunk name and return
- * information needed by the index code to process the chunk name.
- *
- * @param volume_index  The volume index
- * @param name          The chunk name
- * @param triage        Information about the chunk name.  The zone and
- *                      is_sample fields are already filled in.  Set
- *                      in_sampled_chapter and virtual_chapter if the chunk
- *                      name is found in the index.
- *
- * @return UDS_SUCCESS or an error code
- **/
-static int
-lookup_volume_index_sampled_name_006(const struct volume_index *volume_index
-				     __always_unused,
-				     const struct uds_chunk_name *name
-				     __always_unused,
-				     struct volume_index_triage *triage
-				     __always_unused)
-{
-	return ASSERT_WITH_ERROR_CODE(false, UDS_BAD_STATE,
-				      "%s should not be called", __func__);
 }
 
 /**********************************************************************/
@@ -630,20 +713,7 @@ static int get_volume_index_record_006(struct volume_index *volume_index,
 		const_container_of(volume_index, struct volume_index6, common);
 	int result;
 	if (is_volume_index_sample_006(volume_index, name)) {
-		/*
-		 * We need to prevent a lookup_volume_index_name() happening
-		 * while we are finding the volume index record.  Remember that
-		 * because of lazy LRU flushing of the volume index,
-		 * get_volume_index_record() is not a read-only operation.
-		 */
-		unsigned int zone = get_volume_index_zone(vi6->vi_hook, name);
-		struct mutex *mutex = &vi6->zones[zone].hook_mutex;
-		uds_lock_mutex(mutex);
 		result = get_volume_index_record(vi6->vi_hook, name, record);
-		uds_unlock_mutex(mutex);
-		// Remember the mutex so that other operations on the
-		// volume_index_record can use it
-		record->mutex = mutex;
 	} else {
 		result = get_volume_index_record(vi6->vi_non_hook, name,
 						 record);
@@ -651,6 +721,60 @@ static int get_volume_index_record_006(struct volume_index *volume_index,
 	return result;
 }
 
+/**********************************************************************/
+/**
+ * Add new records for a batch of block names, splitting them between the
+ * hook and non-hook sub-indexes.
+ *
+ * @param volume_index     The volume index
+ * @param names            The block names
+ * @param count            The number of block names
+ * @param virtual_chapter  The chapter number where the blocks are found
+ *
+ * @return UDS_SUCCESS, UDS_OVERFLOW if some names were dropped, or an error
+ *         code
+ **/
+static int
+put_volume_index_records_006(struct volume_index *volume_index,
+			     const struct uds_chunk_name *const *names,
+			     unsigned int count,
+			     uint64_t virtual_chapter)
+{
+	const struct volume_index6 *vi6 =
+		const_container_of(volume_index, struct volume_index6, common);
+	const struct uds_chunk_name **split;
+	unsigned int hook_count = 0, non_hook_count = 0, i;
+	bool overflowed;
+	int result = UDS_ALLOCATE(count, const struct uds_chunk_name *,
+				  "volume index names", &split);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// Non-hooks fill the array from the front and hooks from the back.
+	for (i = 0; i < count; i++) {
+		if (is_volume_index_sample_006(volume_index, names[i])) {
+			split[count - ++hook_count] = names[i];
+		} else {
+			split[non_hook_count++] = names[i];
+		}
+	}
+	result = put_volume_index_records(vi6->vi_non_hook, split,
+					  non_hook_count, virtual_chapter);
+	overflowed = (result == UDS_OVERFLOW);
+	if ((result == UDS_SUCCESS) || overflowed) {
+		result = put_volume_index_records(vi6->vi_hook,
+						  &split[non_hook_count],
+						  hook_count,
+						  virtual_chapter);
+	}
+	UDS_FREE(split);
+	if ((result == UDS_SUCCESS) && overflowed) {
+		result = UDS_OVERFLOW;
+	}
+	return result;
+}
+
 /**********************************************************************/
 /**
  * Get the number of bytes used for volume index entries.
@@ -740,6 +864,26 @@ static int split_configuration006(const struct configuration *config,
 	split->hook_geometry.sparse_chapters_per_volume = 0;
 	split->non_hook_geometry.sparse_chapters_per_volume = 0;
 	split->non_hook_geometry.chapters_per_volume = num_dense_chapters;
+
+	// Divide the filter budget in proportion to the records indexed,
+	// with the record counts scaled down so the product cannot overflow.
+	if (config->volume_index_filter_size > 0) {
+		uint64_t hook_records = sample_records * num_chapters;
+		uint64_t non_hook_records =
+			((config->geometry->records_per_chapter -
+			  sample_records) *
+			 num_dense_chapters);
+		while (hook_records + non_hook_records > (1ULL << 20)) {
+			hook_records >>= 1;
+			non_hook_records >>= 1;
+		}
+		split->hook_config.volume_index_filter_size =
+			(config->volume_index_filter_size * hook_records /
+			 (hook_records + non_hook_records));
+		split->non_hook_config.volume_index_filter_size =
+			(config->volume_index_filter_size -
+			 split->hook_config.volume_index_filter_size);
+	}
 	return UDS_SUCCESS;
 }
 
@@ -776,7 +920,6 @@ int make_volume_index006(const struct configuration *config,
 			 struct volume_index **volume_index)
 {
 	struct split_config split;
-	unsigned int zone;
 	struct volume_index6 *vi6;
 	int result = split_configuration006(config, &split);
 	if (result != UDS_SUCCESS) {
@@ -793,6 +936,10 @@ int make_volume_index006(const struct configuration *config,
 	vi6->common.abort_saving_volume_index = abort_saving_volume_index_006;
 	vi6->common.finish_saving_volume_index =
 		finish_saving_volume_index_006;
+	vi6->common.bind_volume_index_zone_memory =
+		bind_volume_index_zone_memory_006;
+	vi6->common.compact_volume_index_zone =
+		compact_volume_index_zone_006;
 	vi6->common.free_volume_index = free_volume_index_006;
 	vi6->common.get_volume_index_memory_used =
 		get_volume_index_memory_used_006;
@@ -804,9 +951,11 @@ int make_volume_index006(const struct configuration *config,
 		is_restoring_volume_index_done_006;
 	vi6->common.is_saving_volume_index_done =
 		is_saving_volume_index_done_006;
-	vi6->common.lookup_volume_index_name = lookup_volume_index_name_006;
-	vi6->common.lookup_volume_index_sampled_name =
-		lookup_volume_index_sampled_name_006;
+	vi6->common.prefetch_volume_index_names =
+		prefetch_volume_index_names_006;
+	vi6->common.put_volume_index_records = put_volume_index_records_006;
+	vi6->common.restore_base_delta_list_to_volume_index =
+		restore_base_delta_list_to_volume_index_006;
 	vi6->common.restore_delta_list_to_volume_index =
 		restore_delta_list_to_volume_index_006;
 	vi6->common.set_volume_index_open_chapter =
@@ -816,25 +965,13 @@ int make_volume_index006(const struct configuration *config,
 		set_volume_index_zone_open_chapter_006;
 	vi6->common.start_restoring_volume_index =
 		start_restoring_volume_index_006;
+	vi6->common.start_restoring_volume_index_base =
+		start_restoring_volume_index_base_006;
 	vi6->common.start_saving_volume_index = start_saving_volume_index_006;
 
 	vi6->num_zones = num_zones;
 	vi6->sparse_sample_rate = config->sparse_sample_rate;
 
-	result = UDS_ALLOCATE(num_zones,
-			      struct volume_index_zone,
-			      "volume index zones",
-			      &vi6->zones);
-	for (zone = 0; zone < num_zones; zone++) {
-		if (result == UDS_SUCCESS) {
-			result = uds_init_mutex(&vi6->zones[zone].hook_mutex);
-		}
-	}
-	if (result != UDS_SUCCESS) {
-		free_volume_index_006(&vi6->common);
-		return result;
-	}
-
 	result = make_volume_index005(&split.non_hook_config,
 				      num_zones,
 				      volume_nonce,
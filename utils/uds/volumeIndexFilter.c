@@ -0,0 +1,210 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/volumeIndexFilter.c#1 $
+ */
+
+#include "volumeIndexFilter.h"
+
+#include "errors.h"
+#include "memoryAlloc.h"
+#include "stringUtils.h"
+
+enum {
+	/* The number of bits in a block, and its log */
+	BLOCK_BITS = FILTER_BLOCK_WORDS * 64,
+	BLOCK_BIT_SHIFT = 9,
+	/* The bits set within its block for each key */
+	BITS_PER_KEY = 6,
+	/*
+	 * The filter memory per key at capacity. With six bits set in a
+	 * 512-bit block, this gives a false positive rate of about 2%.
+	 */
+	FILTER_BITS_PER_KEY = 10,
+	/* The smallest filter worth keeping */
+	MIN_FILTER_BLOCKS = 64,
+};
+
+/**********************************************************************/
+int make_volume_index_filter(size_t size,
+			     struct volume_index_filter **filter_ptr)
+{
+	struct volume_index_filter *filter;
+	size_t num_blocks = size / sizeof(struct filter_block);
+	int result;
+
+	*filter_ptr = NULL;
+	if (num_blocks < MIN_FILTER_BLOCKS) {
+		return UDS_SUCCESS;
+	}
+	if (num_blocks > UINT_MAX) {
+		num_blocks = UINT_MAX;
+	}
+
+	result = UDS_ALLOCATE(1, struct volume_index_filter, __func__,
+			      &filter);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = UDS_ALLOCATE(num_blocks, struct filter_block,
+			      "volume index filter blocks", &filter->blocks);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(filter);
+		return result;
+	}
+
+	filter->num_blocks = num_blocks;
+	filter->capacity = ((unsigned long) num_blocks *
+			    sizeof(struct filter_block) * CHAR_BIT /
+			    FILTER_BITS_PER_KEY);
+	filter->valid = true;
+	*filter_ptr = filter;
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+void free_volume_index_filter(struct volume_index_filter *filter)
+{
+	if (filter == NULL) {
+		return;
+	}
+
+	UDS_FREE(filter->blocks);
+	UDS_FREE(filter);
+}
+
+/**********************************************************************/
+void clear_volume_index_filter(struct volume_index_filter *filter)
+{
+	memset(filter->blocks, 0,
+	       filter->num_blocks * sizeof(struct filter_block));
+	filter->key_count = 0;
+	filter->valid = false;
+}
+
+/**********************************************************************/
+void finish_rebuilding_volume_index_filter(struct volume_index_filter *filter,
+					   ktime_t start_time)
+{
+	filter->rebuilt_count = filter->key_count;
+	filter->valid = true;
+	filter->rebuilds++;
+	filter->rebuild_time +=
+		ktime_sub(current_time_ns(CLOCK_MONOTONIC), start_time);
+}
+
+/**
+ * Mix the bits of a key so that every bit of the result depends on every
+ * bit of the key.
+ *
+ * @param key  The key to mix
+ *
+ * @return the mixed key
+ **/
+static INLINE uint64_t mix_key(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+/**
+ * Find the block of a filter holding the bits of a key.
+ *
+ * @param filter       The filter
+ * @param list_number  The delta list number of the key
+ * @param address      The address of the key within the delta list
+ * @param bits         Set to a hash selecting the bits within the block
+ *
+ * @return the block for the key
+ **/
+static INLINE struct filter_block *
+get_filter_block(const struct volume_index_filter *filter,
+		 unsigned int list_number,
+		 unsigned int address,
+		 uint64_t *bits)
+{
+	uint64_t hash = mix_key(((uint64_t) list_number << 32) | address);
+	uint64_t block = ((hash >> 32) * filter->num_blocks) >> 32;
+	*bits = mix_key(hash);
+	return &filter->blocks[block];
+}
+
+/**********************************************************************/
+void add_to_volume_index_filter(struct volume_index_filter *filter,
+				unsigned int list_number,
+				unsigned int address)
+{
+	uint64_t bits;
+	struct filter_block *block =
+		get_filter_block(filter, list_number, address, &bits);
+	unsigned int i;
+
+	for (i = 0; i < BITS_PER_KEY; i++) {
+		unsigned int bit = bits & (BLOCK_BITS - 1);
+		block->words[bit / 64] |= 1ULL << (bit % 64);
+		bits >>= BLOCK_BIT_SHIFT;
+	}
+	filter->key_count++;
+}
+
+/**********************************************************************/
+bool may_be_in_volume_index_filter(const struct volume_index_filter *filter,
+				   unsigned int list_number,
+				   unsigned int address)
+{
+	uint64_t bits;
+	const struct filter_block *block;
+	unsigned int i;
+
+	if (!filter->valid) {
+		return true;
+	}
+
+	block = get_filter_block(filter, list_number, address, &bits);
+	for (i = 0; i < BITS_PER_KEY; i++) {
+		unsigned int bit = bits & (BLOCK_BITS - 1);
+		if ((block->words[bit / 64] & (1ULL << (bit % 64))) == 0) {
+			return false;
+		}
+		bits >>= BLOCK_BIT_SHIFT;
+	}
+	return true;
+}
+
+/**********************************************************************/
+void add_volume_index_filter_stats(const struct volume_index_filter *filter,
+				   struct volume_index_filter_stats *stats)
+{
+	if (filter == NULL) {
+		return;
+	}
+
+	stats->memory_allocated +=
+		(sizeof(struct volume_index_filter) +
+		 filter->num_blocks * sizeof(struct filter_block));
+	stats->negatives += filter->negatives;
+	stats->passes += filter->passes;
+	stats->false_positives += filter->false_positives;
+	stats->rebuilds += filter->rebuilds;
+	stats->rebuild_time += filter->rebuild_time;
+}
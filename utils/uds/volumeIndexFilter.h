@@ -0,0 +1,169 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/volumeIndexFilter.h#1 $
+ */
+
+#ifndef VOLUME_INDEX_FILTER_H
+#define VOLUME_INDEX_FILTER_H
+
+#include "compiler.h"
+#include "cpu.h"
+#include "timeUtils.h"
+#include "typeDefs.h"
+
+/**
+ * A volume_index_filter is a blocked Bloom filter covering one zone of a
+ * volume index. It records the delta list and address of every entry put
+ * in the zone, so a lookup which the filter rules out can skip searching
+ * the delta list. Each key sets bits within a single cache line, so a
+ * check costs one memory access.
+ *
+ * Entries are never removed from the filter, so entries which have been
+ * removed or expired from the index only cost false positives. Since the
+ * keys are exactly what the delta index stores, the filter can be rebuilt
+ * from the delta lists when it fills with stale keys, or when the index is
+ * loaded.
+ *
+ * A filter is only used by the thread which owns its zone.
+ **/
+enum { FILTER_BLOCK_WORDS = 8 };
+
+struct filter_block {
+	uint64_t words[FILTER_BLOCK_WORDS];
+} __attribute__((aligned(64)));
+
+/*
+ * Each zone has its own filter, whose counters its thread updates on every
+ * lookup, so filters are aligned to keep zones from sharing cache lines.
+ */
+struct volume_index_filter {
+	struct filter_block *blocks;  // The filter bits, a cache line per block
+	unsigned int num_blocks;      // The number of blocks
+	unsigned long capacity;       // Keys held before the filter degrades
+	unsigned long key_count;      // Keys added since the last rebuild
+	unsigned long rebuilt_count;  // Keys present after the last rebuild
+	bool valid;                   // False if the filter must be rebuilt
+				      // before it can rule out a key
+	long negatives;               // Lookups ruled out
+	long passes;                  // Lookups which had to search the index
+	long false_positives;         // Passes which did not find the key
+	long rebuilds;                // Number of rebuilds
+	ktime_t rebuild_time;         // Nanoseconds spent rebuilding
+} __attribute__((aligned(CACHE_LINE_BYTES)));
+
+struct volume_index_filter_stats {
+	size_t memory_allocated; // Number of bytes of filter
+	long negatives;          // Lookups ruled out by the filter
+	long passes;             // Lookups which had to search the index
+	long false_positives;    // Passes which did not find the name
+	long rebuilds;           // Number of filter rebuilds
+	ktime_t rebuild_time;    // Nanoseconds spent rebuilding
+};
+
+/**
+ * Make a volume index filter.
+ *
+ * @param size        The memory budget for the filter in bytes
+ * @param filter_ptr  A pointer to hold the new filter, or NULL if the
+ *                    budget is too small for a useful filter
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check make_volume_index_filter(size_t size,
+					  struct volume_index_filter **filter_ptr);
+
+/**
+ * Free a volume index filter.
+ *
+ * @param filter  The filter to free, which may be NULL
+ **/
+void free_volume_index_filter(struct volume_index_filter *filter);
+
+/**
+ * Empty a volume index filter, ready to be rebuilt.
+ *
+ * @param filter  The filter
+ **/
+void clear_volume_index_filter(struct volume_index_filter *filter);
+
+/**
+ * Record that a volume index filter has been refilled from its zone of the
+ * delta index after clear_volume_index_filter().
+ *
+ * @param filter      The filter
+ * @param start_time  When the rebuild started
+ **/
+void finish_rebuilding_volume_index_filter(struct volume_index_filter *filter,
+					   ktime_t start_time);
+
+/**
+ * Add a key to a volume index filter.
+ *
+ * @param filter       The filter
+ * @param list_number  The delta list number of the key
+ * @param address      The address of the key within the delta list
+ **/
+void add_to_volume_index_filter(struct volume_index_filter *filter,
+				unsigned int list_number,
+				unsigned int address);
+
+/**
+ * Check whether a key may have been added to a volume index filter since
+ * it was last rebuilt.
+ *
+ * @param filter       The filter
+ * @param list_number  The delta list number of the key
+ * @param address      The address of the key within the delta list
+ *
+ * @return false if the key is certainly not in the filter
+ **/
+bool __must_check
+may_be_in_volume_index_filter(const struct volume_index_filter *filter,
+			      unsigned int list_number,
+			      unsigned int address);
+
+/**
+ * Check whether a volume index filter holds so many stale keys that it
+ * should be rebuilt. The filter is rebuilt once it holds more keys than its
+ * capacity, but no sooner than when it holds twice as many as it did after
+ * the last rebuild, so the cost of rebuilding stays proportional to the
+ * number of puts.
+ *
+ * @param filter  The filter
+ *
+ * @return true if the filter should be rebuilt
+ **/
+static INLINE bool
+volume_index_filter_needs_rebuild(const struct volume_index_filter *filter)
+{
+	return (!filter->valid ||
+		((filter->key_count > filter->capacity) &&
+		 (filter->key_count > 2 * filter->rebuilt_count)));
+}
+
+/**
+ * Add the counters of a volume index filter to a set of filter stats.
+ *
+ * @param filter  The filter, which may be NULL
+ * @param stats   The stats to add to
+ **/
+void add_volume_index_filter_stats(const struct volume_index_filter *filter,
+				   struct volume_index_filter_stats *stats);
+
+#endif /* VOLUME_INDEX_FILTER_H */
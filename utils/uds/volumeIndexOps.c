@@ -24,12 +24,14 @@
 #include "errors.h"
 #include "geometry.h"
 #include "indexComponent.h"
+#include "indexState.h"
 #include "logger.h"
 #include "volumeIndex005.h"
 #include "volumeIndex006.h"
 #include "memoryAlloc.h"
 #include "permassert.h"
 #include "uds.h"
+#include "uds-threads.h"
 #include "zone.h"
 
 /**********************************************************************/
@@ -43,6 +45,7 @@ void get_volume_index_combined_stats(const struct volume_index *volume_index,
 				     struct volume_index_stats *stats)
 {
 	struct volume_index_stats dense, sparse;
+	unsigned int i;
 	get_volume_index_stats(volume_index, &dense, &sparse);
 	stats->memory_allocated =
 		dense.memory_allocated + sparse.memory_allocated;
@@ -55,7 +58,21 @@ void get_volume_index_combined_stats(const struct volume_index *volume_index,
 	stats->discard_count = dense.discard_count + sparse.discard_count;
 	stats->overflow_count = dense.overflow_count + sparse.overflow_count;
 	stats->num_lists = dense.num_lists + sparse.num_lists;
+	for (i = 0; i < DELTA_LIST_SIZE_BUCKETS; i++) {
+		stats->list_sizes[i] =
+			dense.list_sizes[i] + sparse.list_sizes[i];
+	}
 	stats->early_flushes = dense.early_flushes + sparse.early_flushes;
+	stats->filter.memory_allocated =
+		dense.filter.memory_allocated + sparse.filter.memory_allocated;
+	stats->filter.negatives =
+		dense.filter.negatives + sparse.filter.negatives;
+	stats->filter.passes = dense.filter.passes + sparse.filter.passes;
+	stats->filter.false_positives =
+		dense.filter.false_positives + sparse.filter.false_positives;
+	stats->filter.rebuilds = dense.filter.rebuilds + sparse.filter.rebuilds;
+	stats->filter.rebuild_time =
+		dense.filter.rebuild_time + sparse.filter.rebuild_time;
 }
 
 /**********************************************************************/
@@ -64,13 +81,14 @@ int make_volume_index(const struct configuration *config,
 		      uint64_t volume_nonce,
 		      struct volume_index **volume_index)
 {
-	if (uses_sparse(config)) {
-		return make_volume_index006(config, num_zones, volume_nonce,
-					    volume_index);
-	} else {
-		return make_volume_index005(config, num_zones, volume_nonce,
-					    volume_index);
-	}
+	enum uds_memory_tag tag = uds_set_memory_tag(UDS_MEMORY_VOLUME_INDEX);
+	int result = (uses_sparse(config) ?
+		      make_volume_index006(config, num_zones, volume_nonce,
+					   volume_index) :
+		      make_volume_index005(config, num_zones, volume_nonce,
+					   volume_index));
+	uds_set_memory_tag(tag);
+	return result;
 }
 
 /**********************************************************************/
@@ -92,30 +110,90 @@ int compute_volume_index_save_blocks(const struct configuration *config,
 	return UDS_SUCCESS;
 }
 
+/**********************************************************************/
+static int
+restore_volume_index_with_base(struct buffered_reader **buffered_readers,
+			       unsigned int num_readers,
+			       struct buffered_reader **base_readers,
+			       unsigned int num_base_readers,
+			       struct volume_index *volume_index);
+
 /**********************************************************************/
 static int read_volume_index(struct read_portal *portal)
 {
 	struct volume_index *volume_index =
 		index_component_context(portal->component);
+	struct index_state *state = portal->component->state;
 	unsigned int num_zones = portal->zones;
+	unsigned int num_base_zones = 0;
 	struct buffered_reader *readers[MAX_ZONES];
+	struct buffered_reader *base_readers[MAX_ZONES];
 	unsigned int z;
-	if (num_zones > MAX_ZONES) {
+	int result = UDS_SUCCESS;
+	if (state->load_base_slot != UINT_MAX) {
+		num_base_zones = state->load_base_zones;
+	}
+	if ((num_zones > MAX_ZONES) || (num_base_zones > MAX_ZONES)) {
 		return uds_log_error_strerror(UDS_BAD_STATE,
 					      "zone count %u must not exceed MAX_ZONES",
-					      num_zones);
+					      max(num_zones, num_base_zones));
 	}
 
 	for (z = 0; z < num_zones; ++z) {
-		int result =
-			get_buffered_reader_for_portal(portal, z, &readers[z]);
+		result = get_buffered_reader_for_portal(portal, z,
+							&readers[z]);
 		if (result != UDS_SUCCESS) {
 			return uds_log_error_strerror(result,
 						      "cannot read component for zone %u",
 						      z);
 		}
 	}
-	return restore_volume_index(readers, num_zones, volume_index);
+
+	// The delta lists which did not change since the base of an
+	// incremental save are read from the base.
+	for (z = 0; z < num_base_zones; ++z) {
+		result = open_state_base_buffered_reader(state,
+							 RL_KIND_VOLUME_INDEX,
+							 z, &base_readers[z]);
+		if (result != UDS_SUCCESS) {
+			uds_log_error_strerror(result,
+					       "cannot read component base for zone %u",
+					       z);
+			num_base_zones = z;
+			break;
+		}
+	}
+	if (result == UDS_SUCCESS) {
+		result = restore_volume_index_with_base(readers, num_zones,
+							base_readers,
+							num_base_zones,
+							volume_index);
+	}
+	for (z = 0; z < num_base_zones; ++z) {
+		portal->component->bytes_read +=
+			get_buffered_reader_bytes_read(base_readers[z]);
+		free_buffered_reader(base_readers[z]);
+	}
+	return result;
+}
+
+/**
+ * Choose how to save the volume index for the save in progress.
+ *
+ * @param state  The index state being saved
+ *
+ * @return the kind of delta index save to make
+ **/
+static enum delta_save_mode
+get_delta_save_mode(const struct index_state *state)
+{
+	if (state->incremental) {
+		return DELTA_SAVE_INCREMENTAL;
+	}
+	// Only a clean save is written while the index is idle, so only it
+	// can write every delta list at once.
+	return ((state->save_type == IS_SAVE) ? DELTA_SAVE_PACKED :
+						DELTA_SAVE_FULL);
 }
 
 /**********************************************************************/
@@ -132,7 +210,8 @@ static int write_volume_index(struct index_component *component,
 
 	switch (command) {
 	case IWC_START:
-		result = start_saving_volume_index(volume_index, zone, writer);
+		result = start_saving_volume_index(volume_index, zone, writer,
+						   get_delta_save_mode(component->state));
 		is_complete = result != UDS_SUCCESS;
 		break;
 	case IWC_CONTINUE:
@@ -176,13 +255,131 @@ static const struct index_component_info VOLUME_INDEX_INFO_DATA = {
 const struct index_component_info *const VOLUME_INDEX_INFO =
 	&VOLUME_INDEX_INFO_DATA;
 
+/**
+ * The delta lists saved in one stream, restored on a thread of their own.
+ **/
+struct restore_stream {
+	struct volume_index *volume_index;
+	struct buffered_reader *buffered_reader;
+	bool base;
+	byte *dl_data;
+	struct thread *thread;
+	int result;
+};
+
+/**********************************************************************/
+static int restore_stream_delta_lists(struct volume_index *volume_index,
+				      struct buffered_reader *buffered_reader,
+				      bool base,
+				      byte dl_data[DELTA_LIST_MAX_BYTE_COUNT])
+{
+	for (;;) {
+		struct delta_list_save_info dlsi;
+		int result = read_saved_delta_list(&dlsi, dl_data,
+						   buffered_reader);
+		if (result == UDS_END_OF_FILE) {
+			return UDS_SUCCESS;
+		} else if (result != UDS_SUCCESS) {
+			return result;
+		}
+		result = (base ?
+			  restore_base_delta_list_to_volume_index(volume_index,
+								  &dlsi,
+								  dl_data) :
+			  restore_delta_list_to_volume_index(volume_index,
+							     &dlsi,
+							     dl_data));
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
+}
+
+/**********************************************************************/
+static void restore_stream_thread(void *arg)
+{
+	struct restore_stream *stream = arg;
+	stream->result = restore_stream_delta_lists(stream->volume_index,
+						    stream->buffered_reader,
+						    stream->base,
+						    stream->dl_data);
+}
+
+/**********************************************************************/
+static int restore_volume_index_streams(struct buffered_reader **buffered_readers,
+					unsigned int num_readers,
+					bool base,
+					struct volume_index *volume_index,
+					byte dl_data[DELTA_LIST_MAX_BYTE_COUNT])
+{
+	struct restore_stream *streams;
+	unsigned int z;
+	int result;
+
+	if (num_readers < 2) {
+		return ((num_readers == 0) ?
+			UDS_SUCCESS :
+			restore_stream_delta_lists(volume_index,
+						   buffered_readers[0],
+						   base, dl_data));
+	}
+
+	result = UDS_ALLOCATE(num_readers, struct restore_stream, __func__,
+			      &streams);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// The first stream is restored by this thread, the rest each get a
+	// thread and a buffer of their own.  A stream that cannot get either
+	// is restored here after the first.
+	for (z = 1; z < num_readers; z++) {
+		struct restore_stream *stream = &streams[z];
+		stream->volume_index = volume_index;
+		stream->buffered_reader = buffered_readers[z];
+		stream->base = base;
+		stream->result = UDS_ALLOCATE(DELTA_LIST_MAX_BYTE_COUNT, byte,
+					      "restore stream",
+					      &stream->dl_data);
+		if (stream->result == UDS_SUCCESS) {
+			stream->result =
+				uds_create_thread(restore_stream_thread, stream,
+						  "restoreVI", &stream->thread);
+		}
+		if (stream->result != UDS_SUCCESS) {
+			stream->thread = NULL;
+		}
+	}
+
+	result = restore_stream_delta_lists(volume_index, buffered_readers[0],
+					    base, dl_data);
+	for (z = 1; z < num_readers; z++) {
+		struct restore_stream *stream = &streams[z];
+		if (stream->thread != NULL) {
+			uds_join_threads(stream->thread);
+		} else if (result == UDS_SUCCESS) {
+			stream->result =
+				restore_stream_delta_lists(volume_index,
+							   buffered_readers[z],
+							   base, dl_data);
+		}
+		if (result == UDS_SUCCESS) {
+			result = stream->result;
+		}
+		UDS_FREE(stream->dl_data);
+	}
+	UDS_FREE(streams);
+	return result;
+}
+
 /**********************************************************************/
 static int restore_volume_index_body(struct buffered_reader **buffered_readers,
 				     unsigned int num_readers,
+				     struct buffered_reader **base_readers,
+				     unsigned int num_base_readers,
 				     struct volume_index *volume_index,
 				     byte dl_data[DELTA_LIST_MAX_BYTE_COUNT])
 {
-	unsigned int z;
 	// Start by reading the "header" section of the stream
 	int result = start_restoring_volume_index(volume_index,
 						  buffered_readers,
@@ -190,26 +387,31 @@ static int restore_volume_index_body(struct buffered_reader **buffered_readers,
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
-	// Loop to read the delta lists, stopping when they have all been
-	// processed.
-	for (z = 0; z < num_readers; z++) {
-		for (;;) {
-			struct delta_list_save_info dlsi;
-			result = read_saved_delta_list(&dlsi, dl_data,
-						       buffered_readers[z]);
-			if (result == UDS_END_OF_FILE) {
-				break;
-			} else if (result != UDS_SUCCESS) {
-				abort_restoring_volume_index(volume_index);
-				return result;
-			}
-			result = restore_delta_list_to_volume_index(volume_index,
-								    &dlsi,
-								    dl_data);
-			if (result != UDS_SUCCESS) {
-				abort_restoring_volume_index(volume_index);
-				return result;
-			}
+	// Read the delta lists from each stream, stopping when they have all
+	// been processed.  The streams are independent, so they are read in
+	// parallel.
+	result = restore_volume_index_streams(buffered_readers, num_readers,
+					      false, volume_index, dl_data);
+	if (result != UDS_SUCCESS) {
+		abort_restoring_volume_index(volume_index);
+		return result;
+	}
+	// An incremental save holds only the changed delta lists, and the
+	// rest are filled in from the full save it was based on.
+	if (num_base_readers > 0) {
+		result = start_restoring_volume_index_base(volume_index,
+							   base_readers,
+							   num_base_readers);
+		if (result == UDS_SUCCESS) {
+			result = restore_volume_index_streams(base_readers,
+							      num_base_readers,
+							      true,
+							      volume_index,
+							      dl_data);
+		}
+		if (result != UDS_SUCCESS) {
+			abort_restoring_volume_index(volume_index);
+			return result;
 		}
 	}
 	if (!is_restoring_volume_index_done(volume_index)) {
@@ -221,9 +423,12 @@ static int restore_volume_index_body(struct buffered_reader **buffered_readers,
 }
 
 /**********************************************************************/
-int restore_volume_index(struct buffered_reader **buffered_readers,
-			 unsigned int num_readers,
-			 struct volume_index *volume_index)
+static int
+restore_volume_index_with_base(struct buffered_reader **buffered_readers,
+			       unsigned int num_readers,
+			       struct buffered_reader **base_readers,
+			       unsigned int num_base_readers,
+			       struct volume_index *volume_index)
 {
 	byte *dl_data;
 	int result =
@@ -232,7 +437,17 @@ int restore_volume_index(struct buffered_reader **buffered_readers,
 		return result;
 	}
 	result = restore_volume_index_body(buffered_readers, num_readers,
+					   base_readers, num_base_readers,
 					   volume_index, dl_data);
 	UDS_FREE(dl_data);
 	return result;
 }
+
+/**********************************************************************/
+int restore_volume_index(struct buffered_reader **buffered_readers,
+			 unsigned int num_readers,
+			 struct volume_index *volume_index)
+{
+	return restore_volume_index_with_base(buffered_readers, num_readers,
+					      NULL, 0, volume_index);
+}
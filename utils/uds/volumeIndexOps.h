@@ -22,44 +22,37 @@
 #ifndef VOLUMEINDEXOPS_H
 #define VOLUMEINDEXOPS_H 1
 
+#include "atomicDefs.h"
 #include "compiler.h"
 #include "deltaIndex.h"
 #include "indexComponent.h"
 #include "indexConfig.h"
 #include "uds-threads.h"
 #include "uds.h"
+#include "volumeIndexFilter.h"
 
 extern const struct index_component_info *const VOLUME_INDEX_INFO;
 extern unsigned int min_volume_index_delta_lists;
 
 struct volume_index_stats {
 	size_t memory_allocated;    // Number of bytes allocated
+	size_t huge_page_memory;    // Number of bytes backed by huge pages
 	ktime_t rebalance_time;	    // Nanoseconds spent rebalancing
 	int rebalance_count;        // Number of memory rebalances
+	ktime_t local_rebalance_time; // Nanoseconds rebalancing nearby lists
+	int local_rebalance_count;  // Number of nearby list rebalances
+	ktime_t compaction_time;    // Nanoseconds spent compacting lists
+	int compaction_count;       // Number of windows of lists compacted
 	long record_count;          // The number of records in the index
 	long collision_count;       // The number of collision records
 	long discard_count;         // The number of records removed
 	long overflow_count;        // The number of UDS_OVERFLOWs detected
 	unsigned int num_lists;     // The number of delta lists
 	long early_flushes;         // Number of early flushes
-};
-
-/*
- * The volume_index_triage structure is used by lookup_volume_index_name(),
- * which is a read-only operation that looks at the chunk name and returns
- * some information used by the index to select the thread/queue/code_path
- * that will process the chunk.
- */
-struct volume_index_triage {
-	uint64_t virtual_chapter;  // If in_sampled_chapter is true, then this
-				   // is the chapter containing the entry for
-				   // the chunk name
-	unsigned int zone;         // The zone containing the chunk name
-	bool is_sample;            // If true, this chunk name belongs to the
-				   // sampled index
-	bool in_sampled_chapter;   // If true, this chunk already has an entry
-				   // in the sampled index and virtual_chapter
-				   // is valid
+	// Delta list size distribution, as in struct delta_index_stats
+	long list_sizes[DELTA_LIST_SIZE_BUCKETS];
+	// Negative lookup filter counters
+	struct volume_index_filter_stats filter;
 };
 
 /*
@@ -82,21 +75,29 @@ struct volume_index_record {
 					       // records
 	unsigned int zone_number;              // Zone that contains this block
 	struct volume_index *volume_index;     // The volume index
-	struct mutex *mutex;                   // Mutex that must be held while
-					       // accessing this delta index
-					       // entry; used only for a
-					       // sampled index; otherwise is
-					       // NULL
+	unsigned int *sequence;                // Sequence count to advance
+					       // while changing this delta
+					       // index entry; used only for
+					       // a shared index; otherwise
+					       // is NULL
 	const struct uds_chunk_name *name;     // The blockname to which this
 					       // record refers
 	struct delta_index_entry delta_entry;  // The delta index entry for
 					       // this record
+	bool is_filtered;                      // The filter ruled the name
+					       // out, so delta_entry has not
+					       // been positioned
 };
 
 struct volume_index {
 	void (*abort_restoring_volume_index)(struct volume_index *volume_index);
 	int (*abort_saving_volume_index)(const struct volume_index *volume_index,
 					 unsigned int zone_number);
+	void (*bind_volume_index_zone_memory)(struct volume_index *volume_index,
+					      unsigned int zone_number,
+					      int node);
+	void (*compact_volume_index_zone)(struct volume_index *volume_index,
+					  unsigned int zone_number);
 	int (*finish_saving_volume_index)(const struct volume_index *volume_index,
 					  unsigned int zone_number);
 	void (*free_volume_index)(struct volume_index *volume_index);
@@ -114,12 +115,16 @@ struct volume_index {
 	bool (*is_restoring_volume_index_done)(const struct volume_index *volume_index);
 	bool (*is_saving_volume_index_done)(const struct volume_index *volume_index,
 					    unsigned int zone_number);
-	int (*lookup_volume_index_name)(const struct volume_index *volume_index,
-					const struct uds_chunk_name *name,
-					struct volume_index_triage *triage);
-	int (*lookup_volume_index_sampled_name)(const struct volume_index *volume_index,
-					        const struct uds_chunk_name *name,
-					        struct volume_index_triage *triage);
+	void (*prefetch_volume_index_names)(const struct volume_index *volume_index,
+					    const struct uds_chunk_name *const *names,
+					    unsigned int count);
+	int (*put_volume_index_records)(struct volume_index *volume_index,
+					const struct uds_chunk_name *const *names,
+					unsigned int count,
+					uint64_t virtual_chapter);
+	int (*restore_base_delta_list_to_volume_index)(struct volume_index *volume_index,
+						       const struct delta_list_save_info *dlsi,
+						       const byte data[DELTA_LIST_MAX_BYTE_COUNT]);
 	int (*restore_delta_list_to_volume_index)(struct volume_index *volume_index,
 						  const struct delta_list_save_info *dlsi,
 						  const byte data[DELTA_LIST_MAX_BYTE_COUNT]);
@@ -133,11 +138,40 @@ struct volume_index {
 	int (*start_restoring_volume_index)(struct volume_index *volume_index,
 					    struct buffered_reader **buffered_readers,
 					    int num_readers);
+	int (*start_restoring_volume_index_base)(struct volume_index *volume_index,
+						 struct buffered_reader **buffered_readers,
+						 int num_readers);
 	int (*start_saving_volume_index)(const struct volume_index *volume_index,
 					 unsigned int zone_number,
-					 struct buffered_writer *buffered_writer);
+					 struct buffered_writer *buffered_writer,
+					 enum delta_save_mode mode);
 };
 
+/**
+ * Note that the zone thread is about to change a shared volume index zone.
+ * The sequence count is odd while a change is in progress, so that readers
+ * searching the zone without a lock know to retry.
+ *
+ * @param sequence  The sequence count of the zone
+ **/
+static INLINE void begin_volume_index_change(unsigned int *sequence)
+{
+	WRITE_ONCE(*sequence, *sequence + 1);
+	smp_wmb();
+}
+
+/**
+ * Note that the zone thread has finished changing a shared volume index
+ * zone.
+ *
+ * @param sequence  The sequence count of the zone
+ **/
+static INLINE void end_volume_index_change(unsigned int *sequence)
+{
+	smp_wmb();
+	WRITE_ONCE(*sequence, *sequence + 1);
+}
+
 /**
  * Return the combined volume index stats.
  *
@@ -218,6 +252,38 @@ abort_saving_volume_index(const struct volume_index *volume_index,
 						       zone_number);
 }
 
+/**
+ * Ask for the memory of a volume index zone to be kept on a NUMA node.
+ *
+ * @param volume_index  The volume index
+ * @param zone_number   The number of the zone
+ * @param node          The NUMA node, or -1 to leave the memory alone
+ **/
+static INLINE void
+bind_volume_index_zone_memory(struct volume_index *volume_index,
+			      unsigned int zone_number,
+			      int node)
+{
+	volume_index->bind_volume_index_zone_memory(volume_index, zone_number,
+						    node);
+}
+
+/**
+ * Compact one slice of the delta list memory of a volume index zone, so that
+ * the free space left by deletes and expired chapters does not stay bunched
+ * up.  This must be called by the zone's own thread, and is meant to be
+ * called when the zone has nothing else to do.
+ *
+ * @param volume_index  The volume index
+ * @param zone_number   The number of the zone
+ **/
+static INLINE void
+compact_volume_index_zone(struct volume_index *volume_index,
+			  unsigned int zone_number)
+{
+	volume_index->compact_volume_index_zone(volume_index, zone_number);
+}
+
 /**
  * Finish saving a volume index to an output stream.  Force the writing of
  * all of the remaining data.  If an error occurred asynchronously during
@@ -370,44 +436,21 @@ is_saving_volume_index_done(const struct volume_index *volume_index,
 }
 
 /**
- * Do a quick read-only lookup of the chunk name and return information
- * needed by the index code to process the chunk name.
- *
- * @param volume_index  The volume index
- * @param name          The chunk name
- * @param triage        Information about the chunk name
- *
- * @return UDS_SUCCESS or an error code
- **/
-static INLINE int
-lookup_volume_index_name(const struct volume_index *volume_index,
-			 const struct uds_chunk_name *name,
-			 struct volume_index_triage *triage)
-{
-	return volume_index->lookup_volume_index_name(volume_index, name,
-						      triage);
-}
-
-/**
- * Do a quick read-only lookup of the sampled chunk name and return
- * information needed by the index code to process the chunk name.
+ * Prefetch the volume index memory which get_volume_index_record() will
+ * read for a batch of chunk names.  This must be called from the thread
+ * that owns the zones of the names, since that thread is the only one
+ * which modifies them.
  *
  * @param volume_index  The volume index
- * @param name          The chunk name
- * @param triage        Information about the chunk name.  The zone and
- *                      is_sample fields are already filled in.  Set
- *                      in_sampled_chapter and virtual_chapter if the chunk
- *                      name is found in the index.
- *
- * @return UDS_SUCCESS or an error code
+ * @param names         The chunk names
+ * @param count         The number of chunk names
  **/
-static INLINE int
-lookup_volume_index_sampled_name(const struct volume_index *volume_index,
-				 const struct uds_chunk_name *name,
-				 struct volume_index_triage *triage)
+static INLINE void
+prefetch_volume_index_names(const struct volume_index *volume_index,
+			    const struct uds_chunk_name *const *names,
+			    unsigned int count)
 {
-	return volume_index->lookup_volume_index_sampled_name(volume_index,
-							      name, triage);
+	volume_index->prefetch_volume_index_names(volume_index, names, count);
 }
 
 /**
@@ -421,6 +464,38 @@ lookup_volume_index_sampled_name(const struct volume_index *volume_index,
 int __must_check put_volume_index_record(struct volume_index_record *record,
 					 uint64_t virtual_chapter);
 
+/**
+ * Add new records for a batch of block names, all associated with the same
+ * chapter.  The names are sorted by delta list, and each delta list they
+ * touch is rewritten once, rather than once for each name as
+ * put_volume_index_record() would.  This is meant for replaying a chapter,
+ * where most of the names of a chapter are added at once.
+ *
+ * Each name must already have been looked up with get_volume_index_record()
+ * and found not to have a record of its own, either because no record was
+ * found or because the record found was for a different name.  A name
+ * whose address matches an existing record or a name earlier in the batch
+ * gets a collision record, exactly as if the names had been put one at a
+ * time in the order given.
+ *
+ * @param volume_index     The volume index
+ * @param names            The block names
+ * @param count            The number of block names
+ * @param virtual_chapter  The chapter number where the blocks are found
+ *
+ * @return UDS_SUCCESS, UDS_OVERFLOW if some names were dropped because
+ *         their delta lists were full, or an error code
+ **/
+static INLINE int
+put_volume_index_records(struct volume_index *volume_index,
+			 const struct uds_chunk_name *const *names,
+			 unsigned int count,
+			 uint64_t virtual_chapter)
+{
+	return volume_index->put_volume_index_records(volume_index, names,
+						      count, virtual_chapter);
+}
+
 /**
  * Remove an existing record.
  *
@@ -431,6 +506,26 @@ int __must_check put_volume_index_record(struct volume_index_record *record,
 int __must_check
 remove_volume_index_record(struct volume_index_record *record);
 
+/**
+ * Restore a delta list saved in the base of an incremental save.  Lists
+ * which were restored from the incremental save are left alone.
+ *
+ * @param volume_index  The volume index to restore into
+ * @param dlsi          The delta_list_save_info describing the delta list
+ * @param data          The saved delta list bit stream
+ *
+ * @return error code or UDS_SUCCESS
+ **/
+static INLINE int
+restore_base_delta_list_to_volume_index(struct volume_index *volume_index,
+					const struct delta_list_save_info *dlsi,
+					const byte data[DELTA_LIST_MAX_BYTE_COUNT])
+{
+	return volume_index->restore_base_delta_list_to_volume_index(volume_index,
+								     dlsi,
+								     data);
+}
+
 /**
  * Restore a saved delta list
  *
@@ -540,23 +635,47 @@ start_restoring_volume_index(struct volume_index *volume_index,
 							  num_readers);
 }
 
+/**
+ * Start restoring the base of an incremental save of the volume index. This
+ * must follow start_restoring_volume_index() on the readers of the
+ * incremental save, which supplies the delta list sizes and chapter ranges.
+ *
+ * @param volume_index      The volume index to restore into
+ * @param buffered_readers  The buffered readers to read the base from
+ * @param num_readers       The number of buffered readers
+ *
+ * @return UDS_SUCCESS on success, or an error code on failure
+ **/
+static INLINE int
+start_restoring_volume_index_base(struct volume_index *volume_index,
+				  struct buffered_reader **buffered_readers,
+				  int num_readers)
+{
+	return volume_index->start_restoring_volume_index_base(volume_index,
+							       buffered_readers,
+							       num_readers);
+}
+
 /**
  * Start saving a volume index to a buffered output stream.
  *
  * @param volume_index     The volume index
  * @param zone_number      The number of the zone to save
  * @param buffered_writer  The index state component being written
+ * @param mode             The kind of save being made
  *
  * @return UDS_SUCCESS on success, or an error code on failure
  **/
 static INLINE int
 start_saving_volume_index(const struct volume_index *volume_index,
 			  unsigned int zone_number,
-			  struct buffered_writer *buffered_writer)
+			  struct buffered_writer *buffered_writer,
+			  enum delta_save_mode mode)
 {
 	return volume_index->start_saving_volume_index(volume_index,
 						       zone_number,
-						       buffered_writer);
+						       buffered_writer,
+						       mode);
 }
 
 #endif /* VOLUMEINDEXOPS_H */
@@ -19,63 +19,715 @@
  * $Id: //eng/uds-releases/krusty/src/uds/volumeStore.c#21 $
  */
 
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "atomicDefs.h"
 #include "geometry.h"
 #include "indexLayout.h"
+#include "ioFactory.h"
+#include "ioRing.h"
 #include "logger.h"
+#include "numeric.h"
 #include "volumeStore.h"
 
+enum {
+	// The most pages moved by one vectored transfer
+	VOLUME_IO_VECTOR_PAGES = 64,
+	// The chapter of a fast tier slot which holds no chapter
+	FAST_TIER_NO_CHAPTER = UINT_MAX,
+	// The size of the magic number of a zoned volume label
+	ZONE_LABEL_MAGIC_SIZE = 8,
+};
+
+static const byte ZONE_LABEL_MAGIC[] = "UDSZONES";
+
+/*
+ * A fast tier holds copies of the newest chapters of the volume, each in the
+ * slot given by its physical chapter number modulo the number of slots. Only
+ * the chapter writer changes the slots; a reader checks the slot before and
+ * after reading from it, so a read which races with the reuse of the slot
+ * goes to the volume instead.
+ */
+struct fast_volume_tier {
+	struct io_region *region;
+	unsigned int chapter_count;
+	unsigned int pages_per_chapter;
+	/* The physical chapter being copied, or FAST_TIER_NO_CHAPTER */
+	unsigned int filling;
+	/* Whether copying the chapter being written has failed */
+	bool failed;
+	/* The physical chapter held by each slot, or FAST_TIER_NO_CHAPTER */
+	unsigned int slots[];
+};
+
+/*
+ * A zoned volume keeps each chapter at the start of a run of whole zones of
+ * its own, so that the chapter can be reset and rewritten without touching
+ * any other. The first zone with a write pointer holds a label which ties
+ * the device to the index, and the chapters follow it. Chapter pages are
+ * written in order by the chapter writer, so plain writes at the write
+ * pointer suffice.
+ */
+struct zoned_volume {
+	struct io_factory *factory;
+	struct io_region *region;
+	size_t zone_size;
+	/* The zone holding the label */
+	unsigned int label_zone;
+	unsigned int zones_per_chapter;
+	unsigned int pages_per_chapter;
+};
+
+/**
+ * Release a zoned volume and its device.
+ *
+ * @param zones  The zoned volume
+ **/
+static void close_zoned_volume(struct zoned_volume *zones)
+{
+	if (zones->region != NULL) {
+		put_io_region(zones->region);
+	}
+	put_uds_io_factory(zones->factory);
+	UDS_FREE(zones);
+}
+
+/**
+ * Get the byte offset in the storage of a volume store of a volume page.
+ * On a zoned volume, any run of pages transferred together must lie within
+ * one chapter.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number
+ *
+ * @return the offset of the page
+ **/
+static off_t get_page_offset(const struct volume_store *volume_store,
+			     unsigned int physical_page)
+{
+	const struct zoned_volume *zones = volume_store->vs_zones;
+	unsigned int page;
+
+	if (zones == NULL) {
+		return (off_t) physical_page * volume_store->vs_bytes_per_page;
+	}
+	if (physical_page == 0) {
+		// The header page is never written; reading it finds the label.
+		return (off_t) zones->label_zone * zones->zone_size;
+	}
+	page = physical_page - 1;
+	return (((off_t) zones->label_zone + 1 +
+		 (off_t) (page / zones->pages_per_chapter) *
+			 zones->zones_per_chapter) * zones->zone_size +
+		(off_t) (page % zones->pages_per_chapter) *
+			volume_store->vs_bytes_per_page);
+}
+
+/**
+ * Get the number of pages at the start of a run of volume pages which lie
+ * next to each other in the storage of a volume store.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number of the first page
+ * @param page_count     The number of pages
+ *
+ * @return the number of pages which can be transferred together
+ **/
+static unsigned int get_contiguous_pages(const struct volume_store *volume_store,
+					 unsigned int physical_page,
+					 unsigned int page_count)
+{
+	const struct zoned_volume *zones = volume_store->vs_zones;
+	unsigned int chapter_end;
+
+	if (zones == NULL) {
+		return page_count;
+	}
+	if (physical_page == 0) {
+		return 1;
+	}
+	chapter_end = (physical_page + zones->pages_per_chapter -
+		       ((physical_page - 1) % zones->pages_per_chapter));
+	return min(page_count, chapter_end - physical_page);
+}
+
+/**
+ * Find the physical chapter of a run of volume pages which a fast tier could
+ * hold.
+ *
+ * @param tier           The fast tier
+ * @param physical_page  The volume page number of the first page
+ * @param page_count     The number of pages
+ *
+ * @return the physical chapter, or FAST_TIER_NO_CHAPTER if the run includes
+ *         the volume header or crosses a chapter boundary
+ **/
+static unsigned int get_tier_chapter(const struct fast_volume_tier *tier,
+				     unsigned int physical_page,
+				     unsigned int page_count)
+{
+	unsigned int chapter;
+
+	if (physical_page == 0) {
+		return FAST_TIER_NO_CHAPTER;
+	}
+	chapter = (physical_page - 1) / tier->pages_per_chapter;
+	if (physical_page - 1 + page_count >
+	    (chapter + 1) * tier->pages_per_chapter) {
+		return FAST_TIER_NO_CHAPTER;
+	}
+	return chapter;
+}
+
+/**
+ * Get the byte offset in a fast tier of a volume page in a chapter it holds.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number
+ *
+ * @return the offset of the copy of the page
+ **/
+static off_t get_tier_offset(const struct volume_store *volume_store,
+			     unsigned int physical_page)
+{
+	const struct fast_volume_tier *tier = volume_store->vs_fast_tier;
+	unsigned int page = physical_page - 1;
+	unsigned int slot = (page / tier->pages_per_chapter) %
+		tier->chapter_count;
+	return (((off_t) slot * tier->pages_per_chapter +
+		 page % tier->pages_per_chapter) *
+		volume_store->vs_bytes_per_page);
+}
+
+/**
+ * Try to read a run of volume pages from the fast tier of a volume store.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number of the first page
+ * @param page_count     The number of pages
+ * @param iov            The buffers to read the pages into
+ * @param iov_count      The number of buffers
+ *
+ * @return true if the tier held the pages and they were read
+ **/
+static bool read_fast_tier_pages(const struct volume_store *volume_store,
+				 unsigned int physical_page,
+				 unsigned int page_count,
+				 const struct iovec *iov,
+				 unsigned int iov_count)
+{
+	struct fast_volume_tier *tier = volume_store->vs_fast_tier;
+	unsigned int chapter, *slot;
+
+	if (tier == NULL) {
+		return false;
+	}
+	chapter = get_tier_chapter(tier, physical_page, page_count);
+	if (chapter == FAST_TIER_NO_CHAPTER) {
+		return false;
+	}
+
+	slot = &tier->slots[chapter % tier->chapter_count];
+	if (READ_ONCE(*slot) != chapter) {
+		return false;
+	}
+	smp_rmb();
+	if (read_vectored_from_region(tier->region,
+				      get_tier_offset(volume_store,
+						      physical_page),
+				      iov, iov_count) != UDS_SUCCESS) {
+		return false;
+	}
+	// The chapter writer may have started reusing the slot meanwhile.
+	smp_rmb();
+	return (READ_ONCE(*slot) == chapter);
+}
+
+/**
+ * Copy a run of volume pages just written to the volume to the fast tier of
+ * the volume store, if they belong to the chapter it is copying. A failed
+ * copy only keeps the tier from serving the chapter.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number of the first page
+ * @param page_count     The number of pages
+ * @param iov            The buffers holding the pages
+ * @param iov_count      The number of buffers
+ **/
+static void write_fast_tier_pages(const struct volume_store *volume_store,
+				  unsigned int physical_page,
+				  unsigned int page_count,
+				  const struct iovec *iov,
+				  unsigned int iov_count)
+{
+	struct fast_volume_tier *tier = volume_store->vs_fast_tier;
+	unsigned int chapter;
+
+	if (tier == NULL) {
+		return;
+	}
+	chapter = get_tier_chapter(tier, physical_page, page_count);
+	if ((chapter == FAST_TIER_NO_CHAPTER) ||
+	    (chapter != READ_ONCE(tier->filling))) {
+		return;
+	}
+
+	if (write_vectored_to_region(tier->region,
+				     get_tier_offset(volume_store,
+						     physical_page),
+				     iov, iov_count) != UDS_SUCCESS) {
+		WRITE_ONCE(tier->failed, true);
+	}
+}
+
+/**********************************************************************/
+int begin_volume_store_chapter(const struct volume_store *volume_store,
+			       unsigned int physical_chapter)
+{
+	struct fast_volume_tier *tier = volume_store->vs_fast_tier;
+	const struct zoned_volume *zones = volume_store->vs_zones;
+
+	if (tier != NULL) {
+		WRITE_ONCE(tier->slots[physical_chapter % tier->chapter_count],
+			   FAST_TIER_NO_CHAPTER);
+		tier->failed = false;
+		// Readers must see the slot emptied before any of its pages
+		// change.
+		smp_mb();
+		WRITE_ONCE(tier->filling, physical_chapter);
+	}
+
+	if (zones == NULL) {
+		return UDS_SUCCESS;
+	}
+	// The chapter being replaced has already expired from the index.
+	return reset_uds_zones(zones->factory,
+			       get_page_offset(volume_store,
+					       1 + (physical_chapter *
+						    zones->pages_per_chapter)),
+			       (size_t) zones->zones_per_chapter *
+				       zones->zone_size);
+}
+
+/**********************************************************************/
+int claim_volume_store_zones(struct volume_store *volume_store,
+			     uint64_t nonce,
+			     bool new_volume)
+{
+	const struct zoned_volume *zones = volume_store->vs_zones;
+	off_t offset;
+	byte *label;
+	int result;
+
+	if (zones == NULL) {
+		return UDS_SUCCESS;
+	}
+
+	result = UDS_ALLOCATE_IO_ALIGNED(UDS_BLOCK_SIZE, byte, __func__,
+					 &label);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	offset = (off_t) zones->label_zone * zones->zone_size;
+	if (new_volume) {
+		memcpy(label, ZONE_LABEL_MAGIC, ZONE_LABEL_MAGIC_SIZE);
+		put_unaligned_le64(nonce, &label[ZONE_LABEL_MAGIC_SIZE]);
+		put_unaligned_le32(zones->pages_per_chapter,
+				   &label[ZONE_LABEL_MAGIC_SIZE +
+					  sizeof(uint64_t)]);
+		put_unaligned_le32(zones->zones_per_chapter,
+				   &label[ZONE_LABEL_MAGIC_SIZE +
+					  sizeof(uint64_t) +
+					  sizeof(uint32_t)]);
+		result = reset_uds_zones(zones->factory, offset,
+					 zones->zone_size);
+		if (result == UDS_SUCCESS) {
+			result = write_to_region(zones->region, offset, label,
+						 UDS_BLOCK_SIZE,
+						 UDS_BLOCK_SIZE);
+		}
+		if (result == UDS_SUCCESS) {
+			result = sync_region_contents(zones->region);
+		}
+		UDS_FREE(label);
+		if (result != UDS_SUCCESS) {
+			return uds_log_error_strerror(result,
+						      "cannot label zoned volume");
+		}
+		return UDS_SUCCESS;
+	}
+
+	result = read_from_region(zones->region, offset, label,
+				  UDS_BLOCK_SIZE, NULL);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(label);
+		return uds_log_error_strerror(result,
+					      "cannot read zoned volume label");
+	}
+	if ((memcmp(label, ZONE_LABEL_MAGIC, ZONE_LABEL_MAGIC_SIZE) != 0) ||
+	    (get_unaligned_le64(&label[ZONE_LABEL_MAGIC_SIZE]) != nonce) ||
+	    (get_unaligned_le32(&label[ZONE_LABEL_MAGIC_SIZE +
+				       sizeof(uint64_t)]) !=
+	     zones->pages_per_chapter) ||
+	    (get_unaligned_le32(&label[ZONE_LABEL_MAGIC_SIZE +
+				       sizeof(uint64_t) +
+				       sizeof(uint32_t)]) !=
+	     zones->zones_per_chapter)) {
+		UDS_FREE(label);
+		return uds_log_error_strerror(UDS_CORRUPT_COMPONENT,
+					      "zoned volume does not hold the chapters of this index");
+	}
+	UDS_FREE(label);
+	return UDS_SUCCESS;
+}
 
 /**********************************************************************/
 void close_volume_store(struct volume_store *volume_store)
 {
+	if (volume_store->vs_mapping.base != NULL) {
+		munmap(volume_store->vs_mapping.base,
+		       volume_store->vs_mapping.length);
+		volume_store->vs_mapping = (struct region_mapping) {
+			.base = NULL,
+		};
+	}
 	if (volume_store->vs_region != NULL) {
 		put_io_region(volume_store->vs_region);
 		volume_store->vs_region = NULL;
 	}
 }
 
+/**********************************************************************/
+void close_volume_store_zones(struct volume_store *volume_store)
+{
+	struct zoned_volume *zones = volume_store->vs_zones;
+
+	if (zones == NULL) {
+		return;
+	}
+	close_zoned_volume(zones);
+	volume_store->vs_zones = NULL;
+}
+
+/**********************************************************************/
+void close_volume_store_tier(struct volume_store *volume_store)
+{
+	struct fast_volume_tier *tier = volume_store->vs_fast_tier;
+
+	if (tier == NULL) {
+		return;
+	}
+	put_io_region(tier->region);
+	UDS_FREE(tier);
+	volume_store->vs_fast_tier = NULL;
+}
+
 /**********************************************************************/
 void destroy_volume_page(struct volume_page *volume_page)
 {
-	UDS_FREE(volume_page->vp_data);
+	UDS_FREE(volume_page->vp_buffer);
+	volume_page->vp_buffer = NULL;
 	volume_page->vp_data = NULL;
 }
 
+/**********************************************************************/
+void finish_volume_store_chapter(const struct volume_store *volume_store,
+				 unsigned int physical_chapter,
+				 bool written)
+{
+	struct fast_volume_tier *tier = volume_store->vs_fast_tier;
+
+	if (tier == NULL) {
+		return;
+	}
+	WRITE_ONCE(tier->filling, FAST_TIER_NO_CHAPTER);
+	if (!written || READ_ONCE(tier->failed)) {
+		return;
+	}
+	// Readers must not see the chapter before its pages.
+	smp_wmb();
+	WRITE_ONCE(tier->slots[physical_chapter % tier->chapter_count],
+		   physical_chapter);
+}
+
 /**********************************************************************/
 int initialize_volume_page(const struct geometry *geometry,
 			   struct volume_page *volume_page)
 {
-	return UDS_ALLOCATE_IO_ALIGNED(geometry->bytes_per_page,
-				       byte, __func__, &volume_page->vp_data);
+	int result = UDS_ALLOCATE_IO_ALIGNED(geometry->bytes_per_page,
+					     byte, __func__,
+					     &volume_page->vp_buffer);
+	volume_page->vp_data = volume_page->vp_buffer;
+	return result;
+}
 
+/**********************************************************************/
+void initialize_volume_page_with_data(struct volume_page *volume_page,
+				      byte *data)
+{
+	volume_page->vp_buffer = data;
+	volume_page->vp_data = data;
 }
 
 /**********************************************************************/
 int open_volume_store(struct volume_store *volume_store,
 		      struct index_layout *layout,
 		      unsigned int reserved_buffers __maybe_unused,
-		      size_t bytes_per_page)
+		      size_t bytes_per_page,
+		      bool direct_io,
+		      bool mapped)
 {
+	int result;
+
 	volume_store->vs_bytes_per_page = bytes_per_page;
-	return open_uds_volume_region(layout, &volume_store->vs_region);
+	volume_store->vs_mapping = (struct region_mapping) {
+		.base = NULL,
+	};
+	if (volume_store->vs_zones != NULL) {
+		// The chapters are on the zoned device, which cannot be mapped.
+		get_io_region(volume_store->vs_zones->region);
+		volume_store->vs_region = volume_store->vs_zones->region;
+		return UDS_SUCCESS;
+	}
+	if (mapped && direct_io) {
+		uds_log_warning("a mapped volume cannot use direct I/O, using buffered I/O for the volume");
+		direct_io = false;
+	}
+
+	result = open_uds_volume_region(layout, direct_io,
+					&volume_store->vs_region);
+	if ((result != UDS_SUCCESS) || !mapped) {
+		return result;
+	}
+
+	if (map_region(volume_store->vs_region,
+		       &volume_store->vs_mapping) != UDS_SUCCESS) {
+		uds_log_warning("index storage cannot be mapped, reading the volume instead");
+		volume_store->vs_mapping = (struct region_mapping) {
+			.base = NULL,
+		};
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int open_volume_store_tier(struct volume_store *volume_store,
+			   const char *path,
+			   unsigned int chapter_count,
+			   unsigned int pages_per_chapter,
+			   bool direct_io)
+{
+	struct fast_volume_tier *tier;
+	struct io_factory *factory;
+	size_t size = ((size_t) chapter_count * pages_per_chapter *
+		       volume_store->vs_bytes_per_page);
+	unsigned int i;
+	int result = UDS_ALLOCATE_EXTENDED(struct fast_volume_tier,
+					   chapter_count,
+					   unsigned int,
+					   "fast volume tier",
+					   &tier);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	tier->chapter_count = chapter_count;
+	tier->pages_per_chapter = pages_per_chapter;
+	tier->filling = FAST_TIER_NO_CHAPTER;
+	for (i = 0; i < chapter_count; i++) {
+		tier->slots[i] = FAST_TIER_NO_CHAPTER;
+	}
+
+	result = make_uds_io_factory(path, FU_CREATE_READ_WRITE, &factory);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(tier);
+		return uds_log_error_strerror(result,
+					      "cannot open fast volume tier %s",
+					      path);
+	}
+	if (get_uds_writable_size(factory) < size) {
+		put_uds_io_factory(factory);
+		UDS_FREE(tier);
+		uds_log_error("fast volume tier %s is smaller than the required size %zu",
+			      path, size);
+		return -ENOSPC;
+	}
+
+	if (direct_io) {
+		result = make_uds_direct_io_region(factory, 0, size,
+						   &tier->region);
+		if (result == EINVAL) {
+			uds_log_warning("fast volume tier does not support direct I/O, using buffered I/O for it");
+			direct_io = false;
+		}
+	}
+	if (!direct_io) {
+		result = make_uds_io_region(factory, 0, size, &tier->region);
+	}
+	put_uds_io_factory(factory);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(tier);
+		return uds_log_error_strerror(result,
+					      "cannot access fast volume tier %s",
+					      path);
+	}
+
+	volume_store->vs_fast_tier = tier;
+	uds_log_info("keeping copies of the newest %u chapters on %s",
+		     chapter_count, path);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int open_volume_store_zones(struct volume_store *volume_store,
+			    const char *path,
+			    unsigned int chapter_count,
+			    unsigned int pages_per_chapter)
+{
+	struct zoned_volume *zones;
+	size_t chapter_size = ((size_t) pages_per_chapter *
+			       volume_store->vs_bytes_per_page);
+	unsigned int zone_count, first_zone, needed;
+	int result = UDS_ALLOCATE(1, struct zoned_volume, "zoned volume",
+				  &zones);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	zones->pages_per_chapter = pages_per_chapter;
+
+	result = make_uds_io_factory(path, FU_READ_WRITE, &zones->factory);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(zones);
+		return uds_log_error_strerror(result,
+					      "cannot open zoned volume %s",
+					      path);
+	}
+	result = get_uds_zones(zones->factory, &zones->zone_size,
+			       &zone_count, &first_zone);
+	if (result != UDS_SUCCESS) {
+		close_zoned_volume(zones);
+		return result;
+	}
+
+	zones->label_zone = first_zone;
+	zones->zones_per_chapter = ((chapter_size + zones->zone_size - 1) /
+				    zones->zone_size);
+	needed = first_zone + 1 + (chapter_count * zones->zones_per_chapter);
+	if (needed > zone_count) {
+		uds_log_error("zoned volume %s has %u zones of %zu bytes, but needs %u",
+			      path, zone_count, zones->zone_size, needed);
+		close_zoned_volume(zones);
+		return -ENOSPC;
+	}
+
+	// Direct I/O keeps the writes in order at the write pointers.
+	result = make_uds_direct_io_region(zones->factory, 0,
+					   (size_t) needed * zones->zone_size,
+					   &zones->region);
+	if (result != UDS_SUCCESS) {
+		close_zoned_volume(zones);
+		return uds_log_error_strerror(result,
+					      "cannot access zoned volume %s with direct I/O",
+					      path);
+	}
+
+	if (volume_store->vs_mapping.base != NULL) {
+		uds_log_warning("a zoned volume cannot be mapped, reading the volume instead");
+		munmap(volume_store->vs_mapping.base,
+		       volume_store->vs_mapping.length);
+		volume_store->vs_mapping = (struct region_mapping) {
+			.base = NULL,
+		};
+	}
+	if (volume_store->vs_region != NULL) {
+		put_io_region(volume_store->vs_region);
+	}
+	get_io_region(zones->region);
+	volume_store->vs_region = zones->region;
+	volume_store->vs_zones = zones;
+	uds_log_info("writing each chapter of %zu bytes to %u zones of %zu bytes on %s",
+		     chapter_size, zones->zones_per_chapter, zones->zone_size,
+		     path);
+	return UDS_SUCCESS;
 }
 
 /**********************************************************************/
-void prefetch_volume_pages(const struct volume_store *vs __maybe_unused,
-			   unsigned int physical_page __maybe_unused,
-			   unsigned int page_count __maybe_unused)
+bool is_volume_store_sequential(const struct volume_store *volume_store)
 {
-	// Nothing to do in user mode
+	return (volume_store->vs_zones != NULL);
+}
+
+/**********************************************************************/
+bool is_volume_page_resident(const struct volume_store *volume_store,
+			     unsigned int physical_page)
+{
+	enum { MAX_VECTOR = 64 };
+	const struct region_mapping *mapping = &volume_store->vs_mapping;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t offset = (size_t) physical_page * volume_store->vs_bytes_per_page;
+	unsigned char vector[MAX_VECTOR];
+	uintptr_t start, end;
+	size_t count, i;
+
+	if ((mapping->base == NULL) ||
+	    (offset + volume_store->vs_bytes_per_page > mapping->size)) {
+		return false;
+	}
+
+	start = (uintptr_t) (mapping->data + offset) &
+		~((uintptr_t) page_size - 1);
+	end = (uintptr_t) (mapping->data + offset +
+			   volume_store->vs_bytes_per_page);
+	count = (end - start + page_size - 1) / page_size;
+	if ((count > MAX_VECTOR) ||
+	    (mincore((void *) start, end - start, vector) != 0)) {
+		return false;
+	}
+
+	for (i = 0; i < count; i++) {
+		if ((vector[i] & 1) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**********************************************************************/
+void prefetch_volume_pages(const struct volume_store *vs,
+			   unsigned int physical_page,
+			   unsigned int page_count)
+{
+	const struct fast_volume_tier *tier = vs->vs_fast_tier;
+
+	if (tier != NULL) {
+		unsigned int chapter = get_tier_chapter(tier, physical_page,
+							page_count);
+		if ((chapter != FAST_TIER_NO_CHAPTER) &&
+		    (READ_ONCE(tier->slots[chapter % tier->chapter_count]) ==
+		     chapter)) {
+			prefetch_region(tier->region,
+					get_tier_offset(vs, physical_page),
+					(size_t) page_count *
+						vs->vs_bytes_per_page);
+			return;
+		}
+	}
+
+	prefetch_region(vs->vs_region,
+			get_page_offset(vs, physical_page),
+			(size_t) page_count * vs->vs_bytes_per_page);
 }
 
 /**********************************************************************/
 int prepare_to_write_volume_page(const struct volume_store *volume_store
 				 __maybe_unused,
 				 unsigned int physical_page __maybe_unused,
-				 struct volume_page *volume_page
-				 __maybe_unused)
+				 struct volume_page *volume_page)
 {
-	// Nothing to do in user mode
+	// The page may be showing a read-only mapping.
+	volume_page->vp_data = volume_page->vp_buffer;
 	return UDS_SUCCESS;
 }
 
@@ -84,11 +736,48 @@ int read_volume_page(const struct volume_store *volume_store,
 		     unsigned int physical_page,
 		     struct volume_page *volume_page)
 {
-	off_t offset = (off_t) physical_page * volume_store->vs_bytes_per_page;
-	int result = read_from_region(volume_store->vs_region,
+	return read_partial_volume_page(volume_store, physical_page,
+					volume_store->vs_bytes_per_page,
+					volume_page);
+}
+
+/**********************************************************************/
+int read_partial_volume_page(const struct volume_store *volume_store,
+			     unsigned int physical_page,
+			     size_t size,
+			     struct volume_page *volume_page)
+{
+	off_t offset = get_page_offset(volume_store, physical_page);
+	int result;
+
+	if (volume_store->vs_fast_tier != NULL) {
+		struct iovec iov = {
+			.iov_base = volume_page->vp_buffer,
+			.iov_len = size,
+		};
+		if (read_fast_tier_pages(volume_store, physical_page, 1,
+					 &iov, 1)) {
+			volume_page->vp_data = volume_page->vp_buffer;
+			return UDS_SUCCESS;
+		}
+	}
+
+	if (volume_store->vs_mapping.base != NULL) {
+		if ((size_t) offset + volume_store->vs_bytes_per_page >
+		    volume_store->vs_mapping.size) {
+			return uds_log_warning_strerror(UDS_OUT_OF_RANGE,
+							"error reading physical page %u",
+							physical_page);
+		}
+		volume_page->vp_data = volume_store->vs_mapping.data + offset;
+		return UDS_SUCCESS;
+	}
+
+	volume_page->vp_data = volume_page->vp_buffer;
+	result = read_from_region(volume_store->vs_region,
 				      offset,
 				      get_page_data(volume_page),
-				      volume_store->vs_bytes_per_page,
+				      size,
 				      NULL);
 	if (result != UDS_SUCCESS) {
 		return uds_log_warning_strerror(result,
@@ -99,9 +788,226 @@ int read_volume_page(const struct volume_store *volume_store,
 }
 
 /**********************************************************************/
-void release_volume_page(struct volume_page *volume_page __maybe_unused)
+int read_volume_pages(const struct volume_store *volume_store,
+		      unsigned int physical_page,
+		      unsigned int page_count,
+		      byte *buffer)
 {
-	// Nothing to do in user mode
+	off_t offset = get_page_offset(volume_store, physical_page);
+	struct iovec iov = {
+		.iov_base = buffer,
+		.iov_len = (size_t) page_count * volume_store->vs_bytes_per_page,
+	};
+	unsigned int contiguous = get_contiguous_pages(volume_store,
+						       physical_page,
+						       page_count);
+	int result;
+
+	if (contiguous < page_count) {
+		result = read_volume_pages(volume_store, physical_page,
+					   contiguous, buffer);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+		return read_volume_pages(volume_store,
+					 physical_page + contiguous,
+					 page_count - contiguous,
+					 buffer + ((size_t) contiguous *
+						   volume_store->vs_bytes_per_page));
+	}
+
+	if (read_fast_tier_pages(volume_store, physical_page, page_count,
+				 &iov, 1)) {
+		return UDS_SUCCESS;
+	}
+
+	result = read_from_region(volume_store->vs_region,
+				  offset,
+				  buffer,
+				  (size_t) page_count *
+					  volume_store->vs_bytes_per_page,
+				  NULL);
+	if (result != UDS_SUCCESS) {
+		return uds_log_warning_strerror(result,
+						"error reading %u physical pages at %u",
+						page_count,
+						physical_page);
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Read the pages of a batch which the store cannot serve from memory or its
+ * fast tier, all at once through an io_ring, and read the rest of them on
+ * the way.
+ *
+ * @param volume_store  The volume store
+ * @param ring          The io_ring of the calling thread
+ * @param reads         The pages to read, at most VOLUME_IO_VECTOR_PAGES
+ * @param count         The number of pages to read
+ **/
+static void read_page_batch_with_ring(const struct volume_store *volume_store,
+				      struct io_ring *ring,
+				      struct volume_page_read reads[],
+				      unsigned int count)
+{
+	struct io_ring_read ring_reads[VOLUME_IO_VECTOR_PAGES];
+	unsigned int pending[VOLUME_IO_VECTOR_PAGES];
+	unsigned int queued = 0, i;
+
+	for (i = 0; i < count; i++) {
+		struct volume_page *volume_page = reads[i].volume_page;
+		struct iovec iov = {
+			.iov_base = volume_page->vp_buffer,
+			.iov_len = volume_store->vs_bytes_per_page,
+		};
+
+		volume_page->vp_data = volume_page->vp_buffer;
+		if (read_fast_tier_pages(volume_store, reads[i].physical_page,
+					 1, &iov, 1)) {
+			reads[i].result = UDS_SUCCESS;
+			continue;
+		}
+
+		ring_reads[queued] = (struct io_ring_read) {
+			.buffer = volume_page->vp_buffer,
+			.size = volume_store->vs_bytes_per_page,
+			.offset = get_page_offset(volume_store,
+						  reads[i].physical_page),
+		};
+		pending[queued++] = i;
+	}
+
+	if (queued == 0) {
+		return;
+	}
+
+	(void) read_batch_from_region(volume_store->vs_region, ring,
+				      ring_reads, queued);
+	for (i = 0; i < queued; i++) {
+		struct volume_page_read *read = &reads[pending[i]];
+
+		read->result = ring_reads[i].result;
+		if (read->result != UDS_SUCCESS) {
+			uds_log_warning_strerror(read->result,
+						 "error reading physical page %u",
+						 read->physical_page);
+		}
+	}
+}
+
+/**********************************************************************/
+int read_volume_page_batch(const struct volume_store *volume_store,
+			   struct io_ring *ring,
+			   struct volume_page_read reads[],
+			   unsigned int count)
+{
+	unsigned int done, i;
+
+	for (done = 0; done < count; done += VOLUME_IO_VECTOR_PAGES) {
+		unsigned int batch = min(count - done,
+					 (unsigned int) VOLUME_IO_VECTOR_PAGES);
+
+		if ((ring != NULL) && (volume_store->vs_mapping.base == NULL)) {
+			read_page_batch_with_ring(volume_store, ring,
+						  &reads[done], batch);
+		} else {
+			for (i = done; i < done + batch; i++) {
+				reads[i].result =
+					read_volume_page(volume_store,
+							 reads[i].physical_page,
+							 reads[i].volume_page);
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (reads[i].result != UDS_SUCCESS) {
+			return reads[i].result;
+		}
+	}
+	return UDS_SUCCESS;
+}
+
+/**
+ * Read or write a run of consecutive volume pages from or to separate page
+ * buffers, moving up to VOLUME_IO_VECTOR_PAGES pages per transfer.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number of the first page
+ * @param page_count     The number of pages
+ * @param volume_pages   The page buffers, one for each page
+ * @param writing        Whether to write the pages rather than read them
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int transfer_volume_page_array(const struct volume_store *volume_store,
+				      unsigned int physical_page,
+				      unsigned int page_count,
+				      struct volume_page volume_pages[],
+				      bool writing)
+{
+	struct iovec iov[VOLUME_IO_VECTOR_PAGES];
+	unsigned int done, i;
+
+	for (done = 0; done < page_count; done += VOLUME_IO_VECTOR_PAGES) {
+		unsigned int count = min(page_count - done,
+					 (unsigned int) VOLUME_IO_VECTOR_PAGES);
+		off_t offset = get_page_offset(volume_store,
+					       physical_page + done);
+		int result;
+		for (i = 0; i < count; i++) {
+			// These pages are always copied into their buffers.
+			volume_pages[done + i].vp_data =
+				volume_pages[done + i].vp_buffer;
+			iov[i] = (struct iovec) {
+				.iov_base = get_page_data(&volume_pages[done + i]),
+				.iov_len = volume_store->vs_bytes_per_page,
+			};
+		}
+
+		if (writing) {
+			result = write_vectored_to_region(volume_store->vs_region,
+							  offset, iov, count);
+			if (result == UDS_SUCCESS) {
+				write_fast_tier_pages(volume_store,
+						      physical_page + done,
+						      count, iov, count);
+			}
+		} else if (read_fast_tier_pages(volume_store,
+						physical_page + done,
+						count, iov, count)) {
+			result = UDS_SUCCESS;
+		} else {
+			result = read_vectored_from_region(volume_store->vs_region,
+							   offset, iov, count);
+		}
+		if (result != UDS_SUCCESS) {
+			return uds_log_warning_strerror(result,
+							"error %s %u physical pages at %u",
+							writing ? "writing" : "reading",
+							count,
+							physical_page + done);
+		}
+	}
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+int read_volume_page_array(const struct volume_store *volume_store,
+			   unsigned int physical_page,
+			   unsigned int page_count,
+			   struct volume_page volume_pages[])
+{
+	return transfer_volume_page_array(volume_store, physical_page,
+					  page_count, volume_pages, false);
+}
+
+/**********************************************************************/
+void release_volume_page(struct volume_page *volume_page)
+{
+	// Drop any view of the store mapping.
+	volume_page->vp_data = volume_page->vp_buffer;
 }
 
 /**********************************************************************/
@@ -129,10 +1035,28 @@ int write_volume_page(const struct volume_store *volume_store,
 		      unsigned int physical_page,
 		      struct volume_page *volume_page)
 {
-	off_t offset = (off_t) physical_page * volume_store->vs_bytes_per_page;
-	return write_to_region(volume_store->vs_region,
-			       offset,
-			       get_page_data(volume_page),
-			       volume_store->vs_bytes_per_page,
-			       volume_store->vs_bytes_per_page);
+	off_t offset = get_page_offset(volume_store, physical_page);
+	struct iovec iov = {
+		.iov_base = get_page_data(volume_page),
+		.iov_len = volume_store->vs_bytes_per_page,
+	};
+	int result = write_to_region(volume_store->vs_region,
+				     offset,
+				     get_page_data(volume_page),
+				     volume_store->vs_bytes_per_page,
+				     volume_store->vs_bytes_per_page);
+	if (result == UDS_SUCCESS) {
+		write_fast_tier_pages(volume_store, physical_page, 1, &iov, 1);
+	}
+	return result;
+}
+
+/**********************************************************************/
+int write_volume_page_array(const struct volume_store *volume_store,
+			    unsigned int physical_page,
+			    unsigned int page_count,
+			    struct volume_page volume_pages[])
+{
+	return transfer_volume_page_array(volume_store, physical_page,
+					  page_count, volume_pages, true);
 }
@@ -28,18 +28,42 @@
 
 #include "ioRegion.h"
 
+struct fast_volume_tier;
 struct geometry;
+struct zoned_volume;
 struct index_layout;
+struct io_ring;
 
 
 struct volume_store {
 	struct io_region *vs_region;
 	size_t vs_bytes_per_page;
+	/* The read-only mapping of the region, if the store is mapped */
+	struct region_mapping vs_mapping;
+	/* The copies of the newest chapters on faster storage, if any */
+	struct fast_volume_tier *vs_fast_tier;
+	/* The zoned block device holding the chapters, if any */
+	struct zoned_volume *vs_zones;
 };
 
 
 struct volume_page {
+	/* The page contents, in vp_buffer or in a store mapping */
 	byte *vp_data;
+	/* The memory owned by the page buffer */
+	byte *vp_buffer;
+};
+
+/**
+ * One page read in a batch given to read_volume_page_batch().
+ **/
+struct volume_page_read {
+	/* The volume page number of the page to read */
+	unsigned int physical_page;
+	/* The page buffer to read it into */
+	struct volume_page *volume_page;
+	/* UDS_SUCCESS or the error of reading the page, once it is read */
+	int result;
 };
 
 /**
@@ -80,18 +104,162 @@ get_page_data(const struct volume_page *volume_page)
 int __must_check initialize_volume_page(const struct geometry *geometry,
 					struct volume_page *volume_page);
 
+/**
+ * Initialize a volume page buffer to use memory which it does not own. A
+ * page initialized this way must not be destroyed with destroy_volume_page().
+ *
+ * @param volume_page  The volume page buffer
+ * @param data         The memory for the page data
+ **/
+void initialize_volume_page_with_data(struct volume_page *volume_page,
+				      byte *data);
+
 /**
  * Open a volume store.
  *
+ * A mapped store maps the volume read-only, and read_volume_page() then
+ * points the page buffer at the page in the mapping rather than copying it.
+ * The page contents must not be written until the buffer has been passed to
+ * prepare_to_write_volume_page(). If the volume cannot be mapped, the store
+ * reads pages into the buffers as usual.
+ *
  * @param volume_store      The volume store
  * @param layout            The index layout
  * @param reserved_buffers  The number of buffers that can be reserved
  * @param bytes_per_page    The number of bytes in a volume page
+ * @param direct_io         Whether to bypass the kernel page cache
+ * @param mapped            Whether to read pages through a memory mapping
  **/
 int __must_check open_volume_store(struct volume_store *volume_store,
 				   struct index_layout *layout,
 				   unsigned int reserved_buffers,
-				   size_t bytes_per_page);
+				   size_t bytes_per_page,
+				   bool direct_io,
+				   bool mapped);
+
+/**
+ * Give a volume store a fast tier, which keeps copies of the most recently
+ * written chapters on faster storage and serves the reads of them. Every
+ * chapter is still written to the volume, so the tier is never saved or
+ * recovered: it starts empty and fills as chapters are written. The tier
+ * survives closing and reopening the store itself.
+ *
+ * @param volume_store       The volume store
+ * @param path               The file or block device to hold the tier
+ * @param chapter_count      The number of chapters the tier holds
+ * @param pages_per_chapter  The number of volume pages in a chapter
+ * @param direct_io          Whether to bypass the kernel page cache
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check open_volume_store_tier(struct volume_store *volume_store,
+					const char *path,
+					unsigned int chapter_count,
+					unsigned int pages_per_chapter,
+					bool direct_io);
+
+/**
+ * Close the fast tier of a volume store, if it has one.
+ *
+ * @param volume_store  The volume store
+ **/
+void close_volume_store_tier(struct volume_store *volume_store);
+
+/**
+ * Keep the chapters of a volume store on a zoned block device rather than
+ * in the volume region of the index. Each chapter is written sequentially
+ * into zones of its own, which are reset just before the chapter is
+ * rewritten. The device replaces the volume region for good, so it must be
+ * given every time the index is opened, and it survives reopening the
+ * store itself. A mapping of the volume region is dropped.
+ *
+ * @param volume_store       The volume store
+ * @param path               The zoned block device
+ * @param chapter_count      The number of chapters in the volume
+ * @param pages_per_chapter  The number of volume pages in a chapter
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check open_volume_store_zones(struct volume_store *volume_store,
+					 const char *path,
+					 unsigned int chapter_count,
+					 unsigned int pages_per_chapter);
+
+/**
+ * Close the zoned block device of a volume store, if it has one. The store
+ * must be closed first.
+ *
+ * @param volume_store  The volume store
+ **/
+void close_volume_store_zones(struct volume_store *volume_store);
+
+/**
+ * Check whether a volume store must write the pages of each chapter in
+ * order, from a single thread.
+ *
+ * @param volume_store  The volume store
+ *
+ * @return true if the store is on a zoned block device
+ **/
+bool __must_check
+is_volume_store_sequential(const struct volume_store *volume_store);
+
+/**
+ * Bind the zoned block device of a volume store to an index, or check that
+ * it belongs to the index being loaded. This does nothing if the store is
+ * not on a zoned block device.
+ *
+ * @param volume_store  The volume store
+ * @param nonce         The nonce of the index volume
+ * @param new_volume    Whether the index is being created
+ *
+ * @return UDS_SUCCESS or an error code, particularly UDS_CORRUPT_COMPONENT
+ *         if the device holds the chapters of some other index
+ **/
+int __must_check claim_volume_store_zones(struct volume_store *volume_store,
+					  uint64_t nonce,
+					  bool new_volume);
+
+/**
+ * Note that a chapter is about to be written to a volume store, so that the
+ * fast tier stops serving the chapter its pages will replace, and copies the
+ * pages of the new chapter as they are written. On a zoned block device,
+ * the zones of the chapter are reset. Only the thread writing chapters may
+ * call this.
+ *
+ * @param volume_store      The volume store
+ * @param physical_chapter  The physical chapter about to be written
+ *
+ * @return UDS_SUCCESS or an error code if the chapter cannot be written
+ **/
+int __must_check
+begin_volume_store_chapter(const struct volume_store *volume_store,
+			   unsigned int physical_chapter);
+
+/**
+ * Note that all the pages of a chapter have been written to a volume store,
+ * so that the fast tier can serve the chapter if it copied every page.
+ *
+ * @param volume_store      The volume store
+ * @param physical_chapter  The physical chapter which was written
+ * @param written           Whether every page was written successfully
+ **/
+void finish_volume_store_chapter(const struct volume_store *volume_store,
+				 unsigned int physical_chapter,
+				 bool written);
+
+/**
+ * Check whether a volume page is in memory, so that reading it from a
+ * mapped store will not block.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number
+ *
+ * @return <code>true</code> if the store is mapped and the page is resident
+ **/
+bool __must_check
+is_volume_page_resident(const struct volume_store *volume_store,
+			unsigned int physical_page);
 
 /**
  * Prefetch volume pages into memory.
@@ -131,6 +299,75 @@ int __must_check read_volume_page(const struct volume_store *volume_store,
 				  unsigned int physical_page,
 				  struct volume_page *volume_page);
 
+/**
+ * Read the leading part of a page from a volume store. The rest of the page
+ * buffer is left as it was, unless the store is mapped.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number of the desired page
+ * @param size           The number of bytes to read, a multiple of
+ *                       UDS_BLOCK_SIZE no larger than a page
+ * @param volume_page    The volume page buffer
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check
+read_partial_volume_page(const struct volume_store *volume_store,
+			 unsigned int physical_page,
+			 size_t size,
+			 struct volume_page *volume_page);
+
+/**
+ * Read a run of consecutive pages from a volume store into a buffer.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number of the first page to read
+ * @param page_count     The number of pages to read
+ * @param buffer         An I/O aligned buffer to hold the pages
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check read_volume_pages(const struct volume_store *volume_store,
+				   unsigned int physical_page,
+				   unsigned int page_count,
+				   byte *buffer);
+
+/**
+ * Read a batch of pages, which need not be consecutive, from a volume store
+ * into separate page buffers. The pages which must be read from storage are
+ * all read at once through an io_ring. Pages which the store maps, or which
+ * its fast tier holds, are read as by read_volume_page(), and so is every
+ * page if there is no ring.
+ *
+ * @param volume_store  The volume store
+ * @param ring          The io_ring of the calling thread, or NULL
+ * @param reads         The pages to read, and the result of each
+ * @param count         The number of pages to read
+ *
+ * @return UDS_SUCCESS or the first error of any page
+ **/
+int read_volume_page_batch(const struct volume_store *volume_store,
+			   struct io_ring *ring,
+			   struct volume_page_read reads[],
+			   unsigned int count);
+
+/**
+ * Read a run of consecutive pages from a volume store into separate page
+ * buffers, with as few transfers as possible.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number of the first page to read
+ * @param page_count     The number of pages to read
+ * @param volume_pages   The page buffers, one for each page
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check
+read_volume_page_array(const struct volume_store *volume_store,
+		       unsigned int physical_page,
+		       unsigned int page_count,
+		       struct volume_page volume_pages[]);
+
 /**
  * Release a volume page buffer, because it will no longer be accessed before a
  * call to read_volume_page or prepare_to_write_volume_page.
@@ -171,4 +408,21 @@ int __must_check write_volume_page(const struct volume_store *volume_store,
 				   unsigned int physical_page,
 				   struct volume_page *volume_page);
 
+/**
+ * Write a run of consecutive pages to a volume store from separate page
+ * buffers, with as few transfers as possible.
+ *
+ * @param volume_store   The volume store
+ * @param physical_page  The volume page number of the first page to write
+ * @param page_count     The number of pages to write
+ * @param volume_pages   The page buffers, one for each page
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int __must_check
+write_volume_page_array(const struct volume_store *volume_store,
+			unsigned int physical_page,
+			unsigned int page_count,
+			struct volume_page volume_pages[]);
+
 #endif /* VOLUME_STORE_H */
@@ -0,0 +1,188 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/warmList.c#1 $
+ */
+
+#include "warmList.h"
+
+#include "compiler.h"
+#include "indexLayout.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "volume.h"
+
+static int read_warm_list(struct read_portal *portal);
+static int write_warm_list(struct index_component *component,
+			   struct buffered_writer *writer,
+			   unsigned int zone);
+
+const struct index_component_info WARM_LIST_INFO = {
+	.kind = RL_KIND_WARM_LIST,
+	.name = "page cache warm list",
+	.save_only = true,
+	.chapter_sync = false,
+	.multi_zone = false,
+	.io_storage = true,
+	.optional = true,
+	.loader = read_warm_list,
+	.saver = write_warm_list,
+	.incremental = NULL,
+};
+
+static const byte WARM_LIST_MAGIC[] = "ALBWL";
+static const byte WARM_LIST_VERSION[] = "01.00";
+
+enum {
+	WARM_LIST_MAGIC_LENGTH = sizeof(WARM_LIST_MAGIC) - 1,
+	WARM_LIST_VERSION_LENGTH = sizeof(WARM_LIST_VERSION) - 1,
+	WARM_LIST_HEADER_LENGTH = (WARM_LIST_MAGIC_LENGTH +
+				   WARM_LIST_VERSION_LENGTH +
+				   sizeof(uint32_t)),
+	MAX_WARM_PAGES = ((WARM_LIST_BLOCKS * UDS_BLOCK_SIZE -
+			   WARM_LIST_HEADER_LENGTH) / sizeof(uint32_t)),
+};
+
+/**********************************************************************/
+static int write_warm_list(struct index_component *component,
+			   struct buffered_writer *writer,
+			   unsigned int zone)
+{
+	struct volume *volume = index_component_data(component);
+	byte header[WARM_LIST_HEADER_LENGTH];
+	unsigned int *pages;
+	unsigned int count, i;
+	int result = ASSERT((zone == 0), "warm list write not zoned");
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// An older save layout has no room for the list.
+	if (writer == NULL) {
+		return UDS_SUCCESS;
+	}
+
+	result = UDS_ALLOCATE(MAX_WARM_PAGES, unsigned int, "warm list",
+			      &pages);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	uds_lock_mutex(&volume->read_threads_mutex);
+	count = list_cached_pages(volume->page_cache, pages, MAX_WARM_PAGES);
+	uds_unlock_mutex(&volume->read_threads_mutex);
+
+	memcpy(header, WARM_LIST_MAGIC, WARM_LIST_MAGIC_LENGTH);
+	memcpy(header + WARM_LIST_MAGIC_LENGTH, WARM_LIST_VERSION,
+	       WARM_LIST_VERSION_LENGTH);
+	put_unaligned_le32(count,
+			   header + WARM_LIST_MAGIC_LENGTH +
+				   WARM_LIST_VERSION_LENGTH);
+	result = write_to_buffered_writer(writer, header, sizeof(header));
+	for (i = 0; (result == UDS_SUCCESS) && (i < count); i++) {
+		byte page[sizeof(uint32_t)];
+		put_unaligned_le32(pages[i], page);
+		result = write_to_buffered_writer(writer, page, sizeof(page));
+	}
+	UDS_FREE(pages);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+	return flush_buffered_writer(writer);
+}
+
+/**
+ * Read the warm list from a buffered reader.
+ *
+ * @param volume  the volume which will load the listed pages
+ * @param reader  the reader
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+static int load_warm_list(struct volume *volume,
+			  struct buffered_reader *reader)
+{
+	byte header[WARM_LIST_HEADER_LENGTH];
+	unsigned int *pages;
+	unsigned int count, i;
+	int result = read_from_buffered_reader(reader, header, sizeof(header));
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	if ((memcmp(header, WARM_LIST_MAGIC, WARM_LIST_MAGIC_LENGTH) != 0) ||
+	    (memcmp(header + WARM_LIST_MAGIC_LENGTH, WARM_LIST_VERSION,
+		    WARM_LIST_VERSION_LENGTH) != 0)) {
+		return UDS_CORRUPT_COMPONENT;
+	}
+
+	count = get_unaligned_le32(header + WARM_LIST_MAGIC_LENGTH +
+				   WARM_LIST_VERSION_LENGTH);
+	if ((count == 0) || (count > MAX_WARM_PAGES)) {
+		return ((count == 0) ? UDS_SUCCESS : UDS_CORRUPT_COMPONENT);
+	}
+
+	result = UDS_ALLOCATE(count, unsigned int, "warm list", &pages);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	for (i = 0; i < count; i++) {
+		byte page[sizeof(uint32_t)];
+		result = read_from_buffered_reader(reader, page, sizeof(page));
+		if (result != UDS_SUCCESS) {
+			UDS_FREE(pages);
+			return result;
+		}
+		pages[i] = get_unaligned_le32(page);
+		// Physical page zero is the volume header.
+		if ((pages[i] == 0) ||
+		    (pages[i] > volume->geometry->pages_per_volume)) {
+			UDS_FREE(pages);
+			return UDS_CORRUPT_COMPONENT;
+		}
+	}
+
+	set_volume_warm_list(volume, pages, count);
+	return UDS_SUCCESS;
+}
+
+/**********************************************************************/
+static int read_warm_list(struct read_portal *portal)
+{
+	struct volume *volume = index_component_data(portal->component);
+	struct buffered_reader *reader;
+	int result = get_buffered_reader_for_portal(portal, 0, &reader);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	// Older saves, and saves with too many zones, have no warm list.
+	if (reader == NULL) {
+		return UDS_SUCCESS;
+	}
+
+	// The list is only a hint, so a bad one must not fail the load.
+	result = load_warm_list(volume, reader);
+	if (result != UDS_SUCCESS) {
+		uds_log_warning_strerror(result,
+					 "ignoring unreadable page cache warm list");
+	}
+	return UDS_SUCCESS;
+}
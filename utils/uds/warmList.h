@@ -0,0 +1,42 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/uds-releases/krusty/src/uds/warmList.h#1 $
+ */
+
+#ifndef WARM_LIST_H
+#define WARM_LIST_H 1
+
+#include "indexComponent.h"
+
+/*
+ * The warm list is the list of pages which were in the page cache when the
+ * index was saved, most recently used first. It is saved as a small
+ * optional component of a full save, and when the index is loaded again the
+ * volume reads the listed pages back into the page cache in the background,
+ * so that the hit rate recovers without waiting for each page to be missed.
+ */
+
+enum {
+	// The number of blocks of a save reserved for the warm list
+	WARM_LIST_BLOCKS = 8,
+};
+
+extern const struct index_component_info WARM_LIST_INFO;
+
+#endif // WARM_LIST_H
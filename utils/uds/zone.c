@@ -22,15 +22,55 @@
 #include "zone.h"
 
 #include "logger.h"
+#include "threadAffinity.h"
 #include "uds-threads.h"
 
+/**
+ * Choose a zone count for UDS_ZONE_COUNT_AUTO. The CPUs this process may
+ * use are divided evenly among its open indexes, and each index takes three
+ * quarters of its share for zones, leaving the rest for the callback,
+ * reader and chapter writer threads. On a NUMA host with more than one zone
+ * per node, the count is rounded down to a multiple of the node count so
+ * that a spread placement puts the same number of zones on every node.
+ *
+ * @param other_indexes  the number of other open indexes in the process
+ *
+ * @return the zone count, before it is limited to MAX_ZONES
+ **/
+static unsigned int tune_zone_count(unsigned int other_indexes)
+{
+	struct cpu_budget budget;
+	unsigned int cpus, share, zone_count;
+
+	get_cpu_budget(&budget);
+	cpus = budget.cpus;
+	if ((budget.quota_cpus > 0) && (budget.quota_cpus < cpus)) {
+		cpus = budget.quota_cpus;
+	}
+
+	share = cpus / (other_indexes + 1);
+	zone_count = (share * 3) / 4;
+	if ((budget.node_count > 1) && (zone_count >= 2 * budget.node_count)) {
+		zone_count -= zone_count % budget.node_count;
+	}
+
+	uds_log_debug("%u usable CPUs on %u nodes shared by %u indexes",
+		      cpus, budget.node_count, other_indexes + 1);
+	return zone_count;
+}
+
 /**********************************************************************/
-unsigned int get_zone_count(const struct uds_parameters *user_params)
+unsigned int get_zone_count(const struct uds_parameters *user_params,
+			    unsigned int other_indexes)
 {
-	unsigned int zone_count =
-		(user_params == NULL) ? 0 : user_params->zone_count;
-	if (zone_count == 0) {
+	int requested = (user_params == NULL) ? 0 : user_params->zone_count;
+	unsigned int zone_count;
+	if (requested == UDS_ZONE_COUNT_AUTO) {
+		zone_count = tune_zone_count(other_indexes);
+	} else if (requested <= 0) {
 		zone_count = uds_get_num_cores() / 2;
+	} else {
+		zone_count = requested;
 	}
 	if (zone_count < 1) {
 		zone_count = 1;
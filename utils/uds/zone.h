@@ -32,12 +32,15 @@ enum {
 /**
  * Return the number of zones.
  *
- * @param user_params  the index session parameters.  If NULL, the default
- *                     session parameters will be used.
+ * @param user_params    the index session parameters.  If NULL, the default
+ *                       session parameters will be used.
+ * @param other_indexes  the number of other indexes open in this process,
+ *                       which share the CPUs in UDS_ZONE_COUNT_AUTO mode
  *
  * @return the number of zones
  **/
 unsigned int __must_check
-get_zone_count(const struct uds_parameters *user_params);
+get_zone_count(const struct uds_parameters *user_params,
+	       unsigned int other_indexes);
 
 #endif /* ZONE_H */
@@ -82,3 +82,33 @@ validate_vdo_block_map_page(struct block_map_page *page,
 
 	return VDO_BLOCK_MAP_PAGE_VALID;
 }
+
+/**********************************************************************/
+void validate_vdo_block_map_pages(const char *pages,
+				  const physical_block_number_t *pbns,
+				  size_t count,
+				  nonce_t nonce,
+				  uint8_t *validities)
+{
+	struct packed_version_number expected =
+		pack_vdo_version_number(BLOCK_MAP_4_1);
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		const struct block_map_page *page =
+			(const struct block_map_page *) (pages +
+							 (i * VDO_BLOCK_SIZE));
+		bool usable =
+			((page->version.major_version ==
+			  expected.major_version) &
+			 (page->version.minor_version ==
+			  expected.minor_version) &
+			 (page->header.initialized != 0) &
+			 (__le64_to_cpu(page->header.nonce) == nonce));
+		bool right = (__le64_to_cpu(page->header.pbn) == pbns[i]);
+
+		validities[i] = (!usable ? VDO_BLOCK_MAP_PAGE_INVALID
+				 : (right ? VDO_BLOCK_MAP_PAGE_VALID
+				    : VDO_BLOCK_MAP_PAGE_BAD));
+	}
+}
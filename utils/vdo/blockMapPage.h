@@ -168,4 +168,22 @@ validate_vdo_block_map_page(struct block_map_page *page,
 			     nonce_t nonce,
 			     physical_block_number_t pbn);
 
+/**
+ * Check the headers of a batch of pages which have been read together,
+ * reaching the same verdict as validate_vdo_block_map_page() for each. The
+ * pages are not modified. The headers are compared with plain loads and no
+ * branches, so that the checks of the whole batch can be vectorized.
+ *
+ * @param [in]  pages       The pages, each VDO_BLOCK_SIZE bytes apart
+ * @param [in]  pbns        The expected absolute PBN of each page
+ * @param [in]  count       The number of pages
+ * @param [in]  nonce       The VDO nonce
+ * @param [out] validities  The block_map_page_validity of each page
+ **/
+void validate_vdo_block_map_pages(const char *pages,
+				  const physical_block_number_t *pbns,
+				  size_t count,
+				  nonce_t nonce,
+				  uint8_t *validities);
+
 #endif // BLOCK_MAP_PAGE_H
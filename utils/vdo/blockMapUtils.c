@@ -22,9 +22,14 @@
 #include "blockMapUtils.h"
 
 #include <err.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "syscalls.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
+#include "uds-threads.h"
+#include "udsProbes.h"
 
 #include "blockMapFormat.h"
 #include "blockMapPage.h"
@@ -34,6 +39,97 @@
 
 #include "userVDO.h"
 
+enum {
+  /** The number of block map pages read at once by a walk by height */
+  PAGE_BATCH_SIZE = 1024,
+};
+
+/**
+ * A growable list of the PBNs of block map pages.
+ **/
+typedef struct {
+  physical_block_number_t *pbns;
+  size_t                   count;
+  size_t                   capacity;
+} PageList;
+
+/**
+ * The examiner used by a walk by height, and the context to pass to it.
+ * Exactly one of examine and examinePage is set.
+ **/
+typedef struct {
+  ParallelMappingExaminer *examine;
+  ParallelPageExaminer    *examinePage;
+  BadPageReporter         *reportBadPage;
+  void                    *context;
+} TreeExaminer;
+
+/**
+ * The buffers used by a walk of the block map. They are allocated once when
+ * the walk starts so that nothing is allocated or freed for each page.
+ **/
+typedef struct {
+  /** One page buffer for each height of a depth-first walk */
+  char                *pages;
+  /** One decoded page for each height */
+  DecodedBlockMapPage *decoded;
+  /** A buffer for PAGE_BATCH_SIZE pages, for a walk by height */
+  char                *batch;
+  /** The pages at the height being walked, for a walk by height */
+  PageList             current;
+  /** The pages at the next height down, for a walk by height */
+  PageList             children;
+} WalkArena;
+
+/**
+ * Allocate the buffers for a walk of the block map.
+ *
+ * @param layer     The layer from which the pages will be read
+ * @param byHeight  Whether the walk will be by height rather than depth first
+ * @param arena     The arena to set up
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int makeWalkArena(PhysicalLayer *layer, bool byHeight, WalkArena *arena)
+{
+  *arena = (WalkArena) {
+    .pages = NULL,
+  };
+  int result = layer->allocateIOBuffer(layer,
+                                       (VDO_BLOCK_MAP_TREE_HEIGHT
+                                        * VDO_BLOCK_SIZE),
+                                       "block map page arena", &arena->pages);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = UDS_ALLOCATE(VDO_BLOCK_MAP_TREE_HEIGHT, DecodedBlockMapPage,
+                        "decoded block map pages", &arena->decoded);
+  if ((result != VDO_SUCCESS) || !byHeight) {
+    return result;
+  }
+
+  return layer->allocateIOBuffer(layer, PAGE_BATCH_SIZE * VDO_BLOCK_SIZE,
+                                 "block map page batch", &arena->batch);
+}
+
+/**
+ * Free the buffers of a walk of the block map.
+ *
+ * @param arena  The arena to free
+ **/
+static void freeWalkArena(WalkArena *arena)
+{
+  UDS_FREE(arena->pages);
+  UDS_FREE(arena->decoded);
+  UDS_FREE(arena->batch);
+  UDS_FREE(arena->current.pbns);
+  UDS_FREE(arena->children.pbns);
+  *arena = (WalkArena) {
+    .pages = NULL,
+  };
+}
+
 /**
  * Read a block map page call the examiner on every defined mapping in it.
  * Also recursively call itself to examine an entire tree.
@@ -42,29 +138,26 @@
  * @param pagePBN   The PBN of the block map page to read
  * @param height    The height of this page in the tree
  * @param examiner  The MappingExaminer to call for each mapped entry
+ * @param arena     The buffers for the walk
  *
  * @return VDO_SUCCESS or an error
  **/
 static int readAndExaminePage(UserVDO                 *vdo,
                               physical_block_number_t  pagePBN,
                               height_t                 height,
-                              MappingExaminer         *examiner)
+                              MappingExaminer         *examiner,
+                              WalkArena               *arena)
 {
-  struct block_map_page *page;
-  int result = vdo->layer->allocateIOBuffer(vdo->layer, VDO_BLOCK_SIZE,
-                                            "block map page", (char **) &page);
-  if (result != VDO_SUCCESS) {
-    return result;
-  }
-
-  result = readBlockMapPage(vdo->layer, pagePBN, vdo->states.vdo.nonce, page);
+  struct block_map_page *page
+    = (struct block_map_page *) (arena->pages + (height * VDO_BLOCK_SIZE));
+  USDT_PROBE2(vdo, block_map_page, pagePBN, height);
+  int result = readBlockMapPage(vdo->layer, pagePBN, vdo->states.vdo.nonce,
+                                page);
   if (result != VDO_SUCCESS) {
-    UDS_FREE(page);
     return result;
   }
 
   if (!is_vdo_block_map_page_initialized(page)) {
-    UDS_FREE(page);
     return VDO_SUCCESS;
   }
 
@@ -79,7 +172,6 @@ static int readAndExaminePage(UserVDO                 *vdo,
 
     result = examiner(blockMapSlot, height, mapped.pbn, mapped.state);
     if (result != VDO_SUCCESS) {
-      UDS_FREE(page);
       return result;
     }
 
@@ -88,15 +180,14 @@ static int readAndExaminePage(UserVDO                 *vdo,
     }
 
     if ((height > 0) && isValidDataBlock(vdo, mapped.pbn)) {
-      result = readAndExaminePage(vdo, mapped.pbn, height - 1, examiner);
+      result = readAndExaminePage(vdo, mapped.pbn, height - 1, examiner,
+                                  arena);
       if (result != VDO_SUCCESS) {
-        UDS_FREE(page);
         return result;
       }
     }
   }
 
-  UDS_FREE(page);
   return VDO_SUCCESS;
 }
 
@@ -116,146 +207,199 @@ int examineBlockMapEntries(UserVDO *vdo, MappingExaminer *examiner)
     return result;
   }
 
+  WalkArena arena;
+  result = makeWalkArena(vdo->layer, false, &arena);
+  if (result != VDO_SUCCESS) {
+    freeWalkArena(&arena);
+    return result;
+  }
+
   height_t height = VDO_BLOCK_MAP_TREE_HEIGHT - 1;
-  for (uint8_t rootIndex = 0; rootIndex < map->root_count; rootIndex++) {
+  for (uint8_t rootIndex = 0;
+       (result == VDO_SUCCESS) && (rootIndex < map->root_count);
+       rootIndex++) {
     result = readAndExaminePage(vdo, rootIndex + map->root_origin, height,
-                                examiner);
-    if (result != VDO_SUCCESS) {
-      return result;
-    }
+                                examiner, &arena);
   }
 
-  return VDO_SUCCESS;
+  freeWalkArena(&arena);
+  return result;
 }
 
 /**
- * Find and decode a particular slot from a block map page.
+ * Check that the block map of a VDO has roots.
  *
- * @param vdo           The VDO
- * @param pbn           The PBN of the block map page to read
- * @param slot          The slot to read from the block map page
- * @param mappedPBNPtr  A pointer to the mapped PBN
- * @param mappedPtr     A pointer to the mapped state
+ * @param map  The block map state
  *
  * @return VDO_SUCCESS or an error
  **/
-static int readSlotFromPage(UserVDO                  *vdo,
-                            physical_block_number_t   pbn,
-                            slot_number_t             slot,
-                            physical_block_number_t  *mappedPBNPtr,
-                            enum block_mapping_state *mappedStatePtr)
+static int checkRoots(const struct block_map_state_2_0 *map)
 {
-  struct block_map_page *page;
-  int result = vdo->layer->allocateIOBuffer(vdo->layer, VDO_BLOCK_SIZE,
-                                            "page buffer", (char **) &page);
+  int result = ASSERT((map->root_origin != 0),
+                      "block map root origin must be non-zero");
   if (result != VDO_SUCCESS) {
     return result;
   }
 
-  result = readBlockMapPage(vdo->layer, pbn, vdo->states.vdo.nonce, page);
-  if (result != VDO_SUCCESS) {
-    UDS_FREE(page);
-    return result;
-  }
+  return ASSERT((map->root_count != 0),
+                "block map root count must be non-zero");
+}
 
-  struct data_location mapped;
-  if (is_vdo_block_map_page_initialized(page)) {
-    mapped = unpack_vdo_block_map_entry(&page->entries[slot]);
-  } else {
-    mapped = (struct data_location) {
-      .state = VDO_MAPPING_STATE_UNMAPPED,
-      .pbn   = VDO_ZERO_BLOCK,
-    };
-  }
+/**********************************************************************/
+void decodeBlockMapPage(const struct block_map_page *page,
+                        physical_block_number_t      pbn,
+                        DecodedBlockMapPage         *decoded)
+{
+  STATIC_ASSERT(sizeof(struct block_map_entry) == 5);
 
-  *mappedStatePtr = mapped.state;
-  *mappedPBNPtr   = mapped.pbn;
+  // Decode the packed entries with plain byte loads and no branches so that
+  // the compiler can vectorize the loop.
+  const byte *entry   = (const byte *) page->entries;
+  uint32_t    anyBits = 0;
+  for (unsigned int slot = 0; slot < VDO_BLOCK_MAP_ENTRIES_PER_PAGE; slot++) {
+    byte     first = entry[0];
+    uint32_t low   = get_unaligned_le32(entry + 1);
+    decoded->pbns[slot]
+      = ((((physical_block_number_t) (first >> 4)) << 32) | low);
+    decoded->states[slot] = (first & 0x0F);
+    anyBits |= (first | low);
+    entry   += sizeof(struct block_map_entry);
+  }
 
-  UDS_FREE(page);
-  return VDO_SUCCESS;
+  decoded->pagePBN     = pbn;
+  decoded->allUnmapped = (anyBits == 0);
 }
 
-/**********************************************************************/
-int findLBNPage(UserVDO                 *vdo,
-                logical_block_number_t   lbn,
-                physical_block_number_t *pbnPtr)
+/**
+ * Read a block map page and call the examiner on the whole page. Then
+ * recursively call itself on each of the page's children.
+ *
+ * @param vdo       The VDO
+ * @param pagePBN   The PBN of the block map page to read
+ * @param height    The height of this page in the tree
+ * @param examiner  The PageExaminer to call for each page
+ * @param arena     The buffers for the walk
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int readAndExamineWholePage(UserVDO                 *vdo,
+                                   physical_block_number_t  pagePBN,
+                                   height_t                 height,
+                                   PageExaminer            *examiner,
+                                   WalkArena               *arena)
 {
-  if (lbn >= vdo->states.vdo.config.logical_blocks) {
-    warnx("VDO has only %llu logical blocks, cannot dump mapping for LBA %llu",
-          (unsigned long long) vdo->states.vdo.config.logical_blocks,
-          (unsigned long long) lbn);
-    return VDO_OUT_OF_RANGE;
+  struct block_map_page *page
+    = (struct block_map_page *) (arena->pages + (height * VDO_BLOCK_SIZE));
+  USDT_PROBE2(vdo, block_map_page, pagePBN, height);
+  int result = readBlockMapPage(vdo->layer, pagePBN, vdo->states.vdo.nonce,
+                                page);
+  if ((result != VDO_SUCCESS) || !is_vdo_block_map_page_initialized(page)) {
+    return result;
   }
 
-  struct block_map_state_2_0 *map = &vdo->states.block_map;
-  page_number_t pageNumber = lbn / VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
-
-  // It's in the tree section of the block map.
-  slot_number_t slots[VDO_BLOCK_MAP_TREE_HEIGHT];
-  slots[0] = lbn % VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
-  root_count_t rootIndex = pageNumber % map->root_count;
-  pageNumber = pageNumber / map->root_count;
-  for (int i = 1; i < VDO_BLOCK_MAP_TREE_HEIGHT; i++) {
-    slots[i] = pageNumber % VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
-    pageNumber /= VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+  DecodedBlockMapPage *decoded = &arena->decoded[height];
+  decodeBlockMapPage(page, pagePBN, decoded);
+  result = examiner(decoded, height);
+  if ((result != VDO_SUCCESS) || (height == 0) || decoded->allUnmapped) {
+    return result;
   }
 
-  physical_block_number_t pbn = map->root_origin + rootIndex;
-  for (int i = VDO_BLOCK_MAP_TREE_HEIGHT - 1; i > 0; i--) {
-    enum block_mapping_state state;
-    int result = readSlotFromPage(vdo, pbn, slots[i], &pbn, &state);
-    if ((result != VDO_SUCCESS) || (pbn == VDO_ZERO_BLOCK)
-        || (state == VDO_MAPPING_STATE_UNMAPPED)) {
-      *pbnPtr = VDO_ZERO_BLOCK;
+  for (unsigned int slot = 0; slot < VDO_BLOCK_MAP_ENTRIES_PER_PAGE; slot++) {
+    if ((decoded->states[slot] == VDO_MAPPING_STATE_UNMAPPED)
+        || !isValidDataBlock(vdo, decoded->pbns[slot])) {
+      continue;
+    }
+
+    result = readAndExamineWholePage(vdo, decoded->pbns[slot], height - 1,
+                                     examiner, arena);
+    if (result != VDO_SUCCESS) {
       return result;
     }
   }
 
-  *pbnPtr = pbn;
   return VDO_SUCCESS;
 }
 
 /**********************************************************************/
-int findLBNMapping(UserVDO                  *vdo,
-                   logical_block_number_t    lbn,
-                   physical_block_number_t  *pbnPtr,
-                   enum block_mapping_state *statePtr)
+int examineBlockMapPages(UserVDO *vdo, PageExaminer *examiner)
 {
-  physical_block_number_t pagePBN;
-  int result = findLBNPage(vdo, lbn, &pagePBN);
+  struct block_map_state_2_0 *map = &vdo->states.block_map;
+  int result = checkRoots(map);
   if (result != VDO_SUCCESS) {
     return result;
   }
 
-  if (pagePBN == VDO_ZERO_BLOCK) {
-    *pbnPtr   = VDO_ZERO_BLOCK;
-    *statePtr = VDO_MAPPING_STATE_UNMAPPED;
-    return VDO_SUCCESS;
+  WalkArena arena;
+  result = makeWalkArena(vdo->layer, false, &arena);
+  if (result != VDO_SUCCESS) {
+    freeWalkArena(&arena);
+    return result;
   }
 
-  slot_number_t slot = lbn % VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
-  return readSlotFromPage(vdo, pagePBN, slot, pbnPtr, statePtr);
+  height_t height = VDO_BLOCK_MAP_TREE_HEIGHT - 1;
+  for (uint8_t rootIndex = 0;
+       (result == VDO_SUCCESS) && (rootIndex < map->root_count);
+       rootIndex++) {
+    result = readAndExamineWholePage(vdo, rootIndex + map->root_origin,
+                                     height, examiner, &arena);
+  }
+
+  freeWalkArena(&arena);
+  return result;
 }
 
-/**********************************************************************/
-int readBlockMapPage(PhysicalLayer            *layer,
-                     physical_block_number_t   pbn,
-                     nonce_t                   nonce,
-                     struct block_map_page    *page)
+/**
+ * Add a page to a PageList, growing it if necessary.
+ *
+ * @param list  The list
+ * @param pbn   The PBN of the page to add
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int addPage(PageList *list, physical_block_number_t pbn)
 {
-  int result = layer->reader(layer, pbn, 1, (char *) page);
-  if (result != VDO_SUCCESS) {
-    char errBuf[ERRBUF_SIZE];
-    printf("%llu unreadable : %s",
-           (unsigned long long) pbn,
-           uds_string_error(result, errBuf, ERRBUF_SIZE));
-    return result;
+  if (list->count == list->capacity) {
+    size_t capacity = max(list->capacity * 2, (size_t) PAGE_BATCH_SIZE);
+    int result = uds_reallocate_memory(list->pbns,
+                                       (list->capacity
+                                        * sizeof(physical_block_number_t)),
+                                       capacity * sizeof(physical_block_number_t),
+                                       "block map page list", &list->pbns);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    list->capacity = capacity;
   }
 
+  list->pbns[list->count++] = pbn;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+static int comparePBNs(const void *a, const void *b)
+{
+  physical_block_number_t pbnA = *((const physical_block_number_t *) a);
+  physical_block_number_t pbnB = *((const physical_block_number_t *) b);
+  return ((pbnA < pbnB) ? -1 : ((pbnA > pbnB) ? 1 : 0));
+}
+
+/**
+ * Check a block map page which has been read, marking it uninitialized if
+ * it is not valid.
+ *
+ * @param page   The page
+ * @param nonce  The VDO nonce
+ * @param pbn    The PBN from which the page was read
+ **/
+static void validatePage(struct block_map_page   *page,
+                         nonce_t                  nonce,
+                         physical_block_number_t  pbn)
+{
   enum block_map_page_validity validity
     = validate_vdo_block_map_page(page, nonce, pbn);
   if (validity == VDO_BLOCK_MAP_PAGE_VALID) {
-    return VDO_SUCCESS;
+    return;
   }
 
   if (validity == VDO_BLOCK_MAP_PAGE_BAD) {
@@ -265,5 +409,1179 @@ int readBlockMapPage(PhysicalLayer            *layer,
   }
 
   mark_vdo_block_map_page_initialized(page, false);
+}
+
+/**
+ * Read a batch of block map pages whose PBNs are sorted, merging runs of
+ * adjacent pages into single extents.
+ *
+ * @param [in]  layer    The layer from which to read
+ * @param [in]  pbns     The sorted PBNs of the pages
+ * @param [in]  count    The number of pages, at most PAGE_BATCH_SIZE
+ * @param [in]  buffer   A buffer for the pages
+ * @param [out] results  The result of reading each page
+ **/
+static void readSortedPages(PhysicalLayer                 *layer,
+                           const physical_block_number_t *pbns,
+                           size_t                         count,
+                           char                          *buffer,
+                           int                           *results)
+{
+  struct extent_read extents[PAGE_BATCH_SIZE];
+  size_t extentCount = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (extentCount > 0) {
+      struct extent_read *last = &extents[extentCount - 1];
+      if (pbns[i] == last->start_block + last->block_count) {
+        last->block_count++;
+        continue;
+      }
+    }
+
+    extents[extentCount++] = (struct extent_read) {
+      .start_block = pbns[i],
+      .block_count = 1,
+      .buffer      = buffer + (i * VDO_BLOCK_SIZE),
+    };
+  }
+
+  int result = layer->readExtents(layer, extents, extentCount, NULL, NULL);
+  size_t page = 0;
+  for (size_t i = 0; i < extentCount; i++) {
+    int extentResult
+      = ((result == VDO_SUCCESS) ? VDO_SUCCESS : extents[i].result);
+    for (size_t j = 0; j < extents[i].block_count; j++) {
+      results[page++] = extentResult;
+    }
+  }
+}
+
+/**
+ * Deal with a block map page which a walk by height could not use. If the
+ * examiner has no reporter, only a wrong page is tolerated.
+ *
+ * @param examiner  The examiner
+ * @param page      The page, if it was read
+ * @param pbn       The PBN of the page
+ * @param height    The height of the page
+ * @param result    The error reading the page, or VDO_BAD_PAGE if it was
+ *                  read but is the wrong page
+ *
+ * @return VDO_SUCCESS if the walk should skip the page and carry on, or
+ *         the error which ends the walk
+ **/
+static int reportBadPage(const TreeExaminer          *examiner,
+                         const struct block_map_page *page,
+                         physical_block_number_t      pbn,
+                         height_t                     height,
+                         int                          result)
+{
+  if (examiner->reportBadPage != NULL) {
+    examiner->reportBadPage(examiner->context, pbn, height, result);
+    return VDO_SUCCESS;
+  }
+
+  if (result == VDO_BAD_PAGE) {
+    warnx("Expected page %llu but got page %llu",
+          (unsigned long long) pbn,
+          (unsigned long long) get_vdo_block_map_page_pbn(page));
+    return VDO_SUCCESS;
+  }
+
+  char errBuf[ERRBUF_SIZE];
+  printf("%llu unreadable : %s",
+         (unsigned long long) pbn,
+         uds_string_error(result, errBuf, ERRBUF_SIZE));
+  return result;
+}
+
+/**
+ * Call a TreeExaminer on a decoded block map page.
+ *
+ * @param examiner  The examiner
+ * @param page      The page
+ * @param height    The height of the page
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int applyExaminer(const TreeExaminer        *examiner,
+                         const DecodedBlockMapPage *page,
+                         height_t                   height)
+{
+  if (examiner->examinePage != NULL) {
+    return examiner->examinePage(examiner->context, page, height);
+  }
+
+  struct block_map_slot blockMapSlot = {
+    .pbn  = page->pagePBN,
+    .slot = 0,
+  };
+  for (; blockMapSlot.slot < VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+       blockMapSlot.slot++) {
+    int result = examiner->examine(examiner->context, blockMapSlot, height,
+                                   page->pbns[blockMapSlot.slot],
+                                   page->states[blockMapSlot.slot]);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Examine every entry of the block map pages at one height of the trees,
+ * collecting the PBNs of the pages at the next height down.
+ *
+ * @param vdo       The VDO
+ * @param pages     The pages at this height; they will be sorted
+ * @param height    The height of the pages
+ * @param examiner  The examiner to call for each page
+ * @param children  The list to which to add the pages at the next height
+ * @param buffer    A buffer big enough for PAGE_BATCH_SIZE pages
+ * @param decoded   A buffer for decoding each page
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int examineHeight(UserVDO             *vdo,
+                         PageList            *pages,
+                         height_t             height,
+                         const TreeExaminer  *examiner,
+                         PageList            *children,
+                         char                *buffer,
+                         DecodedBlockMapPage *decoded)
+{
+  int     results[PAGE_BATCH_SIZE];
+  uint8_t validities[PAGE_BATCH_SIZE];
+  qsort(pages->pbns, pages->count, sizeof(physical_block_number_t),
+        comparePBNs);
+  for (size_t start = 0; start < pages->count; start += PAGE_BATCH_SIZE) {
+    size_t count = min(pages->count - start, (size_t) PAGE_BATCH_SIZE);
+    readSortedPages(vdo->layer, &pages->pbns[start], count, buffer, results);
+    validate_vdo_block_map_pages(buffer, &pages->pbns[start], count,
+                                 vdo->states.vdo.nonce, validities);
+    for (size_t i = 0; i < count; i++) {
+      struct block_map_page *page
+        = (struct block_map_page *) (buffer + (i * VDO_BLOCK_SIZE));
+      physical_block_number_t pbn = pages->pbns[start + i];
+      USDT_PROBE2(vdo, block_map_page, pbn, height);
+      int result = results[i];
+      if ((result == VDO_SUCCESS)
+          && (validities[i] == VDO_BLOCK_MAP_PAGE_BAD)) {
+        result = VDO_BAD_PAGE;
+      }
+
+      if (result != VDO_SUCCESS) {
+        result = reportBadPage(examiner, page, pbn, height, result);
+        if (result != VDO_SUCCESS) {
+          return result;
+        }
+
+        continue;
+      }
+
+      if (validities[i] != VDO_BLOCK_MAP_PAGE_VALID) {
+        continue;
+      }
+
+      decodeBlockMapPage(page, pbn, decoded);
+      result = applyExaminer(examiner, decoded, height);
+      if (result != VDO_SUCCESS) {
+        return result;
+      }
+
+      if ((height == 0) || decoded->allUnmapped) {
+        continue;
+      }
+
+      for (unsigned int slot = 0; slot < VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+           slot++) {
+        if ((decoded->states[slot] == VDO_MAPPING_STATE_UNMAPPED)
+            || !isValidDataBlock(vdo, decoded->pbns[slot])) {
+          continue;
+        }
+
+        result = addPage(children, decoded->pbns[slot]);
+        if (result != VDO_SUCCESS) {
+          return result;
+        }
+      }
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Walk some trees one height at a time.
+ *
+ * @param vdo       The VDO
+ * @param examiner  The examiner to call for each page
+ * @param arena     The buffers for the walk; the current list holds the
+ *                  roots of the trees to walk
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int walkTreesByHeight(UserVDO            *vdo,
+                             const TreeExaminer *examiner,
+                             WalkArena          *arena)
+{
+  int result = VDO_SUCCESS;
+  arena->children.count = 0;
+  for (int height = VDO_BLOCK_MAP_TREE_HEIGHT - 1;
+       (result == VDO_SUCCESS) && (height >= 0) && (arena->current.count > 0);
+       height--) {
+    result = examineHeight(vdo, &arena->current, height, examiner,
+                           &arena->children, arena->batch, arena->decoded);
+
+    // The children become the pages to examine at the next height.
+    PageList examined     = arena->current;
+    arena->current        = arena->children;
+    arena->children       = examined;
+    arena->children.count = 0;
+  }
+
+  return result;
+}
+
+/**
+ * Call the MappingExaminer pointed to by the context.
+ *
+ * Implements ParallelMappingExaminer.
+ **/
+static int callMappingExaminer(void                     *context,
+                               struct block_map_slot     slot,
+                               height_t                  height,
+                               physical_block_number_t   pbn,
+                               enum block_mapping_state  state)
+{
+  MappingExaminer *examiner = *((MappingExaminer **) context);
+  return examiner(slot, height, pbn, state);
+}
+
+/**********************************************************************/
+int examineBlockMapEntriesByHeight(UserVDO *vdo, MappingExaminer *examiner)
+{
+  struct block_map_state_2_0 *map = &vdo->states.block_map;
+  int result = checkRoots(map);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  WalkArena arena;
+  result = makeWalkArena(vdo->layer, true, &arena);
+  for (uint8_t rootIndex = 0;
+       (result == VDO_SUCCESS) && (rootIndex < map->root_count);
+       rootIndex++) {
+    result = addPage(&arena.current, map->root_origin + rootIndex);
+  }
+
+  if (result == VDO_SUCCESS) {
+    TreeExaminer treeExaminer = {
+      .examine       = callMappingExaminer,
+      .examinePage   = NULL,
+      .reportBadPage = NULL,
+      .context       = &examiner,
+    };
+    result = walkTreesByHeight(vdo, &treeExaminer, &arena);
+  }
+
+  freeWalkArena(&arena);
+  return result;
+}
+
+/**
+ * The state shared by the threads of a parallel block map walk.
+ **/
+typedef struct {
+  UserVDO                *vdo;
+  const ParallelExaminer *examiner;
+  /** Protects nextRoot and result */
+  struct mutex            lock;
+  /** The index of the first tree to be walked */
+  root_count_t            firstRoot;
+  /** The index of the next tree to be walked */
+  root_count_t            nextRoot;
+  /** The first error encountered by any thread */
+  int                     result;
+} ParallelWalk;
+
+/**
+ * One thread of a parallel block map walk.
+ **/
+typedef struct {
+  ParallelWalk  *walk;
+  struct thread *thread;
+  void          *context;
+  WalkArena      arena;
+} TreeWalker;
+
+/**
+ * Take the next tree to be walked, unless there are none left, the walk
+ * has failed, or the examiner wants the walk to pause. The first tree is
+ * always taken, so that a paused walk always makes progress.
+ *
+ * @param walk      The parallel walk
+ * @param rootPtr   A pointer to hold the PBN of the root of the tree
+ *
+ * @return <code>true</code> if a tree was taken
+ **/
+static bool takeTree(ParallelWalk *walk, physical_block_number_t *rootPtr)
+{
+  struct block_map_state_2_0 *map = &walk->vdo->states.block_map;
+  uds_lock_mutex(&walk->lock);
+  bool taken = ((walk->result == VDO_SUCCESS)
+                && (walk->nextRoot < map->root_count)
+                && ((walk->examiner->shouldPause == NULL)
+                    || (walk->nextRoot == walk->firstRoot)
+                    || !walk->examiner->shouldPause(walk->examiner->shared)));
+  if (taken) {
+    *rootPtr = map->root_origin + walk->nextRoot++;
+  }
+  uds_unlock_mutex(&walk->lock);
+  return taken;
+}
+
+/**
+ * Record the failure of a parallel walk, keeping the first error.
+ *
+ * @param walk    The parallel walk
+ * @param result  The error
+ **/
+static void failWalk(ParallelWalk *walk, int result)
+{
+  uds_lock_mutex(&walk->lock);
+  if (walk->result == VDO_SUCCESS) {
+    walk->result = result;
+  }
+  uds_unlock_mutex(&walk->lock);
+}
+
+/**
+ * Walk trees until there are none left. This is the body of each thread of
+ * a parallel walk.
+ *
+ * @param arg  The TreeWalker for this thread
+ **/
+static void walkTrees(void *arg)
+{
+  TreeWalker   *walker   = arg;
+  ParallelWalk *walk     = walker->walk;
+  TreeExaminer  examiner = {
+    .examine       = walk->examiner->examine,
+    .examinePage   = walk->examiner->examinePage,
+    .reportBadPage = walk->examiner->reportBadPage,
+    .context       = walker->context,
+  };
+  physical_block_number_t root;
+  while (takeTree(walk, &root)) {
+    USDT_PROBE1(vdo, block_map_tree_start, root);
+    walker->arena.current.count = 0;
+    int result = addPage(&walker->arena.current, root);
+    if (result == VDO_SUCCESS) {
+      result = walkTreesByHeight(walk->vdo, &examiner, &walker->arena);
+    }
+    USDT_PROBE2(vdo, block_map_tree_done, root, result);
+
+    if (result != VDO_SUCCESS) {
+      failWalk(walk, result);
+      break;
+    }
+  }
+}
+
+/**********************************************************************/
+int examineBlockMapEntriesInParallel(UserVDO                *vdo,
+                                     unsigned int            threadCount,
+                                     const ParallelExaminer *examiner)
+{
+  root_count_t nextRoot = 0;
+  return examineBlockMapTreesInParallel(vdo, threadCount, &nextRoot,
+                                        examiner);
+}
+
+/**********************************************************************/
+int examineBlockMapTreesInParallel(UserVDO                *vdo,
+                                   unsigned int            threadCount,
+                                   root_count_t           *nextRootPtr,
+                                   const ParallelExaminer *examiner)
+{
+  struct block_map_state_2_0 *map = &vdo->states.block_map;
+  int result = checkRoots(map);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  if (*nextRootPtr >= map->root_count) {
+    return VDO_SUCCESS;
+  }
+
+  if (threadCount == 0) {
+    threadCount = uds_get_num_cores();
+  }
+  threadCount = max(min(threadCount,
+                        (unsigned int) (map->root_count - *nextRootPtr)),
+                    1U);
+
+  TreeWalker *walkers;
+  result = UDS_ALLOCATE(threadCount, TreeWalker, __func__, &walkers);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  ParallelWalk walk = {
+    .vdo       = vdo,
+    .examiner  = examiner,
+    .firstRoot = *nextRootPtr,
+    .nextRoot  = *nextRootPtr,
+    .result    = VDO_SUCCESS,
+  };
+  result = uds_init_mutex(&walk.lock);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(walkers);
+    return result;
+  }
+
+  // Set up every walker before starting any of them.
+  unsigned int prepared = 0;
+  for (; prepared < threadCount; prepared++) {
+    TreeWalker *walker = &walkers[prepared];
+    walker->walk = &walk;
+    result = makeWalkArena(vdo->layer, true, &walker->arena);
+    if (result != VDO_SUCCESS) {
+      freeWalkArena(&walker->arena);
+      break;
+    }
+
+    result = examiner->makeContext(examiner->shared, &walker->context);
+    if (result != VDO_SUCCESS) {
+      freeWalkArena(&walker->arena);
+      break;
+    }
+  }
+
+  unsigned int started = 0;
+  if (result == VDO_SUCCESS) {
+    for (; started < threadCount; started++) {
+      result = uds_create_thread(walkTrees, &walkers[started],
+                                 "vdoTreeWalker", &walkers[started].thread);
+      if (result != UDS_SUCCESS) {
+        failWalk(&walk, result);
+        break;
+      }
+    }
+  }
+
+  for (unsigned int i = 0; i < started; i++) {
+    uds_join_threads(walkers[i].thread);
+  }
+
+  for (unsigned int i = 0; i < prepared; i++) {
+    examiner->reduce(examiner->shared, walkers[i].context);
+    freeWalkArena(&walkers[i].arena);
+  }
+
+  if (result == VDO_SUCCESS) {
+    result = walk.result;
+  }
+
+  *nextRootPtr = walk.nextRoot;
+  uds_destroy_mutex(&walk.lock);
+  UDS_FREE(walkers);
+  return result;
+}
+
+/**
+ * Find the tree holding a leaf block map page, and the slot to follow at
+ * each height of the tree to reach it.
+ *
+ * @param [in]  map         The block map state
+ * @param [in]  pageNumber  The number of the leaf page
+ * @param [out] slots       The slot at each height; slots[0] is unset
+ *
+ * @return The index of the tree's root
+ **/
+static root_count_t
+computeTreeSlots(const struct block_map_state_2_0 *map,
+                 page_number_t                     pageNumber,
+                 slot_number_t                    *slots)
+{
+  root_count_t rootIndex = pageNumber % map->root_count;
+  pageNumber = pageNumber / map->root_count;
+  for (int i = 1; i < VDO_BLOCK_MAP_TREE_HEIGHT; i++) {
+    slots[i] = pageNumber % VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+    pageNumber /= VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+  }
+
+  return rootIndex;
+}
+
+/**
+ * Find and decode a particular slot from a block map page.
+ *
+ * @param vdo           The VDO
+ * @param pbn           The PBN of the block map page to read
+ * @param slot          The slot to read from the block map page
+ * @param mappedPBNPtr  A pointer to the mapped PBN
+ * @param mappedPtr     A pointer to the mapped state
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int readSlotFromPage(UserVDO                  *vdo,
+                            physical_block_number_t   pbn,
+                            slot_number_t             slot,
+                            physical_block_number_t  *mappedPBNPtr,
+                            enum block_mapping_state *mappedStatePtr)
+{
+  PhysicalLayer *layer = vdo->layer;
+  struct block_map_page *page;
+  int result = layer->borrowIOBuffer(layer, VDO_BLOCK_SIZE, "page buffer",
+                                     (char **) &page);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = readBlockMapPage(layer, pbn, vdo->states.vdo.nonce, page);
+  if (result != VDO_SUCCESS) {
+    layer->returnIOBuffer(layer, VDO_BLOCK_SIZE, (char *) page);
+    return result;
+  }
+
+  struct data_location mapped;
+  if (is_vdo_block_map_page_initialized(page)) {
+    mapped = unpack_vdo_block_map_entry(&page->entries[slot]);
+  } else {
+    mapped = (struct data_location) {
+      .state = VDO_MAPPING_STATE_UNMAPPED,
+      .pbn   = VDO_ZERO_BLOCK,
+    };
+  }
+
+  *mappedStatePtr = mapped.state;
+  *mappedPBNPtr   = mapped.pbn;
+
+  layer->returnIOBuffer(layer, VDO_BLOCK_SIZE, (char *) page);
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int findLBNPage(UserVDO                 *vdo,
+                logical_block_number_t   lbn,
+                physical_block_number_t *pbnPtr)
+{
+  if (lbn >= vdo->states.vdo.config.logical_blocks) {
+    warnx("VDO has only %llu logical blocks, cannot dump mapping for LBA %llu",
+          (unsigned long long) vdo->states.vdo.config.logical_blocks,
+          (unsigned long long) lbn);
+    return VDO_OUT_OF_RANGE;
+  }
+
+  struct block_map_state_2_0 *map = &vdo->states.block_map;
+  slot_number_t slots[VDO_BLOCK_MAP_TREE_HEIGHT];
+  root_count_t rootIndex
+    = computeTreeSlots(map, vdo_compute_page_number(lbn), slots);
+
+  physical_block_number_t pbn = map->root_origin + rootIndex;
+  for (int i = VDO_BLOCK_MAP_TREE_HEIGHT - 1; i > 0; i--) {
+    enum block_mapping_state state;
+    int result = readSlotFromPage(vdo, pbn, slots[i], &pbn, &state);
+    if ((result != VDO_SUCCESS) || (pbn == VDO_ZERO_BLOCK)
+        || (state == VDO_MAPPING_STATE_UNMAPPED)) {
+      *pbnPtr = VDO_ZERO_BLOCK;
+      return result;
+    }
+  }
+
+  *pbnPtr = pbn;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int findLBNMapping(UserVDO                  *vdo,
+                   logical_block_number_t    lbn,
+                   physical_block_number_t  *pbnPtr,
+                   enum block_mapping_state *statePtr)
+{
+  physical_block_number_t pagePBN;
+  int result = findLBNPage(vdo, lbn, &pagePBN);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  if (pagePBN == VDO_ZERO_BLOCK) {
+    *pbnPtr   = VDO_ZERO_BLOCK;
+    *statePtr = VDO_MAPPING_STATE_UNMAPPED;
+    return VDO_SUCCESS;
+  }
+
+  slot_number_t slot = lbn % VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+  return readSlotFromPage(vdo, pagePBN, slot, pbnPtr, statePtr);
+}
+
+/**
+ * The interior pages on the most recently followed path through each tree,
+ * kept by a walk of a range of LBNs so that no page is read twice.
+ **/
+typedef struct {
+  /** The PBN of each cached page, indexed by tree and then by height */
+  physical_block_number_t *pbns;
+  /** The cached pages, in the same order as the PBNs */
+  char                    *pages;
+  /** A buffer for a leaf page, after the cached pages */
+  struct block_map_page   *leaf;
+} PathCache;
+
+/**
+ * Allocate a PathCache for the trees of a VDO.
+ *
+ * @param vdo    The VDO
+ * @param cache  The cache to set up
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int makePathCache(UserVDO *vdo, PathCache *cache)
+{
+  *cache = (PathCache) {
+    .pbns = NULL,
+  };
+
+  // Each tree gets a page for each interior height, and there is one more
+  // page for the leaves.
+  size_t interiorPages = (vdo->states.block_map.root_count
+                          * (VDO_BLOCK_MAP_TREE_HEIGHT - 1));
+  int result = UDS_ALLOCATE(interiorPages, physical_block_number_t, __func__,
+                            &cache->pbns);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = vdo->layer->allocateIOBuffer(vdo->layer,
+                                        (interiorPages + 1) * VDO_BLOCK_SIZE,
+                                        "block map path pages",
+                                        &cache->pages);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  cache->leaf = (struct block_map_page *) (cache->pages
+                                           + (interiorPages * VDO_BLOCK_SIZE));
+  return VDO_SUCCESS;
+}
+
+/**
+ * Free the buffers of a PathCache.
+ *
+ * @param cache  The cache
+ **/
+static void freePathCache(PathCache *cache)
+{
+  UDS_FREE(cache->pbns);
+  UDS_FREE(cache->pages);
+  *cache = (PathCache) {
+    .pbns = NULL,
+  };
+}
+
+/**
+ * Get an interior block map page from a PathCache, reading it if the page
+ * cached for that tree and height is a different one.
+ *
+ * @param [in]  vdo        The VDO
+ * @param [in]  cache      The cache
+ * @param [in]  rootIndex  The tree the page is in
+ * @param [in]  height     The height of the page
+ * @param [in]  pbn        The PBN of the page
+ * @param [out] pagePtr    A pointer to hold the page
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int getPathPage(UserVDO                  *vdo,
+                       PathCache                *cache,
+                       root_count_t              rootIndex,
+                       height_t                  height,
+                       physical_block_number_t   pbn,
+                       struct block_map_page   **pagePtr)
+{
+  size_t index = ((rootIndex * (VDO_BLOCK_MAP_TREE_HEIGHT - 1))
+                  + (height - 1));
+  struct block_map_page *page
+    = (struct block_map_page *) (cache->pages + (index * VDO_BLOCK_SIZE));
+  if (cache->pbns[index] != pbn) {
+    // Forget the old page first in case the read fails.
+    cache->pbns[index] = VDO_ZERO_BLOCK;
+    int result = readBlockMapPage(vdo->layer, pbn, vdo->states.vdo.nonce,
+                                  page);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    cache->pbns[index] = pbn;
+  }
+
+  *pagePtr = page;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Find the PBN of a leaf block map page by following the path through its
+ * tree, using and updating a PathCache.
+ *
+ * @param [in]  vdo         The VDO
+ * @param [in]  cache       The cache of the interior pages of each tree
+ * @param [in]  pageNumber  The number of the leaf page
+ * @param [out] pbnPtr      A pointer to hold the PBN of the leaf page, or
+ *                          the zero block if it has not been allocated
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int findLeafPage(UserVDO                 *vdo,
+                        PathCache               *cache,
+                        page_number_t            pageNumber,
+                        physical_block_number_t *pbnPtr)
+{
+  struct block_map_state_2_0 *map = &vdo->states.block_map;
+  slot_number_t slots[VDO_BLOCK_MAP_TREE_HEIGHT];
+  root_count_t rootIndex = computeTreeSlots(map, pageNumber, slots);
+
+  physical_block_number_t pbn = map->root_origin + rootIndex;
+  for (int height = VDO_BLOCK_MAP_TREE_HEIGHT - 1; height > 0; height--) {
+    struct block_map_page *page;
+    int result = getPathPage(vdo, cache, rootIndex, height, pbn, &page);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    struct data_location mapped = {
+      .pbn   = VDO_ZERO_BLOCK,
+      .state = VDO_MAPPING_STATE_UNMAPPED,
+    };
+    if (is_vdo_block_map_page_initialized(page)) {
+      mapped = unpack_vdo_block_map_entry(&page->entries[slots[height]]);
+    }
+
+    if (!vdo_is_mapped_location(&mapped)
+        || !isValidDataBlock(vdo, mapped.pbn)) {
+      *pbnPtr = VDO_ZERO_BLOCK;
+      return VDO_SUCCESS;
+    }
+
+    pbn = mapped.pbn;
+  }
+
+  *pbnPtr = pbn;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Read and decode a leaf block map page.
+ *
+ * @param vdo      The VDO
+ * @param cache    The cache whose leaf buffer to read into
+ * @param leafPBN  The PBN of the leaf, or the zero block if the leaf has not
+ *                 been allocated
+ * @param decoded  The decoded page; if the page was not allocated or is not
+ *                 initialized, every entry will be unmapped
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int readLeafPage(UserVDO                 *vdo,
+                        PathCache               *cache,
+                        physical_block_number_t  leafPBN,
+                        DecodedBlockMapPage     *decoded)
+{
+  if (leafPBN != VDO_ZERO_BLOCK) {
+    int result = readBlockMapPage(vdo->layer, leafPBN, vdo->states.vdo.nonce,
+                                  cache->leaf);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    if (is_vdo_block_map_page_initialized(cache->leaf)) {
+      decodeBlockMapPage(cache->leaf, leafPBN, decoded);
+      return VDO_SUCCESS;
+    }
+  }
+
+  memset(decoded, 0, sizeof(*decoded));
+  decoded->pagePBN     = leafPBN;
+  decoded->allUnmapped = true;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Examine the LBNs in a range which are on one leaf page.
+ *
+ * @param vdo       The VDO
+ * @param cache     The cache of the interior pages of each tree
+ * @param decoded   A buffer for the decoded leaf page
+ * @param startLBN  The first LBN to examine
+ * @param endLBN    One more than the last LBN to examine; all the LBNs must
+ *                  be on the same leaf page
+ * @param examiner  The examiner to apply to each LBN
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int examineLeafRange(UserVDO                *vdo,
+                            PathCache              *cache,
+                            DecodedBlockMapPage    *decoded,
+                            logical_block_number_t  startLBN,
+                            logical_block_number_t  endLBN,
+                            LBNExaminer            *examiner)
+{
+  physical_block_number_t leafPBN;
+  int result = findLeafPage(vdo, cache, vdo_compute_page_number(startLBN),
+                            &leafPBN);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = readLeafPage(vdo, cache, leafPBN, decoded);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  for (logical_block_number_t lbn = startLBN; lbn < endLBN; lbn++) {
+    slot_number_t slot = vdo_compute_slot(lbn);
+    result = examiner(lbn, decoded->pbns[slot], decoded->states[slot]);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int examineBlockMapRange(UserVDO                *vdo,
+                         logical_block_number_t  startLBN,
+                         logical_block_number_t  endLBN,
+                         LBNExaminer            *examiner)
+{
+  block_count_t logicalBlocks = vdo->states.vdo.config.logical_blocks;
+  if ((startLBN >= endLBN) || (endLBN > logicalBlocks)) {
+    warnx("VDO has only %llu logical blocks, cannot examine LBAs %llu to %llu",
+          (unsigned long long) logicalBlocks, (unsigned long long) startLBN,
+          (unsigned long long) endLBN - 1);
+    return VDO_OUT_OF_RANGE;
+  }
+
+  struct block_map_state_2_0 *map = &vdo->states.block_map;
+  int result = checkRoots(map);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  PathCache cache;
+  DecodedBlockMapPage *decoded = NULL;
+  result = makePathCache(vdo, &cache);
+  if (result == VDO_SUCCESS) {
+    result = UDS_ALLOCATE(1, DecodedBlockMapPage, __func__, &decoded);
+  }
+
+  logical_block_number_t lbn = startLBN;
+  while ((result == VDO_SUCCESS) && (lbn < endLBN)) {
+    logical_block_number_t pageEnd
+      = (vdo_compute_page_number(lbn) + 1) * VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+    logical_block_number_t stop = min(pageEnd, endLBN);
+    result = examineLeafRange(vdo, &cache, decoded, lbn, stop, examiner);
+    lbn = stop;
+  }
+
+  UDS_FREE(decoded);
+  freePathCache(&cache);
+  return result;
+}
+
+struct blockMapIterator {
+  UserVDO                *vdo;
+  /** The interior pages on the path to the current leaf of each tree */
+  PathCache               cache;
+  /** The current leaf page, decoded */
+  DecodedBlockMapPage    *decoded;
+  /** The number of the current leaf page, if there is one */
+  page_number_t           leafNumber;
+  bool                    haveLeaf;
+  bool                    mappedOnly;
+  /** The next LBN to consider */
+  logical_block_number_t  nextLBN;
+  logical_block_number_t  endLBN;
+};
+
+/**********************************************************************/
+int makeBlockMapIterator(UserVDO                 *vdo,
+                         logical_block_number_t   startLBN,
+                         logical_block_number_t   endLBN,
+                         bool                     mappedOnly,
+                         BlockMapIterator       **iteratorPtr)
+{
+  block_count_t logicalBlocks = vdo->states.vdo.config.logical_blocks;
+  if ((startLBN >= endLBN) || (endLBN > logicalBlocks)) {
+    warnx("VDO has only %llu logical blocks, cannot iterate LBAs %llu to %llu",
+          (unsigned long long) logicalBlocks, (unsigned long long) startLBN,
+          (unsigned long long) endLBN - 1);
+    return VDO_OUT_OF_RANGE;
+  }
+
+  int result = checkRoots(&vdo->states.block_map);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  BlockMapIterator *iterator;
+  result = UDS_ALLOCATE(1, BlockMapIterator, __func__, &iterator);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  *iterator = (BlockMapIterator) {
+    .vdo        = vdo,
+    .mappedOnly = mappedOnly,
+    .nextLBN    = startLBN,
+    .endLBN     = endLBN,
+  };
+
+  result = makePathCache(vdo, &iterator->cache);
+  if (result == VDO_SUCCESS) {
+    result = UDS_ALLOCATE(1, DecodedBlockMapPage, __func__,
+                          &iterator->decoded);
+  }
+
+  if (result != VDO_SUCCESS) {
+    freeBlockMapIterator(&iterator);
+    return result;
+  }
+
+  *iteratorPtr = iterator;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int getNextBlockMappings(BlockMapIterator *iterator,
+                         BlockMapping     *mappings,
+                         size_t            capacity,
+                         size_t           *countPtr)
+{
+  DecodedBlockMapPage *decoded = iterator->decoded;
+  size_t count = 0;
+  while ((count < capacity) && (iterator->nextLBN < iterator->endLBN)) {
+    page_number_t pageNumber = vdo_compute_page_number(iterator->nextLBN);
+    logical_block_number_t pageEnd
+      = min((pageNumber + 1) * (logical_block_number_t)
+            VDO_BLOCK_MAP_ENTRIES_PER_PAGE, iterator->endLBN);
+    if (!iterator->haveLeaf || (iterator->leafNumber != pageNumber)) {
+      iterator->haveLeaf = false;
+      physical_block_number_t leafPBN;
+      int result = findLeafPage(iterator->vdo, &iterator->cache, pageNumber,
+                                &leafPBN);
+      if (result == VDO_SUCCESS) {
+        result = readLeafPage(iterator->vdo, &iterator->cache, leafPBN,
+                              decoded);
+      }
+
+      if (result != VDO_SUCCESS) {
+        return result;
+      }
+
+      iterator->leafNumber = pageNumber;
+      iterator->haveLeaf   = true;
+    }
+
+    if (iterator->mappedOnly && decoded->allUnmapped) {
+      iterator->nextLBN = pageEnd;
+      continue;
+    }
+
+    for (; (count < capacity) && (iterator->nextLBN < pageEnd);
+         iterator->nextLBN++) {
+      slot_number_t slot = vdo_compute_slot(iterator->nextLBN);
+      if (iterator->mappedOnly
+          && (decoded->states[slot] == VDO_MAPPING_STATE_UNMAPPED)) {
+        continue;
+      }
+
+      mappings[count++] = (BlockMapping) {
+        .lbn   = iterator->nextLBN,
+        .pbn   = decoded->pbns[slot],
+        .state = decoded->states[slot],
+      };
+    }
+  }
+
+  *countPtr = count;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+void freeBlockMapIterator(BlockMapIterator **iteratorPtr)
+{
+  BlockMapIterator *iterator = *iteratorPtr;
+  if (iterator == NULL) {
+    return;
+  }
+
+  UDS_FREE(iterator->decoded);
+  freePathCache(&iterator->cache);
+  UDS_FREE(iterator);
+  *iteratorPtr = NULL;
+}
+
+/**
+ * An LBN to be looked up by a batch lookup, and its place in the batch.
+ **/
+typedef struct {
+  logical_block_number_t lbn;
+  size_t                 index;
+} LBNLookup;
+
+/**********************************************************************/
+static int compareLookups(const void *a, const void *b)
+{
+  const LBNLookup *lookupA = a;
+  const LBNLookup *lookupB = b;
+  if (lookupA->lbn != lookupB->lbn) {
+    return ((lookupA->lbn < lookupB->lbn) ? -1 : 1);
+  }
+
+  return ((lookupA->index < lookupB->index) ? -1 : 1);
+}
+
+/**
+ * Look up a batch of LBNs. The LBNs are sorted so that each tree is walked
+ * in order, and then a PathCache ensures that each interior page is read
+ * only once. Each leaf page is also read only once if the mappings are
+ * wanted.
+ *
+ * @param [in]  vdo       The VDO
+ * @param [in]  lbns      The LBNs to look up
+ * @param [in]  count     The number of LBNs
+ * @param [out] pagePBNs  The PBN of the leaf page for each LBN
+ * @param [out] pbns      The mapped PBN of each LBN, or NULL if the mappings
+ *                        are not wanted
+ * @param [out] states    The mapping state of each LBN, or NULL
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int lookUpLBNs(UserVDO                      *vdo,
+                      const logical_block_number_t *lbns,
+                      size_t                        count,
+                      physical_block_number_t      *pagePBNs,
+                      physical_block_number_t      *pbns,
+                      enum block_mapping_state     *states)
+{
+  block_count_t logicalBlocks = vdo->states.vdo.config.logical_blocks;
+  for (size_t i = 0; i < count; i++) {
+    if (lbns[i] >= logicalBlocks) {
+      warnx("VDO has only %llu logical blocks, cannot dump mapping for LBA"
+            " %llu", (unsigned long long) logicalBlocks,
+            (unsigned long long) lbns[i]);
+      return VDO_OUT_OF_RANGE;
+    }
+  }
+
+  if (count == 0) {
+    return VDO_SUCCESS;
+  }
+
+  int result = checkRoots(&vdo->states.block_map);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  LBNLookup *lookups;
+  result = UDS_ALLOCATE(count, LBNLookup, __func__, &lookups);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    lookups[i] = (LBNLookup) {
+      .lbn   = lbns[i],
+      .index = i,
+    };
+  }
+  qsort(lookups, count, sizeof(LBNLookup), compareLookups);
+
+  PathCache cache;
+  DecodedBlockMapPage *decoded = NULL;
+  result = makePathCache(vdo, &cache);
+  if ((result == VDO_SUCCESS) && (pbns != NULL)) {
+    result = UDS_ALLOCATE(1, DecodedBlockMapPage, __func__, &decoded);
+  }
+
+  page_number_t           lastPage = 0;
+  physical_block_number_t leafPBN  = VDO_ZERO_BLOCK;
+  for (size_t i = 0; (result == VDO_SUCCESS) && (i < count); i++) {
+    page_number_t pageNumber = vdo_compute_page_number(lookups[i].lbn);
+    if ((i == 0) || (pageNumber != lastPage)) {
+      lastPage = pageNumber;
+      result = findLeafPage(vdo, &cache, pageNumber, &leafPBN);
+      if ((result == VDO_SUCCESS) && (decoded != NULL)) {
+        result = readLeafPage(vdo, &cache, leafPBN, decoded);
+      }
+
+      if (result != VDO_SUCCESS) {
+        break;
+      }
+    }
+
+    size_t index = lookups[i].index;
+    pagePBNs[index] = leafPBN;
+    if (decoded != NULL) {
+      slot_number_t slot = vdo_compute_slot(lookups[i].lbn);
+      pbns[index]   = decoded->pbns[slot];
+      states[index] = decoded->states[slot];
+    }
+  }
+
+  UDS_FREE(decoded);
+  freePathCache(&cache);
+  UDS_FREE(lookups);
+  return result;
+}
+
+/**********************************************************************/
+int findLBNPages(UserVDO                      *vdo,
+                 const logical_block_number_t *lbns,
+                 size_t                        count,
+                 physical_block_number_t      *pagePBNs)
+{
+  return lookUpLBNs(vdo, lbns, count, pagePBNs, NULL, NULL);
+}
+
+/**********************************************************************/
+int findLBNMappings(UserVDO                      *vdo,
+                    const logical_block_number_t *lbns,
+                    size_t                        count,
+                    physical_block_number_t      *pbns,
+                    enum block_mapping_state     *states)
+{
+  physical_block_number_t *pagePBNs;
+  int result = UDS_ALLOCATE(count, physical_block_number_t, __func__,
+                            &pagePBNs);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = lookUpLBNs(vdo, lbns, count, pagePBNs, pbns, states);
+  UDS_FREE(pagePBNs);
+  return result;
+}
+
+/**********************************************************************/
+int readBlockMapPage(PhysicalLayer            *layer,
+                     physical_block_number_t   pbn,
+                     nonce_t                   nonce,
+                     struct block_map_page    *page)
+{
+  int result = layer->reader(layer, pbn, 1, (char *) page);
+  if (result != VDO_SUCCESS) {
+    char errBuf[ERRBUF_SIZE];
+    printf("%llu unreadable : %s",
+           (unsigned long long) pbn,
+           uds_string_error(result, errBuf, ERRBUF_SIZE));
+    return result;
+  }
+
+  validatePage(page, nonce, pbn);
   return VDO_SUCCESS;
 }
@@ -56,6 +56,318 @@ MappingExaminer(struct block_map_slot slot,
 int __must_check
 examineBlockMapEntries(UserVDO *vdo, MappingExaminer *examiner);
 
+/**
+ * A block map page decoded into parallel arrays of PBNs and mapping states.
+ **/
+typedef struct {
+  /** The PBN of the page itself */
+  physical_block_number_t pagePBN;
+  /** Whether every entry in the page is unmapped and has no PBN */
+  bool                    allUnmapped;
+  /** The PBN encoded in each entry */
+  physical_block_number_t pbns[VDO_BLOCK_MAP_ENTRIES_PER_PAGE];
+  /** The block_mapping_state encoded in each entry */
+  uint8_t                 states[VDO_BLOCK_MAP_ENTRIES_PER_PAGE];
+} DecodedBlockMapPage;
+
+/**
+ * A function which examines a whole block map page at once. Functions of this
+ * type are passed to examineBlockMapPages(), which will call this function
+ * once for each initialized page, including ones which are entirely
+ * unmapped.
+ *
+ * @param page    The decoded page
+ * @param height  The height of the page in the tree
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+typedef int __must_check
+PageExaminer(const DecodedBlockMapPage *page, height_t height);
+
+/**
+ * Decode all the entries of a block map page.
+ *
+ * @param [in]  page     The page to decode
+ * @param [in]  pbn      The PBN of the page
+ * @param [out] decoded  The decoded page
+ **/
+void decodeBlockMapPage(const struct block_map_page *page,
+                        physical_block_number_t      pbn,
+                        DecodedBlockMapPage         *decoded);
+
+/**
+ * Apply a page examiner to each initialized block map page in a VDO. The
+ * trees are walked depth first, with each page examined before any of its
+ * children.
+ *
+ * @param vdo       The VDO containing the block map to be examined
+ * @param examiner  The examiner to apply to each page
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check examineBlockMapPages(UserVDO *vdo, PageExaminer *examiner);
+
+/**
+ * Apply a mapping examiner to each mapped block map entry in a VDO, visiting
+ * the trees one height at a time rather than depth first. The pages at each
+ * height are read in PBN order, with adjacent pages merged, in large
+ * batches, so this is much faster than examineBlockMapEntries() on large
+ * block maps. The examiner sees the same entries, but in a different order.
+ *
+ * @param vdo       The VDO containing the block map to be examined
+ * @param examiner  The examiner to apply to each defined mapping
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check
+examineBlockMapEntriesByHeight(UserVDO *vdo, MappingExaminer *examiner);
+
+/**
+ * A function which examines a block map page entry on behalf of one of the
+ * threads of a parallel block map walk. It is like a MappingExaminer, but is
+ * also given the context of the calling thread. Calls with different
+ * contexts may be concurrent.
+ *
+ * @param context     The examiner context of the calling thread
+ * @param slot        The block_map_slot where this entry was found
+ * @param height      The height of the block map entry in the tree
+ * @param pbn         The PBN encoded in the entry
+ * @param state       The mapping state encoded in the entry
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+typedef int __must_check
+ParallelMappingExaminer(void *context,
+			struct block_map_slot slot,
+			height_t height,
+			physical_block_number_t pbn,
+			enum block_mapping_state state);
+
+/**
+ * A function which examines a whole block map page on behalf of one of the
+ * threads of a parallel block map walk.
+ *
+ * @param context  The examiner context of the calling thread
+ * @param page     The decoded page
+ * @param height   The height of the page in the tree
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+typedef int __must_check
+ParallelPageExaminer(void *context,
+		     const DecodedBlockMapPage *page,
+		     height_t height);
+
+/**
+ * A function which makes the examiner context for one thread of a parallel
+ * block map walk.
+ *
+ * @param shared      The shared state of the parallel examiner
+ * @param contextPtr  A pointer to hold the new context
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+typedef int __must_check
+ExaminerContextMaker(void *shared, void **contextPtr);
+
+/**
+ * A function which folds the examiner context of one thread of a parallel
+ * block map walk into the shared state, and then frees the context. The
+ * reducer is called once for each context which was made, one at a time,
+ * after all the threads have finished, whether or not the walk succeeded.
+ *
+ * @param shared   The shared state of the parallel examiner
+ * @param context  The context to reduce and free
+ **/
+typedef void ExaminerContextReducer(void *shared, void *context);
+
+/**
+ * A function which decides whether a parallel block map walk should stop
+ * starting new trees, so that the walk can be resumed later. It may be
+ * called from any of the threads of the walk.
+ *
+ * @param shared  The shared state of the parallel examiner
+ *
+ * @return <code>true</code> if no more trees should be started
+ **/
+typedef bool WalkPauser(void *shared);
+
+/**
+ * A function which is told of a block map page which a parallel block map
+ * walk could not use, either because it could not be read or because it
+ * holds some other page of the same VDO. The page, and anything below it,
+ * is skipped, and the walk carries on.
+ *
+ * @param context  The examiner context of the calling thread
+ * @param pbn      The PBN of the page
+ * @param height   The height of the page in the tree
+ * @param result   The error reading the page, or VDO_BAD_PAGE if the page
+ *                 was read but is the wrong page
+ **/
+typedef void BadPageReporter(void                    *context,
+                             physical_block_number_t  pbn,
+                             height_t                 height,
+                             int                      result);
+
+/**
+ * The functions and shared state which make up a parallel block map walk.
+ * Exactly one of examine and examinePage should be set. shouldPause may be
+ * NULL if the walk should never pause. reportBadPage may be NULL, in which
+ * case a page which can't be read fails the whole walk, and a wrong page is
+ * only logged.
+ **/
+typedef struct {
+  ExaminerContextMaker    *makeContext;
+  ParallelMappingExaminer *examine;
+  ParallelPageExaminer    *examinePage;
+  ExaminerContextReducer  *reduce;
+  WalkPauser              *shouldPause;
+  BadPageReporter         *reportBadPage;
+  void                    *shared;
+} ParallelExaminer;
+
+/**
+ * Apply a parallel examiner to each mapped block map entry in a VDO. The
+ * trees are independent, so each of a pool of threads repeatedly takes the
+ * next unexamined tree and walks it one height at a time, as
+ * examineBlockMapEntriesByHeight() does. Each thread has its own examiner
+ * context, and the contexts are reduced into the shared state once every
+ * thread has finished. If any examiner call fails, no further trees are
+ * started and the first error is returned.
+ *
+ * @param vdo          The VDO containing the block map to be examined
+ * @param threadCount  The number of threads to use, or 0 to use one for each
+ *                     core; no more threads than trees will be used
+ * @param examiner     The parallel examiner to apply to each defined mapping
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check
+examineBlockMapEntriesInParallel(UserVDO                *vdo,
+                                 unsigned int            threadCount,
+                                 const ParallelExaminer *examiner);
+
+/**
+ * Apply a parallel examiner to the trees of a VDO's block map starting from
+ * a given tree, as examineBlockMapEntriesInParallel() does. If the examiner's
+ * shouldPause function returns true, no further trees are started, and the
+ * walk returns once the trees in progress are finished. At least one tree is
+ * always examined, so a walk which is resumed repeatedly will finish. Every
+ * tree before the returned index has been examined completely, and none
+ * after it has been examined at all, so the walk may be resumed from that
+ * index.
+ *
+ * @param [in]     vdo          The VDO containing the block map
+ * @param [in]     threadCount  The number of threads to use, or 0 to use one
+ *                              for each core
+ * @param [in,out] nextRootPtr  A pointer to the index of the first tree to
+ *                              examine, which will be set to the index of
+ *                              the first tree not examined
+ * @param [in]     examiner     The parallel examiner
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check
+examineBlockMapTreesInParallel(UserVDO                *vdo,
+                               unsigned int            threadCount,
+                               root_count_t           *nextRootPtr,
+                               const ParallelExaminer *examiner);
+
+/**
+ * A function which examines the mapping of a single logical block. Functions
+ * of this type are passed to examineBlockMapRange().
+ *
+ * @param lbn    The logical block number
+ * @param pbn    The PBN to which the LBN is mapped
+ * @param state  The mapping state of the LBN
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+typedef int __must_check
+LBNExaminer(logical_block_number_t lbn,
+	    physical_block_number_t pbn,
+	    enum block_mapping_state state);
+
+/**
+ * Apply an LBN examiner to each LBN in a range, in order. Only the parts of
+ * the trees which cover the range are read, and each page is read at most
+ * once. LBNs whose leaf page has not been allocated are reported as
+ * unmapped.
+ *
+ * @param vdo       The VDO
+ * @param startLBN  The first LBN to examine
+ * @param endLBN    One more than the last LBN to examine
+ * @param examiner  The examiner to apply to each LBN
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check examineBlockMapRange(UserVDO *vdo,
+				      logical_block_number_t startLBN,
+				      logical_block_number_t endLBN,
+				      LBNExaminer *examiner);
+
+/**
+ * The mapping of one logical block, as produced by a BlockMapIterator.
+ **/
+typedef struct {
+  logical_block_number_t   lbn;
+  physical_block_number_t  pbn;
+  enum block_mapping_state state;
+} BlockMapping;
+
+/**
+ * A pull-style iterator over the leaf mappings of a range of LBNs. Unlike
+ * the examiners above, the caller asks for each batch of mappings when it
+ * wants them, so a program linking libvdo can stream the block map at the
+ * speed of the underlying reads without a callback or a text dump. The
+ * mappings are produced in LBN order, each page is read at most once, and
+ * only the parts of the trees which cover the range are read.
+ **/
+typedef struct blockMapIterator BlockMapIterator;
+
+/**
+ * Make an iterator over the mappings of a range of LBNs.
+ *
+ * @param [in]  vdo          The VDO, which must outlive the iterator
+ * @param [in]  startLBN     The first LBN to iterate over
+ * @param [in]  endLBN       One more than the last LBN to iterate over
+ * @param [in]  mappedOnly   Whether to skip unmapped LBNs; if false, LBNs
+ *                           whose leaf page has not been allocated are
+ *                           reported as unmapped
+ * @param [out] iteratorPtr  A pointer to hold the iterator
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check makeBlockMapIterator(UserVDO *vdo,
+                                      logical_block_number_t startLBN,
+                                      logical_block_number_t endLBN,
+                                      bool mappedOnly,
+                                      BlockMapIterator **iteratorPtr);
+
+/**
+ * Get the next batch of mappings from a block map iterator.
+ *
+ * @param [in]  iterator  The iterator
+ * @param [out] mappings  An array to hold the mappings
+ * @param [in]  capacity  The size of the array, which must be non-zero
+ * @param [out] countPtr  A pointer to hold the number of mappings produced;
+ *                        it is zero only once the range is exhausted
+ *
+ * @return VDO_SUCCESS or an error code; after an error, the iterator may
+ *         only be freed
+ **/
+int __must_check getNextBlockMappings(BlockMapIterator *iterator,
+                                      BlockMapping *mappings,
+                                      size_t capacity,
+                                      size_t *countPtr);
+
+/**
+ * Free a block map iterator and null out the reference to it.
+ *
+ * @param iteratorPtr  A pointer to the iterator to free
+ **/
+void freeBlockMapIterator(BlockMapIterator **iteratorPtr);
+
 /**
  * Find the PBN for the block map page encoding a particular LBN mapping.
  * This will return the zero block if there is no mapping.
@@ -85,6 +397,44 @@ int __must_check findLBNMapping(UserVDO *vdo,
 				physical_block_number_t *pbnPtr,
 				enum block_mapping_state *statePtr);
 
+/**
+ * Find the PBNs of the block map pages encoding the mappings of a batch of
+ * LBNs. The tree is walked once for the whole batch, so each page is read at
+ * most once, however many of the LBNs it covers.
+ *
+ * @param [in]  vdo       The VDO
+ * @param [in]  lbns      The logical block numbers to look up
+ * @param [in]  count     The number of LBNs
+ * @param [out] pagePBNs  An array to hold the PBN of the page for each LBN,
+ *                        or the zero block if the page has not been
+ *                        allocated
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check findLBNPages(UserVDO *vdo,
+			      const logical_block_number_t *lbns,
+			      size_t count,
+			      physical_block_number_t *pagePBNs);
+
+/**
+ * Look up the mappings of a batch of LBNs. The tree is walked once for the
+ * whole batch, so each page is read at most once, however many of the LBNs
+ * it covers.
+ *
+ * @param [in]  vdo     The VDO
+ * @param [in]  lbns    The logical block numbers to look up
+ * @param [in]  count   The number of LBNs
+ * @param [out] pbns    An array to hold the mapped PBN of each LBN
+ * @param [out] states  An array to hold the mapping state of each LBN
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check findLBNMappings(UserVDO *vdo,
+				 const logical_block_number_t *lbns,
+				 size_t count,
+				 physical_block_number_t *pbns,
+				 enum block_mapping_state *states);
+
 /**
  * Read a single block map page into the buffer. The page will be marked
  * initialized iff the page is valid.
@@ -0,0 +1,506 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/cachingLayer.c#1 $
+ */
+
+#include "cachingLayer.h"
+
+#include <string.h>
+
+#include "hlist.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "permassert.h"
+#include "uds-threads.h"
+
+#include "constants.h"
+#include "numUtils.h"
+#include "statusCodes.h"
+
+enum {
+  /**
+   * Larger extents are assumed to be part of a scan which would only flush
+   * the cache, so they are read around it.
+   **/
+  MAX_CACHED_EXTENT_BLOCKS = 16,
+};
+
+/** A marker for the end of the LRU list */
+static const unsigned int NO_ENTRY = (unsigned int) -1;
+
+/**
+ * A cached block.
+ **/
+typedef struct {
+  /** The entry's node in its hash bucket, if it holds a block */
+  struct hlist_node        hashNode;
+  /** The block held by the entry */
+  physical_block_number_t  pbn;
+  /** Whether the entry holds a block */
+  bool                     valid;
+  /** The neighbors of the entry in the LRU list */
+  unsigned int             newer;
+  unsigned int             older;
+  /** The cached contents of the block */
+  char                    *data;
+} CacheEntry;
+
+typedef struct {
+  PhysicalLayer      common;
+  PhysicalLayer     *underlying;
+  /** Protects all of the fields below */
+  struct mutex       lock;
+  unsigned int       capacity;
+  CacheEntry        *entries;
+  char              *blocks;
+  uint64_t           bucketMask;
+  struct hlist_head *buckets;
+  /** The most and least recently used entries */
+  unsigned int       newest;
+  unsigned int       oldest;
+  uint64_t           hits;
+  uint64_t           misses;
+} CachingLayer;
+
+/**********************************************************************/
+static inline CachingLayer *asCachingLayer(PhysicalLayer *layer)
+{
+  STATIC_ASSERT(offsetof(CachingLayer, common) == 0);
+  return (CachingLayer *) layer;
+}
+
+/**********************************************************************/
+static struct hlist_head *getBucket(CachingLayer            *layer,
+                                    physical_block_number_t  pbn)
+{
+  // Multiplicative hash, taking the high bits which mix best.
+  uint64_t hash = (pbn * 0x9E3779B97F4A7C15ULL) >> 32;
+  return &layer->buckets[hash & layer->bucketMask];
+}
+
+/**********************************************************************/
+static CacheEntry *findEntry(CachingLayer            *layer,
+                             physical_block_number_t  pbn)
+{
+  CacheEntry *entry;
+  hlist_for_each_entry(entry, getBucket(layer, pbn), hashNode) {
+    if (entry->pbn == pbn) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Remove an entry from the LRU list.
+ **/
+static void unlinkEntry(CachingLayer *layer, unsigned int index)
+{
+  CacheEntry *entry = &layer->entries[index];
+  if (entry->newer == NO_ENTRY) {
+    layer->newest = entry->older;
+  } else {
+    layer->entries[entry->newer].older = entry->older;
+  }
+
+  if (entry->older == NO_ENTRY) {
+    layer->oldest = entry->newer;
+  } else {
+    layer->entries[entry->older].newer = entry->newer;
+  }
+}
+
+/**
+ * Make an entry the most recently used.
+ **/
+static void makeNewest(CachingLayer *layer, unsigned int index)
+{
+  CacheEntry *entry = &layer->entries[index];
+  if (layer->newest == index) {
+    return;
+  }
+
+  unlinkEntry(layer, index);
+  entry->newer = NO_ENTRY;
+  entry->older = layer->newest;
+  layer->entries[layer->newest].newer = index;
+  layer->newest = index;
+}
+
+/**
+ * Store a copy of a block in the cache, evicting the least recently used
+ * block if necessary.
+ **/
+static void cacheBlock(CachingLayer            *layer,
+                       physical_block_number_t  pbn,
+                       const char              *data)
+{
+  CacheEntry *entry = findEntry(layer, pbn);
+  if (entry == NULL) {
+    entry = &layer->entries[layer->oldest];
+    if (entry->valid) {
+      hlist_del(&entry->hashNode);
+    }
+
+    entry->pbn   = pbn;
+    entry->valid = true;
+    hlist_add_head(&entry->hashNode, getBucket(layer, pbn));
+  }
+
+  memcpy(entry->data, data, VDO_BLOCK_SIZE);
+  makeNewest(layer, entry - layer->entries);
+}
+
+/**
+ * Drop any cached copies of the blocks in an extent.
+ **/
+static void invalidateExtent(CachingLayer            *layer,
+                             physical_block_number_t  startBlock,
+                             size_t                   blockCount)
+{
+  for (size_t i = 0; i < blockCount; i++) {
+    CacheEntry *entry = findEntry(layer, startBlock + i);
+    if (entry == NULL) {
+      continue;
+    }
+
+    hlist_del(&entry->hashNode);
+    entry->valid = false;
+    // Make the now empty entry the first to be reused.
+    unsigned int index = entry - layer->entries;
+    if (layer->oldest != index) {
+      unlinkEntry(layer, index);
+      entry->older = NO_ENTRY;
+      entry->newer = layer->oldest;
+      layer->entries[layer->oldest].older = index;
+      layer->oldest = index;
+    }
+  }
+}
+
+/**
+ * Copy an extent out of the cache if every block of it is present.
+ *
+ * @return <code>true</code> if the extent was found in the cache
+ **/
+static bool readFromCache(CachingLayer            *layer,
+                          physical_block_number_t  startBlock,
+                          size_t                   blockCount,
+                          char                    *buffer)
+{
+  CacheEntry *found[MAX_CACHED_EXTENT_BLOCKS];
+  for (size_t i = 0; i < blockCount; i++) {
+    found[i] = findEntry(layer, startBlock + i);
+    if (found[i] == NULL) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < blockCount; i++) {
+    memcpy(buffer + (i * VDO_BLOCK_SIZE), found[i]->data, VDO_BLOCK_SIZE);
+    makeNewest(layer, found[i] - layer->entries);
+  }
+  return true;
+}
+
+/**
+ * Implements extent_reader.
+ **/
+static int cachingReader(PhysicalLayer           *header,
+                         physical_block_number_t  startBlock,
+                         size_t                   blockCount,
+                         char                    *buffer)
+{
+  CachingLayer  *layer      = asCachingLayer(header);
+  PhysicalLayer *underlying = layer->underlying;
+  if (blockCount > MAX_CACHED_EXTENT_BLOCKS) {
+    return underlying->reader(underlying, startBlock, blockCount, buffer);
+  }
+
+  uds_lock_mutex(&layer->lock);
+  bool hit = readFromCache(layer, startBlock, blockCount, buffer);
+  if (hit) {
+    layer->hits++;
+  } else {
+    layer->misses++;
+  }
+  uds_unlock_mutex(&layer->lock);
+  if (hit) {
+    return VDO_SUCCESS;
+  }
+
+  int result = underlying->reader(underlying, startBlock, blockCount, buffer);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  uds_lock_mutex(&layer->lock);
+  for (size_t i = 0; i < blockCount; i++) {
+    cacheBlock(layer, startBlock + i, buffer + (i * VDO_BLOCK_SIZE));
+  }
+  uds_unlock_mutex(&layer->lock);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Implements extent_writer.
+ **/
+static int cachingWriter(PhysicalLayer           *header,
+                         physical_block_number_t  startBlock,
+                         size_t                   blockCount,
+                         char                    *buffer)
+{
+  CachingLayer  *layer      = asCachingLayer(header);
+  PhysicalLayer *underlying = layer->underlying;
+  int result = underlying->writer(underlying, startBlock, blockCount, buffer);
+
+  uds_lock_mutex(&layer->lock);
+  if (result != VDO_SUCCESS) {
+    // The device contents are unknown, so forget what was cached.
+    invalidateExtent(layer, startBlock, blockCount);
+  } else {
+    for (size_t i = 0; i < blockCount; i++) {
+      CacheEntry *entry = findEntry(layer, startBlock + i);
+      if (entry != NULL) {
+        memcpy(entry->data, buffer + (i * VDO_BLOCK_SIZE), VDO_BLOCK_SIZE);
+      }
+    }
+  }
+  uds_unlock_mutex(&layer->lock);
+  return result;
+}
+
+/**
+ * Implements extent_zeroer.
+ **/
+static int cachingZeroer(PhysicalLayer           *header,
+                         physical_block_number_t  startBlock,
+                         size_t                   blockCount)
+{
+  CachingLayer  *layer      = asCachingLayer(header);
+  PhysicalLayer *underlying = layer->underlying;
+  if (underlying->zeroExtent == NULL) {
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  uds_lock_mutex(&layer->lock);
+  invalidateExtent(layer, startBlock, blockCount);
+  uds_unlock_mutex(&layer->lock);
+  return underlying->zeroExtent(underlying, startBlock, blockCount);
+}
+
+/**
+ * Implements access_advisor.
+ **/
+static void cachingAdvisor(PhysicalLayer           *header,
+                           physical_block_number_t  startBlock,
+                           block_count_t            blockCount,
+                           enum access_pattern      pattern)
+{
+  PhysicalLayer *underlying = asCachingLayer(header)->underlying;
+  if (underlying->advise != NULL) {
+    underlying->advise(underlying, startBlock, blockCount, pattern);
+  }
+}
+
+/**
+ * Report the I/O done by the underlying layer, since that is what reaches
+ * the device.
+ *
+ * Implements io_statistics_getter.
+ **/
+static void cachingStatistics(PhysicalLayer        *header,
+                              struct io_statistics *stats)
+{
+  PhysicalLayer *underlying = asCachingLayer(header)->underlying;
+  if (underlying->getIOStatistics != NULL) {
+    underlying->getIOStatistics(underlying, stats);
+  } else {
+    *stats = (struct io_statistics) { 0, };
+  }
+}
+
+/**
+ * Read a batch of extents one at a time so that each goes through the cache.
+ *
+ * Implements batch_extent_reader.
+ **/
+static int cachingBatchReader(PhysicalLayer        *header,
+                              struct extent_read   *extents,
+                              size_t                count,
+                              extent_read_callback *callback,
+                              void                 *context)
+{
+  int firstError = VDO_SUCCESS;
+  for (size_t i = 0; i < count; i++) {
+    struct extent_read *extent = &extents[i];
+    extent->result = cachingReader(header, extent->start_block,
+                                   extent->block_count, extent->buffer);
+    if (firstError == VDO_SUCCESS) {
+      firstError = extent->result;
+    }
+
+    if (callback != NULL) {
+      callback(extent, context);
+    }
+  }
+
+  return firstError;
+}
+
+/**********************************************************************/
+static block_count_t getBlockCount(PhysicalLayer *header)
+{
+  PhysicalLayer *underlying = asCachingLayer(header)->underlying;
+  return underlying->getBlockCount(underlying);
+}
+
+/**********************************************************************/
+static int allocateIOBuffer(PhysicalLayer  *header,
+                            size_t          bytes,
+                            const char     *why,
+                            char          **bufferPtr)
+{
+  PhysicalLayer *underlying = asCachingLayer(header)->underlying;
+  return underlying->allocateIOBuffer(underlying, bytes, why, bufferPtr);
+}
+
+/**********************************************************************/
+static int borrowIOBuffer(PhysicalLayer  *header,
+                          size_t          bytes,
+                          const char     *why,
+                          char          **bufferPtr)
+{
+  PhysicalLayer *underlying = asCachingLayer(header)->underlying;
+  return underlying->borrowIOBuffer(underlying, bytes, why, bufferPtr);
+}
+
+/**********************************************************************/
+static void returnIOBuffer(PhysicalLayer *header, size_t bytes, char *buffer)
+{
+  PhysicalLayer *underlying = asCachingLayer(header)->underlying;
+  underlying->returnIOBuffer(underlying, bytes, buffer);
+}
+
+/**********************************************************************/
+static void vacuousFlush(struct vdo_flush *vdoFlush __attribute__((unused)))
+{
+}
+
+/**
+ * Free a CachingLayer and its underlying layer, and NULL out the reference
+ * to it.
+ *
+ * Implements layer_destructor.
+ **/
+static void freeLayer(PhysicalLayer **layerPtr)
+{
+  PhysicalLayer *header = *layerPtr;
+  if (header == NULL) {
+    return;
+  }
+
+  CachingLayer *layer = asCachingLayer(header);
+  uds_log_debug("block cache: %llu hits, %llu misses",
+                (unsigned long long) layer->hits,
+                (unsigned long long) layer->misses);
+  if (layer->underlying != NULL) {
+    layer->underlying->destroy(&layer->underlying);
+  }
+
+  UDS_FREE(layer->entries);
+  UDS_FREE(layer->blocks);
+  UDS_FREE(layer->buckets);
+  uds_destroy_mutex(&layer->lock);
+  UDS_FREE(layer);
+  *layerPtr = NULL;
+}
+
+/**********************************************************************/
+int makeCachingLayer(PhysicalLayer  *underlying,
+                     size_t          budgetBytes,
+                     PhysicalLayer **layerPtr)
+{
+  unsigned int capacity = budgetBytes / VDO_BLOCK_SIZE;
+  int result = ASSERT(capacity >= MAX_CACHED_EXTENT_BLOCKS,
+                      "block cache must hold at least %u blocks",
+                      MAX_CACHED_EXTENT_BLOCKS);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  CachingLayer *layer;
+  result = UDS_ALLOCATE(1, CachingLayer, __func__, &layer);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  result = uds_init_mutex(&layer->lock);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(layer);
+    return result;
+  }
+
+  layer->capacity   = capacity;
+  layer->bucketMask = (1ULL << log_base_two(capacity)) - 1;
+  result = UDS_ALLOCATE(capacity, CacheEntry, "block cache entries",
+                        &layer->entries);
+  if (result == UDS_SUCCESS) {
+    result = UDS_ALLOCATE(layer->bucketMask + 1, struct hlist_head,
+                          "block cache buckets", &layer->buckets);
+  }
+
+  if (result == UDS_SUCCESS) {
+    result = UDS_ALLOCATE((size_t) capacity * VDO_BLOCK_SIZE, char,
+                          "block cache data", &layer->blocks);
+  }
+
+  if (result != UDS_SUCCESS) {
+    freeLayer((PhysicalLayer **) &layer);
+    return result;
+  }
+
+  // Chain every entry into the LRU list, all of them empty.
+  for (unsigned int i = 0; i < capacity; i++) {
+    layer->entries[i] = (CacheEntry) {
+      .newer = ((i == 0) ? NO_ENTRY : i - 1),
+      .older = ((i == capacity - 1) ? NO_ENTRY : i + 1),
+      .data  = layer->blocks + ((size_t) i * VDO_BLOCK_SIZE),
+    };
+  }
+  layer->newest = 0;
+  layer->oldest = capacity - 1;
+
+  layer->underlying              = underlying;
+  layer->common.destroy          = freeLayer;
+  layer->common.getBlockCount    = getBlockCount;
+  layer->common.allocateIOBuffer = allocateIOBuffer;
+  layer->common.borrowIOBuffer   = borrowIOBuffer;
+  layer->common.returnIOBuffer   = returnIOBuffer;
+  layer->common.reader           = cachingReader;
+  layer->common.writer           = cachingWriter;
+  layer->common.readExtents      = cachingBatchReader;
+  layer->common.zeroExtent       = cachingZeroer;
+  layer->common.advise           = cachingAdvisor;
+  layer->common.getIOStatistics  = cachingStatistics;
+  layer->common.completeFlush    = vacuousFlush;
+
+  *layerPtr = &layer->common;
+  return VDO_SUCCESS;
+}
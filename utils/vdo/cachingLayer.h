@@ -0,0 +1,50 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/cachingLayer.h#1 $
+ */
+
+#ifndef CACHING_LAYER_H
+#define CACHING_LAYER_H
+
+#include "physicalLayer.h"
+
+/**
+ * Make a physical layer which keeps a bounded LRU cache of recently read
+ * blocks in front of another layer. Reads of small extents are satisfied
+ * from the cache when every block is present; writes go straight through to
+ * the underlying layer and update any cached copies. The caching layer takes
+ * ownership of the underlying layer and destroys it when it is itself
+ * destroyed.
+ *
+ * Only vdoregenerategeometry uses this, since its candidate probes read the
+ * same few blocks over and over. The other metadata tools read each block
+ * once: lookups of many LBNs share a single walk of the block map, and
+ * scans read extents too large to cache.
+ *
+ * @param [in]  underlying   The layer to cache
+ * @param [in]  budgetBytes  The maximum amount of block data to cache
+ * @param [out] layerPtr     A pointer to hold the new layer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check makeCachingLayer(PhysicalLayer  *underlying,
+                                  size_t          budgetBytes,
+                                  PhysicalLayer **layerPtr);
+
+#endif // CACHING_LAYER_H
@@ -0,0 +1,284 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#include "checksum.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <string.h>
+#include <sys/auxv.h>
+#endif
+
+enum {
+	/* The smallest buffer worth handing to the PCLMULQDQ folding loop */
+	CRC32_FOLD_MINIMUM = 64,
+	/* The smallest buffer worth splitting into interleaved stripes */
+	CRC32_STRIPE_MINIMUM = 3 * 4096,
+	/* The number of stripes a large buffer is split into */
+	CRC32_STRIPES = 3,
+};
+
+#if defined(__x86_64__)
+/*
+ * Constants for folding by four 128-bit lanes, reducing to 64 bits, and the
+ * final Barrett reduction, all for the bit-reflected CRC-32 polynomial
+ * 0x04c11db7 used by zlib. These are x^(4*128+32) mod P, x^(4*128-32) mod P,
+ * x^(128+32) mod P, x^(128-32) mod P, x^64 mod P, P' and mu.
+ */
+static const uint64_t FOLD_BY_4[2] __attribute__((aligned(16))) = {
+	0x0154442bd4, 0x01c6e41596,
+};
+static const uint64_t FOLD_BY_1[2] __attribute__((aligned(16))) = {
+	0x01751997d0, 0x00ccaa009e,
+};
+static const uint64_t FOLD_TO_64[2] __attribute__((aligned(16))) = {
+	0x0163cd6124, 0x0000000000,
+};
+static const uint64_t BARRETT[2] __attribute__((aligned(16))) = {
+	0x01db710641, 0x01f7011641,
+};
+
+/**
+ * Compute the raw (uninverted) CRC-32 of a buffer by carry-less
+ * multiplication.
+ *
+ * @param crc     The raw crc so far
+ * @param buffer  The data, at least CRC32_FOLD_MINIMUM bytes
+ * @param length  The length of the data, a multiple of 16
+ *
+ * @return The updated raw crc
+ **/
+__attribute__((target("sse4.1,pclmul")))
+static uint32_t fold_crc32(uint32_t crc, const byte *buffer, size_t length)
+{
+	const __m128i *in = (const __m128i *) buffer;
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128(in++);
+	x2 = _mm_loadu_si128(in++);
+	x3 = _mm_loadu_si128(in++);
+	x4 = _mm_loadu_si128(in++);
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+	x0 = _mm_load_si128((const __m128i *) FOLD_BY_4);
+	length -= 64;
+
+	while (length >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128(in++);
+		y6 = _mm_loadu_si128(in++);
+		y7 = _mm_loadu_si128(in++);
+		y8 = _mm_loadu_si128(in++);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		length -= 64;
+	}
+
+	/* Fold the four lanes into one. */
+	x0 = _mm_load_si128((const __m128i *) FOLD_BY_1);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (length >= 16) {
+		x2 = _mm_loadu_si128(in++);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		length -= 16;
+	}
+
+	/* Reduce 128 bits to 64. */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_loadl_epi64((const __m128i *) FOLD_TO_64);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduce to 32 bits. */
+	x0 = _mm_load_si128((const __m128i *) BARRETT);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+/**********************************************************************/
+static bool have_hardware_crc32(void)
+{
+	return (__builtin_cpu_supports("pclmul")
+		&& __builtin_cpu_supports("sse4.1"));
+}
+
+/**********************************************************************/
+static crc32_checksum_t hardware_crc32(crc32_checksum_t crc,
+				       const byte *buffer,
+				       size_t length)
+{
+	size_t folded = length & ~((size_t) 15);
+
+	crc = ~fold_crc32(~crc, buffer, folded);
+	return crc32(crc, buffer + folded, length - folded);
+}
+
+#elif defined(__aarch64__)
+
+/**********************************************************************/
+static bool have_hardware_crc32(void)
+{
+	return ((getauxval(AT_HWCAP) & HWCAP_CRC32) != 0);
+}
+
+/**
+ * Compute the raw (uninverted) CRC-32 of a buffer with the CRC32X
+ * instruction.
+ *
+ * @param crc     The raw crc so far
+ * @param buffer  The data
+ * @param length  The length of the data, a multiple of 8
+ *
+ * @return The updated raw crc
+ **/
+__attribute__((target("+crc")))
+static uint32_t crc32_words(uint32_t crc, const byte *buffer, size_t length)
+{
+	size_t i;
+
+	for (i = 0; i < length; i += sizeof(uint64_t)) {
+		uint64_t word;
+
+		memcpy(&word, buffer + i, sizeof(word));
+		crc = __crc32d(crc, word);
+	}
+
+	return crc;
+}
+
+/**
+ * Compute the raw CRC-32s of three buffers at once. CRC32X has a latency of
+ * three cycles but can issue every cycle, so three chains keep it busy.
+ *
+ * @param crcs     The raw crcs so far
+ * @param buffers  The data
+ * @param length   The length of each buffer, a multiple of 8
+ **/
+__attribute__((target("+crc")))
+static void crc32_words_by_3(uint32_t crcs[3],
+			     const byte *const buffers[3],
+			     size_t length)
+{
+	uint32_t crc0 = crcs[0], crc1 = crcs[1], crc2 = crcs[2];
+	size_t i;
+
+	for (i = 0; i < length; i += sizeof(uint64_t)) {
+		uint64_t word0, word1, word2;
+
+		memcpy(&word0, buffers[0] + i, sizeof(word0));
+		memcpy(&word1, buffers[1] + i, sizeof(word1));
+		memcpy(&word2, buffers[2] + i, sizeof(word2));
+		crc0 = __crc32d(crc0, word0);
+		crc1 = __crc32d(crc1, word1);
+		crc2 = __crc32d(crc2, word2);
+	}
+
+	crcs[0] = crc0;
+	crcs[1] = crc1;
+	crcs[2] = crc2;
+}
+
+/**
+ * Checksum a large buffer as three interleaved stripes, then combine the
+ * stripe checksums.
+ **/
+static crc32_checksum_t hardware_crc32(crc32_checksum_t crc,
+				       const byte *buffer,
+				       size_t length)
+{
+	size_t stripe = (length / CRC32_STRIPES) & ~((size_t) 7);
+	uint32_t crcs[CRC32_STRIPES] = { ~crc, ~0U, ~0U };
+	const byte *stripes[CRC32_STRIPES] = {
+		buffer,
+		buffer + stripe,
+		buffer + (2 * stripe),
+	};
+	size_t done = CRC32_STRIPES * stripe;
+
+	if (length < CRC32_STRIPE_MINIMUM) {
+		size_t words = length & ~((size_t) 7);
+
+		crc = ~crc32_words(~crc, buffer, words);
+		return crc32(crc, buffer + words, length - words);
+	}
+
+	crc32_words_by_3(crcs, stripes, stripe);
+	crc = crc32_combine(~crcs[0], ~crcs[1], stripe);
+	crc = crc32_combine(crc, ~crcs[2], stripe);
+	return crc32(crc, buffer + done, length - done);
+}
+
+#else
+
+/**********************************************************************/
+static bool have_hardware_crc32(void)
+{
+	return false;
+}
+
+/**********************************************************************/
+static crc32_checksum_t hardware_crc32(crc32_checksum_t crc,
+				       const byte *buffer,
+				       size_t length)
+{
+	return crc32(crc, buffer, length);
+}
+
+#endif
+
+/**********************************************************************/
+crc32_checksum_t vdo_update_crc32(crc32_checksum_t crc,
+				  const byte *buffer,
+				  size_t length)
+{
+	if ((length < CRC32_FOLD_MINIMUM) || !have_hardware_crc32()) {
+		return crc32(crc, buffer, length);
+	}
+
+	return hardware_crc32(crc, buffer, length);
+}
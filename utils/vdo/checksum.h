@@ -24,6 +24,8 @@
 
 #include <zlib.h>
 
+#include "types.h"
+
 /**
  * A CRC-32 checksum
  **/
@@ -37,7 +39,8 @@ enum {
 };
 
 /**
- * A function to update a running CRC-32 checksum.
+ * A function to update a running CRC-32 checksum. The result is the same as
+ * zlib's crc32(), which remains the fallback when the CPU has no CRC support.
  *
  * @param crc     The current value of the crc
  * @param buffer  The data to add to the checksum
@@ -45,11 +48,8 @@ enum {
  *
  * @return The updated value of the checksum
  **/
-static inline crc32_checksum_t vdo_update_crc32(crc32_checksum_t crc,
-						const byte *buffer,
-			                	size_t length)
-{
-	return crc32(crc, buffer, length);
-}
+crc32_checksum_t vdo_update_crc32(crc32_checksum_t crc,
+				  const byte *buffer,
+				  size_t length);
 
 #endif // CHECKSUM_H
@@ -0,0 +1,897 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/coalescingWriter.c#1 $
+ */
+
+#include "coalescingWriter.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "fileUtils.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "permassert.h"
+#include "uds-threads.h"
+
+#include "constants.h"
+#include "statusCodes.h"
+
+#include "compressedDump.h"
+#include "deltaDump.h"
+
+enum {
+  // The number of words of a block checked for zeros at once.
+  ZERO_CHECK_WORDS    = 8,
+  // The most threads a compressing writer will use.
+  MAX_COMPRESSORS     = 64,
+  // The number of buffers in flight beyond one for each compressor.
+  EXTRA_FRAME_BUFFERS = 2,
+};
+
+/** The states of a buffer of a compressing writer */
+typedef enum {
+  FRAME_FREE,
+  FRAME_FILLED,
+  FRAME_COMPRESSING,
+  FRAME_COMPRESSED,
+} FrameState;
+
+/** A buffer of blocks being compressed into a frame */
+typedef struct {
+  FrameState     state;
+  /** The blocks to compress */
+  char          *input;
+  block_count_t  blockCount;
+  /** The frame header followed by the compressed blocks */
+  byte          *output;
+  size_t         outputBytes;
+  int            result;
+} Frame;
+
+/**
+ * The state of a compressing writer. The frames form a ring which the
+ * writer fills in order; the compressing threads take filled frames in
+ * order, and the writer writes out compressed frames in order, so the
+ * output is in the order the blocks were added however the compression is
+ * scheduled.
+ **/
+typedef struct {
+  unsigned int     threadCount;
+  struct thread  **threads;
+  unsigned int     frameCount;
+  Frame           *frames;
+  /** The capacity of each output buffer */
+  size_t           outputCapacity;
+  /** Protects everything below */
+  struct mutex     lock;
+  struct cond_var  changed;
+  /** The numbers of frames filled, taken for compression, and written */
+  uint64_t         filled;
+  uint64_t         taken;
+  uint64_t         written;
+  /** Set when no more frames will be filled */
+  bool             closing;
+  /** Whether the lock and condition have been initialized */
+  bool             synchronized;
+} Compressor;
+
+/** The state of a writer writing an incremental dump */
+typedef struct {
+  /** The dump being compared against, which the writer does not own */
+  PhysicalLayer           *base;
+  block_count_t            baseBlocks;
+  /** A buffer for the base blocks matching the writer's buffer */
+  char                    *baseBuffer;
+  /** The position in the full dump of the first block in the buffer */
+  physical_block_number_t  position;
+  /** The position in the full dump of each block written so far */
+  physical_block_number_t *changed;
+  block_count_t            changedCount;
+  block_count_t            changedCapacity;
+} Delta;
+
+struct coalescingWriter {
+  int            fd;
+  /** The buffer of blocks not yet written out */
+  char          *buffer;
+  /** The capacity of the buffer, in blocks */
+  block_count_t  capacity;
+  /** The number of blocks in the buffer */
+  block_count_t  filled;
+  /** Whether runs of zero blocks are skipped rather than written */
+  bool           sparse;
+  /** The offset in the file of the first block in the buffer */
+  off_t          offset;
+  /** Whether the output so far ends in a hole */
+  bool           endsInHole;
+  /** Whether the output is standard output, which is not synced or closed */
+  bool           toStdout;
+  /** The compression state, or NULL if the output is not compressed */
+  Compressor    *compressor;
+  /** The incremental dump state, or NULL if the output is a full dump */
+  Delta         *delta;
+};
+
+/**
+ * Close a writer's output file, unless it is standard output.
+ *
+ * @param writer  The writer
+ **/
+static void closeOutput(CoalescingWriter *writer)
+{
+  if (!writer->toStdout) {
+    try_close_file(writer->fd);
+  }
+}
+
+/**********************************************************************/
+int makeCoalescingWriter(const char        *path,
+                         size_t             bufferBytes,
+                         bool               direct,
+                         CoalescingWriter **writerPtr)
+{
+  int result = ASSERT(((bufferBytes % VDO_BLOCK_SIZE) == 0)
+                      && (bufferBytes > 0),
+                      "output buffer must be a positive multiple of the"
+                      " block size");
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  CoalescingWriter *writer;
+  result = UDS_ALLOCATE(1, CoalescingWriter, __func__, &writer);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  result = uds_allocate_memory(bufferBytes, VDO_BLOCK_SIZE, "output buffer",
+                               &writer->buffer);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(writer);
+    return result;
+  }
+
+  writer->toStdout = (strcmp(path, "-") == 0);
+  if (writer->toStdout) {
+    writer->fd = STDOUT_FILENO;
+  } else {
+    enum file_access access
+      = (direct ? FU_CREATE_WRITE_ONLY_DIRECT : FU_CREATE_WRITE_ONLY);
+    result = open_file(path, access, &writer->fd);
+    if (result != UDS_SUCCESS) {
+      UDS_FREE(writer->buffer);
+      UDS_FREE(writer);
+      return result;
+    }
+  }
+
+  // Only a regular file is sure to read back zeros from the holes, and
+  // standard output may be appending to one.
+  struct stat statBuf;
+  result = logging_fstat(writer->fd, &statBuf, "output file");
+  if (result != UDS_SUCCESS) {
+    closeOutput(writer);
+    UDS_FREE(writer->buffer);
+    UDS_FREE(writer);
+    return result;
+  }
+
+  writer->sparse   = (S_ISREG(statBuf.st_mode) && !writer->toStdout);
+  writer->capacity = bufferBytes / VDO_BLOCK_SIZE;
+  *writerPtr = writer;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Check whether a block is entirely zero. The words are ORed together a
+ * chunk at a time so that the compiler can vectorize the loop.
+ *
+ * @param block  The block to check, which must be aligned for uint64_t
+ *
+ * @return <code>true</code> if the block is all zeros
+ **/
+static bool isZeroBlock(const char *block)
+{
+  const uint64_t *words = (const uint64_t *) block;
+  for (size_t i = 0; i < VDO_BLOCK_SIZE / sizeof(uint64_t);
+       i += ZERO_CHECK_WORDS) {
+    uint64_t bits = 0;
+    for (size_t j = 0; j < ZERO_CHECK_WORDS; j++) {
+      bits |= words[i + j];
+    }
+
+    if (bits != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Write out the blocks in a writer's buffer, leaving holes in the file for
+ * runs of zero blocks if the writer is sparse.
+ *
+ * @param writer  The writer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int writeSparseBlocks(CoalescingWriter *writer)
+{
+  block_count_t start = 0;
+  while (start < writer->filled) {
+    bool zero = isZeroBlock(writer->buffer + (start * VDO_BLOCK_SIZE));
+    block_count_t end = start + 1;
+    while ((end < writer->filled)
+           && (isZeroBlock(writer->buffer + (end * VDO_BLOCK_SIZE)) == zero)) {
+      end++;
+    }
+
+    off_t offset = writer->offset + (start * VDO_BLOCK_SIZE);
+    if (!zero) {
+      int result = write_buffer_at_offset(writer->fd, offset,
+                                          writer->buffer
+                                          + (start * VDO_BLOCK_SIZE),
+                                          (end - start) * VDO_BLOCK_SIZE);
+      if (result != UDS_SUCCESS) {
+        return result;
+      }
+    }
+
+    writer->endsInHole = zero;
+    start = end;
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Compress the blocks of a frame into its output buffer, after the frame
+ * header.
+ *
+ * @param compressor  The compressor
+ * @param frame       The frame to compress
+ **/
+static void compressFrame(Compressor *compressor, Frame *frame)
+{
+  uLongf compressedBytes
+    = compressor->outputCapacity - COMPRESSED_FRAME_HEADER_BYTES;
+  int zResult = compress2(frame->output + COMPRESSED_FRAME_HEADER_BYTES,
+                          &compressedBytes, (const Bytef *) frame->input,
+                          frame->blockCount * VDO_BLOCK_SIZE, Z_BEST_SPEED);
+  if (zResult != Z_OK) {
+    // With an output buffer of compressBound() bytes, only memory can fail.
+    frame->result = uds_log_error_strerror(ENOMEM,
+                                           "zlib compression failed: %d",
+                                           zResult);
+    return;
+  }
+
+  size_t offset = 0;
+  encode_uint32_le(frame->output, &offset, compressedBytes);
+  encode_uint32_le(frame->output, &offset, frame->blockCount);
+  frame->outputBytes = offset + compressedBytes;
+  frame->result      = VDO_SUCCESS;
+}
+
+/**
+ * Compress filled frames in order until the writer is closed. This is the
+ * body of each compressing thread.
+ *
+ * @param arg  The Compressor
+ **/
+static void compressFrames(void *arg)
+{
+  Compressor *compressor = arg;
+  uds_lock_mutex(&compressor->lock);
+  for (;;) {
+    if (compressor->taken == compressor->filled) {
+      if (compressor->closing) {
+        break;
+      }
+
+      uds_wait_cond(&compressor->changed, &compressor->lock);
+      continue;
+    }
+
+    Frame *frame
+      = &compressor->frames[compressor->taken++ % compressor->frameCount];
+    frame->state = FRAME_COMPRESSING;
+    uds_unlock_mutex(&compressor->lock);
+    compressFrame(compressor, frame);
+    uds_lock_mutex(&compressor->lock);
+    frame->state = FRAME_COMPRESSED;
+    uds_broadcast_cond(&compressor->changed);
+  }
+  uds_unlock_mutex(&compressor->lock);
+}
+
+/**
+ * Write out compressed frames in order. The caller must hold the
+ * compressor's lock, which is dropped while each frame is written.
+ *
+ * @param writer   The writer
+ * @param waitFor  The number of frames which must have been written before
+ *                 returning; any later frames are written only if they have
+ *                 already been compressed
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int writeCompressedFrames(CoalescingWriter *writer, uint64_t waitFor)
+{
+  Compressor *compressor = writer->compressor;
+  while (compressor->written < compressor->filled) {
+    Frame *frame
+      = &compressor->frames[compressor->written % compressor->frameCount];
+    if (frame->state != FRAME_COMPRESSED) {
+      if (compressor->written >= waitFor) {
+        return VDO_SUCCESS;
+      }
+
+      uds_wait_cond(&compressor->changed, &compressor->lock);
+      continue;
+    }
+
+    uds_unlock_mutex(&compressor->lock);
+    int result = frame->result;
+    if (result == VDO_SUCCESS) {
+      result = write_buffer(writer->fd, frame->output, frame->outputBytes);
+    }
+    uds_lock_mutex(&compressor->lock);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    frame->state = FRAME_FREE;
+    compressor->written++;
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Hand the blocks in a writer's buffer to the compressing threads, taking
+ * the buffer of a free frame in exchange. If every frame is busy, write out
+ * the oldest once it has been compressed.
+ *
+ * @param writer  The writer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int submitFrame(CoalescingWriter *writer)
+{
+  Compressor *compressor = writer->compressor;
+  uds_lock_mutex(&compressor->lock);
+  Frame *frame
+    = &compressor->frames[compressor->filled % compressor->frameCount];
+  int result = VDO_SUCCESS;
+  if (frame->state != FRAME_FREE) {
+    // The frame is the oldest one not yet written.
+    result = writeCompressedFrames(writer, compressor->written + 1);
+  }
+
+  if (result == VDO_SUCCESS) {
+    char *input        = frame->input;
+    frame->input       = writer->buffer;
+    frame->blockCount  = writer->filled;
+    frame->state       = FRAME_FILLED;
+    writer->buffer     = input;
+    compressor->filled++;
+    uds_broadcast_cond(&compressor->changed);
+    result = writeCompressedFrames(writer, 0);
+  }
+
+  uds_unlock_mutex(&compressor->lock);
+  return result;
+}
+
+/**
+ * Stop the compressing threads and free a writer's compressor, which may
+ * have been only partly made.
+ *
+ * @param writer  The writer
+ **/
+static void freeCompressor(CoalescingWriter *writer)
+{
+  Compressor *compressor = writer->compressor;
+  if (compressor == NULL) {
+    return;
+  }
+
+  if (compressor->synchronized) {
+    uds_lock_mutex(&compressor->lock);
+    compressor->closing = true;
+    uds_broadcast_cond(&compressor->changed);
+    uds_unlock_mutex(&compressor->lock);
+    for (unsigned int i = 0; i < compressor->threadCount; i++) {
+      uds_join_threads(compressor->threads[i]);
+    }
+
+    uds_destroy_cond(&compressor->changed);
+    uds_destroy_mutex(&compressor->lock);
+  }
+
+  for (unsigned int i = 0; i < compressor->frameCount; i++) {
+    UDS_FREE(compressor->frames[i].input);
+    UDS_FREE(compressor->frames[i].output);
+  }
+
+  UDS_FREE(compressor->frames);
+  UDS_FREE(compressor->threads);
+  UDS_FREE(compressor);
+  writer->compressor = NULL;
+}
+
+/**
+ * Give a writer a compressor and start its threads. On failure, the
+ * partly made compressor is left for freeCompressor().
+ *
+ * @param writer       The writer
+ * @param threadCount  The number of compressing threads
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int makeCompressor(CoalescingWriter *writer, unsigned int threadCount)
+{
+  Compressor *compressor;
+  int result = UDS_ALLOCATE(1, Compressor, __func__, &compressor);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  writer->compressor = compressor;
+  size_t bufferBytes = writer->capacity * VDO_BLOCK_SIZE;
+  compressor->outputCapacity
+    = COMPRESSED_FRAME_HEADER_BYTES + compressBound(bufferBytes);
+  unsigned int frameCount = threadCount + EXTRA_FRAME_BUFFERS;
+  result = UDS_ALLOCATE(frameCount, Frame, __func__, &compressor->frames);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  compressor->frameCount = frameCount;
+  for (unsigned int i = 0; i < frameCount; i++) {
+    result = uds_allocate_memory(bufferBytes, VDO_BLOCK_SIZE, "frame buffer",
+                                 &compressor->frames[i].input);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    result = UDS_ALLOCATE(compressor->outputCapacity, byte, "frame",
+                          &compressor->frames[i].output);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  result = UDS_ALLOCATE(threadCount, struct thread *, __func__,
+                        &compressor->threads);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = uds_init_mutex(&compressor->lock);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = uds_init_cond(&compressor->changed);
+  if (result != VDO_SUCCESS) {
+    uds_destroy_mutex(&compressor->lock);
+    return result;
+  }
+
+  compressor->synchronized = true;
+  while (compressor->threadCount < threadCount) {
+    result = uds_create_thread(compressFrames, compressor, "vdoCompress",
+                               &compressor->threads[compressor->threadCount]);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    compressor->threadCount++;
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int makeCompressingWriter(const char        *path,
+                          size_t             bufferBytes,
+                          unsigned int       threadCount,
+                          CoalescingWriter **writerPtr)
+{
+  CoalescingWriter *writer;
+  int result = makeCoalescingWriter(path, bufferBytes, false, &writer);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  // Zero blocks compress to almost nothing, so there is no need for holes.
+  writer->sparse = false;
+
+  byte   header[COMPRESSED_DUMP_HEADER_BYTES];
+  size_t offset = 0;
+  memcpy(header, COMPRESSED_DUMP_MAGIC, COMPRESSED_DUMP_MAGIC_BYTES);
+  offset += COMPRESSED_DUMP_MAGIC_BYTES;
+  encode_uint32_le(header, &offset, COMPRESSED_DUMP_VERSION);
+  encode_uint32_le(header, &offset, writer->capacity);
+  result = write_buffer(writer->fd, header, offset);
+  if (result != UDS_SUCCESS) {
+    freeCoalescingWriter(&writer);
+    return result;
+  }
+
+  if (threadCount == 0) {
+    threadCount = uds_get_num_cores();
+  }
+
+  threadCount = max(min(threadCount, (unsigned int) MAX_COMPRESSORS), 1U);
+  result = makeCompressor(writer, threadCount);
+  if (result != VDO_SUCCESS) {
+    freeCoalescingWriter(&writer);
+    return result;
+  }
+
+  *writerPtr = writer;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Free a writer's incremental dump state.
+ *
+ * @param writer  The writer
+ **/
+static void freeDelta(CoalescingWriter *writer)
+{
+  Delta *delta = writer->delta;
+  if (delta == NULL) {
+    return;
+  }
+
+  UDS_FREE(delta->baseBuffer);
+  UDS_FREE(delta->changed);
+  UDS_FREE(delta);
+  writer->delta = NULL;
+}
+
+/**********************************************************************/
+int makeDeltaWriter(const char        *path,
+                    size_t             bufferBytes,
+                    PhysicalLayer     *base,
+                    const char        *baseName,
+                    CoalescingWriter **writerPtr)
+{
+  size_t nameLength = strlen(baseName);
+  if ((nameLength == 0) || (nameLength > DELTA_DUMP_MAX_BASE_NAME)) {
+    return uds_log_error_strerror(VDO_OUT_OF_RANGE,
+                                  "base dump name must be 1 to %u bytes",
+                                  DELTA_DUMP_MAX_BASE_NAME);
+  }
+
+  CoalescingWriter *writer;
+  int result = makeCoalescingWriter(path, bufferBytes, false, &writer);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  // The block index is written after the blocks, so there must be no hole.
+  writer->sparse = false;
+  result = UDS_ALLOCATE(1, Delta, __func__, &writer->delta);
+  if (result == VDO_SUCCESS) {
+    result = base->allocateIOBuffer(base, bufferBytes, "base blocks",
+                                    &writer->delta->baseBuffer);
+  }
+
+  if (result != VDO_SUCCESS) {
+    freeCoalescingWriter(&writer);
+    return result;
+  }
+
+  writer->delta->base       = base;
+  writer->delta->baseBlocks = base->getBlockCount(base);
+
+  byte   header[VDO_BLOCK_SIZE] = { 0 };
+  size_t offset = 0;
+  memcpy(header, DELTA_DUMP_MAGIC, DELTA_DUMP_MAGIC_BYTES);
+  offset += DELTA_DUMP_MAGIC_BYTES;
+  encode_uint32_le(header, &offset, DELTA_DUMP_VERSION);
+  encode_uint32_le(header, &offset, nameLength);
+  encode_uint64_le(header, &offset, writer->delta->baseBlocks);
+  memcpy(header + offset, baseName, nameLength);
+  result = write_buffer(writer->fd, header, sizeof(header));
+  if (result != UDS_SUCCESS) {
+    freeCoalescingWriter(&writer);
+    return result;
+  }
+
+  *writerPtr = writer;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Remove the blocks in a writer's buffer which match the blocks at the same
+ * positions in the base dump, and record the positions of the rest.
+ *
+ * @param writer  The writer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int dropUnchangedBlocks(CoalescingWriter *writer)
+{
+  Delta *delta = writer->delta;
+  block_count_t inBase = 0;
+  if (delta->position < delta->baseBlocks) {
+    inBase = min(writer->filled, delta->baseBlocks - delta->position);
+    int result = delta->base->reader(delta->base, delta->position, inBase,
+                                     delta->baseBuffer);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  if (delta->changedCount + writer->filled > delta->changedCapacity) {
+    block_count_t capacity = max(delta->changedCapacity * 2,
+                                 delta->changedCount + writer->filled);
+    int result
+      = uds_reallocate_memory(delta->changed,
+                              (delta->changedCapacity
+                               * sizeof(physical_block_number_t)),
+                              capacity * sizeof(physical_block_number_t),
+                              "changed block index", &delta->changed);
+    if (result != UDS_SUCCESS) {
+      return result;
+    }
+
+    delta->changedCapacity = capacity;
+  }
+
+  block_count_t kept = 0;
+  for (block_count_t i = 0; i < writer->filled; i++) {
+    char *block = writer->buffer + (i * VDO_BLOCK_SIZE);
+    if ((i < inBase)
+        && (memcmp(block, delta->baseBuffer + (i * VDO_BLOCK_SIZE),
+                   VDO_BLOCK_SIZE) == 0)) {
+      continue;
+    }
+
+    if (kept < i) {
+      memcpy(writer->buffer + (kept * VDO_BLOCK_SIZE), block,
+             VDO_BLOCK_SIZE);
+    }
+
+    delta->changed[delta->changedCount++] = delta->position + i;
+    kept++;
+  }
+
+  delta->position += writer->filled;
+  writer->filled   = kept;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Write out the blocks in a writer's buffer.
+ *
+ * @param writer  The writer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int flushCoalescingWriter(CoalescingWriter *writer)
+{
+  if (writer->filled == 0) {
+    return VDO_SUCCESS;
+  }
+
+  if (writer->compressor != NULL) {
+    int result = submitFrame(writer);
+    if (result == VDO_SUCCESS) {
+      writer->filled = 0;
+    }
+    return result;
+  }
+
+  if (writer->delta != NULL) {
+    int result = dropUnchangedBlocks(writer);
+    if ((result != VDO_SUCCESS) || (writer->filled == 0)) {
+      return result;
+    }
+  }
+
+  int result = (writer->sparse
+                ? writeSparseBlocks(writer)
+                : write_buffer(writer->fd, writer->buffer,
+                               writer->filled * VDO_BLOCK_SIZE));
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  writer->offset += writer->filled * VDO_BLOCK_SIZE;
+  writer->filled  = 0;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int reserveCoalescedBlocks(CoalescingWriter  *writer,
+                           block_count_t      blockCount,
+                           char             **spacePtr)
+{
+  int result = ASSERT(blockCount <= writer->capacity,
+                      "reservation of %llu blocks fits in %llu block buffer",
+                      (unsigned long long) blockCount,
+                      (unsigned long long) writer->capacity);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  if (writer->filled + blockCount > writer->capacity) {
+    result = flushCoalescingWriter(writer);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  *spacePtr = writer->buffer + (writer->filled * VDO_BLOCK_SIZE);
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+void commitCoalescedBlocks(CoalescingWriter *writer, block_count_t blockCount)
+{
+  writer->filled += blockCount;
+}
+
+/**********************************************************************/
+int copyCoalescedBlocks(CoalescingWriter        *writer,
+                        PhysicalLayer           *layer,
+                        physical_block_number_t  startBlock,
+                        block_count_t            blockCount)
+{
+  if ((writer->compressor != NULL) || (writer->delta != NULL)
+      || (layer->copyExtent == NULL)) {
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  int result = flushCoalescingWriter(writer);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  // A sparse writer places its blocks with pwrite(), so the file position
+  // is meaningless and the copy must go to the writer's offset too.
+  off_t offset = writer->offset;
+  result = layer->copyExtent(layer, startBlock, blockCount, writer->fd,
+                             (writer->sparse ? &offset : NULL));
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  writer->offset     += blockCount * VDO_BLOCK_SIZE;
+  writer->endsInHole  = false;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Write out the last frames of a compressing writer, and the frame header
+ * which marks the end of the output.
+ *
+ * @param writer  The writer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int finishCompressedOutput(CoalescingWriter *writer)
+{
+  Compressor *compressor = writer->compressor;
+  uds_lock_mutex(&compressor->lock);
+  int result = writeCompressedFrames(writer, compressor->filled);
+  uds_unlock_mutex(&compressor->lock);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  byte end[COMPRESSED_FRAME_HEADER_BYTES] = { 0 };
+  return write_buffer(writer->fd, end, sizeof(end));
+}
+
+/**
+ * Write out the block index and trailer of an incremental dump.
+ *
+ * @param writer  The writer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int finishDeltaOutput(CoalescingWriter *writer)
+{
+  Delta *delta = writer->delta;
+  size_t indexBytes = delta->changedCount * sizeof(uint64_t);
+  byte *index;
+  int result = UDS_ALLOCATE(indexBytes + DELTA_DUMP_TRAILER_BYTES, byte,
+                            "changed block index", &index);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  size_t offset = 0;
+  for (block_count_t i = 0; i < delta->changedCount; i++) {
+    encode_uint64_le(index, &offset, delta->changed[i]);
+  }
+
+  encode_uint64_le(index, &offset, delta->position);
+  encode_uint64_le(index, &offset, delta->changedCount);
+  memcpy(index + offset, DELTA_DUMP_MAGIC, DELTA_DUMP_MAGIC_BYTES);
+  offset += DELTA_DUMP_MAGIC_BYTES;
+  result = write_buffer(writer->fd, index, offset);
+  UDS_FREE(index);
+  return result;
+}
+
+/**********************************************************************/
+int closeCoalescingWriter(CoalescingWriter **writerPtr)
+{
+  CoalescingWriter *writer = *writerPtr;
+  int result = flushCoalescingWriter(writer);
+  if ((result == VDO_SUCCESS) && (writer->compressor != NULL)) {
+    result = finishCompressedOutput(writer);
+  }
+
+  if ((result == VDO_SUCCESS) && (writer->delta != NULL)) {
+    result = finishDeltaOutput(writer);
+  }
+
+  freeCompressor(writer);
+  freeDelta(writer);
+  if ((result == VDO_SUCCESS) && writer->endsInHole
+      && (ftruncate(writer->fd, writer->offset) != 0)) {
+    // Extend the file over the trailing hole.
+    result = errno;
+  }
+
+  if (writer->toStdout) {
+    // Standard output may be a pipe, which cannot be synced.
+  } else if (result == VDO_SUCCESS) {
+    result = sync_and_close_file(writer->fd, "cannot sync output file");
+  } else {
+    try_close_file(writer->fd);
+  }
+
+  UDS_FREE(writer->buffer);
+  UDS_FREE(writer);
+  *writerPtr = NULL;
+  return result;
+}
+
+/**********************************************************************/
+void freeCoalescingWriter(CoalescingWriter **writerPtr)
+{
+  CoalescingWriter *writer = *writerPtr;
+  if (writer == NULL) {
+    return;
+  }
+
+  freeCompressor(writer);
+  freeDelta(writer);
+  closeOutput(writer);
+  UDS_FREE(writer->buffer);
+  UDS_FREE(writer);
+  *writerPtr = NULL;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/coalescingWriter.h#1 $
+ */
+
+#ifndef COALESCING_WRITER_H
+#define COALESCING_WRITER_H
+
+#include "physicalLayer.h"
+#include "types.h"
+
+/**
+ * A CoalescingWriter gathers consecutive blocks destined for an output file
+ * into a large aligned buffer and writes them out in one go when the buffer
+ * fills, so that tools which produce their output a block or an extent at a
+ * time still issue large writes. If the output is a regular file, runs of
+ * blocks which are entirely zero are skipped rather than written, leaving
+ * holes, so that the file is sparse.
+ **/
+typedef struct coalescingWriter CoalescingWriter;
+
+/**
+ * Create an output file and a writer for it.
+ *
+ * @param [in]  path         The name of the file to create, or "-" for
+ *                           standard output
+ * @param [in]  bufferBytes  The size of the writes to issue, which must be a
+ *                           multiple of the VDO block size
+ * @param [in]  direct       Whether to write the file with O_DIRECT
+ * @param [out] writerPtr    A pointer to hold the new writer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check makeCoalescingWriter(const char        *path,
+                                      size_t             bufferBytes,
+                                      bool               direct,
+                                      CoalescingWriter **writerPtr);
+
+/**
+ * Create a writer which writes a compressed dump, in the format described
+ * in compressedDump.h, to an output file. Each buffer of blocks becomes a
+ * frame, compressed by a pool of threads and written out in order.
+ *
+ * @param [in]  path         The name of the file to create, or "-" for
+ *                           standard output
+ * @param [in]  bufferBytes  The number of bytes of blocks in each frame,
+ *                           which must be a multiple of the VDO block size
+ * @param [in]  threadCount  The number of compressing threads, or 0 for one
+ *                           for each core
+ * @param [out] writerPtr    A pointer to hold the new writer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check makeCompressingWriter(const char        *path,
+                                       size_t             bufferBytes,
+                                       unsigned int       threadCount,
+                                       CoalescingWriter **writerPtr);
+
+/**
+ * Create a writer which writes an incremental dump, in the format described
+ * in deltaDump.h, to an output file. Each block added is compared with the
+ * block at the same position in a base dump, and only those which differ
+ * are written, along with an index of where they belong.
+ *
+ * @param [in]  path         The name of the file to create, or "-" for
+ *                           standard output
+ * @param [in]  bufferBytes  The size of the writes to issue, which must be a
+ *                           multiple of the VDO block size
+ * @param [in]  base         A layer reading the base dump, which must
+ *                           outlive the writer
+ * @param [in]  baseName     The name of the base dump to record
+ * @param [out] writerPtr    A pointer to hold the new writer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check makeDeltaWriter(const char        *path,
+                                 size_t             bufferBytes,
+                                 PhysicalLayer     *base,
+                                 const char        *baseName,
+                                 CoalescingWriter **writerPtr);
+
+/**
+ * Get space in the writer's buffer for the next blocks of output, writing
+ * out the buffered blocks first if there is not enough room. The caller
+ * fills in the space and then calls commitCoalescedBlocks(). The space is
+ * aligned for direct I/O, so it may be read into directly.
+ *
+ * @param [in]  writer      The writer
+ * @param [in]  blockCount  The number of blocks needed, no more than fit in
+ *                          the writer's buffer
+ * @param [out] spacePtr    A pointer to hold the space
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check reserveCoalescedBlocks(CoalescingWriter  *writer,
+                                        block_count_t      blockCount,
+                                        char             **spacePtr);
+
+/**
+ * Add blocks which have been filled in after a call to
+ * reserveCoalescedBlocks() to the output.
+ *
+ * @param writer      The writer
+ * @param blockCount  The number of blocks filled in, no more than were
+ *                    reserved
+ **/
+void commitCoalescedBlocks(CoalescingWriter *writer, block_count_t blockCount);
+
+/**
+ * Add an extent of a layer to the output by having the kernel copy it
+ * straight to the output file, after writing out any buffered blocks. Zero
+ * blocks copied this way are written rather than left as holes. Only plain
+ * writers can do this, and only from layers which support copyExtent().
+ *
+ * @param writer      The writer
+ * @param layer       The layer to copy from
+ * @param startBlock  The first block of the extent
+ * @param blockCount  The number of blocks in the extent
+ *
+ * @return VDO_SUCCESS, VDO_NOT_IMPLEMENTED if nothing has been added because
+ *         the extent must be added through reserveCoalescedBlocks() instead,
+ *         or an error code
+ **/
+int __must_check copyCoalescedBlocks(CoalescingWriter        *writer,
+                                     PhysicalLayer           *layer,
+                                     physical_block_number_t  startBlock,
+                                     block_count_t            blockCount);
+
+/**
+ * Write out any buffered blocks, sync and close the output file, and free
+ * the writer.
+ *
+ * @param writerPtr  A pointer to the writer, which will be NULLed out
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check closeCoalescingWriter(CoalescingWriter **writerPtr);
+
+/**
+ * Close the output file and free a writer, discarding any blocks which have
+ * not yet been written out.
+ *
+ * @param writerPtr  A pointer to the writer, which will be NULLed out
+ **/
+void freeCoalescingWriter(CoalescingWriter **writerPtr);
+
+#endif // COALESCING_WRITER_H
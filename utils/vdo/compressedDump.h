@@ -0,0 +1,52 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/compressedDump.h#1 $
+ */
+
+
+#ifndef COMPRESSED_DUMP_H
+#define COMPRESSED_DUMP_H
+
+#include "types.h"
+
+/**
+ * The format of a compressed metadata dump, as written by vdodumpmetadata
+ * --compress and read by the layer made by makeCompressedDumpLayer().
+ *
+ * The dump starts with a header holding COMPRESSED_DUMP_MAGIC, the format
+ * version, and the largest number of blocks in a frame, each as a
+ * little-endian uint32_t after the magic. The blocks of the dump follow in
+ * order in frames, each of which is an 8 byte frame header holding the
+ * number of compressed bytes in the frame and the number of blocks they
+ * expand to, followed by those blocks compressed as a single zlib stream.
+ * Frames are compressed independently, so that they may be compressed in
+ * parallel and decompressed in any order. A frame header of two zeros marks
+ * the end of the dump, so that a truncated dump can be recognized.
+ **/
+
+static const char COMPRESSED_DUMP_MAGIC[] = "VDOZDUMP";
+
+enum {
+  COMPRESSED_DUMP_VERSION       = 1,
+  COMPRESSED_DUMP_MAGIC_BYTES   = sizeof(COMPRESSED_DUMP_MAGIC) - 1,
+  COMPRESSED_DUMP_HEADER_BYTES  = COMPRESSED_DUMP_MAGIC_BYTES + 8,
+  COMPRESSED_FRAME_HEADER_BYTES = 8,
+};
+
+#endif // COMPRESSED_DUMP_H
@@ -0,0 +1,517 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/compressedDumpLayer.c#1 $
+ */
+
+
+#include "compressedDumpLayer.h"
+
+#include <string.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "fileUtils.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "permassert.h"
+#include "uds-threads.h"
+
+#include "constants.h"
+#include "statusCodes.h"
+
+#include "compressedDump.h"
+
+enum {
+  // The number of decompressed frames kept for later reads.
+  CACHED_FRAMES = 4,
+};
+
+/** Where a frame of the dump is and which blocks it holds */
+typedef struct {
+  /** The offset of the compressed blocks in the file */
+  off_t                   offset;
+  uint32_t                compressedBytes;
+  physical_block_number_t firstBlock;
+  block_count_t           blockCount;
+} FrameLocation;
+
+/** A decompressed frame */
+typedef struct {
+  /** The index of the frame, or SIZE_MAX if the entry is empty */
+  size_t    frame;
+  uint64_t  lastUse;
+  char     *data;
+} CachedFrame;
+
+typedef struct {
+  PhysicalLayer   common;
+  int             fd;
+  block_count_t   blockCount;
+  /** The most blocks in a frame */
+  block_count_t   frameBlocks;
+  FrameLocation  *frames;
+  size_t          frameCount;
+  /** Protects the cache and the compressed buffer */
+  struct mutex    lock;
+  CachedFrame     cache[CACHED_FRAMES];
+  uint64_t        uses;
+  /** A buffer for the compressed blocks of a frame */
+  byte           *compressed;
+  char            name[];
+} CompressedDumpLayer;
+
+/**********************************************************************/
+static inline CompressedDumpLayer *asCompressedDumpLayer(PhysicalLayer *layer)
+{
+  STATIC_ASSERT(offsetof(CompressedDumpLayer, common) == 0);
+  return (CompressedDumpLayer *) layer;
+}
+
+/**********************************************************************/
+static block_count_t getBlockCount(PhysicalLayer *header)
+{
+  return asCompressedDumpLayer(header)->blockCount;
+}
+
+/**********************************************************************/
+static int allocateIOBuffer(PhysicalLayer  *header __attribute__((unused)),
+                            size_t          bytes,
+                            const char     *why,
+                            char          **bufferPtr)
+{
+  return uds_allocate_memory(bytes, VDO_BLOCK_SIZE, why, bufferPtr);
+}
+
+/**********************************************************************/
+static void returnIOBuffer(PhysicalLayer *header __attribute__((unused)),
+                           size_t         bytes __attribute__((unused)),
+                           char          *buffer)
+{
+  UDS_FREE(buffer);
+}
+
+/**
+ * Find the frame holding a block.
+ *
+ * @param layer  The layer
+ * @param pbn    The block, which must be in the dump
+ *
+ * @return The index of the frame
+ **/
+static size_t findFrame(const CompressedDumpLayer *layer,
+                        physical_block_number_t    pbn)
+{
+  size_t low  = 0;
+  size_t high = layer->frameCount;
+  while (high - low > 1) {
+    size_t middle = low + ((high - low) / 2);
+    if (layer->frames[middle].firstBlock <= pbn) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+/**
+ * Get the decompressed blocks of a frame, decompressing it into the least
+ * recently used cache entry if it is not cached. The caller must hold the
+ * layer's lock.
+ *
+ * @param [in]  layer    The layer
+ * @param [in]  frame    The index of the frame
+ * @param [out] dataPtr  A pointer to hold the decompressed blocks
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int getFrame(CompressedDumpLayer *layer, size_t frame, char **dataPtr)
+{
+  CachedFrame *victim = &layer->cache[0];
+  for (unsigned int i = 0; i < CACHED_FRAMES; i++) {
+    CachedFrame *entry = &layer->cache[i];
+    if (entry->frame == frame) {
+      entry->lastUse = ++layer->uses;
+      *dataPtr = entry->data;
+      return VDO_SUCCESS;
+    }
+
+    if (entry->lastUse < victim->lastUse) {
+      victim = entry;
+    }
+  }
+
+  const FrameLocation *location = &layer->frames[frame];
+  size_t length;
+  int result = read_data_at_offset(layer->fd, location->offset,
+                                   layer->compressed,
+                                   location->compressedBytes, &length);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  if (length < location->compressedBytes) {
+    return uds_log_error_strerror(VDO_UNEXPECTED_EOF,
+                                  "%s ends within frame %zu",
+                                  layer->name, frame);
+  }
+
+  // Empty the entry first, so a failure cannot leave stale blocks in it.
+  victim->frame = SIZE_MAX;
+  uLongf expected = location->blockCount * VDO_BLOCK_SIZE;
+  uLongf decompressed = expected;
+  int zResult = uncompress((Bytef *) victim->data, &decompressed,
+                           layer->compressed, location->compressedBytes);
+  if ((zResult != Z_OK) || (decompressed != expected)) {
+    return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                  "frame %zu of %s is corrupt",
+                                  frame, layer->name);
+  }
+
+  victim->frame   = frame;
+  victim->lastUse = ++layer->uses;
+  *dataPtr = victim->data;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Implements extent_reader.
+ **/
+static int compressedDumpReader(PhysicalLayer           *header,
+                                physical_block_number_t  startBlock,
+                                size_t                   blockCount,
+                                char                    *buffer)
+{
+  CompressedDumpLayer *layer = asCompressedDumpLayer(header);
+  if ((startBlock > layer->blockCount)
+      || (blockCount > layer->blockCount - startBlock)) {
+    return VDO_OUT_OF_RANGE;
+  }
+
+  uds_lock_mutex(&layer->lock);
+  while (blockCount > 0) {
+    size_t frame = findFrame(layer, startBlock);
+    char *data = NULL;
+    int result = getFrame(layer, frame, &data);
+    if (result != VDO_SUCCESS) {
+      uds_unlock_mutex(&layer->lock);
+      return result;
+    }
+
+    const FrameLocation *location = &layer->frames[frame];
+    block_count_t offset = startBlock - location->firstBlock;
+    block_count_t count  = min((block_count_t) blockCount,
+                               location->blockCount - offset);
+    memcpy(buffer, data + (offset * VDO_BLOCK_SIZE), count * VDO_BLOCK_SIZE);
+    buffer     += count * VDO_BLOCK_SIZE;
+    startBlock += count;
+    blockCount -= count;
+  }
+
+  uds_unlock_mutex(&layer->lock);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Implements batch_extent_reader.
+ **/
+static int compressedDumpBatchReader(PhysicalLayer        *header,
+                                     struct extent_read   *extents,
+                                     size_t                count,
+                                     extent_read_callback *callback,
+                                     void                 *context)
+{
+  int firstError = VDO_SUCCESS;
+  for (size_t i = 0; i < count; i++) {
+    struct extent_read *extent = &extents[i];
+    extent->result = compressedDumpReader(header, extent->start_block,
+                                          extent->block_count,
+                                          extent->buffer);
+    if (firstError == VDO_SUCCESS) {
+      firstError = extent->result;
+    }
+
+    if (callback != NULL) {
+      callback(extent, context);
+    }
+  }
+
+  return firstError;
+}
+
+/**********************************************************************/
+static int noWriter(PhysicalLayer           *header __attribute__((unused)),
+                    physical_block_number_t  startBlock
+                    __attribute__((unused)),
+                    size_t                   blockCount
+                    __attribute__((unused)),
+                    char                    *buffer __attribute__((unused)))
+{
+  return EPERM;
+}
+
+/**********************************************************************/
+static int noZeroer(PhysicalLayer           *header __attribute__((unused)),
+                    physical_block_number_t  startBlock
+                    __attribute__((unused)),
+                    size_t                   blockCount
+                    __attribute__((unused)))
+{
+  return EPERM;
+}
+
+/**********************************************************************/
+static void vacuousFlush(struct vdo_flush *vdoFlush __attribute__((unused)))
+{
+}
+
+/**
+ * Free a CompressedDumpLayer and NULL out the reference to it.
+ *
+ * Implements layer_destructor.
+ **/
+static void freeLayer(PhysicalLayer **layerPtr)
+{
+  PhysicalLayer *header = *layerPtr;
+  if (header == NULL) {
+    return;
+  }
+
+  CompressedDumpLayer *layer = asCompressedDumpLayer(header);
+  for (unsigned int i = 0; i < CACHED_FRAMES; i++) {
+    UDS_FREE(layer->cache[i].data);
+  }
+
+  uds_destroy_mutex(&layer->lock);
+  UDS_FREE(layer->compressed);
+  UDS_FREE(layer->frames);
+  try_close_file(layer->fd);
+  UDS_FREE(layer);
+  *layerPtr = NULL;
+}
+
+/**
+ * Read the header of a compressed dump.
+ *
+ * @param layer  The layer reading the dump
+ *
+ * @return VDO_SUCCESS, VDO_NOT_IMPLEMENTED if the file is not a compressed
+ *         dump, or another error code
+ **/
+static int readDumpHeader(CompressedDumpLayer *layer)
+{
+  byte   header[COMPRESSED_DUMP_HEADER_BYTES];
+  size_t length;
+  int result = read_data_at_offset(layer->fd, 0, header, sizeof(header),
+                                   &length);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  if ((length < sizeof(header))
+      || (memcmp(header, COMPRESSED_DUMP_MAGIC,
+                 COMPRESSED_DUMP_MAGIC_BYTES) != 0)) {
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  uint32_t version, frameBlocks;
+  size_t offset = COMPRESSED_DUMP_MAGIC_BYTES;
+  decode_uint32_le(header, &offset, &version);
+  decode_uint32_le(header, &offset, &frameBlocks);
+  if (version != COMPRESSED_DUMP_VERSION) {
+    return uds_log_error_strerror(VDO_UNSUPPORTED_VERSION,
+                                  "%s is a version %u compressed dump",
+                                  layer->name, version);
+  }
+
+  if (frameBlocks == 0) {
+    return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                  "%s has empty frames", layer->name);
+  }
+
+  layer->frameBlocks = frameBlocks;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Index the frames of a compressed dump by reading each frame header.
+ *
+ * @param layer  The layer reading the dump
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int indexFrames(CompressedDumpLayer *layer)
+{
+  size_t capacity = 0;
+  off_t  offset   = COMPRESSED_DUMP_HEADER_BYTES;
+  uLong  maxBytes = compressBound(layer->frameBlocks * VDO_BLOCK_SIZE);
+  for (;;) {
+    byte   header[COMPRESSED_FRAME_HEADER_BYTES];
+    size_t length;
+    int result = read_data_at_offset(layer->fd, offset, header,
+                                     sizeof(header), &length);
+    if (result != UDS_SUCCESS) {
+      return result;
+    }
+
+    if (length < sizeof(header)) {
+      return uds_log_error_strerror(VDO_UNEXPECTED_EOF,
+                                    "%s is truncated after %llu blocks",
+                                    layer->name,
+                                    (unsigned long long) layer->blockCount);
+    }
+
+    uint32_t compressedBytes, blockCount;
+    size_t headerOffset = 0;
+    decode_uint32_le(header, &headerOffset, &compressedBytes);
+    decode_uint32_le(header, &headerOffset, &blockCount);
+    if ((compressedBytes == 0) && (blockCount == 0)) {
+      return VDO_SUCCESS;
+    }
+
+    if ((blockCount == 0) || (blockCount > layer->frameBlocks)
+        || (compressedBytes == 0) || (compressedBytes > maxBytes)) {
+      return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                    "%s has a bad frame header at offset %lld",
+                                    layer->name, (long long) offset);
+    }
+
+    if (layer->frameCount == capacity) {
+      size_t newCapacity = max(capacity * 2, (size_t) 64);
+      result = uds_reallocate_memory(layer->frames,
+                                     capacity * sizeof(FrameLocation),
+                                     newCapacity * sizeof(FrameLocation),
+                                     "frame index", &layer->frames);
+      if (result != UDS_SUCCESS) {
+        return result;
+      }
+
+      capacity = newCapacity;
+    }
+
+    offset += sizeof(header);
+    layer->frames[layer->frameCount++] = (FrameLocation) {
+      .offset          = offset,
+      .compressedBytes = compressedBytes,
+      .firstBlock      = layer->blockCount,
+      .blockCount      = blockCount,
+    };
+    layer->blockCount += blockCount;
+    offset            += compressedBytes;
+  }
+}
+
+/**
+ * Allocate the buffers a layer decompresses frames into.
+ *
+ * @param layer  The layer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int allocateFrameBuffers(CompressedDumpLayer *layer)
+{
+  int result = UDS_ALLOCATE(compressBound(layer->frameBlocks * VDO_BLOCK_SIZE),
+                            byte, "compressed frame", &layer->compressed);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  for (unsigned int i = 0; i < CACHED_FRAMES; i++) {
+    layer->cache[i].frame = SIZE_MAX;
+    result = uds_allocate_memory(layer->frameBlocks * VDO_BLOCK_SIZE,
+                                 VDO_BLOCK_SIZE, "decompressed frame",
+                                 &layer->cache[i].data);
+    if (result != UDS_SUCCESS) {
+      return result;
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int makeCompressedDumpLayer(const char *name, PhysicalLayer **layerPtr)
+{
+  int fd;
+  int result = open_file(name, FU_READ_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  // The frames are read at their offsets, so the dump must be seekable.
+  struct stat statbuf;
+  result = logging_fstat(fd, &statbuf, __func__);
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  if (!S_ISREG(statbuf.st_mode)) {
+    try_close_file(fd);
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  CompressedDumpLayer *layer;
+  result = UDS_ALLOCATE_EXTENDED(CompressedDumpLayer, strlen(name) + 1, char,
+                                 "compressed dump layer", &layer);
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  strcpy(layer->name, name);
+  layer->fd = fd;
+  result = uds_init_mutex(&layer->lock);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(layer);
+    try_close_file(fd);
+    return result;
+  }
+
+  PhysicalLayer *header = &layer->common;
+  result = readDumpHeader(layer);
+  if (result == VDO_SUCCESS) {
+    result = indexFrames(layer);
+  }
+
+  if (result == VDO_SUCCESS) {
+    result = allocateFrameBuffers(layer);
+  }
+
+  if (result != VDO_SUCCESS) {
+    freeLayer(&header);
+    return result;
+  }
+
+  layer->common.destroy          = freeLayer;
+  layer->common.getBlockCount    = getBlockCount;
+  layer->common.allocateIOBuffer = allocateIOBuffer;
+  layer->common.borrowIOBuffer   = allocateIOBuffer;
+  layer->common.returnIOBuffer   = returnIOBuffer;
+  layer->common.reader           = compressedDumpReader;
+  layer->common.writer           = noWriter;
+  layer->common.readExtents      = compressedDumpBatchReader;
+  layer->common.zeroExtent       = noZeroer;
+  layer->common.completeFlush    = vacuousFlush;
+
+  *layerPtr = header;
+  return VDO_SUCCESS;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/compressedDumpLayer.h#1 $
+ */
+
+
+#ifndef COMPRESSED_DUMP_LAYER_H
+#define COMPRESSED_DUMP_LAYER_H
+
+#include "physicalLayer.h"
+
+/**
+ * Make a read-only physical layer which reads the blocks of a compressed
+ * metadata dump, as written by vdodumpmetadata --compress. The frames of the
+ * dump are indexed when the layer is made, and each read decompresses the
+ * frames it needs, keeping the last few decompressed for later reads.
+ *
+ * @param [in]  name      The name of the dump file
+ * @param [out] layerPtr  A pointer to hold the new layer
+ *
+ * @return VDO_SUCCESS, VDO_NOT_IMPLEMENTED if the file is not a compressed
+ *         dump, or another error code
+ **/
+int __must_check makeCompressedDumpLayer(const char     *name,
+                                         PhysicalLayer **layerPtr);
+
+#endif // COMPRESSED_DUMP_LAYER_H
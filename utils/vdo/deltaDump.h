@@ -0,0 +1,57 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/deltaDump.h#1 $
+ */
+
+
+#ifndef DELTA_DUMP_H
+#define DELTA_DUMP_H
+
+#include "constants.h"
+#include "types.h"
+
+/**
+ * The format of an incremental metadata dump, as written by vdodumpmetadata
+ * --base and read by the layer made by makeDeltaDumpLayer(). An incremental
+ * dump holds only the blocks which differ from those at the same positions
+ * in a base dump, which may itself be incremental.
+ *
+ * The first block of the dump is a header holding DELTA_DUMP_MAGIC followed
+ * by the format version and the length of the name of the base dump, each a
+ * little-endian uint32_t, the number of blocks in the base dump as a
+ * little-endian uint64_t, and the name of the base dump. The changed blocks
+ * follow in order, one per block of the file. They are followed by an index
+ * holding the position of each changed block in the full dump as a
+ * little-endian uint64_t, and finally a trailer holding the number of blocks
+ * in the full dump and the number of changed blocks, each a little-endian
+ * uint64_t, and DELTA_DUMP_MAGIC again, so that a truncated dump can be
+ * recognized. Blocks past the end of the base dump are always written.
+ **/
+
+static const char DELTA_DUMP_MAGIC[] = "VDODELTA";
+
+enum {
+  DELTA_DUMP_VERSION        = 1,
+  DELTA_DUMP_MAGIC_BYTES    = sizeof(DELTA_DUMP_MAGIC) - 1,
+  DELTA_DUMP_HEADER_BYTES   = DELTA_DUMP_MAGIC_BYTES + 16,
+  DELTA_DUMP_MAX_BASE_NAME  = VDO_BLOCK_SIZE - DELTA_DUMP_HEADER_BYTES,
+  DELTA_DUMP_TRAILER_BYTES  = 16 + DELTA_DUMP_MAGIC_BYTES,
+};
+
+#endif // DELTA_DUMP_H
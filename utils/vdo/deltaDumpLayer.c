@@ -0,0 +1,500 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/deltaDumpLayer.c#1 $
+ */
+
+
+#include "deltaDumpLayer.h"
+
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fileUtils.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "permassert.h"
+#include "stringUtils.h"
+
+#include "constants.h"
+#include "statusCodes.h"
+
+#include "deltaDump.h"
+#include "dumpLayer.h"
+#include "fileLayer.h"
+
+typedef struct {
+  PhysicalLayer            common;
+  int                      fd;
+  /** The number of blocks in the full dump */
+  block_count_t            blockCount;
+  /** The dump the unchanged blocks are read from */
+  PhysicalLayer           *base;
+  block_count_t            baseBlocks;
+  /** The position in the full dump of each changed block, in order */
+  physical_block_number_t *changed;
+  block_count_t            changedCount;
+  char                     name[];
+} DeltaDumpLayer;
+
+/**********************************************************************/
+static inline DeltaDumpLayer *asDeltaDumpLayer(PhysicalLayer *layer)
+{
+  STATIC_ASSERT(offsetof(DeltaDumpLayer, common) == 0);
+  return (DeltaDumpLayer *) layer;
+}
+
+/**********************************************************************/
+static block_count_t getBlockCount(PhysicalLayer *header)
+{
+  return asDeltaDumpLayer(header)->blockCount;
+}
+
+/**********************************************************************/
+static int allocateIOBuffer(PhysicalLayer  *header __attribute__((unused)),
+                            size_t          bytes,
+                            const char     *why,
+                            char          **bufferPtr)
+{
+  return uds_allocate_memory(bytes, VDO_BLOCK_SIZE, why, bufferPtr);
+}
+
+/**********************************************************************/
+static void returnIOBuffer(PhysicalLayer *header __attribute__((unused)),
+                           size_t         bytes __attribute__((unused)),
+                           char          *buffer)
+{
+  UDS_FREE(buffer);
+}
+
+/**
+ * Find the first changed block at or after a position in the full dump.
+ *
+ * @param layer  The layer
+ * @param pbn    The position
+ *
+ * @return The index of the changed block, or the number of changed blocks
+ *         if there is none
+ **/
+static block_count_t findChanged(const DeltaDumpLayer    *layer,
+                                 physical_block_number_t  pbn)
+{
+  block_count_t low  = 0;
+  block_count_t high = layer->changedCount;
+  while (low < high) {
+    block_count_t middle = low + ((high - low) / 2);
+    if (layer->changed[middle] < pbn) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+/**
+ * Implements extent_reader.
+ **/
+static int deltaDumpReader(PhysicalLayer           *header,
+                           physical_block_number_t  startBlock,
+                           size_t                   blockCount,
+                           char                    *buffer)
+{
+  DeltaDumpLayer *layer = asDeltaDumpLayer(header);
+  if ((startBlock > layer->blockCount)
+      || (blockCount > layer->blockCount - startBlock)) {
+    return VDO_OUT_OF_RANGE;
+  }
+
+  block_count_t next = findChanged(layer, startBlock);
+  while (blockCount > 0) {
+    // Read the run of changed blocks, or of unchanged ones, which starts here.
+    block_count_t count = 0;
+    int result;
+    if ((next < layer->changedCount) && (layer->changed[next] == startBlock)) {
+      block_count_t first = next;
+      do {
+        count++;
+        next++;
+      } while ((count < blockCount) && (next < layer->changedCount)
+               && (layer->changed[next] == startBlock + count));
+
+      size_t length;
+      result = read_data_at_offset(layer->fd,
+                                   (off_t) (first + 1) * VDO_BLOCK_SIZE,
+                                   buffer, count * VDO_BLOCK_SIZE, &length);
+      if ((result == UDS_SUCCESS) && (length < count * VDO_BLOCK_SIZE)) {
+        result = VDO_UNEXPECTED_EOF;
+      }
+    } else {
+      block_count_t end = ((next < layer->changedCount)
+                           ? layer->changed[next] : layer->blockCount);
+      count = min((block_count_t) blockCount, end - startBlock);
+      result = layer->base->reader(layer->base, startBlock, count, buffer);
+    }
+
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    buffer     += count * VDO_BLOCK_SIZE;
+    startBlock += count;
+    blockCount -= count;
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Implements batch_extent_reader.
+ **/
+static int deltaDumpBatchReader(PhysicalLayer        *header,
+                                struct extent_read   *extents,
+                                size_t                count,
+                                extent_read_callback *callback,
+                                void                 *context)
+{
+  int firstError = VDO_SUCCESS;
+  for (size_t i = 0; i < count; i++) {
+    struct extent_read *extent = &extents[i];
+    extent->result = deltaDumpReader(header, extent->start_block,
+                                     extent->block_count, extent->buffer);
+    if (firstError == VDO_SUCCESS) {
+      firstError = extent->result;
+    }
+
+    if (callback != NULL) {
+      callback(extent, context);
+    }
+  }
+
+  return firstError;
+}
+
+/**********************************************************************/
+static int noWriter(PhysicalLayer           *header __attribute__((unused)),
+                    physical_block_number_t  startBlock
+                    __attribute__((unused)),
+                    size_t                   blockCount
+                    __attribute__((unused)),
+                    char                    *buffer __attribute__((unused)))
+{
+  return EPERM;
+}
+
+/**********************************************************************/
+static int noZeroer(PhysicalLayer           *header __attribute__((unused)),
+                    physical_block_number_t  startBlock
+                    __attribute__((unused)),
+                    size_t                   blockCount
+                    __attribute__((unused)))
+{
+  return EPERM;
+}
+
+/**********************************************************************/
+static void vacuousFlush(struct vdo_flush *vdoFlush __attribute__((unused)))
+{
+}
+
+/**
+ * Free a DeltaDumpLayer and NULL out the reference to it.
+ *
+ * Implements layer_destructor.
+ **/
+static void freeLayer(PhysicalLayer **layerPtr)
+{
+  PhysicalLayer *header = *layerPtr;
+  if (header == NULL) {
+    return;
+  }
+
+  DeltaDumpLayer *layer = asDeltaDumpLayer(header);
+  if (layer->base != NULL) {
+    layer->base->destroy(&layer->base);
+  }
+
+  UDS_FREE(layer->changed);
+  try_close_file(layer->fd);
+  UDS_FREE(layer);
+  *layerPtr = NULL;
+}
+
+/**
+ * Open the base of an incremental dump. A relative name is looked up next
+ * to the incremental dump first, so that a set of dumps may be moved
+ * together.
+ *
+ * @param layer     The layer reading the incremental dump
+ * @param baseName  The name of the base dump recorded in the header
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int openBase(DeltaDumpLayer *layer, const char *baseName)
+{
+  char *path = NULL;
+  const char *slash = strrchr(layer->name, '/');
+  if ((baseName[0] != '/') && (slash != NULL)) {
+    int result = uds_alloc_sprintf(__func__, &path, "%.*s/%s",
+                                   (int) (slash - layer->name), layer->name,
+                                   baseName);
+    if (result != UDS_SUCCESS) {
+      return result;
+    }
+
+    if (access(path, F_OK) != 0) {
+      UDS_FREE(path);
+      path = NULL;
+    }
+  }
+
+  const char *name = ((path != NULL) ? path : baseName);
+  int result = makeDumpLayer(name, &layer->base);
+  if (result == VDO_NOT_IMPLEMENTED) {
+    result = makeReadOnlyFileLayer(name, &layer->base);
+  }
+
+  if (result != VDO_SUCCESS) {
+    uds_log_error_strerror(result, "cannot open %s, the base of %s",
+                           name, layer->name);
+    UDS_FREE(path);
+    return result;
+  }
+
+  UDS_FREE(path);
+  if (layer->base->getBlockCount(layer->base) != layer->baseBlocks) {
+    return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                  "base %s of %s has %llu blocks, not %llu",
+                                  baseName, layer->name,
+                                  (unsigned long long)
+                                  layer->base->getBlockCount(layer->base),
+                                  (unsigned long long) layer->baseBlocks);
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Read the header of an incremental dump and open its base.
+ *
+ * @param layer  The layer reading the dump
+ *
+ * @return VDO_SUCCESS, VDO_NOT_IMPLEMENTED if the file is not an
+ *         incremental dump, or another error code
+ **/
+static int readDumpHeader(DeltaDumpLayer *layer)
+{
+  byte   header[VDO_BLOCK_SIZE];
+  size_t length;
+  int result = read_data_at_offset(layer->fd, 0, header, sizeof(header),
+                                   &length);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  if ((length < sizeof(header))
+      || (memcmp(header, DELTA_DUMP_MAGIC, DELTA_DUMP_MAGIC_BYTES) != 0)) {
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  uint32_t version, nameLength;
+  uint64_t baseBlocks;
+  size_t offset = DELTA_DUMP_MAGIC_BYTES;
+  decode_uint32_le(header, &offset, &version);
+  decode_uint32_le(header, &offset, &nameLength);
+  decode_uint64_le(header, &offset, &baseBlocks);
+  if (version != DELTA_DUMP_VERSION) {
+    return uds_log_error_strerror(VDO_UNSUPPORTED_VERSION,
+                                  "%s is a version %u incremental dump",
+                                  layer->name, version);
+  }
+
+  if ((nameLength == 0) || (nameLength > DELTA_DUMP_MAX_BASE_NAME)) {
+    return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                  "%s has a bad base name", layer->name);
+  }
+
+  char baseName[DELTA_DUMP_MAX_BASE_NAME + 1];
+  memcpy(baseName, header + offset, nameLength);
+  baseName[nameLength] = '\0';
+  layer->baseBlocks = baseBlocks;
+  return openBase(layer, baseName);
+}
+
+/**
+ * Read the trailer and block index of an incremental dump.
+ *
+ * @param layer  The layer reading the dump
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int readBlockIndex(DeltaDumpLayer *layer)
+{
+  struct stat statbuf;
+  int result = logging_fstat(layer->fd, &statbuf, __func__);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  byte   trailer[DELTA_DUMP_TRAILER_BYTES];
+  size_t length = 0;
+  off_t  trailerOffset = statbuf.st_size - DELTA_DUMP_TRAILER_BYTES;
+  if (trailerOffset >= VDO_BLOCK_SIZE) {
+    result = read_data_at_offset(layer->fd, trailerOffset, trailer,
+                                 sizeof(trailer), &length);
+    if (result != UDS_SUCCESS) {
+      return result;
+    }
+  }
+
+  if ((length < sizeof(trailer))
+      || (memcmp(trailer + 16, DELTA_DUMP_MAGIC,
+                 DELTA_DUMP_MAGIC_BYTES) != 0)) {
+    return uds_log_error_strerror(VDO_UNEXPECTED_EOF, "%s is truncated",
+                                  layer->name);
+  }
+
+  uint64_t blockCount, changedCount;
+  size_t offset = 0;
+  decode_uint64_le(trailer, &offset, &blockCount);
+  decode_uint64_le(trailer, &offset, &changedCount);
+  off_t indexOffset = (off_t) (changedCount + 1) * VDO_BLOCK_SIZE;
+  if ((changedCount > blockCount)
+      || (indexOffset + (off_t) (changedCount * sizeof(uint64_t))
+          != trailerOffset)) {
+    return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                  "%s has a bad trailer", layer->name);
+  }
+
+  layer->blockCount   = blockCount;
+  layer->changedCount = changedCount;
+  if (changedCount == 0) {
+    return VDO_SUCCESS;
+  }
+
+  byte *index;
+  result = UDS_ALLOCATE(changedCount * sizeof(uint64_t), byte, __func__,
+                        &index);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = read_data_at_offset(layer->fd, indexOffset, index,
+                               changedCount * sizeof(uint64_t), &length);
+  if ((result == UDS_SUCCESS) && (length < changedCount * sizeof(uint64_t))) {
+    result = VDO_UNEXPECTED_EOF;
+  }
+
+  if (result == UDS_SUCCESS) {
+    result = UDS_ALLOCATE(changedCount, physical_block_number_t, __func__,
+                          &layer->changed);
+  }
+
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(index);
+    return result;
+  }
+
+  offset = 0;
+  for (block_count_t i = 0; i < changedCount; i++) {
+    uint64_t pbn;
+    decode_uint64_le(index, &offset, &pbn);
+    layer->changed[i] = pbn;
+  }
+  UDS_FREE(index);
+
+  // The index must be in order, and cover every block the base lacks.
+  for (block_count_t i = 0; i < changedCount; i++) {
+    if (((i > 0) && (layer->changed[i] <= layer->changed[i - 1]))
+        || (layer->changed[i] >= blockCount)) {
+      return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                    "%s has a bad block index", layer->name);
+    }
+  }
+
+  if ((blockCount > layer->baseBlocks)
+      && (blockCount - layer->baseBlocks
+          > changedCount - findChanged(layer, layer->baseBlocks))) {
+    return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                  "%s is missing blocks past its base",
+                                  layer->name);
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int makeDeltaDumpLayer(const char *name, PhysicalLayer **layerPtr)
+{
+  int fd;
+  int result = open_file(name, FU_READ_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  // The blocks are read at their offsets, so the dump must be seekable.
+  struct stat statbuf;
+  result = logging_fstat(fd, &statbuf, __func__);
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  if (!S_ISREG(statbuf.st_mode)) {
+    try_close_file(fd);
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  DeltaDumpLayer *layer;
+  result = UDS_ALLOCATE_EXTENDED(DeltaDumpLayer, strlen(name) + 1, char,
+                                 "incremental dump layer", &layer);
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  strcpy(layer->name, name);
+  layer->fd = fd;
+  PhysicalLayer *header = &layer->common;
+  result = readDumpHeader(layer);
+  if (result == VDO_SUCCESS) {
+    result = readBlockIndex(layer);
+  }
+
+  if (result != VDO_SUCCESS) {
+    freeLayer(&header);
+    return result;
+  }
+
+  layer->common.destroy          = freeLayer;
+  layer->common.getBlockCount    = getBlockCount;
+  layer->common.allocateIOBuffer = allocateIOBuffer;
+  layer->common.borrowIOBuffer   = allocateIOBuffer;
+  layer->common.returnIOBuffer   = returnIOBuffer;
+  layer->common.reader           = deltaDumpReader;
+  layer->common.writer           = noWriter;
+  layer->common.readExtents      = deltaDumpBatchReader;
+  layer->common.zeroExtent       = noZeroer;
+  layer->common.completeFlush    = vacuousFlush;
+
+  *layerPtr = header;
+  return VDO_SUCCESS;
+}
@@ -0,0 +1,283 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/dmControl.c#1 $
+ */
+
+
+#include "dmControl.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "memoryAlloc.h"
+
+#include "statusCodes.h"
+
+enum {
+  /** The buffer size for a device-mapper ioctl, until it proves too small */
+  INITIAL_IOCTL_BYTES = 16 * 1024,
+  /** The largest buffer which will be offered for an ioctl's results */
+  MAXIMUM_IOCTL_BYTES = 64 * 1024 * 1024,
+};
+
+static const char DM_CONTROL_PATH[] = "/dev/mapper/control";
+
+/**********************************************************************/
+int openDMControl(int *controlPtr)
+{
+  int control = open(DM_CONTROL_PATH, O_RDWR | O_CLOEXEC);
+  if (control < 0) {
+    return uds_log_error_strerror(errno, "cannot open %s", DM_CONTROL_PATH);
+  }
+
+  *controlPtr = control;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+void closeDMControl(int control)
+{
+  if (control >= 0) {
+    close(control);
+  }
+}
+
+/**
+ * Perform a device-mapper ioctl on a device, retrying with a larger buffer
+ * for as long as the kernel reports that its results did not fit.
+ *
+ * @param [in]  control      The control file descriptor
+ * @param [in]  command      The ioctl to perform
+ * @param [in]  name         The name of the device, or NULL for none
+ * @param [in]  payload      The data to pass after the ioctl header
+ * @param [in]  payloadSize  The size of the payload
+ * @param [out] dmiPtr       A pointer to hold the ioctl header and its
+ *                           results, which must be freed with UDS_FREE()
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int performDMIoctl(int               control,
+                          unsigned long     command,
+                          const char       *name,
+                          const void       *payload,
+                          size_t            payloadSize,
+                          struct dm_ioctl **dmiPtr)
+{
+  if ((name != NULL) && (strlen(name) >= DM_NAME_LEN)) {
+    return uds_log_error_strerror(ENAMETOOLONG,
+                                  "device-mapper name %s too long", name);
+  }
+
+  size_t bytes = INITIAL_IOCTL_BYTES;
+  while (sizeof(struct dm_ioctl) + payloadSize > bytes) {
+    bytes *= 2;
+  }
+
+  for (;;) {
+    struct dm_ioctl *dmi;
+    int result = uds_allocate_memory(bytes, __alignof__(struct dm_ioctl),
+                                     "device-mapper ioctl", &dmi);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    *dmi = (struct dm_ioctl) {
+      .version    = { DM_VERSION_MAJOR, 0, 0 },
+      .data_size  = bytes,
+      .data_start = sizeof(struct dm_ioctl),
+    };
+    if (name != NULL) {
+      strcpy(dmi->name, name);
+    }
+    if (payloadSize > 0) {
+      memcpy((char *) dmi + dmi->data_start, payload, payloadSize);
+    }
+
+    if (ioctl(control, command, dmi) < 0) {
+      result = errno;
+      UDS_FREE(dmi);
+      return uds_log_error_strerror(result, "device-mapper ioctl on %s",
+                                    ((name == NULL) ? "control" : name));
+    }
+
+    if ((dmi->flags & DM_BUFFER_FULL_FLAG) == 0) {
+      *dmiPtr = dmi;
+      return VDO_SUCCESS;
+    }
+
+    UDS_FREE(dmi);
+    if (bytes >= MAXIMUM_IOCTL_BYTES) {
+      return uds_log_error_strerror(ENOBUFS,
+                                    "device-mapper results for %s too large",
+                                    ((name == NULL) ? "control" : name));
+    }
+    bytes *= 2;
+  }
+}
+
+/**********************************************************************/
+int sendDMMessage(int          control,
+                  const char  *name,
+                  const char  *message,
+                  char       **responsePtr)
+{
+  size_t messageSize = strlen(message) + 1;
+  size_t payloadSize = sizeof(struct dm_target_msg) + messageSize;
+  struct dm_target_msg *payload;
+  int result = uds_allocate_memory(payloadSize,
+                                   __alignof__(struct dm_target_msg),
+                                   "device-mapper message", &payload);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  payload->sector = 0;
+  memcpy(payload->message, message, messageSize);
+
+  struct dm_ioctl *dmi = NULL;
+  result = performDMIoctl(control, DM_TARGET_MSG, name, payload, payloadSize,
+                          &dmi);
+  UDS_FREE(payload);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  const char *response = "";
+  if ((dmi->flags & DM_DATA_OUT_FLAG) != 0) {
+    response = (const char *) dmi + dmi->data_start;
+  }
+
+  result = uds_duplicate_string(response, __func__, responsePtr);
+  UDS_FREE(dmi);
+  return result;
+}
+
+/**
+ * Check whether a device has a target of a given type in its live table.
+ *
+ * @param [in]  control     The control file descriptor
+ * @param [in]  name        The name of the device
+ * @param [in]  targetType  The target type to look for
+ * @param [out] hasTarget   A pointer to hold whether the device has one
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int hasTargetType(int         control,
+                         const char *name,
+                         const char *targetType,
+                         bool       *hasTarget)
+{
+  struct dm_ioctl *dmi = NULL;
+  int result = performDMIoctl(control, DM_TABLE_STATUS, name, NULL, 0, &dmi);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  // Each target spec says where the next one is, relative to the first.
+  const char *specs = (const char *) dmi + dmi->data_start;
+  const char *end = (const char *) dmi + dmi->data_size;
+  size_t next = 0;
+  *hasTarget = false;
+  for (unsigned int i = 0; i < dmi->target_count; i++) {
+    const struct dm_target_spec *spec
+      = (const struct dm_target_spec *) (specs + next);
+    if ((const char *) (spec + 1) > end) {
+      break;
+    }
+
+    if (strncmp(spec->target_type, targetType, DM_MAX_TYPE_NAME) == 0) {
+      *hasTarget = true;
+      break;
+    }
+
+    next = spec->next;
+  }
+
+  UDS_FREE(dmi);
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int listDMDevices(int          control,
+                  const char  *targetType,
+                  DMDevice   **devicesPtr,
+                  size_t      *countPtr)
+{
+  struct dm_ioctl *dmi = NULL;
+  int result = performDMIoctl(control, DM_LIST_DEVICES, NULL, NULL, 0, &dmi);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  // The names form a chain, each saying how far on the next one is. A
+  // device number of zero means there are no devices at all.
+  const char *names = (const char *) dmi + dmi->data_start;
+  size_t count = 0;
+  const struct dm_name_list *entry = (const struct dm_name_list *) names;
+  if (entry->dev != 0) {
+    for (;;) {
+      count++;
+      if (entry->next == 0) {
+        break;
+      }
+      entry = (const struct dm_name_list *) ((const char *) entry
+                                             + entry->next);
+    }
+  }
+
+  DMDevice *devices;
+  result = UDS_ALLOCATE(count, DMDevice, __func__, &devices);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(dmi);
+    return result;
+  }
+
+  size_t found = 0;
+  entry = (const struct dm_name_list *) names;
+  for (size_t i = 0; i < count; i++) {
+    bool wanted;
+    result = hasTargetType(control, entry->name, targetType, &wanted);
+    if (result == ENXIO) {
+      // The device went away after it was listed.
+      wanted = false;
+    } else if (result != VDO_SUCCESS) {
+      UDS_FREE(devices);
+      UDS_FREE(dmi);
+      return result;
+    }
+
+    if (wanted) {
+      strncpy(devices[found].name, entry->name, DM_NAME_LEN - 1);
+      devices[found].device = (dev_t) entry->dev;
+      found++;
+    }
+
+    entry = (const struct dm_name_list *) ((const char *) entry
+                                           + entry->next);
+  }
+
+  UDS_FREE(dmi);
+  *devicesPtr = devices;
+  *countPtr = found;
+  return VDO_SUCCESS;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/dmControl.h#1 $
+ */
+
+
+#ifndef DM_CONTROL_H
+#define DM_CONTROL_H
+
+#include <linux/dm-ioctl.h>
+#include <sys/types.h>
+
+#include "compiler.h"
+
+typedef struct {
+  char  name[DM_NAME_LEN];
+  dev_t device;
+} DMDevice;
+
+/**
+ * Open the device-mapper control device, so that device-mapper can be
+ * asked about devices without running dmsetup.
+ *
+ * @param [out] controlPtr  A pointer to hold the control file descriptor
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check openDMControl(int *controlPtr);
+
+/**
+ * Close the device-mapper control device.
+ *
+ * @param control  The control file descriptor
+ **/
+void closeDMControl(int control);
+
+/**
+ * Send a message to the target at sector 0 of a device-mapper device, as
+ * "dmsetup message <name> 0 <message>" does, and get the target's response.
+ * The response may be of any size.
+ *
+ * @param [in]  control      The control file descriptor
+ * @param [in]  name         The name of the device
+ * @param [in]  message      The message to send
+ * @param [out] responsePtr  A pointer to hold the response, which must be
+ *                           freed with UDS_FREE(); it is empty if the target
+ *                           gave no response
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check sendDMMessage(int          control,
+                               const char  *name,
+                               const char  *message,
+                               char       **responsePtr);
+
+/**
+ * List the device-mapper devices with a target of a given type, as
+ * "dmsetup ls --target <type>" does.
+ *
+ * @param [in]  control     The control file descriptor
+ * @param [in]  targetType  The target type to look for
+ * @param [out] devicesPtr  A pointer to hold the array of devices found,
+ *                          which must be freed with UDS_FREE()
+ * @param [out] countPtr    A pointer to hold the number of devices found
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check listDMDevices(int          control,
+                               const char  *targetType,
+                               DMDevice   **devicesPtr,
+                               size_t      *countPtr);
+
+#endif // DM_CONTROL_H
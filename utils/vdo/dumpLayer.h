@@ -0,0 +1,41 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/dumpLayer.h#1 $
+ */
+
+
+#ifndef DUMP_LAYER_H
+#define DUMP_LAYER_H
+
+#include "physicalLayer.h"
+
+/**
+ * Make a read-only physical layer for a metadata dump written by
+ * vdodumpmetadata, recognizing incremental and compressed dumps, and
+ * mapping a plain dump into memory if it can.
+ *
+ * @param [in]  name      The name of the dump file
+ * @param [out] layerPtr  A pointer to hold the new layer
+ *
+ * @return VDO_SUCCESS, VDO_NOT_IMPLEMENTED if the file must instead be read
+ *         through a file layer, or another error code
+ **/
+int __must_check makeDumpLayer(const char *name, PhysicalLayer **layerPtr);
+
+#endif // DUMP_LAYER_H
@@ -0,0 +1,256 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/dumpTOC.c#1 $
+ */
+
+
+#include "dumpTOC.h"
+
+#include <string.h>
+
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+
+#include "constants.h"
+#include "statusCodes.h"
+
+static const char DUMP_TOC_MAGIC[] = "VDODMTOC";
+
+enum {
+  DUMP_TOC_VERSION       = 1,
+  DUMP_TOC_MAGIC_BYTES   = sizeof(DUMP_TOC_MAGIC) - 1,
+  DUMP_TOC_ENTRY_BYTES   = 32,
+  DUMP_TOC_TRAILER_BYTES = DUMP_TOC_MAGIC_BYTES + 24,
+};
+
+/**********************************************************************/
+int addDumpRegion(DumpTOC                 *toc,
+                  DumpRegionType           type,
+                  physical_block_number_t  dumpBlock,
+                  block_count_t            blockCount,
+                  physical_block_number_t  sourcePBN)
+{
+  if (toc->count > 0) {
+    DumpRegion *last = &toc->regions[toc->count - 1];
+    if ((type != DUMP_REGION_SLAB) && (last->type == type)
+        && (last->dumpBlock + last->blockCount == dumpBlock)
+        && (last->sourcePBN + last->blockCount == sourcePBN)) {
+      last->blockCount += blockCount;
+      return VDO_SUCCESS;
+    }
+  }
+
+  if (toc->count == toc->capacity) {
+    size_t capacity = max(toc->capacity * 2, (size_t) 64);
+    int result = uds_reallocate_memory(toc->regions,
+                                       toc->capacity * sizeof(DumpRegion),
+                                       capacity * sizeof(DumpRegion),
+                                       "dump table of contents",
+                                       &toc->regions);
+    if (result != UDS_SUCCESS) {
+      return result;
+    }
+
+    toc->capacity = capacity;
+  }
+
+  toc->regions[toc->count++] = (DumpRegion) {
+    .type       = type,
+    .dumpBlock  = dumpBlock,
+    .blockCount = blockCount,
+    .sourcePBN  = sourcePBN,
+  };
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+block_count_t getDumpTOCBlocks(const DumpTOC *toc)
+{
+  size_t bytes = (toc->count * DUMP_TOC_ENTRY_BYTES) + DUMP_TOC_TRAILER_BYTES;
+  return (bytes + VDO_BLOCK_SIZE - 1) / VDO_BLOCK_SIZE;
+}
+
+/**********************************************************************/
+void encodeDumpTOC(const DumpTOC *toc, char *blocks)
+{
+  byte   *buffer = (byte *) blocks;
+  size_t  offset = 0;
+  for (size_t i = 0; i < toc->count; i++) {
+    const DumpRegion *region = &toc->regions[i];
+    encode_uint32_le(buffer, &offset, region->type);
+    encode_uint32_le(buffer, &offset, 0);
+    encode_uint64_le(buffer, &offset, region->dumpBlock);
+    encode_uint64_le(buffer, &offset, region->blockCount);
+    encode_uint64_le(buffer, &offset, region->sourcePBN);
+  }
+
+  block_count_t tocBlocks = getDumpTOCBlocks(toc);
+  offset = (tocBlocks * VDO_BLOCK_SIZE) - DUMP_TOC_TRAILER_BYTES;
+  memcpy(buffer + offset, DUMP_TOC_MAGIC, DUMP_TOC_MAGIC_BYTES);
+  offset += DUMP_TOC_MAGIC_BYTES;
+  encode_uint32_le(buffer, &offset, DUMP_TOC_VERSION);
+  encode_uint32_le(buffer, &offset, 0);
+  encode_uint64_le(buffer, &offset, toc->count);
+  encode_uint64_le(buffer, &offset, tocBlocks);
+}
+
+/**
+ * Check that the regions of a table of contents are in order and lie
+ * within the dump.
+ *
+ * @param toc         The table of contents
+ * @param dumpBlocks  The number of blocks in the dump before the table
+ *
+ * @return VDO_SUCCESS or VDO_INVALID_FRAGMENT
+ **/
+static int checkRegions(const DumpTOC *toc, block_count_t dumpBlocks)
+{
+  physical_block_number_t next = 0;
+  for (size_t i = 0; i < toc->count; i++) {
+    const DumpRegion *region = &toc->regions[i];
+    if ((region->type < DUMP_REGION_GEOMETRY)
+        || (region->type > DUMP_REGION_SLAB_SUMMARY)
+        || (region->dumpBlock < next)
+        || (region->blockCount > dumpBlocks - region->dumpBlock)) {
+      return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                    "dump table of contents entry %zu is bad",
+                                    i);
+    }
+
+    next = region->dumpBlock + region->blockCount;
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int readDumpTOC(PhysicalLayer *layer, DumpTOC *toc)
+{
+  *toc = (DumpTOC) { .regions = NULL };
+  block_count_t dumpBlocks = layer->getBlockCount(layer);
+  if (dumpBlocks == 0) {
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  char *block;
+  int result = layer->allocateIOBuffer(layer, VDO_BLOCK_SIZE,
+                                       "dump table of contents", &block);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = layer->reader(layer, dumpBlocks - 1, 1, block);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(block);
+    return result;
+  }
+
+  byte *trailer = (byte *) block + VDO_BLOCK_SIZE - DUMP_TOC_TRAILER_BYTES;
+  if (memcmp(trailer, DUMP_TOC_MAGIC, DUMP_TOC_MAGIC_BYTES) != 0) {
+    UDS_FREE(block);
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  uint32_t version, reserved;
+  uint64_t count, tocBlocks;
+  size_t offset = DUMP_TOC_MAGIC_BYTES;
+  decode_uint32_le(trailer, &offset, &version);
+  decode_uint32_le(trailer, &offset, &reserved);
+  decode_uint64_le(trailer, &offset, &count);
+  decode_uint64_le(trailer, &offset, &tocBlocks);
+  UDS_FREE(block);
+  if (version != DUMP_TOC_VERSION) {
+    return uds_log_error_strerror(VDO_UNSUPPORTED_VERSION,
+                                  "dump table of contents is version %u",
+                                  version);
+  }
+
+  DumpTOC check = { .count = count };
+  if ((tocBlocks > dumpBlocks) || (count > tocBlocks * VDO_BLOCK_SIZE)
+      || (getDumpTOCBlocks(&check) != tocBlocks)) {
+    return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                  "dump table of contents is the wrong size");
+  }
+
+  char *blocks;
+  result = layer->allocateIOBuffer(layer, tocBlocks * VDO_BLOCK_SIZE,
+                                   "dump table of contents", &blocks);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = layer->reader(layer, dumpBlocks - tocBlocks, tocBlocks, blocks);
+  if (result == VDO_SUCCESS) {
+    result = UDS_ALLOCATE(max(count, (uint64_t) 1), DumpRegion, __func__,
+                          &toc->regions);
+  }
+
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(blocks);
+    return result;
+  }
+
+  toc->capacity = max(count, (uint64_t) 1);
+  offset = 0;
+  for (size_t i = 0; i < count; i++) {
+    DumpRegion *region = &toc->regions[i];
+    uint32_t type;
+    decode_uint32_le((byte *) blocks, &offset, &type);
+    decode_uint32_le((byte *) blocks, &offset, &reserved);
+    decode_uint64_le((byte *) blocks, &offset, &region->dumpBlock);
+    decode_uint64_le((byte *) blocks, &offset, &region->blockCount);
+    decode_uint64_le((byte *) blocks, &offset, &region->sourcePBN);
+    region->type = type;
+  }
+
+  UDS_FREE(blocks);
+  toc->count = count;
+  result = checkRegions(toc, dumpBlocks - tocBlocks);
+  if (result != VDO_SUCCESS) {
+    freeDumpTOC(toc);
+  }
+
+  return result;
+}
+
+/**********************************************************************/
+const DumpRegion *findDumpRegion(const DumpTOC  *toc,
+                                 DumpRegionType  type,
+                                 size_t          number)
+{
+  for (size_t i = 0; i < toc->count; i++) {
+    if (toc->regions[i].type != type) {
+      continue;
+    }
+
+    if (number-- == 0) {
+      return &toc->regions[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**********************************************************************/
+void freeDumpTOC(DumpTOC *toc)
+{
+  UDS_FREE(toc->regions);
+  *toc = (DumpTOC) { .regions = NULL };
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/dumpTOC.h#1 $
+ */
+
+
+#ifndef DUMP_TOC_H
+#define DUMP_TOC_H
+
+#include "physicalLayer.h"
+#include "types.h"
+
+/**
+ * A metadata dump written by vdodumpmetadata ends with a table of contents
+ * saying where in the dump each piece of metadata was copied from, so that
+ * readers can go straight to the blocks they need instead of working out
+ * where they must be.
+ *
+ * The table is written in whole blocks at the end of the dump. It holds an
+ * entry for each region, in the order the regions appear in the dump, and
+ * ends with a trailer in the last bytes of its last block. Each entry is
+ * the region type as a little-endian uint32_t, four reserved bytes, and the
+ * position of the region in the dump, its length in blocks, and the
+ * physical block it was copied from, each a little-endian uint64_t. The
+ * trailer is DUMP_TOC_MAGIC, the format version as a little-endian
+ * uint32_t, four reserved bytes, and the number of entries and of blocks in
+ * the table, each a little-endian uint64_t.
+ **/
+
+typedef enum {
+  DUMP_REGION_GEOMETRY         = 1,
+  DUMP_REGION_SUPER_BLOCK      = 2,
+  /** Block map pages, or a zero block for an LBN with no leaf page */
+  DUMP_REGION_BLOCK_MAP        = 3,
+  /** The reference counts and slab journal of one slab */
+  DUMP_REGION_SLAB             = 4,
+  DUMP_REGION_RECOVERY_JOURNAL = 5,
+  DUMP_REGION_SLAB_SUMMARY     = 6,
+} DumpRegionType;
+
+typedef struct {
+  DumpRegionType          type;
+  /** The position of the region in the dump */
+  physical_block_number_t dumpBlock;
+  block_count_t           blockCount;
+  /** Where the region was copied from on the volume */
+  physical_block_number_t sourcePBN;
+} DumpRegion;
+
+typedef struct {
+  DumpRegion *regions;
+  size_t      count;
+  size_t      capacity;
+} DumpTOC;
+
+/**
+ * Add a region to a table of contents. If the region continues the last
+ * region both in the dump and on the volume, and is of the same type, the
+ * last region is extended instead. Slab regions are never merged, so that
+ * each slab has its own entry.
+ *
+ * @param toc         The table of contents
+ * @param type        The type of the region
+ * @param dumpBlock   The position of the region in the dump
+ * @param blockCount  The length of the region
+ * @param sourcePBN   Where the region was copied from
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check addDumpRegion(DumpTOC                 *toc,
+                               DumpRegionType           type,
+                               physical_block_number_t  dumpBlock,
+                               block_count_t            blockCount,
+                               physical_block_number_t  sourcePBN);
+
+/**
+ * Get the number of blocks a table of contents will take in the dump.
+ *
+ * @param toc  The table of contents
+ *
+ * @return The number of blocks
+ **/
+block_count_t getDumpTOCBlocks(const DumpTOC *toc);
+
+/**
+ * Encode a table of contents into the blocks which end a dump.
+ *
+ * @param toc     The table of contents
+ * @param blocks  A zeroed buffer of getDumpTOCBlocks() blocks
+ **/
+void encodeDumpTOC(const DumpTOC *toc, char *blocks);
+
+/**
+ * Read the table of contents from the end of a dump.
+ *
+ * @param [in]  layer  A layer reading the dump
+ * @param [out] toc    The table of contents to fill in
+ *
+ * @return VDO_SUCCESS, VDO_NOT_IMPLEMENTED if the dump has no table of
+ *         contents, or another error code
+ **/
+int __must_check readDumpTOC(PhysicalLayer *layer, DumpTOC *toc);
+
+/**
+ * Find the nth region of a type in a table of contents.
+ *
+ * @param toc     The table of contents
+ * @param type    The type of region
+ * @param number  How many regions of that type precede the one wanted
+ *
+ * @return The region, or NULL if there are not that many
+ **/
+const DumpRegion *findDumpRegion(const DumpTOC  *toc,
+                                 DumpRegionType  type,
+                                 size_t          number);
+
+/**
+ * Free the regions of a table of contents.
+ *
+ * @param toc  The table of contents
+ **/
+void freeDumpTOC(DumpTOC *toc);
+
+#endif // DUMP_TOC_H
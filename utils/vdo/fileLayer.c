@@ -21,29 +21,144 @@
 
 #include "fileLayer.h"
 
+#include <fcntl.h>
 #include <linux/fs.h>
+#include <sched.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "atomicDefs.h"
 #include "fileUtils.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
 #include "permassert.h"
 #include "syscalls.h"
+#include "timeUtils.h"
+#include "uds-threads.h"
 
 #include "constants.h"
+#include "numUtils.h"
 #include "statusCodes.h"
 
+#include "ioUring.h"
+
+enum {
+  /** The largest single request the io_uring engine will submit */
+  IO_URING_CHUNK_BYTES         = 128 * 1024,
+  /** The io_uring queue depth when VDO_IO_QUEUE_DEPTH is not set */
+  DEFAULT_IO_URING_QUEUE_DEPTH = 32,
+  /** The largest io_uring queue depth which may be requested */
+  MAX_IO_URING_QUEUE_DEPTH     = 4096,
+  /** The number of idle buffers a layer keeps for reuse */
+  IO_BUFFER_POOL_SIZE          = 64,
+  /** The largest number of I/O threads which may be requested */
+  MAX_IO_THREADS               = 64,
+  /** The size of the pieces a large read is split into for I/O threads */
+  IO_THREAD_STRIPE_BLOCKS      = 32,
+};
+
+/**
+ * An idle aligned buffer kept by a file layer for reuse.
+ **/
+typedef struct {
+  char   *buffer;
+  size_t  bytes;
+} PooledBuffer;
+
+/**
+ * The I/O counters of a file layer, which may be updated from several
+ * threads at once.
+ **/
+typedef struct {
+  atomic64_t reads;
+  atomic64_t readBytes;
+  atomic64_t writes;
+  atomic64_t writeBytes;
+  atomic64_t latency[IO_LATENCY_BUCKETS];
+} IOCounters;
+
+/**
+ * The ways in which a file layer can issue its I/O, chosen at runtime with
+ * the VDO_IO_ENGINE environment variable.
+ **/
+typedef enum {
+  /** Use io_uring if the kernel supports it, else pread/pwrite */
+  IO_ENGINE_AUTO,
+  /** Always use synchronous pread/pwrite */
+  IO_ENGINE_SYNC,
+  /** Use io_uring, warning if falling back to pread/pwrite */
+  IO_ENGINE_IO_URING,
+} IOEngine;
+
+typedef struct ioWorker IOWorker;
+
 typedef struct fileLayer {
   PhysicalLayer common;
   block_count_t blockCount;
   block_count_t fileOffset;
   int           fd;
   size_t        alignment;
+  bool          blockDevice;
+  bool          buffered;
+  IoUring      *ring;
+  /** Held by the thread using the ring, which is not thread safe */
+  struct mutex  ringLock;
+  /** The threads which share out batched reads, if any */
+  unsigned int  workerCount;
+  IOWorker     *workers;
+  IOCounters    counters;
+  /** Protects the buffer pool */
+  struct mutex  poolLock;
+  unsigned int  pooledCount;
+  PooledBuffer  pool[IO_BUFFER_POOL_SIZE];
   char          name[];
 } FileLayer;
 
+/**
+ * A batch of extent reads which has been shared out among a layer's I/O
+ * threads.
+ **/
+typedef struct {
+  /** Protects the fields below, and serializes calls to the callback */
+  struct mutex          lock;
+  struct cond_var       done;
+  size_t                outstanding;
+  int                   firstError;
+  extent_read_callback *callback;
+  void                 *context;
+} IOBatch;
+
+/**
+ * A run of consecutive extents of a batch queued for one I/O thread.
+ **/
+typedef struct ioWork IOWork;
+struct ioWork {
+  IOWork             *next;
+  IOBatch            *batch;
+  struct extent_read *extents;
+  size_t              count;
+};
+
+/**
+ * An I/O thread, which reads the work queued for it with its own file
+ * descriptor so that the reads of different threads proceed in parallel.
+ **/
+struct ioWorker {
+  FileLayer       *layer;
+  int              fd;
+  struct thread   *thread;
+  /** Protects the queue and the stopping flag */
+  struct mutex     lock;
+  struct cond_var  workAvailable;
+  IOWork          *head;
+  IOWork          *tail;
+  bool             stopping;
+};
+
 /**********************************************************************/
 static inline FileLayer *asFileLayer(PhysicalLayer *layer)
 {
@@ -57,6 +172,62 @@ static block_count_t getBlockCount(PhysicalLayer *header)
   return asFileLayer(header)->blockCount;
 }
 
+/**
+ * Count an I/O operation which has finished.
+ *
+ * @param layer      The layer which did the I/O
+ * @param read       Whether the operation was a read
+ * @param bytes      The number of bytes transferred
+ * @param startTime  The time at which the operation was started
+ **/
+static void recordIO(FileLayer *layer,
+                     bool       read,
+                     size_t     bytes,
+                     ktime_t    startTime)
+{
+  IOCounters *counters = &layer->counters;
+  atomic64_inc(read ? &counters->reads : &counters->writes);
+  atomic64_add(bytes, read ? &counters->readBytes : &counters->writeBytes);
+
+  ktime_t micros
+    = ktime_sub(current_time_ns(CLOCK_MONOTONIC), startTime) / NSEC_PER_USEC;
+  unsigned int bucket = ((micros <= 0) ? 0 : log_base_two(micros) + 1);
+  bucket = min(bucket, (unsigned int) IO_LATENCY_BUCKETS - 1);
+  atomic64_inc(&counters->latency[bucket]);
+}
+
+/**
+ * Implements io_statistics_getter.
+ **/
+static void getIOStatistics(PhysicalLayer *header, struct io_statistics *stats)
+{
+  IOCounters *counters = &asFileLayer(header)->counters;
+  stats->reads       = atomic64_read(&counters->reads);
+  stats->read_bytes  = atomic64_read(&counters->readBytes);
+  stats->writes      = atomic64_read(&counters->writes);
+  stats->write_bytes = atomic64_read(&counters->writeBytes);
+  for (unsigned int i = 0; i < IO_LATENCY_BUCKETS; i++) {
+    stats->latency[i] = atomic64_read(&counters->latency[i]);
+  }
+}
+
+/**
+ * Try to take exclusive use of a layer's io_uring. Rather than waiting for
+ * a busy ring, callers fall back to synchronous I/O, so that threads sharing
+ * a layer proceed in parallel and extent callbacks may read from the layer
+ * which invoked them.
+ *
+ * @param layer  The layer
+ *
+ * @return <code>true</code> if the layer has a ring and the caller now owns
+ *         it
+ **/
+static bool tryLockRing(FileLayer *layer)
+{
+  return ((layer->ring != NULL)
+          && (pthread_mutex_trylock(&layer->ringLock.mutex) == 0));
+}
+
 /**
  * An implementation of buffer_allocator that creates a buffer
  * properly aligned for direct I/O to the device under the file layer.
@@ -84,10 +255,69 @@ static int allocateIOBuffer(PhysicalLayer   *header,
                              bufferPtr);
 }
 
+/**
+ * Lend out an aligned buffer from the layer's pool, allocating a new one if
+ * no idle buffer is big enough.
+ *
+ * Implements buffer_borrower.
+ **/
+static int borrowIOBuffer(PhysicalLayer  *header,
+                          size_t          bytes,
+                          const char     *why,
+                          char          **bufferPtr)
+{
+  FileLayer *layer = asFileLayer(header);
+  uds_lock_mutex(&layer->poolLock);
+  // Take the smallest idle buffer which is big enough.
+  unsigned int best = layer->pooledCount;
+  for (unsigned int i = 0; i < layer->pooledCount; i++) {
+    if ((layer->pool[i].bytes >= bytes)
+        && ((best == layer->pooledCount)
+            || (layer->pool[i].bytes < layer->pool[best].bytes))) {
+      best = i;
+    }
+  }
+
+  if (best < layer->pooledCount) {
+    *bufferPtr = layer->pool[best].buffer;
+    layer->pool[best] = layer->pool[--layer->pooledCount];
+    uds_unlock_mutex(&layer->poolLock);
+    return VDO_SUCCESS;
+  }
+
+  uds_unlock_mutex(&layer->poolLock);
+  return allocateIOBuffer(header, bytes, why, bufferPtr);
+}
+
+/**
+ * Take back a buffer lent out by borrowIOBuffer(), keeping it for reuse if
+ * the pool has room.
+ *
+ * Implements buffer_returner.
+ **/
+static void returnIOBuffer(PhysicalLayer *header, size_t bytes, char *buffer)
+{
+  if (buffer == NULL) {
+    return;
+  }
+
+  FileLayer *layer = asFileLayer(header);
+  uds_lock_mutex(&layer->poolLock);
+  if (layer->pooledCount < IO_BUFFER_POOL_SIZE) {
+    layer->pool[layer->pooledCount++] = (PooledBuffer) {
+      .buffer = buffer,
+      .bytes  = bytes,
+    };
+    buffer = NULL;
+  }
+  uds_unlock_mutex(&layer->poolLock);
+  UDS_FREE(buffer);
+}
+
 /**
  * Check if the provided buffer is properly aligned for the device
- * under the file layer; if so, return it, otherwise allocate a new, properly
- * aligned buffer and return that.
+ * under the file layer; if so, return it, otherwise borrow a properly
+ * aligned buffer from the layer's pool and return that.
  *
  * @param [in]  layer             The file layer in question
  * @param [in]  buffer            A buffer to use, if aligned
@@ -108,7 +338,7 @@ static int makeAlignedBuffer(FileLayer *layer,
     return VDO_SUCCESS;
   }
 
-  return allocateIOBuffer(&layer->common, bytes, what, alignedBufferPtr);
+  return borrowIOBuffer(&layer->common, bytes, what, alignedBufferPtr);
 }
 
 /**
@@ -131,6 +361,21 @@ static int performIO(FileLayer               *layer,
 {
   // Make sure we cast so we get a proper 64 bit value on the calculation
   off_t offset = (off_t) startBlock * VDO_BLOCK_SIZE;
+  ktime_t startTime = current_time_ns(CLOCK_MONOTONIC);
+  if (tryLockRing(layer)) {
+    int result = transferWithIoUring(layer->ring, layer->fd, read, buffer,
+                                     bytes, offset, IO_URING_CHUNK_BYTES);
+    uds_unlock_mutex(&layer->ringLock);
+    recordIO(layer, read, bytes, startTime);
+    if (result != VDO_SUCCESS) {
+      return uds_log_error_strerror(result, "%s %s",
+                                    (read ? "io_uring read" : "io_uring write"),
+                                    layer->name);
+    }
+    return VDO_SUCCESS;
+  }
+
+  size_t  total = bytes;
   ssize_t n;
   for (; bytes > 0; bytes -= n) {
     n = (read
@@ -147,9 +392,56 @@ static int performIO(FileLayer               *layer,
     buffer += n;
   }
 
+  recordIO(layer, read, total, startTime);
   return VDO_SUCCESS;
 }
 
+static int readExtentsWithWorkers(FileLayer            *layer,
+                                  struct extent_read   *extents,
+                                  size_t                count,
+                                  extent_read_callback *callback,
+                                  void                 *context);
+
+/**
+ * Read a large extent by splitting it into stripes which the layer's I/O
+ * threads read in parallel.
+ *
+ * @param layer       The layer from which to read
+ * @param startBlock  The first block to read, relative to the file offset
+ * @param blockCount  The number of blocks to read
+ * @param buffer      The aligned buffer to read into
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int readWithWorkers(FileLayer               *layer,
+                           physical_block_number_t  startBlock,
+                           size_t                   blockCount,
+                           char                    *buffer)
+{
+  size_t stripeCount
+    = compute_bucket_count(blockCount, IO_THREAD_STRIPE_BLOCKS);
+  struct extent_read *stripes;
+  int result = UDS_ALLOCATE(stripeCount, struct extent_read, "read stripes",
+                            &stripes);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  for (size_t i = 0; i < stripeCount; i++) {
+    size_t offset = i * IO_THREAD_STRIPE_BLOCKS;
+    stripes[i] = (struct extent_read) {
+      .start_block = startBlock + offset,
+      .block_count = min((size_t) IO_THREAD_STRIPE_BLOCKS,
+                         blockCount - offset),
+      .buffer      = buffer + (offset * VDO_BLOCK_SIZE),
+    };
+  }
+
+  result = readExtentsWithWorkers(layer, stripes, stripeCount, NULL, NULL);
+  UDS_FREE(stripes);
+  return result;
+}
+
 /**********************************************************************/
 static int fileReader(PhysicalLayer           *header,
                       physical_block_number_t  startBlock,
@@ -166,6 +458,13 @@ static int fileReader(PhysicalLayer           *header,
   uds_log_debug("FL: Reading %zu blocks from block %llu",
                 blockCount, (unsigned long long) startBlock);
 
+  if ((layer->workerCount > 1)
+      && (blockCount >= 2 * IO_THREAD_STRIPE_BLOCKS)
+      && ((((uintptr_t) buffer) % layer->alignment) == 0)) {
+    return readWithWorkers(layer, startBlock - layer->fileOffset, blockCount,
+                           buffer);
+  }
+
   // Make sure we cast so we get a proper 64 bit value on the calculation
   char *alignedBuffer;
   size_t bytes = VDO_BLOCK_SIZE * blockCount;
@@ -178,7 +477,7 @@ static int fileReader(PhysicalLayer           *header,
   result = performIO(layer, startBlock, bytes, true, alignedBuffer);
   if (alignedBuffer != buffer) {
     memcpy(buffer, alignedBuffer, bytes);
-    UDS_FREE(alignedBuffer);
+    returnIOBuffer(header, bytes, alignedBuffer);
   }
 
   return result;
@@ -216,12 +515,601 @@ static int fileWriter(PhysicalLayer           *header,
 
   result = performIO(layer, startBlock, bytes, false, alignedBuffer);
   if (alignedBuffer != buffer) {
-    UDS_FREE(alignedBuffer);
+    returnIOBuffer(header, bytes, alignedBuffer);
   }
 
   return result;
 }
 
+/**
+ * Complete one extent of a batched read.
+ *
+ * @param extent    The extent which has completed
+ * @param result    The result of reading the extent
+ * @param callback  The callback for the batch, if any
+ * @param context   The context for the callback
+ **/
+static void completeExtent(struct extent_read   *extent,
+                           int                   result,
+                           extent_read_callback *callback,
+                           void                 *context)
+{
+  extent->result = result;
+  if (callback != NULL) {
+    callback(extent, context);
+  }
+}
+
+/**
+ * Check whether an extent of a batched read can be read directly into its
+ * buffer by a vectored read.
+ *
+ * @param layer   The layer being read
+ * @param extent  The extent to check
+ *
+ * @return <code>true</code> if the extent is in range and its buffer is
+ *         suitably aligned
+ **/
+static bool isDirectExtent(FileLayer *layer, const struct extent_read *extent)
+{
+  return ((((uintptr_t) extent->buffer) % layer->alignment) == 0)
+    && ((extent->start_block + layer->fileOffset + extent->block_count)
+        <= layer->blockCount);
+}
+
+/**
+ * Read a run of extents which are contiguous on the device with a single
+ * preadv() loop, resuming after short reads.
+ *
+ * @param layer     The layer from which to read
+ * @param fd        The descriptor of the layer's file to read with
+ * @param iov       The buffers of the extents; modified by the read
+ * @param iovCount  The number of extents in the run
+ * @param offset    The byte offset of the start of the run
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int performVectoredRead(FileLayer    *layer,
+                               int           fd,
+                               struct iovec *iov,
+                               int           iovCount,
+                               off_t         offset)
+{
+  while (iovCount > 0) {
+    ktime_t startTime = current_time_ns(CLOCK_MONOTONIC);
+    ssize_t n = preadv(fd, iov, iovCount, offset);
+    if (n > 0) {
+      recordIO(layer, true, n, startTime);
+    }
+
+    if (n <= 0) {
+      if (n == 0) {
+        errno = VDO_UNEXPECTED_EOF;
+      }
+      return uds_log_error_strerror(errno, "preadv %s", layer->name);
+    }
+
+    offset += n;
+    for (; (iovCount > 0) && ((size_t) n >= iov->iov_len); iov++, iovCount--) {
+      n -= iov->iov_len;
+    }
+
+    if (n > 0) {
+      iov->iov_base  = (char *) iov->iov_base + n;
+      iov->iov_len  -= n;
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Read a batch of extents with preadv(), coalescing runs of extents which
+ * are contiguous on the device into single system calls.
+ **/
+static int readExtentsWithPreadv(FileLayer            *layer,
+                                 int                   fd,
+                                 struct extent_read   *extents,
+                                 size_t                count,
+                                 extent_read_callback *callback,
+                                 void                 *context)
+{
+  struct iovec *iov;
+  int result = UDS_ALLOCATE(min(count, (size_t) UIO_MAXIOV), struct iovec,
+                            "extent read vectors", &iov);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  int firstError = VDO_SUCCESS;
+  size_t i = 0;
+  while (i < count) {
+    if (!isDirectExtent(layer, &extents[i])) {
+      result = fileReader(&layer->common, extents[i].start_block,
+                          extents[i].block_count, extents[i].buffer);
+      completeExtent(&extents[i], result, callback, context);
+      firstError = ((firstError == VDO_SUCCESS) ? result : firstError);
+      i++;
+      continue;
+    }
+
+    size_t runStart = i;
+    physical_block_number_t nextBlock = extents[i].start_block;
+    int iovCount = 0;
+    while ((i < count) && (iovCount < UIO_MAXIOV)
+           && (extents[i].start_block == nextBlock)
+           && isDirectExtent(layer, &extents[i])) {
+      iov[iovCount++] = (struct iovec) {
+        .iov_base = extents[i].buffer,
+        .iov_len  = extents[i].block_count * VDO_BLOCK_SIZE,
+      };
+      nextBlock += extents[i].block_count;
+      i++;
+    }
+
+    off_t offset = ((off_t) (extents[runStart].start_block + layer->fileOffset)
+                    * VDO_BLOCK_SIZE);
+    result = performVectoredRead(layer, fd, iov, iovCount, offset);
+    for (size_t j = runStart; j < i; j++) {
+      completeExtent(&extents[j], result, callback, context);
+    }
+    firstError = ((firstError == VDO_SUCCESS) ? result : firstError);
+  }
+
+  UDS_FREE(iov);
+  return firstError;
+}
+
+/**
+ * The context for completing the extents of a batch read with io_uring.
+ **/
+typedef struct {
+  FileLayer            *layer;
+  ktime_t               startTime;
+  struct extent_read   *extents;
+  size_t               *indexes;
+  extent_read_callback *callback;
+  void                 *context;
+} IoUringBatch;
+
+/**
+ * Complete an extent read with io_uring.
+ *
+ * Implements IoUringCompletion.
+ **/
+static void completeIoUringExtent(size_t index, int result, void *context)
+{
+  IoUringBatch       *batch  = context;
+  struct extent_read *extent = &batch->extents[batch->indexes[index]];
+  recordIO(batch->layer, true, extent->block_count * VDO_BLOCK_SIZE,
+           batch->startTime);
+  completeExtent(extent, result, batch->callback, batch->context);
+}
+
+/**
+ * Read a batch of extents by submitting all of them to the layer's io_uring
+ * at once.
+ **/
+static int readExtentsWithIoUring(FileLayer            *layer,
+                                  struct extent_read   *extents,
+                                  size_t                count,
+                                  extent_read_callback *callback,
+                                  void                 *context)
+{
+  IoUringTransfer *transfers;
+  int result = UDS_ALLOCATE(count, IoUringTransfer, "extent transfers",
+                            &transfers);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  size_t *indexes;
+  result = UDS_ALLOCATE(count, size_t, "extent indexes", &indexes);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(transfers);
+    return result;
+  }
+
+  // Extents which need bounce buffers or are out of range are handled by
+  // the ordinary reader; the rest go to the ring together.
+  int firstError = VDO_SUCCESS;
+  size_t transferCount = 0;
+  for (size_t i = 0; i < count; i++) {
+    struct extent_read *extent = &extents[i];
+    if (!isDirectExtent(layer, extent)) {
+      result = fileReader(&layer->common, extent->start_block,
+                          extent->block_count, extent->buffer);
+      completeExtent(extent, result, callback, context);
+      firstError = ((firstError == VDO_SUCCESS) ? result : firstError);
+      continue;
+    }
+
+    indexes[transferCount] = i;
+    transfers[transferCount++] = (IoUringTransfer) {
+      .buffer = extent->buffer,
+      .bytes  = extent->block_count * VDO_BLOCK_SIZE,
+      .offset = ((off_t) (extent->start_block + layer->fileOffset)
+                 * VDO_BLOCK_SIZE),
+    };
+  }
+
+  IoUringBatch batch = {
+    .layer     = layer,
+    .startTime = current_time_ns(CLOCK_MONOTONIC),
+    .extents   = extents,
+    .indexes   = indexes,
+    .callback  = callback,
+    .context   = context,
+  };
+  result = transferBatchWithIoUring(layer->ring, layer->fd, true, transfers,
+                                    transferCount, IO_URING_CHUNK_BYTES,
+                                    completeIoUringExtent, &batch);
+  if (result != VDO_SUCCESS) {
+    uds_log_error_strerror(result, "io_uring read %s", layer->name);
+    firstError = ((firstError == VDO_SUCCESS) ? result : firstError);
+  }
+
+  UDS_FREE(indexes);
+  UDS_FREE(transfers);
+  return firstError;
+}
+
+/**
+ * Complete an extent read by an I/O thread, and wake the submitter if it was
+ * the last extent of its batch.
+ *
+ * Implements extent_read_callback.
+ **/
+static void completeWorkerExtent(struct extent_read *extent, void *context)
+{
+  IOBatch *batch = context;
+  uds_lock_mutex(&batch->lock);
+  if (batch->firstError == VDO_SUCCESS) {
+    batch->firstError = extent->result;
+  }
+
+  if (batch->callback != NULL) {
+    batch->callback(extent, batch->context);
+  }
+
+  if (--batch->outstanding == 0) {
+    uds_signal_cond(&batch->done);
+  }
+  uds_unlock_mutex(&batch->lock);
+}
+
+/**
+ * The main loop of an I/O thread.
+ *
+ * @param arg  The IOWorker
+ **/
+static void ioWorkerLoop(void *arg)
+{
+  IOWorker *worker = arg;
+  for (;;) {
+    uds_lock_mutex(&worker->lock);
+    while ((worker->head == NULL) && !worker->stopping) {
+      uds_wait_cond(&worker->workAvailable, &worker->lock);
+    }
+
+    IOWork *work = worker->head;
+    if (work == NULL) {
+      uds_unlock_mutex(&worker->lock);
+      return;
+    }
+
+    worker->head = work->next;
+    if (worker->head == NULL) {
+      worker->tail = NULL;
+    }
+    uds_unlock_mutex(&worker->lock);
+
+    // Errors are returned through the completions.
+    readExtentsWithPreadv(worker->layer, worker->fd, work->extents,
+                          work->count, completeWorkerExtent, work->batch);
+  }
+}
+
+/**
+ * Add work to the queue of an I/O thread.
+ *
+ * @param worker  The thread to do the work
+ * @param work    The work to do
+ **/
+static void enqueueIOWork(IOWorker *worker, IOWork *work)
+{
+  work->next = NULL;
+  uds_lock_mutex(&worker->lock);
+  if (worker->tail == NULL) {
+    worker->head = work;
+  } else {
+    worker->tail->next = work;
+  }
+  worker->tail = work;
+  uds_signal_cond(&worker->workAvailable);
+  uds_unlock_mutex(&worker->lock);
+}
+
+/**
+ * Share a batch of extent reads out among a layer's I/O threads and wait
+ * for all of them to complete. Each thread gets a run of consecutive
+ * extents, so that contiguous extents can still be coalesced.
+ **/
+static int readExtentsWithWorkers(FileLayer            *layer,
+                                  struct extent_read   *extents,
+                                  size_t                count,
+                                  extent_read_callback *callback,
+                                  void                 *context)
+{
+  size_t workCount = min(count, (size_t) layer->workerCount);
+  IOWork *work;
+  int result = UDS_ALLOCATE(workCount, IOWork, "I/O thread work", &work);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  IOBatch batch = {
+    .outstanding = count,
+    .firstError  = VDO_SUCCESS,
+    .callback    = callback,
+    .context     = context,
+  };
+  result = uds_init_mutex(&batch.lock);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(work);
+    return result;
+  }
+
+  result = uds_init_cond(&batch.done);
+  if (result != UDS_SUCCESS) {
+    uds_destroy_mutex(&batch.lock);
+    UDS_FREE(work);
+    return result;
+  }
+
+  size_t start = 0;
+  for (size_t i = 0; i < workCount; i++) {
+    size_t end = ((i + 1) * count) / workCount;
+    work[i] = (IOWork) {
+      .batch   = &batch,
+      .extents = &extents[start],
+      .count   = end - start,
+    };
+    enqueueIOWork(&layer->workers[i], &work[i]);
+    start = end;
+  }
+
+  uds_lock_mutex(&batch.lock);
+  while (batch.outstanding > 0) {
+    uds_wait_cond(&batch.done, &batch.lock);
+  }
+  uds_unlock_mutex(&batch.lock);
+
+  uds_destroy_cond(&batch.done);
+  uds_destroy_mutex(&batch.lock);
+  UDS_FREE(work);
+  return batch.firstError;
+}
+
+/**
+ * Read a batch of extents from a file layer.
+ *
+ * Implements batch_extent_reader.
+ **/
+static int fileBatchReader(PhysicalLayer        *header,
+                           struct extent_read   *extents,
+                           size_t                count,
+                           extent_read_callback *callback,
+                           void                 *context)
+{
+  FileLayer *layer = asFileLayer(header);
+  uds_log_debug("FL: Reading a batch of %zu extents", count);
+  if (count == 0) {
+    return VDO_SUCCESS;
+  }
+
+  if ((layer->workerCount > 1) && (count > 1)) {
+    return readExtentsWithWorkers(layer, extents, count, callback, context);
+  }
+
+  if (tryLockRing(layer)) {
+    int result = readExtentsWithIoUring(layer, extents, count, callback,
+                                        context);
+    uds_unlock_mutex(&layer->ringLock);
+    return result;
+  }
+
+  return readExtentsWithPreadv(layer, layer->fd, extents, count, callback,
+                               context);
+}
+
+/**
+ * Zero an extent of a file layer by asking the device (with BLKZEROOUT, or
+ * BLKDISCARD if discarded blocks read back as zeros) or the file system
+ * (with fallocate()) to do it.
+ *
+ * Implements extent_zeroer.
+ **/
+static int fileZeroer(PhysicalLayer           *header,
+                      physical_block_number_t  startBlock,
+                      size_t                   blockCount)
+{
+  FileLayer *layer = asFileLayer(header);
+  startBlock += layer->fileOffset;
+
+  if (startBlock + blockCount > layer->blockCount) {
+    return VDO_OUT_OF_RANGE;
+  }
+
+  uds_log_debug("FL: Zeroing %zu blocks from block %llu",
+                blockCount, (unsigned long long) startBlock);
+
+  // Make sure we cast so we get a proper 64 bit value on the calculation
+  uint64_t range[2] = {
+    (uint64_t) startBlock * VDO_BLOCK_SIZE,
+    (uint64_t) blockCount * VDO_BLOCK_SIZE,
+  };
+  if (layer->blockDevice) {
+    if (ioctl(layer->fd, BLKZEROOUT, range) == 0) {
+      return VDO_SUCCESS;
+    }
+
+    unsigned int discardZeroes = 0;
+    if ((ioctl(layer->fd, BLKDISCARDZEROES, &discardZeroes) == 0)
+        && (discardZeroes != 0)
+        && (ioctl(layer->fd, BLKDISCARD, range) == 0)) {
+      return VDO_SUCCESS;
+    }
+  } else {
+    if ((fallocate(layer->fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+                   range[0], range[1]) == 0)
+        || (fallocate(layer->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      range[0], range[1]) == 0)) {
+      return VDO_SUCCESS;
+    }
+  }
+
+  uds_log_debug("FL: Cannot offload zeroing of %s: %s", layer->name,
+                strerror(errno));
+  return VDO_NOT_IMPLEMENTED;
+}
+
+/**
+ * Move the bytes in a pipe on to a file descriptor with splice().
+ *
+ * @param pipeFD     The read end of the pipe
+ * @param bytes      The number of bytes in the pipe
+ * @param fd         The file descriptor to move them to
+ * @param offsetPtr  The offset in fd to write at, which is advanced, or NULL
+ *                   to write at the file position of fd
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int drainPipe(int pipeFD, size_t bytes, int fd, off_t *offsetPtr)
+{
+  while (bytes > 0) {
+    ssize_t n = splice(pipeFD, NULL, fd, offsetPtr, bytes, SPLICE_F_MOVE);
+    if (n <= 0) {
+      return ((n == 0) ? VDO_UNEXPECTED_EOF : errno);
+    }
+
+    bytes -= n;
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Copy part of a layer's file to a file descriptor by splicing it through a
+ * pipe, which works whatever the file descriptor is, so long as the kernel
+ * can splice to it.
+ *
+ * @param layer      The layer to copy from
+ * @param inOffset   The offset in the layer's file to copy from, which is
+ *                   advanced past what has been copied
+ * @param bytes      The number of bytes to copy
+ * @param fd         The file descriptor to copy to
+ * @param offsetPtr  The offset in fd to write at, which is advanced, or NULL
+ *                   to write at the file position of fd
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int spliceThroughPipe(FileLayer *layer,
+                             off_t     *inOffset,
+                             size_t     bytes,
+                             int        fd,
+                             off_t     *offsetPtr)
+{
+  int pipeFDs[2];
+  if (pipe(pipeFDs) != 0) {
+    return errno;
+  }
+
+  int result = VDO_SUCCESS;
+  while ((bytes > 0) && (result == VDO_SUCCESS)) {
+    ssize_t n = splice(layer->fd, inOffset, pipeFDs[1], NULL, bytes,
+                       SPLICE_F_MOVE);
+    if (n <= 0) {
+      result = ((n == 0) ? VDO_UNEXPECTED_EOF : errno);
+      break;
+    }
+
+    bytes -= n;
+    result = drainPipe(pipeFDs[0], n, fd, offsetPtr);
+  }
+
+  close(pipeFDs[0]);
+  close(pipeFDs[1]);
+  return result;
+}
+
+/**
+ * Copy an extent of a file layer with copy_file_range(), or failing that,
+ * by splicing it through a pipe, so that the data never enters user space.
+ *
+ * Implements extent_copier.
+ **/
+static int fileCopier(PhysicalLayer           *header,
+                      physical_block_number_t  startBlock,
+                      size_t                   blockCount,
+                      int                      fd,
+                      off_t                   *offsetPtr)
+{
+  FileLayer *layer = asFileLayer(header);
+  startBlock += layer->fileOffset;
+
+  if (startBlock + blockCount > layer->blockCount) {
+    return VDO_OUT_OF_RANGE;
+  }
+
+  uds_log_debug("FL: Copying %zu blocks from block %llu",
+                blockCount, (unsigned long long) startBlock);
+
+  // Make sure we cast so we get a proper 64 bit value on the calculation
+  off_t   start     = (off_t) startBlock * VDO_BLOCK_SIZE;
+  off_t   offset    = start;
+  size_t  bytes     = blockCount * VDO_BLOCK_SIZE;
+  ktime_t startTime = current_time_ns(CLOCK_MONOTONIC);
+  int     result    = VDO_SUCCESS;
+  while (offset < start + (off_t) bytes) {
+    ssize_t n = copy_file_range(layer->fd, &offset, fd, offsetPtr,
+                                start + bytes - offset, 0);
+    if (n <= 0) {
+      result = ((n == 0) ? VDO_UNEXPECTED_EOF : errno);
+      break;
+    }
+  }
+
+  if ((result != VDO_SUCCESS) && (offset == start)) {
+    // Files on different file systems, block devices, and pipes can't be
+    // copied between on many kernels, but can usually be spliced.
+    result = spliceThroughPipe(layer, &offset, bytes, fd, offsetPtr);
+  }
+
+  if (result == VDO_SUCCESS) {
+    recordIO(layer, true, bytes, startTime);
+    return VDO_SUCCESS;
+  }
+
+  if ((offset == start) && (result == EINVAL)) {
+    // Nothing has been copied, so the caller can still copy it themselves.
+    uds_log_debug("FL: Cannot copy from %s in the kernel: %s", layer->name,
+                  strerror(result));
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  return uds_log_error_strerror(result, "copy from %s", layer->name);
+}
+
+/**********************************************************************/
+static int
+noZeroer(PhysicalLayer           *header __attribute__((unused)),
+         physical_block_number_t  startBlock __attribute__((unused)),
+         size_t                   blockCount __attribute__((unused)))
+{
+  return EPERM;
+}
+
 /**********************************************************************/
 static int
 noWriter(PhysicalLayer           *header __attribute__((unused)),
@@ -248,6 +1136,169 @@ static void vacuousFlush(struct vdo_flush *vdoFlush __attribute__((unused)))
 {
 }
 
+/**
+ * Pass access advice on to the kernel. Since the kernel's readahead and page
+ * cache are bypassed by direct I/O, this only does anything for layers
+ * opened with VDO_IO_BUFFERED set.
+ *
+ * Implements access_advisor.
+ **/
+static void fileAdvisor(PhysicalLayer           *header,
+                        physical_block_number_t  startBlock,
+                        block_count_t            blockCount,
+                        enum access_pattern      pattern)
+{
+  FileLayer *layer = asFileLayer(header);
+  if (!layer->buffered || (startBlock >= layer->blockCount)) {
+    return;
+  }
+
+  int advice;
+  switch (pattern) {
+  case ACCESS_SEQUENTIAL:
+    advice = POSIX_FADV_SEQUENTIAL;
+    break;
+
+  case ACCESS_RANDOM:
+    advice = POSIX_FADV_RANDOM;
+    break;
+
+  case ACCESS_WILL_NEED:
+    advice = POSIX_FADV_WILLNEED;
+    break;
+
+  case ACCESS_DONT_NEED:
+    advice = POSIX_FADV_DONTNEED;
+    break;
+
+  default:
+    advice = POSIX_FADV_NORMAL;
+  }
+
+  blockCount = min(blockCount, layer->blockCount - startBlock);
+  off_t offset = (startBlock + layer->fileOffset) * VDO_BLOCK_SIZE;
+  int result = posix_fadvise(layer->fd, offset, blockCount * VDO_BLOCK_SIZE,
+                             advice);
+  if (result != 0) {
+    // Advice is only a hint, so failing to give it is not an error.
+    uds_log_debug("posix_fadvise on %s failed: %s", layer->name,
+                  strerror(result));
+  }
+}
+
+/**
+ * Determine from the VDO_IO_BUFFERED environment variable whether file
+ * layers should go through the page cache instead of using direct I/O.
+ *
+ * @return <code>true</code> if buffered I/O was requested
+ **/
+static bool useBufferedIO(void)
+{
+  const char *buffered = getenv("VDO_IO_BUFFERED");
+  return ((buffered != NULL) && (strcmp(buffered, "") != 0)
+          && (strcmp(buffered, "0") != 0));
+}
+
+/**
+ * Stop and free the I/O threads of a layer.
+ *
+ * @param layer  The layer
+ **/
+static void stopIOWorkers(FileLayer *layer)
+{
+  for (unsigned int i = 0; i < layer->workerCount; i++) {
+    IOWorker *worker = &layer->workers[i];
+    uds_lock_mutex(&worker->lock);
+    worker->stopping = true;
+    uds_signal_cond(&worker->workAvailable);
+    uds_unlock_mutex(&worker->lock);
+    uds_join_threads(worker->thread);
+    uds_destroy_cond(&worker->workAvailable);
+    uds_destroy_mutex(&worker->lock);
+    try_close_file(worker->fd);
+  }
+
+  UDS_FREE(layer->workers);
+  layer->workers     = NULL;
+  layer->workerCount = 0;
+}
+
+/**
+ * Start I/O threads for a layer, each with its own read-only descriptor for
+ * the layer's file. The threads are spread over the CPUs this process may
+ * run on.
+ *
+ * @param layer        The layer
+ * @param threadCount  The number of threads to start
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int startIOWorkers(FileLayer *layer, unsigned int threadCount)
+{
+  int result = UDS_ALLOCATE(threadCount, IOWorker, "I/O threads",
+                            &layer->workers);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  cpu_set_t allowed;
+  bool pin = (sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+  int cpu = -1;
+
+  enum file_access access
+    = (layer->buffered ? FU_READ_ONLY : FU_READ_ONLY_DIRECT);
+  for (unsigned int i = 0; i < threadCount; i++) {
+    IOWorker *worker = &layer->workers[i];
+    worker->layer = layer;
+    result = open_file(layer->name, access, &worker->fd);
+    if (result != UDS_SUCCESS) {
+      break;
+    }
+
+    result = uds_init_mutex(&worker->lock);
+    if (result != UDS_SUCCESS) {
+      try_close_file(worker->fd);
+      break;
+    }
+
+    result = uds_init_cond(&worker->workAvailable);
+    if (result != UDS_SUCCESS) {
+      uds_destroy_mutex(&worker->lock);
+      try_close_file(worker->fd);
+      break;
+    }
+
+    result = uds_create_thread(ioWorkerLoop, worker, "vdoIOThread",
+                               &worker->thread);
+    if (result != UDS_SUCCESS) {
+      uds_destroy_cond(&worker->workAvailable);
+      uds_destroy_mutex(&worker->lock);
+      try_close_file(worker->fd);
+      break;
+    }
+
+    layer->workerCount++;
+    if (pin && (CPU_COUNT(&allowed) > 1)) {
+      // Pick the next allowed CPU, wrapping around.
+      do {
+        cpu = (cpu + 1) % CPU_SETSIZE;
+      } while (!CPU_ISSET(cpu, &allowed));
+
+      cpu_set_t single;
+      CPU_ZERO(&single);
+      CPU_SET(cpu, &single);
+      // Placement is only a performance hint, so ignore any failure.
+      pthread_setaffinity_np(worker->thread->thread, sizeof(single), &single);
+    }
+  }
+
+  if (result != UDS_SUCCESS) {
+    stopIOWorkers(layer);
+  }
+
+  return result;
+}
+
 /**
  * Free a FileLayer and NULL out the reference to it.
  *
@@ -263,6 +1314,13 @@ static void freeLayer(PhysicalLayer **layerPtr)
   }
 
   FileLayer *fileLayer = asFileLayer(layer);
+  stopIOWorkers(fileLayer);
+  freeIoUring(&fileLayer->ring);
+  for (unsigned int i = 0; i < fileLayer->pooledCount; i++) {
+    UDS_FREE(fileLayer->pool[i].buffer);
+  }
+  uds_destroy_mutex(&fileLayer->ringLock);
+  uds_destroy_mutex(&fileLayer->poolLock);
   try_sync_and_close_file(fileLayer->fd);
   UDS_FREE(fileLayer);
   *layerPtr = NULL;
@@ -276,6 +1334,8 @@ static void freeLayer(PhysicalLayer **layerPtr)
  * @param [in]  blockCount  the span of the file, in blocks (may be zero for
  *                            read-only layers in which case it is computed)
  * @param [in]  fileOffset  the block offset to apply to I/O operations
+ * @param [in]  queueDepth  the io_uring queue depth, or 0 to use
+ *                          pread/pwrite
  * @param [out] layerPtr    the pointer to hold the result
  *
  * @return a success or error code
@@ -284,6 +1344,7 @@ static int setupFileLayer(const char     *name,
                           bool            readOnly,
                           block_count_t   blockCount,
                           block_count_t   fileOffset,
+                          unsigned int    queueDepth,
                           PhysicalLayer **layerPtr)
 {
   int result = ASSERT(layerPtr != NULL, "layerPtr must not be NULL");
@@ -315,8 +1376,13 @@ static int setupFileLayer(const char     *name,
     return ENOENT;
   }
 
-  enum file_access access
-    = readOnly ? FU_READ_ONLY_DIRECT : FU_READ_WRITE_DIRECT;
+  layer->buffered = useBufferedIO();
+  enum file_access access;
+  if (layer->buffered) {
+    access = readOnly ? FU_READ_ONLY : FU_READ_WRITE;
+  } else {
+    access = readOnly ? FU_READ_ONLY_DIRECT : FU_READ_WRITE_DIRECT;
+  }
   result = open_file(layer->name, access, &layer->fd);
   if (result != UDS_SUCCESS) {
     UDS_FREE(layer);
@@ -368,30 +1434,198 @@ static int setupFileLayer(const char     *name,
     return result;
   }
 
+  result = uds_init_mutex(&layer->poolLock);
+  if (result != UDS_SUCCESS) {
+    try_close_file(layer->fd);
+    UDS_FREE(layer);
+    return result;
+  }
+
+  result = uds_init_mutex(&layer->ringLock);
+  if (result != UDS_SUCCESS) {
+    uds_destroy_mutex(&layer->poolLock);
+    try_close_file(layer->fd);
+    UDS_FREE(layer);
+    return result;
+  }
+
+  if (queueDepth > 0) {
+    result = makeIoUring(queueDepth, &layer->ring);
+    if (result != VDO_SUCCESS) {
+      uds_destroy_mutex(&layer->ringLock);
+      uds_destroy_mutex(&layer->poolLock);
+      try_close_file(layer->fd);
+      UDS_FREE(layer);
+      return result;
+    }
+  }
+
   layer->alignment               = statbuf.st_blksize;
+  layer->blockDevice             = blockDevice;
   layer->common.destroy          = freeLayer;
   layer->common.getBlockCount    = getBlockCount;
   layer->common.allocateIOBuffer = allocateIOBuffer;
+  layer->common.borrowIOBuffer   = borrowIOBuffer;
+  layer->common.returnIOBuffer   = returnIOBuffer;
   layer->common.reader           = fileReader;
+  layer->common.readExtents      = fileBatchReader;
   layer->common.writer           = readOnly ? noWriter : fileWriter;
+  layer->common.zeroExtent       = readOnly ? noZeroer : fileZeroer;
+  layer->common.copyExtent       = fileCopier;
+  layer->common.advise           = fileAdvisor;
+  layer->common.getIOStatistics  = getIOStatistics;
   layer->common.completeFlush    = vacuousFlush;
 
   *layerPtr = &layer->common;
   return VDO_SUCCESS;
 }
 
+/**
+ * Determine which I/O engine to use from the VDO_IO_ENGINE environment
+ * variable.
+ *
+ * @return the requested engine
+ **/
+static IOEngine getIOEngine(void)
+{
+  const char *engine = getenv("VDO_IO_ENGINE");
+  if ((engine == NULL) || (strcmp(engine, "auto") == 0)) {
+    return IO_ENGINE_AUTO;
+  }
+
+  if (strcmp(engine, "sync") == 0) {
+    return IO_ENGINE_SYNC;
+  }
+
+  if (strcmp(engine, "io_uring") == 0) {
+    return IO_ENGINE_IO_URING;
+  }
+
+  uds_log_warning("ignoring unknown VDO_IO_ENGINE '%s'", engine);
+  return IO_ENGINE_AUTO;
+}
+
+/**
+ * Determine the io_uring queue depth from the VDO_IO_QUEUE_DEPTH environment
+ * variable.
+ *
+ * @return the requested queue depth
+ **/
+static unsigned int getIOQueueDepth(void)
+{
+  const char *depthString = getenv("VDO_IO_QUEUE_DEPTH");
+  if (depthString == NULL) {
+    return DEFAULT_IO_URING_QUEUE_DEPTH;
+  }
+
+  char *end;
+  unsigned long depth = strtoul(depthString, &end, 10);
+  if ((*end != '\0') || (depth == 0) || (depth > MAX_IO_URING_QUEUE_DEPTH)) {
+    uds_log_warning("ignoring invalid VDO_IO_QUEUE_DEPTH '%s'", depthString);
+    return DEFAULT_IO_URING_QUEUE_DEPTH;
+  }
+
+  return depth;
+}
+
+/**
+ * Determine the number of I/O threads from the VDO_IO_THREADS environment
+ * variable.
+ *
+ * @return the requested number of threads; 1 means batched reads are done
+ *         by the calling thread
+ **/
+static unsigned int getIOThreadCount(void)
+{
+  const char *countString = getenv("VDO_IO_THREADS");
+  if (countString == NULL) {
+    return 1;
+  }
+
+  char *end;
+  unsigned long count = strtoul(countString, &end, 10);
+  if ((*end != '\0') || (count == 0) || (count > MAX_IO_THREADS)) {
+    uds_log_warning("ignoring invalid VDO_IO_THREADS '%s'", countString);
+    return 1;
+  }
+
+  return count;
+}
+
+/**
+ * Start the I/O threads requested by the environment for a new layer. The
+ * layer still works without them, so failing to start them is not an error.
+ *
+ * @param layer  The new layer
+ **/
+static void addIOWorkers(PhysicalLayer *layer)
+{
+  unsigned int threadCount = getIOThreadCount();
+  if (threadCount < 2) {
+    return;
+  }
+
+  FileLayer *fileLayer = asFileLayer(layer);
+  int result = startIOWorkers(fileLayer, threadCount);
+  if (result != VDO_SUCCESS) {
+    uds_log_warning("could not start %u I/O threads for %s, reading from"
+                    " one thread", threadCount, fileLayer->name);
+  }
+}
+
+/**
+ * Make a file layer using the I/O engine selected by the environment,
+ * falling back to pread/pwrite if io_uring can not be used.
+ *
+ * @param [in]  name        the name of the underlying file
+ * @param [in]  readOnly    whether the layer is not allowed to write
+ * @param [in]  blockCount  the span of the file, in blocks
+ * @param [in]  fileOffset  the block offset to apply to I/O operations
+ * @param [out] layerPtr    the pointer to hold the result
+ *
+ * @return a success or error code
+ **/
+static int makeLayer(const char     *name,
+                     bool            readOnly,
+                     block_count_t   blockCount,
+                     block_count_t   fileOffset,
+                     PhysicalLayer **layerPtr)
+{
+  IOEngine engine = getIOEngine();
+  int result = VDO_NOT_IMPLEMENTED;
+  if (engine != IO_ENGINE_SYNC) {
+    result = setupFileLayer(name, readOnly, blockCount, fileOffset,
+                            getIOQueueDepth(), layerPtr);
+    if ((result == VDO_NOT_IMPLEMENTED) && (engine == IO_ENGINE_IO_URING)) {
+      uds_log_warning("io_uring is not available, using pread/pwrite for %s",
+                      name);
+    }
+  }
+
+  if (result == VDO_NOT_IMPLEMENTED) {
+    result = setupFileLayer(name, readOnly, blockCount, fileOffset, 0,
+                            layerPtr);
+  }
+
+  if (result == VDO_SUCCESS) {
+    addIOWorkers(*layerPtr);
+  }
+
+  return result;
+}
+
 /**********************************************************************/
 int makeFileLayer(const char           *name,
                   block_count_t         blockCount,
                   PhysicalLayer       **layerPtr)
 {
-  return setupFileLayer(name, false, blockCount, 0, layerPtr);
+  return makeLayer(name, false, blockCount, 0, layerPtr);
 }
 
 /**********************************************************************/
 int makeReadOnlyFileLayer(const char *name, PhysicalLayer **layerPtr)
 {
-  return setupFileLayer(name, true, 0, 0, layerPtr);
+  return makeLayer(name, true, 0, 0, layerPtr);
 }
 
 /**********************************************************************/
@@ -400,5 +1634,20 @@ int makeOffsetFileLayer(const char           *name,
                         block_count_t         fileOffset,
                         PhysicalLayer       **layerPtr)
 {
-  return setupFileLayer(name, false, blockCount, fileOffset, layerPtr);
+  return makeLayer(name, false, blockCount, fileOffset, layerPtr);
+}
+
+/**********************************************************************/
+int makeIoUringFileLayer(const char     *name,
+                         bool            readOnly,
+                         block_count_t   blockCount,
+                         unsigned int    queueDepth,
+                         PhysicalLayer **layerPtr)
+{
+  int result = ASSERT(queueDepth > 0, "io_uring queue depth must be positive");
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  return setupFileLayer(name, readOnly, blockCount, 0, queueDepth, layerPtr);
 }
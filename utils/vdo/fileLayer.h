@@ -27,6 +27,16 @@
 /**
  * Make a file layer implementation of a physical layer.
  *
+ * All of the file layer constructors except makeIoUringFileLayer() choose
+ * how to issue I/O from the VDO_IO_ENGINE environment variable: "sync" uses
+ * pread/pwrite, "io_uring" and "auto" (the default) use io_uring with up to
+ * VDO_IO_QUEUE_DEPTH (default 32) requests in flight, falling back to
+ * pread/pwrite if the kernel does not support io_uring. File layers use
+ * direct I/O unless VDO_IO_BUFFERED is set to something other than "0", in
+ * which case they go through the page cache and honor access advice.
+ * Setting VDO_IO_THREADS to N > 1 shares batched and large reads out among N
+ * threads, each with its own file descriptor.
+ *
  * @param [in]  name        the name of the underlying file
  * @param [in]  blockCount  the span of the file, in blocks
  * @param [out] layerPtr    the pointer to hold the result
@@ -64,4 +74,25 @@ int makeOffsetFileLayer(const char     *name,
                         PhysicalLayer **layerPtr)
   __attribute__((warn_unused_result));
 
+/**
+ * Make a file layer implementation of a physical layer which issues its I/O
+ * through io_uring, splitting each extent into requests which are kept in
+ * flight concurrently.
+ *
+ * @param [in]  name        the name of the underlying file
+ * @param [in]  readOnly    whether the layer is not allowed to write
+ * @param [in]  blockCount  the span of the file, in blocks (may be zero for
+ *                          read-only layers in which case it is computed)
+ * @param [in]  queueDepth  the maximum number of requests in flight
+ * @param [out] layerPtr    the pointer to hold the result
+ *
+ * @return a success or error code; VDO_NOT_IMPLEMENTED if the kernel does
+ *         not support io_uring
+ **/
+int __must_check makeIoUringFileLayer(const char     *name,
+				      bool            readOnly,
+				      block_count_t   blockCount,
+				      unsigned int    queueDepth,
+				      PhysicalLayer **layerPtr);
+
 #endif // FILE_LAYER_H
@@ -0,0 +1,85 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/ioStatistics.c#1 $
+ */
+
+#include "ioStatistics.h"
+
+/**
+ * Print the count and total size of one kind of operation.
+ *
+ * @param stream  The stream to print to
+ * @param name    The name of the operation
+ * @param count   The number of operations
+ * @param bytes   The number of bytes they transferred
+ **/
+static void printOperationCount(FILE       *stream,
+                                const char *name,
+                                uint64_t    count,
+                                uint64_t    bytes)
+{
+  fprintf(stream, "  %-8s %llu ops, %llu bytes", name,
+          (unsigned long long) count, (unsigned long long) bytes);
+  if (count > 0) {
+    fprintf(stream, " (%llu bytes/op)",
+            (unsigned long long) (bytes / count));
+  }
+  fprintf(stream, "\n");
+}
+
+/**********************************************************************/
+void printIOStatistics(FILE *stream, PhysicalLayer *layer)
+{
+  if (layer->getIOStatistics == NULL) {
+    fprintf(stream, "I/O statistics are not available\n");
+    return;
+  }
+
+  struct io_statistics stats;
+  layer->getIOStatistics(layer, &stats);
+  fprintf(stream, "I/O statistics:\n");
+  printOperationCount(stream, "reads", stats.reads, stats.read_bytes);
+  printOperationCount(stream, "writes", stats.writes, stats.write_bytes);
+
+  uint64_t total = stats.reads + stats.writes;
+  if (total == 0) {
+    return;
+  }
+
+  fprintf(stream, "  %-18s %10s\n", "latency (usec)", "ops");
+  for (unsigned int i = 0; i < IO_LATENCY_BUCKETS; i++) {
+    if (stats.latency[i] == 0) {
+      continue;
+    }
+
+    char range[32];
+    if (i == 0) {
+      snprintf(range, sizeof(range), "< 1");
+    } else if (i == IO_LATENCY_BUCKETS - 1) {
+      snprintf(range, sizeof(range), ">= %llu", 1ULL << (i - 1));
+    } else {
+      snprintf(range, sizeof(range), "%llu - %llu",
+               1ULL << (i - 1), (1ULL << i) - 1);
+    }
+
+    fprintf(stream, "  %-18s %10llu (%5.1f%%)\n", range,
+            (unsigned long long) stats.latency[i],
+            (100.0 * stats.latency[i]) / total);
+  }
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/ioStatistics.h#1 $
+ */
+
+#ifndef IO_STATISTICS_H
+#define IO_STATISTICS_H
+
+#include <stdio.h>
+
+#include "physicalLayer.h"
+
+/**
+ * Print the I/O counts and latency histogram of a layer, if the layer keeps
+ * them.
+ *
+ * @param stream  The stream to print to
+ * @param layer   The layer whose I/O is to be reported
+ **/
+void printIOStatistics(FILE *stream, PhysicalLayer *layer);
+
+#endif // IO_STATISTICS_H
@@ -0,0 +1,493 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/ioUring.c#1 $
+ */
+
+#include "ioUring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "atomicDefs.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "permassert.h"
+
+#include "statusCodes.h"
+
+/**
+ * The state of one request slot. A slot describes the part of a chunk which
+ * has not been transferred yet, so a short transfer can simply be
+ * resubmitted from the same slot.
+ **/
+typedef struct {
+  struct iovec iov;
+  off_t        offset;
+  /** The index in its batch of the transfer this request is part of */
+  size_t       transfer;
+} IoUringRequest;
+
+struct ioUring {
+  /** The io_uring file descriptor */
+  int                  fd;
+  /** The maximum number of requests in flight */
+  unsigned int         depth;
+  /** The mapped submission queue ring */
+  void                *sqRing;
+  size_t               sqRingBytes;
+  /** The mapped completion queue ring (may be the same as sqRing) */
+  void                *cqRing;
+  size_t               cqRingBytes;
+  /** The mapped submission queue entries */
+  struct io_uring_sqe *sqes;
+  size_t               sqesBytes;
+  /** Pointers into the submission queue ring */
+  unsigned int        *sqTail;
+  unsigned int        *sqMask;
+  unsigned int        *sqArray;
+  /** Pointers into the completion queue ring */
+  unsigned int        *cqHead;
+  unsigned int        *cqTail;
+  unsigned int        *cqMask;
+  struct io_uring_cqe *cqes;
+  /** The request slots and a stack of the ones not in flight */
+  IoUringRequest      *requests;
+  unsigned int        *freeSlots;
+  unsigned int         freeCount;
+};
+
+/**********************************************************************/
+static int setupIoUring(unsigned int entries, struct io_uring_params *params)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+/**********************************************************************/
+static int enterIoUring(IoUring *ring, unsigned int toSubmit)
+{
+  return (int) syscall(__NR_io_uring_enter, ring->fd, toSubmit, 1,
+                       IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+/**********************************************************************/
+static void *mapRing(IoUring *ring, size_t bytes, off_t offset)
+{
+  void *mapped = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, offset);
+  return ((mapped == MAP_FAILED) ? NULL : mapped);
+}
+
+/**********************************************************************/
+void freeIoUring(IoUring **ringPtr)
+{
+  IoUring *ring = *ringPtr;
+  if (ring == NULL) {
+    return;
+  }
+
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqesBytes);
+  }
+
+  if ((ring->cqRing != NULL) && (ring->cqRing != ring->sqRing)) {
+    munmap(ring->cqRing, ring->cqRingBytes);
+  }
+
+  if (ring->sqRing != NULL) {
+    munmap(ring->sqRing, ring->sqRingBytes);
+  }
+
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+
+  UDS_FREE(ring->requests);
+  UDS_FREE(ring->freeSlots);
+  UDS_FREE(ring);
+  *ringPtr = NULL;
+}
+
+/**********************************************************************/
+int makeIoUring(unsigned int queueDepth, IoUring **ringPtr)
+{
+  int result = ASSERT(queueDepth > 0, "io_uring queue depth must be positive");
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  IoUring *ring;
+  result = UDS_ALLOCATE(1, IoUring, __func__, &ring);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = setupIoUring(queueDepth, &params);
+  if (ring->fd < 0) {
+    result = errno;
+    freeIoUring(&ring);
+    if ((result == ENOSYS) || (result == EPERM)) {
+      return VDO_NOT_IMPLEMENTED;
+    }
+    return uds_log_error_strerror(result, "io_uring_setup");
+  }
+
+  ring->depth = min(queueDepth, params.sq_entries);
+  ring->sqRingBytes
+    = params.sq_off.array + (params.sq_entries * sizeof(unsigned int));
+  ring->cqRingBytes
+    = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+    ring->sqRingBytes = max(ring->sqRingBytes, ring->cqRingBytes);
+    ring->cqRingBytes = ring->sqRingBytes;
+  }
+
+  ring->sqRing = mapRing(ring, ring->sqRingBytes, IORING_OFF_SQ_RING);
+  if (ring->sqRing == NULL) {
+    result = uds_log_error_strerror(errno, "mmap io_uring submission ring");
+    freeIoUring(&ring);
+    return result;
+  }
+
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+    ring->cqRing = ring->sqRing;
+  } else {
+    ring->cqRing = mapRing(ring, ring->cqRingBytes, IORING_OFF_CQ_RING);
+    if (ring->cqRing == NULL) {
+      result = uds_log_error_strerror(errno, "mmap io_uring completion ring");
+      freeIoUring(&ring);
+      return result;
+    }
+  }
+
+  ring->sqesBytes = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mapRing(ring, ring->sqesBytes, IORING_OFF_SQES);
+  if (ring->sqes == NULL) {
+    result = uds_log_error_strerror(errno, "mmap io_uring entries");
+    freeIoUring(&ring);
+    return result;
+  }
+
+  char *sq = ring->sqRing;
+  ring->sqTail  = (unsigned int *) (sq + params.sq_off.tail);
+  ring->sqMask  = (unsigned int *) (sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned int *) (sq + params.sq_off.array);
+
+  char *cq = ring->cqRing;
+  ring->cqHead = (unsigned int *) (cq + params.cq_off.head);
+  ring->cqTail = (unsigned int *) (cq + params.cq_off.tail);
+  ring->cqMask = (unsigned int *) (cq + params.cq_off.ring_mask);
+  ring->cqes   = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  result = UDS_ALLOCATE(ring->depth, IoUringRequest, "io_uring requests",
+                        &ring->requests);
+  if (result != UDS_SUCCESS) {
+    freeIoUring(&ring);
+    return result;
+  }
+
+  result = UDS_ALLOCATE(ring->depth, unsigned int, "io_uring free slots",
+                        &ring->freeSlots);
+  if (result != UDS_SUCCESS) {
+    freeIoUring(&ring);
+    return result;
+  }
+
+  for (unsigned int i = 0; i < ring->depth; i++) {
+    ring->freeSlots[ring->freeCount++] = i;
+  }
+
+  *ringPtr = ring;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+unsigned int getIoUringDepth(const IoUring *ring)
+{
+  return ring->depth;
+}
+
+/**
+ * Put the request in a slot on the submission queue. The caller must ensure
+ * that no more than depth requests are ever queued or in flight.
+ *
+ * @param ring  The ring
+ * @param fd    The file descriptor to transfer to or from
+ * @param read  Whether the request is a read
+ * @param slot  The slot holding the request
+ **/
+static void queueRequest(IoUring *ring, int fd, bool read, unsigned int slot)
+{
+  IoUringRequest      *request = &ring->requests[slot];
+  unsigned int         tail    = ACCESS_ONCE(*ring->sqTail);
+  unsigned int         index   = tail & *ring->sqMask;
+  struct io_uring_sqe *sqe     = &ring->sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode    = (read ? IORING_OP_READV : IORING_OP_WRITEV);
+  sqe->fd        = fd;
+  sqe->addr      = (uintptr_t) &request->iov;
+  sqe->len       = 1;
+  sqe->off       = request->offset;
+  sqe->user_data = slot;
+  ring->sqArray[index] = index;
+
+  // The entry must be visible to the kernel before the new tail is.
+  smp_wmb();
+  ACCESS_ONCE(*ring->sqTail) = tail + 1;
+}
+
+/**
+ * The progress of one transfer in a batch.
+ **/
+typedef struct {
+  /** The part of the transfer which has not been queued yet */
+  char   *next;
+  size_t  remaining;
+  off_t   offset;
+  /** The number of chunks of the transfer which are in flight */
+  size_t  pending;
+  /** The first error encountered by the transfer */
+  int     result;
+} TransferState;
+
+/**
+ * Take a free slot, fill it with the next chunk of a transfer, and queue it.
+ *
+ * @param ring        The ring
+ * @param fd          The file descriptor to transfer to or from
+ * @param read        Whether the transfer is a read
+ * @param state       The state of the transfer
+ * @param index       The index of the transfer in its batch
+ * @param chunkBytes  The maximum size of a single request
+ **/
+static void queueChunk(IoUring       *ring,
+                       int            fd,
+                       bool           read,
+                       TransferState *state,
+                       size_t         index,
+                       size_t         chunkBytes)
+{
+  unsigned int    slot    = ring->freeSlots[--ring->freeCount];
+  IoUringRequest *request = &ring->requests[slot];
+  size_t          bytes   = min(state->remaining, chunkBytes);
+  request->iov.iov_base = state->next;
+  request->iov.iov_len  = bytes;
+  request->offset       = state->offset;
+  request->transfer     = index;
+  queueRequest(ring, fd, read, slot);
+
+  state->next      += bytes;
+  state->remaining -= bytes;
+  state->offset    += bytes;
+  state->pending++;
+}
+
+/**
+ * Take back the requests which were queued but not yet submitted, after the
+ * kernel refused a submission, so that they neither hold their slots nor
+ * linger on the submission queue for the next batch.
+ *
+ * @param ring      The ring
+ * @param states    The states of the transfers of the batch
+ * @param count     The number of requests to take back
+ * @param error     The error to record for their transfers
+ **/
+static void withdrawRequests(IoUring       *ring,
+                             TransferState *states,
+                             unsigned int   count,
+                             int            error)
+{
+  unsigned int tail = ACCESS_ONCE(*ring->sqTail);
+  for (unsigned int i = 1; i <= count; i++) {
+    struct io_uring_sqe *sqe   = &ring->sqes[(tail - i) & *ring->sqMask];
+    unsigned int         slot  = (unsigned int) sqe->user_data;
+    TransferState       *state = &states[ring->requests[slot].transfer];
+    if (state->result == VDO_SUCCESS) {
+      state->result = error;
+    }
+    state->pending--;
+    ring->freeSlots[ring->freeCount++] = slot;
+  }
+
+  // Without SQPOLL, the kernel only reads the queue inside io_uring_enter.
+  ACCESS_ONCE(*ring->sqTail) = tail - count;
+}
+
+/**********************************************************************/
+int transferBatchWithIoUring(IoUring               *ring,
+                             int                    fd,
+                             bool                   read,
+                             const IoUringTransfer *transfers,
+                             size_t                 count,
+                             size_t                 chunkBytes,
+                             IoUringCompletion     *completion,
+                             void                  *context)
+{
+  TransferState  singleState;
+  TransferState *states = &singleState;
+  if (count > 1) {
+    int result = UDS_ALLOCATE(count, TransferState, "io_uring transfers",
+                              &states);
+    if (result != UDS_SUCCESS) {
+      return result;
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    states[i] = (TransferState) {
+      .next      = transfers[i].buffer,
+      .remaining = transfers[i].bytes,
+      .offset    = transfers[i].offset,
+      .result    = VDO_SUCCESS,
+    };
+  }
+
+  int          result   = VDO_SUCCESS;
+  bool         failed   = false;
+  size_t       next     = 0;
+  unsigned int toSubmit = 0;
+  unsigned int inFlight = 0;
+  while ((!failed && (next < count)) || (inFlight > 0)) {
+    while (!failed && (next < count) && (ring->freeCount > 0)) {
+      TransferState *state = &states[next];
+      if (state->remaining == 0) {
+        // Every chunk of this transfer has been queued.
+        if ((state->pending == 0) && (completion != NULL)) {
+          completion(next, state->result, context);
+        }
+        next++;
+        continue;
+      }
+
+      queueChunk(ring, fd, read, state, next, chunkBytes);
+      toSubmit++;
+      inFlight++;
+    }
+
+    if (inFlight == 0) {
+      break;
+    }
+
+    int submitted = enterIoUring(ring, toSubmit);
+    if (submitted < 0) {
+      int error = errno;
+      submitted = 0;
+      if (error == EBUSY) {
+        // The completion queue overflowed. Submitting is refused until it
+        // is drained, and only a call which submits nothing flushes it.
+        (void) enterIoUring(ring, 0);
+      } else if ((error != EINTR) && (error != EAGAIN)) {
+        // The requests already submitted are still in flight and may yet
+        // write into the buffers, so stop queueing but reap them all
+        // before returning.
+        failed = true;
+        if (result == VDO_SUCCESS) {
+          result = error;
+        }
+        withdrawRequests(ring, states, toSubmit, error);
+        inFlight -= toSubmit;
+        toSubmit  = 0;
+      }
+    }
+    toSubmit -= submitted;
+
+    unsigned int head = *ring->cqHead;
+    unsigned int tail = ACCESS_ONCE(*ring->cqTail);
+    // Read the completions only after reading the tail which covers them.
+    smp_rmb();
+    if ((head == tail) && failed) {
+      // io_uring_enter() is failing, so it can't be used to wait.
+      sched_yield();
+    }
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe     = &ring->cqes[head & *ring->cqMask];
+      unsigned int         slot    = (unsigned int) cqe->user_data;
+      IoUringRequest      *request = &ring->requests[slot];
+      TransferState       *state   = &states[request->transfer];
+      if (cqe->res <= 0) {
+        if (state->result == VDO_SUCCESS) {
+          state->result = ((cqe->res == 0) ? VDO_UNEXPECTED_EOF : -cqe->res);
+        }
+      } else if (failed && ((size_t) cqe->res < request->iov.iov_len)) {
+        // Don't resubmit the remainder once the batch has failed.
+        if (state->result == VDO_SUCCESS) {
+          state->result = result;
+        }
+      } else if (((size_t) cqe->res < request->iov.iov_len)
+                 && (state->result == VDO_SUCCESS)) {
+        // A short transfer; resubmit the remainder from the same slot.
+        request->iov.iov_base  = (char *) request->iov.iov_base + cqe->res;
+        request->iov.iov_len  -= cqe->res;
+        request->offset       += cqe->res;
+        queueRequest(ring, fd, read, slot);
+        toSubmit++;
+        continue;
+      }
+
+      ring->freeSlots[ring->freeCount++] = slot;
+      inFlight--;
+      if ((--state->pending == 0) && (state->remaining == 0)) {
+        if (result == VDO_SUCCESS) {
+          result = state->result;
+        }
+
+        if ((completion != NULL) && (request->transfer < next)) {
+          completion(request->transfer, state->result, context);
+        }
+      }
+    }
+
+    // Release the completion entries only once they have been consumed.
+    smp_mb();
+    ACCESS_ONCE(*ring->cqHead) = head;
+  }
+
+  if (states != &singleState) {
+    UDS_FREE(states);
+  }
+
+  return result;
+}
+
+/**********************************************************************/
+int transferWithIoUring(IoUring *ring,
+                        int      fd,
+                        bool     read,
+                        char    *buffer,
+                        size_t   bytes,
+                        off_t    offset,
+                        size_t   chunkBytes)
+{
+  IoUringTransfer transfer = {
+    .buffer = buffer,
+    .bytes  = bytes,
+    .offset = offset,
+  };
+  return transferBatchWithIoUring(ring, fd, read, &transfer, 1, chunkBytes,
+                                  NULL, NULL);
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/ioUring.h#1 $
+ */
+
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <sys/types.h>
+
+#include "types.h"
+
+/**
+ * A minimal io_uring instance used by the user space layers to keep several
+ * reads or writes in flight at once. It is driven directly through the
+ * io_uring system calls so that no additional library is required. An
+ * IoUring is not thread safe; each thread doing I/O needs its own.
+ **/
+typedef struct ioUring IoUring;
+
+/**
+ * One contiguous range of a file to be transferred as part of a batch.
+ **/
+typedef struct {
+  char   *buffer;
+  size_t  bytes;
+  off_t   offset;
+} IoUringTransfer;
+
+/**
+ * A function called as each transfer in a batch completes.
+ *
+ * @param index    The index of the transfer in the batch
+ * @param result   VDO_SUCCESS or the error of the transfer
+ * @param context  The context supplied with the batch
+ **/
+typedef void IoUringCompletion(size_t index, int result, void *context);
+
+/**
+ * Create an io_uring.
+ *
+ * @param [in]  queueDepth  The maximum number of requests to keep in flight
+ * @param [out] ringPtr     A pointer to hold the new ring
+ *
+ * @return VDO_SUCCESS, VDO_NOT_IMPLEMENTED if the kernel does not support
+ *         io_uring, or some other error code
+ **/
+int __must_check makeIoUring(unsigned int queueDepth, IoUring **ringPtr);
+
+/**
+ * Free an io_uring and NULL out the reference to it.
+ *
+ * @param ringPtr  A pointer to the ring to free
+ **/
+void freeIoUring(IoUring **ringPtr);
+
+/**
+ * Get the queue depth of an io_uring.
+ *
+ * @param ring  The ring
+ *
+ * @return The maximum number of requests the ring keeps in flight
+ **/
+unsigned int __must_check getIoUringDepth(const IoUring *ring);
+
+/**
+ * Transfer a contiguous range of a file, splitting it into chunks which are
+ * submitted concurrently up to the depth of the ring. Short transfers are
+ * resubmitted until the whole range is done or an error occurs.
+ *
+ * @param ring        The ring to submit on
+ * @param fd          The file descriptor to read or write
+ * @param read        Whether to read (rather than write)
+ * @param buffer      The buffer to read into or write from
+ * @param bytes       The number of bytes to transfer
+ * @param offset      The byte offset in the file at which to start
+ * @param chunkBytes  The maximum size of a single request
+ *
+ * @return VDO_SUCCESS, VDO_UNEXPECTED_EOF, or the errno of the first failed
+ *         request
+ **/
+int __must_check transferWithIoUring(IoUring *ring,
+                                     int      fd,
+                                     bool     read,
+                                     char    *buffer,
+                                     size_t   bytes,
+                                     off_t    offset,
+                                     size_t   chunkBytes);
+
+/**
+ * Transfer a batch of ranges of a file. Every range is split into chunks,
+ * and chunks from all of the ranges are submitted concurrently up to the
+ * depth of the ring. Short transfers are resubmitted until each range is
+ * done or has failed. This function does not return until every range has
+ * completed.
+ *
+ * @param ring        The ring to submit on
+ * @param fd          The file descriptor to read or write
+ * @param read        Whether to read (rather than write)
+ * @param transfers   The ranges to transfer
+ * @param count       The number of ranges
+ * @param chunkBytes  The maximum size of a single request
+ * @param completion  An optional function to call as each range completes
+ * @param context     The context to pass to the completion
+ *
+ * @return VDO_SUCCESS or the first error of any range
+ **/
+int __must_check transferBatchWithIoUring(IoUring               *ring,
+                                          int                    fd,
+                                          bool                   read,
+                                          const IoUringTransfer *transfers,
+                                          size_t                 count,
+                                          size_t                 chunkBytes,
+                                          IoUringCompletion     *completion,
+                                          void                  *context);
+
+#endif // IO_URING_H
@@ -0,0 +1,493 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/journalChecker.c#1 $
+ */
+
+
+#include "journalChecker.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "memoryAlloc.h"
+#include "uds-threads.h"
+
+#include "fixedLayout.h"
+#include "packedRecoveryJournalBlock.h"
+#include "physicalLayer.h"
+#include "recoveryJournalFormat.h"
+#include "slabDepotFormat.h"
+#include "slabJournalFormat.h"
+#include "statusCodes.h"
+
+#include "journalDecoder.h"
+#include "progress.h"
+
+enum {
+  // The number of recovery journal blocks read at once by each thread.
+  RECOVERY_BATCH_BLOCKS = 256,
+  // The number of slab journals read at once by each thread.
+  SLAB_BATCH_SLABS      = 16,
+  // The most threads a sweep will use.
+  MAX_CHECKER_THREADS   = 64,
+  PROBLEM_BUFFER_SIZE   = 160,
+};
+
+/** The state shared by the threads of a sweep */
+typedef struct {
+  UserVDO                 *vdo;
+  JournalProblemReporter  *reporter;
+  physical_block_number_t  journalOrigin;
+  block_count_t            journalSize;
+  slab_count_t             firstSlab;
+  slab_count_t             slabCount;
+  /** The number of batches of the recovery journal */
+  uint64_t                 recoveryBatches;
+  /** The number of batches in the whole sweep */
+  uint64_t                 totalBatches;
+  /** Protects everything below, and serializes reports */
+  struct mutex             lock;
+  uint64_t                 nextBatch;
+  int                      result;
+} JournalSweep;
+
+/** The state of each thread of a sweep */
+typedef struct {
+  JournalSweep       *sweep;
+  struct thread      *thread;
+  char               *buffer;
+  struct extent_read  reads[SLAB_BATCH_SLABS];
+  JournalCheckCounts  counts;
+} JournalChecker;
+
+/**
+ * Report a problem with a journal block.
+ *
+ * @param checker  The checker which found the problem
+ * @param pbn      The block with the problem
+ * @param format   A printf format describing the problem
+ **/
+__attribute__((format(printf, 3, 4)))
+static void reportProblem(JournalChecker          *checker,
+                          physical_block_number_t  pbn,
+                          const char              *format,
+                          ...)
+{
+  JournalSweep *sweep = checker->sweep;
+  if (sweep->reporter == NULL) {
+    return;
+  }
+
+  char    problem[PROBLEM_BUFFER_SIZE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(problem, sizeof(problem), format, args);
+  va_end(args);
+
+  uds_lock_mutex(&sweep->lock);
+  sweep->reporter(pbn, problem);
+  uds_unlock_mutex(&sweep->lock);
+}
+
+/**
+ * Check a recovery journal block.
+ *
+ * @param checker  The checker doing the work
+ * @param offset   The offset of the block in the journal
+ * @param block    The contents of the block
+ *
+ * @return <code>true</code> if the block has no problems
+ **/
+static bool checkRecoveryBlock(JournalChecker *checker,
+                               block_count_t   offset,
+                               char           *block)
+{
+  JournalSweep *sweep = checker->sweep;
+  physical_block_number_t pbn = sweep->journalOrigin + offset;
+  struct packed_journal_header *packed
+    = (struct packed_journal_header *) block;
+  struct recovery_block_header header;
+  unpack_vdo_recovery_block_header(packed, &header);
+  if ((header.metadata_type != VDO_METADATA_RECOVERY_JOURNAL)
+      || (header.nonce != sweep->vdo->states.vdo.nonce)) {
+    // The block has never been written by this volume.
+    return true;
+  }
+
+  checker->counts.recoveryBlocks++;
+  bool valid = true;
+  if (compute_vdo_recovery_journal_block_number(sweep->journalSize,
+                                                header.sequence_number)
+      != offset) {
+    reportProblem(checker, pbn,
+                  "recovery journal block %llu has sequence number %llu",
+                  (unsigned long long) offset,
+                  (unsigned long long) header.sequence_number);
+    valid = false;
+  }
+
+  if ((header.block_map_head > header.sequence_number)
+      || (header.slab_journal_head > header.sequence_number)) {
+    reportProblem(checker, pbn,
+                  "recovery journal block %llu has heads %llu and %llu"
+                  " after its sequence number %llu",
+                  (unsigned long long) offset,
+                  (unsigned long long) header.block_map_head,
+                  (unsigned long long) header.slab_journal_head,
+                  (unsigned long long) header.sequence_number);
+    valid = false;
+  }
+
+  if (header.entry_count > RECOVERY_JOURNAL_ENTRIES_PER_BLOCK) {
+    reportProblem(checker, pbn,
+                  "recovery journal block %llu has %u entries",
+                  (unsigned long long) offset, header.entry_count);
+    return false;
+  }
+
+  // The entries fill each sector in turn, so all but the last sector which
+  // holds entries must be full.
+  journal_entry_count_t remaining = header.entry_count;
+  for (uint8_t i = 1; i < VDO_SECTORS_PER_BLOCK; i++) {
+    journal_entry_count_t expected
+      = min(remaining,
+            (journal_entry_count_t) RECOVERY_JOURNAL_ENTRIES_PER_SECTOR);
+    remaining -= expected;
+    if (expected == 0) {
+      break;
+    }
+
+    struct packed_journal_sector *sector
+      = get_vdo_journal_block_sector(packed, i);
+    if (!is_valid_vdo_recovery_journal_sector(&header, sector)) {
+      reportProblem(checker, pbn,
+                    "recovery journal block %llu sector %u was not written"
+                    " with its header",
+                    (unsigned long long) offset, i);
+      valid = false;
+    } else if (sector->entry_count != expected) {
+      reportProblem(checker, pbn,
+                    "recovery journal block %llu sector %u has %u entries,"
+                    " not %u",
+                    (unsigned long long) offset, i, sector->entry_count,
+                    expected);
+      valid = false;
+    }
+  }
+
+  return valid;
+}
+
+/**
+ * Check a slab journal block.
+ *
+ * @param checker     The checker doing the work
+ * @param slabNumber  The slab whose journal holds the block
+ * @param offset      The offset of the block in the slab journal
+ * @param pbn         The physical block number of the block
+ * @param block       The contents of the block
+ *
+ * @return <code>true</code> if the block has no problems
+ **/
+static bool checkSlabJournalBlock(JournalChecker          *checker,
+                                  slab_count_t             slabNumber,
+                                  block_count_t            offset,
+                                  physical_block_number_t  pbn,
+                                  char                    *block)
+{
+  const struct slab_config *config
+    = &checker->sweep->vdo->states.slab_depot.slab_config;
+  struct packed_slab_journal_block *journalBlock
+    = (struct packed_slab_journal_block *) block;
+  struct packed_slab_journal_block_header *header = &journalBlock->header;
+  if ((header->metadata_type != VDO_METADATA_SLAB_JOURNAL)
+      || (__le64_to_cpu(header->nonce)
+          != checker->sweep->vdo->states.vdo.nonce)) {
+    return true;
+  }
+
+  checker->counts.slabJournalBlocks++;
+  bool valid = true;
+  sequence_number_t sequence = __le64_to_cpu(header->sequence_number);
+  sequence_number_t head     = __le64_to_cpu(header->head);
+  if ((sequence % config->slab_journal_blocks) != offset) {
+    reportProblem(checker, pbn,
+                  "slab %u journal block %llu has sequence number %llu",
+                  slabNumber, (unsigned long long) offset,
+                  (unsigned long long) sequence);
+    valid = false;
+  }
+
+  if (head > sequence) {
+    reportProblem(checker, pbn,
+                  "slab %u journal block %llu has head %llu after its"
+                  " sequence number %llu",
+                  slabNumber, (unsigned long long) offset,
+                  (unsigned long long) head, (unsigned long long) sequence);
+    valid = false;
+  }
+
+  journal_entry_count_t entryCount = __le16_to_cpu(header->entry_count);
+  journal_entry_count_t maxEntries
+    = (header->has_block_map_increments
+       ? VDO_SLAB_JOURNAL_FULL_ENTRIES_PER_BLOCK
+       : VDO_SLAB_JOURNAL_ENTRIES_PER_BLOCK);
+  if (entryCount > maxEntries) {
+    reportProblem(checker, pbn,
+                  "slab %u journal block %llu has %u entries",
+                  slabNumber, (unsigned long long) offset, entryCount);
+    return false;
+  }
+
+  SlabBlockEntries entries;
+  decodeSlabJournalBlock(journalBlock, &entries);
+  for (journal_entry_count_t i = 0; i < entries.count; i++) {
+    if (entries.sbns[i] >= config->data_blocks) {
+      reportProblem(checker, pbn,
+                    "slab %u journal block %llu entry %u refers to SBN %u",
+                    slabNumber, (unsigned long long) offset, i,
+                    entries.sbns[i]);
+      return false;
+    }
+  }
+
+  return valid;
+}
+
+/**
+ * Read and check a batch of the recovery journal.
+ *
+ * @param checker  The checker doing the work
+ * @param batch    The number of the batch
+ *
+ * @return VDO_SUCCESS or an error reading the batch
+ **/
+static int checkRecoveryBatch(JournalChecker *checker, uint64_t batch)
+{
+  JournalSweep *sweep = checker->sweep;
+  block_count_t start = batch * RECOVERY_BATCH_BLOCKS;
+  block_count_t count = min((block_count_t) RECOVERY_BATCH_BLOCKS,
+                            sweep->journalSize - start);
+  checker->reads[0] = (struct extent_read) {
+    .start_block = sweep->journalOrigin + start,
+    .block_count = count,
+    .buffer      = checker->buffer,
+  };
+
+  PhysicalLayer *layer = sweep->vdo->layer;
+  int result = layer->readExtents(layer, checker->reads, 1, NULL, NULL);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  for (block_count_t i = 0; i < count; i++) {
+    if (!checkRecoveryBlock(checker, start + i,
+                            &checker->buffer[i * VDO_BLOCK_SIZE])) {
+      checker->counts.badRecoveryBlocks++;
+    }
+  }
+
+  addProgress(count);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Read and check the journals of a batch of slabs.
+ *
+ * @param checker  The checker doing the work
+ * @param batch    The number of the batch among the slab batches
+ *
+ * @return VDO_SUCCESS or an error reading the batch
+ **/
+static int checkSlabBatch(JournalChecker *checker, uint64_t batch)
+{
+  JournalSweep *sweep = checker->sweep;
+  struct slab_depot_state_2_0 *depot = &sweep->vdo->states.slab_depot;
+  block_count_t journalBlocks = depot->slab_config.slab_journal_blocks;
+  slab_count_t first = batch * SLAB_BATCH_SLABS;
+  slab_count_t count = min((slab_count_t) SLAB_BATCH_SLABS,
+                           (slab_count_t) (sweep->slabCount - first));
+  first += sweep->firstSlab;
+  for (slab_count_t i = 0; i < count; i++) {
+    physical_block_number_t origin
+      = depot->first_block + ((first + i) * depot->slab_config.slab_blocks);
+    checker->reads[i] = (struct extent_read) {
+      .start_block = get_vdo_slab_journal_start_block(&depot->slab_config,
+                                                      origin),
+      .block_count = journalBlocks,
+      .buffer      = &checker->buffer[i * journalBlocks * VDO_BLOCK_SIZE],
+    };
+  }
+
+  PhysicalLayer *layer = sweep->vdo->layer;
+  int result = layer->readExtents(layer, checker->reads, count, NULL, NULL);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  for (slab_count_t i = 0; i < count; i++) {
+    for (block_count_t j = 0; j < journalBlocks; j++) {
+      if (!checkSlabJournalBlock(checker, first + i, j,
+                                 checker->reads[i].start_block + j,
+                                 &checker->reads[i].buffer[j
+                                                           * VDO_BLOCK_SIZE])) {
+        checker->counts.badSlabJournalBlocks++;
+      }
+    }
+  }
+
+  addProgress(count * journalBlocks);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Take batches of the sweep and check them until there are none left or an
+ * error occurs. This is the body of each checking thread.
+ *
+ * @param arg  The JournalChecker for the thread
+ **/
+static void checkBatches(void *arg)
+{
+  JournalChecker *checker = arg;
+  JournalSweep   *sweep   = checker->sweep;
+  for (;;) {
+    uds_lock_mutex(&sweep->lock);
+    uint64_t batch = sweep->nextBatch;
+    bool     done  = ((sweep->result != VDO_SUCCESS)
+                      || (batch >= sweep->totalBatches));
+    if (!done) {
+      sweep->nextBatch++;
+    }
+    uds_unlock_mutex(&sweep->lock);
+    if (done) {
+      return;
+    }
+
+    int result = ((batch < sweep->recoveryBatches)
+                  ? checkRecoveryBatch(checker, batch)
+                  : checkSlabBatch(checker, batch - sweep->recoveryBatches));
+    if (result != VDO_SUCCESS) {
+      uds_lock_mutex(&sweep->lock);
+      if (sweep->result == VDO_SUCCESS) {
+        sweep->result = result;
+      }
+      uds_unlock_mutex(&sweep->lock);
+      return;
+    }
+  }
+}
+
+/**********************************************************************/
+int checkJournals(UserVDO                *vdo,
+                  unsigned int            threadCount,
+                  slab_count_t            firstSlab,
+                  slab_count_t            lastSlab,
+                  JournalProblemReporter *reporter,
+                  JournalCheckCounts     *counts)
+{
+  const struct partition *partition
+    = getPartition(vdo, RECOVERY_JOURNAL_PARTITION,
+                   "Could not check recovery journal, no partition");
+  block_count_t journalBlocks
+    = vdo->states.slab_depot.slab_config.slab_journal_blocks;
+  JournalSweep sweep = {
+    .vdo           = vdo,
+    .reporter      = reporter,
+    .journalOrigin = get_vdo_fixed_layout_partition_offset(partition),
+    .journalSize   = vdo->states.vdo.config.recovery_journal_size,
+    .firstSlab     = firstSlab,
+    .slabCount     = lastSlab - firstSlab + 1,
+    .result        = VDO_SUCCESS,
+  };
+  sweep.recoveryBatches = ((sweep.journalSize + RECOVERY_BATCH_BLOCKS - 1)
+                           / RECOVERY_BATCH_BLOCKS);
+  sweep.totalBatches
+    = (sweep.recoveryBatches
+       + ((sweep.slabCount + SLAB_BATCH_SLABS - 1) / SLAB_BATCH_SLABS));
+  setProgressPhase("journal check", "blocks",
+                   sweep.journalSize + (sweep.slabCount * journalBlocks));
+
+  int result = uds_init_mutex(&sweep.lock);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  if (threadCount == 0) {
+    threadCount = uds_get_num_cores();
+  }
+  threadCount = max(min(threadCount, (unsigned int) MAX_CHECKER_THREADS), 1U);
+  threadCount = min(threadCount, (unsigned int) sweep.totalBatches);
+
+  JournalChecker *checkers;
+  result = UDS_ALLOCATE(threadCount, JournalChecker, __func__, &checkers);
+  if (result != VDO_SUCCESS) {
+    uds_destroy_mutex(&sweep.lock);
+    return result;
+  }
+
+  size_t bufferSize
+    = (max((block_count_t) RECOVERY_BATCH_BLOCKS,
+           SLAB_BATCH_SLABS * journalBlocks)
+       * VDO_BLOCK_SIZE);
+  unsigned int prepared = 0;
+  for (; prepared < threadCount; prepared++) {
+    checkers[prepared].sweep = &sweep;
+    result = vdo->layer->allocateIOBuffer(vdo->layer, bufferSize,
+                                          "journal batch",
+                                          &checkers[prepared].buffer);
+    if (result != VDO_SUCCESS) {
+      break;
+    }
+  }
+
+  unsigned int started = 0;
+  for (; (result == VDO_SUCCESS) && (started < threadCount); started++) {
+    result = uds_create_thread(checkBatches, &checkers[started],
+                               "vdoJournalCheck", &checkers[started].thread);
+    if (result != VDO_SUCCESS) {
+      break;
+    }
+  }
+
+  if (result != VDO_SUCCESS) {
+    // Stop any threads which did start.
+    uds_lock_mutex(&sweep.lock);
+    sweep.result = result;
+    uds_unlock_mutex(&sweep.lock);
+  }
+
+  for (unsigned int i = 0; i < started; i++) {
+    uds_join_threads(checkers[i].thread);
+  }
+
+  *counts = (JournalCheckCounts) { 0 };
+  for (unsigned int i = 0; i < threadCount; i++) {
+    counts->recoveryBlocks       += checkers[i].counts.recoveryBlocks;
+    counts->badRecoveryBlocks    += checkers[i].counts.badRecoveryBlocks;
+    counts->slabJournalBlocks    += checkers[i].counts.slabJournalBlocks;
+    counts->badSlabJournalBlocks += checkers[i].counts.badSlabJournalBlocks;
+  }
+
+  for (unsigned int i = 0; i < prepared; i++) {
+    UDS_FREE(checkers[i].buffer);
+  }
+  UDS_FREE(checkers);
+  uds_destroy_mutex(&sweep.lock);
+  return ((result == VDO_SUCCESS) ? sweep.result : result);
+}
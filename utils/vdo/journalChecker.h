@@ -0,0 +1,82 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/journalChecker.h#1 $
+ */
+
+
+#ifndef JOURNAL_CHECKER_H
+#define JOURNAL_CHECKER_H
+
+#include "types.h"
+
+#include "userVDO.h"
+
+/**
+ * The journal checker sweeps the recovery journal and the slab journals of a
+ * volume, checking that every block which the volume has written is
+ * self-consistent: that its sequence number belongs at its position in the
+ * journal, that its entry count is possible, and, for recovery journal
+ * blocks, that every sector holding entries was written along with the
+ * header. Blocks which have never been written for this volume are skipped.
+ * The journals are read in large batches by a pool of threads.
+ **/
+
+/** The counts of the journal blocks found by a sweep */
+typedef struct {
+  /** Number of recovery journal blocks written for this volume */
+  block_count_t recoveryBlocks;
+  /** Number of those blocks with problems */
+  block_count_t badRecoveryBlocks;
+  /** Number of slab journal blocks written for this volume */
+  block_count_t slabJournalBlocks;
+  /** Number of those blocks with problems */
+  block_count_t badSlabJournalBlocks;
+} JournalCheckCounts;
+
+/**
+ * A function to report a problem found in a journal block. Reports are
+ * serialized, but may come from any of the sweeping threads.
+ *
+ * @param pbn      The physical block number of the block
+ * @param problem  A description of the problem
+ **/
+typedef void JournalProblemReporter(physical_block_number_t  pbn,
+                                    const char              *problem);
+
+/**
+ * Check the recovery journal and the journals of a range of slabs.
+ *
+ * @param [in]  vdo          The VDO whose journals are to be checked
+ * @param [in]  threadCount  The number of threads to use, or 0 for one
+ *                           thread for each core
+ * @param [in]  firstSlab    The first slab whose journal is to be checked
+ * @param [in]  lastSlab     The last slab whose journal is to be checked
+ * @param [in]  reporter     The function to report each problem, or NULL
+ * @param [out] counts       The counts of the blocks found
+ *
+ * @return VDO_SUCCESS or an error reading the journals
+ **/
+int __must_check checkJournals(UserVDO                *vdo,
+                               unsigned int            threadCount,
+                               slab_count_t            firstSlab,
+                               slab_count_t            lastSlab,
+                               JournalProblemReporter *reporter,
+                               JournalCheckCounts     *counts);
+
+#endif // JOURNAL_CHECKER_H
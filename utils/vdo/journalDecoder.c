@@ -0,0 +1,121 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/journalDecoder.c#1 $
+ */
+
+
+#include "journalDecoder.h"
+
+#include "numeric.h"
+
+enum {
+  RECOVERY_ENTRY_BYTES = sizeof(struct packed_recovery_journal_entry),
+  SLAB_ENTRY_BYTES     = sizeof(packed_slab_journal_entry),
+};
+
+/**
+ * Decode a run of packed recovery journal entries from one sector.
+ *
+ * @param packed   The first packed entry
+ * @param count    The number of entries to decode
+ * @param sector   The number of the sector holding the entries
+ * @param entries  The arrays to append to
+ **/
+static void decodeRecoveryEntries(const byte           *packed,
+                                  journal_entry_count_t  count,
+                                  uint8_t                sector,
+                                  RecoveryBlockEntries  *entries)
+{
+  journal_entry_count_t     base       = entries->count;
+  physical_block_number_t  *slotPBNs   = &entries->slotPBNs[base];
+  uint16_t                 *slots      = &entries->slots[base];
+  physical_block_number_t  *pbns       = &entries->pbns[base];
+  uint8_t                  *states     = &entries->states[base];
+  uint8_t                  *operations = &entries->operations[base];
+  uint8_t                  *sectors    = &entries->sectors[base];
+  uint8_t                  *positions  = &entries->sectorEntries[base];
+  for (journal_entry_count_t i = 0; i < count; i++) {
+    // See struct packed_recovery_journal_entry for the layout of each entry.
+    const byte *entry = &packed[i * RECOVERY_ENTRY_BYTES];
+    operations[i] = entry[0] & 0x03;
+    slots[i]      = (entry[0] >> 2) | ((entry[1] & 0x0F) << 6);
+    slotPBNs[i]   = (((physical_block_number_t) (entry[1] >> 4) << 32)
+                     | get_unaligned_le32(&entry[2]));
+    states[i]     = entry[6] & 0x0F;
+    pbns[i]       = (((physical_block_number_t) (entry[6] >> 4) << 32)
+                     | get_unaligned_le32(&entry[7]));
+    sectors[i]    = sector;
+    positions[i]  = i;
+  }
+
+  entries->count += count;
+}
+
+/**********************************************************************/
+void decodeRecoveryJournalBlock(const struct packed_journal_header *block,
+                                RecoveryBlockEntries               *entries)
+{
+  entries->count = 0;
+  for (uint8_t sector = 1; sector < VDO_SECTORS_PER_BLOCK; sector++) {
+    const struct packed_journal_sector *packed
+      = (const struct packed_journal_sector *)
+        ((const byte *) block + (VDO_SECTOR_SIZE * sector));
+    journal_entry_count_t count
+      = min((journal_entry_count_t) packed->entry_count,
+            (journal_entry_count_t) RECOVERY_JOURNAL_ENTRIES_PER_SECTOR);
+    decodeRecoveryEntries((const byte *) packed->entries, count, sector,
+                          entries);
+  }
+}
+
+/**********************************************************************/
+void decodeSlabJournalBlock(const struct packed_slab_journal_block *block,
+                            SlabBlockEntries                       *entries)
+{
+  bool hasBlockMapIncrements = block->header.has_block_map_increments;
+  journal_entry_count_t count = __le16_to_cpu(block->header.entry_count);
+  journal_entry_count_t maxEntries
+    = (hasBlockMapIncrements
+       ? VDO_SLAB_JOURNAL_FULL_ENTRIES_PER_BLOCK
+       : VDO_SLAB_JOURNAL_ENTRIES_PER_BLOCK);
+  count = min(count, maxEntries);
+
+  // See packed_slab_journal_entry for the layout of each entry.
+  const byte        *packed     = block->payload.space;
+  slab_block_number *sbns       = entries->sbns;
+  uint8_t           *operations = entries->operations;
+  for (journal_entry_count_t i = 0; i < count; i++) {
+    const byte *entry = &packed[i * SLAB_ENTRY_BYTES];
+    sbns[i]       = (entry[0] | (entry[1] << 8)
+                     | ((slab_block_number) (entry[2] & 0x7F) << 16));
+    operations[i] = ((entry[2] >> 7) ? DATA_INCREMENT : DATA_DECREMENT);
+  }
+
+  if (hasBlockMapIncrements) {
+    // Block map increments are marked in a bitmap after the entries.
+    const byte *types = block->payload.full_entries.entry_types;
+    for (journal_entry_count_t i = 0; i < count; i++) {
+      if ((types[i / 8] >> (i % 8)) & 1) {
+        operations[i] = BLOCK_MAP_INCREMENT;
+      }
+    }
+  }
+
+  entries->count = count;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/journalDecoder.h#1 $
+ */
+
+
+#ifndef JOURNAL_DECODER_H
+#define JOURNAL_DECODER_H
+
+#include "packedRecoveryJournalBlock.h"
+#include "slabJournalFormat.h"
+#include "types.h"
+
+/**
+ * Bulk decoders for tools which scan whole journals. Each decodes every
+ * entry of a packed journal block at once into parallel arrays, one for
+ * each field, rather than unpacking the entries one at a time into
+ * structures. The fields are extracted with plain byte arithmetic over the
+ * fixed-size packed entries, with no bitfield accesses and no dependency
+ * from one entry to the next.
+ **/
+
+enum {
+  /** The most entries the sectors of a recovery journal block can claim */
+  MAX_RECOVERY_BLOCK_ENTRIES
+    = ((VDO_SECTORS_PER_BLOCK - 1) * RECOVERY_JOURNAL_ENTRIES_PER_SECTOR),
+};
+
+/** The entries of a recovery journal block, decoded into arrays */
+typedef struct {
+  /** The number of entries decoded */
+  journal_entry_count_t   count;
+  /** The block map page the entry changes */
+  physical_block_number_t slotPBNs[MAX_RECOVERY_BLOCK_ENTRIES];
+  /** The slot of the block map page the entry changes */
+  uint16_t                slots[MAX_RECOVERY_BLOCK_ENTRIES];
+  /** The physical block the slot maps to or from */
+  physical_block_number_t pbns[MAX_RECOVERY_BLOCK_ENTRIES];
+  /** The block_mapping_state of the mapping */
+  uint8_t                 states[MAX_RECOVERY_BLOCK_ENTRIES];
+  /** The journal_operation of the entry */
+  uint8_t                 operations[MAX_RECOVERY_BLOCK_ENTRIES];
+  /** The sector holding the entry (1-based) */
+  uint8_t                 sectors[MAX_RECOVERY_BLOCK_ENTRIES];
+  /** The position of the entry in its sector */
+  uint8_t                 sectorEntries[MAX_RECOVERY_BLOCK_ENTRIES];
+} RecoveryBlockEntries;
+
+/** The entries of a slab journal block, decoded into arrays */
+typedef struct {
+  /** The number of entries decoded */
+  journal_entry_count_t count;
+  /** The slab block number the entry is for */
+  slab_block_number     sbns[VDO_SLAB_JOURNAL_ENTRIES_PER_BLOCK];
+  /** The journal_operation of the entry */
+  uint8_t               operations[VDO_SLAB_JOURNAL_ENTRIES_PER_BLOCK];
+} SlabBlockEntries;
+
+/**
+ * Decode all the entries of a recovery journal block. Each sector
+ * contributes the entries its entry count claims, up to the most a sector
+ * can hold, whether or not the sector is valid for the block; callers which
+ * care check the sectors with is_valid_vdo_recovery_journal_sector().
+ *
+ * @param [in]  block    The packed journal block
+ * @param [out] entries  The arrays to fill in
+ **/
+void decodeRecoveryJournalBlock(const struct packed_journal_header *block,
+                                RecoveryBlockEntries               *entries);
+
+/**
+ * Decode all the entries of a slab journal block. A block claiming more
+ * entries than its format can hold contributes only the entries it can
+ * hold.
+ *
+ * @param [in]  block    The packed journal block
+ * @param [out] entries  The arrays to fill in
+ **/
+void decodeSlabJournalBlock(const struct packed_slab_journal_block *block,
+                            SlabBlockEntries                       *entries);
+
+#endif // JOURNAL_DECODER_H
@@ -17,1288 +17,424 @@
  * 02110-1301, USA. 
  */
 
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "threadOnce.h"
+
 #include "statistics.h"
 #include "statusCodes.h"
 #include "vdoStats.h"
 
-/*********************************************************************/
-static int skip_string(char **buf, char *skip)
-{
-        char *tmp = NULL;
-        tmp = strstr(*buf, skip);
-        if (tmp == NULL) {
-                return VDO_UNEXPECTED_EOF;
-        }
-        *buf = tmp + strlen(skip);
-        return VDO_SUCCESS;
-}
-
-/**********************************************************************/
-static int read_uint64_t(char **buf,
-			 uint64_t *value)
-{
-	int count = sscanf(*buf, "%lu, ", value);
-	if (count != 1) {
-		return VDO_UNEXPECTED_EOF;
-	}
-	return VDO_SUCCESS;
-}
-
-/**********************************************************************/
-static int read_uint32_t(char **buf,
-			 uint32_t *value)
-{
-	int count = sscanf(*buf, "%u, ", value);
-	if (count != 1) {
-		return VDO_UNEXPECTED_EOF;
-	}
-	return VDO_SUCCESS;
-}
+/*
+ * The kernel reports its statistics as a single line of "key : value"
+ * pairs separated by commas, with the statistics of each component nested
+ * in braces after the component's key. Rather than expecting the fields in
+ * a fixed order, each key is looked up by its full dotted path in a table
+ * of the fields of struct vdo_statistics, so that fields the kernel adds or
+ * moves do no harm. Fields the kernel does not report are left as zero.
+ */
 
-/**********************************************************************/
-static int read_block_count_t(char **buf,
-			      block_count_t *value)
-{
-	int count = sscanf(*buf, "%lu, ", value);
-	if (count != 1) {
-		return VDO_UNEXPECTED_EOF;
-	}
-	return VDO_SUCCESS;
-}
+enum stats_field_type {
+	STATS_BOOL,
+	STATS_UINT8,
+	STATS_UINT32,
+	STATS_UINT64,
+	STATS_STRING,
+};
+
+struct stats_field {
+	/* The dotted path of the field's key in the kernel's message */
+	const char *name;
+	size_t offset;
+	size_t size;
+	enum stats_field_type type;
+};
+
+#define FIELD(name, field, type)					\
+	{ name,								\
+	  offsetof(struct vdo_statistics, field),			\
+	  sizeof(((struct vdo_statistics *) NULL)->field),		\
+	  type }
+
+static const struct stats_field fields[] = {
+	FIELD("version", version, STATS_UINT32),
+	FIELD("releaseVersion", release_version, STATS_UINT32),
+	FIELD("dataBlocksUsed", data_blocks_used, STATS_UINT64),
+	FIELD("overheadBlocksUsed", overhead_blocks_used, STATS_UINT64),
+	FIELD("logicalBlocksUsed", logical_blocks_used, STATS_UINT64),
+	FIELD("physicalBlocks", physical_blocks, STATS_UINT64),
+	FIELD("logicalBlocks", logical_blocks, STATS_UINT64),
+	FIELD("blockMapCacheSize", block_map_cache_size, STATS_UINT64),
+	FIELD("blockSize", block_size, STATS_UINT64),
+	FIELD("completeRecoveries", complete_recoveries, STATS_UINT64),
+	FIELD("readOnlyRecoveries", read_only_recoveries, STATS_UINT64),
+	FIELD("mode", mode, STATS_STRING),
+	FIELD("inRecoveryMode", in_recovery_mode, STATS_BOOL),
+	FIELD("recoveryPercentage", recovery_percentage, STATS_UINT8),
+	FIELD("packer.compressedFragmentsWritten", packer.compressed_fragments_written, STATS_UINT64),
+	FIELD("packer.compressedBlocksWritten", packer.compressed_blocks_written, STATS_UINT64),
+	FIELD("packer.compressedFragmentsInPacker", packer.compressed_fragments_in_packer, STATS_UINT64),
+	FIELD("allocator.slabCount", allocator.slab_count, STATS_UINT64),
+	FIELD("allocator.slabsOpened", allocator.slabs_opened, STATS_UINT64),
+	FIELD("allocator.slabsReopened", allocator.slabs_reopened, STATS_UINT64),
+	FIELD("journal.diskFull", journal.disk_full, STATS_UINT64),
+	FIELD("journal.slabJournalCommitsRequested", journal.slab_journal_commits_requested, STATS_UINT64),
+	FIELD("journal.entries.started", journal.entries.started, STATS_UINT64),
+	FIELD("journal.entries.written", journal.entries.written, STATS_UINT64),
+	FIELD("journal.entries.committed", journal.entries.committed, STATS_UINT64),
+	FIELD("journal.blocks.started", journal.blocks.started, STATS_UINT64),
+	FIELD("journal.blocks.written", journal.blocks.written, STATS_UINT64),
+	FIELD("journal.blocks.committed", journal.blocks.committed, STATS_UINT64),
+	FIELD("slabJournal.diskFullCount", slab_journal.disk_full_count, STATS_UINT64),
+	FIELD("slabJournal.flushCount", slab_journal.flush_count, STATS_UINT64),
+	FIELD("slabJournal.blockedCount", slab_journal.blocked_count, STATS_UINT64),
+	FIELD("slabJournal.blocksWritten", slab_journal.blocks_written, STATS_UINT64),
+	FIELD("slabJournal.tailBusyCount", slab_journal.tail_busy_count, STATS_UINT64),
+	FIELD("slabSummary.blocksWritten", slab_summary.blocks_written, STATS_UINT64),
+	FIELD("refCounts.blocksWritten", ref_counts.blocks_written, STATS_UINT64),
+	FIELD("blockMap.dirtyPages", block_map.dirty_pages, STATS_UINT32),
+	FIELD("blockMap.cleanPages", block_map.clean_pages, STATS_UINT32),
+	FIELD("blockMap.freePages", block_map.free_pages, STATS_UINT32),
+	FIELD("blockMap.failedPages", block_map.failed_pages, STATS_UINT32),
+	FIELD("blockMap.incomingPages", block_map.incoming_pages, STATS_UINT32),
+	FIELD("blockMap.outgoingPages", block_map.outgoing_pages, STATS_UINT32),
+	FIELD("blockMap.cachePressure", block_map.cache_pressure, STATS_UINT32),
+	FIELD("blockMap.readCount", block_map.read_count, STATS_UINT64),
+	FIELD("blockMap.writeCount", block_map.write_count, STATS_UINT64),
+	FIELD("blockMap.failedReads", block_map.failed_reads, STATS_UINT64),
+	FIELD("blockMap.failedWrites", block_map.failed_writes, STATS_UINT64),
+	FIELD("blockMap.reclaimed", block_map.reclaimed, STATS_UINT64),
+	FIELD("blockMap.readOutgoing", block_map.read_outgoing, STATS_UINT64),
+	FIELD("blockMap.foundInCache", block_map.found_in_cache, STATS_UINT64),
+	FIELD("blockMap.discardRequired", block_map.discard_required, STATS_UINT64),
+	FIELD("blockMap.waitForPage", block_map.wait_for_page, STATS_UINT64),
+	FIELD("blockMap.fetchRequired", block_map.fetch_required, STATS_UINT64),
+	FIELD("blockMap.pagesLoaded", block_map.pages_loaded, STATS_UINT64),
+	FIELD("blockMap.pagesSaved", block_map.pages_saved, STATS_UINT64),
+	FIELD("blockMap.flushCount", block_map.flush_count, STATS_UINT64),
+	FIELD("hashLock.dedupeAdviceValid", hash_lock.dedupe_advice_valid, STATS_UINT64),
+	FIELD("hashLock.dedupeAdviceStale", hash_lock.dedupe_advice_stale, STATS_UINT64),
+	FIELD("hashLock.concurrentDataMatches", hash_lock.concurrent_data_matches, STATS_UINT64),
+	FIELD("hashLock.concurrentHashCollisions", hash_lock.concurrent_hash_collisions, STATS_UINT64),
+	FIELD("errors.invalidAdvicePBNCount", errors.invalid_advice_pbn_count, STATS_UINT64),
+	FIELD("errors.noSpaceErrorCount", errors.no_space_error_count, STATS_UINT64),
+	FIELD("errors.readOnlyErrorCount", errors.read_only_error_count, STATS_UINT64),
+	FIELD("instance", instance, STATS_UINT32),
+	FIELD("currentVIOsInProgress", current_vios_in_progress, STATS_UINT32),
+	FIELD("maxVIOs", max_vios, STATS_UINT32),
+	FIELD("dedupeAdviceTimeouts", dedupe_advice_timeouts, STATS_UINT64),
+	FIELD("flushOut", flush_out, STATS_UINT64),
+	FIELD("logicalBlockSize", logical_block_size, STATS_UINT64),
+	FIELD("biosIn.read", bios_in.read, STATS_UINT64),
+	FIELD("biosIn.write", bios_in.write, STATS_UINT64),
+	FIELD("biosIn.emptyFlush", bios_in.empty_flush, STATS_UINT64),
+	FIELD("biosIn.discard", bios_in.discard, STATS_UINT64),
+	FIELD("biosIn.flush", bios_in.flush, STATS_UINT64),
+	FIELD("biosIn.fua", bios_in.fua, STATS_UINT64),
+	FIELD("biosInPartial.read", bios_in_partial.read, STATS_UINT64),
+	FIELD("biosInPartial.write", bios_in_partial.write, STATS_UINT64),
+	FIELD("biosInPartial.emptyFlush", bios_in_partial.empty_flush, STATS_UINT64),
+	FIELD("biosInPartial.discard", bios_in_partial.discard, STATS_UINT64),
+	FIELD("biosInPartial.flush", bios_in_partial.flush, STATS_UINT64),
+	FIELD("biosInPartial.fua", bios_in_partial.fua, STATS_UINT64),
+	FIELD("biosOut.read", bios_out.read, STATS_UINT64),
+	FIELD("biosOut.write", bios_out.write, STATS_UINT64),
+	FIELD("biosOut.emptyFlush", bios_out.empty_flush, STATS_UINT64),
+	FIELD("biosOut.discard", bios_out.discard, STATS_UINT64),
+	FIELD("biosOut.flush", bios_out.flush, STATS_UINT64),
+	FIELD("biosOut.fua", bios_out.fua, STATS_UINT64),
+	FIELD("biosMeta.read", bios_meta.read, STATS_UINT64),
+	FIELD("biosMeta.write", bios_meta.write, STATS_UINT64),
+	FIELD("biosMeta.emptyFlush", bios_meta.empty_flush, STATS_UINT64),
+	FIELD("biosMeta.discard", bios_meta.discard, STATS_UINT64),
+	FIELD("biosMeta.flush", bios_meta.flush, STATS_UINT64),
+	FIELD("biosMeta.fua", bios_meta.fua, STATS_UINT64),
+	FIELD("biosJournal.read", bios_journal.read, STATS_UINT64),
+	FIELD("biosJournal.write", bios_journal.write, STATS_UINT64),
+	FIELD("biosJournal.emptyFlush", bios_journal.empty_flush, STATS_UINT64),
+	FIELD("biosJournal.discard", bios_journal.discard, STATS_UINT64),
+	FIELD("biosJournal.flush", bios_journal.flush, STATS_UINT64),
+	FIELD("biosJournal.fua", bios_journal.fua, STATS_UINT64),
+	FIELD("biosPageCache.read", bios_page_cache.read, STATS_UINT64),
+	FIELD("biosPageCache.write", bios_page_cache.write, STATS_UINT64),
+	FIELD("biosPageCache.emptyFlush", bios_page_cache.empty_flush, STATS_UINT64),
+	FIELD("biosPageCache.discard", bios_page_cache.discard, STATS_UINT64),
+	FIELD("biosPageCache.flush", bios_page_cache.flush, STATS_UINT64),
+	FIELD("biosPageCache.fua", bios_page_cache.fua, STATS_UINT64),
+	FIELD("biosOutCompleted.read", bios_out_completed.read, STATS_UINT64),
+	FIELD("biosOutCompleted.write", bios_out_completed.write, STATS_UINT64),
+	FIELD("biosOutCompleted.emptyFlush", bios_out_completed.empty_flush, STATS_UINT64),
+	FIELD("biosOutCompleted.discard", bios_out_completed.discard, STATS_UINT64),
+	FIELD("biosOutCompleted.flush", bios_out_completed.flush, STATS_UINT64),
+	FIELD("biosOutCompleted.fua", bios_out_completed.fua, STATS_UINT64),
+	FIELD("biosMetaCompleted.read", bios_meta_completed.read, STATS_UINT64),
+	FIELD("biosMetaCompleted.write", bios_meta_completed.write, STATS_UINT64),
+	FIELD("biosMetaCompleted.emptyFlush", bios_meta_completed.empty_flush, STATS_UINT64),
+	FIELD("biosMetaCompleted.discard", bios_meta_completed.discard, STATS_UINT64),
+	FIELD("biosMetaCompleted.flush", bios_meta_completed.flush, STATS_UINT64),
+	FIELD("biosMetaCompleted.fua", bios_meta_completed.fua, STATS_UINT64),
+	FIELD("biosJournalCompleted.read", bios_journal_completed.read, STATS_UINT64),
+	FIELD("biosJournalCompleted.write", bios_journal_completed.write, STATS_UINT64),
+	FIELD("biosJournalCompleted.emptyFlush", bios_journal_completed.empty_flush, STATS_UINT64),
+	FIELD("biosJournalCompleted.discard", bios_journal_completed.discard, STATS_UINT64),
+	FIELD("biosJournalCompleted.flush", bios_journal_completed.flush, STATS_UINT64),
+	FIELD("biosJournalCompleted.fua", bios_journal_completed.fua, STATS_UINT64),
+	FIELD("biosPageCacheCompleted.read", bios_page_cache_completed.read, STATS_UINT64),
+	FIELD("biosPageCacheCompleted.write", bios_page_cache_completed.write, STATS_UINT64),
+	FIELD("biosPageCacheCompleted.emptyFlush", bios_page_cache_completed.empty_flush, STATS_UINT64),
+	FIELD("biosPageCacheCompleted.discard", bios_page_cache_completed.discard, STATS_UINT64),
+	FIELD("biosPageCacheCompleted.flush", bios_page_cache_completed.flush, STATS_UINT64),
+	FIELD("biosPageCacheCompleted.fua", bios_page_cache_completed.fua, STATS_UINT64),
+	FIELD("biosAcknowledged.read", bios_acknowledged.read, STATS_UINT64),
+	FIELD("biosAcknowledged.write", bios_acknowledged.write, STATS_UINT64),
+	FIELD("biosAcknowledged.emptyFlush", bios_acknowledged.empty_flush, STATS_UINT64),
+	FIELD("biosAcknowledged.discard", bios_acknowledged.discard, STATS_UINT64),
+	FIELD("biosAcknowledged.flush", bios_acknowledged.flush, STATS_UINT64),
+	FIELD("biosAcknowledged.fua", bios_acknowledged.fua, STATS_UINT64),
+	FIELD("biosAcknowledgedPartial.read", bios_acknowledged_partial.read, STATS_UINT64),
+	FIELD("biosAcknowledgedPartial.write", bios_acknowledged_partial.write, STATS_UINT64),
+	FIELD("biosAcknowledgedPartial.emptyFlush", bios_acknowledged_partial.empty_flush, STATS_UINT64),
+	FIELD("biosAcknowledgedPartial.discard", bios_acknowledged_partial.discard, STATS_UINT64),
+	FIELD("biosAcknowledgedPartial.flush", bios_acknowledged_partial.flush, STATS_UINT64),
+	FIELD("biosAcknowledgedPartial.fua", bios_acknowledged_partial.fua, STATS_UINT64),
+	FIELD("biosInProgress.read", bios_in_progress.read, STATS_UINT64),
+	FIELD("biosInProgress.write", bios_in_progress.write, STATS_UINT64),
+	FIELD("biosInProgress.emptyFlush", bios_in_progress.empty_flush, STATS_UINT64),
+	FIELD("biosInProgress.discard", bios_in_progress.discard, STATS_UINT64),
+	FIELD("biosInProgress.flush", bios_in_progress.flush, STATS_UINT64),
+	FIELD("biosInProgress.fua", bios_in_progress.fua, STATS_UINT64),
+	FIELD("memoryUsage.bytesUsed", memory_usage.bytes_used, STATS_UINT64),
+	FIELD("memoryUsage.peakBytesUsed", memory_usage.peak_bytes_used, STATS_UINT64),
+	FIELD("index.entriesIndexed", index.entries_indexed, STATS_UINT64),
+	FIELD("index.postsFound", index.posts_found, STATS_UINT64),
+	FIELD("index.postsNotFound", index.posts_not_found, STATS_UINT64),
+	FIELD("index.queriesFound", index.queries_found, STATS_UINT64),
+	FIELD("index.queriesNotFound", index.queries_not_found, STATS_UINT64),
+	FIELD("index.updatesFound", index.updates_found, STATS_UINT64),
+	FIELD("index.updatesNotFound", index.updates_not_found, STATS_UINT64),
+	FIELD("index.currDedupeQueries", index.curr_dedupe_queries, STATS_UINT32),
+	FIELD("index.maxDedupeQueries", index.max_dedupe_queries, STATS_UINT32),
+};
+
+#undef FIELD
+
+enum {
+	/* The longest dotted key which can match a field */
+	MAX_KEY_LENGTH = 128,
+	/* How deeply components may be nested */
+	MAX_NESTING = 8,
+};
 
-/**********************************************************************/
-static int read_string(char **buf,
-		       char *value)
-{
-	int count = sscanf(*buf, "%[^,], ", value);
-	if (count != 1) {
-		return VDO_UNEXPECTED_EOF;
-	}
-	return VDO_SUCCESS;
-}
+/*
+ * The fields sorted by name, so that a key can be found with bsearch(). The
+ * fields table itself stays in the order of struct vdo_statistics.
+ */
+static const struct stats_field *sorted_fields[COUNT_OF(fields)];
+static once_state_t sorted_fields_once = ONCE_STATE_INITIALIZER;
 
-/**********************************************************************/
-static int read_bool(char **buf,
-		     bool *value)
-{
-	int temp;
-	int count = sscanf(*buf, "%d, ", &temp);
-	*value = (bool)temp;
-	if (count != 1) {
-		return VDO_UNEXPECTED_EOF;
-	}
-	return VDO_SUCCESS;
-}
+/* A key being looked up, which is not NUL-terminated */
+struct field_key {
+	const char *name;
+	size_t length;
+};
 
 /**********************************************************************/
-static int read_uint8_t(char **buf,
-			uint8_t *value)
+static int compare_fields(const void *a, const void *b)
 {
-	int count = sscanf(*buf, "%hhu, ", value);
-	if (count != 1) {
-		return VDO_UNEXPECTED_EOF;
-	}
-	return VDO_SUCCESS;
+	const struct stats_field *const *field_a = a;
+	const struct stats_field *const *field_b = b;
+	return strcmp((*field_a)->name, (*field_b)->name);
 }
 
 /**********************************************************************/
-static int read_block_allocator_statistics(char **buf,
-					   struct block_allocator_statistics *stats)
+static void sort_fields(void)
 {
-	int result = 0;
-
-	/** The total number of slabs from which blocks may be allocated */
-	result = skip_string(buf, "slabCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->slab_count);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The total number of slabs from which blocks have ever been allocated */
-	result = skip_string(buf, "slabsOpened : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->slabs_opened);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The number of times since loading that a slab has been re-opened */
-	result = skip_string(buf, "slabsReopened : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->slabs_reopened);
-	if (result != VDO_SUCCESS) {
-		return result;
+	for (size_t i = 0; i < COUNT_OF(fields); i++) {
+		sorted_fields[i] = &fields[i];
 	}
-	return VDO_SUCCESS;
+	qsort(sorted_fields, COUNT_OF(sorted_fields), sizeof(sorted_fields[0]),
+	      compare_fields);
 }
 
 /**********************************************************************/
-static int read_commit_statistics(char **buf,
-				  struct commit_statistics *stats)
+static int compare_key(const void *k, const void *f)
 {
-	int result = 0;
-
-	/** The total number of items on which processing has started */
-	result = skip_string(buf, "started : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->started);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The total number of items for which a write operation has been issued */
-	result = skip_string(buf, "written : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->written);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The total number of items for which a write operation has completed */
-	result = skip_string(buf, "committed : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->committed);
-	if (result != VDO_SUCCESS) {
+	const struct field_key *key = k;
+	const struct stats_field *field
+		= *((const struct stats_field *const *) f);
+	int result = strncmp(key->name, field->name, key->length);
+	if (result != 0) {
 		return result;
 	}
-	return VDO_SUCCESS;
-}
-
-/**********************************************************************/
-static int read_recovery_journal_statistics(char **buf,
-					    struct recovery_journal_statistics *stats)
-{
-	int result = 0;
 
-	/** Number of times the on-disk journal was full */
-	result = skip_string(buf, "diskFull : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->disk_full);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of times the recovery journal requested slab journal commits. */
-	result = skip_string(buf, "slabJournalCommitsRequested : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->slab_journal_commits_requested);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Write/Commit totals for individual journal entries */
-	result = skip_string(buf, "entries : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_commit_statistics(buf,
-					&stats->entries);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Write/Commit totals for journal blocks */
-	result = skip_string(buf, "blocks : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_commit_statistics(buf,
-					&stats->blocks);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	return VDO_SUCCESS;
+	/* The key is a prefix of the field name, so it sorts first. */
+	return ((field->name[key->length] == '\0') ? 0 : -1);
 }
 
 /**********************************************************************/
-static int read_packer_statistics(char **buf,
-				  struct packer_statistics *stats)
+static const struct stats_field *find_field(const char *name, size_t length)
 {
-	int result = 0;
-
-	/** Number of compressed data items written since startup */
-	result = skip_string(buf, "compressedFragmentsWritten : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->compressed_fragments_written);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of blocks containing compressed items written since startup */
-	result = skip_string(buf, "compressedBlocksWritten : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->compressed_blocks_written);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of VIOs that are pending in the packer */
-	result = skip_string(buf, "compressedFragmentsInPacker : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->compressed_fragments_in_packer);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	return VDO_SUCCESS;
+	struct field_key key = {
+		.name = name,
+		.length = length,
+	};
+	const struct stats_field **field
+		= bsearch(&key, sorted_fields, COUNT_OF(sorted_fields),
+			  sizeof(sorted_fields[0]), compare_key);
+	return ((field == NULL) ? NULL : *field);
 }
 
 /**********************************************************************/
-static int read_slab_journal_statistics(char **buf,
-					struct slab_journal_statistics *stats)
+static int store_field(const struct stats_field *field,
+		       const char *value,
+		       size_t length,
+		       struct vdo_statistics *stats)
 {
-	int result = 0;
-
-	/** Number of times the on-disk journal was full */
-	result = skip_string(buf, "diskFullCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->disk_full_count);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of times an entry was added over the flush threshold */
-	result = skip_string(buf, "flushCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->flush_count);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of times an entry was added over the block threshold */
-	result = skip_string(buf, "blockedCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->blocked_count);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of times a tail block was written */
-	result = skip_string(buf, "blocksWritten : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->blocks_written);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of times we had to wait for the tail to write */
-	result = skip_string(buf, "tailBusyCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->tail_busy_count);
-	if (result != VDO_SUCCESS) {
-		return result;
+	char *target = (char *) stats + field->offset;
+	if (field->type == STATS_STRING) {
+		if (length >= field->size) {
+			return VDO_UNEXPECTED_EOF;
+		}
+		memcpy(target, value, length);
+		target[length] = '\0';
+		return VDO_SUCCESS;
+	}
+
+	char *end;
+	unsigned long long number = strtoull(value, &end, 10);
+	if (end != value + length) {
+		return VDO_UNEXPECTED_EOF;
 	}
-	return VDO_SUCCESS;
-}
-
-/**********************************************************************/
-static int read_slab_summary_statistics(char **buf,
-					struct slab_summary_statistics *stats)
-{
-	int result = 0;
 
-	/** Number of blocks written */
-	result = skip_string(buf, "blocksWritten : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->blocks_written);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	return VDO_SUCCESS;
-}
+	switch (field->type) {
+	case STATS_BOOL:
+		*((bool *) target) = (number != 0);
+		break;
 
-/**********************************************************************/
-static int read_ref_counts_statistics(char **buf,
-				      struct ref_counts_statistics *stats)
-{
-	int result = 0;
+	case STATS_UINT8:
+		*((uint8_t *) target) = number;
+		break;
 
-	/** Number of reference blocks written */
-	result = skip_string(buf, "blocksWritten : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->blocks_written);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	return VDO_SUCCESS;
-}
+	case STATS_UINT32:
+		*((uint32_t *) target) = number;
+		break;
 
-/**********************************************************************/
-static int read_block_map_statistics(char **buf,
-				     struct block_map_statistics *stats)
-{
-	int result = 0;
+	case STATS_UINT64:
+		*((uint64_t *) target) = number;
+		break;
 
-	/** number of dirty (resident) pages */
-	result = skip_string(buf, "dirtyPages : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->dirty_pages);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of clean (resident) pages */
-	result = skip_string(buf, "cleanPages : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->clean_pages);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of free pages */
-	result = skip_string(buf, "freePages : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->free_pages);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of pages in failed state */
-	result = skip_string(buf, "failedPages : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->failed_pages);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of pages incoming */
-	result = skip_string(buf, "incomingPages : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->incoming_pages);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of pages outgoing */
-	result = skip_string(buf, "outgoingPages : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->outgoing_pages);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** how many times free page not avail */
-	result = skip_string(buf, "cachePressure : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->cache_pressure);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of get_vdo_page() calls for read */
-	result = skip_string(buf, "readCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->read_count);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of get_vdo_page() calls for write */
-	result = skip_string(buf, "writeCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->write_count);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of times pages failed to read */
-	result = skip_string(buf, "failedReads : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->failed_reads);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of times pages failed to write */
-	result = skip_string(buf, "failedWrites : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->failed_writes);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of gets that are reclaimed */
-	result = skip_string(buf, "reclaimed : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->reclaimed);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of gets for outgoing pages */
-	result = skip_string(buf, "readOutgoing : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->read_outgoing);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of gets that were already there */
-	result = skip_string(buf, "foundInCache : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->found_in_cache);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of gets requiring discard */
-	result = skip_string(buf, "discardRequired : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->discard_required);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of gets enqueued for their page */
-	result = skip_string(buf, "waitForPage : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->wait_for_page);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of gets that have to fetch */
-	result = skip_string(buf, "fetchRequired : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->fetch_required);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of page fetches */
-	result = skip_string(buf, "pagesLoaded : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->pages_loaded);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of page saves */
-	result = skip_string(buf, "pagesSaved : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->pages_saved);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** the number of flushes issued */
-	result = skip_string(buf, "flushCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->flush_count);
-	if (result != VDO_SUCCESS) {
-		return result;
+	default:
+		return VDO_UNEXPECTED_EOF;
 	}
 	return VDO_SUCCESS;
 }
 
 /**********************************************************************/
-static int read_hash_lock_statistics(char **buf,
-				     struct hash_lock_statistics *stats)
+static const char *skip_space(const char *buf)
 {
-	int result = 0;
-
-	/** Number of times the UDS advice proved correct */
-	result = skip_string(buf, "dedupeAdviceValid : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->dedupe_advice_valid);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of times the UDS advice proved incorrect */
-	result = skip_string(buf, "dedupeAdviceStale : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->dedupe_advice_stale);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of writes with the same data as another in-flight write */
-	result = skip_string(buf, "concurrentDataMatches : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->concurrent_data_matches);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of writes whose hash collided with an in-flight write */
-	result = skip_string(buf, "concurrentHashCollisions : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->concurrent_hash_collisions);
-	if (result != VDO_SUCCESS) {
-		return result;
+	while ((*buf == ' ') || (*buf == '\t') || (*buf == '\n')) {
+		buf++;
 	}
-	return VDO_SUCCESS;
+	return buf;
 }
 
 /**********************************************************************/
-static int read_error_statistics(char **buf,
-				 struct error_statistics *stats)
+int read_vdo_stats(char *buf,
+		   struct vdo_statistics *stats)
 {
-	int result = 0;
-
-	/** number of times VDO got an invalid dedupe advice PBN from UDS */
-	result = skip_string(buf, "invalidAdvicePBNCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->invalid_advice_pbn_count);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of times a VIO completed with a VDO_NO_SPACE error */
-	result = skip_string(buf, "noSpaceErrorCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->no_space_error_count);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of times a VIO completed with a VDO_READ_ONLY error */
-	result = skip_string(buf, "readOnlyErrorCount : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->read_only_error_count);
-	if (result != VDO_SUCCESS) {
-		return result;
+	perform_once(&sorted_fields_once, sort_fields);
+	memset(stats, 0, sizeof(*stats));
+
+	/*
+	 * The dotted path of the current component, and the length of the
+	 * path outside each open brace.
+	 */
+	char path[MAX_KEY_LENGTH];
+	size_t path_length = 0;
+	size_t outer_lengths[MAX_NESTING];
+	unsigned int depth = 0;
+
+	const char *p = buf;
+	for (;;) {
+		p = skip_space(p);
+		if (*p == ',') {
+			p++;
+			continue;
+		}
+
+		if (*p == '\0') {
+			return ((depth == 0) ? VDO_SUCCESS : VDO_UNEXPECTED_EOF);
+		}
+
+		if (*p == '{') {
+			/* A brace with no key, around the whole message */
+			if (depth == MAX_NESTING) {
+				return VDO_UNEXPECTED_EOF;
+			}
+			outer_lengths[depth++] = path_length;
+			p++;
+			continue;
+		}
+
+		if (*p == '}') {
+			if (depth == 0) {
+				return VDO_UNEXPECTED_EOF;
+			}
+			path_length = outer_lengths[--depth];
+			p++;
+			continue;
+		}
+
+		const char *key = p;
+		size_t key_length = strcspn(p, " :,{}");
+		p = skip_space(p + key_length);
+		if ((key_length == 0) || (*p != ':')) {
+			return VDO_UNEXPECTED_EOF;
+		}
+		p = skip_space(p + 1);
+
+		/* Keys too long to be fields are still parsed, but unused. */
+		size_t full_length = path_length + key_length;
+		bool usable = (full_length < MAX_KEY_LENGTH - 1);
+		if (usable) {
+			memcpy(path + path_length, key, key_length);
+		}
+
+		if (*p == '{') {
+			if (depth == MAX_NESTING) {
+				return VDO_UNEXPECTED_EOF;
+			}
+			outer_lengths[depth++] = path_length;
+			path_length = (usable ? full_length : MAX_KEY_LENGTH);
+			if (usable) {
+				path[path_length++] = '.';
+			}
+			p++;
+			continue;
+		}
+
+		const char *value = p;
+		size_t value_length = strcspn(p, ",}");
+		while ((value_length > 0) && (value[value_length - 1] == ' ')) {
+			value_length--;
+		}
+		p = value + strcspn(value, ",}");
+
+		if (!usable) {
+			continue;
+		}
+
+		const struct stats_field *field = find_field(path, full_length);
+		if (field == NULL) {
+			/* A statistic this version doesn't know about */
+			continue;
+		}
+
+		int result = store_field(field, value, value_length, stats);
+		if (result != VDO_SUCCESS) {
+			return result;
+		}
 	}
-	return VDO_SUCCESS;
-}
-
-/**********************************************************************/
-static int read_bio_stats(char **buf,
-			  struct bio_stats *stats)
-{
-	int result = 0;
-
-	/** Number of REQ_OP_READ bios */
-	result = skip_string(buf, "read : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->read);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of REQ_OP_WRITE bios with data */
-	result = skip_string(buf, "write : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->write);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of bios tagged with REQ_PREFLUSH and containing no data */
-	result = skip_string(buf, "emptyFlush : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->empty_flush);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of REQ_OP_DISCARD bios */
-	result = skip_string(buf, "discard : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->discard);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of bios tagged with REQ_PREFLUSH */
-	result = skip_string(buf, "flush : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->flush);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of bios tagged with REQ_FUA */
-	result = skip_string(buf, "fua : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->fua);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	return VDO_SUCCESS;
-}
-
-/**********************************************************************/
-static int read_memory_usage(char **buf,
-			     struct memory_usage *stats)
-{
-	int result = 0;
-
-	/** Tracked bytes currently allocated. */
-	result = skip_string(buf, "bytesUsed : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->bytes_used);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Maximum tracked bytes allocated. */
-	result = skip_string(buf, "peakBytesUsed : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->peak_bytes_used);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	return VDO_SUCCESS;
-}
-
-/**********************************************************************/
-static int read_index_statistics(char **buf,
-				 struct index_statistics *stats)
-{
-	int result = 0;
-
-	/** Number of chunk names stored in the index */
-	result = skip_string(buf, "entriesIndexed : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->entries_indexed);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of post calls that found an existing entry */
-	result = skip_string(buf, "postsFound : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->posts_found);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of post calls that added a new entry */
-	result = skip_string(buf, "postsNotFound : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->posts_not_found);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of query calls that found an existing entry */
-	result = skip_string(buf, "queriesFound : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->queries_found);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of query calls that added a new entry */
-	result = skip_string(buf, "queriesNotFound : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->queries_not_found);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of update calls that found an existing entry */
-	result = skip_string(buf, "updatesFound : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->updates_found);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of update calls that added a new entry */
-	result = skip_string(buf, "updatesNotFound : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->updates_not_found);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Current number of dedupe queries that are in flight */
-	result = skip_string(buf, "currDedupeQueries : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->curr_dedupe_queries);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Maximum number of dedupe queries that have been in flight */
-	result = skip_string(buf, "maxDedupeQueries : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->max_dedupe_queries);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	return VDO_SUCCESS;
-}
-
-/**********************************************************************/
-static int read_vdo_statistics(char **buf,
-			       struct vdo_statistics *stats)
-{
-	int result = 0;
-
-	result = skip_string(buf, "version : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->version);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = skip_string(buf, "releaseVersion : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->release_version);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of blocks used for data */
-	result = skip_string(buf, "dataBlocksUsed : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->data_blocks_used);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of blocks used for VDO metadata */
-	result = skip_string(buf, "overheadBlocksUsed : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->overhead_blocks_used);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of logical blocks that are currently mapped to physical blocks */
-	result = skip_string(buf, "logicalBlocksUsed : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->logical_blocks_used);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of physical blocks */
-	result = skip_string(buf, "physicalBlocks : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_block_count_t(buf,
-				    &stats->physical_blocks);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** number of logical blocks */
-	result = skip_string(buf, "logicalBlocks : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_block_count_t(buf,
-				    &stats->logical_blocks);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Size of the block map page cache, in bytes */
-	result = skip_string(buf, "blockMapCacheSize : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->block_map_cache_size);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The physical block size */
-	result = skip_string(buf, "blockSize : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->block_size);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of times the VDO has successfully recovered */
-	result = skip_string(buf, "completeRecoveries : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->complete_recoveries);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of times the VDO has recovered from read-only mode */
-	result = skip_string(buf, "readOnlyRecoveries : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->read_only_recoveries);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** String describing the operating mode of the VDO */
-	result = skip_string(buf, "mode : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_string(buf,
-			     stats->mode);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Whether the VDO is in recovery mode */
-	result = skip_string(buf, "inRecoveryMode : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bool(buf,
-			   &stats->in_recovery_mode);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** What percentage of recovery mode work has been completed */
-	result = skip_string(buf, "recoveryPercentage : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint8_t(buf,
-			      &stats->recovery_percentage);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The statistics for the compressed block packer */
-	result = skip_string(buf, "packer : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_packer_statistics(buf,
-					&stats->packer);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Counters for events in the block allocator */
-	result = skip_string(buf, "allocator : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_block_allocator_statistics(buf,
-						 &stats->allocator);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Counters for events in the recovery journal */
-	result = skip_string(buf, "journal : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_recovery_journal_statistics(buf,
-						  &stats->journal);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The statistics for the slab journals */
-	result = skip_string(buf, "slabJournal : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_slab_journal_statistics(buf,
-					      &stats->slab_journal);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The statistics for the slab summary */
-	result = skip_string(buf, "slabSummary : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_slab_summary_statistics(buf,
-					      &stats->slab_summary);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The statistics for the reference counts */
-	result = skip_string(buf, "refCounts : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_ref_counts_statistics(buf,
-					    &stats->ref_counts);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The statistics for the block map */
-	result = skip_string(buf, "blockMap : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_block_map_statistics(buf,
-					   &stats->block_map);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The dedupe statistics from hash locks */
-	result = skip_string(buf, "hashLock : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_hash_lock_statistics(buf,
-					   &stats->hash_lock);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Counts of error conditions */
-	result = skip_string(buf, "errors : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_error_statistics(buf,
-				       &stats->errors);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The VDO instance */
-	result = skip_string(buf, "instance : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->instance);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Current number of active VIOs */
-	result = skip_string(buf, "currentVIOsInProgress : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->current_vios_in_progress);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Maximum number of active VIOs */
-	result = skip_string(buf, "maxVIOs : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint32_t(buf,
-			       &stats->max_vios);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of times the UDS index was too slow in responding */
-	result = skip_string(buf, "dedupeAdviceTimeouts : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->dedupe_advice_timeouts);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Number of flush requests submitted to the storage device */
-	result = skip_string(buf, "flushOut : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->flush_out);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Logical block size */
-	result = skip_string(buf, "logicalBlockSize : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_uint64_t(buf,
-			       &stats->logical_block_size);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Bios submitted into VDO from above */
-	result = skip_string(buf, "biosIn : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_in);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = skip_string(buf, "biosInPartial : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_in_partial);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Bios submitted onward for user data */
-	result = skip_string(buf, "biosOut : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_out);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Bios submitted onward for metadata */
-	result = skip_string(buf, "biosMeta : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_meta);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = skip_string(buf, "biosJournal : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_journal);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = skip_string(buf, "biosPageCache : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_page_cache);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = skip_string(buf, "biosOutCompleted : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_out_completed);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = skip_string(buf, "biosMetaCompleted : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_meta_completed);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = skip_string(buf, "biosJournalCompleted : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_journal_completed);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = skip_string(buf, "biosPageCacheCompleted : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_page_cache_completed);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = skip_string(buf, "biosAcknowledged : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_acknowledged);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = skip_string(buf, "biosAcknowledgedPartial : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_acknowledged_partial);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Current number of bios in progress */
-	result = skip_string(buf, "biosInProgress : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_bio_stats(buf,
-				&stats->bios_in_progress);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** Memory usage stats. */
-	result = skip_string(buf, "memoryUsage : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_memory_usage(buf,
-				   &stats->memory_usage);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	/** The statistics for the UDS index */
-	result = skip_string(buf, "index : ");
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	result = read_index_statistics(buf,
-				       &stats->index);
-	if (result != VDO_SUCCESS) {
-		return result;
-	}
-	return VDO_SUCCESS;
-}
-
-/**********************************************************************/
-int read_vdo_stats(char *buf,
-		   struct vdo_statistics *stats)
-{
-	return(read_vdo_statistics(&buf, stats));
 }
@@ -0,0 +1,355 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/metadataIterators.c#1 $
+ */
+
+#include "metadataIterators.h"
+
+#include <err.h>
+#include <string.h>
+
+#include "memoryAlloc.h"
+#include "numeric.h"
+
+#include "fixedLayout.h"
+#include "physicalLayer.h"
+#include "recoveryJournalFormat.h"
+#include "slabDepotFormat.h"
+#include "statusCodes.h"
+
+enum {
+  /** The number of slabs whose reference counts are read at once */
+  REF_COUNT_BATCH_SLABS = 16,
+  /** The number of recovery journal blocks read at once */
+  RECOVERY_BATCH_BLOCKS = 256,
+};
+
+struct refCountIterator {
+  UserVDO            *vdo;
+  slab_count_t        nextSlab;
+  slab_count_t        lastSlab;
+  /** The first slab whose reference blocks are in the buffer */
+  slab_count_t        batchStart;
+  /** The number of slabs whose reference blocks are in the buffer */
+  slab_count_t        batchCount;
+  block_count_t       refCountBlocks;
+  /** The packed reference blocks of a batch of slabs */
+  char               *buffer;
+  /** The unpacked counts of the current slab */
+  vdo_refcount_t     *counts;
+  struct extent_read  reads[REF_COUNT_BATCH_SLABS];
+  SlabRefCounts       slab;
+};
+
+struct recoveryJournalIterator {
+  UserVDO                 *vdo;
+  physical_block_number_t  journalOrigin;
+  block_count_t            journalSize;
+  /** The offset in the journal of the next block to consider */
+  block_count_t            nextBlock;
+  /** The offset of the first block in the buffer */
+  block_count_t            batchStart;
+  /** The number of blocks in the buffer */
+  block_count_t            batchCount;
+  char                    *buffer;
+  RecoveryJournalBlock     block;
+};
+
+/**********************************************************************/
+void unpackReferenceCounts(const char     *blocks,
+                           block_count_t   dataBlocks,
+                           vdo_refcount_t *counts)
+{
+  block_count_t remaining = dataBlocks;
+  for (; remaining > 0; blocks += VDO_BLOCK_SIZE) {
+    const struct packed_reference_block *block
+      = (const struct packed_reference_block *) blocks;
+    for (sector_count_t i = 0;
+         (i < VDO_SECTORS_PER_BLOCK) && (remaining > 0); i++) {
+      block_count_t entries
+        = min(remaining, (block_count_t) COUNTS_PER_SECTOR);
+      memcpy(counts, block->sectors[i].counts, entries);
+      counts    += entries;
+      remaining -= entries;
+    }
+  }
+}
+
+/**********************************************************************/
+int makeRefCountIterator(UserVDO           *vdo,
+                         slab_count_t       firstSlab,
+                         slab_count_t       lastSlab,
+                         RefCountIterator **iteratorPtr)
+{
+  if ((firstSlab > lastSlab) || (lastSlab >= vdo->slabCount)) {
+    warnx("VDO has only %u slabs, cannot iterate slabs %u to %u",
+          vdo->slabCount, firstSlab, lastSlab);
+    return VDO_OUT_OF_RANGE;
+  }
+
+  RefCountIterator *iterator;
+  int result = UDS_ALLOCATE(1, RefCountIterator, __func__, &iterator);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  const struct slab_config *config = &vdo->states.slab_depot.slab_config;
+  *iterator = (RefCountIterator) {
+    .vdo            = vdo,
+    .nextSlab       = firstSlab,
+    .lastSlab       = lastSlab,
+    .batchStart     = firstSlab,
+    .refCountBlocks = config->reference_count_blocks,
+  };
+
+  size_t batchBytes
+    = REF_COUNT_BATCH_SLABS * iterator->refCountBlocks * VDO_BLOCK_SIZE;
+  result = vdo->layer->allocateIOBuffer(vdo->layer, batchBytes,
+                                        "reference count blocks",
+                                        &iterator->buffer);
+  if (result == VDO_SUCCESS) {
+    result = UDS_ALLOCATE(config->data_blocks, vdo_refcount_t, __func__,
+                          &iterator->counts);
+  }
+
+  if (result != VDO_SUCCESS) {
+    freeRefCountIterator(&iterator);
+    return result;
+  }
+
+  *iteratorPtr = iterator;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Read the reference blocks of the next batch of slabs, starting with the
+ * next slab to be produced.
+ *
+ * @param iterator  The iterator
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int readRefCountBatch(RefCountIterator *iterator)
+{
+  const struct slab_depot_state_2_0 *depot
+    = &iterator->vdo->states.slab_depot;
+  slab_count_t count
+    = min((slab_count_t) REF_COUNT_BATCH_SLABS,
+          (slab_count_t) (iterator->lastSlab - iterator->nextSlab + 1));
+  for (slab_count_t i = 0; i < count; i++) {
+    physical_block_number_t slabOrigin
+      = (depot->first_block
+         + ((iterator->nextSlab + i) * depot->slab_config.slab_blocks));
+    iterator->reads[i] = (struct extent_read) {
+      .start_block = slabOrigin + depot->slab_config.data_blocks,
+      .block_count = iterator->refCountBlocks,
+      .buffer      = (iterator->buffer
+                      + (i * iterator->refCountBlocks * VDO_BLOCK_SIZE)),
+    };
+  }
+
+  iterator->batchStart = iterator->nextSlab;
+  iterator->batchCount = 0;
+  PhysicalLayer *layer = iterator->vdo->layer;
+  int result = layer->readExtents(layer, iterator->reads, count, NULL, NULL);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  iterator->batchCount = count;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int getNextSlabRefCounts(RefCountIterator     *iterator,
+                         const SlabRefCounts **slabPtr)
+{
+  if (iterator->nextSlab > iterator->lastSlab) {
+    *slabPtr = NULL;
+    return VDO_SUCCESS;
+  }
+
+  if (iterator->nextSlab >= (iterator->batchStart + iterator->batchCount)) {
+    int result = readRefCountBatch(iterator);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  const struct slab_depot_state_2_0 *depot
+    = &iterator->vdo->states.slab_depot;
+  slab_count_t index = iterator->nextSlab - iterator->batchStart;
+  unpackReferenceCounts(iterator->reads[index].buffer,
+                        depot->slab_config.data_blocks, iterator->counts);
+  iterator->slab = (SlabRefCounts) {
+    .slabNumber = iterator->nextSlab,
+    .slabOrigin = (depot->first_block
+                   + (iterator->nextSlab * depot->slab_config.slab_blocks)),
+    .dataBlocks = depot->slab_config.data_blocks,
+    .counts     = iterator->counts,
+  };
+  iterator->nextSlab++;
+  *slabPtr = &iterator->slab;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+void freeRefCountIterator(RefCountIterator **iteratorPtr)
+{
+  RefCountIterator *iterator = *iteratorPtr;
+  if (iterator == NULL) {
+    return;
+  }
+
+  UDS_FREE(iterator->buffer);
+  UDS_FREE(iterator->counts);
+  UDS_FREE(iterator);
+  *iteratorPtr = NULL;
+}
+
+/**********************************************************************/
+int makeRecoveryJournalIterator(UserVDO                  *vdo,
+                                RecoveryJournalIterator **iteratorPtr)
+{
+  struct partition *partition;
+  int result = vdo_get_partition(vdo->states.layout,
+                                 RECOVERY_JOURNAL_PARTITION, &partition);
+  if (result != VDO_SUCCESS) {
+    warnx("Could not find recovery journal partition");
+    return result;
+  }
+
+  RecoveryJournalIterator *iterator;
+  result = UDS_ALLOCATE(1, RecoveryJournalIterator, __func__, &iterator);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  *iterator = (RecoveryJournalIterator) {
+    .vdo           = vdo,
+    .journalOrigin = get_vdo_fixed_layout_partition_offset(partition),
+    .journalSize   = vdo->states.vdo.config.recovery_journal_size,
+  };
+
+  result = vdo->layer->allocateIOBuffer(vdo->layer,
+                                        (RECOVERY_BATCH_BLOCKS
+                                         * VDO_BLOCK_SIZE),
+                                        "recovery journal blocks",
+                                        &iterator->buffer);
+  if (result != VDO_SUCCESS) {
+    freeRecoveryJournalIterator(&iterator);
+    return result;
+  }
+
+  *iteratorPtr = iterator;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Decode a recovery journal block which was written by the VDO, keeping
+ * only the entries in sectors which were written along with the header.
+ *
+ * @param packed  The packed block
+ * @param header  The unpacked header of the block
+ * @param block   The block to fill in
+ **/
+static void decodeWrittenBlock(struct packed_journal_header       *packed,
+                               const struct recovery_block_header *header,
+                               RecoveryJournalBlock               *block)
+{
+  block->header = *header;
+  decodeRecoveryJournalBlock(packed, &block->entries);
+
+  uint8_t torn = VDO_SECTORS_PER_BLOCK;
+  for (uint8_t i = 1; i < VDO_SECTORS_PER_BLOCK; i++) {
+    struct packed_journal_sector *sector
+      = get_vdo_journal_block_sector(packed, i);
+    if (!is_valid_vdo_recovery_journal_sector(header, sector)) {
+      torn = i;
+      break;
+    }
+  }
+
+  // The entries fill the sectors in order, so they stop at the first sector
+  // which was not written with the header.
+  journal_entry_count_t count = 0;
+  while ((count < block->entries.count)
+         && (block->entries.sectors[count] < torn)) {
+    count++;
+  }
+
+  block->entries.count = count;
+}
+
+/**********************************************************************/
+int getNextRecoveryJournalBlock(RecoveryJournalIterator     *iterator,
+                                const RecoveryJournalBlock **blockPtr)
+{
+  PhysicalLayer *layer = iterator->vdo->layer;
+  while (iterator->nextBlock < iterator->journalSize) {
+    if (iterator->nextBlock >= (iterator->batchStart + iterator->batchCount)) {
+      block_count_t count
+        = min((block_count_t) RECOVERY_BATCH_BLOCKS,
+              iterator->journalSize - iterator->nextBlock);
+      iterator->batchStart = iterator->nextBlock;
+      iterator->batchCount = 0;
+      int result = layer->reader(layer,
+                                 iterator->journalOrigin + iterator->nextBlock,
+                                 count, iterator->buffer);
+      if (result != VDO_SUCCESS) {
+        return result;
+      }
+
+      iterator->batchCount = count;
+    }
+
+    block_count_t offset = iterator->nextBlock++;
+    struct packed_journal_header *packed
+      = (struct packed_journal_header *)
+      (iterator->buffer + ((offset - iterator->batchStart) * VDO_BLOCK_SIZE));
+    struct recovery_block_header header;
+    unpack_vdo_recovery_block_header(packed, &header);
+    if ((header.metadata_type != VDO_METADATA_RECOVERY_JOURNAL)
+        || (header.nonce != iterator->vdo->states.vdo.nonce)) {
+      // The block has never been written by this volume.
+      continue;
+    }
+
+    iterator->block.pbn = iterator->journalOrigin + offset;
+    decodeWrittenBlock(packed, &header, &iterator->block);
+    *blockPtr = &iterator->block;
+    return VDO_SUCCESS;
+  }
+
+  *blockPtr = NULL;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+void freeRecoveryJournalIterator(RecoveryJournalIterator **iteratorPtr)
+{
+  RecoveryJournalIterator *iterator = *iteratorPtr;
+  if (iterator == NULL) {
+    return;
+  }
+
+  UDS_FREE(iterator->buffer);
+  UDS_FREE(iterator);
+  *iteratorPtr = NULL;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/metadataIterators.h#1 $
+ */
+
+#ifndef METADATA_ITERATORS_H
+#define METADATA_ITERATORS_H
+
+#include "packedRecoveryJournalBlock.h"
+#include "packedReferenceBlock.h"
+#include "types.h"
+
+#include "journalDecoder.h"
+#include "userVDO.h"
+
+/**
+ * Pull-style iterators over the slab reference counts and the recovery
+ * journal of a VDO, for programs which link libvdo to analyze its metadata
+ * rather than parsing the output of the dump tools. Each iterator reads the
+ * metadata in large batches and hands back decoded results one item at a
+ * time; the results remain valid until the next call on the iterator. The
+ * block map has a similar iterator in blockMapUtils.h, and the slab summary
+ * is read whole by readSlabSummary().
+ **/
+
+/** The reference counts of one slab, as produced by a RefCountIterator */
+typedef struct {
+  /** The number of the slab */
+  slab_count_t             slabNumber;
+  /** The PBN of the first data block of the slab */
+  physical_block_number_t  slabOrigin;
+  /** The number of data blocks in the slab */
+  block_count_t            dataBlocks;
+  /** The stored reference count of each data block */
+  const vdo_refcount_t    *counts;
+} SlabRefCounts;
+
+typedef struct refCountIterator RefCountIterator;
+
+/**
+ * Make an iterator over the stored reference counts of a range of slabs.
+ *
+ * @param [in]  vdo          The VDO, which must outlive the iterator
+ * @param [in]  firstSlab    The first slab to iterate over
+ * @param [in]  lastSlab     The last slab to iterate over
+ * @param [out] iteratorPtr  A pointer to hold the iterator
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check makeRefCountIterator(UserVDO           *vdo,
+                                      slab_count_t       firstSlab,
+                                      slab_count_t       lastSlab,
+                                      RefCountIterator **iteratorPtr);
+
+/**
+ * Get the reference counts of the next slab from an iterator.
+ *
+ * @param [in]  iterator  The iterator
+ * @param [out] slabPtr   A pointer to hold the counts of the next slab, or
+ *                        NULL once every slab has been produced
+ *
+ * @return VDO_SUCCESS or an error code; after an error, the iterator may
+ *         only be freed
+ **/
+int __must_check getNextSlabRefCounts(RefCountIterator     *iterator,
+                                      const SlabRefCounts **slabPtr);
+
+/**
+ * Free a reference count iterator and null out the reference to it.
+ *
+ * @param iteratorPtr  A pointer to the iterator to free
+ **/
+void freeRefCountIterator(RefCountIterator **iteratorPtr);
+
+/**
+ * Unpack the counts from a run of reference count blocks.
+ *
+ * @param [in]  blocks      The packed reference count blocks
+ * @param [in]  dataBlocks  The number of counts to unpack
+ * @param [out] counts      An array to hold the counts
+ **/
+void unpackReferenceCounts(const char     *blocks,
+                           block_count_t   dataBlocks,
+                           vdo_refcount_t *counts);
+
+/**
+ * A recovery journal block written by the VDO, as produced by a
+ * RecoveryJournalIterator.
+ **/
+typedef struct {
+  /** The PBN of the block */
+  physical_block_number_t       pbn;
+  /** The unpacked block header */
+  struct recovery_block_header  header;
+  /**
+   * The entries of the block. Only the entries in sectors which were
+   * written along with the header are included, as recovery would use.
+   **/
+  RecoveryBlockEntries          entries;
+} RecoveryJournalBlock;
+
+typedef struct recoveryJournalIterator RecoveryJournalIterator;
+
+/**
+ * Make an iterator over the recovery journal blocks of a VDO. The blocks
+ * are produced in the order they are stored, not in sequence number order,
+ * and blocks which have never been written by this VDO are skipped.
+ *
+ * @param [in]  vdo          The VDO, which must outlive the iterator
+ * @param [out] iteratorPtr  A pointer to hold the iterator
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check
+makeRecoveryJournalIterator(UserVDO                  *vdo,
+                            RecoveryJournalIterator **iteratorPtr);
+
+/**
+ * Get the next recovery journal block from an iterator.
+ *
+ * @param [in]  iterator  The iterator
+ * @param [out] blockPtr  A pointer to hold the next block, or NULL once the
+ *                        whole journal has been read
+ *
+ * @return VDO_SUCCESS or an error code; after an error, the iterator may
+ *         only be freed
+ **/
+int __must_check
+getNextRecoveryJournalBlock(RecoveryJournalIterator     *iterator,
+                            const RecoveryJournalBlock **blockPtr);
+
+/**
+ * Free a recovery journal iterator and null out the reference to it.
+ *
+ * @param iteratorPtr  A pointer to the iterator to free
+ **/
+void freeRecoveryJournalIterator(RecoveryJournalIterator **iteratorPtr);
+
+#endif // METADATA_ITERATORS_H
@@ -0,0 +1,460 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/metricsServer.c#1 $
+ */
+
+
+#include "metricsServer.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "memoryAlloc.h"
+
+#include "statistics.h"
+#include "statusCodes.h"
+
+#include "dmControl.h"
+#include "vdoStats.h"
+
+enum {
+  LISTEN_BACKLOG  = 16,
+  /** The most of a request which is read; only the request line matters */
+  REQUEST_BYTES   = 8192,
+  /** How long a client may take to send its request */
+  REQUEST_SECONDS = 5,
+};
+
+static const char METRICS_CONTENT_TYPE[]
+  = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+/** One device's statistics as formatted by visit_vdo_stats() */
+typedef struct {
+  const char  *name;
+  size_t       count;
+  /** The label and value of each statistic, in the order visited */
+  char       **labels;
+  char       **values;
+} DeviceSamples;
+
+/**
+ * Record a statistic of a device.
+ *
+ * Implements vdo_stats_visitor.
+ **/
+static void recordSample(const char *label, const char *value, void *context)
+{
+  DeviceSamples *samples = context;
+  char *labelCopy = NULL;
+  char *valueCopy = NULL;
+  if ((uds_duplicate_string(label, __func__, &labelCopy) != UDS_SUCCESS)
+      || (uds_duplicate_string(value, __func__, &valueCopy) != UDS_SUCCESS)
+      || (uds_reallocate_memory(samples->labels,
+                                samples->count * sizeof(char *),
+                                (samples->count + 1) * sizeof(char *),
+                                __func__, &samples->labels) != UDS_SUCCESS)
+      || (uds_reallocate_memory(samples->values,
+                                samples->count * sizeof(char *),
+                                (samples->count + 1) * sizeof(char *),
+                                __func__, &samples->values) != UDS_SUCCESS)) {
+    // Leave the statistic out rather than abandon the scrape.
+    UDS_FREE(labelCopy);
+    UDS_FREE(valueCopy);
+    return;
+  }
+
+  samples->labels[samples->count] = labelCopy;
+  samples->values[samples->count] = valueCopy;
+  samples->count++;
+}
+
+/**********************************************************************/
+static void freeSamples(DeviceSamples *samples)
+{
+  for (size_t i = 0; i < samples->count; i++) {
+    UDS_FREE(samples->labels[i]);
+    UDS_FREE(samples->values[i]);
+  }
+  UDS_FREE(samples->labels);
+  UDS_FREE(samples->values);
+}
+
+/**
+ * Write the OpenMetrics name for a statistic: its label in lower case,
+ * with each run of other characters replaced by an underscore.
+ **/
+static void writeMetricName(FILE *out, const char *label)
+{
+  fputs("vdo", out);
+  bool separate = true;
+  for (const char *c = label; *c != '\0'; c++) {
+    if (!isalnum((unsigned char) *c)) {
+      separate = true;
+      continue;
+    }
+
+    if (separate) {
+      fputc('_', out);
+      separate = false;
+    }
+    fputc(tolower((unsigned char) *c), out);
+  }
+}
+
+/**
+ * Write a string as an OpenMetrics label value.
+ **/
+static void writeLabelValue(FILE *out, const char *value)
+{
+  fputc('"', out);
+  for (const char *c = value; *c != '\0'; c++) {
+    if (*c == '\n') {
+      fputs("\\n", out);
+      continue;
+    }
+
+    if ((*c == '"') || (*c == '\\')) {
+      fputc('\\', out);
+    }
+    fputc(*c, out);
+  }
+  fputc('"', out);
+}
+
+/**
+ * Check whether a formatted statistic is a number.
+ **/
+static bool isNumber(const char *value)
+{
+  char *end;
+  strtod(value, &end);
+  return ((end != value) && (*end == '\0'));
+}
+
+/**
+ * Write the statistics of some devices. All devices report the same
+ * statistics in the same order, so each metric family is written in turn
+ * with a sample from each device. Values which are not numbers, such as
+ * the operating mode, become a label on a sample of 1, and values which
+ * are not available are left out.
+ **/
+static void writeMetrics(FILE *out, DeviceSamples *devices, size_t count)
+{
+  size_t fields = ((count == 0) ? 0 : devices[0].count);
+  for (size_t field = 0; field < fields; field++) {
+    fputs("# TYPE ", out);
+    writeMetricName(out, devices[0].labels[field]);
+    fputs(" unknown\n", out);
+    for (size_t i = 0; i < count; i++) {
+      if ((devices[i].count <= field)
+          || (strcmp(devices[i].labels[field], devices[0].labels[field]) != 0)
+          || (strcmp(devices[i].values[field], "N/A") == 0)) {
+        continue;
+      }
+
+      const char *value = devices[i].values[field];
+      writeMetricName(out, devices[0].labels[field]);
+      fputs("{device=", out);
+      writeLabelValue(out, devices[i].name);
+      if (isNumber(value)) {
+        fprintf(out, "} %s\n", value);
+      } else {
+        fputs(",value=", out);
+        writeLabelValue(out, value);
+        fputs("} 1\n", out);
+      }
+    }
+  }
+
+  fputs("# EOF\n", out);
+}
+
+/**
+ * Collect the statistics of every VDO device and format them.
+ *
+ * @param [in]  control  The device-mapper control file descriptor
+ * @param [out] bodyPtr  A pointer to hold the formatted metrics, which must
+ *                       be freed with free()
+ * @param [out] sizePtr  A pointer to hold the size of the metrics
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int collectMetrics(int control, char **bodyPtr, size_t *sizePtr)
+{
+  DMDevice *devices;
+  size_t count;
+  int result = listDMDevices(control, "vdo", &devices, &count);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  DeviceSamples *samples;
+  result = UDS_ALLOCATE(count, DeviceSamples, __func__, &samples);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(devices);
+    return result;
+  }
+
+  size_t reported = 0;
+  for (size_t i = 0; i < count; i++) {
+    char *message;
+    if (sendDMMessage(control, devices[i].name, "stats", &message)
+        != VDO_SUCCESS) {
+      // The device may have gone away since it was listed.
+      continue;
+    }
+
+    struct vdo_statistics stats;
+    if ((message[0] != '\0')
+        && (read_vdo_stats(message, &stats) == VDO_SUCCESS)) {
+      samples[reported].name = devices[i].name;
+      if (visit_vdo_stats(&stats, recordSample, &samples[reported])
+          == VDO_SUCCESS) {
+        reported++;
+      } else {
+        freeSamples(&samples[reported]);
+        samples[reported] = (DeviceSamples) { .name = NULL };
+      }
+    }
+    UDS_FREE(message);
+  }
+
+  FILE *out = open_memstream(bodyPtr, sizePtr);
+  if (out == NULL) {
+    result = errno;
+  } else {
+    writeMetrics(out, samples, reported);
+    if (fclose(out) != 0) {
+      result = errno;
+    }
+  }
+
+  for (size_t i = 0; i < reported; i++) {
+    freeSamples(&samples[i]);
+  }
+  UDS_FREE(samples);
+  UDS_FREE(devices);
+  return result;
+}
+
+/**
+ * Send all of a buffer to a client.
+ **/
+static int sendAll(int client, const char *data, size_t size)
+{
+  while (size > 0) {
+    ssize_t sent = send(client, data, size, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+
+    data += sent;
+    size -= sent;
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Send an HTTP response to a client.
+ **/
+static void sendResponse(int         client,
+                         const char *status,
+                         const char *contentType,
+                         const char *body,
+                         size_t      size)
+{
+  char header[256];
+  int length = snprintf(header, sizeof(header),
+                        "HTTP/1.0 %s\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: close\r\n"
+                        "\r\n",
+                        status, contentType, size);
+  if (sendAll(client, header, length) == VDO_SUCCESS) {
+    sendAll(client, body, size);
+  }
+}
+
+/**
+ * Read a client's request and answer it.
+ **/
+static void handleClient(int client, int control)
+{
+  struct timeval timeout = { .tv_sec = REQUEST_SECONDS };
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  // Read until the end of the request line; the headers don't matter.
+  char request[REQUEST_BYTES];
+  size_t size = 0;
+  while ((size < sizeof(request) - 1)
+         && (memchr(request, '\n', size) == NULL)) {
+    ssize_t n = recv(client, request + size, sizeof(request) - 1 - size, 0);
+    if (n <= 0) {
+      if ((n < 0) && (errno == EINTR)) {
+        continue;
+      }
+      return;
+    }
+    size += n;
+  }
+  request[size] = '\0';
+
+  static const char TEXT[] = "text/plain; charset=utf-8";
+  bool head = (strncmp(request, "HEAD ", 5) == 0);
+  if ((strncmp(request, "GET ", 4) != 0) && !head) {
+    static const char BODY[] = "Method not allowed\n";
+    sendResponse(client, "405 Method Not Allowed", TEXT, BODY,
+                 sizeof(BODY) - 1);
+    return;
+  }
+
+  const char *path = request + (head ? 5 : 4);
+  size_t pathLength = strcspn(path, " ?\r\n");
+  if ((pathLength != strlen("/metrics"))
+      || (strncmp(path, "/metrics", pathLength) != 0)) {
+    static const char BODY[] = "Not found\n";
+    sendResponse(client, "404 Not Found", TEXT, BODY, sizeof(BODY) - 1);
+    return;
+  }
+
+  char *body = NULL;
+  size_t bodySize = 0;
+  int result = collectMetrics(control, &body, &bodySize);
+  if (result != VDO_SUCCESS) {
+    static const char BODY[] = "Could not collect VDO statistics\n";
+    sendResponse(client, "500 Internal Server Error", TEXT, BODY,
+                 sizeof(BODY) - 1);
+  } else {
+    sendResponse(client, "200 OK", METRICS_CONTENT_TYPE, body,
+                 (head ? 0 : bodySize));
+  }
+  free(body);
+}
+
+/**
+ * Open a listening socket on an address of the form [<host>]:<port>.
+ **/
+static int openListener(const char *address, int *listenerPtr)
+{
+  const char *colon = strrchr(address, ':');
+  if (colon == NULL) {
+    return uds_log_error_strerror(EINVAL, "address %s has no port",
+                                  address);
+  }
+
+  char *host;
+  int result = uds_duplicate_string(address, __func__, &host);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  host[colon - address] = '\0';
+  char *hostName = host;
+  size_t hostLength = strlen(hostName);
+  if ((hostLength >= 2) && (hostName[0] == '[')
+      && (hostName[hostLength - 1] == ']')) {
+    hostName[hostLength - 1] = '\0';
+    hostName++;
+  }
+
+  struct addrinfo hints = {
+    .ai_family   = AF_UNSPEC,
+    .ai_socktype = SOCK_STREAM,
+    .ai_flags    = AI_PASSIVE,
+  };
+  struct addrinfo *addresses;
+  int status = getaddrinfo(((*hostName == '\0') ? NULL : hostName),
+                           colon + 1, &hints, &addresses);
+  if (status != 0) {
+    uds_log_error("cannot resolve %s: %s", address, gai_strerror(status));
+    UDS_FREE(host);
+    return EINVAL;
+  }
+
+  result = EADDRNOTAVAIL;
+  for (struct addrinfo *a = addresses; a != NULL; a = a->ai_next) {
+    int listener = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC,
+                          a->ai_protocol);
+    if (listener < 0) {
+      result = errno;
+      continue;
+    }
+
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if ((bind(listener, a->ai_addr, a->ai_addrlen) == 0)
+        && (listen(listener, LISTEN_BACKLOG) == 0)) {
+      *listenerPtr = listener;
+      result = VDO_SUCCESS;
+      break;
+    }
+
+    result = errno;
+    close(listener);
+  }
+
+  freeaddrinfo(addresses);
+  UDS_FREE(host);
+  if (result != VDO_SUCCESS) {
+    return uds_log_error_strerror(result, "cannot listen on %s", address);
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int serveVDOMetrics(const char *address, int control)
+{
+  int listener = -1;
+  int result = openListener(address, &listener);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  for (;;) {
+    int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0) {
+      if ((errno == EINTR) || (errno == ECONNABORTED)) {
+        continue;
+      }
+
+      result = uds_log_error_strerror(errno, "accept on %s", address);
+      break;
+    }
+
+    handleClient(client, control);
+    close(client);
+  }
+
+  close(listener);
+  return result;
+}
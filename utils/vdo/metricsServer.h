@@ -0,0 +1,44 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/metricsServer.h#1 $
+ */
+
+
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include "compiler.h"
+
+/**
+ * Serve the statistics of every VDO device in the OpenMetrics text format
+ * over HTTP, until an error occurs. The statistics are collected afresh
+ * for each request for /metrics, using the device-mapper control device,
+ * and are named after the labels vdostats --verbose uses, so that "bios in
+ * write" becomes vdo_bios_in_write. Each sample is labeled with the name
+ * of its device.
+ *
+ * @param address  The address to listen on, as [<host>]:<port>; an IPv6
+ *                 host may be given in brackets
+ * @param control  The device-mapper control file descriptor
+ *
+ * @return An error code
+ **/
+int __must_check serveVDOMetrics(const char *address, int control);
+
+#endif // METRICS_SERVER_H
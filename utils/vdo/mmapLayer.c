@@ -0,0 +1,312 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/mmapLayer.c#1 $
+ */
+
+#include "mmapLayer.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fileUtils.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "permassert.h"
+#include "syscalls.h"
+
+#include "constants.h"
+#include "statusCodes.h"
+
+typedef struct {
+  PhysicalLayer  common;
+  block_count_t  blockCount;
+  /** The mapping of the whole file */
+  char          *data;
+  size_t         bytes;
+  char           name[];
+} MmapLayer;
+
+/**********************************************************************/
+static inline MmapLayer *asMmapLayer(PhysicalLayer *layer)
+{
+  STATIC_ASSERT(offsetof(MmapLayer, common) == 0);
+  return (MmapLayer *) layer;
+}
+
+/**********************************************************************/
+static block_count_t getBlockCount(PhysicalLayer *header)
+{
+  return asMmapLayer(header)->blockCount;
+}
+
+/**
+ * Check that an extent lies within the mapped file.
+ *
+ * @param layer       The layer
+ * @param startBlock  The start of the extent
+ * @param blockCount  The length of the extent
+ *
+ * @return VDO_SUCCESS or VDO_OUT_OF_RANGE
+ **/
+static int checkExtent(MmapLayer               *layer,
+                       physical_block_number_t  startBlock,
+                       size_t                   blockCount)
+{
+  if ((startBlock > layer->blockCount)
+      || (blockCount > layer->blockCount - startBlock)) {
+    return VDO_OUT_OF_RANGE;
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+static int allocateIOBuffer(PhysicalLayer  *header __attribute__((unused)),
+                            size_t          bytes,
+                            const char     *why,
+                            char          **bufferPtr)
+{
+  return uds_allocate_memory(bytes, VDO_BLOCK_SIZE, why, bufferPtr);
+}
+
+/**********************************************************************/
+static void returnIOBuffer(PhysicalLayer *header __attribute__((unused)),
+                           size_t         bytes __attribute__((unused)),
+                           char          *buffer)
+{
+  UDS_FREE(buffer);
+}
+
+/**
+ * Implements extent_reader.
+ **/
+static int mmapReader(PhysicalLayer           *header,
+                      physical_block_number_t  startBlock,
+                      size_t                   blockCount,
+                      char                    *buffer)
+{
+  MmapLayer *layer = asMmapLayer(header);
+  int result = checkExtent(layer, startBlock, blockCount);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  memcpy(buffer, layer->data + (startBlock * VDO_BLOCK_SIZE),
+         blockCount * VDO_BLOCK_SIZE);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Implements batch_extent_reader.
+ **/
+static int mmapBatchReader(PhysicalLayer        *header,
+                           struct extent_read   *extents,
+                           size_t                count,
+                           extent_read_callback *callback,
+                           void                 *context)
+{
+  int firstError = VDO_SUCCESS;
+  for (size_t i = 0; i < count; i++) {
+    struct extent_read *extent = &extents[i];
+    extent->result = mmapReader(header, extent->start_block,
+                                extent->block_count, extent->buffer);
+    if (firstError == VDO_SUCCESS) {
+      firstError = extent->result;
+    }
+
+    if (callback != NULL) {
+      callback(extent, context);
+    }
+  }
+
+  return firstError;
+}
+
+/**
+ * Implements extent_mapper.
+ **/
+static int mmapMapper(PhysicalLayer            *header,
+                      physical_block_number_t   startBlock,
+                      size_t                    blockCount,
+                      char                    **dataPtr)
+{
+  MmapLayer *layer = asMmapLayer(header);
+  int result = checkExtent(layer, startBlock, blockCount);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  *dataPtr = layer->data + (startBlock * VDO_BLOCK_SIZE);
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+static int noWriter(PhysicalLayer           *header __attribute__((unused)),
+                    physical_block_number_t  startBlock
+                    __attribute__((unused)),
+                    size_t                   blockCount
+                    __attribute__((unused)),
+                    char                    *buffer __attribute__((unused)))
+{
+  return EPERM;
+}
+
+/**********************************************************************/
+static int noZeroer(PhysicalLayer           *header __attribute__((unused)),
+                    physical_block_number_t  startBlock
+                    __attribute__((unused)),
+                    size_t                   blockCount
+                    __attribute__((unused)))
+{
+  return EPERM;
+}
+
+/**
+ * Pass access advice on to the kernel as madvise() hints.
+ *
+ * Implements access_advisor.
+ **/
+static void mmapAdvisor(PhysicalLayer           *header,
+                        physical_block_number_t  startBlock,
+                        block_count_t            blockCount,
+                        enum access_pattern      pattern)
+{
+  MmapLayer *layer = asMmapLayer(header);
+  if (startBlock >= layer->blockCount) {
+    return;
+  }
+
+  int advice;
+  switch (pattern) {
+  case ACCESS_SEQUENTIAL:
+    advice = MADV_SEQUENTIAL;
+    break;
+
+  case ACCESS_RANDOM:
+    advice = MADV_RANDOM;
+    break;
+
+  case ACCESS_WILL_NEED:
+    advice = MADV_WILLNEED;
+    break;
+
+  case ACCESS_DONT_NEED:
+    // MADV_DONTNEED would discard any changes made through the mapping.
+    return;
+
+  default:
+    advice = MADV_NORMAL;
+  }
+
+  blockCount = min(blockCount, layer->blockCount - startBlock);
+  if (madvise(layer->data + (startBlock * VDO_BLOCK_SIZE),
+              blockCount * VDO_BLOCK_SIZE, advice) != 0) {
+    // Advice is only a hint, so failing to give it is not an error.
+    uds_log_debug("madvise on %s failed: %s", layer->name, strerror(errno));
+  }
+}
+
+/**********************************************************************/
+static void vacuousFlush(struct vdo_flush *vdoFlush __attribute__((unused)))
+{
+}
+
+/**
+ * Free an MmapLayer and NULL out the reference to it.
+ *
+ * Implements layer_destructor.
+ **/
+static void freeLayer(PhysicalLayer **layerPtr)
+{
+  PhysicalLayer *header = *layerPtr;
+  if (header == NULL) {
+    return;
+  }
+
+  MmapLayer *layer = asMmapLayer(header);
+  if (layer->data != NULL) {
+    munmap(layer->data, layer->bytes);
+  }
+
+  UDS_FREE(layer);
+  *layerPtr = NULL;
+}
+
+/**********************************************************************/
+int makeMmapLayer(const char *name, PhysicalLayer **layerPtr)
+{
+  int fd;
+  int result = open_file(name, FU_READ_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  struct stat statbuf;
+  result = logging_fstat(fd, &statbuf, __func__);
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  if (!S_ISREG(statbuf.st_mode) || (statbuf.st_size < VDO_BLOCK_SIZE)) {
+    try_close_file(fd);
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  MmapLayer *layer;
+  result = UDS_ALLOCATE_EXTENDED(MmapLayer, strlen(name) + 1, char,
+                                 "mmap layer", &layer);
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  strcpy(layer->name, name);
+  layer->blockCount = statbuf.st_size / VDO_BLOCK_SIZE;
+  layer->bytes      = layer->blockCount * VDO_BLOCK_SIZE;
+  // A private writable mapping lets callers scribble on mapped blocks (from
+  // a debugger, say) without changing the file.
+  void *data = mmap(NULL, layer->bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+  try_close_file(fd);
+  if (data == MAP_FAILED) {
+    uds_log_debug("cannot map %s: %s", name, strerror(errno));
+    UDS_FREE(layer);
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  layer->data                    = data;
+  layer->common.destroy          = freeLayer;
+  layer->common.getBlockCount    = getBlockCount;
+  layer->common.allocateIOBuffer = allocateIOBuffer;
+  layer->common.borrowIOBuffer   = allocateIOBuffer;
+  layer->common.returnIOBuffer   = returnIOBuffer;
+  layer->common.reader           = mmapReader;
+  layer->common.writer           = noWriter;
+  layer->common.readExtents      = mmapBatchReader;
+  layer->common.zeroExtent       = noZeroer;
+  layer->common.advise           = mmapAdvisor;
+  layer->common.mapExtent        = mmapMapper;
+  layer->common.completeFlush    = vacuousFlush;
+
+  *layerPtr = &layer->common;
+  return VDO_SUCCESS;
+}
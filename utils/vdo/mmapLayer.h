@@ -0,0 +1,41 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/mmapLayer.h#1 $
+ */
+
+#ifndef MMAP_LAYER_H
+#define MMAP_LAYER_H
+
+#include "physicalLayer.h"
+
+/**
+ * Make a read-only physical layer which maps a whole regular file, such as
+ * a metadata dump, into memory. Reads are copies from the mapping, and the
+ * layer's mapExtent() method hands out pointers into it so that callers can
+ * avoid the copies altogether.
+ *
+ * @param [in]  name      The name of the file to map
+ * @param [out] layerPtr  A pointer to hold the new layer
+ *
+ * @return VDO_SUCCESS, VDO_NOT_IMPLEMENTED if the file is not a regular file
+ *         which can be mapped, or another error code
+ **/
+int __must_check makeMmapLayer(const char *name, PhysicalLayer **layerPtr);
+
+#endif // MMAP_LAYER_H
@@ -70,6 +70,34 @@ typedef int buffer_allocator(PhysicalLayer *layer,
 			     const char *why,
 			     char **buffer_ptr);
 
+/**
+ * A function which can lend out a buffer suitable for use in an
+ * extent_reader or extent_writer. Unlike a buffer_allocator, the layer may
+ * satisfy the request from buffers which were previously returned to it, so
+ * the contents of the buffer are undefined. The buffer must be given back
+ * with the layer's buffer_returner rather than freed.
+ *
+ * @param [in]  layer       The physical layer in question
+ * @param [in]  bytes       The size of the buffer, in bytes.
+ * @param [in]  why         The occasion for borrowing the buffer
+ * @param [out] buffer_ptr  A pointer to hold the buffer
+ *
+ * @return a success or error code
+ **/
+typedef int buffer_borrower(PhysicalLayer *layer,
+			    size_t bytes,
+			    const char *why,
+			    char **buffer_ptr);
+
+/**
+ * A function which takes back a buffer lent out by a buffer_borrower.
+ *
+ * @param layer   The physical layer which lent out the buffer
+ * @param bytes   The size the buffer was borrowed with
+ * @param buffer  The buffer to return (may be NULL)
+ **/
+typedef void buffer_returner(PhysicalLayer *layer, size_t bytes, char *buffer);
+
 /**
  * A function which can read an extent from a physicalLayer.
  *
@@ -102,6 +130,174 @@ typedef int extent_writer(PhysicalLayer *layer,
 			  size_t blockCount,
 			  char *buffer);
 
+/**
+ * A function which can zero an extent of a physicalLayer without writing
+ * buffers of zeros to it, for example by asking the device or file system to
+ * do it.
+ *
+ * @param layer       The physical layer to zero
+ * @param startBlock  The physical block number of the start of the extent
+ * @param blockCount  The number of blocks in the extent
+ *
+ * @return VDO_SUCCESS, VDO_NOT_IMPLEMENTED if the layer can not zero the
+ *         extent this way, or another error code
+ **/
+typedef int extent_zeroer(PhysicalLayer *layer,
+			  physical_block_number_t startBlock,
+			  size_t blockCount);
+
+/**
+ * A function which gives direct access to an extent of a physicalLayer
+ * without copying it, for layers which can do so. The data is a private
+ * copy-on-write view of the layer: it may be modified, but changes are never
+ * written back. It remains valid until the layer is destroyed.
+ *
+ * @param [in]  layer       The physical layer to map
+ * @param [in]  startBlock  The physical block number of the start of the
+ *                          extent
+ * @param [in]  blockCount  The number of blocks in the extent
+ * @param [out] dataPtr     A pointer to hold the address of the extent
+ *
+ * @return a success or error code
+ **/
+typedef int extent_mapper(PhysicalLayer *layer,
+			  physical_block_number_t startBlock,
+			  size_t blockCount,
+			  char **dataPtr);
+
+/**
+ * A function which copies an extent of a physicalLayer to a file descriptor
+ * inside the kernel, without passing the data through a user buffer, for
+ * layers which can do so.
+ *
+ * @param [in]     layer       The physical layer to copy from
+ * @param [in]     startBlock  The physical block number of the start of the
+ *                             extent
+ * @param [in]     blockCount  The number of blocks in the extent
+ * @param [in]     fd          The file descriptor to copy to
+ * @param [in,out] offsetPtr   The offset in fd at which to write the extent,
+ *                             which is advanced past it, or NULL to write at
+ *                             the file position of fd
+ *
+ * @return a success or error code, VDO_NOT_IMPLEMENTED if nothing has been
+ *         copied because the kernel cannot copy between the two files
+ **/
+typedef int extent_copier(PhysicalLayer *layer,
+			  physical_block_number_t startBlock,
+			  size_t blockCount,
+			  int fd,
+			  off_t *offsetPtr);
+
+/**
+ * The ways in which a caller may expect to read an extent of a
+ * physicalLayer.
+ **/
+enum access_pattern {
+	/* No particular expectation; this undoes any earlier advice */
+	ACCESS_NORMAL,
+	/* The extent will be read in order from start to end */
+	ACCESS_SEQUENTIAL,
+	/* The extent will be read in no particular order */
+	ACCESS_RANDOM,
+	/* The extent will be read soon, so it may be fetched now */
+	ACCESS_WILL_NEED,
+	/* The extent will not be read again soon */
+	ACCESS_DONT_NEED,
+};
+
+/**
+ * A function which tells a physicalLayer how an extent is about to be read,
+ * so that it can arrange readahead or caching to suit. The advice is only a
+ * hint; layers are free to ignore it and it never affects correctness.
+ *
+ * @param layer       The physical layer which will be read
+ * @param startBlock  The physical block number of the start of the extent
+ * @param blockCount  The number of blocks in the extent
+ * @param pattern     The expected access pattern
+ **/
+typedef void access_advisor(PhysicalLayer *layer,
+			    physical_block_number_t startBlock,
+			    block_count_t blockCount,
+			    enum access_pattern pattern);
+
+enum {
+	/* The number of power-of-two buckets in an I/O latency histogram */
+	IO_LATENCY_BUCKETS = 32,
+};
+
+/**
+ * Counts of the I/O which a physicalLayer has done.
+ **/
+struct io_statistics {
+	/* The number of read operations and the bytes they read */
+	uint64_t reads;
+	uint64_t read_bytes;
+	/* The number of write operations and the bytes they wrote */
+	uint64_t writes;
+	uint64_t write_bytes;
+	/*
+	 * A histogram of operation latencies: bucket 0 counts operations
+	 * which took less than a microsecond, and bucket i counts those
+	 * which took [2^(i-1), 2^i) microseconds. The last bucket also counts
+	 * anything slower.
+	 */
+	uint64_t latency[IO_LATENCY_BUCKETS];
+};
+
+/**
+ * A function to get the I/O counts of a physicalLayer.
+ *
+ * @param [in]  layer  The layer
+ * @param [out] stats  The statistics structure to fill in
+ **/
+typedef void io_statistics_getter(PhysicalLayer *layer,
+				  struct io_statistics *stats);
+
+/**
+ * One extent of a batched read.
+ **/
+struct extent_read {
+	/* The physical block number of the start of the extent */
+	physical_block_number_t start_block;
+	/* The number of blocks in the extent */
+	size_t block_count;
+	/* A buffer to hold the extent */
+	char *buffer;
+	/* The result of reading the extent, set once the read completes */
+	int result;
+};
+
+/**
+ * A function called as each extent of a batched read completes.
+ *
+ * @param extent   The extent which has been read; its result field
+ *                 indicates whether the read succeeded
+ * @param context  The context supplied with the batch
+ **/
+typedef void extent_read_callback(struct extent_read *extent, void *context);
+
+/**
+ * A function which can read many extents from a physicalLayer at once. The
+ * layer is free to issue the reads concurrently and in any order. The
+ * function does not return until every extent has been read or has failed;
+ * if a callback is supplied, it is called once for each extent as that
+ * extent completes, so that callers can process early extents while later
+ * ones are still in flight.
+ *
+ * @param layer     The physical layer from which to read
+ * @param extents   The extents to read
+ * @param count     The number of extents
+ * @param callback  An optional function to call as each extent completes
+ * @param context   The context to pass to the callback
+ *
+ * @return VDO_SUCCESS or the first error from any extent
+ **/
+typedef int batch_extent_reader(PhysicalLayer *layer,
+				struct extent_read *extents,
+				size_t count,
+				extent_read_callback *callback,
+				void *context);
+
 /**
  * A function to destroy a vio. The pointer to the vio will be nulled out.
  *
@@ -258,8 +454,16 @@ struct physicalLayer {
 
 	// Synchronous IO interface
 	buffer_allocator *allocateIOBuffer;
+	buffer_borrower *borrowIOBuffer;
+	buffer_returner *returnIOBuffer;
 	extent_reader *reader;
 	extent_writer *writer;
+	batch_extent_reader *readExtents;
+	extent_zeroer *zeroExtent;
+	access_advisor *advise;
+	io_statistics_getter *getIOStatistics;
+	extent_mapper *mapExtent;
+	extent_copier *copyExtent;
 
 	// Synchronous interfaces (vio-based)
 	data_vio_zeroer *zeroDataVIO;
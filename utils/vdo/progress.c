@@ -0,0 +1,224 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/progress.c#1 $
+ */
+
+
+
+#include "progress.h"
+
+#include <err.h>
+#include <errno.h>
+#include <string.h>
+
+#include "atomicDefs.h"
+#include "timeUtils.h"
+#include "uds-threads.h"
+
+#include "statusCodes.h"
+
+enum {
+  PROGRESS_INTERVAL_SECONDS = 5,
+  // The most characters of a label shown in each report.
+  MAX_LABEL_LENGTH          = 64,
+};
+
+/** The work done in the current phase */
+static atomic64_t      done;
+
+/** Protects everything below */
+static struct mutex    lock;
+static struct cond_var stopped;
+static struct thread  *reporter = NULL;
+static bool            stopping = false;
+static PhysicalLayer  *ioLayer  = NULL;
+static const char     *label    = NULL;
+
+/** The current phase */
+static const char     *phaseName  = NULL;
+static const char     *phaseUnit  = NULL;
+static uint64_t        phaseTotal = 0;
+static ktime_t         phaseStart = 0;
+/** The bytes transferred by the layer when the current phase began */
+static uint64_t        phaseBytes = 0;
+
+/**
+ * Get the number of bytes the layer has read and written.
+ *
+ * @return The number of bytes, or 0 if the layer does not count them
+ **/
+static uint64_t getLayerBytes(void)
+{
+  if ((ioLayer == NULL) || (ioLayer->getIOStatistics == NULL)) {
+    return 0;
+  }
+
+  struct io_statistics stats;
+  ioLayer->getIOStatistics(ioLayer, &stats);
+  return (stats.read_bytes + stats.write_bytes);
+}
+
+/**
+ * Report the progress of the current phase. The caller must hold the lock.
+ **/
+static void reportProgress(void)
+{
+  if (phaseName == NULL) {
+    return;
+  }
+
+  uint64_t count   = atomic64_read(&done);
+  double   seconds = ktime_to_us(ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+                                           phaseStart)) / 1000000.0;
+  if (seconds <= 0) {
+    return;
+  }
+
+  char   line[256];
+  double rate   = count / seconds;
+  int    length = 0;
+  if (label != NULL) {
+    // Keep the end of a long label, which is the most distinctive part.
+    size_t labelLength = strlen(label);
+    length += snprintf(line, sizeof(line), "%s: ",
+                       label + ((labelLength > MAX_LABEL_LENGTH)
+                                ? labelLength - MAX_LABEL_LENGTH : 0));
+  }
+
+  length += snprintf(line + length, sizeof(line) - length, "%s: %llu",
+                     phaseName, (unsigned long long) count);
+  if (phaseTotal > 0) {
+    length += snprintf(line + length, sizeof(line) - length,
+                       " of %llu %s (%llu%%)",
+                       (unsigned long long) phaseTotal, phaseUnit,
+                       (unsigned long long) ((count * 100) / phaseTotal));
+  } else {
+    length += snprintf(line + length, sizeof(line) - length, " %s",
+                       phaseUnit);
+  }
+
+  length += snprintf(line + length, sizeof(line) - length, ", %.0f %s/s",
+                     rate, phaseUnit);
+  if ((ioLayer != NULL) && (ioLayer->getIOStatistics != NULL)) {
+    double megabytes = (getLayerBytes() - phaseBytes) / (1024.0 * 1024.0);
+    length += snprintf(line + length, sizeof(line) - length, ", %.1f MB/s",
+                       megabytes / seconds);
+  }
+
+  if ((phaseTotal > count) && (rate > 0)) {
+    uint64_t eta = (phaseTotal - count) / rate;
+    snprintf(line + length, sizeof(line) - length,
+             ", ETA %llu:%02u:%02u", (unsigned long long) (eta / 3600),
+             (unsigned int) ((eta / 60) % 60), (unsigned int) (eta % 60));
+  }
+
+  warnx("%s", line);
+}
+
+/**
+ * Report progress until told to stop. This is the body of the reporting
+ * thread.
+ **/
+static void reportUntilStopped(void *arg __attribute__((unused)))
+{
+  uds_lock_mutex(&lock);
+  while (!stopping) {
+    int result = uds_timed_wait_cond(&stopped, &lock,
+                                     seconds_to_ktime(PROGRESS_INTERVAL_SECONDS));
+    if ((result == ETIMEDOUT) && !stopping) {
+      reportProgress();
+    }
+  }
+  uds_unlock_mutex(&lock);
+}
+
+/**********************************************************************/
+int startProgressReports(PhysicalLayer *layer)
+{
+  int result = uds_init_mutex(&lock);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  result = uds_init_cond(&stopped);
+  if (result != UDS_SUCCESS) {
+    uds_destroy_mutex(&lock);
+    return result;
+  }
+
+  ioLayer  = layer;
+  stopping = false;
+  result = uds_create_thread(reportUntilStopped, NULL, "progress", &reporter);
+  if (result != UDS_SUCCESS) {
+    reporter = NULL;
+    uds_destroy_cond(&stopped);
+    uds_destroy_mutex(&lock);
+    return result;
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+void setProgressPhase(const char *phase, const char *unit, uint64_t total)
+{
+  if (reporter == NULL) {
+    atomic64_set(&done, 0);
+    return;
+  }
+
+  uds_lock_mutex(&lock);
+  phaseName  = phase;
+  phaseUnit  = unit;
+  phaseTotal = total;
+  phaseStart = current_time_ns(CLOCK_MONOTONIC);
+  phaseBytes = getLayerBytes();
+  atomic64_set(&done, 0);
+  uds_unlock_mutex(&lock);
+}
+
+/**********************************************************************/
+void setProgressLabel(const char *progressLabel)
+{
+  label = progressLabel;
+}
+
+/**********************************************************************/
+void addProgress(uint64_t count)
+{
+  atomic64_add(count, &done);
+}
+
+/**********************************************************************/
+void stopProgressReports(void)
+{
+  if (reporter == NULL) {
+    return;
+  }
+
+  uds_lock_mutex(&lock);
+  stopping = true;
+  uds_signal_cond(&stopped);
+  uds_unlock_mutex(&lock);
+
+  uds_join_threads(reporter);
+  reporter = NULL;
+  uds_destroy_cond(&stopped);
+  uds_destroy_mutex(&lock);
+}
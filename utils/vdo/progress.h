@@ -0,0 +1,76 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/progress.h#1 $
+ */
+
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include "physicalLayer.h"
+
+/**
+ * Progress reports let an operator watch a long-running tool. Once started,
+ * a background thread reports the current phase of the work to stderr every
+ * few seconds: how much of the phase has been done, how fast it is going,
+ * the layer's throughput, and when the phase should finish if its size is
+ * known. The tool counts its work with addProgress(), which is just an
+ * atomic add, and so is cheap enough to call from inner loops and from many
+ * threads, whether or not reports have been started.
+ **/
+
+/**
+ * Start reporting progress.
+ *
+ * @param layer  The layer whose throughput should be reported, or NULL
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check startProgressReports(PhysicalLayer *layer);
+
+/**
+ * Begin a new phase of the work, resetting the count of work done.
+ *
+ * @param phase  The name of the phase
+ * @param unit   The plural name of the units in which the work is counted
+ * @param total  The number of units of work in the phase, or 0 if unknown
+ **/
+void setProgressPhase(const char *phase, const char *unit, uint64_t total);
+
+/**
+ * Set a label to begin each report with, such as the name of the volume
+ * being worked on when several are worked on at once.
+ *
+ * @param label  The label, which must outlive the reports, or NULL
+ **/
+void setProgressLabel(const char *label);
+
+/**
+ * Count work done in the current phase.
+ *
+ * @param count  The number of units of work done
+ **/
+void addProgress(uint64_t count);
+
+/**
+ * Stop reporting progress, if reports were started.
+ **/
+void stopProgressReports(void);
+
+#endif // PROGRESS_H
@@ -0,0 +1,399 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/reverseBlockMap.c#1 $
+ */
+
+
+#include "reverseBlockMap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fileUtils.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "permassert.h"
+
+#include "statusCodes.h"
+
+enum {
+  // The number of bits of a record's second word holding the LBN.
+  LBN_BITS          = 60,
+  RECORD_BYTES      = 16,
+  HEADER_BYTES      = 16,
+  // The number of records to buffer when reading or writing a file.
+  RECORDS_PER_CHUNK = 64 * 1024,
+};
+
+static const char MAGIC[] = "VDORBMAP";
+
+/** A PBN and one of the LBNs which map to it */
+typedef struct {
+  physical_block_number_t pbn;
+  /** The LBN, with the mapping state in the top bits */
+  uint64_t                lbnAndState;
+} ReverseMapping;
+
+struct reverseBlockMap {
+  /** The sorted mappings, if the map is in memory */
+  ReverseMapping *mappings;
+  /** The number of mappings */
+  size_t          count;
+  /** The number of mappings there is room for while building the map */
+  size_t          capacity;
+  /** The file holding the mappings, if the map is not in memory */
+  int             fd;
+};
+
+/** The map being built by addReverseMapping() */
+static ReverseBlockMap *building = NULL;
+
+/**********************************************************************/
+static int compareMappings(const void *a, const void *b)
+{
+  const ReverseMapping *mappingA = a;
+  const ReverseMapping *mappingB = b;
+  if (mappingA->pbn != mappingB->pbn) {
+    return ((mappingA->pbn < mappingB->pbn) ? -1 : 1);
+  }
+
+  if (mappingA->lbnAndState != mappingB->lbnAndState) {
+    return ((mappingA->lbnAndState < mappingB->lbnAndState) ? -1 : 1);
+  }
+
+  return 0;
+}
+
+/**
+ * Add the mapping of an LBN to the reverse map being built.
+ *
+ * Implements LBNExaminer.
+ **/
+static int addReverseMapping(logical_block_number_t   lbn,
+                             physical_block_number_t  pbn,
+                             enum block_mapping_state state)
+{
+  if (state == VDO_MAPPING_STATE_UNMAPPED) {
+    return VDO_SUCCESS;
+  }
+
+  if (building->count == building->capacity) {
+    size_t newCapacity = 2 * building->capacity;
+    int result = uds_reallocate_memory(building->mappings,
+                                       (building->capacity
+                                        * sizeof(ReverseMapping)),
+                                       newCapacity * sizeof(ReverseMapping),
+                                       "reverse block map",
+                                       &building->mappings);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    building->capacity = newCapacity;
+  }
+
+  building->mappings[building->count++] = (ReverseMapping) {
+    .pbn         = pbn,
+    .lbnAndState = (((uint64_t) state << LBN_BITS) | lbn),
+  };
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int makeReverseBlockMap(UserVDO *vdo, ReverseBlockMap **mapPtr)
+{
+  ReverseBlockMap *map;
+  int result = UDS_ALLOCATE(1, ReverseBlockMap, __func__, &map);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  // The recovery journal's count of used logical blocks is exact for a
+  // cleanly shut down VDO, so there will normally be no need to grow.
+  map->fd       = -1;
+  map->capacity = max((size_t) vdo->states.recovery_journal.logical_blocks_used,
+                      (size_t) 1);
+  result = UDS_ALLOCATE(map->capacity, ReverseMapping, "reverse block map",
+                        &map->mappings);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(map);
+    return result;
+  }
+
+  building = map;
+  result = examineBlockMapRange(vdo, 0, vdo->states.vdo.config.logical_blocks,
+                                addReverseMapping);
+  building = NULL;
+  if (result != VDO_SUCCESS) {
+    freeReverseBlockMap(&map);
+    return result;
+  }
+
+  // The mappings were added in LBN order, so each PBN's LBNs stay in order.
+  qsort(map->mappings, map->count, sizeof(ReverseMapping), compareMappings);
+  *mapPtr = map;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int openReverseBlockMap(const char *path, ReverseBlockMap **mapPtr)
+{
+  ReverseBlockMap *map;
+  int result = UDS_ALLOCATE(1, ReverseBlockMap, __func__, &map);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = open_file(path, FU_READ_ONLY, &map->fd);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(map);
+    return result;
+  }
+
+  byte   header[HEADER_BYTES];
+  size_t length;
+  result = read_data_at_offset(map->fd, 0, header, HEADER_BYTES, &length);
+  if ((result == UDS_SUCCESS)
+      && ((length != HEADER_BYTES)
+          || (memcmp(header, MAGIC, sizeof(uint64_t)) != 0))) {
+    result = VDO_BAD_MAGIC;
+  }
+
+  off_t size;
+  if (result == UDS_SUCCESS) {
+    result = get_open_file_size(map->fd, &size);
+  }
+
+  if (result == UDS_SUCCESS) {
+    map->count = get_unaligned_le64(header + sizeof(uint64_t));
+    size_t recordBytes = (size_t) size - HEADER_BYTES;
+    if (((recordBytes % RECORD_BYTES) != 0)
+        || (map->count != (recordBytes / RECORD_BYTES))) {
+      result = VDO_UNEXPECTED_EOF;
+    }
+  }
+
+  if (result != UDS_SUCCESS) {
+    freeReverseBlockMap(&map);
+    return result;
+  }
+
+  *mapPtr = map;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Encode a mapping as a file record.
+ *
+ * @param mapping  The mapping
+ * @param record   The buffer for the record
+ **/
+static void encodeMapping(const ReverseMapping *mapping, byte *record)
+{
+  put_unaligned_le64(mapping->pbn, record);
+  put_unaligned_le64(mapping->lbnAndState, record + sizeof(uint64_t));
+}
+
+/**
+ * Decode a mapping from a file record.
+ *
+ * @param record   The record
+ * @param mapping  The decoded mapping
+ **/
+static void decodeMapping(const byte *record, ReverseMapping *mapping)
+{
+  *mapping = (ReverseMapping) {
+    .pbn         = get_unaligned_le64(record),
+    .lbnAndState = get_unaligned_le64(record + sizeof(uint64_t)),
+  };
+}
+
+/**********************************************************************/
+int writeReverseBlockMap(const ReverseBlockMap *map, const char *path)
+{
+  int result = ASSERT(map->mappings != NULL,
+                      "only an in-memory reverse block map can be written");
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  byte *buffer;
+  result = UDS_ALLOCATE(RECORDS_PER_CHUNK * RECORD_BYTES, byte, __func__,
+                        &buffer);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  int fd;
+  result = open_file(path, FU_CREATE_WRITE_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(buffer);
+    return result;
+  }
+
+  memcpy(buffer, MAGIC, sizeof(uint64_t));
+  put_unaligned_le64(map->count, buffer + sizeof(uint64_t));
+  result = write_buffer(fd, buffer, HEADER_BYTES);
+
+  for (size_t i = 0; (result == UDS_SUCCESS) && (i < map->count);
+       i += RECORDS_PER_CHUNK) {
+    size_t records = min(map->count - i, (size_t) RECORDS_PER_CHUNK);
+    for (size_t j = 0; j < records; j++) {
+      encodeMapping(&map->mappings[i + j], buffer + (j * RECORD_BYTES));
+    }
+
+    result = write_buffer(fd, buffer, records * RECORD_BYTES);
+  }
+
+  if (result == UDS_SUCCESS) {
+    result = sync_and_close_file(fd, "cannot sync reverse block map file");
+  } else {
+    try_close_file(fd);
+  }
+
+  UDS_FREE(buffer);
+  return result;
+}
+
+/**********************************************************************/
+size_t getReverseMappingCount(const ReverseBlockMap *map)
+{
+  return map->count;
+}
+
+/**
+ * Get one of the mappings of a reverse map, from memory or from its file.
+ *
+ * @param [in]  map      The reverse map
+ * @param [in]  index    The index of the mapping
+ * @param [out] mapping  The mapping
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int getMapping(const ReverseBlockMap *map,
+                      size_t                 index,
+                      ReverseMapping        *mapping)
+{
+  if (map->mappings != NULL) {
+    *mapping = map->mappings[index];
+    return VDO_SUCCESS;
+  }
+
+  byte   record[RECORD_BYTES];
+  size_t length;
+  int result = read_data_at_offset(map->fd,
+                                   HEADER_BYTES + (index * RECORD_BYTES),
+                                   record, RECORD_BYTES, &length);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  if (length != RECORD_BYTES) {
+    return VDO_UNEXPECTED_EOF;
+  }
+
+  decodeMapping(record, mapping);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Find the LBNs which map to one PBN.
+ *
+ * @param map       The reverse map
+ * @param pbn       The PBN to look up
+ * @param examiner  The examiner to call for each mapping found
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int findReferences(const ReverseBlockMap   *map,
+                          physical_block_number_t  pbn,
+                          LBNExaminer             *examiner)
+{
+  // Find the first mapping whose PBN is not less than the one sought.
+  size_t low  = 0;
+  size_t high = map->count;
+  while (low < high) {
+    size_t         middle = low + ((high - low) / 2);
+    ReverseMapping mapping;
+    int result = getMapping(map, middle, &mapping);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    if (mapping.pbn < pbn) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  for (size_t i = low; i < map->count; i++) {
+    ReverseMapping mapping;
+    int result = getMapping(map, i, &mapping);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    if (mapping.pbn != pbn) {
+      break;
+    }
+
+    uint64_t lbnMask = ((uint64_t) 1 << LBN_BITS) - 1;
+    result = examiner(mapping.lbnAndState & lbnMask, pbn,
+                      mapping.lbnAndState >> LBN_BITS);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int findPBNReferences(const ReverseBlockMap         *map,
+                      const physical_block_number_t *pbns,
+                      size_t                         count,
+                      LBNExaminer                   *examiner)
+{
+  for (size_t i = 0; i < count; i++) {
+    int result = findReferences(map, pbns[i], examiner);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+void freeReverseBlockMap(ReverseBlockMap **mapPtr)
+{
+  ReverseBlockMap *map = *mapPtr;
+  if (map == NULL) {
+    return;
+  }
+
+  if (map->fd >= 0) {
+    try_close_file(map->fd);
+  }
+
+  UDS_FREE(map->mappings);
+  UDS_FREE(map);
+  *mapPtr = NULL;
+}
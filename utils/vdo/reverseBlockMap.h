@@ -0,0 +1,107 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/reverseBlockMap.h#1 $
+ */
+
+
+#ifndef REVERSE_BLOCK_MAP_H
+#define REVERSE_BLOCK_MAP_H
+
+#include "blockMapUtils.h"
+#include "userVDO.h"
+
+/**
+ * A ReverseBlockMap is an index from PBNs to the LBNs which map to them,
+ * kept as an array of (PBN, LBN) pairs sorted by PBN. It is either built in
+ * memory from the block map of a VDO, or opened from a file to which one was
+ * previously written, in which case lookups are binary searches of the file.
+ **/
+typedef struct reverseBlockMap ReverseBlockMap;
+
+/**
+ * Build a reverse block map from the block map of a VDO, in one pass over
+ * the LBN space.
+ *
+ * @param [in]  vdo     The VDO
+ * @param [out] mapPtr  A pointer to hold the new reverse map
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check makeReverseBlockMap(UserVDO *vdo, ReverseBlockMap **mapPtr);
+
+/**
+ * Open a reverse block map which was written to a file.
+ *
+ * @param [in]  path    The name of the file
+ * @param [out] mapPtr  A pointer to hold the reverse map
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check openReverseBlockMap(const char       *path,
+                                     ReverseBlockMap **mapPtr);
+
+/**
+ * Write a reverse block map to a file. The file holds a 16 byte header,
+ * the magic string "VDORBMAP" and the number of records as a little endian
+ * 64 bit number, followed by a 16 byte record for each mapping, sorted by
+ * PBN: the PBN as a little endian 64 bit number, then a little endian 64 bit
+ * number whose low 60 bits are the LBN and whose high 4 bits are the mapping
+ * state.
+ *
+ * @param map   The reverse map to write
+ * @param path  The name of the file to create
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check writeReverseBlockMap(const ReverseBlockMap *map,
+                                      const char            *path);
+
+/**
+ * Get the number of mappings in a reverse block map.
+ *
+ * @param map  The reverse map
+ *
+ * @return The number of mapped LBNs the reverse map covers
+ **/
+size_t getReverseMappingCount(const ReverseBlockMap *map);
+
+/**
+ * Find the LBNs which map to each of a set of PBNs. For each PBN in the order
+ * given, the examiner is called once for each LBN mapped to it, in LBN order.
+ *
+ * @param map       The reverse map
+ * @param pbns      The PBNs to look up
+ * @param count     The number of PBNs
+ * @param examiner  The examiner to call for each mapping found
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check findPBNReferences(const ReverseBlockMap         *map,
+                                   const physical_block_number_t *pbns,
+                                   size_t                         count,
+                                   LBNExaminer                   *examiner);
+
+/**
+ * Free a reverse block map, closing its file if it has one.
+ *
+ * @param mapPtr  A pointer to the reverse map, which will be NULLed out
+ **/
+void freeReverseBlockMap(ReverseBlockMap **mapPtr);
+
+#endif // REVERSE_BLOCK_MAP_H
@@ -0,0 +1,361 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/slabJournalIndex.c#1 $
+ */
+
+
+#include "slabJournalIndex.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fileUtils.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+
+#include "statusCodes.h"
+
+#include "journalDecoder.h"
+
+static const char INDEX_FILE_MAGIC[] = "VDOSJIDX";
+
+enum {
+  INDEX_FILE_VERSION      = 1,
+  INDEX_FILE_MAGIC_BYTES  = sizeof(INDEX_FILE_MAGIC) - 1,
+  // The magic, the version, the slab count, the nonce, and the dump size.
+  INDEX_FILE_HEADER_BYTES = INDEX_FILE_MAGIC_BYTES + 24,
+  // The sequence number, SBN, block, entry, and operation of an entry.
+  INDEX_ENTRY_BYTES       = 17,
+};
+
+/**
+ * Order index entries by slab block number, then by their position in the
+ * journal.
+ *
+ * Implements the qsort comparator.
+ **/
+static int compareEntries(const void *a, const void *b)
+{
+  const SlabJournalIndexEntry *entry1 = a;
+  const SlabJournalIndexEntry *entry2 = b;
+  if (entry1->sbn != entry2->sbn) {
+    return ((entry1->sbn < entry2->sbn) ? -1 : 1);
+  }
+
+  if (entry1->block != entry2->block) {
+    return ((entry1->block < entry2->block) ? -1 : 1);
+  }
+
+  if (entry1->entry != entry2->entry) {
+    return ((entry1->entry < entry2->entry) ? -1 : 1);
+  }
+
+  return 0;
+}
+
+/**
+ * Get the number of entries a journal block can really hold.
+ *
+ * @param block  The journal block
+ *
+ * @return The smaller of the block's entry count and its capacity
+ **/
+static journal_entry_count_t
+getEntryCount(const struct packed_slab_journal_block *block)
+{
+  journal_entry_count_t entryCount = __le16_to_cpu(block->header.entry_count);
+  journal_entry_count_t maxEntries
+    = (block->header.has_block_map_increments
+       ? VDO_SLAB_JOURNAL_FULL_ENTRIES_PER_BLOCK
+       : VDO_SLAB_JOURNAL_ENTRIES_PER_BLOCK);
+  return min(entryCount, maxEntries);
+}
+
+/**********************************************************************/
+int buildSlabJournalIndex(struct packed_slab_journal_block **blocks,
+                          block_count_t                      blockCount,
+                          SlabJournalIndex                  *index)
+{
+  *index = (SlabJournalIndex) { .entries = NULL };
+  size_t entryCount = 0;
+  for (block_count_t i = 0; i < blockCount; i++) {
+    entryCount += getEntryCount(blocks[i]);
+  }
+
+  if (entryCount == 0) {
+    return VDO_SUCCESS;
+  }
+
+  int result = UDS_ALLOCATE(entryCount, SlabJournalIndexEntry, __func__,
+                            &index->entries);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  SlabBlockEntries decoded;
+  for (block_count_t i = 0; i < blockCount; i++) {
+    struct packed_slab_journal_block *block = blocks[i];
+    sequence_number_t sequenceNumber
+      = __le64_to_cpu(block->header.sequence_number);
+    decodeSlabJournalBlock(block, &decoded);
+    for (journal_entry_count_t j = 0; j < decoded.count; j++) {
+      index->entries[index->entryCount++] = (SlabJournalIndexEntry) {
+        .sequenceNumber = sequenceNumber,
+        .sbn            = decoded.sbns[j],
+        .block          = i,
+        .entry          = j,
+        .operation      = decoded.operations[j],
+      };
+    }
+  }
+
+  qsort(index->entries, index->entryCount, sizeof(SlabJournalIndexEntry),
+        compareEntries);
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+const SlabJournalIndexEntry *
+findSlabJournalIndexEntries(const SlabJournalIndex *index,
+                            slab_block_number       sbn,
+                            size_t                 *countPtr)
+{
+  size_t low  = 0;
+  size_t high = index->entryCount;
+  while (low < high) {
+    size_t middle = low + ((high - low) / 2);
+    if (index->entries[middle].sbn < sbn) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  size_t end = low;
+  while ((end < index->entryCount) && (index->entries[end].sbn == sbn)) {
+    end++;
+  }
+
+  *countPtr = end - low;
+  return &index->entries[low];
+}
+
+/**********************************************************************/
+void freeSlabJournalIndex(SlabJournalIndex *index)
+{
+  UDS_FREE(index->entries);
+  *index = (SlabJournalIndex) { .entries = NULL };
+}
+
+/**
+ * Write the entries of one slab's index to an index file.
+ *
+ * @param fd     The index file
+ * @param index  The index
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int writeIndex(int fd, const SlabJournalIndex *index)
+{
+  size_t bytes = sizeof(uint64_t) + (index->entryCount * INDEX_ENTRY_BYTES);
+  byte *buffer;
+  int result = UDS_ALLOCATE(bytes, byte, __func__, &buffer);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  size_t offset = 0;
+  encode_uint64_le(buffer, &offset, index->entryCount);
+  for (size_t i = 0; i < index->entryCount; i++) {
+    const SlabJournalIndexEntry *entry = &index->entries[i];
+    encode_uint64_le(buffer, &offset, entry->sequenceNumber);
+    encode_uint32_le(buffer, &offset, entry->sbn);
+    encode_uint16_le(buffer, &offset, entry->block);
+    encode_uint16_le(buffer, &offset, entry->entry);
+    buffer[offset++] = entry->operation;
+  }
+
+  result = write_buffer(fd, buffer, offset);
+  UDS_FREE(buffer);
+  return result;
+}
+
+/**********************************************************************/
+int saveSlabJournalIndexes(const char             *path,
+                           nonce_t                 nonce,
+                           block_count_t           dumpBlocks,
+                           const SlabJournalIndex *indexes,
+                           slab_count_t            slabCount)
+{
+  int fd;
+  int result = open_file(path, FU_CREATE_WRITE_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  byte   header[INDEX_FILE_HEADER_BYTES];
+  size_t offset = 0;
+  memcpy(header, INDEX_FILE_MAGIC, INDEX_FILE_MAGIC_BYTES);
+  offset += INDEX_FILE_MAGIC_BYTES;
+  encode_uint32_le(header, &offset, INDEX_FILE_VERSION);
+  encode_uint32_le(header, &offset, slabCount);
+  encode_uint64_le(header, &offset, nonce);
+  encode_uint64_le(header, &offset, dumpBlocks);
+  result = write_buffer(fd, header, offset);
+  for (slab_count_t i = 0; (result == VDO_SUCCESS) && (i < slabCount); i++) {
+    result = writeIndex(fd, &indexes[i]);
+  }
+
+  if (result != VDO_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  return sync_and_close_file(fd, "cannot sync slab journal index file");
+}
+
+/**
+ * Read the entries of one slab's index from an index file.
+ *
+ * @param fd     The index file
+ * @param index  The index to fill in
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int readIndex(int fd, SlabJournalIndex *index)
+{
+  byte   countBytes[sizeof(uint64_t)];
+  size_t offset = 0;
+  uint64_t entryCount;
+  int result = read_buffer(fd, countBytes, sizeof(countBytes));
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  decode_uint64_le(countBytes, &offset, &entryCount);
+  if (entryCount == 0) {
+    *index = (SlabJournalIndex) { .entries = NULL };
+    return VDO_SUCCESS;
+  }
+
+  // No slab journal can hold more entries than this.
+  if (entryCount > (UINT16_MAX * VDO_SLAB_JOURNAL_FULL_ENTRIES_PER_BLOCK)) {
+    return VDO_CORRUPT_JOURNAL;
+  }
+
+  byte *buffer;
+  result = UDS_ALLOCATE(entryCount * INDEX_ENTRY_BYTES, byte, __func__,
+                        &buffer);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = read_buffer(fd, buffer, entryCount * INDEX_ENTRY_BYTES);
+  if (result == VDO_SUCCESS) {
+    result = UDS_ALLOCATE(entryCount, SlabJournalIndexEntry, __func__,
+                          &index->entries);
+  }
+
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(buffer);
+    return result;
+  }
+
+  offset = 0;
+  for (size_t i = 0; i < entryCount; i++) {
+    SlabJournalIndexEntry *entry = &index->entries[i];
+    uint32_t sbn;
+    uint16_t block, entryNumber;
+    decode_uint64_le(buffer, &offset, &entry->sequenceNumber);
+    decode_uint32_le(buffer, &offset, &sbn);
+    decode_uint16_le(buffer, &offset, &block);
+    decode_uint16_le(buffer, &offset, &entryNumber);
+    entry->sbn       = sbn;
+    entry->block     = block;
+    entry->entry     = entryNumber;
+    entry->operation = buffer[offset++];
+  }
+
+  index->entryCount = entryCount;
+  UDS_FREE(buffer);
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int loadSlabJournalIndexes(const char       *path,
+                           nonce_t           nonce,
+                           block_count_t     dumpBlocks,
+                           SlabJournalIndex *indexes,
+                           slab_count_t      slabCount)
+{
+  int fd;
+  int result = open_file(path, FU_READ_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  byte header[INDEX_FILE_HEADER_BYTES];
+  result = read_buffer(fd, header, sizeof(header));
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  if (memcmp(header, INDEX_FILE_MAGIC, INDEX_FILE_MAGIC_BYTES) != 0) {
+    try_close_file(fd);
+    return VDO_BAD_MAGIC;
+  }
+
+  uint32_t version, fileSlabCount;
+  uint64_t fileNonce, fileDumpBlocks;
+  size_t offset = INDEX_FILE_MAGIC_BYTES;
+  decode_uint32_le(header, &offset, &version);
+  decode_uint32_le(header, &offset, &fileSlabCount);
+  decode_uint64_le(header, &offset, &fileNonce);
+  decode_uint64_le(header, &offset, &fileDumpBlocks);
+  if (version != INDEX_FILE_VERSION) {
+    try_close_file(fd);
+    return VDO_UNSUPPORTED_VERSION;
+  }
+
+  if ((fileSlabCount != slabCount) || (fileNonce != nonce)
+      || (fileDumpBlocks != dumpBlocks)) {
+    try_close_file(fd);
+    return VDO_BAD_NONCE;
+  }
+
+  slab_count_t loaded = 0;
+  for (; loaded < slabCount; loaded++) {
+    result = readIndex(fd, &indexes[loaded]);
+    if (result != VDO_SUCCESS) {
+      break;
+    }
+  }
+
+  try_close_file(fd);
+  if (result != VDO_SUCCESS) {
+    for (slab_count_t i = 0; i < loaded; i++) {
+      freeSlabJournalIndex(&indexes[i]);
+    }
+    return result;
+  }
+
+  return VDO_SUCCESS;
+}
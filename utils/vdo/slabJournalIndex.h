@@ -0,0 +1,130 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/slabJournalIndex.h#1 $
+ */
+
+
+#ifndef SLAB_JOURNAL_INDEX_H
+#define SLAB_JOURNAL_INDEX_H
+
+#include "slabJournalFormat.h"
+#include "types.h"
+
+/**
+ * A slab journal index holds every entry in the journal blocks of one slab,
+ * sorted by the slab block number the entry is for, so that the entries for
+ * any block can be found without decoding the journal again. Entries for
+ * the same block stay in the order they appear in the journal blocks. A set
+ * of indexes for the slabs of a dump may be saved in a file and loaded in a
+ * later session.
+ **/
+
+/** One entry of a slab journal */
+typedef struct {
+  /** The sequence number of the journal block holding the entry */
+  sequence_number_t      sequenceNumber;
+  /** The slab block number the entry is for */
+  slab_block_number      sbn;
+  /** The position of the journal block in the slab journal */
+  uint16_t               block;
+  /** The position of the entry in the journal block */
+  journal_entry_count_t  entry;
+  enum journal_operation operation;
+} SlabJournalIndexEntry;
+
+typedef struct {
+  SlabJournalIndexEntry *entries;
+  size_t                 entryCount;
+} SlabJournalIndex;
+
+/**
+ * Build the index of a slab's journal. A block claiming more entries than
+ * it can hold contributes only the entries it can hold.
+ *
+ * @param [in]  blocks      The journal blocks of the slab
+ * @param [in]  blockCount  The number of journal blocks
+ * @param [out] index       The index to fill in
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check
+buildSlabJournalIndex(struct packed_slab_journal_block **blocks,
+                      block_count_t                      blockCount,
+                      SlabJournalIndex                  *index);
+
+/**
+ * Find the entries of a slab journal index for a slab block.
+ *
+ * @param [in]  index     The index
+ * @param [in]  sbn       The slab block number
+ * @param [out] countPtr  A pointer to hold the number of entries found
+ *
+ * @return The first entry found, followed by the rest in order
+ **/
+const SlabJournalIndexEntry *
+findSlabJournalIndexEntries(const SlabJournalIndex *index,
+                            slab_block_number       sbn,
+                            size_t                 *countPtr);
+
+/**
+ * Free the entries of a slab journal index.
+ *
+ * @param index  The index
+ **/
+void freeSlabJournalIndex(SlabJournalIndex *index);
+
+/**
+ * Save the journal indexes of all the slabs of a dump to a file. The file
+ * records the nonce of the volume and the size of the dump so that it is
+ * not loaded for a different dump.
+ *
+ * @param path        The name of the file to write
+ * @param nonce       The nonce of the volume
+ * @param dumpBlocks  The number of blocks in the dump
+ * @param indexes     The indexes, one for each slab
+ * @param slabCount   The number of slabs
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check saveSlabJournalIndexes(const char             *path,
+                                        nonce_t                 nonce,
+                                        block_count_t           dumpBlocks,
+                                        const SlabJournalIndex *indexes,
+                                        slab_count_t            slabCount);
+
+/**
+ * Load the journal indexes of all the slabs of a dump from a file written
+ * by saveSlabJournalIndexes().
+ *
+ * @param path        The name of the file to read
+ * @param nonce       The nonce of the volume
+ * @param dumpBlocks  The number of blocks in the dump
+ * @param indexes     The indexes to fill in, one for each slab
+ * @param slabCount   The number of slabs
+ *
+ * @return VDO_SUCCESS, VDO_BAD_NONCE if the file is for a different dump,
+ *         or another error code
+ **/
+int __must_check loadSlabJournalIndexes(const char       *path,
+                                        nonce_t           nonce,
+                                        block_count_t     dumpBlocks,
+                                        SlabJournalIndex *indexes,
+                                        slab_count_t      slabCount);
+
+#endif // SLAB_JOURNAL_INDEX_H
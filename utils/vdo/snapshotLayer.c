@@ -0,0 +1,929 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/snapshotLayer.c#1 $
+ */
+
+#include "snapshotLayer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atomicDefs.h"
+#include "fileUtils.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
+#include "permassert.h"
+#include "stringUtils.h"
+
+#include "checksum.h"
+#include "constants.h"
+#include "slabSummaryFormat.h"
+#include "statusCodes.h"
+#include "vdoState.h"
+#include "volumeGeometry.h"
+
+#include "blockMapUtils.h"
+#include "dumpTOC.h"
+#include "fileLayer.h"
+#include "userVDO.h"
+
+static const char SNAPSHOT_MAGIC[] = "VDOSNAPC";
+
+enum {
+  SNAPSHOT_VERSION       = 1,
+  SNAPSHOT_MAGIC_BYTES   = sizeof(SNAPSHOT_MAGIC) - 1,
+  /** The snapshot holds the block map tree pages */
+  SNAPSHOT_HAS_BLOCK_MAP = 1,
+  /** The most blocks to read or write at once */
+  SNAPSHOT_IO_BLOCKS     = 256,
+  /** The most extents to read in one batch while writing a snapshot */
+  SNAPSHOT_IO_EXTENTS    = 64,
+};
+
+typedef struct {
+  uint32_t          flags;
+  nonce_t           nonce;
+  uint32_t          state;
+  crc32_checksum_t  superBlockChecksum;
+  crc32_checksum_t  contentChecksum;
+} SnapshotHeader;
+
+typedef struct {
+  PhysicalLayer  common;
+  PhysicalLayer *underlying;
+  /** A layer reading the snapshot file */
+  PhysicalLayer *snapshot;
+  /** The regions of the snapshot, in increasing order of PBN */
+  DumpTOC        toc;
+  atomic64_t     snapshotBlocks;
+  atomic64_t     underlyingBlocks;
+} SnapshotLayer;
+
+/** An extent of the volume to copy into a new snapshot */
+typedef struct {
+  DumpRegionType          type;
+  physical_block_number_t pbn;
+  block_count_t           count;
+} SnapshotExtent;
+
+typedef struct {
+  SnapshotExtent *extents;
+  size_t          count;
+  size_t          capacity;
+} SnapshotExtents;
+
+/** The extents being collected by the block map walk */
+static SnapshotExtents *collecting;
+
+/**********************************************************************/
+static inline SnapshotLayer *asSnapshotLayer(PhysicalLayer *layer)
+{
+  STATIC_ASSERT(offsetof(SnapshotLayer, common) == 0);
+  return (SnapshotLayer *) layer;
+}
+
+/**********************************************************************/
+static void encodeHeader(const SnapshotHeader *header, byte *block)
+{
+  size_t offset = 0;
+  memcpy(block, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_BYTES);
+  offset += SNAPSHOT_MAGIC_BYTES;
+  encode_uint32_le(block, &offset, SNAPSHOT_VERSION);
+  encode_uint32_le(block, &offset, header->flags);
+  encode_uint64_le(block, &offset, header->nonce);
+  encode_uint32_le(block, &offset, header->state);
+  encode_uint32_le(block, &offset, header->superBlockChecksum);
+  encode_uint32_le(block, &offset, header->contentChecksum);
+}
+
+/**
+ * Decode the header block of a snapshot.
+ *
+ * @param [in]  block   The header block
+ * @param [out] header  The decoded header
+ *
+ * @return VDO_SUCCESS, VDO_BAD_MAGIC, or VDO_UNSUPPORTED_VERSION
+ **/
+static int decodeHeader(const byte *block, SnapshotHeader *header)
+{
+  if (memcmp(block, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_BYTES) != 0) {
+    return VDO_BAD_MAGIC;
+  }
+
+  uint32_t version;
+  size_t   offset = SNAPSHOT_MAGIC_BYTES;
+  decode_uint32_le(block, &offset, &version);
+  if (version != SNAPSHOT_VERSION) {
+    return VDO_UNSUPPORTED_VERSION;
+  }
+
+  decode_uint32_le(block, &offset, &header->flags);
+  decode_uint64_le(block, &offset, &header->nonce);
+  decode_uint32_le(block, &offset, &header->state);
+  decode_uint32_le(block, &offset, &header->superBlockChecksum);
+  decode_uint32_le(block, &offset, &header->contentChecksum);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Find the first region of a snapshot which ends after a given PBN.
+ *
+ * @param layer  The snapshot layer
+ * @param pbn    The PBN
+ *
+ * @return The region, or NULL if every region ends at or before the PBN
+ **/
+static const DumpRegion *findRegion(SnapshotLayer           *layer,
+                                    physical_block_number_t  pbn)
+{
+  size_t low  = 0;
+  size_t high = layer->toc.count;
+  while (low < high) {
+    size_t middle = low + ((high - low) / 2);
+    const DumpRegion *region = &layer->toc.regions[middle];
+    if (region->sourcePBN + region->blockCount <= pbn) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return ((low < layer->toc.count) ? &layer->toc.regions[low] : NULL);
+}
+
+/**
+ * Check whether any block of an extent is held in the snapshot.
+ **/
+static bool isInSnapshot(SnapshotLayer           *layer,
+                         physical_block_number_t  startBlock,
+                         size_t                   blockCount)
+{
+  const DumpRegion *region = findRegion(layer, startBlock);
+  return ((region != NULL)
+          && (region->sourcePBN < startBlock + blockCount));
+}
+
+/**
+ * Read an extent, taking the blocks held in the snapshot from it and the
+ * rest from the underlying layer.
+ *
+ * Implements extent_reader.
+ **/
+static int snapshotReader(PhysicalLayer           *header,
+                          physical_block_number_t  startBlock,
+                          size_t                   blockCount,
+                          char                    *buffer)
+{
+  SnapshotLayer *layer = asSnapshotLayer(header);
+  while (blockCount > 0) {
+    const DumpRegion *region = findRegion(layer, startBlock);
+    size_t count;
+    int result;
+    if ((region != NULL) && (region->sourcePBN <= startBlock)) {
+      block_count_t offset = startBlock - region->sourcePBN;
+      count  = min(blockCount, (size_t) (region->blockCount - offset));
+      result = layer->snapshot->reader(layer->snapshot,
+                                       region->dumpBlock + offset, count,
+                                       buffer);
+      atomic64_add(count, &layer->snapshotBlocks);
+    } else {
+      count = ((region == NULL)
+               ? blockCount
+               : min(blockCount, (size_t) (region->sourcePBN - startBlock)));
+      result = layer->underlying->reader(layer->underlying, startBlock,
+                                         count, buffer);
+      atomic64_add(count, &layer->underlyingBlocks);
+    }
+
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    startBlock += count;
+    blockCount -= count;
+    buffer     += count * VDO_BLOCK_SIZE;
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Read a batch of extents. A batch which touches no block of the snapshot
+ * is passed to the underlying layer whole so that its reads can still be
+ * issued together.
+ *
+ * Implements batch_extent_reader.
+ **/
+static int snapshotBatchReader(PhysicalLayer        *header,
+                               struct extent_read   *extents,
+                               size_t                count,
+                               extent_read_callback *callback,
+                               void                 *context)
+{
+  SnapshotLayer *layer = asSnapshotLayer(header);
+  bool touched = false;
+  for (size_t i = 0; !touched && (i < count); i++) {
+    touched = isInSnapshot(layer, extents[i].start_block,
+                           extents[i].block_count);
+  }
+
+  if (!touched) {
+    for (size_t i = 0; i < count; i++) {
+      atomic64_add(extents[i].block_count, &layer->underlyingBlocks);
+    }
+
+    return layer->underlying->readExtents(layer->underlying, extents, count,
+                                          callback, context);
+  }
+
+  int firstError = VDO_SUCCESS;
+  for (size_t i = 0; i < count; i++) {
+    struct extent_read *extent = &extents[i];
+    extent->result = snapshotReader(header, extent->start_block,
+                                    extent->block_count, extent->buffer);
+    if (firstError == VDO_SUCCESS) {
+      firstError = extent->result;
+    }
+
+    if (callback != NULL) {
+      callback(extent, context);
+    }
+  }
+
+  return firstError;
+}
+
+/**
+ * A snapshot layer is read-only.
+ *
+ * Implements extent_writer.
+ **/
+static int noWriter(PhysicalLayer           *header __attribute__((unused)),
+                    physical_block_number_t  startBlock
+                    __attribute__((unused)),
+                    size_t                   blockCount
+                    __attribute__((unused)),
+                    char                    *buffer __attribute__((unused)))
+{
+  return EPERM;
+}
+
+/**********************************************************************/
+static void snapshotAdvisor(PhysicalLayer           *header,
+                            physical_block_number_t  startBlock,
+                            block_count_t            blockCount,
+                            enum access_pattern      pattern)
+{
+  PhysicalLayer *underlying = asSnapshotLayer(header)->underlying;
+  if (underlying->advise != NULL) {
+    underlying->advise(underlying, startBlock, blockCount, pattern);
+  }
+}
+
+/**
+ * Report the I/O done by the underlying layer, since that is what reaches
+ * the device.
+ *
+ * Implements io_statistics_getter.
+ **/
+static void snapshotStatistics(PhysicalLayer        *header,
+                               struct io_statistics *stats)
+{
+  PhysicalLayer *underlying = asSnapshotLayer(header)->underlying;
+  if (underlying->getIOStatistics != NULL) {
+    underlying->getIOStatistics(underlying, stats);
+  } else {
+    *stats = (struct io_statistics) { 0, };
+  }
+}
+
+/**********************************************************************/
+static block_count_t getBlockCount(PhysicalLayer *header)
+{
+  PhysicalLayer *underlying = asSnapshotLayer(header)->underlying;
+  return underlying->getBlockCount(underlying);
+}
+
+/**********************************************************************/
+static int allocateIOBuffer(PhysicalLayer  *header,
+                            size_t          bytes,
+                            const char     *why,
+                            char          **bufferPtr)
+{
+  PhysicalLayer *underlying = asSnapshotLayer(header)->underlying;
+  return underlying->allocateIOBuffer(underlying, bytes, why, bufferPtr);
+}
+
+/**********************************************************************/
+static int borrowIOBuffer(PhysicalLayer  *header,
+                          size_t          bytes,
+                          const char     *why,
+                          char          **bufferPtr)
+{
+  PhysicalLayer *underlying = asSnapshotLayer(header)->underlying;
+  return underlying->borrowIOBuffer(underlying, bytes, why, bufferPtr);
+}
+
+/**********************************************************************/
+static void returnIOBuffer(PhysicalLayer *header, size_t bytes, char *buffer)
+{
+  PhysicalLayer *underlying = asSnapshotLayer(header)->underlying;
+  underlying->returnIOBuffer(underlying, bytes, buffer);
+}
+
+/**********************************************************************/
+static void vacuousFlush(struct vdo_flush *vdoFlush __attribute__((unused)))
+{
+}
+
+/**
+ * Free a SnapshotLayer and its underlying layer, and NULL out the reference
+ * to it.
+ *
+ * Implements layer_destructor.
+ **/
+static void freeLayer(PhysicalLayer **layerPtr)
+{
+  PhysicalLayer *header = *layerPtr;
+  if (header == NULL) {
+    return;
+  }
+
+  SnapshotLayer *layer = asSnapshotLayer(header);
+  uds_log_debug("snapshot cache: %llu blocks from snapshot, %llu from device",
+                (unsigned long long) atomic64_read(&layer->snapshotBlocks),
+                (unsigned long long) atomic64_read(&layer->underlyingBlocks));
+  if (layer->underlying != NULL) {
+    layer->underlying->destroy(&layer->underlying);
+  }
+
+  if (layer->snapshot != NULL) {
+    layer->snapshot->destroy(&layer->snapshot);
+  }
+
+  freeDumpTOC(&layer->toc);
+  UDS_FREE(layer);
+  *layerPtr = NULL;
+}
+
+/**
+ * Checksum a range of blocks of a layer.
+ *
+ * @param [in]     layer       The layer to read
+ * @param [in]     startBlock  The first block to checksum
+ * @param [in]     blockCount  The number of blocks to checksum
+ * @param [in,out] crc         The running checksum
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int checksumBlocks(PhysicalLayer           *layer,
+                          physical_block_number_t  startBlock,
+                          block_count_t            blockCount,
+                          crc32_checksum_t        *crc)
+{
+  char *buffer;
+  int result = layer->allocateIOBuffer(layer,
+                                       SNAPSHOT_IO_BLOCKS * VDO_BLOCK_SIZE,
+                                       "snapshot checksum buffer", &buffer);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  while (blockCount > 0) {
+    block_count_t count = min(blockCount, (block_count_t) SNAPSHOT_IO_BLOCKS);
+    result = layer->reader(layer, startBlock, count, buffer);
+    if (result != VDO_SUCCESS) {
+      break;
+    }
+
+    *crc = vdo_update_crc32(*crc, (byte *) buffer, count * VDO_BLOCK_SIZE);
+    startBlock += count;
+    blockCount -= count;
+  }
+
+  UDS_FREE(buffer);
+  return result;
+}
+
+/**
+ * Check that a block held in a snapshot is the same as the block on the
+ * volume.
+ *
+ * @param layer  The snapshot layer
+ * @param type   The type of the region holding the block
+ * @param crc    A pointer to hold the checksum of the block, may be NULL
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int checkBlock(SnapshotLayer    *layer,
+                      DumpRegionType    type,
+                      crc32_checksum_t *crc)
+{
+  const DumpRegion *region = findDumpRegion(&layer->toc, type, 0);
+  if (region == NULL) {
+    return VDO_INVALID_FRAGMENT;
+  }
+
+  char *buffer;
+  int result = layer->underlying->allocateIOBuffer(layer->underlying,
+                                                   2 * VDO_BLOCK_SIZE,
+                                                   "snapshot check buffer",
+                                                   &buffer);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = layer->snapshot->reader(layer->snapshot, region->dumpBlock, 1,
+                                   buffer);
+  if (result == VDO_SUCCESS) {
+    result = layer->underlying->reader(layer->underlying, region->sourcePBN,
+                                       1, buffer + VDO_BLOCK_SIZE);
+  }
+
+  if ((result == VDO_SUCCESS)
+      && (memcmp(buffer, buffer + VDO_BLOCK_SIZE, VDO_BLOCK_SIZE) != 0)) {
+    result = VDO_CHECKSUM_MISMATCH;
+  }
+
+  if ((result == VDO_SUCCESS) && (crc != NULL)) {
+    *crc = vdo_update_crc32(VDO_INITIAL_CHECKSUM, (byte *) buffer,
+                            VDO_BLOCK_SIZE);
+  }
+
+  UDS_FREE(buffer);
+  return result;
+}
+
+/**
+ * Open an existing snapshot and check that it is intact and matches the
+ * volume.
+ *
+ * @param layer         The snapshot layer, with its underlying layer set
+ * @param path          The name of the snapshot file
+ * @param withBlockMap  Whether the snapshot must hold the block map
+ *
+ * @return VDO_SUCCESS, or an error code if the snapshot can't be used
+ **/
+static int openSnapshot(SnapshotLayer *layer,
+                        const char    *path,
+                        bool           withBlockMap)
+{
+  bool exists;
+  int result = file_exists(path, &exists);
+  if ((result != UDS_SUCCESS) || !exists) {
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  result = makeReadOnlyFileLayer(path, &layer->snapshot);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  PhysicalLayer *snapshot = layer->snapshot;
+  char *block;
+  result = snapshot->allocateIOBuffer(snapshot, VDO_BLOCK_SIZE,
+                                      "snapshot header", &block);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  SnapshotHeader header;
+  result = snapshot->reader(snapshot, 0, 1, block);
+  if (result == VDO_SUCCESS) {
+    result = decodeHeader((byte *) block, &header);
+  }
+
+  UDS_FREE(block);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  if (withBlockMap && ((header.flags & SNAPSHOT_HAS_BLOCK_MAP) == 0)) {
+    uds_log_info("snapshot %s has no block map", path);
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  crc32_checksum_t crc = VDO_INITIAL_CHECKSUM;
+  result = checksumBlocks(snapshot, 1, snapshot->getBlockCount(snapshot) - 1,
+                          &crc);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  if (crc != header.contentChecksum) {
+    uds_log_info("snapshot %s is corrupt", path);
+    return VDO_CHECKSUM_MISMATCH;
+  }
+
+  result = readDumpTOC(snapshot, &layer->toc);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  physical_block_number_t next = 0;
+  for (size_t i = 0; i < layer->toc.count; i++) {
+    const DumpRegion *region = &layer->toc.regions[i];
+    if ((region->dumpBlock == 0) || (region->sourcePBN < next)) {
+      return VDO_INVALID_FRAGMENT;
+    }
+
+    next = region->sourcePBN + region->blockCount;
+  }
+
+  result = checkBlock(layer, DUMP_REGION_GEOMETRY, NULL);
+  if (result == VDO_SUCCESS) {
+    result = checkBlock(layer, DUMP_REGION_SUPER_BLOCK, &crc);
+  }
+
+  if ((result == VDO_CHECKSUM_MISMATCH)
+      || ((result == VDO_SUCCESS) && (crc != header.superBlockChecksum))) {
+    uds_log_info("snapshot %s of VDO with nonce %llu in state %s is stale",
+                 path, (unsigned long long) header.nonce,
+                 get_vdo_state_name(header.state));
+    return VDO_CHECKSUM_MISMATCH;
+  }
+
+  return result;
+}
+
+/**********************************************************************/
+static int addExtent(SnapshotExtents         *extents,
+                     DumpRegionType           type,
+                     physical_block_number_t  pbn,
+                     block_count_t            count)
+{
+  if (extents->count == extents->capacity) {
+    size_t capacity = max(extents->capacity * 2, (size_t) 64);
+    int result = uds_reallocate_memory(extents->extents,
+                                       (extents->capacity
+                                        * sizeof(SnapshotExtent)),
+                                       capacity * sizeof(SnapshotExtent),
+                                       "snapshot extents", &extents->extents);
+    if (result != UDS_SUCCESS) {
+      return result;
+    }
+
+    extents->capacity = capacity;
+  }
+
+  extents->extents[extents->count++] = (SnapshotExtent) {
+    .type  = type,
+    .pbn   = pbn,
+    .count = count,
+  };
+  return VDO_SUCCESS;
+}
+
+/**
+ * Add each initialized block map page to the snapshot extents.
+ *
+ * Implements PageExaminer.
+ **/
+static int collectPage(const DecodedBlockMapPage *page,
+                       height_t height __attribute__((unused)))
+{
+  return addExtent(collecting, DUMP_REGION_BLOCK_MAP, page->pagePBN, 1);
+}
+
+/**********************************************************************/
+static int compareExtents(const void *a, const void *b)
+{
+  const SnapshotExtent *extentA = a;
+  const SnapshotExtent *extentB = b;
+  if (extentA->pbn == extentB->pbn) {
+    return 0;
+  }
+
+  return ((extentA->pbn < extentB->pbn) ? -1 : 1);
+}
+
+/**
+ * Work out which extents of a volume go into its snapshot.
+ *
+ * @param vdo           The VDO
+ * @param withBlockMap  Whether to include the block map
+ * @param extents       The extents to fill in, in increasing order of PBN
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int getSnapshotExtents(UserVDO         *vdo,
+                              bool             withBlockMap,
+                              SnapshotExtents *extents)
+{
+  int result = addExtent(extents, DUMP_REGION_GEOMETRY,
+                         GEOMETRY_BLOCK_LOCATION, 1);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = addExtent(extents, DUMP_REGION_SUPER_BLOCK,
+                     vdo_get_data_region_start(vdo->geometry), 1);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  struct partition *partition;
+  result = vdo_get_partition(vdo->states.layout, SLAB_SUMMARY_PARTITION,
+                             &partition);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = addExtent(extents, DUMP_REGION_SLAB_SUMMARY,
+                     get_vdo_fixed_layout_partition_offset(partition),
+                     get_vdo_slab_summary_size(VDO_BLOCK_SIZE));
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  if (withBlockMap) {
+    collecting = extents;
+    result = examineBlockMapPages(vdo, collectPage);
+    collecting = NULL;
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  qsort(extents->extents, extents->count, sizeof(SnapshotExtent),
+        compareExtents);
+  for (size_t i = 1; i < extents->count; i++) {
+    const SnapshotExtent *previous = &extents->extents[i - 1];
+    if (previous->pbn + previous->count > extents->extents[i].pbn) {
+      return uds_log_error_strerror(VDO_INVALID_FRAGMENT,
+                                    "snapshot extents overlap at PBN %llu",
+                                    (unsigned long long)
+                                    extents->extents[i].pbn);
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Copy a batch of extents from the volume to the snapshot file.
+ *
+ * @param [in]     underlying  The layer holding the VDO
+ * @param [in]     fd          The snapshot file
+ * @param [in]     extents     The extents to copy
+ * @param [in]     count       The number of extents
+ * @param [in]     buffer      A buffer large enough for all the extents
+ * @param [in,out] toc         The table of contents to add the regions to
+ * @param [in,out] dumpBlock   The next block of the snapshot file
+ * @param [in,out] header      The header, whose checksums are updated
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int copyExtents(PhysicalLayer        *underlying,
+                       int                   fd,
+                       const SnapshotExtent *extents,
+                       size_t                count,
+                       char                 *buffer,
+                       DumpTOC              *toc,
+                       block_count_t        *dumpBlock,
+                       SnapshotHeader       *header)
+{
+  struct extent_read reads[SNAPSHOT_IO_EXTENTS];
+  char *next = buffer;
+  for (size_t i = 0; i < count; i++) {
+    reads[i] = (struct extent_read) {
+      .start_block = extents[i].pbn,
+      .block_count = extents[i].count,
+      .buffer      = next,
+    };
+    next += extents[i].count * VDO_BLOCK_SIZE;
+  }
+
+  int result = underlying->readExtents(underlying, reads, count, NULL, NULL);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (extents[i].type == DUMP_REGION_SUPER_BLOCK) {
+      header->superBlockChecksum
+        = vdo_update_crc32(VDO_INITIAL_CHECKSUM, (byte *) reads[i].buffer,
+                           VDO_BLOCK_SIZE);
+    }
+
+    result = addDumpRegion(toc, extents[i].type, *dumpBlock,
+                           extents[i].count, extents[i].pbn);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    *dumpBlock += extents[i].count;
+  }
+
+  size_t bytes = next - buffer;
+  header->contentChecksum = vdo_update_crc32(header->contentChecksum,
+                                             (byte *) buffer, bytes);
+  return write_buffer(fd, buffer, bytes);
+}
+
+/**
+ * Write a snapshot of a volume.
+ *
+ * @param underlying    The layer holding the VDO
+ * @param path          The name of the snapshot file
+ * @param withBlockMap  Whether to include the block map
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int writeSnapshot(PhysicalLayer *underlying,
+                         const char    *path,
+                         bool           withBlockMap)
+{
+  UserVDO *vdo;
+  int result = loadVDO(underlying, false, &vdo);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  SnapshotExtents extents = { .extents = NULL };
+  result = getSnapshotExtents(vdo, withBlockMap, &extents);
+  SnapshotHeader header = {
+    .flags           = (withBlockMap ? SNAPSHOT_HAS_BLOCK_MAP : 0),
+    .nonce           = vdo->states.vdo.nonce,
+    .state           = vdo->states.vdo.state,
+    .contentChecksum = VDO_INITIAL_CHECKSUM,
+  };
+  freeUserVDO(&vdo);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(extents.extents);
+    return result;
+  }
+
+  char *newPath;
+  result = uds_alloc_sprintf(__func__, &newPath, "%s.new", path);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(extents.extents);
+    return result;
+  }
+
+  char *buffer;
+  result = underlying->allocateIOBuffer(underlying,
+                                        SNAPSHOT_IO_BLOCKS * VDO_BLOCK_SIZE,
+                                        "snapshot buffer", &buffer);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(newPath);
+    UDS_FREE(extents.extents);
+    return result;
+  }
+
+  int fd;
+  result = open_file(newPath, FU_CREATE_WRITE_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(buffer);
+    UDS_FREE(newPath);
+    UDS_FREE(extents.extents);
+    return result;
+  }
+
+  // Leave room for the header, which is written once the checksums are
+  // known.
+  memset(buffer, 0, VDO_BLOCK_SIZE);
+  result = write_buffer(fd, buffer, VDO_BLOCK_SIZE);
+
+  DumpTOC       toc       = { .regions = NULL };
+  block_count_t dumpBlock = 1;
+  size_t        start     = 0;
+  while ((result == VDO_SUCCESS) && (start < extents.count)) {
+    // Copy a batch of extents which fits in the buffer, splitting any
+    // extent which is too large for the buffer by itself.
+    SnapshotExtent batch[SNAPSHOT_IO_EXTENTS];
+    size_t         count  = 0;
+    block_count_t  blocks = 0;
+    while ((start < extents.count) && (count < SNAPSHOT_IO_EXTENTS)
+           && (blocks < SNAPSHOT_IO_BLOCKS)) {
+      SnapshotExtent *extent = &extents.extents[start];
+      block_count_t   take   = min(extent->count,
+                                   (block_count_t) (SNAPSHOT_IO_BLOCKS
+                                                    - blocks));
+      batch[count++] = (SnapshotExtent) {
+        .type  = extent->type,
+        .pbn   = extent->pbn,
+        .count = take,
+      };
+      blocks += take;
+      if (take == extent->count) {
+        start++;
+      } else {
+        extent->pbn   += take;
+        extent->count -= take;
+      }
+    }
+
+    result = copyExtents(underlying, fd, batch, count, buffer, &toc,
+                         &dumpBlock, &header);
+  }
+
+  UDS_FREE(buffer);
+  UDS_FREE(extents.extents);
+
+  if (result == VDO_SUCCESS) {
+    block_count_t tocBlocks = getDumpTOCBlocks(&toc);
+    result = UDS_ALLOCATE(tocBlocks * VDO_BLOCK_SIZE, char,
+                          "snapshot table of contents", &buffer);
+    if (result == VDO_SUCCESS) {
+      encodeDumpTOC(&toc, buffer);
+      header.contentChecksum
+        = vdo_update_crc32(header.contentChecksum, (byte *) buffer,
+                           tocBlocks * VDO_BLOCK_SIZE);
+      result = write_buffer(fd, buffer, tocBlocks * VDO_BLOCK_SIZE);
+      UDS_FREE(buffer);
+    }
+  }
+
+  freeDumpTOC(&toc);
+  if (result == VDO_SUCCESS) {
+    byte block[VDO_BLOCK_SIZE] = { 0, };
+    encodeHeader(&header, block);
+    result = write_buffer_at_offset(fd, 0, block, VDO_BLOCK_SIZE);
+  }
+
+  if (result == VDO_SUCCESS) {
+    result = sync_and_close_file(fd, "cannot write snapshot");
+  } else {
+    try_close_file(fd);
+  }
+
+  if ((result == VDO_SUCCESS) && (rename(newPath, path) != 0)) {
+    result = uds_log_error_strerror(errno, "cannot rename %s to %s",
+                                    newPath, path);
+  }
+
+  if (result != VDO_SUCCESS) {
+    remove_file(newPath);
+  }
+
+  UDS_FREE(newPath);
+  return result;
+}
+
+/**********************************************************************/
+int makeSnapshotLayer(PhysicalLayer  *underlying,
+                      const char     *path,
+                      bool            withBlockMap,
+                      PhysicalLayer **layerPtr)
+{
+  SnapshotLayer *layer;
+  int result = UDS_ALLOCATE(1, SnapshotLayer, __func__, &layer);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  layer->underlying = underlying;
+  result = openSnapshot(layer, path, withBlockMap);
+  if (result != VDO_SUCCESS) {
+    if (layer->snapshot != NULL) {
+      layer->snapshot->destroy(&layer->snapshot);
+    }
+
+    freeDumpTOC(&layer->toc);
+    result = writeSnapshot(underlying, path, withBlockMap);
+    if (result == VDO_SUCCESS) {
+      result = openSnapshot(layer, path, withBlockMap);
+    }
+  }
+
+  if (result != VDO_SUCCESS) {
+    layer->underlying = NULL;
+    freeLayer((PhysicalLayer **) &layer);
+    return result;
+  }
+
+  layer->common.destroy          = freeLayer;
+  layer->common.getBlockCount    = getBlockCount;
+  layer->common.allocateIOBuffer = allocateIOBuffer;
+  layer->common.borrowIOBuffer   = borrowIOBuffer;
+  layer->common.returnIOBuffer   = returnIOBuffer;
+  layer->common.reader           = snapshotReader;
+  layer->common.writer           = noWriter;
+  layer->common.readExtents      = snapshotBatchReader;
+  layer->common.advise           = snapshotAdvisor;
+  layer->common.getIOStatistics  = snapshotStatistics;
+  layer->common.completeFlush    = vacuousFlush;
+
+  *layerPtr = &layer->common;
+  return VDO_SUCCESS;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/snapshotLayer.h#1 $
+ */
+
+#ifndef SNAPSHOT_LAYER_H
+#define SNAPSHOT_LAYER_H
+
+#include "physicalLayer.h"
+
+/**
+ * A snapshot cache is a file holding copies of the metadata blocks which
+ * the tools read before doing anything else: the geometry block, the super
+ * block, the slab summary, and optionally every initialized block map tree
+ * page. Tools which are run one after another on the same offline VDO can
+ * share one snapshot instead of each reading these from the device.
+ *
+ * The snapshot starts with a header block and is otherwise laid out like a
+ * metadata dump, with its regions in order of PBN and a table of contents
+ * at the end (see dumpTOC.h). The header is SNAPSHOT_MAGIC, the format
+ * version and the flags as little-endian uint32_ts, the nonce as a
+ * little-endian uint64_t, the VDO state as a little-endian uint32_t, and
+ * the CRC-32s of the super block and of every block after the header, each
+ * a little-endian uint32_t.
+ *
+ * A snapshot is only used if every block after its header is intact and
+ * the geometry and super block it holds are the same as those on the
+ * device, so any change saved to the super block, such as a change to the
+ * VDO state or recovery journal, or a new nonce, makes it stale. Changes to
+ * the block map or slab summary alone do not; a VDO which is running or
+ * has been changed without saving its super block must not be read through
+ * a snapshot.
+ **/
+
+/**
+ * Make a read-only physical layer which reads the blocks held in a snapshot
+ * cache from the snapshot and all other blocks from another layer. If the
+ * snapshot file does not exist, is stale, or lacks a block map which is
+ * wanted, it is first (re)written from that layer. The snapshot layer takes
+ * ownership of the underlying layer and destroys it when it is itself
+ * destroyed.
+ *
+ * @param [in]  underlying    The layer holding the VDO
+ * @param [in]  path          The name of the snapshot file
+ * @param [in]  withBlockMap  Whether the snapshot must hold the block map
+ * @param [out] layerPtr      A pointer to hold the new layer
+ *
+ * @return VDO_SUCCESS or an error code, in which case the underlying layer
+ *         has not been destroyed
+ **/
+int __must_check makeSnapshotLayer(PhysicalLayer  *underlying,
+                                   const char     *path,
+                                   bool            withBlockMap,
+                                   PhysicalLayer **layerPtr);
+
+#endif // SNAPSHOT_LAYER_H
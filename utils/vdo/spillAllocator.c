@@ -0,0 +1,275 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/spillAllocator.c#1 $
+ */
+
+
+#include "spillAllocator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "stringUtils.h"
+#include "uds-threads.h"
+
+#include "statusCodes.h"
+
+/**
+ * The header in front of every allocation, recording where it came from.
+ **/
+typedef struct {
+  /** The number of bytes requested */
+  uint64_t bytes;
+  /** The number of bytes mapped from the file, or 0 for heap memory */
+  uint64_t mappedBytes;
+  /** The offset in the file of the mapping */
+  uint64_t offset;
+  uint64_t padding;
+} SpillHeader;
+
+struct spillAllocator {
+  /** Protects the fields below */
+  struct mutex  lock;
+  /** The heap bytes which may still be allocated before spilling */
+  size_t        budget;
+  /** The directory for the temporary file */
+  char         *directory;
+  /** The temporary file, or -1 if nothing has spilled yet */
+  int           fd;
+  /** The size of the temporary file */
+  off_t         fileSize;
+  /** The number of bytes currently mapped from the temporary file */
+  size_t        spilledBytes;
+};
+
+/**********************************************************************/
+int makeSpillAllocator(size_t           budget,
+                       const char      *directory,
+                       SpillAllocator **allocatorPtr)
+{
+  if (directory == NULL) {
+    directory = getenv("TMPDIR");
+  }
+  if (directory == NULL) {
+    directory = "/var/tmp";
+  }
+
+  SpillAllocator *allocator;
+  int result = UDS_ALLOCATE(1, SpillAllocator, __func__, &allocator);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = uds_duplicate_string(directory, __func__, &allocator->directory);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(allocator);
+    return result;
+  }
+
+  result = uds_init_mutex(&allocator->lock);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(allocator->directory);
+    UDS_FREE(allocator);
+    return result;
+  }
+
+  allocator->budget = budget;
+  allocator->fd     = -1;
+  *allocatorPtr     = allocator;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Create the temporary file for a spill allocator, and unlink it so that it
+ * goes away when it is closed. The caller must hold the allocator's lock.
+ *
+ * @param allocator  The allocator
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int openSpillFile(SpillAllocator *allocator)
+{
+  char *path;
+  int result = uds_alloc_sprintf(__func__, &path, "%s/vdoSpillXXXXXX",
+                                 allocator->directory);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  allocator->fd = mkstemp(path);
+  if (allocator->fd < 0) {
+    result = errno;
+    uds_log_error_strerror(result, "cannot create spill file in %s",
+                           allocator->directory);
+    UDS_FREE(path);
+    return result;
+  }
+
+  unlink(path);
+  UDS_FREE(path);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Allocate memory from the end of a spill allocator's temporary file. The
+ * caller must hold the allocator's lock.
+ *
+ * @param [in]  allocator  The allocator
+ * @param [in]  bytes      The number of bytes needed, including the header
+ * @param [out] headerPtr  A pointer to hold the mapped memory
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int mapSpillMemory(SpillAllocator  *allocator,
+                          size_t           bytes,
+                          SpillHeader    **headerPtr)
+{
+  if (allocator->fd < 0) {
+    int result = openSpillFile(allocator);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  size_t pageSize    = sysconf(_SC_PAGESIZE);
+  size_t mappedBytes = ((bytes + pageSize - 1) / pageSize) * pageSize;
+  off_t  offset      = allocator->fileSize;
+  if (ftruncate(allocator->fd, offset + mappedBytes) != 0) {
+    return errno;
+  }
+
+  void *memory = mmap(NULL, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      allocator->fd, offset);
+  if (memory == MAP_FAILED) {
+    return errno;
+  }
+
+  allocator->fileSize     += mappedBytes;
+  allocator->spilledBytes += mappedBytes;
+
+  SpillHeader *header = memory;
+  header->mappedBytes = mappedBytes;
+  header->offset      = offset;
+  *headerPtr          = header;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int spillAllocate(SpillAllocator *allocator,
+                  size_t          bytes,
+                  const char     *what,
+                  void           *ptr)
+{
+  size_t       totalBytes = sizeof(SpillHeader) + bytes;
+  SpillHeader *header     = NULL;
+  int          result     = VDO_SUCCESS;
+
+  uds_lock_mutex(&allocator->lock);
+  bool fromHeap = (totalBytes <= allocator->budget);
+  if (fromHeap) {
+    allocator->budget -= totalBytes;
+  } else {
+    result = mapSpillMemory(allocator, totalBytes, &header);
+  }
+  uds_unlock_mutex(&allocator->lock);
+
+  if (fromHeap) {
+    result = UDS_ALLOCATE(totalBytes, char, what, &header);
+    if (result != VDO_SUCCESS) {
+      uds_lock_mutex(&allocator->lock);
+      allocator->budget += totalBytes;
+      uds_unlock_mutex(&allocator->lock);
+    }
+  }
+
+  if (result != VDO_SUCCESS) {
+    uds_log_error_strerror(result, "cannot allocate %zu bytes for %s",
+                           bytes, what);
+    return result;
+  }
+
+  header->bytes = bytes;
+  *((void **) ptr) = header + 1;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+void spillFree(SpillAllocator *allocator, void *ptr)
+{
+  if (ptr == NULL) {
+    return;
+  }
+
+  SpillHeader *header = ((SpillHeader *) ptr) - 1;
+  if (header->mappedBytes == 0) {
+    size_t totalBytes = sizeof(SpillHeader) + header->bytes;
+    UDS_FREE(header);
+    uds_lock_mutex(&allocator->lock);
+    allocator->budget += totalBytes;
+    uds_unlock_mutex(&allocator->lock);
+    return;
+  }
+
+  uint64_t mappedBytes = header->mappedBytes;
+  uint64_t offset      = header->offset;
+  munmap(header, mappedBytes);
+  uds_lock_mutex(&allocator->lock);
+  allocator->spilledBytes -= mappedBytes;
+  // Give the space back to the file system; the file is not reused, so this
+  // is only to keep it from growing without bound.
+  if (fallocate(allocator->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                offset, mappedBytes) != 0) {
+    uds_log_debug("cannot release spilled memory: %s", strerror(errno));
+  }
+  uds_unlock_mutex(&allocator->lock);
+}
+
+/**********************************************************************/
+size_t getSpilledBytes(SpillAllocator *allocator)
+{
+  uds_lock_mutex(&allocator->lock);
+  size_t spilledBytes = allocator->spilledBytes;
+  uds_unlock_mutex(&allocator->lock);
+  return spilledBytes;
+}
+
+/**********************************************************************/
+void freeSpillAllocator(SpillAllocator **allocatorPtr)
+{
+  SpillAllocator *allocator = *allocatorPtr;
+  if (allocator == NULL) {
+    return;
+  }
+
+  if (allocator->fd >= 0) {
+    close(allocator->fd);
+  }
+
+  uds_destroy_mutex(&allocator->lock);
+  UDS_FREE(allocator->directory);
+  UDS_FREE(allocator);
+  *allocatorPtr = NULL;
+}
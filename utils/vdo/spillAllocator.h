@@ -0,0 +1,94 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/spillAllocator.h#1 $
+ */
+
+
+#ifndef SPILL_ALLOCATOR_H
+#define SPILL_ALLOCATOR_H
+
+#include "types.h"
+
+/**
+ * A SpillAllocator hands out zeroed memory for tools whose working state may
+ * be too large to hold in RAM. Allocations are made from the heap until a
+ * budget is used up; after that they are carved out of an unlinked temporary
+ * file mapped into memory, so that the kernel can write them back to the file
+ * rather than needing RAM or swap for them. A SpillAllocator may be used by
+ * many threads at once.
+ **/
+typedef struct spillAllocator SpillAllocator;
+
+/**
+ * Create a spill allocator.
+ *
+ * @param [in]  budget        The number of bytes which may be allocated from
+ *                            the heap before allocations spill to the file
+ * @param [in]  directory     The directory in which to create the temporary
+ *                            file, or NULL to use $TMPDIR or /var/tmp
+ * @param [out] allocatorPtr  A pointer to hold the new allocator
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check makeSpillAllocator(size_t           budget,
+                                    const char      *directory,
+                                    SpillAllocator **allocatorPtr);
+
+/**
+ * Allocate zeroed memory from a spill allocator.
+ *
+ * @param [in]  allocator  The allocator
+ * @param [in]  bytes      The number of bytes to allocate
+ * @param [in]  what       What is being allocated, for error messages
+ * @param [out] ptr        A pointer to hold the allocated memory
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check spillAllocate(SpillAllocator *allocator,
+                               size_t          bytes,
+                               const char     *what,
+                               void           *ptr);
+
+/**
+ * Free memory allocated by a spill allocator.
+ *
+ * @param allocator  The allocator
+ * @param ptr        The memory to free (may be NULL)
+ **/
+void spillFree(SpillAllocator *allocator, void *ptr);
+
+/**
+ * Get the number of bytes currently allocated from a spill allocator's
+ * temporary file.
+ *
+ * @param allocator  The allocator
+ *
+ * @return The number of bytes spilled
+ **/
+size_t getSpilledBytes(SpillAllocator *allocator);
+
+/**
+ * Free a spill allocator, closing its temporary file. Any memory still
+ * allocated from it must not be used afterwards.
+ *
+ * @param allocatorPtr  A pointer to the allocator, which will be NULLed out
+ **/
+void freeSpillAllocator(SpillAllocator **allocatorPtr);
+
+#endif // SPILL_ALLOCATOR_H
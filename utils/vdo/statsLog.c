@@ -0,0 +1,200 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/statsLog.c#1 $
+ */
+
+#include "statsLog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fileUtils.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+
+#include "statusCodes.h"
+
+enum {
+  STATS_LOG_VERSION    = 1,
+  STATS_LOG_BYTE_ORDER = 0x01020304,
+};
+
+static const char STATS_LOG_MAGIC[8] = "VDOSTLOG";
+
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  /** Identifies the byte order of the writer */
+  uint32_t byteOrder;
+  /** The size of each record, which identifies the writer's layout */
+  uint32_t recordSize;
+  uint32_t reserved;
+} StatsLogHeader;
+
+/**********************************************************************/
+static StatsLogHeader makeHeader(void)
+{
+  StatsLogHeader header = {
+    .version    = STATS_LOG_VERSION,
+    .byteOrder  = STATS_LOG_BYTE_ORDER,
+    .recordSize = sizeof(StatsRecord),
+  };
+  memcpy(header.magic, STATS_LOG_MAGIC, sizeof(header.magic));
+  return header;
+}
+
+/**
+ * Check that a statistics log was written in the layout this program uses.
+ *
+ * @param path    The path of the log, for messages
+ * @param header  The header of the log
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int checkHeader(const char *path, const StatsLogHeader *header)
+{
+  if (memcmp(header->magic, STATS_LOG_MAGIC, sizeof(header->magic)) != 0) {
+    return uds_log_error_strerror(VDO_BAD_MAGIC,
+                                  "%s is not a statistics log", path);
+  }
+
+  StatsLogHeader expected = makeHeader();
+  if ((header->version != expected.version)
+      || (header->byteOrder != expected.byteOrder)
+      || (header->recordSize != expected.recordSize)) {
+    return uds_log_error_strerror(VDO_UNSUPPORTED_VERSION,
+                                  "%s was written by an incompatible"
+                                  " version of vdostats", path);
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Read and check the header of a statistics log.
+ *
+ * @param fd    The file descriptor of the log
+ * @param path  The path of the log, for messages
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int readHeader(int fd, const char *path)
+{
+  StatsLogHeader header;
+  size_t length;
+  int result = read_data_at_offset(fd, 0, &header, sizeof(header), &length);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  if (length < sizeof(header)) {
+    return uds_log_error_strerror(VDO_BAD_MAGIC,
+                                  "%s is not a statistics log", path);
+  }
+
+  return checkHeader(path, &header);
+}
+
+/**********************************************************************/
+int openStatsLog(const char *path, int *fdPtr)
+{
+  int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return uds_log_error_strerror(errno, "cannot open %s", path);
+  }
+
+  off_t size;
+  int result = get_open_file_size(fd, &size);
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  if (size == 0) {
+    StatsLogHeader header = makeHeader();
+    result = write_buffer(fd, &header, sizeof(header));
+  } else {
+    result = readHeader(fd, path);
+  }
+
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  *fdPtr = fd;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int appendStatsRecord(int fd, const StatsRecord *record)
+{
+  // A single write, so that concurrent appenders can't interleave records.
+  return write_buffer(fd, record, sizeof(*record));
+}
+
+/**********************************************************************/
+int readStatsLog(const char   *path,
+                 StatsRecord **recordsPtr,
+                 size_t       *countPtr)
+{
+  int fd;
+  int result = open_file(path, FU_READ_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  off_t size;
+  result = get_open_file_size(fd, &size);
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  result = readHeader(fd, path);
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  size_t count = (size - sizeof(StatsLogHeader)) / sizeof(StatsRecord);
+  StatsRecord *records = NULL;
+  result = UDS_ALLOCATE(max(count, (size_t) 1), StatsRecord, __func__,
+                        &records);
+  if (result != VDO_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  size_t length;
+  result = read_data_at_offset(fd, sizeof(StatsLogHeader), records,
+                               count * sizeof(StatsRecord), &length);
+  try_close_file(fd);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(records);
+    return result;
+  }
+
+  *recordsPtr = records;
+  // The log may have been truncated since its size was taken.
+  *countPtr = length / sizeof(StatsRecord);
+  return VDO_SUCCESS;
+}
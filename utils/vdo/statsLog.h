@@ -0,0 +1,82 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/statsLog.h#1 $
+ */
+
+#ifndef STATS_LOG_H
+#define STATS_LOG_H
+
+#include <linux/dm-ioctl.h>
+
+#include "compiler.h"
+#include "timeUtils.h"
+#include "statistics.h"
+
+/**
+ * A log of statistics snapshots is a header followed by fixed-size records,
+ * each the statistics of one device at one time. Records are only ever
+ * appended, so a log may be written by successive runs of vdostats. The
+ * statistics are stored in the layout of the struct vdo_statistics which
+ * wrote them; the header records that layout so that a log is only read by
+ * a vdostats which agrees with it.
+ **/
+typedef struct {
+  /** When the statistics were collected, in nanoseconds since the epoch */
+  ktime_t               timestamp;
+  /** The device-mapper name of the device */
+  char                  device[DM_NAME_LEN];
+  struct vdo_statistics stats;
+} StatsRecord;
+
+/**
+ * Open a statistics log for appending, creating it if it does not exist.
+ *
+ * @param [in]  path    The path of the log
+ * @param [out] fdPtr   A pointer to hold the log's file descriptor
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check openStatsLog(const char *path, int *fdPtr);
+
+/**
+ * Append a record to a statistics log.
+ *
+ * @param fd      The file descriptor of the log
+ * @param record  The record to append
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check appendStatsRecord(int fd, const StatsRecord *record);
+
+/**
+ * Read every record from a statistics log. A partial record at the end of
+ * the log, as left by an interrupted append, is ignored.
+ *
+ * @param [in]  path        The path of the log
+ * @param [out] recordsPtr  A pointer to hold the records, which must be
+ *                          freed with UDS_FREE()
+ * @param [out] countPtr    A pointer to hold the number of records
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check readStatsLog(const char   *path,
+                              StatsRecord **recordsPtr,
+                              size_t       *countPtr);
+
+#endif // STATS_LOG_H
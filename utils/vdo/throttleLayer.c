@@ -0,0 +1,420 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/throttleLayer.c#1 $
+ */
+
+#include "throttleLayer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "permassert.h"
+#include "timeUtils.h"
+#include "uds-threads.h"
+
+#include "constants.h"
+#include "numUtils.h"
+#include "statusCodes.h"
+
+#include "parseUtils.h"
+
+enum {
+  // The I/O priority classes and encoding of linux/ioprio.h.
+  IOPRIO_CLASS_RT     = 1,
+  IOPRIO_CLASS_BE     = 2,
+  IOPRIO_CLASS_IDLE   = 3,
+  IOPRIO_CLASS_SHIFT  = 13,
+  IOPRIO_WHO_PROCESS  = 1,
+  IOPRIO_MAX_LEVEL    = 7,
+  IOPRIO_DEFAULT      = 4,
+  // How much burst each token bucket allows, in fractions of a second.
+  BURST_FRACTION      = 10,
+};
+
+/**
+ * A token bucket, kept as the time at which the bucket would be full if
+ * nothing more were drawn from it. Drawing from the bucket pushes that time
+ * later; a draw which would push it more than the burst beyond now must
+ * wait until it doesn't.
+ **/
+typedef struct {
+  /** The rate at which the bucket fills, per second, or 0 if unlimited */
+  uint64_t rate;
+  /** The time at which the bucket will be full */
+  ktime_t  fullTime;
+  /** How far ahead of now fullTime may be without waiting */
+  ktime_t  burst;
+} TokenBucket;
+
+typedef struct {
+  PhysicalLayer  common;
+  PhysicalLayer *underlying;
+  /** Protects the buckets */
+  struct mutex   lock;
+  TokenBucket    operations;
+  TokenBucket    bytes;
+  /** The total time spent waiting for the buckets */
+  ktime_t        waited;
+} ThrottleLayer;
+
+/**********************************************************************/
+static inline ThrottleLayer *asThrottleLayer(PhysicalLayer *layer)
+{
+  STATIC_ASSERT(offsetof(ThrottleLayer, common) == 0);
+  return (ThrottleLayer *) layer;
+}
+
+/**
+ * Draw tokens from a bucket. The caller must hold the layer's lock.
+ *
+ * @param bucket  The bucket
+ * @param tokens  The number of tokens to draw
+ * @param now     The current time
+ *
+ * @return How long the caller must wait before doing its I/O
+ **/
+static ktime_t drawTokens(TokenBucket *bucket, uint64_t tokens, ktime_t now)
+{
+  if (bucket->rate == 0) {
+    return 0;
+  }
+
+  ktime_t fullTime = max(bucket->fullTime, now);
+  bucket->fullTime = fullTime + (ktime_t) (tokens * NSEC_PER_SEC
+                                           / bucket->rate);
+  ktime_t wait = bucket->fullTime - bucket->burst - now;
+  return max(wait, (ktime_t) 0);
+}
+
+/**
+ * Wait until an operation may proceed without exceeding either limit.
+ *
+ * @param layer       The throttling layer
+ * @param operations  The number of operations to be done
+ * @param blockCount  The number of blocks they will transfer
+ **/
+static void throttle(ThrottleLayer *layer,
+                     uint64_t       operations,
+                     size_t         blockCount)
+{
+  ktime_t now = current_time_ns(CLOCK_MONOTONIC);
+  uds_lock_mutex(&layer->lock);
+  ktime_t wait = max(drawTokens(&layer->operations, operations, now),
+                     drawTokens(&layer->bytes,
+                                (uint64_t) blockCount * VDO_BLOCK_SIZE, now));
+  layer->waited += wait;
+  uds_unlock_mutex(&layer->lock);
+  if (wait == 0) {
+    return;
+  }
+
+  struct timespec until = {
+    .tv_sec  = (now + wait) / NSEC_PER_SEC,
+    .tv_nsec = (now + wait) % NSEC_PER_SEC,
+  };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL)
+         == EINTR) {
+    // Keep waiting.
+  }
+}
+
+/**
+ * Implements extent_reader.
+ **/
+static int throttleReader(PhysicalLayer           *header,
+                          physical_block_number_t  startBlock,
+                          size_t                   blockCount,
+                          char                    *buffer)
+{
+  ThrottleLayer *layer = asThrottleLayer(header);
+  throttle(layer, 1, blockCount);
+  return layer->underlying->reader(layer->underlying, startBlock, blockCount,
+                                   buffer);
+}
+
+/**
+ * Implements extent_writer.
+ **/
+static int throttleWriter(PhysicalLayer           *header,
+                          physical_block_number_t  startBlock,
+                          size_t                   blockCount,
+                          char                    *buffer)
+{
+  ThrottleLayer *layer = asThrottleLayer(header);
+  throttle(layer, 1, blockCount);
+  return layer->underlying->writer(layer->underlying, startBlock, blockCount,
+                                   buffer);
+}
+
+/**
+ * Zeroing moves no data, so it counts only as an operation.
+ *
+ * Implements extent_zeroer.
+ **/
+static int throttleZeroer(PhysicalLayer           *header,
+                          physical_block_number_t  startBlock,
+                          size_t                   blockCount)
+{
+  ThrottleLayer *layer      = asThrottleLayer(header);
+  PhysicalLayer *underlying = layer->underlying;
+  if (underlying->zeroExtent == NULL) {
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  throttle(layer, 1, 0);
+  return underlying->zeroExtent(underlying, startBlock, blockCount);
+}
+
+/**
+ * Implements extent_copier.
+ **/
+static int throttleCopier(PhysicalLayer           *header,
+                          physical_block_number_t  startBlock,
+                          size_t                   blockCount,
+                          int                      fd,
+                          off_t                   *offsetPtr)
+{
+  ThrottleLayer *layer      = asThrottleLayer(header);
+  PhysicalLayer *underlying = layer->underlying;
+  if (underlying->copyExtent == NULL) {
+    return VDO_NOT_IMPLEMENTED;
+  }
+
+  throttle(layer, 1, blockCount);
+  return underlying->copyExtent(underlying, startBlock, blockCount, fd,
+                                offsetPtr);
+}
+
+/**
+ * Meter a whole batch, then pass it on so its reads can still be issued
+ * together.
+ *
+ * Implements batch_extent_reader.
+ **/
+static int throttleBatchReader(PhysicalLayer        *header,
+                               struct extent_read   *extents,
+                               size_t                count,
+                               extent_read_callback *callback,
+                               void                 *context)
+{
+  ThrottleLayer *layer = asThrottleLayer(header);
+  size_t blockCount = 0;
+  for (size_t i = 0; i < count; i++) {
+    blockCount += extents[i].block_count;
+  }
+
+  throttle(layer, count, blockCount);
+  return layer->underlying->readExtents(layer->underlying, extents, count,
+                                        callback, context);
+}
+
+/**
+ * Implements access_advisor.
+ **/
+static void throttleAdvisor(PhysicalLayer           *header,
+                            physical_block_number_t  startBlock,
+                            block_count_t            blockCount,
+                            enum access_pattern      pattern)
+{
+  PhysicalLayer *underlying = asThrottleLayer(header)->underlying;
+  if (underlying->advise != NULL) {
+    underlying->advise(underlying, startBlock, blockCount, pattern);
+  }
+}
+
+/**
+ * Implements io_statistics_getter.
+ **/
+static void throttleStatistics(PhysicalLayer        *header,
+                               struct io_statistics *stats)
+{
+  PhysicalLayer *underlying = asThrottleLayer(header)->underlying;
+  if (underlying->getIOStatistics != NULL) {
+    underlying->getIOStatistics(underlying, stats);
+  } else {
+    *stats = (struct io_statistics) { 0, };
+  }
+}
+
+/**********************************************************************/
+static block_count_t getBlockCount(PhysicalLayer *header)
+{
+  PhysicalLayer *underlying = asThrottleLayer(header)->underlying;
+  return underlying->getBlockCount(underlying);
+}
+
+/**********************************************************************/
+static int allocateIOBuffer(PhysicalLayer  *header,
+                            size_t          bytes,
+                            const char     *why,
+                            char          **bufferPtr)
+{
+  PhysicalLayer *underlying = asThrottleLayer(header)->underlying;
+  return underlying->allocateIOBuffer(underlying, bytes, why, bufferPtr);
+}
+
+/**********************************************************************/
+static int borrowIOBuffer(PhysicalLayer  *header,
+                          size_t          bytes,
+                          const char     *why,
+                          char          **bufferPtr)
+{
+  PhysicalLayer *underlying = asThrottleLayer(header)->underlying;
+  return underlying->borrowIOBuffer(underlying, bytes, why, bufferPtr);
+}
+
+/**********************************************************************/
+static void returnIOBuffer(PhysicalLayer *header, size_t bytes, char *buffer)
+{
+  PhysicalLayer *underlying = asThrottleLayer(header)->underlying;
+  underlying->returnIOBuffer(underlying, bytes, buffer);
+}
+
+/**********************************************************************/
+static void vacuousFlush(struct vdo_flush *vdoFlush __attribute__((unused)))
+{
+}
+
+/**
+ * Free a ThrottleLayer and its underlying layer, and NULL out the reference
+ * to it.
+ *
+ * Implements layer_destructor.
+ **/
+static void freeLayer(PhysicalLayer **layerPtr)
+{
+  PhysicalLayer *header = *layerPtr;
+  if (header == NULL) {
+    return;
+  }
+
+  ThrottleLayer *layer = asThrottleLayer(header);
+  uds_log_debug("I/O throttle: waited %lld ms",
+                (long long) ktime_to_ms(layer->waited));
+  if (layer->underlying != NULL) {
+    layer->underlying->destroy(&layer->underlying);
+  }
+
+  uds_destroy_mutex(&layer->lock);
+  UDS_FREE(layer);
+  *layerPtr = NULL;
+}
+
+/**
+ * Set up a token bucket.
+ *
+ * @param bucket  The bucket
+ * @param rate    The rate at which it fills, per second, or 0 for no limit
+ **/
+static void initializeBucket(TokenBucket *bucket, uint64_t rate)
+{
+  *bucket = (TokenBucket) {
+    .rate  = rate,
+    .burst = NSEC_PER_SEC / BURST_FRACTION,
+  };
+}
+
+/**********************************************************************/
+int makeThrottleLayer(PhysicalLayer  *underlying,
+                      uint64_t        maxIOPS,
+                      uint64_t        maxBandwidth,
+                      PhysicalLayer **layerPtr)
+{
+  ThrottleLayer *layer;
+  int result = UDS_ALLOCATE(1, ThrottleLayer, __func__, &layer);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  result = uds_init_mutex(&layer->lock);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(layer);
+    return result;
+  }
+
+  initializeBucket(&layer->operations, maxIOPS);
+  initializeBucket(&layer->bytes, maxBandwidth);
+
+  layer->underlying              = underlying;
+  layer->common.destroy          = freeLayer;
+  layer->common.getBlockCount    = getBlockCount;
+  layer->common.allocateIOBuffer = allocateIOBuffer;
+  layer->common.borrowIOBuffer   = borrowIOBuffer;
+  layer->common.returnIOBuffer   = returnIOBuffer;
+  layer->common.reader           = throttleReader;
+  layer->common.writer           = throttleWriter;
+  layer->common.readExtents      = throttleBatchReader;
+  layer->common.zeroExtent       = throttleZeroer;
+  layer->common.copyExtent       = throttleCopier;
+  layer->common.advise           = throttleAdvisor;
+  layer->common.getIOStatistics  = throttleStatistics;
+  layer->common.completeFlush    = vacuousFlush;
+
+  *layerPtr = &layer->common;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int setIOPriority(const char *priority)
+{
+  static const struct {
+    const char *name;
+    int         class;
+    bool        leveled;
+  } CLASSES[] = {
+    { "realtime",    IOPRIO_CLASS_RT,   true  },
+    { "best-effort", IOPRIO_CLASS_BE,   true  },
+    { "idle",        IOPRIO_CLASS_IDLE, false },
+  };
+
+  const char   *colon  = strchr(priority, ':');
+  size_t        length = ((colon == NULL) ? strlen(priority)
+                          : (size_t) (colon - priority));
+  unsigned int  level  = IOPRIO_DEFAULT;
+  for (unsigned int i = 0; i < COUNT_OF(CLASSES); i++) {
+    if ((strlen(CLASSES[i].name) != length)
+        || (strncmp(priority, CLASSES[i].name, length) != 0)) {
+      continue;
+    }
+
+    if (colon != NULL) {
+      if (!CLASSES[i].leveled
+          || (parseUInt(colon + 1, 0, IOPRIO_MAX_LEVEL, &level)
+              != VDO_SUCCESS)) {
+        return VDO_OUT_OF_RANGE;
+      }
+    } else if (!CLASSES[i].leveled) {
+      level = 0;
+    }
+
+    int value = ((CLASSES[i].class << IOPRIO_CLASS_SHIFT) | level);
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, value) != 0) {
+      return errno;
+    }
+
+    return VDO_SUCCESS;
+  }
+
+  return VDO_OUT_OF_RANGE;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA. 
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/throttleLayer.h#1 $
+ */
+
+#ifndef THROTTLE_LAYER_H
+#define THROTTLE_LAYER_H
+
+#include "physicalLayer.h"
+
+/**
+ * Make a physical layer which limits the rate of I/O to another layer, so
+ * that a tool scanning a volume on shared storage does not crowd out other
+ * users of it. Operations and bytes are each metered by a token bucket
+ * which refills at the given rate and holds a tenth of a second of burst;
+ * an operation which would overdraw either bucket waits until it would
+ * not. Every extent of a batched read counts as an operation, and the whole
+ * batch is metered before it is passed on, so the underlying layer may
+ * still issue it at once. Extents can't be mapped through the layer, since
+ * the reads of a mapping could not be metered. The throttling layer takes
+ * ownership of the underlying layer and destroys it when it is itself
+ * destroyed.
+ *
+ * @param [in]  underlying    The layer to throttle
+ * @param [in]  maxIOPS       The most operations per second, or 0 for no
+ *                            limit
+ * @param [in]  maxBandwidth  The most bytes per second, or 0 for no limit
+ * @param [out] layerPtr      A pointer to hold the new layer
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check makeThrottleLayer(PhysicalLayer  *underlying,
+                                   uint64_t        maxIOPS,
+                                   uint64_t        maxBandwidth,
+                                   PhysicalLayer **layerPtr);
+
+/**
+ * Set the I/O scheduling priority of the calling thread, which threads it
+ * creates afterwards inherit, in the manner of ionice(1). The priority is a
+ * class, one of "idle", "best-effort", or "realtime", optionally followed
+ * by a colon and a level from 0 (highest) to 7 for the best-effort and
+ * realtime classes. Only I/O schedulers which support priorities honor it.
+ *
+ * @param priority  The priority to set
+ *
+ * @return VDO_SUCCESS, VDO_OUT_OF_RANGE if the priority can't be parsed, or
+ *         an error from the system
+ **/
+int __must_check setIOPriority(const char *priority);
+
+#endif // THROTTLE_LAYER_H
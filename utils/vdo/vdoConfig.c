@@ -27,6 +27,7 @@
 #include "memoryAlloc.h"
 #include "permassert.h"
 #include "timeUtils.h"
+#include "uds-threads.h"
 
 #include "blockMapFormat.h"
 #include "constants.h"
@@ -42,6 +43,7 @@
 #include "vdoState.h"
 #include "volumeGeometry.h"
 
+#include "progress.h"
 #include "userVDO.h"
 #include "vdoVolumeUtils.h"
 
@@ -217,26 +219,89 @@ int calculateMinimumVDOFromConfig(const struct vdo_config   *config,
   return VDO_SUCCESS;
 }
 
+/**********************************************************************/
+int planVDO(const struct vdo_config   *config,
+            const struct index_config *indexConfig,
+            VDOPlan                   *plan)
+{
+  int result = validate_vdo_config(config, config->physical_blocks, false);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  UserVDO *vdo;
+  result = makeUserVDO(NULL, &vdo);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  uuid_t uuid;
+  uuid_clear(uuid);
+  result = vdo_initialize_volume_geometry(0, &uuid, indexConfig,
+                                          &vdo->geometry);
+  if (result == VDO_SUCCESS) {
+    vdo->states.vdo.config = *config;
+    result = configureVDO(vdo);
+  }
+
+  if (result != VDO_SUCCESS) {
+    freeUserVDO(&vdo);
+    return result;
+  }
+
+  block_count_t dataBlocks
+    = vdo->slabCount * vdo->states.slab_depot.slab_config.data_blocks;
+  block_count_t logicalBlocks = vdo->states.vdo.config.logical_blocks;
+  *plan = (VDOPlan) {
+    .indexBlocks    = (vdo_get_data_region_start(vdo->geometry)
+                       - vdo_get_index_region_start(vdo->geometry)),
+    .overheadBlocks = config->physical_blocks - dataBlocks,
+    .dataBlocks     = dataBlocks,
+    .slabCount      = vdo->slabCount,
+    .logicalBlocks  = logicalBlocks,
+    .forestBlocks   = computeForestSize(logicalBlocks,
+                                        DEFAULT_VDO_BLOCK_MAP_TREE_ROOT_COUNT),
+  };
+  freeUserVDO(&vdo);
+  return VDO_SUCCESS;
+}
+
+/**
+ * An extent of a new VDO to be cleared, as by clearExtent(), possibly on a
+ * thread of its own.
+ **/
+typedef struct {
+  UserVDO                 *vdo;
+  const char              *what;
+  physical_block_number_t  start;
+  block_count_t            size;
+  struct thread           *thread;
+  int                      result;
+} ClearTask;
+
 /**
- * Clear a partition by writing zeros to every block in that partition.
+ * Clear an extent. The layer is asked to zero the extent directly, which
+ * is nearly free on devices and file systems which support it; otherwise
+ * zeros are written to every block in the extent.
  *
- * @param vdo  The VDO with the partition to be cleared
- * @param id   The ID of the partition to clear
+ * @param vdo    The VDO with the extent to be cleared
+ * @param start  The first block of the extent
+ * @param size   The number of blocks in the extent
  *
  * @return VDO_SUCCESS or an error code
  **/
-static int __must_check clearPartition(UserVDO *vdo, enum partition_id id)
+static int __must_check clearExtent(UserVDO                 *vdo,
+                                    physical_block_number_t  start,
+                                    block_count_t            size)
 {
-  struct partition *partition;
-  int result = vdo_get_partition(vdo->states.layout, id, &partition);
-  if (result != VDO_SUCCESS) {
-    return result;
+  if (vdo->layer->zeroExtent != NULL) {
+    int result = vdo->layer->zeroExtent(vdo->layer, start, size);
+    if (result != VDO_NOT_IMPLEMENTED) {
+      addProgress(size);
+      return result;
+    }
   }
 
-  block_count_t size = get_vdo_fixed_layout_partition_size(partition);
-  physical_block_number_t start
-    = get_vdo_fixed_layout_partition_offset(partition);
-
   block_count_t bufferBlocks = 1;
   for (block_count_t n = size;
        (bufferBlocks < 4096) && ((n & 0x1) == 0);
@@ -245,9 +310,9 @@ static int __must_check clearPartition(UserVDO *vdo, enum partition_id id)
   }
 
   char *zeroBuffer;
-  result = vdo->layer->allocateIOBuffer(vdo->layer,
-                                        bufferBlocks * VDO_BLOCK_SIZE,
-                                        "zero buffer", &zeroBuffer);
+  int result = vdo->layer->allocateIOBuffer(vdo->layer,
+                                            bufferBlocks * VDO_BLOCK_SIZE,
+                                            "zero buffer", &zeroBuffer);
   if (result != VDO_SUCCESS) {
     return result;
   }
@@ -256,12 +321,101 @@ static int __must_check clearPartition(UserVDO *vdo, enum partition_id id)
        (pbn < start + size) && (result == VDO_SUCCESS);
        pbn += bufferBlocks) {
     result = vdo->layer->writer(vdo->layer, pbn, bufferBlocks, zeroBuffer);
+    addProgress(bufferBlocks);
   }
 
   UDS_FREE(zeroBuffer);
   return result;
 }
 
+/**
+ * Clear the extent of a ClearTask.
+ *
+ * @param arg  The ClearTask
+ **/
+static void clearTaskExtent(void *arg)
+{
+  ClearTask *task = arg;
+  task->result = clearExtent(task->vdo, task->start, task->size);
+}
+
+/**
+ * Make a task to clear a partition.
+ *
+ * @param vdo   The VDO with the partition to be cleared
+ * @param id    The ID of the partition to clear
+ * @param what  The name of the partition, for error messages
+ *
+ * @return The task
+ **/
+static ClearTask makePartitionClearTask(UserVDO           *vdo,
+                                        enum partition_id  id,
+                                        const char        *what)
+{
+  const struct partition *partition = getPartition(vdo, id, what);
+  return (ClearTask) {
+    .vdo   = vdo,
+    .what  = what,
+    .start = get_vdo_fixed_layout_partition_offset(partition),
+    .size  = get_vdo_fixed_layout_partition_size(partition),
+  };
+}
+
+/**
+ * Clear the block map roots and recovery journal of a new VDO, and the
+ * super block of any index which was previously on the device. These
+ * extents don't overlap, so they are cleared at the same time.
+ *
+ * @param vdo  The VDO to clear
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+static int __must_check clearMetadata(UserVDO *vdo)
+{
+  ClearTask tasks[] = {
+    makePartitionClearTask(vdo, BLOCK_MAP_PARTITION, "block map partition"),
+    makePartitionClearTask(vdo, RECOVERY_JOURNAL_PARTITION,
+                           "recovery journal partition"),
+    {
+      .vdo   = vdo,
+      .what  = "index super block",
+      .start = vdo_get_index_region_start(vdo->geometry),
+      .size  = 1,
+    },
+  };
+
+  block_count_t total = 0;
+  for (unsigned int i = 0; i < COUNT_OF(tasks); i++) {
+    total += tasks[i].size;
+  }
+  setProgressPhase("clearing metadata", "blocks", total);
+
+  // This thread clears the first extent, and any whose thread won't start.
+  for (unsigned int i = 1; i < COUNT_OF(tasks); i++) {
+    if (uds_create_thread(clearTaskExtent, &tasks[i], "clearer",
+                          &tasks[i].thread) != UDS_SUCCESS) {
+      tasks[i].thread = NULL;
+      clearTaskExtent(&tasks[i]);
+    }
+  }
+
+  clearTaskExtent(&tasks[0]);
+  for (unsigned int i = 1; i < COUNT_OF(tasks); i++) {
+    if (tasks[i].thread != NULL) {
+      uds_join_threads(tasks[i].thread);
+    }
+  }
+
+  for (unsigned int i = 0; i < COUNT_OF(tasks); i++) {
+    if (tasks[i].result != VDO_SUCCESS) {
+      return uds_log_error_strerror(tasks[i].result, "cannot clear %s",
+                                    tasks[i].what);
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
 /**
  * Configure a VDO and its geometry and write it out.
  *
@@ -296,15 +450,9 @@ static int configureAndWriteVDO(UserVDO                   *vdo,
     return result;
   }
 
-  result = clearPartition(vdo, BLOCK_MAP_PARTITION);
+  result = clearMetadata(vdo);
   if (result != VDO_SUCCESS) {
-    return uds_log_error_strerror(result, "cannot clear block map partition");
-  }
-
-  result = clearPartition(vdo, RECOVERY_JOURNAL_PARTITION);
-  if (result != VDO_SUCCESS) {
-    return uds_log_error_strerror(result,
-                                  "cannot clear recovery journal partition");
+    return result;
   }
 
   return saveVDO(vdo, true);
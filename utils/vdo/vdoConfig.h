@@ -68,6 +68,39 @@ int calculateMinimumVDOFromConfig(const struct vdo_config *config,
 				  block_count_t *minVDOBlocks)
   __attribute__((warn_unused_result));
 
+/**
+ * The sizes of the parts of a VDO which would be formatted with a given
+ * configuration.
+ **/
+typedef struct {
+	/** The blocks of the index region */
+	block_count_t indexBlocks;
+	/** The blocks which can never hold data, including the index */
+	block_count_t overheadBlocks;
+	/** The slab data blocks, including those the forest will use */
+	block_count_t dataBlocks;
+	/** The number of slabs */
+	slab_count_t slabCount;
+	/** The logical size, defaulted as the format would if not given */
+	block_count_t logicalBlocks;
+	/** The block map pages needed to map every logical block */
+	block_count_t forestBlocks;
+} VDOPlan;
+
+/**
+ * Compute how a VDO would be laid out by formatVDO(), without formatting
+ * anything.
+ *
+ * @param [in]  config       The configuration parameters for the VDO
+ * @param [in]  indexConfig  The configuration parameters for the index
+ * @param [out] plan         The plan to fill in
+ *
+ * @return VDO_SUCCESS or an error, as formatVDO() would return
+ **/
+int __must_check planVDO(const struct vdo_config *config,
+			 const struct index_config *indexConfig,
+			 VDOPlan *plan);
+
 /**
  * Make a fixed_layout according to a vdo_config. Exposed for testing only.
  *
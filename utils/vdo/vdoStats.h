@@ -44,4 +44,30 @@ int read_vdo_stats(char *buf, struct vdo_statistics *stats);
  */
 int write_vdo_stats(struct vdo_statistics *stats);
 
+/**
+ * A function called with each statistic as it would be written by
+ * write_vdo_stats().
+ *
+ * @param label    the label of the statistic, including its indentation
+ * @param value    the formatted value of the statistic
+ * @param context  the context passed to visit_vdo_stats()
+ */
+typedef void vdo_stats_visitor(const char *label,
+			       const char *value,
+			       void *context);
+
+/**
+ * Call a function with the label and value of each vdo statistic, in the
+ * order write_vdo_stats() would write them.
+ *
+ * @param stats    pointer to the statistics
+ * @param visitor  the function to call
+ * @param context  a context for the function
+ *
+ * @return VDO_SUCCESS or an error
+ */
+int visit_vdo_stats(struct vdo_statistics *stats,
+		    vdo_stats_visitor *visitor,
+		    void *context);
+
 #endif  /* VDO_STATS_H */
@@ -1450,7 +1450,7 @@ static int write_vdo_statistics(char *prefix,
 }
 
 /**********************************************************************/
-int write_vdo_stats(struct vdo_statistics *stats)
+static int format_vdo_stats(struct vdo_statistics *stats)
 {
 	fieldCount = 0;
 	maxLabelLength = 0;
@@ -1458,7 +1458,28 @@ int write_vdo_stats(struct vdo_statistics *stats)
 	memset(labels, '\0', MAX_STATS * MAX_STAT_LENGTH);
 	memset(values, '\0', MAX_STATS * MAX_STAT_LENGTH);
 
-	int result = write_vdo_statistics(" ", stats);
+	return write_vdo_statistics(" ", stats);
+}
+
+/**********************************************************************/
+int visit_vdo_stats(struct vdo_statistics *stats,
+		    vdo_stats_visitor *visitor,
+		    void *context)
+{
+	int result = format_vdo_stats(stats);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+	for (int i = 0; i < fieldCount; i++) {
+		visitor(labels[i], values[i], context);
+	}
+	return VDO_SUCCESS;
+}
+
+/**********************************************************************/
+int write_vdo_stats(struct vdo_statistics *stats)
+{
+	int result = format_vdo_stats(stats);
 	if (result != VDO_SUCCESS) {
 		return result;
 	}
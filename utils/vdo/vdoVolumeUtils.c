@@ -27,17 +27,26 @@
 
 #include "statusCodes.h"
 
+#include "dumpLayer.h"
 #include "fileLayer.h"
+#include "snapshotLayer.h"
+#include "throttleLayer.h"
 #include "userVDO.h"
 
 static char errBuf[ERRBUF_SIZE];
 
+/** The limits set by setVDOIOLimits() */
+static uint64_t maxIOPS      = 0;
+static uint64_t maxBandwidth = 0;
+
 /**
  * Load a VDO from a file.
  *
  * @param [in]  filename        The file name
  * @param [in]  readOnly        Whether the layer should be read-only.
  * @param [in]  validateConfig  Whether the VDO should validate its config
+ * @param [in]  snapshot        The name of a snapshot cache file, or NULL
+ * @param [in]  withBlockMap    Whether the snapshot should hold the block map
  * @param [out] vdoPtr          A pointer to hold the VDO
  *
  * @return VDO_SUCCESS or an error code
@@ -45,6 +54,8 @@ static char errBuf[ERRBUF_SIZE];
 static int __must_check loadVDOFromFile(const char *filename,
 					bool readOnly,
 					bool validateConfig,
+					const char *snapshot,
+					bool withBlockMap,
 					UserVDO **vdoPtr)
 {
   int result = ASSERT(validateConfig || readOnly,
@@ -55,10 +66,17 @@ static int __must_check loadVDOFromFile(const char *filename,
   }
 
   PhysicalLayer *layer;
-  if (readOnly) {
-    result = makeReadOnlyFileLayer(filename, &layer);
-  } else {
-    result = makeFileLayer(filename, 0, &layer);
+  result = VDO_NOT_IMPLEMENTED;
+  if (!validateConfig) {
+    // Unvalidated loads are mostly of dump files, which may be incremental
+    // or compressed, and otherwise can be mapped.
+    result = makeDumpLayer(filename, &layer);
+  }
+
+  if (result == VDO_NOT_IMPLEMENTED) {
+    result = (readOnly
+              ? makeReadOnlyFileLayer(filename, &layer)
+              : makeFileLayer(filename, 0, &layer));
   }
 
   if (result != VDO_SUCCESS) {
@@ -67,6 +85,32 @@ static int __must_check loadVDOFromFile(const char *filename,
     return result;
   }
 
+  if ((maxIOPS != 0) || (maxBandwidth != 0)) {
+    // Throttle only the I/O to the file, and not reads from a snapshot.
+    PhysicalLayer *throttleLayer;
+    result = makeThrottleLayer(layer, maxIOPS, maxBandwidth, &throttleLayer);
+    if (result != VDO_SUCCESS) {
+      layer->destroy(&layer);
+      warnx("Could not limit the I/O to '%s': %s", filename,
+            uds_string_error(result, errBuf, ERRBUF_SIZE));
+      return result;
+    }
+
+    layer = throttleLayer;
+  }
+
+  if (snapshot != NULL) {
+    // Carry on without the snapshot if it can't be used or written.
+    PhysicalLayer *snapshotLayer;
+    result = makeSnapshotLayer(layer, snapshot, withBlockMap, &snapshotLayer);
+    if (result == VDO_SUCCESS) {
+      layer = snapshotLayer;
+    } else {
+      warnx("Could not use snapshot cache '%s': %s", snapshot,
+            uds_string_error(result, errBuf, ERRBUF_SIZE));
+    }
+  }
+
   // Create the VDO.
   UserVDO *vdo;
   result = loadVDO(layer, validateConfig, &vdo);
@@ -84,13 +128,31 @@ static int __must_check loadVDOFromFile(const char *filename,
 /**********************************************************************/
 int makeVDOFromFile(const char *filename, bool readOnly, UserVDO **vdoPtr)
 {
-  return loadVDOFromFile(filename, readOnly, true, vdoPtr);
+  return loadVDOFromFile(filename, readOnly, true, NULL, false, vdoPtr);
 }
 
 /**********************************************************************/
 int readVDOWithoutValidation(const char *filename, UserVDO **vdoPtr)
 {
-  return loadVDOFromFile(filename, true, false, vdoPtr);
+  return loadVDOFromFile(filename, true, false, NULL, false, vdoPtr);
+}
+
+/**********************************************************************/
+int loadVDOWithSnapshot(const char  *filename,
+                        bool         validateConfig,
+                        const char  *snapshot,
+                        bool         withBlockMap,
+                        UserVDO    **vdoPtr)
+{
+  return loadVDOFromFile(filename, true, validateConfig, snapshot,
+                         withBlockMap, vdoPtr);
+}
+
+/**********************************************************************/
+void setVDOIOLimits(uint64_t iops, uint64_t bandwidth)
+{
+  maxIOPS      = iops;
+  maxBandwidth = bandwidth;
 }
 
 /**********************************************************************/
@@ -49,6 +49,37 @@ makeVDOFromFile(const char *filename, bool readOnly, UserVDO **vdoPtr);
 int __must_check
 readVDOWithoutValidation(const char *filename, UserVDO **vdoPtr);
 
+/**
+ * Load a VDO from a file read-only, reading its geometry, super block, slab
+ * summary, and optionally its block map from a snapshot cache file (see
+ * snapshotLayer.h) instead of the file if the snapshot is current. The
+ * snapshot is written if it is missing or stale. If the snapshot can't be
+ * used, the VDO is loaded from the file alone.
+ *
+ * @param [in]  filename        The file name
+ * @param [in]  validateConfig  Whether the VDO should validate its config
+ * @param [in]  snapshot        The name of the snapshot file, or NULL to
+ *                              load without one
+ * @param [in]  withBlockMap    Whether the snapshot should hold the block map
+ * @param [out] vdoPtr          A pointer to hold the VDO
+ *
+ * @return VDO_SUCCESS or an error code
+ **/
+int __must_check loadVDOWithSnapshot(const char  *filename,
+                                     bool         validateConfig,
+                                     const char  *snapshot,
+                                     bool         withBlockMap,
+                                     UserVDO    **vdoPtr);
+
+/**
+ * Limit the rate of I/O to the files of the VDOs loaded from now on (see
+ * throttleLayer.h). Reads satisfied from a snapshot cache are not limited.
+ *
+ * @param iops       The most operations per second, or 0 for no limit
+ * @param bandwidth  The most bytes per second, or 0 for no limit
+ **/
+void setVDOIOLimits(uint64_t iops, uint64_t bandwidth);
+
 /**
  * Free the VDO made with makeVDOFromFile().
  *
@@ -20,19 +20,30 @@
  */
 
 #include <err.h>
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <linux/fs.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "errors.h"
 #include "fileUtils.h"
 #include "logger.h"
 #include "memoryAlloc.h"
+#include "numeric.h"
+#include "random.h"
+#include "stringUtils.h"
 #include "syscalls.h"
+#include "timeUtils.h"
+#include "uds-threads.h"
+#include "udsProbes.h"
 
 #include "numUtils.h"
 #include "packedReferenceBlock.h"
@@ -44,7 +55,14 @@
 #include "vdoState.h"
 
 #include "blockMapUtils.h"
+#include "ioStatistics.h"
+#include "journalChecker.h"
+#include "metadataIterators.h"
+#include "parseUtils.h"
+#include "progress.h"
 #include "slabSummaryReader.h"
+#include "spillAllocator.h"
+#include "throttleLayer.h"
 #include "userVDO.h"
 #include "vdoVolumeUtils.h"
 
@@ -53,37 +71,249 @@
 enum {
   MIN_ERROR_DELTA = -255,
   MAX_ERROR_DELTA = 255,
+  // The most threads --threads may ask for.
+  MAX_THREADS     = 1024,
+  // The number of slabs whose reference counts each thread keeps in flight.
+  PIPELINE_DEPTH  = 3,
+  // The number of reference counts compared at once by verifyRefCountSector().
+  CHUNK_WORDS     = 4,
+  CHUNK_COUNTS    = CHUNK_WORDS * sizeof(uint64_t),
+  // The number of buckets in a histogram of reference count errors.
+  DELTA_BUCKETS   = MAX_ERROR_DELTA - MIN_ERROR_DELTA + 1,
+  // The number of buckets in a histogram of audited reference counts.
+  COUNT_BUCKETS   = UINT8_MAX + 1,
+  // The number of buckets in the --analytics histogram of slab utilization.
+  UTILIZATION_BUCKETS = 10,
+  // The initial size of the overflow table of a compactly tracked slab.
+  MIN_OVERFLOW    = 64,
+  // How often --checkpoint saves the progress of the audit.
+  CHECKPOINT_INTERVAL_SECONDS = 300,
+  CHECKPOINT_VERSION          = 2,
+  CHECKPOINT_HEADER_BYTES     = 88,
+  // The fixed part of the checkpoint record of a verified slab.
+  VERIFIED_SLAB_BYTES         = 12,
+  // The most memory the stored counts read during the walk may take up
+  // without --memory-limit.
+  PRELOAD_LIMIT_BYTES         = 1 << 30,
+  // The number of volumes --batch audits at once without --jobs.
+  DEFAULT_BATCH_JOBS          = 4,
+  // The most volumes --jobs may ask to audit at once.
+  MAX_BATCH_JOBS              = 256,
 };
 
+/** The phases of an audit which a checkpoint may record */
+typedef enum {
+  AUDIT_PHASE_WALK   = 0,
+  AUDIT_PHASE_VERIFY = 1,
+} AuditPhase;
+
+static const char CHECKPOINT_MAGIC[] = "VDOAUDCP";
+
+/** The normal quantile for the 95% confidence interval of a sampled audit */
+static const double CONFIDENCE_Z = 1.96;
+
+/** A range of audited reference counts reported by --analytics */
+typedef struct {
+  const char     *name;
+  vdo_refcount_t  first;
+  vdo_refcount_t  last;
+} CountRange;
+
+static const CountRange COUNT_RANGES[] = {
+  { "free",      EMPTY_REFERENCE_COUNT,       EMPTY_REFERENCE_COUNT       },
+  { "1",         1,                           1                           },
+  { "2-10",      2,                           10                          },
+  { "11-100",    11,                          100                         },
+  { "101-254",   101,                         MAXIMUM_REFERENCE_COUNT     },
+  { "treePages", PROVISIONAL_REFERENCE_COUNT, PROVISIONAL_REFERENCE_COUNT },
+};
+
+/** The phases of an audit which are timed */
+typedef enum {
+  TIMED_PHASE_WALK     = 0,
+  TIMED_PHASE_SUMMARY  = 1,
+  TIMED_PHASE_VERIFY   = 2,
+  TIMED_PHASE_JOURNALS = 3,
+  TIMED_PHASE_COUNT    = 4,
+} TimedPhase;
+
+/** The wall clock and CPU time taken by a phase of the audit */
+typedef struct {
+  const char *name;
+  /** Whether the phase ran, which it may not have if the audit resumed */
+  bool        ran;
+  ktime_t     wallStart;
+  ktime_t     cpuStart;
+  ktime_t     wallTime;
+  ktime_t     cpuTime;
+} PhaseTiming;
+
+/**
+ * An entry in the table of the audited reference counts of the blocks of a
+ * compactly tracked slab which are referenced more than once or are tree
+ * pages.
+ **/
+typedef struct {
+  slab_block_number sbn;
+  /** The audited reference count, or zero if the entry is empty */
+  vdo_refcount_t    count;
+} OverflowEntry;
+
 /**
  * A record to hold the audit information for each slab.
+ *
+ * The audited reference counts are allocated when the block map first
+ * refers to the slab, and freed once the slab has been verified. Normally
+ * there is a byte for each block. If --memory-limit is given, the slab is
+ * instead tracked compactly, with a bit for each block which is referenced
+ * at least once, and a hash table of the counts of the few blocks which are
+ * referenced more than once. If that table grows as big as a byte per block
+ * would be, the slab switches to a byte per block.
  **/
 typedef struct {
   slab_count_t             slabNumber;
   physical_block_number_t  slabOrigin;
-  /** Reference counts audited from the block map for each slab data block */
+  /**
+   * Reference counts audited from the block map for each slab data block, or
+   * NULL if the slab is tracked compactly or has not been referenced
+   **/
   uint8_t                 *refCounts;
+  /** The blocks referenced at least once, if the slab is tracked compactly */
+  uint64_t                *referenced;
+  /** The counts of compactly tracked blocks referenced more than once */
+  OverflowEntry           *overflow;
+  /** The number of entries in the overflow table, a power of two */
+  uint32_t                 overflowCapacity;
+  /** The number of entries of the overflow table in use */
+  uint32_t                 overflowCount;
+  /** Protects the audited counts while the block map is examined */
+  struct mutex             lock;
   /** Number of reference count inconsistencies found in the slab */
   uint32_t                 badRefCounts;
   /**
    * Histogram of the reference count differences in the slab, indexed by
-   * 255 + (storedReferences - auditedReferences).
+   * 255 + (storedReferences - auditedReferences), or NULL if the slab has no
+   * errors.
    **/
-  uint32_t                 deltaCounts[MAX_ERROR_DELTA - MIN_ERROR_DELTA + 1];
+  uint32_t                *deltaCounts;
   /** Offset in the slab of the first block with an error */
   slab_block_number        firstError;
   /** Offset in the slab of the last block with an error */
   slab_block_number        lastError;
+  /**
+   * Whether the slab is being audited, which is always so unless sampling or
+   * restricted to a range
+   **/
+  bool                     sampled;
+  /** The blocks with an audited reference, if --analytics is given */
+  uint32_t                 usedBlocks;
+  /** The audited block map tree pages, if --analytics is given */
+  uint32_t                 treePages;
+  /** The compressed mappings to the slab, if --analytics is given */
+  uint32_t                 compressedMappings;
+  /**
+   * The stored reference counts of the slab, a byte for each block, if
+   * they were read while the block map was walked, otherwise NULL
+   **/
+  vdo_refcount_t          *storedCounts;
 } SlabAudit;
 
+/**
+ * The state of each thread verifying the reference counts of slabs.
+ **/
+typedef struct {
+  struct thread      *thread;
+  /** A buffer for the reference counts of each slab in flight */
+  char               *buffer;
+  /** The reads of the reference counts of the slabs in flight */
+  struct extent_read  reads[PIPELINE_DEPTH];
+  /** The numbers of the slabs in flight */
+  slab_count_t        slabNumbers[PIPELINE_DEPTH];
+  /** Number of reference count inconsistencies found by this thread */
+  uint64_t            badRefCounts;
+  /** Number of slabs this thread found to have reference count errors */
+  slab_count_t        badSlabs;
+  /** Number of bad slab summary hints found by this thread */
+  slab_count_t        badSummaryHints;
+  /** Number of blocks the stored counts show allocated, for --quick */
+  block_count_t       allocatedBlocks;
+  /** A buffer for the audited counts of an unreferenced or compact slab */
+  vdo_refcount_t     *observed;
+  /** The histogram of the errors in the slab being verified */
+  uint32_t            deltaCounts[DELTA_BUCKETS];
+  /** The histogram of audited counts of the slabs verified, for --analytics */
+  block_count_t       countHistogram[COUNT_BUCKETS];
+} SlabVerifier;
+
+/**
+ * The state of the thread which reads the stored reference counts of dirty
+ * slabs while the block map is walked.
+ **/
+typedef struct {
+  struct thread *thread;
+  /** A buffer for the reference count blocks of one slab */
+  char          *buffer;
+  /** The memory the stored counts may still take up */
+  size_t         budget;
+  /** Protects the stopping flag */
+  struct mutex   lock;
+  bool           stopping;
+} StoredCountLoader;
+
+/**
+ * A volume audited by --batch.
+ **/
+typedef struct {
+  char  *path;
+  pid_t  pid;
+  /** The file holding the JSON report of the volume's audit */
+  FILE  *report;
+  /** The JSON report, or NULL if the audit produced none */
+  char  *json;
+  /** The exit status of the volume's audit */
+  int    status;
+} BatchVolume;
+
+/**
+ * The counts accumulated by each thread examining the block map.
+ **/
+typedef struct {
+  /** Number of mapped entries found in block map leaf pages */
+  block_count_t lbnCount;
+  /** Number of bad block map entries found */
+  uint64_t      badBlockMappings;
+  /** Number of block map tree pages which could not be read or were wrong */
+  uint64_t      badTreePages;
+  /** Number of leaf entries mapped to the zero block, for --analytics */
+  block_count_t zeroMappings;
+  /** Number of leaf entries mapped to each compressed slot, for --analytics */
+  block_count_t compressedMappings[VDO_MAX_COMPRESSION_SLOTS];
+} AuditContext;
+
 static const char usageString[]
-  = "[--help] [ [--summary] | [--verbose] ] [--version] filename";
+  = "[--help] [ [--summary] | [--verbose] ] [--threads=<count>]"
+    " [--memory-limit=<size>] [--checkpoint=<file> [--resume]]"
+    " [--cache=<file>] [--sample-slabs=<count>|<percent>%]"
+    " [--max-iops=<count>] [--max-bandwidth=<size>]"
+    " [--io-priority=<class>[:<level>]]"
+    " [--slabs=<first>-<last> | --pbn-range=<first>-<last>]"
+    " [--quick] [--journals] [--progress] [--io-stats] [--json]"
+    " [--analytics] [--version]"
+    " { filename | --batch=<file> [--jobs=<count>] }";
 
 static const char helpString[] =
   "vdoAudit - confirm the reference counts of a VDO device\n"
   "\n"
   "SYNOPSIS\n"
-  "  vdoAudit [ [--summary] | [--verbose] ] <filename>\n"
+  "  vdoAudit [ [--summary] | [--verbose] ] [--threads=<count>]\n"
+  "           [--memory-limit=<size>] [--checkpoint=<file> [--resume]]\n"
+  "           [--cache=<file>] [--sample-slabs=<count>|<percent>%]\n"
+  "           [--max-iops=<count>] [--max-bandwidth=<size>]\n"
+  "           [--io-priority=<class>[:<level>]]\n"
+  "           [--slabs=<first>-<last> | --pbn-range=<first>-<last>]\n"
+  "           [--quick] [--journals] [--progress] [--io-stats] [--json]\n"
+  "           [--analytics] { <filename> | --batch=<file>\n"
+  "           [--jobs=<count>] }\n"
   "\n"
   "DESCRIPTION\n"
   "  vdoAudit adds up the logical block references to all physical\n"
@@ -95,20 +325,141 @@ static const char helpString[] =
   "\n"
   "  If --verbose is specified, a line item will be reported for each\n"
   "  inconsistency; otherwise a summary of the problems will be displayed.\n"
+  "\n"
+  "  --threads sets the number of threads used to examine the block map\n"
+  "  and to verify the slabs. The default, 0, uses one thread for each\n"
+  "  core.\n"
+  "\n"
+  "  If --memory-limit is specified, the audited reference counts are\n"
+  "  kept compactly, and once they take up more than <size> bytes, the\n"
+  "  rest are kept in a temporary file in $TMPDIR (or /var/tmp) which is\n"
+  "  mapped into memory. <size> may have a K, M, G, or T suffix.\n"
+  "\n"
+  "  Stored reference counts are read during the block map walk until\n"
+  "  they fill 1 GB (or <size>, if smaller).\n"
+  "\n"
+  "  If --checkpoint is specified, the progress of the audit is saved to\n"
+  "  <file> every five minutes, and the file is removed when the audit\n"
+  "  finishes. With --resume, an audit interrupted after saving <file>\n"
+  "  continues from where it was saved, rather than starting over.\n"
+  "\n"
+  "  If --cache is specified, the geometry, super block, slab summary,\n"
+  "  and block map are read from the snapshot cache <file> if it is\n"
+  "  current for the VDO, and <file> is written first if it is not.\n"
+  "  The snapshot can be shared with vdoDumpBlockMap and vdoListMetadata\n"
+  "  as long as the VDO is not started.\n"
+  "\n"
+  "  --max-iops and --max-bandwidth limit the rate of I/O to the VDO\n"
+  "  device to <count> operations and <size> bytes per second, so that\n"
+  "  vdoAudit does not crowd out other users of shared storage. <size> may\n"
+  "  have a K, M, G, or T suffix. --io-priority sets the I/O scheduling\n"
+  "  class, one of idle, best-effort, or realtime, and for the last two\n"
+  "  an optional level from 0 to 7, as for ionice(1).\n"
+  "\n"
+  "  If --sample-slabs is specified, only the references to a random\n"
+  "  sample of the slabs (either <count> of them or <percent>% of them)\n"
+  "  are counted and verified, and the fraction of slabs with reference\n"
+  "  count errors in the whole volume is estimated from the sample.\n"
+  "\n"
+  "  If --slabs or --pbn-range is specified, only the references to the\n"
+  "  given slabs, or to the slabs containing the given physical blocks,\n"
+  "  are counted and verified. Either range may be a single number.\n"
+  "\n"
+  "  If --journals is specified, every block written to the recovery\n"
+  "  journal and to the journals of the audited slabs is also checked\n"
+  "  for a sequence number, entry count, and sectors consistent with\n"
+  "  its position and header.\n"
+  "\n"
+  "  If --progress is specified, the phase of the audit, its rate, the\n"
+  "  I/O throughput, and an estimate of when the phase will finish are\n"
+  "  reported every few seconds.\n"
+  "\n"
+  "  If --io-stats is specified, the number of reads done and their\n"
+  "  latencies will be displayed when the audit finishes.\n"
+  "\n"
+  "  If --json is specified, the results of the audit, including each\n"
+  "  slab with errors and the time taken by each phase, are written to\n"
+  "  standard output as a JSON object instead of the summary.\n"
+  "\n"
+  "  If --analytics is specified, the JSON report also includes the\n"
+  "  distribution of the audited reference counts, the compressed and\n"
+  "  zero block mappings, and the utilization of each audited slab, all\n"
+  "  gathered by the same block map walk. --analytics implies --json.\n"
+  "\n";
+
+static const char quickHelpString[] =
+  "  If --quick is specified, the block map is not examined. Only the\n"
+  "  stored reference counts are read, and the number of blocks they show\n"
+  "  allocated is checked against the stored number of logical blocks\n"
+  "  and block map pages, and against the slab summary hints. This is\n"
+  "  enough to sanity check a cleanly shut down VDO in a fraction of the\n"
+  "  time; if it finds a problem, a full audit will locate it. --quick\n"
+  "  cannot be used with --checkpoint, --sample-slabs, --slabs,\n"
+  "  --pbn-range, or --analytics.\n"
+  "\n";
+
+static const char batchHelpString[] =
+  "  If --batch is specified instead of <filename>, each volume named on\n"
+  "  a line of <file> is audited, --jobs of them (by default, 4) at\n"
+  "  once. The threads, memory limit, and I/O limits are shared evenly\n"
+  "  among the audits running at once, progress reports are labeled with\n"
+  "  the volume, and one report covering every volume is written when\n"
+  "  they have all finished. --batch cannot be used with --checkpoint or\n"
+  "  --cache.\n"
   "\n";
 
 static struct option options[] = {
-  { "help",    no_argument, NULL, 'h' },
-  { "summary", no_argument, NULL, 's' },
-  { "verbose", no_argument, NULL, 'v' },
-  { "version", no_argument, NULL, 'V' },
-  { NULL,      0,           NULL,  0  },
+  { "analytics",    no_argument,       NULL, 'a' },
+  { "batch",        required_argument, NULL, 'B' },
+  { "cache",        required_argument, NULL, 'C' },
+  { "checkpoint",   required_argument, NULL, 'c' },
+  { "help",         no_argument,       NULL, 'h' },
+  { "io-priority",  required_argument, NULL, 'n' },
+  { "io-stats",     no_argument,       NULL, 'i' },
+  { "jobs",         required_argument, NULL, 'o' },
+  { "journals",     no_argument,       NULL, 'J' },
+  { "json",         no_argument,       NULL, 'j' },
+  { "max-bandwidth", required_argument, NULL, 'W' },
+  { "max-iops",     required_argument, NULL, 'I' },
+  { "memory-limit", required_argument, NULL, 'm' },
+  { "pbn-range",    required_argument, NULL, 'P' },
+  { "progress",     no_argument,       NULL, 'p' },
+  { "quick",        no_argument,       NULL, 'q' },
+  { "resume",       no_argument,       NULL, 'r' },
+  { "sample-slabs", required_argument, NULL, 'S' },
+  { "slabs",        required_argument, NULL, 'l' },
+  { "summary",      no_argument,       NULL, 's' },
+  { "threads",      required_argument, NULL, 't' },
+  { "verbose",      no_argument,       NULL, 'v' },
+  { "version",      no_argument,       NULL, 'V' },
+  { NULL,           0,                 NULL,  0  },
 };
-static char optionString[] = "hsvV";
+static char optionString[] = "aB:C:c:hI:iJjl:m:n:o:P:pqrS:st:vVW:";
 
 // Command-line options
 static const char  *filename;
 static bool         verbose          = false;
+static bool         ioStats          = false;
+static bool         jsonOutput       = false;
+static bool         analytics        = false;
+static bool         journals         = false;
+static bool         progress         = false;
+static bool         quick            = false;
+static unsigned int threadCount      = 0;
+static uint64_t     memoryLimit      = 0;
+static unsigned int maxIOPS          = 0;
+static uint64_t     maxBandwidth     = 0;
+static const char  *checkpointPath   = NULL;
+static const char  *cachePath        = NULL;
+static bool         resume           = false;
+static unsigned int sampleSize       = 0;
+static bool         samplePercent    = false;
+static bool         rangeGiven       = false;
+static bool         rangeIsPBNs      = false;
+static uint64_t     rangeFirst       = 0;
+static uint64_t     rangeLast        = 0;
+static const char  *batchPath        = NULL;
+static unsigned int jobCount         = 0;
 
 // Values loaded from the volume
 static UserVDO                   *vdo                = NULL;
@@ -122,14 +473,65 @@ static unsigned int hintShift;
 static block_count_t lbnCount = 0;
 
 /** Reference counts and audit counters for each slab */
-static SlabAudit    slabs[MAX_VDO_SLABS] = { { 0, }, };
+static SlabAudit      *slabs         = NULL;
+/** The number of slabs whose audit records have been initialized */
+static slab_count_t    preparedSlabs = 0;
+/** The allocator for the audited reference counts */
+static SpillAllocator *allocator     = NULL;
+/** The first and last slabs which may be audited */
+static slab_count_t    firstRangeSlab = 0;
+static slab_count_t    lastRangeSlab  = 0;
+/** The number of slabs which may be audited, from which any sample is taken */
+static slab_count_t    rangeSlabs     = 0;
+/** The number of slabs being audited */
+static slab_count_t    sampledSlabs  = 0;
+/** The reader of stored reference counts overlapping the walk */
+static StoredCountLoader loader;
 
 // Total number of errors of each type found
 static uint64_t     badBlockMappings = 0;
+static uint64_t     badTreePages     = 0;
 static uint64_t     badRefCounts     = 0;
 static slab_count_t badSlabs         = 0;
 static slab_count_t badSummaryHints  = 0;
 
+/** The blocks the stored reference counts show allocated, for --quick */
+static block_count_t allocatedBlocks    = 0;
+/** Whether allocatedBlocks disagrees with the stored volume counts */
+static bool          allocationMismatch = false;
+
+// The distributions gathered by --analytics
+static block_count_t zeroMappings = 0;
+static block_count_t compressedMappings[VDO_MAX_COMPRESSION_SLOTS];
+static block_count_t countHistogram[COUNT_BUCKETS];
+
+/** The journal blocks found by --journals */
+static JournalCheckCounts journalCounts;
+
+/** Protects nextSlab, slabResult, and verbose reports during verification */
+static struct mutex slabLock;
+/** The number of the next slab to be verified */
+static slab_count_t nextSlab   = 0;
+/** The number of the first slab verified since the last checkpoint */
+static slab_count_t firstSlab  = 0;
+/** The first error encountered while verifying slabs */
+static int          slabResult = VDO_SUCCESS;
+
+/** The phase of the audit in progress */
+static AuditPhase   auditPhase     = AUDIT_PHASE_WALK;
+/** The index of the next block map tree to be examined */
+static root_count_t nextRoot       = 0;
+/** When the audit was last checkpointed, or started */
+static ktime_t      lastCheckpoint = 0;
+
+/** The time taken by each phase of the audit */
+static PhaseTiming phaseTimings[TIMED_PHASE_COUNT] = {
+  [TIMED_PHASE_WALK]     = { .name = "block map walk"    },
+  [TIMED_PHASE_SUMMARY]  = { .name = "slab summary read" },
+  [TIMED_PHASE_VERIFY]   = { .name = "slab verification" },
+  [TIMED_PHASE_JOURNALS] = { .name = "journal check"     },
+};
+
 /**
  * Explain how this command-line function is used.
  *
@@ -174,6 +576,10 @@ static void printSlabErrorHistogram(const SlabAudit *audit)
   printf("  delta     count   (%u%% of errors in slab per dot)\n",
          100 / scale);
 
+  if (audit->deltaCounts == NULL) {
+    return;
+  }
+
   for (int delta = MIN_ERROR_DELTA; delta <= MAX_ERROR_DELTA; delta++) {
     uint32_t count = audit->deltaCounts[delta - MIN_ERROR_DELTA];
     if (count == 0) {
@@ -216,11 +622,32 @@ static void printSlabErrorSummary(const SlabAudit *audit)
  **/
 static void printErrorSummary(void)
 {
+  if (quick) {
+    printf("quick check summary for VDO volume '%s':\n", filename);
+    if (allocationMismatch) {
+      printf("allocated block count is inconsistent\n");
+    }
+    printErrorCount(badSummaryHints, "free space hint error");
+    printf("run a full audit to locate the problems\n");
+    return;
+  }
+
   printf("audit summary for VDO volume '%s':\n", filename);
   printErrorCount(badBlockMappings, "block mapping error");
+  printErrorCount(badTreePages, "unusable block map page");
   printErrorCount(badSummaryHints, "free space hint error");
   printErrorCount(badRefCounts, "reference count error");
   printErrorCount(badSlabs, "error-containing slab");
+  if (journals) {
+    printErrorCount(journalCounts.badRecoveryBlocks,
+                    "bad recovery journal block");
+    printErrorCount(journalCounts.badSlabJournalBlocks,
+                    "bad slab journal block");
+  }
+  if (rangeSlabs < vdo->slabCount) {
+    printf("audited slabs %u to %u of %u\n",
+           firstRangeSlab, lastRangeSlab, vdo->slabCount);
+  }
 
   for (slab_count_t i = 0; i < vdo->slabCount; i++) {
     printSlabErrorSummary(&slabs[i]);
@@ -229,221 +656,1180 @@ static void printErrorSummary(void)
 }
 
 /**
- * Release any and all allocated memory.
+ * Estimate the fraction of slabs with reference count errors from a sampled
+ * audit. The fraction is estimated with a Wilson score interval, narrowed by
+ * the finite population correction since the slabs are sampled without
+ * replacement.
+ *
+ * @param [out] fractionPtr  The fraction of sampled slabs with errors
+ * @param [out] lowPtr       The low end of the confidence interval
+ * @param [out] highPtr      The high end of the confidence interval
  **/
-static void freeAuditAllocations(void)
+static void estimateBadSlabs(double *fractionPtr,
+                             double *lowPtr,
+                             double *highPtr)
 {
-  UDS_FREE(slabSummaryEntries);
-  for (slab_count_t i = 0; i < vdo->slabCount; i++) {
-    UDS_FREE(slabs[i].refCounts);
+  double sample   = sampledSlabs;
+  double total    = rangeSlabs;
+  double fraction = badSlabs / sample;
+  double low      = fraction;
+  double high     = fraction;
+  if (sampledSlabs < rangeSlabs) {
+    double effective = sample * (total - 1) / (total - sample);
+    double z2        = CONFIDENCE_Z * CONFIDENCE_Z;
+    double scale     = 1 + (z2 / effective);
+    double center    = (fraction + (z2 / (2 * effective))) / scale;
+    double margin    = ((CONFIDENCE_Z / scale)
+                        * sqrt((fraction * (1 - fraction) / effective)
+                               + (z2 / (4 * effective * effective))));
+    low  = max(center - margin, 0.0);
+    high = min(center + margin, 1.0);
   }
-  freeVDOFromFile(&vdo);
+
+  *fractionPtr = fraction;
+  *lowPtr      = low;
+  *highPtr     = high;
 }
 
 /**
- * Get the filename and any option settings from the input arguments and place
- * them in the corresponding global variables. Print command usage if
- * arguments are wrong.
- *
- * @param argc  Number of input arguments
- * @param argv  Array of input arguments
+ * Display the estimates made from a sampled audit.
+ **/
+static void printSampleEstimate(void)
+{
+  double fraction, low, high;
+  estimateBadSlabs(&fraction, &low, &high);
+  printf("sampled %u of %u slabs\n", sampledSlabs, rangeSlabs);
+  printf("estimated %.1f%% of slabs have reference count errors"
+         " (95%% confidence interval %.1f%% to %.1f%%)\n",
+         100 * fraction, 100 * low, 100 * high);
+  printf("estimated %.0f reference count errors in the %s\n",
+         badRefCounts * (double) rangeSlabs / sampledSlabs,
+         ((rangeSlabs < vdo->slabCount) ? "selected slabs" : "volume"));
+}
+
+/**
+ * Write a string to standard output as a JSON string.
  *
- * @return VDO_SUCCESS or some error.
+ * @param string  The string to write
  **/
-static int processAuditArgs(int argc, char *argv[])
+static void printJSONString(const char *string)
 {
-  int   c;
-  while ((c = getopt_long(argc, argv, optionString, options, NULL)) != -1) {
-    switch (c) {
-    case 'h':
-      printf("%s", helpString);
-      exit(0);
-      break;
+  putchar('"');
+  for (const unsigned char *c = (const unsigned char *) string; *c != '\0';
+       c++) {
+    if ((*c == '"') || (*c == '\\')) {
+      printf("\\%c", *c);
+    } else if (*c < 0x20) {
+      printf("\\u%04x", *c);
+    } else {
+      putchar(*c);
+    }
+  }
+  putchar('"');
+}
 
-    case 's':
-      verbose = false;
-      break;
+/**
+ * Write the record of a slab with reference count errors as a JSON object.
+ *
+ * @param audit      The audit of the slab
+ * @param separator  The text to write before the object
+ **/
+static void printSlabJSON(const SlabAudit *audit, const char *separator)
+{
+  printf("%s\n    { \"slab\": %u, \"origin\": %llu,"
+         " \"referenceCountErrors\": %u,"
+         " \"firstError\": %u, \"lastError\": %u, \"deltas\": {",
+         separator, audit->slabNumber,
+         (unsigned long long) audit->slabOrigin, audit->badRefCounts,
+         audit->firstError, audit->lastError);
+  const char *deltaSeparator = "";
+  for (int delta = MIN_ERROR_DELTA;
+       (audit->deltaCounts != NULL) && (delta <= MAX_ERROR_DELTA);
+       delta++) {
+    uint32_t count = audit->deltaCounts[delta - MIN_ERROR_DELTA];
+    if (count > 0) {
+      printf("%s\"%d\": %u", deltaSeparator, delta, count);
+      deltaSeparator = ", ";
+    }
+  }
+  printf("} }");
+}
 
-    case 'v':
-      verbose = true;
-      break;
+/**
+ * Write the distributions gathered by --analytics as a JSON object. Data
+ * block references are the leaf mappings to blocks other than the zero
+ * block, so dividing them by the referenced data blocks gives the
+ * deduplication and compression ratio of the audited slabs. The slab
+ * utilization histogram is keyed by the low end of each tenth.
+ **/
+static void printAnalyticsJSON(void)
+{
+  block_count_t compressed = 0;
+  for (unsigned int i = 0; i < VDO_MAX_COMPRESSION_SLOTS; i++) {
+    compressed += compressedMappings[i];
+  }
 
-    case 'V':
-      printf("%s version is: %s\n", argv[0], CURRENT_VERSION);
-      exit(0);
-      break;
+  printf("  \"analytics\": {\n");
+  printf("    \"mappings\": { \"zeroBlock\": %llu, \"uncompressed\": %llu,"
+         " \"compressed\": %llu },\n",
+         (unsigned long long) zeroMappings,
+         (unsigned long long) (lbnCount - zeroMappings - compressed),
+         (unsigned long long) compressed);
+  printf("    \"compressionSlots\": [");
+  for (unsigned int i = 0; i < VDO_MAX_COMPRESSION_SLOTS; i++) {
+    printf("%s%llu", ((i == 0) ? " " : ", "),
+           (unsigned long long) compressedMappings[i]);
+  }
+  printf(" ],\n");
+
+  block_count_t  references = 0;
+  block_count_t  referenced = 0;
+  const char    *separator  = "";
+  printf("    \"referenceCounts\": {");
+  for (unsigned int count = 1; count <= MAXIMUM_REFERENCE_COUNT; count++) {
+    if (countHistogram[count] > 0) {
+      printf("%s \"%u\": %llu", separator, count,
+             (unsigned long long) countHistogram[count]);
+      separator   = ",";
+      referenced += countHistogram[count];
+      references += count * countHistogram[count];
+    }
+  }
+  printf(" },\n");
+
+  printf("    \"referenceCountRanges\": {");
+  separator = "";
+  for (unsigned int i = 0; i < COUNT_OF(COUNT_RANGES); i++) {
+    block_count_t blocks = 0;
+    for (unsigned int count = COUNT_RANGES[i].first;
+         count <= COUNT_RANGES[i].last; count++) {
+      blocks += countHistogram[count];
+    }
+    printf("%s \"%s\": %llu", separator, COUNT_RANGES[i].name,
+           (unsigned long long) blocks);
+    separator = ",";
+  }
+  printf(" },\n");
+
+  printf("    \"dataBlocks\": { \"referenced\": %llu, \"references\": %llu,"
+         " \"ratio\": %.4f },\n",
+         (unsigned long long) referenced, (unsigned long long) references,
+         ((referenced == 0) ? 0.0 : ((double) references / referenced)));
+
+  uint32_t utilization[UTILIZATION_BUCKETS] = { 0 };
+  for (slab_count_t i = 0; i < preparedSlabs; i++) {
+    if (slabs[i].sampled) {
+      unsigned int bucket
+        = (slabs[i].usedBlocks * (uint64_t) UTILIZATION_BUCKETS
+           / slabDataBlocks);
+      utilization[min(bucket, UTILIZATION_BUCKETS - 1U)]++;
+    }
+  }
 
-    default:
-      usage(argv[0], usageString);
-      break;
+  printf("    \"slabUtilization\": {");
+  separator = "";
+  for (unsigned int i = 0; i < UTILIZATION_BUCKETS; i++) {
+    printf("%s \"%u%%\": %u", separator, i * 100 / UTILIZATION_BUCKETS,
+           utilization[i]);
+    separator = ",";
+  }
+  printf(" },\n");
 
+  printf("    \"slabs\": [");
+  separator = "";
+  for (slab_count_t i = 0; i < preparedSlabs; i++) {
+    const SlabAudit *audit = &slabs[i];
+    if (!audit->sampled) {
+      continue;
     }
+
+    printf("%s\n      { \"slab\": %u, \"usedBlocks\": %u,"
+           " \"treePages\": %u, \"compressedMappings\": %u }",
+           separator, audit->slabNumber, audit->usedBlocks,
+           audit->treePages, audit->compressedMappings);
+    separator = ",";
   }
+  printf("\n    ]\n  },\n");
+}
 
-  // Explain usage and exit
-  if (optind != (argc - 1)) {
-    usage(argv[0], usageString);
+/**
+ * Write the results of the audit to standard output as a JSON object. The
+ * report is written as it is formatted, one slab at a time.
+ *
+ * @param passed  Whether the volume was fully consistent
+ **/
+static void printJSONReport(bool passed)
+{
+  printf("{\n  \"volume\": ");
+  printJSONString(filename);
+  printf(",\n  \"passed\": %s,\n", (passed ? "true" : "false"));
+  printf("  \"quick\": %s,\n", (quick ? "true" : "false"));
+  if (quick) {
+    printf("  \"allocatedBlocks\": { \"found\": %llu, \"logicalBlocks\": %llu,"
+           " \"blockMapPages\": %llu, \"consistent\": %s },\n",
+           (unsigned long long) allocatedBlocks,
+           (unsigned long long)
+           vdo->states.recovery_journal.logical_blocks_used,
+           (unsigned long long)
+           vdo->states.recovery_journal.block_map_data_blocks,
+           (allocationMismatch ? "false" : "true"));
+    printf("  \"freeSpaceHintErrors\": %u,\n", badSummaryHints);
+  } else {
+    printf("  \"logicalBlocks\": { \"expected\": %llu, \"found\": %llu },\n",
+           (unsigned long long)
+           vdo->states.recovery_journal.logical_blocks_used,
+           (unsigned long long) lbnCount);
+    printf("  \"blockMappingErrors\": %llu,\n",
+           (unsigned long long) badBlockMappings);
+    printf("  \"unusableBlockMapPages\": %llu,\n",
+           (unsigned long long) badTreePages);
+    printf("  \"freeSpaceHintErrors\": %u,\n", badSummaryHints);
+    printf("  \"referenceCountErrors\": %llu,\n",
+           (unsigned long long) badRefCounts);
+    printf("  \"errorContainingSlabs\": %u,\n", badSlabs);
+  }
+  if (journals) {
+    printf("  \"journals\": { \"recoveryBlocks\": %llu,"
+           " \"badRecoveryBlocks\": %llu, \"slabJournalBlocks\": %llu,"
+           " \"badSlabJournalBlocks\": %llu },\n",
+           (unsigned long long) journalCounts.recoveryBlocks,
+           (unsigned long long) journalCounts.badRecoveryBlocks,
+           (unsigned long long) journalCounts.slabJournalBlocks,
+           (unsigned long long) journalCounts.badSlabJournalBlocks);
+  }
+  printf("  \"slabCount\": %u,\n", vdo->slabCount);
+  printf("  \"slabRange\": { \"first\": %u, \"last\": %u },\n",
+         firstRangeSlab, lastRangeSlab);
+  printf("  \"sampledSlabs\": %u,\n", sampledSlabs);
+  if (sampledSlabs < rangeSlabs) {
+    double fraction, low, high;
+    estimateBadSlabs(&fraction, &low, &high);
+    printf("  \"estimate\": { \"errorSlabFraction\": %.6f,"
+           " \"confidenceLow\": %.6f, \"confidenceHigh\": %.6f,"
+           " \"referenceCountErrors\": %.0f },\n",
+           fraction, low, high,
+           badRefCounts * (double) rangeSlabs / sampledSlabs);
   }
 
-  filename = argv[optind];
+  printf("  \"phases\": [");
+  const char *separator = "";
+  for (TimedPhase phase = 0; phase < TIMED_PHASE_COUNT; phase++) {
+    const PhaseTiming *timing = &phaseTimings[phase];
+    if (!timing->ran) {
+      continue;
+    }
+    printf("%s\n    { \"name\": \"%s\", \"wallSeconds\": %.6f,"
+           " \"cpuSeconds\": %.6f }",
+           separator, timing->name, timing->wallTime / 1e9,
+           timing->cpuTime / 1e9);
+    separator = ",";
+  }
+  printf("\n  ],\n");
 
-  return VDO_SUCCESS;
+  if (analytics) {
+    printAnalyticsJSON();
+  }
+
+  printf("  \"slabs\": [");
+  separator = "";
+  for (slab_count_t i = 0; i < preparedSlabs; i++) {
+    if (slabs[i].badRefCounts > 0) {
+      printSlabJSON(&slabs[i], separator);
+      separator = ",";
+    }
+  }
+  printf("\n  ]\n}\n");
 }
 
 /**
- * Read from the layer.
+ * Parse the argument of --sample-slabs, which is either a count of slabs or
+ * a percentage of them.
  *
- * @param startBlock  The block number at which to start reading
- * @param blockCount  The number of blocks to read
- * @param buffer      The buffer to read into
+ * @param arg  The argument
  *
  * @return VDO_SUCCESS or an error
  **/
-static int readFromLayer(physical_block_number_t  startBlock,
-                         block_count_t            blockCount,
-                         char                    *buffer)
+static int parseSampleSize(const char *arg)
 {
-  return vdo->layer->reader(vdo->layer, startBlock, blockCount, buffer);
+  size_t length = strlen(arg);
+  samplePercent = ((length > 0) && (arg[length - 1] == '%'));
+  if (!samplePercent) {
+    return parseUInt(arg, 1, UINT_MAX, &sampleSize);
+  }
+
+  char *number;
+  int result = uds_duplicate_string(arg, __func__, &number);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  number[length - 1] = '\0';
+  result = parseUInt(number, 1, 100, &sampleSize);
+  UDS_FREE(number);
+  return result;
 }
 
 /**
- * Report a problem with a block map entry.
+ * Parse the argument of --slabs or --pbn-range, which is either a single
+ * number or two numbers separated by a '-'.
+ *
+ * @param arg  The argument
+ *
+ * @return VDO_SUCCESS or VDO_OUT_OF_RANGE
  **/
-static void reportBlockMapEntry(const char               *message,
-                                struct block_map_slot     slot,
-                                height_t                  height,
-                                physical_block_number_t   pbn,
-                                enum block_mapping_state  state)
+static int parseRange(const char *arg)
 {
-  badBlockMappings++;
-  if (!verbose) {
-    return;
+  char *endPtr;
+  errno = 0;
+  rangeFirst = strtoull(arg, &endPtr, 0);
+  if ((errno != 0) || (endPtr == arg)) {
+    return VDO_OUT_OF_RANGE;
   }
 
-  if (vdo_is_state_compressed(state)) {
-    warnx("Mapping at (page %llu, slot %u) (height %u)"
-          " %s (PBN %llu, state %u)\n",
-          (unsigned long long) slot.pbn, slot.slot, height, message,
-          (unsigned long long) pbn, state);
-  } else {
-    warnx("Mapping at (page %llu, slot %u) (height %u)"
-          " %s (PBN %llu)\n",
-          (unsigned long long) slot.pbn, slot.slot, height, message,
-          (unsigned long long) pbn);
+  rangeLast = rangeFirst;
+  if (*endPtr == '-') {
+    const char *last = endPtr + 1;
+    rangeLast = strtoull(last, &endPtr, 0);
+    if ((errno != 0) || (endPtr == last)) {
+      return VDO_OUT_OF_RANGE;
+    }
   }
+
+  return (((*endPtr != '\0') || (rangeLast < rangeFirst))
+          ? VDO_OUT_OF_RANGE : VDO_SUCCESS);
 }
 
 /**
- * Record the given reference in a block map page.
+ * Work out the range of slabs which may be audited from --slabs or
+ * --pbn-range. Without either, every slab may be audited.
  *
- * Implements MappingExaminer.
+ * @return VDO_SUCCESS or VDO_OUT_OF_RANGE
  **/
-static int examineBlockMapEntry(struct block_map_slot    slot,
-                                height_t                 height,
-                                physical_block_number_t  pbn,
-                                enum block_mapping_state state)
+static int selectSlabRange(void)
 {
-  if (state == VDO_MAPPING_STATE_UNMAPPED) {
-    if (pbn != VDO_ZERO_BLOCK) {
-      reportBlockMapEntry("is unmapped but has a physical block",
-                          slot, height, pbn, state);
-      return VDO_BAD_MAPPING;
+  firstRangeSlab = 0;
+  lastRangeSlab  = vdo->slabCount - 1;
+  if (rangeIsPBNs) {
+    int result = getSlabNumber(vdo, rangeFirst, &firstRangeSlab);
+    if (result == VDO_SUCCESS) {
+      result = getSlabNumber(vdo, rangeLast, &lastRangeSlab);
     }
-    return VDO_SUCCESS;
+
+    if (result != VDO_SUCCESS) {
+      warnx("PBN range %llu-%llu is not within the slab depot",
+            (unsigned long long) rangeFirst, (unsigned long long) rangeLast);
+      return VDO_OUT_OF_RANGE;
+    }
+  } else if (rangeGiven) {
+    if (rangeLast >= vdo->slabCount) {
+      warnx("Slab range %llu-%llu is not within the %u slabs of the volume",
+            (unsigned long long) rangeFirst, (unsigned long long) rangeLast,
+            vdo->slabCount);
+      return VDO_OUT_OF_RANGE;
+    }
+
+    firstRangeSlab = rangeFirst;
+    lastRangeSlab  = rangeLast;
   }
 
-  if (vdo_is_state_compressed(state) && (pbn == VDO_ZERO_BLOCK)) {
-    reportBlockMapEntry("is compressed but has no physical block",
-                        slot, height, pbn, state);
-    return VDO_BAD_MAPPING;
+  rangeSlabs = lastRangeSlab - firstRangeSlab + 1;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Choose the slabs to audit from the range selected by selectSlabRange().
+ * Unless --sample-slabs was given, every slab in the range is audited.
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int sampleSlabs(void)
+{
+  sampledSlabs = rangeSlabs;
+  if (sampleSize != 0) {
+    uint64_t count = (samplePercent
+                      ? ((((uint64_t) sampleSize * rangeSlabs) + 99) / 100)
+                      : sampleSize);
+    sampledSlabs = min(count, (uint64_t) rangeSlabs);
   }
 
-  if (height == 0) {
-    lbnCount++;
-    if (pbn == VDO_ZERO_BLOCK) {
-      return VDO_SUCCESS;
+  if (sampledSlabs == rangeSlabs) {
+    for (slab_count_t i = firstRangeSlab; i <= lastRangeSlab; i++) {
+      slabs[i].sampled = true;
     }
+    return VDO_SUCCESS;
   }
 
-  slab_count_t slabNumber = 0;
-  int result = getSlabNumber(vdo, pbn, &slabNumber);
+  // Choose the sample with a partial Fisher-Yates shuffle.
+  slab_count_t *order;
+  int result = UDS_ALLOCATE(rangeSlabs, slab_count_t, __func__, &order);
   if (result != VDO_SUCCESS) {
-    reportBlockMapEntry("refers to out-of-range physical block",
-                        slot, height, pbn, state);
     return result;
   }
 
-  slab_block_number offset = 0;
-  result = getSlabBlockNumber(vdo, pbn, &offset);
-  if (result != VDO_SUCCESS) {
-    reportBlockMapEntry("refers to slab metadata block",
-                        slot, height, pbn, state);
-    return result;
+  for (slab_count_t i = 0; i < rangeSlabs; i++) {
+    order[i] = firstRangeSlab + i;
   }
 
-  SlabAudit *audit = &slabs[slabNumber];
-  if (height > 0) {
-    // If this interior tree block has already been referenced, warn.
-    if ((audit->refCounts[offset]) != 0) {
-      reportBlockMapEntry("refers to previously referenced tree page",
-                          slot, height, pbn, state);
-    }
-
-    // If this interior tree block appears to be compressed, warn.
-    if (vdo_is_state_compressed(state)) {
-      reportBlockMapEntry("refers to compressed fragment",
-                          slot, height, pbn, state);
-    }
-
-    audit->refCounts[offset] = PROVISIONAL_REFERENCE_COUNT;
-  } else {
-    // If incrementing the reference count goes above the maximum, warn.
-    if ((audit->refCounts[offset] == PROVISIONAL_REFERENCE_COUNT)
-        || (++audit->refCounts[offset] > MAXIMUM_REFERENCE_COUNT) ) {
-      reportBlockMapEntry("overflows reference count",
-                          slot, height, pbn, state);
-    }
+  srandom(time(NULL) ^ getpid());
+  for (slab_count_t i = 0; i < sampledSlabs; i++) {
+    slab_count_t j = random_in_range(i, rangeSlabs - 1);
+    slab_count_t chosen = order[j];
+    order[j] = order[i];
+    order[i] = chosen;
+    slabs[chosen].sampled = true;
   }
 
+  UDS_FREE(order);
   return VDO_SUCCESS;
 }
 
 /**
- * Report a problem with the reference count of a block in a slab.
+ * Free the audited reference counts of a slab.
  *
- * @param audit              The audit record for the slab
- * @param sbn                The offset of the block within the slab
- * @param treePage           <code>true</code> if the block appears to be a
- *                           block map tree page
- * @param pristine           <code>true</code> if the slab has never been used
- * @param auditedReferences  The number of references to the block found
- *                           by examining the block map tree
- * @param storedReferences   The reference count recorded in the slab (or
- *                           zero for a pristine slab)
+ * @param audit  The audit record for the slab
  **/
-static void reportRefCount(SlabAudit         *audit,
-                           slab_block_number  sbn,
-                           bool               treePage,
-                           bool               pristine,
-                           vdo_refcount_t     auditedReferences,
-                           vdo_refcount_t     storedReferences)
+static void freeAuditedCounts(SlabAudit *audit)
 {
-  int errorDelta = storedReferences - (int) auditedReferences;
-  badRefCounts++;
-  if (audit->badRefCounts == 0) {
-    badSlabs++;
-  }
-
-  audit->badRefCounts++;
-  audit->deltaCounts[errorDelta - MIN_ERROR_DELTA]++;
-  audit->firstError = min(audit->firstError, sbn);
-  audit->lastError  = max(audit->lastError, sbn);
+  spillFree(allocator, audit->refCounts);
+  spillFree(allocator, audit->referenced);
+  spillFree(allocator, audit->overflow);
+  audit->refCounts        = NULL;
+  audit->referenced       = NULL;
+  audit->overflow         = NULL;
+  audit->overflowCapacity = 0;
+  audit->overflowCount    = 0;
+}
 
-  if (!verbose) {
-    return;
+/**
+ * Release any and all allocated memory.
+ **/
+static void freeAuditAllocations(void)
+{
+  UDS_FREE(slabSummaryEntries);
+  for (slab_count_t i = 0; i < preparedSlabs; i++) {
+    freeAuditedCounts(&slabs[i]);
+    uds_destroy_mutex(&slabs[i].lock);
+    UDS_FREE(slabs[i].deltaCounts);
+    UDS_FREE(slabs[i].storedCounts);
   }
+  UDS_FREE(slabs);
+  freeSpillAllocator(&allocator);
+  freeVDOFromFile(&vdo);
+}
 
-  warnx("Reference mismatch for%s pbn %llu\n"
+/**
+ * Get the filename and any option settings from the input arguments and place
+ * them in the corresponding global variables. Print command usage if
+ * arguments are wrong.
+ *
+ * @param argc  Number of input arguments
+ * @param argv  Array of input arguments
+ *
+ * @return VDO_SUCCESS or some error.
+ **/
+static int processAuditArgs(int argc, char *argv[])
+{
+  char  errBuf[ERRBUF_SIZE];
+  int   result;
+  int   c;
+  while ((c = getopt_long(argc, argv, optionString, options, NULL)) != -1) {
+    switch (c) {
+    case 'a':
+      analytics  = true;
+      jsonOutput = true;
+      break;
+
+    case 'B':
+      batchPath = optarg;
+      break;
+
+    case 'C':
+      cachePath = optarg;
+      break;
+
+    case 'c':
+      checkpointPath = optarg;
+      break;
+
+    case 'h':
+      printf("%s%s%s", helpString, quickHelpString, batchHelpString);
+      exit(0);
+      break;
+
+    case 'i':
+      ioStats = true;
+      break;
+
+    case 'I':
+      if (parseUInt(optarg, 1, UINT_MAX, &maxIOPS) != VDO_SUCCESS) {
+        errx(1, "--max-iops must be a positive number");
+      }
+      break;
+
+    case 'n':
+      result = setIOPriority(optarg);
+      if (result == VDO_OUT_OF_RANGE) {
+        errx(1, "--io-priority must be idle, best-effort[:<level>],"
+             " or realtime[:<level>]");
+      } else if (result != VDO_SUCCESS) {
+        errx(1, "Could not set the I/O priority: %s",
+             uds_string_error(result, errBuf, ERRBUF_SIZE));
+      }
+      break;
+
+    case 'W':
+      if ((parseSize(optarg, false, &maxBandwidth) != VDO_SUCCESS)
+          || (maxBandwidth == 0)) {
+        errx(1, "--max-bandwidth must be a positive size");
+      }
+      break;
+
+    case 'J':
+      journals = true;
+      break;
+
+    case 'j':
+      jsonOutput = true;
+      break;
+
+    case 'l':
+    case 'P':
+      if (rangeGiven) {
+        errx(1, "Only one of --slabs and --pbn-range may be given");
+      }
+
+      if (parseRange(optarg) != VDO_SUCCESS) {
+        errx(1, "%s must be a number or a range <first>-<last>",
+             ((c == 'l') ? "--slabs" : "--pbn-range"));
+      }
+
+      rangeGiven  = true;
+      rangeIsPBNs = (c == 'P');
+      break;
+
+    case 'm':
+      if ((parseSize(optarg, false, &memoryLimit) != VDO_SUCCESS)
+          || (memoryLimit == 0)) {
+        errx(1, "Memory limit must be a positive size");
+      }
+      break;
+
+    case 'o':
+      if (parseUInt(optarg, 1, MAX_BATCH_JOBS, &jobCount) != VDO_SUCCESS) {
+        errx(1, "--jobs must be from 1 to %u", MAX_BATCH_JOBS);
+      }
+      break;
+
+    case 'p':
+      progress = true;
+      break;
+
+    case 'q':
+      quick = true;
+      break;
+
+    case 'r':
+      resume = true;
+      break;
+
+    case 'S':
+      if (parseSampleSize(optarg) != VDO_SUCCESS) {
+        errx(1, "Slab sample size must be a positive count or percentage");
+      }
+      break;
+
+    case 's':
+      verbose = false;
+      break;
+
+    case 't':
+      if (parseUInt(optarg, 0, MAX_THREADS, &threadCount) != VDO_SUCCESS) {
+        errx(1, "Thread count must be at most %u", MAX_THREADS);
+      }
+      break;
+
+    case 'v':
+      verbose = true;
+      break;
+
+    case 'V':
+      printf("%s version is: %s\n", argv[0], CURRENT_VERSION);
+      exit(0);
+      break;
+
+    default:
+      usage(argv[0], usageString);
+      break;
+
+    }
+  }
+
+  // Explain usage and exit
+  if (optind != (argc - ((batchPath == NULL) ? 1 : 0))) {
+    usage(argv[0], usageString);
+  }
+
+  if ((jobCount != 0) && (batchPath == NULL)) {
+    errx(1, "--jobs requires --batch");
+  }
+
+  if ((batchPath != NULL)
+      && ((checkpointPath != NULL) || (cachePath != NULL))) {
+    errx(1, "--batch cannot be used with --checkpoint or --cache");
+  }
+
+  if (resume && (checkpointPath == NULL)) {
+    errx(1, "--resume requires --checkpoint");
+  }
+
+  if ((sampleSize != 0) && (checkpointPath != NULL)) {
+    errx(1, "--sample-slabs cannot be used with --checkpoint");
+  }
+
+  if (analytics && (checkpointPath != NULL)) {
+    errx(1, "--analytics cannot be used with --checkpoint");
+  }
+
+  if (rangeGiven && (checkpointPath != NULL)) {
+    errx(1, "%s cannot be used with --checkpoint",
+         (rangeIsPBNs ? "--pbn-range" : "--slabs"));
+  }
+
+  // The totals --quick checks only mean something for the whole volume.
+  if (quick && ((checkpointPath != NULL) || (sampleSize != 0) || rangeGiven
+                || analytics)) {
+    errx(1, "--quick cannot be used with --checkpoint, --sample-slabs,"
+         " --slabs, --pbn-range, or --analytics");
+  }
+
+  filename = argv[optind];
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Make sure a slab has somewhere to keep its audited reference counts. The
+ * caller must hold the slab's lock.
+ *
+ * @param audit  The audit record for the slab
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int prepareAuditedCounts(SlabAudit *audit)
+{
+  if ((audit->refCounts != NULL) || (audit->referenced != NULL)) {
+    return VDO_SUCCESS;
+  }
+
+  if (memoryLimit == 0) {
+    return spillAllocate(allocator, slabDataBlocks, "audited reference counts",
+                         &audit->refCounts);
+  }
+
+  size_t words = ((slabDataBlocks + 63) / 64);
+  int result = spillAllocate(allocator, words * sizeof(uint64_t),
+                             "referenced block bitmap", &audit->referenced);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = spillAllocate(allocator, MIN_OVERFLOW * sizeof(OverflowEntry),
+                         "reference count overflow table", &audit->overflow);
+  if (result != VDO_SUCCESS) {
+    freeAuditedCounts(audit);
+    return result;
+  }
+
+  audit->overflowCapacity = MIN_OVERFLOW;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Find the overflow entry for a block of a compactly tracked slab, or the
+ * empty entry where it belongs.
+ *
+ * @param audit  The audit record for the slab
+ * @param sbn    The offset of the block within the slab
+ *
+ * @return The entry
+ **/
+static OverflowEntry *findOverflowEntry(const SlabAudit   *audit,
+                                        slab_block_number  sbn)
+{
+  uint32_t mask  = audit->overflowCapacity - 1;
+  uint32_t index = (sbn * 0x9E3779B1U) & mask;
+  while ((audit->overflow[index].count != 0)
+         && (audit->overflow[index].sbn != sbn)) {
+    index = (index + 1) & mask;
+  }
+
+  return &audit->overflow[index];
+}
+
+/**
+ * Get the audited reference count of a block.
+ *
+ * @param audit  The audit record for the slab
+ * @param sbn    The offset of the block within the slab
+ *
+ * @return The audited count
+ **/
+static vdo_refcount_t getAuditedCount(const SlabAudit   *audit,
+                                      slab_block_number  sbn)
+{
+  if (audit->refCounts != NULL) {
+    return audit->refCounts[sbn];
+  }
+
+  if ((audit->referenced == NULL)
+      || ((audit->referenced[sbn / 64] & (1ULL << (sbn % 64))) == 0)) {
+    return 0;
+  }
+
+  vdo_refcount_t count = findOverflowEntry(audit, sbn)->count;
+  return ((count == 0) ? 1 : count);
+}
+
+/**
+ * Expand the audited counts of a slab into a byte for each block.
+ *
+ * @param audit   The audit record for the slab
+ * @param counts  The buffer to fill in
+ **/
+static void expandAuditedCounts(const SlabAudit *audit, vdo_refcount_t *counts)
+{
+  memset(counts, 0, slabDataBlocks);
+  if (audit->referenced == NULL) {
+    return;
+  }
+
+  for (size_t i = 0; i < ((slabDataBlocks + 63) / 64); i++) {
+    for (uint64_t word = audit->referenced[i]; word != 0;
+         word &= (word - 1)) {
+      counts[(i * 64) + __builtin_ctzll(word)] = 1;
+    }
+  }
+
+  for (uint32_t i = 0; i < audit->overflowCapacity; i++) {
+    if (audit->overflow[i].count != 0) {
+      counts[audit->overflow[i].sbn] = audit->overflow[i].count;
+    }
+  }
+}
+
+/**
+ * Make room for another entry in the overflow table of a compactly tracked
+ * slab, either by doubling the table, or if it would be no smaller than a
+ * byte for each block, by switching the slab to a byte for each block.
+ *
+ * @param audit  The audit record for the slab
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int growOverflow(SlabAudit *audit)
+{
+  uint32_t newCapacity = 2 * audit->overflowCapacity;
+  if ((newCapacity * sizeof(OverflowEntry)) >= slabDataBlocks) {
+    uint8_t *refCounts;
+    int result = spillAllocate(allocator, slabDataBlocks,
+                               "audited reference counts", &refCounts);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    expandAuditedCounts(audit, refCounts);
+    freeAuditedCounts(audit);
+    audit->refCounts = refCounts;
+    return VDO_SUCCESS;
+  }
+
+  OverflowEntry *oldTable    = audit->overflow;
+  uint32_t       oldCapacity = audit->overflowCapacity;
+  int result = spillAllocate(allocator, newCapacity * sizeof(OverflowEntry),
+                             "reference count overflow table",
+                             &audit->overflow);
+  if (result != VDO_SUCCESS) {
+    audit->overflow = oldTable;
+    return result;
+  }
+
+  audit->overflowCapacity = newCapacity;
+  for (uint32_t i = 0; i < oldCapacity; i++) {
+    if (oldTable[i].count != 0) {
+      *findOverflowEntry(audit, oldTable[i].sbn) = oldTable[i];
+    }
+  }
+
+  spillFree(allocator, oldTable);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Set the audited reference count of a block.
+ *
+ * @param audit  The audit record for the slab
+ * @param sbn    The offset of the block within the slab
+ * @param count  The new count, which must not be zero
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int setAuditedCount(SlabAudit         *audit,
+                           slab_block_number  sbn,
+                           vdo_refcount_t     count)
+{
+  if (audit->refCounts != NULL) {
+    audit->refCounts[sbn] = count;
+    return VDO_SUCCESS;
+  }
+
+  audit->referenced[sbn / 64] |= (1ULL << (sbn % 64));
+  if (count == 1) {
+    return VDO_SUCCESS;
+  }
+
+  OverflowEntry *entry = findOverflowEntry(audit, sbn);
+  if (entry->count == 0) {
+    // Keep the table at most half full.
+    if (2 * (audit->overflowCount + 1) > audit->overflowCapacity) {
+      int result = growOverflow(audit);
+      if (result != VDO_SUCCESS) {
+        return result;
+      }
+
+      if (audit->refCounts != NULL) {
+        audit->refCounts[sbn] = count;
+        return VDO_SUCCESS;
+      }
+
+      entry = findOverflowEntry(audit, sbn);
+    }
+
+    entry->sbn = sbn;
+    audit->overflowCount++;
+  }
+
+  entry->count = count;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Record a reference to a block found in the block map.
+ *
+ * @param [in]  audit        The audit record for the slab
+ * @param [in]  sbn          The offset of the block within the slab
+ * @param [in]  treePage     Whether the reference is to a block map tree page
+ * @param [in]  compressed   Whether the reference is a compressed mapping
+ * @param [out] previousPtr  A pointer to hold the audited count before this
+ *                           reference
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int addReference(SlabAudit         *audit,
+                        slab_block_number  sbn,
+                        bool               treePage,
+                        bool               compressed,
+                        vdo_refcount_t    *previousPtr)
+{
+  uds_lock_mutex(&audit->lock);
+  if (compressed && !treePage) {
+    audit->compressedMappings++;
+  }
+
+  int result = prepareAuditedCounts(audit);
+  if (result == VDO_SUCCESS) {
+    vdo_refcount_t previous = getAuditedCount(audit, sbn);
+    *previousPtr = previous;
+    if (treePage) {
+      result = setAuditedCount(audit, sbn, PROVISIONAL_REFERENCE_COUNT);
+    } else if (previous != PROVISIONAL_REFERENCE_COUNT) {
+      result = setAuditedCount(audit, sbn, previous + 1);
+    }
+  }
+  uds_unlock_mutex(&audit->lock);
+  return result;
+}
+
+/**
+ * Report a problem with a block map entry.
+ **/
+static void reportBlockMapEntry(AuditContext             *context,
+                                const char               *message,
+                                struct block_map_slot     slot,
+                                height_t                  height,
+                                physical_block_number_t   pbn,
+                                enum block_mapping_state  state)
+{
+  context->badBlockMappings++;
+  if (!verbose) {
+    return;
+  }
+
+  if (vdo_is_state_compressed(state)) {
+    warnx("Mapping at (page %llu, slot %u) (height %u)"
+          " %s (PBN %llu, state %u)\n",
+          (unsigned long long) slot.pbn, slot.slot, height, message,
+          (unsigned long long) pbn, state);
+  } else {
+    warnx("Mapping at (page %llu, slot %u) (height %u)"
+          " %s (PBN %llu)\n",
+          (unsigned long long) slot.pbn, slot.slot, height, message,
+          (unsigned long long) pbn);
+  }
+}
+
+/**
+ * Record the given reference in a block map page.
+ *
+ * @param audited  The counts for the examining thread
+ * @param slot     The block_map_slot where this entry was found
+ * @param height   The height of the block map entry in the tree
+ * @param pbn      The PBN encoded in the entry
+ * @param state    The mapping state encoded in the entry
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int examineBlockMapEntry(AuditContext             *audited,
+                                struct block_map_slot     slot,
+                                height_t                  height,
+                                physical_block_number_t   pbn,
+                                enum block_mapping_state  state)
+{
+  if (state == VDO_MAPPING_STATE_UNMAPPED) {
+    if (pbn != VDO_ZERO_BLOCK) {
+      reportBlockMapEntry(audited, "is unmapped but has a physical block",
+                          slot, height, pbn, state);
+      return VDO_BAD_MAPPING;
+    }
+    return VDO_SUCCESS;
+  }
+
+  if (vdo_is_state_compressed(state) && (pbn == VDO_ZERO_BLOCK)) {
+    reportBlockMapEntry(audited, "is compressed but has no physical block",
+                        slot, height, pbn, state);
+    return VDO_BAD_MAPPING;
+  }
+
+  if (height == 0) {
+    audited->lbnCount++;
+    if (pbn == VDO_ZERO_BLOCK) {
+      audited->zeroMappings++;
+      return VDO_SUCCESS;
+    }
+
+    if (vdo_is_state_compressed(state)) {
+      audited->compressedMappings[vdo_get_slot_from_state(state)]++;
+    }
+  }
+
+  slab_count_t slabNumber = 0;
+  int result = getSlabNumber(vdo, pbn, &slabNumber);
+  if (result != VDO_SUCCESS) {
+    reportBlockMapEntry(audited, "refers to out-of-range physical block",
+                        slot, height, pbn, state);
+    return result;
+  }
+
+  slab_block_number offset = 0;
+  result = getSlabBlockNumber(vdo, pbn, &offset);
+  if (result != VDO_SUCCESS) {
+    reportBlockMapEntry(audited, "refers to slab metadata block",
+                        slot, height, pbn, state);
+    return result;
+  }
+
+  if (!slabs[slabNumber].sampled) {
+    return VDO_SUCCESS;
+  }
+
+  vdo_refcount_t previous;
+  result = addReference(&slabs[slabNumber], offset, (height > 0),
+                        (analytics && vdo_is_state_compressed(state)),
+                        &previous);
+  if (result != VDO_SUCCESS) {
+    warnx("Could not record the audited reference count of PBN %llu",
+          (unsigned long long) pbn);
+    return result;
+  }
+
+  if (height > 0) {
+    // If this interior tree block has already been referenced, warn.
+    if (previous != 0) {
+      reportBlockMapEntry(audited, "refers to previously referenced tree page",
+                          slot, height, pbn, state);
+    }
+
+    // If this interior tree block appears to be compressed, warn.
+    if (vdo_is_state_compressed(state)) {
+      reportBlockMapEntry(audited, "refers to compressed fragment",
+                          slot, height, pbn, state);
+    }
+  } else if ((previous == PROVISIONAL_REFERENCE_COUNT)
+             || (previous + 1 > MAXIMUM_REFERENCE_COUNT)) {
+    // If incrementing the reference count goes above the maximum, warn.
+    reportBlockMapEntry(audited, "overflows reference count",
+                        slot, height, pbn, state);
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Record all the references in a block map page.
+ *
+ * Implements ParallelPageExaminer.
+ **/
+static int examineBlockMapPage(void                      *context,
+                               const DecodedBlockMapPage *page,
+                               height_t                   height)
+{
+  addProgress(1);
+  if (page->allUnmapped) {
+    return VDO_SUCCESS;
+  }
+
+  struct block_map_slot slot = {
+    .pbn  = page->pagePBN,
+    .slot = 0,
+  };
+  for (; slot.slot < VDO_BLOCK_MAP_ENTRIES_PER_PAGE; slot.slot++) {
+    int result = examineBlockMapEntry(context, slot, height,
+                                      page->pbns[slot.slot],
+                                      page->states[slot.slot]);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Make the counts for one thread examining the block map.
+ *
+ * Implements ExaminerContextMaker.
+ **/
+static int makeAuditContext(void *shared __attribute__((unused)),
+                            void **contextPtr)
+{
+  AuditContext *context;
+  int result = UDS_ALLOCATE(1, AuditContext, __func__, &context);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  *contextPtr = context;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Add the counts from one thread examining the block map to the totals.
+ *
+ * Implements ExaminerContextReducer.
+ **/
+static void reduceAuditContext(void *shared __attribute__((unused)),
+                               void *context)
+{
+  AuditContext *audited = context;
+  lbnCount         += audited->lbnCount;
+  badBlockMappings += audited->badBlockMappings;
+  badTreePages     += audited->badTreePages;
+  zeroMappings     += audited->zeroMappings;
+  for (unsigned int i = 0; i < VDO_MAX_COMPRESSION_SLOTS; i++) {
+    compressedMappings[i] += audited->compressedMappings[i];
+  }
+  UDS_FREE(audited);
+}
+
+/**
+ * Check whether it is time to pause the audit and save a checkpoint.
+ *
+ * Implements WalkPauser.
+ **/
+static bool checkpointDue(void *shared __attribute__((unused)))
+{
+  if (checkpointPath == NULL) {
+    return false;
+  }
+
+  ktime_t elapsed = ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+                              lastCheckpoint);
+  return (elapsed >= seconds_to_ktime(CHECKPOINT_INTERVAL_SECONDS));
+}
+
+/**
+ * Count a block map page which could not be read, or which holds the wrong
+ * page. Everything below it in its tree goes unexamined, so the blocks it
+ * maps will also show up as reference count errors.
+ *
+ * Implements BadPageReporter.
+ **/
+static void reportBadTreePage(void                    *context,
+                              physical_block_number_t  pbn,
+                              height_t                 height,
+                              int                      result)
+{
+  AuditContext *audited = context;
+  audited->badTreePages++;
+  if (!verbose) {
+    return;
+  }
+
+  char errBuf[ERRBUF_SIZE];
+  warnx("Block map page %llu (height %u) is unusable: %s",
+        (unsigned long long) pbn, height,
+        uds_string_error(result, errBuf, ERRBUF_SIZE));
+}
+
+/** The examiner which populates the audited reference counts */
+static const ParallelExaminer auditExaminer = {
+  .makeContext   = makeAuditContext,
+  .examine       = NULL,
+  .examinePage   = examineBlockMapPage,
+  .reduce        = reduceAuditContext,
+  .shouldPause   = checkpointDue,
+  .reportBadPage = reportBadTreePage,
+  .shared        = NULL,
+};
+
+/**
+ * Report a problem with the reference count of a block in a slab.
+ *
+ * @param verifier           The verifier counting the errors
+ * @param audit              The audit record for the slab
+ * @param sbn                The offset of the block within the slab
+ * @param treePage           <code>true</code> if the block appears to be a
+ *                           block map tree page
+ * @param pristine           <code>true</code> if the slab has never been used
+ * @param auditedReferences  The number of references to the block found
+ *                           by examining the block map tree
+ * @param storedReferences   The reference count recorded in the slab (or
+ *                           zero for a pristine slab)
+ **/
+static void reportRefCount(SlabVerifier      *verifier,
+                           SlabAudit         *audit,
+                           slab_block_number  sbn,
+                           bool               treePage,
+                           bool               pristine,
+                           vdo_refcount_t     auditedReferences,
+                           vdo_refcount_t     storedReferences)
+{
+  int errorDelta = storedReferences - (int) auditedReferences;
+  verifier->badRefCounts++;
+  if (audit->badRefCounts == 0) {
+    verifier->badSlabs++;
+  }
+
+  audit->badRefCounts++;
+  verifier->deltaCounts[errorDelta - MIN_ERROR_DELTA]++;
+  audit->firstError = min(audit->firstError, sbn);
+  audit->lastError  = max(audit->lastError, sbn);
+
+  if (!verbose) {
+    return;
+  }
+
+  uds_lock_mutex(&slabLock);
+  warnx("Reference mismatch for%s pbn %llu\n"
         "Block map had %u but%s slab %u had %u\n",
         (treePage ? " tree page" : ""),
         (unsigned long long) audit->slabOrigin + sbn,
@@ -451,210 +1837,1275 @@ static void reportRefCount(SlabAudit         *audit,
         (pristine ? " (uninitialized)" : ""),
         audit->slabNumber,
         storedReferences);
+  uds_unlock_mutex(&slabLock);
+}
+
+/**
+ * Verify a run of reference counts against observed reference counts, one
+ * count at a time. Any mismatches will generate a warning message.
+ *
+ * @param verifier        The verifier counting the errors
+ * @param audit           The audit record for the slab
+ * @param observed        The audited reference counts of the slab
+ * @param counts          The stored reference counts to check
+ * @param entries         Number of counts to check
+ * @param startingOffset  The offset within the slab of the first count
+ *
+ * @return The allocated count for the run
+ **/
+static block_count_t verifyRefCounts(SlabVerifier         *verifier,
+                                     SlabAudit            *audit,
+                                     const vdo_refcount_t *observed,
+                                     const vdo_refcount_t *counts,
+                                     block_count_t         entries,
+                                     slab_block_number     startingOffset)
+{
+  block_count_t allocatedCount = 0;
+  for (block_count_t i = 0; i < entries; i++) {
+    slab_block_number sbn                = startingOffset + i;
+    vdo_refcount_t    observedReferences = observed[sbn];
+    vdo_refcount_t    storedReferences   = counts[i];
+
+    // If the observed reference is provisional, it is a block map tree page,
+    // and there are two valid reference count values.
+    if (observedReferences == PROVISIONAL_REFERENCE_COUNT) {
+      if ((storedReferences == 1)
+          || (storedReferences == MAXIMUM_REFERENCE_COUNT)) {
+        allocatedCount++;
+        continue;
+      }
+
+      reportRefCount(verifier, audit, sbn, true, false,
+                     observedReferences, storedReferences);
+      continue;
+    }
+
+    if (observedReferences != storedReferences) {
+      // Mismatch, but maybe the refcount is provisional and the proper
+      // count is 0.
+      if ((observedReferences == EMPTY_REFERENCE_COUNT)
+          && (storedReferences == PROVISIONAL_REFERENCE_COUNT)) {
+        continue;
+      }
+
+      reportRefCount(verifier, audit, sbn, false, false,
+                     observedReferences, storedReferences);
+    }
+    if (storedReferences > 0) {
+      allocatedCount++;
+    }
+  }
+
+  return allocatedCount;
+}
+
+/**
+ * Mark the zero bytes of a word.
+ *
+ * @param word  The word to examine
+ *
+ * @return A word with the high bit of each byte set if and only if that byte
+ *         of the input is zero
+ **/
+static inline uint64_t markZeroBytes(uint64_t word)
+{
+  const uint64_t lowBits = 0x7F7F7F7F7F7F7F7FULL;
+  return ~(((word & lowBits) + lowBits) | word | lowBits);
+}
+
+/**
+ * Check whether a chunk of stored reference counts exactly matches the
+ * observed counts, with none of them tree pages, in which case no count in
+ * the chunk needs to be examined individually. The counts are compared a
+ * word at a time, which stays portable to every architecture VDO supports
+ * while letting the compiler vectorize the loop.
+ *
+ * @param [in]  stored     The stored reference counts
+ * @param [in]  observed   The observed reference counts
+ * @param [out] zerosPtr   A pointer to hold the number of zero counts in the
+ *                         chunk, if it matched
+ *
+ * @return <code>true</code> if the chunk matched
+ **/
+static bool chunkMatches(const vdo_refcount_t *stored,
+                         const vdo_refcount_t *observed,
+                         block_count_t        *zerosPtr)
+{
+  STATIC_ASSERT(sizeof(vdo_refcount_t) == 1);
+  STATIC_ASSERT(PROVISIONAL_REFERENCE_COUNT == 0xFF);
+
+  uint64_t differences = 0;
+  uint64_t treePages   = 0;
+  uint64_t zeros       = 0;
+  for (unsigned int i = 0; i < CHUNK_WORDS; i++) {
+    uint64_t storedWord;
+    uint64_t observedWord;
+    memcpy(&storedWord, stored + (i * sizeof(uint64_t)), sizeof(uint64_t));
+    memcpy(&observedWord, observed + (i * sizeof(uint64_t)),
+           sizeof(uint64_t));
+    differences |= (storedWord ^ observedWord);
+    // Provisional counts (0xFF) are the zero bytes of the complement.
+    treePages   |= markZeroBytes(~observedWord);
+    zeros       += __builtin_popcountll(markZeroBytes(storedWord));
+  }
+
+  if ((differences | treePages) != 0) {
+    return false;
+  }
+
+  *zerosPtr = zeros;
+  return true;
+}
+
+/**
+ * Verify a run of stored reference counts, such as those of a
+ * packed_reference_sector, against observed reference counts. Any
+ * mismatches will generate a warning message. Nearly all counts normally
+ * match, so the counts are compared a chunk at a time, and only the chunks
+ * which differ or contain tree pages are examined count by count.
+ *
+ * @param verifier        The verifier counting the errors
+ * @param audit           The audit record for the slab
+ * @param observed        The audited reference counts of the slab
+ * @param counts          The stored reference counts to check
+ * @param entries         Number of counts in the run
+ * @param startingOffset  The starting offset within the slab
+ *
+ * @return The allocated count for the run
+ **/
+static block_count_t verifyRefCountRun(SlabVerifier         *verifier,
+                                       SlabAudit            *audit,
+                                       const vdo_refcount_t *observed,
+                                       const vdo_refcount_t *counts,
+                                       block_count_t         entries,
+                                       slab_block_number     startingOffset)
+{
+  block_count_t allocatedCount = 0;
+  block_count_t i              = 0;
+  for (; (i + CHUNK_COUNTS) <= entries; i += CHUNK_COUNTS) {
+    block_count_t zeros;
+    if (chunkMatches(&counts[i], &observed[startingOffset + i], &zeros)) {
+      allocatedCount += CHUNK_COUNTS - zeros;
+      continue;
+    }
+
+    allocatedCount += verifyRefCounts(verifier, audit, observed, &counts[i],
+                                      CHUNK_COUNTS, startingOffset + i);
+  }
+
+  return (allocatedCount
+          + verifyRefCounts(verifier, audit, observed, &counts[i],
+                            entries - i, startingOffset + i));
+}
+
+/**
+ * Verify all reference count entries in a given packed_reference_block
+ * against observed reference counts.
+ * Any mismatches will generate a warning message.
+ *
+ * @param verifier        The verifier counting the errors
+ * @param audit           The audit record for the slab
+ * @param observed        The audited reference counts of the slab
+ * @param block           packed_reference_block to check
+ * @param blockEntries    Number of counts in this block
+ * @param startingOffset  The starting offset within the slab
+ *
+ * @return The allocated count for this block
+ **/
+static block_count_t
+verifyRefCountBlock(SlabVerifier                  *verifier,
+                    SlabAudit                     *audit,
+                    const vdo_refcount_t          *observed,
+                    struct packed_reference_block *block,
+                    block_count_t                  blockEntries,
+                    slab_block_number              startingOffset)
+{
+  block_count_t allocatedCount = 0;
+  block_count_t entries        = blockEntries;
+  for (sector_count_t i = 0;
+       (i < VDO_SECTORS_PER_BLOCK) && (entries > 0); i++) {
+    block_count_t sectorEntries
+      = min(entries, (block_count_t) COUNTS_PER_SECTOR);
+    allocatedCount += verifyRefCountRun(verifier, audit, observed,
+                                        block->sectors[i].counts,
+                                        sectorEntries, startingOffset);
+    startingOffset += sectorEntries;
+    entries        -= sectorEntries;
+  }
+
+  return allocatedCount;
+}
+
+/**
+ * Verify that the number of free blocks in the slab matches the summary's
+ * approximate value.
+ *
+ * @param verifier    The verifier counting the errors
+ * @param slabNumber  The number of the slab to check
+ * @param freeBlocks  The actual number of free blocks in the slab
+ **/
+static void verifySummaryHint(SlabVerifier  *verifier,
+                              slab_count_t   slabNumber,
+                              block_count_t  freeBlocks)
+{
+  block_count_t fullnessHint = slabSummaryEntries[slabNumber].fullness_hint;
+  block_count_t freeBlockHint = fullnessHint << hintShift;
+  block_count_t hintError = (1ULL << hintShift);
+  if ((freeBlocks < max(freeBlockHint, hintError) - hintError)
+      || (freeBlocks >= (freeBlockHint + hintError))) {
+    verifier->badSummaryHints++;
+    if (verbose) {
+      uds_lock_mutex(&slabLock);
+      warnx("Slab summary reports roughly %llu free blocks in\n"
+            "slab %u, instead of %llu blocks",
+            (unsigned long long) freeBlockHint, slabNumber,
+            (unsigned long long) freeBlocks);
+      uds_unlock_mutex(&slabLock);
+    }
+  }
+}
+
+/**
+ * Get the audited reference counts of a slab as a byte for each block,
+ * expanding them into the verifier's buffer if the slab is tracked
+ * compactly.
+ *
+ * @param verifier  The verifier doing the work
+ * @param audit     The audit record for the slab
+ *
+ * @return The audited reference counts
+ **/
+static const vdo_refcount_t *getObservedCounts(SlabVerifier    *verifier,
+                                               const SlabAudit *audit)
+{
+  if (audit->refCounts != NULL) {
+    return audit->refCounts;
+  }
+
+  expandAuditedCounts(audit, verifier->observed);
+  return verifier->observed;
+}
+
+/**
+ * Add the audited reference counts of a slab to the verifier's histogram
+ * for --analytics, and count the slab's used blocks and tree pages.
+ *
+ * @param verifier  The verifier doing the work
+ * @param audit     The audit record for the slab
+ * @param observed  The audited reference counts of the slab
+ **/
+static void analyzeSlab(SlabVerifier         *verifier,
+                        SlabAudit            *audit,
+                        const vdo_refcount_t *observed)
+{
+  if (!analytics) {
+    return;
+  }
+
+  block_count_t *histogram = verifier->countHistogram;
+  block_count_t  freeBlocks = histogram[EMPTY_REFERENCE_COUNT];
+  block_count_t  treePages  = histogram[PROVISIONAL_REFERENCE_COUNT];
+  for (slab_block_number sbn = 0; sbn < slabDataBlocks; sbn++) {
+    histogram[observed[sbn]]++;
+  }
+
+  freeBlocks        = histogram[EMPTY_REFERENCE_COUNT] - freeBlocks;
+  audit->usedBlocks = slabDataBlocks - freeBlocks;
+  audit->treePages  = histogram[PROVISIONAL_REFERENCE_COUNT] - treePages;
+}
+
+/**
+ * Finish the verification of a slab by keeping the histogram of its errors,
+ * if it had any, and freeing its audited reference counts, which are no
+ * longer needed.
+ *
+ * @param verifier  The verifier which verified the slab
+ * @param audit     The audit record for the slab
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int finishSlab(SlabVerifier *verifier, SlabAudit *audit)
+{
+  addProgress(1);
+  freeAuditedCounts(audit);
+  if (audit->badRefCounts == 0) {
+    return VDO_SUCCESS;
+  }
+
+  int result = UDS_ALLOCATE(DELTA_BUCKETS, uint32_t, __func__,
+                            &audit->deltaCounts);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  memcpy(audit->deltaCounts, verifier->deltaCounts,
+         sizeof(verifier->deltaCounts));
+  memset(verifier->deltaCounts, 0, sizeof(verifier->deltaCounts));
+  return VDO_SUCCESS;
+}
+
+/**
+ * Verify that a pristine slab, which has never had its reference counts
+ * written, is not referenced by the block map.
+ *
+ * @param verifier    The verifier doing the work
+ * @param slabNumber  The number of the slab to verify
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int verifyPristineSlab(SlabVerifier *verifier, slab_count_t slabNumber)
+{
+  SlabAudit            *audit    = &slabs[slabNumber];
+  const vdo_refcount_t *observed = getObservedCounts(verifier, audit);
+  USDT_PROBE1(vdo, slab_verify_start, slabNumber);
+
+  // Confirm that all reference counts for this pristine slab are 0.
+  for (slab_block_number sbn = 0; sbn < slabDataBlocks; sbn++) {
+    if (observed[sbn] != 0) {
+      reportRefCount(verifier, audit, sbn, false, true, observed[sbn], 0);
+    }
+  }
+  analyzeSlab(verifier, audit, observed);
+
+  // Verify that the slab summary contains the expected free block count.
+  verifySummaryHint(verifier, slabNumber, slabDataBlocks);
+  USDT_PROBE2(vdo, slab_verify_done, slabNumber, slabDataBlocks);
+  return finishSlab(verifier, audit);
+}
+
+/**
+ * Finish verifying a slab whose stored reference counts have been compared
+ * with the audited ones, by checking its slab summary hint.
+ *
+ * @param verifier    The verifier doing the work
+ * @param audit       The audit record for the slab
+ * @param observed    The audited reference counts of the slab
+ * @param freeBlocks  The number of free blocks the stored counts show
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int finishVerifiedSlab(SlabVerifier         *verifier,
+                              SlabAudit            *audit,
+                              const vdo_refcount_t *observed,
+                              block_count_t         freeBlocks)
+{
+  analyzeSlab(verifier, audit, observed);
+
+  // Verify that the slab summary contains the expected free block count.
+  verifySummaryHint(verifier, audit->slabNumber, freeBlocks);
+  USDT_PROBE2(vdo, slab_verify_done, audit->slabNumber, freeBlocks);
+  return finishSlab(verifier, audit);
+}
+
+/**
+ * Verify that the stored reference counts for a given slab are consistent
+ * with the block map.
+ *
+ * @param verifier    The verifier doing the work
+ * @param slabNumber  The number of the slab to verify
+ * @param buffer      The reference counts read from the slab
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int verifySlab(SlabVerifier *verifier,
+                      slab_count_t  slabNumber,
+                      char         *buffer)
+{
+  SlabAudit            *audit             = &slabs[slabNumber];
+  const vdo_refcount_t *observed          = getObservedCounts(verifier, audit);
+  char                 *currentBlockStart = buffer;
+  block_count_t         freeBlocks        = 0;
+  slab_block_number     currentOffset     = 0;
+  block_count_t         remainingEntries  = slabDataBlocks;
+  USDT_PROBE1(vdo, slab_verify_start, slabNumber);
+  while (remainingEntries > 0) {
+    struct packed_reference_block *block
+      = (struct packed_reference_block *) currentBlockStart;
+    block_count_t blockEntries
+      = min((block_count_t) COUNTS_PER_BLOCK, remainingEntries);
+    block_count_t allocatedCount
+      = verifyRefCountBlock(verifier, audit, observed, block, blockEntries,
+                            currentOffset);
+    freeBlocks        += (blockEntries - allocatedCount);
+    remainingEntries  -= blockEntries;
+    currentBlockStart += VDO_BLOCK_SIZE;
+    currentOffset     += blockEntries;
+  }
+
+  return finishVerifiedSlab(verifier, audit, observed, freeBlocks);
+}
+
+/**
+ * Verify a slab whose stored reference counts were read while the block map
+ * was walked, and free them.
+ *
+ * @param verifier    The verifier doing the work
+ * @param slabNumber  The number of the slab to verify
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int verifyLoadedSlab(SlabVerifier *verifier, slab_count_t slabNumber)
+{
+  SlabAudit            *audit    = &slabs[slabNumber];
+  const vdo_refcount_t *observed = getObservedCounts(verifier, audit);
+  USDT_PROBE1(vdo, slab_verify_start, slabNumber);
+  block_count_t allocatedCount
+    = verifyRefCountRun(verifier, audit, observed, audit->storedCounts,
+                        slabDataBlocks, 0);
+  UDS_FREE(audit->storedCounts);
+  audit->storedCounts = NULL;
+  return finishVerifiedSlab(verifier, audit, observed,
+                            slabDataBlocks - allocatedCount);
+}
+
+/**
+ * Check a slab for --quick, which has no audited counts to compare with, by
+ * counting the blocks its stored reference counts show allocated and
+ * checking its slab summary hint against them. Provisional counts are
+ * counted as free, as a full audit of a block with no references would.
+ *
+ * @param verifier    The verifier doing the work
+ * @param slabNumber  The number of the slab to check
+ * @param buffer      The reference counts read from the slab, or NULL if the
+ *                    slab is pristine
+ **/
+static void quickCheckSlab(SlabVerifier *verifier,
+                           slab_count_t  slabNumber,
+                           char         *buffer)
+{
+  block_count_t allocatedCount   = 0;
+  block_count_t remainingEntries = ((buffer == NULL) ? 0 : slabDataBlocks);
+  for (char *blockStart = buffer; remainingEntries > 0;
+       blockStart += VDO_BLOCK_SIZE) {
+    struct packed_reference_block *block
+      = (struct packed_reference_block *) blockStart;
+    for (sector_count_t i = 0;
+         (i < VDO_SECTORS_PER_BLOCK) && (remainingEntries > 0); i++) {
+      block_count_t sectorEntries
+        = min(remainingEntries, (block_count_t) COUNTS_PER_SECTOR);
+      const vdo_refcount_t *counts = block->sectors[i].counts;
+      for (block_count_t j = 0; j < sectorEntries; j++) {
+        allocatedCount += ((counts[j] != EMPTY_REFERENCE_COUNT)
+                           && (counts[j] != PROVISIONAL_REFERENCE_COUNT));
+      }
+      remainingEntries -= sectorEntries;
+    }
+  }
+
+  verifier->allocatedBlocks += allocatedCount;
+  verifySummaryHint(verifier, slabNumber, slabDataBlocks - allocatedCount);
+  addProgress(1);
+}
+
+/**
+ * Record a failure to verify a slab, keeping the first error.
+ *
+ * @param result  The error
+ **/
+static void failSlabs(int result)
+{
+  uds_lock_mutex(&slabLock);
+  if (slabResult == VDO_SUCCESS) {
+    slabResult = result;
+  }
+  uds_unlock_mutex(&slabLock);
+}
+
+/**
+ * Verify a slab as soon as its reference counts have been read, while the
+ * reads of the other slabs in flight continue.
+ *
+ * Implements extent_read_callback.
+ **/
+static void verifyReadSlab(struct extent_read *extent, void *context)
+{
+  SlabVerifier *verifier   = context;
+  slab_count_t  slabNumber = verifier->slabNumbers[extent - verifier->reads];
+  if (extent->result != VDO_SUCCESS) {
+    warnx("Could not read reference count buffer for slab number %u\n",
+          slabNumber);
+    return;
+  }
+
+  if (quick) {
+    quickCheckSlab(verifier, slabNumber, extent->buffer);
+    return;
+  }
+
+  int result = verifySlab(verifier, slabNumber, extent->buffer);
+  if (result != VDO_SUCCESS) {
+    failSlabs(result);
+  }
+}
+
+/**
+ * Let the layer know that the reference counts of a slab will be read soon,
+ * so that they can be fetched while the previous slab is being verified.
+ *
+ * @param slabNumber  The number of the slab which will be read next
+ **/
+static void adviseSlabRead(slab_count_t slabNumber)
+{
+  if ((vdo->layer->advise == NULL) || (slabNumber >= vdo->slabCount)
+      || !slabs[slabNumber].sampled
+      || !slabSummaryEntries[slabNumber].load_ref_counts) {
+    return;
+  }
+
+  vdo->layer->advise(vdo->layer, slabs[slabNumber].slabOrigin + slabDataBlocks,
+                     vdo->states.slab_depot.slab_config.reference_count_blocks,
+                     ACCESS_WILL_NEED);
+}
+
+/**
+ * Take the next sampled slab to be verified, unless there are none left, the
+ * verification has failed, or it is time to save a checkpoint. At least one
+ * slab is taken between checkpoints, so that verification always makes
+ * progress.
+ *
+ * @param slabNumberPtr  A pointer to hold the number of the slab
+ *
+ * @return <code>true</code> if a slab was taken
+ **/
+static bool takeSlab(slab_count_t *slabNumberPtr)
+{
+  uds_lock_mutex(&slabLock);
+  while ((nextSlab < vdo->slabCount) && !slabs[nextSlab].sampled) {
+    nextSlab++;
+  }
+
+  bool taken = ((slabResult == VDO_SUCCESS) && (nextSlab < vdo->slabCount)
+                && ((nextSlab == firstSlab) || !checkpointDue(NULL)));
+  if (taken) {
+    *slabNumberPtr = nextSlab++;
+  }
+  uds_unlock_mutex(&slabLock);
+
+  if (taken) {
+    adviseSlabRead(*slabNumberPtr + 1);
+  }
+  return taken;
+}
+
+/**
+ * Verify slabs until there are none left. This is the body of each slab
+ * verification thread. The reference counts of up to PIPELINE_DEPTH slabs
+ * are read at once, and each slab is verified as soon as its read completes,
+ * so that verification overlaps the reads still in flight. Pristine slabs,
+ * and slabs whose counts were read during the walk, have nothing to read,
+ * so they are verified as they are taken.
+ *
+ * @param arg  The SlabVerifier for this thread
+ **/
+static void verifySlabs(void *arg)
+{
+  SlabVerifier  *verifier       = arg;
+  block_count_t  refCountBlocks
+    = vdo->states.slab_depot.slab_config.reference_count_blocks;
+  for (;;) {
+    size_t       count = 0;
+    slab_count_t slabNumber;
+    while ((count < PIPELINE_DEPTH) && takeSlab(&slabNumber)) {
+      if (quick && !slabSummaryEntries[slabNumber].load_ref_counts) {
+        quickCheckSlab(verifier, slabNumber, NULL);
+        continue;
+      }
+
+      if (!slabSummaryEntries[slabNumber].load_ref_counts) {
+        int result = verifyPristineSlab(verifier, slabNumber);
+        if (result != VDO_SUCCESS) {
+          failSlabs(result);
+        }
+        continue;
+      }
+
+      if (slabs[slabNumber].storedCounts != NULL) {
+        int result = verifyLoadedSlab(verifier, slabNumber);
+        if (result != VDO_SUCCESS) {
+          failSlabs(result);
+        }
+        continue;
+      }
+
+      verifier->slabNumbers[count] = slabNumber;
+      verifier->reads[count] = (struct extent_read) {
+        .start_block = slabs[slabNumber].slabOrigin + slabDataBlocks,
+        .block_count = refCountBlocks,
+        .buffer      = (verifier->buffer
+                        + (count * refCountBlocks * VDO_BLOCK_SIZE)),
+        .result      = VDO_SUCCESS,
+      };
+      count++;
+    }
+
+    if (count == 0) {
+      return;
+    }
+
+    int result = vdo->layer->readExtents(vdo->layer, verifier->reads, count,
+                                         verifyReadSlab, verifier);
+    if (result != VDO_SUCCESS) {
+      failSlabs(result);
+      return;
+    }
+  }
+}
+
+/**
+ * Write the checkpoint record of a slab. A slab which has been verified
+ * records its errors; any other slab records its audited reference counts,
+ * if it has any.
+ *
+ * @param fd      The checkpoint file
+ * @param audit   The audit record for the slab
+ * @param counts  A buffer for the expanded counts of a compact slab
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int writeSlabCheckpoint(int fd, const SlabAudit *audit, byte *counts)
+{
+  byte   record[VERIFIED_SLAB_BYTES + (DELTA_BUCKETS * sizeof(uint32_t))];
+  size_t offset = 0;
+  if (audit->slabNumber < nextSlab) {
+    encode_uint32_le(record, &offset, audit->badRefCounts);
+    encode_uint32_le(record, &offset, audit->firstError);
+    encode_uint32_le(record, &offset, audit->lastError);
+    for (unsigned int i = 0;
+         (audit->deltaCounts != NULL) && (i < DELTA_BUCKETS); i++) {
+      encode_uint32_le(record, &offset, audit->deltaCounts[i]);
+    }
+
+    return write_buffer(fd, record, offset);
+  }
+
+  bool referenced = ((audit->refCounts != NULL)
+                     || (audit->referenced != NULL));
+  record[0] = referenced;
+  int result = write_buffer(fd, record, 1);
+  if ((result != UDS_SUCCESS) || !referenced) {
+    return result;
+  }
+
+  if (audit->refCounts != NULL) {
+    return write_buffer(fd, audit->refCounts, slabDataBlocks);
+  }
+
+  expandAuditedCounts(audit, counts);
+  return write_buffer(fd, counts, slabDataBlocks);
 }
 
 /**
- * Verify all reference count entries in a given
- * packed_reference_sector against observed reference counts. Any
- * mismatches will generate a warning message.
+ * Save the progress of the audit to the checkpoint file. The checkpoint is
+ * written to a temporary file which then replaces the old checkpoint, so
+ * that an interruption while saving leaves the previous checkpoint intact.
  *
- * @param audit           The audit record for the slab
- * @param sector          packed_reference_sector to check
- * @param entries         Number of counts in this sector
- * @param startingOffset  The starting offset within the slab
+ * @return VDO_SUCCESS or an error
+ **/
+static int saveCheckpoint(void)
+{
+  char *tempPath;
+  int result = uds_alloc_sprintf(__func__, &tempPath, "%s.new",
+                                 checkpointPath);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  byte *counts;
+  result = UDS_ALLOCATE(slabDataBlocks, byte, __func__, &counts);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(tempPath);
+    return result;
+  }
+
+  int fd;
+  result = open_file(tempPath, FU_CREATE_WRITE_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    UDS_FREE(counts);
+    UDS_FREE(tempPath);
+    return result;
+  }
+
+  byte   header[CHECKPOINT_HEADER_BYTES];
+  size_t offset = 0;
+  memcpy(header, CHECKPOINT_MAGIC, sizeof(uint64_t));
+  offset += sizeof(uint64_t);
+  encode_uint32_le(header, &offset, CHECKPOINT_VERSION);
+  encode_uint32_le(header, &offset, auditPhase);
+  encode_uint64_le(header, &offset, vdo->states.vdo.nonce);
+  encode_uint64_le(header, &offset, slabDataBlocks);
+  encode_uint32_le(header, &offset, vdo->slabCount);
+  encode_uint32_le(header, &offset, vdo->states.block_map.root_count);
+  encode_uint32_le(header, &offset, nextRoot);
+  encode_uint32_le(header, &offset, nextSlab);
+  encode_uint64_le(header, &offset, lbnCount);
+  encode_uint64_le(header, &offset, badBlockMappings);
+  encode_uint64_le(header, &offset, badTreePages);
+  encode_uint64_le(header, &offset, badRefCounts);
+  encode_uint32_le(header, &offset, badSlabs);
+  encode_uint32_le(header, &offset, badSummaryHints);
+  STATIC_ASSERT(sizeof(CHECKPOINT_MAGIC) == sizeof(uint64_t) + 1);
+  result = ASSERT(offset == CHECKPOINT_HEADER_BYTES,
+                  "checkpoint header is %zu bytes", offset);
+  if (result == UDS_SUCCESS) {
+    result = write_buffer(fd, header, offset);
+  }
+
+  for (slab_count_t i = 0; (result == UDS_SUCCESS) && (i < vdo->slabCount);
+       i++) {
+    result = writeSlabCheckpoint(fd, &slabs[i], counts);
+  }
+
+  if (result == UDS_SUCCESS) {
+    result = sync_and_close_file(fd, "cannot sync checkpoint file");
+  } else {
+    try_close_file(fd);
+  }
+
+  if ((result == UDS_SUCCESS) && (rename(tempPath, checkpointPath) != 0)) {
+    result = errno;
+  }
+
+  if (result == UDS_SUCCESS) {
+    lastCheckpoint = current_time_ns(CLOCK_MONOTONIC);
+  } else {
+    warnx("Could not save checkpoint '%s'", checkpointPath);
+  }
+
+  UDS_FREE(counts);
+  UDS_FREE(tempPath);
+  return result;
+}
+
+/**
+ * Read the checkpoint record of a slab, as written by writeSlabCheckpoint().
  *
- * @return The allocated count for this sector
+ * @param fd     The checkpoint file
+ * @param audit  The audit record for the slab
+ *
+ * @return VDO_SUCCESS or an error
  **/
-static block_count_t
-verifyRefCountSector(SlabAudit                      *audit,
-                     struct packed_reference_sector *sector,
-                     block_count_t                   entries,
-                     slab_block_number               startingOffset)
+static int readSlabCheckpoint(int fd, SlabAudit *audit)
 {
-  block_count_t allocatedCount = 0;
-  for (block_count_t i = 0; i < entries; i++) {
-    slab_block_number sbn                = startingOffset + i;
-    vdo_refcount_t    observedReferences = audit->refCounts[sbn];
-    vdo_refcount_t    storedReferences   = sector->counts[i];
+  byte record[VERIFIED_SLAB_BYTES];
+  if (audit->slabNumber < nextSlab) {
+    int result = read_buffer(fd, record, VERIFIED_SLAB_BYTES);
+    if (result != UDS_SUCCESS) {
+      return result;
+    }
 
-    // If the observed reference is provisional, it is a block map tree page,
-    // and there are two valid reference count values.
-    if (observedReferences == PROVISIONAL_REFERENCE_COUNT) {
-      if ((storedReferences == 1)
-          || (storedReferences == MAXIMUM_REFERENCE_COUNT)) {
-        allocatedCount++;
-        continue;
+    size_t   offset = 0;
+    uint32_t firstError;
+    uint32_t lastError;
+    decode_uint32_le(record, &offset, &audit->badRefCounts);
+    decode_uint32_le(record, &offset, &firstError);
+    decode_uint32_le(record, &offset, &lastError);
+    audit->firstError = firstError;
+    audit->lastError  = lastError;
+    if (audit->badRefCounts == 0) {
+      return VDO_SUCCESS;
+    }
+
+    result = UDS_ALLOCATE(DELTA_BUCKETS, uint32_t, __func__,
+                          &audit->deltaCounts);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    for (unsigned int i = 0; i < DELTA_BUCKETS; i++) {
+      result = read_buffer(fd, record, sizeof(uint32_t));
+      if (result != UDS_SUCCESS) {
+        return result;
       }
 
-      reportRefCount(audit, sbn, true, false,
-                     observedReferences, storedReferences);
+      audit->deltaCounts[i] = get_unaligned_le32(record);
+    }
+
+    return VDO_SUCCESS;
+  }
+
+  int result = read_buffer(fd, record, 1);
+  if ((result != UDS_SUCCESS) || (record[0] == 0)) {
+    return result;
+  }
+
+  result = spillAllocate(allocator, slabDataBlocks, "audited reference counts",
+                         &audit->refCounts);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  return read_buffer(fd, audit->refCounts, slabDataBlocks);
+}
+
+/**
+ * Restore the progress of an audit from the checkpoint file, if there is
+ * one.
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int loadCheckpoint(void)
+{
+  bool exists;
+  int result = file_exists(checkpointPath, &exists);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  if (!exists) {
+    warnx("No checkpoint '%s' found, starting a new audit", checkpointPath);
+    return VDO_SUCCESS;
+  }
+
+  int fd;
+  result = open_file(checkpointPath, FU_READ_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    return result;
+  }
+
+  byte header[CHECKPOINT_HEADER_BYTES];
+  result = read_buffer(fd, header, CHECKPOINT_HEADER_BYTES);
+  if (result != UDS_SUCCESS) {
+    try_close_file(fd);
+    return result;
+  }
+
+  size_t   offset = sizeof(uint64_t);
+  uint32_t version, phase, slabCount, rootCount, root, slab;
+  uint32_t slabErrors, hintErrors;
+  uint64_t nonce, dataBlocks;
+  decode_uint32_le(header, &offset, &version);
+  decode_uint32_le(header, &offset, &phase);
+  decode_uint64_le(header, &offset, &nonce);
+  decode_uint64_le(header, &offset, &dataBlocks);
+  decode_uint32_le(header, &offset, &slabCount);
+  decode_uint32_le(header, &offset, &rootCount);
+  decode_uint32_le(header, &offset, &root);
+  decode_uint32_le(header, &offset, &slab);
+  decode_uint64_le(header, &offset, &lbnCount);
+  decode_uint64_le(header, &offset, &badBlockMappings);
+  decode_uint64_le(header, &offset, &badTreePages);
+  decode_uint64_le(header, &offset, &badRefCounts);
+  decode_uint32_le(header, &offset, &slabErrors);
+  decode_uint32_le(header, &offset, &hintErrors);
+  if ((memcmp(header, CHECKPOINT_MAGIC, sizeof(uint64_t)) != 0)
+      || (version != CHECKPOINT_VERSION)) {
+    warnx("'%s' is not a vdoaudit checkpoint", checkpointPath);
+    try_close_file(fd);
+    return VDO_BAD_MAGIC;
+  }
+
+  if ((nonce != vdo->states.vdo.nonce) || (dataBlocks != slabDataBlocks)
+      || (slabCount != vdo->slabCount)
+      || (rootCount != vdo->states.block_map.root_count)
+      || (phase > AUDIT_PHASE_VERIFY) || (root > rootCount)
+      || (slab > slabCount)) {
+    warnx("Checkpoint '%s' does not belong to this volume", checkpointPath);
+    try_close_file(fd);
+    return VDO_OUT_OF_RANGE;
+  }
+
+  auditPhase      = phase;
+  nextRoot        = root;
+  nextSlab        = slab;
+  badSlabs        = slabErrors;
+  badSummaryHints = hintErrors;
+  for (slab_count_t i = 0; (result == VDO_SUCCESS) && (i < slabCount); i++) {
+    result = readSlabCheckpoint(fd, &slabs[i]);
+  }
+
+  try_close_file(fd);
+  if (result != VDO_SUCCESS) {
+    warnx("Could not read checkpoint '%s'", checkpointPath);
+    return result;
+  }
+
+  warnx("Resuming audit from checkpoint '%s'", checkpointPath);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Check whether the stored count loader has been told to stop.
+ *
+ * @return <code>true</code> if the loader should stop
+ **/
+static bool loaderStopping(void)
+{
+  uds_lock_mutex(&loader.lock);
+  bool stopping = loader.stopping;
+  uds_unlock_mutex(&loader.lock);
+  return stopping;
+}
+
+/**
+ * Read the stored reference counts of the dirty slabs being audited, in
+ * order, until they are all read, the memory for them runs out, or the walk
+ * of the block map finishes. The counts don't depend on the walk, so reading
+ * them alongside it takes the reads off the verification phase. Any slab
+ * which can't be read here is read again, and any error reported, when it is
+ * verified. This is the body of the loader thread.
+ *
+ * @param arg  Unused
+ **/
+static void loadStoredCounts(void *arg __attribute__((unused)))
+{
+  block_count_t refCountBlocks
+    = vdo->states.slab_depot.slab_config.reference_count_blocks;
+  for (slab_count_t i = 0;
+       (i < vdo->slabCount) && (loader.budget >= slabDataBlocks); i++) {
+    if (!slabs[i].sampled || !slabSummaryEntries[i].load_ref_counts) {
       continue;
     }
 
-    if (observedReferences != storedReferences) {
-      // Mismatch, but maybe the refcount is provisional and the proper
-      // count is 0.
-      if ((observedReferences == EMPTY_REFERENCE_COUNT)
-          && (storedReferences == PROVISIONAL_REFERENCE_COUNT)) {
-        continue;
-      }
+    if (loaderStopping()) {
+      return;
+    }
 
-      reportRefCount(audit, sbn, false, false,
-                     observedReferences, storedReferences);
+    int result = vdo->layer->reader(vdo->layer,
+                                    slabs[i].slabOrigin + slabDataBlocks,
+                                    refCountBlocks, loader.buffer);
+    if (result != VDO_SUCCESS) {
+      return;
     }
-    if (storedReferences > 0) {
-      allocatedCount++;
+
+    vdo_refcount_t *counts;
+    result = UDS_ALLOCATE(slabDataBlocks, vdo_refcount_t, __func__, &counts);
+    if (result != VDO_SUCCESS) {
+      return;
     }
+
+    unpackReferenceCounts(loader.buffer, slabDataBlocks, counts);
+    slabs[i].storedCounts  = counts;
+    loader.budget         -= slabDataBlocks;
   }
+}
 
-  return allocatedCount;
+/**
+ * Start the thread reading stored reference counts during the walk. If it
+ * can't be started, the counts are all read when the slabs are verified.
+ *
+ * @return <code>true</code> if the thread was started
+ **/
+static bool startStoredCountLoader(void)
+{
+  block_count_t refCountBlocks
+    = vdo->states.slab_depot.slab_config.reference_count_blocks;
+  loader = (StoredCountLoader) {
+    .budget = ((memoryLimit == 0)
+               ? PRELOAD_LIMIT_BYTES
+               : (size_t) min(memoryLimit, (uint64_t) PRELOAD_LIMIT_BYTES)),
+  };
+  if (vdo->layer->allocateIOBuffer(vdo->layer,
+                                   refCountBlocks * VDO_BLOCK_SIZE,
+                                   "stored reference counts",
+                                   &loader.buffer) != VDO_SUCCESS) {
+    return false;
+  }
+
+  if (uds_init_mutex(&loader.lock) != UDS_SUCCESS) {
+    UDS_FREE(loader.buffer);
+    return false;
+  }
+
+  if (uds_create_thread(loadStoredCounts, NULL, "vdoCountLoader",
+                        &loader.thread) != UDS_SUCCESS) {
+    uds_destroy_mutex(&loader.lock);
+    UDS_FREE(loader.buffer);
+    return false;
+  }
+
+  return true;
 }
 
 /**
- * Verify all reference count entries in a given packed_reference_block
- * against observed reference counts.
- * Any mismatches will generate a warning message.
+ * Stop the thread reading stored reference counts, keeping the counts it
+ * has read.
+ **/
+static void stopStoredCountLoader(void)
+{
+  uds_lock_mutex(&loader.lock);
+  loader.stopping = true;
+  uds_unlock_mutex(&loader.lock);
+  uds_join_threads(loader.thread);
+  uds_destroy_mutex(&loader.lock);
+  UDS_FREE(loader.buffer);
+}
+
+/**
+ * Populate the audited reference counts by examining the block map trees
+ * not yet examined, saving a checkpoint whenever one is due.
  *
- * @param audit           The audit record for the slab
- * @param block           packed_reference_block to check
- * @param blockEntries    Number of counts in this block
- * @param startingOffset  The starting offset within the slab
+ * @return VDO_SUCCESS or an error
+ **/
+static int walkBlockMap(void)
+{
+  setProgressPhase("block map walk", "pages", 0);
+  while (nextRoot < vdo->states.block_map.root_count) {
+    int result = examineBlockMapTreesInParallel(vdo, threadCount, &nextRoot,
+                                                &auditExaminer);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    if (nextRoot < vdo->states.block_map.root_count) {
+      result = saveCheckpoint();
+      if (result != VDO_SUCCESS) {
+        return result;
+      }
+    }
+  }
+
+  // The walk is much the longest part of the audit, so always save it.
+  auditPhase = AUDIT_PHASE_VERIFY;
+  return ((checkpointPath == NULL) ? VDO_SUCCESS : saveCheckpoint());
+}
+
+/**
+ * Run the slab verification threads until there are no slabs left or a
+ * checkpoint is due, and add their error counts to the totals.
  *
- * @return The allocated count for this block
+ * @param verifiers      The verifiers, one for each thread
+ * @param verifierCount  The number of verifiers
+ *
+ * @return VDO_SUCCESS or an error
  **/
-static block_count_t
-verifyRefCountBlock(SlabAudit                     *audit,
-                    struct packed_reference_block *block,
-                    block_count_t                  blockEntries,
-                    slab_block_number              startingOffset)
+static int runSlabVerifiers(SlabVerifier *verifiers,
+                            unsigned int  verifierCount)
 {
-  block_count_t allocatedCount = 0;
-  block_count_t entries        = blockEntries;
-  for (sector_count_t i = 0;
-       (i < VDO_SECTORS_PER_BLOCK) && (entries > 0); i++) {
-    block_count_t sectorEntries
-      = min(entries, (block_count_t) COUNTS_PER_SECTOR);
-    allocatedCount += verifyRefCountSector(audit, &block->sectors[i],
-                                           sectorEntries, startingOffset);
-    startingOffset += sectorEntries;
-    entries        -= sectorEntries;
+  firstSlab = nextSlab;
+  adviseSlabRead(nextSlab);
+
+  int          result  = VDO_SUCCESS;
+  unsigned int started = 0;
+  for (; started < verifierCount; started++) {
+    result = uds_create_thread(verifySlabs, &verifiers[started],
+                               "vdoSlabAudit", &verifiers[started].thread);
+    if (result != UDS_SUCCESS) {
+      failSlabs(result);
+      break;
+    }
   }
 
-  return allocatedCount;
+  for (unsigned int i = 0; i < started; i++) {
+    uds_join_threads(verifiers[i].thread);
+  }
+
+  for (unsigned int i = 0; i < verifierCount; i++) {
+    badRefCounts    += verifiers[i].badRefCounts;
+    badSlabs        += verifiers[i].badSlabs;
+    badSummaryHints += verifiers[i].badSummaryHints;
+    allocatedBlocks += verifiers[i].allocatedBlocks;
+    verifiers[i].badRefCounts    = 0;
+    verifiers[i].badSlabs        = 0;
+    verifiers[i].badSummaryHints = 0;
+    verifiers[i].allocatedBlocks = 0;
+    for (unsigned int count = 0; count < COUNT_BUCKETS; count++) {
+      countHistogram[count] += verifiers[i].countHistogram[count];
+      verifiers[i].countHistogram[count] = 0;
+    }
+  }
+
+  return ((result == VDO_SUCCESS) ? slabResult : result);
 }
 
 /**
- * Verify that the number of free blocks in the slab matches the summary's
- * approximate value.
+ * Check that the reference counts are consistent with the block map. Warn for
+ * any physical block whose reference counts are inconsistent. The slabs are
+ * independent, so they are shared out among a pool of threads, each with its
+ * own buffer and error counts. Slabs are taken in order, so when a
+ * checkpoint is due, the threads stop taking slabs, and once they have
+ * finished the slabs they have, every slab before nextSlab has been
+ * verified.
  *
- * @param slabNumber  The number of the slab to check
- * @param freeBlocks  The actual number of free blocks in the slab
+ * @return VDO_SUCCESS or some error.
  **/
-static void verifySummaryHint(slab_count_t  slabNumber,
-                              block_count_t freeBlocks)
+static int verifyPBNRefCounts(void)
 {
-  block_count_t fullnessHint = slabSummaryEntries[slabNumber].fullness_hint;
-  block_count_t freeBlockHint = fullnessHint << hintShift;
-  block_count_t hintError = (1ULL << hintShift);
-  if ((freeBlocks < max(freeBlockHint, hintError) - hintError)
-      || (freeBlocks >= (freeBlockHint + hintError))) {
-    badSummaryHints++;
-    if (verbose) {
-      warnx("Slab summary reports roughly %llu free blocks in\n"
-            "slab %u, instead of %llu blocks",
-            (unsigned long long) freeBlockHint, slabNumber,
-            (unsigned long long) freeBlocks);
+  struct slab_config slabConfig = vdo->states.slab_depot.slab_config;
+  size_t refCountBytes
+    = (PIPELINE_DEPTH * slabConfig.reference_count_blocks * VDO_BLOCK_SIZE);
+
+  unsigned int verifierCount
+    = ((threadCount == 0) ? uds_get_num_cores() : threadCount);
+  verifierCount = max(min(verifierCount, (unsigned int) sampledSlabs), 1U);
+
+  SlabVerifier *verifiers;
+  int result = UDS_ALLOCATE(verifierCount, SlabVerifier, __func__,
+                            &verifiers);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = uds_init_mutex(&slabLock);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(verifiers);
+    return result;
+  }
+
+  unsigned int prepared = 0;
+  for (; prepared < verifierCount; prepared++) {
+    result = vdo->layer->allocateIOBuffer(vdo->layer, refCountBytes,
+                                          "slab reference counts",
+                                          &verifiers[prepared].buffer);
+    if (result != VDO_SUCCESS) {
+      warnx("Could not allocate %zu bytes for slab reference counts",
+            refCountBytes);
+      break;
+    }
+
+    if (quick) {
+      // There are no audited counts to expand.
+      continue;
+    }
+
+    result = UDS_ALLOCATE(slabDataBlocks, vdo_refcount_t, __func__,
+                          &verifiers[prepared].observed);
+    if (result != VDO_SUCCESS) {
+      warnx("Could not allocate %llu audited reference counts",
+            (unsigned long long) slabDataBlocks);
+      break;
+    }
+  }
+
+  slab_count_t remaining = 0;
+  for (slab_count_t i = nextSlab; i < vdo->slabCount; i++) {
+    remaining += slabs[i].sampled;
+  }
+
+  setProgressPhase("slab verification", "slabs", remaining);
+  hintShift = get_vdo_slab_summary_hint_shift(vdo->slabSizeShift);
+  while ((result == VDO_SUCCESS) && (nextSlab < vdo->slabCount)) {
+    result = runSlabVerifiers(verifiers, verifierCount);
+    if ((result == VDO_SUCCESS) && (nextSlab < vdo->slabCount)) {
+      result = saveCheckpoint();
     }
   }
+
+  for (unsigned int i = 0; i < verifierCount; i++) {
+    UDS_FREE(verifiers[i].buffer);
+    UDS_FREE(verifiers[i].observed);
+  }
+
+  uds_destroy_mutex(&slabLock);
+  UDS_FREE(verifiers);
+  return result;
+}
+
+/**
+ * Report a problem found in a journal block, if line items are wanted.
+ *
+ * Implements JournalProblemReporter.
+ **/
+static void reportJournalProblem(physical_block_number_t  pbn,
+                                 const char              *problem)
+{
+  if (verbose) {
+    warnx("Journal block at PBN %llu: %s", (unsigned long long) pbn, problem);
+  }
+}
+
+/**
+ * Note the start of a timed phase of the audit.
+ *
+ * @param phase  The phase which is starting
+ **/
+static void startPhaseTiming(TimedPhase phase)
+{
+  PhaseTiming *timing = &phaseTimings[phase];
+  timing->ran       = true;
+  timing->wallStart = current_time_ns(CLOCK_MONOTONIC);
+  timing->cpuStart  = current_time_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/**
+ * Note the end of a timed phase of the audit.
+ *
+ * @param phase  The phase which has finished
+ **/
+static void finishPhaseTiming(TimedPhase phase)
+{
+  PhaseTiming *timing = &phaseTimings[phase];
+  timing->wallTime = ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+                               timing->wallStart);
+  timing->cpuTime  = ktime_sub(current_time_ns(CLOCK_PROCESS_CPUTIME_ID),
+                               timing->cpuStart);
 }
 
 /**
- * Verify that the reference counts for a given slab are consistent with the
- * block map.
+ * Check the blocks the stored reference counts show allocated, found by
+ * --quick, against the logical blocks and block map pages the recovery
+ * journal says are in use. Every block map tree page is allocated, and
+ * every other allocated block is mapped by at least one logical block.
  *
- * @param slabNumber  The number of the slab to verify
- * @param buffer      A buffer to hold the reference counts for the slab
+ * @return <code>true</code> if the counts are consistent
  **/
-static int verifySlab(slab_count_t slabNumber, char *buffer)
+static bool checkAllocatedBlocks(void)
 {
-  SlabAudit *audit = &slabs[slabNumber];
-
-  if (!slabSummaryEntries[slabNumber].load_ref_counts) {
-    // Confirm that all reference counts for this pristine slab are 0.
-    for (slab_block_number sbn = 0; sbn < slabDataBlocks; sbn++) {
-      if (audit->refCounts[sbn] != 0) {
-        reportRefCount(audit, sbn, false, true, audit->refCounts[sbn], 0);
-      }
-    }
-
-    // Verify that the slab summary contains the expected free block count.
-    verifySummaryHint(slabNumber, slabDataBlocks);
-    return VDO_SUCCESS;
-  }
-
-  // Get the refCounts stored on this used slab.
-  struct slab_depot_state_2_0 depot = vdo->states.slab_depot;
-  int result = readFromLayer(audit->slabOrigin + slabDataBlocks,
-                             depot.slab_config.reference_count_blocks,
-                             buffer);
-  if (result != VDO_SUCCESS) {
-    warnx("Could not read reference count buffer for slab number %u\n",
-          slabNumber);
-    return result;
+  block_count_t logicalBlocks
+    = vdo->states.recovery_journal.logical_blocks_used;
+  block_count_t treePages
+    = vdo->states.recovery_journal.block_map_data_blocks;
+  if (allocatedBlocks < treePages) {
+    warnx("Allocated block count mismatch! %llu blocks are allocated,"
+          " fewer than the %llu block map pages",
+          (unsigned long long) allocatedBlocks,
+          (unsigned long long) treePages);
+    return false;
   }
 
-  char              *currentBlockStart = buffer;
-  block_count_t      freeBlocks        = 0;
-  slab_block_number  currentOffset     = 0;
-  block_count_t      remainingEntries  = slabDataBlocks;
-  while (remainingEntries > 0) {
-    struct packed_reference_block *block
-      = (struct packed_reference_block *) currentBlockStart;
-    block_count_t blockEntries
-      = min((block_count_t) COUNTS_PER_BLOCK, remainingEntries);
-    block_count_t allocatedCount
-      = verifyRefCountBlock(audit, block, blockEntries, currentOffset);
-    freeBlocks        += (blockEntries - allocatedCount);
-    remainingEntries  -= blockEntries;
-    currentBlockStart += VDO_BLOCK_SIZE;
-    currentOffset     += blockEntries;
+  if ((allocatedBlocks - treePages) > logicalBlocks) {
+    warnx("Allocated block count mismatch! %llu data blocks are allocated,"
+          " more than the %llu logical blocks in use",
+          (unsigned long long) (allocatedBlocks - treePages),
+          (unsigned long long) logicalBlocks);
+    return false;
   }
 
-  // Verify that the slab summary contains the expected free block count.
-  verifySummaryHint(slabNumber, freeBlocks);
-  return VDO_SUCCESS;
+  warnx("Allocated block count %llu is consistent with %llu logical blocks"
+        " and %llu block map pages",
+        (unsigned long long) allocatedBlocks,
+        (unsigned long long) logicalBlocks, (unsigned long long) treePages);
+  return true;
 }
 
 /**
- * Check that the reference counts are consistent with the block map. Warn for
- * any physical block whose reference counts are inconsistent.
+ * Walk the block map to count the logical blocks and the references to each
+ * physical block, while the stored reference counts are read in the
+ * background, then check the counts against the stored ones.
  *
- * @return VDO_SUCCESS or some error.
+ * @return VDO_SUCCESS or an error
  **/
-static int verifyPBNRefCounts(void)
+static int auditBlockMap(void)
 {
-  struct slab_config slabConfig = vdo->states.slab_depot.slab_config;
-  size_t refCountBytes = (slabConfig.reference_count_blocks * VDO_BLOCK_SIZE);
-
-  char *buffer;
-  int result = vdo->layer->allocateIOBuffer(vdo->layer, refCountBytes,
-                                            "slab reference counts", &buffer);
-  if (result != VDO_SUCCESS) {
-    warnx("Could not allocate %zu bytes for slab reference counts",
-          refCountBytes);
-    return result;
-  }
+  if (auditPhase == AUDIT_PHASE_WALK) {
+    bool loading = startStoredCountLoader();
+    startPhaseTiming(TIMED_PHASE_WALK);
+    int result = walkBlockMap();
+    finishPhaseTiming(TIMED_PHASE_WALK);
+    if (loading) {
+      stopStoredCountLoader();
+    }
 
-  hintShift = get_vdo_slab_summary_hint_shift(vdo->slabSizeShift);
-  for (slab_count_t slabNumber = 0; slabNumber < vdo->slabCount;
-       slabNumber++) {
-    result = verifySlab(slabNumber, buffer);
     if (result != VDO_SUCCESS) {
-      break;
+      return result;
     }
   }
 
-  UDS_FREE(buffer);
+  // Audit stored versus counted mapped logical blocks.
+  block_count_t savedLBNCount
+    = vdo->states.recovery_journal.logical_blocks_used;
+  if (lbnCount == savedLBNCount) {
+    warnx("Logical block count matched at %llu",
+          (unsigned long long) savedLBNCount);
+  } else {
+    warnx("Logical block count mismatch! Expected %llu, got %llu",
+          (unsigned long long) savedLBNCount,
+          (unsigned long long) lbnCount);
+  }
+
+  // Now confirm the stored references of all physical blocks.
+  startPhaseTiming(TIMED_PHASE_VERIFY);
+  int result = verifyPBNRefCounts();
+  finishPhaseTiming(TIMED_PHASE_VERIFY);
   return result;
 }
 
@@ -676,58 +3127,73 @@ static bool auditVDO(void)
           get_vdo_state_name(vdo->states.vdo.state));
   }
 
-  // Get logical block count and populate observed slab reference counts.
-  int result = examineBlockMapEntries(vdo, examineBlockMapEntry);
+  // Load the slab summary data, which says which slabs have stored
+  // reference counts to read.
+  startPhaseTiming(TIMED_PHASE_SUMMARY);
+  int result = readSlabSummary(vdo, &slabSummaryEntries);
+  finishPhaseTiming(TIMED_PHASE_SUMMARY);
   if (result != VDO_SUCCESS) {
     return false;
   }
 
-  // Load the slab summary data.
-  result = readSlabSummary(vdo, &slabSummaryEntries);
-  if (result != VDO_SUCCESS) {
-    return false;
-  }
+  bool countsMatched;
+  lastCheckpoint = current_time_ns(CLOCK_MONOTONIC);
+  if (quick) {
+    // Without the block map walk, the stored reference counts can only be
+    // checked against the slab summary and the volume's own totals.
+    startPhaseTiming(TIMED_PHASE_VERIFY);
+    result = verifyPBNRefCounts();
+    finishPhaseTiming(TIMED_PHASE_VERIFY);
+    if (result != VDO_SUCCESS) {
+      return false;
+    }
 
-  // Audit stored versus counted mapped logical blocks.
-  block_count_t savedLBNCount
-    = vdo->states.recovery_journal.logical_blocks_used;
-  if (lbnCount == savedLBNCount) {
-    warnx("Logical block count matched at %llu",
-          (unsigned long long) savedLBNCount);
+    allocationMismatch = !checkAllocatedBlocks();
+    countsMatched      = !allocationMismatch;
   } else {
-    warnx("Logical block count mismatch! Expected %llu, got %llu",
-          (unsigned long long) savedLBNCount,
-          (unsigned long long) lbnCount);
+    result = auditBlockMap();
+    if (result != VDO_SUCCESS) {
+      return false;
+    }
+
+    countsMatched
+      = (lbnCount == vdo->states.recovery_journal.logical_blocks_used);
   }
 
-  // Now confirm the stored references of all physical blocks.
-  result = verifyPBNRefCounts();
-  if (result != VDO_SUCCESS) {
-    return false;
+  if (journals) {
+    startPhaseTiming(TIMED_PHASE_JOURNALS);
+    result = checkJournals(vdo, threadCount, firstRangeSlab, lastRangeSlab,
+                           reportJournalProblem, &journalCounts);
+    finishPhaseTiming(TIMED_PHASE_JOURNALS);
+    if (result != VDO_SUCCESS) {
+      warnx("Could not check the journals");
+      return false;
+    }
+  }
+
+  if (checkpointPath != NULL) {
+    remove_file(checkpointPath);
   }
 
-  return ((lbnCount == savedLBNCount)
+  return (countsMatched
+          && (badTreePages == 0)
           && (badRefCounts == 0)
-          && (badSummaryHints == 0));
+          && (badSummaryHints == 0)
+          && (journalCounts.badRecoveryBlocks == 0)
+          && (journalCounts.badSlabJournalBlocks == 0));
 }
 
-/**********************************************************************/
-int main(int argc, char *argv[])
+/**
+ * Audit the volume named by filename and report the results.
+ *
+ * @return The exit status: 0 if the volume passed, 1 if not
+ **/
+static int auditVolume(void)
 {
   static char errBuf[ERRBUF_SIZE];
 
-  int result = register_vdo_status_codes();
-  if (result != VDO_SUCCESS) {
-    errx(1, "Could not register status codes: %s",
-         uds_string_error(result, errBuf, ERRBUF_SIZE));
-  }
-
-  result = processAuditArgs(argc, argv);
-  if (result != VDO_SUCCESS) {
-    exit(1);
-  }
-
-  result = makeVDOFromFile(filename, true, &vdo);
+  setVDOIOLimits(maxIOPS, maxBandwidth);
+  int result = loadVDOWithSnapshot(filename, true, cachePath, !quick, &vdo);
   if (result != VDO_SUCCESS) {
     errx(1, "Could not load VDO from '%s': %s",
          filename, uds_string_error(result, errBuf, ERRBUF_SIZE));
@@ -739,6 +3205,22 @@ int main(int argc, char *argv[])
   slab_count_t slabCount = compute_vdo_slab_count(depot.first_block,
                                                   depot.last_block,
                                                   vdo->slabSizeShift);
+  size_t budget = ((memoryLimit == 0) ? SIZE_MAX
+                   : (size_t) min(memoryLimit, (uint64_t) SIZE_MAX));
+  result = makeSpillAllocator(budget, NULL, &allocator);
+  if (result != VDO_SUCCESS) {
+    freeAuditAllocations();
+    errx(1, "Could not make the reference count allocator: %s",
+         uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+
+  result = UDS_ALLOCATE(slabCount, SlabAudit, __func__, &slabs);
+  if (result != VDO_SUCCESS) {
+    freeAuditAllocations();
+    errx(1, "Could not allocate %u slab audit records: %s",
+         slabCount, uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+
   for (slab_count_t i = 0; i < slabCount; i++) {
     SlabAudit *audit = &slabs[i];
     audit->slabNumber = i;
@@ -747,23 +3229,374 @@ int main(int argc, char *argv[])
     // So firstError = min(firstError, x) will always do the right thing.
     audit->firstError = (slab_block_number) -1;
 
-    result
-      = UDS_ALLOCATE(slabDataBlocks, uint8_t, __func__, &audit->refCounts);
+    result = uds_init_mutex(&audit->lock);
+    if (result != VDO_SUCCESS) {
+      freeAuditAllocations();
+      errx(1, "Could not initialize slab lock: %s",
+           uds_string_error(result, errBuf, ERRBUF_SIZE));
+    }
+
+    preparedSlabs++;
+  }
+
+  if (selectSlabRange() != VDO_SUCCESS) {
+    freeAuditAllocations();
+    exit(1);
+  }
+
+  result = sampleSlabs();
+  if (result != VDO_SUCCESS) {
+    freeAuditAllocations();
+    errx(1, "Could not choose the slabs to audit: %s",
+         uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+
+  if (resume) {
+    result = loadCheckpoint();
+    if (result != VDO_SUCCESS) {
+      freeAuditAllocations();
+      errx(1, "Could not resume from checkpoint '%s': %s", checkpointPath,
+           uds_string_error(result, errBuf, ERRBUF_SIZE));
+    }
+  }
+
+  if (progress) {
+    result = startProgressReports(vdo->layer);
     if (result != VDO_SUCCESS) {
       freeAuditAllocations();
-      errx(1, "Could not allocate %llu reference counts: %s",
-           (unsigned long long) slabDataBlocks,
+      errx(1, "Could not start progress reports: %s",
            uds_string_error(result, errBuf, ERRBUF_SIZE));
     }
   }
 
   bool passed = auditVDO();
-  if (passed) {
-    warnx("All pbn references matched.\n");
-  } else if (!verbose) {
-    printErrorSummary();
+  stopProgressReports();
+  if (jsonOutput) {
+    printJSONReport(passed);
+  } else {
+    if (passed) {
+      warnx("%s", (quick ? "Quick check found no inconsistencies.\n"
+                   : "All pbn references matched.\n"));
+    } else if (!verbose) {
+      printErrorSummary();
+    }
+
+    if (sampledSlabs < rangeSlabs) {
+      printSampleEstimate();
+    }
+  }
+
+  if (ioStats) {
+    printIOStatistics(stderr, vdo->layer);
   }
 
   freeAuditAllocations();
-  exit(passed ? 0 : 1);
+  return (passed ? 0 : 1);
+}
+
+/**
+ * Read the list of volumes to audit from the --batch file, one to a line,
+ * skipping blank lines and lines starting with '#'.
+ *
+ * @param [out] volumesPtr  A pointer to hold the volumes
+ * @param [out] countPtr    A pointer to hold the number of volumes
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int readBatchFile(BatchVolume **volumesPtr, size_t *countPtr)
+{
+  FILE *file = fopen(batchPath, "r");
+  if (file == NULL) {
+    return errno;
+  }
+
+  BatchVolume *volumes  = NULL;
+  size_t       count    = 0;
+  size_t       capacity = 0;
+  char        *line     = NULL;
+  size_t       lineSize = 0;
+  int          result   = VDO_SUCCESS;
+  ssize_t      length;
+  while ((length = getline(&line, &lineSize, file)) != -1) {
+    while ((length > 0) && ((line[length - 1] == '\n')
+                            || (line[length - 1] == ' '))) {
+      line[--length] = '\0';
+    }
+
+    if ((length == 0) || (line[0] == '#')) {
+      continue;
+    }
+
+    if (count == capacity) {
+      size_t newCapacity = max(capacity * 2, (size_t) 16);
+      result = uds_reallocate_memory(volumes, capacity * sizeof(BatchVolume),
+                                     newCapacity * sizeof(BatchVolume),
+                                     "batch volumes", &volumes);
+      if (result != UDS_SUCCESS) {
+        break;
+      }
+
+      capacity = newCapacity;
+    }
+
+    result = uds_duplicate_string(line, "volume path", &volumes[count].path);
+    if (result != UDS_SUCCESS) {
+      break;
+    }
+
+    count++;
+  }
+
+  free(line);
+  fclose(file);
+  if ((result == VDO_SUCCESS) && (count == 0)) {
+    result = VDO_OUT_OF_RANGE;
+  }
+
+  if (result != VDO_SUCCESS) {
+    for (size_t i = 0; i < count; i++) {
+      UDS_FREE(volumes[i].path);
+    }
+    UDS_FREE(volumes);
+    return result;
+  }
+
+  *volumesPtr = volumes;
+  *countPtr   = count;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Start auditing a volume in a child process, whose JSON report goes to a
+ * temporary file. The child inherits the parsed options, with the limits
+ * already divided among the jobs.
+ *
+ * @param volume  The volume to audit
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int startBatchAudit(BatchVolume *volume)
+{
+  volume->report = tmpfile();
+  if (volume->report == NULL) {
+    return errno;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  volume->pid = fork();
+  if (volume->pid < 0) {
+    return errno;
+  }
+
+  if (volume->pid > 0) {
+    return VDO_SUCCESS;
+  }
+
+  if (dup2(fileno(volume->report), STDOUT_FILENO) < 0) {
+    _exit(2);
+  }
+
+  filename   = volume->path;
+  jsonOutput = true;
+  setProgressLabel(volume->path);
+  exit(auditVolume());
+}
+
+/**
+ * Collect the report of a volume whose audit has finished.
+ *
+ * @param volume  The volume
+ * @param status  The status of the child process, from wait()
+ **/
+static void finishBatchAudit(BatchVolume *volume, int status)
+{
+  volume->status = (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+  long size = ftell(volume->report);
+  if ((size > 0)
+      && (UDS_ALLOCATE(size + 1, char, "volume report",
+                       &volume->json) == VDO_SUCCESS)) {
+    rewind(volume->report);
+    if (fread(volume->json, 1, size, volume->report) != (size_t) size) {
+      UDS_FREE(volume->json);
+      volume->json = NULL;
+    }
+  }
+
+  fclose(volume->report);
+  volume->report = NULL;
+  if (volume->json == NULL) {
+    // An audit which could not be run or crashed says so on stderr.
+    volume->status = -1;
+  }
+}
+
+/**
+ * Find a count in the JSON report of a volume.
+ *
+ * @param json  The report
+ * @param key   The name of the count
+ *
+ * @return The count, or 0 if it is not in the report
+ **/
+static unsigned long long getReportCount(const char *json, const char *key)
+{
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  const char *found = strstr(json, pattern);
+  return ((found == NULL) ? 0 : strtoull(found + strlen(pattern), NULL, 10));
+}
+
+/**
+ * Write the report covering every volume of a batch, as one JSON object if
+ * --json was given and as a line for each volume otherwise.
+ *
+ * @param volumes  The volumes
+ * @param count    The number of volumes
+ **/
+static void printBatchReport(const BatchVolume *volumes, size_t count)
+{
+  size_t passed = 0;
+  size_t failed = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (volumes[i].status == 0) {
+      passed++;
+    } else if (volumes[i].status > 0) {
+      failed++;
+    }
+  }
+
+  if (!jsonOutput) {
+    for (size_t i = 0; i < count; i++) {
+      const BatchVolume *volume = &volumes[i];
+      if (volume->status < 0) {
+        printf("%s: could not be audited\n", volume->path);
+      } else if (volume->status == 0) {
+        printf("%s: passed\n", volume->path);
+      } else {
+        printf("%s: FAILED, %llu reference count errors, %llu block"
+               " mapping errors, %llu free space hint errors\n",
+               volume->path,
+               getReportCount(volume->json, "referenceCountErrors"),
+               getReportCount(volume->json, "blockMappingErrors"),
+               getReportCount(volume->json, "freeSpaceHintErrors"));
+      }
+    }
+
+    printf("%zu volumes: %zu passed, %zu failed, %zu not audited\n", count,
+           passed, failed, count - passed - failed);
+    return;
+  }
+
+  printf("{\n  \"passed\": %zu,\n  \"failed\": %zu,\n"
+         "  \"notAudited\": %zu,\n  \"volumes\": [\n",
+         passed, failed, count - passed - failed);
+  for (size_t i = 0; i < count; i++) {
+    const BatchVolume *volume = &volumes[i];
+    if (volume->status < 0) {
+      printf("{ \"volume\": ");
+      printJSONString(volume->path);
+      printf(", \"audited\": false }");
+    } else {
+      // Each report is a complete object ending in a newline.
+      printf("%.*s", (int) (strlen(volume->json) - 1), volume->json);
+    }
+    printf("%s\n", ((i + 1 < count) ? "," : ""));
+  }
+  printf("  ]\n}\n");
+}
+
+/**
+ * Audit every volume in the --batch file, several at once, each in its own
+ * process so that the audits share nothing but the limits divided among
+ * them, and write one report covering them all.
+ *
+ * @return The exit status: 0 if every volume passed, 1 if not
+ **/
+static int auditBatch(void)
+{
+  static char errBuf[ERRBUF_SIZE];
+
+  BatchVolume *volumes = NULL;
+  size_t       count   = 0;
+  int result = readBatchFile(&volumes, &count);
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not read any volumes from '%s': %s", batchPath,
+         uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+
+  unsigned int jobs = ((jobCount == 0) ? DEFAULT_BATCH_JOBS : jobCount);
+  jobs = min(jobs, (unsigned int) count);
+
+  // Share out the limits, which the children inherit.
+  unsigned int totalThreads
+    = ((threadCount == 0) ? uds_get_num_cores() : threadCount);
+  threadCount  = max(totalThreads / jobs, 1U);
+  maxIOPS      = ((maxIOPS == 0) ? 0 : max(maxIOPS / jobs, 1U));
+  maxBandwidth = ((maxBandwidth == 0) ? 0
+                  : max(maxBandwidth / jobs, (uint64_t) VDO_BLOCK_SIZE));
+  memoryLimit  = ((memoryLimit == 0) ? 0
+                  : max(memoryLimit / jobs, (uint64_t) VDO_BLOCK_SIZE));
+
+  size_t       next    = 0;
+  unsigned int running = 0;
+  while ((next < count) || (running > 0)) {
+    while ((next < count) && (running < jobs)) {
+      result = startBatchAudit(&volumes[next]);
+      if (result != VDO_SUCCESS) {
+        errx(1, "Could not start the audit of '%s': %s", volumes[next].path,
+             uds_string_error(result, errBuf, ERRBUF_SIZE));
+      }
+
+      next++;
+      running++;
+    }
+
+    int   status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      err(1, "Could not wait for the audits");
+    }
+
+    for (size_t i = 0; i < next; i++) {
+      if (volumes[i].pid == pid) {
+        finishBatchAudit(&volumes[i], status);
+        running--;
+        break;
+      }
+    }
+  }
+
+  printBatchReport(volumes, count);
+  bool passed = true;
+  for (size_t i = 0; i < count; i++) {
+    passed = passed && (volumes[i].status == 0);
+    UDS_FREE(volumes[i].json);
+    UDS_FREE(volumes[i].path);
+  }
+  UDS_FREE(volumes);
+  return (passed ? 0 : 1);
+}
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+  static char errBuf[ERRBUF_SIZE];
+
+  int result = register_vdo_status_codes();
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not register status codes: %s",
+         uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+
+  result = processAuditArgs(argc, argv);
+  if (result != VDO_SUCCESS) {
+    exit(1);
+  }
+
+  exit((batchPath == NULL) ? auditVolume() : auditBatch());
 }
@@ -25,10 +25,12 @@
 #include <stdlib.h>
 
 #include "errors.h"
+#include "fileUtils.h"
 #include "logger.h"
 #include "memoryAlloc.h"
 #include "stringUtils.h"
 #include "syscalls.h"
+#include "util/radixSort.h"
 
 #include "blockMapFormat.h"
 #include "numUtils.h"
@@ -42,18 +44,25 @@
 #include "types.h"
 #include "volumeGeometry.h"
 
+#include "dumpLayer.h"
+#include "dumpTOC.h"
 #include "fileLayer.h"
+#include "ioStatistics.h"
+#include "journalDecoder.h"
+#include "slabJournalIndex.h"
 #include "userVDO.h"
 #include "vdoVolumeUtils.h"
 
 static const char usageString[]
-  = "[--help] [--pbn=<pbn>] [--searchLBN=<lbn>] [--version] filename";
+  = "[--help] [--pbn=<pbn>] [--searchLBN=<lbn>] [--journal-index=<file>]"
+    " [--io-stats] [--version] filename";
 
 static const char helpString[] =
   "vdoDebugMetadata - load a metadata dump of a VDO device\n"
   "\n"
   "SYNOPSIS\n"
-  "  vdoDebugMetadata [--pbn=<pbn>] [--searchLBN=<lbn>] <filename>\n"
+  "  vdoDebugMetadata [--pbn=<pbn>] [--searchLBN=<lbn>]\n"
+  "    [--journal-index=<file>] [--io-stats] <filename>\n"
   "\n"
   "DESCRIPTION\n"
   "  vdoDebugMetadata loads the metadata regions dumped by vdoDumpMetadata.\n"
@@ -70,23 +79,40 @@ static const char helpString[] =
   "  Any --pbn argument(s) will print the slab journal entries for the\n"
   "  given PBN(s).\n"
   "\n"
+  "  If --journal-index is specified, the slab journal entries of every\n"
+  "  slab are indexed and the index saved in the given file, or loaded\n"
+  "  from it if it was saved for this dump, so that later sessions can\n"
+  "  look up PBNs without decoding the slab journals again.\n"
+  "\n"
   "  Any --searchLBN argument(s) will print the recovery journal entries\n"
   "  for the given LBN(s). This includes PBN, increment/decrement, mapping\n"
   "  state, recovery journal position information, and whether the \n"
   "  recovery journal block is valid.\n"
+  "\n"
+  "  If --io-stats is specified, the number of reads done and their\n"
+  "  latencies will be displayed on exit.\n"
   "\n";
 
 static struct option options[] = {
-  { "help",      no_argument,       NULL, 'h' },
-  { "pbn",       required_argument, NULL, 'p' },
-  { "searchLBN", required_argument, NULL, 's' },
-  { "version",   no_argument,       NULL, 'V' },
-  { NULL,        0,                 NULL,  0  },
+  { "help",          no_argument,       NULL, 'h' },
+  { "io-stats",      no_argument,       NULL, 'i' },
+  { "journal-index", required_argument, NULL, 'j' },
+  { "pbn",           required_argument, NULL, 'p' },
+  { "searchLBN",     required_argument, NULL, 's' },
+  { "version",       no_argument,       NULL, 'V' },
+  { NULL,            0,                 NULL,  0  },
 };
 
 typedef struct {
+  /** Whether the slab's metadata has been read from the dump */
+  bool                               loaded;
+  /** The slab's metadata, unless it points into a mapping of the dump */
+  char                              *buffer;
   struct packed_slab_journal_block **slabJournalBlocks;
   struct packed_reference_block    **referenceBlocks;
+  /** Whether the slab's journal entries have been indexed */
+  bool                               indexed;
+  SlabJournalIndex                   journalIndex;
 } SlabState;
 
 typedef struct {
@@ -100,8 +126,19 @@ static slab_count_t                slabCount       = 0;
 static SlabState                  *slabs           = NULL;
 static UnpackedJournalBlock       *recoveryJournal = NULL;
 static char                       *rawJournalBytes = NULL;
+/** The keys of every recovery journal entry, sorted by slot */
+static const byte                **journalKeys     = NULL;
+static byte                       *journalKeyBytes = NULL;
+static unsigned int                journalKeyCount = 0;
 
 static physical_block_number_t     nextBlock;
+/** The position in the dump of the first slab's metadata */
+static physical_block_number_t     slabMetadataStart;
+// The table of contents of the dump, if it has one
+static DumpTOC                     toc;
+static bool                        haveTOC         = false;
+/** Whether metadata blocks point into a mapping of the dump */
+static bool                        mapped          = false;
 static const struct slab_config   *slabConfig      = NULL;
 
 static physical_block_number_t    *pbns            = NULL;
@@ -110,9 +147,17 @@ static uint8_t                     pbnCount        = 0;
 static logical_block_number_t     *searchLBNs      = NULL;
 static uint8_t                     searchLBNCount  = 0;
 
+static bool                        ioStats         = false;
+static const char                 *indexFilename   = NULL;
+
 enum {
   MAX_PBNS        = 255,
   MAX_SEARCH_LBNS = 255,
+  // A journal entry key is the big-endian block map slot the entry is for,
+  // followed by the entry's position, so that sorting the keys sorts the
+  // entries by slot and, for each slot, by position.
+  SLOT_KEY_BYTES  = sizeof(uint64_t) + sizeof(uint16_t),
+  KEY_BYTES       = SLOT_KEY_BYTES + sizeof(uint32_t) + 2,
 };
 
 /**
@@ -140,7 +185,7 @@ static void usage(const char *progname, const char *usageOptionsString)
 static int processArgs(int argc, char *argv[], char **filename)
 {
   int      c;
-  char    *optionString = "hp:s:V";
+  char    *optionString = "hij:p:s:V";
   while ((c = getopt_long(argc, argv, optionString, options, NULL)) != -1) {
     if (c == (int) 'h') {
       printf("%s", helpString);
@@ -152,6 +197,14 @@ static int processArgs(int argc, char *argv[], char **filename)
       exit(0);
     }
 
+    if (c == (int) 'i') {
+      ioStats = true;
+    }
+
+    if (c == (int) 'j') {
+      indexFilename = optarg;
+    }
+
     if (c == (int) 'p') {
       // Limit to 255 PBNs for now.
       if (pbnCount == MAX_PBNS) {
@@ -198,16 +251,20 @@ __attribute__((__noinline__)) static void doNothing(void)
 }
 
 /**
- * Read blocks from the current position.
+ * Read blocks from the current position. If the dump is mapped, the blocks
+ * are not copied; the buffer pointer is pointed at the mapping instead.
  *
- * @param [in]  count   How many blocks to read
- * @param [out] buffer  The buffer to read into
+ * @param [in]     count      How many blocks to read
+ * @param [in/out] bufferPtr  A pointer to the buffer to read into
  *
  * @return VDO_SUCCESS or an error
  **/
-static int readBlocks(block_count_t count, char *buffer)
+static int readBlocks(block_count_t count, char **bufferPtr)
 {
-  int result = vdo->layer->reader(vdo->layer, nextBlock, count, buffer);
+  PhysicalLayer *layer = vdo->layer;
+  int result = (mapped
+                ? layer->mapExtent(layer, nextBlock, count, bufferPtr)
+                : layer->reader(layer, nextBlock, count, *bufferPtr));
   if (result != VDO_SUCCESS) {
     return result;
   }
@@ -226,31 +283,30 @@ static void freeState(SlabState *state)
     return;
   }
 
-  if (state->slabJournalBlocks != NULL) {
-    for (block_count_t i = 0; i < slabConfig->slab_journal_blocks; i++) {
-      UDS_FREE(state->slabJournalBlocks[i]);
-      state->slabJournalBlocks[i] = NULL;
-    }
-  }
-
-  if (state->referenceBlocks != NULL) {
-    for (block_count_t i = 0; i < slabConfig->reference_count_blocks; i++) {
-      UDS_FREE(state->referenceBlocks[i]);
-      state->referenceBlocks[i] = NULL;
-    }
-  }
-
+  // Mapped blocks belong to the mapping, so there is no buffer to free.
+  UDS_FREE(state->buffer);
   UDS_FREE(state->slabJournalBlocks);
   UDS_FREE(state->referenceBlocks);
+  freeSlabJournalIndex(&state->journalIndex);
+  *state = (SlabState) { .loaded = false };
 }
 
 /**
- * Allocate a single slab state.
+ * Read a slab's metadata from the dump, as a single extent, if it has not
+ * already been read. Slabs are only read when a query needs them, so that
+ * investigating a few PBNs does not mean reading every slab.
+ *
+ * @param slabNumber  The slab to load
  *
- * @param [out] statePtr  Where to store the allocated state.
+ * @return VDO_SUCCESS or an error
  **/
-static int allocateState(SlabState *state)
+static int loadSlab(slab_count_t slabNumber)
 {
+  SlabState *state = &slabs[slabNumber];
+  if (state->loaded) {
+    return VDO_SUCCESS;
+  }
+
   int result = UDS_ALLOCATE(slabConfig->slab_journal_blocks,
                             struct packed_slab_journal_block *, __func__,
                             &state->slabJournalBlocks);
@@ -268,28 +324,152 @@ static int allocateState(SlabState *state)
   }
 
   PhysicalLayer *layer = vdo->layer;
-  for (block_count_t i = 0; i < slabConfig->reference_count_blocks; i++) {
-    char *buffer;
-    result = layer->allocateIOBuffer(layer, VDO_BLOCK_SIZE,
-                                     "reference count block", &buffer);
+  block_count_t slabBlocks
+    = (slabConfig->reference_count_blocks + slabConfig->slab_journal_blocks);
+  char *data = NULL;
+  if (!mapped) {
+    result = layer->allocateIOBuffer(layer, slabBlocks * VDO_BLOCK_SIZE,
+                                     "slab metadata", &state->buffer);
     if (result != VDO_SUCCESS) {
       freeState(state);
       return result;
     }
-    state->referenceBlocks[i] = (struct packed_reference_block *) buffer;
+    data = state->buffer;
   }
 
-  for (block_count_t i = 0; i < slabConfig->slab_journal_blocks; i++) {
-    char *buffer;
-    result = layer->allocateIOBuffer(layer, VDO_BLOCK_SIZE,
-                                     "slab journal block", &buffer);
-    if (result != VDO_SUCCESS) {
+  nextBlock = slabMetadataStart + (slabNumber * slabBlocks);
+  if (haveTOC) {
+    const DumpRegion *region = findDumpRegion(&toc, DUMP_REGION_SLAB,
+                                              slabNumber);
+    if ((region == NULL) || (region->blockCount != slabBlocks)) {
       freeState(state);
-      return result;
+      return VDO_INVALID_FRAGMENT;
+    }
+    nextBlock = region->dumpBlock;
+  }
+
+  result = readBlocks(slabBlocks, &data);
+  if (result != VDO_SUCCESS) {
+    freeState(state);
+    return result;
+  }
+
+  for (block_count_t i = 0; i < slabConfig->reference_count_blocks; i++) {
+    state->referenceBlocks[i] = (struct packed_reference_block *) data;
+    data += VDO_BLOCK_SIZE;
+  }
+
+  for (block_count_t i = 0; i < slabConfig->slab_journal_blocks; i++) {
+    state->slabJournalBlocks[i] = (struct packed_slab_journal_block *) data;
+    data += VDO_BLOCK_SIZE;
+  }
+
+  state->loaded = true;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Load every slab, for a session in a debugger.
+ **/
+static void loadAllSlabs(void)
+{
+  if (vdo->layer->advise != NULL) {
+    vdo->layer->advise(vdo->layer, slabMetadataStart,
+                       ((slabConfig->reference_count_blocks
+                         + slabConfig->slab_journal_blocks) * slabCount),
+                       ACCESS_SEQUENTIAL);
+  }
+
+  for (slab_count_t i = 0; i < slabCount; i++) {
+    if (loadSlab(i) != VDO_SUCCESS) {
+      errx(1, "Could not read metadata for slab %u", i);
     }
-    state->slabJournalBlocks[i] = (struct packed_slab_journal_block *) buffer;
   }
-  return result;
+}
+
+/**
+ * Index a slab's journal entries, if they have not already been indexed, so
+ * that every PBN in the slab can be looked up without decoding the journal
+ * again.
+ *
+ * @param slabNumber  The slab to index
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int indexSlab(slab_count_t slabNumber)
+{
+  SlabState *state = &slabs[slabNumber];
+  if (state->indexed) {
+    return VDO_SUCCESS;
+  }
+
+  int result = loadSlab(slabNumber);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  result = buildSlabJournalIndex(state->slabJournalBlocks,
+                                 slabConfig->slab_journal_blocks,
+                                 &state->journalIndex);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  state->indexed = true;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Load the journal indexes of every slab from the index file if it was
+ * saved for this dump, or else build them and save them in it.
+ **/
+static void prepareJournalIndexes(void)
+{
+  SlabJournalIndex *indexes;
+  int result = UDS_ALLOCATE(slabCount, SlabJournalIndex, __func__, &indexes);
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not allocate slab journal indexes");
+  }
+
+  nonce_t nonce = vdo->states.vdo.nonce;
+  block_count_t dumpBlocks = vdo->layer->getBlockCount(vdo->layer);
+  bool exists;
+  if ((file_exists(indexFilename, &exists) == UDS_SUCCESS) && exists) {
+    result = loadSlabJournalIndexes(indexFilename, nonce, dumpBlocks,
+                                    indexes, slabCount);
+    if (result == VDO_SUCCESS) {
+      for (slab_count_t i = 0; i < slabCount; i++) {
+        slabs[i].journalIndex = indexes[i];
+        slabs[i].indexed      = true;
+      }
+
+      UDS_FREE(indexes);
+      return;
+    }
+
+    char errBuf[ERRBUF_SIZE];
+    warnx("Rebuilding slab journal index '%s', which could not be used: %s",
+          indexFilename, uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+
+  for (slab_count_t i = 0; i < slabCount; i++) {
+    if (indexSlab(i) != VDO_SUCCESS) {
+      errx(1, "Could not index the journal of slab %u", i);
+    }
+
+    indexes[i] = slabs[i].journalIndex;
+  }
+
+  result = saveSlabJournalIndexes(indexFilename, nonce, dumpBlocks, indexes,
+                                  slabCount);
+  if (result != VDO_SUCCESS) {
+    char errBuf[ERRBUF_SIZE];
+    warnx("Could not save slab journal index '%s': %s",
+          indexFilename, uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+
+  // The slabs still own the indexes.
+  UDS_FREE(indexes);
 }
 
 /**
@@ -298,28 +478,25 @@ static int allocateState(SlabState *state)
 static int allocateMetadataSpace(void)
 {
   slabConfig = &vdo->states.slab_depot.slab_config;
+  mapped     = (vdo->layer->mapExtent != NULL);
   int result = UDS_ALLOCATE(vdo->slabCount, SlabState, __func__, &slabs);
   if (result != VDO_SUCCESS) {
-    errx(1, "Could not allocate %u slab state pointers", slabCount);
+    errx(1, "Could not allocate %u slab state pointers", vdo->slabCount);
   }
 
-  while (slabCount < vdo->slabCount) {
-    result = allocateState(&slabs[slabCount]);
-    if (result != VDO_SUCCESS) {
-      errx(1, "Could not allocate slab state for slab %u", slabCount);
-    }
-
-    slabCount++;
-  }
+  // Each slab's metadata is read when it is first needed.
+  slabCount = vdo->slabCount;
 
   PhysicalLayer *layer = vdo->layer;
   struct vdo_config *config = &vdo->states.vdo.config;
   size_t journalBytes = config->recovery_journal_size * VDO_BLOCK_SIZE;
-  result = layer->allocateIOBuffer(layer, journalBytes,
-                                   "recovery journal", &rawJournalBytes);
-  if (result != VDO_SUCCESS) {
-    errx(1, "Could not allocate %llu bytes for the journal",
-         (unsigned long long) journalBytes);
+  if (!mapped) {
+    result = layer->allocateIOBuffer(layer, journalBytes,
+                                     "recovery journal", &rawJournalBytes);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not allocate %llu bytes for the journal",
+           (unsigned long long) journalBytes);
+    }
   }
 
   result = UDS_ALLOCATE(config->recovery_journal_size, UnpackedJournalBlock,
@@ -337,7 +514,8 @@ static int allocateMetadataSpace(void)
          (unsigned long long) get_vdo_slab_summary_size(VDO_BLOCK_SIZE));
   }
 
-  for (block_count_t i = 0; i < get_vdo_slab_summary_size(VDO_BLOCK_SIZE);
+  for (block_count_t i = 0;
+       !mapped && (i < get_vdo_slab_summary_size(VDO_BLOCK_SIZE));
        i++) {
     char *buffer;
     result = layer->allocateIOBuffer(layer, VDO_BLOCK_SIZE,
@@ -365,13 +543,20 @@ static void freeMetadataSpace(void)
   UDS_FREE(slabs);
   slabs = NULL;
 
-  UDS_FREE(rawJournalBytes);
+  if (!mapped) {
+    UDS_FREE(rawJournalBytes);
+  }
   rawJournalBytes = NULL;
 
   UDS_FREE(recoveryJournal);
   recoveryJournal = NULL;
 
-  if (slabSummary != NULL) {
+  UDS_FREE(journalKeys);
+  journalKeys = NULL;
+  UDS_FREE(journalKeyBytes);
+  journalKeyBytes = NULL;
+
+  if (!mapped && (slabSummary != NULL)) {
     for (block_count_t i = 0; i < get_vdo_slab_summary_size(VDO_BLOCK_SIZE);
          i++) {
       UDS_FREE(slabSummary[i]);
@@ -381,6 +566,43 @@ static void freeMetadataSpace(void)
 
   UDS_FREE(slabSummary);
   slabSummary = NULL;
+
+  freeDumpTOC(&toc);
+  haveTOC = false;
+}
+
+/**
+ * Find the metadata in a dump from its table of contents, if it has one.
+ *
+ * @return true if the dump has a usable table of contents
+ **/
+static bool readTableOfContents(void)
+{
+  int result = readDumpTOC(vdo->layer, &toc);
+  if (result == VDO_NOT_IMPLEMENTED) {
+    return false;
+  }
+
+  if (result != VDO_SUCCESS) {
+    char errBuf[ERRBUF_SIZE];
+    errx(1, "Could not read the dump's table of contents: %s",
+         uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+
+  const DumpRegion *slab = findDumpRegion(&toc, DUMP_REGION_SLAB, 0);
+  const DumpRegion *journal
+    = findDumpRegion(&toc, DUMP_REGION_RECOVERY_JOURNAL, 0);
+  const DumpRegion *summary = findDumpRegion(&toc, DUMP_REGION_SLAB_SUMMARY, 0);
+  if ((slab == NULL) || (journal == NULL) || (summary == NULL)
+      || (findDumpRegion(&toc, DUMP_REGION_SLAB, slabCount - 1) == NULL)
+      || (journal->blockCount != vdo->states.vdo.config.recovery_journal_size)
+      || (summary->blockCount != get_vdo_slab_summary_size(VDO_BLOCK_SIZE))) {
+    errx(1, "The dump's table of contents does not match its super block");
+  }
+
+  slabMetadataStart = slab->dumpBlock;
+  haveTOC = true;
+  return true;
 }
 
 /**
@@ -388,13 +610,6 @@ static void freeMetadataSpace(void)
  **/
 static void readMetadata(void)
 {
-  /**
-   * The dump tool dumps the whole block map of whatever size, or some LBNs,
-   * or nothing, at the beginning of the dump. This tool doesn't currently know
-   * how to read the block map, so we figure out how many other metadata blocks
-   * there are, then skip back from the end of the file to the beginning of
-   * that metadata.
-   **/
   block_count_t metadataBlocksPerSlab
     = (slabConfig->reference_count_blocks + slabConfig->slab_journal_blocks);
   struct vdo_config *config = &vdo->states.vdo.config;
@@ -403,30 +618,30 @@ static void readMetadata(void)
        + config->recovery_journal_size
        + get_vdo_slab_summary_size(VDO_BLOCK_SIZE));
 
-  nextBlock
-    = (vdo->layer->getBlockCount(vdo->layer) - totalNonBlockMapMetadataBlocks);
-
-  for (slab_count_t i = 0; i < slabCount; i++) {
-    SlabState *slab = &slabs[i];
-    for (block_count_t j = 0; j < slabConfig->reference_count_blocks; j++) {
-      int result = readBlocks(1, (char *) slab->referenceBlocks[j]);
-      if (result != VDO_SUCCESS) {
-        errx(1, "Could not read reference block %llu for slab %u",
-	     (unsigned long long) j,
-             i);
-      }
-    }
+  if (readTableOfContents()) {
+    nextBlock
+      = findDumpRegion(&toc, DUMP_REGION_RECOVERY_JOURNAL, 0)->dumpBlock;
+  } else {
+    /**
+     * Dumps from before the table of contents have the whole block map of
+     * whatever size, or some LBNs, or nothing, at the beginning of the
+     * dump, so we figure out how many other metadata blocks there are, then
+     * skip back from the end of the file to the beginning of that metadata.
+     **/
+    slabMetadataStart = (vdo->layer->getBlockCount(vdo->layer)
+                         - totalNonBlockMapMetadataBlocks);
+    nextBlock = slabMetadataStart + (metadataBlocksPerSlab * slabCount);
+  }
 
-    for (block_count_t j = 0; j < slabConfig->slab_journal_blocks; j++) {
-      int result = readBlocks(1, (char *) slab->slabJournalBlocks[j]);
-      if (result != VDO_SUCCESS) {
-        errx(1, "Could not read slab journal block %llu for slab %u",
-             (unsigned long long) j, i);
-      }
-    }
+  if (vdo->layer->advise != NULL) {
+    // The rest of the dump is read in order, one block at a time.
+    vdo->layer->advise(vdo->layer, nextBlock,
+                       (totalNonBlockMapMetadataBlocks
+                        - (metadataBlocksPerSlab * slabCount)),
+                       ACCESS_SEQUENTIAL);
   }
 
-  int result = readBlocks(config->recovery_journal_size, rawJournalBytes);
+  int result = readBlocks(config->recovery_journal_size, &rawJournalBytes);
   if (result != VDO_SUCCESS) {
     errx(1, "Could not read recovery journal");
   }
@@ -442,9 +657,15 @@ static void readMetadata(void)
     }
   }
 
+  if (haveTOC) {
+    nextBlock = findDumpRegion(&toc, DUMP_REGION_SLAB_SUMMARY, 0)->dumpBlock;
+  }
+
   for (block_count_t i = 0; i < get_vdo_slab_summary_size(VDO_BLOCK_SIZE);
        i++) {
-    readBlocks(1, (char *) slabSummary[i]);
+    char *block = (char *) slabSummary[i];
+    readBlocks(1, &block);
+    slabSummary[i] = (struct slab_summary_entry *) block;
   }
 }
 
@@ -465,23 +686,20 @@ static void findSlabJournalEntries(physical_block_number_t pbn)
 
   printf("PBN %llu is offset %d in slab %d\n",
          (unsigned long long) pbn, slabOffset, slabNumber);
-  for (block_count_t i = 0; i < depot.slab_config.slab_journal_blocks; i++) {
-    struct packed_slab_journal_block *block
-      = slabs[slabNumber].slabJournalBlocks[i];
-    journal_entry_count_t entryCount
-      = __le16_to_cpu(block->header.entry_count);
-    for (journal_entry_count_t entryIndex = 0;
-         entryIndex < entryCount;
-         entryIndex++) {
-      struct slab_journal_entry entry
-        = decode_vdo_slab_journal_entry(block, entryIndex);
-      if (slabOffset == entry.sbn) {
-        printf("PBN %llu (%llu, %d) %s\n",
-               (unsigned long long) pbn,
-	       (unsigned long long) __le64_to_cpu(block->header.sequence_number),
-               entryIndex, get_vdo_journal_operation_name(entry.operation));
-      }
-    }
+  if (indexSlab(slabNumber) != VDO_SUCCESS) {
+    errx(1, "Could not index the journal of slab %u", slabNumber);
+  }
+
+  size_t count;
+  const SlabJournalIndexEntry *entries
+    = findSlabJournalIndexEntries(&slabs[slabNumber].journalIndex,
+                                  slabOffset, &count);
+  for (size_t i = 0; i < count; i++) {
+    printf("PBN %llu (%llu, %d) %s\n",
+           (unsigned long long) pbn,
+           (unsigned long long) entries[i].sequenceNumber,
+           entries[i].entry,
+           get_vdo_journal_operation_name(entries[i].operation));
   }
 }
 
@@ -525,6 +743,113 @@ isSequenceNumberPossibleForOffset(const struct recovery_block_header *header,
   return (expectedOffset == offset);
 }
 
+/**
+ * Encode the block map slot part of a journal entry key.
+ *
+ * @param slot  The slot
+ * @param key   The key to encode into
+ **/
+static void encodeSlotKey(struct block_map_slot slot, byte *key)
+{
+  for (int i = sizeof(uint64_t) - 1; i >= 0; i--) {
+    key[i] = slot.pbn & 0xff;
+    slot.pbn >>= 8;
+  }
+
+  key[sizeof(uint64_t)]     = slot.slot >> 8;
+  key[sizeof(uint64_t) + 1] = slot.slot & 0xff;
+}
+
+/**
+ * Get the number of entries a recovery journal sector can really hold.
+ *
+ * @param sector  The sector
+ *
+ * @return The smaller of the sector's entry count and its capacity
+ **/
+static journal_entry_count_t
+getSectorEntryCount(const struct packed_journal_sector *sector)
+{
+  return min((journal_entry_count_t) sector->entry_count,
+             (journal_entry_count_t) RECOVERY_JOURNAL_ENTRIES_PER_SECTOR);
+}
+
+/**
+ * Decode every entry of the recovery journal once and sort them by slot,
+ * so that each LBN searched for is a binary search rather than another
+ * pass over the whole journal.
+ **/
+static void indexRecoveryJournal(void)
+{
+  block_count_t journalSize = vdo->states.vdo.config.recovery_journal_size;
+  if (journalSize > UINT32_MAX) {
+    errx(1, "Recovery journal of %llu blocks is too large to index",
+         (unsigned long long) journalSize);
+  }
+
+  uint64_t count = 0;
+  for (block_count_t i = 0; i < journalSize; i++) {
+    for (sector_count_t j = 1; j < VDO_SECTORS_PER_BLOCK; j++) {
+      count += getSectorEntryCount(recoveryJournal[i].sectors[j]);
+    }
+  }
+
+  if (count > UINT_MAX) {
+    errx(1, "Recovery journal has too many entries to index");
+  }
+
+  journalKeyCount = count;
+  if (count == 0) {
+    return;
+  }
+
+  int result = UDS_ALLOCATE(count * KEY_BYTES, byte, __func__,
+                            &journalKeyBytes);
+  if (result == VDO_SUCCESS) {
+    result = UDS_ALLOCATE(count, const byte *, __func__, &journalKeys);
+  }
+
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not allocate an index of %llu journal entries",
+         (unsigned long long) count);
+  }
+
+  static RecoveryBlockEntries decoded;
+  byte *key = journalKeyBytes;
+  unsigned int next = 0;
+  for (block_count_t i = 0; i < journalSize; i++) {
+    decodeRecoveryJournalBlock((const struct packed_journal_header *)
+                               &rawJournalBytes[i * VDO_BLOCK_SIZE],
+                               &decoded);
+    for (journal_entry_count_t n = 0; n < decoded.count; n++) {
+      struct block_map_slot slot = {
+        .pbn  = decoded.slotPBNs[n],
+        .slot = decoded.slots[n],
+      };
+      encodeSlotKey(slot, key);
+      key[SLOT_KEY_BYTES]     = i >> 24;
+      key[SLOT_KEY_BYTES + 1] = (i >> 16) & 0xff;
+      key[SLOT_KEY_BYTES + 2] = (i >> 8) & 0xff;
+      key[SLOT_KEY_BYTES + 3] = i & 0xff;
+      key[SLOT_KEY_BYTES + 4] = decoded.sectors[n];
+      key[SLOT_KEY_BYTES + 5] = decoded.sectorEntries[n];
+      journalKeys[next++] = key;
+      key += KEY_BYTES;
+    }
+  }
+
+  struct radix_sorter *sorter;
+  result = make_radix_sorter(count, &sorter);
+  if (result == UDS_SUCCESS) {
+    result = radix_sort(sorter, journalKeys, count, KEY_BYTES);
+    free_radix_sorter(sorter);
+  }
+
+  if (result != UDS_SUCCESS) {
+    errx(1, "Could not sort the recovery journal entries");
+  }
+}
+
 /**
  *  Search recovery journal for PBNs belonging to the given LBN.
  **/
@@ -534,42 +859,54 @@ static void findRecoveryJournalEntries(logical_block_number_t lbn)
     .pbn  = vdo_compute_page_number(lbn),
     .slot = vdo_compute_slot(lbn),
   };
-  for (block_count_t i = 0;
-       i < vdo->states.vdo.config.recovery_journal_size;
-       i++) {
-    UnpackedJournalBlock block = recoveryJournal[i];
-
-    for (sector_count_t j = 1; j < VDO_SECTORS_PER_BLOCK; j++) {
-      const struct packed_journal_sector *sector = block.sectors[j];
-
-      for (journal_entry_count_t k = 0; k < sector->entry_count; k++) {
-        struct recovery_journal_entry entry
-          = unpack_vdo_recovery_journal_entry(&sector->entries[k]);
-
-        if ((desiredSlot.pbn == entry.slot.pbn)
-            && (desiredSlot.slot == entry.slot.slot)) {
-          bool isValidJournalBlock = isBlockFromJournal(&block.header);
-          bool isSequenceNumberPossible
-            = isSequenceNumberPossibleForOffset(&block.header, i);
-          bool isSectorValid
-            = is_valid_vdo_recovery_journal_sector(&block.header, sector);
-
-          printf("found LBN %llu at offset %llu"
-                 " (block %svalid, sequence number %llu %spossible), "
-                 "sector %u (sector %svalid), entry %u "
-                 ": PBN %llu, %s, mappingState %u\n",
-                 (unsigned long long) lbn, (unsigned long long) i,
-		 (isValidJournalBlock ? "" : "not "),
-                 (unsigned long long) block.header.sequence_number,
-                 (isSequenceNumberPossible ? "" : "not "),
-                 j, (isSectorValid ? "" : "not "), k,
-                 (unsigned long long) entry.mapping.pbn,
-                 get_vdo_journal_operation_name(entry.operation),
-                 entry.mapping.state);
-        }
-      }
+  byte desiredKey[SLOT_KEY_BYTES];
+  encodeSlotKey(desiredSlot, desiredKey);
+
+  unsigned int low  = 0;
+  unsigned int high = journalKeyCount;
+  while (low < high) {
+    unsigned int middle = low + ((high - low) / 2);
+    if (memcmp(journalKeys[middle], desiredKey, SLOT_KEY_BYTES) < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
     }
   }
+
+  for (unsigned int n = low;
+       ((n < journalKeyCount)
+        && (memcmp(journalKeys[n], desiredKey, SLOT_KEY_BYTES) == 0));
+       n++) {
+    const byte *key = journalKeys[n];
+    block_count_t i = (((block_count_t) key[SLOT_KEY_BYTES] << 24)
+                       | (key[SLOT_KEY_BYTES + 1] << 16)
+                       | (key[SLOT_KEY_BYTES + 2] << 8)
+                       | key[SLOT_KEY_BYTES + 3]);
+    sector_count_t j = key[SLOT_KEY_BYTES + 4];
+    journal_entry_count_t k = key[SLOT_KEY_BYTES + 5];
+    const UnpackedJournalBlock *block = &recoveryJournal[i];
+    const struct packed_journal_sector *sector = block->sectors[j];
+    struct recovery_journal_entry entry
+      = unpack_vdo_recovery_journal_entry(&sector->entries[k]);
+    bool isValidJournalBlock = isBlockFromJournal(&block->header);
+    bool isSequenceNumberPossible
+      = isSequenceNumberPossibleForOffset(&block->header, i);
+    bool isSectorValid
+      = is_valid_vdo_recovery_journal_sector(&block->header, sector);
+
+    printf("found LBN %llu at offset %llu"
+           " (block %svalid, sequence number %llu %spossible), "
+           "sector %u (sector %svalid), entry %u "
+           ": PBN %llu, %s, mappingState %u\n",
+           (unsigned long long) lbn, (unsigned long long) i,
+           (isValidJournalBlock ? "" : "not "),
+           (unsigned long long) block->header.sequence_number,
+           (isSequenceNumberPossible ? "" : "not "),
+           j, (isSectorValid ? "" : "not "), k,
+           (unsigned long long) entry.mapping.pbn,
+           get_vdo_journal_operation_name(entry.operation),
+           entry.mapping.state);
+  }
 }
 
 /**
@@ -582,8 +919,14 @@ static void findRecoveryJournalEntries(logical_block_number_t lbn)
 static int __must_check
 readVDOFromDump(const char *filename)
 {
+  // Map the dump if possible, so that its blocks need not be copied, unless
+  // it is incremental or compressed.
   PhysicalLayer *layer;
-  int result = makeReadOnlyFileLayer(filename, &layer);
+  int result = makeDumpLayer(filename, &layer);
+
+  if (result == VDO_NOT_IMPLEMENTED) {
+    result = makeReadOnlyFileLayer(filename, &layer);
+  }
 
   if (result != VDO_SUCCESS) {
     char errBuf[ERRBUF_SIZE];
@@ -648,6 +991,10 @@ int main(int argc, char *argv[])
 
   readMetadata();
 
+  if (indexFilename != NULL) {
+    prepareJournalIndexes();
+  }
+
   // Print the nonce for this dump.
   printf("Nonce value: %llu\n", (unsigned long long) vdo->states.vdo.nonce);
 
@@ -657,18 +1004,31 @@ int main(int argc, char *argv[])
   }
 
   // Process any search LBNs.
+  if (searchLBNCount > 0) {
+    indexRecoveryJournal();
+  }
+
   for (uint8_t i = 0; i < searchLBNCount; i++) {
     findRecoveryJournalEntries(searchLBNs[i]);
   }
 
+  // If someone runs the program manually, tell them to use GDB, and give
+  // them every slab to look at.
+  if ((pbnCount == 0) && (searchLBNCount == 0)) {
+    loadAllSlabs();
+  }
+
   // This is a great line for a GDB breakpoint.
   doNothing();
 
-  // If someone runs the program manually, tell them to use GDB.
   if ((pbnCount == 0) && (searchLBNCount == 0)) {
     printf("%s", helpString);
   }
 
+  if (ioStats) {
+    printIOStatistics(stderr, vdo->layer);
+  }
+
   freeMetadataSpace();
   PhysicalLayer *layer = vdo->layer;
   freeUserVDO(&vdo);
@@ -34,22 +34,31 @@
 
 #include "errors.h"
 #include "logger.h"
+#include "memoryAlloc.h"
 #include "statusCodes.h"
 #include "types.h"
 
+#include "dmControl.h"
+
 static const char usageString[] =
-  " [--help] [options...] vdo";
+  " [--help] [options...] { vdo... | --all }";
 
 static const char helpString[] =
   "vdodmeventd - register/unregister VDO device with dmeventd\n"
   "\n"
   "SYNOPSIS\n"
-  "  vdodmeventd [options] <vdo device name>\n"
+  "  vdodmeventd [options] { <vdo device name>... | --all }\n"
   "\n"
   "DESCRIPTION\n"
-  "  vdodmeventd handles registration of VDO devices with dmeventd\n"
+  "  vdodmeventd handles registration of VDO devices with dmeventd.\n"
+  "  Each device named is registered or unregistered in turn, the\n"
+  "  result for each is reported, and the exit status is non-zero if\n"
+  "  any of them failed.\n"
   "\n"
   "OPTIONS\n"
+  "    --all\n"
+  "       Register or unregister every device with a VDO target.\n"
+  "\n"
   "    --help\n"
   "       Print this help message and exit.\n"
   "\n"
@@ -65,13 +74,14 @@ static const char helpString[] =
 
 // N.B. the option array must be in sync with the option string.
 static struct option options[] = {
+  { "all",                      no_argument,       NULL, 'a' },
   { "help",                     no_argument,       NULL, 'h' },
   { "register",                 no_argument,       NULL, 'r' },
   { "unregister",               no_argument,       NULL, 'u' },
   { "version",                  no_argument,       NULL, 'V' },
   { NULL,                       0,                 NULL,  0  },
 };
-static char optionString[] = "hruV";
+static char optionString[] = "ahruV";
 
 static void usage(const char *progname, const char *usageOptionsString)
 {
@@ -118,29 +128,25 @@ static struct dm_event_handler *createEventHandler(const char *devName,
 }
 
 /**
- * Gets the current registration state for the VDO device.
+ * Gets the current registration state for the VDO device. The handler
+ * is filled in with what dmeventd knows of the device, so that it can
+ * be used to unregister it.
  *
- * @param devName  Name of vdo device
- * @param dso      Name of vdo plugin to use, null will ignore setting
+ * @param dmevh    The event handler for the device
+ * @param pending  Set to 1 if a registration is pending
  *
  * @returns -1 if error, 0 if device not registered, non zero event
  *          mask of registered events if device registered
  **/
-static int getRegistrationState(char *devName, char *dso, int *pending)
+static int getRegistrationState(struct dm_event_handler *dmevh, int *pending)
 {
   int result = 0;
   enum dm_event_mask evmask = 0;
 
   *pending = 0;
 
-  struct dm_event_handler *dmevh = createEventHandler(devName, dso);
-  if (dmevh == NULL) {
-    return -1;
-  }
-
   result = dm_event_get_registered_device(dmevh, 0);
   if (result != 0) {
-    dm_event_handler_destroy(dmevh);
     return 0;
   }
 
@@ -150,7 +156,6 @@ static int getRegistrationState(char *devName, char *dso, int *pending)
     *pending = 1;
   }
 
-  dm_event_handler_destroy(dmevh);
   return evmask;
 }
 
@@ -160,20 +165,20 @@ enum registerType { EVENTS_REGISTER, EVENTS_UNREGISTER };
  * Used to register all needed events.
  *
  * @param type    Whether to register or unregister
+ * @param dmevh   The event handler for the device
  * @param devName Name of vdo device
- * @param dso     Name of the plugin to use
  *
  * @returns 0 is success, otherwise error
  */
-static int processEvents(enum registerType type, char *devName, char *dso)
+static int processEvents(enum registerType        type,
+                         struct dm_event_handler *dmevh,
+                         const char              *devName)
 {
   int result = 0;
 
-  struct dm_event_handler *dmevh = createEventHandler(devName, dso);
-  if (dmevh == NULL) {
-    uds_log_error("Failed to create event handler for %s", devName);
-    return 1;
-  }
+  // The state query may have replaced the events asked for.
+  dm_event_handler_set_event_mask(dmevh,
+                                  DM_EVENT_ALL_ERRORS | DM_EVENT_TIMEOUT);
 
   // Note: 1 is valid. 0 is error here.
   result = (type == EVENTS_REGISTER) ? dm_event_register_handler(dmevh)
@@ -182,8 +187,6 @@ static int processEvents(enum registerType type, char *devName, char *dso)
     uds_log_error("Failure to process events for %s", devName);
   }
 
-  dm_event_handler_destroy(dmevh);
-
   return !result;
 }
 
@@ -194,25 +197,28 @@ static int processEvents(enum registerType type, char *devName, char *dso)
  *
  * @returns 0 is success, otherwise error
  */
-static int registerVDO(char * devName) {
+static int registerVDO(const char *devName) {
   int result = 0;
   int pending = 0;
 
-  result = getRegistrationState(devName, PLUGIN_NAME, &pending);
-  if (result < 0) {
+  struct dm_event_handler *dmevh = createEventHandler(devName, PLUGIN_NAME);
+  if (dmevh == NULL) {
     uds_log_error("Failed to get registration info for VDO device %s",
                   devName);
     return 1;
   }
 
+  result = getRegistrationState(dmevh, &pending);
   if (result > 0) {
     uds_log_error("VDO device %s %s", devName,
                   pending ? "has a registration event pending"
                   : "is already being monitored");
+    dm_event_handler_destroy(dmevh);
     return 1;
   }
 
-  result = processEvents(EVENTS_REGISTER, devName, PLUGIN_NAME);
+  result = processEvents(EVENTS_REGISTER, dmevh, devName);
+  dm_event_handler_destroy(dmevh);
   if (result != 0) {
     uds_log_error("Unable to register events for VDO device %s", devName);
     return result;
@@ -231,25 +237,29 @@ static int registerVDO(char * devName) {
  *
  * @returns 0 is success, otherwise error
  */
-static int unregisterVDO(char * devName) {
+static int unregisterVDO(const char *devName) {
   int result = 0;
   int pending = 0;
 
-  result = getRegistrationState(devName, NULL, &pending);
-  if (result < 0) {
+  struct dm_event_handler *dmevh = createEventHandler(devName, NULL);
+  if (dmevh == NULL) {
     uds_log_error("Failed to get registration info for VDO device %s",
                   devName);
     return 1;
   }
 
+  result = getRegistrationState(dmevh, &pending);
   if ((result == 0) || (pending == 1)) {
     uds_log_error("VDO device %s %s", devName,
                   pending ? "cannot be unregistered until completed"
                   : "is not currently being monitored");
+    dm_event_handler_destroy(dmevh);
     return 1;
   }
 
-  result = processEvents(EVENTS_UNREGISTER, devName, NULL);
+  // The handler now names the plugin monitoring the device.
+  result = processEvents(EVENTS_UNREGISTER, dmevh, devName);
+  dm_event_handler_destroy(dmevh);
   if (result != 0) {
     uds_log_error("Unable to unregister dmeventd events for VDO "
                   "device %s", devName);
@@ -266,6 +276,56 @@ static int unregisterVDO(char * devName) {
  *
  * @returns 0 if success, otherwise error
  */
+/**
+ * Find the names of all devices with a VDO target.
+ *
+ * @param [out] namesPtr  A pointer to hold the array of device names
+ * @param [out] countPtr  A pointer to hold the number of devices
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int findVDODevices(char ***namesPtr, size_t *countPtr)
+{
+  int control;
+  int result = openDMControl(&control);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  DMDevice *devices;
+  size_t    count;
+  result = listDMDevices(control, "vdo", &devices, &count);
+  closeDMControl(control);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  char **names;
+  result = UDS_ALLOCATE(count + 1, char *, __func__, &names);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(devices);
+    return result;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    result = uds_duplicate_string(devices[i].name, __func__, &names[i]);
+    if (result != VDO_SUCCESS) {
+      while (i > 0) {
+        UDS_FREE(names[--i]);
+      }
+      UDS_FREE(names);
+      UDS_FREE(devices);
+      return result;
+    }
+  }
+
+  UDS_FREE(devices);
+  *namesPtr = names;
+  *countPtr = count;
+  return VDO_SUCCESS;
+}
+
+/**********************************************************************/
 static int validatePlugin(void)
 {
   void *dl = dlopen(PLUGIN_NAME, RTLD_NOW);
@@ -291,11 +351,16 @@ int main(int argc, char *argv[])
   }
 
   int c;
+  bool doAll = false;
   bool doRegister = false;
   bool doUnregister = false;
 
   while ((c = getopt_long(argc, argv, optionString, options, NULL)) != -1) {
     switch (c) {
+    case 'a':
+      doAll = true;
+      break;
+
     case 'h':
       printf("%s", helpString);
       exit(0);
@@ -320,12 +385,10 @@ int main(int argc, char *argv[])
     };
   }
 
-  if (optind != (argc - 1)) {
+  if (doAll == (optind < argc)) {
     usage(argv[0], usageString);
   }
 
-  char *devName = argv[optind];
-
   if (doRegister && doUnregister) {
     errx(1, "Only one of -r and -u can be specified");
   }
@@ -339,9 +402,38 @@ int main(int argc, char *argv[])
     return 1;
   }
 
-  if (doRegister) {
-    return registerVDO(devName);
+  char **devNames = &argv[optind];
+  size_t deviceCount = argc - optind;
+  if (doAll) {
+    result = findVDODevices(&devNames, &deviceCount);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not list VDO devices: %s",
+           uds_string_error(result, errBuf, ERRBUF_SIZE));
+    }
+  }
+
+  // Each request to dmeventd stands alone, so a failure for one device
+  // does not stop the rest from being handled.
+  size_t failures = 0;
+  for (size_t i = 0; i < deviceCount; i++) {
+    if ((doRegister ? registerVDO(devNames[i])
+                    : unregisterVDO(devNames[i])) != 0) {
+      failures++;
+    }
+  }
+
+  if (deviceCount > 1) {
+    uds_log_info("%s %zu of %zu VDO devices",
+                 doRegister ? "Registered" : "Unregistered",
+                 deviceCount - failures, deviceCount);
+  }
+
+  if (doAll) {
+    for (size_t i = 0; i < deviceCount; i++) {
+      UDS_FREE(devNames[i]);
+    }
+    UDS_FREE(devNames);
   }
 
-  return unregisterVDO(devName);
+  return (failures > 0) ? 1 : 0;
 }
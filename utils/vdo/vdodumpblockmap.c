@@ -22,38 +22,128 @@
 #include <err.h>
 #include <getopt.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "errors.h"
 #include "logger.h"
+#include "memoryAlloc.h"
+#include "numeric.h"
 
 #include "blockMapFormat.h"
 #include "statusCodes.h"
 #include "types.h"
 
 #include "blockMapUtils.h"
+#include "ioStatistics.h"
+#include "reverseBlockMap.h"
 #include "vdoVolumeUtils.h"
 
+enum {
+  // The size of each write to standard output in the compact formats.
+  OUTPUT_BUFFER_BYTES = 1024 * 1024,
+  // The size of a record in the binary format.
+  BINARY_RECORD_BYTES = 16,
+  // The number of bits of a binary record's second word holding the PBN.
+  BINARY_PBN_BITS     = 60,
+};
+
+/** A growable list of block numbers given on the command line */
+typedef struct {
+  uint64_t *numbers;
+  size_t    count;
+  size_t    capacity;
+} BlockNumberList;
+
+typedef enum {
+  FORMAT_TEXT,
+  FORMAT_EXTENTS,
+  FORMAT_BINARY,
+} OutputFormat;
+
 static const char usageString[]
-  = "[--help] [--lba=<lba>] [--version] <filename>";
+  = "[--help] [--lba=<lba> | --range=<first>-<last>]"
+    " [--format=<text|extents|binary>] [--pba=<pba>]"
+    " [--write-reverse-index=<file> | --reverse-index=<file>] [--io-stats]"
+    " [--cache=<file>] [--version] [<filename>]";
 
 static const char helpString[] =
   "vdoDumpBlockMap - dump the LBA->PBA mappings of a VDO device\n"
   "\n"
   "SYNOPSIS\n"
-  "  vdoDumpBlockMap [--lba=<lba>] <filename>\n"
+  "  vdoDumpBlockMap [--lba=<lba> | --range=<first>-<last>]\n"
+  "                  [--format=<text|extents|binary>] [--pba=<pba>]\n"
+  "                  [--write-reverse-index=<file>] [--io-stats]\n"
+  "                  [--cache=<file>] <filename>\n"
+  "  vdoDumpBlockMap --reverse-index=<file> --pba=<pba>\n"
   "\n"
   "DESCRIPTION\n"
   "  vdoDumpBlockMap dumps all (or only the specified) LBA->PBA mappings\n"
-  "  from a cleanly shut down VDO device\n";
+  "  from a cleanly shut down VDO device\n"
+  "\n"
+  "  --lba may be given more than once. The mappings of all the LBAs\n"
+  "  given will be looked up together, and printed in the order given.\n"
+  "\n"
+  "  If --range is specified, the mappings of the LBAs from <first> to\n"
+  "  <last>, inclusive, will be dumped in order, reading only the parts\n"
+  "  of the block map which cover them.\n"
+  "\n"
+  "  --format selects the output format. The default, text, prints one\n"
+  "  line per mapping. extents prints the mapped LBAs in LBA order, with\n"
+  "  each run of consecutive LBAs mapped to consecutive PBAs in the same\n"
+  "  state on one line as <lba> <count> <pba> <state>. binary writes a\n"
+  "  16 byte record for each mapped LBA in LBA order: the LBA as a little\n"
+  "  endian 64 bit number, then a little endian 64 bit number whose low 60\n"
+  "  bits are the PBA and whose high 4 bits are the mapping state.\n"
+  "\n"
+  "  If --pba is specified, the LBAs which map to the given PBA are printed\n"
+  "  instead, using a reverse index built from the whole block map in one\n"
+  "  pass. --pba may be given more than once, and all the PBAs given are\n"
+  "  answered from the same index. If --write-reverse-index is specified,\n"
+  "  the index is also saved in the given file. If --reverse-index is\n"
+  "  specified, the --pba queries are answered by binary searches of a\n"
+  "  saved index, and no VDO is read.\n"
+  "\n"
+  "  If --cache is specified, the block map is read from the snapshot\n"
+  "  cache <file> if it is current for the VDO, and <file> is written\n"
+  "  first if it is not. See vdoAudit for details.\n"
+  "\n"
+  "  If --io-stats is specified, the number of reads done and their\n"
+  "  latencies will be displayed on exit.\n";
 
 static struct option options[] = {
-  { "help",       no_argument,       NULL, 'h' },
-  { "lba",        required_argument, NULL, 'l' },
-  { "version",    no_argument,       NULL, 'V' },
-  { NULL,         0,                 NULL,  0  },
+  { "cache",               required_argument, NULL, 'C' },
+  { "format",              required_argument, NULL, 'f' },
+  { "help",                no_argument,       NULL, 'h' },
+  { "io-stats",            no_argument,       NULL, 'i' },
+  { "lba",                 required_argument, NULL, 'l' },
+  { "pba",                 required_argument, NULL, 'p' },
+  { "range",               required_argument, NULL, 'r' },
+  { "reverse-index",       required_argument, NULL, 'x' },
+  { "version",             no_argument,       NULL, 'V' },
+  { "write-reverse-index", required_argument, NULL, 'w' },
+  { NULL,                  0,                 NULL,  0  },
 };
 
-static logical_block_number_t lbn = 0xFFFFFFFFFFFFFFFF;
+static logical_block_number_t rangeStart        = 0;
+static logical_block_number_t rangeEnd          = 0;
+static BlockNumberList        lbas;
+static BlockNumberList        pbas;
+static const char            *reverseIndexPath  = NULL;
+static const char            *writeIndexPath    = NULL;
+static const char            *cachePath         = NULL;
+static OutputFormat           format            = FORMAT_TEXT;
+static bool                   ioStats           = false;
+
+/** Output waiting to be written in the compact formats */
+static char   *outputBuffer = NULL;
+static size_t  outputBytes  = 0;
+
+/** The run of mappings which will be the next line in the extents format */
+static logical_block_number_t   extentLBN   = 0;
+static block_count_t            extentCount = 0;
+static physical_block_number_t  extentPBN   = 0;
+static enum block_mapping_state extentState = VDO_MAPPING_STATE_UNMAPPED;
 
 static UserVDO *vdo;
 
@@ -69,6 +159,40 @@ static void usage(const char *progname, const char *usageOptionsString)
   exit(1);
 }
 
+/**
+ * Parse a block number from the command line and add it to a list.
+ *
+ * @param list  The list to add to
+ * @param arg   The argument to parse
+ * @param what  What sort of block number the list holds, for errors
+ **/
+static void addBlockNumber(BlockNumberList *list,
+                           const char      *arg,
+                           const char      *what)
+{
+  char *endptr;
+  errno = 0;
+  uint64_t number = strtoull(arg, &endptr, 0);
+  if (errno == ERANGE || errno == EINVAL || endptr == arg) {
+    errx(1, "No %s specified", what);
+  }
+
+  if (list->count == list->capacity) {
+    size_t newCapacity = ((list->capacity == 0) ? 16 : (2 * list->capacity));
+    int result = uds_reallocate_memory(list->numbers,
+                                       list->capacity * sizeof(uint64_t),
+                                       newCapacity * sizeof(uint64_t),
+                                       __func__, &list->numbers);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not allocate space for %zu %ss", newCapacity, what);
+    }
+
+    list->capacity = newCapacity;
+  }
+
+  list->numbers[list->count++] = number;
+}
+
 /**
  * Get the filename (or "help") from the input arguments.
  * Print command usage if arguments are wrong.
@@ -82,28 +206,90 @@ static void usage(const char *progname, const char *usageOptionsString)
 static int processDumpArgs(int argc, char *argv[], char **filename)
 {
   int      c;
-  char    *optionString = "l:hV";
+  char    *optionString = "C:f:l:p:r:w:x:hiV";
   while ((c = getopt_long(argc, argv, optionString, options, NULL)) != -1) {
     if (c == (int) 'h') {
       printf("%s", helpString);
       exit(0);
     }
 
+    if (c == (int) 'i') {
+      ioStats = true;
+      continue;
+    }
+
+    if (c == (int) 'C') {
+      cachePath = optarg;
+      continue;
+    }
+
+    if (c == (int) 'f') {
+      if (strcmp(optarg, "text") == 0) {
+        format = FORMAT_TEXT;
+      } else if (strcmp(optarg, "extents") == 0) {
+        format = FORMAT_EXTENTS;
+      } else if (strcmp(optarg, "binary") == 0) {
+        format = FORMAT_BINARY;
+      } else {
+        errx(1, "Format must be one of text, extents, or binary");
+      }
+      continue;
+    }
+
     if (c == (int) 'V') {
       printf("%s version is: %s\n", argv[0], CURRENT_VERSION);
       exit(0);
     }
 
     if (c == (int) 'l') {
+      addBlockNumber(&lbas, optarg, "LBA");
+      rangeEnd = 0;
+    }
+
+    if (c == (int) 'p') {
+      addBlockNumber(&pbas, optarg, "PBA");
+    }
+
+    if (c == (int) 'w') {
+      writeIndexPath = optarg;
+    }
+
+    if (c == (int) 'x') {
+      reverseIndexPath = optarg;
+    }
+
+    if (c == (int) 'r') {
       char *endptr;
       errno = 0;
-      lbn = strtoull(optarg, &endptr, 0);
-      if (errno == ERANGE || errno == EINVAL || endptr == optarg) {
-        errx(1, "No LBA specified");
+      rangeStart = strtoull(optarg, &endptr, 0);
+      if ((errno == ERANGE) || (errno == EINVAL) || (endptr == optarg)
+          || (*endptr != '-')) {
+        errx(1, "Range must be <first>-<last>");
       }
+
+      char *last = endptr + 1;
+      rangeEnd = strtoull(last, &endptr, 0);
+      if ((errno == ERANGE) || (errno == EINVAL) || (endptr == last)
+          || (*endptr != '\0') || (rangeEnd < rangeStart)) {
+        errx(1, "Range must be <first>-<last>");
+      }
+
+      // The range end is exclusive from here on.
+      rangeEnd++;
+      lbas.count = 0;
     }
   }
 
+  // A saved reverse index is used in place of a VDO.
+  if (reverseIndexPath != NULL) {
+    if ((optind != argc) || (pbas.count == 0)) {
+      usage(argv[0], usageString);
+    }
+
+    *filename = NULL;
+    return VDO_SUCCESS;
+  }
+
   // Explain usage and exit
   if (optind != (argc - 1)) {
     usage(argv[0], usageString);
@@ -114,17 +300,15 @@ static int processDumpArgs(int argc, char *argv[], char **filename)
   return VDO_SUCCESS;
 }
 
-/**********************************************************************/
-static int dumpLBN(void)
+/**
+ * Print out the mapping of a single LBN.
+ *
+ * Implements LBNExaminer.
+ **/
+static int printMapping(logical_block_number_t   lbn,
+                        physical_block_number_t  pbn,
+                        enum block_mapping_state state)
 {
-  physical_block_number_t  pbn;
-  enum block_mapping_state state;
-  int result = findLBNMapping(vdo, lbn, &pbn, &state);
-  if (result != VDO_SUCCESS) {
-    warnx("Could not read mapping for lbn %llu", (unsigned long long) lbn);
-    return result;
-  }
-
   printf("%llu\t", (unsigned long long) lbn);
   switch (state) {
   case VDO_MAPPING_STATE_UNMAPPED:
@@ -145,20 +329,284 @@ static int dumpLBN(void)
 }
 
 /**
- * Print out a mapping from a block map page.
+ * Write out the buffered output of the compact formats.
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int flushOutput(void)
+{
+  size_t written = 0;
+  while (written < outputBytes) {
+    ssize_t bytes = write(STDOUT_FILENO, outputBuffer + written,
+                          outputBytes - written);
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return errno;
+    }
+
+    written += bytes;
+  }
+
+  outputBytes = 0;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Make sure there is room in the output buffer for another line or record.
+ *
+ * @param bytes  The number of bytes needed
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int reserveOutput(size_t bytes)
+{
+  if ((outputBytes + bytes) > OUTPUT_BUFFER_BYTES) {
+    return flushOutput();
+  }
+
+  return VDO_SUCCESS;
+}
+
+/**
+ * Append a number in decimal to the output buffer, without going through
+ * stdio. The caller must have reserved enough room.
+ *
+ * @param value      The number to append
+ * @param separator  The character to append after the number
+ **/
+static void appendNumber(uint64_t value, char separator)
+{
+  char digits[20];
+  size_t count = 0;
+  do {
+    digits[count++] = '0' + (value % 10);
+    value /= 10;
+  } while (value > 0);
+
+  while (count > 0) {
+    outputBuffer[outputBytes++] = digits[--count];
+  }
+  outputBuffer[outputBytes++] = separator;
+}
+
+/**
+ * Append the pending extent, if any, to the output as one line.
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int flushExtent(void)
+{
+  if (extentCount == 0) {
+    return VDO_SUCCESS;
+  }
+
+  // Four numbers of at most 20 digits each, a word, and the separators.
+  int result = reserveOutput(128);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  appendNumber(extentLBN, '\t');
+  appendNumber(extentCount, '\t');
+  appendNumber(extentPBN, '\t');
+  if (vdo_is_state_compressed(extentState)) {
+    memcpy(outputBuffer + outputBytes, "compressed ", 11);
+    outputBytes += 11;
+    appendNumber(vdo_get_slot_from_state(extentState), '\n');
+  } else {
+    memcpy(outputBuffer + outputBytes, "mapped\n", 7);
+    outputBytes += 7;
+  }
+
+  extentCount = 0;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Add the mapping of a single LBN to the output in one of the compact
+ * formats. Unmapped LBNs are skipped.
  *
- * Implements MappingExaminer.
+ * Implements LBNExaminer.
  **/
-static int dumpBlockMapEntry(struct block_map_slot    slot,
-                             height_t                 height,
-                             physical_block_number_t  pbn,
-                             enum block_mapping_state state)
+static int recordMapping(logical_block_number_t   lbn,
+                         physical_block_number_t  pbn,
+                         enum block_mapping_state state)
 {
-  if ((state != VDO_MAPPING_STATE_UNMAPPED) || (pbn != VDO_ZERO_BLOCK)) {
-    printf("PBN %llu\t slot %u\t height %u\t"
-           "-> PBN %llu (compression state %u)\n",
-           (unsigned long long) slot.pbn, slot.slot, height,
-           (unsigned long long) pbn, state);
+  if (state == VDO_MAPPING_STATE_UNMAPPED) {
+    return VDO_SUCCESS;
+  }
+
+  if (format == FORMAT_BINARY) {
+    int result = reserveOutput(BINARY_RECORD_BYTES);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    byte *record = (byte *) outputBuffer + outputBytes;
+    put_unaligned_le64(lbn, record);
+    put_unaligned_le64(((uint64_t) state << BINARY_PBN_BITS) | pbn,
+                       record + sizeof(uint64_t));
+    outputBytes += BINARY_RECORD_BYTES;
+    return VDO_SUCCESS;
+  }
+
+  if ((extentCount > 0)
+      && (lbn == extentLBN + extentCount)
+      && (pbn == extentPBN + extentCount)
+      && (state == extentState)) {
+    extentCount++;
+    return VDO_SUCCESS;
+  }
+
+  int result = flushExtent();
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  extentLBN   = lbn;
+  extentCount = 1;
+  extentPBN   = pbn;
+  extentState = state;
+  return VDO_SUCCESS;
+}
+
+/**
+ * Write out whatever remains of the output in the compact formats, and free
+ * the output buffer.
+ *
+ * @param result  The result of the dump so far
+ *
+ * @return The result of the dump so far if it failed, otherwise the result
+ *         of writing the output
+ **/
+static int finishOutput(int result)
+{
+  if (format == FORMAT_TEXT) {
+    return result;
+  }
+
+  if (result == VDO_SUCCESS) {
+    result = flushExtent();
+  }
+  if (result == VDO_SUCCESS) {
+    result = flushOutput();
+    if (result != VDO_SUCCESS) {
+      char errBuf[ERRBUF_SIZE];
+      warnx("Could not write output: %s",
+            uds_string_error(result, errBuf, ERRBUF_SIZE));
+    }
+  }
+
+  UDS_FREE(outputBuffer);
+  return result;
+}
+
+/**
+ * Print out the mappings of the LBAs given on the command line.
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int dumpLBAs(void)
+{
+  physical_block_number_t *pbns;
+  int result = UDS_ALLOCATE(lbas.count, physical_block_number_t, __func__,
+                            &pbns);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  enum block_mapping_state *states;
+  result = UDS_ALLOCATE(lbas.count, enum block_mapping_state, __func__,
+                        &states);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(pbns);
+    return result;
+  }
+
+  result = findLBNMappings(vdo, lbas.numbers, lbas.count, pbns, states);
+  if (result != VDO_SUCCESS) {
+    warnx("Could not read mappings for the requested LBAs");
+  }
+
+  LBNExaminer *examiner
+    = ((format == FORMAT_TEXT) ? printMapping : recordMapping);
+  for (size_t i = 0; (result == VDO_SUCCESS) && (i < lbas.count); i++) {
+    result = examiner(lbas.numbers[i], pbns[i], states[i]);
+  }
+
+  UDS_FREE(states);
+  UDS_FREE(pbns);
+  return result;
+}
+
+/**
+ * Print out the LBAs which map to the PBAs given on the command line, and
+ * save the reverse index if requested.
+ *
+ * @param map  The reverse index
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int dumpReverseMappings(const ReverseBlockMap *map)
+{
+  LBNExaminer *examiner
+    = ((format == FORMAT_TEXT) ? printMapping : recordMapping);
+  return findPBNReferences(map, pbas.numbers, pbas.count, examiner);
+}
+
+/**
+ * Build a reverse index of the block map, save it if requested, and print
+ * out the LBAs which map to the PBAs given on the command line.
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int dumpPBAs(void)
+{
+  ReverseBlockMap *map;
+  int result = makeReverseBlockMap(vdo, &map);
+  if (result != VDO_SUCCESS) {
+    warnx("Could not build the reverse block map");
+    return result;
+  }
+
+  if (writeIndexPath != NULL) {
+    result = writeReverseBlockMap(map, writeIndexPath);
+    if (result != VDO_SUCCESS) {
+      warnx("Could not write the reverse block map to '%s'", writeIndexPath);
+    }
+  }
+
+  if (result == VDO_SUCCESS) {
+    result = dumpReverseMappings(map);
+  }
+
+  freeReverseBlockMap(&map);
+  return result;
+}
+
+/**
+ * Print out the mappings from a block map page.
+ *
+ * Implements PageExaminer.
+ **/
+static int dumpBlockMapPage(const DecodedBlockMapPage *page, height_t height)
+{
+  if (page->allUnmapped) {
+    return VDO_SUCCESS;
+  }
+
+  for (slot_number_t slot = 0; slot < VDO_BLOCK_MAP_ENTRIES_PER_PAGE; slot++) {
+    physical_block_number_t  pbn   = page->pbns[slot];
+    enum block_mapping_state state = page->states[slot];
+    if ((state != VDO_MAPPING_STATE_UNMAPPED) || (pbn != VDO_ZERO_BLOCK)) {
+      printf("PBN %llu\t slot %u\t height %u\t"
+             "-> PBN %llu (compression state %u)\n",
+             (unsigned long long) page->pagePBN, slot, height,
+             (unsigned long long) pbn, state);
+    }
   }
   return VDO_SUCCESS;
 }
@@ -180,14 +628,61 @@ int main(int argc, char *argv[])
     exit(1);
   }
 
-  result = makeVDOFromFile(filename, true, &vdo);
+  if (format != FORMAT_TEXT) {
+    result = UDS_ALLOCATE(OUTPUT_BUFFER_BYTES, char, "output buffer",
+                          &outputBuffer);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not allocate %u bytes for output",
+           OUTPUT_BUFFER_BYTES);
+    }
+  }
+
+  if (reverseIndexPath != NULL) {
+    ReverseBlockMap *map;
+    result = openReverseBlockMap(reverseIndexPath, &map);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not open reverse index '%s': %s", reverseIndexPath,
+           uds_string_error(result, errBuf, ERRBUF_SIZE));
+    }
+
+    result = dumpReverseMappings(map);
+    freeReverseBlockMap(&map);
+    result = finishOutput(result);
+    UDS_FREE(pbas.numbers);
+    exit((result == VDO_SUCCESS) ? 0 : 1);
+  }
+
+  result = loadVDOWithSnapshot(filename, true, cachePath, true, &vdo);
   if (result != VDO_SUCCESS) {
     errx(1, "Could not load VDO from '%s': %s",
          filename, uds_string_error(result, errBuf, ERRBUF_SIZE));
   }
 
-  result = ((lbn != 0xFFFFFFFFFFFFFFFF)
-            ? dumpLBN() : examineBlockMapEntries(vdo, dumpBlockMapEntry));
+  if ((pbas.count > 0) || (writeIndexPath != NULL)) {
+    result = dumpPBAs();
+  } else if (lbas.count > 0) {
+    result = dumpLBAs();
+  } else if (format != FORMAT_TEXT) {
+    // The compact formats are in LBN order, so dump the whole space as one
+    // range.
+    if (rangeEnd == 0) {
+      rangeEnd = vdo->states.vdo.config.logical_blocks;
+    }
+    result = examineBlockMapRange(vdo, rangeStart, rangeEnd, recordMapping);
+  } else if (rangeEnd != 0) {
+    result = examineBlockMapRange(vdo, rangeStart, rangeEnd, printMapping);
+  } else {
+    result = examineBlockMapPages(vdo, dumpBlockMapPage);
+  }
+
+  result = finishOutput(result);
+
+  if (ioStats) {
+    printIOStatistics(stderr, vdo->layer);
+  }
+
   freeVDOFromFile(&vdo);
+  UDS_FREE(lbas.numbers);
+  UDS_FREE(pbas.numbers);
   exit((result == VDO_SUCCESS) ? 0 : 1);
 }
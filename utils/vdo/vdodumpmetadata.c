@@ -21,12 +21,14 @@
 
 #include <err.h>
 #include <getopt.h>
+#include <string.h>
 
 #include "errors.h"
 #include "fileUtils.h"
 #include "memoryAlloc.h"
 #include "stringUtils.h"
 #include "syscalls.h"
+#include "uds-threads.h"
 
 #include "blockMapFormat.h"
 #include "fixedLayout.h"
@@ -39,25 +41,74 @@
 #include "volumeGeometry.h"
 
 #include "blockMapUtils.h"
+#include "coalescingWriter.h"
+#include "dumpLayer.h"
+#include "dumpTOC.h"
 #include "fileLayer.h"
+#include "ioStatistics.h"
+#include "parseUtils.h"
+#include "throttleLayer.h"
+#include "progress.h"
 #include "userVDO.h"
 #include "vdoVolumeUtils.h"
 
 enum {
-  STRIDE_LENGTH = 256,
-  MAX_LBNS      = 255,
+  STRIDE_LENGTH       = 256,
+  MAX_LBNS            = 255,
+  // The size of each write to the output file, and of each compressed frame.
+  OUTPUT_BUFFER_BYTES = 4 * 1024 * 1024,
+  // The most threads --threads may ask for.
+  MAX_THREADS         = 64,
+  // The number of threads reading slab metadata ahead of the output.
+  SLAB_READERS        = 4,
+  // The number of slabs which may be read but not yet written.
+  SLAB_BUFFERS        = 2 * SLAB_READERS,
+  // The size of each kernel-side copy with --zero-copy.
+  COPY_CHUNK_BLOCKS   = 2048,
 };
 
+/**
+ * A buffer holding the metadata of one slab, read by a slab reader and
+ * waiting for its turn to be written.
+ **/
+typedef struct {
+  char *data;
+  bool  ready;
+  int   result;
+} SlabBuffer;
+
+/**
+ * The state shared by the slab readers and the thread writing the slabs
+ * out in order.
+ **/
+typedef struct {
+  struct mutex         lock;
+  struct cond_var      changed;
+  SlabBuffer           buffers[SLAB_BUFFERS];
+  // The next slab a reader will claim
+  slab_count_t         nextToRead;
+  // The next slab to be written, whose buffer is the oldest in use
+  slab_count_t         nextToWrite;
+  block_count_t        slabBlocks;
+} SlabCopy;
+
 static const char usageString[]
-  = "[--help] [--no-block-map] [--lbn=<lbn>] [--version] vdoBacking"
-    " outputFile";
+  = "[--help] [--no-block-map] [--lbn=<lbn>] [--direct-output]"
+    " [--zero-copy] [--compress [--threads=<count>]] [--base=<previousDump>] [--progress]"
+    " [--max-iops=<count>] [--max-bandwidth=<size>]"
+    " [--io-priority=<class>[:<level>]] [--io-stats] [--version]"
+    " vdoBacking outputFile";
 
 static const char helpString[] =
   "vdodumpmetadata - dump the metadata regions from a VDO device\n"
   "\n"
   "SYNOPSIS\n"
-  "  vdodumpmetadata [--no-block-map] [--lbn=<lbn>] <vdoBacking>"
-  "    <outputFile>\n"
+  "  vdodumpmetadata [--no-block-map] [--lbn=<lbn>] [--direct-output]\n"
+  "    [--zero-copy]\n"
+  "    [--compress [--threads=<count>]] [--base=<previousDump>]\n"
+  "    [--max-iops=<count>] [--max-bandwidth=<size>]\n"
+  "    [--io-priority=<class>[:<level>]]\n"
+  "    [--progress] [--io-stats] <vdoBacking> <outputFile>\n"
   "\n"
   "DESCRIPTION\n"
   "  vdodumpmetadata dumps the metadata regions of a VDO device to\n"
@@ -66,7 +117,9 @@ static const char helpString[] =
   "\n"
   "  vdodumpmetadata will produce a large output file. The expected size is\n"
   "  roughly equal to VDO's metadata size. A rough estimate of the storage\n"
-  "  needed is 1.4 GB per TB of logical space.\n"
+  "  needed is 1.4 GB per TB of logical space. If the output file is a\n"
+  "  regular file, blocks which are entirely zero are not written, so the\n"
+  "  file is sparse and takes up much less space on lightly used volumes.\n"
   "\n"
   "  If the --no-block-map option is used, the output file will be of size\n"
   "  no higher than 130MB + (9 MB per slab).\n"
@@ -74,13 +127,62 @@ static const char helpString[] =
   "  --lbn implies --no-block-map, and saves the block map page associated\n"
   "  with the specified LBN in the output file. This option may be\n"
   "  specified up to 255 times.\n"
+  "\n"
+  "  --direct-output writes the output file with O_DIRECT, bypassing the\n"
+  "  page cache.\n"
+  "\n"
+  "  --zero-copy has the kernel copy the slab metadata, recovery journal,\n"
+  "  and slab summary straight to the output file, with copy_file_range(2)\n"
+  "  or splice(2), rather than passing them through vdodumpmetadata. The\n"
+  "  zero blocks in them are then written, so the output is less sparse.\n"
+  "  Block map pages are still copied through vdodumpmetadata, as are\n"
+  "  other regions if the kernel cannot copy between the two files.\n"
+  "\n"
+  "  --compress writes the dump as independently compressed frames, using\n"
+  "  the number of threads given by --threads (by default, one for each\n"
+  "  core). vdodebugmetadata and vdolistmetadata read compressed dumps\n"
+  "  directly.\n"
+  "\n"
+  "  --base writes an incremental dump holding only the blocks which differ\n"
+  "  from those in <previousDump>, which may itself be incremental, and an\n"
+  "  index of where they belong. The tools which read dumps reassemble the\n"
+  "  full dump from the two, so <previousDump> must be kept with it.\n"
+  "\n"
+  "  If <outputFile> is -, the dump is written to standard output.\n"
+  "\n"
+  "  The dump ends with a table of contents recording where each region\n"
+  "  in it was copied from.\n"
+  "\n"
+  "  --max-iops and --max-bandwidth limit the rate of I/O to the VDO\n"
+  "  device to <count> operations and <size> bytes per second, so that\n"
+  "  the dump does not crowd out other users of shared storage. <size>\n"
+  "  may have a K, M, G, or T suffix. --io-priority sets the I/O\n"
+  "  scheduling class, one of idle, best-effort, or realtime, and for the\n"
+  "  last two an optional level from 0 to 7, as for ionice(1).\n"
+  "\n"
+  "  --progress reports the region being dumped, the blocks copied, the\n"
+  "  throughput, and an estimate of when the region will be done every\n"
+  "  few seconds.\n"
+  "\n"
+  "  --io-stats displays the number of reads done from the VDO device and\n"
+  "  their latencies on exit.\n"
   "\n";
 
 static struct option options[] = {
+  { "base",            required_argument, NULL, 'B' },
+  { "compress",        no_argument,       NULL, 'c' },
+  { "direct-output",   no_argument,       NULL, 'd' },
   { "help",            no_argument,       NULL, 'h' },
+  { "io-priority",     required_argument, NULL, 'n' },
+  { "io-stats",        no_argument,       NULL, 'i' },
   { "lbn",             required_argument, NULL, 'l' },
+  { "max-bandwidth",   required_argument, NULL, 'W' },
+  { "max-iops",        required_argument, NULL, 'I' },
   { "no-block-map",    no_argument,       NULL, 'b' },
+  { "progress",        no_argument,       NULL, 'p' },
+  { "threads",         required_argument, NULL, 't' },
   { "version",         no_argument,       NULL, 'V' },
+  { "zero-copy",       no_argument,       NULL, 'z' },
   { NULL,              0,                 NULL,  0  },
 };
 
@@ -88,13 +190,26 @@ static char                    *vdoBacking     = NULL;
 static UserVDO                 *vdo            = NULL;
 
 static char                    *outputFilename = NULL;
-static int                      outputFD       = -1;
-static char                    *buffer         = NULL;
+static CoalescingWriter        *output         = NULL;
+static bool                     directOutput   = false;
+static bool                     zeroCopy       = false;
+static bool                     compress       = false;
+static unsigned int             threadCount    = 0;
+static char                    *baseFilename   = NULL;
+static PhysicalLayer           *base           = NULL;
+static bool                     ioStats        = false;
+static bool                     progress       = false;
+static unsigned int             maxIOPS        = 0;
+static uint64_t                 maxBandwidth   = 0;
 
 static bool                     noBlockMap     = false;
 static uint8_t                  lbnCount       = 0;
 static physical_block_number_t *lbns           = NULL;
 
+/** The number of blocks written to the dump so far */
+static block_count_t            dumpPosition   = 0;
+static DumpTOC                  toc;
+
 /**
  * Explain how this command-line tool is used.
  *
@@ -112,10 +227,12 @@ static void usage(const char *progname)
 static void freeAllocations(void)
 {
   freeVDOFromFile(&vdo);
-  try_sync_and_close_file(outputFD);
-  UDS_FREE(buffer);
+  freeCoalescingWriter(&output);
+  freeDumpTOC(&toc);
+  if (base != NULL) {
+    base->destroy(&base);
+  }
   UDS_FREE(lbns);
-  buffer = NULL;
 }
 
 /**
@@ -126,14 +243,38 @@ static void freeAllocations(void)
  **/
 static void processArgs(int argc, char *argv[])
 {
+  char  errBuf[ERRBUF_SIZE];
+  int   result;
   int   c;
-  char *optionString = "hbl:V";
+  char *optionString = "B:cdhI:ibl:n:pt:VW:z";
   while ((c = getopt_long(argc, argv, optionString, options, NULL)) != -1) {
     switch (c) {
+    case 'B':
+      baseFilename = optarg;
+      break;
+
+    case 'c':
+      compress = true;
+      break;
+
+    case 'd':
+      directOutput = true;
+      break;
+
     case 'h':
       printf("%s", helpString);
       exit(0);
 
+    case 'I':
+      if (parseUInt(optarg, 1, UINT_MAX, &maxIOPS) != VDO_SUCCESS) {
+        errx(1, "--max-iops must be a positive number");
+      }
+      break;
+
+    case 'i':
+      ioStats = true;
+      break;
+
     case 'b':
       noBlockMap = true;
       break;
@@ -146,17 +287,49 @@ static void processArgs(int argc, char *argv[])
       }
 
       noBlockMap = true;
-      int result = uds_parse_uint64(optarg, &lbns[lbnCount++]);
+      result = uds_parse_uint64(optarg, &lbns[lbnCount++]);
       if (result != VDO_SUCCESS) {
         warnx("Cannot parse LBN as a number");
         usage(argv[0]);
       }
       break;
 
+    case 'n':
+      result = setIOPriority(optarg);
+      if (result == VDO_OUT_OF_RANGE) {
+        errx(1, "--io-priority must be idle, best-effort[:<level>],"
+             " or realtime[:<level>]");
+      } else if (result != VDO_SUCCESS) {
+        errx(1, "Could not set the I/O priority: %s",
+             uds_string_error(result, errBuf, ERRBUF_SIZE));
+      }
+      break;
+
+    case 'p':
+      progress = true;
+      break;
+
+    case 't':
+      if (parseUInt(optarg, 0, MAX_THREADS, &threadCount) != VDO_SUCCESS) {
+        errx(1, "Thread count must be at most %u", MAX_THREADS);
+      }
+      break;
+
     case 'V':
       printf("%s version is: %s\n", argv[0], CURRENT_VERSION);
       exit(0);
 
+    case 'W':
+      if ((parseSize(optarg, false, &maxBandwidth) != VDO_SUCCESS)
+          || (maxBandwidth == 0)) {
+        errx(1, "--max-bandwidth must be a positive size");
+      }
+      break;
+
+    case 'z':
+      zeroCopy = true;
+      break;
+
     default:
       usage(argv[0]);
       break;
@@ -170,35 +343,144 @@ static void processArgs(int argc, char *argv[])
 
   vdoBacking     = argv[optind++];
   outputFilename = argv[optind++];
+
+  if (directOutput && (compress || (strcmp(outputFilename, "-") == 0))) {
+    errx(1, "--direct-output cannot be used with --compress or stdout");
+  }
+
+  if ((baseFilename != NULL) && (compress || directOutput)) {
+    errx(1, "--base cannot be used with --compress or --direct-output");
+  }
+
+  if (zeroCopy && (compress || directOutput || (baseFilename != NULL))) {
+    errx(1, "--zero-copy cannot be used with --compress, --direct-output,"
+         " or --base");
+  }
+}
+
+/**
+ * Open the base of an incremental dump and make a writer comparing the
+ * output against it.
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int makeDeltaOutput(void)
+{
+  int result = makeDumpLayer(baseFilename, &base);
+  if (result == VDO_NOT_IMPLEMENTED) {
+    result = makeReadOnlyFileLayer(baseFilename, &base);
+  }
+
+  if (result != VDO_SUCCESS) {
+    warnx("Could not open base dump '%s'", baseFilename);
+    return result;
+  }
+
+  return makeDeltaWriter(outputFilename, OUTPUT_BUFFER_BYTES, base,
+                         baseFilename, &output);
+}
+
+/**
+ * Note the next blocks of the dump in its table of contents.
+ *
+ * @param type       The type of metadata the blocks hold
+ * @param sourcePBN  Where the blocks are copied from
+ * @param count      How many blocks are about to be added to the dump
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int addRegion(DumpRegionType          type,
+                     physical_block_number_t sourcePBN,
+                     block_count_t           count)
+{
+  int result = addDumpRegion(&toc, type, dumpPosition, count, sourcePBN);
+  dumpPosition += count;
+  return result;
 }
 
 /**
  * Copy blocks from the VDO backing to the output file.
  *
+ * @param type        The type of metadata being copied
  * @param startBlock  The block to start at in the VDO backing
  * @param count       How many blocks to copy
  *
  * @return VDO_SUCCESS or an error
  **/
-static int copyBlocks(physical_block_number_t startBlock, block_count_t count)
+static int copyBlocks(DumpRegionType          type,
+                      physical_block_number_t startBlock,
+                      block_count_t           count)
 {
+  int result = addRegion(type, startBlock, count);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
   while ((count > 0)) {
     block_count_t blocksToWrite = min((block_count_t) STRIDE_LENGTH, count);
-    int result = vdo->layer->reader(vdo->layer, startBlock, blocksToWrite,
-                                    buffer);
+    char *space;
+    result = reserveCoalescedBlocks(output, blocksToWrite, &space);
     if (result != VDO_SUCCESS) {
       return result;
     }
-    result = write_buffer(outputFD, buffer, blocksToWrite * VDO_BLOCK_SIZE);
+
+    // Read straight into the output buffer to avoid a copy.
+    result = vdo->layer->reader(vdo->layer, startBlock, blocksToWrite, space);
     if (result != VDO_SUCCESS) {
       return result;
     }
+
+    commitCoalescedBlocks(output, blocksToWrite);
+    addProgress(blocksToWrite);
     startBlock += blocksToWrite;
     count      -= blocksToWrite;
   }
   return VDO_SUCCESS;
 }
 
+/**
+ * Copy a contiguous region which needs no inspection from the VDO backing to
+ * the output file, inside the kernel if --zero-copy was given and the kernel
+ * can do it, and through the output buffer otherwise.
+ *
+ * @param type        The type of metadata being copied
+ * @param startBlock  The block to start at in the VDO backing
+ * @param count       How many blocks to copy
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int copyRegion(DumpRegionType          type,
+                      physical_block_number_t startBlock,
+                      block_count_t           count)
+{
+  if (!zeroCopy) {
+    return copyBlocks(type, startBlock, count);
+  }
+
+  // Copy in chunks so that progress reports and throttling stay smooth.
+  for (block_count_t copied = 0; copied < count; ) {
+    block_count_t chunk = min((block_count_t) COPY_CHUNK_BLOCKS,
+                              count - copied);
+    int result = copyCoalescedBlocks(output, vdo->layer, startBlock + copied,
+                                     chunk);
+    if ((result == VDO_NOT_IMPLEMENTED) && (copied == 0)) {
+      // Nothing can be copied in the kernel, so stop trying.
+      warnx("Cannot copy in the kernel, copying through user space");
+      zeroCopy = false;
+      return copyBlocks(type, startBlock, count);
+    }
+
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    addProgress(chunk);
+    copied += chunk;
+  }
+
+  return addRegion(type, startBlock, count);
+}
+
 /**
  * Write a zero block to the output file.
  *
@@ -206,8 +488,20 @@ static int copyBlocks(physical_block_number_t startBlock, block_count_t count)
  **/
 static int zeroBlock(void)
 {
-  memset(buffer, 0, VDO_BLOCK_SIZE);
-  return write_buffer(outputFD, buffer, VDO_BLOCK_SIZE);
+  int result = addRegion(DUMP_REGION_BLOCK_MAP, VDO_ZERO_BLOCK, 1);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  char *space;
+  result = reserveCoalescedBlocks(output, 1, &space);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  memset(space, 0, VDO_BLOCK_SIZE);
+  commitCoalescedBlocks(output, 1);
+  return VDO_SUCCESS;
 }
 
 /**
@@ -226,7 +520,7 @@ static int copyPage(struct block_map_slot    slot __attribute__((unused)),
     return VDO_SUCCESS;
   }
 
-  int result = copyBlocks(pbn, 1);
+  int result = copyBlocks(DUMP_REGION_BLOCK_MAP, pbn, 1);
   if (result != VDO_SUCCESS) {
     warnx("Could not copy block map page %llu", (unsigned long long) pbn);
   }
@@ -237,7 +531,7 @@ static int copyPage(struct block_map_slot    slot __attribute__((unused)),
 static void dumpGeometryBlock(void)
 {
   // Copy the geometry block.
-  int result = copyBlocks(0, 1);
+  int result = copyBlocks(DUMP_REGION_GEOMETRY, 0, 1);
   if (result != VDO_SUCCESS) {
     errx(1, "Could not copy super block");
   }
@@ -253,7 +547,8 @@ static void dumpSuperBlock(void)
   }
 
   // Copy the super block.
-  result = copyBlocks(vdo_get_data_region_start(geometry), 1);
+  result = copyBlocks(DUMP_REGION_SUPER_BLOCK,
+                      vdo_get_data_region_start(geometry), 1);
   if (result != VDO_SUCCESS) {
     errx(1, "Could not copy super block");
   }
@@ -265,29 +560,32 @@ static void dumpBlockMap(void)
   if (!noBlockMap) {
     // Copy the block map.
     struct block_map_state_2_0 *map = &vdo->states.block_map;
-    int result = copyBlocks(map->root_origin, map->root_count);
+    setProgressPhase("block map", "blocks", 0);
+    int result = copyBlocks(DUMP_REGION_BLOCK_MAP, map->root_origin,
+                            map->root_count);
     if (result != VDO_SUCCESS) {
       errx(1, "Could not copy tree root block map pages");
     }
 
-    result = examineBlockMapEntries(vdo, copyPage);
+    result = examineBlockMapEntriesByHeight(vdo, copyPage);
     if (result != VDO_SUCCESS) {
       errx(1, "Could not copy allocated block map pages");
     }
   } else {
-    // Copy any specific block map pages requested.
-    for (size_t i = 0; i < lbnCount; i++) {
-      physical_block_number_t pagePBN;
-      int result = findLBNPage(vdo, lbns[i], &pagePBN);
-      if (result != VDO_SUCCESS) {
-        errx(1, "Could not read block map for LBN %llu",
-             (unsigned long long) lbns[i]);
-      }
+    // Copy any specific block map pages requested. The lookups are done
+    // together so that the tree pages they share are only read once.
+    physical_block_number_t pagePBNs[MAX_LBNS];
+    int result = findLBNPages(vdo, lbns, lbnCount, pagePBNs);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not read block map for the requested LBNs");
+    }
 
+    for (size_t i = 0; i < lbnCount; i++) {
+      physical_block_number_t pagePBN = pagePBNs[i];
       if (pagePBN == VDO_ZERO_BLOCK) {
         result = zeroBlock();
       } else {
-        result = copyBlocks(pagePBN, 1);
+        result = copyBlocks(DUMP_REGION_BLOCK_MAP, pagePBN, 1);
       }
       if (result != VDO_SUCCESS) {
         errx(1, "Could not copy block map for LBN %llu",
@@ -297,23 +595,196 @@ static void dumpBlockMap(void)
   }
 }
 
+/**
+ * Get the PBN of the first metadata block of a slab.
+ *
+ * @param slab  The slab number
+ *
+ * @return The slab's reference count origin
+ **/
+static physical_block_number_t getSlabMetadataOrigin(slab_count_t slab)
+{
+  const struct slab_depot_state_2_0 *depot = &vdo->states.slab_depot;
+  return (depot->first_block + (slab * vdo->states.vdo.config.slab_size)
+          + depot->slab_config.data_blocks);
+}
+
+/**
+ * Read the metadata of each slab claimed into that slab's buffer, staying
+ * no more than SLAB_BUFFERS slabs ahead of the writer.
+ *
+ * @param arg  The SlabCopy
+ **/
+static void readSlabs(void *arg)
+{
+  SlabCopy *copy = arg;
+  uds_lock_mutex(&copy->lock);
+  for (;;) {
+    while ((copy->nextToRead < vdo->slabCount)
+           && (copy->nextToRead >= copy->nextToWrite + SLAB_BUFFERS)) {
+      uds_wait_cond(&copy->changed, &copy->lock);
+    }
+
+    if (copy->nextToRead >= vdo->slabCount) {
+      break;
+    }
+
+    slab_count_t slab = copy->nextToRead++;
+    SlabBuffer *buffer = &copy->buffers[slab % SLAB_BUFFERS];
+    uds_unlock_mutex(&copy->lock);
+
+    int result = vdo->layer->reader(vdo->layer, getSlabMetadataOrigin(slab),
+                                    copy->slabBlocks, buffer->data);
+
+    uds_lock_mutex(&copy->lock);
+    buffer->result = result;
+    buffer->ready  = true;
+    uds_broadcast_cond(&copy->changed);
+  }
+  uds_unlock_mutex(&copy->lock);
+}
+
+/**
+ * Write a slab's metadata to the output file once it has been read.
+ *
+ * @param copy  The SlabCopy
+ * @param slab  The slab to write, which must be copy->nextToWrite
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int writeSlab(SlabCopy *copy, slab_count_t slab)
+{
+  SlabBuffer *buffer = &copy->buffers[slab % SLAB_BUFFERS];
+  uds_lock_mutex(&copy->lock);
+  while (!buffer->ready) {
+    uds_wait_cond(&copy->changed, &copy->lock);
+  }
+  uds_unlock_mutex(&copy->lock);
+
+  if (buffer->result != VDO_SUCCESS) {
+    return buffer->result;
+  }
+
+  int result = addRegion(DUMP_REGION_SLAB, getSlabMetadataOrigin(slab),
+                         copy->slabBlocks);
+  if (result != VDO_SUCCESS) {
+    return result;
+  }
+
+  for (block_count_t written = 0; written < copy->slabBlocks; ) {
+    block_count_t count = min((block_count_t) STRIDE_LENGTH,
+                              copy->slabBlocks - written);
+    char *space;
+    result = reserveCoalescedBlocks(output, count, &space);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+
+    memcpy(space, buffer->data + (written * VDO_BLOCK_SIZE),
+           count * VDO_BLOCK_SIZE);
+    commitCoalescedBlocks(output, count);
+    addProgress(count);
+    written += count;
+  }
+
+  // Hand the buffer back to the readers.
+  uds_lock_mutex(&copy->lock);
+  buffer->ready = false;
+  copy->nextToWrite++;
+  uds_broadcast_cond(&copy->changed);
+  uds_unlock_mutex(&copy->lock);
+  return VDO_SUCCESS;
+}
+
+/**
+ * Copy the slab metadata in the kernel, one slab at a time, stopping early
+ * if the kernel turns out not to be able to copy it.
+ *
+ * @param slabBlocks  The number of metadata blocks in each slab
+ *
+ * @return The number of slabs copied
+ **/
+static slab_count_t dumpSlabsInKernel(block_count_t slabBlocks)
+{
+  slab_count_t slab = 0;
+  while (zeroCopy && (slab < vdo->slabCount)) {
+    int result = copyRegion(DUMP_REGION_SLAB, getSlabMetadataOrigin(slab),
+                            slabBlocks);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not copy slab metadata");
+    }
+
+    slab++;
+  }
+
+  return slab;
+}
+
 /**********************************************************************/
 static void dumpSlabs(void)
 {
-  // Copy the slab metadata.
-  const struct slab_depot_state_2_0 depot = vdo->states.slab_depot;
-  const struct slab_config slabConfig = depot.slab_config;
-  block_count_t journalBlocks  = slabConfig.slab_journal_blocks;
-  block_count_t refCountBlocks = slabConfig.reference_count_blocks;
-  for (slab_count_t i = 0; i < vdo->slabCount; i++) {
-    physical_block_number_t slabStart
-      = depot.first_block + (i * vdo->states.vdo.config.slab_size);
-    physical_block_number_t origin = slabStart + slabConfig.data_blocks;
-    int result = copyBlocks(origin, refCountBlocks + journalBlocks);
+  // Copy the slab metadata. Slabs are spread across the whole device, so
+  // several are read at once, but they are written in order so that the
+  // dump is the same as if they had been copied one at a time.
+  const struct slab_config slabConfig = vdo->states.slab_depot.slab_config;
+  SlabCopy copy = {
+    .slabBlocks = (slabConfig.reference_count_blocks
+                   + slabConfig.slab_journal_blocks),
+  };
+  setProgressPhase("slabs", "blocks", copy.slabBlocks * vdo->slabCount);
+  if (zeroCopy) {
+    // The kernel does the reading, so there is nothing to read ahead, but
+    // if it can't, the readers pick up where it stopped.
+    copy.nextToRead  = dumpSlabsInKernel(copy.slabBlocks);
+    copy.nextToWrite = copy.nextToRead;
+    if (copy.nextToWrite == vdo->slabCount) {
+      return;
+    }
+  }
+
+  int result = uds_init_mutex(&copy.lock);
+  if (result == VDO_SUCCESS) {
+    result = uds_init_cond(&copy.changed);
+  }
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not initialize slab readers");
+  }
+
+  for (unsigned int i = 0; i < SLAB_BUFFERS; i++) {
+    result = vdo->layer->allocateIOBuffer(vdo->layer,
+                                          copy.slabBlocks * VDO_BLOCK_SIZE,
+                                          "slab metadata",
+                                          &copy.buffers[i].data);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not allocate slab metadata buffers");
+    }
+  }
+
+  struct thread *readers[SLAB_READERS];
+  for (unsigned int i = 0; i < SLAB_READERS; i++) {
+    result = uds_create_thread(readSlabs, &copy, "vdoSlabReader",
+                               &readers[i]);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not start slab readers");
+    }
+  }
+
+  for (slab_count_t i = copy.nextToWrite; i < vdo->slabCount; i++) {
+    result = writeSlab(&copy, i);
     if (result != VDO_SUCCESS) {
       errx(1, "Could not copy slab metadata");
     }
   }
+
+  for (unsigned int i = 0; i < SLAB_READERS; i++) {
+    uds_join_threads(readers[i]);
+  }
+
+  for (unsigned int i = 0; i < SLAB_BUFFERS; i++) {
+    UDS_FREE(copy.buffers[i].data);
+  }
+  uds_destroy_cond(&copy.changed);
+  uds_destroy_mutex(&copy.lock);
 }
 
 /**********************************************************************/
@@ -323,7 +794,10 @@ static void dumpRecoveryJournal(void)
   const struct partition *partition
     = getPartition(vdo, RECOVERY_JOURNAL_PARTITION,
                    "Could not copy recovery journal, no partition");
-  int result = copyBlocks(get_vdo_fixed_layout_partition_offset(partition),
+  setProgressPhase("recovery journal", "blocks",
+                   vdo->states.vdo.config.recovery_journal_size);
+  int result = copyRegion(DUMP_REGION_RECOVERY_JOURNAL,
+                          get_vdo_fixed_layout_partition_offset(partition),
                           vdo->states.vdo.config.recovery_journal_size);
   if (result != VDO_SUCCESS) {
     errx(1, "Could not copy recovery journal");
@@ -337,13 +811,48 @@ static void dumpSlabSummary(void)
   const struct partition *partition
     = getPartition(vdo, SLAB_SUMMARY_PARTITION,
                    "Could not copy slab summary, no partition");
-  int result = copyBlocks(get_vdo_fixed_layout_partition_offset(partition),
+  setProgressPhase("slab summary", "blocks",
+                   get_vdo_slab_summary_size(VDO_BLOCK_SIZE));
+  int result = copyRegion(DUMP_REGION_SLAB_SUMMARY,
+                          get_vdo_fixed_layout_partition_offset(partition),
                           get_vdo_slab_summary_size(VDO_BLOCK_SIZE));
   if (result != VDO_SUCCESS) {
     errx(1, "Could not copy slab summary");
   }
 }
 
+/**********************************************************************/
+static void dumpTableOfContents(void)
+{
+  // End the dump with the table of contents, so that readers can find
+  // everything in it.
+  block_count_t tocBlocks = getDumpTOCBlocks(&toc);
+  char *blocks;
+  int result = UDS_ALLOCATE(tocBlocks * VDO_BLOCK_SIZE, char, __func__,
+                            &blocks);
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not allocate the table of contents");
+  }
+
+  encodeDumpTOC(&toc, blocks);
+  for (block_count_t written = 0; written < tocBlocks; ) {
+    block_count_t count = min((block_count_t) STRIDE_LENGTH,
+                              tocBlocks - written);
+    char *space;
+    result = reserveCoalescedBlocks(output, count, &space);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not write the table of contents");
+    }
+
+    memcpy(space, blocks + (written * VDO_BLOCK_SIZE),
+           count * VDO_BLOCK_SIZE);
+    commitCoalescedBlocks(output, count);
+    written += count;
+  }
+
+  UDS_FREE(blocks);
+}
+
 /**********************************************************************/
 int main(int argc, char *argv[])
 {
@@ -364,23 +873,31 @@ int main(int argc, char *argv[])
   processArgs(argc, argv);
 
   // Read input VDO.
+  setVDOIOLimits(maxIOPS, maxBandwidth);
   result = makeVDOFromFile(vdoBacking, true, &vdo);
   if (result != VDO_SUCCESS) {
     errx(1, "Could not load VDO from '%s'", vdoBacking);
   }
 
-  // Allocate buffer for copies.
-  size_t copyBufferBytes = STRIDE_LENGTH * VDO_BLOCK_SIZE;
-  result = vdo->layer->allocateIOBuffer(vdo->layer, copyBufferBytes,
-                                        "copy buffer", &buffer);
+  // Open the dump output file.
+  if (baseFilename != NULL) {
+    result = makeDeltaOutput();
+  } else if (compress) {
+    result = makeCompressingWriter(outputFilename, OUTPUT_BUFFER_BYTES,
+                                   threadCount, &output);
+  } else {
+    result = makeCoalescingWriter(outputFilename, OUTPUT_BUFFER_BYTES,
+                                  directOutput, &output);
+  }
   if (result != VDO_SUCCESS) {
-    errx(1, "Could not allocate %zu bytes", copyBufferBytes);
+    errx(1, "Could not open output file '%s'", outputFilename);
   }
 
-  // Open the dump output file.
-  result = open_file(outputFilename, FU_CREATE_WRITE_ONLY, &outputFD);
-  if (result != UDS_SUCCESS) {
-    errx(1, "Could not open output file '%s'", outputFilename);
+  if (progress) {
+    result = startProgressReports(vdo->layer);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not start progress reports");
+    }
   }
 
   dumpGeometryBlock();
@@ -389,6 +906,17 @@ int main(int argc, char *argv[])
   dumpSlabs();
   dumpRecoveryJournal();
   dumpSlabSummary();
+  dumpTableOfContents();
+
+  stopProgressReports();
+  result = closeCoalescingWriter(&output);
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not write output file '%s'", outputFilename);
+  }
+
+  if (ioStats) {
+    printIOStatistics(stderr, vdo->layer);
+  }
 
   freeAllocations();
   exit(0);
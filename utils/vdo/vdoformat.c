@@ -30,12 +30,14 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
+#include <sys/wait.h>
 
 #include "uds.h"
 
 #include "errors.h"
 #include "fileUtils.h"
 #include "logger.h"
+#include "memoryAlloc.h"
 #include "stringUtils.h"
 #include "syscalls.h"
 #include "timeUtils.h"
@@ -47,23 +49,51 @@
 
 #include "fileLayer.h"
 #include "parseUtils.h"
+#include "progress.h"
 #include "userVDO.h"
 #include "vdoVolumeUtils.h"
 
 enum {
   MIN_SLAB_BITS        =  4,
   DEFAULT_SLAB_BITS    = 19,
+  /** The block map cache size of a vdo target which doesn't specify one */
+  DEFAULT_BLOCK_MAP_CACHE_BLOCKS = 32768,
+  /** The most devices --jobs may ask to format at once */
+  MAX_FORMAT_JOBS      = 256,
+};
+
+/**
+ * A device formatted along with others.
+ **/
+typedef struct {
+  char    *path;
+  pid_t    pid;
+  /** The file holding what the format of the device wrote to stdout */
+  FILE    *output;
+  /** When the format of the device was started */
+  ktime_t  start;
+  /** How long the format of the device took */
+  ktime_t  elapsed;
+  /** The exit status of the format of the device */
+  int      status;
+} FormatDevice;
+
+/** The index memory sizes which --plan considers, unless given one */
+static const char *PLANNED_MEMORY_SIZES[] = {
+  "0.25", "0.5", "0.75", "1", "2", "4", "8", "16",
 };
 
 
 static const char usageString[] =
-  " [--help] [options...] filename";
+  " [--help] [options...] [--jobs=<count>] filename...\n"
+  "       vdoformat --plan [--json] [options...]"
+  " {--physical-size=<size> | filename}";
 
 static const char helpString[] =
   "vdoformat - format a VDO device\n"
   "\n"
   "SYNOPSIS\n"
-  "  vdoformat [options] filename\n"
+  "  vdoformat [options] filename...\n"
   "\n"
   "DESCRIPTION\n"
   "  vdoformat formats the block device named by filename as a VDO device\n"
@@ -73,6 +103,12 @@ static const char helpString[] =
   "\n"
   "  vdoformat can also modify some of the formatting parameters.\n"
   "\n"
+  "  If more than one filename is given, each device is formatted with the\n"
+  "  same parameters, --jobs of them at once in separate processes. What\n"
+  "  each format prints is collected and written, labeled with the device,\n"
+  "  once it finishes, followed by whether it succeeded and how long it\n"
+  "  took. A device which cannot be formatted does not stop the others.\n"
+  "\n"
   "OPTIONS\n"
   "    --force\n"
   "       Format the block device, even if there is already a VDO formatted\n"
@@ -81,12 +117,34 @@ static const char helpString[] =
   "    --help\n"
   "       Print this help message and exit.\n"
   "\n"
+  "    --jobs=<count>\n"
+  "       With several devices, format at most <count> of them at once.\n"
+  "       By default, all of them are formatted at once.\n"
+  "\n"
+  "    --json\n"
+  "       With --plan, print the plan as JSON.\n"
+  "\n"
   "    --logical-size=<size>\n"
   "       Set the logical (provisioned) size of the VDO device to <size>.\n"
   "       A size suffix of K for kilobytes, M for megabytes, G for\n"
   "       gigabytes, T for terabytes, or P for petabytes is optional. The\n"
   "       default unit is megabytes.\n"
   "\n"
+  "    --physical-size=<size>\n"
+  "       With --plan, plan for a device of <size> rather than for the\n"
+  "       size of filename. Size suffixes are as for --logical-size.\n"
+  "\n"
+  "    --plan\n"
+  "       Write nothing, but print the metadata overhead, slab count,\n"
+  "       index size, block map size and memory needs of the VDO which\n"
+  "       each of a range of slab sizes and index memory sizes would\n"
+  "       produce. --slab-bits and --uds-memory-size restrict the plan\n"
+  "       to the given value.\n"
+  "\n"
+  "    --progress\n"
+  "       Report what is being written, its rate, and an estimate of when\n"
+  "       it will be done every few seconds.\n"
+  "\n"
   "    --slab-bits=<bits>\n"
   "      Set the free space allocator's slab size to 2^<bits> 4 KB blocks.\n"
   "      <bits> must be a value between 4 and 23 (inclusive), corresponding\n"
@@ -124,7 +182,12 @@ static const char helpString[] =
 static struct option options[] = {
   { "force",                    no_argument,       NULL, 'f' },
   { "help",                     no_argument,       NULL, 'h' },
+  { "jobs",                     required_argument, NULL, 'J' },
+  { "json",                     no_argument,       NULL, 'j' },
   { "logical-size",             required_argument, NULL, 'l' },
+  { "physical-size",            required_argument, NULL, 'P' },
+  { "plan",                     no_argument,       NULL, 'n' },
+  { "progress",                 no_argument,       NULL, 'p' },
   { "slab-bits",                required_argument, NULL, 'S' },
   { "uds-checkpoint-frequency", required_argument, NULL, 'c' },
   { "uds-memory-size",          required_argument, NULL, 'm' },
@@ -133,7 +196,15 @@ static struct option options[] = {
   { "version",                  no_argument,       NULL, 'V' },
   { NULL,                       0,                 NULL,  0  },
 };
-static char optionString[] = "fhil:S:c:m:svV";
+static char optionString[] = "fhiJ:jl:P:npS:c:m:svV";
+
+static uint64_t         logicalSize = 0; // defaults to physicalSize
+static unsigned int     slabBits    = DEFAULT_SLAB_BITS;
+static UdsConfigStrings configStrings;
+static bool             verbose     = false;
+static bool             force       = false;
+static bool             progress    = false;
+static unsigned int     jobCount    = 0;
 
 static void usage(const char *progname, const char *usageOptionsString)
 {
@@ -152,6 +223,171 @@ static void printReadableSize(size_t size)
   printf("%zu %s", size, UNITS[unit]);
 }
 
+/**
+ * Get the memory an index will use.
+ *
+ * @param indexConfig  The configuration of the index
+ *
+ * @return The number of bytes of memory configured for the index
+ **/
+static uint64_t getIndexMemory(const struct index_config *indexConfig)
+{
+  if (indexConfig->mem == UDS_MEMORY_CONFIG_256MB) {
+    return 256ULL << 20;
+  } else if (indexConfig->mem == UDS_MEMORY_CONFIG_512MB) {
+    return 512ULL << 20;
+  } else if (indexConfig->mem == UDS_MEMORY_CONFIG_768MB) {
+    return 768ULL << 20;
+  }
+
+  return ((uint64_t) indexConfig->mem) << 30;
+}
+
+/**
+ * Print the plans for a device for each combination of the slab sizes and
+ * index memory sizes considered, skipping those which couldn't be
+ * formatted.
+ *
+ * @param config         The configuration given, whose slab size is ignored
+ * @param configStrings  The index configuration given
+ * @param slabBits       The slab bits given, or 0 to consider all
+ * @param json           Whether to print JSON rather than a table
+ *
+ * @return VDO_SUCCESS, or an error if no combination could be formatted
+ **/
+static int planFormats(struct vdo_config config,
+                       UdsConfigStrings  configStrings,
+                       unsigned int      slabBits,
+                       bool              json)
+{
+  unsigned int firstBits = ((slabBits == 0) ? MIN_SLAB_BITS : slabBits);
+  unsigned int lastBits = ((slabBits == 0) ? MAX_VDO_SLAB_BITS : slabBits);
+  const char *const *memorySizes = PLANNED_MEMORY_SIZES;
+  unsigned int memoryCount = COUNT_OF(PLANNED_MEMORY_SIZES);
+  const char *givenSize = configStrings.memorySize;
+  if (givenSize != NULL) {
+    memorySizes = &givenSize;
+    memoryCount = 1;
+  }
+
+  if (json) {
+    printf("{\n  \"physicalBlocks\": %llu,\n  \"blockSize\": %u,\n"
+           "  \"plans\": [",
+           (unsigned long long) config.physical_blocks, VDO_BLOCK_SIZE);
+  } else {
+    printf("%9s %9s %6s %12s %12s %12s %12s %12s %12s\n", "slab size",
+           "index mem", "slabs", "index blocks", "overhead", "data blocks",
+           "logical", "forest", "cache bytes");
+  }
+
+  unsigned int planned = 0;
+  int lastError = VDO_SUCCESS;
+  for (unsigned int bits = firstBits; bits <= lastBits; bits++) {
+    // Slabs no bigger than their journals can't be formatted.
+    if ((1U << bits) <= config.slab_journal_blocks) {
+      lastError = VDO_BAD_CONFIGURATION;
+      continue;
+    }
+
+    for (unsigned int m = 0; m < memoryCount; m++) {
+      char memorySize[16];
+      snprintf(memorySize, sizeof(memorySize), "%s", memorySizes[m]);
+      configStrings.memorySize = memorySize;
+      struct index_config indexConfig;
+      int result = parseIndexConfig(&configStrings, &indexConfig);
+      if (result != VDO_SUCCESS) {
+        return result;
+      }
+
+      config.slab_size = 1 << bits;
+      VDOPlan plan;
+      result = planVDO(&config, &indexConfig, &plan);
+      if (result != VDO_SUCCESS) {
+        lastError = result;
+        continue;
+      }
+
+      // The cache which would hold every block map page at once.
+      uint64_t cacheBytes = plan.forestBlocks * VDO_BLOCK_SIZE;
+      if (json) {
+        printf("%s\n    { \"slabBits\": %u, \"slabBlocks\": %u,"
+               " \"indexMemory\": %llu, \"sparse\": %s,"
+               " \"slabCount\": %u, \"indexBlocks\": %llu,"
+               " \"overheadBlocks\": %llu, \"dataBlocks\": %llu,"
+               " \"logicalBlocks\": %llu, \"forestBlocks\": %llu,"
+               " \"fullBlockMapCacheBytes\": %llu,"
+               " \"defaultBlockMapCacheBytes\": %llu }",
+               ((planned == 0) ? "" : ","), bits,
+               (unsigned int) config.slab_size,
+               (unsigned long long) getIndexMemory(&indexConfig),
+               (indexConfig.sparse ? "true" : "false"), plan.slabCount,
+               (unsigned long long) plan.indexBlocks,
+               (unsigned long long) plan.overheadBlocks,
+               (unsigned long long) plan.dataBlocks,
+               (unsigned long long) plan.logicalBlocks,
+               (unsigned long long) plan.forestBlocks,
+               (unsigned long long) cacheBytes,
+               (unsigned long long) DEFAULT_BLOCK_MAP_CACHE_BLOCKS
+               * VDO_BLOCK_SIZE);
+      } else {
+        printf("%7lluMB %7lluMB %6u %12llu %12llu %12llu %12llu %12llu"
+               " %12llu\n",
+               ((unsigned long long) config.slab_size * VDO_BLOCK_SIZE) >> 20,
+               (unsigned long long) getIndexMemory(&indexConfig) >> 20,
+               plan.slabCount,
+               (unsigned long long) plan.indexBlocks,
+               (unsigned long long) plan.overheadBlocks,
+               (unsigned long long) plan.dataBlocks,
+               (unsigned long long) plan.logicalBlocks,
+               (unsigned long long) plan.forestBlocks,
+               (unsigned long long) cacheBytes);
+      }
+      planned++;
+    }
+  }
+
+  if (json) {
+    printf("%s]\n}\n", ((planned == 0) ? "" : "\n  "));
+  } else {
+    printf("Sizes are in %u byte blocks. A vdo target's block map cache is"
+           " %llu bytes\nunless configured otherwise; \"cache bytes\" would"
+           " hold the whole block map.\n", VDO_BLOCK_SIZE,
+           (unsigned long long) DEFAULT_BLOCK_MAP_CACHE_BLOCKS
+           * VDO_BLOCK_SIZE);
+  }
+
+  return ((planned > 0) ? VDO_SUCCESS : lastError);
+}
+
+/**
+ * Get the size of the device or file which would be planned for.
+ *
+ * @param filename  The name of the device or file
+ *
+ * @return The size in bytes
+ **/
+static uint64_t getPlannedSize(const char *filename)
+{
+  int fd;
+  int result = open_file(filename, FU_READ_ONLY, &fd);
+  if (result != UDS_SUCCESS) {
+    errx(result, "unable to open %s", filename);
+  }
+
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) != 0) {
+    errx(errno, "unable to get status of %s", filename);
+  }
+
+  uint64_t size = statbuf.st_size;
+  if (S_ISBLK(statbuf.st_mode) && (ioctl(fd, BLKGETSIZE64, &size) < 0)) {
+    errx(errno, "unable to get size of %s", filename);
+  }
+
+  try_close_file(fd);
+  return size;
+}
+
 /**********************************************************************/
 static void describeCapacity(const UserVDO *vdo,
                              uint64_t       logicalSize,
@@ -413,91 +649,15 @@ static int checkDeviceInUse(char *filename, uint32_t major, uint32_t minor)
   return VDO_SUCCESS;
 }
 
-/**********************************************************************/
-int main(int argc, char *argv[])
+/**********************************************************************
+ * Format one device, exiting with an error if it can't be formatted.
+ *
+ * @param filename  the name of the device to format
+ **/
+static void formatDevice(char *filename)
 {
-  static char errBuf[ERRBUF_SIZE];
-
-  int result = register_vdo_status_codes();
-  if (result != VDO_SUCCESS) {
-    errx(1, "Could not register status codes: %s",
-         uds_string_error(result, errBuf, ERRBUF_SIZE));
-  }
-
-  uint64_t     logicalSize  = 0; // defaults to physicalSize
-  unsigned int slabBits     = DEFAULT_SLAB_BITS;
-
-  UdsConfigStrings configStrings;
-  memset(&configStrings, 0, sizeof(configStrings));
-
-  int c;
-  uint64_t sizeArg;
-  static bool verbose = false;
-  static bool force   = false;
-
-  while ((c = getopt_long(argc, argv, optionString, options, NULL)) != -1) {
-    switch (c) {
-    case 'f':
-      force = true;
-      break;
-
-    case 'h':
-      printf("%s", helpString);
-      exit(0);
-      break;
-
-    case 'l':
-      result = parseSize(optarg, true, &sizeArg);
-      if (result != VDO_SUCCESS) {
-        usage(argv[0], usageString);
-      }
-      logicalSize = sizeArg;
-      break;
-
-    case 'S':
-      result = parseUInt(optarg, MIN_SLAB_BITS, MAX_VDO_SLAB_BITS, &slabBits);
-      if (result != VDO_SUCCESS) {
-        warnx("invalid slab bits, must be %u-%u",
-              MIN_SLAB_BITS, MAX_VDO_SLAB_BITS);
-        usage(argv[0], usageString);
-      }
-      break;
-
-    case 'c':
-      configStrings.checkpointFrequency = optarg;
-      break;
-
-    case 'm':
-      configStrings.memorySize = optarg;
-      break;
-
-    case 's':
-      configStrings.sparse = "1";
-      break;
-
-    case 'v':
-      verbose = true;
-      break;
-
-    case 'V':
-      fprintf(stdout, "vdoformat version is: %s\n", CURRENT_VERSION);
-      exit(0);
-      break;
-
-    default:
-      usage(argv[0], usageString);
-      break;
-    };
-  }
-
-  if (optind != (argc - 1)) {
-    usage(argv[0], usageString);
-  }
-
-  char *filename = argv[optind];
-
   struct stat statbuf;
-  result = logging_stat_missing_ok(filename, &statbuf, "Getting status");
+  int result = logging_stat_missing_ok(filename, &statbuf, "Getting status");
   if (result != UDS_SUCCESS && result != ENOENT) {
     errx(result, "unable to get status of %s", filename);
   }
@@ -577,19 +737,6 @@ int main(int argc, char *argv[])
          uds_string_error(result, errorBuffer, sizeof(errorBuffer)));
   }
 
-  // Zero out the UDS superblock in case there's already a UDS there.
-  char *zeroBuffer;
-  result = layer->allocateIOBuffer(layer, VDO_BLOCK_SIZE,
-                                   "zero buffer", &zeroBuffer);
-  if (result != VDO_SUCCESS) {
-    return result;
-  }
-
-  result = layer->writer(layer, 1, 1, zeroBuffer);
-  if (result != VDO_SUCCESS) {
-    return result;
-  }
-
   if (verbose) {
     if (logicalSize > 0) {
       printf("Formatting '%s' with %llu logical and %llu"
@@ -605,7 +752,15 @@ int main(int argc, char *argv[])
     }
   }
 
+  if (progress) {
+    result = startProgressReports(layer);
+    if (result != VDO_SUCCESS) {
+      errx(result, "unable to start progress reports");
+    }
+  }
+
   result = formatVDO(&config, &indexConfig, layer);
+  stopProgressReports();
   if (result != VDO_SUCCESS) {
     const char *extraHelp = "";
     if (result == VDO_TOO_MANY_SLABS) {
@@ -647,3 +802,328 @@ int main(int argc, char *argv[])
   // Close and sync the underlying file.
   layer->destroy(&layer);
 }
+
+/**********************************************************************
+ * Start formatting a device in a child process, whose stdout goes to a
+ * temporary file so that what it prints can be written all together once
+ * it has finished.
+ *
+ * @param device  the device to format
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int startDeviceFormat(FormatDevice *device)
+{
+  device->output = tmpfile();
+  if (device->output == NULL) {
+    return errno;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  device->start = current_time_ns(CLOCK_MONOTONIC);
+  device->pid = fork();
+  if (device->pid < 0) {
+    return errno;
+  }
+
+  if (device->pid > 0) {
+    return VDO_SUCCESS;
+  }
+
+  if (dup2(fileno(device->output), STDOUT_FILENO) < 0) {
+    _exit(2);
+  }
+
+  setProgressLabel(device->path);
+  formatDevice(device->path);
+  exit(0);
+}
+
+/**********************************************************************
+ * Report on a device whose format has finished: what it printed, each line
+ * labeled with the device, then whether it succeeded and how long it took.
+ *
+ * @param device  the device
+ * @param status  the status of the child process, from wait()
+ **/
+static void finishDeviceFormat(FormatDevice *device, int status)
+{
+  device->elapsed = ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+                              device->start);
+  device->status = (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+
+  char line[1024];
+  rewind(device->output);
+  bool lineStart = true;
+  while (fgets(line, sizeof(line), device->output) != NULL) {
+    printf("%s%s", (lineStart ? device->path : ""), (lineStart ? ": " : ""));
+    printf("%s", line);
+    lineStart = (line[strlen(line) - 1] == '\n');
+  }
+  if (!lineStart) {
+    printf("\n");
+  }
+  fclose(device->output);
+  device->output = NULL;
+
+  double seconds = (double) device->elapsed / NSEC_PER_SEC;
+  if (device->status == 0) {
+    printf("%s: formatted in %.1f seconds\n", device->path, seconds);
+  } else if (device->status > 0) {
+    printf("%s: FAILED with status %d after %.1f seconds\n", device->path,
+           device->status, seconds);
+  } else {
+    printf("%s: FAILED, formatting stopped abnormally after %.1f seconds\n",
+           device->path, seconds);
+  }
+  fflush(stdout);
+}
+
+/**********************************************************************
+ * Check that no device is named more than once, even by different paths,
+ * since formatting one device twice at once would corrupt it.
+ *
+ * @param devices  the devices
+ * @param count    the number of devices
+ **/
+static void checkDistinctDevices(const FormatDevice *devices, size_t count)
+{
+  dev_t *ids;
+  int result = UDS_ALLOCATE(count, dev_t, "device numbers", &ids);
+  if (result != UDS_SUCCESS) {
+    errx(result, "cannot allocate device numbers");
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    struct stat statbuf;
+    if (stat(devices[i].path, &statbuf) != 0) {
+      // The format of this device will report it.
+      ids[i] = 0;
+      continue;
+    }
+
+    ids[i] = (S_ISBLK(statbuf.st_mode) ? statbuf.st_rdev : 0);
+    for (size_t j = 0; j < i; j++) {
+      if ((ids[i] != 0) && (ids[i] == ids[j])) {
+        errx(1, "%s and %s are the same device", devices[j].path,
+             devices[i].path);
+      }
+    }
+  }
+
+  UDS_FREE(ids);
+}
+
+/**********************************************************************
+ * Format several devices with the same parameters, each in its own process
+ * so that their signature checks, holder checks and formats all proceed at
+ * once, and report how each went.
+ *
+ * @param paths  the names of the devices
+ * @param count  the number of devices
+ *
+ * @return the exit status: 0 if every device was formatted, 1 if not
+ **/
+static int formatDevices(char **paths, size_t count)
+{
+  static char errBuf[ERRBUF_SIZE];
+
+  FormatDevice *devices;
+  int result = UDS_ALLOCATE(count, FormatDevice, "devices", &devices);
+  if (result != UDS_SUCCESS) {
+    errx(result, "cannot allocate devices");
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    devices[i].path = paths[i];
+  }
+  checkDistinctDevices(devices, count);
+
+  unsigned int jobs = ((jobCount == 0) ? MAX_FORMAT_JOBS : jobCount);
+  jobs = min(jobs, (unsigned int) count);
+
+  ktime_t      start   = current_time_ns(CLOCK_MONOTONIC);
+  size_t       next    = 0;
+  unsigned int running = 0;
+  while ((next < count) || (running > 0)) {
+    while ((next < count) && (running < jobs)) {
+      result = startDeviceFormat(&devices[next]);
+      if (result != VDO_SUCCESS) {
+        errx(1, "Could not start formatting '%s': %s", devices[next].path,
+             uds_string_error(result, errBuf, ERRBUF_SIZE));
+      }
+
+      next++;
+      running++;
+    }
+
+    int   status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      err(1, "Could not wait for the formats");
+    }
+
+    for (size_t i = 0; i < next; i++) {
+      if (devices[i].pid == pid) {
+        finishDeviceFormat(&devices[i], status);
+        running--;
+        break;
+      }
+    }
+  }
+
+  size_t formatted = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (devices[i].status == 0) {
+      formatted++;
+    }
+  }
+
+  ktime_t elapsed = ktime_sub(current_time_ns(CLOCK_MONOTONIC), start);
+  printf("%zu devices: %zu formatted, %zu failed, in %.1f seconds\n",
+         count, formatted, count - formatted,
+         (double) elapsed / NSEC_PER_SEC);
+  UDS_FREE(devices);
+  return ((formatted == count) ? 0 : 1);
+}
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+  static char errBuf[ERRBUF_SIZE];
+
+  int result = register_vdo_status_codes();
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not register status codes: %s",
+         uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+
+  int c;
+  uint64_t sizeArg;
+  static bool plan     = false;
+  static bool json     = false;
+  bool slabBitsGiven   = false;
+  uint64_t plannedSize = 0;
+
+  while ((c = getopt_long(argc, argv, optionString, options, NULL)) != -1) {
+    switch (c) {
+    case 'f':
+      force = true;
+      break;
+
+    case 'h':
+      printf("%s", helpString);
+      exit(0);
+      break;
+
+    case 'J':
+      result = parseUInt(optarg, 1, MAX_FORMAT_JOBS, &jobCount);
+      if (result != VDO_SUCCESS) {
+        warnx("invalid jobs, must be 1-%u", MAX_FORMAT_JOBS);
+        usage(argv[0], usageString);
+      }
+      break;
+
+    case 'l':
+      result = parseSize(optarg, true, &sizeArg);
+      if (result != VDO_SUCCESS) {
+        usage(argv[0], usageString);
+      }
+      logicalSize = sizeArg;
+      break;
+
+    case 'j':
+      json = true;
+      break;
+
+    case 'n':
+      plan = true;
+      break;
+
+    case 'P':
+      result = parseSize(optarg, true, &plannedSize);
+      if (result != VDO_SUCCESS) {
+        usage(argv[0], usageString);
+      }
+      break;
+
+    case 'p':
+      progress = true;
+      break;
+
+    case 'S':
+      result = parseUInt(optarg, MIN_SLAB_BITS, MAX_VDO_SLAB_BITS, &slabBits);
+      if (result != VDO_SUCCESS) {
+        warnx("invalid slab bits, must be %u-%u",
+              MIN_SLAB_BITS, MAX_VDO_SLAB_BITS);
+        usage(argv[0], usageString);
+      }
+      slabBitsGiven = true;
+      break;
+
+    case 'c':
+      configStrings.checkpointFrequency = optarg;
+      break;
+
+    case 'm':
+      configStrings.memorySize = optarg;
+      break;
+
+    case 's':
+      configStrings.sparse = "1";
+      break;
+
+    case 'v':
+      verbose = true;
+      break;
+
+    case 'V':
+      fprintf(stdout, "vdoformat version is: %s\n", CURRENT_VERSION);
+      exit(0);
+      break;
+
+    default:
+      usage(argv[0], usageString);
+      break;
+    };
+  }
+
+  if (plan) {
+    if (optind == (argc - 1)) {
+      plannedSize = getPlannedSize(argv[optind]);
+    } else if ((optind != argc) || (plannedSize == 0)) {
+      usage(argv[0], usageString);
+    }
+
+    struct vdo_config config = {
+      .logical_blocks        = logicalSize / VDO_BLOCK_SIZE,
+      .physical_blocks       = min(plannedSize / VDO_BLOCK_SIZE,
+                                   (uint64_t) MAXIMUM_VDO_PHYSICAL_BLOCKS),
+      .slab_journal_blocks   = DEFAULT_VDO_SLAB_JOURNAL_SIZE,
+      .recovery_journal_size = DEFAULT_VDO_RECOVERY_JOURNAL_SIZE,
+    };
+    result = planFormats(config, configStrings,
+                         (slabBitsGiven ? slabBits : 0), json);
+    if (result != VDO_SUCCESS) {
+      errx(result, "no VDO can be formatted with this configuration: %s",
+           uds_string_error(result, errBuf, ERRBUF_SIZE));
+    }
+    exit(0);
+  }
+
+  if (optind == argc) {
+    usage(argv[0], usageString);
+  }
+
+  if (optind == (argc - 1)) {
+    formatDevice(argv[optind]);
+    exit(0);
+  }
+
+  exit(formatDevices(&argv[optind], argc - optind));
+}
@@ -21,8 +21,10 @@
 
 #include <err.h>
 #include <getopt.h>
+#include <stdlib.h>
 
 #include "errors.h"
+#include "memoryAlloc.h"
 #include "syscalls.h"
 
 #include "blockMapFormat.h"
@@ -32,16 +34,20 @@
 #include "statusCodes.h"
 #include "types.h"
 
+#include "parseUtils.h"
 #include "userVDO.h"
 #include "vdoVolumeUtils.h"
 
-static const char usageString[] = "[--help] [--version] <vdoBackingDevice>";
+static const char usageString[]
+  = "[--help] [--version] [--extents [--shards=<count>]] [--cache=<file>]"
+    " <vdoBackingDevice>";
 
 static const char helpString[] =
   "vdoListMetadata - list the metadata regions on a VDO device\n"
   "\n"
   "SYNOPSIS\n"
-  "  vdoListMetadata <vdoBackingDevice>\n"
+  "  vdoListMetadata [--extents [--shards=<count>]] [--cache=<file>]\n"
+  "                  <vdoBackingDevice>\n"
   "\n"
   "DESCRIPTION\n"
   "  vdoListMetadata lists the metadata regions of a VDO device\n"
@@ -50,16 +56,46 @@ static const char helpString[] =
   "    startBlock .. endBlock: label\n"
   "  Both endpoints are included in the range, and are the zero-based\n"
   "  indexes of 4KB VDO metadata blocks on the backing device.\n"
+  "\n"
+  "  --extents merges adjacent regions and lists the fewest ranges which\n"
+  "  cover all of the metadata, in block order, each labeled \"extent\".\n"
+  "\n"
+  "  --shards splits the extents into the given number of shards of as\n"
+  "  nearly equal size as possible, splitting an extent where a shard\n"
+  "  boundary falls inside it. Each range is labeled \"shard <n>\", and\n"
+  "  the ranges of each shard are consecutive. --shards implies --extents.\n"
+  "\n"
+  "  If --cache is specified, the snapshot cache <file> is checked\n"
+  "  against the VDO, and is written without the block map if it is not\n"
+  "  current. See vdoAudit for details.\n"
   "\n";
 
 static struct option options[] = {
-  { "help",    no_argument, NULL, 'h' },
-  { "version", no_argument, NULL, 'V' },
-  { NULL,      0,           NULL,  0  },
+  { "cache",   required_argument, NULL, 'C' },
+  { "help",    no_argument,       NULL, 'h' },
+  { "extents", no_argument,       NULL, 'e' },
+  { "shards",  required_argument, NULL, 's' },
+  { "version", no_argument,       NULL, 'V' },
+  { NULL,      0,                 NULL,  0  },
 };
 
-static char    *vdoBackingName = NULL;
-static UserVDO *vdo            = NULL;
+enum {
+  MAX_SHARDS = 1024,
+};
+
+typedef struct {
+  physical_block_number_t start;
+  block_count_t           count;
+} Extent;
+
+static char         *vdoBackingName = NULL;
+static const char   *cachePath      = NULL;
+static UserVDO      *vdo            = NULL;
+
+static bool          listExtents    = false;
+static unsigned int  shardCount     = 1;
+static Extent       *extents        = NULL;
+static size_t        extentCount    = 0;
 
 /**
  * Explain how this command-line tool is used.
@@ -81,12 +117,27 @@ static void usage(const char *programName)
 static void processArgs(int argc, char *argv[])
 {
   int c;
-  while ((c = getopt_long(argc, argv, "hV", options, NULL)) != -1) {
+  while ((c = getopt_long(argc, argv, "C:ehs:V", options, NULL)) != -1) {
     switch (c) {
+    case 'C':
+      cachePath = optarg;
+      break;
+
+    case 'e':
+      listExtents = true;
+      break;
+
     case 'h':
       printf("%s", helpString);
       exit(0);
 
+    case 's':
+      if (parseUInt(optarg, 1, MAX_SHARDS, &shardCount) != VDO_SUCCESS) {
+        errx(1, "Shard count must be between 1 and %u", MAX_SHARDS);
+      }
+      listExtents = true;
+      break;
+
     case 'V':
       printf("%s version is: %s\n", argv[0], CURRENT_VERSION);
       exit(0);
@@ -106,7 +157,8 @@ static void processArgs(int argc, char *argv[])
 }
 
 /**
- * List a range of metadata blocks on stdout.
+ * List a range of metadata blocks on stdout, or save it to be merged into
+ * extents if listing extents.
  *
  * @param label       The type of metadata
  * @param startBlock  The block to start at in the VDO backing device
@@ -116,7 +168,100 @@ static void listBlocks(const char              *label,
                        physical_block_number_t  startBlock,
                        block_count_t            count)
 {
-  printf("%ld .. %ld: %s\n", startBlock, startBlock + count - 1, label);
+  if (!listExtents) {
+    printf("%ld .. %ld: %s\n", startBlock, startBlock + count - 1, label);
+    return;
+  }
+
+  if (count > 0) {
+    extents[extentCount++] = (Extent) {
+      .start = startBlock,
+      .count = count,
+    };
+  }
+}
+
+/**********************************************************************/
+static int compareExtents(const void *a, const void *b)
+{
+  const Extent *extent1 = a;
+  const Extent *extent2 = b;
+  if (extent1->start == extent2->start) {
+    return 0;
+  }
+
+  return ((extent1->start < extent2->start) ? -1 : 1);
+}
+
+/**
+ * Sort the saved ranges and merge those which touch or overlap, so that
+ * the fewest extents remain.
+ *
+ * @return The total number of blocks in the extents
+ **/
+static block_count_t mergeExtents(void)
+{
+  if (extentCount == 0) {
+    return 0;
+  }
+
+  qsort(extents, extentCount, sizeof(Extent), compareExtents);
+  size_t merged = 0;
+  for (size_t i = 1; i < extentCount; i++) {
+    Extent *last = &extents[merged];
+    physical_block_number_t end = last->start + last->count;
+    if (extents[i].start <= end) {
+      physical_block_number_t newEnd = extents[i].start + extents[i].count;
+      if (newEnd > end) {
+        last->count = newEnd - last->start;
+      }
+      continue;
+    }
+
+    extents[++merged] = extents[i];
+  }
+
+  extentCount = merged + 1;
+  block_count_t total = 0;
+  for (size_t i = 0; i < extentCount; i++) {
+    total += extents[i].count;
+  }
+
+  return total;
+}
+
+/**
+ * List the merged extents, divided into shards. Shard n covers the blocks
+ * from n * total / shardCount up to (n + 1) * total / shardCount of the
+ * extents taken in order, so no two shards differ in size by more than a
+ * block.
+ *
+ * @param total  The total number of blocks in the extents
+ **/
+static void listShards(block_count_t total)
+{
+  size_t extent = 0;
+  block_count_t used = 0;
+  for (unsigned int shard = 0; shard < shardCount; shard++) {
+    block_count_t remaining
+      = (((shard + 1) * total / shardCount) - (shard * total / shardCount));
+    while (remaining > 0) {
+      block_count_t count = min(remaining, extents[extent].count - used);
+      physical_block_number_t start = extents[extent].start + used;
+      if (shardCount == 1) {
+        printf("%ld .. %ld: extent\n", start, start + count - 1);
+      } else {
+        printf("%ld .. %ld: shard %u\n", start, start + count - 1, shard);
+      }
+
+      remaining -= count;
+      used += count;
+      if (used == extents[extent].count) {
+        extent++;
+        used = 0;
+      }
+    }
+  }
 }
 
 /**********************************************************************/
@@ -206,11 +351,20 @@ int main(int argc, char *argv[])
   processArgs(argc, argv);
 
   // Read input VDO, without validating its config.
-  result = readVDOWithoutValidation(vdoBackingName, &vdo);
+  result = loadVDOWithSnapshot(vdoBackingName, false, cachePath, false, &vdo);
   if (result != VDO_SUCCESS) {
     errx(1, "Could not load VDO from '%s'", vdoBackingName);
   }
 
+  if (listExtents) {
+    // Every slab has two ranges, and there are at most six others.
+    result = UDS_ALLOCATE(6 + (2 * (size_t) vdo->slabCount), Extent,
+                          __func__, &extents);
+    if (result != VDO_SUCCESS) {
+      errx(1, "Could not allocate extents");
+    }
+  }
+
   listGeometryBlock();
   listIndex();
   listSuperBlock();
@@ -218,6 +372,10 @@ int main(int argc, char *argv[])
   listSlabs();
   listRecoveryJournal();
   listSlabSummary();
+  if (listExtents) {
+    listShards(mergeExtents());
+    UDS_FREE(extents);
+  }
 
   freeVDOFromFile(&vdo);
   exit(0);
@@ -0,0 +1,923 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/vdoMakeImage.c#1 $
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "errors.h"
+#include "fileUtils.h"
+#include "logger.h"
+#include "memoryAlloc.h"
+#include "stringUtils.h"
+#include "syscalls.h"
+
+#include "blockMapEntry.h"
+#include "blockMapPage.h"
+#include "constants.h"
+#include "packedReferenceBlock.h"
+#include "slabSummaryFormat.h"
+#include "statusCodes.h"
+#include "types.h"
+#include "vdoState.h"
+
+#include "blockMapUtils.h"
+#include "fileLayer.h"
+#include "parseUtils.h"
+#include "slabSummaryReader.h"
+#include "userVDO.h"
+#include "vdoConfig.h"
+
+enum {
+  MIN_SLAB_BITS     = 4,
+  DEFAULT_SLAB_BITS = 19,
+  // The number of recently written data blocks which new mappings may share.
+  RECENT_BLOCKS     = 1024,
+  // The number of heights of interior pages between the leaves and roots.
+  INTERIOR_HEIGHTS  = VDO_BLOCK_MAP_TREE_HEIGHT - 2,
+};
+
+/** The kinds of inconsistency which may be injected into an image */
+typedef enum {
+  INJECT_REF_COUNT,
+  INJECT_SUMMARY,
+  INJECT_MAPPING,
+  INJECT_LBN_COUNT,
+  INJECT_KINDS,
+} InjectionKind;
+
+static const char *injectionNames[INJECT_KINDS] = {
+  "refcount",
+  "summary",
+  "mapping",
+  "lbn-count",
+};
+
+/** A data location which later mappings may share */
+typedef struct {
+  physical_block_number_t  pbn;
+  enum block_mapping_state state;
+} RecentBlock;
+
+/**
+ * The interior pages of a tree which are still being filled in, indexed
+ * from height 1 up.
+ **/
+typedef struct {
+  /** The index within the tree's height of each open page, plus one */
+  page_number_t           indexes[INTERIOR_HEIGHTS];
+  /** The PBN of each open page */
+  physical_block_number_t pbns[INTERIOR_HEIGHTS];
+  /** The open pages, followed by the root */
+  struct block_map_page  *pages[INTERIOR_HEIGHTS + 1];
+} OpenTree;
+
+static const char usageString[]
+  = " [--help] --physical-size=<size> [--logical-size=<size>]"
+    " [--slab-bits=<bits>] [--fill=<percent>] [--dedupe-ratio=<ratio>]"
+    " [--compression-ratio=<ratio>] [--inject=<kind>[:<count>]]"
+    " [--seed=<number>] [--force] [--verbose] [--version] filename";
+
+static const char helpString[] =
+  "vdomakeimage - generate a synthetic VDO image\n"
+  "\n"
+  "SYNOPSIS\n"
+  "  vdomakeimage --physical-size=<size> [--logical-size=<size>]\n"
+  "               [--slab-bits=<bits>] [--fill=<percent>]\n"
+  "               [--dedupe-ratio=<ratio>] [--compression-ratio=<ratio>]\n"
+  "               [--inject=<kind>[:<count>]] [--seed=<number>]\n"
+  "               [--force] [--verbose] <filename>\n"
+  "\n"
+  "DESCRIPTION\n"
+  "  vdomakeimage creates <filename> as a sparse file, formats a VDO in\n"
+  "  it, and then writes the block map trees, reference counts and slab\n"
+  "  summary of a VDO which has had data written to it, leaving the\n"
+  "  VDO cleanly shut down. Only metadata is written, so the image takes\n"
+  "  up little more space than its block map, however large the VDO is.\n"
+  "  The data blocks are never written and read back as zeros.\n"
+  "\n"
+  "  It is meant for measuring and testing the VDO metadata tools at\n"
+  "  scale; the image is not of any customer's volume.\n"
+  "\n"
+  "OPTIONS\n"
+  "    --compression-ratio=<ratio>\n"
+  "       Store an average of <ratio> distinct blocks in each data block,\n"
+  "       packing those after the first as compressed fragments. <ratio>\n"
+  "       must be between 1 (the default, no compression) and 14.\n"
+  "\n"
+  "    --dedupe-ratio=<ratio>\n"
+  "       Map an average of <ratio> logical blocks to each distinct\n"
+  "       block, each duplicate sharing one of the recently written\n"
+  "       blocks. <ratio> must be at least 1, the default.\n"
+  "\n"
+  "    --fill=<percent>\n"
+  "       Map <percent> of the logical blocks, in whole block map pages\n"
+  "       spread evenly across the logical space. The default is 50.\n"
+  "\n"
+  "    --force\n"
+  "       Overwrite <filename> if it exists.\n"
+  "\n"
+  "    --help\n"
+  "       Print this help message and exit.\n"
+  "\n"
+  "    --inject=<kind>[:<count>]\n"
+  "       Make <count> (by default 1) known inconsistencies of a kind in\n"
+  "       the image, each in a random place. This may be given more than\n"
+  "       once. The kinds are:\n"
+  "         refcount   a stored reference count one more than it should be\n"
+  "         summary    a slab summary fullness hint which is far off\n"
+  "         mapping    a mapping to a block past the end of the volume\n"
+  "         lbn-count  <count> too many logical blocks used recorded in\n"
+  "                    the super block\n"
+  "\n"
+  "    --logical-size=<size>\n"
+  "       Specify the logical size of the VDO. The default is the most\n"
+  "       which would fit in the physical size without deduplication or\n"
+  "       compression, as for vdoformat.\n"
+  "\n"
+  "    --physical-size=<size>\n"
+  "       Specify the size of the image. This is required.\n"
+  "\n"
+  "    --seed=<number>\n"
+  "       Seed the choices of duplicates and injection sites, so that the\n"
+  "       same options always make the same image.\n"
+  "\n"
+  "    --slab-bits=<bits>\n"
+  "       Set the slab size to 2^<bits> 4 KB blocks, as for vdoformat.\n"
+  "       The default is 19.\n"
+  "\n"
+  "    --verbose\n"
+  "       Describe each inconsistency as it is injected.\n"
+  "\n"
+  "    --version\n"
+  "       Show the version of vdomakeimage.\n"
+  "\n";
+
+// N.B. the option array must be in sync with the option string.
+static struct option options[] = {
+  { "compression-ratio", required_argument, NULL, 'c' },
+  { "dedupe-ratio",      required_argument, NULL, 'd' },
+  { "fill",              required_argument, NULL, 'F' },
+  { "force",             no_argument,       NULL, 'f' },
+  { "help",              no_argument,       NULL, 'h' },
+  { "inject",            required_argument, NULL, 'i' },
+  { "logical-size",      required_argument, NULL, 'l' },
+  { "physical-size",     required_argument, NULL, 'P' },
+  { "seed",              required_argument, NULL, 'r' },
+  { "slab-bits",         required_argument, NULL, 'S' },
+  { "verbose",           no_argument,       NULL, 'v' },
+  { "version",           no_argument,       NULL, 'V' },
+  { NULL,                0,                 NULL,  0  },
+};
+static char optionString[] = "c:d:F:fhi:l:P:r:S:vV";
+
+static const char *filename;
+static uint64_t     physicalSize     = 0;
+static uint64_t     logicalSize      = 0;
+static unsigned int slabBits         = DEFAULT_SLAB_BITS;
+static double       fillFraction     = 0.5;
+static double       dedupeRatio      = 1.0;
+static double       compressionRatio = 1.0;
+static uint64_t     randomState      = 0x9e3779b97f4a7c15ULL;
+static bool         force            = false;
+static bool         verbose          = false;
+static uint64_t     injections[INJECT_KINDS];
+
+static UserVDO       *vdo            = NULL;
+static block_count_t  slabDataBlocks = 0;
+
+// The slab being allocated from, and the reference counts of its blocks.
+static slab_count_t             currentSlab = 0;
+static physical_block_number_t  slabOrigin  = 0;
+static slab_block_number        nextBlock   = 0;
+static vdo_refcount_t          *refCounts   = NULL;
+static char                    *refBuffer   = NULL;
+static struct slab_summary_entry *summary   = NULL;
+
+// The blocks of the current slab which later mappings may share.
+static RecentBlock   recentBlocks[RECENT_BLOCKS];
+static unsigned int  recentCount = 0;
+
+// The compressed block being filled with fragments.
+static physical_block_number_t compressedPBN   = VDO_ZERO_BLOCK;
+static unsigned int            nextFragment    = 0;
+static unsigned int            fragmentsLeft   = 0;
+
+// Bresenham accumulators for the dedupe and compression ratios.
+static double uniqueCredit   = 0;
+static double fragmentCredit = 0;
+
+static OpenTree              *trees    = NULL;
+static struct block_map_page *leafPage = NULL;
+
+// What was generated.
+static block_count_t mappedBlocks     = 0;
+static block_count_t dataBlocks       = 0;
+static block_count_t compressedBlocks = 0;
+static block_count_t fragments        = 0;
+static block_count_t treePages        = 0;
+static slab_count_t  usedSlabs        = 0;
+
+/**********************************************************************/
+static void usage(const char *progname, const char *usageOptionsString)
+{
+  errx(1, "Usage: %s%s\n", progname, usageOptionsString);
+}
+
+/**
+ * Get the next number from the generator's random number sequence
+ * (xorshift64*), which --seed starts.
+ **/
+static uint64_t nextRandom(void)
+{
+  randomState ^= randomState >> 12;
+  randomState ^= randomState << 25;
+  randomState ^= randomState >> 27;
+  return randomState * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * Parse a ratio option.
+ **/
+static double parseRatio(const char *arg, double highest, const char *name)
+{
+  char *end;
+  double ratio = strtod(arg, &end);
+  if ((*end != '\0') || !(ratio >= 1.0) || (ratio > highest)) {
+    errx(1, "invalid %s '%s'", name, arg);
+  }
+
+  return ratio;
+}
+
+/**
+ * Parse an --inject option of the form <kind>[:<count>].
+ **/
+static void parseInjection(const char *arg)
+{
+  size_t nameLength = strcspn(arg, ":");
+  for (InjectionKind kind = 0; kind < INJECT_KINDS; kind++) {
+    if ((strlen(injectionNames[kind]) != nameLength)
+        || (strncmp(arg, injectionNames[kind], nameLength) != 0)) {
+      continue;
+    }
+
+    uint64_t count = 1;
+    if ((arg[nameLength] == ':')
+        && (uds_parse_uint64(arg + nameLength + 1, &count) != UDS_SUCCESS)) {
+      errx(1, "invalid injection count in '%s'", arg);
+    }
+
+    injections[kind] += count;
+    return;
+  }
+
+  errx(1, "unknown injection '%s'", arg);
+}
+
+/**********************************************************************/
+static void processArgs(int argc, char *argv[])
+{
+  int c;
+  uint64_t seed;
+  double percent;
+  char *end;
+  while ((c = getopt_long(argc, argv, optionString, options, NULL)) != -1) {
+    switch (c) {
+    case 'c':
+      compressionRatio = parseRatio(optarg, VDO_MAX_COMPRESSION_SLOTS,
+                                    "compression ratio");
+      break;
+
+    case 'd':
+      dedupeRatio = parseRatio(optarg, MAXIMUM_REFERENCE_COUNT,
+                               "dedupe ratio");
+      break;
+
+    case 'F':
+      percent = strtod(optarg, &end);
+      if ((*end != '\0') || !(percent >= 0) || (percent > 100)) {
+        errx(1, "invalid fill percentage '%s'", optarg);
+      }
+      fillFraction = percent / 100;
+      break;
+
+    case 'f':
+      force = true;
+      break;
+
+    case 'h':
+      printf("%s", helpString);
+      exit(0);
+      break;
+
+    case 'i':
+      parseInjection(optarg);
+      break;
+
+    case 'l':
+      if (parseSize(optarg, true, &logicalSize) != VDO_SUCCESS) {
+        usage(argv[0], usageString);
+      }
+      break;
+
+    case 'P':
+      if (parseSize(optarg, true, &physicalSize) != VDO_SUCCESS) {
+        usage(argv[0], usageString);
+      }
+      break;
+
+    case 'r':
+      if (uds_parse_uint64(optarg, &seed) != UDS_SUCCESS) {
+        errx(1, "invalid seed '%s'", optarg);
+      }
+      // A xorshift generator must not start from zero.
+      randomState ^= seed * 0xbf58476d1ce4e5b9ULL;
+      if (randomState == 0) {
+        randomState = 1;
+      }
+      break;
+
+    case 'S':
+      if (parseUInt(optarg, MIN_SLAB_BITS, MAX_VDO_SLAB_BITS, &slabBits)
+          != VDO_SUCCESS) {
+        warnx("invalid slab bits, must be %u-%u",
+              MIN_SLAB_BITS, MAX_VDO_SLAB_BITS);
+        usage(argv[0], usageString);
+      }
+      break;
+
+    case 'v':
+      verbose = true;
+      break;
+
+    case 'V':
+      fprintf(stdout, "vdomakeimage version is: %s\n", CURRENT_VERSION);
+      exit(0);
+      break;
+
+    default:
+      usage(argv[0], usageString);
+      break;
+    };
+  }
+
+  if ((optind != (argc - 1)) || (physicalSize == 0)) {
+    usage(argv[0], usageString);
+  }
+
+  filename = argv[optind];
+}
+
+/**********************************************************************/
+static void checkResult(int result, const char *what)
+{
+  if (result != VDO_SUCCESS) {
+    char errBuf[ERRBUF_SIZE];
+    errx(1, "%s: %s", what, uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+}
+
+/**
+ * Create the image file at its full size, which leaves it entirely sparse,
+ * and format a VDO in it.
+ *
+ * @return The layer of the new VDO
+ **/
+static PhysicalLayer *formatImage(void)
+{
+  bool exists;
+  checkResult(file_exists(filename, &exists), "Could not check the image");
+  if (exists && !force) {
+    errx(1, "'%s' exists; use --force to overwrite it", filename);
+  }
+
+  block_count_t physicalBlocks
+    = min(physicalSize / VDO_BLOCK_SIZE,
+          (uint64_t) MAXIMUM_VDO_PHYSICAL_BLOCKS);
+  int fd;
+  checkResult(open_file(filename, FU_CREATE_READ_WRITE, &fd),
+              "Could not create the image");
+  if (ftruncate(fd, physicalBlocks * VDO_BLOCK_SIZE) != 0) {
+    err(1, "Could not size '%s'", filename);
+  }
+  checkResult(close_file(fd, "cannot close image"),
+              "Could not close the image");
+
+  PhysicalLayer *layer;
+  checkResult(makeFileLayer(filename, physicalBlocks, &layer),
+              "Could not open the image");
+
+  UdsConfigStrings configStrings;
+  memset(&configStrings, 0, sizeof(configStrings));
+  struct index_config indexConfig;
+  checkResult(parseIndexConfig(&configStrings, &indexConfig),
+              "Could not configure the index");
+
+  struct vdo_config config = {
+    .logical_blocks        = logicalSize / VDO_BLOCK_SIZE,
+    .physical_blocks       = physicalBlocks,
+    .slab_size             = 1 << slabBits,
+    .slab_journal_blocks   = DEFAULT_VDO_SLAB_JOURNAL_SIZE,
+    .recovery_journal_size = DEFAULT_VDO_RECOVERY_JOURNAL_SIZE,
+  };
+  checkResult(formatVDO(&config, &indexConfig, layer),
+              "Could not format the image");
+  return layer;
+}
+
+/**
+ * Compute the slab summary fullness hint for a number of free blocks, as
+ * the slab depot does.
+ **/
+static uint8_t computeFullnessHint(block_count_t freeBlocks)
+{
+  if (freeBlocks == 0) {
+    return 0;
+  }
+
+  block_count_t hint
+    = freeBlocks >> get_vdo_slab_summary_hint_shift(vdo->slabSizeShift);
+  return ((hint == 0) ? 1 : hint);
+}
+
+/**
+ * Start allocating from a slab.
+ **/
+static void startSlab(slab_count_t slab)
+{
+  currentSlab   = slab;
+  slabOrigin    = (vdo->states.slab_depot.first_block
+                   + (slab * vdo->states.slab_depot.slab_config.slab_blocks));
+  nextBlock     = 0;
+  recentCount   = 0;
+  fragmentsLeft = 0;
+  memset(refCounts, 0, slabDataBlocks);
+}
+
+/**
+ * Write the reference counts of the current slab, and record in the slab
+ * summary that they must be loaded.
+ **/
+static void finishSlab(void)
+{
+  if (nextBlock == 0) {
+    return;
+  }
+
+  const struct slab_config *slabConfig
+    = &vdo->states.slab_depot.slab_config;
+  memset(refBuffer, 0, slabConfig->reference_count_blocks * VDO_BLOCK_SIZE);
+  struct packed_reference_sector *sectors
+    = (struct packed_reference_sector *) refBuffer;
+  for (slab_block_number sbn = 0; sbn < nextBlock; sbn++) {
+    sectors[sbn / COUNTS_PER_SECTOR].counts[sbn % COUNTS_PER_SECTOR]
+      = refCounts[sbn];
+  }
+
+  checkResult(vdo->layer->writer(vdo->layer, slabOrigin + slabDataBlocks,
+                                 slabConfig->reference_count_blocks,
+                                 refBuffer),
+              "Could not write reference counts");
+  summary[currentSlab] = (struct slab_summary_entry) {
+    .tail_block_offset = 0,
+    .fullness_hint     = computeFullnessHint(slabDataBlocks - nextBlock),
+    .load_ref_counts   = true,
+    .is_dirty          = false,
+  };
+  usedSlabs++;
+}
+
+/**
+ * Allocate the next free block, moving on to the next slab when the
+ * current one is full. Since blocks are only ever referenced by mappings
+ * made while their slab is current, each slab's reference counts are final
+ * when it is finished.
+ *
+ * @param count  The reference count of the new block
+ *
+ * @return The PBN of the block
+ **/
+static physical_block_number_t allocateBlock(vdo_refcount_t count)
+{
+  if (nextBlock == slabDataBlocks) {
+    finishSlab();
+    if (currentSlab + 1 == vdo->slabCount) {
+      errx(1, "The image is out of physical space after mapping %llu"
+           " blocks; reduce the fill or raise the dedupe or compression"
+           " ratio", (unsigned long long) mappedBlocks);
+    }
+    startSlab(currentSlab + 1);
+  }
+
+  refCounts[nextBlock] = count;
+  return slabOrigin + nextBlock++;
+}
+
+/**
+ * Remember a data location which later mappings may share.
+ **/
+static void addRecentBlock(physical_block_number_t  pbn,
+                           enum block_mapping_state state)
+{
+  unsigned int index = ((recentCount < RECENT_BLOCKS)
+                        ? recentCount++ : (nextRandom() % RECENT_BLOCKS));
+  recentBlocks[index] = (RecentBlock) {
+    .pbn   = pbn,
+    .state = state,
+  };
+}
+
+/**
+ * Choose the data location of the next mapped logical block, as either a
+ * duplicate of a recently written block, a fragment of a compressed block,
+ * or a new uncompressed block, in proportions which meet the requested
+ * ratios.
+ **/
+static struct block_map_entry mapNextBlock(void)
+{
+  mappedBlocks++;
+  uniqueCredit += 1.0 / dedupeRatio;
+  if ((uniqueCredit < 1.0) && (recentCount > 0)) {
+    RecentBlock *recent = &recentBlocks[nextRandom() % recentCount];
+    vdo_refcount_t *count = &refCounts[recent->pbn - slabOrigin];
+    if (*count < MAXIMUM_REFERENCE_COUNT) {
+      (*count)++;
+      return pack_vdo_pbn(recent->pbn, recent->state);
+    }
+  }
+
+  if (uniqueCredit >= 1.0) {
+    uniqueCredit -= 1.0;
+  }
+
+  if (fragmentsLeft == 0) {
+    fragmentCredit += compressionRatio;
+    unsigned int blockFragments
+      = min((unsigned int) fragmentCredit,
+            (unsigned int) VDO_MAX_COMPRESSION_SLOTS);
+    fragmentCredit -= blockFragments;
+    dataBlocks++;
+    if (blockFragments == 1) {
+      physical_block_number_t pbn = allocateBlock(1);
+      addRecentBlock(pbn, VDO_MAPPING_STATE_UNCOMPRESSED);
+      return pack_vdo_pbn(pbn, VDO_MAPPING_STATE_UNCOMPRESSED);
+    }
+
+    // Starting a new slab abandons any partly filled compressed block, so
+    // the count of fragments must only be set once the block is allocated.
+    compressedBlocks++;
+    compressedPBN = allocateBlock(0);
+    fragmentsLeft = blockFragments;
+    nextFragment  = 0;
+  }
+
+  fragments++;
+  fragmentsLeft--;
+  refCounts[compressedPBN - slabOrigin]++;
+  enum block_mapping_state state = vdo_get_state_for_slot(nextFragment++);
+  addRecentBlock(compressedPBN, state);
+  return pack_vdo_pbn(compressedPBN, state);
+}
+
+/**
+ * Write a block map page.
+ **/
+static void writePage(physical_block_number_t pbn, struct block_map_page *page)
+{
+  checkResult(vdo->layer->writer(vdo->layer, pbn, 1, (char *) page),
+              "Could not write block map page");
+}
+
+/**
+ * Make sure the interior pages above a leaf page are allocated, writing
+ * out any pages which are finished, and return the entry in the lowest
+ * of them which should map the leaf.
+ *
+ * @param pageNumber  The number of the leaf page
+ **/
+static struct block_map_entry *findLeafEntry(page_number_t pageNumber)
+{
+  root_count_t rootCount = vdo->states.block_map.root_count;
+  OpenTree    *tree      = &trees[pageNumber % rootCount];
+  page_number_t treePage = pageNumber / rootCount;
+
+  // The root is always open, so work down from just below it.
+  page_number_t indexes[INTERIOR_HEIGHTS];
+  page_number_t index = treePage;
+  for (height_t height = 0; height < INTERIOR_HEIGHTS; height++) {
+    index /= VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+    indexes[height] = index;
+  }
+
+  for (int height = INTERIOR_HEIGHTS - 1; height >= 0; height--) {
+    if (tree->indexes[height] == indexes[height] + 1) {
+      continue;
+    }
+
+    if (tree->indexes[height] != 0) {
+      writePage(tree->pbns[height], tree->pages[height]);
+    }
+
+    physical_block_number_t pbn = allocateBlock(MAXIMUM_REFERENCE_COUNT);
+    treePages++;
+    format_vdo_block_map_page(tree->pages[height], vdo->states.vdo.nonce, pbn,
+                              true);
+    slot_number_t slot = indexes[height] % VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+    tree->pages[height + 1]->entries[slot]
+      = pack_vdo_pbn(pbn, VDO_MAPPING_STATE_UNCOMPRESSED);
+    tree->indexes[height] = indexes[height] + 1;
+    tree->pbns[height]    = pbn;
+  }
+
+  return &tree->pages[0]->entries[treePage % VDO_BLOCK_MAP_ENTRIES_PER_PAGE];
+}
+
+/**
+ * Check whether a leaf page is one of those which --fill maps, which are
+ * spread evenly over the logical space.
+ **/
+static bool isFilledPage(page_number_t pageNumber)
+{
+  return ((uint64_t) ((pageNumber + 1) * fillFraction)
+          > (uint64_t) (pageNumber * fillFraction));
+}
+
+/**
+ * Map the filled leaf pages of the block map, allocating the tree pages and
+ * data blocks as a VDO writing the logical blocks in order would.
+ **/
+static void fillBlockMap(void)
+{
+  const struct block_map_state_2_0 *map = &vdo->states.block_map;
+  block_count_t logicalBlocks = vdo->states.vdo.config.logical_blocks;
+  page_number_t leafPages = compute_vdo_block_map_page_count(logicalBlocks);
+  char *buffer;
+  checkResult(vdo->layer->allocateIOBuffer(vdo->layer,
+                                           ((map->root_count
+                                             * (INTERIOR_HEIGHTS + 1)) + 1)
+                                           * VDO_BLOCK_SIZE,
+                                           "block map pages", &buffer),
+              "Could not allocate block map pages");
+  checkResult(UDS_ALLOCATE(map->root_count, OpenTree, __func__, &trees),
+              "Could not allocate block map trees");
+  for (root_count_t root = 0; root < map->root_count; root++) {
+    for (height_t height = 0; height <= INTERIOR_HEIGHTS; height++) {
+      trees[root].pages[height] = (struct block_map_page *) buffer;
+      buffer += VDO_BLOCK_SIZE;
+    }
+    format_vdo_block_map_page(trees[root].pages[INTERIOR_HEIGHTS],
+                              vdo->states.vdo.nonce, map->root_origin + root,
+                              true);
+  }
+  leafPage = (struct block_map_page *) buffer;
+
+  startSlab(0);
+  for (page_number_t page = 0; page < leafPages; page++) {
+    if (!isFilledPage(page)) {
+      continue;
+    }
+
+    struct block_map_entry *entry = findLeafEntry(page);
+    physical_block_number_t pbn = allocateBlock(MAXIMUM_REFERENCE_COUNT);
+    treePages++;
+    *entry = pack_vdo_pbn(pbn, VDO_MAPPING_STATE_UNCOMPRESSED);
+    format_vdo_block_map_page(leafPage, vdo->states.vdo.nonce, pbn, true);
+
+    logical_block_number_t lbn = page * VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+    for (slot_number_t slot = 0;
+         (slot < VDO_BLOCK_MAP_ENTRIES_PER_PAGE) && (lbn < logicalBlocks);
+         slot++, lbn++) {
+      leafPage->entries[slot] = mapNextBlock();
+    }
+    writePage(pbn, leafPage);
+  }
+  finishSlab();
+
+  for (root_count_t root = 0; root < map->root_count; root++) {
+    OpenTree *tree = &trees[root];
+    for (height_t height = 0; height < INTERIOR_HEIGHTS; height++) {
+      if (tree->indexes[height] != 0) {
+        writePage(tree->pbns[height], tree->pages[height]);
+      }
+    }
+    writePage(map->root_origin + root, tree->pages[INTERIOR_HEIGHTS]);
+  }
+}
+
+/**
+ * Pick a random slab which has had blocks allocated from it.
+ **/
+static slab_count_t pickUsedSlab(void)
+{
+  return nextRandom() % usedSlabs;
+}
+
+/**
+ * Make a stored reference count of a random allocated block one too high.
+ **/
+static void injectRefCountError(void)
+{
+  const struct slab_config *slabConfig
+    = &vdo->states.slab_depot.slab_config;
+  slab_count_t slab = pickUsedSlab();
+  physical_block_number_t origin
+    = vdo->states.slab_depot.first_block + (slab * slabConfig->slab_blocks);
+  block_count_t allocated
+    = ((slab == currentSlab) ? nextBlock : slabDataBlocks);
+  slab_block_number sbn = nextRandom() % allocated;
+  physical_block_number_t blockPBN
+    = origin + slabDataBlocks + (sbn / COUNTS_PER_BLOCK);
+
+  checkResult(vdo->layer->reader(vdo->layer, blockPBN, 1, refBuffer),
+              "Could not read reference counts");
+  struct packed_reference_sector *sector
+    = &((struct packed_reference_sector *) refBuffer)[(sbn % COUNTS_PER_BLOCK)
+                                                      / COUNTS_PER_SECTOR];
+  vdo_refcount_t *count = &sector->counts[sbn % COUNTS_PER_SECTOR];
+  // A tree page may validly be counted as 1 or the maximum, so use 2.
+  vdo_refcount_t wrong
+    = ((*count >= MAXIMUM_REFERENCE_COUNT - 1) ? 2 : *count + 1);
+  if (verbose) {
+    printf("Reference count of PBN %llu changed from %u to %u\n",
+           (unsigned long long) (origin + sbn), *count, wrong);
+  }
+  *count = wrong;
+  checkResult(vdo->layer->writer(vdo->layer, blockPBN, 1, refBuffer),
+              "Could not write reference counts");
+}
+
+/**
+ * Make the slab summary entry of a random used slab claim it is either
+ * empty or full, whichever is further from the truth.
+ **/
+static void injectSummaryError(void)
+{
+  slab_count_t slab = pickUsedSlab();
+  struct slab_summary_entry *entry = &summary[slab];
+  uint8_t emptyHint = computeFullnessHint(slabDataBlocks);
+  uint8_t wrong
+    = ((entry->fullness_hint > emptyHint / 2) ? 0 : emptyHint);
+  if (verbose) {
+    printf("Fullness hint of slab %u changed from %u to %u\n",
+           slab, entry->fullness_hint, wrong);
+  }
+  entry->fullness_hint = wrong;
+}
+
+/**
+ * Remap a random mapped logical block to a block past the end of the
+ * volume.
+ **/
+static void injectMappingError(void)
+{
+  block_count_t logicalBlocks = vdo->states.vdo.config.logical_blocks;
+  page_number_t leafPages = compute_vdo_block_map_page_count(logicalBlocks);
+  page_number_t page = nextRandom() % leafPages;
+  while (!isFilledPage(page)) {
+    page = (page + 1) % leafPages;
+  }
+
+  logical_block_number_t firstLBN = page * VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+  block_count_t entries = min((block_count_t) VDO_BLOCK_MAP_ENTRIES_PER_PAGE,
+                              logicalBlocks - firstLBN);
+  logical_block_number_t lbn = firstLBN + (nextRandom() % entries);
+  physical_block_number_t pagePBN;
+  checkResult(findLBNPage(vdo, lbn, &pagePBN),
+              "Could not find block map page");
+  checkResult(readBlockMapPage(vdo->layer, pagePBN, vdo->states.vdo.nonce,
+                               leafPage),
+              "Could not read block map page");
+
+  physical_block_number_t wrong = vdo->states.vdo.config.physical_blocks;
+  if (verbose) {
+    printf("LBN %llu remapped to PBN %llu\n", (unsigned long long) lbn,
+           (unsigned long long) wrong);
+  }
+  leafPage->entries[lbn - firstLBN]
+    = pack_vdo_pbn(wrong, VDO_MAPPING_STATE_UNCOMPRESSED);
+  writePage(pagePBN, leafPage);
+}
+
+/**
+ * Make the requested inconsistencies.
+ **/
+static void injectErrors(void)
+{
+  if (((injections[INJECT_REF_COUNT] + injections[INJECT_SUMMARY]
+        + injections[INJECT_MAPPING]) > 0) && (mappedBlocks == 0)) {
+    errx(1, "Nothing is mapped, so no inconsistencies can be injected");
+  }
+
+  for (uint64_t i = 0; i < injections[INJECT_REF_COUNT]; i++) {
+    injectRefCountError();
+  }
+
+  for (uint64_t i = 0; i < injections[INJECT_SUMMARY]; i++) {
+    injectSummaryError();
+  }
+
+  for (uint64_t i = 0; i < injections[INJECT_MAPPING]; i++) {
+    injectMappingError();
+  }
+
+  vdo->states.recovery_journal.logical_blocks_used
+    += injections[INJECT_LBN_COUNT];
+}
+
+/**
+ * Write the slab summary zone which the format wrote.
+ **/
+static void writeSlabSummary(void)
+{
+  const struct partition *partition
+    = getPartition(vdo, SLAB_SUMMARY_PARTITION, "no slab summary partition");
+  checkResult(vdo->layer->writer(vdo->layer,
+                                 get_vdo_fixed_layout_partition_offset(partition),
+                                 get_vdo_slab_summary_zone_size(VDO_BLOCK_SIZE),
+                                 (char *) summary),
+              "Could not write the slab summary");
+}
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+  static char errBuf[ERRBUF_SIZE];
+
+  int result = register_vdo_status_codes();
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not register status codes: %s",
+         uds_string_error(result, errBuf, ERRBUF_SIZE));
+  }
+
+  processArgs(argc, argv);
+
+  PhysicalLayer *layer = formatImage();
+  checkResult(loadVDO(layer, true, &vdo), "Could not load the new VDO");
+  checkResult(readSlabSummary(vdo, &summary),
+              "Could not read the slab summary");
+
+  const struct slab_config *slabConfig
+    = &vdo->states.slab_depot.slab_config;
+  slabDataBlocks = slabConfig->data_blocks;
+  checkResult(UDS_ALLOCATE(slabDataBlocks, vdo_refcount_t, __func__,
+                           &refCounts),
+              "Could not allocate reference counts");
+  checkResult(layer->allocateIOBuffer(layer,
+                                      slabConfig->reference_count_blocks
+                                      * VDO_BLOCK_SIZE,
+                                      "reference blocks", &refBuffer),
+              "Could not allocate reference blocks");
+
+  fillBlockMap();
+  vdo->states.recovery_journal.logical_blocks_used = mappedBlocks;
+  vdo->states.recovery_journal.block_map_data_blocks = treePages;
+  vdo->states.vdo.state = VDO_CLEAN;
+  checkResult(saveVDO(vdo, false), "Could not save the super block");
+
+  injectErrors();
+  writeSlabSummary();
+  checkResult(saveVDO(vdo, false), "Could not save the super block");
+
+  printf("%s: %llu of %llu logical blocks mapped to %llu data blocks"
+         " (%llu compressed, holding %llu fragments),\n"
+         "  %llu block map pages and %u of %u slabs used\n",
+         filename, (unsigned long long) mappedBlocks,
+         (unsigned long long) vdo->states.vdo.config.logical_blocks,
+         (unsigned long long) dataBlocks,
+         (unsigned long long) compressedBlocks,
+         (unsigned long long) fragments, (unsigned long long) treePages,
+         usedSlabs, vdo->slabCount);
+  for (InjectionKind kind = 0; kind < INJECT_KINDS; kind++) {
+    if (injections[kind] > 0) {
+      printf("  %llu %s inconsistencies injected\n",
+             (unsigned long long) injections[kind], injectionNames[kind]);
+    }
+  }
+
+  freeUserVDO(&vdo);
+  layer->destroy(&layer);
+  exit(0);
+}
@@ -25,6 +25,7 @@
 
 #include "memoryAlloc.h"
 #include "uds.h"
+#include "uds-threads.h"
 #include "timeUtils.h"
 
 #include "constants.h"
@@ -33,19 +34,22 @@
 #include "statusCodes.h"
 #include "volumeGeometry.h"
 
+#include "cachingLayer.h"
 #include "fileLayer.h"
 #include "parseUtils.h"
 #include "userVDO.h"
 #include "vdoVolumeUtils.h"
 
 static const char usageString[]
-  = "[--help] [--version] [--offset <offset>] <filename>";
+  = "[--help] [--version] [--offset <offset>] [--cache-size <size>]"
+    " <filename>";
 
 static const char helpString[] =
   "vdoRegenerateGeometry - regenerate a VDO whose first few blocks have been wiped\n"
   "\n"
   "SYNOPSIS\n"
-  "  vdoRegenerateGeometry [--offset <offset>] <filename>\n"
+  "  vdoRegenerateGeometry [--offset <offset>] [--cache-size <size>]\n"
+  "                        <filename>\n"
   "\n"
   "DESCRIPTION\n"
   "  vdoRegenerateGeometry will attempt to regenerate the geometry block of a\n"
@@ -58,19 +62,31 @@ static const char helpString[] =
   "  super blocks in the event that multiple candidates were found, the\n"
   "  --offset option can be used to specify the location (in bytes) of the\n"
   "  super block on the backing store.\n"
+  "\n"
+  "  The candidates are probed through a shared cache of the blocks read,\n"
+  "  4MB by default. --cache-size sets its size; a larger cache helps when\n"
+  "  many candidates share block map pages.\n"
   "\n";
 
 enum {
   // This should use UDS_MEMORY_CONFIG_MAX instead of the explicit 1024, but
   // the compiler won't let us.
   UDS_CONFIGURATIONS = (1024 + 3) * 2,
+  // Candidates are probed in parallel, since each spends most of its time
+  // waiting for reads.
+  PROBE_THREADS      = 16,
+  // Enough for the super blocks and block map roots of many candidates
+  DEFAULT_CACHE_BYTES = 4 * 1024 * 1024,
+  // The cache must hold a few of the largest reads it caches
+  MIN_CACHE_BYTES     = 256 * 1024,
 };
 
 static struct option options[] = {
-  { "help",    no_argument,       NULL, 'h' },
-  { "version", no_argument,       NULL, 'V' },
-  { "offset",  required_argument, NULL, 'o' },
-  { NULL,      0,                 NULL,  0  },
+  { "help",       no_argument,       NULL, 'h' },
+  { "version",    no_argument,       NULL, 'V' },
+  { "offset",     required_argument, NULL, 'o' },
+  { "cache-size", required_argument, NULL, 'c' },
+  { NULL,         0,                 NULL,  0  },
 };
 
 typedef struct {
@@ -80,7 +96,12 @@ typedef struct {
   UserVDO                *vdo;
 } Candidate;
 
-static char          *blockBuffer;
+typedef struct {
+  struct mutex lock;
+  /** The next candidate to be probed */
+  int          nextCandidate;
+} ProbeQueue;
+
 static PhysicalLayer *fileLayer;
 static block_count_t  physicalSize;
 static uuid_t         uuid;
@@ -88,8 +109,9 @@ static char           errorBuffer[ERRBUF_SIZE];
 static Candidate      candidates[UDS_CONFIGURATIONS];
 static int            candidateCount = 0;
 
-static char   *fileName = NULL;
-static size_t  offset   = 0;
+static char     *fileName   = NULL;
+static size_t    offset     = 0;
+static uint64_t  cacheBytes = DEFAULT_CACHE_BYTES;
 
 /**
  * Explain how this command-line tool is used.
@@ -137,6 +159,13 @@ static void processArgs(int argc, char *argv[])
       offset /= VDO_BLOCK_SIZE;
       break;
 
+    case 'c':
+      result = parseSize(optarg, false, &cacheBytes);
+      if ((result != VDO_SUCCESS) || (cacheBytes < MIN_CACHE_BYTES)) {
+        errx(1, "cache size must be at least %uKB", MIN_CACHE_BYTES / 1024);
+      }
+      break;
+
     case 'V':
       printf("%s version is: %s\n", argv[0], CURRENT_VERSION);
       exit(0);
@@ -166,6 +195,18 @@ static const char *resultString(int result) {
   return uds_string_error(result, errorBuffer, ERRBUF_SIZE);
 }
 
+/**
+ * Stringify an error code from a probing thread.
+ *
+ * @param result  The error code
+ * @param buffer  A buffer of ERRBUF_SIZE bytes for the message
+ *
+ * @return The error message associated with the error code
+ **/
+static const char *threadResultString(int result, char *buffer) {
+  return uds_string_error(result, buffer, ERRBUF_SIZE);
+}
+
 /**
  * Generate a geometry based on index parameters.
  *
@@ -218,26 +259,18 @@ static int generateGeometry(const uds_memory_config_size_t memory, bool sparse)
 }
 
 /**
- * Try to find a valid super block corresponding to a given index
- * configuration.
+ * Check whether a candidate geometry leads to a valid super block, and to
+ * a block map with a valid tree root, using only the candidate itself so
+ * that candidates can be checked concurrently.
  *
- * @param memory  The memory size of the index
- * @param sparse  Whether or not the index is sparse
+ * @param candidate  The candidate to check
+ * @param buffer     A block buffer for the checking thread
  *
- * @return <code>true</code> if a valid super block was found for this config
+ * @return <code>true</code> if a valid super block was found for the
+ *         candidate, in which case candidate->vdo holds it
  **/
-static bool tryUDSConfig(const uds_memory_config_size_t memory, bool sparse)
+static bool probeCandidate(Candidate *candidate, char *buffer)
 {
-  Candidate *candidate = &candidates[candidateCount];
-  if (generateGeometry(memory, sparse) != VDO_SUCCESS) {
-    return false;
-  }
-
-  if ((offset != 0)
-      && (vdo_get_data_region_start(candidate->geometry) != offset)) {
-    return false;
-  }
-
   if (loadVDOWithGeometry(fileLayer, &candidate->geometry, false,
                           &candidate->vdo) != VDO_SUCCESS) {
     return false;
@@ -252,32 +285,98 @@ static bool tryUDSConfig(const uds_memory_config_size_t memory, bool sparse)
   struct block_map_state_2_0 map = candidate->vdo->states.block_map;
   for (block_count_t root = 0; root < map.root_count; root++) {
     int result = fileLayer->reader(fileLayer, map.root_origin + root, 1,
-                                   blockBuffer);
+                                   buffer);
     if (result != VDO_SUCCESS) {
+      char errBuf[ERRBUF_SIZE];
       warnx("candidate block map root at %llu unreadable: %s",
             (unsigned long long) (map.root_origin + root),
-            resultString(result));
+            threadResultString(result, errBuf));
+      freeUserVDO(&candidate->vdo);
       return false;
     }
 
     enum block_map_page_validity validity
-      = validate_vdo_block_map_page((struct block_map_page *) blockBuffer,
+      = validate_vdo_block_map_page((struct block_map_page *) buffer,
                                     candidate->vdo->states.vdo.nonce,
                                     map.root_origin + root);
     if (validity == VDO_BLOCK_MAP_PAGE_VALID) {
-      printf("Found candidate super block at block %llu"
-             " (index memory %sGB%s)\n",
-             (unsigned long long) vdo_get_data_region_start(candidate->geometry),
-             candidate->memoryString, (sparse ? ", sparse" : ""));
       return true;
     }
   }
 
+  freeUserVDO(&candidate->vdo);
   return false;
 }
 
 /**
- * Find all the super block candidates.
+ * Probe candidates from the shared queue until there are none left.
+ *
+ * @param arg  The ProbeQueue
+ **/
+static void probeCandidates(void *arg)
+{
+  ProbeQueue *queue = arg;
+  char *buffer;
+  int result = fileLayer->allocateIOBuffer(fileLayer, VDO_BLOCK_SIZE,
+                                           "block buffer", &buffer);
+  if (result != VDO_SUCCESS) {
+    char errBuf[ERRBUF_SIZE];
+    errx(result, "Failed to allocate block buffer: %s",
+         threadResultString(result, errBuf));
+  }
+
+  for (;;) {
+    uds_lock_mutex(&queue->lock);
+    int next = queue->nextCandidate++;
+    uds_unlock_mutex(&queue->lock);
+    if (next >= candidateCount) {
+      break;
+    }
+
+    probeCandidate(&candidates[next], buffer);
+  }
+
+  UDS_FREE(buffer);
+}
+
+/**
+ * Generate the geometry for an index configuration and add it to the
+ * candidates to be probed, unless it cannot be the one sought.
+ *
+ * @param memory  The memory size of the index
+ * @param sparse  Whether or not the index is sparse
+ *
+ * @return <code>false</code> if the geometry puts the super block beyond
+ *         the end of the device, so that larger indexes need not be tried
+ **/
+static bool addCandidate(const uds_memory_config_size_t memory, bool sparse)
+{
+  Candidate *candidate = &candidates[candidateCount];
+  if (generateGeometry(memory, sparse) != VDO_SUCCESS) {
+    return true;
+  }
+
+  physical_block_number_t start
+    = vdo_get_data_region_start(candidate->geometry);
+  if (start > physicalSize) {
+    return false;
+  }
+
+  // A super block at the very end of the device can't be read either.
+  if ((start < physicalSize) && ((offset == 0) || (start == offset))) {
+    candidateCount++;
+  }
+
+  return true;
+}
+
+/**
+ * Find all the super block candidates. The geometry for each index
+ * configuration depends only on the configuration, so the candidates, and
+ * the point at which larger indexes no longer fit on the device, are worked
+ * out before any reads are done. The candidates are then all probed at
+ * once, sharing a cache of the blocks read, and those which pass are kept
+ * in the order they were generated.
  **/
 static void findSuperBlocks(void)
 {
@@ -290,21 +389,54 @@ static void findSuperBlocks(void)
   bool trySparse = true;
   for (unsigned int i = 0; i < UDS_MEMORY_CONFIG_MAX; i++) {
     const uds_memory_config_size_t memory = ((i < 3) ? smallSizes[i] : i - 2);
-    Candidate *candidate = &candidates[candidateCount];
-    if (tryUDSConfig(memory, false)) {
-      candidateCount++;
-    } else if (vdo_get_data_region_start(candidate->geometry)
-               > physicalSize) {
-      return;
+    if (!addCandidate(memory, false)) {
+      break;
     }
 
-    if (trySparse && tryUDSConfig(memory, true)) {
-      candidateCount++;
-    } else if (vdo_get_data_region_start(candidate->geometry)
-               > physicalSize) {
+    if (trySparse && !addCandidate(memory, true)) {
       trySparse = false;
     }
   }
+
+  ProbeQueue queue = { .nextCandidate = 0 };
+  int result = uds_init_mutex(&queue.lock);
+  if (result != VDO_SUCCESS) {
+    errx(result, "Failed to initialize probe queue: %s",
+         resultString(result));
+  }
+
+  unsigned int threadCount = min((unsigned int) PROBE_THREADS,
+                                 (unsigned int) max(candidateCount, 1));
+  struct thread *threads[PROBE_THREADS];
+  for (unsigned int i = 0; i < threadCount; i++) {
+    result = uds_create_thread(probeCandidates, &queue, "vdoProbe",
+                               &threads[i]);
+    if (result != VDO_SUCCESS) {
+      errx(result, "Failed to start probe threads: %s",
+           resultString(result));
+    }
+  }
+
+  for (unsigned int i = 0; i < threadCount; i++) {
+    uds_join_threads(threads[i]);
+  }
+  uds_destroy_mutex(&queue.lock);
+
+  int found = 0;
+  for (int i = 0; i < candidateCount; i++) {
+    Candidate *candidate = &candidates[i];
+    if (candidate->vdo == NULL) {
+      continue;
+    }
+
+    printf("Found candidate super block at block %llu"
+           " (index memory %sGB%s)\n",
+           (unsigned long long) vdo_get_data_region_start(candidate->geometry),
+           candidate->memoryString, (candidate->sparse ? ", sparse" : ""));
+    candidates[found++] = *candidate;
+  }
+
+  candidateCount = found;
 }
 
 /**
@@ -334,16 +466,16 @@ int main(int argc, char *argv[])
 
   processArgs(argc, argv);
 
-  result = makeFileLayer(fileName, 0, &fileLayer);
+  PhysicalLayer *backing;
+  result = makeFileLayer(fileName, 0, &backing);
   if (result != VDO_SUCCESS) {
     errx(result, "Failed to open VDO backing store '%s' with %s",
          fileName, resultString(result));
   }
 
-  result = fileLayer->allocateIOBuffer(fileLayer, VDO_BLOCK_SIZE,
-                                       "block buffer", &blockBuffer);
+  result = makeCachingLayer(backing, cacheBytes, &fileLayer);
   if (result != VDO_SUCCESS) {
-    errx(result, "Failed to allocate block buffer: %s", resultString(result));
+    errx(result, "Failed to make block cache: %s", resultString(result));
   }
 
   physicalSize = fileLayer->getBlockCount(fileLayer);
@@ -374,7 +506,6 @@ int main(int argc, char *argv[])
            "\na candidate\n");
   }
 
-  UDS_FREE(blockBuffer);
   fileLayer->destroy(&fileLayer);
 
   if (candidateCount == 0) {
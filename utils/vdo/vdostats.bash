@@ -24,7 +24,7 @@ _vdostats()
     local opts cur
     _init_completion || return
     COMPREPLY=()
-    opts="--help --all --human-readable --si --verbose --version"
+    opts="--help --all --human-readable --si --verbose --version --watch --serve --record --replay --diff --cache"
     cur="${COMP_WORDS[COMP_CWORD]}"
     case "${cur}" in
         *)
@@ -28,15 +28,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <stddef.h>
+#include <sys/sysmacros.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "errors.h"
+#include "fileUtils.h"
+#include "hlist.h"
 #include "logger.h"
 #include "memoryAlloc.h"
 #include "statistics.h"
 #include "statusCodes.h"
+#include "timeUtils.h"
+#include "uds-threads.h"
 #include "vdoStats.h"
 
+#include "dmControl.h"
+#include "metricsServer.h"
+#include "numUtils.h"
+#include "parseUtils.h"
+#include "statsLog.h"
+
 static const char usage_string[] =
   " [--help] [--version] [options...] [device [device ...]]";
 
@@ -72,6 +85,38 @@ static const char help_string[] =
   "\n"
   "    -V, --version\n"
   "       Print the vdostats version number and exit.\n"
+  "\n"
+  "    -w, --watch=<seconds>\n"
+  "       Sample the statistics every <seconds> seconds until interrupted,\n"
+  "       and display the change in the I/O, deduplication, compression,\n"
+  "       journal and block map cache counters over each interval, with\n"
+  "       their rates per second. The bio, journal and dedupe query\n"
+  "       queues are sampled ten times each interval, to display their\n"
+  "       mean and peak occupancy, throughput and mean latency.\n"
+  "\n"
+  "    --serve=[<host>]:<port>\n"
+  "       Serve the statistics of all VDO devices over HTTP at /metrics in\n"
+  "       the OpenMetrics text format, collecting them for each request.\n"
+  "\n"
+  "    --record=<file>\n"
+  "       Append a snapshot of the statistics to the binary log <file>\n"
+  "       instead of displaying them. With --watch, append a snapshot\n"
+  "       every interval until interrupted.\n"
+  "\n"
+  "    --cache=<file>\n"
+  "       Write the --verbose statistics of the devices to <file> instead\n"
+  "       of displaying them, replacing it atomically. With --watch,\n"
+  "       rewrite it every interval until interrupted, so that monitoring\n"
+  "       checks can read it instead of running vdostats.\n"
+  "\n"
+  "    --replay=<file>\n"
+  "       Display the snapshots in the log <file>, numbered from 0,\n"
+  "       instead of the statistics of the running devices.\n"
+  "\n"
+  "    --diff=<first>,<last>\n"
+  "       With --replay, display the change in the --watch counters from\n"
+  "       snapshot <first> to snapshot <last> of the log, with their rates\n"
+  "       per second. Negative numbers count back from the last snapshot.\n"
   "\n";
 
 static struct option options[] = {
@@ -81,10 +126,16 @@ static struct option options[] = {
   { "si",              no_argument,  NULL,  's' },
   { "verbose",         no_argument,  NULL,  'v' },
   { "version",         no_argument,  NULL,  'V' },
+  { "watch",     required_argument,  NULL,  'w' },
+  { "serve",     required_argument,  NULL,  'S' },
+  { "record",    required_argument,  NULL,  'R' },
+  { "replay",    required_argument,  NULL,  'P' },
+  { "cache",     required_argument,  NULL,  'C' },
+  { "diff",      required_argument,  NULL,  'D' },
   { NULL,              0,            NULL,   0  },
 };
 
-static char option_string[] = "harsvV";
+static char option_string[] = "harsvVw:S:R:P:D:C:";
 
 enum style {
   STYLE_DF,
@@ -97,6 +148,159 @@ static bool si                     = false;
 static bool verbose                = false;
 static bool header_printed         = false;
 static int  maxDeviceNameLength = 6;
+static unsigned int watch_interval = 0;
+static const char  *serve_address  = NULL;
+static const char  *record_path    = NULL;
+static const char  *replay_path    = NULL;
+static const char  *cache_path     = NULL;
+static bool         diff           = false;
+static long         diff_first     = 0;
+static long         diff_last      = 0;
+
+/**
+ * A counter reported by --watch, as the offset of its uint64_t in
+ * struct vdo_statistics.
+ **/
+typedef struct watchedCounter {
+  const char *label;
+  size_t      offset;
+} WatchedCounter;
+
+#define WATCHED(label, field) { label, offsetof(struct vdo_statistics, field) }
+
+static const WatchedCounter watched_counters[] = {
+  WATCHED("bios in read",                   bios_in.read),
+  WATCHED("bios in write",                  bios_in.write),
+  WATCHED("bios in discard",                bios_in.discard),
+  WATCHED("bios in flush",                  bios_in.flush),
+  WATCHED("bios in fua",                    bios_in.fua),
+  WATCHED("bios out read",                  bios_out.read),
+  WATCHED("bios out write",                 bios_out.write),
+  WATCHED("bios out discard",               bios_out.discard),
+  WATCHED("bios out flush",                 bios_out.flush),
+  WATCHED("bios out fua",                   bios_out.fua),
+  WATCHED("dedupe advice valid",            hash_lock.dedupe_advice_valid),
+  WATCHED("dedupe advice stale",            hash_lock.dedupe_advice_stale),
+  WATCHED("dedupe advice timeouts",         dedupe_advice_timeouts),
+  WATCHED("compressed fragments written",
+          packer.compressed_fragments_written),
+  WATCHED("compressed blocks written",      packer.compressed_blocks_written),
+  WATCHED("journal entries committed",      journal.entries.committed),
+  WATCHED("journal blocks committed",       journal.blocks.committed),
+  WATCHED("block map cache hits",           block_map.found_in_cache),
+  WATCHED("block map cache misses",         block_map.fetch_required),
+  WATCHED("block map pages loaded",         block_map.pages_loaded),
+  WATCHED("block map pages saved",          block_map.pages_saved),
+};
+
+#undef WATCHED
+
+/**
+ * Sum the bios of a struct bio_stats, counting flushes with data only
+ * once.
+ **/
+static uint64_t total_bios(const struct bio_stats *bios)
+{
+  return bios->read + bios->write + bios->discard + bios->empty_flush;
+}
+
+static uint64_t bios_in_flight(const struct vdo_statistics *stats)
+{
+  return total_bios(&stats->bios_in_progress);
+}
+
+static uint64_t bios_acknowledged(const struct vdo_statistics *stats)
+{
+  return total_bios(&stats->bios_acknowledged);
+}
+
+static uint64_t data_bios_in_flight(const struct vdo_statistics *stats)
+{
+  return (total_bios(&stats->bios_out)
+          - total_bios(&stats->bios_out_completed));
+}
+
+static uint64_t data_bios_completed(const struct vdo_statistics *stats)
+{
+  return total_bios(&stats->bios_out_completed);
+}
+
+static uint64_t metadata_bios_in_flight(const struct vdo_statistics *stats)
+{
+  return (total_bios(&stats->bios_meta)
+          - total_bios(&stats->bios_meta_completed));
+}
+
+static uint64_t metadata_bios_completed(const struct vdo_statistics *stats)
+{
+  return total_bios(&stats->bios_meta_completed);
+}
+
+static uint64_t entries_in_flight(const struct vdo_statistics *stats)
+{
+  return stats->journal.entries.started - stats->journal.entries.committed;
+}
+
+static uint64_t entries_committed(const struct vdo_statistics *stats)
+{
+  return stats->journal.entries.committed;
+}
+
+static uint64_t blocks_in_flight(const struct vdo_statistics *stats)
+{
+  return stats->journal.blocks.started - stats->journal.blocks.committed;
+}
+
+static uint64_t blocks_committed(const struct vdo_statistics *stats)
+{
+  return stats->journal.blocks.committed;
+}
+
+static uint64_t queries_in_flight(const struct vdo_statistics *stats)
+{
+  return stats->index.curr_dedupe_queries;
+}
+
+static uint64_t queries_answered(const struct vdo_statistics *stats)
+{
+  const struct index_statistics *index = &stats->index;
+  return (index->posts_found + index->posts_not_found
+          + index->queries_found + index->queries_not_found
+          + index->updates_found + index->updates_not_found);
+}
+
+/**
+ * A queue reported by --watch, as the functions which get the number of
+ * requests in it and the number it has completed from a sample.
+ **/
+typedef struct watchedQueue {
+  const char *label;
+  uint64_t  (*inFlight)(const struct vdo_statistics *stats);
+  uint64_t  (*completed)(const struct vdo_statistics *stats);
+} WatchedQueue;
+
+static const WatchedQueue watched_queues[] = {
+  { "bios in",              bios_in_flight,          bios_acknowledged   },
+  { "data bios out",        data_bios_in_flight,     data_bios_completed },
+  { "metadata bios out",    metadata_bios_in_flight,
+                            metadata_bios_completed                      },
+  { "journal entries",      entries_in_flight,       entries_committed   },
+  { "journal blocks",       blocks_in_flight,        blocks_committed    },
+  { "dedupe queries",       queries_in_flight,       queries_answered    },
+};
+
+enum {
+  WATCHED_QUEUE_COUNT = COUNT_OF(watched_queues),
+  /** How many times the queues are sampled in each watch interval */
+  QUEUE_SAMPLES       = 10,
+};
+
+/** The occupancy of a watched queue over a watch interval */
+typedef struct queueWindow {
+  uint64_t sum;
+  uint64_t peak;
+  unsigned int samples;
+} QueueWindow;
 
 typedef struct dfStats {
   uint64_t  size;
@@ -121,10 +325,49 @@ typedef struct vdoPath {
   char resolvedPath[PATH_MAX];
 } VDOPath;
 
+/**
+ * One of the names by which a VDO device may be given: its device-mapper
+ * name, its dm-N name, or the path of its device node.
+ **/
+typedef struct pathKey {
+  struct hlist_node  hashNode;
+  const char        *key;
+  VDOPath           *path;
+} PathKey;
+
 static VDOPath *vdoPaths = NULL;
 
 static int pathCount = 0;
 
+static PathKey           *pathKeys   = NULL;
+static struct hlist_head *pathBuckets = NULL;
+static uint64_t           bucketMask  = 0;
+
+static int dmControl = -1;
+
+enum {
+  // Stats requests each wait on a device, so many are made at once.
+  MAX_STATS_THREADS = 32,
+};
+
+/**
+ * The stats of one device, as collected by collect_device_stats().
+ **/
+typedef struct deviceSample {
+  const char            *original;
+  const char            *name;
+  struct vdo_statistics  stats;
+  int                    result;
+  bool                   reported;
+} DeviceSample;
+
+typedef struct sampleQueue {
+  struct mutex  lock;
+  DeviceSample *samples;
+  int           count;
+  int           next;
+} SampleQueue;
+
 /**********************************************************************
  * Obtain the VDO device statistics.
  *
@@ -255,6 +498,20 @@ static void displayDFStyle(const char *path, struct vdo_statistics *stats)
   }
 }
 
+/**********************************************************************
+ * Calculate max device name length to display
+ *
+ * @param name The name to get the length for
+ *
+ */
+static void calculateMaxDeviceName(const char *name)
+{
+  int name_length = strlen(name);
+  maxDeviceNameLength = ((name_length > maxDeviceNameLength)
+                         ? name_length
+                         : maxDeviceNameLength);
+}
+
 /**********************************************************************
  * Display the usage string.
  *
@@ -306,11 +563,58 @@ static void process_args(int argc, char *argv[])
       exit(0);
       break;
 
+    case 'S':
+      serve_address = optarg;
+      break;
+
+    case 'R':
+      record_path = optarg;
+      break;
+
+    case 'P':
+      replay_path = optarg;
+      break;
+
+    case 'C':
+      cache_path = optarg;
+      break;
+
+    case 'D':
+      {
+        char *end;
+        diff_first = strtol(optarg, &end, 10);
+        if ((end == optarg) || (*end != ',')) {
+          errx(1, "The snapshots to compare must be given as <first>,<last>");
+        }
+        char *last = end + 1;
+        diff_last = strtol(last, &end, 10);
+        if ((end == last) || (*end != '\0')) {
+          errx(1, "The snapshots to compare must be given as <first>,<last>");
+        }
+        diff = true;
+      }
+      break;
+
+    case 'w':
+      if (parseUInt(optarg, 1, UINT_MAX, &watch_interval) != VDO_SUCCESS) {
+        errx(1, "The watch interval must be a positive number of seconds");
+      }
+      break;
+
     default:
       usage(argv[0], usage_string);
       break;
     };
   }
+
+  if (diff && (replay_path == NULL)) {
+    errx(1, "--diff requires --replay");
+  }
+
+  if (((record_path != NULL) + (replay_path != NULL) + (cache_path != NULL))
+      > 1) {
+    errx(1, "Only one of --record, --replay and --cache may be used");
+  }
 }
 
 
@@ -321,30 +625,132 @@ static void process_args(int argc, char *argv[])
 static void freeAllocations(void)
 {
   UDS_FREE(vdoPaths);
+  UDS_FREE(pathKeys);
+  pathKeys = NULL;
+  UDS_FREE(pathBuckets);
+  pathBuckets = NULL;
+  closeDMControl(dmControl);
+  dmControl = -1;
+}
+
+/**********************************************************************
+ * Get the VDO stats for a single device.
+ *
+ * @param sample  The sample to fill in, naming the device
+ *
+ **/
+static void get_device_stats(DeviceSample *sample)
+{
+  char *statsBuf;
+  sample->reported = false;
+  sample->result = sendDMMessage(dmControl, sample->name, "stats", &statsBuf);
+  if (sample->result != VDO_SUCCESS) {
+    return;
+  }
+
+  sample->reported = (statsBuf[0] != '\0');
+  if (sample->reported) {
+    read_vdo_stats(statsBuf, &sample->stats);
+  }
+
+  UDS_FREE(statsBuf);
 }
 
 /**********************************************************************
- * Process the VDO stats for a single device.
+ * Get the stats of devices from the shared queue until there are none
+ * left.
  *
- * @param original The orignal name passed into vdostats
- * @param name     The name of the vdo device to use in dmsetup message
+ * @param arg  The SampleQueue
  *
  **/
-static void process_device(const char *original, const char *name)
+static void collect_from_queue(void *arg)
 {
-  struct vdo_statistics stats;
-  
-  char dmCommand[256];
-  sprintf(dmCommand, "dmsetup message %s 0 stats", name);
-  FILE* fp = popen(dmCommand, "r");
-  if (fp == NULL) {
+  SampleQueue *queue = arg;
+  for (;;) {
+    uds_lock_mutex(&queue->lock);
+    int next = queue->next++;
+    uds_unlock_mutex(&queue->lock);
+    if (next >= queue->count) {
+      return;
+    }
+
+    get_device_stats(&queue->samples[next]);
+  }
+}
+
+/**********************************************************************
+ * Get the VDO stats of some devices, asking all of them at once so that
+ * the time taken is that of the slowest device rather than the sum.
+ *
+ * @param samples  The samples to fill in, naming the devices
+ * @param count    The number of devices
+ *
+ **/
+static void collect_device_stats(DeviceSample *samples, int count)
+{
+  if (count <= 1) {
+    for (int i = 0; i < count; i++) {
+      get_device_stats(&samples[i]);
+    }
+    return;
+  }
+
+  SampleQueue queue = {
+    .samples = samples,
+    .count   = count,
+    .next    = 0,
+  };
+  int result = uds_init_mutex(&queue.lock);
+  if (result != VDO_SUCCESS) {
+    freeAllocations();
+    errx(1, "Could not initialize stats collection");
+  }
+
+  struct thread *threads[MAX_STATS_THREADS];
+  int threadCount = min(count, (int) MAX_STATS_THREADS);
+  int started = 0;
+  for (; started < threadCount; started++) {
+    if (uds_create_thread(collect_from_queue, &queue, "vdostats",
+                          &threads[started]) != VDO_SUCCESS) {
+      break;
+    }
+  }
+
+  // Whatever threads could not be started, this one makes up for.
+  collect_from_queue(&queue);
+  for (int i = 0; i < started; i++) {
+    uds_join_threads(threads[i]);
+  }
+  uds_destroy_mutex(&queue.lock);
+}
+
+/**********************************************************************
+ * Exit if the stats of a device could not be retrieved.
+ *
+ * @param sample  The sample of the device
+ *
+ **/
+static void check_sample(const DeviceSample *sample)
+{
+  if (sample->result != VDO_SUCCESS) {
     freeAllocations();
-    errx(1, "'%s': Could not retrieve VDO device stats information", name);
+    errx(1, "'%s': Could not retrieve VDO device stats information",
+         sample->name);
   }
-  
-  char statsBuf[8192];
-  if (fgets(statsBuf, sizeof(statsBuf), fp) != NULL) {
-    read_vdo_stats(statsBuf, &stats);
+}
+
+/**********************************************************************
+ * Display the VDO stats for a single device.
+ *
+ * @param sample  The collected stats of the device
+ *
+ **/
+static void process_device(const DeviceSample *sample)
+{
+  check_sample(sample);
+  const char *original = sample->original;
+  struct vdo_statistics stats = sample->stats;
+  if (sample->reported) {
     switch (style) {
       case STYLE_DF:
         displayDFStyle(original, &stats);
@@ -356,140 +762,643 @@ static void process_device(const char *original, const char *name)
         break;
 
       default:
-        pclose(fp);
         freeAllocations();
         errx(1, "unknown style %d", style);
     }
   }
+}
 
-  int result = pclose(fp);
-  if ((WIFEXITED(result))) {
-    result = WEXITSTATUS(result);
+/**********************************************************************
+ * Display the change in the watched counters of a device between two
+ * samples.
+ *
+ * @param original  The name passed into vdostats
+ * @param before    The earlier sample
+ * @param after     The later sample
+ * @param seconds   The time between the samples
+ *
+ **/
+static void display_watched_counters(const char                  *original,
+                                     const struct vdo_statistics *before,
+                                     const struct vdo_statistics *after,
+                                     double                       seconds)
+{
+  int label_length = strlen("interval seconds");
+  for (unsigned int i = 0; i < COUNT_OF(watched_counters); i++) {
+    label_length = max(label_length, (int) strlen(watched_counters[i].label));
+  }
+
+  printf("%s : \n", original);
+  printf("  %-*s : %.2f\n", label_length, "interval seconds", seconds);
+  for (unsigned int i = 0; i < COUNT_OF(watched_counters); i++) {
+    size_t offset = watched_counters[i].offset;
+    const uint64_t *old = (const uint64_t *) ((const char *) before + offset);
+    const uint64_t *new = (const uint64_t *) ((const char *) after + offset);
+    // Counters go backwards if the device is restarted between samples.
+    uint64_t delta = ((*new >= *old) ? (*new - *old) : *new);
+    printf("  %-*s : %" PRIu64 " (%.1f/s)\n", label_length,
+           watched_counters[i].label, delta, delta / seconds);
   }
-  if (result != 0) {
+}
+
+/**********************************************************************
+ * Add a sample of a device to the windows of its watched queues.
+ *
+ * @param windows  The windows of the device's queues
+ * @param stats    The sample
+ *
+ **/
+static void sample_queues(QueueWindow *windows,
+                          const struct vdo_statistics *stats)
+{
+  for (unsigned int i = 0; i < WATCHED_QUEUE_COUNT; i++) {
+    uint64_t inFlight = watched_queues[i].inFlight(stats);
+    windows[i].sum += inFlight;
+    windows[i].peak = max(windows[i].peak, inFlight);
+    windows[i].samples++;
+  }
+}
+
+/**********************************************************************
+ * Display the mean and peak occupancy of the watched queues of a device
+ * over an interval, with their throughput and, by Little's law, the mean
+ * time a request spent in each.
+ *
+ * @param windows  The windows of the device's queues
+ * @param before   The sample at the start of the interval
+ * @param after    The sample at the end of the interval
+ * @param seconds  The length of the interval
+ *
+ **/
+static void display_queue_windows(const QueueWindow           *windows,
+                                  const struct vdo_statistics *before,
+                                  const struct vdo_statistics *after,
+                                  double                       seconds)
+{
+  int label_length = 0;
+  for (unsigned int i = 0; i < WATCHED_QUEUE_COUNT; i++) {
+    label_length = max(label_length, (int) strlen(watched_queues[i].label));
+  }
+
+  printf("  in flight (mean/peak, completions, latency) : \n");
+  for (unsigned int i = 0; i < WATCHED_QUEUE_COUNT; i++) {
+    if (windows[i].samples == 0) {
+      continue;
+    }
+
+    double mean = (double) windows[i].sum / windows[i].samples;
+    uint64_t old = watched_queues[i].completed(before);
+    uint64_t new = watched_queues[i].completed(after);
+    double rate = ((new >= old) ? (new - old) : new) / seconds;
+    printf("    %-*s : %.1f/%" PRIu64 ", %.1f/s, ", label_length,
+           watched_queues[i].label, mean, windows[i].peak, rate);
+    if (rate > 0) {
+      printf("%.3f ms\n", 1000.0 * mean / rate);
+    } else {
+      printf("N/A\n");
+    }
+  }
+}
+
+/**********************************************************************
+ * Wait until the end of a sampling period. Waiting for a fixed period,
+ * whatever the time taken to sample, keeps samples evenly spaced.
+ *
+ * @param next    The monotonic time at which the period started, updated
+ *                to the time at which it ends
+ * @param period  The length of the period
+ *
+ **/
+static void wait_for_period(ktime_t *next, ktime_t period)
+{
+  *next += period;
+  struct timespec wake = {
+    .tv_sec  = *next / NSEC_PER_SEC,
+    .tv_nsec = *next % NSEC_PER_SEC,
+  };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL)
+         == EINTR) {
+  }
+}
+
+/**********************************************************************
+ * Sample the stats of some devices and append them to the record log,
+ * repeating at the watch interval if there is one.
+ *
+ * @param samples  The devices to sample
+ * @param count    The number of devices
+ *
+ **/
+static void record_devices(DeviceSample *samples, int count)
+{
+  char err_buf[ERRBUF_SIZE];
+  int fd;
+  int result = openStatsLog(record_path, &fd);
+  if (result != VDO_SUCCESS) {
+    freeAllocations();
+    errx(1, "Could not open %s: %s", record_path,
+         string_error(result, err_buf, ERRBUF_SIZE));
+  }
+
+  ktime_t next = current_time_ns(CLOCK_MONOTONIC);
+  for (;;) {
+    collect_device_stats(samples, count);
+    // Records of one snapshot share a timestamp, which is how replay
+    // tells snapshots apart.
+    ktime_t now = current_time_ns(CLOCK_REALTIME);
+    for (int i = 0; i < count; i++) {
+      check_sample(&samples[i]);
+      if (!samples[i].reported) {
+        continue;
+      }
+
+      StatsRecord record = {
+        .timestamp = now,
+        .stats     = samples[i].stats,
+      };
+      strncpy(record.device, samples[i].name, sizeof(record.device) - 1);
+      result = appendStatsRecord(fd, &record);
+      if (result != VDO_SUCCESS) {
+        freeAllocations();
+        errx(1, "Could not write to %s: %s", record_path,
+             string_error(result, err_buf, ERRBUF_SIZE));
+      }
+    }
+
+    if (watch_interval == 0) {
+      break;
+    }
+
+    wait_for_period(&next, seconds_to_ktime(watch_interval));
+  }
+
+  result = close_file(fd, "cannot close statistics log");
+  if (result != UDS_SUCCESS) {
     freeAllocations();
-    errx(1, "'%s': Could not retrieve VDO device stats information", name);
+    errx(1, "Could not write to %s: %s", record_path,
+         string_error(result, err_buf, ERRBUF_SIZE));
   }
 }
 
 /**********************************************************************
- * Transform device into a known vdo path and name, if possible.
+ * Write one statistic to the cache file.
  *
- * @param device The device name to search for.
+ * @param label    The label of the statistic, indented
+ * @param value    The value of the statistic
+ * @param context  The cache file
  *
- * @return struct containing name and path if found, otherwise NULL.
+ **/
+static void cache_statistic(const char *label,
+                            const char *value,
+                            void       *context)
+{
+  fprintf(context, "%s : %s\n", label, value);
+}
+
+/**********************************************************************
+ * Write the stats of some devices to the cache file in the --verbose
+ * format, repeating at the watch interval if there is one. Each version of
+ * the file is written beside it and renamed into place, so that readers
+ * never see a partial one.
+ *
+ * @param samples  The devices to sample
+ * @param count    The number of devices
  *
  **/
-static VDOPath *transformDevice(char *device)
+static void cache_devices(DeviceSample *samples, int count)
 {
+  char *temporary;
+  if (asprintf(&temporary, "%s.tmp", cache_path) == -1) {
+    freeAllocations();
+    errx(1, "Could not allocate the name of the cache file");
+  }
 
-  for (int i = 0; i < pathCount; i++) {
-    if (strcmp(device, vdoPaths[i].name) == 0) {
-      return &vdoPaths[i];
+  ktime_t next = current_time_ns(CLOCK_MONOTONIC);
+  for (;;) {
+    collect_device_stats(samples, count);
+    FILE *file = fopen(temporary, "w");
+    if (file == NULL) {
+      freeAllocations();
+      err(1, "Could not open %s", temporary);
     }
-    if (strcmp(device, vdoPaths[i].resolvedName) == 0) {
-      return &vdoPaths[i];
+
+    for (int i = 0; i < count; i++) {
+      check_sample(&samples[i]);
+      if (samples[i].reported) {
+        fprintf(file, "%s : \n", samples[i].name);
+        visit_vdo_stats(&samples[i].stats, cache_statistic, file);
+      }
     }
 
-    char buf[PATH_MAX];
-    char *path = realpath(device, buf);
-    if (path == NULL) {
-      continue;
+    if ((fclose(file) != 0) || (rename(temporary, cache_path) != 0)) {
+      freeAllocations();
+      err(1, "Could not write %s", cache_path);
     }
-    if (strcmp(buf, vdoPaths[i].resolvedPath) == 0) {
-      return &vdoPaths[i];
+
+    if (watch_interval == 0) {
+      break;
     }
+
+    wait_for_period(&next, seconds_to_ktime(watch_interval));
   }
 
-  return NULL;
+  free(temporary);
 }
 
 /**********************************************************************
- * Process the VDO stats for all VDO devices.
+ * Format the time of a snapshot.
+ *
+ * @param timestamp  The time of the snapshot
+ * @param buffer     The buffer to hold the formatted time
+ * @param size       The size of the buffer
  *
  **/
-static void enumerate_devices(void)
+static void format_timestamp(ktime_t timestamp, char *buffer, size_t size)
 {
-  FILE *fp;
-  size_t line_size = 0;
-  char *dmsetup_line = NULL;
+  time_t seconds = timestamp / NSEC_PER_SEC;
+  struct tm local;
+  if ((localtime_r(&seconds, &local) == NULL)
+      || (strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &local) == 0)) {
+    snprintf(buffer, size, "%lld", (long long) seconds);
+  }
+}
 
-  fp = popen("dmsetup ls --target vdo", "r");
-  if (fp == NULL) {
-    errx(1, "Could not retrieve VDO device status information");
+/**********************************************************************
+ * Check whether a device from a log was selected on the command line.
+ *
+ * @param name     The device-mapper name of the device
+ * @param devices  The devices named on the command line
+ * @param count    The number of devices named
+ *
+ * @return true if the device should be displayed
+ **/
+static bool is_selected(const char *name, char **devices, int count)
+{
+  if (count == 0) {
+    return true;
   }
 
-  pathCount = 0;
-  while ((getline(&dmsetup_line, &line_size, fp)) > 0) {
-    pathCount++;
+  for (int i = 0; i < count; i++) {
+    char *device = strdup(devices[i]);
+    bool match = ((strcmp(name, devices[i]) == 0)
+                  || ((device != NULL)
+                      && (strcmp(name, basename(device)) == 0)));
+    free(device);
+    if (match) {
+      return true;
+    }
   }
 
-  int result = pclose(fp);
-  if ((WIFEXITED(result))) {
-    result = WEXITSTATUS(result);
+  return false;
+}
+
+/**********************************************************************
+ * Find the snapshots of a log. The records of a snapshot are adjacent and
+ * share a timestamp.
+ *
+ * @param records  The records of the log
+ * @param count    The number of records
+ * @param starts   An array to hold the index of the first record of each
+ *                 snapshot, and the record count after the last snapshot
+ *
+ * @return The number of snapshots
+ **/
+static size_t find_snapshots(const StatsRecord *records,
+                             size_t             count,
+                             size_t            *starts)
+{
+  size_t snapshots = 0;
+  for (size_t i = 0; i < count; i++) {
+    if ((i == 0) || (records[i].timestamp != records[i - 1].timestamp)) {
+      starts[snapshots++] = i;
+    }
   }
-  if (result != 0) {
-    errx(1, "Could not retrieve VDO device status information");
+
+  starts[snapshots] = count;
+  return snapshots;
+}
+
+/**********************************************************************
+ * Resolve a snapshot number given to --diff.
+ *
+ * @param number     The number given, negative to count from the end
+ * @param snapshots  The number of snapshots in the log
+ *
+ * @return The index of the snapshot
+ **/
+static size_t resolve_snapshot(long number, size_t snapshots)
+{
+  long index = ((number < 0) ? (long) snapshots + number : number);
+  if ((index < 0) || ((size_t) index >= snapshots)) {
+    freeAllocations();
+    errx(1, "%s has no snapshot %ld", replay_path, number);
   }
 
-  if (pathCount == 0) {
-    errx(1, "Could not find any VDO devices");
+  return index;
+}
+
+/**********************************************************************
+ * Display the snapshots of a statistics log, or the change between two of
+ * them.
+ *
+ * @param devices  The devices named on the command line
+ * @param count    The number of devices named
+ *
+ **/
+static void replay_log(char **devices, int count)
+{
+  char err_buf[ERRBUF_SIZE];
+  StatsRecord *records;
+  size_t recordCount;
+  int result = readStatsLog(replay_path, &records, &recordCount);
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not read %s: %s", replay_path,
+         string_error(result, err_buf, ERRBUF_SIZE));
   }
-  
-  result = UDS_ALLOCATE(pathCount, struct vdoPath, __func__, &vdoPaths);
+
+  size_t *starts;
+  result = UDS_ALLOCATE(recordCount + 1, size_t, __func__, &starts);
   if (result != VDO_SUCCESS) {
-    errx(1, "Could not allocate vdo path structure");
+    UDS_FREE(records);
+    errx(1, "Could not allocate statistics snapshots");
+  }
+
+  size_t snapshots = find_snapshots(records, recordCount, starts);
+  for (size_t i = 0; i < recordCount; i++) {
+    if (is_selected(records[i].device, devices, count)) {
+      calculateMaxDeviceName(records[i].device);
+    }
   }
 
-  fp = popen("dmsetup ls --target vdo", "r");
-  if (fp == NULL) {
+  char first_time[64];
+  char last_time[64];
+  if (diff) {
+    size_t first = resolve_snapshot(diff_first, snapshots);
+    size_t last = resolve_snapshot(diff_last, snapshots);
+    ktime_t elapsed = ktime_sub(records[starts[last]].timestamp,
+                                records[starts[first]].timestamp);
+    double seconds = (double) elapsed / NSEC_PER_SEC;
+    format_timestamp(records[starts[first]].timestamp, first_time,
+                     sizeof(first_time));
+    format_timestamp(records[starts[last]].timestamp, last_time,
+                     sizeof(last_time));
+    printf("snapshot %zu (%s) to snapshot %zu (%s)\n",
+           first, first_time, last, last_time);
+    for (size_t i = starts[first]; i < starts[first + 1]; i++) {
+      if (!is_selected(records[i].device, devices, count)) {
+        continue;
+      }
+
+      for (size_t j = starts[last]; j < starts[last + 1]; j++) {
+        if (strcmp(records[i].device, records[j].device) == 0) {
+          display_watched_counters(records[i].device, &records[i].stats,
+                                   &records[j].stats, seconds);
+          break;
+        }
+      }
+    }
+  } else {
+    for (size_t s = 0; s < snapshots; s++) {
+      format_timestamp(records[starts[s]].timestamp, first_time,
+                       sizeof(first_time));
+      printf("%ssnapshot %zu (%s)\n", ((s == 0) ? "" : "\n"), s,
+             first_time);
+      header_printed = false;
+      for (size_t i = starts[s]; i < starts[s + 1]; i++) {
+        if (!is_selected(records[i].device, devices, count)) {
+          continue;
+        }
+
+        DeviceSample sample = {
+          .original = records[i].device,
+          .name     = records[i].device,
+          .stats    = records[i].stats,
+          .result   = VDO_SUCCESS,
+          .reported = true,
+        };
+        process_device(&sample);
+      }
+    }
+  }
+
+  UDS_FREE(starts);
+  UDS_FREE(records);
+}
+
+/**********************************************************************
+ * Sample the stats of some devices at a fixed interval until interrupted,
+ * displaying the change over each interval.
+ *
+ * @param devices  The devices to sample, named by their first samples
+ * @param count    The number of devices
+ *
+ **/
+static void watch_devices(DeviceSample *devices, int count)
+{
+  DeviceSample *later;
+  int result = UDS_ALLOCATE(count, DeviceSample, __func__, &later);
+  if (result != VDO_SUCCESS) {
     freeAllocations();
-    errx(1, "Could not retrieve VDO device status information");
+    errx(1, "Could not allocate statistics samples");
   }
 
-  line_size = 0;
-  dmsetup_line = NULL;
+  QueueWindow *windows;
+  result = UDS_ALLOCATE(count * WATCHED_QUEUE_COUNT, QueueWindow, __func__,
+                        &windows);
+  if (result != VDO_SUCCESS) {
+    freeAllocations();
+    errx(1, "Could not allocate statistics samples");
+  }
 
-  int major, minor;
+  for (int i = 0; i < count; i++) {
+    later[i].original = devices[i].original;
+    later[i].name = devices[i].name;
+  }
 
-  int count = 0;
-  while ((getline(&dmsetup_line, &line_size, fp)) > 0) {
-    int items = sscanf(dmsetup_line, "%s (%d, %d)",
-                       vdoPaths[count].name, &major, &minor);
-    if (items != 3) {
-      pclose(fp);
-      freeAllocations();
-      errx(1, "Could not parse device mapper information");
+  DeviceSample *previous = devices;
+  DeviceSample *current  = later;
+  collect_device_stats(previous, count);
+  for (int i = 0; i < count; i++) {
+    check_sample(&previous[i]);
+  }
+
+  ktime_t last = current_time_ns(CLOCK_MONOTONIC);
+  ktime_t next = last;
+  ktime_t period = seconds_to_ktime(watch_interval) / QUEUE_SAMPLES;
+  for (;;) {
+    // The counters only need the last sample, but the queues need many.
+    memset(windows, 0, count * WATCHED_QUEUE_COUNT * sizeof(QueueWindow));
+    for (unsigned int s = 0; s < QUEUE_SAMPLES; s++) {
+      wait_for_period(&next, period);
+      collect_device_stats(current, count);
+      for (int i = 0; i < count; i++) {
+        check_sample(&current[i]);
+        if (current[i].reported) {
+          sample_queues(&windows[i * WATCHED_QUEUE_COUNT], &current[i].stats);
+        }
+      }
+    }
+
+    ktime_t now = current_time_ns(CLOCK_MONOTONIC);
+    ktime_t elapsed = ktime_sub(now, last);
+    double seconds = (double) elapsed / NSEC_PER_SEC;
+    last = now;
+    for (int i = 0; i < count; i++) {
+      if (previous[i].reported && current[i].reported) {
+        display_watched_counters(current[i].original, &previous[i].stats,
+                                 &current[i].stats, seconds);
+        display_queue_windows(&windows[i * WATCHED_QUEUE_COUNT],
+                              &previous[i].stats, &current[i].stats,
+                              seconds);
+      }
     }
 
-    sprintf(vdoPaths[count].resolvedName, "dm-%d", minor);
-    sprintf(vdoPaths[count].resolvedPath, "/dev/%s",
-            vdoPaths[count].resolvedName);
-    count++;
+    printf("\n");
+    fflush(stdout);
+
+    DeviceSample *swap = previous;
+    previous = current;
+    current = swap;
   }
+}
 
-  result = pclose(fp);
-  if ((WIFEXITED(result))) {
-    result = WEXITSTATUS(result);
+/**********************************************************************
+ * Get the hash bucket for a device name.
+ *
+ * @param key  The name
+ *
+ * @return The bucket which would hold the name
+ **/
+static struct hlist_head *getPathBucket(const char *key)
+{
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char *c = key; *c != '\0'; c++) {
+    hash = (hash ^ (unsigned char) *c) * 0x100000001b3ULL;
   }
-  if (result != 0) {
-    freeAllocations();
-    errx(1, "Could not retrieve VDO device status information");
+
+  return &pathBuckets[hash & bucketMask];
+}
+
+/**********************************************************************
+ * Look up a device name in the table of known VDO names.
+ *
+ * @param key  The name to look up
+ *
+ * @return The device with that name, or NULL if there is none
+ **/
+static VDOPath *findPath(const char *key)
+{
+  PathKey *entry;
+  hlist_for_each_entry(entry, getPathBucket(key), hashNode) {
+    if (strcmp(entry->key, key) == 0) {
+      return entry->path;
+    }
   }
+
+  return NULL;
 }
 
 /**********************************************************************
- * Calculate max device name length to display
+ * Transform device into a known vdo path and name, if possible.
  *
- * @param name The name to get the length for
+ * @param device The device name to search for.
  *
- */
-static void calculateMaxDeviceName(char *name)
+ * @return struct containing name and path if found, otherwise NULL.
+ *
+ **/
+static VDOPath *transformDevice(char *device)
 {
-  int name_length = strlen(name);
-  maxDeviceNameLength = ((name_length > maxDeviceNameLength)
-                         ? name_length
-                         : maxDeviceNameLength);
+  VDOPath *path = findPath(device);
+  if (path != NULL) {
+    return path;
+  }
+
+  char buf[PATH_MAX];
+  if (realpath(device, buf) == NULL) {
+    return NULL;
+  }
+
+  return findPath(buf);
+}
+
+/**********************************************************************
+ * Build the table of the names by which each VDO device may be given.
+ *
+ **/
+static void index_devices(void)
+{
+  int result = UDS_ALLOCATE(3 * pathCount, PathKey, __func__, &pathKeys);
+  if (result != VDO_SUCCESS) {
+    freeAllocations();
+    errx(1, "Could not allocate vdo path table");
+  }
+
+  bucketMask = (1ULL << (log_base_two(3 * pathCount) + 1)) - 1;
+  result = UDS_ALLOCATE(bucketMask + 1, struct hlist_head, __func__,
+                        &pathBuckets);
+  if (result != VDO_SUCCESS) {
+    freeAllocations();
+    errx(1, "Could not allocate vdo path table");
+  }
+
+  for (int i = 0; i < pathCount; i++) {
+    const char *keys[] = {
+      vdoPaths[i].name,
+      vdoPaths[i].resolvedName,
+      vdoPaths[i].resolvedPath,
+    };
+    for (int k = 0; k < 3; k++) {
+      // As a name given for a device is tried against each device in turn,
+      // the first device with a name keeps it.
+      if (findPath(keys[k]) != NULL) {
+        continue;
+      }
+
+      PathKey *entry = &pathKeys[(3 * i) + k];
+      entry->key  = keys[k];
+      entry->path = &vdoPaths[i];
+      hlist_add_head(&entry->hashNode, getPathBucket(keys[k]));
+    }
+  }
+}
+
+/**********************************************************************
+ * Process the VDO stats for all VDO devices.
+ *
+ **/
+static void enumerate_devices(void)
+{
+  DMDevice *devices;
+  size_t count;
+  int result = listDMDevices(dmControl, "vdo", &devices, &count);
+  if (result != VDO_SUCCESS) {
+    freeAllocations();
+    errx(1, "Could not retrieve VDO device status information");
+  }
+
+  if (count == 0) {
+    UDS_FREE(devices);
+    freeAllocations();
+    errx(1, "Could not find any VDO devices");
+  }
+
+  pathCount = count;
+  result = UDS_ALLOCATE(pathCount, struct vdoPath, __func__, &vdoPaths);
+  if (result != VDO_SUCCESS) {
+    UDS_FREE(devices);
+    freeAllocations();
+    errx(1, "Could not allocate vdo path structure");
+  }
+
+  for (int i = 0; i < pathCount; i++) {
+    strcpy(vdoPaths[i].name, devices[i].name);
+    sprintf(vdoPaths[i].resolvedName, "dm-%u", minor(devices[i].device));
+    sprintf(vdoPaths[i].resolvedPath, "/dev/%s", vdoPaths[i].resolvedName);
+  }
+
+  UDS_FREE(devices);
+  index_devices();
 }
 
 /**********************************************************************/
@@ -510,6 +1419,24 @@ int main(int argc, char *argv[])
     style = STYLE_YAML;
   }
 
+  if (replay_path != NULL) {
+    replay_log(&argv[optind], argc - optind);
+    exit(0);
+  }
+
+  result = openDMControl(&dmControl);
+  if (result != VDO_SUCCESS) {
+    errx(1, "Could not open device-mapper control: %s",
+         string_error(result, err_buf, ERRBUF_SIZE));
+  }
+
+  if (serve_address != NULL) {
+    result = serveVDOMetrics(serve_address, dmControl);
+    freeAllocations();
+    errx(1, "Could not serve VDO statistics on %s: %s", serve_address,
+         string_error(result, err_buf, ERRBUF_SIZE));
+  }
+
   // Build a list of known vdo devices that we can validate against.
   enumerate_devices();
   if (vdoPaths == NULL) {
@@ -517,33 +1444,73 @@ int main(int argc, char *argv[])
   }
 
   int num_devices = argc - optind;
+  int count = ((num_devices == 0) ? pathCount : num_devices);
+  DeviceSample *samples;
+  result = UDS_ALLOCATE(count, DeviceSample, __func__, &samples);
+  if (result != VDO_SUCCESS) {
+    freeAllocations();
+    errx(1, "Could not allocate statistics samples");
+  }
 
-  if (num_devices == 0) {
-    // Set maxDeviceNameLength
-    for (int i = 0; i < pathCount; i++) {
-      calculateMaxDeviceName(vdoPaths[i].name);
+  // Name the devices, stopping at the first which isn't a VDO device.
+  int valid = 0;
+  for (; valid < count; valid++) {
+    if (num_devices == 0) {
+      samples[valid].original = vdoPaths[valid].name;
+      samples[valid].name = vdoPaths[valid].name;
+      continue;
     }
 
-    // Process all VDO devices
-    for (int i = 0; i < pathCount; i++) {
-      process_device(vdoPaths[i].name, vdoPaths[i].name);
-    }
-  } else {
-    // Set maxDeviceNameLength
-    for (int i = optind; i < argc; i++) {
-      calculateMaxDeviceName(basename(argv[i]));
+    VDOPath *path = transformDevice(argv[optind + valid]);
+    if (path == NULL) {
+      break;
     }
+    samples[valid].original = argv[optind + valid];
+    samples[valid].name = path->name;
+  }
 
-    // Process the input devices
-    for (int i = optind; i < argc; i++) {
-      VDOPath *path = transformDevice(argv[i]);
-      if (path != NULL) {
-        process_device(argv[i], path->name);
-      } else {
-        freeAllocations();
-        errx(1, "'%s': Not a valid running VDO device", argv[i]);
-      }
-    }
+  if (((watch_interval > 0) || (record_path != NULL) || (cache_path != NULL))
+      && (valid < count)) {
+    freeAllocations();
+    errx(1, "'%s': Not a valid running VDO device", argv[optind + valid]);
+  }
+
+  if (record_path != NULL) {
+    record_devices(samples, count);
+    UDS_FREE(samples);
+    freeAllocations();
+    exit(0);
   }
+
+  if (cache_path != NULL) {
+    cache_devices(samples, count);
+    UDS_FREE(samples);
+    freeAllocations();
+    exit(0);
+  }
+
+  if (watch_interval > 0) {
+    watch_devices(samples, count);
+  }
+
+  // Set maxDeviceNameLength
+  for (int i = 0; i < count; i++) {
+    calculateMaxDeviceName((num_devices == 0)
+                           ? vdoPaths[i].name : basename(argv[optind + i]));
+  }
+
+  // Ask every device at once, then display them in order.
+  collect_device_stats(samples, valid);
+  for (int i = 0; i < valid; i++) {
+    process_device(&samples[i]);
+  }
+
+  if (valid < count) {
+    UDS_FREE(samples);
+    freeAllocations();
+    errx(1, "'%s': Not a valid running VDO device", argv[optind + valid]);
+  }
+
+  UDS_FREE(samples);
   freeAllocations();
 }
@@ -0,0 +1,457 @@
+/*
+ * Copyright Red Hat
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * $Id: //eng/vdo-releases/sulfur/src/c++/vdo/user/vdoToolBench.c#1 $
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "numeric.h"
+#include "timeUtils.h"
+
+enum {
+  MAX_SIZES     = 16,
+  MAX_ARGS      = 8,
+  MAX_RESULTS   = 256,
+  NAME_LENGTH   = 64,
+  // Times shorter than this are too noisy to compare against a baseline.
+  MIN_COMPARED_MICROSECONDS = 100000,
+};
+
+/** A tool run to be measured on each image */
+typedef struct {
+  /** The name the run is recorded under */
+  const char *name;
+  /** The arguments, with IMAGE and DUMP standing for the file names */
+  char       *args[MAX_ARGS];
+} ToolRun;
+
+static char IMAGE[] = "<image>";
+static char DUMP[]  = "<dump>";
+
+static const ToolRun toolRuns[] = {
+  { "vdoaudit",         { "./vdoaudit", IMAGE, NULL } },
+  { "vdodumpblockmap",  { "./vdodumpblockmap", IMAGE, NULL } },
+  { "vdodumpmetadata",  { "./vdodumpmetadata", IMAGE, DUMP, NULL } },
+  { "vdodumpmetadata-no-block-map",
+    { "./vdodumpmetadata", "--no-block-map", IMAGE, DUMP, NULL } },
+  // This reads the dump of the run before, which has no block map.
+  { "vdodebugmetadata", { "./vdodebugmetadata", "--pbn=1", DUMP, NULL } },
+};
+
+/** The measurements of one tool run */
+typedef struct {
+  char     image[NAME_LENGTH];
+  char     tool[NAME_LENGTH];
+  uint64_t wallMicroseconds;
+  uint64_t userMicroseconds;
+  uint64_t systemMicroseconds;
+  uint64_t maxRSSKilobytes;
+  uint64_t readBlocks;
+  uint64_t writeBlocks;
+} ToolResult;
+
+static const char usageString[]
+  = " [--help] [--sizes=<logical>:<physical>[,...]] [--fill=<percent>]"
+    " [--directory=<dir>] [--results=<file>] [--baseline=<file>]"
+    " [--tolerance=<percent>] [--keep]";
+
+static const char helpString[] =
+  "vdotoolbench - measure the VDO metadata tools on synthetic images\n"
+  "\n"
+  "SYNOPSIS\n"
+  "  vdotoolbench [--sizes=<logical>:<physical>[,...]] [--fill=<percent>]\n"
+  "               [--directory=<dir>] [--results=<file>]\n"
+  "               [--baseline=<file>] [--tolerance=<percent>] [--keep]\n"
+  "\n"
+  "DESCRIPTION\n"
+  "  vdotoolbench generates an image of each size with vdomakeimage and\n"
+  "  runs vdoaudit, vdodumpblockmap, vdodumpmetadata (with and without\n"
+  "  --no-block-map) and vdodebugmetadata against it, measuring the wall\n"
+  "  time, CPU time, peak resident set size, and blocks read and written\n"
+  "  by each. It must be run from the directory holding the tools.\n"
+  "\n"
+  "  The results are written as a tab separated table with a header\n"
+  "  line, as the baseline must be. If a baseline is given, any tool\n"
+  "  taking more time or memory than its baseline by more than the\n"
+  "  tolerance is reported, and vdotoolbench exits with status 2.\n"
+  "\n"
+  "OPTIONS\n"
+  "    --baseline=<file>\n"
+  "       Compare the results against those in <file>.\n"
+  "\n"
+  "    --directory=<dir>\n"
+  "       Make the images and dumps in <dir>. The default is $TMPDIR, or\n"
+  "       /var/tmp.\n"
+  "\n"
+  "    --fill=<percent>\n"
+  "       Map <percent> of the logical blocks of each image. The default\n"
+  "       is 5.\n"
+  "\n"
+  "    --help\n"
+  "       Print this help message and exit.\n"
+  "\n"
+  "    --keep\n"
+  "       Keep the images and dumps rather than removing them.\n"
+  "\n"
+  "    --results=<file>\n"
+  "       Write the results to <file> rather than standard output.\n"
+  "\n"
+  "    --sizes=<logical>:<physical>[,...]\n"
+  "       Make an image of each logical and physical size, as for\n"
+  "       vdomakeimage. The default is 100G:20G,1T:100G,10T:1T.\n"
+  "\n"
+  "    --tolerance=<percent>\n"
+  "       Report times and sizes more than <percent> over the baseline.\n"
+  "       The default is 20.\n"
+  "\n";
+
+static struct option options[] = {
+  { "baseline",  required_argument, NULL, 'b' },
+  { "directory", required_argument, NULL, 'd' },
+  { "fill",      required_argument, NULL, 'f' },
+  { "help",      no_argument,       NULL, 'h' },
+  { "keep",      no_argument,       NULL, 'k' },
+  { "results",   required_argument, NULL, 'r' },
+  { "sizes",     required_argument, NULL, 's' },
+  { "tolerance", required_argument, NULL, 't' },
+  { NULL,        0,                 NULL,  0  },
+};
+static char optionString[] = "b:d:f:hkr:s:t:";
+
+static const char  *baselineFile = NULL;
+static const char  *directory    = NULL;
+static const char  *fill         = "5";
+static bool         keep         = false;
+static const char  *resultsFile  = NULL;
+static char        *sizes[MAX_SIZES];
+static unsigned int sizeCount    = 0;
+static unsigned int tolerance    = 20;
+
+static ToolResult   results[MAX_RESULTS];
+static unsigned int resultCount = 0;
+
+/**********************************************************************/
+static void usage(const char *progname, const char *usageOptionsString)
+{
+  errx(1, "Usage: %s%s\n", progname, usageOptionsString);
+}
+
+/**********************************************************************/
+static void processArgs(int argc, char *argv[])
+{
+  char *sizeList = NULL;
+  int c;
+  while ((c = getopt_long(argc, argv, optionString, options, NULL)) != -1) {
+    switch (c) {
+    case 'b':
+      baselineFile = optarg;
+      break;
+
+    case 'd':
+      directory = optarg;
+      break;
+
+    case 'f':
+      fill = optarg;
+      break;
+
+    case 'h':
+      printf("%s", helpString);
+      exit(0);
+      break;
+
+    case 'k':
+      keep = true;
+      break;
+
+    case 'r':
+      resultsFile = optarg;
+      break;
+
+    case 's':
+      sizeList = optarg;
+      break;
+
+    case 't':
+      tolerance = atoi(optarg);
+      break;
+
+    default:
+      usage(argv[0], usageString);
+      break;
+    };
+  }
+
+  if (optind != argc) {
+    usage(argv[0], usageString);
+  }
+
+  if (directory == NULL) {
+    directory = getenv("TMPDIR");
+    if (directory == NULL) {
+      directory = "/var/tmp";
+    }
+  }
+
+  if (sizeList == NULL) {
+    sizeList = strdup("100G:20G,1T:100G,10T:1T");
+  }
+
+  char *saveptr = NULL;
+  for (char *size = strtok_r(sizeList, ",", &saveptr); size != NULL;
+       size = strtok_r(NULL, ",", &saveptr)) {
+    if ((sizeCount == MAX_SIZES) || (strchr(size, ':') == NULL)) {
+      usage(argv[0], usageString);
+    }
+    sizes[sizeCount++] = size;
+  }
+}
+
+/**********************************************************************/
+static uint64_t timevalMicroseconds(struct timeval time)
+{
+  return ((uint64_t) time.tv_sec * 1000000) + time.tv_usec;
+}
+
+/**
+ * Run a command with its output discarded, and wait for it to finish.
+ *
+ * @param [in]  argv   The command and its arguments
+ * @param [out] usage  The resources used by the command
+ *
+ * @return The wall time taken, in microseconds
+ **/
+static uint64_t runCommand(char *const argv[], struct rusage *usage)
+{
+  ktime_t start = current_time_ns(CLOCK_MONOTONIC);
+  pid_t pid = fork();
+  if (pid < 0) {
+    err(1, "Could not fork");
+  }
+
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+    }
+    execv(argv[0], argv);
+    _exit(127);
+  }
+
+  int status;
+  if (wait4(pid, &status, 0, usage) != pid) {
+    err(1, "Could not wait for %s", argv[0]);
+  }
+
+  uint64_t elapsed = (current_time_ns(CLOCK_MONOTONIC) - start) / 1000;
+  if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+    errx(1, "%s failed with status %d", argv[0], status);
+  }
+
+  return elapsed;
+}
+
+/**
+ * Make the image of a given size.
+ **/
+static void makeImage(const char *size, char *image)
+{
+  char *logical = strdup(size);
+  char *physical = strchr(logical, ':');
+  *physical++ = '\0';
+
+  char logicalArg[NAME_LENGTH + 32];
+  char physicalArg[NAME_LENGTH + 32];
+  char fillArg[NAME_LENGTH + 32];
+  snprintf(logicalArg, sizeof(logicalArg), "--logical-size=%s", logical);
+  snprintf(physicalArg, sizeof(physicalArg), "--physical-size=%s", physical);
+  snprintf(fillArg, sizeof(fillArg), "--fill=%s", fill);
+  char *argv[] = {
+    "./vdomakeimage", logicalArg, physicalArg, fillArg, "--dedupe-ratio=2",
+    "--compression-ratio=1.5", "--seed=1", "--force", image, NULL,
+  };
+
+  struct rusage usage;
+  fprintf(stderr, "making %s\n", image);
+  runCommand(argv, &usage);
+  free(logical);
+}
+
+/**
+ * Run each tool against an image and record what it takes.
+ **/
+static void measureTools(const char *size, char *image, char *dump)
+{
+  for (unsigned int i = 0; i < COUNT_OF(toolRuns); i++) {
+    const ToolRun *run = &toolRuns[i];
+    char *argv[MAX_ARGS];
+    for (unsigned int a = 0; a < MAX_ARGS; a++) {
+      char *arg = run->args[a];
+      argv[a] = ((arg == IMAGE) ? image : (arg == DUMP) ? dump : arg);
+    }
+
+    if (resultCount == MAX_RESULTS) {
+      errx(1, "too many results");
+    }
+
+    ToolResult *result = &results[resultCount++];
+    struct rusage usage;
+    fprintf(stderr, "running %s on %s\n", run->name, size);
+    result->wallMicroseconds   = runCommand(argv, &usage);
+    result->userMicroseconds   = timevalMicroseconds(usage.ru_utime);
+    result->systemMicroseconds = timevalMicroseconds(usage.ru_stime);
+    result->maxRSSKilobytes    = usage.ru_maxrss;
+    result->readBlocks         = usage.ru_inblock;
+    result->writeBlocks        = usage.ru_oublock;
+    snprintf(result->image, sizeof(result->image), "%s", size);
+    snprintf(result->tool, sizeof(result->tool), "%s", run->name);
+  }
+}
+
+/**
+ * Write the results as a table.
+ **/
+static void writeResults(FILE *file)
+{
+  fprintf(file, "image\ttool\twall_us\tuser_us\tsystem_us\tmax_rss_kb"
+          "\tread_blocks\twrite_blocks\n");
+  for (unsigned int i = 0; i < resultCount; i++) {
+    const ToolResult *result = &results[i];
+    fprintf(file, "%s\t%s\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+            result->image, result->tool,
+            (unsigned long long) result->wallMicroseconds,
+            (unsigned long long) result->userMicroseconds,
+            (unsigned long long) result->systemMicroseconds,
+            (unsigned long long) result->maxRSSKilobytes,
+            (unsigned long long) result->readBlocks,
+            (unsigned long long) result->writeBlocks);
+  }
+}
+
+/**
+ * Check whether a measurement has regressed from its baseline.
+ **/
+static bool checkRegression(const ToolResult *result,
+                            const char       *what,
+                            uint64_t          measured,
+                            uint64_t          baseline,
+                            uint64_t          floor)
+{
+  if ((max(measured, baseline) < floor)
+      || (measured * 100 <= baseline * (100 + tolerance))) {
+    return false;
+  }
+
+  fprintf(stderr, "regression: %s on %s: %s %llu, baseline %llu\n",
+          result->tool, result->image, what, (unsigned long long) measured,
+          (unsigned long long) baseline);
+  return true;
+}
+
+/**
+ * Compare the results against a baseline table.
+ *
+ * @return The number of regressions found
+ **/
+static unsigned int compareBaseline(void)
+{
+  FILE *file = fopen(baselineFile, "r");
+  if (file == NULL) {
+    err(1, "Could not open baseline %s", baselineFile);
+  }
+
+  unsigned int regressions = 0;
+  char line[512];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    ToolResult baseline;
+    unsigned long long wall, user, sys, rss, reads, writes;
+    if (sscanf(line, "%63s %63s %llu %llu %llu %llu %llu %llu",
+               baseline.image, baseline.tool, &wall, &user, &sys, &rss,
+               &reads, &writes) != 8) {
+      continue;
+    }
+
+    for (unsigned int i = 0; i < resultCount; i++) {
+      const ToolResult *result = &results[i];
+      if ((strcmp(result->image, baseline.image) != 0)
+          || (strcmp(result->tool, baseline.tool) != 0)) {
+        continue;
+      }
+
+      regressions += checkRegression(result, "wall_us",
+                                     result->wallMicroseconds, wall,
+                                     MIN_COMPARED_MICROSECONDS);
+      regressions += checkRegression(result, "cpu_us",
+                                     (result->userMicroseconds
+                                      + result->systemMicroseconds),
+                                     user + sys, MIN_COMPARED_MICROSECONDS);
+      regressions += checkRegression(result, "max_rss_kb",
+                                     result->maxRSSKilobytes, rss, 0);
+    }
+  }
+
+  fclose(file);
+  return regressions;
+}
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+  processArgs(argc, argv);
+  for (unsigned int i = 0; i < sizeCount; i++) {
+    char image[1024];
+    char dump[1024];
+    snprintf(image, sizeof(image), "%s/vdotoolbench-%u.img", directory, i);
+    snprintf(dump, sizeof(dump), "%s/vdotoolbench-%u.dump", directory, i);
+    makeImage(sizes[i], image);
+    measureTools(sizes[i], image, dump);
+    if (!keep) {
+      unlink(image);
+      unlink(dump);
+    }
+  }
+
+  FILE *file = stdout;
+  if (resultsFile != NULL) {
+    file = fopen(resultsFile, "w");
+    if (file == NULL) {
+      err(1, "Could not create %s", resultsFile);
+    }
+  }
+  writeResults(file);
+  if (file != stdout) {
+    fclose(file);
+  }
+
+  if ((baselineFile != NULL) && (compareBaseline() > 0)) {
+    exit(2);
+  }
+
+  exit(0);
+}